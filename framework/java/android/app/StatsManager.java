@@ -54,6 +54,7 @@ import java.io.IOException;
 import java.nio.BufferOverflowException;
 import java.nio.ByteBuffer;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.List;
 import java.util.concurrent.Executor;
 
@@ -681,6 +682,10 @@ public final class StatsManager {
     }
 
     private static class PullAtomCallbackInternal extends IPullAtomCallback.Stub {
+        // Pulls bigger than this are sent to statsd in chunks of about this size, which keeps
+        // every oneway transaction well under the binder limit.
+        private static final int MAX_PULL_CHUNK_BYTES = 128 * 1024;
+
         public final int mAtomId;
         public final StatsPullAtomCallback mCallback;
         public final Executor mExecutor;
@@ -699,13 +704,26 @@ public final class StatsManager {
                     List<StatsEvent> data = new ArrayList<>();
                     int successInt = mCallback.onPullAtom(atomTag, data);
                     boolean success = successInt == PULL_SUCCESS;
-                    StatsEventParcel[] parcels = new StatsEventParcel[data.size()];
-                    for (int i = 0; i < data.size(); i++) {
-                        parcels[i] = new StatsEventParcel();
-                        parcels[i].buffer = data.get(i).getBytes();
-                    }
+                    List<StatsEventParcel> parcels = new ArrayList<>();
+                    int chunkBytes = 0;
                     try {
-                        resultReceiver.pullFinished(atomTag, success, parcels);
+                        for (int i = 0; i < data.size(); i++) {
+                            byte[] buffer = data.get(i).getBytes();
+                            // Only the last chunk goes with pullFinished.
+                            if (success && chunkBytes > 0
+                                    && chunkBytes + buffer.length > MAX_PULL_CHUNK_BYTES) {
+                                resultReceiver.pullPartial(atomTag,
+                                        parcels.toArray(new StatsEventParcel[0]));
+                                parcels.clear();
+                                chunkBytes = 0;
+                            }
+                            StatsEventParcel parcel = new StatsEventParcel();
+                            parcel.buffer = buffer;
+                            parcels.add(parcel);
+                            chunkBytes += buffer.length;
+                        }
+                        resultReceiver.pullFinished(atomTag, success,
+                                parcels.toArray(new StatsEventParcel[0]));
                     } catch (RemoteException e) {
                         Log.w(TAG, "StatsPullResultReceiver failed for tag " + mAtomId
                                 + " due to TransactionTooLarge. Calling pullFinish with no data");
@@ -722,6 +740,38 @@ public final class StatsManager {
                 Binder.restoreCallingIdentity(token);
             }
         }
+
+        @Override
+        public void onPullAtomDelta(int atomTag, long baseGeneration,
+                IPullAtomResultReceiver resultReceiver) {
+            // Java pullers do not register delta key fields, a full pull is always valid.
+            onPullAtom(atomTag, resultReceiver);
+        }
+
+        @Override
+        public void onPullAtomAggregated(int atomTag, int[] groupByFields, int[] sumFields,
+                IPullAtomResultReceiver resultReceiver) {
+            // Java pullers do not register support for aggregation, the raw rows are always valid.
+            onPullAtom(atomTag, resultReceiver);
+        }
+
+        @Override
+        public void onPullAtomProjected(int atomTag, int[] fields,
+                IPullAtomResultReceiver resultReceiver) {
+            // Writing every field is always valid.
+            onPullAtom(atomTag, resultReceiver);
+        }
+
+        @Override
+        public void onPullAtomGroup(int[] atomTags, IPullAtomResultReceiver resultReceiver) {
+            // Java pullers do not register pull groups, the stats service pulls each atom instead.
+            try {
+                resultReceiver.pullFinished(atomTags.length > 0 ? atomTags[0] : 0,
+                        /*success=*/false, new StatsEventParcel[0]);
+            } catch (RemoteException e) {
+                Log.w(TAG, "StatsPullResultReceiver failed for the group pull of tag " + mAtomId);
+            }
+        }
     }
 
     /**
@@ -859,6 +909,12 @@ public final class StatsManager {
         OutcomeReceiver<StatsCursor, StatsQueryException> queryCallback;
         Executor mExecutor;
 
+        // The pages of results received so far.
+        @GuardedBy("this")
+        private final ArrayList<String> mPagedData = new ArrayList<>();
+        @GuardedBy("this")
+        private int mPagedRowCount = 0;
+
         StatsQueryCallbackInternal(OutcomeReceiver<StatsCursor, StatsQueryException> queryCallback,
                 @NonNull @CallbackExecutor Executor executor) {
             this.queryCallback = queryCallback;
@@ -884,12 +940,35 @@ public final class StatsManager {
             }
         }
 
+        @Override
+        public void sendResultsPage(String[] queryData, String[] columnNames, int[] columnTypes,
+                int rowCount, boolean isLastPage) {
+            final String[] allData;
+            final int allRowCount;
+            synchronized (this) {
+                mPagedData.addAll(Arrays.asList(queryData));
+                mPagedRowCount += rowCount;
+                if (!isLastPage) {
+                    return;
+                }
+                allData = mPagedData.toArray(new String[0]);
+                allRowCount = mPagedRowCount;
+                mPagedData.clear();
+                mPagedRowCount = 0;
+            }
+            sendResults(allData, columnNames, columnTypes, allRowCount);
+        }
+
         @Override
         public void sendFailure(String error) {
             if (!SdkLevel.isAtLeastU()) {
                 throw new IllegalStateException(
                         "StatsManager#query is not available before Android U");
             }
+            synchronized (this) {
+                mPagedData.clear();
+                mPagedRowCount = 0;
+            }
             final long token = Binder.clearCallingIdentity();
             try {
                 mExecutor.execute(() -> {
@@ -66,6 +66,27 @@ void CompactorStack::Add(const int64_t value) {
     }
 }
 
+void CompactorStack::AddBatch(const std::vector<int64_t>& values) {
+    size_t next = 0;
+    while (next < values.size()) {
+        if (sampler_ != nullptr) {
+            sampler_->Add(values[next++]);
+            continue;
+        }
+        // Add() compacts as soon as the stack reaches its overall capacity, so the chunk stops
+        // there. At least one value is added since the stack is below capacity between adds.
+        const size_t room =
+                std::max<int64_t>(1, static_cast<int64_t>(overall_capacity_) -
+                                             num_items_in_compactors_);
+        const size_t chunk = std::min(room, values.size() - next);
+        compactors_[0].insert(compactors_[0].end(), values.begin() + next,
+                              values.begin() + next + chunk);
+        num_items_in_compactors_ += chunk;
+        next += chunk;
+        CompactStack();
+    }
+}
+
 // Adds an item to the compactor stack with weight >= 1.
 // Does nothing if weight <= 0.
 void CompactorStack::AddWithWeight(int64_t value, int weight) {
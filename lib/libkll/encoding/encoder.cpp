@@ -57,9 +57,14 @@ void Encoder::SerializeToPackedStringAll(std::vector<int64_t>::const_iterator be
                                          std::vector<int64_t>::const_iterator end,
                                          std::string* dst) {
     dst->clear();
-    for (; begin != end; ++begin) {
-        Encoder::AppendToString(*begin, dst);
+    if (begin == end) {
+        return;
     }
+    // Size the string once and encode in place rather than appending value by value.
+    const int64_t* const first = &*begin;
+    const int64_t* const last = first + (end - begin);
+    dst->resize(Varint::LengthAll64(first, last));
+    Varint::EncodeAll64(dst->data(), first, last);
 }
 
 }  // namespace encoding
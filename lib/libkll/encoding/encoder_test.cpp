@@ -136,6 +136,25 @@ TEST(EncoderTest, SerializeToPackedStringAllClearsPrepopulatedString) {
     EXPECT_EQ(empty, prepopulated);
 }
 
+TEST(EncoderTest, SerializeToPackedStringAllMatchesAppendToString) {
+    // Sorted like a compactor, with runs of one byte values and multi-byte values.
+    std::vector<int64_t> v;
+    for (int64_t i = -1000; i < 1000; i += 7) {
+        v.push_back(i);
+    }
+    for (int64_t i = 1; i < (1ll << 60); i *= 3) {
+        v.push_back(i);
+    }
+    std::string expected;
+    for (const int64_t value : v) {
+        Encoder::AppendToString(value, &expected);
+    }
+
+    std::string packed;
+    Encoder::SerializeToPackedStringAll(v.begin(), v.end(), &packed);
+    EXPECT_EQ(packed, expected);
+}
+
 }  // namespace
 
 }  // namespace encoding
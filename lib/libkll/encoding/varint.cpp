@@ -16,6 +16,16 @@
 #include "varint.h"
 
 #include <cstdint>
+#include <cstring>
+
+namespace {
+
+// Values are encoded and decoded in groups of this many when they all fit in one byte, which
+// is the common case for the low levels of sketches of small values.
+constexpr size_t kGroupSize = 8;
+constexpr uint64_t kContinuationBits = 0x8080808080808080ull;
+
+}  // namespace
 
 char* Varint::Encode32(char* sptr, uint32_t v) {
     return Encode32Inline(sptr, v);
@@ -44,3 +54,79 @@ char* Varint::Encode64(char* sptr, uint64_t v) {
         }
     }
 }
+
+char* Varint::EncodeAll64(char* sptr, const int64_t* begin, const int64_t* end) {
+    while (end - begin >= static_cast<ptrdiff_t>(kGroupSize)) {
+        uint64_t bits = 0;
+        for (size_t i = 0; i < kGroupSize; i++) {
+            bits |= static_cast<uint64_t>(begin[i]);
+        }
+        if (bits < (1 << 7)) {
+            for (size_t i = 0; i < kGroupSize; i++) {
+                sptr[i] = static_cast<char>(begin[i]);
+            }
+            sptr += kGroupSize;
+            begin += kGroupSize;
+            continue;
+        }
+        for (const int64_t* groupEnd = begin + kGroupSize; begin != groupEnd; ++begin) {
+            sptr = Encode64(sptr, static_cast<uint64_t>(*begin));
+        }
+    }
+    for (; begin != end; ++begin) {
+        sptr = Encode64(sptr, static_cast<uint64_t>(*begin));
+    }
+    return sptr;
+}
+
+size_t Varint::LengthAll64(const int64_t* begin, const int64_t* end) {
+    size_t length = 0;
+    for (; begin != end; ++begin) {
+        length += Length64(static_cast<uint64_t>(*begin));
+    }
+    return length;
+}
+
+const char* Varint::Parse64(const char* sptr, const char* limit, uint64_t* v) {
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(sptr);
+    const unsigned char* const end = reinterpret_cast<const unsigned char*>(limit);
+    uint64_t result = 0;
+    for (int shift = 0; shift < 7 * kMax64; shift += 7) {
+        if (ptr == end) {
+            return nullptr;
+        }
+        const uint64_t byte = *(ptr++);
+        // The last byte of a 10 byte varint only holds the top bit of the value.
+        if (shift == 7 * (kMax64 - 1) && byte > 1) {
+            return nullptr;
+        }
+        result |= (byte & 0x7f) << shift;
+        if (byte < (1 << 7)) {
+            *v = result;
+            return reinterpret_cast<const char*>(ptr);
+        }
+    }
+    return nullptr;
+}
+
+bool Varint::ParseAll64(const char* ptr, const char* limit, std::vector<int64_t>* values) {
+    while (ptr != limit) {
+        if (limit - ptr >= static_cast<ptrdiff_t>(kGroupSize)) {
+            uint64_t word;
+            memcpy(&word, ptr, sizeof(word));
+            if ((word & kContinuationBits) == 0) {
+                const unsigned char* bytes = reinterpret_cast<const unsigned char*>(ptr);
+                values->insert(values->end(), bytes, bytes + kGroupSize);
+                ptr += kGroupSize;
+                continue;
+            }
+        }
+        uint64_t v;
+        ptr = Parse64(ptr, limit, &v);
+        if (ptr == nullptr) {
+            return false;
+        }
+        values->push_back(static_cast<int64_t>(v));
+    }
+    return true;
+}
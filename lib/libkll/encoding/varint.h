@@ -15,7 +15,9 @@
  */
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include "bits_util.h"
 
@@ -33,6 +35,26 @@ public:
     // EFFECTS    Returns the encoding length of the specified value.
     static int Length64(uint64_t v);
 
+    // REQUIRES   "ptr" points to a buffer of at least LengthAll64(begin, end) bytes.
+    // EFFECTS    Encodes each value of [begin, end), cast to uint64, back to back
+    //            into "ptr", as packed repeated fields are, and returns a pointer to
+    //            the byte just past the last encoded byte.
+    static char* EncodeAll64(char* ptr, const int64_t* begin, const int64_t* end);
+
+    // EFFECTS    Returns the total encoding length of the values of [begin, end)
+    //            cast to uint64.
+    static size_t LengthAll64(const int64_t* begin, const int64_t* end);
+
+    // EFFECTS    Decodes the varint at "ptr" into "v" and returns a pointer to the
+    //            byte just past it, or nullptr if [ptr, limit) does not start with
+    //            a valid varint.
+    static const char* Parse64(const char* ptr, const char* limit, uint64_t* v);
+
+    // EFFECTS    Appends the values encoded by EncodeAll64() in [ptr, limit) to
+    //            "values". Returns false if [ptr, limit) is not a sequence of
+    //            valid varints, in which case "values" holds the ones before.
+    static bool ParseAll64(const char* ptr, const char* limit, std::vector<int64_t>* values);
+
 private:
     // A fully inlined version of Encode32: useful in the most time critical
     // routines, but its code size is large
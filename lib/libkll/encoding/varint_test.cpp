@@ -18,6 +18,8 @@
 #include <gtest/gtest.h>
 
 #include <cstdint>
+#include <string>
+#include <vector>
 
 // A straightforward implementation of Length64 for testing
 inline int Varint_Length64Old(uint64_t v) {
@@ -84,3 +86,72 @@ TEST(VarintTest, Encode64) {
     *end_s = '\0';  // terminate the string
     ASSERT_EQ(std::string(s), std::string(reinterpret_cast<char*>(n_encrypt)));
 }
+
+// Values that mix one byte runs longer and shorter than a group with multi-byte ones.
+std::vector<int64_t> MixedValues() {
+    std::vector<int64_t> values;
+    for (int i = 0; i < 20; i++) {
+        values.push_back(i);
+    }
+    values.push_back(-1);
+    values.push_back(127);
+    values.push_back(128);
+    for (int i = 0; i < 5; i++) {
+        values.push_back(i * 3);
+    }
+    for (int i = 0; i < 63; i++) {
+        values.push_back(1ll << i);
+    }
+    values.push_back(INT64_MIN);
+    values.push_back(INT64_MAX);
+    for (int i = 0; i < 9; i++) {
+        values.push_back(100 + i);
+    }
+    return values;
+}
+
+TEST(VarintTest, EncodeAll64) {
+    const std::vector<int64_t> values = MixedValues();
+    std::string expected;
+    for (int64_t v : values) {
+        char s[Varint::kMax64];
+        expected.append(s, Varint::Encode64(s, static_cast<uint64_t>(v)));
+    }
+    ASSERT_EQ(Varint::LengthAll64(values.data(), values.data() + values.size()),
+              expected.size());
+
+    std::string actual(expected.size(), '\0');
+    char* end = Varint::EncodeAll64(actual.data(), values.data(), values.data() + values.size());
+    ASSERT_EQ(end, actual.data() + actual.size());
+    ASSERT_EQ(actual, expected);
+}
+
+TEST(VarintTest, ParseAll64) {
+    const std::vector<int64_t> values = MixedValues();
+    std::string encoded(Varint::LengthAll64(values.data(), values.data() + values.size()), '\0');
+    Varint::EncodeAll64(encoded.data(), values.data(), values.data() + values.size());
+
+    std::vector<int64_t> parsed = {42};
+    ASSERT_TRUE(Varint::ParseAll64(encoded.data(), encoded.data() + encoded.size(), &parsed));
+    ASSERT_EQ(parsed.size(), values.size() + 1);
+    ASSERT_EQ(parsed[0], 42);
+    ASSERT_EQ(std::vector<int64_t>(parsed.begin() + 1, parsed.end()), values);
+}
+
+TEST(VarintTest, ParseAll64RejectsInvalidVarints) {
+    std::vector<int64_t> parsed;
+    // Truncated after its continuation bit.
+    const std::string truncated = "\x1\x2\x80";
+    ASSERT_FALSE(Varint::ParseAll64(truncated.data(), truncated.data() + truncated.size(),
+                                    &parsed));
+    ASSERT_EQ(parsed, std::vector<int64_t>({1, 2}));
+
+    // More than 64 bits.
+    const std::string tooLong = "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x02";
+    uint64_t v;
+    ASSERT_EQ(Varint::Parse64(tooLong.data(), tooLong.data() + tooLong.size(), &v), nullptr);
+    const std::string maxValue = "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01";
+    ASSERT_EQ(Varint::Parse64(maxValue.data(), maxValue.data() + maxValue.size(), &v),
+              maxValue.data() + maxValue.size());
+    ASSERT_EQ(v, ~0ull);
+}
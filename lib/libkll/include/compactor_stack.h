@@ -46,6 +46,11 @@ public:
 
     void Add(const int64_t value);
 
+    // Same as calling Add() for each value in order. Values are appended to the lowest compactor
+    // up to the point where Add() would compact the stack, so compactions and random draws
+    // happen exactly as they would one value at a time.
+    void AddBatch(const std::vector<int64_t>& values);
+
     // Adds an item to the compactor stack with weight >= 1.
     // Does nothing if weight <= 0.
     void AddWithWeight(int64_t value, int weight);
@@ -52,6 +52,10 @@ public:
     void Reset();
     void Add(int64_t value);
 
+    // Adds the values in order, leaving the aggregator in the same state as calling Add() for
+    // each of them, but updating min/max once and filling the lowest compactor in chunks.
+    void AddBatch(const std::vector<int64_t>& values);
+
     // Adds a value to the aggregator with multiplicity 'weight' (same as adding
     // the value with Add(value) 'weight' times). Does nothing if weight <= 0.
     //
@@ -65,6 +69,11 @@ public:
     // downscaling and randomized rounding is negligible.
     void AddWeighted(int64_t value, int weight);
 
+    // Adds the values summarized by other, each item of its compactor stack and sampler with
+    // the weight it stands for. The result keeps the rank error guarantee of this aggregator,
+    // as long as both were created with the same options. other must not be this aggregator.
+    void Merge(const KllQuantile& other);
+
     // Not safe to be called concurrently.
     zetasketch::android::AggregatorStateProto SerializeToProto();
 
@@ -72,6 +81,33 @@ public:
         return compactor_stack_.IsSamplerOn();
     }
 
+    // Accessors for serializers that write the state directly instead of building an
+    // AggregatorStateProto. min() and max() are only meaningful if num_values() > 0.
+    int64_t min() const {
+        return min_;
+    }
+
+    int64_t max() const {
+        return max_;
+    }
+
+    // Sorts the compactors, as SerializeToProto() does before encoding them.
+    void SortCompactorContents() {
+        compactor_stack_.SortCompactorContents();
+    }
+
+    const std::vector<std::vector<int64_t>>& compactors() const {
+        return compactor_stack_.compactors();
+    }
+
+    std::optional<std::pair<const int64_t, int64_t>> sampled_item_and_weight() const {
+        return compactor_stack_.sampled_item_and_weight();
+    }
+
+    int sampler_log_capacity() const {
+        return compactor_stack_.lowest_active_level();
+    }
+
 private:
     // Constructor.
     KllQuantile(int64_t inv_eps, int64_t inv_delta, int k, RandomGenerator* random)
@@ -16,8 +16,11 @@
 
 #include "kll.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include "aggregator.pb.h"
 #include "compactor_stack.h"
@@ -52,6 +55,17 @@ void KllQuantile::Add(const int64_t value) {
     num_values_++;
 }
 
+void KllQuantile::AddBatch(const std::vector<int64_t>& values) {
+    if (values.empty()) {
+        return;
+    }
+    compactor_stack_.AddBatch(values);
+    const auto [min_it, max_it] = std::minmax_element(values.begin(), values.end());
+    UpdateMin(*min_it);
+    UpdateMax(*max_it);
+    num_values_ += values.size();
+}
+
 void KllQuantile::AddWeighted(int64_t value, int weight) {
     if (weight > 0) {
         compactor_stack_.AddWithWeight(value, weight);
@@ -61,6 +75,38 @@ void KllQuantile::AddWeighted(int64_t value, int weight) {
     }
 }
 
+void KllQuantile::Merge(const KllQuantile& other) {
+    if (other.num_values_ == 0) {
+        return;
+    }
+    const std::vector<std::vector<int64_t>>& other_compactors = other.compactor_stack_.compactors();
+    for (size_t level = 0; level < other_compactors.size(); level++) {
+        if (level == 0) {
+            compactor_stack_.AddBatch(other_compactors[0]);
+            continue;
+        }
+        // Items at a level stand for 2^level values. AddWithWeight() takes an int, so weights
+        // at levels above 30 are added in parts.
+        const int64_t weight = int64_t{1} << level;
+        for (const int64_t value : other_compactors[level]) {
+            for (int64_t remaining = weight; remaining > 0;) {
+                const int part = static_cast<int>(
+                        std::min<int64_t>(remaining, std::numeric_limits<int>::max()));
+                compactor_stack_.AddWithWeight(value, part);
+                remaining -= part;
+            }
+        }
+    }
+    const auto sampled_item_and_weight = other.compactor_stack_.sampled_item_and_weight();
+    if (sampled_item_and_weight.has_value()) {
+        compactor_stack_.AddWithWeight(sampled_item_and_weight->first,
+                                       static_cast<int>(sampled_item_and_weight->second));
+    }
+    UpdateMin(other.min_);
+    UpdateMax(other.max_);
+    num_values_ += other.num_values_;
+}
+
 AggregatorStateProto KllQuantile::SerializeToProto() {
     AggregatorStateProto aggregator_state;
 
@@ -171,6 +171,104 @@ TEST(KllQuantileSerializationTest, EmptyQuantilesProto) {
     EXPECT_EQ(quantiles_state.compactors_size(), 0);
     ASSERT_FALSE(quantiles_state.has_sampler());
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// ------------------------- Tests for AddBatch ----------------------------- //
+
+TEST(KllQuantileAddBatchTest, SameStateAsAddingOneByOne) {
+    // Small k so that the stack compacts often and the sampler kicks in.
+    MTRandomGenerator random1(/*seed=*/42);
+    MTRandomGenerator random2(/*seed=*/42);
+    KllQuantileOptions options1;
+    options1.set_k(8);
+    options1.set_random(&random1);
+    KllQuantileOptions options2 = options1;
+    options2.set_random(&random2);
+    std::unique_ptr<KllQuantile> oneByOne = KllQuantile::Create(options1);
+    std::unique_ptr<KllQuantile> batched = KllQuantile::Create(options2);
+
+    std::vector<int64_t> values;
+    for (int i = 0; i < 10000; i++) {
+        values.push_back((i * 7919) % 1000 - 500);
+    }
+    for (int64_t value : values) {
+        oneByOne->Add(value);
+    }
+    // Uneven batches, including empty ones.
+    const std::vector<size_t> batchSizes = {1, 5, 0, 100, 3000};
+    size_t next = 0;
+    for (size_t i = 0; next < values.size(); i++) {
+        const size_t batchSize = std::min(batchSizes[i % batchSizes.size()], values.size() - next);
+        batched->AddBatch(std::vector<int64_t>(values.begin() + next,
+                                               values.begin() + next + batchSize));
+        next += batchSize;
+    }
+
+    EXPECT_EQ(oneByOne->num_values(), batched->num_values());
+    EXPECT_TRUE(batched->IsSamplerOn());
+    EXPECT_EQ(oneByOne->SerializeToProto().SerializeAsString(),
+              batched->SerializeToProto().SerializeAsString());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------- Tests for Merge ------------------------------- //
+
+TEST(KllQuantileMergeTest, MergeUncompactedSketchIsSameAsAddingItsValues) {
+    MTRandomGenerator random1(/*seed=*/42);
+    MTRandomGenerator random2(/*seed=*/42);
+    KllQuantileOptions options1;
+    options1.set_random(&random1);
+    KllQuantileOptions options2 = options1;
+    options2.set_random(&random2);
+    std::unique_ptr<KllQuantile> added = KllQuantile::Create(options1);
+    std::unique_ptr<KllQuantile> merged = KllQuantile::Create(options2);
+    std::unique_ptr<KllQuantile> other = KllQuantile::Create();
+
+    for (int i = 0; i < 10; i++) {
+        added->Add(i);
+        merged->Add(i);
+        added->Add(100 - i);
+        other->Add(100 - i);
+    }
+    merged->Merge(*other);
+
+    EXPECT_EQ(merged->num_values(), 20);
+    EXPECT_EQ(added->SerializeToProto().SerializeAsString(),
+              merged->SerializeToProto().SerializeAsString());
+}
+
+TEST(KllQuantileMergeTest, MergeCompactedSketches) {
+    KllQuantileOptions options;
+    options.set_k(8);
+    std::unique_ptr<KllQuantile> merged = KllQuantile::Create(options);
+    std::unique_ptr<KllQuantile> other = KllQuantile::Create(options);
+    for (int i = 0; i < 10000; i++) {
+        merged->Add(i);
+        other->Add(-i);
+    }
+    ASSERT_TRUE(other->IsSamplerOn());
+    const int64_t stored_before_merge = merged->num_stored_values();
+
+    merged->Merge(*other);
+
+    EXPECT_EQ(merged->num_values(), 20000);
+    EXPECT_EQ(merged->min(), -9999);
+    EXPECT_EQ(merged->max(), 9999);
+    // The merged sketch stays within the memory bound of a single sketch.
+    EXPECT_LE(merged->num_stored_values(), 2 * stored_before_merge);
+    EXPECT_EQ(other->num_values(), 10000);
+}
+
+TEST(KllQuantileMergeTest, MergeEmptySketchIsNoOp) {
+    std::unique_ptr<KllQuantile> merged = KllQuantile::Create();
+    std::unique_ptr<KllQuantile> empty = KllQuantile::Create();
+    merged->Add(5);
+    const std::string before = merged->SerializeToProto().SerializeAsString();
+
+    merged->Merge(*empty);
+
+    EXPECT_EQ(before, merged->SerializeToProto().SerializeAsString());
+}
 }  // namespace
 
 }  // namespace aggregation
@@ -19,6 +19,15 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/cdefs.h>
+
+#ifndef __STATSD_PULL_DELTA_MIN_API__
+#define __STATSD_PULL_DELTA_MIN_API__ __ANDROID_API_V__
+#endif
+
+#ifndef __STATSD_PULL_BATCH_MIN_API__
+#define __STATSD_PULL_BATCH_MIN_API__ __ANDROID_API_V__
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -97,6 +106,79 @@ int32_t AStatsManager_PullAtomMetadata_getNumAdditiveFields(
 void AStatsManager_PullAtomMetadata_getAdditiveFields(AStatsManager_PullAtomMetadata* metadata,
                                                       int32_t* fields);
 
+/**
+ * Set the fields that identify a row of this pulled atom, which lets the callback send only the
+ * rows that changed since its previous pull. See AStatsEventList_setDelta.
+ *
+ * The stats service keeps the rows of the last pull and replaces those with the same values of
+ * the key fields. Introduced in API 35.
+ */
+void AStatsManager_PullAtomMetadata_setDeltaKeyFields(AStatsManager_PullAtomMetadata* metadata,
+                                                      int32_t* key_fields, int32_t num_fields)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Get the number of delta key fields for this pulled atom. This is intended to be called before
+ * AStatsManager_PullAtomMetadata_getDeltaKeyFields to determine the size of the array.
+ *
+ * Introduced in API 35.
+ */
+int32_t AStatsManager_PullAtomMetadata_getNumDeltaKeyFields(
+        AStatsManager_PullAtomMetadata* metadata) __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Get the delta key fields of this pulled atom.
+ *
+ * \param fields an output parameter containing the delta key fields for this PullAtomMetadata.
+ *               Fields is an array and it is assumed that it is at least as large as the number of
+ *               delta key fields, which can be obtained by calling
+ *               AStatsManager_PullAtomMetadata_getNumDeltaKeyFields.
+ *
+ * Introduced in API 35.
+ */
+void AStatsManager_PullAtomMetadata_getDeltaKeyFields(AStatsManager_PullAtomMetadata* metadata,
+                                                      int32_t* fields)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Set whether the callback of this pulled atom may aggregate the rows it adds, as the stats
+ * service requests. See AStatsEventList_getAggregation. Atoms with delta key fields are never
+ * requested to aggregate their rows.
+ *
+ * Introduced in API 35.
+ */
+void AStatsManager_PullAtomMetadata_setSupportsAggregation(
+        AStatsManager_PullAtomMetadata* metadata, bool supports_aggregation)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Get whether the callback of this pulled atom may aggregate the rows it adds.
+ *
+ * Introduced in API 35.
+ */
+bool AStatsManager_PullAtomMetadata_getSupportsAggregation(
+        AStatsManager_PullAtomMetadata* metadata) __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Set the pull group of this pulled atom. The stats service may pull the atoms of a process that
+ * share a non-zero pull group in one request, which runs the callback of each of them in turn
+ * and sends all their events at once. Atoms with delta key fields are always pulled on their own.
+ * The default is 0, for no group.
+ *
+ * Introduced in API 35.
+ */
+void AStatsManager_PullAtomMetadata_setPullGroup(AStatsManager_PullAtomMetadata* metadata,
+                                                 int32_t pull_group)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Get the pull group of this pulled atom.
+ *
+ * Introduced in API 35.
+ */
+int32_t AStatsManager_PullAtomMetadata_getPullGroup(AStatsManager_PullAtomMetadata* metadata)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
 /**
  * Return codes for the result of a pull.
  */
@@ -125,6 +207,50 @@ typedef struct AStatsEventList AStatsEventList;
  */
 AStatsEvent* AStatsEventList_addStatsEvent(AStatsEventList* pull_data);
 
+/**
+ * Marks the AStatsEventList of a pull as a delta, in which the callback only adds the rows that
+ * changed or were added since its previous pull. Rows cannot be removed by a delta.
+ *
+ * This only applies to atoms registered with delta key fields, and only when the stats service
+ * holds the result of the previous pull. Returns false if the pull cannot be a delta, in which
+ * case the callback must add all the rows.
+ *
+ * Introduced in API 35.
+ */
+bool AStatsEventList_setDelta(AStatsEventList* pull_data)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Gets how the callback may aggregate the rows of a pull. The rows with the same values of the
+ * group by fields may be added as a single row, in which each sum field holds the sum of the
+ * values of the rows, and the other fields hold the values of any of the rows. The callback may
+ * still add the rows without aggregating them.
+ *
+ * This only applies to atoms registered with AStatsManager_PullAtomMetadata_setSupportsAggregation.
+ * Returns false if the rows cannot be aggregated, in which case the output parameters are not
+ * set. The arrays are only valid during the callback.
+ *
+ * Introduced in API 35.
+ */
+bool AStatsEventList_getAggregation(AStatsEventList* pull_data, const int32_t** group_by_fields,
+                                    int32_t* num_group_by_fields, const int32_t** sum_fields,
+                                    int32_t* num_sum_fields)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
+/**
+ * Gets the top level fields of the atom that the stats service reads from the events of a pull.
+ * The events must still have all their fields, but the fields that are not in use may hold any
+ * value of their type, e.g. 0 or an empty string, so that the callback can skip computing them.
+ *
+ * Returns false if all fields are in use, in which case the output parameters are not set. The
+ * array is only valid during the callback.
+ *
+ * Introduced in API 35.
+ */
+bool AStatsEventList_getFieldsInUse(AStatsEventList* pull_data, const int32_t** fields,
+                                    int32_t* num_fields)
+        __INTRODUCED_IN(__STATSD_PULL_DELTA_MIN_API__);
+
 /**
  * Callback interface for pulling atoms requested by the stats service.
  *
@@ -155,6 +281,30 @@ typedef AStatsManager_PullAtomCallbackReturn (*AStatsManager_PullAtomCallback)(
 void AStatsManager_setPullAtomCallback(int32_t atom_tag, AStatsManager_PullAtomMetadata* metadata,
                                        AStatsManager_PullAtomCallback callback, void* cookie);
 
+/**
+ * Sets the same callback for several atoms, as AStatsManager_setPullAtomCallback does for each of
+ * them, but registers them with the stats service in a single call. This is also how they are
+ * registered again if the stats service restarts.
+ *
+ * Requires the REGISTER_STATS_PULL_ATOM permission.
+ *
+ * \param num_atoms         The number of atoms to set the callback for.
+ * \param atom_tags         The tags of the atoms, an array of num_atoms elements.
+ * \param metadata          Optional metadata of each atom, an array of num_atoms elements which
+ *                          the metadata is copied from. This param and its elements are
+ *                          nullable, in which case defaults will be used.
+ * \param callback          The callback to be invoked when the stats service pulls one of the
+ *                          atoms. It receives the tag of the atom to pull.
+ * \param cookie            A pointer that will be passed back to the callback.
+ *                          It has no meaning to statsd.
+ *
+ * Introduced in API 35.
+ */
+void AStatsManager_setPullAtomCallbacks(int32_t num_atoms, const int32_t* atom_tags,
+                                        AStatsManager_PullAtomMetadata* const* metadata,
+                                        AStatsManager_PullAtomCallback callback, void* cookie)
+        __INTRODUCED_IN(__STATSD_PULL_BATCH_MIN_API__);
+
 /**
  * Clears a callback for an atom when that atom is to be pulled. Note that any ongoing
  * pulls will still occur.
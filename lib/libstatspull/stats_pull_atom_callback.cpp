@@ -17,27 +17,42 @@
 #include <aidl/android/os/BnPullAtomCallback.h>
 #include <aidl/android/os/IPullAtomResultReceiver.h>
 #include <aidl/android/os/IStatsd.h>
-#include <aidl/android/util/StatsEventParcel.h>
+#include <aidl/android/os/PullAtomRegistration.h>
 #include <android/binder_auto_utils.h>
 #include <android/binder_ibinder.h>
 #include <android/binder_manager.h>
 #include <stats_event.h>
 #include <stats_pull_atom_callback.h>
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
 #include <map>
 #include <queue>
 #include <thread>
+#include <utility>
 #include <vector>
 
 using Status = ::ndk::ScopedAStatus;
 using aidl::android::os::BnPullAtomCallback;
 using aidl::android::os::IPullAtomResultReceiver;
 using aidl::android::os::IStatsd;
-using aidl::android::util::StatsEventParcel;
+using aidl::android::os::PullAtomRegistration;
 using ::ndk::SharedRefBase;
 
 struct AStatsEventList {
     std::vector<AStatsEvent*> data;
+    // Whether the puller may add only the rows changed since its last pull.
+    bool delta_allowed = false;
+    // Whether the puller did so.
+    bool is_delta = false;
+    // Whether the puller may aggregate the rows by group_by_fields, summing sum_fields.
+    bool aggregation_allowed = false;
+    std::vector<int32_t> group_by_fields;
+    std::vector<int32_t> sum_fields;
+    // Whether statsd only reads the top level fields in fields_in_use.
+    bool fields_limited = false;
+    std::vector<int32_t> fields_in_use;
 };
 
 AStatsEvent* AStatsEventList_addStatsEvent(AStatsEventList* pull_data) {
@@ -46,13 +61,55 @@ AStatsEvent* AStatsEventList_addStatsEvent(AStatsEventList* pull_data) {
     return event;
 }
 
+bool AStatsEventList_setDelta(AStatsEventList* pull_data) {
+    if (!pull_data->delta_allowed) {
+        return false;
+    }
+    pull_data->is_delta = true;
+    return true;
+}
+
+bool AStatsEventList_getAggregation(AStatsEventList* pull_data, const int32_t** group_by_fields,
+                                    int32_t* num_group_by_fields, const int32_t** sum_fields,
+                                    int32_t* num_sum_fields) {
+    if (!pull_data->aggregation_allowed) {
+        return false;
+    }
+    *group_by_fields = pull_data->group_by_fields.data();
+    *num_group_by_fields = pull_data->group_by_fields.size();
+    *sum_fields = pull_data->sum_fields.data();
+    *num_sum_fields = pull_data->sum_fields.size();
+    return true;
+}
+
+bool AStatsEventList_getFieldsInUse(AStatsEventList* pull_data, const int32_t** fields,
+                                    int32_t* num_fields) {
+    if (!pull_data->fields_limited) {
+        return false;
+    }
+    *fields = pull_data->fields_in_use.data();
+    *num_fields = pull_data->fields_in_use.size();
+    return true;
+}
+
 constexpr int64_t DEFAULT_COOL_DOWN_MILLIS = 1000LL;  // 1 second.
 constexpr int64_t DEFAULT_TIMEOUT_MILLIS = 1500LL;    // 1.5 seconds.
 
+// Pulls bigger than this are sent to statsd in chunks of about this size. This bounds the size of
+// a single oneway transaction, and lets statsd parse a chunk while the next one is built.
+constexpr size_t MAX_PULL_CHUNK_BYTES = 128 * 1024;
+
+// Registrations of more atoms than this are sent to statsd in several calls, to keep each oneway
+// transaction well below the binder buffer size.
+constexpr size_t MAX_REGISTRATIONS_PER_CALL = 64;
+
 struct AStatsManager_PullAtomMetadata {
     int64_t cool_down_millis;
     int64_t timeout_millis;
     std::vector<int32_t> additive_fields;
+    std::vector<int32_t> delta_key_fields;
+    bool supports_aggregation;
+    int32_t pull_group;
 };
 
 AStatsManager_PullAtomMetadata* AStatsManager_PullAtomMetadata_obtain() {
@@ -60,6 +117,9 @@ AStatsManager_PullAtomMetadata* AStatsManager_PullAtomMetadata_obtain() {
     metadata->cool_down_millis = DEFAULT_COOL_DOWN_MILLIS;
     metadata->timeout_millis = DEFAULT_TIMEOUT_MILLIS;
     metadata->additive_fields = std::vector<int32_t>();
+    metadata->delta_key_fields = std::vector<int32_t>();
+    metadata->supports_aggregation = false;
+    metadata->pull_group = 0;
     return metadata;
 }
 
@@ -101,25 +161,176 @@ void AStatsManager_PullAtomMetadata_getAdditiveFields(AStatsManager_PullAtomMeta
     std::copy(metadata->additive_fields.begin(), metadata->additive_fields.end(), fields);
 }
 
+void AStatsManager_PullAtomMetadata_setDeltaKeyFields(AStatsManager_PullAtomMetadata* metadata,
+                                                      int32_t* key_fields, int32_t num_fields) {
+    metadata->delta_key_fields.assign(key_fields, key_fields + num_fields);
+}
+
+int32_t AStatsManager_PullAtomMetadata_getNumDeltaKeyFields(
+        AStatsManager_PullAtomMetadata* metadata) {
+    return metadata->delta_key_fields.size();
+}
+
+void AStatsManager_PullAtomMetadata_getDeltaKeyFields(AStatsManager_PullAtomMetadata* metadata,
+                                                      int32_t* fields) {
+    std::copy(metadata->delta_key_fields.begin(), metadata->delta_key_fields.end(), fields);
+}
+
+void AStatsManager_PullAtomMetadata_setSupportsAggregation(
+        AStatsManager_PullAtomMetadata* metadata, bool supports_aggregation) {
+    metadata->supports_aggregation = supports_aggregation;
+}
+
+bool AStatsManager_PullAtomMetadata_getSupportsAggregation(
+        AStatsManager_PullAtomMetadata* metadata) {
+    return metadata->supports_aggregation;
+}
+
+void AStatsManager_PullAtomMetadata_setPullGroup(AStatsManager_PullAtomMetadata* metadata,
+                                                 int32_t pull_group) {
+    metadata->pull_group = pull_group;
+}
+
+int32_t AStatsManager_PullAtomMetadata_getPullGroup(AStatsManager_PullAtomMetadata* metadata) {
+    return metadata->pull_group;
+}
+
 class StatsPullAtomCallbackInternal : public BnPullAtomCallback {
   public:
     StatsPullAtomCallbackInternal(const AStatsManager_PullAtomCallback callback, void* cookie,
                                   const int64_t coolDownMillis, const int64_t timeoutMillis,
-                                  const std::vector<int32_t> additiveFields)
+                                  const std::vector<int32_t> additiveFields,
+                                  const std::vector<int32_t> deltaKeyFields,
+                                  const bool supportsAggregation, const int32_t pullGroup)
         : mCallback(callback),
           mCookie(cookie),
           mCoolDownMillis(coolDownMillis),
           mTimeoutMillis(timeoutMillis),
-          mAdditiveFields(additiveFields) {}
+          mAdditiveFields(additiveFields),
+          mDeltaKeyFields(deltaKeyFields),
+          mSupportsAggregation(supportsAggregation),
+          mPullGroup(deltaKeyFields.empty() ? pullGroup : 0) {}
 
     Status onPullAtom(int32_t atomTag,
                       const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
         AStatsEventList statsEventList;
+        pull(atomTag, statsEventList, resultReceiver);
+        return Status::ok();
+    }
+
+    Status onPullAtomDelta(
+            int32_t atomTag, int64_t baseGeneration,
+            const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        AStatsEventList statsEventList;
+        // A delta is only meaningful against the last result statsd received. Oneway calls to
+        // this binder are serialized, so mGeneration is not accessed concurrently.
+        statsEventList.delta_allowed = baseGeneration != 0 && baseGeneration == mGeneration;
         int successInt = mCallback(atomTag, &statsEventList, mCookie);
         bool success = successInt == AStatsManager_PULL_SUCCESS;
 
-        // Convert stats_events into StatsEventParcels.
-        std::vector<StatsEventParcel> parcels;
+        const int64_t resultBaseGeneration = statsEventList.is_delta ? baseGeneration : 0;
+        const int64_t generation = mGeneration + 1;
+        const bool sent = sendPullResult(
+                atomTag, success, statsEventList, resultReceiver,
+                [&](bool resultSuccess, const std::vector<uint8_t>& packedEvents) {
+                    return resultReceiver->pullFinishedDelta(atomTag, resultSuccess,
+                                                             resultBaseGeneration, generation,
+                                                             packedEvents);
+                });
+        if (sent && success) {
+            mGeneration = generation;
+        }
+        for (int i = 0; i < statsEventList.data.size(); i++) {
+            AStatsEvent_release(statsEventList.data[i]);
+        }
+        return Status::ok();
+    }
+
+    Status onPullAtomAggregated(
+            int32_t atomTag, const std::vector<int32_t>& groupByFields,
+            const std::vector<int32_t>& sumFields,
+            const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        AStatsEventList statsEventList;
+        statsEventList.aggregation_allowed = mSupportsAggregation;
+        statsEventList.group_by_fields = groupByFields;
+        statsEventList.sum_fields = sumFields;
+        if (mSupportsAggregation) {
+            // The other fields of an aggregated row may hold the values of any row, so they are
+            // not read either.
+            statsEventList.fields_limited = true;
+            std::set_union(groupByFields.begin(), groupByFields.end(), sumFields.begin(),
+                           sumFields.end(), std::back_inserter(statsEventList.fields_in_use));
+        }
+        pull(atomTag, statsEventList, resultReceiver);
+        return Status::ok();
+    }
+
+    Status onPullAtomProjected(
+            int32_t atomTag, const std::vector<int32_t>& fields,
+            const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        AStatsEventList statsEventList;
+        statsEventList.fields_limited = true;
+        statsEventList.fields_in_use = fields;
+        pull(atomTag, statsEventList, resultReceiver);
+        return Status::ok();
+    }
+
+    Status onPullAtomGroup(
+            const std::vector<int32_t>& atomTags,
+            const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        AStatsEventList statsEventList;
+        // Every atom of the group adds its rows to the same list. If any of them is not in the
+        // group of this callback, or fails, the whole pull fails and statsd pulls each atom.
+        bool success = mPullGroup != 0 && !atomTags.empty();
+        for (size_t i = 0; success && i < atomTags.size(); i++) {
+            const std::shared_ptr<StatsPullAtomCallbackInternal> cb =
+                    findGroupPuller(atomTags[i], mPullGroup);
+            success = cb != nullptr && cb->mCallback(atomTags[i], &statsEventList, cb->mCookie) ==
+                                               AStatsManager_PULL_SUCCESS;
+        }
+        finishPull(atomTags.empty() ? 0 : atomTags[0], success, statsEventList, resultReceiver);
+        return Status::ok();
+    }
+
+    int64_t getCoolDownMillis() const { return mCoolDownMillis; }
+    int64_t getTimeoutMillis() const { return mTimeoutMillis; }
+    const std::vector<int32_t>& getAdditiveFields() const { return mAdditiveFields; }
+    const std::vector<int32_t>& getDeltaKeyFields() const { return mDeltaKeyFields; }
+    bool getSupportsAggregation() const { return mSupportsAggregation; }
+    int32_t getPullGroup() const { return mPullGroup; }
+
+  private:
+    // Runs the callback on the list, and sends the events it adds with pullFinishedPacked.
+    void pull(int32_t atomTag, AStatsEventList& statsEventList,
+              const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) {
+        int successInt = mCallback(atomTag, &statsEventList, mCookie);
+        finishPull(atomTag, successInt == AStatsManager_PULL_SUCCESS, statsEventList,
+                   resultReceiver);
+    }
+
+    // Sends the events of the list with pullFinishedPacked, and releases them.
+    void finishPull(int32_t atomTag, bool success, AStatsEventList& statsEventList,
+                    const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver) {
+        sendPullResult(atomTag, success, statsEventList, resultReceiver,
+                       [&](bool resultSuccess, const std::vector<uint8_t>& packedEvents) {
+                           return resultReceiver->pullFinishedPacked(atomTag, resultSuccess,
+                                                                     packedEvents);
+                       });
+        for (int i = 0; i < statsEventList.data.size(); i++) {
+            AStatsEvent_release(statsEventList.data[i]);
+        }
+    }
+
+    // Sends the events of the list in chunks, the last one with finish. Returns whether the
+    // result of the pull was delivered.
+    bool sendPullResult(
+            int32_t atomTag, bool success, const AStatsEventList& statsEventList,
+            const std::shared_ptr<IPullAtomResultReceiver>& resultReceiver,
+            const std::function<Status(bool, const std::vector<uint8_t>&)>& finish) {
+        // Pack the stats_events in a single buffer, each event prefixed with its size. statsd is
+        // in the same module as this library, so it always knows the packed format.
+        std::vector<uint8_t> packedEvents;
+        Status status = Status::ok();
 
         // Resolves fuzz build failure in b/161575591.
 #if defined(__ANDROID_APEX__) || defined(LIB_STATS_PULL_TESTS_FLAG)
@@ -127,35 +338,52 @@ class StatsPullAtomCallbackInternal : public BnPullAtomCallback {
             size_t size;
             uint8_t* buffer = AStatsEvent_getBuffer(statsEventList.data[i], &size);
 
-            StatsEventParcel p;
-            // vector.assign() creates a copy, but this is inevitable unless
-            // stats_event.h/c uses a vector as opposed to a buffer.
-            p.buffer.assign(buffer, buffer + size);
-            parcels.push_back(std::move(p));
+            // Send the events packed so far once the chunk is full. Only the last chunk goes
+            // with pullFinished, and a failed pull has no use for the earlier ones.
+            if (success && !packedEvents.empty() &&
+                packedEvents.size() + sizeof(uint32_t) + size > MAX_PULL_CHUNK_BYTES) {
+                status = resultReceiver->pullPartialPacked(atomTag, packedEvents);
+                if (!status.isOk()) {
+                    break;
+                }
+                packedEvents.clear();
+            }
+
+            // This copy is inevitable unless stats_event.h/c uses a vector as opposed to a
+            // buffer, but it is one copy into a buffer that is reused across the chunks.
+            const uint32_t eventSize = size;
+            const uint8_t* sizeBytes = reinterpret_cast<const uint8_t*>(&eventSize);
+            packedEvents.insert(packedEvents.end(), sizeBytes, sizeBytes + sizeof(eventSize));
+            packedEvents.insert(packedEvents.end(), buffer, buffer + size);
         }
 #endif
 
-        Status status = resultReceiver->pullFinished(atomTag, success, parcels);
-        if (!status.isOk()) {
-            std::vector<StatsEventParcel> emptyParcels;
-            resultReceiver->pullFinished(atomTag, /*success=*/false, emptyParcels);
+        if (status.isOk()) {
+            status = finish(success, packedEvents);
         }
-        for (int i = 0; i < statsEventList.data.size(); i++) {
-            AStatsEvent_release(statsEventList.data[i]);
+        if (!status.isOk()) {
+            finish(/*success=*/false, {});
+            return false;
         }
-        return Status::ok();
+        return true;
     }
 
-    int64_t getCoolDownMillis() const { return mCoolDownMillis; }
-    int64_t getTimeoutMillis() const { return mTimeoutMillis; }
-    const std::vector<int32_t>& getAdditiveFields() const { return mAdditiveFields; }
+    // Returns the callback registered for the atom if it is in the pull group, or else null.
+    static std::shared_ptr<StatsPullAtomCallbackInternal> findGroupPuller(int32_t atomTag,
+                                                                          int32_t pullGroup);
 
-  private:
     const AStatsManager_PullAtomCallback mCallback;
     void* mCookie;
     const int64_t mCoolDownMillis;
     const int64_t mTimeoutMillis;
     const std::vector<int32_t> mAdditiveFields;
+    const std::vector<int32_t> mDeltaKeyFields;
+    const bool mSupportsAggregation;
+    // The group of atoms that statsd may pull together with onPullAtomGroup, 0 if none. Atoms
+    // with delta key fields are always pulled on their own.
+    const int32_t mPullGroup;
+    // The generation of the last result of onPullAtomDelta delivered to statsd.
+    int64_t mGeneration = 0;
 };
 
 /**
@@ -170,6 +398,68 @@ static std::mutex pullersMutex;
 
 static std::map<int32_t, std::shared_ptr<StatsPullAtomCallbackInternal>> pullers;
 
+std::shared_ptr<StatsPullAtomCallbackInternal> StatsPullAtomCallbackInternal::findGroupPuller(
+        int32_t atomTag, int32_t pullGroup) {
+    std::lock_guard<std::mutex> lock(pullersMutex);
+    const auto it = pullers.find(atomTag);
+    if (it == pullers.end() || it->second->mPullGroup != pullGroup) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+using PullerList = std::vector<std::pair<int32_t, std::shared_ptr<StatsPullAtomCallbackInternal>>>;
+
+PullAtomRegistration makePullAtomRegistration(
+        int32_t atomTag, const std::shared_ptr<StatsPullAtomCallbackInternal>& cb) {
+    PullAtomRegistration registration;
+    registration.atomTag = atomTag;
+    registration.coolDownMillis = cb->getCoolDownMillis();
+    registration.timeoutMillis = cb->getTimeoutMillis();
+    registration.additiveFields = cb->getAdditiveFields();
+    registration.deltaKeyFields = cb->getDeltaKeyFields();
+    registration.supportsAggregation = cb->getSupportsAggregation();
+    registration.pullGroup = cb->getPullGroup();
+    registration.pullerCallback = cb;
+    return registration;
+}
+
+void registerPullAtomCallback(const std::shared_ptr<IStatsd>& statsService, int32_t atomTag,
+                              const std::shared_ptr<StatsPullAtomCallbackInternal>& cb) {
+    if (cb->getSupportsAggregation() || cb->getPullGroup() != 0) {
+        // Only the batched registration carries the support for aggregation and the pull group.
+        statsService->registerNativePullAtomCallbacks({makePullAtomRegistration(atomTag, cb)});
+    } else if (cb->getDeltaKeyFields().empty()) {
+        statsService->registerNativePullAtomCallback(atomTag, cb->getCoolDownMillis(),
+                                                     cb->getTimeoutMillis(),
+                                                     cb->getAdditiveFields(), cb);
+    } else {
+        statsService->registerNativeDeltaPullAtomCallback(
+                atomTag, cb->getCoolDownMillis(), cb->getTimeoutMillis(),
+                cb->getAdditiveFields(), cb->getDeltaKeyFields(), cb);
+    }
+}
+
+// Registers the pullers with as few binder calls as possible.
+void registerPullAtomCallbacks(const std::shared_ptr<IStatsd>& statsService,
+                               const PullerList& pullerList) {
+    if (pullerList.size() == 1) {
+        registerPullAtomCallback(statsService, pullerList[0].first, pullerList[0].second);
+        return;
+    }
+    std::vector<PullAtomRegistration> registrations;
+    for (const auto& [atomTag, cb] : pullerList) {
+        registrations.push_back(makePullAtomRegistration(atomTag, cb));
+        if (registrations.size() == MAX_REGISTRATIONS_PER_CALL) {
+            statsService->registerNativePullAtomCallbacks(registrations);
+            registrations.clear();
+        }
+    }
+    if (!registrations.empty()) {
+        statsService->registerNativePullAtomCallbacks(registrations);
+    }
+}
+
 class StatsdProvider {
 public:
     StatsdProvider() : mDeathRecipient(AIBinder_DeathRecipient_new(binderDied)) {
@@ -213,15 +503,13 @@ public:
 
         // Since we do not want to make an IPC with the lock held, we first create a
         // copy of the data with the lock held before iterating through the map.
-        std::map<int32_t, std::shared_ptr<StatsPullAtomCallbackInternal>> pullersCopy;
+        PullerList pullersCopy;
         {
             std::lock_guard<std::mutex> lock(pullersMutex);
-            pullersCopy = pullers;
+            pullersCopy.assign(pullers.begin(), pullers.end());
         }
-        for (const auto& it : pullersCopy) {
-            statsService->registerNativePullAtomCallback(it.first, it.second->getCoolDownMillis(),
-                                                         it.second->getTimeoutMillis(),
-                                                         it.second->getAdditiveFields(), it.second);
+        if (!pullersCopy.empty()) {
+            registerPullAtomCallbacks(statsService, pullersCopy);
         }
     }
 
@@ -241,17 +529,15 @@ private:
 
 static std::shared_ptr<StatsdProvider> statsProvider = std::make_shared<StatsdProvider>();
 
-void registerStatsPullAtomCallbackBlocking(int32_t atomTag,
-                                           std::shared_ptr<StatsdProvider> statsProvider,
-                                           std::shared_ptr<StatsPullAtomCallbackInternal> cb) {
+void registerStatsPullAtomCallbacksBlocking(const PullerList& pullerList,
+                                            std::shared_ptr<StatsdProvider> statsProvider) {
     const std::shared_ptr<IStatsd> statsService = statsProvider->getStatsService();
     if (statsService == nullptr) {
         // Statsd not available
         return;
     }
 
-    statsService->registerNativePullAtomCallback(
-            atomTag, cb->getCoolDownMillis(), cb->getTimeoutMillis(), cb->getAdditiveFields(), cb);
+    registerPullAtomCallbacks(statsService, pullerList);
 }
 
 void unregisterStatsPullAtomCallbackBlocking(int32_t atomTag,
@@ -286,12 +572,17 @@ public:
         return handler;
     }
 
-    void registerCallback(int atomTag, std::shared_ptr<StatsPullAtomCallbackInternal> callback) {
-        auto registerCmd = std::make_unique<Cmd>();
-        registerCmd->type = Cmd::CMD_REGISTER;
-        registerCmd->atomTag = atomTag;
-        registerCmd->callback = std::move(callback);
-        pushToQueue(std::move(registerCmd));
+    void registerCallbacks(const PullerList& pullerList) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            for (const auto& [atomTag, callback] : pullerList) {
+                auto registerCmd = std::make_unique<Cmd>();
+                registerCmd->type = Cmd::CMD_REGISTER;
+                registerCmd->atomTag = atomTag;
+                registerCmd->callback = callback;
+                mCmdQueue.push(std::move(registerCmd));
+            }
+        }
 
         startWorkerThread();
     }
@@ -350,6 +641,9 @@ private:
 
         while (true) {
             std::unique_ptr<Cmd> cmd = nullptr;
+            // Consecutive registrations, such as those of a process setting up its pullers, are
+            // sent to statsd together.
+            PullerList pullerList;
             {
                 /**
                  * To guarantee sequential commands processing we need to lock mutex queue
@@ -362,12 +656,19 @@ private:
 
                 cmd = std::move(mCmdQueue.front());
                 mCmdQueue.pop();
+                if (cmd->type == Cmd::CMD_REGISTER) {
+                    pullerList.emplace_back(cmd->atomTag, std::move(cmd->callback));
+                    while (!mCmdQueue.empty() && mCmdQueue.front()->type == Cmd::CMD_REGISTER) {
+                        pullerList.emplace_back(mCmdQueue.front()->atomTag,
+                                                std::move(mCmdQueue.front()->callback));
+                        mCmdQueue.pop();
+                    }
+                }
             }
 
             switch (cmd->type) {
                 case Cmd::CMD_REGISTER: {
-                    registerStatsPullAtomCallbackBlocking(cmd->atomTag, statsProvider,
-                                                          cmd->callback);
+                    registerStatsPullAtomCallbacksBlocking(pullerList, statsProvider);
                     break;
                 }
                 case Cmd::CMD_UNREGISTER: {
@@ -379,28 +680,65 @@ private:
     }
 };
 
-void AStatsManager_setPullAtomCallback(int32_t atom_tag, AStatsManager_PullAtomMetadata* metadata,
-                                       AStatsManager_PullAtomCallback callback, void* cookie) {
+namespace {
+
+std::shared_ptr<StatsPullAtomCallbackInternal> makePullAtomCallback(
+        const AStatsManager_PullAtomMetadata* metadata, AStatsManager_PullAtomCallback callback,
+        void* cookie) {
     int64_t coolDownMillis =
             metadata == nullptr ? DEFAULT_COOL_DOWN_MILLIS : metadata->cool_down_millis;
     int64_t timeoutMillis = metadata == nullptr ? DEFAULT_TIMEOUT_MILLIS : metadata->timeout_millis;
 
     std::vector<int32_t> additiveFields;
+    std::vector<int32_t> deltaKeyFields;
+    bool supportsAggregation = false;
+    int32_t pullGroup = 0;
     if (metadata != nullptr) {
         additiveFields = metadata->additive_fields;
+        deltaKeyFields = metadata->delta_key_fields;
+        supportsAggregation = metadata->supports_aggregation;
+        pullGroup = metadata->pull_group;
     }
 
-    std::shared_ptr<StatsPullAtomCallbackInternal> callbackBinder =
-            SharedRefBase::make<StatsPullAtomCallbackInternal>(callback, cookie, coolDownMillis,
-                                                               timeoutMillis, additiveFields);
+    return SharedRefBase::make<StatsPullAtomCallbackInternal>(
+            callback, cookie, coolDownMillis, timeoutMillis, additiveFields, deltaKeyFields,
+            supportsAggregation, pullGroup);
+}
 
+void setPullAtomCallbacks(const PullerList& pullerList) {
     {
         std::lock_guard<std::mutex> lock(pullersMutex);
         // Always add to the map. If statsd is dead, we will add them when it comes back.
-        pullers[atom_tag] = callbackBinder;
+        for (const auto& [atomTag, callbackBinder] : pullerList) {
+            pullers[atomTag] = callbackBinder;
+        }
     }
 
-    CallbackOperationsHandler::getInstance().registerCallback(atom_tag, callbackBinder);
+    CallbackOperationsHandler::getInstance().registerCallbacks(pullerList);
+}
+
+}  // namespace
+
+void AStatsManager_setPullAtomCallback(int32_t atom_tag, AStatsManager_PullAtomMetadata* metadata,
+                                       AStatsManager_PullAtomCallback callback, void* cookie) {
+    setPullAtomCallbacks({{atom_tag, makePullAtomCallback(metadata, callback, cookie)}});
+}
+
+void AStatsManager_setPullAtomCallbacks(int32_t num_atoms, const int32_t* atom_tags,
+                                        AStatsManager_PullAtomMetadata* const* metadata,
+                                        AStatsManager_PullAtomCallback callback, void* cookie) {
+    if (num_atoms <= 0) {
+        return;
+    }
+    PullerList pullerList;
+    pullerList.reserve(num_atoms);
+    for (int32_t i = 0; i < num_atoms; i++) {
+        pullerList.emplace_back(
+                atom_tags[i],
+                makePullAtomCallback(metadata == nullptr ? nullptr : metadata[i], callback,
+                                     cookie));
+    }
+    setPullAtomCallbacks(pullerList);
 }
 
 void AStatsManager_clearPullAtomCallback(int32_t atom_tag) {
@@ -18,19 +18,150 @@
 #include <aidl/android/os/IStatsd.h>
 #include <aidl/android/os/StatsSubscriptionCallbackReason.h>
 #include <android/binder_auto_utils.h>
+#include <fcntl.h>
 #include <stats_provider.h>
 #include <stats_subscription.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 using Status = ::ndk::ScopedAStatus;
 using aidl::android::os::BnStatsSubscriptionCallback;
 using aidl::android::os::IStatsd;
 using aidl::android::os::StatsSubscriptionCallbackReason;
+using ::ndk::ScopedFileDescriptor;
 using ::ndk::SharedRefBase;
 
+/**
+ * Shared memory layout of the subscription ring written by statsd.
+ * (*MUST BE IN SYNC WITH StatsRingListener.h in statsd*)
+ *
+ * The ring data follows the header at kStatsRingHeaderSize. Each record is a uint32_t size
+ * followed by a subscription payload, padded to 4 bytes. A record that does not fit before the
+ * end of the ring is preceded by a kStatsRingWrapMarker size, and starts over at offset 0.
+ */
+struct StatsRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t reserved;
+    alignas(64) std::atomic<uint64_t> writePos;
+    std::atomic<uint32_t> producerClosed;
+    alignas(64) std::atomic<uint64_t> readPos;
+    alignas(64) std::atomic<uint32_t> consumerState;
+};
+
+constexpr uint32_t kStatsRingMagic = 0x73726e67;
+constexpr uint32_t kStatsRingVersion = 1;
+constexpr size_t kStatsRingHeaderSize = 256;
+constexpr uint32_t kStatsRingWrapMarker = 0xffffffff;
+constexpr uint32_t kStatsRingConsumerAttached = 1;
+constexpr uint32_t kStatsRingConsumerWaiting = 2;
+
+static_assert(sizeof(StatsRingHeader) <= kStatsRingHeaderSize);
+
+// Holds about a hundred flushes of a busy subscription.
+constexpr uint32_t kSubscriptionRingCapacity = 256 * 1024;
+
+/**
+ * Consumer side of the ring a subscription shares with statsd. statsd writes the payloads of its
+ * periodic flushes to the ring, and only calls onSubscriptionRingData when the consumer waits.
+ */
+class SubscriptionRing {
+public:
+    // Returns null if the ring could not be created, the subscription then only uses binder.
+    static std::unique_ptr<SubscriptionRing> create() {
+#ifdef __ANDROID__
+        const size_t mappedSize = kStatsRingHeaderSize + kSubscriptionRingCapacity;
+        const int memFd = memfd_create("stats_subscription_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memFd < 0) {
+            return nullptr;
+        }
+        // statsd only maps rings that can not shrink under it.
+        void* mapped = MAP_FAILED;
+        if (ftruncate(memFd, mappedSize) == 0 &&
+            fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0) {
+            mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+        }
+        if (mapped == MAP_FAILED) {
+            close(memFd);
+            return nullptr;
+        }
+        // The memfd is zero filled, only the constant fields need to be set.
+        StatsRingHeader* header = static_cast<StatsRingHeader*>(mapped);
+        header->magic = kStatsRingMagic;
+        header->version = kStatsRingVersion;
+        header->capacity = kSubscriptionRingCapacity;
+        // Nothing was read yet, the first record wakes the consumer up.
+        header->consumerState.store(kStatsRingConsumerWaiting);
+        return std::unique_ptr<SubscriptionRing>(new SubscriptionRing(memFd, header, mappedSize));
+#else
+        return nullptr;
+#endif
+    }
+
+    ~SubscriptionRing() {
+        munmap(mHeader, mMappedSize);
+        close(mMemFd);
+    }
+
+    int getFd() const {
+        return mMemFd;
+    }
+
+    // Hands the records to consume in order, in place, then advances the read position.
+    template <typename Consume>
+    void drain(const Consume& consume) {
+        uint8_t* data = reinterpret_cast<uint8_t*>(mHeader) + kStatsRingHeaderSize;
+        uint64_t readPos = mHeader->readPos.load();
+        const uint64_t writePos = mHeader->writePos.load(std::memory_order_acquire);
+        while (readPos < writePos) {
+            const uint64_t offset = readPos & (kSubscriptionRingCapacity - 1);
+            uint32_t size;
+            memcpy(&size, data + offset, sizeof(size));
+            if (size == kStatsRingWrapMarker) {
+                readPos += kSubscriptionRingCapacity - offset;
+                continue;
+            }
+            if (size > kSubscriptionRingCapacity - offset - sizeof(size)) {
+                // Corrupted ring, drop what is left.
+                readPos = writePos;
+                break;
+            }
+            consume(data + offset + sizeof(size), size);
+            readPos += (sizeof(size) + size + 3) & ~uint64_t(3);
+        }
+        mHeader->readPos.store(readPos, std::memory_order_release);
+    }
+
+    // Marks the consumer as waiting. Returns false if records were written meanwhile, the
+    // consumer is then still attached and must drain again.
+    bool wait() {
+        mHeader->consumerState.store(kStatsRingConsumerWaiting);
+        // Pairs with statsd publishing its write position and then checking the state.
+        if (mHeader->writePos.load() == mHeader->readPos.load()) {
+            return true;
+        }
+        mHeader->consumerState.store(kStatsRingConsumerAttached);
+        return false;
+    }
+
+private:
+    SubscriptionRing(int memFd, StatsRingHeader* header, size_t mappedSize)
+        : mMemFd(memFd), mHeader(header), mMappedSize(mappedSize) {
+    }
+
+    const int mMemFd;
+    StatsRingHeader* const mHeader;
+    const size_t mMappedSize;
+};
+
 class Subscription;
 
 // Mutex for accessing subscriptions map.
@@ -47,14 +178,21 @@ public:
         : mSubscriptionId(subscriptionId),
           mSubscriptionParamsBytes(subscriptionConfig),
           mCallback(callback),
-          mCookie(cookie) {
+          mCookie(cookie),
+          mRing(SubscriptionRing::create()) {
     }
 
     Status onSubscriptionData(const StatsSubscriptionCallbackReason reason,
                               const std::vector<uint8_t>& subscriptionPayload) override {
-        std::vector<uint8_t> mutablePayload = subscriptionPayload;
-        mCallback(mSubscriptionId, static_cast<AStatsManager_SubscriptionCallbackReason>(reason),
-                  mutablePayload.data(), mutablePayload.size(), mCookie);
+        {
+            std::lock_guard<std::mutex> lock(mRingMutex);
+            // The ring holds the payloads statsd wrote before this one.
+            drainRingLocked();
+            std::vector<uint8_t> mutablePayload = subscriptionPayload;
+            mCallback(mSubscriptionId,
+                      static_cast<AStatsManager_SubscriptionCallbackReason>(reason),
+                      mutablePayload.data(), mutablePayload.size(), mCookie);
+        }
 
         std::shared_ptr<Subscription> thisSubscription;
         if (reason == StatsSubscriptionCallbackReason::SUBSCRIPTION_ENDED) {
@@ -73,15 +211,46 @@ public:
         return Status::ok();
     }
 
+    Status onSubscriptionRingData() override {
+        std::lock_guard<std::mutex> lock(mRingMutex);
+        do {
+            drainRingLocked();
+        } while (mRing != nullptr && !mRing->wait());
+        return Status::ok();
+    }
+
     const std::vector<uint8_t>& getSubscriptionParamsBytes() const {
         return mSubscriptionParamsBytes;
     }
 
+    // Adds the subscription to statsd, with its ring if it has one.
+    void addTo(const std::shared_ptr<IStatsd>& statsService) {
+        if (mRing == nullptr) {
+            statsService->addSubscription(mSubscriptionParamsBytes, ref<Subscription>());
+            return;
+        }
+        statsService->addRingSubscription(mSubscriptionParamsBytes, ref<Subscription>(),
+                                          ScopedFileDescriptor(dup(mRing->getFd())));
+    }
+
 private:
+    void drainRingLocked() {
+        if (mRing == nullptr) {
+            return;
+        }
+        mRing->drain([this](uint8_t* payload, size_t size) {
+            mCallback(mSubscriptionId, ASTATSMANAGER_SUBSCRIPTION_CALLBACK_REASON_STATSD_INITIATED,
+                      payload, size, mCookie);
+        });
+    }
+
     const int32_t mSubscriptionId;
     const std::vector<uint8_t> mSubscriptionParamsBytes;
     const AStatsManager_SubscriptionCallback mCallback;
     void* mCookie;
+    // Serializes the callbacks, so the ring and binder payloads are delivered in order.
+    std::mutex mRingMutex;
+    const std::unique_ptr<SubscriptionRing> mRing;
 };
 
 // forward declare so it can be referenced in StatsProvider constructor.
@@ -104,7 +273,8 @@ static void onStatsBinderRestart() {
         subscriptionsCopy = subscriptions;
     }
     for (const auto& [_, subscription] : subscriptionsCopy) {
-        statsService->addSubscription(subscription->getSubscriptionParamsBytes(), subscription);
+        // The ring is kept, statsd continues from its write position.
+        subscription->addTo(statsService);
     }
 }
 
@@ -141,7 +311,7 @@ int32_t AStatsManager_addSubscription(const uint8_t* subscription_config, const
     // TODO(b/270648168): Queue the binder call to not block on binder
     const std::shared_ptr<IStatsd> statsService = statsProvider->getStatsService();
     if (statsService != nullptr) {
-        statsService->addSubscription(subscriptionConfig, subscription);
+        subscription->addTo(statsService);
     }
 
     return subscriptionId;
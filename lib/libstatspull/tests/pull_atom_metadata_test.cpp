@@ -69,6 +69,39 @@ TEST(AStatsManager_PullAtomMetadataTest, TestSetAdditiveFields) {
     AStatsManager_PullAtomMetadata_release(metadata);
 }
 
+TEST(AStatsManager_PullAtomMetadataTest, TestSetDeltaKeyFields) {
+    const int numFields = 2;
+    int inputFields[numFields] = {1, 3};
+    AStatsManager_PullAtomMetadata* metadata = AStatsManager_PullAtomMetadata_obtain();
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getNumDeltaKeyFields(metadata), 0);
+    AStatsManager_PullAtomMetadata_setDeltaKeyFields(metadata, inputFields, numFields);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getNumAdditiveFields(metadata), 0);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getNumDeltaKeyFields(metadata), numFields);
+    int outputFields[numFields];
+    AStatsManager_PullAtomMetadata_getDeltaKeyFields(metadata, outputFields);
+    for (int i = 0; i < numFields; i++) {
+        EXPECT_EQ(inputFields[i], outputFields[i]);
+    }
+    AStatsManager_PullAtomMetadata_release(metadata);
+}
+
+TEST(AStatsManager_PullAtomMetadataTest, TestSetSupportsAggregation) {
+    AStatsManager_PullAtomMetadata* metadata = AStatsManager_PullAtomMetadata_obtain();
+    EXPECT_FALSE(AStatsManager_PullAtomMetadata_getSupportsAggregation(metadata));
+    AStatsManager_PullAtomMetadata_setSupportsAggregation(metadata, true);
+    EXPECT_TRUE(AStatsManager_PullAtomMetadata_getSupportsAggregation(metadata));
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getNumDeltaKeyFields(metadata), 0);
+    AStatsManager_PullAtomMetadata_release(metadata);
+}
+
+TEST(AStatsManager_PullAtomMetadataTest, TestSetPullGroup) {
+    AStatsManager_PullAtomMetadata* metadata = AStatsManager_PullAtomMetadata_obtain();
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getPullGroup(metadata), 0);
+    AStatsManager_PullAtomMetadata_setPullGroup(metadata, 3);
+    EXPECT_EQ(AStatsManager_PullAtomMetadata_getPullGroup(metadata), 3);
+    AStatsManager_PullAtomMetadata_release(metadata);
+}
+
 TEST(AStatsManager_PullAtomMetadataTest, TestSetAllElements) {
     int64_t timeoutMillis = 500;
     int64_t coolDownMillis = 10000;
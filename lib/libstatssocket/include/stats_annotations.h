@@ -160,6 +160,15 @@ enum AnnotationIds : uint8_t {
      * Introduced in API 34.
      */
     ASTATSLOG_ANNOTATION_ID_FIELD_RESTRICTION_DEMOGRAPHIC_CLASSIFICATION = 18,
+
+    /**
+     * Annotation ID to indicate that the event stands for this many identical events, as written
+     * by AStatsEvent_writeAggregated. This annotation must only be attached to the atom id. This
+     * is an int annotation, and count metrics count the event that many times.
+     *
+     * Introduced in API 36.
+     */
+    ASTATSLOG_ANNOTATION_ID_EVENT_COUNT = 19,
 };
 
 enum AStatsLogRestrictionCategory : uint32_t {
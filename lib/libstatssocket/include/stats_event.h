@@ -78,11 +78,40 @@ void AStatsEvent_build(AStatsEvent* event);
  * For the system_server the write is done via intermediate queue:
  * - Returns 1 if event was added into the queue, 0 otherwise.
  *
- * After calling this, AStatsEvent_release must be called,
- * and is the only function that can be safely called.
+ * After calling this, AStatsEvent_release or AStatsEvent_reset must be called,
+ * and are the only functions that can be safely called.
  */
 int AStatsEvent_write(AStatsEvent* event);
 
+/**
+ * Writes the StatsEvent to the stats log like AStatsEvent_write, for a counter-style atom that is
+ * logged at a high rate with the same field values. Events that only differ by their timestamp
+ * are held for up to a second, then written as a single event with the timestamp of the first
+ * one and the ASTATSLOG_ANNOTATION_ID_EVENT_COUNT annotation.
+ *
+ * Only count metrics see the number of events, so this should only be used for atoms that are
+ * counted. The event must not already have 15 atom-level annotations.
+ *
+ * Returns 1 if the event is held, and otherwise the same as AStatsEvent_write.
+ *
+ * After calling this, AStatsEvent_release or AStatsEvent_reset must be called,
+ * and are the only functions that can be safely called.
+ */
+int AStatsEvent_writeAggregated(AStatsEvent* event);
+
+/**
+ * Writes the events held by AStatsEvent_writeAggregated without waiting for the end of their
+ * window, such as before the process goes idle.
+ */
+void AStatsEvent_flushAggregated();
+
+/**
+ * Clears the StatsEvent for a new atom, as if it was just returned by AStatsEvent_obtain, with
+ * a new timestamp. The buffer of the StatsEvent is kept, which saves its allocation when the same
+ * thread logs atoms in a loop.
+ */
+void AStatsEvent_reset(AStatsEvent* event);
+
 /**
  * Frees the memory held by this StatsEvent.
  *
@@ -197,12 +226,77 @@ void AStatsEvent_addBoolAnnotation(AStatsEvent* event, uint8_t annotationId, boo
  **/
 void AStatsEvent_addInt32Annotation(AStatsEvent* event, uint8_t annotationId, int32_t value);
 
+/**
+ * Opaque struct holding the precomputed encoding of an atom, for callers that log the same atom
+ * at a high rate. The header, type bytes and annotations are encoded once, and each write only
+ * fills in the field values.
+ *
+ * Usage:
+ *      AStatsEvent* prototype = AStatsEvent_obtain();
+ *      AStatsEvent_setAtomId(prototype, atomId);
+ *      AStatsEvent_writeInt32(prototype, 0);
+ *      AStatsEvent_addBoolAnnotation(prototype, 1, true);
+ *      AStatsEvent_writeInt64(prototype, 0);
+ *      AStatsEventTemplate* eventTemplate = AStatsEventTemplate_create(prototype);
+ *      AStatsEvent_release(prototype);
+ *
+ *      AStatsEventTemplate_setInt32(eventTemplate, 0, 24);
+ *      AStatsEventTemplate_setInt64(eventTemplate, 1, 128);
+ *      AStatsEventTemplate_write(eventTemplate);
+ *
+ *      AStatsEventTemplate_release(eventTemplate);
+ *
+ * A template is not thread safe, concurrent writers must use one template each.
+ */
+struct AStatsEventTemplate;
+typedef struct AStatsEventTemplate AStatsEventTemplate;
+
+/**
+ * Creates a template for the atom written to the prototype, with the same atom id, fields and
+ * annotations. Only int32, int64, float and bool fields can be templated since their encoding
+ * has a fixed size.
+ *
+ * The prototype is built by this call, and can be released right after.
+ *
+ * Returns NULL if the prototype has errors or fields of other types.
+ **/
+AStatsEventTemplate* AStatsEventTemplate_create(AStatsEvent* prototype);
+
+/**
+ * Frees the memory held by this template.
+ **/
+void AStatsEventTemplate_release(AStatsEventTemplate* eventTemplate);
+
+/**
+ * Sets the value of an atom field, indexed from 0 in the order the prototype fields were written.
+ *
+ * Calls with an index out of range or a type that does not match the prototype are ignored.
+ **/
+void AStatsEventTemplate_setInt32(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                  int32_t value);
+void AStatsEventTemplate_setInt64(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                  int64_t value);
+void AStatsEventTemplate_setFloat(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                  float value);
+void AStatsEventTemplate_setBool(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                 bool value);
+
+/**
+ * Timestamps the event with the current time and writes it to the stats log. The field values
+ * are kept, so only the ones that changed need to be set before the next write.
+ *
+ * Returns the same as AStatsEvent_write.
+ **/
+int AStatsEventTemplate_write(AStatsEventTemplate* eventTemplate);
+
 // Internal/test APIs. Should not be exposed outside of the APEX.
 void AStatsEvent_overwriteTimestamp(AStatsEvent* event, uint64_t timestampNs);
 uint32_t AStatsEvent_getAtomId(AStatsEvent* event);
 // Size is an output parameter.
 uint8_t* AStatsEvent_getBuffer(AStatsEvent* event, size_t* size);
 uint32_t AStatsEvent_getErrors(AStatsEvent* event);
+// Size is an output parameter.
+const uint8_t* AStatsEventTemplate_getBuffer(AStatsEventTemplate* eventTemplate, size_t* size);
 
 #ifdef __cplusplus
 }
@@ -22,6 +22,7 @@
 
 #include "stats_buffer_writer_impl.h"
 #include "stats_buffer_writer_queue.h"
+#include "stats_ring_writer.h"
 #include "statsd_writer.h"
 
 static const uint32_t kStatsEventTag = 1937006964;
@@ -56,6 +57,9 @@ int stats_log_is_closed() {
 
 int write_buffer_to_statsd(void* buffer, size_t size, uint32_t atomId) {
     const int kQueueOverflowErrorCode = 1;
+    if (write_buffer_to_statsd_ring((const uint8_t*)buffer, size)) {
+        return size;
+    }
     if (should_write_via_queue(atomId)) {
         const bool ret = write_buffer_to_statsd_queue(buffer, size, atomId);
         if (!ret) {
@@ -85,6 +89,10 @@ int write_buffer_to_statsd_impl(void* buffer, size_t size, uint32_t atomId, bool
     return ret;
 }
 
+int write_vectors_to_statsd_impl(struct iovec* vecs, size_t nr) {
+    return __write_to_statsd(vecs, nr);
+}
+
 static int __write_to_stats_daemon(struct iovec* vec, size_t nr) {
     int save_errno;
     struct timespec ts;
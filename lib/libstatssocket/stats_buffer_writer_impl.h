@@ -23,6 +23,26 @@
 
 __BEGIN_DECLS
 
+/**
+ * Tag of the datagrams that carry several atoms, each one prefixed with its uint32_t size.
+ * MUST BE IN SYNC with StatsSocketListener in statsd.
+ */
+#define STATS_EVENT_BATCH_TAG 0x73746274
+
+/**
+ * Tag of the datagram registering a shared memory ring, sent with the ring memfd and eventfd.
+ * MUST BE IN SYNC with StatsSocketListener in statsd.
+ */
+#define STATS_RING_REGISTRATION_TAG 0x73747267
+
+struct iovec;
+
 int write_buffer_to_statsd_impl(void* buffer, size_t size, uint32_t atomId, bool doNoteDrop);
 
+/**
+ * Writes the vectors as a single datagram. The caller provides the payload tag.
+ * Returns the number of bytes written or -errno.
+ */
+int write_vectors_to_statsd_impl(struct iovec* vecs, size_t nr);
+
 __END_DECLS
@@ -17,17 +17,19 @@
 #include "stats_buffer_writer_queue.h"
 
 #include <private/android_filesystem_config.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <chrono>
-#include <queue>
 #include <thread>
 
 #include "stats_buffer_writer_impl.h"
 #include "stats_buffer_writer_queue_impl.h"
+#include "stats_ring_writer.h"
 #include "utils.h"
 
-BufferWriterQueue::BufferWriterQueue() : mWorkThread(&BufferWriterQueue::processCommands, this) {
+BufferWriterQueue::BufferWriterQueue(bool batchWrites)
+    : mBatchWrites(batchWrites), mWorkThread(&BufferWriterQueue::processCommands, this) {
 }
 
 BufferWriterQueue::~BufferWriterQueue() {
@@ -58,7 +60,7 @@ bool BufferWriterQueue::pushToQueue(const Cmd& cmd) {
             // error code
             return false;
         }
-        mCmdQueue.push(cmd);
+        mCmdQueue.push_back(cmd);
     }
     mCondition.notify_one();
     return true;
@@ -91,39 +93,78 @@ void BufferWriterQueue::drainQueue() {
     std::unique_lock<std::mutex> lock(mMutex);
     while (!mCmdQueue.empty()) {
         free(mCmdQueue.front().buffer);
-        mCmdQueue.pop();
+        mCmdQueue.pop_front();
+    }
+}
+
+void BufferWriterQueue::collectBatchLocked(std::vector<Cmd>* batch) const {
+    size_t payloadBytes = sizeof(uint32_t);  // batch tag
+    for (const Cmd& cmd : mCmdQueue) {
+        if (cmd.buffer == NULL || batch->size() >= (size_t)kMaxBatchAtoms) {
+            break;
+        }
+        const size_t atomBytes = sizeof(uint32_t) + cmd.size;
+        if (!batch->empty() && payloadBytes + atomBytes > kMaxBatchPayloadBytes) {
+            break;
+        }
+        batch->push_back(cmd);
+        payloadBytes += atomBytes;
     }
 }
 
 void BufferWriterQueue::processCommands() {
+    // temporary local thread copy of the commands to send
+    std::vector<Cmd> batch;
     while (true) {
-        // temporary local thread copy
-        Cmd cmd;
+        batch.clear();
         {
             std::unique_lock<std::mutex> lock(mMutex);
             if (mCmdQueue.empty()) {
                 mCondition.wait(lock, [this] { return !this->mCmdQueue.empty(); });
             }
-            cmd = mCmdQueue.front();
         }
 
-        if (cmd.buffer == NULL) {
+        // statsd would drop the atoms, buffer them instead until it catches up. They are still
+        // dropped if the queue overflows meanwhile.
+        if (!mDoTerminate && isStatsdCongested()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(kDelayOnCongestionMs));
+            continue;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mBatchWrites) {
+                // give the batch a bounded amount of time to fill up
+                mCondition.wait_for(lock, std::chrono::microseconds(kBatchFlushDelayUs), [this] {
+                    return this->mDoTerminate ||
+                           this->mCmdQueue.size() >= (size_t)kMaxBatchAtoms;
+                });
+                collectBatchLocked(&batch);
+            } else if (mCmdQueue.front().buffer != NULL) {
+                batch.push_back(mCmdQueue.front());
+            }
+        }
+
+        if (batch.empty()) {
             // null buffer ptr used as a marker of the termination request
             return;
         }
 
-        const bool writeSuccess = handleCommand(cmd);
+        const bool writeSuccess = batch.size() == 1 ? handleCommand(batch.front())
+                                                    : handleBatch(batch);
         if (writeSuccess) {
-            // no event drop is observed otherwise command remains in the queue
+            // no event drop is observed otherwise commands remain in the queue
             // and worker thread will try to log later on
 
             // call free() explicitly here to free memory before the mutex lock
-            free(cmd.buffer);
+            for (const Cmd& cmd : batch) {
+                free(cmd.buffer);
+            }
             {
                 std::unique_lock<std::mutex> lock(mMutex);
-                // this will lead to Cmd destructor call which will be no-op since now the
-                // buffer is NULL
-                mCmdQueue.pop();
+                // the sent commands are still at the front of the queue, the worker thread is
+                // the only one removing commands
+                mCmdQueue.erase(mCmdQueue.begin(), mCmdQueue.begin() + batch.size());
             }
         }
         // TODO (b/258003151): add logging info about retry count
@@ -146,8 +187,29 @@ bool BufferWriterQueue::handleCommand(const Cmd& cmd) const {
     return write_buffer_to_statsd_impl(cmd.buffer, cmd.size, cmd.atomId, /*doNoteDrop*/ false) > 0;
 }
 
+bool BufferWriterQueue::isStatsdCongested() const {
+    return is_statsd_congested();
+}
+
+bool BufferWriterQueue::handleBatch(const std::vector<Cmd>& cmds) const {
+    // format: |batch tag|size of atom 1|atom 1|size of atom 2|atom 2|...
+    const uint32_t tag = STATS_EVENT_BATCH_TAG;
+    std::vector<uint32_t> sizes(cmds.size());
+    std::vector<struct iovec> vecs;
+    vecs.reserve(1 + 2 * cmds.size());
+    vecs.push_back({(void*)&tag, sizeof(tag)});
+    for (size_t i = 0; i < cmds.size(); i++) {
+        sizes[i] = cmds[i].size;
+        vecs.push_back({&sizes[i], sizeof(uint32_t)});
+        vecs.push_back({cmds[i].buffer, (size_t)cmds[i].size});
+    }
+    // as for single atoms, a failed batch remains in the queue and is retried without noting
+    // drops
+    return write_vectors_to_statsd_impl(vecs.data(), vecs.size()) > 0;
+}
+
 bool write_buffer_to_statsd_queue(const uint8_t* buffer, size_t size, uint32_t atomId) {
-    static BufferWriterQueue queue;
+    static BufferWriterQueue queue(/*batchWrites*/ true);
     return queue.write(buffer, size, atomId);
 }
 
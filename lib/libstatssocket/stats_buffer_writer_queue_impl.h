@@ -19,15 +19,33 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <queue>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 class BufferWriterQueue {
 public:
     constexpr static int kDelayOnFailedWriteMs = 5;
+
+    // How long the worker thread holds the queued atoms back before checking again whether
+    // statsd is still congested.
+    constexpr static int kDelayOnCongestionMs = 5;
     constexpr static int kQueueMaxSizeLimit = 4800;  // 2X max_dgram_qlen
 
-    BufferWriterQueue();
+    // Limits of a batch of atoms sent as one datagram. The payload limit is the socket's
+    // LOGGER_ENTRY_MAX_PAYLOAD.
+    constexpr static int kMaxBatchAtoms = 64;
+    constexpr static size_t kMaxBatchPayloadBytes = 4068;
+
+    // How long the worker thread waits for a batch to fill before sending it.
+    constexpr static int kBatchFlushDelayUs = 1000;
+
+    // With batchWrites, atoms queued together are coalesced into batch datagrams that statsd
+    // unpacks, instead of being sent one write per atom.
+    explicit BufferWriterQueue(bool batchWrites = false);
     virtual ~BufferWriterQueue();
 
     bool write(const uint8_t* buffer, size_t size, uint32_t atomId);
@@ -44,11 +62,18 @@ public:
 
     virtual bool handleCommand(const Cmd& cmd) const;
 
+    // Sends two or more atoms in one batch datagram.
+    virtual bool handleBatch(const std::vector<Cmd>& cmds) const;
+
+    // Whether statsd asks for the atoms to be held back.
+    virtual bool isStatsdCongested() const;
+
 private:
     std::condition_variable mCondition;
     mutable std::mutex mMutex;
-    std::queue<Cmd> mCmdQueue;
+    std::deque<Cmd> mCmdQueue;
     std::atomic_bool mDoTerminate = false;
+    const bool mBatchWrites;
     std::thread mWorkThread;
 
     static Cmd createWriteBufferCmd(const uint8_t* buffer, size_t size, uint32_t atomId);
@@ -58,4 +83,7 @@ private:
     void terminate();
 
     void processCommands();
+
+    // Copies the commands at the front of the queue that fit in one batch. mMutex must be held.
+    void collectBatchLocked(std::vector<Cmd>* batch) const;
 };
@@ -16,10 +16,12 @@
 
 #include "include/stats_event.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "stats_buffer_writer.h"
+#include "stats_event_aggregator.h"
 #include "utils.h"
 
 #define LOGGER_ENTRY_MAX_PAYLOAD 4068
@@ -29,6 +31,9 @@
 
 #define MAX_PULL_EVENT_PAYLOAD (50 * 1024)  // 50 KB
 
+// Released events kept by each thread to be obtained again.
+#define MAX_CACHED_EVENTS 4
+
 /* POSITIONS */
 #define POS_NUM_ELEMENTS 1
 #define POS_TIMESTAMP (POS_NUM_ELEMENTS + sizeof(uint8_t))
@@ -83,26 +88,94 @@ struct AStatsEvent {
     size_t bufSize;
 };
 
-AStatsEvent* AStatsEvent_obtain() {
-    AStatsEvent* event = malloc(sizeof(AStatsEvent));
+// Events released with a buffer of the default size, reused by AStatsEvent_obtain on the same
+// thread. This saves the allocation of the buffer, which is only ever written before being read
+// so it does not need to be zeroed either.
+struct EventCache {
+    AStatsEvent* events[MAX_CACHED_EVENTS];
+    size_t count;
+};
+
+static pthread_key_t sEventCacheKey;
+static pthread_once_t sEventCacheKeyOnce = PTHREAD_ONCE_INIT;
+static bool sEventCacheKeyCreated = false;
+
+static void free_event(AStatsEvent* event) {
+    free(event->buf);
+    free(event);
+}
+
+// Called on thread exit.
+static void free_event_cache(void* value) {
+    struct EventCache* cache = (struct EventCache*)value;
+    for (size_t i = 0; i < cache->count; i++) {
+        free_event(cache->events[i]);
+    }
+    free(cache);
+}
+
+static void create_event_cache_key() {
+    sEventCacheKeyCreated = pthread_key_create(&sEventCacheKey, free_event_cache) == 0;
+}
+
+// Returns NULL if the thread has no cache and create is false, or on failure.
+static struct EventCache* get_event_cache(bool create) {
+    pthread_once(&sEventCacheKeyOnce, create_event_cache_key);
+    if (!sEventCacheKeyCreated) {
+        return NULL;
+    }
+    struct EventCache* cache = (struct EventCache*)pthread_getspecific(sEventCacheKey);
+    if (cache == NULL && create) {
+        cache = (struct EventCache*)calloc(1, sizeof(struct EventCache));
+        if (cache != NULL && pthread_setspecific(sEventCacheKey, cache) != 0) {
+            free(cache);
+            cache = NULL;
+        }
+    }
+    return cache;
+}
+
+static void init_event(AStatsEvent* event) {
     event->lastFieldPos = 0;
     event->numBytesWritten = 2;  // reserve first 2 bytes for root event type and number of elements
     event->numElements = 0;
     event->atomId = 0;
     event->errors = 0;
     event->built = false;
-    event->bufSize = MAX_PUSH_EVENT_PAYLOAD;
-    event->buf = (uint8_t*)calloc(event->bufSize, 1);
 
     event->buf[0] = OBJECT_TYPE;
+    event->buf[POS_NUM_ELEMENTS] = 0;
     AStatsEvent_writeInt64(event, get_elapsed_realtime_ns());  // write the timestamp
+}
 
+AStatsEvent* AStatsEvent_obtain() {
+    AStatsEvent* event;
+    struct EventCache* cache = get_event_cache(false /* create */);
+    if (cache != NULL && cache->count > 0) {
+        event = cache->events[--cache->count];
+    } else {
+        event = malloc(sizeof(AStatsEvent));
+        event->bufSize = MAX_PUSH_EVENT_PAYLOAD;
+        event->buf = (uint8_t*)malloc(event->bufSize);
+    }
+    init_event(event);
     return event;
 }
 
+void AStatsEvent_reset(AStatsEvent* event) {
+    init_event(event);
+}
+
 void AStatsEvent_release(AStatsEvent* event) {
-    free(event->buf);
-    free(event);
+    // Events grown for a large pulled atom are not worth keeping around.
+    if (event->bufSize == MAX_PUSH_EVENT_PAYLOAD) {
+        struct EventCache* cache = get_event_cache(true /* create */);
+        if (cache != NULL && cache->count < MAX_CACHED_EVENTS) {
+            cache->events[cache->count++] = event;
+            return;
+        }
+    }
+    free_event(event);
 }
 
 void AStatsEvent_setAtomId(AStatsEvent* event, uint32_t atomId) {
@@ -416,3 +489,135 @@ int AStatsEvent_write(AStatsEvent* event) {
     build_internal(event, true /* push */);
     return write_buffer_to_statsd(event->buf, event->numBytesWritten, event->atomId);
 }
+
+int AStatsEvent_writeAggregated(AStatsEvent* event) {
+    build_internal(event, true /* push */);
+    return write_buffer_to_statsd_aggregated(event->buf, event->numBytesWritten, event->atomId);
+}
+
+void AStatsEvent_flushAggregated() {
+    flush_aggregated_events_to_statsd();
+}
+
+// Location and type of a field value within the template buffer.
+struct AStatsEventTemplateSlot {
+    uint16_t offset;
+    uint8_t typeId;
+};
+
+struct AStatsEventTemplate {
+    uint8_t* buf;
+    size_t size;
+    uint32_t atomId;
+    size_t numFields;
+    struct AStatsEventTemplateSlot slots[];
+};
+
+// Returns the encoded size of a fixed size value, or 0 for the other types.
+static size_t fixed_value_size(uint8_t typeId) {
+    switch (typeId) {
+        case INT32_TYPE:
+        case FLOAT_TYPE:
+            return sizeof(int32_t);
+        case INT64_TYPE:
+            return sizeof(int64_t);
+        case BOOL_TYPE:
+            return sizeof(uint8_t);
+        default:
+            return 0;
+    }
+}
+
+AStatsEventTemplate* AStatsEventTemplate_create(AStatsEvent* prototype) {
+    build_internal(prototype, true /* push */);
+    if (prototype->errors) {
+        return NULL;
+    }
+
+    const uint8_t* buf = prototype->buf;
+    const size_t size = prototype->numBytesWritten;
+    // The first 2 elements are the timestamp and the atom id.
+    const size_t numFields = prototype->numElements - 2;
+    const size_t slotsSize = numFields * sizeof(struct AStatsEventTemplateSlot);
+    AStatsEventTemplate* eventTemplate = malloc(sizeof(AStatsEventTemplate) + slotsSize);
+    eventTemplate->numFields = numFields;
+
+    // Walk the encoding to find where each field value lives.
+    size_t pos = POS_TIMESTAMP;
+    for (uint32_t i = 0; i < prototype->numElements; i++) {
+        const uint8_t typeId = buf[pos] & 0x0F;
+        const uint8_t numAnnotations = (buf[pos] & 0xF0) >> 4;
+        const size_t valueSize = fixed_value_size(typeId);
+        if (valueSize == 0) {
+            free(eventTemplate);
+            return NULL;
+        }
+        pos += sizeof(uint8_t);
+        if (i >= 2) {
+            eventTemplate->slots[i - 2].offset = pos;
+            eventTemplate->slots[i - 2].typeId = typeId;
+        }
+        pos += valueSize;
+        // Each annotation is its id, type and value.
+        for (uint8_t j = 0; j < numAnnotations; j++) {
+            pos += 2 * sizeof(uint8_t) + fixed_value_size(buf[pos + 1]);
+        }
+    }
+
+    eventTemplate->buf = malloc(size);
+    memcpy(eventTemplate->buf, buf, size);
+    eventTemplate->size = size;
+    eventTemplate->atomId = prototype->atomId;
+    return eventTemplate;
+}
+
+void AStatsEventTemplate_release(AStatsEventTemplate* eventTemplate) {
+    free(eventTemplate->buf);
+    free(eventTemplate);
+}
+
+// Returns where the value of the field goes, or NULL if the field does not have this type.
+static uint8_t* template_slot(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                              uint8_t typeId) {
+    if (fieldIndex >= eventTemplate->numFields ||
+        eventTemplate->slots[fieldIndex].typeId != typeId) {
+        return NULL;
+    }
+    return &eventTemplate->buf[eventTemplate->slots[fieldIndex].offset];
+}
+
+void AStatsEventTemplate_setInt32(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                  int32_t value) {
+    uint8_t* slot = template_slot(eventTemplate, fieldIndex, INT32_TYPE);
+    if (slot) memcpy(slot, &value, sizeof(value));
+}
+
+void AStatsEventTemplate_setInt64(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                  int64_t value) {
+    uint8_t* slot = template_slot(eventTemplate, fieldIndex, INT64_TYPE);
+    if (slot) memcpy(slot, &value, sizeof(value));
+}
+
+void AStatsEventTemplate_setFloat(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                  float value) {
+    uint8_t* slot = template_slot(eventTemplate, fieldIndex, FLOAT_TYPE);
+    if (slot) memcpy(slot, &value, sizeof(value));
+}
+
+void AStatsEventTemplate_setBool(AStatsEventTemplate* eventTemplate, size_t fieldIndex,
+                                 bool value) {
+    uint8_t* slot = template_slot(eventTemplate, fieldIndex, BOOL_TYPE);
+    if (slot) *slot = (uint8_t)value;
+}
+
+const uint8_t* AStatsEventTemplate_getBuffer(AStatsEventTemplate* eventTemplate, size_t* size) {
+    if (size) *size = eventTemplate->size;
+    return eventTemplate->buf;
+}
+
+int AStatsEventTemplate_write(AStatsEventTemplate* eventTemplate) {
+    const int64_t timestampNs = get_elapsed_realtime_ns();
+    memcpy(&eventTemplate->buf[POS_TIMESTAMP + sizeof(uint8_t)], &timestampNs,
+           sizeof(timestampNs));
+    return write_buffer_to_statsd(eventTemplate->buf, eventTemplate->size, eventTemplate->atomId);
+}
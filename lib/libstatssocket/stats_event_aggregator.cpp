@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats_event_aggregator.h"
+
+#include <stats_annotations.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "include/stats_buffer_writer.h"
+#include "stats_event_aggregator_impl.h"
+
+namespace {
+
+// Layout of the start of an event, see stats_event.c.
+constexpr size_t kPosTimestampValue = 3;
+constexpr size_t kPosAtomIdTypeInfo = kPosTimestampValue + sizeof(int64_t);
+constexpr size_t kPosAtomLevelAnnotations = kPosAtomIdTypeInfo + 1 + sizeof(uint32_t);
+constexpr uint8_t kInt32TypeId = 0x00;
+constexpr uint8_t kMaxAnnotationCount = 15;
+// LOGGER_ENTRY_MAX_PAYLOAD less the stats event tag.
+constexpr size_t kMaxPushEventPayload = 4068 - 4;
+
+// id, type and value of the count annotation
+constexpr size_t kCountAnnotationSize = 2 + sizeof(int32_t);
+
+}  // namespace
+
+EventAggregator::EventAggregator() : mWorkThread(&EventAggregator::processFlushes, this) {
+}
+
+EventAggregator::~EventAggregator() {
+    terminate();
+    flush();
+}
+
+bool EventAggregator::add(const uint8_t* buffer, size_t size, uint32_t atomId) {
+    if (size < kPosAtomLevelAnnotations || size + kCountAnnotationSize > kMaxPushEventPayload ||
+        (buffer[kPosAtomIdTypeInfo] >> 4) == kMaxAnnotationCount) {
+        return false;
+    }
+    int64_t timestampNs;
+    memcpy(&timestampNs, &buffer[kPosTimestampValue], sizeof(timestampNs));
+    std::string body((const char*)buffer, size);
+    memset(&body[kPosTimestampValue], 0, sizeof(int64_t));
+
+    AggregatedEvents fullEvents;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto [it, inserted] =
+                mEvents.try_emplace(std::move(body), AggregatedEvent{timestampNs, atomId, 0});
+        it->second.count++;
+        if (mEvents.size() >= kMaxDistinctEvents) {
+            mEvents.swap(fullEvents);
+        } else if (inserted && mEvents.size() == 1) {
+            // starts the window
+            mCondition.notify_one();
+        }
+    }
+    writeEvents(fullEvents);
+    return true;
+}
+
+void EventAggregator::flush() {
+    AggregatedEvents events;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mEvents.swap(events);
+    }
+    writeEvents(events);
+}
+
+size_t EventAggregator::getDistinctEventCount() const {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mEvents.size();
+}
+
+std::vector<uint8_t> EventAggregator::encodeEvent(const std::string& body, int64_t timestampNs,
+                                                  int32_t count) {
+    std::vector<uint8_t> event(body.begin(), body.end());
+    memcpy(&event[kPosTimestampValue], &timestampNs, sizeof(timestampNs));
+    if (count > 1) {
+        // The count is an atom-level annotation, which follows the atom id.
+        event[kPosAtomIdTypeInfo] += 1 << 4;
+        const uint8_t annotation[kCountAnnotationSize] = {ASTATSLOG_ANNOTATION_ID_EVENT_COUNT,
+                                                          kInt32TypeId};
+        auto annotationIt = event.insert(event.begin() + kPosAtomLevelAnnotations, annotation,
+                                         annotation + kCountAnnotationSize);
+        memcpy(&*(annotationIt + 2), &count, sizeof(count));
+    }
+    return event;
+}
+
+void EventAggregator::writeEvent(const uint8_t* buffer, size_t size, uint32_t atomId) const {
+    write_buffer_to_statsd((void*)buffer, size, atomId);
+}
+
+void EventAggregator::terminate() {
+    if (mWorkThread.joinable()) {
+        mDoTerminate = true;
+        mCondition.notify_one();
+        mWorkThread.join();
+    }
+}
+
+void EventAggregator::processFlushes() {
+    while (true) {
+        AggregatedEvents events;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this] { return mDoTerminate || !mEvents.empty(); });
+            mCondition.wait_for(lock, std::chrono::milliseconds(kWindowMs),
+                                [this] { return mDoTerminate.load(); });
+            if (mDoTerminate) {
+                // the remaining events are flushed by the destructor
+                return;
+            }
+            mEvents.swap(events);
+        }
+        writeEvents(events);
+    }
+}
+
+void EventAggregator::writeEvents(const AggregatedEvents& events) const {
+    for (const auto& [body, event] : events) {
+        const std::vector<uint8_t> buffer = encodeEvent(body, event.timestampNs, event.count);
+        writeEvent(buffer.data(), buffer.size(), event.atomId);
+    }
+}
+
+static EventAggregator& getEventAggregator() {
+    static EventAggregator aggregator;
+    return aggregator;
+}
+
+int write_buffer_to_statsd_aggregated(const uint8_t* buffer, size_t size, uint32_t atomId) {
+    if (getEventAggregator().add(buffer, size, atomId)) {
+        return 1;
+    }
+    return write_buffer_to_statsd((void*)buffer, size, atomId);
+}
+
+void flush_aggregated_events_to_statsd() {
+    getEventAggregator().flush();
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Sums identical events over a short window, and writes each distinct event once with the
+ * ASTATSLOG_ANNOTATION_ID_EVENT_COUNT annotation. Events are identical if their encodings only
+ * differ by their timestamp, and are written with the timestamp of the first one.
+ */
+class EventAggregator {
+public:
+    // How long the events are held, from the first event added since the last flush.
+    constexpr static int kWindowMs = 1000;
+
+    // Distinct events held at once. Adding the last one flushes all of them early.
+    constexpr static size_t kMaxDistinctEvents = 128;
+
+    EventAggregator();
+    virtual ~EventAggregator();
+
+    // Returns false, without holding the event, if it cannot carry the count annotation.
+    bool add(const uint8_t* buffer, size_t size, uint32_t atomId);
+
+    void flush();
+
+    size_t getDistinctEventCount() const;
+
+    // Returns the encoding of the event standing for count events identical to the event which
+    // encoding is body once timestamped with timestampNs.
+    static std::vector<uint8_t> encodeEvent(const std::string& body, int64_t timestampNs,
+                                            int32_t count);
+
+    virtual void writeEvent(const uint8_t* buffer, size_t size, uint32_t atomId) const;
+
+private:
+    struct AggregatedEvent {
+        int64_t timestampNs;
+        uint32_t atomId;
+        int32_t count;
+    };
+
+    // Keyed by the encoding of the events with a zero timestamp.
+    using AggregatedEvents = std::unordered_map<std::string, AggregatedEvent>;
+
+    std::condition_variable mCondition;
+    mutable std::mutex mMutex;
+    AggregatedEvents mEvents;
+    std::atomic_bool mDoTerminate = false;
+    std::thread mWorkThread;
+
+    void terminate();
+
+    // Flushes the events once the window of the first one ends.
+    void processFlushes();
+
+    void writeEvents(const AggregatedEvents& events) const;
+};
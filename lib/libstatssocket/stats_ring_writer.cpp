@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats_ring_writer.h"
+
+#include <fcntl.h>
+#include <private/android_filesystem_config.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "stats_buffer_writer_impl.h"
+#include "stats_ring_writer_impl.h"
+#include "statsd_writer.h"
+#include "utils.h"
+
+namespace {
+
+// Atoms larger than a datagram payload (LOGGER_ENTRY_MAX_PAYLOAD) are left to the socket.
+constexpr size_t kMaxRecordPayloadBytes = 4068;
+
+// A process replacing its ring more often than this gives up on the ring transport.
+constexpr int kMaxRingsCreated = 4;
+
+constexpr uint64_t alignRecord(uint64_t size) {
+    return (size + 3) & ~uint64_t(3);
+}
+
+}  // namespace
+
+StatsRingWriter::~StatsRingWriter() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    releaseRingLocked(/*closeRing*/ mPid == getpid());
+}
+
+bool StatsRingWriter::write(const uint8_t* buffer, size_t size, int64_t nowNs) {
+    if (size > kMaxRecordPayloadBytes) {
+        return false;
+    }
+    // Most processes are not trusted, they skip the lock once disabled. A forked child goes
+    // through the checks again.
+    if (mDisabledPid.load(std::memory_order_relaxed) == getpid()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!updateStateLocked(nowNs)) {
+        return false;
+    }
+    if (checkCongestedLocked(nowNs)) {
+        // Trusted processes write via the queue, which holds the atom until statsd catches up.
+        return false;
+    }
+    if (writeRecordLocked(buffer, size)) {
+        mFullSinceNs = 0;
+        return true;
+    }
+    if (mFullSinceNs == 0) {
+        mFullSinceNs = nowNs;
+    } else if (nowNs - mFullSinceNs >= kStalledRingTimeoutNs) {
+        releaseRingLocked(/*closeRing*/ true);
+        mState = STATE_UNINITIALIZED;
+    }
+    return false;
+}
+
+bool StatsRingWriter::isConsumerCongested(int64_t nowNs) {
+    if (mDisabledPid.load(std::memory_order_relaxed) == getpid()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPid == getpid() && mState == STATE_ATTACHED &&
+           mHeader->consumerState.load() != kStatsRingConsumerDetached &&
+           checkCongestedLocked(nowNs);
+}
+
+bool StatsRingWriter::checkCongestedLocked(int64_t nowNs) {
+    if (mHeader->consumerCongested.load(std::memory_order_relaxed) == 0) {
+        mCongestedSinceNs = 0;
+        return false;
+    }
+    if (mCongestedSinceNs == 0) {
+        mCongestedSinceNs = nowNs;
+    } else if (nowNs - mCongestedSinceNs >= kStalledRingTimeoutNs) {
+        // statsd may have died congested, the flag would never be cleared.
+        releaseRingLocked(/*closeRing*/ true);
+        mState = STATE_UNINITIALIZED;
+        return false;
+    }
+    return true;
+}
+
+bool StatsRingWriter::sendRegistration(int memFd, int eventFd) {
+    const uint32_t tag = STATS_RING_REGISTRATION_TAG;
+    const int fds[] = {memFd, eventFd};
+    return statsd_writer_send_fds(&tag, sizeof(tag), fds, 2) > 0;
+}
+
+bool StatsRingWriter::isTrustedProcess() const {
+    return getuid() == AID_SYSTEM;
+}
+
+bool StatsRingWriter::updateStateLocked(int64_t nowNs) {
+    const pid_t pid = getpid();
+    if (mPid != pid) {
+        // First write, or forked child: the ring belongs to the parent.
+        releaseRingLocked(/*closeRing*/ false);
+        mState = STATE_UNINITIALIZED;
+        mRingsCreated = 0;
+        mPid = pid;
+    }
+    switch (mState) {
+        case STATE_UNINITIALIZED:
+            if (!isTrustedProcess() || mRingsCreated >= kMaxRingsCreated ||
+                !createRingLocked()) {
+                mState = STATE_DISABLED;
+                mDisabledPid = pid;
+                return false;
+            }
+            mRingsCreated++;
+            mState = STATE_REGISTERING;
+            [[fallthrough]];
+        case STATE_REGISTERING:
+            if (mHeader->consumerState.load() != kStatsRingConsumerDetached) {
+                mState = STATE_ATTACHED;
+                return true;
+            }
+            if (mFirstRegistrationNs != 0 && nowNs - mFirstRegistrationNs >= kAttachTimeoutNs) {
+                // statsd does not use rings, keep using the socket only.
+                releaseRingLocked(/*closeRing*/ false);
+                mState = STATE_DISABLED;
+                mDisabledPid = pid;
+                return false;
+            }
+            if (mLastRegistrationNs == 0 || nowNs - mLastRegistrationNs >= kRegistrationRetryNs) {
+                if (sendRegistration(mMemFd.get(), mEventFd.get())) {
+                    if (mFirstRegistrationNs == 0) {
+                        mFirstRegistrationNs = nowNs;
+                    }
+                    mLastRegistrationNs = nowNs;
+                }
+            }
+            return false;
+        case STATE_ATTACHED:
+            if (mHeader->consumerState.load() == kStatsRingConsumerDetached) {
+                // statsd dropped the ring, register a new one.
+                releaseRingLocked(/*closeRing*/ false);
+                mState = STATE_UNINITIALIZED;
+                return false;
+            }
+            return true;
+        case STATE_DISABLED:
+            return false;
+    }
+    return false;
+}
+
+bool StatsRingWriter::createRingLocked() {
+#ifdef __ANDROID__
+    const size_t mappedSize = kStatsRingHeaderSize + kRingCapacity;
+    android::base::unique_fd memFd(memfd_create("statsd_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    android::base::unique_fd eventFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (memFd < 0 || eventFd < 0 || ftruncate(memFd.get(), mappedSize) != 0) {
+        return false;
+    }
+    // statsd only maps rings that can not shrink under it.
+    if (fcntl(memFd.get(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        return false;
+    }
+    void* mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd.get(), 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    // The memfd is zero filled, only the constant fields need to be set.
+    mHeader = static_cast<StatsRingHeader*>(mapped);
+    mHeader->magic = kStatsRingMagic;
+    mHeader->version = kStatsRingVersion;
+    mHeader->capacity = kRingCapacity;
+    mMappedSize = mappedSize;
+    mMemFd = std::move(memFd);
+    mEventFd = std::move(eventFd);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void StatsRingWriter::releaseRingLocked(bool closeRing) {
+    if (mHeader != nullptr) {
+        if (closeRing) {
+            mHeader->producerClosed.store(1);
+        }
+        munmap(mHeader, mMappedSize);
+        mHeader = nullptr;
+    }
+    mMemFd.reset();
+    mEventFd.reset();
+    mFirstRegistrationNs = 0;
+    mLastRegistrationNs = 0;
+    mFullSinceNs = 0;
+    mCongestedSinceNs = 0;
+}
+
+bool StatsRingWriter::writeRecordLocked(const uint8_t* buffer, size_t size) {
+    const uint64_t capacity = kRingCapacity;
+    uint8_t* data = reinterpret_cast<uint8_t*>(mHeader) + kStatsRingHeaderSize;
+    const uint32_t recordPayloadSize = size;
+    const uint64_t recordSize = alignRecord(sizeof(recordPayloadSize) + size);
+
+    uint64_t writePos = mHeader->writePos.load(std::memory_order_relaxed);
+    const uint64_t readPos = mHeader->readPos.load(std::memory_order_acquire);
+    // Positions are multiples of 4, so there is always room for the wrap marker.
+    const uint64_t contiguous = capacity - (writePos & (capacity - 1));
+    const uint64_t needed = recordSize > contiguous ? contiguous + recordSize : recordSize;
+    if (writePos - readPos + needed > capacity) {
+        return false;
+    }
+    if (recordSize > contiguous) {
+        const uint32_t marker = kStatsRingWrapMarker;
+        memcpy(data + (writePos & (capacity - 1)), &marker, sizeof(marker));
+        writePos += contiguous;
+    }
+    uint8_t* record = data + (writePos & (capacity - 1));
+    memcpy(record, &recordPayloadSize, sizeof(recordPayloadSize));
+    memcpy(record + sizeof(recordPayloadSize), buffer, size);
+
+    // Pairs with statsd marking itself as waiting and then reading the write position, at least
+    // one of the two sides sees the other's update.
+    mHeader->writePos.store(writePos + recordSize);
+    uint32_t expected = kStatsRingConsumerWaiting;
+    if (mHeader->consumerState.load() == kStatsRingConsumerWaiting &&
+        mHeader->consumerState.compare_exchange_strong(expected, kStatsRingConsumerAttached)) {
+        const uint64_t one = 1;
+        TEMP_FAILURE_RETRY(::write(mEventFd.get(), &one, sizeof(one)));
+    }
+    return true;
+}
+
+static StatsRingWriter& getRingWriter() {
+    static StatsRingWriter ringWriter;
+    return ringWriter;
+}
+
+bool write_buffer_to_statsd_ring(const uint8_t* buffer, size_t size) {
+    return getRingWriter().write(buffer, size, get_elapsed_realtime_ns());
+}
+
+bool is_statsd_congested() {
+    return getRingWriter().isConsumerCongested(get_elapsed_realtime_ns());
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/**
+ * Writes the atom to the shared memory ring of the process, set up with statsd on first use.
+ * Returns false if the atom must be written to the socket instead: the ring is not attached
+ * yet, is full, or the process is not trusted to use a ring.
+ */
+bool write_buffer_to_statsd_ring(const uint8_t* buffer, size_t size);
+
+/**
+ * Returns true while statsd signals on the ring of the process that its event queue is
+ * congested. Atoms written meanwhile are better held back than sent to be dropped.
+ */
+bool is_statsd_congested();
+
+__END_DECLS
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <mutex>
+
+/**
+ * Shared memory layout of the ring drained by statsd.
+ * (*MUST BE IN SYNC WITH StatsRingListener.h in statsd*)
+ *
+ * The ring data follows the header at kStatsRingHeaderSize. Each record is a uint32_t size
+ * followed by the atom, padded to 4 bytes. A record that does not fit before the end of the
+ * ring is preceded by a kStatsRingWrapMarker size, and starts over at offset 0.
+ */
+struct StatsRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t reserved;
+    alignas(64) std::atomic<uint64_t> writePos;
+    std::atomic<uint32_t> producerClosed;
+    alignas(64) std::atomic<uint64_t> readPos;
+    alignas(64) std::atomic<uint32_t> consumerState;
+    std::atomic<uint32_t> consumerCongested;
+};
+
+constexpr uint32_t kStatsRingMagic = 0x73726e67;
+constexpr uint32_t kStatsRingVersion = 1;
+constexpr size_t kStatsRingHeaderSize = 256;
+constexpr uint32_t kStatsRingWrapMarker = 0xffffffff;
+constexpr uint32_t kStatsRingConsumerDetached = 0;
+constexpr uint32_t kStatsRingConsumerAttached = 1;
+constexpr uint32_t kStatsRingConsumerWaiting = 2;
+
+static_assert(sizeof(StatsRingHeader) <= kStatsRingHeaderSize);
+
+/**
+ * Writes the atoms of a trusted process to a shared memory ring that statsd maps, instead of
+ * sending one datagram per atom. statsd is only signaled when it went idle on an empty ring.
+ */
+class StatsRingWriter {
+public:
+    constexpr static uint32_t kRingCapacity = 256 * 1024;
+
+    // Registration is sent again on this period until statsd attaches the ring, and given up
+    // after kAttachTimeoutNs.
+    constexpr static int64_t kRegistrationRetryNs = 1000000000LL;
+    constexpr static int64_t kAttachTimeoutNs = 10 * kRegistrationRetryNs;
+
+    // A ring that stays full or congested this long is considered abandoned by statsd, e.g.
+    // after a restart, and is replaced by a new one.
+    constexpr static int64_t kStalledRingTimeoutNs = 5 * kRegistrationRetryNs;
+
+    StatsRingWriter() = default;
+    virtual ~StatsRingWriter();
+
+    // Returns false if the atom must be written to the socket instead.
+    bool write(const uint8_t* buffer, size_t size, int64_t nowNs);
+
+    // Whether statsd attached the ring and asks its producers to hold their atoms back.
+    bool isConsumerCongested(int64_t nowNs);
+
+    // Sends the ring fds to statsd. Returns false if the socket is not open yet.
+    virtual bool sendRegistration(int memFd, int eventFd);
+
+    // Whether this process may write to a ring.
+    virtual bool isTrustedProcess() const;
+
+private:
+    enum State {
+        STATE_UNINITIALIZED,
+        STATE_REGISTERING,
+        STATE_ATTACHED,
+        STATE_DISABLED,
+    };
+
+    std::mutex mMutex;
+    State mState = STATE_UNINITIALIZED;
+    android::base::unique_fd mMemFd;
+    android::base::unique_fd mEventFd;
+    StatsRingHeader* mHeader = nullptr;
+    size_t mMappedSize = 0;
+    // Process owning the state: a forked child must not write to its parent's ring.
+    pid_t mPid = 0;
+    std::atomic<pid_t> mDisabledPid = 0;
+    int mRingsCreated = 0;
+    int64_t mFirstRegistrationNs = 0;
+    int64_t mLastRegistrationNs = 0;
+    int64_t mFullSinceNs = 0;
+    int64_t mCongestedSinceNs = 0;
+
+    bool createRingLocked();
+
+    // Unmaps the ring. With closeRing, statsd drops the ring once it is drained.
+    void releaseRingLocked(bool closeRing);
+
+    // Returns true if the ring is attached.
+    bool updateStateLocked(int64_t nowNs);
+
+    bool writeRecordLocked(const uint8_t* buffer, size_t size);
+
+    // Returns true if statsd signals the attached ring as congested.
+    bool checkCongestedLocked(int64_t nowNs);
+};
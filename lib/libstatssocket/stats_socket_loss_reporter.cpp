@@ -54,25 +54,10 @@ void StatsSocketLossReporter::noteDrop(int32_t error, int32_t atomId) {
 
     if (atomId == STATS_SOCKET_LOSS_REPORTED) {
         // avoid self counting due to write to socket might fail during dumpAtomsLossStats()
-        // also due to mutex is not re-entrant and is already locked by dumpAtomsLossStats() API,
-        // return to avoid deadlock
-        // alternative is to consider std::recursive_mutex
         return;
     }
 
-    std::unique_lock<std::mutex> lock(mMutex);
-
-    // using unordered_map is more CPU efficient vs vectors, however will require some
-    // postprocessing before writing into the socket
-    const LossInfoKey key = std::make_pair(error, atomId);
-    auto counterIt = mLossInfo.find(key);
-    if (counterIt != mLossInfo.end()) {
-        ++counterIt->second;
-    } else if (mLossInfo.size() < kMaxAtomTagsCount) {
-        mLossInfo[key] = 1;
-    } else {
-        mOverflowCounter++;
-    }
+    mLossInfo.noteLoss(error, atomId);
 }
 
 void StatsSocketLossReporter::dumpAtomsLossStats(bool forceDump) {
@@ -88,37 +73,24 @@ void StatsSocketLossReporter::dumpAtomsLossStats(bool forceDump) {
         return;
     }
 
-    // intention to hold mutex here during the stats_write() to avoid data copy overhead
-    std::unique_lock<std::mutex> lock(mMutex);
-    if (mLossInfo.size() == 0) {
+    // Losses noted while the snapshot is written are left in the table for the next dump, as
+    // are the pairs beyond the atom guardrail.
+    const StatsSocketLossTable::Snapshot snapshot = mLossInfo.takeSnapshot(kMaxAtomTagsCount);
+    if (snapshot.empty()) {
         return;
     }
 
-    // populate temp vectors to be written into the socket
-    std::vector<int> errors(mLossInfo.size());
-    std::vector<int> tags(mLossInfo.size());
-    std::vector<int> counts(mLossInfo.size());
-
-    auto lossInfoIt = mLossInfo.begin();
-    for (size_t i = 0; i < mLossInfo.size(); i++, lossInfoIt++) {
-        const LossInfoKey& key = lossInfoIt->first;
-        errors[i] = key.first;
-        tags[i] = key.second;
-        counts[i] = lossInfoIt->second;
-    }
-
     // below call might lead to socket loss event - intention is to avoid self counting
     const int ret = stats_write(STATS_SOCKET_LOSS_REPORTED, mUid, mFirstTsNanos, mLastTsNanos,
-                                mOverflowCounter, errors, tags, counts);
+                                snapshot.overflowCount, snapshot.errors, snapshot.tags,
+                                snapshot.counts);
     if (ret > 0) {
-        // Otherwise, in case of failure we preserve all socket loss information between dumps.
-        // When above write failed - the socket loss stats are not discarded
-        // and would be re-send during next attempt.
-        mOverflowCounter = 0;
-        mLossInfo.clear();
-
         mFirstTsNanos.store(0, std::memory_order_relaxed);
         mLastTsNanos.store(0, std::memory_order_relaxed);
+    } else {
+        // When above write failed - the socket loss stats are not discarded
+        // and would be re-send during next attempt.
+        mLossInfo.restoreSnapshot(snapshot);
     }
     // since the delay before next attempt is significantly larger than this API call
     // duration it is ok to have correctness of timestamp in a range of 10us
@@ -20,8 +20,8 @@
 #include <stdint.h>
 
 #include <atomic>
-#include <thread>
-#include <unordered_map>
+
+#include "stats_socket_loss_table.h"
 
 class StatsSocketLossReporter {
 public:
@@ -60,24 +60,7 @@ private:
 
     const int64_t kCoolDownTimerDurationNanos = 10 * 1000 * 1000;  // 10ms
 
-    struct HashPair final {
-        template <class TFirst, class TSecond>
-        size_t operator()(const std::pair<TFirst, TSecond>& p) const noexcept {
-            uintmax_t hash = std::hash<TFirst>{}(p.first);
-            hash <<= sizeof(uintmax_t) * 4;
-            hash ^= std::hash<TSecond>{}(p.second);
-            return std::hash<uintmax_t>{}(hash);
-        }
-    };
-
-    // guards access to below mLossInfo
-    mutable std::mutex mMutex;
-
-    using LossInfoKey = std::pair<int, int>;  // [error, tag]
-
-    // Represents loss info as a counter per [error, tag] pair
-    std::unordered_map<LossInfoKey, int, HashPair> mLossInfo;
-
-    // tracks guardrail kMaxAtomTagsCount hit count
-    int32_t mOverflowCounter = 0;
+    // Represents loss info as a counter per [error, tag] pair. It is lock-free since it is
+    // updated on the path of writes which are already failing under load.
+    StatsSocketLossTable mLossInfo;
 };
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats_socket_loss_table.h"
+
+namespace {
+
+constexpr size_t kIndexMask = StatsSocketLossTable::kCapacity - 1;
+static_assert((StatsSocketLossTable::kCapacity & kIndexMask) == 0,
+              "capacity must be a power of 2");
+
+uint64_t toKey(int32_t error, int32_t tag) {
+    return (uint64_t)(uint32_t)error << 32 | (uint32_t)tag;
+}
+
+size_t toIndex(uint64_t key) {
+    // Fibonacci hashing spreads the tags, which are often consecutive, over the table.
+    return (key * 0x9e3779b97f4a7c15ull) >> 56 & kIndexMask;
+}
+
+}  // namespace
+
+StatsSocketLossTable::StatsSocketLossTable() {
+    for (Slot& slot : mSlots) {
+        slot.key.store(kEmptyKey, std::memory_order_relaxed);
+        slot.count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void StatsSocketLossTable::noteLoss(int32_t error, int32_t tag) {
+    const uint64_t key = toKey(error, tag);
+    const size_t start = toIndex(key);
+    for (size_t i = 0; i < kMaxProbes; i++) {
+        Slot& slot = mSlots[(start + i) & kIndexMask];
+        uint64_t slotKey = slot.key.load(std::memory_order_acquire);
+        if (slotKey == kEmptyKey &&
+            slot.key.compare_exchange_strong(slotKey, key, std::memory_order_acq_rel)) {
+            slotKey = key;
+        }
+        // A failed claim leaves the key that won the slot in slotKey, which may be this one.
+        if (slotKey == key) {
+            slot.count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    mOverflowCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+StatsSocketLossTable::Snapshot StatsSocketLossTable::takeSnapshot(size_t maxPairs) {
+    Snapshot snapshot;
+    for (Slot& slot : mSlots) {
+        if (snapshot.counts.size() == maxPairs) {
+            break;
+        }
+        const uint64_t key = slot.key.load(std::memory_order_acquire);
+        if (key == kEmptyKey) {
+            continue;
+        }
+        const int32_t count = slot.count.exchange(0, std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        snapshot.errors.push_back((int32_t)(key >> 32));
+        snapshot.tags.push_back((int32_t)(uint32_t)key);
+        snapshot.counts.push_back(count);
+    }
+    snapshot.overflowCount = mOverflowCount.exchange(0, std::memory_order_relaxed);
+    return snapshot;
+}
+
+void StatsSocketLossTable::restoreSnapshot(const Snapshot& snapshot) {
+    for (size_t i = 0; i < snapshot.counts.size(); i++) {
+        const uint64_t key = toKey(snapshot.errors[i], snapshot.tags[i]);
+        const size_t start = toIndex(key);
+        // The slot of a pair is never released, so it is still found on its probe sequence.
+        for (size_t j = 0; j < kMaxProbes; j++) {
+            Slot& slot = mSlots[(start + j) & kIndexMask];
+            if (slot.key.load(std::memory_order_acquire) == key) {
+                slot.count.fetch_add(snapshot.counts[i], std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+    mOverflowCount.fetch_add(snapshot.overflowCount, std::memory_order_relaxed);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief Lock-free counters of socket losses per [error, tag] pair.
+ *
+ * The counters live in a fixed open-addressing table, whose slots are claimed by the first loss
+ * of their pair and are never released, so that writers only need atomic operations. Losses of
+ * pairs that find no slot within kMaxProbes of their hash are counted by an overflow counter
+ * instead, which bounds the cost of a loss once the table is full.
+ */
+class StatsSocketLossTable {
+public:
+    static constexpr size_t kCapacity = 256;
+    static constexpr size_t kMaxProbes = 16;
+
+    struct Snapshot {
+        std::vector<int> errors;
+        std::vector<int> tags;
+        std::vector<int> counts;
+        int32_t overflowCount = 0;
+
+        bool empty() const {
+            return counts.empty() && overflowCount == 0;
+        }
+    };
+
+    StatsSocketLossTable();
+
+    // Safe to call from any number of threads, including during takeSnapshot().
+    void noteLoss(int32_t error, int32_t tag);
+
+    /**
+     * @brief Moves the counts of up to maxPairs pairs and the overflow count into a snapshot,
+     * resetting them to 0. Counts of the remaining pairs stay in the table.
+     */
+    Snapshot takeSnapshot(size_t maxPairs);
+
+    /**
+     * @brief Adds the counts of a snapshot back, such as when it could not be reported.
+     */
+    void restoreSnapshot(const Snapshot& snapshot);
+
+private:
+    // Keys pack the error in the high half and the tag in the low half. Atom tags are positive,
+    // so kEmptyKey is never the key of a loss.
+    static constexpr uint64_t kEmptyKey = UINT64_MAX;
+
+    struct Slot {
+        std::atomic_uint64_t key;
+        std::atomic_int32_t count;
+    };
+
+    Slot mSlots[kCapacity];
+
+    std::atomic_int32_t mOverflowCount = 0;
+};
@@ -20,6 +20,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
 #include <stdarg.h>
 #include <stdatomic.h>
@@ -90,6 +91,27 @@ struct android_log_transport_write statsdLoggerWrite = {
         .isClosed = statsdIsClosed,
 };
 
+// Processes of the system uids write to a socket of their own, so that app bursts do not fill up
+// the socket they write to. It is only served when statsd enables it, writers fall back to the
+// default socket otherwise.
+// (*MUST BE IN SYNC WITH StatsSocketListener::getSocketName() in statsd*)
+static const char kDefaultSocketPath[] = "/dev/socket/statsdw";
+static const char kSystemSocketPath[] = "/dev/socket/statsdw_system";
+
+static int connectToStatsd(int sock) {
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(struct sockaddr_un));
+    un.sun_family = AF_UNIX;
+    if (getuid() % AID_USER_OFFSET < AID_APP_START) {
+        strcpy(un.sun_path, kSystemSocketPath);
+        if (TEMP_FAILURE_RETRY(connect(sock, (struct sockaddr*)&un, sizeof(un))) == 0) {
+            return 0;
+        }
+    }
+    strcpy(un.sun_path, kDefaultSocketPath);
+    return TEMP_FAILURE_RETRY(connect(sock, (struct sockaddr*)&un, sizeof(un)));
+}
+
 /* log_init_lock assumed */
 static int statsdOpen() {
     int i, ret = 0;
@@ -112,13 +134,8 @@ static int statsdOpen() {
             // SO_RCVBUF does not have an effect on unix domain socket, but SO_SNDBUF does.
             // Proceed to connect even setsockopt fails.
             setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, bufLen);
-            struct sockaddr_un un;
-            memset(&un, 0, sizeof(struct sockaddr_un));
-            un.sun_family = AF_UNIX;
-            strcpy(un.sun_path, "/dev/socket/statsdw");
 
-            if (TEMP_FAILURE_RETRY(
-                        connect(sock, (struct sockaddr*)&un, sizeof(struct sockaddr_un))) < 0) {
+            if (connectToStatsd(sock) < 0) {
                 ret = -errno;
                 switch (ret) {
                     case -ENOTCONN:
@@ -156,7 +173,7 @@ static void statsdClose() {
 
 static int statsdAvailable() {
     if (atomic_load(&statsdLoggerWrite.sock) < 0) {
-        if (access("/dev/socket/statsdw", W_OK) == 0) {
+        if (access(kDefaultSocketPath, W_OK) == 0) {
             return 0;
         }
         return -EBADF;
@@ -313,3 +330,53 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
 
     return ret;
 }
+
+int statsd_writer_send_fds(const void* payload, size_t size, const int* fds, size_t fdCount) {
+    static const size_t kMaxFds = 4;
+    if (fdCount == 0 || fdCount > kMaxFds) {
+        return -EINVAL;
+    }
+    const int sock = atomic_load(&statsdLoggerWrite.sock);
+    if (sock < 0) {
+        return -EBADF;
+    }
+
+    android_log_header_t header;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.id = LOG_ID_STATS;
+    header.tid = android::base::GetThreadId();
+    header.realtime.tv_sec = ts.tv_sec;
+    header.realtime.tv_nsec = ts.tv_nsec;
+
+    struct iovec vecs[2];
+    vecs[0].iov_base = &header;
+    vecs[0].iov_len = sizeof(header);
+    vecs[1].iov_base = const_cast<void*>(payload);
+    vecs[1].iov_len = size;
+
+    union {
+        char buf[CMSG_SPACE(kMaxFds * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vecs;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(fdCount * sizeof(int));
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fdCount * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, fdCount * sizeof(int));
+
+    ssize_t ret = TEMP_FAILURE_RETRY(sendmsg(sock, &msg, MSG_NOSIGNAL));
+    if (ret < 0) {
+        return -errno;
+    }
+    return ret > (ssize_t)sizeof(header) ? ret - sizeof(header) : 0;
+}
@@ -46,6 +46,13 @@ struct android_log_transport_write {
     int (*isClosed)();
 };
 
+/**
+ * Sends the payload with the file descriptors over the statsd socket, in one datagram.
+ * Returns the number of payload bytes sent, or -errno. The socket must have been opened by a
+ * previous write.
+ */
+int statsd_writer_send_fds(const void* payload, size_t size, const int* fds, size_t fdCount);
+
 __END_DECLS
 
 #endif  // ANDROID_STATS_LOG_STATS_WRITER_H
@@ -46,6 +46,29 @@ public:
 
 typedef StrictMock<BasicBufferWriterQueueMock> BufferWriterQueueMock;
 
+class BasicBatchingBufferWriterQueueMock : public BufferWriterQueue {
+public:
+    BasicBatchingBufferWriterQueueMock() : BufferWriterQueue(/*batchWrites*/ true) {
+    }
+    MOCK_METHOD(bool, handleCommand, (const BasicBatchingBufferWriterQueueMock::Cmd& cmd),
+                (const override));
+    MOCK_METHOD(bool, handleBatch,
+                (const std::vector<BasicBatchingBufferWriterQueueMock::Cmd>& cmds),
+                (const override));
+};
+
+typedef StrictMock<BasicBatchingBufferWriterQueueMock> BatchingBufferWriterQueueMock;
+
+class BasicCongestedBufferWriterQueueMock : public BufferWriterQueue {
+public:
+    BasicCongestedBufferWriterQueueMock() = default;
+    MOCK_METHOD(bool, handleCommand, (const BasicCongestedBufferWriterQueueMock::Cmd& cmd),
+                (const override));
+    MOCK_METHOD(bool, isStatsdCongested, (), (const override));
+};
+
+typedef StrictMock<BasicCongestedBufferWriterQueueMock> CongestedBufferWriterQueueMock;
+
 TEST(StatsBufferWriterQueueTest, TestWriteSuccess) {
     AStatsEvent* event = generateTestEvent();
 
@@ -128,6 +151,91 @@ TEST(StatsBufferWriterQueueTest, TestSleepOnOverflow) {
     }
 }
 
+TEST(StatsBufferWriterQueueTest, TestBatchWrites) {
+    AStatsEvent* event = generateTestEvent();
+
+    size_t eventBufferSize = 0;
+    const uint8_t* buffer = AStatsEvent_getBuffer(event, &eventBufferSize);
+    EXPECT_TRUE(buffer != nullptr);
+
+    const uint32_t atomId = AStatsEvent_getAtomId(event);
+
+    std::atomic_int sentAtoms = 0;
+    BatchingBufferWriterQueueMock queue;
+    EXPECT_CALL(queue, handleCommand(_)).WillRepeatedly([&sentAtoms](const auto&) {
+        sentAtoms++;
+        return true;
+    });
+    EXPECT_CALL(queue, handleBatch(_)).WillRepeatedly([&sentAtoms](const auto& cmds) {
+        EXPECT_LE(cmds.size(), (size_t)BatchingBufferWriterQueueMock::kMaxBatchAtoms);
+        sentAtoms += cmds.size();
+        return true;
+    });
+
+    const int atomCount = BatchingBufferWriterQueueMock::kMaxBatchAtoms * 3;
+    for (int i = 0; i < atomCount; i++) {
+        EXPECT_TRUE(queue.write(buffer, eventBufferSize, atomId));
+    }
+    AStatsEvent_release(event);
+
+    // to yeld to the queue worker thread
+    std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_MS));
+    EXPECT_EQ(atomCount, sentAtoms.load());
+    EXPECT_EQ(queue.getQueueSize(), 0);
+}
+
+TEST(StatsBufferWriterQueueTest, TestBatchWriteFailureRetried) {
+    AStatsEvent* event = generateTestEvent();
+
+    size_t eventBufferSize = 0;
+    const uint8_t* buffer = AStatsEvent_getBuffer(event, &eventBufferSize);
+    EXPECT_TRUE(buffer != nullptr);
+
+    const uint32_t atomId = AStatsEvent_getAtomId(event);
+
+    BatchingBufferWriterQueueMock queue;
+    // the worker thread may send a single atom before the others are queued
+    EXPECT_CALL(queue, handleCommand(_)).WillRepeatedly(Return(false));
+    EXPECT_CALL(queue, handleBatch(_)).WillRepeatedly(Return(false));
+    for (int i = 0; i < BatchingBufferWriterQueueMock::kMaxBatchAtoms; i++) {
+        EXPECT_TRUE(queue.write(buffer, eventBufferSize, atomId));
+    }
+    AStatsEvent_release(event);
+
+    // to yeld to the queue worker thread
+    std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_MS));
+    // failed batches remain in the queue
+    EXPECT_EQ(queue.getQueueSize(), BatchingBufferWriterQueueMock::kMaxBatchAtoms);
+}
+
+TEST(StatsBufferWriterQueueTest, TestHoldWhileStatsdCongested) {
+    AStatsEvent* event = generateTestEvent();
+
+    size_t eventBufferSize = 0;
+    const uint8_t* buffer = AStatsEvent_getBuffer(event, &eventBufferSize);
+    EXPECT_TRUE(buffer != nullptr);
+
+    const uint32_t atomId = AStatsEvent_getAtomId(event);
+
+    std::atomic_bool congested = true;
+    CongestedBufferWriterQueueMock queue;
+    EXPECT_CALL(queue, isStatsdCongested()).WillRepeatedly([&congested] {
+        return congested.load();
+    });
+    EXPECT_CALL(queue, handleCommand(_)).WillOnce(Return(true));
+    EXPECT_TRUE(queue.write(buffer, eventBufferSize, atomId));
+    AStatsEvent_release(event);
+
+    // to yeld to the queue worker thread
+    std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_MS));
+    // the atom is held back without attempting to write it
+    EXPECT_EQ(queue.getQueueSize(), 1);
+
+    congested = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_MS));
+    EXPECT_EQ(queue.getQueueSize(), 0);
+}
+
 TEST(StatsBufferWriterQueueTest, TestTerminateNonEmptyQueue) {
     AStatsEvent* event = generateTestEvent();
 
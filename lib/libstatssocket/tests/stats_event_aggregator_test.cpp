@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stats_annotations.h>
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "stats_event.h"
+#include "stats_event_aggregator_impl.h"
+
+namespace {
+
+struct WrittenEvent {
+    std::vector<uint8_t> buffer;
+    uint32_t atomId;
+};
+
+class RecordingEventAggregator : public EventAggregator {
+public:
+    ~RecordingEventAggregator() override {
+        flush();
+    }
+
+    void writeEvent(const uint8_t* buffer, size_t size, uint32_t atomId) const override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWritten.push_back({std::vector<uint8_t>(buffer, buffer + size), atomId});
+    }
+
+    std::vector<WrittenEvent> getWritten() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mWritten;
+    }
+
+private:
+    mutable std::mutex mMutex;
+    mutable std::vector<WrittenEvent> mWritten;
+};
+
+// Adds an event of atom 100 with value to aggregator.
+bool addTestEvent(EventAggregator* aggregator, int32_t value, uint64_t timestampNs) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_overwriteTimestamp(event, timestampNs);
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, value);
+    AStatsEvent_build(event);
+    size_t size;
+    const uint8_t* buffer = AStatsEvent_getBuffer(event, &size);
+    const bool added = aggregator->add(buffer, size, 100);
+    AStatsEvent_release(event);
+    return added;
+}
+
+// The encoding of the event of atom 100 with value, with count annotation if count > 1.
+std::vector<uint8_t> getExpectedEvent(int32_t value, uint64_t timestampNs, int32_t count) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_overwriteTimestamp(event, timestampNs);
+    AStatsEvent_setAtomId(event, 100);
+    if (count > 1) {
+        AStatsEvent_addInt32Annotation(event, ASTATSLOG_ANNOTATION_ID_EVENT_COUNT, count);
+    }
+    AStatsEvent_writeInt32(event, value);
+    AStatsEvent_build(event);
+    size_t size;
+    const uint8_t* buffer = AStatsEvent_getBuffer(event, &size);
+    std::vector<uint8_t> expected(buffer, buffer + size);
+    AStatsEvent_release(event);
+    return expected;
+}
+
+}  // namespace
+
+TEST(EventAggregatorTest, TestIdenticalEventsWrittenOnceWithCount) {
+    RecordingEventAggregator aggregator;
+    EXPECT_TRUE(addTestEvent(&aggregator, 5, 1000));
+    EXPECT_TRUE(addTestEvent(&aggregator, 5, 2000));
+    EXPECT_TRUE(addTestEvent(&aggregator, 5, 3000));
+    EXPECT_TRUE(addTestEvent(&aggregator, 6, 4000));
+    EXPECT_EQ(2u, aggregator.getDistinctEventCount());
+
+    aggregator.flush();
+    EXPECT_EQ(0u, aggregator.getDistinctEventCount());
+
+    std::vector<WrittenEvent> written = aggregator.getWritten();
+    ASSERT_EQ(2u, written.size());
+    if (written[0].buffer.size() < written[1].buffer.size()) {
+        std::swap(written[0], written[1]);
+    }
+    EXPECT_EQ(100u, written[0].atomId);
+    EXPECT_EQ(getExpectedEvent(5, 1000, 3), written[0].buffer);
+    EXPECT_EQ(100u, written[1].atomId);
+    EXPECT_EQ(getExpectedEvent(6, 4000, 1), written[1].buffer);
+}
+
+TEST(EventAggregatorTest, TestFlushAtEndOfWindow) {
+    RecordingEventAggregator aggregator;
+    EXPECT_TRUE(addTestEvent(&aggregator, 5, 1000));
+    EXPECT_TRUE(addTestEvent(&aggregator, 5, 2000));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(EventAggregator::kWindowMs + 200));
+    const std::vector<WrittenEvent> written = aggregator.getWritten();
+    ASSERT_EQ(1u, written.size());
+    EXPECT_EQ(getExpectedEvent(5, 1000, 2), written[0].buffer);
+}
+
+TEST(EventAggregatorTest, TestFlushWhenFull) {
+    RecordingEventAggregator aggregator;
+    for (size_t i = 0; i < EventAggregator::kMaxDistinctEvents; i++) {
+        EXPECT_TRUE(addTestEvent(&aggregator, i, 1000));
+    }
+
+    EXPECT_EQ(0u, aggregator.getDistinctEventCount());
+    EXPECT_EQ(EventAggregator::kMaxDistinctEvents, aggregator.getWritten().size());
+}
+
+TEST(EventAggregatorTest, TestEventWithTooManyAnnotationsNotAdded) {
+    RecordingEventAggregator aggregator;
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    for (int i = 0; i < 15; i++) {
+        AStatsEvent_addBoolAnnotation(event, ASTATSLOG_ANNOTATION_ID_TRUNCATE_TIMESTAMP, true);
+    }
+    AStatsEvent_writeInt32(event, 5);
+    AStatsEvent_build(event);
+    size_t size;
+    const uint8_t* buffer = AStatsEvent_getBuffer(event, &size);
+
+    EXPECT_FALSE(aggregator.add(buffer, size, 100));
+    EXPECT_EQ(0u, aggregator.getDistinctEventCount());
+    AStatsEvent_release(event);
+}
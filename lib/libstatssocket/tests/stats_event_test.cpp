@@ -669,6 +669,65 @@ TEST(StatsEventTest, TestOverwriteTimestamp) {
     AStatsEvent_release(event);
 }
 
+TEST(StatsEventTest, TestReleasedEventReused) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt64(event, 0x1234);
+    AStatsEvent_build(event);
+    AStatsEvent_release(event);
+
+    uint32_t atomId = 101;
+    int32_t int32Value = -12;
+    int64_t startTime = android::elapsedRealtimeNano();
+    AStatsEvent* reused = AStatsEvent_obtain();
+    EXPECT_EQ(event, reused);
+    AStatsEvent_setAtomId(reused, atomId);
+    AStatsEvent_writeInt32(reused, int32Value);
+    AStatsEvent_build(reused);
+    int64_t endTime = android::elapsedRealtimeNano();
+
+    size_t bufferSize;
+    uint8_t* buffer = AStatsEvent_getBuffer(reused, &bufferSize);
+    uint8_t* bufferEnd = buffer + bufferSize;
+
+    checkMetadata(&buffer, /*numElements=*/1, startTime, endTime, atomId);
+    checkTypeHeader(&buffer, INT32_TYPE);
+    checkScalar(&buffer, int32Value);
+
+    EXPECT_EQ(buffer, bufferEnd);  // ensure that we have read the entire buffer
+    EXPECT_EQ(AStatsEvent_getErrors(reused), 0);
+    AStatsEvent_release(reused);
+}
+
+TEST(StatsEventTest, TestReset) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeString(event, "a string discarded by the reset");
+    AStatsEvent_addBoolAnnotation(event, 1, true);
+    AStatsEvent_build(event);
+
+    uint32_t atomId = 101;
+    bool boolValue = true;
+    int64_t startTime = android::elapsedRealtimeNano();
+    AStatsEvent_reset(event);
+    AStatsEvent_setAtomId(event, atomId);
+    AStatsEvent_writeBool(event, boolValue);
+    AStatsEvent_build(event);
+    int64_t endTime = android::elapsedRealtimeNano();
+
+    size_t bufferSize;
+    uint8_t* buffer = AStatsEvent_getBuffer(event, &bufferSize);
+    uint8_t* bufferEnd = buffer + bufferSize;
+
+    checkMetadata(&buffer, /*numElements=*/1, startTime, endTime, atomId);
+    checkTypeHeader(&buffer, BOOL_TYPE);
+    checkScalar(&buffer, boolValue);
+
+    EXPECT_EQ(buffer, bufferEnd);  // ensure that we have read the entire buffer
+    EXPECT_EQ(AStatsEvent_getErrors(event), 0);
+    AStatsEvent_release(event);
+}
+
 TEST(StatsEventTest, TestAttributionChainTooLongError) {
     uint32_t atomId = 100;
     uint8_t numNodes = 128;
@@ -708,3 +767,67 @@ TEST(StatsEventTest, TestListTooLongError) {
     uint32_t errors = AStatsEvent_getErrors(event);
     EXPECT_EQ(errors & ERROR_LIST_TOO_LONG, ERROR_LIST_TOO_LONG);
 }
+
+TEST(StatsEventTest, TestTemplateMatchesEncoding) {
+    uint32_t atomId = 100;
+    int64_t timestamp = 0x123456789;
+
+    AStatsEvent* prototype = AStatsEvent_obtain();
+    AStatsEvent_overwriteTimestamp(prototype, timestamp);
+    AStatsEvent_setAtomId(prototype, atomId);
+    AStatsEvent_addBoolAnnotation(prototype, 5, true);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEvent_addBoolAnnotation(prototype, 1, true);
+    AStatsEvent_addInt32Annotation(prototype, 2, 128);
+    AStatsEvent_writeInt64(prototype, 0);
+    AStatsEvent_writeFloat(prototype, 0);
+    AStatsEvent_writeBool(prototype, false);
+    AStatsEventTemplate* eventTemplate = AStatsEventTemplate_create(prototype);
+    AStatsEvent_release(prototype);
+    ASSERT_NE(eventTemplate, nullptr);
+
+    AStatsEventTemplate_setInt32(eventTemplate, 0, -24);
+    AStatsEventTemplate_setInt64(eventTemplate, 1, 0x7FFFFFFFFFFF);
+    AStatsEventTemplate_setFloat(eventTemplate, 2, 2.5);
+    AStatsEventTemplate_setBool(eventTemplate, 3, true);
+    // Ignored: wrong type and index out of range.
+    AStatsEventTemplate_setInt64(eventTemplate, 0, 1);
+    AStatsEventTemplate_setInt32(eventTemplate, 4, 1);
+
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_overwriteTimestamp(event, timestamp);
+    AStatsEvent_setAtomId(event, atomId);
+    AStatsEvent_addBoolAnnotation(event, 5, true);
+    AStatsEvent_writeInt32(event, -24);
+    AStatsEvent_addBoolAnnotation(event, 1, true);
+    AStatsEvent_addInt32Annotation(event, 2, 128);
+    AStatsEvent_writeInt64(event, 0x7FFFFFFFFFFF);
+    AStatsEvent_writeFloat(event, 2.5);
+    AStatsEvent_writeBool(event, true);
+    AStatsEvent_build(event);
+
+    size_t expectedSize;
+    const uint8_t* expected = AStatsEvent_getBuffer(event, &expectedSize);
+    size_t templateSize;
+    const uint8_t* templateBuffer = AStatsEventTemplate_getBuffer(eventTemplate, &templateSize);
+    EXPECT_EQ(vector<uint8_t>(expected, expected + expectedSize),
+              vector<uint8_t>(templateBuffer, templateBuffer + templateSize));
+
+    AStatsEvent_release(event);
+    AStatsEventTemplate_release(eventTemplate);
+}
+
+TEST(StatsEventTest, TestTemplateUnsupportedFields) {
+    AStatsEvent* prototype = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(prototype, 100);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEvent_writeString(prototype, "variable size");
+    EXPECT_EQ(AStatsEventTemplate_create(prototype), nullptr);
+    AStatsEvent_release(prototype);
+
+    // No atom id.
+    prototype = AStatsEvent_obtain();
+    AStatsEvent_writeInt32(prototype, 0);
+    EXPECT_EQ(AStatsEventTemplate_create(prototype), nullptr);
+    AStatsEvent_release(prototype);
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats_socket_loss_table.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+int getCount(const StatsSocketLossTable::Snapshot& snapshot, int error, int tag) {
+    for (size_t i = 0; i < snapshot.counts.size(); i++) {
+        if (snapshot.errors[i] == error && snapshot.tags[i] == tag) {
+            return snapshot.counts[i];
+        }
+    }
+    return 0;
+}
+
+}  // namespace
+
+TEST(StatsSocketLossTableTest, TestSnapshotResetsCounts) {
+    StatsSocketLossTable table;
+    table.noteLoss(-EAGAIN, 10);
+    table.noteLoss(-EAGAIN, 10);
+    table.noteLoss(-EBADF, 10);
+    table.noteLoss(-EAGAIN, 11);
+
+    StatsSocketLossTable::Snapshot snapshot = table.takeSnapshot(100);
+    ASSERT_EQ(3u, snapshot.counts.size());
+    EXPECT_EQ(2, getCount(snapshot, -EAGAIN, 10));
+    EXPECT_EQ(1, getCount(snapshot, -EBADF, 10));
+    EXPECT_EQ(1, getCount(snapshot, -EAGAIN, 11));
+    EXPECT_EQ(0, snapshot.overflowCount);
+
+    EXPECT_TRUE(table.takeSnapshot(100).empty());
+
+    table.noteLoss(-EAGAIN, 11);
+    snapshot = table.takeSnapshot(100);
+    ASSERT_EQ(1u, snapshot.counts.size());
+    EXPECT_EQ(1, getCount(snapshot, -EAGAIN, 11));
+}
+
+TEST(StatsSocketLossTableTest, TestRestoreSnapshot) {
+    StatsSocketLossTable table;
+    table.noteLoss(-EAGAIN, 10);
+    const StatsSocketLossTable::Snapshot snapshot = table.takeSnapshot(100);
+    table.noteLoss(-EAGAIN, 10);
+    table.restoreSnapshot(snapshot);
+
+    EXPECT_EQ(2, getCount(table.takeSnapshot(100), -EAGAIN, 10));
+}
+
+TEST(StatsSocketLossTableTest, TestMaxPairsLeavesCountsForNextSnapshot) {
+    StatsSocketLossTable table;
+    for (int tag = 1; tag <= 10; tag++) {
+        table.noteLoss(-EAGAIN, tag);
+    }
+
+    const StatsSocketLossTable::Snapshot first = table.takeSnapshot(6);
+    const StatsSocketLossTable::Snapshot second = table.takeSnapshot(6);
+    EXPECT_EQ(6u, first.counts.size());
+    EXPECT_EQ(4u, second.counts.size());
+    for (int tag = 1; tag <= 10; tag++) {
+        EXPECT_EQ(1, getCount(first, -EAGAIN, tag) + getCount(second, -EAGAIN, tag));
+    }
+}
+
+TEST(StatsSocketLossTableTest, TestOverflow) {
+    StatsSocketLossTable table;
+    const int pairs = StatsSocketLossTable::kCapacity + 5;
+    for (int tag = 1; tag <= pairs; tag++) {
+        table.noteLoss(-EAGAIN, tag);
+    }
+
+    const StatsSocketLossTable::Snapshot snapshot = table.takeSnapshot(pairs);
+    EXPECT_LE(snapshot.counts.size(), StatsSocketLossTable::kCapacity);
+    EXPECT_EQ(pairs, (int)snapshot.counts.size() + snapshot.overflowCount);
+}
+
+TEST(StatsSocketLossTableTest, TestConcurrentWriters) {
+    StatsSocketLossTable table;
+    constexpr int kThreads = 8;
+    constexpr int kLossesPerThread = 10000;
+    constexpr int kTags = 20;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&table] {
+            for (int i = 0; i < kLossesPerThread; i++) {
+                table.noteLoss(-EAGAIN, 1 + i % kTags);
+            }
+        });
+    }
+    // Snapshots taken concurrently with the writers must not lose or double count any loss.
+    int64_t total = 0;
+    for (int i = 0; i < 100; i++) {
+        for (const int count : table.takeSnapshot(kTags).counts) {
+            total += count;
+        }
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const StatsSocketLossTable::Snapshot snapshot = table.takeSnapshot(kTags);
+    for (const int count : snapshot.counts) {
+        total += count;
+    }
+
+    EXPECT_EQ(kThreads * kLossesPerThread, total);
+    EXPECT_EQ(0, snapshot.overflowCount);
+}
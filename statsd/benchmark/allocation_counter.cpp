@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "allocation_counter.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+namespace {
+
+std::atomic<int64_t> gAllocationCount = 0;
+std::atomic<int64_t> gAllocatedBytes = 0;
+std::atomic<int64_t> gLiveBytes = 0;
+std::atomic<int64_t> gPeakLiveBytes = 0;
+
+void* countedAlloc(size_t size) {
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        abort();
+    }
+    const int64_t blockSize = malloc_usable_size(ptr);
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    gAllocatedBytes.fetch_add(blockSize, std::memory_order_relaxed);
+    const int64_t liveBytes = gLiveBytes.fetch_add(blockSize, std::memory_order_relaxed) +
+                              blockSize;
+    int64_t peakLiveBytes = gPeakLiveBytes.load(std::memory_order_relaxed);
+    while (liveBytes > peakLiveBytes &&
+           !gPeakLiveBytes.compare_exchange_weak(peakLiveBytes, liveBytes,
+                                                 std::memory_order_relaxed)) {
+    }
+    return ptr;
+}
+
+void countedFree(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    gLiveBytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    free(ptr);
+}
+
+}  // namespace
+
+// Replaces the global allocation functions of the benchmark binary to count allocations.
+void* operator new(size_t size) {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+    return countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    countedFree(ptr);
+}
+
+namespace android {
+namespace os {
+namespace statsd {
+
+int64_t getAllocationCount() {
+    return gAllocationCount.load(std::memory_order_relaxed);
+}
+
+int64_t getAllocatedBytes() {
+    return gAllocatedBytes.load(std::memory_order_relaxed);
+}
+
+int64_t getLiveBytes() {
+    return gLiveBytes.load(std::memory_order_relaxed);
+}
+
+AllocationCounters::AllocationCounters() {
+    resume();
+}
+
+void AllocationCounters::pause() {
+    if (mPaused) {
+        return;
+    }
+    mPaused = true;
+    mAllocationCount += getAllocationCount() - mResumeAllocationCount;
+    mAllocatedBytes += getAllocatedBytes() - mResumeAllocatedBytes;
+    mPeakLiveBytes = std::max(mPeakLiveBytes, gPeakLiveBytes.load(std::memory_order_relaxed) -
+                                                      mResumeLiveBytes);
+}
+
+void AllocationCounters::resume() {
+    mPaused = false;
+    mResumeAllocationCount = getAllocationCount();
+    mResumeAllocatedBytes = getAllocatedBytes();
+    mResumeLiveBytes = getLiveBytes();
+    // The peak is only tracked from here.
+    gPeakLiveBytes.store(mResumeLiveBytes, std::memory_order_relaxed);
+}
+
+void AllocationCounters::report(benchmark::State& state) {
+    pause();
+    state.counters["allocs_per_iter"] =
+            benchmark::Counter(mAllocationCount, benchmark::Counter::kAvgIterations);
+    state.counters["alloc_bytes_per_iter"] =
+            benchmark::Counter(mAllocatedBytes, benchmark::Counter::kAvgIterations);
+    state.counters["peak_live_bytes"] = mPeakLiveBytes;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
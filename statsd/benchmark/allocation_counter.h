@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <stdint.h>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Returns the number of calls to the global operator new since the benchmark binary started.
+int64_t getAllocationCount();
+
+// Bytes allocated through the global operator new since the benchmark binary started, and bytes
+// still allocated. Sizes are the usable sizes of the malloc blocks, which round up the requests.
+int64_t getAllocatedBytes();
+int64_t getLiveBytes();
+
+/**
+ * Counts the allocations of the timed part of a benchmark, and reports them as counters:
+ * - allocs_per_iter: calls to the global operator new per iteration.
+ * - alloc_bytes_per_iter: bytes allocated per iteration.
+ * - peak_live_bytes: most bytes allocated at once, above what was allocated when counting
+ *   started or resumed. For a loop that frees what each iteration allocates, this is the peak
+ *   of an iteration.
+ *
+ * Allocations made by C code through malloc, such as by libstatssocket, are not counted.
+ * Not thread safe, although the allocations of all threads are counted.
+ */
+class AllocationCounters {
+public:
+    // Starts counting.
+    AllocationCounters();
+
+    // Stops and resumes counting, such as around the untimed part of each iteration.
+    void pause();
+    void resume();
+
+    // Adds the counters to the state of the benchmark, which must have stopped running.
+    void report(benchmark::State& state);
+
+private:
+    bool mPaused = false;
+    int64_t mAllocationCount = 0;
+    int64_t mAllocatedBytes = 0;
+    int64_t mPeakLiveBytes = 0;
+
+    // Counts when counting last resumed.
+    int64_t mResumeAllocationCount;
+    int64_t mResumeAllocatedBytes;
+    int64_t mResumeLiveBytes;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
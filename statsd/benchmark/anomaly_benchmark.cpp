@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "anomaly/AlarmMonitor.h"
+#include "anomaly/AnomalyTracker.h"
+#include "benchmark/benchmark.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::make_shared;
+using std::shared_ptr;
+using std::vector;
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+const uint32_t kFirstAlarmSec = 1000000;
+
+MetricDimensionKey createDimensionKey(const int value) {
+    int pos[] = {1, 0, 0};
+    HashableDimensionKey dim;
+    dim.addValue(FieldValue(Field(/*tag=*/1, pos, /*depth=*/0), Value(value)));
+    return MetricDimensionKey(dim, DEFAULT_DIMENSION_KEY);
+}
+
+sp<AlarmMonitor> createAlarmMonitor(const AlarmMonitor::Type type) {
+    return new AlarmMonitor(
+            /*minDiffToUpdateRegisteredAlarmTimeSec=*/0,
+            [](const shared_ptr<IStatsCompanionService>&, int64_t) {},
+            [](const shared_ptr<IStatsCompanionService>&) {}, type);
+}
+
+}  // anonymous namespace
+
+// Rolls the buckets of an alert over, then checks each dimension of the new bucket, as a metric
+// producer does when it closes a bucket.
+static void BM_AnomalyTrackerBucketRollover(benchmark::State& state) {
+    const int dimensionCount = state.range(0);
+    Alert alert;
+    alert.set_num_buckets(10);
+    alert.set_refractory_period_secs(60);
+    // Never reached, so that no anomaly is declared.
+    alert.set_trigger_if_sum_gt(INT64_MAX);
+    AnomalyTracker tracker(alert, kConfigKey);
+
+    shared_ptr<DimToValMap> bucket = make_shared<DimToValMap>();
+    for (int i = 0; i < dimensionCount; i++) {
+        (*bucket)[createDimensionKey(i)] = i;
+    }
+
+    int64_t bucketNum = 0;
+    for (auto _ : state) {
+        tracker.addPastBucket(bucket, bucketNum++);
+        for (const auto& [key, value] : *bucket) {
+            benchmark::DoNotOptimize(tracker.detectAnomaly(bucketNum, key, value));
+        }
+    }
+}
+BENCHMARK(BM_AnomalyTrackerBucketRollover)->RangeMultiplier(4)->Range(1, 1024);
+
+// Adds and removes an alarm among a growing number of pending ones, as duration anomaly trackers
+// do when their durations start and stop.
+static void BM_AlarmMonitorAddRemove(benchmark::State& state) {
+    const int alarmCount = state.range(0);
+    const sp<AlarmMonitor> alarmMonitor =
+            createAlarmMonitor(static_cast<AlarmMonitor::Type>(state.range(1)));
+    vector<sp<const InternalAlarm>> alarms;
+    for (int i = 0; i < alarmCount; i++) {
+        alarms.push_back(new InternalAlarm(kFirstAlarmSec + i));
+        alarmMonitor->add(alarms.back());
+    }
+
+    const sp<const InternalAlarm> alarm = new InternalAlarm(kFirstAlarmSec + alarmCount / 2);
+    for (auto _ : state) {
+        alarmMonitor->add(alarm);
+        alarmMonitor->remove(alarm);
+    }
+}
+BENCHMARK(BM_AlarmMonitorAddRemove)
+        ->ArgsProduct({benchmark::CreateRange(16, 16384, /*multi=*/8),
+                       {(int)AlarmMonitor::Type::PRIORITY_QUEUE,
+                        (int)AlarmMonitor::Type::TIMER_WHEEL}});
+
+// Fires the alarms that are due one second at a time.
+static void BM_AlarmMonitorPopSoonerThan(benchmark::State& state) {
+    const int alarmCount = state.range(0);
+    vector<sp<const InternalAlarm>> alarms;
+    for (int i = 0; i < alarmCount; i++) {
+        alarms.push_back(new InternalAlarm(kFirstAlarmSec + i));
+    }
+
+    for (auto _ : state) {
+        // Each iteration starts over from the first alarm.
+        state.PauseTiming();
+        const sp<AlarmMonitor> alarmMonitor =
+                createAlarmMonitor(static_cast<AlarmMonitor::Type>(state.range(1)));
+        for (const sp<const InternalAlarm>& alarm : alarms) {
+            alarmMonitor->add(alarm);
+        }
+        state.ResumeTiming();
+
+        for (int i = 0; i < alarmCount; i++) {
+            benchmark::DoNotOptimize(alarmMonitor->popSoonerThan(kFirstAlarmSec + i));
+        }
+    }
+}
+BENCHMARK(BM_AlarmMonitorPopSoonerThan)
+        ->ArgsProduct({benchmark::CreateRange(16, 4096, /*multi=*/4),
+                       {(int)AlarmMonitor::Type::PRIORITY_QUEUE,
+                        (int)AlarmMonitor::Type::TIMER_WHEEL}});
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "HashableDimensionKey.h"
+#include "benchmark/benchmark.h"
+#include "condition/CombinationConditionTracker.h"
+#include "condition/SimpleConditionTracker.h"
+#include "metric_util.h"
+#include "stats_event.h"
+#include "stats_log_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+const int kAtomId = 100;
+const int kUidField = 1;
+
+std::unique_ptr<LogEvent> createUidEvent(const int uid) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, kAtomId);
+    AStatsEvent_writeInt32(statsEvent, uid);
+    AStatsEvent_writeInt32(statsEvent, /*acquire=*/1);
+
+    std::unique_ptr<LogEvent> event = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+    parseStatsEventToLogEvent(statsEvent, event.get());
+    return event;
+}
+
+Predicate createSimplePredicate(const string& name, const bool sliced) {
+    Predicate predicate;
+    predicate.set_id(StringToId(name));
+    SimplePredicate* simplePredicate = predicate.mutable_simple_predicate();
+    simplePredicate->set_start(StringToId(name + "_START"));
+    simplePredicate->set_stop(StringToId(name + "_STOP"));
+    simplePredicate->set_count_nesting(false);
+    if (sliced) {
+        *simplePredicate->mutable_dimensions() = CreateDimensions(kAtomId, {kUidField});
+    }
+    return predicate;
+}
+
+}  // anonymous namespace
+
+// Queries a condition sliced by uid that is true for every queried uid, as sliced metrics do for
+// each of their events.
+static void BM_SimpleConditionTrackerSlicedQuery(benchmark::State& state) {
+    const int dimensionCount = state.range(0);
+    const Predicate predicate = createSimplePredicate("HOLDING", /*sliced=*/true);
+    unordered_map<int64_t, int> atomMatchingTrackerMap;
+    atomMatchingTrackerMap[predicate.simple_predicate().start()] = 0;
+    atomMatchingTrackerMap[predicate.simple_predicate().stop()] = 1;
+    SimpleConditionTracker tracker(kConfigKey, predicate.id(), /*protoHash=*/0x1234,
+                                   /*index=*/0, predicate.simple_predicate(),
+                                   atomMatchingTrackerMap);
+
+    vector<Matcher> dimensions;
+    translateFieldMatcher(predicate.simple_predicate().dimensions(), &dimensions);
+    const vector<MatchingState> startMatched = {MatchingState::kMatched,
+                                                MatchingState::kNotMatched};
+    const vector<sp<ConditionTracker>> allConditions;
+    vector<ConditionState> conditionCache(1, ConditionState::kNotEvaluated);
+    vector<bool> changedCache(1, false);
+    vector<ConditionKey> queryKeys;
+    for (int i = 0; i < dimensionCount; i++) {
+        const std::unique_ptr<LogEvent> event = createUidEvent(10000 + i);
+        tracker.evaluateCondition(*event, startMatched, allConditions, conditionCache,
+                                  changedCache);
+        conditionCache[0] = ConditionState::kNotEvaluated;
+        changedCache[0] = false;
+
+        HashableDimensionKey key;
+        filterValues(dimensions, event->getValues(), &key);
+        queryKeys.push_back({{predicate.id(), key}});
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        conditionCache[0] = ConditionState::kNotEvaluated;
+        tracker.isConditionMet(queryKeys[i++ % queryKeys.size()], allConditions,
+                               /*isPartialLink=*/false, conditionCache);
+        benchmark::DoNotOptimize(conditionCache);
+    }
+}
+BENCHMARK(BM_SimpleConditionTrackerSlicedQuery)->RangeMultiplier(4)->Range(1, 4096);
+
+// Evaluates an OR of unsliced conditions for an event that starts one of them.
+static void BM_CombinationConditionTrackerEvaluate(benchmark::State& state) {
+    const int childCount = state.range(0);
+    vector<Predicate> allPredicates;
+    unordered_map<int64_t, int> atomMatchingTrackerMap;
+    unordered_map<int64_t, int> conditionIdIndexMap;
+    vector<sp<ConditionTracker>> allConditions;
+    Predicate combination;
+    combination.set_id(StringToId("ANY"));
+    combination.mutable_combination()->set_operation(LogicalOperation::OR);
+    for (int i = 0; i < childCount; i++) {
+        const Predicate predicate =
+                createSimplePredicate("CHILD_" + std::to_string(i), /*sliced=*/false);
+        atomMatchingTrackerMap[predicate.simple_predicate().start()] = 2 * i;
+        atomMatchingTrackerMap[predicate.simple_predicate().stop()] = 2 * i + 1;
+        conditionIdIndexMap[predicate.id()] = i;
+        allConditions.push_back(new SimpleConditionTracker(
+                kConfigKey, predicate.id(), /*protoHash=*/i, /*index=*/i,
+                predicate.simple_predicate(), atomMatchingTrackerMap));
+        combination.mutable_combination()->add_predicate(predicate.id());
+        allPredicates.push_back(predicate);
+    }
+    conditionIdIndexMap[combination.id()] = childCount;
+    allConditions.push_back(
+            new CombinationConditionTracker(combination.id(), childCount, /*protoHash=*/0x1234));
+    allPredicates.push_back(combination);
+
+    vector<bool> stack(allConditions.size(), false);
+    vector<ConditionState> conditionCache(allConditions.size(), ConditionState::kNotEvaluated);
+    for (const sp<ConditionTracker>& condition : allConditions) {
+        condition->init(allPredicates, allConditions, conditionIdIndexMap, stack,
+                        conditionCache);
+    }
+
+    // The event alternately starts and stops the first child.
+    const std::unique_ptr<LogEvent> event = createUidEvent(10000);
+    vector<MatchingState> matcherStates(2 * childCount, MatchingState::kNotMatched);
+    vector<bool> changedCache(allConditions.size(), false);
+    bool start = true;
+    for (auto _ : state) {
+        matcherStates[0] = start ? MatchingState::kMatched : MatchingState::kNotMatched;
+        matcherStates[1] = start ? MatchingState::kNotMatched : MatchingState::kMatched;
+        start = !start;
+        std::fill(conditionCache.begin(), conditionCache.end(), ConditionState::kNotEvaluated);
+        std::fill(changedCache.begin(), changedCache.end(), false);
+        allConditions.back()->evaluateCondition(*event, matcherStates, allConditions,
+                                                conditionCache, changedCache);
+        benchmark::DoNotOptimize(conditionCache);
+    }
+}
+BENCHMARK(BM_CombinationConditionTrackerEvaluate)->RangeMultiplier(4)->Range(2, 512);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -91,6 +91,42 @@ BENCHMARK(BM_insertAtomsIntoDbTablesReuseConnection)
         ->Args({10, 10})
         ->Args({10, 20});
 
+static void BM_insertAtomsIntoDbTablesAsync(benchmark::State& state) {
+    ConfigKey key = ConfigKey(111, 222);
+    int64_t bucketStartTimeNs = 10000000000;
+
+    unique_ptr<LogEvent> event =
+            CreateScreenStateChangedEvent(bucketStartTimeNs, android::view::DISPLAY_STATE_OFF);
+    vector<LogEvent> logEvents;
+    for (int j = 0; j < state.range(1); ++j) {
+        logEvents.push_back(*event.get());
+    }
+    for (auto s : state) {
+        state.PauseTiming();
+        vector<vector<LogEvent>> metricEvents;
+        for (int metricId = 0; metricId < state.range(0); ++metricId) {
+            deleteTable(key, metricId);
+            createTableIfNeeded(key, metricId, *event.get());
+            metricEvents.push_back(logEvents);
+        }
+        state.ResumeTiming();
+        // The inserts queued for all the metrics are written in one transaction.
+        for (int metricId = 0; metricId < state.range(0); ++metricId) {
+            insertAsync(key, metricId, std::move(metricEvents[metricId]), bucketStartTimeNs);
+        }
+        flushPendingInserts();
+    }
+    deleteDb(key);
+}
+
+BENCHMARK(BM_insertAtomsIntoDbTablesAsync)
+        ->Args({1, 10})
+        ->Args({1, 50})
+        ->Args({1, 100})
+        ->Args({1, 500})
+        ->Args({10, 10})
+        ->Args({10, 20});
+
 static void BM_createDbTables(benchmark::State& state) {
     ConfigKey key = ConfigKey(111, 222);
     int64_t metricId = 0;
@@ -309,6 +309,61 @@ static void BM_DurationMetricLink(benchmark::State& state) {
 
 BENCHMARK(BM_DurationMetricLink);
 
+// One uid running state.range(0) nested jobs, all tracked by the same duration tracker, while
+// the screen and the sync of the uid toggle the condition.
+static void BM_DurationMetricHighCardinalityNesting(benchmark::State& state) {
+    ConfigKey cfgKey;
+    auto config = CreateDurationMetricConfig_Link_AND_CombinationCondition(
+            DurationMetric::SUM, false);
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs =
+            TimeUnitToBucketSizeInMillis(config.duration_metric(0).bucket()) * 1000000LL;
+    const int numJobs = state.range(0);
+    const int64_t eventGapNs = bucketSizeNs / (8 * numJobs);
+
+    std::vector<std::unique_ptr<LogEvent>> events;
+    vector<int> attributionUids = {111};
+    vector<string> attributionTags = {"App1"};
+    int64_t timestampNs = bucketStartTimeNs + 1;
+    for (int i = 0; i < numJobs; i++) {
+        string jobName = "job" + std::to_string(i);
+        events.push_back(CreateStartScheduledJobEvent(timestampNs, attributionUids,
+                                                      attributionTags, jobName));
+        events.push_back(CreateStartScheduledJobEvent(timestampNs + 1, attributionUids,
+                                                      attributionTags, jobName));
+        timestampNs += eventGapNs;
+    }
+    for (int i = 0; i < 4; i++) {
+        events.push_back(CreateScreenStateChangedEvent(timestampNs,
+                                                       android::view::DISPLAY_STATE_OFF));
+        events.push_back(CreateSyncStartEvent(timestampNs + 1, attributionUids, attributionTags,
+                                              "ReadEmail"));
+        events.push_back(CreateSyncEndEvent(timestampNs + 2, attributionUids, attributionTags,
+                                            "ReadEmail"));
+        events.push_back(CreateScreenStateChangedEvent(timestampNs + 3,
+                                                       android::view::DISPLAY_STATE_ON));
+        timestampNs += eventGapNs;
+    }
+    for (int i = 0; i < numJobs; i++) {
+        string jobName = "job" + std::to_string(i);
+        events.push_back(CreateFinishScheduledJobEvent(timestampNs, attributionUids,
+                                                       attributionTags, jobName));
+        events.push_back(CreateFinishScheduledJobEvent(timestampNs + 1, attributionUids,
+                                                       attributionTags, jobName));
+        timestampNs += eventGapNs;
+    }
+
+    while (state.KeepRunning()) {
+        auto processor = CreateStatsLogProcessor(
+                bucketStartTimeNs / NS_PER_SEC, config, cfgKey);
+        for (const auto& event : events) {
+            processor->OnLogEvent(event.get());
+        }
+    }
+}
+
+BENCHMARK(BM_DurationMetricHighCardinalityNesting)->Arg(10)->Arg(100)->Arg(500);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
@@ -18,6 +18,7 @@
 #include "FieldValue.h"
 #include "HashableDimensionKey.h"
 #include "benchmark/benchmark.h"
+#include "condition/ConditionQueryCache.h"
 #include "logd/LogEvent.h"
 #include "metric_util.h"
 #include "stats_event.h"
@@ -71,6 +72,52 @@ static void BM_GetDimensionInCondition(benchmark::State& state) {
 
 BENCHMARK(BM_GetDimensionInCondition);
 
+// Each of state.range(0) metrics sharing the link builds the condition key of the event.
+static void BM_GetDimensionInConditionMultipleMetrics(benchmark::State& state) {
+    Metric2Condition link;
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    createLogEventAndLink(&event, &link);
+    const vector<Metric2Condition> links = {link};
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < state.range(0); i++) {
+            ConditionKey conditionKey;
+            getDimensionForCondition(event.getValues(), link, &conditionKey[link.conditionId]);
+            benchmark::DoNotOptimize(conditionKey);
+        }
+    }
+}
+
+BENCHMARK(BM_GetDimensionInConditionMultipleMetrics)->Arg(1)->Arg(4)->Arg(16);
+
+// Same as above, with the metrics sharing the condition key through a ConditionQueryCache.
+static void BM_GetDimensionInConditionMultipleMetricsCached(benchmark::State& state) {
+    Metric2Condition link;
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    createLogEventAndLink(&event, &link);
+    const vector<Metric2Condition> links = {link};
+    sp<ConditionQueryCache> cache = new ConditionQueryCache();
+
+    while (state.KeepRunning()) {
+        cache->setCurrentEvent(&event);
+        for (int i = 0; i < state.range(0); i++) {
+            ConditionKey conditionKey;
+            const ConditionQueryCache::Entry* entry = cache->find(event, 0, links, false);
+            if (entry != nullptr) {
+                conditionKey = entry->conditionKey;
+            } else {
+                getDimensionForCondition(event.getValues(), link,
+                                         &conditionKey[link.conditionId]);
+                cache->add(event, 0, links, false, conditionKey, ConditionState::kTrue);
+            }
+            benchmark::DoNotOptimize(conditionKey);
+        }
+        cache->setCurrentEvent(nullptr);
+    }
+}
+
+BENCHMARK(BM_GetDimensionInConditionMultipleMetricsCached)->Arg(1)->Arg(4)->Arg(16);
+
 
 }  //  namespace statsd
 }  //  namespace os
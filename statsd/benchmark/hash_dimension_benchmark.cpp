@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vector>
+
+#include "FieldValue.h"
+#include "HashableDimensionKey.h"
+#include "benchmark/benchmark.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+static vector<FieldValue> createIntOnlyValues() {
+    int pos[] = {1, 1, 1};
+    vector<FieldValue> values;
+    for (int i = 1; i <= 3; i++) {
+        pos[0] = i;
+        values.push_back(FieldValue(Field(10, pos, 0), Value((int32_t)(1000 * i))));
+    }
+    return values;
+}
+
+static vector<FieldValue> createIntAndStringValues() {
+    int pos[] = {1, 1, 1};
+    vector<FieldValue> values;
+    values.push_back(FieldValue(Field(10, pos, 0), Value((int32_t)10001)));
+    pos[0] = 2;
+    values.push_back(FieldValue(Field(10, pos, 0), Value(string("com.google.android.gms"))));
+    return values;
+}
+
+static vector<FieldValue> createAttributionChainValues() {
+    int pos[] = {1, 1, 1};
+    vector<FieldValue> values;
+    for (int i = 1; i <= 3; i++) {
+        pos[1] = i;
+        pos[2] = 1;
+        values.push_back(FieldValue(Field(10, pos, 2), Value((int32_t)(10000 + i))));
+        pos[2] = 2;
+        values.push_back(FieldValue(Field(10, pos, 2), Value(string("LOCATION"))));
+    }
+    return values;
+}
+
+static void benchmarkHashFieldValues(benchmark::State& state, const vector<FieldValue>& values) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hashFieldValues(values));
+    }
+}
+
+static void BM_HashDimensionIntOnly(benchmark::State& state) {
+    benchmarkHashFieldValues(state, createIntOnlyValues());
+}
+BENCHMARK(BM_HashDimensionIntOnly);
+
+static void BM_HashDimensionIntAndString(benchmark::State& state) {
+    benchmarkHashFieldValues(state, createIntAndStringValues());
+}
+BENCHMARK(BM_HashDimensionIntAndString);
+
+static void BM_HashDimensionAttributionChain(benchmark::State& state) {
+    benchmarkHashFieldValues(state, createAttributionChainValues());
+}
+BENCHMARK(BM_HashDimensionAttributionChain);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "kll.h"
+#include "varint.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using dist_proc::aggregation::KllQuantile;
+
+namespace {
+
+constexpr int kValuesCount = 100000;
+
+std::vector<int64_t> generateValues() {
+    std::mt19937 gen(/*seed=*/1);
+    std::uniform_int_distribution<int64_t> distribution(0, 1000000);
+    std::vector<int64_t> values(kValuesCount);
+    for (int64_t& value : values) {
+        value = distribution(gen);
+    }
+    return values;
+}
+
+const std::vector<int64_t> kValues = generateValues();
+
+}  // namespace
+
+static void BM_KllAdd(benchmark::State& state) {
+    for (auto _ : state) {
+        std::unique_ptr<KllQuantile> kll = KllQuantile::Create();
+        for (int64_t value : kValues) {
+            kll->Add(value);
+        }
+        benchmark::DoNotOptimize(kll->num_stored_values());
+    }
+    state.SetItemsProcessed(state.iterations() * kValuesCount);
+}
+BENCHMARK(BM_KllAdd);
+
+static void BM_KllAddBatch(benchmark::State& state) {
+    const size_t batchSize = state.range(0);
+    std::vector<std::vector<int64_t>> batches;
+    for (size_t i = 0; i < kValues.size(); i += batchSize) {
+        batches.emplace_back(kValues.begin() + i,
+                             kValues.begin() + std::min(i + batchSize, kValues.size()));
+    }
+    for (auto _ : state) {
+        std::unique_ptr<KllQuantile> kll = KllQuantile::Create();
+        for (const std::vector<int64_t>& batch : batches) {
+            kll->AddBatch(batch);
+        }
+        benchmark::DoNotOptimize(kll->num_stored_values());
+    }
+    state.SetItemsProcessed(state.iterations() * kValuesCount);
+}
+BENCHMARK(BM_KllAddBatch)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_KllSerialize(benchmark::State& state) {
+    std::unique_ptr<KllQuantile> kll = KllQuantile::Create();
+    kll->AddBatch(kValues);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(kll->SerializeToProto());
+    }
+}
+BENCHMARK(BM_KllSerialize);
+
+// Values of a sorted compactor, all below range(0).
+static std::vector<int64_t> sortedCompactorValues(const int64_t maxValue) {
+    std::vector<int64_t> values(kValues.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = kValues[i] % maxValue;
+    }
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+static void BM_VarintEncodeAll64(benchmark::State& state) {
+    const std::vector<int64_t> values = sortedCompactorValues(state.range(0));
+    const int64_t* const begin = values.data();
+    const int64_t* const end = begin + values.size();
+    std::string encoded(Varint::LengthAll64(begin, end), '\0');
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Varint::EncodeAll64(encoded.data(), begin, end));
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+    state.SetBytesProcessed(state.iterations() * encoded.size());
+}
+BENCHMARK(BM_VarintEncodeAll64)->Arg(128)->Arg(1000000);
+
+static void BM_VarintParseAll64(benchmark::State& state) {
+    const std::vector<int64_t> values = sortedCompactorValues(state.range(0));
+    const int64_t* const begin = values.data();
+    const int64_t* const end = begin + values.size();
+    std::string encoded(Varint::LengthAll64(begin, end), '\0');
+    Varint::EncodeAll64(encoded.data(), begin, end);
+    std::vector<int64_t> parsed;
+    parsed.reserve(values.size());
+    for (auto _ : state) {
+        parsed.clear();
+        benchmark::DoNotOptimize(
+                Varint::ParseAll64(encoded.data(), encoded.data() + encoded.size(), &parsed));
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+    state.SetBytesProcessed(state.iterations() * encoded.size());
+}
+BENCHMARK(BM_VarintParseAll64)->Arg(128)->Arg(1000000);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -14,9 +14,12 @@
  * limitations under the License.
  */
 #include <vector>
+#include "allocation_counter.h"
 #include "benchmark/benchmark.h"
 #include "logd/LogEvent.h"
+#include "logd/LogEventPool.h"
 #include "stats_event.h"
+#include "statslog_statsd.h"
 
 namespace android {
 namespace os {
@@ -206,6 +209,81 @@ static void BM_LogEventCreationExtraLargeWithPrefetchOnly(benchmark::State& stat
 }
 BENCHMARK(BM_LogEventCreationExtraLargeWithPrefetchOnly);
 
+// A single int32 field, like SCREEN_BRIGHTNESS_CHANGED, which has a flat schema.
+static size_t createFlatStatsEvent(uint8_t* msg, int32_t atomId) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, atomId);
+    AStatsEvent_writeInt32(event, 128);
+    AStatsEvent_build(event);
+
+    size_t size;
+    uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+    memcpy(msg, buf, size);
+    AStatsEvent_release(event);
+    return size;
+}
+
+static void BM_LogEventFlatGenericParsing(benchmark::State& state) {
+    uint8_t msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    const size_t size = createFlatStatsEvent(msg, /*atomId=*/100);
+    while (state.KeepRunning()) {
+        LogEvent event(/*uid=*/1000, /*pid=*/1001);
+        benchmark::DoNotOptimize(event.parseBuffer(msg, size));
+    }
+}
+BENCHMARK(BM_LogEventFlatGenericParsing);
+
+static void BM_LogEventFlatSchemaParsing(benchmark::State& state) {
+    uint8_t msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    const size_t size = createFlatStatsEvent(msg, util::SCREEN_BRIGHTNESS_CHANGED);
+    while (state.KeepRunning()) {
+        LogEvent event(/*uid=*/1000, /*pid=*/1001);
+        benchmark::DoNotOptimize(event.parseBuffer(msg, size));
+    }
+}
+BENCHMARK(BM_LogEventFlatSchemaParsing);
+
+static void BM_LogEventCreationAllocations(benchmark::State& state) {
+    uint8_t msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    const size_t size = createStatsEventMedium(msg);
+    AllocationCounters allocationCounters;
+    while (state.KeepRunning()) {
+        std::unique_ptr<LogEvent> event = std::make_unique<LogEvent>(/*uid=*/1000, /*pid=*/1001);
+        benchmark::DoNotOptimize(event->parseBuffer(msg, size));
+    }
+    allocationCounters.report(state);
+}
+BENCHMARK(BM_LogEventCreationAllocations);
+
+static void BM_LogEventCreationExtraLargeAllocations(benchmark::State& state) {
+    uint8_t msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    const size_t size = createStatsEventExtraLarge(msg);
+    AllocationCounters allocationCounters;
+    while (state.KeepRunning()) {
+        std::unique_ptr<LogEvent> event = std::make_unique<LogEvent>(/*uid=*/1000, /*pid=*/1001);
+        benchmark::DoNotOptimize(event->parseBuffer(msg, size));
+    }
+    allocationCounters.report(state);
+}
+BENCHMARK(BM_LogEventCreationExtraLargeAllocations);
+
+static void BM_LogEventCreationFromPoolAllocations(benchmark::State& state) {
+    uint8_t msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    const size_t size = createStatsEventMedium(msg);
+    LogEventPool pool(/*maxSize=*/1);
+    std::vector<std::unique_ptr<LogEvent>> processed;
+    processed.reserve(1);
+    AllocationCounters allocationCounters;
+    while (state.KeepRunning()) {
+        std::unique_ptr<LogEvent> event = pool.obtain(/*uid=*/1000, /*pid=*/1001);
+        benchmark::DoNotOptimize(event->parseBuffer(msg, size));
+        processed.push_back(std::move(event));
+        pool.recycle(processed);
+    }
+    allocationCounters.report(state);
+}
+BENCHMARK(BM_LogEventCreationFromPoolAllocations);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
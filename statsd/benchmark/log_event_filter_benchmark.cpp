@@ -135,6 +135,29 @@ static void BM_LogEventFilterSet2Consumers(benchmark::State& state) {
 }
 BENCHMARK(BM_LogEventFilterSet2Consumers);
 
+static void BM_LogEventFilterBitmapLookup(benchmark::State& state) {
+    LogEventFilter eventFilter;
+    eventFilter.setAtomIds(kAtomIdsUnorderedSet, nullptr);
+    while (state.KeepRunning()) {
+        // many fetches against an already published filter
+        for (const auto& atomId : kSampleIdsList) {
+            benchmark::DoNotOptimize(eventFilter.isAtomInUse(atomId));
+        }
+    }
+}
+BENCHMARK(BM_LogEventFilterBitmapLookup);
+
+static void BM_LogEventFilterUnorderedSetLookup(benchmark::State& state) {
+    // baseline: the per datagram check before the filter was backed by a bitmap
+    const std::unordered_set<int> atomIds = kAtomIdsUnorderedSet;
+    while (state.KeepRunning()) {
+        for (const auto& atomId : kSampleIdsList) {
+            benchmark::DoNotOptimize(atomIds.find(atomId) != atomIds.end());
+        }
+    }
+}
+BENCHMARK(BM_LogEventFilterUnorderedSetLookup);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
@@ -16,11 +16,13 @@
 #include <cstdlib>
 #include <ctime>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "benchmark/benchmark.h"
+#include "stats_socket_loss_table.h"
 
 namespace android {
 namespace os {
@@ -229,6 +231,68 @@ BENCHMARK(BM_LossInfoCollectionAndDumpViaUnorderedMap)
         ->Args({14})
         ->Args({15});
 
+static void BM_LossInfoCollectionAndDumpViaLossTable(benchmark::State& state) {
+    const TestVector& testVector = kTestVectors[state.range(0)];
+    StatsSocketLossTable lossInfo;
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < kTestVectorSize; i++) {
+            lossInfo.noteLoss(testVector.errors[i], testVector.tags[i]);
+        }
+    }
+    benchmark::DoNotOptimize(lossInfo.takeSnapshot(kMaxAtomTagsCount));
+}
+BENCHMARK(BM_LossInfoCollectionAndDumpViaLossTable)
+        ->Args({0})
+        ->Args({1})
+        ->Args({2})
+        ->Args({3})
+        ->Args({4})
+        ->Args({5})
+        ->Args({6})
+        ->Args({7})
+        ->Args({8})
+        ->Args({9})
+        ->Args({10})
+        ->Args({11})
+        ->Args({12})
+        ->Args({13})
+        ->Args({14})
+        ->Args({15});
+
+// The contended benchmarks share one container between all the threads, like the writers of a
+// process share the socket loss reporter, with a dump every kTestVectorSize losses.
+static void BM_LossInfoContendedViaLockedUnorderedMap(benchmark::State& state) {
+    static std::mutex lock;
+    static LossInfoMap<std::unordered_map<LossInfoKey, int, hash_pair>> lossInfo;
+    const TestVector& testVector = kTestVectors[state.range(0)];
+
+    while (state.KeepRunning()) {
+        int res = 0;
+        for (int i = 0; i < kTestVectorSize; i++) {
+            std::lock_guard<std::mutex> guard(lock);
+            res += lossInfo.noteLossInfo(testVector.errors[i], testVector.tags[i]);
+        }
+        benchmark::DoNotOptimize(res);
+        std::lock_guard<std::mutex> guard(lock);
+        lossInfo.countsPerErrorTag.clear();
+    }
+}
+BENCHMARK(BM_LossInfoContendedViaLockedUnorderedMap)->Args({5})->Args({15})->ThreadRange(1, 8);
+
+static void BM_LossInfoContendedViaLossTable(benchmark::State& state) {
+    static StatsSocketLossTable lossInfo;
+    const TestVector& testVector = kTestVectors[state.range(0)];
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < kTestVectorSize; i++) {
+            lossInfo.noteLoss(testVector.errors[i], testVector.tags[i]);
+        }
+        benchmark::DoNotOptimize(lossInfo.takeSnapshot(kMaxAtomTagsCount));
+    }
+}
+BENCHMARK(BM_LossInfoContendedViaLossTable)->Args({5})->Args({15})->ThreadRange(1, 8);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
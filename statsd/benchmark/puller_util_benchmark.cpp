@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "external/puller_util.h"
+#include "metric_util.h"
+#include "stats_event.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::make_shared;
+using std::shared_ptr;
+using std::vector;
+
+namespace {
+
+const int kAtomId = 100;
+const int kFirstHostUid = 10000;
+const int kFirstIsolatedUid = 90000;
+// Rows per uid, each with another process state.
+const int kProcessStateCount = 3;
+const vector<int> kAdditiveFields = {3, 4};
+
+// Each host uid has a row per process state, followed by a row of its isolated uid that is merged
+// into one of them.
+vector<shared_ptr<LogEvent>> createPulledData(const int rowCount) {
+    vector<shared_ptr<LogEvent>> data;
+    for (int i = 0; i < rowCount; i++) {
+        const int hostIndex = i / (kProcessStateCount + 1);
+        const int rowIndex = i % (kProcessStateCount + 1);
+        const bool isolated = rowIndex == kProcessStateCount;
+        const int uid = (isolated ? kFirstIsolatedUid : kFirstHostUid) + hostIndex;
+        const int processState = isolated ? hostIndex % kProcessStateCount : rowIndex;
+        AStatsEvent* statsEvent = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(statsEvent, kAtomId);
+        AStatsEvent_writeInt32(statsEvent, uid);
+        AStatsEvent_addBoolAnnotation(statsEvent, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+        AStatsEvent_writeInt32(statsEvent, processState);
+        AStatsEvent_writeInt64(statsEvent, 100 + i);
+        AStatsEvent_writeInt64(statsEvent, 200 + i);
+
+        shared_ptr<LogEvent> event = make_shared<LogEvent>(/*uid=*/0, /*pid=*/0);
+        parseStatsEventToLogEvent(statsEvent, event.get());
+        data.push_back(event);
+    }
+    return data;
+}
+
+sp<UidMap> createUidMap(const int rowCount) {
+    sp<UidMap> uidMap = new UidMap();
+    for (int i = 0; i <= rowCount / (kProcessStateCount + 1); i++) {
+        uidMap->assignIsolatedUid(kFirstIsolatedUid + i, kFirstHostUid + i);
+    }
+    return uidMap;
+}
+
+}  // anonymous namespace
+
+static void BM_MapAndMergeIsolatedUidsToHostUid(benchmark::State& state) {
+    const vector<shared_ptr<LogEvent>> pulledData = createPulledData(state.range(0));
+    const sp<UidMap> uidMap = createUidMap(state.range(0));
+    for (auto _ : state) {
+        // The data is mapped and merged in place, so each iteration gets its own copy.
+        state.PauseTiming();
+        vector<shared_ptr<LogEvent>> data;
+        data.reserve(pulledData.size());
+        for (const shared_ptr<LogEvent>& event : pulledData) {
+            data.push_back(make_shared<LogEvent>(*event));
+        }
+        state.ResumeTiming();
+
+        mapAndMergeIsolatedUidsToHostUid(data, uidMap, kAtomId, kAdditiveFields);
+        benchmark::DoNotOptimize(data);
+    }
+}
+BENCHMARK(BM_MapAndMergeIsolatedUidsToHostUid)->RangeMultiplier(4)->Range(16, 4096);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "benchmark/benchmark.h"
+#include "logd/LogEventPool.h"
+#include "logd/LogEventQueue.h"
+#include "metric_util.h"
+#include "replay_trace.h"
+#include "socket/StatsSocketListener.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+// Workloads are read from the files named by these variables. STATSD_REPLAY_CONFIGS is a colon
+// separated list of serialized StatsdConfigs, STATSD_REPLAY_TRACE a trace of atoms in the format
+// of readReplayTrace(). A synthetic workload is replayed when they are not set.
+const char* const kConfigsEnv = "STATSD_REPLAY_CONFIGS";
+const char* const kTraceEnv = "STATSD_REPLAY_TRACE";
+
+// Atoms submitted to the queue before the processor drains it, as the socket thread does with
+// the default read batch size.
+const size_t kReplayBatchSize = StatsSocketListener::kDefaultReadBatchSize;
+
+const int kReplayUid = 1000;
+
+struct ReplayWorkload {
+    vector<StatsdConfig> configs;
+    vector<ReplayAtom> atoms;
+    int64_t timeBaseNs = 0;
+};
+
+StatsdConfig createSyntheticConfig() {
+    StatsdConfig config;
+    const AtomMatcher jobStartMatcher = CreateStartScheduledJobAtomMatcher();
+    *config.add_atom_matcher() = jobStartMatcher;
+    *config.add_atom_matcher() = CreateFinishScheduledJobAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOffAtomMatcher();
+
+    Predicate jobPredicate = CreateScheduledJobPredicate();
+    FieldMatcher* jobDimensions = jobPredicate.mutable_simple_predicate()->mutable_dimensions();
+    jobDimensions->set_field(util::SCHEDULED_JOB_STATE_CHANGED);
+    jobDimensions->add_child()->set_field(2);  // job name field.
+    const Predicate screenIsOffPredicate = CreateScreenIsOffPredicate();
+    *config.add_predicate() = jobPredicate;
+    *config.add_predicate() = screenIsOffPredicate;
+
+    CountMetric* countMetric = config.add_count_metric();
+    countMetric->set_id(StringToId("ScheduledJobStarts"));
+    countMetric->set_what(jobStartMatcher.id());
+    countMetric->set_condition(screenIsOffPredicate.id());
+    *countMetric->mutable_dimensions_in_what() =
+            CreateAttributionUidDimensions(util::SCHEDULED_JOB_STATE_CHANGED, {Position::FIRST});
+    countMetric->set_bucket(FIVE_MINUTES);
+
+    DurationMetric* durationMetric = config.add_duration_metric();
+    durationMetric->set_id(StringToId("ScheduledJobDuration"));
+    durationMetric->set_what(jobPredicate.id());
+    durationMetric->set_aggregation_type(DurationMetric::SUM);
+    FieldMatcher* durationDimensions = durationMetric->mutable_dimensions_in_what();
+    durationDimensions->set_field(util::SCHEDULED_JOB_STATE_CHANGED);
+    durationDimensions->add_child()->set_field(2);  // job name field.
+    durationMetric->set_bucket(FIVE_MINUTES);
+    return config;
+}
+
+ReplayAtom buildAtom(AStatsEvent* statsEvent) {
+    AStatsEvent_build(statsEvent);
+    size_t size;
+    const uint8_t* buf = AStatsEvent_getBuffer(statsEvent, &size);
+    ReplayAtom atom = {kReplayUid, /*pid=*/0, vector<uint8_t>(buf, buf + size)};
+    AStatsEvent_release(statsEvent);
+    return atom;
+}
+
+// Jobs of a few apps starting and finishing while the screen turns on and off.
+vector<ReplayAtom> createSyntheticTrace(const int64_t timeBaseNs) {
+    const int numAtoms = 10000;
+    const int numUids = 20;
+    vector<ReplayAtom> atoms;
+    atoms.reserve(numAtoms);
+    for (int i = 0; i < numAtoms; i++) {
+        const int64_t timestampNs = timeBaseNs + (i + 1) * NS_PER_SEC / 100;
+        AStatsEvent* statsEvent = AStatsEvent_obtain();
+        AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+        if (i % 100 == 0) {
+            AStatsEvent_setAtomId(statsEvent, util::SCREEN_STATE_CHANGED);
+            AStatsEvent_writeInt32(statsEvent, (i / 100) % 2 == 0
+                                                       ? android::view::DISPLAY_STATE_OFF
+                                                       : android::view::DISPLAY_STATE_ON);
+        } else {
+            const int uid = 10000 + (i / 2) % numUids;
+            const string jobName = "job" + std::to_string(uid);
+            AStatsEvent_setAtomId(statsEvent, util::SCHEDULED_JOB_STATE_CHANGED);
+            writeAttribution(statsEvent, {uid}, {"tag"});
+            AStatsEvent_writeString(statsEvent, jobName.c_str());
+            AStatsEvent_writeInt32(statsEvent, i % 2 == 0 ? ScheduledJobStateChanged::STARTED
+                                                          : ScheduledJobStateChanged::FINISHED);
+        }
+        atoms.push_back(buildAtom(statsEvent));
+    }
+    return atoms;
+}
+
+bool loadReplayWorkload(ReplayWorkload* workload, string* error) {
+    const char* configPaths = getenv(kConfigsEnv);
+    const char* tracePath = getenv(kTraceEnv);
+    if (configPaths == nullptr || tracePath == nullptr) {
+        workload->timeBaseNs = 10 * NS_PER_SEC;
+        workload->configs.push_back(createSyntheticConfig());
+        workload->atoms = createSyntheticTrace(workload->timeBaseNs);
+        return true;
+    }
+
+    std::stringstream paths(configPaths);
+    for (string path; std::getline(paths, path, ':');) {
+        if (!readReplayConfig(path, &workload->configs.emplace_back())) {
+            *error = "Failed to read config " + path;
+            return false;
+        }
+    }
+    if (!readReplayTrace(tracePath, &workload->atoms) || workload->atoms.empty()) {
+        *error = string("Failed to read trace ") + tracePath;
+        return false;
+    }
+    // The configs are added just before the first atom of the trace.
+    workload->timeBaseNs = std::numeric_limits<int64_t>::max();
+    for (const ReplayAtom& atom : workload->atoms) {
+        LogEvent event(atom.uid, atom.pid);
+        event.parseHeader(atom.buffer.data(), atom.buffer.size());
+        workload->timeBaseNs = std::min(workload->timeBaseNs, event.GetElapsedTimestampNs());
+    }
+    return true;
+}
+
+sp<StatsLogProcessor> createReplayProcessor(const ReplayWorkload& workload,
+                                            const std::shared_ptr<LogEventFilter>& filter) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    sp<StatsLogProcessor> processor = new StatsLogProcessor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor,
+            workload.timeBaseNs, [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {}, filter);
+    for (size_t i = 0; i < workload.configs.size(); i++) {
+        processor->OnConfigUpdated(workload.timeBaseNs, ConfigKey(kReplayUid, i),
+                                   workload.configs[i]);
+    }
+    return processor;
+}
+
+int64_t getPercentile(const vector<int64_t>& sortedValues, const double percentile) {
+    if (sortedValues.empty()) {
+        return 0;
+    }
+    return sortedValues[(size_t)(percentile * (sortedValues.size() - 1))];
+}
+
+}  // namespace
+
+/**
+ * Replays atoms the way statsd processes them: the socket thread parses each atom into a
+ * LogEvent of the pool and submits it to the queue, and the events thread drains the queue in
+ * batches into the processor and gives the events back to the pool.
+ */
+class ReplayHarness {
+public:
+    explicit ReplayHarness(const std::shared_ptr<LogEventFilter>& filter)
+        : mQueue(std::make_shared<LogEventQueue>(4 * kReplayBatchSize)),
+          mPool(std::make_shared<LogEventPool>(4 * kReplayBatchSize)),
+          mFilter(filter) {
+    }
+
+    // Appends the latency of each atom, from its submission until its batch is processed.
+    void replay(const vector<ReplayAtom>& atoms, StatsLogProcessor& processor,
+                vector<int64_t>* latenciesNs) {
+        vector<int64_t> submitTimesNs;
+        submitTimesNs.reserve(kReplayBatchSize);
+        for (size_t start = 0; start < atoms.size(); start += kReplayBatchSize) {
+            const size_t end = std::min(start + kReplayBatchSize, atoms.size());
+            submitTimesNs.clear();
+            for (size_t i = start; i < end; i++) {
+                submitTimesNs.push_back(getElapsedRealtimeNs());
+                StatsSocketListener::processMessage(atoms[i].buffer.data(),
+                                                    atoms[i].buffer.size(), atoms[i].uid,
+                                                    atoms[i].pid, mQueue, mFilter, mPool);
+            }
+            vector<unique_ptr<LogEvent>> events = mQueue->waitPopBatch(end - start);
+            processor.OnLogEvents(events);
+            const int64_t processedTimeNs = getElapsedRealtimeNs();
+            for (const int64_t submitTimeNs : submitTimesNs) {
+                latenciesNs->push_back(processedTimeNs - submitTimeNs);
+            }
+            mPool->recycle(events);
+        }
+    }
+
+private:
+    const std::shared_ptr<LogEventQueue> mQueue;
+    const std::shared_ptr<LogEventPool> mPool;
+    const std::shared_ptr<LogEventFilter> mFilter;
+};
+
+static void BM_ReplayTrace(benchmark::State& state) {
+    ReplayWorkload workload;
+    string error;
+    if (!loadReplayWorkload(&workload, &error)) {
+        state.SkipWithError(error.c_str());
+        return;
+    }
+
+    vector<int64_t> latenciesNs;
+    int64_t allocations = 0;
+    for (auto _ : state) {
+        // Every iteration replays the trace into a processor with fresh metrics.
+        state.PauseTiming();
+        std::shared_ptr<LogEventFilter> filter = std::make_shared<LogEventFilter>();
+        sp<StatsLogProcessor> processor = createReplayProcessor(workload, filter);
+        ReplayHarness harness(filter);
+        state.ResumeTiming();
+
+        const int64_t allocationsBefore = getAllocationCount();
+        harness.replay(workload.atoms, *processor, &latenciesNs);
+        allocations += getAllocationCount() - allocationsBefore;
+    }
+
+    const int64_t numAtoms = state.iterations() * workload.atoms.size();
+    state.SetItemsProcessed(numAtoms);
+    std::sort(latenciesNs.begin(), latenciesNs.end());
+    state.counters["p50_latency_ns"] = getPercentile(latenciesNs, 0.5);
+    state.counters["p99_latency_ns"] = getPercentile(latenciesNs, 0.99);
+    state.counters["allocs_per_atom"] = numAtoms > 0 ? (double)allocations / numAtoms : 0;
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        state.counters["peak_rss_kb"] = usage.ru_maxrss;
+    }
+}
+BENCHMARK(BM_ReplayTrace)->Unit(benchmark::kMillisecond);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "replay_trace.h"
+
+#include <fstream>
+#include <iterator>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+struct RecordHeader {
+    uint32_t uid;
+    uint32_t pid;
+    uint32_t size;
+};
+
+}  // namespace
+
+bool readReplayTrace(const std::string& path, std::vector<ReplayAtom>* atoms) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    RecordHeader header;
+    while (file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        ReplayAtom& atom = atoms->emplace_back();
+        atom.uid = header.uid;
+        atom.pid = header.pid;
+        atom.buffer.resize(header.size);
+        if (!file.read(reinterpret_cast<char*>(atom.buffer.data()), header.size)) {
+            return false;
+        }
+    }
+    // A partial header is a truncated record.
+    return file.gcount() == 0;
+}
+
+bool writeReplayTrace(const std::string& path, const std::vector<ReplayAtom>& atoms) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    for (const ReplayAtom& atom : atoms) {
+        const RecordHeader header = {atom.uid, atom.pid, (uint32_t)atom.buffer.size()};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(atom.buffer.data()), atom.buffer.size());
+    }
+    return file.good();
+}
+
+bool readReplayConfig(const std::string& path, StatsdConfig* config) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    const std::string data((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+    return config->ParseFromString(data);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
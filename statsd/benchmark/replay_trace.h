@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "src/statsd_config.pb.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// An atom as statsd received it on its socket.
+struct ReplayAtom {
+    uint32_t uid;
+    uint32_t pid;
+    // The StatsEvent buffer, i.e. the datagram after the socket header and the event tag, as
+    // StatsSocketListener::processMessage() receives it. Batched atoms are separate atoms.
+    std::vector<uint8_t> buffer;
+};
+
+/**
+ * Reads a trace of atoms. The file is a sequence of records, each a header of three uint32_t in
+ * host byte order, the uid and pid of the sender and the size of the atom buffer, followed by
+ * the atom buffer. Returns false if the file cannot be read or a record is truncated.
+ */
+bool readReplayTrace(const std::string& path, std::vector<ReplayAtom>* atoms);
+
+// Writes a trace of atoms that readReplayTrace() reads back.
+bool writeReplayTrace(const std::string& path, const std::vector<ReplayAtom>& atoms);
+
+// Reads a serialized StatsdConfig, as pushed to statsd, from a file.
+bool readReplayConfig(const std::string& path, StatsdConfig* config);
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
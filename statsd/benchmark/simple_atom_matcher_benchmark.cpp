@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "logd/LogEvent.h"
+#include "matchers/matcher_util.h"
+#include "metric_util.h"
+#include "stats_event.h"
+#include "stats_log_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+static void createLogEventAndMatcher(LogEvent* event, SimpleAtomMatcher* simpleMatcher) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, 1);
+    AStatsEvent_overwriteTimestamp(statsEvent, 100000);
+
+    std::vector<int> attributionUids = {100, 200, 300};
+    std::vector<string> attributionTags = {"LOCATION", "LOCATION", "LOCATION"};
+    writeAttribution(statsEvent, attributionUids, attributionTags);
+
+    AStatsEvent_writeFloat(statsEvent, 3.2f);
+    AStatsEvent_writeString(statsEvent, "LOCATION");
+    AStatsEvent_writeInt64(statsEvent, 990);
+
+    parseStatsEventToLogEvent(statsEvent, event);
+
+    simpleMatcher->set_atom_id(1);
+
+    // Any attribution uid in a list of 20 uids.
+    FieldValueMatcher* attributionMatcher = simpleMatcher->add_field_value_matcher();
+    attributionMatcher->set_field(1);
+    attributionMatcher->set_position(ANY);
+    FieldValueMatcher* uidMatcher =
+            attributionMatcher->mutable_matches_tuple()->add_field_value_matcher();
+    uidMatcher->set_field(1);
+    for (int uid = 1000; uid > 0; uid -= 50) {
+        uidMatcher->mutable_eq_any_int()->add_int_value(uid);
+    }
+
+    simpleMatcher->add_field_value_matcher()->set_field(2);
+    simpleMatcher->mutable_field_value_matcher(1)->set_gt_float(1.5f);
+
+    simpleMatcher->add_field_value_matcher()->set_field(4);
+    simpleMatcher->mutable_field_value_matcher(2)->set_lte_int(1000);
+}
+
+static void BM_MatchesSimpleProto(benchmark::State& state) {
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    SimpleAtomMatcher simpleMatcher;
+    createLogEventAndMatcher(&event, &simpleMatcher);
+    sp<UidMap> uidMap = new UidMap();
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(matchesSimple(uidMap, simpleMatcher, event));
+    }
+}
+
+BENCHMARK(BM_MatchesSimpleProto);
+
+static void BM_MatchesSimpleCompiled(benchmark::State& state) {
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    SimpleAtomMatcher simpleMatcher;
+    createLogEventAndMatcher(&event, &simpleMatcher);
+    const CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(simpleMatcher);
+    sp<UidMap> uidMap = new UidMap();
+
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(matchesSimple(uidMap, compiled, event));
+    }
+}
+
+BENCHMARK(BM_MatchesSimpleCompiled);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "metric_util.h"
+#include "state/StateManager.h"
+#include "stats_event.h"
+#include "statslog_statsd.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+namespace {
+
+const int kFirstUid = 10000;
+// Cycles through as many process states.
+const int kStateCount = 4;
+
+class CountingStateListener : public StateListener {
+public:
+    void onStateChanged(const int64_t eventTimeNs, const int32_t atomId,
+                        const HashableDimensionKey& primaryKey, const FieldValue& oldState,
+                        const FieldValue& newState) override {
+        mChanges++;
+    }
+
+    int64_t mChanges = 0;
+};
+
+std::unique_ptr<LogEvent> createUidProcessStateChangedEvent(const int64_t timestampNs,
+                                                            const int uid, const int state) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, util::UID_PROCESS_STATE_CHANGED);
+    AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+    AStatsEvent_writeInt32(statsEvent, uid);
+    AStatsEvent_addBoolAnnotation(statsEvent, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+    AStatsEvent_addBoolAnnotation(statsEvent, ASTATSLOG_ANNOTATION_ID_PRIMARY_FIELD, true);
+    AStatsEvent_writeInt32(statsEvent, state);
+    AStatsEvent_addBoolAnnotation(statsEvent, ASTATSLOG_ANNOTATION_ID_EXCLUSIVE_STATE, true);
+    AStatsEvent_addBoolAnnotation(statsEvent, ASTATSLOG_ANNOTATION_ID_STATE_NESTED, false);
+
+    // Logged by AID_ROOT, which the StateManager accepts state atoms from.
+    std::unique_ptr<LogEvent> event = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+    parseStatsEventToLogEvent(statsEvent, event.get());
+    return event;
+}
+
+// Every event changes the state of one of primaryKeyCount uids.
+vector<std::unique_ptr<LogEvent>> createStateEvents(const int primaryKeyCount) {
+    vector<std::unique_ptr<LogEvent>> events;
+    for (int i = 0; i < primaryKeyCount * kStateCount; i++) {
+        events.push_back(createUidProcessStateChangedEvent(
+                /*timestampNs=*/1000 + i, kFirstUid + i % primaryKeyCount,
+                /*state=*/1000 + i / primaryKeyCount));
+    }
+    return events;
+}
+
+void runStateChanges(benchmark::State& state, const int listenerCount,
+                     const int primaryKeyCount) {
+    StateManager stateManager;
+    vector<sp<CountingStateListener>> listeners;
+    for (int i = 0; i < listenerCount; i++) {
+        listeners.push_back(new CountingStateListener());
+        stateManager.registerListener(util::UID_PROCESS_STATE_CHANGED, listeners.back());
+    }
+    const vector<std::unique_ptr<LogEvent>> events = createStateEvents(primaryKeyCount);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        stateManager.onLogEvent(*events[i++ % events.size()]);
+    }
+    benchmark::DoNotOptimize(listeners.front()->mChanges);
+}
+
+}  // anonymous namespace
+
+// Notifies a growing number of listeners, such as the metrics sliced by the state, of each change.
+static void BM_StateManagerListeners(benchmark::State& state) {
+    runStateChanges(state, /*listenerCount=*/state.range(0), /*primaryKeyCount=*/16);
+}
+BENCHMARK(BM_StateManagerListeners)->RangeMultiplier(4)->Range(1, 256);
+
+// Tracks the state of a growing number of primary keys.
+static void BM_StateManagerPrimaryKeys(benchmark::State& state) {
+    runStateChanges(state, /*listenerCount=*/1, /*primaryKeyCount=*/state.range(0));
+}
+BENCHMARK(BM_StateManagerPrimaryKeys)->RangeMultiplier(4)->Range(1, 4096);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
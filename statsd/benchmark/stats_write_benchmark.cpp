@@ -13,6 +13,8 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <stats_annotations.h>
+#include <stats_event.h>
 #include <statslog.h>
 
 #include "benchmark/benchmark.h"
@@ -58,6 +60,83 @@ static void BM_StatsWriteViaQueue(benchmark::State& state) {
 }
 BENCHMARK(BM_StatsWriteViaQueue);
 
+// Encodes an atom shaped like APP_BREADCRUMB_REPORTED field by field.
+static void BM_StatsEventEncode(benchmark::State& state) {
+    int32_t label = 100;
+    while (state.KeepRunning()) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, android::util::APP_BREADCRUMB_REPORTED);
+        AStatsEvent_writeInt32(event, 0);
+        AStatsEvent_addBoolAnnotation(event, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+        AStatsEvent_writeInt32(event, label++);
+        AStatsEvent_writeInt32(event, 1);
+        AStatsEvent_build(event);
+        benchmark::DoNotOptimize(AStatsEvent_getBuffer(event, nullptr));
+        AStatsEvent_release(event);
+    }
+}
+BENCHMARK(BM_StatsEventEncode);
+
+// Same atom as BM_StatsEventEncode, encoded again in a single event reset between atoms.
+static void BM_StatsEventResetEncode(benchmark::State& state) {
+    int32_t label = 100;
+    AStatsEvent* event = AStatsEvent_obtain();
+    while (state.KeepRunning()) {
+        AStatsEvent_reset(event);
+        AStatsEvent_setAtomId(event, android::util::APP_BREADCRUMB_REPORTED);
+        AStatsEvent_writeInt32(event, 0);
+        AStatsEvent_addBoolAnnotation(event, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+        AStatsEvent_writeInt32(event, label++);
+        AStatsEvent_writeInt32(event, 1);
+        AStatsEvent_build(event);
+        benchmark::DoNotOptimize(AStatsEvent_getBuffer(event, nullptr));
+    }
+    AStatsEvent_release(event);
+}
+BENCHMARK(BM_StatsEventResetEncode);
+
+// Same atom as BM_StatsEventEncode, only the values are filled into a reused template.
+static void BM_StatsEventTemplateEncode(benchmark::State& state) {
+    AStatsEvent* prototype = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(prototype, android::util::APP_BREADCRUMB_REPORTED);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEvent_addBoolAnnotation(prototype, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEventTemplate* eventTemplate = AStatsEventTemplate_create(prototype);
+    AStatsEvent_release(prototype);
+
+    int32_t label = 100;
+    while (state.KeepRunning()) {
+        AStatsEventTemplate_setInt32(eventTemplate, 0, 0);
+        AStatsEventTemplate_setInt32(eventTemplate, 1, label++);
+        AStatsEventTemplate_setInt32(eventTemplate, 2, 1);
+        benchmark::DoNotOptimize(AStatsEventTemplate_getBuffer(eventTemplate, nullptr));
+    }
+    AStatsEventTemplate_release(eventTemplate);
+}
+BENCHMARK(BM_StatsEventTemplateEncode);
+
+static void BM_StatsWriteTemplateViaQueue(benchmark::State& state) {
+    AStatsEvent* prototype = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(prototype, android::util::APP_BREADCRUMB_REPORTED);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEvent_addBoolAnnotation(prototype, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEvent_writeInt32(prototype, 0);
+    AStatsEventTemplate* eventTemplate = AStatsEventTemplate_create(prototype);
+    AStatsEvent_release(prototype);
+
+    int32_t a_state = 1;
+    AStatsEventTemplate_setInt32(eventTemplate, 1, 100);
+    while (state.KeepRunning()) {
+        AStatsEventTemplate_setInt32(eventTemplate, 2, a_state++);
+        benchmark::DoNotOptimize(AStatsEventTemplate_write(eventTemplate));
+    }
+    AStatsEventTemplate_release(eventTemplate);
+}
+BENCHMARK(BM_StatsWriteTemplateViaQueue);
+
 }  //  namespace statsd
 }  //  namespace os
 }  //  namespace android
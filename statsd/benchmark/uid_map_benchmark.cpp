@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "packages/UidMap.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+const int kFirstUid = 10000;
+
+string getPackageName(const int index) {
+    return "com.android.benchmark.package" + std::to_string(index);
+}
+
+// One package per uid.
+sp<UidMap> createUidMap(const int packageCount) {
+    UidData uidData;
+    for (int i = 0; i < packageCount; i++) {
+        ApplicationInfo* appInfo = uidData.add_app_info();
+        appInfo->set_uid(kFirstUid + i);
+        appInfo->set_version(i);
+        appInfo->set_version_string("v" + std::to_string(i));
+        appInfo->set_package_name(getPackageName(i));
+        appInfo->set_installer("com.android.vending");
+    }
+    sp<UidMap> uidMap = new UidMap();
+    uidMap->updateMap(/*timestamp=*/1, uidData);
+    return uidMap;
+}
+
+}  // anonymous namespace
+
+static void BM_UidMapHasApp(benchmark::State& state) {
+    const int packageCount = state.range(0);
+    const sp<UidMap> uidMap = createUidMap(packageCount);
+    const string packageName = getPackageName(packageCount / 2);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(uidMap->hasApp(kFirstUid + packageCount / 2, packageName));
+    }
+}
+BENCHMARK(BM_UidMapHasApp)->RangeMultiplier(4)->Range(16, 4096);
+
+static void BM_UidMapGetAppVersion(benchmark::State& state) {
+    const int packageCount = state.range(0);
+    const sp<UidMap> uidMap = createUidMap(packageCount);
+    const string packageName = getPackageName(packageCount / 2);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+                uidMap->getAppVersion(kFirstUid + packageCount / 2, packageName));
+    }
+}
+BENCHMARK(BM_UidMapGetAppVersion)->RangeMultiplier(4)->Range(16, 4096);
+
+// The uids of a package, as used to match the uid fields of atoms against package names.
+static void BM_UidMapGetAppUid(benchmark::State& state) {
+    const int packageCount = state.range(0);
+    const sp<UidMap> uidMap = createUidMap(packageCount);
+    const string packageName = getPackageName(packageCount / 2);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(uidMap->getAppUid(packageName));
+    }
+}
+BENCHMARK(BM_UidMapGetAppUid)->RangeMultiplier(4)->Range(16, 4096);
+
+// The package names of a uid, as used to translate uid fields in dimensions.
+static void BM_UidMapGetAppNamesFromUid(benchmark::State& state) {
+    const int packageCount = state.range(0);
+    const sp<UidMap> uidMap = createUidMap(packageCount);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(uidMap->getAppNamesFromUid(kFirstUid + packageCount / 2,
+                                                            /*returnNormalized=*/true));
+    }
+}
+BENCHMARK(BM_UidMapGetAppNamesFromUid)->RangeMultiplier(4)->Range(16, 4096);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <memory>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "benchmark/benchmark.h"
+#include "workload_generator.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+const int64_t kWorkloadTimeBaseNs = 10 * NS_PER_SEC;
+
+// Processes the events of the options into a processor with fresh metrics at every iteration,
+// and reports the events processed per second and the allocations of the metric updates.
+void runWorkload(benchmark::State& state, const WorkloadOptions& options) {
+    const vector<unique_ptr<LogEvent>> events =
+            createWorkloadEvents(options, kWorkloadTimeBaseNs);
+    AllocationCounters allocationCounters;
+    for (auto _ : state) {
+        state.PauseTiming();
+        allocationCounters.pause();
+        sp<StatsLogProcessor> processor = createWorkloadProcessor(options, kWorkloadTimeBaseNs);
+        allocationCounters.resume();
+        state.ResumeTiming();
+
+        for (const unique_ptr<LogEvent>& event : events) {
+            processor->OnLogEvent(event.get());
+        }
+    }
+    allocationCounters.report(state);
+    state.SetItemsProcessed(state.iterations() * events.size());
+}
+
+// All the features on, with the arguments setting the size of the workload.
+WorkloadOptions createFullWorkloadOptions(const int numConfigs, const int numMetrics,
+                                          const int cardinality) {
+    WorkloadOptions options;
+    options.numConfigs = numConfigs;
+    options.numMetrics = numMetrics;
+    options.numDimensions = 2;
+    options.condition = true;
+    options.sliceByState = true;
+    options.activation = true;
+    options.alert = true;
+    options.cardinality = cardinality;
+    return options;
+}
+
+}  // namespace
+
+// Events per second against the number of configs.
+static void BM_WorkloadConfigs(benchmark::State& state) {
+    runWorkload(state, createFullWorkloadOptions(state.range(0), /*numMetrics=*/10,
+                                                 /*cardinality=*/100));
+}
+BENCHMARK(BM_WorkloadConfigs)->RangeMultiplier(2)->Range(1, 32)->Unit(benchmark::kMillisecond);
+
+// Events per second against the number of metrics of a config.
+static void BM_WorkloadMetrics(benchmark::State& state) {
+    runWorkload(state, createFullWorkloadOptions(/*numConfigs=*/1, state.range(0),
+                                                 /*cardinality=*/100));
+}
+BENCHMARK(BM_WorkloadMetrics)->RangeMultiplier(2)->Range(5, 160)->Unit(benchmark::kMillisecond);
+
+// Events per second against the number of dimension keys.
+static void BM_WorkloadCardinality(benchmark::State& state) {
+    runWorkload(state, createFullWorkloadOptions(/*numConfigs=*/1, /*numMetrics=*/10,
+                                                 state.range(0)));
+}
+BENCHMARK(BM_WorkloadCardinality)
+        ->RangeMultiplier(4)
+        ->Range(1, 4096)
+        ->Unit(benchmark::kMillisecond);
+
+// Events per second against the number of dimensions, each feature off and on.
+static void BM_WorkloadFeatures(benchmark::State& state) {
+    WorkloadOptions options;
+    options.numMetrics = 10;
+    options.numDimensions = state.range(0);
+    options.condition = state.range(1);
+    options.sliceByState = state.range(2);
+    options.activation = state.range(3);
+    options.alert = state.range(4);
+    runWorkload(state, options);
+}
+BENCHMARK(BM_WorkloadFeatures)
+        ->ArgNames({"dimensions", "condition", "state", "activation", "alert"})
+        ->ArgsProduct({{0, 1, 3}, {0, 1}, {0, 1}, {0, 1}, {0, 1}})
+        ->Unit(benchmark::kMillisecond);
+
+// Events per second against the size of the bursts the events arrive in.
+static void BM_WorkloadBurstiness(benchmark::State& state) {
+    WorkloadOptions options = createFullWorkloadOptions(/*numConfigs=*/1, /*numMetrics=*/10,
+                                                        /*cardinality=*/100);
+    options.burstSize = state.range(0);
+    runWorkload(state, options);
+}
+BENCHMARK(BM_WorkloadBurstiness)
+        ->RangeMultiplier(8)
+        ->Range(1, 512)
+        ->Unit(benchmark::kMillisecond);
+
+// Time and allocations of dumping the reports of all the configs, against the number of dimension
+// keys. The data is erased by the dump, so that each iteration dumps a freshly filled processor.
+static void BM_WorkloadDumpReport(benchmark::State& state) {
+    const WorkloadOptions options = createFullWorkloadOptions(/*numConfigs=*/1,
+                                                              /*numMetrics=*/10, state.range(0));
+    const vector<unique_ptr<LogEvent>> events =
+            createWorkloadEvents(options, kWorkloadTimeBaseNs);
+    const int64_t dumpTimeNs = events.back()->GetElapsedTimestampNs() + 1;
+    AllocationCounters allocationCounters;
+    int64_t reportBytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        allocationCounters.pause();
+        sp<StatsLogProcessor> processor = createWorkloadProcessor(options, kWorkloadTimeBaseNs);
+        for (const unique_ptr<LogEvent>& event : events) {
+            processor->OnLogEvent(event.get());
+        }
+        vector<uint8_t> output;
+        allocationCounters.resume();
+        state.ResumeTiming();
+
+        processor->onDumpReport(ConfigKey(kWorkloadUid, 0), dumpTimeNs, dumpTimeNs,
+                                /*include_current_partial_bucket=*/true, /*erase_data=*/true,
+                                ADB_DUMP, FAST, &output);
+
+        state.PauseTiming();
+        allocationCounters.pause();
+        reportBytes += output.size();
+        processor = nullptr;
+        output = vector<uint8_t>();
+        allocationCounters.resume();
+        state.ResumeTiming();
+    }
+    allocationCounters.report(state);
+    state.counters["report_bytes"] =
+            benchmark::Counter(reportBytes, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_WorkloadDumpReport)
+        ->RangeMultiplier(8)
+        ->Range(1, 4096)
+        ->Unit(benchmark::kMillisecond);
+
+}  //  namespace statsd
+}  //  namespace os
+}  //  namespace android
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "workload_generator.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+#include "metric_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+const int kNumMetricTypes = 5;
+
+const int kMaxNumDimensions = 3;
+
+const int64_t kActivationTtlSecs = 60;
+
+FieldMatcher createWorkloadDimensions(const int numDimensions) {
+    FieldMatcher dimensions =
+            CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+    if (numDimensions >= 2) {
+        dimensions.add_child()->set_field(3);  // tag field.
+    }
+    if (numDimensions >= 3) {
+        dimensions.add_child()->set_field(2);  // type field.
+    }
+    return dimensions;
+}
+
+// Sets the fields that the bucketed metric types share.
+template <typename T>
+void setBucketedMetricFields(const WorkloadOptions& options, const int64_t metricId,
+                             const Predicate& condition, const FieldMatcher& dimensions,
+                             T* metric) {
+    metric->set_id(metricId);
+    metric->set_bucket(FIVE_MINUTES);
+    if (options.condition) {
+        metric->set_condition(condition.id());
+    }
+    if (options.numDimensions > 0) {
+        *metric->mutable_dimensions_in_what() = dimensions;
+    }
+}
+
+void addAlert(const int index, const int64_t metricId, const double threshold,
+              StatsdConfig* config) {
+    Alert* alert = config->add_alert();
+    alert->set_id(StringToId("WorkloadAlert" + std::to_string(index)));
+    alert->set_metric_id(metricId);
+    alert->set_num_buckets(2);
+    alert->set_refractory_period_secs(60);
+    alert->set_trigger_if_sum_gt(threshold);
+}
+
+}  // namespace
+
+StatsdConfig createWorkloadConfig(const WorkloadOptions& options) {
+    StatsdConfig config;
+    config.set_id(StringToId("Workload"));
+    const AtomMatcher acquireMatcher = CreateAcquireWakelockAtomMatcher();
+    const AtomMatcher screenTurnedOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = acquireMatcher;
+    *config.add_atom_matcher() = CreateReleaseWakelockAtomMatcher();
+    *config.add_atom_matcher() = screenTurnedOnMatcher;
+    *config.add_atom_matcher() = CreateScreenTurnedOffAtomMatcher();
+
+    const int numDimensions = std::min(options.numDimensions, kMaxNumDimensions);
+    const FieldMatcher dimensions = createWorkloadDimensions(numDimensions);
+    Predicate wakelockPredicate = CreateHoldingWakelockPredicate();
+    if (numDimensions > 0) {
+        *wakelockPredicate.mutable_simple_predicate()->mutable_dimensions() = dimensions;
+    }
+    const Predicate screenIsOffPredicate = CreateScreenIsOffPredicate();
+    *config.add_predicate() = wakelockPredicate;
+    *config.add_predicate() = screenIsOffPredicate;
+
+    const int64_t screenStateId = StringToId("ScreenState");
+    if (options.sliceByState) {
+        State* state = config.add_state();
+        state->set_id(screenStateId);
+        state->set_atom_id(util::SCREEN_STATE_CHANGED);
+    }
+
+    for (int i = 0; i < options.numMetrics; i++) {
+        const int64_t metricId = StringToId("WorkloadMetric" + std::to_string(i));
+        switch (i % kNumMetricTypes) {
+            case 0: {
+                CountMetric* countMetric = config.add_count_metric();
+                countMetric->set_what(acquireMatcher.id());
+                setBucketedMetricFields(options, metricId, screenIsOffPredicate, dimensions,
+                                        countMetric);
+                if (options.sliceByState) {
+                    countMetric->add_slice_by_state(screenStateId);
+                }
+                if (options.alert) {
+                    addAlert(i, metricId, /*threshold=*/10, &config);
+                }
+                break;
+            }
+            case 1: {
+                DurationMetric* durationMetric = config.add_duration_metric();
+                durationMetric->set_what(wakelockPredicate.id());
+                durationMetric->set_aggregation_type(DurationMetric::SUM);
+                setBucketedMetricFields(options, metricId, screenIsOffPredicate, dimensions,
+                                        durationMetric);
+                if (options.sliceByState) {
+                    durationMetric->add_slice_by_state(screenStateId);
+                }
+                if (options.alert) {
+                    addAlert(i, metricId, /*threshold=*/10 * NS_PER_SEC, &config);
+                }
+                break;
+            }
+            case 2: {
+                ValueMetric* valueMetric = config.add_value_metric();
+                valueMetric->set_what(acquireMatcher.id());
+                *valueMetric->mutable_value_field() =
+                        CreateDimensions(util::WAKELOCK_STATE_CHANGED, {2 /* type field */});
+                valueMetric->set_aggregation_type(ValueMetric::SUM);
+                setBucketedMetricFields(options, metricId, screenIsOffPredicate, dimensions,
+                                        valueMetric);
+                if (options.sliceByState) {
+                    valueMetric->add_slice_by_state(screenStateId);
+                }
+                break;
+            }
+            case 3: {
+                GaugeMetric* gaugeMetric = config.add_gauge_metric();
+                gaugeMetric->set_what(acquireMatcher.id());
+                gaugeMetric->mutable_gauge_fields_filter()->set_include_all(true);
+                gaugeMetric->set_sampling_type(GaugeMetric::FIRST_N_SAMPLES);
+                setBucketedMetricFields(options, metricId, screenIsOffPredicate, dimensions,
+                                        gaugeMetric);
+                break;
+            }
+            default: {
+                EventMetric* eventMetric = config.add_event_metric();
+                eventMetric->set_id(metricId);
+                eventMetric->set_what(acquireMatcher.id());
+                if (options.condition) {
+                    eventMetric->set_condition(screenIsOffPredicate.id());
+                }
+                break;
+            }
+        }
+
+        if (options.activation) {
+            MetricActivation* metricActivation = config.add_metric_activation();
+            metricActivation->set_metric_id(metricId);
+            EventActivation* eventActivation = metricActivation->add_event_activation();
+            eventActivation->set_atom_matcher_id(screenTurnedOnMatcher.id());
+            eventActivation->set_ttl_seconds(kActivationTtlSecs);
+            eventActivation->set_activation_type(ACTIVATE_IMMEDIATELY);
+        }
+    }
+    return config;
+}
+
+// Wakelocks picked at random among options.cardinality, each acquired and released in turn,
+// while the screen turns off and on.
+vector<unique_ptr<LogEvent>> createWorkloadEvents(const WorkloadOptions& options,
+                                                  const int64_t timeBaseNs) {
+    std::mt19937 generator(options.seed);
+    std::uniform_int_distribution<int> keyDistribution(0, std::max(options.cardinality, 1) - 1);
+    const int burstSize = std::max(options.burstSize, 1);
+    vector<bool> held(std::max(options.cardinality, 1));
+
+    vector<unique_ptr<LogEvent>> events;
+    events.reserve(options.numEvents + options.numEvents / options.screenToggleEvents + 1);
+    for (int i = 0; i < options.numEvents; i++) {
+        const int64_t timestampNs =
+                timeBaseNs + (i / burstSize + 1) * burstSize * options.eventIntervalNs +
+                i % burstSize;
+        if (i % options.screenToggleEvents == 0) {
+            events.push_back(CreateScreenStateChangedEvent(
+                    timestampNs, (i / options.screenToggleEvents) % 2 == 0
+                                         ? android::view::DISPLAY_STATE_OFF
+                                         : android::view::DISPLAY_STATE_ON));
+        }
+
+        const int key = keyDistribution(generator);
+        const string tag = "wakelock" + std::to_string(key);
+        AStatsEvent* statsEvent = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(statsEvent, util::WAKELOCK_STATE_CHANGED);
+        AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+        writeAttribution(statsEvent, {10000 + key}, {tag});
+        AStatsEvent_writeInt32(statsEvent, key % 4);  // type field.
+        AStatsEvent_writeString(statsEvent, tag.c_str());
+        AStatsEvent_writeInt32(statsEvent, held[key] ? WakelockStateChanged::RELEASE
+                                                     : WakelockStateChanged::ACQUIRE);
+        held[key] = !held[key];
+
+        unique_ptr<LogEvent> logEvent = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+        parseStatsEventToLogEvent(statsEvent, logEvent.get());
+        events.push_back(std::move(logEvent));
+    }
+    return events;
+}
+
+sp<StatsLogProcessor> createWorkloadProcessor(const WorkloadOptions& options,
+                                              const int64_t timeBaseNs) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    sp<StatsLogProcessor> processor = new StatsLogProcessor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, timeBaseNs,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>());
+    const StatsdConfig config = createWorkloadConfig(options);
+    for (int i = 0; i < options.numConfigs; i++) {
+        processor->OnConfigUpdated(timeBaseNs, ConfigKey(kWorkloadUid, i), config);
+    }
+    return processor;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "src/StatsLogProcessor.h"
+#include "src/logd/LogEvent.h"
+#include "src/statsd_config.pb.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Parameters of a synthetic workload: configs whose metrics follow wakelocks of apps, and the
+ * wakelock and screen state events they process. The same options with the same seed always
+ * give the same workload.
+ */
+struct WorkloadOptions {
+    // Each config is a copy of the same config, added under its own ConfigKey.
+    int numConfigs = 1;
+
+    // Metrics of each config. Their types cycle through count, duration, value, gauge and
+    // event metrics.
+    int numMetrics = 5;
+
+    // Dimensions in what of the metrics, out of the attribution uid, the tag and the type of
+    // the wakelock. Event metrics have none.
+    int numDimensions = 1;
+
+    // Whether the metrics are conditioned on the screen being off.
+    bool condition = false;
+
+    // Whether the count, duration and value metrics are sliced by the screen state.
+    bool sliceByState = false;
+
+    // Whether the metrics are only active for a minute after the screen turns on.
+    bool activation = false;
+
+    // Whether the count and duration metrics have an alert.
+    bool alert = false;
+
+    // Wakelock events in the stream. Screen state events are added to them.
+    int numEvents = 10000;
+
+    // Distinct wakelocks, and so dimension keys, in the stream.
+    int cardinality = 100;
+
+    // Events arrive in bursts of this size, 1 ns apart. The bursts are spaced so that the
+    // event rate stays 1 / eventIntervalNs whatever the burst size.
+    int burstSize = 1;
+
+    // The default spreads the stream over a few buckets of five minutes.
+    int64_t eventIntervalNs = NS_PER_SEC / 10;
+
+    // The screen turns on or off after every this many wakelock events.
+    int screenToggleEvents = 100;
+
+    uint32_t seed = 1;
+};
+
+// Uid of the ConfigKeys of the configs, whose ids count from 0.
+const int kWorkloadUid = 1000;
+
+// Builds the config described by the options.
+StatsdConfig createWorkloadConfig(const WorkloadOptions& options);
+
+// Builds the event stream described by the options, in timestamp order, from timeBaseNs.
+std::vector<std::unique_ptr<LogEvent>> createWorkloadEvents(const WorkloadOptions& options,
+                                                            int64_t timeBaseNs);
+
+// Creates a processor with the config of the options added numConfigs times at timeBaseNs.
+sp<StatsLogProcessor> createWorkloadProcessor(const WorkloadOptions& options,
+                                              int64_t timeBaseNs);
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
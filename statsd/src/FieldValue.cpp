@@ -128,6 +128,17 @@ int32_t getUidIfExists(const FieldValue& value) {
     return isUid ? value.mValue.int_value : -1;
 }
 
+void addTopLevelFields(const std::vector<Matcher>& matchers, AtomFieldMasks* masks) {
+    for (const Matcher& matcher : matchers) {
+        // Matchers of the uid field of attribution nodes, at any position, do not read the tags.
+        const bool attributionUidsOnly = matcher.mMatcher.getDepth() == 2 &&
+                                         matcher.mMatcher.getPosAtDepth(2) == 1 &&
+                                         (matcher.mMask & 0x7f) == 0x7f;
+        setTopLevelFieldInUse(matcher.mMatcher.getPosAtDepth(0), attributionUidsOnly,
+                              &(*masks)[matcher.mMatcher.getTag()]);
+    }
+}
+
 bool isAttributionUidField(const Field& field, const Value& value) {
     int f = field.getField() & 0xff007f;
     if (f == 0x10001 && value.getType() == INT) {
@@ -144,7 +155,22 @@ bool isPrimitiveRepeatedField(const Field& field) {
     return field.getDepth() == 1;
 }
 
-Value::Value(const Value& from) {
+namespace {
+
+const std::string kEmptyString;
+const std::vector<uint8_t> kEmptyStorage;
+
+}  // namespace
+
+Value::Value(const Value& from) : type(UNKNOWN) {
+    copyFrom(from);
+}
+
+Value::Value(Value&& from) noexcept : type(UNKNOWN) {
+    moveFrom(from);
+}
+
+void Value::copyFrom(const Value& from) {
     type = from.getType();
     switch (type) {
         case INT:
@@ -160,16 +186,33 @@ Value::Value(const Value& from) {
             double_value = from.double_value;
             break;
         case STRING:
-            str_value = from.str_value;
+            string_payload = from.string_payload;
+            string_payload->refCount.fetch_add(1, std::memory_order_relaxed);
             break;
         case STORAGE:
-            storage_value = from.storage_value;
+            storage_payload = from.storage_payload;
+            storage_payload->refCount.fetch_add(1, std::memory_order_relaxed);
             break;
         default:
             break;
     }
 }
 
+void Value::moveFrom(Value& from) {
+    // The union is trivially copyable, take it over wholesale along with any payload.
+    long_value = from.long_value;
+    type = from.type;
+    from.type = UNKNOWN;
+}
+
+const std::string& Value::getString() const {
+    return type == STRING ? string_payload->data : kEmptyString;
+}
+
+const std::vector<uint8_t>& Value::getStorage() const {
+    return type == STORAGE ? storage_payload->data : kEmptyStorage;
+}
+
 std::string Value::toString() const {
     switch (type) {
         case INT:
@@ -181,9 +224,9 @@ std::string Value::toString() const {
         case DOUBLE:
             return std::to_string(double_value) + "[D]";
         case STRING:
-            return str_value + "[S]";
+            return getString() + "[S]";
         case STORAGE:
-            return "bytes of size " + std::to_string(storage_value.size()) + "[ST]";
+            return "bytes of size " + std::to_string(getStorage().size()) + "[ST]";
         default:
             return "[UNKNOWN]";
     }
@@ -200,9 +243,9 @@ bool Value::isZero() const {
         case DOUBLE:
             return fabs(double_value) <= std::numeric_limits<double>::epsilon();
         case STRING:
-            return str_value.size() == 0;
+            return getString().size() == 0;
         case STORAGE:
-            return storage_value.size() == 0;
+            return getStorage().size() == 0;
         default:
             return false;
     }
@@ -221,9 +264,9 @@ bool Value::operator==(const Value& that) const {
         case DOUBLE:
             return double_value == that.double_value;
         case STRING:
-            return str_value == that.str_value;
+            return getString() == that.getString();
         case STORAGE:
-            return storage_value == that.storage_value;
+            return getStorage() == that.getStorage();
         default:
             return false;
     }
@@ -241,32 +284,34 @@ bool Value::operator!=(const Value& that) const {
         case DOUBLE:
             return double_value != that.double_value;
         case STRING:
-            return str_value != that.str_value;
+            return getString() != that.getString();
         case STORAGE:
-            return storage_value != that.storage_value;
+            return getStorage() != that.getStorage();
         default:
             return false;
     }
 }
 
 bool Value::operator<(const Value& that) const {
-    if (type != that.getType()) return type < that.getType();
+    return compare(that) < 0;
+}
 
+int Value::compareSameSortKey(const Value& that) const {
     switch (type) {
-        case INT:
-            return int_value < that.int_value;
-        case LONG:
-            return long_value < that.long_value;
         case FLOAT:
-            return float_value < that.float_value;
+            return float_value < that.float_value ? -1 : (that.float_value < float_value ? 1 : 0);
         case DOUBLE:
-            return double_value < that.double_value;
-        case STRING:
-            return str_value < that.str_value;
+            return double_value < that.double_value ? -1
+                                                    : (that.double_value < double_value ? 1 : 0);
+        case STRING: {
+            const int result = getString().compare(that.getString());
+            return result < 0 ? -1 : (result > 0 ? 1 : 0);
+        }
         case STORAGE:
-            return storage_value < that.storage_value;
+            return getStorage() < that.getStorage() ? -1
+                                                    : (that.getStorage() < getStorage() ? 1 : 0);
         default:
-            return false;
+            return 0;
     }
 }
 
@@ -283,9 +328,9 @@ bool Value::operator>(const Value& that) const {
         case DOUBLE:
             return double_value > that.double_value;
         case STRING:
-            return str_value > that.str_value;
+            return getString() > that.getString();
         case STORAGE:
-            return storage_value > that.storage_value;
+            return getStorage() > that.getStorage();
         default:
             return false;
     }
@@ -304,9 +349,9 @@ bool Value::operator>=(const Value& that) const {
         case DOUBLE:
             return double_value >= that.double_value;
         case STRING:
-            return str_value >= that.str_value;
+            return getString() >= that.getString();
         case STORAGE:
-            return storage_value >= that.storage_value;
+            return getStorage() >= that.getStorage();
         default:
             return false;
     }
@@ -348,32 +393,44 @@ Value Value::operator-(const Value& that) const {
 }
 
 Value& Value::operator=(const Value& that) {
-    type = that.type;
-    switch (type) {
-        case INT:
-            int_value = that.int_value;
-            break;
-        case LONG:
-            long_value = that.long_value;
-            break;
-        case FLOAT:
-            float_value = that.float_value;
-            break;
-        case DOUBLE:
-            double_value = that.double_value;
-            break;
-        case STRING:
-            str_value = that.str_value;
-            break;
-        case STORAGE:
-            storage_value = that.storage_value;
-            break;
-        default:
-            break;
+    if (this == &that) {
+        return *this;
     }
+    releasePayload();
+    copyFrom(that);
     return *this;
 }
 
+Value& Value::operator=(Value&& that) noexcept {
+    if (this == &that) {
+        return *this;
+    }
+    releasePayload();
+    moveFrom(that);
+    return *this;
+}
+
+Value StringValueInterner::intern(const std::string_view str) {
+    const auto it = mValues.find(str);
+    if (it != mValues.end()) {
+        return it->second;
+    }
+    Value value{std::string(str)};
+    // The payload does not move with the value, so the key stays valid.
+    const std::string_view key = value.getString();
+    return mValues.emplace(key, std::move(value)).first->second;
+}
+
+void StringValueInterner::prune() {
+    for (auto it = mValues.begin(); it != mValues.end();) {
+        if (it->second.string_payload->refCount.load(std::memory_order_acquire) == 1) {
+            it = mValues.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
 Value& Value::operator+=(const Value& that) {
     if (type != that.type) {
         ALOGE("Can't operate on different value types, %d, %d", type, that.type);
@@ -438,10 +495,10 @@ size_t Value::getSize() const {
             size = sizeof(double);
             break;
         case STRING:
-            size = sizeof(char) * str_value.length();
+            size = sizeof(char) * getString().length();
             break;
         case STORAGE:
-            size = sizeof(uint8_t) * storage_value.size();
+            size = sizeof(uint8_t) * getStorage().size();
             break;
         default:
             break;
@@ -549,7 +606,7 @@ bool ShouldUseNestedDimensions(const FieldMatcher& matcher) {
     return HasPositionALL(matcher) || HasPrimitiveRepeatedField(matcher);
 }
 
-size_t getSize(const std::vector<FieldValue>& fieldValues) {
+size_t getSize(std::span<const FieldValue> fieldValues) {
     size_t totalSize = 0;
     for (const FieldValue& fieldValue : fieldValues) {
         totalSize += fieldValue.getSize();
@@ -577,11 +634,11 @@ bool shouldKeepSample(const FieldValue& sampleFieldValue, int shardOffset, int s
                                sizeof(sampleFieldValue.mValue.double_value));
             break;
         case STRING:
-            hashValue = Hash32(sampleFieldValue.mValue.str_value);
+            hashValue = Hash32(sampleFieldValue.mValue.getString());
             break;
         case STORAGE:
-            hashValue = Hash32((const char*)sampleFieldValue.mValue.storage_value.data(),
-                               sampleFieldValue.mValue.storage_value.size());
+            hashValue = Hash32((const char*)sampleFieldValue.mValue.getStorage().data(),
+                               sampleFieldValue.mValue.getStorage().size());
             break;
         default:
             return true;
@@ -15,6 +15,14 @@
  */
 #pragma once
 
+#include <atomic>
+#include <bitset>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
 #include "src/statsd_config.pb.h"
 
 namespace android {
@@ -172,16 +180,13 @@ public:
         return mTag != that.getTag() || mField != that.getField();
     };
 
-    bool operator<(const Field& that) const {
-        if (mTag != that.getTag()) {
-            return mTag < that.getTag();
-        }
-
-        if (mField != that.getField()) {
-            return mField < that.getField();
-        }
+    // Tag and field packed in one word that orders as (mTag, mField).
+    inline uint64_t getSortKey() const {
+        return (uint64_t(uint32_t(mTag) ^ 0x80000000u) << 32) | (uint32_t(mField) ^ 0x80000000u);
+    }
 
-        return false;
+    inline bool operator<(const Field& that) const {
+        return getSortKey() < that.getSortKey();
     }
 
     bool matches(const Matcher& that) const;
@@ -279,6 +284,37 @@ inline Matcher getFirstUidMatcher(int32_t atomId) {
  * A wrapper for a union type to contain multiple types of values.
  *
  */
+/**
+ * Immutable, reference counted storage for the STRING and STORAGE payloads of a Value.
+ * Copies of a Value share the payload, so copying a FieldValue never copies the string or the
+ * byte array, and the Value itself stays the size of the numeric union.
+ */
+template <class T>
+struct ValuePayload {
+    explicit ValuePayload(const T& v) : data(v), sortPrefix(getSortPrefix(data)) {
+    }
+
+    explicit ValuePayload(T&& v) : data(std::move(v)), sortPrefix(getSortPrefix(data)) {
+    }
+
+    // First 8 bytes of data, big endian and zero padded, so that payloads whose prefixes differ
+    // order as their prefixes.
+    static uint64_t getSortPrefix(const T& v) {
+        uint64_t prefix = 0;
+        for (size_t i = 0; i < sizeof(prefix); i++) {
+            prefix <<= 8;
+            if (i < v.size()) {
+                prefix |= static_cast<uint8_t>(v[i]);
+            }
+        }
+        return prefix;
+    }
+
+    std::atomic<int32_t> refCount = 1;
+    const T data;
+    const uint64_t sortPrefix;
+};
+
 struct Value {
     Value() : type(UNKNOWN) {}
 
@@ -303,31 +339,49 @@ struct Value {
     }
 
     Value(const std::string& v) {
-        str_value = v;
+        string_payload = new ValuePayload<std::string>(v);
+        type = STRING;
+    }
+
+    Value(std::string&& v) {
+        string_payload = new ValuePayload<std::string>(std::move(v));
         type = STRING;
     }
 
     Value(const std::vector<uint8_t>& v) {
-        storage_value = v;
+        storage_payload = new ValuePayload<std::vector<uint8_t>>(v);
+        type = STORAGE;
+    }
+
+    Value(std::vector<uint8_t>&& v) {
+        storage_payload = new ValuePayload<std::vector<uint8_t>>(std::move(v));
         type = STORAGE;
     }
 
+    ~Value() {
+        releasePayload();
+    }
+
     void setInt(int32_t v) {
+        releasePayload();
         int_value = v;
         type = INT;
     }
 
     void setLong(int64_t v) {
+        releasePayload();
         long_value = v;
         type = LONG;
     }
 
     void setFloat(float v) {
+        releasePayload();
         float_value = v;
         type = FLOAT;
     }
 
     void setDouble(double v) {
+        releasePayload();
         double_value = v;
         type = DOUBLE;
     }
@@ -337,12 +391,24 @@ struct Value {
         int64_t long_value;
         float float_value;
         double double_value;
+        // Set when type is STRING.
+        ValuePayload<std::string>* string_payload;
+        // Set when type is STORAGE.
+        ValuePayload<std::vector<uint8_t>>* storage_payload;
     };
-    std::string str_value;
-    std::vector<uint8_t> storage_value;
 
     Type type;
 
+    /**
+     * Returns the string value, or an empty string if type is not STRING.
+     */
+    const std::string& getString() const;
+
+    /**
+     * Returns the byte array value, or an empty array if type is not STORAGE.
+     */
+    const std::vector<uint8_t>& getStorage() const;
+
     std::string toString() const;
 
     bool isZero() const;
@@ -355,7 +421,42 @@ struct Value {
 
     size_t getSize() const;
 
+    // Word that orders as the value among values of the same type: the value itself for INT and
+    // LONG, and the prefix of the payload for STRING and STORAGE. Zero for the other types.
+    inline uint64_t getSortKey() const {
+        switch (type) {
+            case INT:
+                return uint64_t(int64_t(int_value)) ^ (uint64_t(1) << 63);
+            case LONG:
+                return uint64_t(long_value) ^ (uint64_t(1) << 63);
+            case STRING:
+                return string_payload->sortPrefix;
+            case STORAGE:
+                return storage_payload->sortPrefix;
+            default:
+                return 0;
+        }
+    }
+
+    // Returns a negative number, zero or a positive number as this value orders before, the same
+    // as, or after that. Most comparisons are settled by the type and the sort keys.
+    inline int compare(const Value& that) const {
+        if (type != that.type) {
+            return type < that.type ? -1 : 1;
+        }
+        const uint64_t sortKey = getSortKey();
+        const uint64_t thatSortKey = that.getSortKey();
+        if (sortKey != thatSortKey) {
+            return sortKey < thatSortKey ? -1 : 1;
+        }
+        if (type == INT || type == LONG) {
+            return 0;
+        }
+        return compareSameSortKey(that);
+    }
+
     Value(const Value& from);
+    Value(Value&& from) noexcept;
 
     bool operator==(const Value& that) const;
     bool operator!=(const Value& that) const;
@@ -366,6 +467,54 @@ struct Value {
     Value operator-(const Value& that) const;
     Value& operator+=(const Value& that);
     Value& operator=(const Value& that);
+    Value& operator=(Value&& that) noexcept;
+
+private:
+    // compare() of values of the same type whose sort keys are equal.
+    int compareSameSortKey(const Value& that) const;
+
+    // Copies the union and the type of [from], sharing its payload if any.
+    void copyFrom(const Value& from);
+
+    // Takes over the union, the type and the payload of [from], leaving [from] UNKNOWN.
+    void moveFrom(Value& from);
+
+    // Drops the reference on the payload if any. The union is left dangling, callers must
+    // overwrite it.
+    void releasePayload() {
+        if (type == STRING) {
+            if (string_payload->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete string_payload;
+            }
+        } else if (type == STORAGE) {
+            if (storage_payload->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete storage_payload;
+            }
+        }
+        type = UNKNOWN;
+    }
+};
+
+// Stores one payload for each of the STRING values built from equal strings, like StringInterner
+// does for plain strings. The rows of a pull often repeat the same package, process or tag names,
+// which then keep sharing one payload in the dimension keys and atoms built from the rows.
+//
+// Not thread safe.
+class StringValueInterner {
+public:
+    // Returns a STRING value equal to str, sharing its payload with the values interned before.
+    Value intern(std::string_view str);
+
+    // Drops the values whose payload nothing outside of the interner refers to anymore.
+    void prune();
+
+    inline size_t size() const {
+        return mValues.size();
+    }
+
+private:
+    // Keyed by a view of the payload of the value itself.
+    std::unordered_map<std::string_view, Value> mValues;
 };
 
 class Annotations {
@@ -434,15 +583,17 @@ struct FieldValue {
         return mField != that.mField || mValue != that.mValue;
     }
     bool operator<(const FieldValue& that) const {
-        if (mField != that.mField) {
-            return mField < that.mField;
-        }
+        return compare(that) < 0;
+    }
 
-        if (mValue != that.mValue) {
-            return mValue < that.mValue;
+    // Same as Value::compare(), ordering by field first.
+    inline int compare(const FieldValue& that) const {
+        const uint64_t fieldKey = mField.getSortKey();
+        const uint64_t thatFieldKey = that.mField.getSortKey();
+        if (fieldKey != thatFieldKey) {
+            return fieldKey < thatFieldKey ? -1 : 1;
         }
-
-        return false;
+        return mValue.compare(that.mValue);
     }
 
     size_t getSize() const {
@@ -454,6 +605,9 @@ struct FieldValue {
     Annotations mAnnotations;
 };
 
+// FieldValues are stored in bulk in LogEvents, dimension keys and gauge atoms. Keep them small.
+static_assert(sizeof(FieldValue) <= 32, "FieldValue should fit in 32 bytes");
+
 bool HasPositionANY(const FieldMatcher& matcher);
 bool HasPositionALL(const FieldMatcher& matcher);
 bool HasPrimitiveRepeatedField(const FieldMatcher& matcher);
@@ -466,6 +620,31 @@ int getUidIfExists(const FieldValue& value);
 
 void translateFieldMatcher(const FieldMatcher& matcher, std::vector<Matcher>* output);
 
+// Offset of the attribution tag bits in a TopLevelFieldMask.
+const int32_t kAttributionTagsInUseOffset = 0x80;
+
+// Top-level field positions of an atom, bit i stands for the field at position i. Bit
+// kAttributionTagsInUseOffset + i stands for the tags of an attribution chain at position i, an
+// attribution chain whose tags are not in use is decoded into its uids only.
+typedef std::bitset<2 * kAttributionTagsInUseOffset> TopLevelFieldMask;
+
+// Marks the top-level field at pos as in use, together with its attribution tags unless
+// attributionUidsOnly is set.
+inline void setTopLevelFieldInUse(int32_t pos, bool attributionUidsOnly, TopLevelFieldMask* mask) {
+    if (pos > 0 && pos < kAttributionTagsInUseOffset) {
+        mask->set(pos);
+        if (!attributionUidsOnly) {
+            mask->set(kAttributionTagsInUseOffset + pos);
+        }
+    }
+}
+
+// Top-level fields in use for each atom id. An atom without an entry uses all of its fields.
+typedef std::unordered_map<int, TopLevelFieldMask> AtomFieldMasks;
+
+// Adds the top-level fields read by the matchers to the masks of the matchers' atoms.
+void addTopLevelFields(const std::vector<Matcher>& matchers, AtomFieldMasks* masks);
+
 bool isAttributionUidField(const Field& field, const Value& value);
 bool isUidField(const FieldValue& fieldValue);
 bool isPrimitiveRepeatedField(const Field& field);
@@ -479,7 +658,7 @@ bool subsetDimensions(const std::vector<Matcher>& dimension_a,
 
 // Estimate the memory size of the FieldValues. This is different from sizeof(FieldValue) because
 // the size is computed at runtime using the actual contents stored in the FieldValue.
-size_t getSize(const std::vector<FieldValue>& fieldValues);
+size_t getSize(std::span<const FieldValue> fieldValues);
 
 bool shouldKeepSample(const FieldValue& sampleFieldValue, int shardOffset, int shardCount);
 
@@ -16,8 +16,11 @@
 #define STATSD_DEBUG false  // STOPSHIP if true
 #include "Log.h"
 
+#include <algorithm>
+
 #include "HashableDimensionKey.h"
 #include "FieldValue.h"
+#include "hash.h"
 
 namespace android {
 namespace os {
@@ -39,7 +42,7 @@ using android::base::StringPrintf;
  */
 static void populateStatsDimensionsValueParcelChildren(StatsDimensionsValueParcel& parent,
                                                        int childDepth, int childPrefix,
-                                                       const vector<FieldValue>& dims,
+                                                       std::span<const FieldValue> dims,
                                                        size_t& index) {
     if (childDepth > 2) {
         ALOGE("Depth > 2 not supported by StatsDimensionsValueParcel.");
@@ -70,7 +73,7 @@ static void populateStatsDimensionsValueParcelChildren(StatsDimensionsValueParce
                     break;
                 case STRING:
                     child.valueType = STATS_DIMENSIONS_VALUE_STRING_TYPE;
-                    child.stringValue = dim.mValue.str_value;
+                    child.stringValue = dim.mValue.getString();
                     break;
                 default:
                     ALOGE("Encountered FieldValue with unsupported value type.");
@@ -95,25 +98,71 @@ static void populateStatsDimensionsValueParcelChildren(StatsDimensionsValueParce
 
 StatsDimensionsValueParcel HashableDimensionKey::toStatsDimensionsValueParcel() const {
     StatsDimensionsValueParcel root;
-    if (mValues.size() == 0) {
+    std::span<const FieldValue> values = getValues();
+    if (values.size() == 0) {
         return root;
     }
 
-    root.field = mValues[0].mField.getTag();
+    root.field = values[0].mField.getTag();
     root.valueType = STATS_DIMENSIONS_VALUE_TUPLE_TYPE;
 
     // Children of the root correspond to top-level (depth = 0) FieldValues.
     int childDepth = 0;
     int childPrefix = 0;
     size_t index = 0;
-    populateStatsDimensionsValueParcelChildren(root, childDepth, childPrefix, mValues, index);
+    populateStatsDimensionsValueParcelChildren(root, childDepth, childPrefix, values, index);
 
     return root;
 }
 
 android::hash_t hashDimension(const HashableDimensionKey& value) {
+    return hashFieldValues(value.getValues());
+}
+
+#ifdef STATSD_DIMENSION_HASH_WYHASH
+android::hash_t hashFieldValues(std::span<const FieldValue> values) {
+    // Each value is consumed as a 16 byte image: its field and tag in one word, its payload in
+    // the other. Strings and storage are reduced to a payload word with WyHash64 first.
+    uint64_t hash = 0x1f83d9abfb41bd6bull;
+    for (const auto& fieldValue : values) {
+        const Value& value = fieldValue.mValue;
+        uint64_t payload = 0;
+        switch (value.getType()) {
+            case INT:
+                payload = static_cast<uint32_t>(value.int_value);
+                break;
+            case LONG:
+                payload = static_cast<uint64_t>(value.long_value);
+                break;
+            case FLOAT:
+                payload = android::hash_type(value.float_value);
+                break;
+            case DOUBLE:
+                payload = android::hash_type(value.double_value);
+                break;
+            case STRING:
+                payload = WyHash64(value.getString().data(), value.getString().size(), hash);
+                break;
+            case STORAGE:
+                payload = WyHash64(reinterpret_cast<const char*>(value.getStorage().data()),
+                                   value.getStorage().size(), hash);
+                break;
+            default:
+                break;
+        }
+        const uint64_t fieldAndTag =
+                (static_cast<uint64_t>(static_cast<uint32_t>(fieldValue.mField.getField())) << 32) |
+                static_cast<uint32_t>(fieldValue.mField.getTag());
+        // The type is folded into the state so INT 1 and LONG 1 at the same field differ.
+        hash = WyMix(fieldAndTag ^ 0xe7037ed1a0b428dbull,
+                     payload ^ hash ^ (static_cast<uint64_t>(value.getType()) << 59));
+    }
+    return static_cast<android::hash_t>(hash ^ (hash >> 32));
+}
+#else
+android::hash_t hashFieldValues(std::span<const FieldValue> values) {
     android::hash_t hash = 0;
-    for (const auto& fieldValue : value.getValues()) {
+    for (const auto& fieldValue : values) {
         hash = android::JenkinsHashMix(hash, android::hash_type((int)fieldValue.mField.getField()));
         hash = android::JenkinsHashMix(hash, android::hash_type((int)fieldValue.mField.getTag()));
         hash = android::JenkinsHashMix(hash, android::hash_type((int)fieldValue.mValue.getType()));
@@ -128,7 +177,7 @@ android::hash_t hashDimension(const HashableDimensionKey& value) {
                 break;
             case STRING:
                 hash = android::JenkinsHashMix(hash, static_cast<uint32_t>(std::hash<std::string>()(
-                                                             fieldValue.mValue.str_value)));
+                                                             fieldValue.mValue.getString())));
                 break;
             case FLOAT: {
                 hash = android::JenkinsHashMix(hash,
@@ -141,8 +190,8 @@ android::hash_t hashDimension(const HashableDimensionKey& value) {
                 break;
             }
             case STORAGE: {
-                hash = android::JenkinsHashMixBytes(hash, fieldValue.mValue.storage_value.data(),
-                                                    fieldValue.mValue.storage_value.size());
+                hash = android::JenkinsHashMixBytes(hash, fieldValue.mValue.getStorage().data(),
+                                                    fieldValue.mValue.getStorage().size());
                 break;
             }
             default:
@@ -151,41 +200,125 @@ android::hash_t hashDimension(const HashableDimensionKey& value) {
     }
     return JenkinsHashWhiten(hash);
 }
+#endif  // STATSD_DIMENSION_HASH_WYHASH
 
-bool filterValues(const Matcher& matcherField, const vector<FieldValue>& values,
-                  FieldValue* output) {
-    if (matcherField.hasAllPositionMatcher()) {
-        return false;
-    }
-    for (const auto& value : values) {
-        if (value.mField.matches(matcherField)) {
-            (*output) = value;
-            return true;
+namespace {
+
+// Returns the values of the event at the top-level field of the matcher, the only ones it can
+// match.
+std::span<const FieldValue> getCandidateValues(const Matcher& matcher, const LogEvent& event) {
+    const auto [start, end] = event.getTopLevelFieldRange(matcher.mMatcher.getPosAtDepth(0));
+    return std::span<const FieldValue>(event.getValues()).subspan(start, end - start);
+}
+
+// Returns the distinct [start, end) ranges of the event values at the top-level fields of the
+// matchers, in the order of the values.
+SmallVector<std::pair<size_t, size_t>, 4> getCandidateRanges(const vector<Matcher>& matchers,
+                                                             const LogEvent& event) {
+    SmallVector<std::pair<size_t, size_t>, 4> ranges;
+    for (const Matcher& matcher : matchers) {
+        const auto range = event.getTopLevelFieldRange(matcher.mMatcher.getPosAtDepth(0));
+        if (range.first != range.second &&
+            std::find(ranges.begin(), ranges.end(), range) == ranges.end()) {
+            ranges.push_back(range);
         }
     }
-    return false;
+    std::sort(ranges.begin(), ranges.end());
+    return ranges;
 }
 
-bool filterValues(const vector<Matcher>& matcherFields, const vector<FieldValue>& values,
-                  HashableDimensionKey* output) {
+// Appends the values matched by the matchers to output, in the order of the values. Returns
+// the number of values appended.
+size_t appendMatchedValues(const vector<Matcher>& matcherFields,
+                           std::span<const FieldValue> values, HashableDimensionKey* output) {
     size_t num_matches = 0;
     for (const auto& value : values) {
         for (size_t i = 0; i < matcherFields.size(); ++i) {
             const auto& matcher = matcherFields[i];
             if (value.mField.matches(matcher)) {
                 output->addValue(value);
-                output->mutableValue(num_matches)->mField.setTag(value.mField.getTag());
-                output->mutableValue(num_matches)->mField.setField(
-                    value.mField.getField() & matcher.mMask);
+                FieldValue* const added = output->mutableValue(output->getValues().size() - 1);
+                added->mField.setTag(value.mField.getTag());
+                added->mField.setField(value.mField.getField() & matcher.mMask);
                 num_matches++;
             }
         }
     }
-    return num_matches > 0;
+    return num_matches;
+}
+
+size_t appendMatchedValues(const vector<Matcher>& matcherFields, const LogEvent& event,
+                           HashableDimensionKey* output) {
+    const std::span<const FieldValue> values(event.getValues());
+    size_t num_matches = 0;
+    for (const auto& [start, end] : getCandidateRanges(matcherFields, event)) {
+        num_matches += appendMatchedValues(matcherFields, values.subspan(start, end - start),
+                                           output);
+    }
+    return num_matches;
+}
+
+void setConditionFields(const Metric2Condition& links, HashableDimensionKey* conditionDimension) {
+    size_t count = conditionDimension->getValues().size();
+    if (count != links.conditionFields.size()) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        conditionDimension->mutableValue(i)->mField.setField(
+                links.conditionFields[i].mMatcher.getField());
+        conditionDimension->mutableValue(i)->mField.setTag(
+                links.conditionFields[i].mMatcher.getTag());
+    }
+}
+
+void setStateFields(const Metric2State& link, HashableDimensionKey* statePrimaryKey) {
+    // Check that the statePrimaryKey size equals the number of state fields
+    size_t count = statePrimaryKey->getValues().size();
+    if (count != link.stateFields.size()) {
+        return;
+    }
+
+    // For each dimension Value in the statePrimaryKey, set the field and tag
+    // using the state atom fields from MetricStateLinks.
+    for (size_t i = 0; i < count; i++) {
+        statePrimaryKey->mutableValue(i)->mField.setField(link.stateFields[i].mMatcher.getField());
+        statePrimaryKey->mutableValue(i)->mField.setTag(link.stateFields[i].mMatcher.getTag());
+    }
+}
+
+}  // namespace
+
+bool filterValues(const Matcher& matcherField, std::span<const FieldValue> values,
+                  FieldValue* output) {
+    if (matcherField.hasAllPositionMatcher()) {
+        return false;
+    }
+    for (const auto& value : values) {
+        if (value.mField.matches(matcherField)) {
+            (*output) = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool filterValues(const Matcher& matcherField, const LogEvent& event, FieldValue* output) {
+    return filterValues(matcherField, getCandidateValues(matcherField, event), output);
+}
+
+bool filterValues(const vector<Matcher>& matcherFields, std::span<const FieldValue> values,
+                  HashableDimensionKey* output) {
+    return appendMatchedValues(matcherFields, values, output) > 0;
+}
+
+bool filterValues(const vector<Matcher>& matcherFields, const LogEvent& event,
+                  HashableDimensionKey* output) {
+    return appendMatchedValues(matcherFields, event, output) > 0;
 }
 
 bool filterValues(const vector<Matcher>& dimKeyMatcherFields,
-                  const vector<Matcher>& valueMatcherFields, const vector<FieldValue>& values,
+                  const vector<Matcher>& valueMatcherFields, std::span<const FieldValue> values,
                   HashableDimensionKey& key, vector<int>& valueIndices) {
     size_t key_num_matches = 0;
     size_t value_num_matches = 0;
@@ -210,7 +343,29 @@ bool filterValues(const vector<Matcher>& dimKeyMatcherFields,
     return value_num_matches == valueMatcherFields.size();
 }
 
-bool filterPrimaryKey(const std::vector<FieldValue>& values, HashableDimensionKey* output) {
+bool filterValues(const vector<Matcher>& dimKeyMatcherFields,
+                  const vector<Matcher>& valueMatcherFields, const LogEvent& event,
+                  HashableDimensionKey& key, vector<int>& valueIndices) {
+    appendMatchedValues(dimKeyMatcherFields, event, &key);
+    size_t value_num_matches = 0;
+    for (size_t j = 0; j < valueMatcherFields.size(); ++j) {
+        if (valueIndices[j] != -1) {
+            continue;
+        }
+        const auto [start, end] =
+                event.getTopLevelFieldRange(valueMatcherFields[j].mMatcher.getPosAtDepth(0));
+        for (size_t i = start; i < end; ++i) {
+            if (event.getValues()[i].mField.matches(valueMatcherFields[j])) {
+                valueIndices[j] = i;
+                value_num_matches++;
+                break;
+            }
+        }
+    }
+    return value_num_matches == valueMatcherFields.size();
+}
+
+bool filterPrimaryKey(std::span<const FieldValue> values, HashableDimensionKey* output) {
     size_t num_matches = 0;
     const int32_t simpleFieldMask = 0xff7f0000;
     const int32_t attributionUidFieldMask = 0xff7f7f7f;
@@ -228,7 +383,7 @@ bool filterPrimaryKey(const std::vector<FieldValue>& values, HashableDimensionKe
 }
 
 void filterGaugeValues(const std::vector<Matcher>& matcherFields,
-                       const std::vector<FieldValue>& values, std::vector<FieldValue>* output) {
+                       std::span<const FieldValue> values, std::vector<FieldValue>* output) {
     for (const auto& field : matcherFields) {
         for (const auto& value : values) {
             if (value.mField.matches(field)) {
@@ -238,43 +393,60 @@ void filterGaugeValues(const std::vector<Matcher>& matcherFields,
     }
 }
 
-void getDimensionForCondition(const std::vector<FieldValue>& eventValues,
+void filterGaugeValues(const std::vector<Matcher>& matcherFields, const LogEvent& event,
+                       std::vector<FieldValue>* output) {
+    for (const auto& field : matcherFields) {
+        for (const auto& value : getCandidateValues(field, event)) {
+            if (value.mField.matches(field)) {
+                output->push_back(value);
+            }
+        }
+    }
+}
+
+void getDimensionForCondition(std::span<const FieldValue> eventValues,
                               const Metric2Condition& links,
                               HashableDimensionKey* conditionDimension) {
     // Get the dimension first by using dimension from what.
     filterValues(links.metricFields, eventValues, conditionDimension);
+    setConditionFields(links, conditionDimension);
+}
 
-    size_t count = conditionDimension->getValues().size();
-    if (count != links.conditionFields.size()) {
-        return;
-    }
+void getDimensionForCondition(const LogEvent& event, const Metric2Condition& links,
+                              HashableDimensionKey* conditionDimension) {
+    filterValues(links.metricFields, event, conditionDimension);
+    setConditionFields(links, conditionDimension);
+}
 
-    for (size_t i = 0; i < count; i++) {
-        conditionDimension->mutableValue(i)->mField.setField(
-                links.conditionFields[i].mMatcher.getField());
-        conditionDimension->mutableValue(i)->mField.setTag(
-                links.conditionFields[i].mMatcher.getTag());
+bool getLinkedConditionDimension(const HashableDimensionKey& conditionDimension,
+                                 const Metric2Condition& link,
+                                 HashableDimensionKey* linkedDimension) {
+    for (const auto& matcher : link.conditionFields) {
+        const auto& values = conditionDimension.getValues();
+        const auto valueIt = std::find_if(values.begin(), values.end(), [&](const auto& value) {
+            return value.mField.getTag() == matcher.mMatcher.getTag() &&
+                   value.mField.getField() == matcher.mMatcher.getField();
+        });
+        if (valueIt == values.end()) {
+            return false;
+        }
+        linkedDimension->addValue(*valueIt);
     }
+    return true;
 }
 
-void getDimensionForState(const std::vector<FieldValue>& eventValues, const Metric2State& link,
+void getDimensionForState(std::span<const FieldValue> eventValues, const Metric2State& link,
                           HashableDimensionKey* statePrimaryKey) {
     // First, get the dimension from the event using the "what" fields from the
     // MetricStateLinks.
     filterValues(link.metricFields, eventValues, statePrimaryKey);
+    setStateFields(link, statePrimaryKey);
+}
 
-    // Then check that the statePrimaryKey size equals the number of state fields
-    size_t count = statePrimaryKey->getValues().size();
-    if (count != link.stateFields.size()) {
-        return;
-    }
-
-    // For each dimension Value in the statePrimaryKey, set the field and tag
-    // using the state atom fields from MetricStateLinks.
-    for (size_t i = 0; i < count; i++) {
-        statePrimaryKey->mutableValue(i)->mField.setField(link.stateFields[i].mMatcher.getField());
-        statePrimaryKey->mutableValue(i)->mField.setTag(link.stateFields[i].mMatcher.getTag());
-    }
+void getDimensionForState(const LogEvent& event, const Metric2State& link,
+                          HashableDimensionKey* statePrimaryKey) {
+    filterValues(link.metricFields, event, statePrimaryKey);
+    setStateFields(link, statePrimaryKey);
 }
 
 bool containsLinkedStateValues(const HashableDimensionKey& whatKey,
@@ -318,15 +490,16 @@ bool linked(const vector<Metric2State>& stateLinks, const int32_t stateAtomId,
     return false;
 }
 
-bool LessThan(const vector<FieldValue>& s1, const vector<FieldValue>& s2) {
+bool LessThan(std::span<const FieldValue> s1, std::span<const FieldValue> s2) {
     if (s1.size() != s2.size()) {
         return s1.size() < s2.size();
     }
 
     size_t count = s1.size();
     for (size_t i = 0; i < count; i++) {
-        if (s1[i] != s2[i]) {
-            return s1[i] < s2[i];
+        const int result = s1[i].compare(s2[i]);
+        if (result != 0) {
+            return result < 0;
         }
     }
     return false;
@@ -337,8 +510,17 @@ bool HashableDimensionKey::operator!=(const HashableDimensionKey& that) const {
 }
 
 bool HashableDimensionKey::operator==(const HashableDimensionKey& that) const {
+    // Keys whose hashes are both cached and differ cannot be equal.
+    const uint64_t cachedHash = mCachedHash.load(std::memory_order_relaxed);
+    const uint64_t thatCachedHash = that.mCachedHash.load(std::memory_order_relaxed);
+    if ((cachedHash & thatCachedHash & kHashValidBit) && cachedHash != thatCachedHash) {
+        return false;
+    }
+    if (mSharedValues != nullptr && mSharedValues == that.mSharedValues) {
+        return true;
+    }
     // according to http://go/cppref/cpp/container/vector/operator_cmp
-    return mValues == that.mValues;
+    return getValues() == that.getValues();
 };
 
 bool HashableDimensionKey::operator<(const HashableDimensionKey& that) const {
@@ -346,17 +528,18 @@ bool HashableDimensionKey::operator<(const HashableDimensionKey& that) const {
 };
 
 bool HashableDimensionKey::contains(const HashableDimensionKey& that) const {
-    if (mValues.size() < that.getValues().size()) {
+    std::span<const FieldValue> values = getValues();
+    if (values.size() < that.getValues().size()) {
         return false;
     }
 
-    if (mValues.size() == that.getValues().size()) {
+    if (values.size() == that.getValues().size()) {
         return (*this) == that;
     }
 
     for (const auto& value : that.getValues()) {
         bool found = false;
-        for (const auto& myValue : mValues) {
+        for (const auto& myValue : values) {
             if (value.mField == myValue.mField && value.mValue == myValue.mValue) {
                 found = true;
                 break;
@@ -372,7 +555,7 @@ bool HashableDimensionKey::contains(const HashableDimensionKey& that) const {
 
 string HashableDimensionKey::toString() const {
     std::string output;
-    for (const auto& value : mValues) {
+    for (const auto& value : getValues()) {
         output += StringPrintf("(%d)%#x->%s ", value.mField.getTag(), value.mField.getField(),
                                value.mValue.toString().c_str());
     }
@@ -18,10 +18,16 @@
 
 #include <aidl/android/os/StatsDimensionsValueParcel.h>
 #include <utils/JenkinsHash.h>
+
+#include <atomic>
+#include <memory>
+#include <span>
 #include <vector>
+
 #include "android-base/stringprintf.h"
 #include "FieldValue.h"
 #include "logd/LogEvent.h"
+#include "utils/SmallVector.h"
 
 namespace android {
 namespace os {
@@ -50,35 +56,78 @@ struct Metric2State {
     std::vector<Matcher> stateFields;
 };
 
+// Most dimension keys have one to three fields, such as a uid or a uid and a tag, so keys keep
+// up to three values inline and only allocate for larger ones.
+using DimensionValues = SmallVector<FieldValue, 3>;
+
 class HashableDimensionKey {
 public:
-    explicit HashableDimensionKey(const std::vector<FieldValue>& values) {
-        mValues = values;
+    explicit HashableDimensionKey(const std::vector<FieldValue>& values)
+        : mValues(values.data(), values.data() + values.size()) {
+    }
+
+    explicit HashableDimensionKey(const DimensionValues& values) : mValues(values) {
     }
 
     HashableDimensionKey() {};
 
-    HashableDimensionKey(const HashableDimensionKey& that) : mValues(that.getValues()){};
+    HashableDimensionKey(const HashableDimensionKey& that)
+        : mValues(that.mValues),
+          mSharedValues(that.mSharedValues),
+          mCachedHash(that.mCachedHash.load(std::memory_order_relaxed)){};
+
+    HashableDimensionKey(HashableDimensionKey&& that) noexcept
+        : mValues(std::move(that.mValues)),
+          mSharedValues(std::move(that.mSharedValues)),
+          mCachedHash(that.mCachedHash.exchange(0, std::memory_order_relaxed)){};
+
+    HashableDimensionKey& operator=(const HashableDimensionKey& that) {
+        mValues = that.mValues;
+        mSharedValues = that.mSharedValues;
+        mCachedHash.store(that.mCachedHash.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+        return *this;
+    }
+
+    HashableDimensionKey& operator=(HashableDimensionKey&& that) noexcept {
+        mValues = std::move(that.mValues);
+        mSharedValues = std::move(that.mSharedValues);
+        mCachedHash.store(that.mCachedHash.exchange(0, std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+        return *this;
+    }
 
     inline void addValue(const FieldValue& value) {
+        unshareValues();
         mValues.push_back(value);
+        invalidateHash();
     }
 
-    inline const std::vector<FieldValue>& getValues() const {
-        return mValues;
+    inline const DimensionValues& getValues() const {
+        return mSharedValues ? *mSharedValues : mValues;
     }
 
-    inline std::vector<FieldValue>* mutableValues() {
+    // The cached hash is invalidated when this is called, so the returned pointer must not be used
+    // to modify the values after the key has been hashed again.
+    inline DimensionValues* mutableValues() {
+        unshareValues();
+        invalidateHash();
         return &mValues;
     }
 
+    // Same as mutableValues() for a single value.
     inline FieldValue* mutableValue(size_t i) {
+        unshareValues();
         if (i >= 0 && i < mValues.size()) {
+            invalidateHash();
             return &(mValues[i]);
         }
         return nullptr;
     }
 
+    // Returns hashDimension(*this), computed on first use and cached until the values change.
+    inline android::hash_t getHash() const;
+
     StatsDimensionsValueParcel toStatsDimensionsValueParcel() const;
 
     std::string toString() const;
@@ -92,7 +141,31 @@ public:
     bool contains(const HashableDimensionKey& that) const;
 
 private:
-    std::vector<FieldValue> mValues;
+    friend class DimensionKeyInterner;
+
+    // Set in mCachedHash above the 32 bit hash when the hash is valid.
+    static constexpr uint64_t kHashValidBit = 1ULL << 32;
+
+    inline void invalidateHash() {
+        mCachedHash.store(0, std::memory_order_relaxed);
+    }
+
+    // Copies the shared values, if any, so that they can be modified.
+    inline void unshareValues() {
+        if (mSharedValues) {
+            mValues = *mSharedValues;
+            mSharedValues.reset();
+        }
+    }
+
+    // Either mValues or mSharedValues holds the values. Keys interned by a DimensionKeyInterner,
+    // and their copies, share one immutable copy of the values.
+    DimensionValues mValues;
+    std::shared_ptr<const DimensionValues> mSharedValues;
+
+    // Keys such as DEFAULT_DIMENSION_KEY are shared between configs that can be processed on
+    // different threads, so the cache is atomic. Racing writers store the same value.
+    mutable std::atomic<uint64_t> mCachedHash{0};
 };
 
 class MetricDimensionKey {
@@ -164,14 +237,33 @@ private:
 
 android::hash_t hashDimension(const HashableDimensionKey& key);
 
+// Same as hashDimension, for values that are not held by a HashableDimensionKey.
+android::hash_t hashFieldValues(std::span<const FieldValue> values);
+
+android::hash_t HashableDimensionKey::getHash() const {
+    uint64_t cachedHash = mCachedHash.load(std::memory_order_relaxed);
+    if (cachedHash & kHashValidBit) {
+        return static_cast<android::hash_t>(cachedHash);
+    }
+    const android::hash_t hash = hashDimension(*this);
+    mCachedHash.store(kHashValidBit | hash, std::memory_order_relaxed);
+    return hash;
+}
+
 /**
  * Returns true if a FieldValue field matches the matcher field.
  * This function can only be used to match one field (i.e. matcher with position ALL will return
  * false). The value of the FieldValue is output.
  */
-bool filterValues(const Matcher& matcherField, const std::vector<FieldValue>& values,
+bool filterValues(const Matcher& matcherField, std::span<const FieldValue> values,
                   FieldValue* output);
 
+/**
+ * Same as above for the values of an event. Only the values at the top-level field of the
+ * matcher are scanned, which the event indexes.
+ */
+bool filterValues(const Matcher& matcherField, const LogEvent& event, FieldValue* output);
+
 /**
  * Creating HashableDimensionKeys from FieldValues using matcher.
  *
@@ -182,7 +274,14 @@ bool filterValues(const Matcher& matcherField, const std::vector<FieldValue>& va
  * these 2 events should be mapped to the same dimension.  So we will remove the original position
  * from the dimension key for the uid field (by applying 0x80 bit mask).
  */
-bool filterValues(const std::vector<Matcher>& matcherFields, const std::vector<FieldValue>& values,
+bool filterValues(const std::vector<Matcher>& matcherFields, std::span<const FieldValue> values,
+                  HashableDimensionKey* output);
+
+/**
+ * Same as above for the values of an event, scanning only the values at the top-level fields of
+ * the matchers. The output is the same as for the whole event.getValues().
+ */
+bool filterValues(const std::vector<Matcher>& matcherFields, const LogEvent& event,
                   HashableDimensionKey* output);
 
 /**
@@ -204,9 +303,14 @@ bool filterValues(const std::vector<Matcher>& matcherFields, const std::vector<F
  */
 bool filterValues(const std::vector<Matcher>& dimKeyMatcherFields,
                   const std::vector<Matcher>& valueMatcherFields,
-                  const std::vector<FieldValue>& values, HashableDimensionKey& key,
+                  std::span<const FieldValue> values, HashableDimensionKey& key,
                   std::vector<int>& valueIndices);
 
+// Same as above for the values of an event, with valueIndices indexing event.getValues().
+bool filterValues(const std::vector<Matcher>& dimKeyMatcherFields,
+                  const std::vector<Matcher>& valueMatcherFields, const LogEvent& event,
+                  HashableDimensionKey& key, std::vector<int>& valueIndices);
+
 /**
  * Creating HashableDimensionKeys from State Primary Keys in FieldValues.
  *
@@ -217,7 +321,7 @@ bool filterValues(const std::vector<Matcher>& dimKeyMatcherFields,
  * these 2 events should be mapped to the same dimension.  So we will remove the original position
  * from the dimension key for the uid field (by applying 0x80 bit mask).
  */
-bool filterPrimaryKey(const std::vector<FieldValue>& values, HashableDimensionKey* output);
+bool filterPrimaryKey(std::span<const FieldValue> values, HashableDimensionKey* output);
 
 /**
  * Filter the values from FieldValues using the matchers.
@@ -225,18 +329,36 @@ bool filterPrimaryKey(const std::vector<FieldValue>& values, HashableDimensionKe
  * In contrast to the above function, this function will not do any modification to the original
  * data. Considering it as taking a snapshot on the atom event.
  */
-void filterGaugeValues(const std::vector<Matcher>& matchers, const std::vector<FieldValue>& values,
+void filterGaugeValues(const std::vector<Matcher>& matchers, std::span<const FieldValue> values,
                        std::vector<FieldValue>* output);
 
-void getDimensionForCondition(const std::vector<FieldValue>& eventValues,
+void filterGaugeValues(const std::vector<Matcher>& matchers, const LogEvent& event,
+                       std::vector<FieldValue>* output);
+
+void getDimensionForCondition(std::span<const FieldValue> eventValues,
                               const Metric2Condition& links,
                               HashableDimensionKey* conditionDimension);
 
+void getDimensionForCondition(const LogEvent& event, const Metric2Condition& links,
+                              HashableDimensionKey* conditionDimension);
+
+/**
+ * Get the values of a condition dimension that the "condition" fields of the link read, in the
+ * order getDimensionForCondition() produces them for the linked metric dimension. Returns false
+ * if the condition dimension lacks any of the fields.
+ */
+bool getLinkedConditionDimension(const HashableDimensionKey& conditionDimension,
+                                 const Metric2Condition& link,
+                                 HashableDimensionKey* linkedDimension);
+
 /**
  * Get dimension values using metric's "what" fields and fill statePrimaryKey's
  * mField information using "state" fields.
  */
-void getDimensionForState(const std::vector<FieldValue>& eventValues, const Metric2State& link,
+void getDimensionForState(std::span<const FieldValue> eventValues, const Metric2State& link,
+                          HashableDimensionKey* statePrimaryKey);
+
+void getDimensionForState(const LogEvent& event, const Metric2State& link,
                           HashableDimensionKey* statePrimaryKey);
 
 /**
@@ -278,15 +400,15 @@ using android::os::statsd::MetricDimensionKey;
 template <>
 struct hash<HashableDimensionKey> {
     std::size_t operator()(const HashableDimensionKey& key) const {
-        return hashDimension(key);
+        return key.getHash();
     }
 };
 
 template <>
 struct hash<MetricDimensionKey> {
     std::size_t operator()(const MetricDimensionKey& key) const {
-        android::hash_t hash = hashDimension(key.getDimensionKeyInWhat());
-        hash = android::JenkinsHashMix(hash, hashDimension(key.getStateValuesKey()));
+        android::hash_t hash = key.getDimensionKeyInWhat().getHash();
+        hash = android::JenkinsHashMix(hash, key.getStateValuesKey().getHash());
         return android::JenkinsHashWhiten(hash);
     }
 };
@@ -294,7 +416,7 @@ struct hash<MetricDimensionKey> {
 template <>
 struct hash<AtomDimensionKey> {
     std::size_t operator()(const AtomDimensionKey& key) const {
-        android::hash_t hash = hashDimension(key.getAtomFieldValues());
+        android::hash_t hash = key.getAtomFieldValues().getHash();
         hash = android::JenkinsHashMix(hash, key.getAtomTag());
         return android::JenkinsHashWhiten(hash);
     }
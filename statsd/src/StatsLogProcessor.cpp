@@ -20,12 +20,16 @@
 #include "StatsLogProcessor.h"
 
 #include <android-base/file.h>
+#include <android/util/protobuf.h>
 #include <cutils/multiuser.h>
 #include <src/active_config_list.pb.h>
 #include <src/experiment_ids.pb.h>
 
+#include <algorithm>
+
 #include "StatsService.h"
 #include "android-base/stringprintf.h"
+#include "external/Perfetto.h"
 #include "external/StatsPullerManager.h"
 #include "flags/FlagProvider.h"
 #include "guardrail/StatsdStats.h"
@@ -35,7 +39,10 @@
 #include "stats_log_util.h"
 #include "stats_util.h"
 #include "statslog_statsd.h"
+#include "storage/ChunkedFileWriter.h"
+#include "storage/ReportCompression.h"
 #include "storage/StorageManager.h"
+#include "utils/ProtoOutputStreamPool.h"
 
 using namespace android;
 using android::base::StringPrintf;
@@ -47,6 +54,7 @@ using android::util::FIELD_TYPE_INT64;
 using android::util::FIELD_TYPE_MESSAGE;
 using android::util::FIELD_TYPE_STRING;
 using android::util::ProtoOutputStream;
+using std::pair;
 using std::vector;
 
 namespace android {
@@ -63,6 +71,10 @@ const int FIELD_ID_UID = 1;
 const int FIELD_ID_ID = 2;
 const int FIELD_ID_REPORT_NUMBER = 3;
 const int FIELD_ID_STATSD_STATS_ID = 4;
+
+// A tag and a length, each at most a 64 bit varint.
+const size_t kMaxReportHeaderBytes = 20;
+
 // for ConfigMetricsReport
 // const int FIELD_ID_METRICS = 1; // written in MetricsManager.cpp
 const int FIELD_ID_UID_MAP = 2;
@@ -77,6 +89,9 @@ const int FIELD_ID_DATA_CORRUPTED_REASON = 10;
 // for ActiveConfigList
 const int FIELD_ID_ACTIVE_CONFIG_LIST_CONFIG = 1;
 
+// for StatsMetadataList
+const int FIELD_ID_STATS_METADATA_LIST_STATS_METADATA = 1;
+
 // for permissions checks
 constexpr const char* kPermissionDump = "android.permission.DUMP";
 constexpr const char* kPermissionUsage = "android.permission.PACKAGE_USAGE_STATS";
@@ -96,8 +111,21 @@ StatsLogProcessor::StatsLogProcessor(
         const std::function<bool(const int&, const vector<int64_t>&)>& activateBroadcast,
         const std::function<void(const ConfigKey&, const string&, const vector<int64_t>&)>&
                 sendRestrictedMetricsBroadcast,
-        const std::shared_ptr<LogEventFilter>& logEventFilter)
-    : mLastTtlTime(0),
+        const std::shared_ptr<LogEventFilter>& logEventFilter,
+        const StatsLogProcessorOptions& options)
+    : mConfigMajorBatches(options.configMajorBatches),
+      mReportSegments(options.reportSegments),
+      mReportCodec(options.reportCodec),
+      mAsyncRestrictedInserts(options.asyncRestrictedInserts),
+      mConfigArenas(options.configArenas),
+      mOffLockConfigBuilds(options.offLockConfigBuilds),
+      mPendingConfigBuilds(0),
+      mBucketCheckpointIntervalNs(options.bucketCheckpointIntervalNs),
+      mLastBucketCheckpointNs(timeBaseNs),
+      mAppUpgradeCoalescingWindowNs(options.appUpgradeCoalescingWindowNs),
+      mPerConfigDumps(options.perConfigDumps),
+      mConfigBuildEventsOverflowed(false),
+      mLastTtlTime(0),
       mLastFlushRestrictedTime(0),
       mLastDbGuardrailEnforcementTime(0),
       mUidMap(uidMap),
@@ -111,10 +139,20 @@ StatsLogProcessor::StatsLogProcessor(
       mTimeBaseNs(timeBaseNs),
       mLargestTimestampSeen(0),
       mLastTimestampSeen(0) {
+    if (options.numEventProcessingThreads > 1) {
+        mEventWorkerPool = std::make_unique<ShardedWorkerPool>(options.numEventProcessingThreads);
+    }
+    if (options.asyncDiskWrites) {
+        mAsyncDiskWriter = std::make_unique<AsyncFileWriter>();
+    }
+    if (options.asyncConfigTeardown) {
+        mMetricsManagerReaper = std::make_unique<MetricsManagerReaper>();
+    }
     mPullerManager->ForceClearPullerCache();
     StateManager::getInstance().updateLogSources(uidMap);
     // It is safe called locked version at constructor - no concurrent access possible
     updateLogEventFilterLocked();
+    refreshLogSourceConfigMasksLocked();
 }
 
 StatsLogProcessor::~StatsLogProcessor() {
@@ -143,43 +181,12 @@ void StatsLogProcessor::processFiredAnomalyAlarmsLocked(
 void StatsLogProcessor::onPeriodicAlarmFired(
         const int64_t& timestampNs,
         unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>& alarmSet) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     for (const auto& itr : mMetricsManagers) {
         itr.second->onPeriodicAlarmFired(timestampNs, alarmSet);
     }
 }
 
-void StatsLogProcessor::mapIsolatedUidToHostUidIfNecessaryLocked(LogEvent* event) const {
-    if (std::pair<size_t, size_t> indexRange; event->hasAttributionChain(&indexRange)) {
-        vector<FieldValue>* const fieldValues = event->getMutableValues();
-        for (size_t i = indexRange.first; i <= indexRange.second; i++) {
-            FieldValue& fieldValue = fieldValues->at(i);
-            if (isAttributionUidField(fieldValue)) {
-                const int hostUid = mUidMap->getHostUidOrSelf(fieldValue.mValue.int_value);
-                fieldValue.mValue.setInt(hostUid);
-            }
-        }
-    } else {
-        mapIsolatedUidsToHostUidInLogEvent(mUidMap, *event);
-    }
-}
-
-void StatsLogProcessor::onIsolatedUidChangedEventLocked(const LogEvent& event) {
-    status_t err = NO_ERROR, err2 = NO_ERROR, err3 = NO_ERROR;
-    bool is_create = event.GetBool(3, &err);
-    auto parent_uid = int(event.GetLong(1, &err2));
-    auto isolated_uid = int(event.GetLong(2, &err3));
-    if (err == NO_ERROR && err2 == NO_ERROR && err3 == NO_ERROR) {
-        if (is_create) {
-            mUidMap->assignIsolatedUid(isolated_uid, parent_uid);
-        } else {
-            mUidMap->removeIsolatedUid(isolated_uid);
-        }
-    } else {
-        ALOGE("Failed to parse uid in the isolated uid change event.");
-    }
-}
-
 void StatsLogProcessor::onBinaryPushStateChangedEventLocked(LogEvent* event) {
     pid_t pid = event->GetPid();
     uid_t uid = event->GetUid();
@@ -375,7 +382,7 @@ vector<int64_t> StatsLogProcessor::processWatchdogRollbackOccurred(const int32_t
 }
 
 void StatsLogProcessor::resetConfigs() {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     resetConfigsLocked(getElapsedRealtimeNs());
 }
 
@@ -392,8 +399,232 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event) {
 }
 
 void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
+    ScopedStageTrace trace("StatsLogProcessor::OnLogEvent");
     std::lock_guard<std::mutex> lock(mMetricsMutex);
 
+    onLogEventBatchStartLocked(elapsedRealtimeNs);
+
+    std::unordered_set<int> uidsWithActiveConfigsChanged;
+    onLogEventLocked(event, &uidsWithActiveConfigsChanged);
+    noteEventLatencyTotalLocked(*event);
+
+    onLogEventBatchEndLocked(uidsWithActiveConfigsChanged, elapsedRealtimeNs);
+}
+
+void StatsLogProcessor::OnLogEvents(std::span<const std::unique_ptr<LogEvent>> events) {
+    OnLogEvents(events, getElapsedRealtimeNs());
+}
+
+void StatsLogProcessor::OnLogEvents(std::span<const std::unique_ptr<LogEvent>> events,
+                                    int64_t elapsedRealtimeNs) {
+    if (events.empty()) {
+        return;
+    }
+
+    ScopedStageTrace trace("StatsLogProcessor::OnLogEvents");
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+
+    // Time driven checks are done once for the whole batch. Events of a batch were read from
+    // the queue at once, so they are close enough in time for the checks to be shared.
+    onLogEventBatchStartLocked(elapsedRealtimeNs);
+
+    std::unordered_set<int> uidsWithActiveConfigsChanged;
+    if (mEventWorkerPool != nullptr && mMetricsManagers.size() > 1) {
+        onLogEventsParallelLocked(events, &uidsWithActiveConfigsChanged);
+    } else if (mConfigMajorBatches && mMetricsManagers.size() > 1) {
+        onLogEventsConfigMajorLocked(events, &uidsWithActiveConfigsChanged);
+    } else {
+        for (const auto& event : events) {
+            onLogEventLocked(event.get(), &uidsWithActiveConfigsChanged);
+        }
+    }
+    for (const auto& event : events) {
+        noteEventLatencyTotalLocked(*event);
+    }
+
+    onLogEventBatchEndLocked(uidsWithActiveConfigsChanged, elapsedRealtimeNs);
+}
+
+void StatsLogProcessor::noteEventLatencyTotalLocked(const LogEvent& event) const {
+    if (event.isLatencyTraced()) {
+        StatsdStats::getInstance().noteEventLatency(
+                StatsdStats::EVENT_LATENCY_TOTAL,
+                getElapsedRealtimeNs() - event.getLatencyTraceStartNs());
+    }
+}
+
+void StatsLogProcessor::onLogEventBatchStartLocked(const int64_t elapsedRealtimeNs) {
+    // The checks touch every config. They are due until done, so the first batch after a dump
+    // does them. A dump can not start during a batch, which holds mMetricsMutex.
+    mBatchConfigTtlCheckDue = mConfigBeingDumped == nullptr;
+    mBatchHousekeepingDue = mConfigBeingDumped == nullptr;
+    mBatchElapsedRealtimeNs = elapsedRealtimeNs;
+}
+
+void StatsLogProcessor::checkBatchConfigTtlsLocked(const int64_t eventElapsedTimeNs) {
+    if (!mBatchConfigTtlCheckDue) {
+        return;
+    }
+    mBatchConfigTtlCheckDue = false;
+    if (eventElapsedTimeNs >= mNextConfigTtlExpiryNs) {
+        resetIfConfigTtlExpiredLocked(eventElapsedTimeNs);
+    }
+}
+
+void StatsLogProcessor::runBatchHousekeepingLocked() {
+    if (!mBatchHousekeepingDue) {
+        return;
+    }
+    mBatchHousekeepingDue = false;
+    if (mMetricsManagers.empty() ||
+        mBatchElapsedRealtimeNs < mNextHousekeepingNs.load(std::memory_order_relaxed)) {
+        return;
+    }
+    runHousekeepingLocked(mBatchElapsedRealtimeNs);
+}
+
+void StatsLogProcessor::runHousekeepingLocked(const int64_t elapsedRealtimeNs) {
+    bool fireAlarm = false;
+    {
+        std::lock_guard<std::mutex> anomalyLock(mAnomalyAlarmMutex);
+        if (mNextAnomalyAlarmTime != 0 &&
+            MillisToNano(mNextAnomalyAlarmTime) <= elapsedRealtimeNs) {
+            mNextAnomalyAlarmTime = 0;
+            VLOG("informing anomaly alarm at time %lld", (long long)elapsedRealtimeNs);
+            fireAlarm = true;
+        }
+    }
+    if (fireAlarm) {
+        informAnomalyAlarmFiredLocked(NanoToMillis(elapsedRealtimeNs));
+    }
+
+    // The batch time stands for the clock, so that the deadlines below are on the same clock.
+    const int64_t curTimeSec = elapsedRealtimeNs / NS_PER_SEC;
+    if (curTimeSec - mLastPullerCacheClearTimeSec > StatsdStats::kPullerCacheClearIntervalSec) {
+        mPullerManager->ClearPullerCacheIfNecessary(curTimeSec * NS_PER_SEC);
+        StateManager::getInstance().evictIdleStates(elapsedRealtimeNs);
+        mLastPullerCacheClearTimeSec = curTimeSec;
+    }
+
+    const int64_t wallClockNs = getWallClockNs();
+    flushRestrictedDataIfNecessaryLocked(elapsedRealtimeNs);
+    enforceDataTtlsIfNecessaryLocked(wallClockNs, elapsedRealtimeNs);
+    enforceDbGuardrailsIfNecessaryLocked(wallClockNs, elapsedRealtimeNs);
+    writeBucketCheckpointsIfNecessaryLocked(elapsedRealtimeNs);
+
+    // The puller cache is cleared every couple of seconds, which bounds how long the checks
+    // wait when their own deadline moves earlier.
+    int64_t nextHousekeepingNs =
+            (mLastPullerCacheClearTimeSec + StatsdStats::kPullerCacheClearIntervalSec + 1) *
+            NS_PER_SEC;
+    if (isAtLeastU()) {
+        nextHousekeepingNs = std::min(
+                {nextHousekeepingNs,
+                 mLastFlushRestrictedTime + StatsdStats::kMinFlushRestrictedPeriodNs,
+                 mLastTtlTime + StatsdStats::kMinTtlCheckPeriodNs});
+    }
+    nextHousekeepingNs =
+            std::min(nextHousekeepingNs, mLastDbGuardrailEnforcementTime +
+                                                 StatsdStats::kMinDbGuardrailEnforcementPeriodNs);
+    if (mBucketCheckpointIntervalNs > 0) {
+        nextHousekeepingNs = std::min(nextHousekeepingNs,
+                                      mLastBucketCheckpointNs + mBucketCheckpointIntervalNs);
+    }
+    std::lock_guard<std::mutex> anomalyLock(mAnomalyAlarmMutex);
+    if (mNextAnomalyAlarmTime != 0) {
+        nextHousekeepingNs = std::min(nextHousekeepingNs, MillisToNano(mNextAnomalyAlarmTime));
+    }
+    mNextHousekeepingNs.store(nextHousekeepingNs, std::memory_order_relaxed);
+}
+
+void StatsLogProcessor::onLogEventLocked(LogEvent* event,
+                                         std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    if (!preprocessLogEventLocked(event)) {
+        return;
+    }
+
+    if (mConfigBeingDumped != nullptr &&
+        (mConfigDumpEvents.size() >= kMaxConfigDumpEvents ||
+         StateManager::getInstance().hasStateTracker(event->GetTagId()))) {
+        // State changes reach every config through their listeners, they wait for the dump.
+        waitForConfigDumpLocked();
+    }
+    StateManager::getInstance().onLogEvent(*event);
+    if (mPendingConfigBuilds > 0) {
+        noteEventForConfigBuildsLocked(*event);
+    }
+    runBatchHousekeepingLocked();
+
+    flushExpiredActivationsLocked(event->GetElapsedTimestampNs(), uidsWithActiveConfigsChanged);
+
+    // pass the event to the metrics managers using its atom.
+    const auto routes = mAtomConfigRoutes.find(event->GetTagId());
+    if (routes == mAtomConfigRoutes.end()) {
+        return;
+    }
+    const LogSourceVerdict verdict = getLogSourceVerdictLocked(*event);
+    beginSharedMatchingLocked();
+    for (const ConfigRoute& route : routes->second) {
+        onLogEventForConfigLocked(route.key, *route.metricsManager, *event, verdict,
+                                  uidsWithActiveConfigsChanged);
+        mNextActivationExpiryNs = std::min(mNextActivationExpiryNs,
+                                           route.metricsManager->getNextActivationExpiryNs());
+    }
+}
+
+void StatsLogProcessor::beginSharedMatchingLocked() {
+    for (const auto& cache : mSharedMatcherCaches) {
+        cache->beginEvent();
+    }
+}
+
+void StatsLogProcessor::flushExpiredActivationsLocked(
+        const int64_t eventTimeNs, std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    if (eventTimeNs <= mNextActivationExpiryNs) {
+        return;
+    }
+    mNextActivationExpiryNs = INT64_MAX;
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        // The dumped config is flushed once its events are replayed.
+        if (metricsManager != mConfigBeingDumped) {
+            mNextActivationExpiryNs = std::min(
+                    mNextActivationExpiryNs,
+                    flushExpiredActivationsForConfigLocked(key, *metricsManager, eventTimeNs,
+                                                           uidsWithActiveConfigsChanged));
+        }
+    }
+}
+
+int64_t StatsLogProcessor::flushExpiredActivationsForConfigLocked(
+        const ConfigKey& key, MetricsManager& metricsManager, const int64_t eventTimeNs,
+        std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    if (metricsManager.getNextActivationExpiryNs() >= eventTimeNs) {
+        return metricsManager.getNextActivationExpiryNs();
+    }
+    const bool isPrevActive = metricsManager.isActive();
+    metricsManager.onActivationsExpired(eventTimeNs);
+    if (isPrevActive != metricsManager.isActive()) {
+        noteActiveStatusChangedLocked(key, metricsManager.isActive(),
+                                      uidsWithActiveConfigsChanged);
+    }
+    return metricsManager.getNextActivationExpiryNs();
+}
+
+void StatsLogProcessor::noteActiveStatusChangedLocked(
+        const ConfigKey& key, const bool isActive,
+        std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    VLOG("Active status changed for uid  %d", key.GetUid());
+    uidsWithActiveConfigsChanged->insert(key.GetUid());
+    StatsdStats::getInstance().noteActiveStatusChanged(key, isActive);
+}
+
+bool StatsLogProcessor::preprocessLogEventLocked(LogEvent* event) {
+    if (event->isLatencyTraced()) {
+        StatsdStats::getInstance().noteEventLatency(
+                StatsdStats::EVENT_LATENCY_DISPATCH,
+                event->lapLatencyTrace(getElapsedRealtimeNs()));
+    }
+
     // Tell StatsdStats about new event
     const int64_t eventElapsedTimeNs = event->GetElapsedTimestampNs();
     const int atomId = event->GetTagId();
@@ -401,7 +632,7 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
                                               event->isParsedHeaderOnly());
     if (!event->isValid()) {
         StatsdStats::getInstance().noteAtomError(atomId);
-        return;
+        return false;
     }
 
     // Hard-coded logic to update train info on disk and fill in any information
@@ -419,78 +650,312 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
     if (mPrintAllLogs) {
         ALOGI("%s", event->ToString().c_str());
     }
-    resetIfConfigTtlExpiredLocked(eventElapsedTimeNs);
+    checkBatchConfigTtlsLocked(eventElapsedTimeNs);
 
     // Hard-coded logic to update the isolated uid's in the uid-map.
     // The field numbers need to be currently updated by hand with atoms.proto
-    if (atomId == util::ISOLATED_UID_CHANGED) {
-        onIsolatedUidChangedEventLocked(*event);
-    } else {
-        // Map the isolated uid to host uid if necessary.
-        mapIsolatedUidToHostUidIfNecessaryLocked(event);
+    // Already done for the events whose isolated uids were handled as they were read.
+    if (!event->areIsolatedUidsHandled()) {
+        if (atomId == util::ISOLATED_UID_CHANGED) {
+            onIsolatedUidChangedEvent(mUidMap, *event);
+        } else {
+            // Map the isolated uid to host uid if necessary.
+            mapIsolatedUidsToHostUid(mUidMap, event);
+        }
     }
 
-    StateManager::getInstance().onLogEvent(*event);
+    // The sanity of an event does not depend on the config, so it is checked once here.
+    return MetricsManager::eventSanityCheck(*event, mUidMap);
+}
 
-    if (mMetricsManagers.empty()) {
+StatsLogProcessor::LogSourceVerdict StatsLogProcessor::getLogSourceVerdictLocked(
+        const LogEvent& event) const {
+    LogSourceVerdict verdict;
+    verdict.fromSystemLogSource = MetricsManager::isSystemLogSource(event.GetUid());
+    const auto it = mLogSourceConfigMasks.find(event.GetUid());
+    if (it != mLogSourceConfigMasks.end()) {
+        verdict.configMask = &it->second;
+    }
+    return verdict;
+}
+
+void StatsLogProcessor::refreshLogSourceConfigMasksLocked() {
+    mLogSourceConfigMasks.clear();
+    size_t slot = 0;
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        metricsManager->setLogSourceSlot(slot);
+        for (const int32_t uid : metricsManager->getAllowedLogSources()) {
+            std::vector<bool>& mask = mLogSourceConfigMasks[uid];
+            mask.resize(mMetricsManagers.size());
+            mask[slot] = true;
+        }
+        slot++;
+    }
+    mLogSourceSlotCount = slot;
+}
+
+void StatsLogProcessor::onLogEventForConfigLocked(
+        const ConfigKey& key, MetricsManager& metricsManager, const LogEvent& event,
+        const LogSourceVerdict& verdict, std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    if (&metricsManager == mConfigBeingDumped.get()) {
+        // Room was made before the event was dispatched.
+        mConfigDumpEvents.push_back(std::make_unique<LogEvent>(event));
         return;
     }
+    if (event.isRestricted() && !metricsManager.hasRestrictedMetricsDelegate()) {
+        return;
+    }
+    // A manager without a slot was added since the last refresh, and looks the uid up itself.
+    const size_t slot = metricsManager.getLogSourceSlot();
+    const bool fromAllowedLogSource =
+            verdict.fromSystemLogSource ||
+            (slot < mLogSourceSlotCount
+                     ? verdict.configMask != nullptr && (*verdict.configMask)[slot]
+                     : metricsManager.isAllowedLogSource(event.GetUid()));
+    metricsManager.setLoadShedding(mLoadShedding.load(std::memory_order_relaxed));
+    bool isPrevActive = metricsManager.isActive();
+    const int64_t configStartNs = event.isLatencyTraced() ? getElapsedRealtimeNs() : 0;
+    metricsManager.onLogEvent(event, fromAllowedLogSource);
+    if (configStartNs != 0) {
+        StatsdStats::getInstance().noteEventLatency(StatsdStats::EVENT_LATENCY_CONFIG,
+                                                    getElapsedRealtimeNs() - configStartNs);
+    }
+    bool isCurActive = metricsManager.isActive();
+    // The activation state of this config changed.
+    if (isPrevActive != isCurActive) {
+        noteActiveStatusChangedLocked(key, isCurActive, uidsWithActiveConfigsChanged);
+    }
+}
+
+void StatsLogProcessor::onLogEventsParallelLocked(
+        std::span<const std::unique_ptr<LogEvent>> events,
+        std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    splitIntoConfigRunsLocked(events, [&](const vector<const LogEvent*>& run) {
+        // A config always belongs to the same shard, so its events are processed in order and
+        // by the same thread. The shards are taken for each run, as the config ttl checks of
+        // the first event may have replaced configs.
+        const size_t numShards = mEventWorkerPool->getNumShards();
+        vector<vector<std::pair<ConfigKey, sp<MetricsManager>>>> shards(numShards);
+        for (const auto& pair : mMetricsManagers) {
+            shards[std::hash<ConfigKey>()(pair.first) % numShards].push_back(pair);
+        }
+        dispatchToShardsLocked(run, shards, uidsWithActiveConfigsChanged);
+    });
+}
 
-    bool fireAlarm = false;
-    {
-        std::lock_guard<std::mutex> anomalyLock(mAnomalyAlarmMutex);
-        if (mNextAnomalyAlarmTime != 0 &&
-            MillisToNano(mNextAnomalyAlarmTime) <= elapsedRealtimeNs) {
-            mNextAnomalyAlarmTime = 0;
-            VLOG("informing anomaly alarm at time %lld", (long long)elapsedRealtimeNs);
-            fireAlarm = true;
+void StatsLogProcessor::onLogEventsConfigMajorLocked(
+        std::span<const std::unique_ptr<LogEvent>> events,
+        std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    splitIntoConfigRunsLocked(events, [&](const vector<const LogEvent*>& run) {
+        if (run.empty()) {
+            return;
+        }
+        // Taken for each run, see onLogEventsParallelLocked().
+        const vector<std::pair<ConfigKey, sp<MetricsManager>>> metricsManagers(
+                mMetricsManagers.begin(), mMetricsManagers.end());
+        if (mConfigDumpEvents.size() + run.size() > kMaxConfigDumpEvents) {
+            waitForConfigDumpLocked();
+        }
+        vector<LogSourceVerdict> verdicts;
+        verdicts.reserve(run.size());
+        for (const LogEvent* event : run) {
+            verdicts.push_back(getLogSourceVerdictLocked(*event));
         }
+        mNextActivationExpiryNs =
+                dispatchConfigMajorLocked(run, verdicts, metricsManagers, /*shard=*/0,
+                                          uidsWithActiveConfigsChanged);
+    });
+}
+
+void StatsLogProcessor::splitIntoConfigRunsLocked(
+        std::span<const std::unique_ptr<LogEvent>> events,
+        const std::function<void(const vector<const LogEvent*>&)>& dispatch) {
+    vector<const LogEvent*> pendingEvents;
+    pendingEvents.reserve(events.size());
+    for (const auto& event : events) {
+        // State changes and isolated uid changes are visible to every config, so the configs
+        // must have processed all prior events when they are applied.
+        const int atomId = event->GetTagId();
+        if (atomId == util::ISOLATED_UID_CHANGED ||
+            StateManager::getInstance().hasStateTracker(atomId)) {
+            dispatch(pendingEvents);
+            pendingEvents.clear();
+            if (StateManager::getInstance().hasStateTracker(atomId)) {
+                waitForConfigDumpLocked();
+            }
+        }
+        if (!preprocessLogEventLocked(event.get())) {
+            continue;
+        }
+        StateManager::getInstance().onLogEvent(*event);
+        if (mPendingConfigBuilds > 0) {
+            noteEventForConfigBuildsLocked(*event);
+        }
+        runBatchHousekeepingLocked();
+        pendingEvents.push_back(event.get());
     }
-    if (fireAlarm) {
-        informAnomalyAlarmFiredLocked(NanoToMillis(elapsedRealtimeNs));
+    dispatch(pendingEvents);
+}
+
+int64_t StatsLogProcessor::dispatchConfigMajorLocked(
+        const vector<const LogEvent*>& events, const vector<LogSourceVerdict>& verdicts,
+        const vector<std::pair<ConfigKey, sp<MetricsManager>>>& metricsManagers,
+        const size_t shard, std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    // Indices of the events routed to each manager, in order.
+    std::unordered_map<const MetricsManager*, vector<size_t>> routedEvents;
+    for (size_t i = 0; i < events.size(); i++) {
+        const auto routes = mAtomConfigRoutes.find(events[i]->GetTagId());
+        if (routes == mAtomConfigRoutes.end()) {
+            continue;
+        }
+        for (const ConfigRoute& route : routes->second) {
+            if (route.shard == shard) {
+                routedEvents[route.metricsManager.get()].push_back(i);
+            }
+        }
     }
 
-    const int64_t curTimeSec = getElapsedRealtimeSec();
-    if (curTimeSec - mLastPullerCacheClearTimeSec > StatsdStats::kPullerCacheClearIntervalSec) {
-        mPullerManager->ClearPullerCacheIfNecessary(curTimeSec * NS_PER_SEC);
-        mLastPullerCacheClearTimeSec = curTimeSec;
+    // The results of the shared matchers are kept for each event, so that the managers
+    // processing an event after the first one still look them up.
+    SharedMatcherCache& sharedMatcherCache = *mSharedMatcherCaches[shard];
+    sharedMatcherCache.beginBatch(events.size());
+    static const vector<size_t> kNoEvents;
+    int64_t nextActivationExpiryNs = INT64_MAX;
+    for (const auto& [key, metricsManager] : metricsManagers) {
+        const bool isBeingDumped = metricsManager == mConfigBeingDumped;
+        const auto it = routedEvents.find(metricsManager.get());
+        if (it == routedEvents.end() && isBeingDumped) {
+            continue;
+        }
+        const vector<size_t>& indices = it != routedEvents.end() ? it->second : kNoEvents;
+        // The expired activations are flushed at the time of the first event past them, whether
+        // or not it is routed to the manager.
+        int64_t nextExpiryNs = metricsManager->getNextActivationExpiryNs();
+        size_t nextIndex = 0;
+        for (size_t i = 0; i < events.size(); i++) {
+            const LogEvent& event = *events[i];
+            if (event.GetElapsedTimestampNs() > nextExpiryNs && !isBeingDumped) {
+                nextExpiryNs = flushExpiredActivationsForConfigLocked(
+                        key, *metricsManager, event.GetElapsedTimestampNs(),
+                        uidsWithActiveConfigsChanged);
+            }
+            if (nextIndex == indices.size() || indices[nextIndex] != i) {
+                continue;
+            }
+            nextIndex++;
+            sharedMatcherCache.selectEvent(i);
+            onLogEventForConfigLocked(key, *metricsManager, event, verdicts[i],
+                                      uidsWithActiveConfigsChanged);
+            nextExpiryNs = metricsManager->getNextActivationExpiryNs();
+        }
+        if (!isBeingDumped) {
+            nextActivationExpiryNs = std::min(nextActivationExpiryNs, nextExpiryNs);
+        }
     }
+    return nextActivationExpiryNs;
+}
 
-    flushRestrictedDataIfNecessaryLocked(elapsedRealtimeNs);
-    enforceDataTtlsIfNecessaryLocked(getWallClockNs(), elapsedRealtimeNs);
-    enforceDbGuardrailsIfNecessaryLocked(getWallClockNs(), elapsedRealtimeNs);
+void StatsLogProcessor::dispatchToShardsLocked(
+        const vector<const LogEvent*>& events,
+        const vector<vector<std::pair<ConfigKey, sp<MetricsManager>>>>& shards,
+        std::unordered_set<int>* uidsWithActiveConfigsChanged) {
+    if (events.empty()) {
+        return;
+    }
+    if (mConfigDumpEvents.size() + events.size() > kMaxConfigDumpEvents) {
+        // The shards can not wait for the dump, so it is done before they run.
+        waitForConfigDumpLocked();
+    }
+    vector<LogSourceVerdict> verdicts;
+    verdicts.reserve(events.size());
+    for (const LogEvent* event : events) {
+        verdicts.push_back(getLogSourceVerdictLocked(*event));
+    }
+    vector<std::unordered_set<int>> shardUidsWithActiveConfigsChanged(shards.size());
+    vector<int64_t> shardNextActivationExpiryNs(shards.size());
+    mEventWorkerPool->runOnAllShards([&](size_t shard) {
+        std::unordered_set<int>* uids = &shardUidsWithActiveConfigsChanged[shard];
+        if (mConfigMajorBatches) {
+            shardNextActivationExpiryNs[shard] =
+                    dispatchConfigMajorLocked(events, verdicts, shards[shard], shard, uids);
+            return;
+        }
+        // Like mNextActivationExpiryNs for the managers of the shard, found on the first event.
+        int64_t nextExpiryNs = INT64_MIN;
+        for (size_t i = 0; i < events.size(); i++) {
+            const LogEvent& event = *events[i];
+            const int64_t eventTimeNs = event.GetElapsedTimestampNs();
+            if (eventTimeNs > nextExpiryNs) {
+                nextExpiryNs = INT64_MAX;
+                for (const auto& [key, metricsManager] : shards[shard]) {
+                    if (metricsManager != mConfigBeingDumped) {
+                        nextExpiryNs = std::min(
+                                nextExpiryNs, flushExpiredActivationsForConfigLocked(
+                                                      key, *metricsManager, eventTimeNs, uids));
+                    }
+                }
+            }
+            const auto routes = mAtomConfigRoutes.find(event.GetTagId());
+            if (routes == mAtomConfigRoutes.end()) {
+                continue;
+            }
+            mSharedMatcherCaches[shard]->beginEvent();
+            for (const ConfigRoute& route : routes->second) {
+                if (route.shard != shard) {
+                    continue;
+                }
+                onLogEventForConfigLocked(route.key, *route.metricsManager, event, verdicts[i],
+                                          uids);
+                nextExpiryNs =
+                        std::min(nextExpiryNs, route.metricsManager->getNextActivationExpiryNs());
+            }
+        }
+        shardNextActivationExpiryNs[shard] = nextExpiryNs;
+    });
+    mNextActivationExpiryNs = *std::min_element(shardNextActivationExpiryNs.begin(),
+                                                shardNextActivationExpiryNs.end());
+    for (const auto& uids : shardUidsWithActiveConfigsChanged) {
+        uidsWithActiveConfigsChanged->insert(uids.begin(), uids.end());
+    }
+}
 
-    std::unordered_set<int> uidsWithActiveConfigsChanged;
+void StatsLogProcessor::onLogEventBatchEndLocked(
+        const std::unordered_set<int>& uidsWithActiveConfigsChanged,
+        const int64_t elapsedRealtimeNs) {
+    // Not done if the batch had no valid event.
+    mBatchConfigTtlCheckDue = false;
+    mBatchHousekeepingDue = false;
     std::unordered_map<int, std::vector<int64_t>> activeConfigsPerUid;
-
-    // pass the event to metrics managers.
-    for (auto& pair : mMetricsManagers) {
-        if (event->isRestricted() && !pair.second->hasRestrictedMetricsDelegate()) {
-            continue;
+    if (!uidsWithActiveConfigsChanged.empty() || elapsedRealtimeNs >= mNextByteSizeCheckNs) {
+        const bool checkByteSizes = elapsedRealtimeNs >= mNextByteSizeCheckNs;
+        if (checkByteSizes) {
+            mNextByteSizeCheckNs = INT64_MAX;
         }
-        int uid = pair.first.GetUid();
-        int64_t configId = pair.first.GetId();
-        bool isPrevActive = pair.second->isActive();
-        pair.second->onLogEvent(*event);
-        bool isCurActive = pair.second->isActive();
-        // Map all active configs by uid.
-        if (isCurActive) {
-            auto activeConfigs = activeConfigsPerUid.find(uid);
-            if (activeConfigs != activeConfigsPerUid.end()) {
-                activeConfigs->second.push_back(configId);
-            } else {
-                vector<int64_t> newActiveConfigs;
-                newActiveConfigs.push_back(configId);
-                activeConfigsPerUid[uid] = newActiveConfigs;
+        for (auto& pair : mMetricsManagers) {
+            // Map all active configs by uid.
+            if (!uidsWithActiveConfigsChanged.empty() && pair.second->isActive()) {
+                activeConfigsPerUid[pair.first.GetUid()].push_back(pair.first.GetId());
+            }
+            if (!checkByteSizes) {
+                continue;
             }
+            if (pair.second != mConfigBeingDumped) {
+                flushIfNecessaryLocked(pair.first, *(pair.second));
+            }
+            const auto lastCheckTime = mLastByteSizeTimes.find(pair.first);
+            mNextByteSizeCheckNs = std::min(
+                    mNextByteSizeCheckNs,
+                    lastCheckTime != mLastByteSizeTimes.end()
+                            ? lastCheckTime->second + StatsdStats::kMinByteSizeCheckPeriodNs
+                            : 0);
         }
-        // The activation state of this config changed.
-        if (isPrevActive != isCurActive) {
-            VLOG("Active status changed for uid  %d", uid);
-            uidsWithActiveConfigsChanged.insert(uid);
-            StatsdStats::getInstance().noteActiveStatusChanged(pair.first, isCurActive);
+    }
+    if (!uidsWithActiveConfigsChanged.empty()) {
+        for (const auto& [key, metricsManager] : mMetricsManagers) {
+            if (ConfigSummary* summary = getConfigSummaryLocked(key)) {
+                summary->isActive.store(metricsManager->isActive(), std::memory_order_relaxed);
+            }
         }
-        flushIfNecessaryLocked(pair.first, *(pair.second));
     }
 
     // Don't use the event timestamp for the guardrail.
@@ -521,36 +986,317 @@ void StatsLogProcessor::OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs) {
     }
 }
 
-void StatsLogProcessor::GetActiveConfigs(const int uid, vector<int64_t>& outActiveConfigs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
-    GetActiveConfigsLocked(uid, outActiveConfigs);
+void StatsLogProcessor::GetActiveConfigs(const int uid, vector<int64_t>& outActiveConfigs) const {
+    outActiveConfigs.clear();
+    const std::shared_ptr<const ConfigSummaries> summaries = std::atomic_load(&mConfigSummaries);
+    if (summaries == nullptr) {
+        return;
+    }
+    for (const auto& [key, summary] : *summaries) {
+        if (key.GetUid() == uid && summary->isActive.load(std::memory_order_relaxed)) {
+            outActiveConfigs.push_back(key.GetId());
+        }
+    }
 }
 
-void StatsLogProcessor::GetActiveConfigsLocked(const int uid, vector<int64_t>& outActiveConfigs) {
-    outActiveConfigs.clear();
-    for (auto& pair : mMetricsManagers) {
-        if (pair.first.GetUid() == uid && pair.second->isActive()) {
-            outActiveConfigs.push_back(pair.first.GetId());
+void StatsLogProcessor::publishConfigSummariesLocked() {
+    const std::shared_ptr<const ConfigSummaries> previous = std::atomic_load(&mConfigSummaries);
+    auto summaries = std::make_shared<ConfigSummaries>();
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        auto summary = std::make_shared<ConfigSummary>();
+        summary->isActive.store(metricsManager->isActive(), std::memory_order_relaxed);
+        summary->lastReportTimeNs.store(metricsManager->getLastReportTimeNs(),
+                                        std::memory_order_relaxed);
+        // byteSize() is only called at the rate limited checks, the size is kept until then.
+        if (previous != nullptr) {
+            const auto it = previous->find(key);
+            if (it != previous->end()) {
+                summary->byteSize.store(it->second->byteSize.load(std::memory_order_relaxed),
+                                        std::memory_order_relaxed);
+            }
         }
+        summaries->emplace(key, std::move(summary));
+    }
+    std::shared_ptr<const ConfigSummaries> published = std::move(summaries);
+    std::atomic_store(&mConfigSummaries, published);
+}
+
+StatsLogProcessor::ConfigSummary* StatsLogProcessor::getConfigSummaryLocked(
+        const ConfigKey& key) const {
+    // mConfigSummaries is only replaced with mMetricsMutex held.
+    if (mConfigSummaries == nullptr) {
+        return nullptr;
     }
+    const auto it = mConfigSummaries->find(key);
+    return it == mConfigSummaries->end() ? nullptr : it->second.get();
+}
+
+std::unique_lock<std::mutex> StatsLogProcessor::lockAllConfigs() {
+    std::unique_lock<std::mutex> lock(mMetricsMutex);
+    waitForConfigDumpLocked();
+    return lock;
+}
+
+bool StatsLogProcessor::beginConfigDumpLocked(const ConfigKey& key) {
+    if (!mPerConfigDumps) {
+        return false;
+    }
+    const auto it = mMetricsManagers.find(key);
+    if (it == mMetricsManagers.end()) {
+        return false;
+    }
+    mConfigBeingDumped = it->second;
+    mConfigKeyBeingDumped = key;
+    return true;
+}
+
+void StatsLogProcessor::endConfigDumpLocked(const int64_t dumpTimeNs, const int64_t wallClockNs) {
+    // Another dump may have started since, and finished this one.
+    waitForConfigDumpLocked();
+    if (mConfigDumpCheckpointPending) {
+        mConfigDumpCheckpointPending = false;
+        writeBucketCheckpointsLocked(dumpTimeNs, wallClockNs);
+    }
+}
+
+void StatsLogProcessor::waitForConfigDumpLocked() {
+    if (mConfigBeingDumped == nullptr) {
+        return;
+    }
+    // The dump holds mConfigDumpMutex until it no longer needs the config.
+    { std::lock_guard<std::mutex> dumpLock(mConfigDumpMutex); }
+    finishConfigDumpLocked();
+}
+
+void StatsLogProcessor::finishConfigDumpLocked() {
+    if (mConfigBeingDumped == nullptr) {
+        return;
+    }
+    const sp<MetricsManager> metricsManager = mConfigBeingDumped;
+    mConfigBeingDumped = nullptr;
+    std::unordered_set<int> uidsWithActiveConfigsChanged;
+    for (const auto& event : mConfigDumpEvents) {
+        beginSharedMatchingLocked();
+        onLogEventForConfigLocked(mConfigKeyBeingDumped, *metricsManager, *event,
+                                  getLogSourceVerdictLocked(*event), &uidsWithActiveConfigsChanged);
+    }
+    mConfigDumpEvents.clear();
+    // Its activations were left out while it was dumped.
+    mNextActivationExpiryNs = INT64_MIN;
+    onLogEventBatchEndLocked(uidsWithActiveConfigsChanged, getElapsedRealtimeNs());
 }
 
 void StatsLogProcessor::OnConfigUpdated(const int64_t timestampNs, const int64_t wallClockNs,
                                         const ConfigKey& key, const StatsdConfig& config,
                                         bool modularUpdate) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    if (mOffLockConfigBuilds) {
+        OnConfigUpdatedOffLock(timestampNs, wallClockNs, key, config, modularUpdate);
+        return;
+    }
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     WriteDataToDiskLocked(key, timestampNs, wallClockNs, CONFIG_UPDATED, NO_TIME_CONSTRAINTS);
     OnConfigUpdatedLocked(timestampNs, key, config, modularUpdate);
 }
 
+void StatsLogProcessor::OnConfigUpdatedOffLock(const int64_t timestampNs,
+                                               const int64_t wallClockNs, const ConfigKey& key,
+                                               const StatsdConfig& config, bool modularUpdate) {
+    int64_t generation;
+    size_t firstEventIndex;
+    {
+        std::unique_lock<std::mutex> lock = lockAllConfigs();
+        if (!createsMetricsManagerLocked(key, config, modularUpdate)) {
+            // Modular updates change the live MetricsManager in place.
+            WriteDataToDiskLocked(key, timestampNs, wallClockNs, CONFIG_UPDATED,
+                                  NO_TIME_CONSTRAINTS);
+            OnConfigUpdatedLocked(timestampNs, key, config, modularUpdate);
+            return;
+        }
+        generation = ++mConfigGenerations[key];
+        firstEventIndex = mConfigBuildEvents.size();
+        mPendingConfigBuilds++;
+    }
+
+    // The StateManager is only used with the lock held, so the metrics sliced by state are
+    // registered when the MetricsManager is swapped in.
+    sp<MetricsManager> builtMetricsManager =
+            new MetricsManager(key, config, mTimeBaseNs, timestampNs, mUidMap, mPullerManager,
+                               mAnomalyAlarmMonitor, mPeriodicAlarmMonitor,
+                               /*registerStateListeners=*/false);
+
+    // Declared after builtMetricsManager so that a dropped MetricsManager is destroyed once the
+    // lock is released.
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
+    mPendingConfigBuilds--;
+    if (mConfigGenerations[key] != generation) {
+        // The config was updated or removed again in the meantime. That change wins, as it
+        // would have if this update had held the lock.
+        VLOG("Dropping the outdated build of config %s", key.ToString().c_str());
+    } else {
+        WriteDataToDiskLocked(key, timestampNs, wallClockNs, CONFIG_UPDATED, NO_TIME_CONSTRAINTS);
+        if (mConfigBuildEventsOverflowed) {
+            // Too many events to replay, build the config again without processing events.
+            ALOGW("Too many events during the build of config %s, building it again",
+                  key.ToString().c_str());
+            OnConfigUpdatedLocked(timestampNs, key, config, modularUpdate);
+        } else {
+            OnConfigUpdatedLocked(timestampNs, key, config, modularUpdate, builtMetricsManager);
+            replayConfigBuildEventsLocked(key, firstEventIndex);
+        }
+    }
+    if (mPendingConfigBuilds == 0) {
+        mConfigBuildEvents.clear();
+        mConfigBuildEventsOverflowed = false;
+    }
+}
+
+bool StatsLogProcessor::createsMetricsManagerLocked(const ConfigKey& key,
+                                                    const StatsdConfig& config,
+                                                    bool modularUpdate) const {
+    const auto it = mMetricsManagers.find(key);
+    if (!modularUpdate || it == mMetricsManagers.end()) {
+        return true;
+    }
+    // Not a modular update if has_restricted_metrics_delegate changes.
+    return isAtLeastU() && it->second->hasRestrictedMetricsDelegate() !=
+                                   config.has_restricted_metrics_delegate_package_name();
+}
+
+void StatsLogProcessor::noteEventForConfigBuildsLocked(const LogEvent& event) {
+    if (mConfigBuildEvents.size() >= kMaxConfigBuildEvents) {
+        mConfigBuildEventsOverflowed = true;
+        return;
+    }
+    mConfigBuildEvents.push_back(std::make_unique<LogEvent>(event));
+}
+
+void StatsLogProcessor::replayConfigBuildEventsLocked(const ConfigKey& key,
+                                                      const size_t firstEventIndex) {
+    const auto it = mMetricsManagers.find(key);
+    if (it == mMetricsManagers.end() || firstEventIndex >= mConfigBuildEvents.size()) {
+        return;
+    }
+    std::unordered_set<int> uidsWithActiveConfigsChanged;
+    for (size_t i = firstEventIndex; i < mConfigBuildEvents.size(); i++) {
+        const LogEvent& event = *mConfigBuildEvents[i];
+        beginSharedMatchingLocked();
+        onLogEventForConfigLocked(key, *it->second, event, getLogSourceVerdictLocked(event),
+                                  &uidsWithActiveConfigsChanged);
+    }
+    mNextActivationExpiryNs = INT64_MIN;
+    onLogEventBatchEndLocked(uidsWithActiveConfigsChanged, getElapsedRealtimeNs());
+}
+
 void StatsLogProcessor::OnConfigUpdated(const int64_t timestampNs, const ConfigKey& key,
                                         const StatsdConfig& config, bool modularUpdate) {
     OnConfigUpdated(timestampNs, getWallClockNs(), key, config, modularUpdate);
 }
 
+void StatsLogProcessor::OnConfigsUpdated(const int64_t timestampNs,
+                                         const vector<pair<ConfigKey, StatsdConfig>>& configs) {
+    const int64_t wallClockNs = getWallClockNs();
+    if (!mOffLockConfigBuilds) {
+        std::unique_lock<std::mutex> lock = lockAllConfigs();
+        for (const auto& [key, config] : configs) {
+            WriteDataToDiskLocked(key, timestampNs, wallClockNs, CONFIG_UPDATED,
+                                  NO_TIME_CONSTRAINTS);
+            applyConfigUpdateLocked(timestampNs, key, config, /*modularUpdate=*/true);
+        }
+        onConfigsChangedLocked();
+        return;
+    }
+
+    struct ConfigBuild {
+        const ConfigKey& key;
+        const StatsdConfig& config;
+        int64_t generation;
+        sp<MetricsManager> builtMetricsManager;
+    };
+    vector<ConfigBuild> builds;
+    size_t firstEventIndex;
+    {
+        std::unique_lock<std::mutex> lock = lockAllConfigs();
+        bool updatedInPlace = false;
+        for (const auto& [key, config] : configs) {
+            if (!createsMetricsManagerLocked(key, config, /*modularUpdate=*/true)) {
+                // Modular updates change the live MetricsManager in place.
+                WriteDataToDiskLocked(key, timestampNs, wallClockNs, CONFIG_UPDATED,
+                                      NO_TIME_CONSTRAINTS);
+                applyConfigUpdateLocked(timestampNs, key, config, /*modularUpdate=*/true);
+                updatedInPlace = true;
+            } else {
+                builds.push_back({key, config, ++mConfigGenerations[key], nullptr});
+            }
+        }
+        if (updatedInPlace) {
+            onConfigsChangedLocked();
+        }
+        if (builds.empty()) {
+            return;
+        }
+        firstEventIndex = mConfigBuildEvents.size();
+        mPendingConfigBuilds++;
+    }
+
+    // Each shard builds every numShards-th config.
+    ShardedWorkerPool buildPool(std::min(builds.size(), kConfigBatchBuildThreads));
+    const size_t numShards = buildPool.getNumShards();
+    buildPool.runOnAllShards([&](const size_t shard) {
+        for (size_t i = shard; i < builds.size(); i += numShards) {
+            builds[i].builtMetricsManager = new MetricsManager(
+                    builds[i].key, builds[i].config, mTimeBaseNs, timestampNs, mUidMap,
+                    mPullerManager, mAnomalyAlarmMonitor, mPeriodicAlarmMonitor,
+                    /*registerStateListeners=*/false);
+        }
+    });
+
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
+    mPendingConfigBuilds--;
+    vector<ConfigKey> builtKeys;
+    for (const ConfigBuild& build : builds) {
+        if (mConfigGenerations[build.key] != build.generation) {
+            // Same as in OnConfigUpdatedOffLock().
+            VLOG("Dropping the outdated build of config %s", build.key.ToString().c_str());
+            continue;
+        }
+        WriteDataToDiskLocked(build.key, timestampNs, wallClockNs, CONFIG_UPDATED,
+                              NO_TIME_CONSTRAINTS);
+        if (mConfigBuildEventsOverflowed) {
+            ALOGW("Too many events during the build of config %s, building it again",
+                  build.key.ToString().c_str());
+            applyConfigUpdateLocked(timestampNs, build.key, build.config, /*modularUpdate=*/true);
+        } else {
+            applyConfigUpdateLocked(timestampNs, build.key, build.config, /*modularUpdate=*/true,
+                                    build.builtMetricsManager);
+            builtKeys.push_back(build.key);
+        }
+    }
+    onConfigsChangedLocked();
+    // The events are replayed once every config is swapped in and the matchers are shared.
+    for (const ConfigKey& key : builtKeys) {
+        replayConfigBuildEventsLocked(key, firstEventIndex);
+    }
+    if (mPendingConfigBuilds == 0) {
+        mConfigBuildEvents.clear();
+        mConfigBuildEventsOverflowed = false;
+    }
+}
+
 void StatsLogProcessor::OnConfigUpdatedLocked(const int64_t timestampNs, const ConfigKey& key,
-                                              const StatsdConfig& config, bool modularUpdate) {
+                                              const StatsdConfig& config, bool modularUpdate,
+                                              const sp<MetricsManager>& builtMetricsManager) {
+    applyConfigUpdateLocked(timestampNs, key, config, modularUpdate, builtMetricsManager);
+    onConfigsChangedLocked();
+}
+
+void StatsLogProcessor::applyConfigUpdateLocked(const int64_t timestampNs, const ConfigKey& key,
+                                                const StatsdConfig& config, bool modularUpdate,
+                                                const sp<MetricsManager>& builtMetricsManager) {
     VLOG("Updated configuration for key %s", key.ToString().c_str());
+    mConfigGenerations[key]++;
+    // The ttl and the byte size of the config are checked with the next batch.
+    mNextConfigTtlExpiryNs = 0;
+    mNextByteSizeCheckNs = 0;
     const auto& it = mMetricsManagers.find(key);
     bool configValid = false;
     if (isAtLeastU() && it != mMetricsManagers.end()) {
@@ -568,11 +1314,21 @@ void StatsLogProcessor::OnConfigUpdatedLocked(const int64_t timestampNs, const C
     }
     // Create new config if this is not a modular update or if this is a new config.
     if (!modularUpdate || it == mMetricsManagers.end()) {
-        sp<MetricsManager> newMetricsManager =
-                new MetricsManager(key, config, mTimeBaseNs, timestampNs, mUidMap, mPullerManager,
-                                   mAnomalyAlarmMonitor, mPeriodicAlarmMonitor);
+        sp<MetricsManager> newMetricsManager = builtMetricsManager;
+        if (newMetricsManager == nullptr) {
+            newMetricsManager = new MetricsManager(key, config, mTimeBaseNs, timestampNs, mUidMap,
+                                                   mPullerManager, mAnomalyAlarmMonitor,
+                                                   mPeriodicAlarmMonitor);
+        }
+        newMetricsManager->setDimensionKeyInterner(mDimensionKeyInterner);
+        if (mConfigArenas) {
+            newMetricsManager->setConfigArena(new ConfigArena());
+        }
         configValid = newMetricsManager->isConfigValid();
         if (configValid) {
+            if (builtMetricsManager != nullptr) {
+                newMetricsManager->registerToStateManager();
+            }
             newMetricsManager->init();
             newMetricsManager->refreshTtl(timestampNs);
             // Sdk check for U+ is unnecessary because config with restricted metrics delegate
@@ -591,6 +1347,9 @@ void StatsLogProcessor::OnConfigUpdatedLocked(const int64_t timestampNs, const C
                 mSendRestrictedMetricsBroadcast(key, it->second->getRestrictedMetricsDelegate(),
                                                 {});
             }
+            if (it != mMetricsManagers.end()) {
+                releaseMetricsManagerLocked(std::move(it->second));
+            }
             mMetricsManagers[key] = newMetricsManager;
             VLOG("StatsdConfig valid");
         }
@@ -622,31 +1381,53 @@ void StatsLogProcessor::OnConfigUpdatedLocked(const int64_t timestampNs, const C
             StatsdStats::getInstance().noteDbConfigInvalid(key);
             dbutils::deleteDb(key);
         }
-        mMetricsManagers.erase(key);
+        if (it != mMetricsManagers.end()) {
+            releaseMetricsManagerLocked(std::move(it->second));
+            mMetricsManagers.erase(it);
+        }
         mUidMap->OnConfigRemoved(key);
     }
+}
 
+void StatsLogProcessor::onConfigsChangedLocked() {
     updateLogEventFilterLocked();
+    refreshLogSourceConfigMasksLocked();
+    publishConfigSummariesLocked();
+}
+
+void StatsLogProcessor::releaseMetricsManagerLocked(sp<MetricsManager> metricsManager) {
+    if (mMetricsManagerReaper != nullptr && metricsManager != nullptr) {
+        mMetricsManagerReaper->release(std::move(metricsManager));
+    }
 }
 
 size_t StatsLogProcessor::GetMetricsSize(const ConfigKey& key) const {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
-    auto it = mMetricsManagers.find(key);
-    if (it == mMetricsManagers.end()) {
+    const std::shared_ptr<const ConfigSummaries> summaries = std::atomic_load(&mConfigSummaries);
+    if (summaries == nullptr || summaries->find(key) == summaries->end()) {
         ALOGW("Config source %s does not exist", key.ToString().c_str());
         return 0;
     }
-    return it->second->byteSize();
+    return summaries->at(key)->byteSize.load(std::memory_order_relaxed);
 }
 
 void StatsLogProcessor::dumpStates(int out, bool verbose) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     dprintf(out, "MetricsManager count: %lu\n", (unsigned long)mMetricsManagers.size());
     for (auto metricsManager : mMetricsManagers) {
         metricsManager.second->dumpStates(out, verbose);
     }
 }
 
+void StatsLogProcessor::dumpMemory(int out) {
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
+    dprintf(out, "UidMap: %zu bytes\n", mUidMap->getBytesUsed());
+    dprintf(out, "Idle proto output streams: %zu bytes\n",
+            ProtoOutputStreamPool::getInstance().getRetainedBytes());
+    for (const auto& [_, metricsManager] : mMetricsManagers) {
+        metricsManager->dumpMemory(out);
+    }
+}
+
 /*
  * onDumpReport dumps serialized ConfigMetricsReportList into proto.
  */
@@ -655,7 +1436,9 @@ void StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTim
                                      const bool include_current_partial_bucket,
                                      const bool erase_data, const DumpReportReason dumpReportReason,
                                      const DumpLatency dumpLatency, ProtoOutputStream* proto) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> dumpLock(mConfigDumpMutex);
+    std::unique_lock<std::mutex> lock(mMetricsMutex);
+    finishConfigDumpLocked();
 
     auto it = mMetricsManagers.find(key);
     if (it != mMetricsManagers.end() && it->second->hasRestrictedMetricsDelegate()) {
@@ -674,18 +1457,26 @@ void StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTim
     if (it != mMetricsManagers.end() && it->second->shouldPersistLocalHistory()) {
         keepFile = true;
     }
+    if (it != mMetricsManagers.end()) {
+        // This allows another broadcast to be sent within the rate-limit period if we get close to
+        // filling the buffer again soon.
+        mLastBroadcastTimes.erase(key);
+    }
+    const bool dumpOffLock = beginConfigDumpLocked(key);
+    if (dumpOffLock) {
+        lock.unlock();
+    }
 
     // Then, check stats-data directory to see there's any file containing
     // ConfigMetricsReport from previous shutdowns to concatenate to reports.
+    if (mAsyncDiskWriter != nullptr) {
+        mAsyncDiskWriter->waitForPendingWrites();
+    }
     StorageManager::appendConfigMetricsReport(
             key, proto, erase_data && !keepFile /* should remove file after appending it */,
             dumpReportReason == ADB_DUMP /*if caller is adb*/);
 
     if (it != mMetricsManagers.end()) {
-        // This allows another broadcast to be sent within the rate-limit period if we get close to
-        // filling the buffer again soon.
-        mLastBroadcastTimes.erase(key);
-
         vector<uint8_t> buffer;
         onConfigMetricsReportLocked(key, dumpTimeStampNs, wallClockNs,
                                     include_current_partial_bucket, erase_data, dumpReportReason,
@@ -696,6 +1487,11 @@ void StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTim
     } else {
         ALOGW("Config source %s does not exist", key.ToString().c_str());
     }
+    if (dumpOffLock) {
+        dumpLock.unlock();
+        lock.lock();
+        endConfigDumpLocked(dumpTimeStampNs, wallClockNs);
+    }
 
     if (erase_data) {
         ++mDumpReportNumbers[key];
@@ -718,16 +1514,131 @@ void StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTim
                                      const bool include_current_partial_bucket,
                                      const bool erase_data, const DumpReportReason dumpReportReason,
                                      const DumpLatency dumpLatency, vector<uint8_t>* outData) {
-    ProtoOutputStream proto;
+    ProtoOutputStreamPool::Stream proto = ProtoOutputStreamPool::getInstance().acquire();
     onDumpReport(key, dumpTimeStampNs, wallClockNs, include_current_partial_bucket, erase_data,
-                 dumpReportReason, dumpLatency, &proto);
+                 dumpReportReason, dumpLatency, proto.get());
 
     if (outData != nullptr) {
-        flushProtoToBuffer(proto, outData);
+        flushProtoToBuffer(*proto, outData);
         VLOG("output data size %zu", outData->size());
     }
 }
 
+// Returns the end of the tag and length written for one of the reports.
+static uint8_t* writeReportHeader(uint8_t* buf, size_t reportSize) {
+    return android::util::write_length_delimited_tag_header(buf, FIELD_ID_REPORTS, reportSize);
+}
+
+size_t ConfigMetricsReportListParts::size() const {
+    uint8_t reportHeader[kMaxReportHeaderBytes];
+    size_t size = mHeader.size() + mTrailer.size();
+    for (const std::string_view& report : mDiskReports.mReports) {
+        size += writeReportHeader(reportHeader, report.size()) - reportHeader + report.size();
+    }
+    if (mHasMemoryReport) {
+        size += writeReportHeader(reportHeader, mMemoryReport.size()) - reportHeader +
+                mMemoryReport.size();
+    }
+    return size;
+}
+
+bool ConfigMetricsReportListParts::writeToFd(int fd) const {
+    uint8_t reportHeader[kMaxReportHeaderBytes];
+    auto writeReport = [&](const void* data, size_t reportSize) {
+        const uint8_t* headerEnd = writeReportHeader(reportHeader, reportSize);
+        return android::base::WriteFully(fd, reportHeader, headerEnd - reportHeader) &&
+               android::base::WriteFully(fd, data, reportSize);
+    };
+    if (!android::base::WriteFully(fd, mHeader.data(), mHeader.size())) {
+        return false;
+    }
+    // Written straight from the mappings, so the disk reports are never copied to the heap.
+    for (const std::string_view& report : mDiskReports.mReports) {
+        if (!writeReport(report.data(), report.size())) {
+            return false;
+        }
+    }
+    if (mHasMemoryReport && !writeReport(mMemoryReport.data(), mMemoryReport.size())) {
+        return false;
+    }
+    return android::base::WriteFully(fd, mTrailer.data(), mTrailer.size());
+}
+
+/*
+ * Same as onDumpReport into a ProtoOutputStream, but the ConfigMetricsReportList is returned in
+ * pieces.
+ */
+void StatsLogProcessor::onDumpReport(const ConfigKey& key, const int64_t dumpTimeStampNs,
+                                     const int64_t wallClockNs,
+                                     const bool include_current_partial_bucket,
+                                     const bool erase_data, const DumpReportReason dumpReportReason,
+                                     const DumpLatency dumpLatency,
+                                     ConfigMetricsReportListParts* parts) {
+    std::unique_lock<std::mutex> dumpLock(mConfigDumpMutex);
+    std::unique_lock<std::mutex> lock(mMetricsMutex);
+    finishConfigDumpLocked();
+
+    auto it = mMetricsManagers.find(key);
+    if (it != mMetricsManagers.end() && it->second->hasRestrictedMetricsDelegate()) {
+        VLOG("Unexpected call to StatsLogProcessor::onDumpReport for restricted metrics.");
+        return;
+    }
+
+    ProtoOutputStream header;
+    uint64_t configKeyToken = header.start(FIELD_TYPE_MESSAGE | FIELD_ID_CONFIG_KEY);
+    header.write(FIELD_TYPE_INT32 | FIELD_ID_UID, key.GetUid());
+    header.write(FIELD_TYPE_INT64 | FIELD_ID_ID, (long long)key.GetId());
+    header.end(configKeyToken);
+    flushProtoToBuffer(header, &parts->mHeader);
+
+    bool keepFile = false;
+    if (it != mMetricsManagers.end() && it->second->shouldPersistLocalHistory()) {
+        keepFile = true;
+    }
+    if (it != mMetricsManagers.end()) {
+        mLastBroadcastTimes.erase(key);
+    }
+    const bool dumpOffLock = beginConfigDumpLocked(key);
+    if (dumpOffLock) {
+        lock.unlock();
+    }
+
+    if (mAsyncDiskWriter != nullptr) {
+        mAsyncDiskWriter->waitForPendingWrites();
+    }
+    StorageManager::mapConfigMetricsReports(
+            key, erase_data && !keepFile /* should remove file after mapping it */,
+            dumpReportReason == ADB_DUMP /*if caller is adb*/, &parts->mDiskReports);
+
+    if (it != mMetricsManagers.end()) {
+        onConfigMetricsReportLocked(key, dumpTimeStampNs, wallClockNs,
+                                    include_current_partial_bucket, erase_data, dumpReportReason,
+                                    dumpLatency, false /* is this data going to be saved on disk */,
+                                    &parts->mMemoryReport);
+        parts->mHasMemoryReport = true;
+    } else {
+        ALOGW("Config source %s does not exist", key.ToString().c_str());
+    }
+    if (dumpOffLock) {
+        dumpLock.unlock();
+        lock.lock();
+        endConfigDumpLocked(dumpTimeStampNs, wallClockNs);
+    }
+
+    if (erase_data) {
+        ++mDumpReportNumbers[key];
+    }
+    ProtoOutputStream trailer;
+    trailer.write(FIELD_TYPE_INT32 | FIELD_ID_REPORT_NUMBER, mDumpReportNumbers[key]);
+    trailer.write(FIELD_TYPE_INT32 | FIELD_ID_STATSD_STATS_ID,
+                  StatsdStats::getInstance().getStatsdStatsId());
+    flushProtoToBuffer(trailer, &parts->mTrailer);
+    if (erase_data) {
+        StatsdStats::getInstance().noteMetricsReportSent(key, parts->size(),
+                                                         mDumpReportNumbers[key]);
+    }
+}
+
 /*
  * For test use only. Excludes wallclockNs.
  * onDumpReport dumps serialized ConfigMetricsReportList into outData.
@@ -748,68 +1659,100 @@ void StatsLogProcessor::onConfigMetricsReportLocked(
         const bool include_current_partial_bucket, const bool erase_data,
         const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
         const bool dataSavedOnDisk, vector<uint8_t>* buffer) {
+    ProtoOutputStreamPool::Stream tempProto = ProtoOutputStreamPool::getInstance().acquire();
+    if (!writeConfigMetricsReportLocked(key, dumpTimeStampNs, wallClockNs,
+                                        include_current_partial_bucket, erase_data,
+                                        dumpReportReason, dumpLatency, tempProto.get())) {
+        return;
+    }
+    flushProtoToBuffer(*tempProto, buffer);
+
+    // save buffer to disk if needed
+    if (erase_data && !dataSavedOnDisk &&
+        mMetricsManagers.find(key)->second->shouldPersistLocalHistory()) {
+        VLOG("save history to disk");
+        string file_name = StorageManager::getDataHistoryFileName((long)getWallClockSec(),
+                                                                  key.GetUid(), key.GetId());
+        // The buffer is also returned to the caller, so only the copy on disk is compressed.
+        vector<uint8_t> compressed;
+        const vector<uint8_t>& saved =
+                compressReport(mReportCodec, *buffer, &compressed) ? compressed : *buffer;
+        StorageManager::writeFile(file_name.c_str(), saved.data(), saved.size());
+    }
+}
+
+bool StatsLogProcessor::writeConfigMetricsReportLocked(
+        const ConfigKey& key, const int64_t dumpTimeStampNs, const int64_t wallClockNs,
+        const bool include_current_partial_bucket, const bool erase_data,
+        const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
+        ProtoOutputStream* proto,
+        const std::function<void(ProtoOutputStream*)>& flushCompletedFields) {
     // We already checked whether key exists in mMetricsManagers in
     // WriteDataToDisk.
     auto it = mMetricsManagers.find(key);
     if (it == mMetricsManagers.end()) {
-        return;
+        return false;
     }
     if (it->second->hasRestrictedMetricsDelegate()) {
         VLOG("Unexpected call to StatsLogProcessor::onConfigMetricsReportLocked for restricted "
              "metrics.");
         // Do not call onDumpReport for restricted metrics.
-        return;
+        return false;
     }
     int64_t lastReportTimeNs = it->second->getLastReportTimeNs();
     int64_t lastReportWallClockNs = it->second->getLastReportWallClockNs();
 
     std::set<string> str_set;
 
-    ProtoOutputStream tempProto;
     // First, fill in ConfigMetricsReport using current data on memory, which
     // starts from filling in StatsLogReport's.
     it->second->onDumpReport(dumpTimeStampNs, wallClockNs, include_current_partial_bucket,
-                             erase_data, dumpLatency, &str_set, &tempProto);
+                             erase_data, dumpLatency, &str_set, proto, flushCompletedFields);
+    if (ConfigSummary* summary = getConfigSummaryLocked(key)) {
+        summary->lastReportTimeNs.store(it->second->getLastReportTimeNs(),
+                                        std::memory_order_relaxed);
+    }
+    if (erase_data && include_current_partial_bucket && mCheckpointedConfigs.count(key) > 0) {
+        // The checkpointed buckets are reported, they must not be restored after a crash. The
+        // checkpoint covers every config, so a config dumped off lock writes it at the end.
+        if (mConfigBeingDumped == it->second) {
+            mConfigDumpCheckpointPending = true;
+        } else {
+            writeBucketCheckpointsLocked(dumpTimeStampNs, wallClockNs);
+        }
+    }
 
     // Fill in UidMap if there is at least one metric to report.
     // This skips the uid map if it's an empty config.
     if (it->second->getNumMetrics() > 0) {
-        uint64_t uidMapToken = tempProto.start(FIELD_TYPE_MESSAGE | FIELD_ID_UID_MAP);
+        uint64_t uidMapToken = proto->start(FIELD_TYPE_MESSAGE | FIELD_ID_UID_MAP);
         mUidMap->appendUidMap(dumpTimeStampNs, key, it->second->versionStringsInReport(),
                               it->second->installerInReport(),
                               it->second->packageCertificateHashSizeBytes(),
-                              it->second->hashStringInReport() ? &str_set : nullptr, &tempProto);
-        tempProto.end(uidMapToken);
+                              it->second->hashStringInReport() ? &str_set : nullptr, proto,
+                              it->second->uidMapDeltaSnapshots());
+        proto->end(uidMapToken);
     }
 
     // Fill in the timestamps.
-    tempProto.write(FIELD_TYPE_INT64 | FIELD_ID_LAST_REPORT_ELAPSED_NANOS,
-                    (long long)lastReportTimeNs);
-    tempProto.write(FIELD_TYPE_INT64 | FIELD_ID_CURRENT_REPORT_ELAPSED_NANOS,
-                    (long long)dumpTimeStampNs);
-    tempProto.write(FIELD_TYPE_INT64 | FIELD_ID_LAST_REPORT_WALL_CLOCK_NANOS,
-                    (long long)lastReportWallClockNs);
-    tempProto.write(FIELD_TYPE_INT64 | FIELD_ID_CURRENT_REPORT_WALL_CLOCK_NANOS,
-                    (long long)wallClockNs);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_LAST_REPORT_ELAPSED_NANOS,
+                 (long long)lastReportTimeNs);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_CURRENT_REPORT_ELAPSED_NANOS,
+                 (long long)dumpTimeStampNs);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_LAST_REPORT_WALL_CLOCK_NANOS,
+                 (long long)lastReportWallClockNs);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_CURRENT_REPORT_WALL_CLOCK_NANOS,
+                 (long long)wallClockNs);
     // Dump report reason
-    tempProto.write(FIELD_TYPE_INT32 | FIELD_ID_DUMP_REPORT_REASON, dumpReportReason);
+    proto->write(FIELD_TYPE_INT32 | FIELD_ID_DUMP_REPORT_REASON, dumpReportReason);
 
     for (const auto& str : str_set) {
-        tempProto.write(FIELD_TYPE_STRING | FIELD_COUNT_REPEATED | FIELD_ID_STRINGS, str);
+        proto->write(FIELD_TYPE_STRING | FIELD_COUNT_REPEATED | FIELD_ID_STRINGS, str);
     }
 
     // Data corrupted reason
-    writeDataCorruptedReasons(tempProto);
-
-    flushProtoToBuffer(tempProto, buffer);
-
-    // save buffer to disk if needed
-    if (erase_data && !dataSavedOnDisk && it->second->shouldPersistLocalHistory()) {
-        VLOG("save history to disk");
-        string file_name = StorageManager::getDataHistoryFileName((long)getWallClockSec(),
-                                                                  key.GetUid(), key.GetId());
-        StorageManager::writeFile(file_name.c_str(), buffer->data(), buffer->size());
-    }
+    writeDataCorruptedReasons(*proto);
+    return true;
 }
 
 void StatsLogProcessor::resetConfigsLocked(const int64_t timestampNs,
@@ -842,10 +1785,19 @@ void StatsLogProcessor::resetIfConfigTtlExpiredLocked(const int64_t eventTimeNs)
                               getWallClockNs());
         resetConfigsLocked(eventTimeNs, configKeysTtlExpired);
     }
+
+    mNextConfigTtlExpiryNs = INT64_MAX;
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        if (metricsManager != nullptr) {
+            mNextConfigTtlExpiryNs =
+                    std::min(mNextConfigTtlExpiryNs, metricsManager->getTtlExpiryNs());
+        }
+    }
 }
 
 void StatsLogProcessor::OnConfigRemoved(const ConfigKey& key) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
+    mConfigGenerations[key]++;
     auto it = mMetricsManagers.find(key);
     if (it != mMetricsManagers.end()) {
         WriteDataToDiskLocked(key, getElapsedRealtimeNs(), getWallClockNs(), CONFIG_REMOVED,
@@ -855,6 +1807,7 @@ void StatsLogProcessor::OnConfigRemoved(const ConfigKey& key) {
             dbutils::deleteDb(key);
             mSendRestrictedMetricsBroadcast(key, it->second->getRestrictedMetricsDelegate(), {});
         }
+        releaseMetricsManagerLocked(std::move(it->second));
         mMetricsManagers.erase(it);
         mUidMap->OnConfigRemoved(key);
     }
@@ -881,6 +1834,8 @@ void StatsLogProcessor::OnConfigRemoved(const ConfigKey& key) {
     }
 
     updateLogEventFilterLocked();
+    refreshLogSourceConfigMasksLocked();
+    publishConfigSummariesLocked();
 }
 
 // TODO(b/267501143): Add unit tests when metric producer is ready
@@ -910,7 +1865,7 @@ void StatsLogProcessor::querySql(const string& sqlQuery, const int32_t minSqlCli
                                  const shared_ptr<IStatsQueryCallback>& callback,
                                  const int64_t configId, const string& configPackage,
                                  const int32_t callingUid) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     string err = "";
 
     if (!isAtLeastU()) {
@@ -964,43 +1919,45 @@ void StatsLogProcessor::querySql(const string& sqlQuery, const int32_t minSqlCli
         return;
     }
 
-    flushRestrictedDataLocked(elapsedRealtimeNs);
-    enforceDataTtlsLocked(getWallClockNs(), elapsedRealtimeNs);
+    // Only the queried config needs its data written and its expired data deleted. The query
+    // itself runs on a read-only db handle, without blocking the event processing.
+    const ConfigKey queryKey = *keysToQuery.begin();
+    const sp<MetricsManager>& metricsManager = mMetricsManagers[queryKey];
+    metricsManager->flushRestrictedData(mAsyncRestrictedInserts);
+    metricsManager->enforceRestrictedDataTtls(getWallClockNs());
+    lock.unlock();
 
-    std::vector<std::vector<std::string>> rows;
     std::vector<int32_t> columnTypes;
     std::vector<string> columnNames;
-    if (!dbutils::query(*(keysToQuery.begin()), sqlQuery, rows, columnTypes, columnNames, err)) {
-        callback->sendFailure(StringPrintf("failed to query db %s:", err.c_str()));
+    // Results that fit in one page are sent at once, the larger ones page by page.
+    bool sendingPages = false;
+    bool cancelled = false;
+    const auto sendPage = [&](vector<string>& pageData, int32_t rowCount, bool isLastPage) {
+        if (isLastPage && !sendingPages) {
+            callback->sendResults(pageData, columnNames, columnTypes, rowCount);
+            return true;
+        }
+        sendingPages = true;
+        if (!callback->sendResultsPage(pageData, columnNames, columnTypes, rowCount, isLastPage)
+                     .isOk()) {
+            // The client is gone, the rest of the results has nowhere to go.
+            cancelled = true;
+            return false;
+        }
+        return true;
+    };
+    if (!dbutils::query(queryKey, sqlQuery, StatsdStats::kMaxQueryResultsPageBytes, sendPage,
+                        columnTypes, columnNames, err)) {
+        if (!cancelled) {
+            callback->sendFailure(StringPrintf("failed to query db %s:", err.c_str()));
+        }
         StatsdStats::getInstance().noteQueryRestrictedMetricFailed(
-                configId, configPackage, keysToQuery.begin()->GetUid(), callingUid,
+                configId, configPackage, queryKey.GetUid(), callingUid,
                 InvalidQueryReason(QUERY_FAILURE), err.c_str());
         return;
     }
-
-    vector<string> queryData;
-    queryData.reserve(rows.size() * columnNames.size());
-    // TODO(b/268415904): avoid this vector transformation.
-    if (columnNames.size() != columnTypes.size()) {
-        callback->sendFailure("Inconsistent row sizes");
-        StatsdStats::getInstance().noteQueryRestrictedMetricFailed(
-                configId, configPackage, keysToQuery.begin()->GetUid(), callingUid,
-                InvalidQueryReason(INCONSISTENT_ROW_SIZE));
-    }
-    for (size_t i = 0; i < rows.size(); ++i) {
-        if (rows[i].size() != columnNames.size()) {
-            callback->sendFailure("Inconsistent row sizes");
-            StatsdStats::getInstance().noteQueryRestrictedMetricFailed(
-                    configId, configPackage, keysToQuery.begin()->GetUid(), callingUid,
-                    InvalidQueryReason(INCONSISTENT_ROW_SIZE));
-            return;
-        }
-        queryData.insert(std::end(queryData), std::make_move_iterator(std::begin(rows[i])),
-                         std::make_move_iterator(std::end(rows[i])));
-    }
-    callback->sendResults(queryData, columnNames, columnTypes, rows.size());
     StatsdStats::getInstance().noteQueryRestrictedMetricSucceed(
-            configId, configPackage, keysToQuery.begin()->GetUid(), callingUid,
+            configId, configPackage, queryKey.GetUid(), callingUid,
             /*queryLatencyNs=*/getElapsedRealtimeNs() - elapsedRealtimeNs);
 }
 
@@ -1042,7 +1999,7 @@ void StatsLogProcessor::EnforceDataTtls(const int64_t wallClockNs,
     if (!isAtLeastU()) {
         return;
     }
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     enforceDataTtlsLocked(wallClockNs, elapsedRealtimeNs);
 }
 
@@ -1067,7 +2024,7 @@ void StatsLogProcessor::enforceDbGuardrailsIfNecessaryLocked(const int64_t wallC
 
 void StatsLogProcessor::fillRestrictedMetrics(const int64_t configId, const string& configPackage,
                                               const int32_t delegateUid, vector<int64_t>* output) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
 
     set<int32_t> configPackageUids;
     const auto& uidMapItr = UidMap::sAidToUidMapping.find(configPackage);
@@ -1090,7 +2047,7 @@ void StatsLogProcessor::fillRestrictedMetrics(const int64_t configId, const stri
 void StatsLogProcessor::flushRestrictedDataLocked(const int64_t elapsedRealtimeNs) {
     for (const auto& it : mMetricsManagers) {
         // no-op if metricsManager is not restricted
-        it.second->flushRestrictedData();
+        it.second->flushRestrictedData(mAsyncRestrictedInserts);
     }
 
     mLastFlushRestrictedTime = elapsedRealtimeNs;
@@ -1106,8 +2063,12 @@ void StatsLogProcessor::flushIfNecessaryLocked(const ConfigKey& key,
         }
     }
 
-    // We suspect that the byteSize() computation is expensive, so we set a rate limit.
+    // Producers keep their byte size up to date, but each of them still has to be locked to read
+    // it, so the check is rate limited.
     size_t totalBytes = metricsManager.byteSize();
+    if (ConfigSummary* summary = getConfigSummaryLocked(key)) {
+        summary->byteSize.store(totalBytes, std::memory_order_relaxed);
+    }
 
     mLastByteSizeTimes[key] = elapsedRealtimeNs;
     const size_t kBytesPerConfig = metricsManager.hasRestrictedMetricsDelegate()
@@ -1129,7 +2090,7 @@ void StatsLogProcessor::flushIfNecessaryLocked(const ConfigKey& key,
 
     if (requestDump) {
         if (metricsManager.hasRestrictedMetricsDelegate()) {
-            metricsManager.flushRestrictedData();
+            metricsManager.flushRestrictedData(mAsyncRestrictedInserts);
             // No need to send broadcast for restricted metrics.
             return;
         }
@@ -1160,23 +2121,63 @@ void StatsLogProcessor::WriteDataToDiskLocked(const ConfigKey& key, const int64_
         return;
     }
     if (mMetricsManagers.find(key)->second->hasRestrictedMetricsDelegate()) {
-        mMetricsManagers.find(key)->second->flushRestrictedData();
+        mMetricsManagers.find(key)->second->flushRestrictedData(mAsyncRestrictedInserts);
+        return;
+    }
+    writeReportToDiskLocked(key, timestampNs, wallClockNs, dumpReportReason, dumpLatency);
+
+    // We were able to write the ConfigMetricsReport to disk, so we should trigger collection ASAP.
+    mOnDiskDataConfigs.insert(key);
+}
+
+void StatsLogProcessor::writeReportToDiskLocked(const ConfigKey& key, const int64_t timestampNs,
+                                                const int64_t wallClockNs,
+                                                const DumpReportReason dumpReportReason,
+                                                const DumpLatency dumpLatency) {
+    if (!mReportSegments && mReportCodec == REPORT_CODEC_NONE && mAsyncDiskWriter == nullptr) {
+        // The report is written as it is built, one metric at a time, so at most one metric
+        // report is held in memory instead of the whole report and a copy of it.
+        ChunkedFileWriter writer(StorageManager::getDataFileName((long)getWallClockSec(),
+                                                                 key.GetUid(), key.GetId()));
+        const auto flushToFile = [&writer](ProtoOutputStream* proto) { writer.write(proto); };
+        ProtoOutputStreamPool::Stream proto = ProtoOutputStreamPool::getInstance().acquire();
+        if (writeConfigMetricsReportLocked(key, timestampNs, wallClockNs,
+                                           true /* include_current_partial_bucket*/,
+                                           true /* erase_data */, dumpReportReason, dumpLatency,
+                                           proto.get(), flushToFile)) {
+            writer.write(proto.get());
+            writer.commit();
+        }
         return;
     }
+
     vector<uint8_t> buffer;
     onConfigMetricsReportLocked(key, timestampNs, wallClockNs,
                                 true /* include_current_partial_bucket*/, true /* erase_data */,
                                 dumpReportReason, dumpLatency, true, &buffer);
-    string file_name =
-            StorageManager::getDataFileName((long)getWallClockSec(), key.GetUid(), key.GetId());
-    StorageManager::writeFile(file_name.c_str(), buffer.data(), buffer.size());
-
-    // We were able to write the ConfigMetricsReport to disk, so we should trigger collection ASAP.
-    mOnDiskDataConfigs.insert(key);
+    vector<uint8_t> compressed;
+    if (compressReport(mReportCodec, buffer, &compressed)) {
+        buffer.swap(compressed);
+    }
+    if (mReportSegments) {
+        if (mAsyncDiskWriter != nullptr) {
+            mAsyncDiskWriter->appendReport(key, std::move(buffer));
+        } else {
+            StorageManager::appendReportToSegment(key, buffer.data(), buffer.size());
+        }
+    } else {
+        string file_name = StorageManager::getDataFileName((long)getWallClockSec(), key.GetUid(),
+                                                           key.GetId());
+        if (mAsyncDiskWriter != nullptr) {
+            mAsyncDiskWriter->write(std::move(file_name), std::move(buffer));
+        } else {
+            StorageManager::writeFile(file_name.c_str(), buffer.data(), buffer.size());
+        }
+    }
 }
 
 void StatsLogProcessor::SaveActiveConfigsToDisk(int64_t currentTimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     const int64_t timeNs = getElapsedRealtimeNs();
     // Do not write to disk if we already have in the last few seconds.
     if (static_cast<unsigned long long> (timeNs) <
@@ -1187,23 +2188,27 @@ void StatsLogProcessor::SaveActiveConfigsToDisk(int64_t currentTimeNs) {
     }
     mLastActiveMetricsWriteNs = timeNs;
 
-    ProtoOutputStream proto;
-    WriteActiveConfigsToProtoOutputStreamLocked(currentTimeNs, DEVICE_SHUTDOWN, &proto);
-
+    std::unordered_map<ConfigKey, vector<uint8_t>> entries;
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        ProtoOutputStream proto;
+        metricsManager->writeActiveConfigToProtoOutputStream(currentTimeNs, DEVICE_SHUTDOWN,
+                                                             &proto);
+        proto.serializeToVector(&entries[key]);
+    }
     string file_name = StringPrintf("%s/active_metrics", STATS_ACTIVE_METRIC_DIR);
-    StorageManager::deleteFile(file_name.c_str());
-    android::base::unique_fd fd(
-            open(file_name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR));
-    if (fd == -1) {
-        ALOGE("Attempt to write %s but failed", file_name.c_str());
-        return;
+    persistEntriesLocked(file_name, FIELD_ID_ACTIVE_CONFIG_LIST_CONFIG, std::move(entries),
+                         &mPersistedActiveConfigs);
+
+    lock.unlock();
+    // Callers, e.g. on shutdown, expect the file to be on disk once this returns.
+    if (mAsyncDiskWriter != nullptr) {
+        mAsyncDiskWriter->waitForPendingWrites();
     }
-    proto.flush(fd.get());
 }
 
 void StatsLogProcessor::SaveMetadataToDisk(int64_t currentWallClockTimeNs,
                                            int64_t systemElapsedTimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     // Do not write to disk if we already have in the last few seconds.
     if (static_cast<unsigned long long> (systemElapsedTimeNs) <
             mLastMetadataWriteNs + WRITE_DATA_COOL_DOWN_SEC * NS_PER_SEC) {
@@ -1213,27 +2218,99 @@ void StatsLogProcessor::SaveMetadataToDisk(int64_t currentWallClockTimeNs,
     }
     mLastMetadataWriteNs = systemElapsedTimeNs;
 
-    metadata::StatsMetadataList metadataList;
-    WriteMetadataToProtoLocked(
-            currentWallClockTimeNs, systemElapsedTimeNs, &metadataList);
-
+    // Configs without metadata have no entry.
+    std::unordered_map<ConfigKey, vector<uint8_t>> entries;
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        metadata::StatsMetadata statsMetadata;
+        if (metricsManager->writeMetadataToProto(currentWallClockTimeNs, systemElapsedTimeNs,
+                                                 &statsMetadata)) {
+            vector<uint8_t>& entry = entries[key];
+            entry.resize(statsMetadata.ByteSizeLong());
+            statsMetadata.SerializeToArray(entry.data(), entry.size());
+        }
+    }
     string file_name = StringPrintf("%s/metadata", STATS_METADATA_DIR);
-    StorageManager::deleteFile(file_name.c_str());
+    persistEntriesLocked(file_name, FIELD_ID_STATS_METADATA_LIST_STATS_METADATA,
+                         std::move(entries), &mPersistedMetadata);
 
-    if (metadataList.stats_metadata_size() == 0) {
-        // Skip the write if we have nothing to write.
+    lock.unlock();
+    // See SaveActiveConfigsToDisk.
+    if (mAsyncDiskWriter != nullptr) {
+        mAsyncDiskWriter->waitForPendingWrites();
+    }
+}
+
+void StatsLogProcessor::persistEntriesLocked(
+        const string& fileName, const int fieldId,
+        std::unordered_map<ConfigKey, vector<uint8_t>> entries, PersistedEntries* persisted) {
+    if (entries.empty() && persisted->entries.empty()) {
+        // Nothing to write, and nothing written that could be stale.
+        StorageManager::deleteFile(fileName.c_str());
+        persisted->appendedCount = 0;
         return;
     }
 
-    std::string data;
-    metadataList.SerializeToString(&data);
-    StorageManager::writeFile(file_name.c_str(), data.c_str(), data.size());
+    // Until something is written, the file may be left from an earlier process.
+    bool writeInFull = persisted->entries.empty();
+    for (const auto& [key, entry] : persisted->entries) {
+        if (entries.find(key) == entries.end()) {
+            writeInFull = true;
+            break;
+        }
+    }
+
+    vector<uint8_t> data;
+    auto appendEntry = [&data, fieldId](const vector<uint8_t>& entry) {
+        uint8_t header[kMaxReportHeaderBytes];
+        const uint8_t* headerEnd =
+                android::util::write_length_delimited_tag_header(header, fieldId, entry.size());
+        data.insert(data.end(), header, headerEnd);
+        data.insert(data.end(), entry.begin(), entry.end());
+    };
+    size_t changedCount = 0;
+    if (!writeInFull) {
+        for (const auto& [key, entry] : entries) {
+            const auto it = persisted->entries.find(key);
+            if (it == persisted->entries.end() || it->second != entry) {
+                appendEntry(entry);
+                changedCount++;
+            }
+        }
+        if (changedCount == 0) {
+            VLOG("Skipping the write of unchanged %s", fileName.c_str());
+            return;
+        }
+        writeInFull = persisted->appendedCount + changedCount > entries.size();
+    }
+
+    if (writeInFull) {
+        data.clear();
+        for (const auto& [key, entry] : entries) {
+            appendEntry(entry);
+        }
+        persisted->appendedCount = 0;
+    } else {
+        persisted->appendedCount += changedCount;
+    }
+    persisted->entries = std::move(entries);
+
+    if (mAsyncDiskWriter != nullptr) {
+        if (writeInFull) {
+            mAsyncDiskWriter->write(fileName, std::move(data));
+        } else {
+            mAsyncDiskWriter->append(fileName, std::move(data));
+        }
+    } else if (writeInFull) {
+        StorageManager::writeFileAtomically(fileName.c_str(), data.data(), data.size());
+    } else {
+        StorageManager::appendToFile(fileName.c_str(), data.data(), data.size());
+    }
 }
 
 void StatsLogProcessor::WriteMetadataToProto(int64_t currentWallClockTimeNs,
                                              int64_t systemElapsedTimeNs,
                                              metadata::StatsMetadataList* metadataList) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     WriteMetadataToProtoLocked(currentWallClockTimeNs, systemElapsedTimeNs, metadataList);
 }
 
@@ -1251,9 +2328,26 @@ void StatsLogProcessor::WriteMetadataToProtoLocked(int64_t currentWallClockTimeN
     }
 }
 
+// Keeps the last entry of each config, which is its current one in a file written by
+// StatsLogProcessor::persistEntriesLocked().
+template <typename Entry, typename GetKey>
+static void keepLastEntryOfEachConfig(google::protobuf::RepeatedPtrField<Entry>* entries,
+                                      GetKey getKey) {
+    std::set<ConfigKey> seen;
+    google::protobuf::RepeatedPtrField<Entry> lastEntries;
+    for (int i = entries->size() - 1; i >= 0; i--) {
+        if (seen.insert(getKey(entries->Get(i))).second) {
+            lastEntries.Add()->Swap(entries->Mutable(i));
+        }
+    }
+    entries->Swap(&lastEntries);
+}
+
 void StatsLogProcessor::LoadMetadataFromDisk(int64_t currentWallClockTimeNs,
                                              int64_t systemElapsedTimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
+    // The file is deleted once read.
+    mPersistedMetadata = PersistedEntries();
     string file_name = StringPrintf("%s/metadata", STATS_METADATA_DIR);
     int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
     if (-1 == fd) {
@@ -1277,14 +2371,102 @@ void StatsLogProcessor::LoadMetadataFromDisk(int64_t currentWallClockTimeNs,
         StorageManager::deleteFile(file_name.c_str());
         return;
     }
+    keepLastEntryOfEachConfig(statsMetadataList.mutable_stats_metadata(),
+                              [](const metadata::StatsMetadata& statsMetadata) {
+                                  return ConfigKey(statsMetadata.config_key().uid(),
+                                                   statsMetadata.config_key().config_id());
+                              });
     SetMetadataStateLocked(statsMetadataList, currentWallClockTimeNs, systemElapsedTimeNs);
     StorageManager::deleteFile(file_name.c_str());
 }
 
+void StatsLogProcessor::writeBucketCheckpointsIfNecessaryLocked(const int64_t elapsedRealtimeNs) {
+    if (mBucketCheckpointIntervalNs <= 0 ||
+        elapsedRealtimeNs - mLastBucketCheckpointNs < mBucketCheckpointIntervalNs) {
+        return;
+    }
+    writeBucketCheckpointsLocked(elapsedRealtimeNs, getWallClockNs());
+}
+
+void StatsLogProcessor::writeBucketCheckpointsLocked(const int64_t elapsedRealtimeNs,
+                                                     const int64_t wallClockNs) {
+    mLastBucketCheckpointNs = elapsedRealtimeNs;
+    mCheckpointedConfigs.clear();
+
+    metadata::BucketCheckpointList checkpointList;
+    checkpointList.set_checkpoint_elapsed_ns(elapsedRealtimeNs);
+    checkpointList.set_checkpoint_wall_clock_ns(wallClockNs);
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        metadata::ConfigBucketCheckpoints* checkpoints =
+                checkpointList.add_config_bucket_checkpoints();
+        if (!metricsManager->writeBucketCheckpoints(checkpoints)) {
+            checkpointList.mutable_config_bucket_checkpoints()->RemoveLast();
+            continue;
+        }
+        mCheckpointedConfigs.insert(key);
+    }
+
+    // An empty checkpoint is still written, as it replaces a checkpoint that may still be queued.
+    string file_name = StringPrintf("%s/bucket_checkpoints", STATS_METADATA_DIR);
+    vector<uint8_t> data(checkpointList.ByteSizeLong());
+    checkpointList.SerializeToArray(data.data(), data.size());
+    if (mAsyncDiskWriter != nullptr) {
+        mAsyncDiskWriter->write(std::move(file_name), std::move(data));
+    } else {
+        StorageManager::writeFileAtomically(file_name.c_str(), data.data(), data.size());
+    }
+}
+
+void StatsLogProcessor::LoadBucketCheckpointsFromDisk(int64_t currentWallClockTimeNs,
+                                                      int64_t systemElapsedTimeNs) {
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
+    string file_name = StringPrintf("%s/bucket_checkpoints", STATS_METADATA_DIR);
+    android::base::unique_fd fd(open(file_name.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd == -1) {
+        VLOG("Attempt to read %s but failed", file_name.c_str());
+        return;
+    }
+    metadata::BucketCheckpointList checkpointList;
+    if (checkpointList.ParseFromFileDescriptor(fd.get())) {
+        restoreBucketCheckpointsLocked(checkpointList, currentWallClockTimeNs,
+                                       systemElapsedTimeNs);
+    } else {
+        ALOGE("Attempt to read %s but failed; failed to parse bucket checkpoints",
+              file_name.c_str());
+    }
+    // The restored buckets are not in the next checkpoints, so a checkpoint is only restored once.
+    StorageManager::deleteFile(file_name.c_str());
+}
+
+void StatsLogProcessor::restoreBucketCheckpointsLocked(
+        const metadata::BucketCheckpointList& checkpointList, int64_t currentWallClockTimeNs,
+        int64_t systemElapsedTimeNs) {
+    const int64_t checkpointNs = checkpointList.checkpoint_elapsed_ns();
+    const int64_t elapsedSinceCheckpointNs = systemElapsedTimeNs - checkpointNs;
+    const int64_t wallClockSinceCheckpointNs =
+            currentWallClockTimeNs - checkpointList.checkpoint_wall_clock_ns();
+    if (elapsedSinceCheckpointNs < 0 ||
+        std::abs(elapsedSinceCheckpointNs - wallClockSinceCheckpointNs) >
+                kMaxBucketCheckpointClockDriftNs) {
+        VLOG("Dropping bucket checkpoints written before a reboot");
+        return;
+    }
+    for (const metadata::ConfigBucketCheckpoints& checkpoints :
+         checkpointList.config_bucket_checkpoints()) {
+        ConfigKey key(checkpoints.config_key().uid(), checkpoints.config_key().config_id());
+        auto it = mMetricsManagers.find(key);
+        if (it == mMetricsManagers.end()) {
+            VLOG("No config found for configKey %s", key.ToString().c_str());
+            continue;
+        }
+        it->second->restoreBucketCheckpoints(checkpoints, checkpointNs);
+    }
+}
+
 void StatsLogProcessor::SetMetadataState(const metadata::StatsMetadataList& statsMetadataList,
                                          int64_t currentWallClockTimeNs,
                                          int64_t systemElapsedTimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     SetMetadataStateLocked(statsMetadataList, currentWallClockTimeNs, systemElapsedTimeNs);
 }
 
@@ -1307,7 +2489,7 @@ void StatsLogProcessor::SetMetadataStateLocked(
 
 void StatsLogProcessor::WriteActiveConfigsToProtoOutputStream(
         int64_t currentTimeNs, const DumpReportReason reason, ProtoOutputStream* proto) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     WriteActiveConfigsToProtoOutputStreamLocked(currentTimeNs, reason, proto);
 }
 
@@ -1322,7 +2504,9 @@ void StatsLogProcessor::WriteActiveConfigsToProtoOutputStreamLocked(
     }
 }
 void StatsLogProcessor::LoadActiveConfigsFromDisk() {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
+    // See LoadMetadataFromDisk.
+    mPersistedActiveConfigs = PersistedEntries();
     string file_name = StringPrintf("%s/active_metrics", STATS_ACTIVE_METRIC_DIR);
     int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
     if (-1 == fd) {
@@ -1346,6 +2530,9 @@ void StatsLogProcessor::LoadActiveConfigsFromDisk() {
         StorageManager::deleteFile(file_name.c_str());
         return;
     }
+    keepLastEntryOfEachConfig(activeConfigList.mutable_config(), [](const ActiveConfig& config) {
+        return ConfigKey(config.uid(), config.id());
+    });
     // Passing in mTimeBaseNs only works as long as we only load from disk is when statsd starts.
     SetConfigsActiveStateLocked(activeConfigList, mTimeBaseNs);
     StorageManager::deleteFile(file_name.c_str());
@@ -1353,7 +2540,7 @@ void StatsLogProcessor::LoadActiveConfigsFromDisk() {
 
 void StatsLogProcessor::SetConfigsActiveState(const ActiveConfigList& activeConfigList,
                                                     int64_t currentTimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     SetConfigsActiveStateLocked(activeConfigList, currentTimeNs);
 }
 
@@ -1369,7 +2556,11 @@ void StatsLogProcessor::SetConfigsActiveStateLocked(const ActiveConfigList& acti
         }
         VLOG("Setting active config %s", key.ToString().c_str());
         it->second->loadActiveConfig(config, currentTimeNs);
+        if (ConfigSummary* summary = getConfigSummaryLocked(key)) {
+            summary->isActive.store(it->second->isActive(), std::memory_order_relaxed);
+        }
     }
+    mNextActivationExpiryNs = INT64_MIN;
     VLOG("Successfully loaded %d active configs.", activeConfigList.config_size());
 }
 
@@ -1387,65 +2578,152 @@ void StatsLogProcessor::WriteDataToDiskLocked(const DumpReportReason dumpReportR
         return;
     }
     mLastWriteTimeNs = elapsedRealtimeNs;
+    if (mEventWorkerPool != nullptr && mMetricsManagers.size() > 1) {
+        writeDataToDiskParallelLocked(elapsedRealtimeNs, wallClockNs, dumpReportReason,
+                                      dumpLatency);
+        return;
+    }
     for (auto& pair : mMetricsManagers) {
         WriteDataToDiskLocked(pair.first, elapsedRealtimeNs, wallClockNs, dumpReportReason,
                               dumpLatency);
     }
 }
 
+void StatsLogProcessor::writeDataToDiskParallelLocked(const int64_t elapsedRealtimeNs,
+                                                      const int64_t wallClockNs,
+                                                      const DumpReportReason dumpReportReason,
+                                                      const DumpLatency dumpLatency) {
+    // The metrics of a config share its dimension key interner and condition cache, so each
+    // config is dumped by a single thread: the one owning its shard for event processing.
+    const size_t numShards = mEventWorkerPool->getNumShards();
+    vector<vector<ConfigKey>> shards(numShards);
+    bool rewriteBucketCheckpoints = false;
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        if (!metricsManager->shouldWriteToDisk()) {
+            continue;
+        }
+        if (metricsManager->hasRestrictedMetricsDelegate()) {
+            metricsManager->flushRestrictedData(mAsyncRestrictedInserts);
+            continue;
+        }
+        // The checkpoints are rewritten once all the configs are dumped, instead of by each
+        // dump of a checkpointed config.
+        rewriteBucketCheckpoints |= mCheckpointedConfigs.erase(key) > 0;
+        shards[std::hash<ConfigKey>()(key) % numShards].push_back(key);
+    }
+
+    mEventWorkerPool->runOnAllShards([&](size_t shard) {
+        for (const ConfigKey& key : shards[shard]) {
+            writeReportToDiskLocked(key, elapsedRealtimeNs, wallClockNs, dumpReportReason,
+                                    dumpLatency);
+        }
+    });
+
+    for (const auto& keys : shards) {
+        mOnDiskDataConfigs.insert(keys.begin(), keys.end());
+    }
+    if (rewriteBucketCheckpoints) {
+        writeBucketCheckpointsLocked(elapsedRealtimeNs, wallClockNs);
+    }
+}
+
+void StatsLogProcessor::onMemoryPressure(const int64_t elapsedRealtimeNs,
+                                         const int64_t wallClockNs) {
+    ALOGI("Shedding memory under memory pressure");
+    mPullerManager->ForceClearPullerCache();
+    ProtoOutputStreamPool::getInstance().trim();
+    // Gauge metrics do not pull again for the dump.
+    WriteDataToDisk(MEMORY_PRESSURE, FAST, elapsedRealtimeNs, wallClockNs);
+}
+
+void StatsLogProcessor::setLoadShedding(const bool loadShedding) {
+    if (mLoadShedding.exchange(loadShedding, std::memory_order_relaxed) != loadShedding) {
+        ALOGI("%s shedding load of the best effort configs", loadShedding ? "Start" : "Stop");
+    }
+}
+
 void StatsLogProcessor::WriteDataToDisk(const DumpReportReason dumpReportReason,
                                         const DumpLatency dumpLatency,
                                         const int64_t elapsedRealtimeNs,
                                         const int64_t wallClockNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
-    WriteDataToDiskLocked(dumpReportReason, dumpLatency, elapsedRealtimeNs, wallClockNs);
+    {
+        std::unique_lock<std::mutex> lock = lockAllConfigs();
+        WriteDataToDiskLocked(dumpReportReason, dumpLatency, elapsedRealtimeNs, wallClockNs);
+    }
+    // Callers, e.g. on shutdown, expect the data to be on disk once this returns. Events keep
+    // being processed while the files are written.
+    if (mAsyncDiskWriter != nullptr) {
+        mAsyncDiskWriter->waitForPendingWrites();
+    }
+    if (mAsyncRestrictedInserts) {
+        dbutils::flushPendingInserts();
+    }
 }
 
 void StatsLogProcessor::informPullAlarmFired(const int64_t timestampNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     mPullerManager->OnAlarmFired(timestampNs);
 }
 
-int64_t StatsLogProcessor::getLastReportTimeNs(const ConfigKey& key) {
-    auto it = mMetricsManagers.find(key);
-    if (it == mMetricsManagers.end()) {
+int64_t StatsLogProcessor::getLastReportTimeNs(const ConfigKey& key) const {
+    const std::shared_ptr<const ConfigSummaries> summaries = std::atomic_load(&mConfigSummaries);
+    if (summaries == nullptr) {
+        return 0;
+    }
+    const auto it = summaries->find(key);
+    if (it == summaries->end()) {
         return 0;
-    } else {
-        return it->second->getLastReportTimeNs();
     }
+    return it->second->lastReportTimeNs.load(std::memory_order_relaxed);
 }
 
 void StatsLogProcessor::notifyAppUpgrade(const int64_t& eventTimeNs, const string& apk,
                                          const int uid, const int64_t version) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     VLOG("Received app upgrade");
     StateManager::getInstance().notifyAppChanged(apk, mUidMap);
+    const bool splitBuckets = shouldSplitForAppChangeLocked(eventTimeNs);
     for (const auto& it : mMetricsManagers) {
-        it.second->notifyAppUpgrade(eventTimeNs, apk, uid, version);
+        it.second->notifyAppUpgrade(eventTimeNs, apk, uid, version, splitBuckets);
     }
+    refreshLogSourceConfigMasksLocked();
 }
 
 void StatsLogProcessor::notifyAppRemoved(const int64_t& eventTimeNs, const string& apk,
                                          const int uid) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     VLOG("Received app removed");
     StateManager::getInstance().notifyAppChanged(apk, mUidMap);
+    const bool splitBuckets = shouldSplitForAppChangeLocked(eventTimeNs);
     for (const auto& it : mMetricsManagers) {
-        it.second->notifyAppRemoved(eventTimeNs, apk, uid);
+        it.second->notifyAppRemoved(eventTimeNs, apk, uid, splitBuckets);
+    }
+    refreshLogSourceConfigMasksLocked();
+}
+
+bool StatsLogProcessor::shouldSplitForAppChangeLocked(const int64_t eventTimeNs) {
+    if (mAppUpgradeCoalescingWindowNs > 0 && mLastAppUpgradeSplitNs.has_value() &&
+        eventTimeNs >= *mLastAppUpgradeSplitNs &&
+        eventTimeNs - *mLastAppUpgradeSplitNs < mAppUpgradeCoalescingWindowNs) {
+        VLOG("App change coalesced with the split at %lld", (long long)*mLastAppUpgradeSplitNs);
+        return false;
     }
+    mLastAppUpgradeSplitNs = eventTimeNs;
+    return true;
 }
 
 void StatsLogProcessor::onUidMapReceived(const int64_t& eventTimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     VLOG("Received uid map");
     StateManager::getInstance().updateLogSources(mUidMap);
     for (const auto& it : mMetricsManagers) {
         it.second->onUidMapReceived(eventTimeNs);
     }
+    refreshLogSourceConfigMasksLocked();
 }
 
 void StatsLogProcessor::onStatsdInitCompleted(const int64_t& elapsedTimeNs) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     VLOG("Received boot completed signal");
     for (const auto& it : mMetricsManagers) {
         it.second->onStatsdInitCompleted(elapsedTimeNs);
@@ -1453,13 +2731,16 @@ void StatsLogProcessor::onStatsdInitCompleted(const int64_t& elapsedTimeNs) {
 }
 
 void StatsLogProcessor::noteOnDiskData(const ConfigKey& key) {
-    std::lock_guard<std::mutex> lock(mMetricsMutex);
+    std::unique_lock<std::mutex> lock = lockAllConfigs();
     mOnDiskDataConfigs.insert(key);
 }
 
 void StatsLogProcessor::setAnomalyAlarm(const int64_t elapsedTimeMillis) {
     std::lock_guard<std::mutex> lock(mAnomalyAlarmMutex);
     mNextAnomalyAlarmTime = elapsedTimeMillis;
+    if (MillisToNano(elapsedTimeMillis) < mNextHousekeepingNs.load(std::memory_order_relaxed)) {
+        mNextHousekeepingNs.store(MillisToNano(elapsedTimeMillis), std::memory_order_relaxed);
+    }
 }
 
 void StatsLogProcessor::cancelAnomalyAlarm() {
@@ -1490,14 +2771,42 @@ LogEventFilter::AtomIdSet StatsLogProcessor::getDefaultAtomIdSet() {
     return allAtomIds;
 }
 
-void StatsLogProcessor::updateLogEventFilterLocked() const {
+void StatsLogProcessor::updateLogEventFilterLocked() {
     VLOG("StatsLogProcessor: Updating allAtomIds");
     LogEventFilter::AtomIdSet allAtomIds = getDefaultAtomIdSet();
-    for (const auto& metricsManager : mMetricsManagers) {
-        metricsManager.second->addAllAtomIds(allAtomIds);
-    }
     StateManager::getInstance().addAllAtomIds(allAtomIds);
+    // The hard-coded atoms and the state atoms are read as a whole.
+    AtomFieldMasks fieldMasks;
+    for (const int atomId : allAtomIds) {
+        fieldMasks[atomId].set();
+    }
+    mAtomConfigRoutes.clear();
+    mSharedMatcherCaches.clear();
+    const size_t numShards = mEventWorkerPool != nullptr ? mEventWorkerPool->getNumShards() : 1;
+    for (size_t shard = 0; shard < numShards; shard++) {
+        mSharedMatcherCaches.push_back(std::make_shared<SharedMatcherCache>());
+    }
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        const size_t shard = std::hash<ConfigKey>()(key) % numShards;
+        LogEventFilter::AtomIdSet atomIds;
+        metricsManager->addAllAtomIds(atomIds);
+        for (const int atomId : atomIds) {
+            mAtomConfigRoutes[atomId].push_back({key, metricsManager, shard});
+        }
+        allAtomIds.insert(atomIds.begin(), atomIds.end());
+        metricsManager->addAllAtomFieldMasks(fieldMasks);
+        metricsManager->addSharedMatchers(*mSharedMatcherCaches[shard]);
+    }
+    for (const auto& [key, metricsManager] : mMetricsManagers) {
+        metricsManager->shareMatcherResults(
+                mSharedMatcherCaches[std::hash<ConfigKey>()(key) % numShards]);
+    }
+    // New configs may have loaded activations.
+    mNextActivationExpiryNs = INT64_MIN;
     VLOG("StatsLogProcessor: Updating allAtomIds done. Total atoms %d", (int)allAtomIds.size());
+    mPullerManager->SetPullAtomFieldMasks(fieldMasks);
+    // The masks are set first so that the new atom ids are never parsed with stale masks.
+    mLogEventFilter->setAtomFieldMasks(std::move(fieldMasks), this);
     mLogEventFilter->setAtomIds(std::move(allAtomIds), this);
 }
 
@@ -20,14 +20,23 @@
 #include <gtest/gtest_prod.h>
 #include <stdio.h>
 
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <span>
 #include <unordered_map>
 
 #include "config/ConfigListener.h"
 #include "external/StatsPullerManager.h"
 #include "logd/LogEvent.h"
 #include "metrics/MetricsManager.h"
+#include "metrics/MetricsManagerReaper.h"
 #include "packages/UidMap.h"
 #include "socket/LogEventFilter.h"
+#include "storage/AsyncFileWriter.h"
+#include "storage/ReportCompression.h"
+#include "storage/StorageManager.h"
+#include "utils/ShardedWorkerPool.h"
 #include "src/statsd_config.pb.h"
 #include "src/statsd_metadata.pb.h"
 
@@ -35,6 +44,72 @@ namespace android {
 namespace os {
 namespace statsd {
 
+/**
+ * A ConfigMetricsReportList kept in pieces, so it can be written out without first being copied
+ * into one buffer: the reports on disk stay mapped, and the report from memory is not copied
+ * again after it is serialized.
+ */
+struct ConfigMetricsReportListParts {
+    // The fields before the reports.
+    vector<uint8_t> mHeader;
+
+    MappedReports mDiskReports;
+
+    bool mHasMemoryReport = false;
+    vector<uint8_t> mMemoryReport;
+
+    // The fields after the reports.
+    vector<uint8_t> mTrailer;
+
+    // Size of the serialized ConfigMetricsReportList.
+    size_t size() const;
+
+    // Writes the serialized ConfigMetricsReportList. Returns false if a write fails.
+    bool writeToFd(int fd) const;
+};
+
+/**
+ * How a StatsLogProcessor processes events, configs and reports. Filled once from the boot flags,
+ * the defaults are the behavior without them.
+ */
+struct StatsLogProcessorOptions {
+    // Batches of events are processed by this many threads when more than 1.
+    size_t numEventProcessingThreads = 1;
+
+    // Reports and metadata are written to disk by a background thread.
+    bool asyncDiskWrites = false;
+
+    // Reports are returned in pieces rather than copied into one buffer.
+    bool reportSegments = false;
+
+    // Codec of the reports written to disk.
+    ReportCodec reportCodec = REPORT_CODEC_NONE;
+
+    // Restricted metrics are inserted into their databases by a background thread.
+    bool asyncRestrictedInserts = false;
+
+    // Configs are built without mMetricsMutex held.
+    bool offLockConfigBuilds = false;
+
+    // Buckets are checkpointed to disk at this interval when not 0.
+    int64_t bucketCheckpointIntervalNs = 0;
+
+    // App upgrades closer than this split only one partial bucket when not 0.
+    int64_t appUpgradeCoalescingWindowNs = 0;
+
+    // A report dump only blocks the events of the config being dumped.
+    bool perConfigDumps = false;
+
+    // MetricsManagers of removed configs are destroyed by a background thread.
+    bool asyncConfigTeardown = false;
+
+    // The metrics of a config are allocated in one arena.
+    bool configArenas = false;
+
+    // Batches of events are processed one config after the other.
+    bool configMajorBatches = false;
+};
+
 class StatsLogProcessor : public ConfigListener, public virtual PackageInfoListener {
 public:
     StatsLogProcessor(
@@ -45,22 +120,61 @@ public:
             const std::function<bool(const int&, const vector<int64_t>&)>& sendActivationBroadcast,
             const std::function<void(const ConfigKey&, const string&, const vector<int64_t>&)>&
                     sendRestrictedMetricsBroadcast,
-            const std::shared_ptr<LogEventFilter>& logEventFilter);
+            const std::shared_ptr<LogEventFilter>& logEventFilter,
+            const StatsLogProcessorOptions& options = StatsLogProcessorOptions());
 
     virtual ~StatsLogProcessor();
 
+    // Number of threads processing batches of events when parallel processing is enabled.
+    static constexpr size_t kParallelEventProcessingThreads = 4;
+
+    // Maximum number of events kept to be replayed to configs built without mMetricsMutex held.
+    static constexpr size_t kMaxConfigBuildEvents = 10000;
+
+    // Number of threads building the MetricsManagers of a batch of configs, see
+    // OnConfigsUpdated().
+    static constexpr size_t kConfigBatchBuildThreads = 4;
+
+    // Maximum number of events kept for a config dumped without mMetricsMutex held. Once
+    // reached, event processing waits for the dump.
+    static constexpr size_t kMaxConfigDumpEvents = 10000;
+
+    // Period of the checkpoints of in progress buckets, when enabled.
+    static constexpr int64_t kBucketCheckpointIntervalNs = 10 * 60 * NS_PER_SEC;
+
+    // App upgrades and removals within this time of the last one that split the buckets, as
+    // during batch updates, share its partial buckets when coalescing is enabled.
+    static constexpr int64_t kAppUpgradeCoalescingWindowNs = 10 * NS_PER_SEC;
+
+    // Checkpoints are only restored if the elapsed and wall clocks moved by the same time since
+    // they were written, give or take this drift. Otherwise the device rebooted in between.
+    static constexpr int64_t kMaxBucketCheckpointClockDriftNs = 60 * NS_PER_SEC;
+
     void OnLogEvent(LogEvent* event);
 
+    /* Processes a batch of events taking mMetricsMutex once. Time driven checks (config ttl,
+     * anomaly alarms, guardrails) are done once per batch instead of once per event. */
+    void OnLogEvents(std::span<const std::unique_ptr<LogEvent>> events);
+
     void OnConfigUpdated(const int64_t timestampNs, const int64_t wallClockNs, const ConfigKey& key,
                          const StatsdConfig& config, bool modularUpdate = true);
     // For testing only.
     void OnConfigUpdated(const int64_t timestampNs, const ConfigKey& key,
                          const StatsdConfig& config, bool modularUpdate = true);
+
+    // Applies the configs in one pass: what is derived from all the configs, such as the atoms
+    // of the LogEventFilter, is computed once. With off lock config builds, the MetricsManagers
+    // of the new configs are built in parallel without mMetricsMutex held.
+    void OnConfigsUpdated(const int64_t timestampNs,
+                          const std::vector<std::pair<ConfigKey, StatsdConfig>>& configs) override;
+
     void OnConfigRemoved(const ConfigKey& key);
 
+    // As of the last byte size check of the config. Does not take mMetricsMutex.
     size_t GetMetricsSize(const ConfigKey& key) const;
 
-    void GetActiveConfigs(const int uid, vector<int64_t>& outActiveConfigs);
+    // Does not take mMetricsMutex.
+    void GetActiveConfigs(const int uid, vector<int64_t>& outActiveConfigs) const;
 
     void onDumpReport(const ConfigKey& key, const int64_t dumpTimeNs, const int64_t wallClockNs,
                       const bool include_current_partial_bucket, const bool erase_data,
@@ -70,6 +184,11 @@ public:
                       const bool include_current_partial_bucket, const bool erase_data,
                       const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
                       ProtoOutputStream* proto);
+    // Used by getDataFd, where peak memory during the dump should not scale with report size.
+    void onDumpReport(const ConfigKey& key, const int64_t dumpTimeNs, const int64_t wallClockNs,
+                      const bool include_current_partial_bucket, const bool erase_data,
+                      const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
+                      ConfigMetricsReportListParts* parts);
     // For testing only.
     void onDumpReport(const ConfigKey& key, const int64_t dumpTimeNs,
                       const bool include_current_partial_bucket, const bool erase_data,
@@ -85,6 +204,14 @@ public:
     void WriteDataToDisk(const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
                          const int64_t elapsedRealtimeNs, const int64_t wallClockNs);
 
+    // Frees the pull caches and the idle proto streams, and moves the metric data to disk,
+    // from where it is still reported.
+    void onMemoryPressure(const int64_t elapsedRealtimeNs, const int64_t wallClockNs);
+
+    // Sets whether event processing falls behind, in which case the best effort configs only
+    // process a sample of their events. Takes effect from the next event.
+    void setLoadShedding(bool loadShedding);
+
     /* Persist configs containing metrics with active activations to disk. */
     void SaveActiveConfigsToDisk(int64_t currentTimeNs);
 
@@ -107,6 +234,10 @@ public:
     void LoadMetadataFromDisk(int64_t currentWallClockTimeNs,
                               int64_t systemElapsedTimeNs);
 
+    /* Restores the in progress buckets checkpointed by the previous statsd process. */
+    void LoadBucketCheckpointsFromDisk(int64_t currentWallClockTimeNs,
+                                       int64_t systemElapsedTimeNs);
+
     /* Sets the metadata for all configs and metrics */
     void SetMetadataState(const metadata::StatsMetadataList& statsMetadataList,
                           int64_t currentWallClockTimeNs,
@@ -142,9 +273,13 @@ public:
 
     void dumpStates(int outFd, bool verbose);
 
+    // Writes the estimated heap bytes held by each config, and by the uid map they share.
+    void dumpMemory(int outFd);
+
     void informPullAlarmFired(const int64_t timestampNs);
 
-    int64_t getLastReportTimeNs(const ConfigKey& key);
+    // Does not take mMetricsMutex, so it can be called from the broadcast callbacks.
+    int64_t getLastReportTimeNs(const ConfigKey& key) const;
 
     inline void setPrintLogs(bool enabled) {
         std::lock_guard<std::mutex> lock(mMetricsMutex);
@@ -184,6 +319,103 @@ private:
 
     mutable mutex mMetricsMutex;
 
+    // Threads processing batches of events in parallel across configs. Null when events are
+    // processed on the calling thread only. Tasks only run while mMetricsMutex is held by the
+    // thread calling OnLogEvents, so other operations on the metrics managers still get a
+    // consistent view of them.
+    std::unique_ptr<ShardedWorkerPool> mEventWorkerPool;
+
+    // Whether each metrics manager processes the events of a batch before the next one starts,
+    // instead of each event going through every manager before the next event. The working set
+    // of a manager then stays in the caches for the whole batch.
+    const bool mConfigMajorBatches;
+
+    // Writes reports to disk in the background, so that mMetricsMutex is only held while they
+    // are serialized. Null when reports are written before WriteDataToDiskLocked returns.
+    // Reports on disk are only read with mMetricsMutex held, after waiting for pending writes.
+    std::unique_ptr<AsyncFileWriter> mAsyncDiskWriter;
+
+    // Destroys the MetricsManagers of removed and replaced configs in the background. Null when
+    // they are destroyed with mMetricsMutex held.
+    std::unique_ptr<MetricsManagerReaper> mMetricsManagerReaper;
+
+    // Whether reports are appended to per config segments instead of written to files of their
+    // own. Reports are read back from both, so this can change across reboots.
+    const bool mReportSegments;
+
+    // Codec the reports saved to disk are compressed with. Compressed and raw reports are both
+    // read back, so this can change across reboots.
+    const ReportCodec mReportCodec;
+
+    // Whether flushing restricted metrics only hands their events over to the db writer thread
+    // instead of inserting them with mMetricsMutex held. Reading the db waits for the queued
+    // inserts first.
+    const bool mAsyncRestrictedInserts;
+
+    // Whether the metrics of each new or replaced config allocate their long lived state from an
+    // arena of the config.
+    const bool mConfigArenas;
+
+    // Whether new and replaced configs are built without mMetricsMutex held, so that large
+    // configs do not block event processing. The events processed while a config is built are
+    // kept in mConfigBuildEvents and replayed to it once it is swapped in.
+    const bool mOffLockConfigBuilds;
+
+    // Changed at every update and removal of a config, so that a config built without the lock
+    // is dropped if the config changed again before it is swapped in.
+    std::unordered_map<ConfigKey, int64_t> mConfigGenerations;
+
+    int mPendingConfigBuilds;
+
+    // Period of the checkpoints of in progress buckets. 0 if checkpoints are disabled.
+    const int64_t mBucketCheckpointIntervalNs;
+
+    // Starts at the time base, so that the checkpoint of the previous process is not replaced
+    // before it is restored.
+    int64_t mLastBucketCheckpointNs;
+
+    // 0 if each app upgrade and removal splits the buckets.
+    const int64_t mAppUpgradeCoalescingWindowNs;
+
+    // Whether a dump requested for one config only holds mMetricsMutex to start and to finish,
+    // so that it only blocks the processing of that config. While the config is dumped, the
+    // events it would have processed are kept in mConfigDumpEvents and replayed to it after.
+    // Everything else that touches the MetricsManagers waits for the dump, see lockAllConfigs().
+    const bool mPerConfigDumps;
+
+    // Held by a dump for as long as it uses mConfigBeingDumped without mMetricsMutex. Taken
+    // before mMetricsMutex; mMetricsMutex holders may wait for it, as the dump does not need
+    // mMetricsMutex meanwhile.
+    mutable std::mutex mConfigDumpMutex;
+
+    // The config dumped without mMetricsMutex, null if none. Set and cleared with mMetricsMutex
+    // held. When set, onConfigMetricsReportLocked() runs for it without mMetricsMutex, and the
+    // event processing skips the checks that touch every config.
+    sp<MetricsManager> mConfigBeingDumped;
+    ConfigKey mConfigKeyBeingDumped;
+
+    std::vector<std::unique_ptr<LogEvent>> mConfigDumpEvents;
+
+    // Set when the dump off lock reported checkpointed buckets, so the checkpoint is written
+    // again once the lock is taken back.
+    bool mConfigDumpCheckpointPending = false;
+
+    // Time of the last app upgrade or removal that split the buckets.
+    std::optional<int64_t> mLastAppUpgradeSplitNs;
+
+    // Returns whether the app upgrade or removal at eventTimeNs splits the buckets, and records
+    // it if so.
+    bool shouldSplitForAppChangeLocked(const int64_t eventTimeNs);
+
+    // Configs that had buckets in the last checkpoint. The checkpoint is written again when they
+    // report their current buckets, so that reported data is not restored after a crash.
+    std::set<ConfigKey> mCheckpointedConfigs;
+
+    std::vector<std::unique_ptr<LogEvent>> mConfigBuildEvents;
+
+    // Set when an event could not be kept. The pending builds are then redone with the lock held.
+    bool mConfigBuildEventsOverflowed;
+
     // Guards mNextAnomalyAlarmTime. A separate mutex is needed because alarms are set/cancelled
     // in the onLogEvent code path, which is locked by mMetricsMutex.
     // DO NOT acquire mMetricsMutex while holding mAnomalyAlarmMutex. This can lead to a deadlock.
@@ -191,6 +423,80 @@ private:
 
     std::unordered_map<ConfigKey, sp<MetricsManager>> mMetricsManagers;
 
+    // The state of a config read by the binder threads. Written with mMetricsMutex held.
+    struct ConfigSummary {
+        std::atomic<bool> isActive = false;
+        std::atomic<size_t> byteSize = 0;
+        std::atomic<int64_t> lastReportTimeNs = 0;
+    };
+
+    using ConfigSummaries = std::unordered_map<ConfigKey, std::shared_ptr<ConfigSummary>>;
+
+    // A ConfigSummary per config of mMetricsManagers, so the read-only binder calls do not
+    // contend with event processing on mMetricsMutex. Replaced when the configs change, the
+    // summaries themselves are updated in place. Only accessed through std::atomic_load and
+    // std::atomic_store.
+    std::shared_ptr<const ConfigSummaries> mConfigSummaries;
+
+    // Replaces mConfigSummaries after mMetricsManagers changed.
+    void publishConfigSummariesLocked();
+
+    // Returns null if the config has no summary.
+    ConfigSummary* getConfigSummaryLocked(const ConfigKey& key) const;
+
+    // Takes mMetricsMutex once no config is dumped without it. For everything but the event
+    // processing and the dumps, which may touch any of the MetricsManagers.
+    std::unique_lock<std::mutex> lockAllConfigs();
+
+    // Called with mConfigDumpMutex and mMetricsMutex held. Returns whether the config may be
+    // dumped with only mConfigDumpMutex held, until endConfigDumpLocked().
+    bool beginConfigDumpLocked(const ConfigKey& key);
+
+    // Called with mMetricsMutex held again, once mConfigDumpMutex is released.
+    void endConfigDumpLocked(const int64_t dumpTimeNs, const int64_t wallClockNs);
+
+    // Waits until the config dumped off lock is no longer used by the dump, then replays its
+    // events.
+    void waitForConfigDumpLocked();
+
+    // Replays the events of the config dumped off lock. Requires its dump to be done with it.
+    void finishConfigDumpLocked();
+
+    // Maps a log source uid to the configs that allow it, as a bitmap indexed by
+    // MetricsManager::getLogSourceSlot(). Refreshed whenever the configs or the uid map change, so
+    // the allowed log sources are looked up once per event instead of once per config.
+    std::unordered_map<int32_t, std::vector<bool>> mLogSourceConfigMasks;
+
+    // Number of slots assigned by the last refresh of mLogSourceConfigMasks.
+    size_t mLogSourceSlotCount = 0;
+
+    // Passed to each MetricsManager along with its events, so that the new ones pick it up.
+    std::atomic<bool> mLoadShedding = false;
+
+    // A metrics manager using an atom, with the shard of mEventWorkerPool it belongs to.
+    struct ConfigRoute {
+        ConfigKey key;
+        sp<MetricsManager> metricsManager;
+        size_t shard;
+    };
+
+    // The metrics managers using each atom id. Rebuilt with the atom ids of the LogEventFilter,
+    // events are only passed to the managers using their atom.
+    std::unordered_map<int, std::vector<ConfigRoute>> mAtomConfigRoutes;
+
+    // Shared by the metrics managers, so that equal metrics of different configs store one copy
+    // of each dimension key.
+    const sp<DimensionKeyInterner> mDimensionKeyInterner = new DimensionKeyInterner();
+
+    // The results of the matchers defined by several configs of a shard, computed once per
+    // event. Indexed by shard, as the configs of a shard are processed by the same thread.
+    std::vector<std::shared_ptr<SharedMatcherCache>> mSharedMatcherCaches;
+
+    // Lower bound of the activation expiries of the metrics managers. The managers an event is
+    // not routed to flush their expired activations once an event is past it. INT64_MIN when
+    // unknown, e.g. after activations were loaded.
+    int64_t mNextActivationExpiryNs = INT64_MIN;
+
     std::unordered_map<ConfigKey, int64_t> mLastBroadcastTimes;
 
     // Last time we sent a broadcast to this uid that the active configs had changed.
@@ -211,6 +517,24 @@ private:
     // Tracks when we last checked db guardrails.
     int64_t mLastDbGuardrailEnforcementTime;
 
+    // Elapsed realtime of the next periodic check or anomaly alarm due in
+    // runBatchHousekeepingLocked(). Read without a lock by the batches, written under
+    // mAnomalyAlarmMutex so that a new anomaly alarm is never pushed back.
+    std::atomic<int64_t> mNextHousekeepingNs = 0;
+
+    // Earliest ttl expiry of the configs, in event time. 0 once the configs changed.
+    int64_t mNextConfigTtlExpiryNs = 0;
+
+    // The checks of the batch being processed that its first valid event has yet to do, see
+    // onLogEventBatchStartLocked().
+    bool mBatchConfigTtlCheckDue = false;
+    bool mBatchHousekeepingDue = false;
+    int64_t mBatchElapsedRealtimeNs = 0;
+
+    // Elapsed realtime of the next byte size check of a config in onLogEventBatchEndLocked().
+    // 0 once the configs changed.
+    int64_t mNextByteSizeCheckNs = 0;
+
     // Tracks which config keys has metric reports on disk
     std::set<ConfigKey> mOnDiskDataConfigs;
 
@@ -226,12 +550,160 @@ private:
 
     void OnLogEvent(LogEvent* event, int64_t elapsedRealtimeNs);
 
+    void OnLogEvents(std::span<const std::unique_ptr<LogEvent>> events,
+                     int64_t elapsedRealtimeNs);
+
+    // Makes the time driven checks of a batch of events due. They are done at the first valid
+    // event of the batch, where the per event path has always done them: the config ttls before
+    // the isolated uids are mapped, and the periodic checks once the states are updated. Until
+    // the deadlines below, a batch only compares its times against them.
+    void onLogEventBatchStartLocked(const int64_t elapsedRealtimeNs);
+
+    void checkBatchConfigTtlsLocked(const int64_t eventElapsedTimeNs);
+
+    void runBatchHousekeepingLocked();
+
+    // Runs the periodic checks of runBatchHousekeepingLocked() that are due, and moves
+    // mNextHousekeepingNs to the next one.
+    void runHousekeepingLocked(const int64_t elapsedRealtimeNs);
+
+    // Passes a single event to the metrics managers. Fills the uids whose configs changed
+    // activation status.
+    void onLogEventLocked(LogEvent* event, std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Notes the event in StatsdStats and applies the hard-coded handling of special atoms
+    // (isolated uids, train info, ...). Returns false if the event is invalid and must be dropped.
+    bool preprocessLogEventLocked(LogEvent* event);
+
+    // Notes the socket to metrics latency of an event sampled for latency tracing.
+    void noteEventLatencyTotalLocked(const LogEvent& event) const;
+
+    // The configs that allow the log source of an event, computed once per event.
+    struct LogSourceVerdict {
+        bool fromSystemLogSource = false;
+        // Entry of mLogSourceConfigMasks for the uid of the event, or nullptr if it has none.
+        const std::vector<bool>* configMask = nullptr;
+    };
+
+    LogSourceVerdict getLogSourceVerdictLocked(const LogEvent& event) const;
+
+    // Assigns the log source slots of the metrics managers and rebuilds mLogSourceConfigMasks.
+    void refreshLogSourceConfigMasksLocked();
+
+    // Passes an event to one metrics manager, noting if its activation status changed.
+    void onLogEventForConfigLocked(const ConfigKey& key, MetricsManager& metricsManager,
+                                   const LogEvent& event, const LogSourceVerdict& verdict,
+                                   std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Flushes the activations of the metrics managers that lapsed before eventTimeNs, if any
+    // may have since mNextActivationExpiryNs.
+    void flushExpiredActivationsLocked(const int64_t eventTimeNs,
+                                       std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Flushes the activations of one metrics manager that lapsed before eventTimeNs, noting if
+    // its activation status changed. Returns its next activation expiry.
+    int64_t flushExpiredActivationsForConfigLocked(
+            const ConfigKey& key, MetricsManager& metricsManager, const int64_t eventTimeNs,
+            std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Starts a new event for all the SharedMatcherCaches.
+    void beginSharedMatchingLocked();
+
+    void noteActiveStatusChangedLocked(const ConfigKey& key, const bool isActive,
+                                       std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Parallel version of calling onLogEventLocked for every event. The metrics managers are
+    // sharded across mEventWorkerPool, and each shard processes the events in order.
+    void onLogEventsParallelLocked(std::span<const std::unique_ptr<LogEvent>> events,
+                                   std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Version of calling onLogEventLocked for every event where each metrics manager processes
+    // the events in turn, see mConfigMajorBatches.
+    void onLogEventsConfigMajorLocked(std::span<const std::unique_ptr<LogEvent>> events,
+                                      std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Does the processing of the events shared by all configs, and passes the events to
+    // dispatch in runs that the configs may process independently of each other. The events
+    // changing the states or the isolated uids seen by every config start a new run, once the
+    // configs have processed the prior events.
+    void splitIntoConfigRunsLocked(
+            std::span<const std::unique_ptr<LogEvent>> events,
+            const std::function<void(const std::vector<const LogEvent*>&)>& dispatch);
+
+    // Passes a run of events to the given metrics managers of the shard, one manager after the
+    // other. Returns the lower bound of the activation expiries of the managers.
+    int64_t dispatchConfigMajorLocked(
+            const std::vector<const LogEvent*>& events,
+            const std::vector<LogSourceVerdict>& verdicts,
+            const std::vector<std::pair<ConfigKey, sp<MetricsManager>>>& metricsManagers,
+            const size_t shard, std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Passes the events to the metrics managers of every shard, in parallel across shards.
+    void dispatchToShardsLocked(
+            const std::vector<const LogEvent*>& events,
+            const std::vector<std::vector<std::pair<ConfigKey, sp<MetricsManager>>>>& shards,
+            std::unordered_set<int>* uidsWithActiveConfigsChanged);
+
+    // Guardrail checks and activation broadcasts done after processing a batch of events.
+    void onLogEventBatchEndLocked(const std::unordered_set<int>& uidsWithActiveConfigsChanged,
+                                  const int64_t elapsedRealtimeNs);
+
     void resetIfConfigTtlExpiredLocked(const int64_t eventTimeNs);
 
+    // [builtMetricsManager]: the new MetricsManager, if it was created before taking the lock and
+    //                        without registering its metrics to the StateManager.
     void OnConfigUpdatedLocked(const int64_t currentTimestampNs, const ConfigKey& key,
-                               const StatsdConfig& config, bool modularUpdate);
+                               const StatsdConfig& config, bool modularUpdate,
+                               const sp<MetricsManager>& builtMetricsManager = nullptr);
+
+    // OnConfigUpdatedLocked() without onConfigsChangedLocked(), for batches of configs.
+    void applyConfigUpdateLocked(const int64_t currentTimestampNs, const ConfigKey& key,
+                                 const StatsdConfig& config, bool modularUpdate,
+                                 const sp<MetricsManager>& builtMetricsManager = nullptr);
+
+    // Recomputes what is derived from all the configs once they changed.
+    void onConfigsChangedLocked();
+
+    // Creates the MetricsManager of a new or replaced config without mMetricsMutex held, then
+    // swaps it in and replays the events processed in the meantime.
+    void OnConfigUpdatedOffLock(const int64_t timestampNs, const int64_t wallClockNs,
+                                const ConfigKey& key, const StatsdConfig& config,
+                                bool modularUpdate);
+
+    // Returns whether updating the config creates a new MetricsManager instead of updating the
+    // existing one.
+    bool createsMetricsManagerLocked(const ConfigKey& key, const StatsdConfig& config,
+                                     bool modularUpdate) const;
+
+    void writeBucketCheckpointsIfNecessaryLocked(const int64_t elapsedRealtimeNs);
+
+    void writeBucketCheckpointsLocked(const int64_t elapsedRealtimeNs, const int64_t wallClockNs);
+
+    void restoreBucketCheckpointsLocked(const metadata::BucketCheckpointList& checkpointList,
+                                        int64_t currentWallClockTimeNs,
+                                        int64_t systemElapsedTimeNs);
+
+    // Serialized entries of the configs, as last written to a file by persistEntriesLocked().
+    struct PersistedEntries {
+        std::unordered_map<ConfigKey, std::vector<uint8_t>> entries;
+
+        // Entries appended since the file was last written in full.
+        size_t appendedCount = 0;
+    };
+
+    // Writes entries to fileName as the elements of the repeated message field fieldId. Only the
+    // entries that changed since the last write are appended, so the last entry of a config in
+    // the file is its current one. The file is written in full instead when a config has no
+    // entry anymore, or once it would hold more appended entries than current ones.
+    void persistEntriesLocked(const std::string& fileName, const int fieldId,
+                              std::unordered_map<ConfigKey, std::vector<uint8_t>> entries,
+                              PersistedEntries* persisted);
 
-    void GetActiveConfigsLocked(const int uid, vector<int64_t>& outActiveConfigs);
+    // Keeps a copy of the event for the configs being built.
+    void noteEventForConfigBuildsLocked(const LogEvent& event);
+
+    // Passes the events kept from firstEventIndex on to the MetricsManager of the config.
+    void replayConfigBuildEventsLocked(const ConfigKey& key, const size_t firstEventIndex);
 
     void WriteActiveConfigsToProtoOutputStreamLocked(
             int64_t currentTimeNs, const DumpReportReason reason, ProtoOutputStream* proto);
@@ -255,6 +727,19 @@ private:
                                const int64_t wallClockNs, const DumpReportReason dumpReportReason,
                                const DumpLatency dumpLatency);
 
+    // Writes the report of a non-restricted config to disk. Only reads the processor state, so
+    // it runs concurrently for configs of different shards of mEventWorkerPool.
+    void writeReportToDiskLocked(const ConfigKey& key, const int64_t timestampNs,
+                                 const int64_t wallClockNs,
+                                 const DumpReportReason dumpReportReason,
+                                 const DumpLatency dumpLatency);
+
+    // Writes the reports of all the configs to disk, the configs of each shard of
+    // mEventWorkerPool on its own thread.
+    void writeDataToDiskParallelLocked(const int64_t elapsedRealtimeNs, const int64_t wallClockNs,
+                                       const DumpReportReason dumpReportReason,
+                                       const DumpLatency dumpLatency);
+
     void onConfigMetricsReportLocked(
             const ConfigKey& key, const int64_t dumpTimeStampNs, const int64_t wallClockNs,
             const bool include_current_partial_bucket, const bool erase_data,
@@ -263,6 +748,16 @@ private:
              (e.g., before reboot). So no need to further persist local history.*/
             const bool dataSavedToDisk, vector<uint8_t>* proto);
 
+    // Writes the ConfigMetricsReport of key into proto, passing flushCompletedFields on to
+    // MetricsManager::onDumpReport. Returns false if nothing was written because the config
+    // does not exist or has restricted metrics.
+    bool writeConfigMetricsReportLocked(
+            const ConfigKey& key, const int64_t dumpTimeStampNs, const int64_t wallClockNs,
+            const bool include_current_partial_bucket, const bool erase_data,
+            const DumpReportReason dumpReportReason, const DumpLatency dumpLatency,
+            ProtoOutputStream* proto,
+            const std::function<void(ProtoOutputStream*)>& flushCompletedFields = nullptr);
+
     /* Check if it is time enforce data ttls for restricted metrics, and if it is, enforce ttls
      * on all restricted metrics. */
     void enforceDataTtlsIfNecessaryLocked(const int64_t wallClockNs,
@@ -285,12 +780,6 @@ private:
                                                         string& err,
                                                         InvalidQueryReason& invalidQueryReason);
 
-    // Maps the isolated uid in the log event to host uid if the log event contains uid fields.
-    void mapIsolatedUidToHostUidIfNecessaryLocked(LogEvent* event) const;
-
-    // Handler over the isolated uid change event.
-    void onIsolatedUidChangedEventLocked(const LogEvent& event);
-
     // Handler over the binary push state changed event.
     void onBinaryPushStateChangedEventLocked(LogEvent* event);
 
@@ -325,8 +814,12 @@ private:
 
     void flushRestrictedDataIfNecessaryLocked(const int64_t elapsedRealtimeNs);
 
-    /* Tells LogEventFilter about atom ids to parse */
-    void updateLogEventFilterLocked() const;
+    /* Tells LogEventFilter about atom ids to parse, and rebuilds mAtomConfigRoutes */
+    void updateLogEventFilterLocked();
+
+    // Drops a MetricsManager that was removed from mMetricsManagers, on the reaper thread if
+    // there is one.
+    void releaseMetricsManagerLocked(sp<MetricsManager> metricsManager);
 
     void writeDataCorruptedReasons(ProtoOutputStream& proto);
 
@@ -362,6 +855,10 @@ private:
     //Last time we wrote metadata to disk.
     int64_t mLastMetadataWriteNs = 0;
 
+    PersistedEntries mPersistedActiveConfigs;
+
+    PersistedEntries mPersistedMetadata;
+
     // The time for the next anomaly alarm for alerts.
     int64_t mNextAnomalyAlarmTime = 0;
 
@@ -370,6 +867,20 @@ private:
     friend class StatsLogProcessorTestRestricted;
     FRIEND_TEST(StatsLogProcessorTest, TestOutOfOrderLogs);
     FRIEND_TEST(StatsLogProcessorTest, TestRateLimitByteSize);
+    FRIEND_TEST(StatsLogProcessorTest, TestConfigSummariesReadWithoutLock);
+    FRIEND_TEST(StatsLogProcessorTest, TestHousekeepingDeadline);
+    FRIEND_TEST(StatsLogProcessorTest, TestOnLogEventsBatch);
+    FRIEND_TEST(StatsLogProcessorTest, TestOnLogEventsChecksAtFirstValidEvent);
+    FRIEND_TEST(StatsLogProcessorTest, TestOnLogEventsParallel);
+    FRIEND_TEST(StatsLogProcessorTest, TestOnLogEventsConfigMajor);
+    FRIEND_TEST(StatsLogProcessorTest, TestEventsRoutedToConfigsUsingAtom);
+    FRIEND_TEST(StatsLogProcessorTest, TestWriteDataToDiskParallel);
+    FRIEND_TEST(StatsLogProcessorTest, TestLogSourceVerdict);
+    FRIEND_TEST(StatsLogProcessorTest, TestOffLockConfigBuild);
+    FRIEND_TEST(StatsLogProcessorTest, TestConfigBatch);
+    FRIEND_TEST(StatsLogProcessorTest, TestConfigBuildEventsReplayed);
+    FRIEND_TEST(StatsLogProcessorTest, TestPerConfigDump);
+    FRIEND_TEST(StatsLogProcessorTest, TestAsyncConfigTeardown);
     FRIEND_TEST(StatsLogProcessorTest, TestRateLimitBroadcast);
     FRIEND_TEST(StatsLogProcessorTest, TestDropWhenByteSizeTooLarge);
     FRIEND_TEST(StatsLogProcessorTest, InvalidConfigRemoved);
@@ -434,6 +945,8 @@ private:
                 TestCountMetric_save_refractory_to_disk_no_data_written);
     FRIEND_TEST(AnomalyCountDetectionE2eTest, TestCountMetric_save_refractory_to_disk);
     FRIEND_TEST(AnomalyCountDetectionE2eTest, TestCountMetric_load_refractory_from_disk);
+    FRIEND_TEST(AnomalyCountDetectionE2eTest,
+                TestCountMetric_load_refractory_from_appended_metadata);
     FRIEND_TEST(AnomalyDurationDetectionE2eTest, TestDurationMetric_SUM_single_bucket);
     FRIEND_TEST(AnomalyDurationDetectionE2eTest, TestDurationMetric_SUM_partial_bucket);
     FRIEND_TEST(AnomalyDurationDetectionE2eTest, TestDurationMetric_SUM_multiple_buckets);
@@ -468,6 +981,7 @@ private:
     FRIEND_TEST(DurationMetricE2eTest, TestWithCondition);
     FRIEND_TEST(DurationMetricE2eTest, TestWithSlicedCondition);
     FRIEND_TEST(DurationMetricE2eTest, TestWithActivationAndSlicedCondition);
+    FRIEND_TEST(DurationMetricE2eTest, TestWithPartialLinkToCombinationCondition);
     FRIEND_TEST(DurationMetricE2eTest, TestWithSlicedState);
     FRIEND_TEST(DurationMetricE2eTest, TestWithConditionAndSlicedState);
     FRIEND_TEST(DurationMetricE2eTest, TestWithSlicedStateMapped);
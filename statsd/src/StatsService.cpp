@@ -23,6 +23,8 @@
 #include <android-base/strings.h>
 #include <android/binder_ibinder_platform.h>
 #include <cutils/multiuser.h>
+#include <fcntl.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <private/android_filesystem_config.h>
 #include <src/statsd_config.pb.h>
 #include <src/uid_data.pb.h>
@@ -43,6 +45,9 @@
 #include "storage/StorageManager.h"
 #include "subscriber/SubscriberReporter.h"
 #include "utils/DbUtils.h"
+#include "utils/MemoryPressure.h"
+#include "utils/ProtoOutputStreamPool.h"
+#include "utils/ThreadConfig.h"
 
 using namespace android;
 
@@ -125,7 +130,13 @@ Status checkSid(const char* expectedSid) {
 
 StatsService::StatsService(const sp<UidMap>& uidMap, shared_ptr<LogEventQueue> queue,
                            const std::shared_ptr<LogEventFilter>& logEventFilter,
-                           int initEventDelaySecs)
+                           int initEventDelaySecs,
+                           const std::shared_ptr<LogEventPool>& logEventPool,
+                           const StatsLogProcessorOptions& processorOptions,
+                           int64_t pullCoalescingWindowNs, AlarmMonitor::Type alarmMonitorType,
+                           bool subscriptionRings, bool memoryPressureShedding,
+                           bool debouncedAlarmRegistrations, bool incrementalUidMapUpdates,
+                           bool loadShedding)
     : mUidMap(uidMap),
       mAnomalyAlarmMonitor(new AlarmMonitor(
               MIN_DIFF_TO_UPDATE_REGISTERED_ALARM_SECS,
@@ -136,7 +147,9 @@ StatsService::StatsService(const sp<UidMap>& uidMap, shared_ptr<LogEventQueue> q
               [this](const shared_ptr<IStatsCompanionService>& /*sc*/) {
                   mProcessor->cancelAnomalyAlarm();
                   StatsdStats::getInstance().noteRegisteredAnomalyAlarmChanged();
-              })),
+              },
+              alarmMonitorType,
+              debouncedAlarmRegistrations ? MIN_ALARM_REGISTRATION_INTERVAL_SECS : 0)),
       mPeriodicAlarmMonitor(new AlarmMonitor(
               MIN_DIFF_TO_UPDATE_REGISTERED_ALARM_SECS,
               [](const shared_ptr<IStatsCompanionService>& sc, int64_t timeMillis) {
@@ -150,15 +163,25 @@ StatsService::StatsService(const sp<UidMap>& uidMap, shared_ptr<LogEventQueue> q
                       sc->cancelAlarmForSubscriberTriggering();
                       StatsdStats::getInstance().noteRegisteredPeriodicAlarmChanged();
                   }
-              })),
+              },
+              alarmMonitorType,
+              debouncedAlarmRegistrations ? MIN_ALARM_REGISTRATION_INTERVAL_SECS : 0)),
       mEventQueue(std::move(queue)),
       mLogEventFilter(logEventFilter),
+      mLogEventPool(logEventPool),
       mBootCompleteTrigger({kBootCompleteTag, kUidMapReceivedTag, kAllPullersRegisteredTag},
                            [this]() { onStatsdInitCompleted(); }),
       mStatsCompanionServiceDeathRecipient(
               AIBinder_DeathRecipient_new(StatsService::statsCompanionServiceDied)),
-      mInitEventDelaySecs(initEventDelaySecs) {
-    mPullerManager = new StatsPullerManager();
+      mInitEventDelaySecs(initEventDelaySecs),
+      mSubscriptionRings(subscriptionRings),
+      mMemoryPressureShedding(memoryPressureShedding),
+      mIncrementalUidMapUpdates(incrementalUidMapUpdates),
+      mLoadShedding(loadShedding) {
+    mPullerManager = new StatsPullerManager(processorOptions.numEventProcessingThreads > 1
+                                                    ? StatsPullerManager::kParallelPullThreads
+                                                    : 1,
+                                            pullCoalescingWindowNs);
     StatsPuller::SetUidMap(mUidMap);
     mConfigManager = new ConfigManager();
     mProcessor = new StatsLogProcessor(
@@ -221,7 +244,7 @@ StatsService::StatsService(const sp<UidMap>& uidMap, shared_ptr<LogEventQueue> q
                 mConfigManager->SendRestrictedMetricsBroadcast(configPackages, key.GetId(),
                                                                delegateUids, restrictedMetrics);
             },
-            logEventFilter);
+            logEventFilter, processorOptions);
 
     mUidMap->setListener(mProcessor);
     mConfigManager->AddListener(mProcessor);
@@ -243,28 +266,67 @@ StatsService::~StatsService() {
 
 /* Runs on a dedicated thread to process pushed events. */
 void StatsService::readLogs() {
+    configureStatsdThread("statsd.reader");
     // Read forever..... long live statsd
     while (1) {
-        // Block until an event is available.
-        auto event = mEventQueue->waitPop();
+        // Block until at least one event is available.
+        vector<unique_ptr<LogEvent>> events = mEventQueue->waitPopBatch(kMaxLogEventBatchSize);
 
         // Below flag will be set when statsd is exiting and log event will be pushed to break
-        // out of waitPop.
+        // out of waitPopBatch.
         if (mIsStopRequested) {
             break;
         }
 
-        // Pass it to StatsLogProcess to all configs/metrics
+        for (const auto& event : events) {
+            if (event->isLatencyTraced()) {
+                StatsdStats::getInstance().noteEventLatency(
+                        StatsdStats::EVENT_LATENCY_QUEUE,
+                        event->lapLatencyTrace(getElapsedRealtimeNs()));
+            }
+        }
+
+        if (mLoadShedding) {
+            mProcessor->setLoadShedding(mEventQueue->isCongested());
+        }
+        // Pass them to StatsLogProcess to all configs/metrics
         // At this point, the LogEventQueue is not blocked, so that the socketListener
         // can read events from the socket and write to buffer to avoid data drop.
-        mProcessor->OnLogEvent(event.get());
+        mProcessor->OnLogEvents(events);
         // The ShellSubscriber is only used by shell for local debugging.
         if (mShellSubscriber != nullptr) {
-            mShellSubscriber->onLogEvent(*event);
+            for (const auto& event : events) {
+                mShellSubscriber->onLogEvent(*event);
+            }
+        }
+
+        if (mLogEventPool != nullptr) {
+            mLogEventPool->recycle(events);
+        }
+        mEventQueue->maybeUpdateCapacity(getElapsedRealtimeNs());
+        if (mMemoryPressureShedding) {
+            maybeShedMemory(getElapsedRealtimeNs());
         }
     }
 }
 
+void StatsService::maybeShedMemory(const int64_t elapsedRealtimeNs) {
+    if (elapsedRealtimeNs - mLastMemoryPressureCheckNs < kMemoryPressureCheckPeriodNs) {
+        return;
+    }
+    mLastMemoryPressureCheckNs = elapsedRealtimeNs;
+    if ((mLastMemoryPressureSheddingNs &&
+         elapsedRealtimeNs - *mLastMemoryPressureSheddingNs < kMemoryPressureSheddingPeriodNs) ||
+        !isUnderMemoryPressure()) {
+        return;
+    }
+    mLastMemoryPressureSheddingNs = elapsedRealtimeNs;
+    if (mLogEventPool != nullptr) {
+        mLogEventPool->trim();
+    }
+    mProcessor->onMemoryPressure(elapsedRealtimeNs, getWallClockNs());
+}
+
 void StatsService::init_system_properties() {
     mEngBuild = false;
     const prop_info* buildType = __system_property_find("ro.build.type");
@@ -283,6 +345,7 @@ void StatsService::init_build_type_callback(void* cookie, const char* /*name*/,
 /**
  * Write data from statsd.
  * Format for statsdStats:  adb shell dumpsys stats --metadata [-v] [--proto]
+ * Format for memory usage: adb shell dumpsys stats --memory
  * Format for data report:  adb shell dumpsys stats [anything other than --metadata] [--proto]
  * Anything ending in --proto will be in proto format.
  * Anything without --metadata as the first argument will be report information.
@@ -308,6 +371,8 @@ status_t StatsService::dump(int fd, const char** args, uint32_t numArgs) {
             lastArg--;
         }
         dumpStatsdStats(fd, verbose, asProto);
+    } else if (numArgs > 0 && string(args[0]) == "--memory") {  // first argument
+        mProcessor->dumpMemory(fd);
     } else {
         // Request is to dump statsd report data.
         if (asProto) {
@@ -333,6 +398,7 @@ void StatsService::dumpStatsdStats(int out, bool verbose, bool proto) {
     } else {
         StatsdStats::getInstance().dumpStats(out);
         mProcessor->dumpStates(out, verbose);
+        dumpStatsdThreads(out);
     }
 }
 
@@ -340,16 +406,16 @@ void StatsService::dumpStatsdStats(int out, bool verbose, bool proto) {
  * Write stats report data in StatsDataDumpProto incident section format.
  */
 void StatsService::dumpIncidentSection(int out) {
-    ProtoOutputStream proto;
+    ProtoOutputStreamPool::Stream pooledProto = ProtoOutputStreamPool::getInstance().acquire();
+    ProtoOutputStream& proto = *pooledProto;
     for (const ConfigKey& configKey : mConfigManager->GetAllConfigKeys()) {
         uint64_t reportsListToken =
                 proto.start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS_LIST);
-        // Don't include the current bucket to avoid skipping buckets.
-        // If we need to include the current bucket later, consider changing to NO_TIME_CONSTRAINTS
-        // or other alternatives to avoid skipping buckets for pulled metrics.
+        // The current bucket is only snapshotted, so that frequent dumps neither split buckets
+        // nor pull.
         mProcessor->onDumpReport(configKey, getElapsedRealtimeNs(), getWallClockNs(),
-                                 false /* includeCurrentBucket */, false /* erase_data */, ADB_DUMP,
-                                 FAST, &proto);
+                                 true /* includeCurrentBucket */, false /* erase_data */, ADB_DUMP,
+                                 SNAPSHOT, &proto);
         proto.end(reportsListToken);
         proto.flush(out);
         proto.clear();
@@ -519,13 +585,16 @@ void StatsService::print_cmd_help(int out) {
     dprintf(out, "\n");
     dprintf(out,
             "usage: adb shell cmd stats dump-report [UID] NAME [--keep_data] "
-            "[--include_current_bucket] [--proto]\n");
+            "[--include_current_bucket | --snapshot_current_bucket] [--proto]\n");
     dprintf(out, "  Dump all metric data for a configuration.\n");
     dprintf(out, "  UID           The uid of the configuration. It is only possible to pass\n");
     dprintf(out, "                the UID parameter on eng builds. If UID is omitted the\n");
     dprintf(out, "                calling uid is used.\n");
     dprintf(out, "  NAME          The name of the configuration\n");
     dprintf(out, "  --keep_data   Do NOT erase the data upon dumping it.\n");
+    dprintf(out, "  --include_current_bucket  Close the current bucket and dump it.\n");
+    dprintf(out, "  --snapshot_current_bucket  Dump the current bucket so far without closing\n");
+    dprintf(out, "                it. It is dumped again once closed.\n");
     dprintf(out, "  --proto       Print proto binary.\n");
     dprintf(out, "\n");
     dprintf(out, "\n");
@@ -728,6 +797,7 @@ status_t StatsService::cmd_dump_report(int out, const Vector<String8>& args) {
         bool good = false;
         bool proto = false;
         bool includeCurrentBucket = false;
+        DumpLatency dumpLatency = NO_TIME_CONSTRAINTS;
         bool eraseData = true;
         int uid;
         string name;
@@ -738,6 +808,10 @@ status_t StatsService::cmd_dump_report(int out, const Vector<String8>& args) {
         if (!std::strcmp("--include_current_bucket", args[argCount-1].c_str())) {
             includeCurrentBucket = true;
             argCount -= 1;
+        } else if (!std::strcmp("--snapshot_current_bucket", args[argCount - 1].c_str())) {
+            includeCurrentBucket = true;
+            dumpLatency = SNAPSHOT;
+            argCount -= 1;
         }
         if (!std::strcmp("--keep_data", args[argCount-1].c_str())) {
             eraseData = false;
@@ -760,7 +834,7 @@ status_t StatsService::cmd_dump_report(int out, const Vector<String8>& args) {
             vector<uint8_t> data;
             mProcessor->onDumpReport(ConfigKey(uid, StrToInt64(name)), getElapsedRealtimeNs(),
                                      getWallClockNs(), includeCurrentBucket, eraseData, ADB_DUMP,
-                                     NO_TIME_CONSTRAINTS, &data);
+                                     dumpLatency, &data);
             if (proto) {
                 for (size_t i = 0; i < data.size(); i ++) {
                     dprintf(out, "%c", data[i]);
@@ -987,6 +1061,15 @@ bool StatsService::getUidFromString(const char* s, int32_t& uid) {
 Status StatsService::informAllUidData(const ScopedFileDescriptor& fd) {
     ENFORCE_UID(AID_SYSTEM);
 
+    if (mIncrementalUidMapUpdates) {
+        google::protobuf::io::FileInputStream input(fd.get());
+        if (!mUidMap->updateMapIncrementally(getElapsedRealtimeNs(), &input)) {
+            return exception(EX_ILLEGAL_ARGUMENT, "Error parsing proto stream for UidData.");
+        }
+        mBootCompleteTrigger.markComplete(kUidMapReceivedTag);
+        return Status::ok();
+    }
+
     // Parse fd into proto.
     UidData uidData;
     if (!uidData.ParseFromFileDescriptor(fd.get())) {
@@ -1132,10 +1215,13 @@ void StatsService::onStatsdInitCompleted() {
 
 void StatsService::Startup() {
     mConfigManager->Startup();
+    StorageManager::loadTrainInfos();
+    StorageManager::loadFileCatalogs();
     int64_t wallClockNs = getWallClockNs();
     int64_t elapsedRealtimeNs = getElapsedRealtimeNs();
     mProcessor->LoadActiveConfigsFromDisk();
     mProcessor->LoadMetadataFromDisk(wallClockNs, elapsedRealtimeNs);
+    mProcessor->LoadBucketCheckpointsFromDisk(wallClockNs, elapsedRealtimeNs);
     mProcessor->EnforceDataTtls(wallClockNs, elapsedRealtimeNs);
 }
 
@@ -1177,15 +1263,21 @@ Status StatsService::getData(int64_t key, const int32_t callingUid, vector<uint8
 Status StatsService::getDataFd(int64_t key, const int32_t callingUid,
                                const ScopedFileDescriptor& fd) {
     ENFORCE_UID(AID_SYSTEM);
-    vector<uint8_t> reportData;
-    getDataChecked(key, callingUid, &reportData);
+    VLOG("StatsService::getDataFd with Uid %i", callingUid);
+    // Reports on disk are mapped rather than read, and the report list is never assembled in
+    // memory, so peak memory use does not scale with the report size.
+    ConfigMetricsReportListParts report;
+    mProcessor->onDumpReport(ConfigKey(callingUid, key), getElapsedRealtimeNs(), getWallClockNs(),
+                             false /* include_current_bucket*/, true /* erase_data */,
+                             GET_DATA_CALLED, FAST, &report);
+    const size_t reportSize = report.size();
 
-    if (reportData.size() >= std::numeric_limits<int32_t>::max()) {
+    if (reportSize >= std::numeric_limits<int32_t>::max()) {
         ALOGE("Report size is infeasible big and can not be returned");
         return exception(EX_ILLEGAL_STATE, "Report size is infeasible big.");
     }
 
-    const uint32_t bytesToWrite = static_cast<uint32_t>(reportData.size());
+    const uint32_t bytesToWrite = static_cast<uint32_t>(reportSize);
     VLOG("StatsService::getDataFd report size %d", bytesToWrite);
 
     // write 4 bytes of report size for correct buffer allocation
@@ -1193,7 +1285,7 @@ Status StatsService::getDataFd(int64_t key, const int32_t callingUid,
     if (!android::base::WriteFully(fd.get(), &bytesToWriteBE, sizeof(uint32_t))) {
         return exception(EX_ILLEGAL_STATE, "Failed to write report data size to file descriptor");
     }
-    if (!android::base::WriteFully(fd.get(), reportData.data(), reportData.size())) {
+    if (!report.writeToFd(fd.get())) {
         return exception(EX_ILLEGAL_STATE, "Failed to write report data to file descriptor");
     }
 
@@ -1361,6 +1453,46 @@ Status StatsService::registerNativePullAtomCallback(
     return Status::ok();
 }
 
+Status StatsService::registerNativeDeltaPullAtomCallback(
+        int32_t atomTag, int64_t coolDownMillis, int64_t timeoutMillis,
+        const std::vector<int32_t>& additiveFields, const std::vector<int32_t>& deltaKeyFields,
+        const shared_ptr<IPullAtomCallback>& pullerCallback) {
+    if (!checkPermission(kPermissionRegisterPullAtom)) {
+        return exception(
+                EX_SECURITY,
+                StringPrintf("Uid %d does not have the %s permission when registering atom %d",
+                             AIBinder_getCallingUid(), kPermissionRegisterPullAtom, atomTag));
+    }
+    VLOG("StatsService::registerNativeDeltaPullAtomCallback called.");
+    int32_t uid = AIBinder_getCallingUid();
+    mPullerManager->RegisterPullAtomCallback(uid, atomTag, MillisToNano(coolDownMillis),
+                                             MillisToNano(timeoutMillis), additiveFields,
+                                             pullerCallback, deltaKeyFields);
+    return Status::ok();
+}
+
+Status StatsService::registerNativePullAtomCallbacks(
+        const vector<PullAtomRegistration>& registrations) {
+    if (!checkPermission(kPermissionRegisterPullAtom)) {
+        return exception(
+                EX_SECURITY,
+                StringPrintf("Uid %d does not have the %s permission when registering %zu atoms",
+                             AIBinder_getCallingUid(), kPermissionRegisterPullAtom,
+                             registrations.size()));
+    }
+    VLOG("StatsService::registerNativePullAtomCallbacks called for %zu atoms.",
+         registrations.size());
+    int32_t uid = AIBinder_getCallingUid();
+    for (const PullAtomRegistration& registration : registrations) {
+        mPullerManager->RegisterPullAtomCallback(
+                uid, registration.atomTag, MillisToNano(registration.coolDownMillis),
+                MillisToNano(registration.timeoutMillis), registration.additiveFields,
+                registration.pullerCallback, registration.deltaKeyFields,
+                registration.supportsAggregation, registration.pullGroup);
+    }
+    return Status::ok();
+}
+
 Status StatsService::unregisterPullAtomCallback(int32_t uid, int32_t atomTag) {
     ENFORCE_UID(AID_SYSTEM);
     VLOG("StatsService::unregisterPullAtomCallback called.");
@@ -1504,6 +1636,21 @@ Status StatsService::addSubscription(const vector<uint8_t>& subscriptionConfig,
     return Status::ok();
 }
 
+Status StatsService::addRingSubscription(const vector<uint8_t>& subscriptionConfig,
+                                         const shared_ptr<IStatsSubscriptionCallback>& callback,
+                                         const ScopedFileDescriptor& ring) {
+    ENFORCE_SID(kTracedProbesSid);
+
+    initShellSubscriber();
+
+    android::base::unique_fd ringFd;
+    if (mSubscriptionRings) {
+        ringFd.reset(fcntl(ring.get(), F_DUPFD_CLOEXEC, 0));
+    }
+    mShellSubscriber->startNewSubscription(subscriptionConfig, callback, std::move(ringFd));
+    return Status::ok();
+}
+
 Status StatsService::removeSubscription(const shared_ptr<IStatsSubscriptionCallback>& callback) {
     ENFORCE_SID(kTracedProbesSid);
 
@@ -21,16 +21,19 @@
 #include <aidl/android/os/IPendingIntentRef.h>
 #include <aidl/android/os/IPullAtomCallback.h>
 #include <aidl/android/os/IStatsSubscriptionCallback.h>
+#include <aidl/android/os/PullAtomRegistration.h>
 #include <aidl/android/util/PropertyParcel.h>
 #include <gtest/gtest_prod.h>
 #include <utils/Looper.h>
 
 #include <mutex>
+#include <optional>
 
 #include "StatsLogProcessor.h"
 #include "anomaly/AlarmMonitor.h"
 #include "config/ConfigManager.h"
 #include "external/StatsPullerManager.h"
+#include "logd/LogEventPool.h"
 #include "logd/LogEventQueue.h"
 #include "packages/UidMap.h"
 #include "shell/ShellSubscriber.h"
@@ -48,6 +51,7 @@ using aidl::android::os::IPendingIntentRef;
 using aidl::android::os::IPullAtomCallback;
 using aidl::android::os::IStatsQueryCallback;
 using aidl::android::os::IStatsSubscriptionCallback;
+using aidl::android::os::PullAtomRegistration;
 using aidl::android::util::PropertyParcel;
 using ::ndk::ScopedAIBinder_DeathRecipient;
 using ::ndk::ScopedFileDescriptor;
@@ -60,12 +64,22 @@ class StatsService : public BnStatsd {
 public:
     StatsService(const sp<UidMap>& uidMap, shared_ptr<LogEventQueue> queue,
                  const std::shared_ptr<LogEventFilter>& logEventFilter,
-                 int initEventDelaySecs = kStatsdInitDelaySecs);
+                 int initEventDelaySecs = kStatsdInitDelaySecs,
+                 const std::shared_ptr<LogEventPool>& logEventPool = nullptr,
+                 const StatsLogProcessorOptions& processorOptions = StatsLogProcessorOptions(),
+                 int64_t pullCoalescingWindowNs = 0,
+                 AlarmMonitor::Type alarmMonitorType = AlarmMonitor::Type::PRIORITY_QUEUE,
+                 bool subscriptionRings = false, bool memoryPressureShedding = false,
+                 bool debouncedAlarmRegistrations = false,
+                 bool incrementalUidMapUpdates = false, bool loadShedding = false);
     virtual ~StatsService();
 
     /** The anomaly alarm registered with AlarmManager won't be updated by less than this. */
     const uint32_t MIN_DIFF_TO_UPDATE_REGISTERED_ALARM_SECS = 5;
 
+    /** With debounced registrations, registered alarms are not postponed more often than this. */
+    const uint32_t MIN_ALARM_REGISTRATION_INTERVAL_SECS = 60;
+
     virtual status_t dump(int fd, const char** args, uint32_t numArgs) override;
     virtual status_t handleShellCommand(int in, int out, int err, const char** argv,
                                         uint32_t argc) override;
@@ -192,6 +206,20 @@ public:
             const vector<int32_t>& additiveFields,
             const shared_ptr<IPullAtomCallback>& pullerCallback) override;
 
+    /**
+     * Binder call to register a callback function for a pulled atom that sends deltas.
+     */
+    virtual Status registerNativeDeltaPullAtomCallback(
+            int32_t atomTag, int64_t coolDownMillis, int64_t timeoutMillis,
+            const vector<int32_t>& additiveFields, const vector<int32_t>& deltaKeyFields,
+            const shared_ptr<IPullAtomCallback>& pullerCallback) override;
+
+    /**
+     * Binder call to register the callback functions of several pulled atoms.
+     */
+    virtual Status registerNativePullAtomCallbacks(
+            const vector<PullAtomRegistration>& registrations) override;
+
     /**
      * Binder call to unregister any existing callback for the given uid and atom.
      */
@@ -245,6 +273,13 @@ public:
     virtual Status addSubscription(const vector<uint8_t>& subscriptionConfig,
                                    const shared_ptr<IStatsSubscriptionCallback>& callback) override;
 
+    /**
+     * Binder call to add a subscription that writes its data to a shared memory ring.
+     */
+    virtual Status addRingSubscription(const vector<uint8_t>& subscriptionConfig,
+                                       const shared_ptr<IStatsSubscriptionCallback>& callback,
+                                       const ScopedFileDescriptor& ring) override;
+
     /**
      * Binder call to remove a subscription.
      */
@@ -260,6 +295,25 @@ public:
     const static int kStatsdInitDelaySecs = 90;
 
 private:
+    /**
+     * Max number of events popped from the event queue and processed under a single
+     * StatsLogProcessor lock.
+     */
+    static constexpr size_t kMaxLogEventBatchSize = 64;
+
+    /**
+     * Period of the memory pressure checks of the events thread, and minimum time between two
+     * sheddings while the pressure lasts.
+     */
+    static constexpr int64_t kMemoryPressureCheckPeriodNs = 10 * NS_PER_SEC;
+    static constexpr int64_t kMemoryPressureSheddingPeriodNs = 5 * 60 * NS_PER_SEC;
+
+    /**
+     * Frees the caches and pools, and moves the metric data to disk, if the device is under
+     * memory pressure. Called by the events thread, which does the checks.
+     */
+    void maybeShedMemory(int64_t elapsedRealtimeNs);
+
     /**
      * Load system properties at init.
      */
@@ -471,6 +525,10 @@ private:
     shared_ptr<LogEventQueue> mEventQueue;
     std::shared_ptr<LogEventFilter> mLogEventFilter;
 
+    // Processed events are given back to this pool to be reused by the socket listener.
+    // Can be null.
+    std::shared_ptr<LogEventPool> mLogEventPool;
+
     std::unique_ptr<std::thread> mLogsReaderThread;
 
     std::condition_variable mStatsdInitCompletedHandlerTerminationFlag;
@@ -490,6 +548,23 @@ private:
 
     const int mInitEventDelaySecs;
 
+    // Whether the rings of addRingSubscription are used. If not, their data goes through the
+    // callback.
+    const bool mSubscriptionRings;
+
+    // Whether memory is shed under memory pressure.
+    const bool mMemoryPressureShedding;
+
+    // Whether informAllUidData() only applies the apps that changed to the uid map.
+    const bool mIncrementalUidMapUpdates;
+
+    // Whether the best effort configs shed load while mEventQueue is congested.
+    const bool mLoadShedding;
+
+    // Only used by the events thread.
+    int64_t mLastMemoryPressureCheckNs = 0;
+    std::optional<int64_t> mLastMemoryPressureSheddingNs;
+
     friend class StatsServiceConfigTest;
     friend class StatsServiceStatsdInitTest;
     friend class RestrictedConfigE2ETest;
@@ -512,6 +587,7 @@ private:
     FRIEND_TEST(PartialBucketE2eTest, TestGaugeMetricWithoutMinPartialBucket);
     FRIEND_TEST(PartialBucketE2eTest, TestGaugeMetricWithMinPartialBucket);
     FRIEND_TEST(PartialBucketE2eTest, TestCountMetricNoSplitByDefault);
+    FRIEND_TEST(PartialBucketCoalescingE2eTest, TestCountMetricCoalescesUpgradeSplits);
     FRIEND_TEST(RestrictedConfigE2ETest, NonRestrictedConfigGetReport);
     FRIEND_TEST(RestrictedConfigE2ETest, RestrictedConfigNoReport);
     FRIEND_TEST(RestrictedConfigE2ETest,
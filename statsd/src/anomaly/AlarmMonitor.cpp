@@ -18,7 +18,11 @@
 #include "Log.h"
 
 #include "anomaly/AlarmMonitor.h"
+
+#include <algorithm>
+
 #include "guardrail/StatsdStats.h"
+#include "stats_log_util.h"
 
 namespace android {
 namespace os {
@@ -27,9 +31,12 @@ namespace statsd {
 AlarmMonitor::AlarmMonitor(
         uint32_t minDiffToUpdateRegisteredAlarmTimeSec,
         const std::function<void(const shared_ptr<IStatsCompanionService>&, int64_t)>& updateAlarm,
-        const std::function<void(const shared_ptr<IStatsCompanionService>&)>& cancelAlarm)
+        const std::function<void(const shared_ptr<IStatsCompanionService>&)>& cancelAlarm,
+        Type type, uint32_t minRegistrationIntervalSec)
     : mRegisteredAlarmTimeSec(0),
+      mType(type),
       mMinUpdateTimeSec(minDiffToUpdateRegisteredAlarmTimeSec),
+      mMinRegistrationIntervalSec(minRegistrationIntervalSec),
       mUpdateAlarm(updateAlarm),
       mCancelAlarm(cancelAlarm) {}
 
@@ -45,9 +52,8 @@ void AlarmMonitor::setStatsCompanionService(
         return;
     }
     VLOG("Creating link to statsCompanionService");
-    const sp<const InternalAlarm> top = mPq.top();
-    if (top != nullptr) {
-        updateRegisteredAlarmTime_l(top->timestampSec);
+    if (!empty_l()) {
+        updateRegisteredAlarmTime_l(soonestAlarmTimeSec_l());
     }
 }
 
@@ -64,9 +70,15 @@ void AlarmMonitor::add(sp<const InternalAlarm> alarm) {
     }
     // TODO(b/110563466): Ensure that refractory period is respected.
     VLOG("Adding alarm with time %u", alarm->timestampSec);
-    mPq.push(alarm);
-    if (mRegisteredAlarmTimeSec < 1 ||
-        alarm->timestampSec + mMinUpdateTimeSec < mRegisteredAlarmTimeSec) {
+    if (mType == Type::TIMER_WHEEL) {
+        mWheel.push(alarm);
+    } else {
+        mPq.push(alarm);
+    }
+    // Moving the registered alarm sooner is never debounced, since alarms must not fire later
+    // than their slack allows.
+    const uint32_t slackSec = std::max(mMinUpdateTimeSec, alarm->slackSec);
+    if (mRegisteredAlarmTimeSec < 1 || alarm->timestampSec + slackSec < mRegisteredAlarmTimeSec) {
         updateRegisteredAlarmTime_l(alarm->timestampSec);
     }
 }
@@ -78,14 +90,18 @@ void AlarmMonitor::remove(sp<const InternalAlarm> alarm) {
         return;
     }
     VLOG("Removing alarm with time %u", alarm->timestampSec);
-    bool wasPresent = mPq.remove(alarm);
+    bool wasPresent = mType == Type::TIMER_WHEEL ? mWheel.remove(alarm) : mPq.remove(alarm);
     if (!wasPresent) return;
-    if (mPq.empty()) {
+    if (!canPostponeRegisteredAlarm_l()) {
+        VLOG("Keeping the alarm registered at %u.", mRegisteredAlarmTimeSec);
+        return;
+    }
+    if (empty_l()) {
         VLOG("Queue is empty. Cancel any alarm.");
         cancelRegisteredAlarmTime_l();
         return;
     }
-    uint32_t soonestAlarmTimeSec = mPq.top()->timestampSec;
+    uint32_t soonestAlarmTimeSec = soonestAlarmTimeSec_l();
     VLOG("Soonest alarm is %u", soonestAlarmTimeSec);
     if (soonestAlarmTimeSec > mRegisteredAlarmTimeSec + mMinUpdateTimeSec) {
         updateRegisteredAlarmTime_l(soonestAlarmTimeSec);
@@ -100,19 +116,25 @@ unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> AlarmMonitor::popS
     unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> oldAlarms;
     std::lock_guard<std::mutex> lock(mLock);
 
-    for (sp<const InternalAlarm> t = mPq.top(); t != nullptr && t->timestampSec <= timestampSec;
-        t = mPq.top()) {
-        oldAlarms.insert(t);
-        mPq.pop();  // remove t
+    if (mType == Type::TIMER_WHEEL) {
+        mWheel.popSoonerThan(timestampSec, &oldAlarms);
+    } else {
+        for (sp<const InternalAlarm> t = mPq.top();
+             t != nullptr && t->timestampSec <= timestampSec; t = mPq.top()) {
+            oldAlarms.insert(t);
+            mPq.pop();  // remove t
+        }
     }
-    // Always update registered alarm time (if anything has changed).
-    if (!oldAlarms.empty()) {
-        if (mPq.empty()) {
+    // Always update registered alarm time (if anything has changed). An alarm kept registered
+    // by remove() can fire with no alarm to pop, and must then be registered again.
+    if (!oldAlarms.empty() ||
+        (mRegisteredAlarmTimeSec > 0 && mRegisteredAlarmTimeSec <= timestampSec)) {
+        if (empty_l()) {
             VLOG("Queue is empty. Cancel any alarm.");
             cancelRegisteredAlarmTime_l();
         } else {
             // Always update the registered alarm in this case (unlike remove()).
-            updateRegisteredAlarmTime_l(mPq.top()->timestampSec);
+            updateRegisteredAlarmTime_l(soonestAlarmTimeSec_l());
         }
     }
     return oldAlarms;
@@ -121,15 +143,30 @@ unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> AlarmMonitor::popS
 void AlarmMonitor::updateRegisteredAlarmTime_l(uint32_t timestampSec) {
     VLOG("Updating reg alarm time to %u", timestampSec);
     mRegisteredAlarmTimeSec = timestampSec;
+    mLastRegistrationSec = getElapsedRealtimeSec();
     mUpdateAlarm(mStatsCompanionService, secToMs(mRegisteredAlarmTimeSec));
 }
 
 void AlarmMonitor::cancelRegisteredAlarmTime_l() {
     VLOG("Cancelling reg alarm.");
     mRegisteredAlarmTimeSec = 0;
+    mLastRegistrationSec = getElapsedRealtimeSec();
     mCancelAlarm(mStatsCompanionService);
 }
 
+bool AlarmMonitor::canPostponeRegisteredAlarm_l() const {
+    return mMinRegistrationIntervalSec == 0 ||
+           getElapsedRealtimeSec() - mLastRegistrationSec >= mMinRegistrationIntervalSec;
+}
+
+bool AlarmMonitor::empty_l() const {
+    return mType == Type::TIMER_WHEEL ? mWheel.empty() : mPq.empty();
+}
+
+uint32_t AlarmMonitor::soonestAlarmTimeSec_l() {
+    return mType == Type::TIMER_WHEEL ? mWheel.soonestTimestampSec() : mPq.top()->timestampSec;
+}
+
 int64_t AlarmMonitor::secToMs(uint32_t timeSec) {
     return ((int64_t)timeSec) * 1000;
 }
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "anomaly/AlarmTimerWheel.h"
 #include "anomaly/indexed_priority_queue.h"
 
 #include <aidl/android/os/IStatsCompanionService.h>
@@ -42,11 +43,21 @@ namespace statsd {
  * Timestamps are in seconds since epoch in a uint32, so will fail in year 2106.
  */
 struct InternalAlarm : public RefBase {
-    explicit InternalAlarm(uint32_t timestampSec) : timestampSec(timestampSec) {
+    explicit InternalAlarm(uint32_t timestampSec, uint32_t slackSec = 0)
+        : timestampSec(timestampSec), slackSec(slackSec) {
     }
 
     const uint32_t timestampSec;
 
+    // How late the alarm may fire, so that it can share the wakeup of a later alarm.
+    const uint32_t slackSec;
+
+    // Links of the AlarmTimerWheel holding the alarm, only used by AlarmTimerWheel.
+    mutable const AlarmTimerWheel* wheel = nullptr;
+    mutable const InternalAlarm* wheelPrev = nullptr;
+    mutable const InternalAlarm* wheelNext = nullptr;
+    mutable int wheelSlot = -1;
+
     /** InternalAlarm a is smaller (higher priority) than b if its timestamp is sooner. */
     struct SmallerTimestamp {
         bool operator()(sp<const InternalAlarm> a, sp<const InternalAlarm> b) const {
@@ -60,15 +71,27 @@ struct InternalAlarm : public RefBase {
  */
 class AlarmMonitor : public RefBase {
 public:
+    // How the alarms are stored.
+    enum class Type {
+        // Binary heap, logarithmic insertion and removal.
+        PRIORITY_QUEUE,
+        // Hierarchical timer wheel, constant time insertion and removal.
+        TIMER_WHEEL,
+    };
+
     /**
      * @param minDiffToUpdateRegisteredAlarmTimeSec If the soonest alarm differs
      * from the registered alarm by more than this amount, update the registered
      * alarm.
+     * @param minRegistrationIntervalSec Within this many seconds of the last
+     * registration, the registered alarm is not postponed or cancelled when alarms
+     * are removed. It then fires early, at most once, and is registered again.
      */
     AlarmMonitor(uint32_t minDiffToUpdateRegisteredAlarmTimeSec,
                  const function<void(const shared_ptr<IStatsCompanionService>&, int64_t)>&
                          updateAlarm,
-                 const function<void(const shared_ptr<IStatsCompanionService>&)>& cancelAlarm);
+                 const function<void(const shared_ptr<IStatsCompanionService>&)>& cancelAlarm,
+                 Type type = Type::PRIORITY_QUEUE, uint32_t minRegistrationIntervalSec = 0);
     ~AlarmMonitor();
 
     /**
@@ -93,7 +116,8 @@ public:
 
     /**
      * Returns and removes all alarms whose timestamp <= the given timestampSec.
-     * Always updates the registered alarm if return is non-empty.
+     * Always updates the registered alarm if return is non-empty or if the
+     * registered alarm is not after timestampSec.
      */
     unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> popSoonerThan(
             uint32_t timestampSec);
@@ -101,7 +125,9 @@ public:
     /**
      * Returns the projected alarm timestamp that is registered with
      * StatsCompanionService. This may not be equal to the soonest alarm,
-     * but should be within minDiffToUpdateRegisteredAlarmTimeSec of it.
+     * but should be within minDiffToUpdateRegisteredAlarmTimeSec, or the slack
+     * of the alarm, of it. While registrations are debounced, it may also be
+     * sooner.
      */
     uint32_t getRegisteredAlarmTimeSec() const {
         return mRegisteredAlarmTimeSec;
@@ -118,11 +144,19 @@ private:
      */
     uint32_t mRegisteredAlarmTimeSec;
 
+    const Type mType;
+
     /**
      * Priority queue of alarms, prioritized by soonest alarm.timestampSec.
+     * Only used with Type::PRIORITY_QUEUE.
      */
     indexed_priority_queue<InternalAlarm, InternalAlarm::SmallerTimestamp> mPq;
 
+    /**
+     * Timer wheel of alarms. Only used with Type::TIMER_WHEEL.
+     */
+    AlarmTimerWheel mWheel;
+
     /**
      * Binder interface for communicating with StatsCompanionService.
      */
@@ -134,6 +168,21 @@ private:
      */
     uint32_t mMinUpdateTimeSec;
 
+    /**
+     * Minimum time between a registration and postponing or cancelling it, in
+     * seconds. 0 if registrations are not debounced.
+     */
+    const uint32_t mMinRegistrationIntervalSec;
+
+    /**
+     * Elapsed realtime (seconds) of the last update or cancellation of the
+     * registered alarm.
+     */
+    int64_t mLastRegistrationSec = 0;
+
+    /** Returns whether the registered alarm may be postponed or cancelled now. */
+    bool canPostponeRegisteredAlarm_l() const;
+
     /**
      * Updates the alarm registered with StatsCompanionService to the given time.
      * Also correspondingly updates mRegisteredAlarmTimeSec.
@@ -146,6 +195,12 @@ private:
      */
     void cancelRegisteredAlarmTime_l();
 
+    /** Returns whether there is no alarm. */
+    bool empty_l() const;
+
+    /** Returns the timestamp of the soonest alarm, should only be called if !empty_l(). */
+    uint32_t soonestAlarmTimeSec_l();
+
     /** Converts uint32 timestamp in seconds to a Java long in msec. */
     int64_t secToMs(uint32_t timeSec);
 
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false
+#include "Log.h"
+
+#include "anomaly/AlarmTimerWheel.h"
+
+#include "anomaly/AlarmMonitor.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+AlarmTimerWheel::~AlarmTimerWheel() {
+    for (const InternalAlarm* head : mSlots) {
+        while (head != nullptr) {
+            const InternalAlarm* next = head->wheelNext;
+            head->wheelPrev = nullptr;
+            head->wheelNext = nullptr;
+            head->wheel = nullptr;
+            head->decStrong(this);
+            head = next;
+        }
+    }
+}
+
+bool AlarmTimerWheel::push(const sp<const InternalAlarm>& alarm) {
+    if (alarm == nullptr || alarm->wheel != nullptr) {
+        return false;
+    }
+    alarm->incStrong(this);
+    alarm->wheel = this;
+    link(alarm.get(), slotOf(alarm->timestampSec));
+    if (mSize == 0) {
+        mSoonestSec = alarm->timestampSec;
+        mSoonestValid = true;
+    } else if (mSoonestValid && alarm->timestampSec < mSoonestSec) {
+        mSoonestSec = alarm->timestampSec;
+    }
+    mSize++;
+    return true;
+}
+
+bool AlarmTimerWheel::remove(const sp<const InternalAlarm>& alarm) {
+    if (alarm == nullptr || alarm->wheel != this) {
+        return false;
+    }
+    unlink(alarm.get());
+    alarm->wheel = nullptr;
+    mSize--;
+    if (alarm->timestampSec == mSoonestSec) {
+        mSoonestValid = false;
+    }
+    alarm->decStrong(this);
+    return true;
+}
+
+int AlarmTimerWheel::slotOf(uint32_t timestampSec) const {
+    if (timestampSec <= mCurrentSec) {
+        return kOverdueSlot;
+    }
+    const int highestBit = 31 - __builtin_clz(timestampSec ^ mCurrentSec);
+    const int level = highestBit / kSlotBits;
+    return level * kSlotsPerLevel + ((timestampSec >> (level * kSlotBits)) & kSlotMask);
+}
+
+void AlarmTimerWheel::link(const InternalAlarm* alarm, int slot) {
+    const InternalAlarm* head = mSlots[slot];
+    alarm->wheelSlot = slot;
+    alarm->wheelPrev = nullptr;
+    alarm->wheelNext = head;
+    if (head != nullptr) {
+        head->wheelPrev = alarm;
+    } else if (slot != kOverdueSlot) {
+        const int level = slot / kSlotsPerLevel;
+        const int index = slot & kSlotMask;
+        mOccupied[level][index / 64] |= uint64_t(1) << (index % 64);
+    }
+    mSlots[slot] = alarm;
+}
+
+void AlarmTimerWheel::unlink(const InternalAlarm* alarm) {
+    const int slot = alarm->wheelSlot;
+    if (alarm->wheelPrev != nullptr) {
+        alarm->wheelPrev->wheelNext = alarm->wheelNext;
+    } else {
+        mSlots[slot] = alarm->wheelNext;
+    }
+    if (alarm->wheelNext != nullptr) {
+        alarm->wheelNext->wheelPrev = alarm->wheelPrev;
+    }
+    alarm->wheelPrev = nullptr;
+    alarm->wheelNext = nullptr;
+    alarm->wheelSlot = -1;
+    if (mSlots[slot] == nullptr && slot != kOverdueSlot) {
+        const int level = slot / kSlotsPerLevel;
+        const int index = slot & kSlotMask;
+        mOccupied[level][index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+}
+
+int AlarmTimerWheel::firstOccupiedSlot(int level) const {
+    for (int word = 0; word < kOccupancyWords; word++) {
+        if (mOccupied[level][word] != 0) {
+            return level * kSlotsPerLevel + word * 64 + __builtin_ctzll(mOccupied[level][word]);
+        }
+    }
+    return -1;
+}
+
+uint32_t AlarmTimerWheel::soonestTimestampSec() {
+    if (mSoonestValid) {
+        return mSoonestSec;
+    }
+    // Overdue alarms are sooner than all the others, otherwise the soonest alarm is in the first
+    // occupied slot of the lowest occupied level.
+    int slot = mSlots[kOverdueSlot] != nullptr ? kOverdueSlot : -1;
+    for (int level = 0; slot < 0 && level < kLevels; level++) {
+        slot = firstOccupiedSlot(level);
+    }
+    if (slot < 0) {
+        return 0;
+    }
+    uint32_t soonestSec = UINT32_MAX;
+    for (const InternalAlarm* alarm = mSlots[slot]; alarm != nullptr; alarm = alarm->wheelNext) {
+        soonestSec = std::min(soonestSec, alarm->timestampSec);
+        if (slot < kSlotsPerLevel) {
+            // All the alarms of a slot of the lowest level have the same timestamp.
+            break;
+        }
+    }
+    mSoonestSec = soonestSec;
+    mSoonestValid = true;
+    return mSoonestSec;
+}
+
+bool AlarmTimerWheel::popSlot(
+        int slot, uint32_t timestampSec,
+        std::unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>* alarms) {
+    const InternalAlarm* alarm = mSlots[slot];
+    while (alarm != nullptr) {
+        const InternalAlarm* next = alarm->wheelNext;
+        if (alarm->timestampSec <= timestampSec) {
+            unlink(alarm);
+            alarm->wheel = nullptr;
+            mSize--;
+            alarms->insert(sp<const InternalAlarm>(alarm));
+            alarm->decStrong(this);
+        }
+        alarm = next;
+    }
+    return mSlots[slot] == nullptr;
+}
+
+void AlarmTimerWheel::popSoonerThan(
+        uint32_t timestampSec,
+        std::unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>* alarms) {
+    const size_t previousSize = mSize;
+    popSlot(kOverdueSlot, timestampSec, alarms);
+    if (timestampSec > mCurrentSec) {
+        // Pops the slots in timestamp order, until one that is not entirely due.
+        bool done = false;
+        for (int level = 0; level < kLevels && !done; level++) {
+            const int shift = level * kSlotBits;
+            const int levelBits = shift + kSlotBits;
+            // Timestamps in the level share the bytes above it with mCurrentSec.
+            const uint64_t levelBase =
+                    levelBits < 32 ? (uint64_t(mCurrentSec) >> levelBits) << levelBits : 0;
+            for (int slot; !done && (slot = firstOccupiedSlot(level)) >= 0;) {
+                const uint64_t slotStartSec = levelBase | (uint64_t(slot & kSlotMask) << shift);
+                done = slotStartSec > timestampSec || !popSlot(slot, timestampSec, alarms);
+            }
+        }
+        advanceTo(timestampSec);
+    }
+    if (mSize != previousSize) {
+        mSoonestValid = false;
+    }
+}
+
+void AlarmTimerWheel::advanceTo(uint32_t timestampSec) {
+    mCurrentSec = timestampSec;
+    // The bytes of the timestamp above a level did not change for the alarms left in the level.
+    // The ones in the slot of the new current time now belong to a lower level, from the top so
+    // that an alarm can move down several levels.
+    for (int level = kLevels - 1; level > 0; level--) {
+        const int slot =
+                level * kSlotsPerLevel + ((timestampSec >> (level * kSlotBits)) & kSlotMask);
+        const InternalAlarm* alarm = mSlots[slot];
+        while (alarm != nullptr) {
+            const InternalAlarm* next = alarm->wheelNext;
+            unlink(alarm);
+            link(alarm, slotOf(alarm->timestampSec));
+            alarm = next;
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
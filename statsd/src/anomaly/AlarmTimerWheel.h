@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <array>
+#include <unordered_set>
+
+#include "anomaly/indexed_priority_queue.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+struct InternalAlarm;
+
+/**
+ * Hierarchical timer wheel of InternalAlarms, with constant time insertion and removal.
+ *
+ * The wheel has 4 levels of 256 slots, one per byte of the 32 bits timestamps. An alarm is kept
+ * at the level of the highest byte in which its timestamp differs from the current time of the
+ * wheel, in the slot of that byte. Alarms of a level are thus sooner than the ones of the levels
+ * above, and within a level, sooner in the lower slots. Advancing the current time moves the
+ * alarms of the slots it enters down to the lower levels.
+ *
+ * The alarms are linked through their intrusive wheel fields, an alarm can only be in one wheel
+ * at a time. The wheel holds a strong reference to each of its alarms.
+ *
+ * Not thread-safe, AlarmMonitor guards it with its lock.
+ */
+class AlarmTimerWheel {
+public:
+    AlarmTimerWheel() = default;
+
+    ~AlarmTimerWheel();
+
+    AlarmTimerWheel(const AlarmTimerWheel&) = delete;
+    AlarmTimerWheel& operator=(const AlarmTimerWheel&) = delete;
+
+    /** Adds the alarm. Returns false if it is null or already in a wheel. */
+    bool push(const sp<const InternalAlarm>& alarm);
+
+    /** Removes the alarm. Returns false if it is not in this wheel. */
+    bool remove(const sp<const InternalAlarm>& alarm);
+
+    /** Moves the alarms whose timestamp <= timestampSec to alarms. */
+    void popSoonerThan(uint32_t timestampSec,
+                       std::unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>* alarms);
+
+    /** Returns the timestamp of the soonest alarm. Should only be called when not empty(). */
+    uint32_t soonestTimestampSec();
+
+    size_t size() const {
+        return mSize;
+    }
+
+    bool empty() const {
+        return mSize == 0;
+    }
+
+private:
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 8;
+    static constexpr int kSlotsPerLevel = 1 << kSlotBits;
+    static constexpr int kSlotMask = kSlotsPerLevel - 1;
+    static constexpr int kOccupancyWords = kSlotsPerLevel / 64;
+
+    // Alarms that are not later than mCurrentSec, they are kept out of the levels.
+    static constexpr int kOverdueSlot = kLevels * kSlotsPerLevel;
+
+    // Returns the slot of the alarm timestamp relative to mCurrentSec.
+    int slotOf(uint32_t timestampSec) const;
+
+    void link(const InternalAlarm* alarm, int slot);
+
+    void unlink(const InternalAlarm* alarm);
+
+    // Moves the alarms of the slot that are not later than timestampSec to alarms. Returns
+    // whether the slot is now empty.
+    bool popSlot(int slot, uint32_t timestampSec,
+                 std::unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>* alarms);
+
+    // Returns the lowest occupied slot of the level, or -1.
+    int firstOccupiedSlot(int level) const;
+
+    // Sets mCurrentSec, and moves down the alarms of the slots it enters. All the alarms in the
+    // levels must be later than timestampSec.
+    void advanceTo(uint32_t timestampSec);
+
+    std::array<const InternalAlarm*, kOverdueSlot + 1> mSlots{};
+
+    // Bitmap of the non-empty slots of each level.
+    std::array<std::array<uint64_t, kOccupancyWords>, kLevels> mOccupied{};
+
+    uint32_t mCurrentSec = 0;
+
+    size_t mSize = 0;
+
+    // Cached soonestTimestampSec(), only valid when mSoonestValid.
+    uint32_t mSoonestSec = 0;
+    bool mSoonestValid = false;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -30,6 +30,8 @@
 #include <statslog_statsd.h>
 #include <time.h>
 
+#include <algorithm>
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -50,10 +52,11 @@ void AnomalyTracker::onConfigUpdated() {
 
 void AnomalyTracker::resetStorage() {
     VLOG("resetStorage() called.");
-    mPastBuckets.clear();
-    // Excludes the current bucket.
-    mPastBuckets.resize(mNumOfPastBuckets);
-    mSumOverPastBuckets.clear();
+    mDimensionIds.clear();
+    mFreeDimensionIds.clear();
+    mPastBucketValues.clear();
+    mPastBucketSums.clear();
+    mSyncedBucketNums.clear();
 }
 
 size_t AnomalyTracker::index(int64_t bucketNum) const {
@@ -77,16 +80,102 @@ void AnomalyTracker::advanceMostRecentBucketTo(const int64_t& bucketNum) {
     if (bucketNum >= mMostRecentBucketNum + mNumOfPastBuckets) {
         resetStorage();
         mMostRecentBucketNum = bucketNum;
+        mLastCompactionBucketNum = bucketNum;
         return;
     }
 
-    // Clear out space by emptying out old mPastBuckets[i] values and update mSumOverPastBuckets.
-    for (int64_t i = mMostRecentBucketNum + 1; i <= bucketNum; i++) {
-        const int idx = index(i);
-        subtractBucketFromSum(mPastBuckets[idx]);
-        mPastBuckets[idx] = nullptr;  // release (but not clear) the old bucket.
-    }
+    // The old values are dropped when each dimension is next written. The dimensions that are not
+    // written for a whole ring only hold old values, and are removed from time to time.
     mMostRecentBucketNum = bucketNum;
+    if (mMostRecentBucketNum - mLastCompactionBucketNum >= mNumOfPastBuckets) {
+        compactDimensions();
+    }
+}
+
+int AnomalyTracker::getOrCreateDimensionId(const MetricDimensionKey& key) {
+    const auto [it, inserted] = mDimensionIds.insert({key, 0});
+    if (!inserted) {
+        syncDimension(it->second);
+        return it->second;
+    }
+    if (mFreeDimensionIds.empty()) {
+        it->second = mPastBucketSums.size();
+        mPastBucketValues.resize(mPastBucketValues.size() + mNumOfPastBuckets, 0);
+        mPastBucketSums.push_back(0);
+        mSyncedBucketNums.push_back(mMostRecentBucketNum);
+    } else {
+        // The ring of a removed dimension is all 0s.
+        it->second = mFreeDimensionIds.back();
+        mFreeDimensionIds.pop_back();
+        mSyncedBucketNums[it->second] = mMostRecentBucketNum;
+    }
+    return it->second;
+}
+
+void AnomalyTracker::syncDimension(int id) {
+    int64_t& syncedBucketNum = mSyncedBucketNums[id];
+    if (syncedBucketNum == mMostRecentBucketNum) {
+        return;
+    }
+    int64_t* values = &mPastBucketValues[id * mNumOfPastBuckets];
+    if (mMostRecentBucketNum - syncedBucketNum >= mNumOfPastBuckets) {
+        std::fill(values, values + mNumOfPastBuckets, 0);
+        mPastBucketSums[id] = 0;
+    } else {
+        // The buckets after the synced one replace the ones a whole ring before them.
+        for (int64_t i = syncedBucketNum + 1; i <= mMostRecentBucketNum; i++) {
+            int64_t& value = values[index(i)];
+            mPastBucketSums[id] -= value;
+            value = 0;
+        }
+    }
+    syncedBucketNum = mMostRecentBucketNum;
+}
+
+int64_t AnomalyTracker::getStaleSum(int id) const {
+    const int64_t syncedBucketNum = mSyncedBucketNums[id];
+    if (mMostRecentBucketNum - syncedBucketNum >= mNumOfPastBuckets) {
+        return mPastBucketSums[id];
+    }
+    int64_t staleSum = 0;
+    const int64_t* values = &mPastBucketValues[id * mNumOfPastBuckets];
+    for (int64_t i = syncedBucketNum + 1; i <= mMostRecentBucketNum; i++) {
+        staleSum += values[index(i)];
+    }
+    return staleSum;
+}
+
+void AnomalyTracker::setPastBucketValue(int id, const int64_t& bucketNum,
+                                        const int64_t& bucketValue) {
+    int64_t& value = mPastBucketValues[id * mNumOfPastBuckets + index(bucketNum)];
+    mPastBucketSums[id] += bucketValue - value;
+    value = bucketValue;
+}
+
+void AnomalyTracker::compactDimensions() {
+    for (auto it = mDimensionIds.begin(); it != mDimensionIds.end();) {
+        const int id = it->second;
+        syncDimension(id);
+        const int64_t* values = &mPastBucketValues[id * mNumOfPastBuckets];
+        if (mPastBucketSums[id] == 0 &&
+            std::all_of(values, values + mNumOfPastBuckets, [](int64_t v) { return v == 0; })) {
+            mFreeDimensionIds.push_back(id);
+            it = mDimensionIds.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    mLastCompactionBucketNum = mMostRecentBucketNum;
+}
+
+size_t AnomalyTracker::getNumOfDimensionsWithPastData() const {
+    size_t count = 0;
+    for (const auto& [key, id] : mDimensionIds) {
+        if (mPastBucketSums[id] - getStaleSum(id) != 0) {
+            count++;
+        }
+    }
+    return count;
 }
 
 void AnomalyTracker::addPastBucket(const MetricDimensionKey& key,
@@ -98,25 +187,11 @@ void AnomalyTracker::addPastBucket(const MetricDimensionKey& key,
         return;
     }
 
-    const int bucketIndex = index(bucketNum);
-    if (bucketNum <= mMostRecentBucketNum && (mPastBuckets[bucketIndex] != nullptr)) {
-        // We need to insert into an already existing past bucket.
-        std::shared_ptr<DimToValMap>& bucket = mPastBuckets[bucketIndex];
-        auto itr = bucket->find(key);
-        if (itr != bucket->end()) {
-            // Old entry already exists; update it.
-            subtractValueFromSum(key, itr->second);
-            itr->second = bucketValue;
-        } else {
-            bucket->insert({key, bucketValue});
-        }
-        mSumOverPastBuckets[key] += bucketValue;
-    } else {
-        // Bucket does not exist yet (in future or was never made), so we must make it.
-        std::shared_ptr<DimToValMap> bucket = std::make_shared<DimToValMap>();
-        bucket->insert({key, bucketValue});
-        addPastBucket(bucket, bucketNum);
+    if (bucketNum > mMostRecentBucketNum) {
+        // Clear space for the new bucket to be at bucketNum.
+        advanceMostRecentBucketTo(bucketNum);
     }
+    setPastBucketValue(getOrCreateDimensionId(key), bucketNum, bucketValue);
 }
 
 void AnomalyTracker::addPastBucket(std::shared_ptr<DimToValMap> bucket,
@@ -128,45 +203,21 @@ void AnomalyTracker::addPastBucket(std::shared_ptr<DimToValMap> bucket,
     }
 
     if (bucketNum <= mMostRecentBucketNum) {
-        // We are updating an old bucket, not adding a new one.
-        subtractBucketFromSum(mPastBuckets[index(bucketNum)]);
+        // We are updating an old bucket, not adding a new one. Dimensions missing from the new
+        // bucket no longer have a value in it.
+        for (const auto& [key, id] : mDimensionIds) {
+            syncDimension(id);
+            setPastBucketValue(id, bucketNum, 0);
+        }
     } else {
         // Clear space for the new bucket to be at bucketNum.
         advanceMostRecentBucketTo(bucketNum);
     }
-    mPastBuckets[index(bucketNum)] = bucket;
-    addBucketToSum(bucket);
-}
-
-void AnomalyTracker::subtractBucketFromSum(const shared_ptr<DimToValMap>& bucket) {
-    if (bucket == nullptr) {
-        return;
-    }
-    for (const auto& keyValuePair : *bucket) {
-        subtractValueFromSum(keyValuePair.first, keyValuePair.second);
-    }
-}
-
-
-void AnomalyTracker::subtractValueFromSum(const MetricDimensionKey& key,
-                                          const int64_t& bucketValue) {
-    auto itr = mSumOverPastBuckets.find(key);
-    if (itr == mSumOverPastBuckets.end()) {
-        return;
-    }
-    itr->second -= bucketValue;
-    if (itr->second == 0) {
-        mSumOverPastBuckets.erase(itr);
-    }
-}
-
-void AnomalyTracker::addBucketToSum(const shared_ptr<DimToValMap>& bucket) {
     if (bucket == nullptr) {
         return;
     }
-    // For each dimension present in the bucket, add its value to its corresponding sum.
-    for (const auto& keyValuePair : *bucket) {
-        mSumOverPastBuckets[keyValuePair.first] += keyValuePair.second;
+    for (const auto& [key, value] : *bucket) {
+        setPastBucketValue(getOrCreateDimensionId(key), bucketNum, value);
     }
 }
 
@@ -178,18 +229,18 @@ int64_t AnomalyTracker::getPastBucketValue(const MetricDimensionKey& key,
         return 0;
     }
 
-    const auto& bucket = mPastBuckets[index(bucketNum)];
-    if (bucket == nullptr) {
+    const auto& itr = mDimensionIds.find(key);
+    if (itr == mDimensionIds.end() || bucketNum > mSyncedBucketNums[itr->second]) {
+        // The value in the ring is stale.
         return 0;
     }
-    const auto& itr = bucket->find(key);
-    return itr == bucket->end() ? 0 : itr->second;
+    return mPastBucketValues[itr->second * mNumOfPastBuckets + index(bucketNum)];
 }
 
 int64_t AnomalyTracker::getSumOverPastBuckets(const MetricDimensionKey& key) const {
-    const auto& itr = mSumOverPastBuckets.find(key);
-    if (itr != mSumOverPastBuckets.end()) {
-        return itr->second;
+    const auto& itr = mDimensionIds.find(key);
+    if (itr != mDimensionIds.end()) {
+        return mPastBucketSums[itr->second] - getStaleSum(itr->second);
     }
     return 0;
 }
@@ -265,6 +316,9 @@ bool AnomalyTracker::isInRefractoryPeriod(const int64_t& timestampNs,
 }
 
 std::pair<optional<InvalidConfigReason>, uint64_t> AnomalyTracker::getProtoHash() const {
+    if (mProtoHash.has_value()) {
+        return {nullopt, *mProtoHash};
+    }
     string serializedAlert;
     if (!mAlert.SerializeToString(&serializedAlert)) {
         ALOGW("Unable to serialize alert %lld", (long long)mAlert.id());
@@ -272,7 +326,8 @@ std::pair<optional<InvalidConfigReason>, uint64_t> AnomalyTracker::getProtoHash(
                                                    mAlert.metric_id(), mAlert.id()),
                 0};
     }
-    return {nullopt, Hash64(serializedAlert)};
+    mProtoHash = Hash64(serializedAlert);
+    return {nullopt, *mProtoHash};
 }
 
 void AnomalyTracker::informSubscribers(const MetricDimensionKey& key, int64_t metric_id,
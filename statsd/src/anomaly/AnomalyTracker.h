@@ -160,6 +160,9 @@ protected:
     // statsd_config.proto Alert message that defines this tracker.
     const Alert mAlert;
 
+    // Hash of mAlert, computed on the first config update that checks whether the alert changed.
+    mutable optional<uint64_t> mProtoHash;
+
     // The subscriptions that depend on this alert.
     std::vector<Subscription> mSubscriptions;
 
@@ -170,14 +173,6 @@ protected:
     // for the anomaly detection (since the current bucket is not in the past).
     const int mNumOfPastBuckets;
 
-    // Values for each of the past mNumOfPastBuckets buckets. Always of size mNumOfPastBuckets.
-    // mPastBuckets[i] can be null, meaning that no data is present in that bucket.
-    std::vector<shared_ptr<DimToValMap>> mPastBuckets;
-
-    // Cached sum over all existing buckets in mPastBuckets.
-    // Its buckets never contain entries of 0.
-    DimToValMap mSumOverPastBuckets;
-
     // The bucket number of the last added bucket.
     int64_t mMostRecentBucketNum = -1;
 
@@ -187,20 +182,51 @@ protected:
     // Entries may be, but are not guaranteed to be, removed after the period is finished.
     unordered_map<MetricDimensionKey, uint32_t> mRefractoryPeriodEndsSec;
 
+    // Interned id of each dimension with past bucket data, indexing the vectors below.
+    unordered_map<MetricDimensionKey, int> mDimensionIds;
+
+    // Ids of removed dimensions, reused for new ones.
+    std::vector<int> mFreeDimensionIds;
+
+    // Ring of the past mNumOfPastBuckets bucket values of each dimension, the value of a bucket
+    // is at mPastBucketValues[id * mNumOfPastBuckets + index(bucketNum)].
+    // The ring of a dimension is only brought up to date with mMostRecentBucketNum when the
+    // dimension is written, so that advancing buckets does not visit every dimension. Up to
+    // that, the values of the buckets after mSyncedBucketNums[id] are stale.
+    std::vector<int64_t> mPastBucketValues;
+
+    // Sum over the ring of each dimension, stale values included.
+    std::vector<int64_t> mPastBucketSums;
+
+    // mMostRecentBucketNum when the ring of each dimension was last brought up to date.
+    std::vector<int64_t> mSyncedBucketNums;
+
+    // mMostRecentBucketNum when the dimensions without past data were last removed.
+    int64_t mLastCompactionBucketNum = -1;
+
     // Advances mMostRecentBucketNum to bucketNum, deleting any data that is now too old.
     // Specifically, since it is now too old, removes the data for
     //   [mMostRecentBucketNum - mNumOfPastBuckets + 1, bucketNum - mNumOfPastBuckets].
     void advanceMostRecentBucketTo(const int64_t& bucketNum);
 
-    // Add the information in the given bucket to mSumOverPastBuckets.
-    void addBucketToSum(const shared_ptr<DimToValMap>& bucket);
+    // Returns the interned id of the dimension, adding it if needed. Its ring is up to date.
+    int getOrCreateDimensionId(const MetricDimensionKey& key);
+
+    // Removes the stale values from the ring of the dimension.
+    void syncDimension(int id);
 
-    // Subtract the information in the given bucket from mSumOverPastBuckets
-    // and remove any items with value 0.
-    void subtractBucketFromSum(const shared_ptr<DimToValMap>& bucket);
+    // Returns the sum of the stale values in the ring of the dimension.
+    int64_t getStaleSum(int id) const;
 
-    // From mSumOverPastBuckets[key], subtracts bucketValue, removing it if it is now 0.
-    void subtractValueFromSum(const MetricDimensionKey& key, const int64_t& bucketValue);
+    // Sets the value of a past bucket, which must be within the ring, for the dimension.
+    void setPastBucketValue(int id, const int64_t& bucketNum, const int64_t& bucketValue);
+
+    // Removes the dimensions without past data.
+    void compactDimensions();
+
+    // For testing only.
+    // Returns the number of dimensions whose sum over past buckets is not 0.
+    size_t getNumOfDimensionsWithPastData() const;
 
     // Returns true if in the refractory period, else false.
     bool isInRefractoryPeriod(const int64_t& timestampNs, const MetricDimensionKey& key) const;
@@ -18,6 +18,9 @@
 #include "Log.h"
 
 #include "DurationAnomalyTracker.h"
+
+#include <algorithm>
+
 #include "guardrail/StatsdStats.h"
 
 namespace android {
@@ -49,7 +52,8 @@ void DurationAnomalyTracker::startAlarm(const MetricDimensionKey& dimensionKey,
         mAlarmMonitor->remove(itr->second);
     }
 
-    sp<const InternalAlarm> alarm = new InternalAlarm{timestampSec};
+    sp<const InternalAlarm> alarm = new InternalAlarm{
+            timestampSec, static_cast<uint32_t>(std::max(mAlert.alarm_slack_secs(), 0))};
     mAlarms[dimensionKey] = alarm;
     if (mAlarmMonitor != nullptr) {
         mAlarmMonitor->add(alarm);
@@ -19,9 +19,7 @@
 
 #include "subscriber_util.h"
 
-#include "external/Perfetto.h"
-#include "subscriber/IncidentdReporter.h"
-#include "subscriber/SubscriberReporter.h"
+#include "subscriber/SubscriberDispatcher.h"
 
 namespace android {
 namespace os {
@@ -45,26 +43,8 @@ void triggerSubscribers(const int64_t ruleId, const int64_t metricId,
             ALOGI("Fate decided that a subscriber would not be informed.");
             continue;
         }
-        switch (subscription.subscriber_information_case()) {
-            case Subscription::SubscriberInformationCase::kIncidentdDetails:
-                if (!GenerateIncidentReport(subscription.incidentd_details(), ruleId, metricId,
-                                            dimensionKey, metricValue, configKey)) {
-                    ALOGW("Failed to generate incident report.");
-                }
-                break;
-            case Subscription::SubscriberInformationCase::kPerfettoDetails:
-                if (!CollectPerfettoTraceAndUploadToDropbox(subscription.perfetto_details(),
-                                                            subscription.id(), ruleId, configKey)) {
-                    ALOGW("Failed to generate perfetto traces.");
-                }
-                break;
-            case Subscription::SubscriberInformationCase::kBroadcastSubscriberDetails:
-                SubscriberReporter::getInstance().alertBroadcastSubscriber(configKey, subscription,
-                                                                           dimensionKey);
-                break;
-            default:
-                break;
-        }
+        SubscriberDispatcher::getInstance().dispatch(subscription, ruleId, metricId, dimensionKey,
+                                                     metricValue, configKey);
     }
 }
 
@@ -54,7 +54,7 @@ public:
                         std::vector<ConditionState>& conditionCache) const override;
 
     // Only one child predicate can have dimension.
-    const std::set<HashableDimensionKey>* getChangedToTrueDimensions(
+    const ChangedDimensions* getChangedToTrueDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
         for (const auto& child : mChildren) {
             auto result = allConditions[child]->getChangedToTrueDimensions(allConditions);
@@ -66,7 +66,7 @@ public:
     }
 
     // Only one child predicate can have dimension.
-    const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
+    const ChangedDimensions* getChangedToFalseDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
         for (const auto& child : mChildren) {
             auto result = allConditions[child]->getChangedToFalseDimensions(allConditions);
@@ -77,17 +77,33 @@ public:
         return nullptr;
     }
 
+    const std::vector<int>& getChildren() const override {
+        return mChildren;
+    }
+
     bool IsSimpleCondition() const  override { return false; }
 
     bool IsChangedDimensionTrackable() const  override {
         return mLogicalOperation == LogicalOperation::AND && mSlicedChildren.size() == 1;
     }
 
+    // Whatever the operation, a condition with a single sliced child only changes for the
+    // dimensions the child changed, or for all of them when its unsliced part changes. Nested
+    // sliced combinations are not attributed, as their unsliced part is not visible here.
+    optional<int64_t> getChangedDimensionSourceId(
+            const std::vector<sp<ConditionTracker>>& allConditions) const override {
+        if (mSlicedChildren.size() != 1 ||
+            !allConditions[mSlicedChildren.front()]->IsSimpleCondition()) {
+            return nullopt;
+        }
+        return allConditions[mSlicedChildren.front()]->getChangedDimensionSourceId(allConditions);
+    }
+
     bool equalOutputDimensions(
         const std::vector<sp<ConditionTracker>>& allConditions,
         const vector<Matcher>& dimensions) const override;
 
-    const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(
+    const SlicedConditionStateMap* getSlicedDimensionMap(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
         if (mSlicedChildren.size() == 1) {
             return allConditions[mSlicedChildren.front()]->getSlicedDimensionMap(allConditions);
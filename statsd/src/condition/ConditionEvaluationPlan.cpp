@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ConditionEvaluationPlan.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+// Ranks conditionIndex after its descendants. The condition graph was checked for cycles when
+// the conditions were initialized.
+void rankChildrenFirst(const vector<sp<ConditionTracker>>& allConditionTrackers,
+                       const int conditionIndex, int& nextRank, vector<int>& ranks) {
+    if (ranks[conditionIndex] >= 0) {
+        return;
+    }
+    for (const int childIndex : allConditionTrackers[conditionIndex]->getChildren()) {
+        rankChildrenFirst(allConditionTrackers, childIndex, nextRank, ranks);
+    }
+    ranks[conditionIndex] = nextRank++;
+}
+
+void collectDescendants(const vector<sp<ConditionTracker>>& allConditionTrackers,
+                        const int conditionIndex, vector<bool>& collected,
+                        vector<int>& conditions) {
+    if (collected[conditionIndex]) {
+        return;
+    }
+    collected[conditionIndex] = true;
+    conditions.push_back(conditionIndex);
+    for (const int childIndex : allConditionTrackers[conditionIndex]->getChildren()) {
+        collectDescendants(allConditionTrackers, childIndex, collected, conditions);
+    }
+}
+
+}  // anonymous namespace
+
+void ConditionEvaluationPlan::build(const vector<sp<ConditionTracker>>& allConditionTrackers,
+                                    const unordered_map<int, vector<int>>& trackerToConditionMap) {
+    clear();
+
+    mRanks.assign(allConditionTrackers.size(), -1);
+    int nextRank = 0;
+    for (size_t i = 0; i < allConditionTrackers.size(); i++) {
+        rankChildrenFirst(allConditionTrackers, i, nextRank, mRanks);
+    }
+
+    vector<bool> collected(allConditionTrackers.size(), false);
+    for (const auto& [matcherIndex, conditionIndices] : trackerToConditionMap) {
+        vector<int>& conditions = mTrackerToConditions[matcherIndex];
+        for (const int conditionIndex : conditionIndices) {
+            collectDescendants(allConditionTrackers, conditionIndex, collected, conditions);
+        }
+        std::sort(conditions.begin(), conditions.end(),
+                  [this](int a, int b) { return mRanks[a] < mRanks[b]; });
+        for (const int conditionIndex : conditions) {
+            collected[conditionIndex] = false;
+        }
+    }
+}
+
+void ConditionEvaluationPlan::clear() {
+    mRanks.clear();
+    mTrackerToConditions.clear();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
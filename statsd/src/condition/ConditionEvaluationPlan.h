@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "condition/ConditionTracker.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The order in which the ConditionTrackers of a config are evaluated for a matched event.
+ *
+ * Built once per config init/update. Each condition gets a rank in an order of all the conditions
+ * where children come before their parents, and each matcher lists the conditions it is used by
+ * together with all their descendants, by rank. Evaluating the conditions of an event by rank
+ * finds the children of every CombinationConditionTracker already evaluated, so the evaluation
+ * never recurses.
+ */
+class ConditionEvaluationPlan {
+public:
+    /**
+     * Rebuilds the plan from the conditions and the matcher index to condition indices map.
+     */
+    void build(const std::vector<sp<ConditionTracker>>& allConditionTrackers,
+               const std::unordered_map<int, std::vector<int>>& trackerToConditionMap);
+
+    /**
+     * Returns the conditions to evaluate when the matcher matches, by rank.
+     */
+    const std::vector<int>& getConditions(const int matcherIndex) const {
+        static const std::vector<int> kNoConditions;
+        const auto it = mTrackerToConditions.find(matcherIndex);
+        return it == mTrackerToConditions.end() ? kNoConditions : it->second;
+    }
+
+    int getRank(const int conditionIndex) const {
+        return mRanks[conditionIndex];
+    }
+
+    void clear();
+
+private:
+    // Indexed by condition index.
+    std::vector<int> mRanks;
+
+    std::unordered_map<int, std::vector<int>> mTrackerToConditions;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "condition/ConditionQueryCache.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+namespace {
+
+bool equalLinks(const vector<Metric2Condition>& links1, const vector<Metric2Condition>& links2) {
+    if (&links1 == &links2) {
+        return true;
+    }
+    if (links1.size() != links2.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < links1.size(); i++) {
+        if (links1[i].conditionId != links2[i].conditionId ||
+            !equalDimensions(links1[i].metricFields, links2[i].metricFields) ||
+            !equalDimensions(links1[i].conditionFields, links2[i].conditionFields)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+void ConditionQueryCache::setCurrentEvent(const LogEvent* event) {
+    mCurrentEvent = event;
+    mEntries.clear();
+}
+
+const ConditionQueryCache::Entry* ConditionQueryCache::find(const LogEvent& event,
+                                                            const int conditionIndex,
+                                                            const vector<Metric2Condition>& links,
+                                                            const bool isPartialLink) const {
+    if (&event != mCurrentEvent) {
+        return nullptr;
+    }
+    for (const Entry& entry : mEntries) {
+        if (entry.conditionIndex == conditionIndex && entry.isPartialLink == isPartialLink &&
+            equalLinks(*entry.links, links)) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void ConditionQueryCache::add(const LogEvent& event, const int conditionIndex,
+                              const vector<Metric2Condition>& links, const bool isPartialLink,
+                              const ConditionKey& conditionKey,
+                              const ConditionState conditionState) {
+    if (&event != mCurrentEvent) {
+        return;
+    }
+    mEntries.push_back({conditionIndex, isPartialLink, &links, conditionKey, conditionState});
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
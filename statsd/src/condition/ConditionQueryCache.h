@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <vector>
+
+#include "HashableDimensionKey.h"
+#include "condition/condition_util.h"
+#include "logd/LogEvent.h"
+#include "stats_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Held by the MetricProducers of one MetricsManager. Metrics that share a sliced condition with
+// the same Metric2Condition links build the same condition key from an event and get the same
+// answer from ConditionWizard::query. The MetricsManager marks the event it is dispatching to its
+// metrics, and the first metric to query the condition for it leaves the result here for the
+// others.
+//
+// Not thread safe, this is used under the lock of the StatsLogProcessor like the rest of the
+// MetricsManager.
+class ConditionQueryCache : public virtual RefBase {
+public:
+    struct Entry {
+        int conditionIndex;
+        bool isPartialLink;
+        // Owned by the metric that made the entry, which outlives the event.
+        const std::vector<Metric2Condition>* links;
+        ConditionKey conditionKey;
+        ConditionState conditionState;
+    };
+
+    // Entries are only returned for event until the next call. Pass nullptr once the event has
+    // been dispatched.
+    void setCurrentEvent(const LogEvent* event);
+
+    // Returns the entry for the condition and links if one was added for the current event, or
+    // nullptr.
+    const Entry* find(const LogEvent& event, const int conditionIndex,
+                      const std::vector<Metric2Condition>& links, const bool isPartialLink) const;
+
+    // Adds an entry for the current event, does nothing for other events.
+    void add(const LogEvent& event, const int conditionIndex,
+             const std::vector<Metric2Condition>& links, const bool isPartialLink,
+             const ConditionKey& conditionKey, const ConditionState conditionState);
+
+private:
+    const LogEvent* mCurrentEvent = nullptr;
+
+    // A few entries at most per event, searched linearly.
+    std::vector<Entry> mEntries;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -116,6 +116,13 @@ public:
         return mTrackerIndex;
     }
 
+    // return the list of children ConditionTracker index that this ConditionTracker evaluates.
+    // Only CombinationConditionTrackers have children.
+    virtual const std::vector<int>& getChildren() const {
+        static const std::vector<int> kNoChildren;
+        return kNoChildren;
+    }
+
     virtual void setSliced(bool sliced) {
         mSliced = mSliced | sliced;
     }
@@ -124,11 +131,16 @@ public:
         return mSliced;
     }
 
-    virtual const std::set<HashableDimensionKey>* getChangedToTrueDimensions(
+    virtual const ChangedDimensions* getChangedToTrueDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const = 0;
-    virtual const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
+    virtual const ChangedDimensions* getChangedToFalseDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const = 0;
 
+    // Estimated heap bytes of the state kept for the condition slices.
+    virtual size_t byteSize() const {
+        return 0;
+    }
+
     inline int64_t getConditionId() const {
         return mConditionId;
     }
@@ -137,17 +149,27 @@ public:
         return mProtoHash;
     }
 
-    virtual const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(
+    virtual const SlicedConditionStateMap* getSlicedDimensionMap(
             const std::vector<sp<ConditionTracker>>& allConditions) const = 0;
 
     virtual bool IsChangedDimensionTrackable() const = 0;
 
+    // Returns the id of the sliced simple condition whose changed dimensions account for every
+    // change of this condition that does not come from a change of its unsliced part, or nullopt
+    // if the changes can't be attributed to dimensions.
+    virtual optional<int64_t> getChangedDimensionSourceId(
+            const std::vector<sp<ConditionTracker>>& allConditions) const = 0;
+
     virtual bool IsSimpleCondition() const = 0;
 
     virtual bool equalOutputDimensions(
         const std::vector<sp<ConditionTracker>>& allConditions,
         const vector<Matcher>& dimensions) const = 0;
 
+    // Adds the top-level fields that the condition reads from events to fieldMasks.
+    virtual void addFieldsInUse(AtomFieldMasks* fieldMasks) const {
+    }
+
     // Return the current condition state of the unsliced part of the condition.
     inline ConditionState getUnSlicedPartConditionState() const  {
         return mUnSlicedPartCondition;
@@ -31,12 +31,12 @@ ConditionState ConditionWizard::query(const int index, const ConditionKey& param
     return cache[index];
 }
 
-const set<HashableDimensionKey>* ConditionWizard::getChangedToTrueDimensions(
+const ChangedDimensions* ConditionWizard::getChangedToTrueDimensions(
         const int index) const {
     return mAllConditions[index]->getChangedToTrueDimensions(mAllConditions);
 }
 
-const set<HashableDimensionKey>* ConditionWizard::getChangedToFalseDimensions(
+const ChangedDimensions* ConditionWizard::getChangedToFalseDimensions(
         const int index) const {
     return mAllConditions[index]->getChangedToFalseDimensions(mAllConditions);
 }
@@ -49,6 +49,14 @@ bool ConditionWizard::IsChangedDimensionTrackable(const int index) {
     }
 }
 
+optional<int64_t> ConditionWizard::getChangedDimensionSourceId(const int index) {
+    if (index >= 0 && index < (int)mAllConditions.size()) {
+        return mAllConditions[index]->getChangedDimensionSourceId(mAllConditions);
+    } else {
+        return nullopt;
+    }
+}
+
 bool ConditionWizard::IsSimpleCondition(const int index) {
     if (index >= 0 && index < (int)mAllConditions.size()) {
         return mAllConditions[index]->IsSimpleCondition();
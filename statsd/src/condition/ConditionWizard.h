@@ -42,19 +42,19 @@ public:
     virtual ConditionState query(const int conditionIndex, const ConditionKey& conditionParameters,
                                  const bool isPartialLink);
 
-    virtual const std::set<HashableDimensionKey>* getChangedToTrueDimensions(const int index) const;
-    virtual const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
-            const int index) const;
+    virtual const ChangedDimensions* getChangedToTrueDimensions(const int index) const;
+    virtual const ChangedDimensions* getChangedToFalseDimensions(const int index) const;
     bool equalOutputDimensions(const int index, const vector<Matcher>& dimensions);
 
     bool IsChangedDimensionTrackable(const int index);
+    optional<int64_t> getChangedDimensionSourceId(const int index);
     bool IsSimpleCondition(const int index);
 
     ConditionState getUnSlicedPartConditionState(const int index) {
         return mAllConditions[index]->getUnSlicedPartConditionState();
     }
 
-    const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(const int index) const {
+    const SlicedConditionStateMap* getSlicedDimensionMap(const int index) const {
         return mAllConditions[index]->getSlicedDimensionMap(mAllConditions);
     }
 
@@ -154,7 +154,7 @@ void SimpleConditionTracker::handleStopAll(std::vector<ConditionState>& conditio
 
     for (const auto& cond : mSlicedConditionState) {
         if (cond.second > 0) {
-            mLastChangedToFalseDimensions.insert(cond.first);
+            mLastChangedToFalseDimensions.push_back(cond.first);
         }
     }
 
@@ -201,12 +201,12 @@ void SimpleConditionTracker::handleConditionEvent(const HashableDimensionKey& ou
         if (matchStart && mInitialValue != ConditionState::kTrue) {
             mSlicedConditionState[outputKey] = 1;
             changed = true;
-            mLastChangedToTrueDimensions.insert(outputKey);
+            mLastChangedToTrueDimensions.push_back(outputKey);
         } else if (mInitialValue != ConditionState::kFalse) {
             // it's a stop and we don't have history about it.
             // If the default condition is not false, it means this stop is valuable to us.
             mSlicedConditionState[outputKey] = 0;
-            mLastChangedToFalseDimensions.insert(outputKey);
+            mLastChangedToFalseDimensions.push_back(outputKey);
             changed = true;
         }
     } else {
@@ -216,7 +216,7 @@ void SimpleConditionTracker::handleConditionEvent(const HashableDimensionKey& ou
         newCondition = startedCount > 0 ? ConditionState::kTrue : ConditionState::kFalse;
         if (matchStart) {
             if (startedCount == 0) {
-                mLastChangedToTrueDimensions.insert(outputKey);
+                mLastChangedToTrueDimensions.push_back(outputKey);
                 // This condition for this output key will change from false -> true
                 changed = true;
             }
@@ -240,7 +240,7 @@ void SimpleConditionTracker::handleConditionEvent(const HashableDimensionKey& ou
                 }
                 // if everything has stopped for this output key, condition true -> false;
                 if (startedCount == 0) {
-                    mLastChangedToFalseDimensions.insert(outputKey);
+                    mLastChangedToFalseDimensions.push_back(outputKey);
                     changed = true;
                 }
             }
@@ -335,7 +335,7 @@ void SimpleConditionTracker::evaluateCondition(
                              &overallChanged);
     } else if (!mContainANYPositionInInternalDimensions) {
         HashableDimensionKey outputValue;
-        filterValues(mOutputDimensions, event.getValues(), &outputValue);
+        filterValues(mOutputDimensions, event, &outputValue);
 
         // If this event has multiple nodes in the attribution chain,  this log event probably will
         // generate multiple dimensions. If so, we will find if the condition changes for any
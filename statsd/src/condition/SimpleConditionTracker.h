@@ -58,7 +58,7 @@ public:
                         const bool isPartialLink,
                         std::vector<ConditionState>& conditionCache) const override;
 
-    virtual const std::set<HashableDimensionKey>* getChangedToTrueDimensions(
+    virtual const ChangedDimensions* getChangedToTrueDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const {
         if (mSliced) {
             return &mLastChangedToTrueDimensions;
@@ -67,7 +67,7 @@ public:
         }
     }
 
-    virtual const std::set<HashableDimensionKey>* getChangedToFalseDimensions(
+    virtual const ChangedDimensions* getChangedToFalseDimensions(
             const std::vector<sp<ConditionTracker>>& allConditions) const {
         if (mSliced) {
             return &mLastChangedToFalseDimensions;
@@ -76,13 +76,21 @@ public:
         }
     }
 
-    const std::map<HashableDimensionKey, int>* getSlicedDimensionMap(
+    const SlicedConditionStateMap* getSlicedDimensionMap(
             const std::vector<sp<ConditionTracker>>& allConditions) const override {
         return &mSlicedConditionState;
     }
 
     bool IsChangedDimensionTrackable() const  override { return true; }
 
+    optional<int64_t> getChangedDimensionSourceId(
+            const std::vector<sp<ConditionTracker>>& allConditions) const override {
+        if (mSliced) {
+            return mConditionId;
+        }
+        return nullopt;
+    }
+
     bool IsSimpleCondition() const  override { return true; }
 
     bool equalOutputDimensions(
@@ -91,6 +99,16 @@ public:
             return equalDimensions(mOutputDimensions, dimensions);
     }
 
+    void addFieldsInUse(AtomFieldMasks* fieldMasks) const override {
+        addTopLevelFields(mOutputDimensions, fieldMasks);
+    }
+
+    size_t byteSize() const override {
+        return estimateMapByteSize(mSlicedConditionState) +
+               sizeof(HashableDimensionKey) * (mLastChangedToTrueDimensions.capacity() +
+                                               mLastChangedToFalseDimensions.capacity());
+    }
+
 private:
     const ConfigKey mConfigKey;
     // The index of the LogEventMatcher which defines the start.
@@ -111,10 +129,11 @@ private:
 
     bool mContainANYPositionInInternalDimensions;
 
-    std::set<HashableDimensionKey> mLastChangedToTrueDimensions;
-    std::set<HashableDimensionKey> mLastChangedToFalseDimensions;
+    // Cleared before each evaluated event, so they only hold the dimensions that changed with it.
+    ChangedDimensions mLastChangedToTrueDimensions;
+    ChangedDimensions mLastChangedToFalseDimensions;
 
-    std::map<HashableDimensionKey, int> mSlicedConditionState;
+    SlicedConditionStateMap mSlicedConditionState;
 
     void setMatcherIndices(const SimplePredicate& predicate,
                            const std::unordered_map<int64_t, int>& logTrackerMap);
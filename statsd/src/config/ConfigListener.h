@@ -20,6 +20,9 @@
 
 #include <utils/RefBase.h>
 
+#include <utility>
+#include <vector>
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -39,6 +42,17 @@ public:
     virtual void OnConfigUpdated(const int64_t timestampNs, const ConfigKey& key,
                                  const StatsdConfig& config, bool modularUpdate = true) = 0;
 
+    /**
+     * Configurations were added or updated together, such as the ones saved on disk at boot. By
+     * default, they are handled one by one.
+     */
+    virtual void OnConfigsUpdated(const int64_t timestampNs,
+                                  const std::vector<std::pair<ConfigKey, StatsdConfig>>& configs) {
+        for (const auto& [key, config] : configs) {
+            OnConfigUpdated(timestampNs, key, config);
+        }
+    }
+
     /**
      * A configuration was removed.
      */
@@ -51,10 +51,28 @@ ConfigManager::~ConfigManager() {
 }
 
 void ConfigManager::Startup() {
-    map<ConfigKey, StatsdConfig> configsFromDisk;
-    StorageManager::readConfigFromDisk(configsFromDisk);
-    for (const auto& pair : configsFromDisk) {
-        UpdateConfig(pair.first, pair.second);
+    // The saved configs are handed to the listeners as one batch, so that they are applied in one
+    // pass. They all get the same timestamp, so the initial pulls of their first buckets ask the
+    // pullers for the same event time, and are served the first pull of each atom from the cache.
+    const int64_t timestampNs = getElapsedRealtimeNs();
+    vector<pair<ConfigKey, StatsdConfig>> configs;
+    vector<sp<ConfigListener>> broadcastList;
+    {
+        lock_guard<mutex> lock(mMutex);
+        StorageManager::readConfigFromDisk(
+                [this, &configs](const ConfigKey& key, const StatsdConfig& config,
+                                 const string& fileName) {
+                    if (addConfigLocked(key, config, &fileName)) {
+                        configs.emplace_back(key, config);
+                    }
+                });
+        broadcastList = mListeners;
+    }
+    if (configs.empty()) {
+        return;
+    }
+    for (const sp<ConfigListener>& listener : broadcastList) {
+        listener->OnConfigsUpdated(timestampNs, configs);
     }
 }
 
@@ -70,40 +88,10 @@ void ConfigManager::AddListener(const sp<ConfigListener>& listener) {
 void ConfigManager::UpdateConfig(const ConfigKey& key, const StatsdConfig& config) {
     vector<sp<ConfigListener>> broadcastList;
     {
-        lock_guard <mutex> lock(mMutex);
-
-        const int numBytes = config.ByteSize();
-        vector<uint8_t> buffer(numBytes);
-        config.SerializeToArray(buffer.data(), numBytes);
-
-        auto uidIt = mConfigs.find(key.GetUid());
-        // GuardRail: Limit the number of configs per uid.
-        if (uidIt != mConfigs.end()) {
-            auto it = uidIt->second.find(key);
-            if (it == uidIt->second.end() &&
-                uidIt->second.size() >= StatsdStats::kMaxConfigCountPerUid) {
-                ALOGE("ConfigManager: uid %d has exceeded the config count limit", key.GetUid());
-                return;
-            }
-        }
-
-        // Check if it's a duplicate config.
-        if (uidIt != mConfigs.end() && uidIt->second.find(key) != uidIt->second.end() &&
-            StorageManager::hasIdenticalConfig(key, buffer)) {
-            // This is a duplicate config.
-            ALOGI("ConfigManager This is a duplicate config %s", key.ToString().c_str());
-            // Update saved file on disk. We still update timestamp of file when
-            // there exists a duplicate configuration to avoid garbage collection.
-            update_saved_configs_locked(key, buffer, numBytes);
+        lock_guard<mutex> lock(mMutex);
+        if (!addConfigLocked(key, config, /*savedFileName=*/nullptr)) {
             return;
         }
-
-        // Update saved file on disk.
-        update_saved_configs_locked(key, buffer, numBytes);
-
-        // Add to set.
-        mConfigs[key.GetUid()].insert(key);
-
         broadcastList = mListeners;
     }
 
@@ -114,6 +102,51 @@ void ConfigManager::UpdateConfig(const ConfigKey& key, const StatsdConfig& confi
     }
 }
 
+bool ConfigManager::addConfigLocked(const ConfigKey& key, const StatsdConfig& config,
+                                    const string* savedFileName) {
+    // The saved file already holds the serialized config.
+    vector<uint8_t> buffer;
+    if (savedFileName == nullptr) {
+        buffer.resize(config.ByteSize());
+        config.SerializeToArray(buffer.data(), buffer.size());
+    }
+    const int numBytes = buffer.size();
+
+    auto uidIt = mConfigs.find(key.GetUid());
+    // GuardRail: Limit the number of configs per uid.
+    if (uidIt != mConfigs.end()) {
+        auto it = uidIt->second.find(key);
+        if (it == uidIt->second.end() &&
+            uidIt->second.size() >= StatsdStats::kMaxConfigCountPerUid) {
+            ALOGE("ConfigManager: uid %d has exceeded the config count limit", key.GetUid());
+            return false;
+        }
+    }
+
+    // Check if it's a duplicate config.
+    if (savedFileName == nullptr && uidIt != mConfigs.end() &&
+        uidIt->second.find(key) != uidIt->second.end() &&
+        StorageManager::hasIdenticalConfig(key, buffer)) {
+        // This is a duplicate config.
+        ALOGI("ConfigManager This is a duplicate config %s", key.ToString().c_str());
+        // Update saved file on disk. We still update timestamp of file when
+        // there exists a duplicate configuration to avoid garbage collection.
+        update_saved_configs_locked(key, buffer, numBytes);
+        return false;
+    }
+
+    // Update saved file on disk.
+    if (savedFileName != nullptr) {
+        refresh_saved_config_locked(key, *savedFileName);
+    } else {
+        update_saved_configs_locked(key, buffer, numBytes);
+    }
+
+    // Add to set.
+    mConfigs[key.GetUid()].insert(key);
+    return true;
+}
+
 void ConfigManager::SetConfigReceiver(const ConfigKey& key,
                                       const shared_ptr<IPendingIntentRef>& pir) {
     lock_guard<mutex> lock(mMutex);
@@ -255,6 +288,17 @@ void ConfigManager::RemoveConfig(const ConfigKey& key) {
     }
 }
 
+void ConfigManager::refresh_saved_config_locked(const ConfigKey& key,
+                                                const string& savedFileName) {
+    const string file_name =
+        StringPrintf("%s/%ld_%d_%lld", STATS_SERVICE_DIR, time(nullptr),
+                     key.GetUid(), (long long)key.GetId());
+    if (file_name != savedFileName && rename(savedFileName.c_str(), file_name.c_str()) != 0) {
+        ALOGE("Failed to refresh the saved config %s: %s", savedFileName.c_str(),
+              strerror(errno));
+    }
+}
+
 void ConfigManager::remove_saved_configs(const ConfigKey& key) {
     string suffix = StringPrintf("%d_%lld", key.GetUid(), (long long)key.GetId());
     StorageManager::deleteSuffixedFiles(STATS_SERVICE_DIR, suffix.c_str());
@@ -159,6 +159,14 @@ public:
 private:
     mutable std::mutex mMutex;
 
+    /**
+     * Adds or updates a config, returning false if the listeners need not be told. A config read
+     * from disk by Startup() passes the file it is saved in, which is renamed with the current
+     * time instead of serializing and writing the config again.
+     */
+    bool addConfigLocked(const ConfigKey& key, const StatsdConfig& config,
+                         const std::string* savedFileName);
+
     /**
      * Save the configs to disk.
      */
@@ -166,6 +174,11 @@ private:
                                      const std::vector<uint8_t>& buffer,
                                      const int numBytes);
 
+    /**
+     * Refreshes the timestamp of the saved config, to avoid its garbage collection.
+     */
+    void refresh_saved_config_locked(const ConfigKey& key, const std::string& savedFileName);
+
     /**
      * Remove saved configs from disk.
      */
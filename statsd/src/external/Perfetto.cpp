@@ -15,32 +15,75 @@
  */
 
 #define STATSD_DEBUG false  // STOPSHIP if true
+#define ATRACE_TAG ATRACE_TAG_ALWAYS
 #include "config/ConfigKey.h"
 #include "Log.h"
 
 #include "src/statsd_config.pb.h"  // Alert
 
 #include <android-base/unique_fd.h>
+#include <cutils/trace.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <spawn.h>
 #include <sys/wait.h>
 
 #include <string>
+#include <thread>
+
+extern char** environ;
 
 namespace {
 const char kDropboxTag[] = "perfetto";
+const char kPerfettoPath[] = "/system/bin/perfetto";
+// File descriptors of statsd below this value are closed in the Perfetto client.
+const int kMaxClosedFd = 1024;
 }
 
 namespace android {
 namespace os {
 namespace statsd {
 
+namespace {
+
+// Writes the trace config to the stdin of the Perfetto client and waits for it to detach.
+void passConfigToPerfettoClient(const pid_t pid, android::base::unique_fd writePipe,
+                                const std::string& cfgProto) {
+    // Using fdopen() because fwrite() has the right logic to chunking write()
+    // over a pipe (see __sfvwrite()).
+    FILE* writePipeStream = android::base::Fdopen(std::move(writePipe), "wb");
+    if (!writePipeStream) {
+        ALOGE("fdopen() failed while calling the Perfetto client: %s", strerror(errno));
+    } else {
+        const size_t bytesWritten = fwrite(cfgProto.data(), 1, cfgProto.size(), writePipeStream);
+        fclose(writePipeStream);
+        if (bytesWritten != cfgProto.size()) {
+            ALOGE("fwrite() failed (ret: %zd) while calling the Perfetto client: %s",
+                  bytesWritten, strerror(errno));
+        }
+    }
+
+    // This does NOT wait for the full duration of the trace. It just waits until
+    // the process has read the config from stdin and detached. The child is reaped even if
+    // the config could not be written, in which case it fails on its own.
+    int childStatus = 0;
+    waitpid(pid, &childStatus, 0);
+    if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0) {
+        ALOGE("Child process failed (0x%x) while calling the Perfetto client", childStatus);
+        return;
+    }
+    VLOG("Perfetto client detached");
+}
+
+}  // anonymous namespace
+
 bool CollectPerfettoTraceAndUploadToDropbox(const PerfettoDetails& config,
                                             int64_t subscription_id,
                                             int64_t alert_id,
                                             const ConfigKey& configKey) {
     VLOG("Starting trace collection through perfetto");
 
-    if (!config.has_trace_config()) {
+    if (!config.has_trace_config() || config.trace_config().empty()) {
         ALOGE("The perfetto trace config is empty, aborting");
         return false;
     }
@@ -61,77 +104,55 @@ bool CollectPerfettoTraceAndUploadToDropbox(const PerfettoDetails& config,
         return false;
     }
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        ALOGE("fork() failed while calling the Perfetto client: %s", strerror(errno));
-        return false;
+    // posix_spawn() does not copy the page tables of statsd's heap the way fork() does, so
+    // starting the client does not stall the alarm path. The file actions replace stdin with
+    // |readPipe| so the main process can write into it, replace stdout/stderr with /dev/null and
+    // close any other file descriptor. This is to avoid SELinux complaining about perfetto
+    // trying to access files accidentally left open by statsd (i.e. files that have been opened
+    // without the O_CLOEXEC flag).
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_adddup2(&fileActions, readPipe.get(), STDIN_FILENO);
+    posix_spawn_file_actions_addopen(&fileActions, STDOUT_FILENO, "/dev/null", O_RDWR, 0);
+    posix_spawn_file_actions_adddup2(&fileActions, STDOUT_FILENO, STDERR_FILENO);
+    for (int fd = STDERR_FILENO + 1; fd < kMaxClosedFd; fd++) {
+        posix_spawn_file_actions_addclose(&fileActions, fd);
     }
 
-    if (pid == 0) {
-        // Child process.
-
-        // No malloc calls or library calls after this point. Remember that even
-        // ALOGx (aka android_printLog()) can use dynamic memory for vsprintf().
-
-        writePipe.reset();  // Close the write end (owned by the main process).
-
-        // Replace stdin with |readPipe| so the main process can write into it.
-        if (dup2(readPipe.get(), STDIN_FILENO) < 0) _exit(1);
-        readPipe.reset();
-
-        // Replace stdout/stderr with /dev/null and close any other file
-        // descriptor. This is to avoid SELinux complaining about perfetto
-        // trying to access files accidentally left open by statsd (i.e. files
-        // that have been opened without the O_CLOEXEC flag).
-        int devNullFd = open("/dev/null", O_RDWR | O_CLOEXEC);
-        if (dup2(devNullFd, STDOUT_FILENO) < 0) _exit(2);
-        if (dup2(devNullFd, STDERR_FILENO) < 0) _exit(3);
-        close(devNullFd);
-        for (int i = 0; i < 1024; i++) {
-            if (i != STDIN_FILENO && i != STDOUT_FILENO && i != STDERR_FILENO) close(i);
-        }
-
-        execl("/system/bin/perfetto", "perfetto", "--background", "--config", "-", "--dropbox",
-              kDropboxTag, "--alert-id", alertId, "--config-id", configId, "--config-uid",
-              configUid, "--subscription-id", subscriptionId, nullptr);
-
-        // execl() doesn't return in case of success, if we get here something
-        // failed.
-        _exit(4);
+    const char* const argv[] = {"perfetto", "--background", "--config", "-", "--dropbox",
+                                kDropboxTag, "--alert-id", alertId, "--config-id", configId,
+                                "--config-uid", configUid, "--subscription-id", subscriptionId,
+                                nullptr};
+    pid_t pid = 0;
+    const int spawnError = posix_spawn(&pid, kPerfettoPath, &fileActions, nullptr,
+                                       const_cast<char* const*>(argv), environ);
+    posix_spawn_file_actions_destroy(&fileActions);
+    if (spawnError != 0) {
+        ALOGE("posix_spawn() failed while calling the Perfetto client: %s", strerror(spawnError));
+        return false;
     }
 
-    // Main process.
-
     readPipe.reset();  // Close the read end (owned by the child process).
 
-    // Using fdopen() because fwrite() has the right logic to chunking write()
-    // over a pipe (see __sfvwrite()).
-    FILE* writePipeStream = android::base::Fdopen(std::move(writePipe), "wb");
-    if (!writePipeStream) {
-        ALOGE("fdopen() failed while calling the Perfetto client: %s", strerror(errno));
-        return false;
-    }
+    // The client reads the config before it detaches, which can take a while for a large config
+    // or a busy system, so the wait happens off the caller's thread.
+    std::thread(passConfigToPerfettoClient, pid, std::move(writePipe), config.trace_config())
+            .detach();
 
-    const std::string& cfgProto = config.trace_config();
-    size_t bytesWritten = fwrite(cfgProto.data(), 1, cfgProto.size(), writePipeStream);
-    fclose(writePipeStream);
-    if (bytesWritten != cfgProto.size() || cfgProto.size() == 0) {
-        ALOGE("fwrite() failed (ret: %zd) while calling the Perfetto client: %s", bytesWritten,
-              strerror(errno));
-        return false;
-    }
+    VLOG("CollectPerfettoTraceAndUploadToDropbox() started the Perfetto client");
+    return true;
+}
 
-    // This does NOT wait for the full duration of the trace. It just waits until
-    // the process has read the config from stdin and detached.
-    int childStatus = 0;
-    waitpid(pid, &childStatus, 0);
-    if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0) {
-        ALOGE("Child process failed (0x%x) while calling the Perfetto client", childStatus);
-        return false;
-    }
+void TraceCounter(const char* name, int64_t value) {
+    ATRACE_INT64(name, value);
+}
 
-    VLOG("CollectPerfettoTraceAndUploadToDropbox() succeeded");
-    return true;
+void BeginTraceSlice(const char* name) {
+    ATRACE_BEGIN(name);
+}
+
+void EndTraceSlice() {
+    ATRACE_END();
 }
 
 }  // namespace statsd
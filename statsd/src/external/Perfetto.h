@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -25,13 +28,52 @@ class PerfettoDetails;  // Declared in statsd_config.pb.h
 
 // Starts the collection of a Perfetto trace with the given |config|.
 // The trace is uploaded to Dropbox by the perfetto cmdline util once done.
-// This method returns immediately after passing the config and does NOT wait
-// for the full duration of the trace.
+// This method returns as soon as the cmdline util is started. The config is
+// passed to it on a background thread, and failures past this point are only
+// logged.
 bool CollectPerfettoTraceAndUploadToDropbox(const PerfettoDetails& config,
                                             int64_t subscription_id,
                                             int64_t alert_id,
                                             const ConfigKey& configKey);
 
+// Sets the value of the named counter track in the system trace.
+void TraceCounter(const char* name, int64_t value);
+
+void BeginTraceSlice(const char* name);
+void EndTraceSlice();
+
+// Records a slice named |name| in the system trace for the lifetime of the object, around a stage
+// of statsd such as parsing or dispatching an event. Stage tracing is off unless enabled at boot,
+// in which case a stage costs one relaxed load.
+class ScopedStageTrace {
+public:
+    explicit ScopedStageTrace(const char* name)
+        : mTraced(sEnabled.load(std::memory_order_relaxed)) {
+        if (mTraced) {
+            BeginTraceSlice(name);
+        }
+    }
+
+    ~ScopedStageTrace() {
+        if (mTraced) {
+            EndTraceSlice();
+        }
+    }
+
+    ScopedStageTrace(const ScopedStageTrace&) = delete;
+    ScopedStageTrace& operator=(const ScopedStageTrace&) = delete;
+
+    static void setEnabled(bool enabled) {
+        sEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+private:
+    static inline std::atomic<bool> sEnabled = false;
+
+    // Whether the slice was begun, so it is ended even if tracing is disabled meanwhile.
+    const bool mTraced;
+};
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
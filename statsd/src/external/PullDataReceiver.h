@@ -16,8 +16,12 @@
 #pragma once
 
 #include <utils/RefBase.h>
+
+#include <optional>
+
 #include "StatsPuller.h"
 #include "logd/LogEvent.h"
+#include "puller_util.h"
 
 namespace android {
 namespace os {
@@ -39,6 +43,12 @@ class PullDataReceiver : virtual public RefBase{
                             PullResult pullResult, int64_t originalPullTimeNs) = 0;
 
   virtual bool isPullNeeded() const = 0;
+
+  // How the rows pulled for this receiver may be aggregated, nullopt if it needs them as pulled.
+  // Called with the puller manager locked, so it must not wait on a pull.
+  virtual std::optional<PullAggregation> getPullAggregation() const {
+    return std::nullopt;
+  }
 };
 
 }  // namespace statsd
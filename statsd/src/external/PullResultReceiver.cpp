@@ -16,18 +16,99 @@
 
 #include "PullResultReceiver.h"
 
+#include <string.h>
+
 namespace android {
 namespace os {
 namespace statsd {
 
+PulledEventBuffers::PulledEventBuffers(const vector<StatsEventParcel>& parcels)
+    : mParcels(&parcels) {
+}
+
+PulledEventBuffers::PulledEventBuffers(std::span<const uint8_t> packedEvents)
+    : mParcels(nullptr), mPackedEvents(packedEvents) {
+}
+
+bool PulledEventBuffers::forEach(
+        const function<void(const uint8_t* buffer, size_t size)>& visitor) const {
+    if (mParcels != nullptr) {
+        for (const StatsEventParcel& parcel : *mParcels) {
+            visitor(parcel.buffer.data(), parcel.buffer.size());
+        }
+        return true;
+    }
+    // format: |size of event 1|event 1|size of event 2|event 2|...
+    const uint8_t* buffer = mPackedEvents.data();
+    size_t remaining = mPackedEvents.size();
+    while (remaining > 0) {
+        uint32_t size;
+        if (remaining < sizeof(size)) {
+            return false;
+        }
+        memcpy(&size, buffer, sizeof(size));
+        buffer += sizeof(size);
+        remaining -= sizeof(size);
+        if (size > remaining) {
+            return false;
+        }
+        visitor(buffer, size);
+        buffer += size;
+        remaining -= size;
+    }
+    return true;
+}
+
 PullResultReceiver::PullResultReceiver(
-        std::function<void(int32_t, bool, const vector<StatsEventParcel>&)> pullFinishCb)
-    : pullFinishCallback(std::move(pullFinishCb)) {
+        std::function<void(int32_t, bool, const PulledEventBuffers&)> pullFinishCb,
+        std::function<void(int32_t, const PulledEventBuffers&)> pullPartialCb,
+        std::function<void(int32_t, bool, int64_t, int64_t, const PulledEventBuffers&)>
+                pullDeltaFinishCb)
+    : pullFinishCallback(std::move(pullFinishCb)),
+      pullPartialCallback(std::move(pullPartialCb)),
+      pullDeltaFinishCallback(std::move(pullDeltaFinishCb)) {
 }
 
 Status PullResultReceiver::pullFinished(int32_t atomTag, bool success,
                                         const vector<StatsEventParcel>& output) {
-    pullFinishCallback(atomTag, success, output);
+    pullFinishCallback(atomTag, success, PulledEventBuffers(output));
+    return Status::ok();
+}
+
+Status PullResultReceiver::pullPartial(int32_t atomTag, const vector<StatsEventParcel>& output) {
+    if (pullPartialCallback != nullptr) {
+        pullPartialCallback(atomTag, PulledEventBuffers(output));
+    }
+    return Status::ok();
+}
+
+Status PullResultReceiver::pullFinishedPacked(int32_t atomTag, bool success,
+                                              const vector<uint8_t>& packedEvents) {
+    pullFinishCallback(atomTag, success, PulledEventBuffers(packedEvents));
+    return Status::ok();
+}
+
+Status PullResultReceiver::pullPartialPacked(int32_t atomTag,
+                                             const vector<uint8_t>& packedEvents) {
+    if (pullPartialCallback != nullptr) {
+        pullPartialCallback(atomTag, PulledEventBuffers(packedEvents));
+    }
+    return Status::ok();
+}
+
+Status PullResultReceiver::pullFinishedDelta(int32_t atomTag, bool success,
+                                             int64_t baseGeneration, int64_t generation,
+                                             const vector<uint8_t>& packedEvents) {
+    if (pullDeltaFinishCallback != nullptr) {
+        pullDeltaFinishCallback(atomTag, success, baseGeneration, generation,
+                                PulledEventBuffers(packedEvents));
+    } else if (baseGeneration == 0) {
+        pullFinishCallback(atomTag, success, PulledEventBuffers(packedEvents));
+    } else {
+        // The rows left out of the delta are unknown here.
+        pullFinishCallback(atomTag, /*success=*/false,
+                           PulledEventBuffers(std::span<const uint8_t>()));
+    }
     return Status::ok();
 }
 
@@ -17,6 +17,8 @@
 #include <aidl/android/os/BnPullAtomResultReceiver.h>
 #include <aidl/android/util/StatsEventParcel.h>
 
+#include <span>
+
 using namespace std;
 
 using Status = ::ndk::ScopedAStatus;
@@ -27,10 +29,35 @@ namespace android {
 namespace os {
 namespace statsd {
 
+/**
+ * The event buffers of a pull result chunk, received either as a parcel per event or packed in
+ * a single buffer. Only refers to the binder call arguments, it must not outlive the call.
+ */
+class PulledEventBuffers {
+public:
+    explicit PulledEventBuffers(const vector<StatsEventParcel>& parcels);
+
+    explicit PulledEventBuffers(std::span<const uint8_t> packedEvents);
+
+    /**
+     * Calls visitor with the buffer of each event, in order. Returns false if the packed events
+     * are malformed, the events before the malformed one are still visited.
+     */
+    bool forEach(const function<void(const uint8_t* buffer, size_t size)>& visitor) const;
+
+private:
+    const vector<StatsEventParcel>* const mParcels;
+
+    const std::span<const uint8_t> mPackedEvents;
+};
+
 class PullResultReceiver : public BnPullAtomResultReceiver {
 public:
-    PullResultReceiver(function<void(int32_t, bool, const vector<StatsEventParcel>&)>
-                               pullFinishCallback);
+    PullResultReceiver(function<void(int32_t, bool, const PulledEventBuffers&)> pullFinishCallback,
+                       function<void(int32_t, const PulledEventBuffers&)> pullPartialCallback =
+                               nullptr,
+                       function<void(int32_t, bool, int64_t, int64_t, const PulledEventBuffers&)>
+                               pullDeltaFinishCallback = nullptr);
     ~PullResultReceiver();
 
     /**
@@ -39,8 +66,38 @@ public:
     Status pullFinished(int32_t atomTag, bool success,
                         const vector<StatsEventParcel>& output) override;
 
+    /**
+     * Binder call for delivering a chunk of a pull before it finishes.
+     */
+    Status pullPartial(int32_t atomTag, const vector<StatsEventParcel>& output) override;
+
+    /**
+     * Binder call for finishing a pull, with the events packed in a single buffer.
+     */
+    Status pullFinishedPacked(int32_t atomTag, bool success,
+                              const vector<uint8_t>& packedEvents) override;
+
+    /**
+     * Binder call for delivering a chunk of a pull, with the events packed in a single buffer.
+     */
+    Status pullPartialPacked(int32_t atomTag, const vector<uint8_t>& packedEvents) override;
+
+    /**
+     * Binder call for finishing a pull requested with onPullAtomDelta.
+     */
+    Status pullFinishedDelta(int32_t atomTag, bool success, int64_t baseGeneration,
+                             int64_t generation, const vector<uint8_t>& packedEvents) override;
+
 private:
-    function<void(int32_t, bool, const vector<StatsEventParcel>&)> pullFinishCallback;
+    function<void(int32_t, bool, const PulledEventBuffers&)> pullFinishCallback;
+
+    // Null if the receiver does not accept chunks, in which case they are dropped.
+    function<void(int32_t, const PulledEventBuffers&)> pullPartialCallback;
+
+    // Takes the base generation and the generation of the result. If null, the results that are
+    // full snapshots go to pullFinishCallback and the deltas fail the pull.
+    function<void(int32_t, bool, int64_t, int64_t, const PulledEventBuffers&)>
+            pullDeltaFinishCallback;
 };
 
 }  // namespace statsd
@@ -35,57 +35,211 @@ namespace android {
 namespace os {
 namespace statsd {
 
+namespace {
+
+// Parses one chunk of a pull as soon as it arrives, so its buffers can be freed before the next
+// chunk comes in. Only the fields in fieldMask are decoded, unless it is null. The strings are
+// interned in strings. Returns false if the chunk is malformed.
+bool parsePulledEvents(const PulledEventBuffers& output, const TopLevelFieldMask* fieldMask,
+                       StringValueInterner* strings, vector<shared_ptr<LogEvent>>* data) {
+    return output.forEach([fieldMask, strings, data](const uint8_t* buffer, size_t size) {
+        shared_ptr<LogEvent> event = make_shared<LogEvent>(/*uid=*/-1, /*pid=*/-1);
+        bool valid = event->parseBuffer(buffer, size, fieldMask, strings);
+        if (valid) {
+            data->push_back(event);
+        } else {
+            StatsdStats::getInstance().noteAtomError(event->GetTagId(), /*pull=*/true);
+        }
+    });
+}
+
+// The values of the key fields of a row of a delta pull.
+HashableDimensionKey getDeltaKey(const LogEvent& row, const vector<int>& deltaKeyFields) {
+    vector<FieldValue> keyValues;
+    keyValues.reserve(deltaKeyFields.size());
+    for (const int field : deltaKeyFields) {
+        const auto [start, end] = row.getTopLevelFieldRange(field);
+        keyValues.insert(keyValues.end(), row.getValues().begin() + start,
+                         row.getValues().begin() + end);
+    }
+    return HashableDimensionKey(keyValues);
+}
+
+}  // namespace
+
 StatsCallbackPuller::StatsCallbackPuller(int tagId, const shared_ptr<IPullAtomCallback>& callback,
                                          const int64_t coolDownNs, int64_t timeoutNs,
-                                         const vector<int> additiveFields)
-    : StatsPuller(tagId, coolDownNs, timeoutNs, additiveFields), mCallback(callback) {
+                                         const vector<int> additiveFields,
+                                         const vector<int> deltaKeyFields,
+                                         const bool supportsAggregation, const int32_t pullGroup)
+    : StatsPuller(tagId, coolDownNs, timeoutNs, additiveFields),
+      mCallback(callback),
+      mDeltaKeyFields(deltaKeyFields),
+      mSupportsAggregation(supportsAggregation && deltaKeyFields.empty()),
+      mPullGroup(deltaKeyFields.empty() ? pullGroup : 0),
+      mStrings(make_shared<StringValueInterner>()) {
     VLOG("StatsCallbackPuller created for tag %d", tagId);
 }
 
+bool StatsCallbackPuller::applyDelta(const int64_t baseGeneration, const int64_t generation,
+                                     vector<shared_ptr<LogEvent>>& rows,
+                                     vector<shared_ptr<LogEvent>>* data) {
+    if (baseGeneration == 0) {
+        resetDeltaSnapshot();
+    } else if (baseGeneration != mDeltaGeneration) {
+        // A delta against a result that is not held here, e.g. one that timed out. The next
+        // request asks for a full pull.
+        ALOGW("Delta pull for atom %d against generation %lld, holding %lld", mTagId,
+              (long long)baseGeneration, (long long)mDeltaGeneration);
+        resetDeltaSnapshot();
+        return false;
+    }
+    const int64_t pullTimeNs = getElapsedRealtimeNs();
+    vector<bool> changed(mDeltaSnapshot.size() + rows.size(), false);
+    for (shared_ptr<LogEvent>& row : rows) {
+        const auto [it, inserted] = mDeltaSnapshotIndex.try_emplace(
+                getDeltaKey(*row, mDeltaKeyFields), mDeltaSnapshot.size());
+        if (inserted) {
+            mDeltaSnapshot.push_back(std::move(row));
+        } else {
+            mDeltaSnapshot[it->second] = std::move(row);
+        }
+        changed[it->second] = true;
+    }
+    mDeltaGeneration = generation;
+
+    // The pulled events are modified downstream, e.g. when mapping isolated uids, so the snapshot
+    // hands out copies. The unchanged rows are stamped with the time of this pull.
+    data->reserve(mDeltaSnapshot.size());
+    for (size_t i = 0; i < mDeltaSnapshot.size(); i++) {
+        shared_ptr<LogEvent> row = make_shared<LogEvent>(*mDeltaSnapshot[i]);
+        if (!changed[i]) {
+            row->setElapsedTimestampNs(pullTimeNs);
+        }
+        data->push_back(std::move(row));
+    }
+    if (generation == 0) {
+        // The puller does not track its results, there is nothing to apply the next one to.
+        resetDeltaSnapshot();
+    }
+    return true;
+}
+
+void StatsCallbackPuller::resetDeltaSnapshot() {
+    mDeltaGeneration = 0;
+    mDeltaSnapshot.clear();
+    mDeltaSnapshotIndex.clear();
+}
+
 PullErrorCode StatsCallbackPuller::PullInternal(vector<shared_ptr<LogEvent>>* data) {
+    return pull(data, /*aggregation=*/nullptr, /*fieldMask=*/nullptr, /*groupAtomTags=*/nullptr,
+                mPullTimeoutNs);
+}
+
+PullErrorCode StatsCallbackPuller::PullSubsetInternal(
+        vector<shared_ptr<LogEvent>>* data, const std::optional<PullAggregation>& aggregation,
+        const std::optional<TopLevelFieldMask>& fieldMask) {
+    return pull(data, aggregation ? &*aggregation : nullptr, fieldMask ? &*fieldMask : nullptr,
+                /*groupAtomTags=*/nullptr, mPullTimeoutNs);
+}
+
+PullErrorCode StatsCallbackPuller::PullGroupInternal(const vector<int32_t>& atomTags,
+                                                     const int64_t timeoutNs,
+                                                     vector<shared_ptr<LogEvent>>* data) {
+    return pull(data, /*aggregation=*/nullptr, /*fieldMask=*/nullptr, &atomTags, timeoutNs);
+}
+
+PullErrorCode StatsCallbackPuller::pull(vector<shared_ptr<LogEvent>>* data,
+                                        const PullAggregation* aggregation,
+                                        const TopLevelFieldMask* fieldMask,
+                                        const vector<int32_t>* groupAtomTags,
+                                        const int64_t timeoutNs) {
     VLOG("StatsCallbackPuller called for tag %d", mTagId);
     if(mCallback == nullptr) {
         ALOGW("No callback registered");
         return PULL_FAIL;
     }
+    // Nothing parses into mStrings between pulls. The strings still held by the rows of earlier
+    // pulls, e.g. in gauge atoms or dimension keys, are kept for the rows of this one.
+    mStrings->prune();
 
     // Shared variables needed in the result receiver.
     shared_ptr<mutex> cv_mutex = make_shared<mutex>();
     shared_ptr<condition_variable> cv = make_shared<condition_variable>();
     shared_ptr<bool> pullFinish = make_shared<bool>(false);
     shared_ptr<bool> pullSuccess = make_shared<bool>(false);
+    shared_ptr<bool> pullChunkMalformed = make_shared<bool>(false);
+    // The generations of a delta pull result. Both are 0 for other results.
+    shared_ptr<int64_t> resultBaseGeneration = make_shared<int64_t>(0);
+    shared_ptr<int64_t> resultGeneration = make_shared<int64_t>(0);
     shared_ptr<vector<shared_ptr<LogEvent>>> sharedData =
             make_shared<vector<shared_ptr<LogEvent>>>();
+    shared_ptr<const TopLevelFieldMask> sharedFieldMask =
+            fieldMask != nullptr ? make_shared<const TopLevelFieldMask>(*fieldMask) : nullptr;
+
+    const shared_ptr<StringValueInterner> strings = mStrings;
+
+    const auto finishPull = [cv_mutex, cv, pullFinish, pullSuccess, pullChunkMalformed,
+                             resultBaseGeneration, resultGeneration, sharedData, sharedFieldMask,
+                             strings](bool success, int64_t baseGeneration,
+                                              int64_t generation,
+                                              const PulledEventBuffers& output) {
+        // This is the result of the pull, executing in a statsd binder thread.
+        // The pull could have taken a long time, and we should only modify
+        // data (the output param) if the pointer is in scope and the pull did not time out.
+        {
+            lock_guard<mutex> lk(*cv_mutex);
+            if (*pullFinish) {
+                // The pull already timed out.
+                return;
+            }
+            // A malformed chunk fails the pull rather than reporting partial data.
+            const bool parsed = parsePulledEvents(output, sharedFieldMask.get(), strings.get(),
+                                                  sharedData.get());
+            *pullSuccess = success && parsed && !*pullChunkMalformed;
+            *resultBaseGeneration = baseGeneration;
+            *resultGeneration = generation;
+            *pullFinish = true;
+        }
+        cv->notify_one();
+    };
 
     shared_ptr<PullResultReceiver> resultReceiver = SharedRefBase::make<PullResultReceiver>(
-            [cv_mutex, cv, pullFinish, pullSuccess, sharedData](
-                    int32_t atomTag, bool success, const vector<StatsEventParcel>& output) {
-                // This is the result of the pull, executing in a statsd binder thread.
-                // The pull could have taken a long time, and we should only modify
-                // data (the output param) if the pointer is in scope and the pull did not time out.
-                {
-                    lock_guard<mutex> lk(*cv_mutex);
-                    for (const StatsEventParcel& parcel: output) {
-                        shared_ptr<LogEvent> event = make_shared<LogEvent>(/*uid=*/-1, /*pid=*/-1);
-                        bool valid = event->parseBuffer((uint8_t*)parcel.buffer.data(),
-                                                        parcel.buffer.size());
-                        if (valid) {
-                            sharedData->push_back(event);
-                        } else {
-                            StatsdStats::getInstance().noteAtomError(event->GetTagId(),
-                                                                     /*pull=*/true);
-                        }
-                    }
-                    *pullSuccess = success;
-                    *pullFinish = true;
+            [finishPull](int32_t atomTag, bool success, const PulledEventBuffers& output) {
+                finishPull(success, /*baseGeneration=*/0, /*generation=*/0, output);
+            },
+            [cv_mutex, pullFinish, pullChunkMalformed, sharedData, sharedFieldMask, strings](
+                    int32_t atomTag, const PulledEventBuffers& output) {
+                // A chunk of a large pull. Chunks arrive in order, before pullFinished.
+                lock_guard<mutex> lk(*cv_mutex);
+                if (!*pullFinish && !parsePulledEvents(output, sharedFieldMask.get(),
+                                                       strings.get(), sharedData.get())) {
+                    *pullChunkMalformed = true;
                 }
-                cv->notify_one();
+            },
+            [finishPull](int32_t atomTag, bool success, int64_t baseGeneration,
+                         int64_t generation, const PulledEventBuffers& output) {
+                finishPull(success, baseGeneration, generation, output);
             });
 
     // Initiate the pull. This is a oneway call to a different process, except
     // in unit tests. In process calls are not oneway.
-    Status status = mCallback->onPullAtom(mTagId, resultReceiver);
+    Status status = Status::ok();
+    if (groupAtomTags != nullptr) {
+        status = mCallback->onPullAtomGroup(*groupAtomTags, resultReceiver);
+    } else if (aggregation != nullptr) {
+        status = mCallback->onPullAtomAggregated(mTagId, aggregation->groupByFields,
+                                                 aggregation->sumFields, resultReceiver);
+    } else if (fieldMask != nullptr) {
+        status = mCallback->onPullAtomProjected(mTagId, getTopLevelFieldsInUse(*fieldMask),
+                                                resultReceiver);
+    } else if (mDeltaKeyFields.empty()) {
+        status = mCallback->onPullAtom(mTagId, resultReceiver);
+    } else {
+        status = mCallback->onPullAtomDelta(mTagId, mDeltaGeneration, resultReceiver);
+    }
     if (!status.isOk()) {
+        resetDeltaSnapshot();
         StatsdStats::getInstance().notePullBinderCallFailed(mTagId);
         if (status.getExceptionCode() == EX_TRANSACTION_FAILED &&
             status.getStatus() == STATUS_DEAD_OBJECT) {
@@ -97,17 +251,25 @@ PullErrorCode StatsCallbackPuller::PullInternal(vector<shared_ptr<LogEvent>>* da
     {
         unique_lock<mutex> unique_lk(*cv_mutex);
         // Wait until the pull finishes, or until the pull timeout.
-        cv->wait_for(unique_lk, chrono::nanoseconds(mPullTimeoutNs),
+        cv->wait_for(unique_lk, chrono::nanoseconds(timeoutNs),
                      [pullFinish] { return *pullFinish; });
         if (!*pullFinish) {
             // Note: The parent stats puller will also note that there was a timeout and that the
             // cache should be cleared. Once we migrate all pullers to this callback, we could
             // consolidate the logic.
+            // Mark the pull finished so that chunks still in flight are dropped, not parsed.
+            *pullFinish = true;
+            sharedData->clear();
+            resetDeltaSnapshot();
             return PULL_SUCCESS;
         } else {
             // Only copy the data if we did not timeout and the pull was successful.
-            if (*pullSuccess) {
+            if (!*pullSuccess) {
+                resetDeltaSnapshot();
+            } else if (mDeltaKeyFields.empty()) {
                 *data = std::move(*sharedData);
+            } else if (!applyDelta(*resultBaseGeneration, *resultGeneration, *sharedData, data)) {
+                return PULL_FAIL;
             }
             VLOG("StatsCallbackPuller::pull succeeded for %d", mTagId);
             return *pullSuccess ? PULL_SUCCESS : PULL_FAIL;
@@ -17,6 +17,10 @@
 #pragma once
 
 #include <aidl/android/os/IPullAtomCallback.h>
+
+#include <unordered_map>
+
+#include "HashableDimensionKey.h"
 #include "StatsPuller.h"
 
 using aidl::android::os::IPullAtomCallback;
@@ -30,14 +34,92 @@ class StatsCallbackPuller : public StatsPuller {
 public:
     explicit StatsCallbackPuller(int tagId, const shared_ptr<IPullAtomCallback>& callback,
                                  const int64_t coolDownNs, const int64_t timeoutNs,
-                                 const std::vector<int> additiveFields);
+                                 const std::vector<int> additiveFields,
+                                 const std::vector<int> deltaKeyFields = {},
+                                 const bool supportsAggregation = false,
+                                 const int32_t pullGroup = 0);
+
+    int32_t GetPullGroup() const override {
+        return mPullGroup;
+    }
 
 private:
     PullErrorCode PullInternal(vector<std::shared_ptr<LogEvent>>* data) override;
+
+    PullErrorCode PullSubsetInternal(vector<std::shared_ptr<LogEvent>>* data,
+                                     const std::optional<PullAggregation>& aggregation,
+                                     const std::optional<TopLevelFieldMask>& fieldMask) override;
+
+    PullErrorCode PullGroupInternal(const std::vector<int32_t>& atomTags, int64_t timeoutNs,
+                                    vector<std::shared_ptr<LogEvent>>* data) override;
+
+    bool SupportsAggregation() const override {
+        return mSupportsAggregation;
+    }
+
+    // The rows of a delta are applied to the held ones, which would miss the fields left out of
+    // an earlier pull.
+    bool SupportsFieldMask() const override {
+        return mDeltaKeyFields.empty();
+    }
+
+    // Requests the pull with onPullAtomGroup if groupAtomTags is not null, or else with
+    // onPullAtomAggregated if aggregation is not null, or else with onPullAtomProjected if
+    // fieldMask is not null. The fields not in fieldMask are not parsed.
+    PullErrorCode pull(vector<std::shared_ptr<LogEvent>>* data,
+                       const PullAggregation* aggregation, const TopLevelFieldMask* fieldMask,
+                       const std::vector<int32_t>* groupAtomTags, int64_t timeoutNs);
+
+    // Applies the rows of a delta pull to mDeltaSnapshot, and copies the snapshot to data.
+    // Returns false if the delta is not against the snapshot held, which is then dropped.
+    bool applyDelta(int64_t baseGeneration, int64_t generation,
+                    vector<std::shared_ptr<LogEvent>>& rows,
+                    vector<std::shared_ptr<LogEvent>>* data);
+
+    void resetDeltaSnapshot();
+
     const shared_ptr<IPullAtomCallback> mCallback;
 
+    // The fields that identify a row of the atom. If empty, the puller does not send deltas.
+    const std::vector<int> mDeltaKeyFields;
+
+    // Whether the puller may aggregate the rows it sends. Never set along with mDeltaKeyFields,
+    // as the rows of a delta are matched to the held ones by their key fields.
+    const bool mSupportsAggregation;
+
+    // See StatsPuller::GetPullGroup. Never set along with mDeltaKeyFields, as the deltas of the
+    // atoms of a group would all be against one generation.
+    const int32_t mPullGroup;
+
+    // The generation of mDeltaSnapshot, 0 if there is none.
+    int64_t mDeltaGeneration = 0;
+
+    // The rows of the last delta pull, in the order the puller first sent them.
+    vector<std::shared_ptr<LogEvent>> mDeltaSnapshot;
+
+    // The index in mDeltaSnapshot of each row, by the values of its key fields.
+    std::unordered_map<HashableDimensionKey, size_t> mDeltaSnapshotIndex;
+
+    // The strings of the pulled rows, only used while a pull is parsed. Shared with the result
+    // receiver, which may outlive the puller.
+    const shared_ptr<StringValueInterner> mStrings;
+
+    FRIEND_TEST(StatsCallbackPullerTest, PullDelta);
+    FRIEND_TEST(StatsCallbackPullerTest, PullDeltaAgainstUnknownGeneration);
+    FRIEND_TEST(StatsCallbackPullerTest, PullDeltaResetAfterFailure);
+    FRIEND_TEST(StatsCallbackPullerTest, PullAggregated);
+    FRIEND_TEST(StatsCallbackPullerTest, PullAggregatedNotSupportedWithDelta);
     FRIEND_TEST(StatsCallbackPullerTest, PullFail);
+    FRIEND_TEST(StatsCallbackPullerTest, PullFieldMask);
+    FRIEND_TEST(StatsCallbackPullerTest, PullFieldMaskNotSupportedWithDelta);
+    FRIEND_TEST(StatsCallbackPullerTest, PullGroup);
+    FRIEND_TEST(StatsCallbackPullerTest, PullGroupNotSupportedWithDelta);
+    FRIEND_TEST(StatsCallbackPullerTest, PullFailInChunks);
+    FRIEND_TEST(StatsCallbackPullerTest, PullFailPackedTruncated);
     FRIEND_TEST(StatsCallbackPullerTest, PullSuccess);
+    FRIEND_TEST(StatsCallbackPullerTest, PullSuccessInChunks);
+    FRIEND_TEST(StatsCallbackPullerTest, PullSuccessPacked);
+    FRIEND_TEST(StatsCallbackPullerTest, PullSuccessPackedEmpty);
     FRIEND_TEST(StatsCallbackPullerTest, PullTimeout);
 };
 
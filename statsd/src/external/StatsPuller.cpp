@@ -19,10 +19,14 @@
 
 #include "StatsPuller.h"
 #include "StatsPullerManager.h"
+#include "external/Perfetto.h"
 #include "guardrail/StatsdStats.h"
 #include "puller_util.h"
 #include "stats_log_util.h"
 
+#include <algorithm>
+#include <unordered_map>
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -44,28 +48,115 @@ StatsPuller::StatsPuller(const int tagId, const int64_t coolDownNs, const int64_
 
 PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs,
                                 std::vector<std::shared_ptr<LogEvent>>* data) {
+    PulledDataSnapshot snapshot;
+    const PullErrorCode status = Pull(eventTimeNs, &snapshot);
+    if (status == PULL_SUCCESS) {
+        (*data) = *snapshot;
+    }
+    return status;
+}
+
+PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs, PulledDataSnapshot* data,
+                                const std::optional<PullAggregation>& aggregation,
+                                const std::optional<TopLevelFieldMask>& fieldMask) {
+    ScopedStageTrace trace("StatsPuller::Pull");
     lock_guard<std::mutex> lock(mLock);
     const int64_t elapsedTimeNs = getElapsedRealtimeNs();
     const int64_t systemUptimeMillis = getSystemUptimeMillis();
     StatsdStats::getInstance().notePull(mTagId);
-    const bool shouldUseCache =
-            (mLastEventTimeNs == eventTimeNs) || (elapsedTimeNs - mLastPullTimeNs < mCoolDownNs);
+    std::optional<PullAggregation> pullAggregation =
+            SupportsAggregation() ? aggregation : std::nullopt;
+    std::optional<TopLevelFieldMask> pullFieldMask =
+            SupportsFieldMask() ? fieldMask : std::nullopt;
+    bool shouldUseCache = (mLastEventTimeNs == eventTimeNs) ||
+                          (elapsedTimeNs - mLastPullTimeNs < mCoolDownNs + mCoolDownPenaltyNs);
+    if (shouldUseCache && mHasGoodData &&
+        (!pullAggregationCovers(mCachedAggregation, pullAggregation) ||
+         !pullFieldMaskCovers(mCachedFieldMask, pullFieldMask))) {
+        // The cached rows are aggregated more, or hold fewer fields, than this caller allows. The
+        // new rows also serve the callers of the cached ones, so that they are not pulled again in
+        // turn.
+        VLOG("Pulling atom %d again for rows not covered by the cached ones", mTagId);
+        pullAggregation = mergePullAggregations(mCachedAggregation, pullAggregation);
+        pullFieldMask = mergePullFieldMasks(mCachedFieldMask, pullFieldMask);
+        shouldUseCache = false;
+    }
     if (shouldUseCache) {
         if (mHasGoodData) {
+            // The cache may have been cleared since the last good pull.
+            if (mCachedData == nullptr) {
+                mCachedData = std::make_shared<const std::vector<std::shared_ptr<LogEvent>>>();
+            }
             (*data) = mCachedData;
             StatsdStats::getInstance().notePullFromCache(mTagId);
 
         }
         return mHasGoodData ? PULL_SUCCESS : PULL_FAIL;
     }
+    startPullLocked(eventTimeNs, elapsedTimeNs, pullAggregation, pullFieldMask);
+    std::vector<std::shared_ptr<LogEvent>> pulledData;
+    const PullErrorCode status =
+            pullAggregation || pullFieldMask
+                    ? PullSubsetInternal(&pulledData, pullAggregation, pullFieldMask)
+                    : PullInternal(&pulledData);
+    return finishPullLocked(status, elapsedTimeNs, systemUptimeMillis, std::move(pulledData),
+                            data);
+}
+
+void StatsPuller::PullGroup(const std::vector<sp<StatsPuller>>& pullers,
+                            const int64_t eventTimeNs) {
+    ScopedStageTrace trace("StatsPuller::PullGroup");
+    std::vector<int32_t> atomTags;
+    atomTags.reserve(pullers.size());
+    int64_t timeoutNs = 0;
+    for (const sp<StatsPuller>& puller : pullers) {
+        atomTags.push_back(puller->mTagId);
+        timeoutNs = std::max(timeoutNs, puller->mPullTimeoutNs);
+    }
+    const int64_t elapsedTimeNs = getElapsedRealtimeNs();
+    const int64_t systemUptimeMillis = getSystemUptimeMillis();
+    std::vector<std::shared_ptr<LogEvent>> pulledData;
+    {
+        lock_guard<std::mutex> lock(pullers[0]->mLock);
+        if (pullers[0]->PullGroupInternal(atomTags, timeoutNs, &pulledData) != PULL_SUCCESS) {
+            VLOG("Pull of the group of atom %d failed", atomTags[0]);
+            return;
+        }
+    }
+    std::unordered_map<int, std::vector<std::shared_ptr<LogEvent>>> rowsByTag;
+    for (std::shared_ptr<LogEvent>& row : pulledData) {
+        rowsByTag[row->GetTagId()].push_back(std::move(row));
+    }
+    for (const sp<StatsPuller>& puller : pullers) {
+        lock_guard<std::mutex> lock(puller->mLock);
+        StatsdStats::getInstance().notePull(puller->mTagId);
+        puller->startPullLocked(eventTimeNs, elapsedTimeNs, /*aggregation=*/std::nullopt,
+                                /*fieldMask=*/std::nullopt);
+        PulledDataSnapshot snapshot;
+        puller->finishPullLocked(PULL_SUCCESS, elapsedTimeNs, systemUptimeMillis,
+                                 std::move(rowsByTag[puller->mTagId]), &snapshot);
+    }
+}
+
+void StatsPuller::startPullLocked(const int64_t eventTimeNs, const int64_t elapsedTimeNs,
+                                  const std::optional<PullAggregation>& aggregation,
+                                  const std::optional<TopLevelFieldMask>& fieldMask) {
     if (mLastPullTimeNs > 0) {
         StatsdStats::getInstance().updateMinPullIntervalSec(
                 mTagId, (elapsedTimeNs - mLastPullTimeNs) / NS_PER_SEC);
     }
-    mCachedData.clear();
+    mCachedData = nullptr;
+    mCachedAggregation = aggregation;
+    mCachedFieldMask = fieldMask;
     mLastPullTimeNs = elapsedTimeNs;
     mLastEventTimeNs = eventTimeNs;
-    PullErrorCode status = PullInternal(&mCachedData);
+}
+
+PullErrorCode StatsPuller::finishPullLocked(const PullErrorCode status,
+                                            const int64_t elapsedTimeNs,
+                                            const int64_t systemUptimeMillis,
+                                            std::vector<std::shared_ptr<LogEvent>>&& pulledData,
+                                            PulledDataSnapshot* data) {
     mHasGoodData = (status == PULL_SUCCESS);
     if (!mHasGoodData) {
         return status;
@@ -73,10 +164,10 @@ PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs,
     const int64_t pullElapsedDurationNs = getElapsedRealtimeNs() - elapsedTimeNs;
     const int64_t pullSystemUptimeDurationMillis = getSystemUptimeMillis() - systemUptimeMillis;
     StatsdStats::getInstance().notePullTime(mTagId, pullElapsedDurationNs);
+    updateSlowPullPenaltyLocked(pullElapsedDurationNs);
     const bool pullTimeOut = pullElapsedDurationNs > mPullTimeoutNs;
     if (pullTimeOut) {
         // Something went wrong. Discard the data.
-        mCachedData.clear();
         mHasGoodData = false;
         StatsdStats::getInstance().notePullTimeout(
                 mTagId, pullSystemUptimeDurationMillis, NanoToMillis(pullElapsedDurationNs));
@@ -85,19 +176,45 @@ PullErrorCode StatsPuller::Pull(const int64_t eventTimeNs,
         return PULL_FAIL;
     }
 
-    if (mCachedData.size() > 0) {
-        mapAndMergeIsolatedUidsToHostUid(mCachedData, mUidMap, mTagId, mAdditiveFields);
+    // The merge runs once per actual pull. Every caller served from the cache gets its result.
+    if (pulledData.size() > 0) {
+        mapAndMergeIsolatedUidsToHostUid(pulledData, mUidMap, mTagId, mAdditiveFields);
     }
 
-    if (mCachedData.empty()) {
+    if (pulledData.empty()) {
         VLOG("Data pulled is empty");
         StatsdStats::getInstance().noteEmptyData(mTagId);
     }
 
+    mCachedData = std::make_shared<const std::vector<std::shared_ptr<LogEvent>>>(
+            std::move(pulledData));
     (*data) = mCachedData;
     return PULL_SUCCESS;
 }
 
+void StatsPuller::updateSlowPullPenaltyLocked(int64_t pullDurationNs) {
+    if (pullDurationNs <= mPullTimeoutNs / kSlowPullTimeoutDivisor) {
+        mSlowPullCount = 0;
+        if (mCoolDownPenaltyNs > 0) {
+            mCoolDownPenaltyNs = 0;
+            StatsdStats::getInstance().noteSlowPullerCoolDownPenalty(mTagId, /*penaltyNs=*/0);
+        }
+        return;
+    }
+    mSlowPullCount++;
+    if (mSlowPullCount < kSlowPullsForPenalty) {
+        return;
+    }
+    const int64_t penaltyNs =
+            std::min(kSlowPullPenaltyFactor * pullDurationNs, kMaxCoolDownPenaltyNs);
+    if (penaltyNs != mCoolDownPenaltyNs) {
+        VLOG("Puller for atom %d is slow, widening its cool down by %lld ns", mTagId,
+             (long long)penaltyNs);
+        mCoolDownPenaltyNs = penaltyNs;
+        StatsdStats::getInstance().noteSlowPullerCoolDownPenalty(mTagId, penaltyNs);
+    }
+}
+
 int StatsPuller::ForceClearCache() {
     return clearCache();
 }
@@ -108,15 +225,17 @@ int StatsPuller::clearCache() {
 }
 
 int StatsPuller::clearCacheLocked() {
-    int ret = mCachedData.size();
-    mCachedData.clear();
+    int ret = mCachedData == nullptr ? 0 : mCachedData->size();
+    mCachedData = nullptr;
+    mCachedAggregation = std::nullopt;
+    mCachedFieldMask = std::nullopt;
     mLastPullTimeNs = 0;
     mLastEventTimeNs = 0;
     return ret;
 }
 
 int StatsPuller::ClearCacheIfNecessary(int64_t timestampNs) {
-    if (timestampNs - mLastPullTimeNs > mCoolDownNs) {
+    if (timestampNs - mLastPullTimeNs > mCoolDownNs + mCoolDownPenaltyNs) {
         return clearCache();
     } else {
         return 0;
@@ -19,6 +19,7 @@
 #include <aidl/android/os/IStatsCompanionService.h>
 #include <utils/RefBase.h>
 #include <mutex>
+#include <optional>
 #include <vector>
 #include "packages/UidMap.h"
 
@@ -33,6 +34,10 @@ namespace android {
 namespace os {
 namespace statsd {
 
+// Result of one pull. The vector is never modified once published, so every caller served from
+// the same pull shares it without copying.
+typedef std::shared_ptr<const std::vector<std::shared_ptr<LogEvent>>> PulledDataSnapshot;
+
 enum PullErrorCode {
     PULL_SUCCESS = 0,
     PULL_FAIL = 1,
@@ -60,12 +65,40 @@ public:
     // should make a copy as this data may be shared with multiple metrics.
     PullErrorCode Pull(const int64_t eventTimeNs, std::vector<std::shared_ptr<LogEvent>>* data);
 
+    // Same as above, but hands out the cached snapshot itself instead of a copy of it. data is
+    // only set, and never to null, when the pull succeeds. If the puller supports it, the rows
+    // may be aggregated as aggregation allows, and may only hold the fields in fieldMask.
+    PullErrorCode Pull(const int64_t eventTimeNs, PulledDataSnapshot* data,
+                       const std::optional<PullAggregation>& aggregation = std::nullopt,
+                       const std::optional<TopLevelFieldMask>& fieldMask = std::nullopt);
+
+    // Pulls the atoms of the pullers, which share a pull group, in one request made by the first
+    // of them. The rows of each atom are cached by its puller as if it pulled them at eventTimeNs.
+    // No puller is changed if the request fails, so that each atom is then pulled on its own.
+    static void PullGroup(const std::vector<sp<StatsPuller>>& pullers, int64_t eventTimeNs);
+
+    // The group of atoms this puller may pull together with PullGroup, 0 if none.
+    virtual int32_t GetPullGroup() const {
+        return 0;
+    }
+
     // Clear cache immediately
     int ForceClearCache();
 
     // Clear cache if elapsed time is more than cooldown time
     int ClearCacheIfNecessary(int64_t timestampNs);
 
+    // A pull taking more than this fraction of the pull timeout counts as slow.
+    static constexpr int kSlowPullTimeoutDivisor = 2;
+
+    // Number of consecutive slow pulls after which the cool down is widened.
+    static constexpr int kSlowPullsForPenalty = 3;
+
+    // The widened cool down is the regular one plus this many times the last pull time, capped
+    // so that it stays well below the 1 min minimum interval of scheduled pulls.
+    static constexpr int kSlowPullPenaltyFactor = 4;
+    static constexpr int64_t kMaxCoolDownPenaltyNs = 20 * NS_PER_SEC;
+
     static void SetUidMap(const sp<UidMap>& uidMap);
 
     virtual void SetStatsCompanionService(
@@ -86,6 +119,31 @@ private:
     // Real puller impl.
     virtual PullErrorCode PullInternal(std::vector<std::shared_ptr<LogEvent>>* data) = 0;
 
+    // Same as PullInternal, but the rows may be aggregated as aggregation allows, and may only
+    // hold the fields in fieldMask. Only called if one of them is set, aggregation only if
+    // SupportsAggregation and fieldMask only if SupportsFieldMask.
+    virtual PullErrorCode PullSubsetInternal(std::vector<std::shared_ptr<LogEvent>>* data,
+                                             const std::optional<PullAggregation>& aggregation,
+                                             const std::optional<TopLevelFieldMask>& fieldMask) {
+        return PullInternal(data);
+    }
+
+    // Pulls the rows of all the atoms, waiting for at most timeoutNs. Only called if
+    // GetPullGroup is not 0.
+    virtual PullErrorCode PullGroupInternal(const std::vector<int32_t>& atomTags,
+                                            int64_t timeoutNs,
+                                            std::vector<std::shared_ptr<LogEvent>>* data) {
+        return PULL_FAIL;
+    }
+
+    virtual bool SupportsAggregation() const {
+        return false;
+    }
+
+    virtual bool SupportsFieldMask() const {
+        return false;
+    }
+
     bool mHasGoodData = false;
 
     // Minimum time before this puller does actual pull again.
@@ -95,6 +153,29 @@ private:
     // will be returned.
     const int64_t mCoolDownNs = 1 * NS_PER_SEC;
 
+    // Added to mCoolDownNs while the puller is chronically slow, so that more of the pulls made
+    // around a bucket boundary, e.g. for condition changes, are served from the cache instead of
+    // paying the slow pull again. Cleared by the first pull that is not slow.
+    int64_t mCoolDownPenaltyNs = 0;
+
+    // Number of consecutive slow pulls.
+    int mSlowPullCount = 0;
+
+    void updateSlowPullPenaltyLocked(int64_t pullDurationNs);
+
+    // Drops the cache for a pull at eventTimeNs started at elapsedTimeNs, whose rows are
+    // aggregated and limited as given.
+    void startPullLocked(int64_t eventTimeNs, int64_t elapsedTimeNs,
+                         const std::optional<PullAggregation>& aggregation,
+                         const std::optional<TopLevelFieldMask>& fieldMask);
+
+    // Caches the rows of the pull begun with startPullLocked if it succeeded in time, and sets data
+    // to them.
+    PullErrorCode finishPullLocked(PullErrorCode status, int64_t elapsedTimeNs,
+                                   int64_t systemUptimeMillis,
+                                   std::vector<std::shared_ptr<LogEvent>>&& pulledData,
+                                   PulledDataSnapshot* data);
+
     // The field numbers of the fields that need to be summed when merging
     // isolated uid with host uid.
     const std::vector<int> mAdditiveFields;
@@ -106,13 +187,19 @@ private:
     // the first pull.
     int64_t mLastEventTimeNs;
 
-    // Cache of data from last pull. If next request comes before cool down finishes,
-    // cached data will be returned.
+    // Cache of data from last pull, with isolated uids already merged into their host uid. If
+    // next request comes before cool down finishes, cached data will be returned.
     // Cached data is cleared when
     //   1) A pull fails
     //   2) A new pull request comes after cooldown time.
     //   3) clearCache is called.
-    std::vector<std::shared_ptr<LogEvent>> mCachedData;
+    PulledDataSnapshot mCachedData;
+
+    // How mCachedData may be aggregated, nullopt if it is not.
+    std::optional<PullAggregation> mCachedAggregation;
+
+    // The fields mCachedData may be limited to, nullopt if it holds all of them.
+    std::optional<TopLevelFieldMask> mCachedFieldMask;
 
     int clearCache();
 
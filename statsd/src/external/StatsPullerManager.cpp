@@ -25,6 +25,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 
 #include "../StatsService.h"
 #include "../logd/LogEvent.h"
@@ -44,29 +45,65 @@ namespace statsd {
 // Values smaller than this may require to update the alarm.
 const int64_t NO_ALARM_UPDATE = INT64_MAX;
 
-StatsPullerManager::StatsPullerManager()
+StatsPullerManager::StatsPullerManager(size_t numPullThreads, int64_t pullCoalescingWindowNs)
     : kAllPullAtomInfo({
               // TrainInfo.
               {{.uid = AID_STATSD, .atomTag = util::TRAIN_INFO}, new TrainInfoPuller()},
       }),
-      mNextPullTimeNs(NO_ALARM_UPDATE) {
+      mNextPullTimeNs(NO_ALARM_UPDATE),
+      mPullCoalescingWindowNs(pullCoalescingWindowNs) {
+    if (numPullThreads > 1) {
+        mPullExecutor = std::make_unique<ShardedWorkerPool>(numPullThreads);
+    }
 }
 
 bool StatsPullerManager::Pull(int tagId, const ConfigKey& configKey, const int64_t eventTimeNs,
                               vector<shared_ptr<LogEvent>>* data) {
-    std::lock_guard<std::mutex> _l(mLock);
-    return PullLocked(tagId, configKey, eventTimeNs, data);
+    vector<int32_t> uids;
+    std::optional<TopLevelFieldMask> fieldMask;
+    {
+        std::lock_guard<std::mutex> _l(mLock);
+        if (!getPullAtomUidsLocked(tagId, configKey, &uids)) {
+            return false;
+        }
+        fieldMask = getReceiversPullFieldMaskLocked(tagId);
+    }
+    PulledDataSnapshot snapshot;
+    if (!PullUids(tagId, uids, eventTimeNs, &snapshot, /*aggregation=*/std::nullopt, fieldMask)) {
+        return false;
+    }
+    (*data) = *snapshot;
+    return true;
+}
+
+bool StatsPullerManager::Pull(int tagId, const ConfigKey& configKey, const int64_t eventTimeNs,
+                              PulledDataSnapshot* data) {
+    vector<int32_t> uids;
+    std::optional<PullAggregation> aggregation;
+    std::optional<TopLevelFieldMask> fieldMask;
+    {
+        std::lock_guard<std::mutex> _l(mLock);
+        if (!getPullAtomUidsLocked(tagId, configKey, &uids)) {
+            return false;
+        }
+        aggregation = getReceiversPullAggregationLocked(tagId);
+        fieldMask = getReceiversPullFieldMaskLocked(tagId);
+    }
+    return PullUids(tagId, uids, eventTimeNs, data, aggregation, fieldMask);
 }
 
 bool StatsPullerManager::Pull(int tagId, const vector<int32_t>& uids, const int64_t eventTimeNs,
                               vector<std::shared_ptr<LogEvent>>* data) {
-    std::lock_guard<std::mutex> _l(mLock);
-    return PullLocked(tagId, uids, eventTimeNs, data);
+    PulledDataSnapshot snapshot;
+    if (!PullUids(tagId, uids, eventTimeNs, &snapshot)) {
+        return false;
+    }
+    (*data) = *snapshot;
+    return true;
 }
 
-bool StatsPullerManager::PullLocked(int tagId, const ConfigKey& configKey,
-                                    const int64_t eventTimeNs, vector<shared_ptr<LogEvent>>* data) {
-    vector<int32_t> uids;
+bool StatsPullerManager::getPullAtomUidsLocked(int tagId, const ConfigKey& configKey,
+                                               vector<int32_t>* uids) const {
     const auto& uidProviderIt = mPullUidProviders.find(configKey);
     if (uidProviderIt == mPullUidProviders.end()) {
         ALOGE("Error pulling tag %d. No pull uid provider for config key %s", tagId,
@@ -81,36 +118,109 @@ bool StatsPullerManager::PullLocked(int tagId, const ConfigKey& configKey,
         StatsdStats::getInstance().notePullUidProviderNotFound(tagId);
         return false;
     }
-    uids = pullUidProvider->getPullAtomUids(tagId);
-    return PullLocked(tagId, uids, eventTimeNs, data);
+    *uids = pullUidProvider->getPullAtomUids(tagId);
+    return true;
 }
 
-bool StatsPullerManager::PullLocked(int tagId, const vector<int32_t>& uids,
-                                    const int64_t eventTimeNs, vector<shared_ptr<LogEvent>>* data) {
-    VLOG("Initiating pulling %d", tagId);
+sp<StatsPuller> StatsPullerManager::findPullerLocked(int tagId, const vector<int32_t>& uids,
+                                                     int* pullerUid) const {
     for (int32_t uid : uids) {
-        PullerKey key = {.uid = uid, .atomTag = tagId};
-        auto pullerIt = kAllPullAtomInfo.find(key);
+        const auto pullerIt = kAllPullAtomInfo.find({.uid = uid, .atomTag = tagId});
         if (pullerIt != kAllPullAtomInfo.end()) {
-            PullErrorCode status = pullerIt->second->Pull(eventTimeNs, data);
-            VLOG("pulled %zu items", data->size());
-            if (status != PULL_SUCCESS) {
-                StatsdStats::getInstance().notePullFailed(tagId);
+            *pullerUid = uid;
+            return pullerIt->second;
+        }
+    }
+    return nullptr;
+}
+
+bool StatsPullerManager::PullUids(int tagId, const vector<int32_t>& uids,
+                                  const int64_t eventTimeNs, PulledDataSnapshot* data,
+                                  const std::optional<PullAggregation>& aggregation,
+                                  const std::optional<TopLevelFieldMask>& fieldMask) {
+    int pullerUid = -1;
+    sp<StatsPuller> puller;
+    {
+        std::lock_guard<std::mutex> _l(mPullersLock);
+        puller = findPullerLocked(tagId, uids, &pullerUid);
+    }
+    return PullFrom(tagId, pullerUid, puller, eventTimeNs, data, aggregation, fieldMask);
+}
+
+bool StatsPullerManager::PullFrom(int tagId, int pullerUid, const sp<StatsPuller>& puller,
+                                  const int64_t eventTimeNs, PulledDataSnapshot* data,
+                                  const std::optional<PullAggregation>& aggregation,
+                                  const std::optional<TopLevelFieldMask>& fieldMask) {
+    if (puller == nullptr) {
+        StatsdStats::getInstance().notePullerNotFound(tagId);
+        ALOGW("StatsPullerManager: Unknown tagId %d", tagId);
+        return false;  // Return early since we don't know what to pull.
+    }
+    VLOG("Initiating pulling %d", tagId);
+    PullErrorCode status = puller->Pull(eventTimeNs, data, aggregation, fieldMask);
+    VLOG("pulled %zu items", *data == nullptr ? 0 : (*data)->size());
+    if (status != PULL_SUCCESS) {
+        StatsdStats::getInstance().notePullFailed(tagId);
+    }
+    // If we received a dead object exception, it means the client process has died.
+    // We can remove the puller from the map.
+    if (status == PULL_DEAD_OBJECT) {
+        std::lock_guard<std::mutex> _l(mPullersLock);
+        const auto pullerIt = kAllPullAtomInfo.find({.uid = pullerUid, .atomTag = tagId});
+        // The process may have registered a new puller during the pull.
+        if (pullerIt != kAllPullAtomInfo.end() && pullerIt->second == puller) {
+            StatsdStats::getInstance().notePullerCallbackRegistrationChanged(
+                    tagId,
+                    /*registered=*/false);
+            kAllPullAtomInfo.erase(pullerIt);
+        }
+    }
+    return status == PULL_SUCCESS;
+}
+
+std::optional<PullAggregation> StatsPullerManager::getReceiversPullAggregationLocked(
+        int tagId) const {
+    std::optional<PullAggregation> aggregation;
+    bool hasReceiver = false;
+    const ReceiverKey firstKey = {.atomTag = tagId,
+                                  .configKey = ConfigKey(std::numeric_limits<int>::min(),
+                                                         std::numeric_limits<int64_t>::min())};
+    for (auto it = mReceivers.lower_bound(firstKey);
+         it != mReceivers.end() && it->first.atomTag == tagId; it++) {
+        for (const ReceiverInfo& receiverInfo : it->second) {
+            sp<PullDataReceiver> receiver = receiverInfo.receiver.promote();
+            if (receiver == nullptr) {
+                continue;
             }
-            // If we received a dead object exception, it means the client process has died.
-            // We can remove the puller from the map.
-            if (status == PULL_DEAD_OBJECT) {
-                StatsdStats::getInstance().notePullerCallbackRegistrationChanged(
-                        tagId,
-                        /*registered=*/false);
-                kAllPullAtomInfo.erase(pullerIt);
+            std::optional<PullAggregation> receiverAggregation = receiver->getPullAggregation();
+            if (!receiverAggregation) {
+                return std::nullopt;
             }
-            return status == PULL_SUCCESS;
+            aggregation = hasReceiver ? mergePullAggregations(aggregation, receiverAggregation)
+                                      : std::move(receiverAggregation);
+            hasReceiver = true;
+        }
+    }
+    return aggregation;
+}
+
+std::optional<TopLevelFieldMask> StatsPullerManager::getReceiversPullFieldMaskLocked(
+        int tagId) const {
+    const auto it = mPullAtomFieldMasks.find(tagId);
+    if (it == mPullAtomFieldMasks.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void StatsPullerManager::SetPullAtomFieldMasks(const AtomFieldMasks& fieldMasks) {
+    std::lock_guard<std::mutex> _l(mLock);
+    mPullAtomFieldMasks.clear();
+    for (const auto& [atomTag, fieldMask] : fieldMasks) {
+        if (!fieldMask.all() && PullerForMatcherExists(atomTag)) {
+            mPullAtomFieldMasks[atomTag] = fieldMask;
         }
     }
-    StatsdStats::getInstance().notePullerNotFound(tagId);
-    ALOGW("StatsPullerManager: Unknown tagId %d", tagId);
-    return false;  // Return early since we don't know what to pull.
 }
 
 bool StatsPullerManager::PullerForMatcherExists(int tagId) const {
@@ -134,13 +244,37 @@ void StatsPullerManager::updateAlarmLocked() {
     return;
 }
 
+int64_t StatsPullerManager::computeNextPullTimeLocked() const {
+    // Receivers that are gone are no longer rescheduled, so they must not hold the alarm back.
+    vector<int64_t> nextPullTimesNs;
+    int64_t minNextPullTimeNs = NO_ALARM_UPDATE;
+    for (const auto& pair : mReceivers) {
+        for (const ReceiverInfo& receiverInfo : pair.second) {
+            if (receiverInfo.receiver.promote() != nullptr) {
+                nextPullTimesNs.push_back(receiverInfo.nextPullTimeNs);
+                minNextPullTimeNs = min(receiverInfo.nextPullTimeNs, minNextPullTimeNs);
+            }
+        }
+    }
+    if (mPullCoalescingWindowNs <= 0 || minNextPullTimeNs == NO_ALARM_UPDATE) {
+        return minNextPullTimeNs;
+    }
+    int64_t nextPullTimeNs = minNextPullTimeNs;
+    for (const int64_t pullTimeNs : nextPullTimesNs) {
+        if (pullTimeNs - minNextPullTimeNs <= mPullCoalescingWindowNs) {
+            nextPullTimeNs = max(pullTimeNs, nextPullTimeNs);
+        }
+    }
+    return nextPullTimeNs;
+}
+
 void StatsPullerManager::SetStatsCompanionService(
         shared_ptr<IStatsCompanionService> statsCompanionService) {
     std::lock_guard<std::mutex> _l(mLock);
     shared_ptr<IStatsCompanionService> tmpForLock = mStatsCompanionService;
     mStatsCompanionService = statsCompanionService;
-    for (const auto& pulledAtom : kAllPullAtomInfo) {
-        pulledAtom.second->SetStatsCompanionService(statsCompanionService);
+    for (const sp<StatsPuller>& puller : getAllPullers()) {
+        puller->SetStatsCompanionService(statsCompanionService);
     }
     if (mStatsCompanionService != nullptr) {
         updateAlarmLocked();
@@ -151,6 +285,8 @@ void StatsPullerManager::RegisterReceiver(int tagId, const ConfigKey& configKey,
                                           wp<PullDataReceiver> receiver, int64_t nextPullTimeNs,
                                           int64_t intervalNs) {
     std::lock_guard<std::mutex> _l(mLock);
+    // The mask was set before the new receiver, and may miss the fields it reads.
+    mPullAtomFieldMasks.erase(tagId);
     auto& receivers = mReceivers[{.atomTag = tagId, .configKey = configKey}];
     for (auto it = receivers.begin(); it != receivers.end(); it++) {
         if (it->receiver == receiver) {
@@ -175,7 +311,15 @@ void StatsPullerManager::RegisterReceiver(int tagId, const ConfigKey& configKey,
     receivers.push_back(receiverInfo);
 
     // There is only one alarm for all pulled events. So only set it to the smallest denom.
-    if (nextPullTimeNs < mNextPullTimeNs) {
+    // When coalescing, a new receiver may also move the alarm later, to also cover its pull.
+    if (mPullCoalescingWindowNs > 0) {
+        const int64_t coalescedPullTimeNs = computeNextPullTimeLocked();
+        if (coalescedPullTimeNs != mNextPullTimeNs) {
+            VLOG("Updating next pull time %lld", (long long)mNextPullTimeNs);
+            mNextPullTimeNs = coalescedPullTimeNs;
+            updateAlarmLocked();
+        }
+    } else if (nextPullTimeNs < mNextPullTimeNs) {
         VLOG("Updating next pull time %lld", (long long)mNextPullTimeNs);
         mNextPullTimeNs = nextPullTimeNs;
         updateAlarmLocked();
@@ -217,46 +361,125 @@ void StatsPullerManager::UnregisterPullUidProvider(const ConfigKey& configKey,
 }
 
 void StatsPullerManager::OnAlarmFired(int64_t elapsedTimeNs) {
-    std::lock_guard<std::mutex> _l(mLock);
+    std::lock_guard<std::mutex> alarmLock(mAlarmLock);
     int64_t wallClockNs = getWallClockNs();
 
-    int64_t minNextPullTimeNs = NO_ALARM_UPDATE;
-
-    vector<pair<const ReceiverKey*, vector<ReceiverInfo*>>> needToPull;
-    for (auto& pair : mReceivers) {
-        vector<ReceiverInfo*> receivers;
-        if (pair.second.size() != 0) {
-            for (ReceiverInfo& receiverInfo : pair.second) {
+    // The due pulls are collected and their receivers rescheduled with mLock held. The pulls and
+    // deliveries are made without it, so that a slow puller does not hold up registrations.
+    vector<DuePull> needToPull;
+    vector<sp<PullDataReceiver>> notNeeded;
+    {
+        std::lock_guard<std::mutex> _l(mLock);
+        int64_t minNextPullTimeNs = NO_ALARM_UPDATE;
+        for (auto& [key, receiverInfos] : mReceivers) {
+            vector<sp<PullDataReceiver>> receivers;
+            for (ReceiverInfo& receiverInfo : receiverInfos) {
+                sp<PullDataReceiver> receiverPtr = receiverInfo.receiver.promote();
+                if (receiverPtr == nullptr) {
+                    // Receivers that are gone are no longer rescheduled.
+                    continue;
+                }
                 // If pullNecessary and enough time has passed for the next bucket, then add
                 // receiver to the list that will pull on this alarm.
-                // If pullNecessary is false, check if next pull time needs to be updated.
-                sp<PullDataReceiver> receiverPtr = receiverInfo.receiver.promote();
-                const bool pullNecessary = receiverPtr != nullptr && receiverPtr->isPullNeeded();
-                if (receiverInfo.nextPullTimeNs <= elapsedTimeNs && pullNecessary) {
-                    receivers.push_back(&receiverInfo);
-                } else {
-                    if (receiverInfo.nextPullTimeNs <= elapsedTimeNs) {
-                        receiverPtr->onDataPulled({}, PullResult::PULL_NOT_NEEDED, elapsedTimeNs);
-                        int numBucketsAhead = (elapsedTimeNs - receiverInfo.nextPullTimeNs) /
-                                              receiverInfo.intervalNs;
-                        receiverInfo.nextPullTimeNs +=
-                                (numBucketsAhead + 1) * receiverInfo.intervalNs;
+                if (receiverInfo.nextPullTimeNs <= elapsedTimeNs) {
+                    if (receiverPtr->isPullNeeded()) {
+                        receivers.push_back(receiverPtr);
+                    } else {
+                        notNeeded.push_back(receiverPtr);
                     }
-                    minNextPullTimeNs = min(receiverInfo.nextPullTimeNs, minNextPullTimeNs);
+                    // We may have just come out of a coma, compute next pull time.
+                    int numBucketsAhead = (elapsedTimeNs - receiverInfo.nextPullTimeNs) /
+                                          receiverInfo.intervalNs;
+                    receiverInfo.nextPullTimeNs += (numBucketsAhead + 1) * receiverInfo.intervalNs;
                 }
+                minNextPullTimeNs = min(receiverInfo.nextPullTimeNs, minNextPullTimeNs);
             }
             if (receivers.size() > 0) {
-                needToPull.push_back(make_pair(&pair.first, receivers));
+                DuePull& pull = needToPull.emplace_back();
+                pull.atomTag = key.atomTag;
+                pull.configKey = key.configKey;
+                pull.receivers = std::move(receivers);
+            }
+        }
+        if (mPullCoalescingWindowNs > 0) {
+            minNextPullTimeNs = computeNextPullTimeLocked();
+        }
+        VLOG("mNextPullTimeNs: %lld updated to %lld", (long long)mNextPullTimeNs,
+             (long long)minNextPullTimeNs);
+        mNextPullTimeNs = minNextPullTimeNs;
+        updateAlarmLocked();
+
+        // Every receiver key of an atom pulls with the same aggregation, so that they share a
+        // pull.
+        for (size_t i = 0; i < needToPull.size(); i++) {
+            DuePull& pull = needToPull[i];
+            pull.hasUids = getPullAtomUidsLocked(pull.atomTag, pull.configKey, &pull.uids);
+            pull.aggregation = i > 0 && pull.atomTag == needToPull[i - 1].atomTag
+                                       ? needToPull[i - 1].aggregation
+                                       : getReceiversPullAggregationLocked(pull.atomTag);
+            pull.fieldMask = getReceiversPullFieldMaskLocked(pull.atomTag);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> _l(mPullersLock);
+        for (DuePull& pull : needToPull) {
+            if (pull.hasUids) {
+                pull.puller = findPullerLocked(pull.atomTag, pull.uids, &pull.pullerUid);
+            }
+        }
+    }
+
+    for (const sp<PullDataReceiver>& receiver : notNeeded) {
+        receiver->onDataPulled({}, PullResult::PULL_NOT_NEEDED, elapsedTimeNs);
+    }
+
+    PullGroups(needToPull, elapsedTimeNs);
+    const int64_t pullStartNs = getElapsedRealtimeNs();
+    auto pullAt = [&](size_t i) {
+        DuePull& pull = needToPull[i];
+        StatsdStats::getInstance().notePullQueueDelay(pull.atomTag,
+                                                      getElapsedRealtimeNs() - pullStartNs);
+        pull.result = pull.hasUids && PullFrom(pull.atomTag, pull.pullerUid, pull.puller,
+                                               elapsedTimeNs, &pull.data, pull.aggregation,
+                                               pull.fieldMask)
+                              ? PullResult::PULL_RESULT_SUCCESS
+                              : PullResult::PULL_RESULT_FAIL;
+    };
+
+    // needToPull is sorted by atom, so it holds several atoms iff its ends differ.
+    if (mPullExecutor == nullptr || needToPull.empty() ||
+        needToPull.front().atomTag == needToPull.back().atomTag) {
+        for (size_t i = 0; i < needToPull.size(); i++) {
+            pullAt(i);
+        }
+    } else {
+        // Spread the atoms across the shards. All pulls of an atom go to the same shard, so at
+        // most one pull per atom is in flight.
+        const size_t numShards = mPullExecutor->getNumShards();
+        vector<size_t> shardOfPull(needToPull.size());
+        size_t atomIndex = 0;
+        for (size_t i = 0; i < needToPull.size(); i++) {
+            if (i > 0 && needToPull[i].atomTag != needToPull[i - 1].atomTag) {
+                atomIndex++;
             }
+            shardOfPull[i] = atomIndex % numShards;
         }
+        mPullExecutor->runOnAllShards([&](size_t shard) {
+            for (size_t i = 0; i < needToPull.size(); i++) {
+                if (shardOfPull[i] == shard) {
+                    pullAt(i);
+                }
+            }
+        });
     }
-    for (const auto& pullInfo : needToPull) {
-        vector<shared_ptr<LogEvent>> data;
-        PullResult pullResult =
-                PullLocked(pullInfo.first->atomTag, pullInfo.first->configKey, elapsedTimeNs, &data)
-                        ? PullResult::PULL_RESULT_SUCCESS
-                        : PullResult::PULL_RESULT_FAIL;
-        if (pullResult == PullResult::PULL_RESULT_FAIL) {
+
+    // Results are delivered in the order of needToPull, whichever thread pulled. Receivers of
+    // the same atom share one snapshot.
+    const vector<shared_ptr<LogEvent>> noData;
+    for (size_t i = 0; i < needToPull.size(); i++) {
+        const DuePull& pull = needToPull[i];
+        const vector<shared_ptr<LogEvent>>& data = pull.data == nullptr ? noData : *pull.data;
+        if (pull.result == PullResult::PULL_RESULT_FAIL) {
             VLOG("pull failed at %lld, will try again later", (long long)elapsedTimeNs);
         }
 
@@ -267,46 +490,66 @@ void StatsPullerManager::OnAlarmFired(int64_t elapsedTimeNs) {
         // Here the triggering event is alarm fired from AlarmManager.
         // In ValueMetricProducer and GaugeMetricProducer we do same thing
         // when pull on condition change, etc.
-        for (auto& event : data) {
-            event->setElapsedTimestampNs(elapsedTimeNs);
-            event->setLogdWallClockTimestampNs(wallClockNs);
+        // A snapshot shared with the previous receiver key was already stamped.
+        if (i == 0 || pull.data != needToPull[i - 1].data) {
+            for (const auto& event : data) {
+                event->setElapsedTimestampNs(elapsedTimeNs);
+                event->setLogdWallClockTimestampNs(wallClockNs);
+            }
+        }
+
+        for (const sp<PullDataReceiver>& receiver : pull.receivers) {
+            receiver->onDataPulled(data, pull.result, elapsedTimeNs);
         }
+    }
+}
 
-        for (const auto& receiverInfo : pullInfo.second) {
-            sp<PullDataReceiver> receiverPtr = receiverInfo->receiver.promote();
-            if (receiverPtr != nullptr) {
-                receiverPtr->onDataPulled(data, pullResult, elapsedTimeNs);
-                // We may have just come out of a coma, compute next pull time.
-                int numBucketsAhead =
-                        (elapsedTimeNs - receiverInfo->nextPullTimeNs) / receiverInfo->intervalNs;
-                receiverInfo->nextPullTimeNs += (numBucketsAhead + 1) * receiverInfo->intervalNs;
-                minNextPullTimeNs = min(receiverInfo->nextPullTimeNs, minNextPullTimeNs);
-            } else {
-                VLOG("receiver already gone.");
+void StatsPullerManager::PullGroups(const vector<DuePull>& needToPull, const int64_t eventTimeNs) {
+    // The pullers of the due atoms in a pull group, by their uid and pull group.
+    std::map<pair<int, int32_t>, vector<sp<StatsPuller>>> groups;
+    for (const DuePull& pull : needToPull) {
+        if (pull.puller == nullptr) {
+            continue;
+        }
+        const int32_t pullGroup = pull.puller->GetPullGroup();
+        if (pullGroup != 0) {
+            vector<sp<StatsPuller>>& pullers = groups[{pull.pullerUid, pullGroup}];
+            if (std::find(pullers.begin(), pullers.end(), pull.puller) == pullers.end()) {
+                pullers.push_back(pull.puller);
             }
         }
     }
+    for (const auto& [group, pullers] : groups) {
+        if (pullers.size() > 1) {
+            VLOG("Pulling %zu atoms of pull group %d of uid %d together", pullers.size(),
+                 group.second, group.first);
+            StatsPuller::PullGroup(pullers, eventTimeNs);
+        }
+    }
+}
 
-    VLOG("mNextPullTimeNs: %lld updated to %lld", (long long)mNextPullTimeNs,
-         (long long)minNextPullTimeNs);
-    mNextPullTimeNs = minNextPullTimeNs;
-    updateAlarmLocked();
+vector<sp<StatsPuller>> StatsPullerManager::getAllPullers() {
+    std::lock_guard<std::mutex> _l(mPullersLock);
+    vector<sp<StatsPuller>> pullers;
+    pullers.reserve(kAllPullAtomInfo.size());
+    for (const auto& pulledAtom : kAllPullAtomInfo) {
+        pullers.push_back(pulledAtom.second);
+    }
+    return pullers;
 }
 
 int StatsPullerManager::ForceClearPullerCache() {
-    std::lock_guard<std::mutex> _l(mLock);
     int totalCleared = 0;
-    for (const auto& pulledAtom : kAllPullAtomInfo) {
-        totalCleared += pulledAtom.second->ForceClearCache();
+    for (const sp<StatsPuller>& puller : getAllPullers()) {
+        totalCleared += puller->ForceClearCache();
     }
     return totalCleared;
 }
 
 int StatsPullerManager::ClearPullerCacheIfNecessary(int64_t timestampNs) {
-    std::lock_guard<std::mutex> _l(mLock);
     int totalCleared = 0;
-    for (const auto& pulledAtom : kAllPullAtomInfo) {
-        totalCleared += pulledAtom.second->ClearCacheIfNecessary(timestampNs);
+    for (const sp<StatsPuller>& puller : getAllPullers()) {
+        totalCleared += puller->ClearCacheIfNecessary(timestampNs);
     }
     return totalCleared;
 }
@@ -314,8 +557,10 @@ int StatsPullerManager::ClearPullerCacheIfNecessary(int64_t timestampNs) {
 void StatsPullerManager::RegisterPullAtomCallback(const int uid, const int32_t atomTag,
                                                   const int64_t coolDownNs, const int64_t timeoutNs,
                                                   const vector<int32_t>& additiveFields,
-                                                  const shared_ptr<IPullAtomCallback>& callback) {
-    std::lock_guard<std::mutex> _l(mLock);
+                                                  const shared_ptr<IPullAtomCallback>& callback,
+                                                  const vector<int32_t>& deltaKeyFields,
+                                                  const bool supportsAggregation,
+                                                  const int32_t pullGroup) {
     VLOG("RegisterPullerCallback: adding puller for tag %d", atomTag);
 
     if (callback == nullptr) {
@@ -326,9 +571,11 @@ void StatsPullerManager::RegisterPullAtomCallback(const int uid, const int32_t a
     int64_t actualCoolDownNs = coolDownNs < kMinCoolDownNs ? kMinCoolDownNs : coolDownNs;
     int64_t actualTimeoutNs = timeoutNs > kMaxTimeoutNs ? kMaxTimeoutNs : timeoutNs;
 
-    sp<StatsCallbackPuller> puller = new StatsCallbackPuller(atomTag, callback, actualCoolDownNs,
-                                                             actualTimeoutNs, additiveFields);
+    sp<StatsCallbackPuller> puller = new StatsCallbackPuller(
+            atomTag, callback, actualCoolDownNs, actualTimeoutNs, additiveFields, deltaKeyFields,
+            supportsAggregation, pullGroup);
     PullerKey key = {.uid = uid, .atomTag = atomTag};
+    std::lock_guard<std::mutex> _l(mPullersLock);
     auto it = kAllPullAtomInfo.find(key);
     if (it != kAllPullAtomInfo.end()) {
         StatsdStats::getInstance().notePullerCallbackRegistrationChanged(atomTag,
@@ -339,7 +586,7 @@ void StatsPullerManager::RegisterPullAtomCallback(const int uid, const int32_t a
 }
 
 void StatsPullerManager::UnregisterPullAtomCallback(const int uid, const int32_t atomTag) {
-    std::lock_guard<std::mutex> _l(mLock);
+    std::lock_guard<std::mutex> _l(mPullersLock);
     PullerKey key = {.uid = uid, .atomTag = atomTag};
     if (kAllPullAtomInfo.find(key) != kAllPullAtomInfo.end()) {
         StatsdStats::getInstance().notePullerCallbackRegistrationChanged(atomTag,
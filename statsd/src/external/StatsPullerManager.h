@@ -21,6 +21,8 @@
 #include <utils/RefBase.h>
 
 #include <list>
+#include <memory>
+#include <optional>
 #include <vector>
 
 #include "PullDataReceiver.h"
@@ -29,6 +31,7 @@
 #include "guardrail/StatsdStats.h"
 #include "logd/LogEvent.h"
 #include "packages/UidMap.h"
+#include "utils/ShardedWorkerPool.h"
 
 using aidl::android::os::IPullAtomCallback;
 using aidl::android::os::IStatsCompanionService;
@@ -61,11 +64,27 @@ typedef struct PullerKey {
 
 class StatsPullerManager : public virtual RefBase {
 public:
-    StatsPullerManager();
+    // Number of threads pulling atoms due at the same alarm when parallel pulling is enabled.
+    static constexpr size_t kParallelPullThreads = 4;
+
+    // How late a scheduled pull may be made so that it shares an alarm with the pulls due after
+    // it, when pull coalescing is enabled. Well below the 1 min minimum pull interval, so a
+    // delayed pull still lands in the bucket right after its boundary and is snapped back to it.
+    static constexpr int64_t kPullCoalescingWindowNs = 10 * NS_PER_SEC;
+
+    // With numPullThreads > 1, different atoms due at the same alarm are pulled concurrently.
+    // With pullCoalescingWindowNs > 0, pulls due within that window of the earliest one are made
+    // at a single alarm.
+    explicit StatsPullerManager(size_t numPullThreads = 1, int64_t pullCoalescingWindowNs = 0);
 
     virtual ~StatsPullerManager() {
     }
 
+    // Sets the top level fields that the receivers of each atom read, as computed for the
+    // LogEventFilter. The pulls made for receivers only need to hold those fields, see
+    // StatsPuller::Pull. Atoms without a mask, or with a receiver registered since the masks
+    // were set, are pulled with all their fields.
+    void SetPullAtomFieldMasks(const AtomFieldMasks& fieldMasks);
 
     // Registers a receiver for tagId. It will be pulled on the nextPullTimeNs
     // and then every intervalNs thereafter.
@@ -108,6 +127,14 @@ public:
     virtual bool Pull(int tagId, const vector<int32_t>& uids, const int64_t eventTimeNs,
                       vector<std::shared_ptr<LogEvent>>* data);
 
+    // Same as the first Pull, but sets data to the snapshot cached by the puller instead of a
+    // copy. Pulls served from the same cached data get the same snapshot. This is a pull for a
+    // receiver of the atom: the rows may be aggregated as all its receivers allow, see
+    // PullDataReceiver::getPullAggregation. As for the first Pull, they may only hold the fields
+    // set with SetPullAtomFieldMasks.
+    virtual bool Pull(int tagId, const ConfigKey& configKey, const int64_t eventTimeNs,
+                      PulledDataSnapshot* data);
+
     // Clear pull data cache immediately.
     int ForceClearPullerCache();
 
@@ -118,10 +145,13 @@ public:
 
     void RegisterPullAtomCallback(const int uid, const int32_t atomTag, const int64_t coolDownNs,
                                   const int64_t timeoutNs, const vector<int32_t>& additiveFields,
-                                  const shared_ptr<IPullAtomCallback>& callback);
+                                  const shared_ptr<IPullAtomCallback>& callback,
+                                  const vector<int32_t>& deltaKeyFields = {},
+                                  bool supportsAggregation = false, int32_t pullGroup = 0);
 
     void UnregisterPullAtomCallback(const int uid, const int32_t atomTag);
 
+    // Guarded by mPullersLock.
     std::map<const PullerKey, sp<StatsPuller>> kAllPullAtomInfo;
 
 private:
@@ -145,25 +175,99 @@ private:
         wp<PullDataReceiver> receiver;
     } ReceiverInfo;
 
+    // A receiver key due at an alarm, with what its pull needs, read while the locks are held.
+    struct DuePull {
+        int atomTag;
+        ConfigKey configKey;
+        vector<sp<PullDataReceiver>> receivers;
+        // False if the config has no pull uid provider.
+        bool hasUids = false;
+        vector<int32_t> uids;
+        std::optional<PullAggregation> aggregation;
+        std::optional<TopLevelFieldMask> fieldMask;
+        // The puller of the first of uids that has one, if any.
+        int pullerUid = -1;
+        sp<StatsPuller> puller;
+        PulledDataSnapshot data;
+        PullResult result = PullResult::PULL_RESULT_FAIL;
+    };
+
     // mapping from Receiver Key to receivers
     std::map<ReceiverKey, std::list<ReceiverInfo>> mReceivers;
 
     // mapping from Config Key to the PullUidProvider for that config
     std::map<ConfigKey, wp<PullUidProvider>> mPullUidProviders;
 
-    bool PullLocked(int tagId, const ConfigKey& configKey, const int64_t eventTimeNs,
-                    vector<std::shared_ptr<LogEvent>>* data);
+    // Sets uids to the uids that the config pulls the atom from. Returns false if the config has
+    // no pull uid provider.
+    bool getPullAtomUidsLocked(int tagId, const ConfigKey& configKey,
+                               vector<int32_t>* uids) const;
+
+    // Returns the puller of the atom for the first of uids that has one, and sets pullerUid to
+    // that uid. Returns nullptr if there is none. Needs mPullersLock.
+    sp<StatsPuller> findPullerLocked(int tagId, const vector<int32_t>& uids,
+                                     int* pullerUid) const;
+
+    // Pulls from the puller of the atom for the first of uids that has one.
+    bool PullUids(int tagId, const vector<int32_t>& uids, const int64_t eventTimeNs,
+                  PulledDataSnapshot* data,
+                  const std::optional<PullAggregation>& aggregation = std::nullopt,
+                  const std::optional<TopLevelFieldMask>& fieldMask = std::nullopt);
+
+    // Pulls from puller, registered by pullerUid, holding only the lock of the puller. A puller
+    // whose process died is erased from kAllPullAtomInfo, unless it was replaced meanwhile.
+    // On success, data is set to the snapshot cached by the puller.
+    // The rows are aggregated as aggregation allows, and only hold the fields in fieldMask, if
+    // the puller supports it.
+    bool PullFrom(int tagId, int pullerUid, const sp<StatsPuller>& puller,
+                  const int64_t eventTimeNs, PulledDataSnapshot* data,
+                  const std::optional<PullAggregation>& aggregation,
+                  const std::optional<TopLevelFieldMask>& fieldMask);
+
+    // Pulls together the due atoms whose pullers, registered for the same uid, share a pull group,
+    // so that the pulls of needToPull are then served from the cache of the pullers.
+    void PullGroups(const vector<DuePull>& needToPull, int64_t eventTimeNs);
+
+    // Returns the registered pullers, so that they can be called without mPullersLock held.
+    vector<sp<StatsPuller>> getAllPullers();
+
+    // Returns the aggregation that every receiver of the atom allows, nullopt if one of them
+    // needs the rows as pulled or if there are none.
+    std::optional<PullAggregation> getReceiversPullAggregationLocked(int tagId) const;
+
+    // Returns the fields that the receivers of the atom read, nullopt if they may read all.
+    std::optional<TopLevelFieldMask> getReceiversPullFieldMaskLocked(int tagId) const;
+
+    // See SetPullAtomFieldMasks.
+    AtomFieldMasks mPullAtomFieldMasks;
+
+    // Guards the receivers, the pull uid providers, the field masks and the alarm. Never held
+    // during a pull. Taken before mPullersLock.
+    std::mutex mLock;
 
-    bool PullLocked(int tagId, const vector<int32_t>& uids, const int64_t eventTimeNs,
-                    vector<std::shared_ptr<LogEvent>>* data);
+    // Guards kAllPullAtomInfo. Only held to look pullers up and to register them, so that a slow
+    // puller does not delay the registrations and the pulls of the other atoms.
+    std::mutex mPullersLock;
 
-    // locks for data receiver and StatsCompanionService changes
-    std::mutex mLock;
+    // Serializes OnAlarmFired, which pulls without mLock held. Taken before mLock.
+    std::mutex mAlarmLock;
 
     void updateAlarmLocked();
 
+    // Returns the alarm time for the receivers currently registered: the earliest next pull time,
+    // moved to the latest next pull time within mPullCoalescingWindowNs of it.
+    int64_t computeNextPullTimeLocked() const;
+
     int64_t mNextPullTimeNs;
 
+    const int64_t mPullCoalescingWindowNs;
+
+    // Pulls the atoms due at an alarm. Each atom is pulled on a single shard, so pulls of the
+    // same atom at an alarm are never concurrent and later ones can be served from the puller
+    // cache.
+    // Null when pulls run on the alarm thread.
+    std::unique_ptr<ShardedWorkerPool> mPullExecutor;
+
     FRIEND_TEST(GaugeMetricE2ePulledTest, TestFirstNSamplesPulledNoTrigger);
     FRIEND_TEST(GaugeMetricE2ePulledTest, TestFirstNSamplesPulledNoTriggerWithActivation);
     FRIEND_TEST(GaugeMetricE2ePulledTest, TestRandomSamplePulledEvents);
@@ -176,6 +280,14 @@ private:
 
     FRIEND_TEST(StatsLogProcessorTest, TestPullUidProviderSetOnConfigUpdate);
 
+    FRIEND_TEST(StatsPullerManagerTest, TestParallelPullsOnAlarm);
+    FRIEND_TEST(StatsPullerManagerTest, TestParallelPullsDeadPuller);
+    FRIEND_TEST(StatsPullerManagerTest, TestPullCoalescing);
+    FRIEND_TEST(StatsPullerManagerTest, TestPullCoalescingDisabled);
+    FRIEND_TEST(StatsPullerManagerTest, TestReceiversPullAggregation);
+    FRIEND_TEST(StatsPullerManagerTest, TestReceiversPullFieldMask);
+    FRIEND_TEST(StatsPullerManagerTest, TestPullGroupOnAlarm);
+
     FRIEND_TEST(ConfigUpdateE2eTest, TestGaugeMetric);
     FRIEND_TEST(ConfigUpdateE2eTest, TestValueMetric);
 };
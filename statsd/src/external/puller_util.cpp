@@ -18,6 +18,12 @@
 #include "Log.h"
 
 #include "puller_util.h"
+
+#include <algorithm>
+#include <span>
+#include <unordered_map>
+
+#include "HashableDimensionKey.h"
 #include "stats_log_util.h"
 
 namespace android {
@@ -26,6 +32,89 @@ namespace statsd {
 
 using namespace std;
 
+namespace {
+
+bool containsField(const vector<int>& sortedFields, int field) {
+    return std::binary_search(sortedFields.begin(), sortedFields.end(), field);
+}
+
+}  // namespace
+
+PullAggregation makePullAggregation(vector<int> groupByFields, vector<int> sumFields) {
+    std::sort(groupByFields.begin(), groupByFields.end());
+    groupByFields.erase(std::unique(groupByFields.begin(), groupByFields.end()),
+                        groupByFields.end());
+    std::sort(sumFields.begin(), sumFields.end());
+    sumFields.erase(std::unique(sumFields.begin(), sumFields.end()), sumFields.end());
+    // A field that is grouped by holds the same value in every row of the group.
+    sumFields.erase(std::remove_if(sumFields.begin(), sumFields.end(),
+                                   [&groupByFields](int field) {
+                                       return containsField(groupByFields, field);
+                                   }),
+                    sumFields.end());
+    return {std::move(groupByFields), std::move(sumFields)};
+}
+
+bool pullAggregationCovers(const optional<PullAggregation>& pulled,
+                           const optional<PullAggregation>& requested) {
+    if (!pulled) {
+        return true;
+    }
+    if (!requested) {
+        return false;
+    }
+    for (const int field : requested->groupByFields) {
+        if (!containsField(pulled->groupByFields, field)) {
+            return false;
+        }
+    }
+    for (const int field : requested->sumFields) {
+        if (!containsField(pulled->groupByFields, field) &&
+            !containsField(pulled->sumFields, field)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+optional<PullAggregation> mergePullAggregations(const optional<PullAggregation>& a,
+                                                const optional<PullAggregation>& b) {
+    if (!a || !b) {
+        return nullopt;
+    }
+    vector<int> groupByFields = a->groupByFields;
+    groupByFields.insert(groupByFields.end(), b->groupByFields.begin(), b->groupByFields.end());
+    vector<int> sumFields = a->sumFields;
+    sumFields.insert(sumFields.end(), b->sumFields.begin(), b->sumFields.end());
+    return makePullAggregation(std::move(groupByFields), std::move(sumFields));
+}
+
+bool pullFieldMaskCovers(const optional<TopLevelFieldMask>& pulled,
+                         const optional<TopLevelFieldMask>& requested) {
+    if (!pulled) {
+        return true;
+    }
+    return requested && (*requested & ~*pulled).none();
+}
+
+optional<TopLevelFieldMask> mergePullFieldMasks(const optional<TopLevelFieldMask>& a,
+                                                const optional<TopLevelFieldMask>& b) {
+    if (!a || !b) {
+        return nullopt;
+    }
+    return *a | *b;
+}
+
+vector<int> getTopLevelFieldsInUse(const TopLevelFieldMask& mask) {
+    vector<int> fields;
+    for (int pos = 1; pos < kAttributionTagsInUseOffset; pos++) {
+        if (mask.test(pos)) {
+            fields.push_back(pos);
+        }
+    }
+    return fields;
+}
+
 /**
  * Process all data and merge isolated with host if necessary.
  * For example:
@@ -80,77 +169,73 @@ void mapAndMergeIsolatedUidsToHostUid(vector<shared_ptr<LogEvent>>& data, const
         }
     }
 
-    // 2. sort the data, bit-wise
-    sort(data.begin(), data.end(),
-         [](const shared_ptr<LogEvent>& lhs, const shared_ptr<LogEvent>& rhs) {
-             if (lhs->size() != rhs->size()) {
-                 return lhs->size() < rhs->size();
-             }
-             const std::vector<FieldValue>& lhsValues = lhs->getValues();
-             const std::vector<FieldValue>& rhsValues = rhs->getValues();
-             for (int i = 0; i < (int)lhs->size(); i++) {
-                 if (lhsValues[i] != rhsValues[i]) {
-                     return lhsValues[i] < rhsValues[i];
-                 }
-             }
-             return false;
-         });
+    // 2. Merge each event into the first one with the same non-additive values, in one pass.
+    // Events are hashed on their non-additive values only, so that merging does not change the
+    // hash of the events held in mergedData. Merged events keep the order of their first
+    // occurrence.
+    vector<bool> additivePositions;
+    for (const int pos : additiveFieldsVec) {
+        if (pos < 0) {
+            continue;
+        }
+        if (pos >= (int)additivePositions.size()) {
+            additivePositions.resize(pos + 1);
+        }
+        additivePositions[pos] = true;
+    }
+    const auto isAdditive = [&additivePositions](const FieldValue& fieldValue) {
+        // Repeated additive fields are treated as non-additive fields.
+        const int pos = fieldValue.mField.getPosAtDepth(0);
+        return pos < (int)additivePositions.size() && additivePositions[pos] &&
+               !isPrimitiveRepeatedField(fieldValue.mField);
+    };
 
     vector<shared_ptr<LogEvent>> mergedData;
-    const set<int> additiveFields(additiveFieldsVec.begin(), additiveFieldsVec.end());
-    bool needMerge = true;
-
-    // 3. do the merge.
-    // The loop invariant is this: for every event,
-    // - check if it has a different length (means different attribution chains or repeated fields)
-    // - check if fields are different
-    // - check if non-additive field values are different (non-additive is default for repeated
-    // fields)
-    // If any are true, no need to merge, add itself to the result. Otherwise, merge the
-    // value onto the one immediately next to it.
-    for (int i = 0; i < (int)data.size() - 1; i++) {
-        // Size different, must be different chains or repeated fields.
-        if (data[i]->size() != data[i + 1]->size()) {
-            mergedData.push_back(data[i]);
-            continue;
+    mergedData.reserve(data.size());
+    // Indices in mergedData of the events with a given hash.
+    unordered_multimap<hash_t, size_t> eventIndices;
+    eventIndices.reserve(data.size());
+    for (shared_ptr<LogEvent>& event : data) {
+        const vector<FieldValue>& values = event->getValues();
+        hash_t hash = JenkinsHashMix(0, hash_type((int)values.size()));
+        for (const FieldValue& fieldValue : values) {
+            if (!isAdditive(fieldValue)) {
+                hash = JenkinsHashMix(hash, hashFieldValues(std::span(&fieldValue, 1)));
+            }
         }
-        vector<FieldValue>* lhsValues = data[i]->getMutableValues();
-        vector<FieldValue>* rhsValues = data[i + 1]->getMutableValues();
-        needMerge = true;
-        for (int p = 0; p < (int)lhsValues->size(); p++) {
-            if ((*lhsValues)[p].mField != (*rhsValues)[p].mField) {
-                needMerge = false;
-                break;
+
+        bool merged = false;
+        const auto [begin, end] = eventIndices.equal_range(hash);
+        for (auto it = begin; it != end && !merged; it++) {
+            vector<FieldValue>* mergedValues = mergedData[it->second]->getMutableValues();
+            // Different sizes mean different attribution chains or repeated fields.
+            if (mergedValues->size() != values.size()) {
+                continue;
             }
-            if ((*lhsValues)[p].mValue != (*rhsValues)[p].mValue) {
-                int pos = (*lhsValues)[p].mField.getPosAtDepth(0);
-                // Differ on non-additive field, abort.
-                // Repeated additive fields are treated as non-additive fields.
-                if (isPrimitiveRepeatedField((*lhsValues)[p].mField) ||
-                    (additiveFields.find(pos) == additiveFields.end())) {
-                    needMerge = false;
-                    break;
+            bool needMerge = true;
+            for (size_t p = 0; p < values.size() && needMerge; p++) {
+                const FieldValue& mergedValue = (*mergedValues)[p];
+                needMerge = mergedValue.mField == values[p].mField &&
+                            (isAdditive(mergedValue) || mergedValue.mValue == values[p].mValue);
+            }
+            if (!needMerge) {
+                continue;
+            }
+            // This should be infrequent operation.
+            for (size_t p = 0; p < values.size(); p++) {
+                if (isAdditive((*mergedValues)[p])) {
+                    (*mergedValues)[p].mValue += values[p].mValue;
                 }
             }
+            merged = true;
         }
-        if (!needMerge) {
-            mergedData.push_back(data[i]);
-            continue;
-        }
-        // This should be infrequent operation.
-        for (int p = 0; p < (int)lhsValues->size(); p++) {
-            int pos = (*lhsValues)[p].mField.getPosAtDepth(0);
-            // Don't merge repeated fields.
-            if (!isPrimitiveRepeatedField((*lhsValues)[p].mField) &&
-                (additiveFields.find(pos) != additiveFields.end())) {
-                (*rhsValues)[p].mValue += (*lhsValues)[p].mValue;
-            }
+        if (!merged) {
+            eventIndices.emplace(hash, mergedData.size());
+            mergedData.push_back(std::move(event));
         }
     }
-    mergedData.push_back(data.back());
 
-    data.clear();
-    data = mergedData;
+    data = std::move(mergedData);
 }
 
 }  // namespace statsd
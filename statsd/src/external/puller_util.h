@@ -16,8 +16,9 @@
 
 #pragma once
 
+#include <optional>
 #include <vector>
-#include "StatsPuller.h"
+
 #include "logd/LogEvent.h"
 #include "packages/UidMap.h"
 
@@ -25,6 +26,41 @@ namespace android {
 namespace os {
 namespace statsd {
 
+// How the rows of a pull may be aggregated: the rows with the same values of groupByFields may be
+// replaced by a single row holding the sum of their values of sumFields, and the values of any of
+// them in the other fields. Both hold top level field numbers, sorted and disjoint.
+struct PullAggregation {
+    std::vector<int> groupByFields;
+    std::vector<int> sumFields;
+
+    bool operator==(const PullAggregation& that) const {
+        return groupByFields == that.groupByFields && sumFields == that.sumFields;
+    }
+};
+
+// Sorts the fields, and drops the sum fields that are also grouped by.
+PullAggregation makePullAggregation(std::vector<int> groupByFields, std::vector<int> sumFields);
+
+// Whether rows aggregated as pulled can be used where they may be aggregated as requested. No
+// aggregation, nullopt, is only covered by itself but covers every aggregation.
+bool pullAggregationCovers(const std::optional<PullAggregation>& pulled,
+                           const std::optional<PullAggregation>& requested);
+
+// Returns the aggregation that covers both.
+std::optional<PullAggregation> mergePullAggregations(const std::optional<PullAggregation>& a,
+                                                     const std::optional<PullAggregation>& b);
+
+// Same as the above for the top level fields the rows of a pull need to hold, nullopt standing for
+// all of them.
+bool pullFieldMaskCovers(const std::optional<TopLevelFieldMask>& pulled,
+                         const std::optional<TopLevelFieldMask>& requested);
+
+std::optional<TopLevelFieldMask> mergePullFieldMasks(const std::optional<TopLevelFieldMask>& a,
+                                                     const std::optional<TopLevelFieldMask>& b);
+
+// The sorted top level field numbers in use in the mask.
+std::vector<int> getTopLevelFieldsInUse(const TopLevelFieldMask& mask);
+
 void mapAndMergeIsolatedUidsToHostUid(std::vector<std::shared_ptr<LogEvent>>& data,
                                       const sp<UidMap>& uidMap, int tagId,
                                       const vector<int>& additiveFieldsVec);
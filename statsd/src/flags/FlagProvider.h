@@ -40,6 +40,69 @@ const std::string STATSD_NATIVE_BOOT_NAMESPACE = "statsd_native_boot";
 
 const std::string STATSD_INIT_COMPLETED_NO_DELAY_FLAG = "statsd_init_completed_no_delay";
 
+const std::string STATSD_LOCK_FREE_EVENT_QUEUE_FLAG = "statsd_lock_free_event_queue";
+
+const std::string STATSD_PARALLEL_CONFIG_PROCESSING_FLAG = "statsd_parallel_config_processing";
+
+const std::string STATSD_PULL_ALARM_COALESCING_FLAG = "statsd_pull_alarm_coalescing";
+
+const std::string STATSD_ASYNC_DISK_WRITES_FLAG = "statsd_async_disk_writes";
+
+const std::string STATSD_REPORT_SEGMENTS_FLAG = "statsd_report_segments";
+
+const std::string STATSD_REPORT_COMPRESSION_FLAG = "statsd_report_compression";
+
+const std::string STATSD_RING_TRANSPORT_FLAG = "statsd_ring_transport";
+
+const std::string STATSD_ALARM_TIMER_WHEEL_FLAG = "statsd_alarm_timer_wheel";
+
+const std::string STATSD_ASYNC_RESTRICTED_INSERTS_FLAG = "statsd_async_restricted_inserts";
+
+const std::string STATSD_OFF_LOCK_CONFIG_BUILD_FLAG = "statsd_off_lock_config_build";
+
+const std::string STATSD_BUCKET_CHECKPOINTS_FLAG = "statsd_bucket_checkpoints";
+
+const std::string STATSD_EVENT_LATENCY_TRACING_FLAG = "statsd_event_latency_tracing";
+
+const std::string STATSD_APP_UPGRADE_COALESCING_FLAG = "statsd_app_upgrade_coalescing";
+
+const std::string STATSD_SUBSCRIPTION_RING_FLAG = "statsd_subscription_ring";
+
+const std::string STATSD_PER_CONFIG_DUMP_FLAG = "statsd_per_config_dumps";
+
+const std::string STATSD_PRIORITIZED_EVENT_QUEUE_FLAG = "statsd_prioritized_event_queue";
+
+const std::string STATSD_ADAPTIVE_EVENT_QUEUE_FLAG = "statsd_adaptive_event_queue";
+
+const std::string STATSD_STAGE_TRACING_FLAG = "statsd_stage_tracing";
+
+const std::string STATSD_PARALLEL_SOCKET_PARSING_FLAG = "statsd_parallel_socket_parsing";
+
+const std::string STATSD_SYSTEM_SOCKET_FLAG = "statsd_system_socket";
+
+const std::string STATSD_ASYNC_CONFIG_TEARDOWN_FLAG = "statsd_async_config_teardown";
+
+const std::string STATSD_CONFIG_ARENAS_FLAG = "statsd_config_arenas";
+
+const std::string STATSD_MEMORY_PRESSURE_SHEDDING_FLAG = "statsd_memory_pressure_shedding";
+
+const std::string STATSD_DEBOUNCED_ALARM_REGISTRATION_FLAG =
+        "statsd_debounced_alarm_registration";
+
+const std::string STATSD_INCREMENTAL_UID_MAP_FLAG = "statsd_incremental_uid_map";
+
+const std::string STATSD_INGESTION_ISOLATED_UIDS_FLAG = "statsd_ingestion_isolated_uids";
+
+const std::string STATSD_ASYNC_SUBSCRIBER_DISPATCH_FLAG = "statsd_async_subscriber_dispatch";
+
+const std::string STATSD_EVENT_QUEUE_SPILL_FLAG = "statsd_event_queue_spill";
+
+const std::string STATSD_IDLE_STATE_EVICTION_FLAG = "statsd_idle_state_eviction";
+
+const std::string STATSD_LOAD_SHEDDING_FLAG = "statsd_load_shedding";
+
+const std::string STATSD_CONFIG_MAJOR_BATCHES_FLAG = "statsd_config_major_batches";
+
 const std::string FLAG_TRUE = "true";
 const std::string FLAG_FALSE = "false";
 const std::string FLAG_EMPTY = "";
@@ -20,10 +20,14 @@
 
 #include <android/util/ProtoOutputStream.h>
 
+#include <algorithm>
+
 #include "../stats_log_util.h"
+#include "external/Perfetto.h"
 #include "shell/ShellSubscriber.h"
 #include "statslog_statsd.h"
 #include "storage/StorageManager.h"
+#include "utils/ProtoOutputStreamPool.h"
 #include "utils/ShardOffsetProvider.h"
 
 namespace android {
@@ -62,6 +66,9 @@ const int FIELD_ID_SHARD_OFFSET = 21;
 const int FIELD_ID_STATSD_STATS_ID = 22;
 const int FIELD_ID_SUBSCRIPTION_STATS = 23;
 const int FIELD_ID_SOCKET_LOSS_STATS = 24;
+const int FIELD_ID_SOCKET_READ_STATS = 25;
+const int FIELD_ID_REPORT_COMPRESSION_STATS = 26;
+const int FIELD_ID_EVENT_LATENCY_STATS = 27;
 
 const int FIELD_ID_RESTRICTED_METRIC_QUERY_STATS_CALLING_UID = 1;
 const int FIELD_ID_RESTRICTED_METRIC_QUERY_STATS_CONFIG_ID = 2;
@@ -89,6 +96,24 @@ const int FIELD_ID_LOG_LOSS_STATS_TAG = 4;
 const int FIELD_ID_LOG_LOSS_STATS_UID = 5;
 const int FIELD_ID_LOG_LOSS_STATS_PID = 6;
 
+const int FIELD_ID_SOCKET_READ_STATS_BATCH_SIZE_BINS = 1;
+const int FIELD_ID_BATCH_SIZE_BIN_BATCH_SIZE = 1;
+const int FIELD_ID_BATCH_SIZE_BIN_COUNT = 2;
+const int FIELD_ID_SOCKET_READ_STATS_SOCKET_CLASS_STATS = 2;
+const int FIELD_ID_SOCKET_CLASS_STATS_SOCKET_CLASS = 1;
+const int FIELD_ID_SOCKET_CLASS_STATS_DATAGRAM_COUNT = 2;
+const int FIELD_ID_SOCKET_CLASS_STATS_DROPPED_BY_WRITERS_COUNT = 3;
+const int FIELD_ID_SOCKET_CLASS_STATS_REJECTED_COUNT = 4;
+
+const int FIELD_ID_REPORT_COMPRESSION_STATS_CODEC = 1;
+const int FIELD_ID_REPORT_COMPRESSION_STATS_REPORT_COUNT = 2;
+const int FIELD_ID_REPORT_COMPRESSION_STATS_UNCOMPRESSED_REPORT_COUNT = 3;
+const int FIELD_ID_REPORT_COMPRESSION_STATS_UNCOMPRESSED_BYTES = 4;
+const int FIELD_ID_REPORT_COMPRESSION_STATS_STORED_BYTES = 5;
+
+const int FIELD_ID_EVENT_LATENCY_STATS_STAGE = 1;
+const int FIELD_ID_EVENT_LATENCY_STATS_HISTOGRAM = 2;
+
 const int FIELD_ID_OVERFLOW_COUNT = 1;
 const int FIELD_ID_OVERFLOW_MAX_HISTORY = 2;
 const int FIELD_ID_OVERFLOW_MIN_HISTORY = 3;
@@ -132,6 +157,17 @@ const int FIELD_ID_DB_DELETION_CONFIG_INVALID = 34;
 const int FIELD_ID_DB_DELETION_TOO_OLD = 35;
 const int FIELD_ID_DB_DELETION_CONFIG_REMOVED = 36;
 const int FIELD_ID_DB_DELETION_CONFIG_UPDATED = 37;
+const int FIELD_ID_CONFIG_STATS_EVENT_PROCESSING_COST = 38;
+const int FIELD_ID_CONFIG_STATS_METRIC_PROCESSING_COST = 39;
+const int FIELD_ID_CONFIG_STATS_SHED_EVENT_COUNT = 40;
+
+const int FIELD_ID_PROCESSING_COST_SAMPLE_COUNT = 1;
+const int FIELD_ID_PROCESSING_COST_WALL_TIME_NS = 2;
+const int FIELD_ID_PROCESSING_COST_CPU_TIME_NS = 3;
+
+const int FIELD_ID_METRIC_PROCESSING_COST_METRIC_ID = 1;
+const int FIELD_ID_METRIC_PROCESSING_COST_MATCHED_EVENT = 2;
+const int FIELD_ID_METRIC_PROCESSING_COST_PULLED_DATA = 3;
 
 const int FIELD_ID_INVALID_CONFIG_REASON_ENUM = 1;
 const int FIELD_ID_INVALID_CONFIG_REASON_METRIC_ID = 2;
@@ -203,7 +239,6 @@ const std::map<int, std::pair<size_t, size_t>> StatsdStats::kAtomDimensionKeySiz
 };
 
 StatsdStats::StatsdStats() : mStatsdStatsId(rand()) {
-    mPushedAtomStats.resize(kMaxPushedAtomId + 1);
     mStartTimeSec = getWallClockSec();
 }
 
@@ -282,9 +317,6 @@ void StatsdStats::noteConfigReset(const ConfigKey& key) {
 void StatsdStats::noteLogLost(int32_t wallClockTimeSec, int32_t count, int32_t lastError,
                               int32_t lastTag, int32_t uid, int32_t pid) {
     lock_guard<std::mutex> lock(mLock);
-    if (mLogLossStats.size() == kMaxLoggerErrors) {
-        mLogLossStats.pop_front();
-    }
     mLogLossStats.emplace_back(wallClockTimeSec, count, lastError, lastTag, uid, pid);
 }
 
@@ -299,9 +331,6 @@ void StatsdStats::noteBroadcastSent(const ConfigKey& key, int32_t timeSec) {
         ALOGE("Config key %s not found!", key.ToString().c_str());
         return;
     }
-    if (it->second->broadcast_sent_time_sec.size() == kMaxTimestampCount) {
-        it->second->broadcast_sent_time_sec.pop_front();
-    }
     it->second->broadcast_sent_time_sec.push_back(timeSec);
 }
 
@@ -318,9 +347,6 @@ void StatsdStats::noteActiveStatusChanged(const ConfigKey& key, bool activated,
     }
     auto& vec = activated ? it->second->activation_time_sec
                           : it->second->deactivation_time_sec;
-    if (vec.size() == kMaxTimestampCount) {
-        vec.pop_front();
-    }
     vec.push_back(timeSec);
 }
 
@@ -331,9 +357,6 @@ void StatsdStats::noteActivationBroadcastGuardrailHit(const int uid) {
 void StatsdStats::noteActivationBroadcastGuardrailHit(const int uid, const int32_t timeSec) {
     lock_guard<std::mutex> lock(mLock);
     auto& guardrailTimes = mActivationBroadcastGuardrailStats[uid];
-    if (guardrailTimes.size() == kMaxTimestampCount) {
-        guardrailTimes.pop_front();
-    }
     guardrailTimes.push_back(timeSec);
 }
 
@@ -361,6 +384,73 @@ void StatsdStats::noteEventQueueOverflow(int64_t oldestEventTimestampNs, int32_t
     noteAtomDroppedLocked(atomId);
 }
 
+void StatsdStats::noteSocketReadBatch(int batchSize) {
+    if (batchSize <= 0) {
+        return;
+    }
+    lock_guard<std::mutex> lock(mLock);
+    mSocketReadBatchSizeHistogram[std::min(batchSize, kMaxSocketReadBatchSize) - 1]++;
+}
+
+void StatsdStats::noteSocketClassRead(int socketClass, int datagramCount) {
+    if (socketClass < 0 || socketClass >= kNumSocketClasses) {
+        return;
+    }
+    lock_guard<std::mutex> lock(mLock);
+    mSocketClassStats[socketClass].datagramCount += datagramCount;
+}
+
+void StatsdStats::noteSocketClassLogLost(int socketClass, int droppedCount) {
+    if (socketClass < 0 || socketClass >= kNumSocketClasses) {
+        return;
+    }
+    lock_guard<std::mutex> lock(mLock);
+    mSocketClassStats[socketClass].droppedByWritersCount += droppedCount;
+}
+
+void StatsdStats::noteSocketClassRejected(int socketClass) {
+    if (socketClass < 0 || socketClass >= kNumSocketClasses) {
+        return;
+    }
+    lock_guard<std::mutex> lock(mLock);
+    mSocketClassStats[socketClass].rejectedCount++;
+}
+
+void StatsdStats::noteReportCompression(int32_t codec, size_t uncompressedBytes,
+                                        size_t storedBytes) {
+    lock_guard<std::mutex> lock(mLock);
+    ReportCompressionStats& stats = mReportCompressionStats[codec];
+    stats.reportCount++;
+    if (storedBytes >= uncompressedBytes) {
+        stats.uncompressedReportCount++;
+    }
+    stats.uncompressedBytes += uncompressedBytes;
+    stats.storedBytes += storedBytes;
+}
+
+void StatsdStats::setEventLatencySampleInterval(uint32_t sampleInterval) {
+    mEventLatencySampleInterval.store(sampleInterval, std::memory_order_relaxed);
+}
+
+void StatsdStats::noteEventLatency(EventLatencyStage stage, int64_t latencyNs) {
+    static const char* const kCounterNames[EVENT_LATENCY_STAGE_COUNT] = {
+            "statsd_event_latency_parse_us", "statsd_event_latency_queue_us",
+            "statsd_event_latency_dispatch_us", "statsd_event_latency_config_us",
+            "statsd_event_latency_total_us"};
+    if (stage < 0 || stage >= EVENT_LATENCY_STAGE_COUNT) {
+        return;
+    }
+    const int64_t latencyMicros = latencyNs / 1000;
+    TraceCounter(kCounterNames[stage], latencyMicros);
+    int bin = 0;
+    while (bin < (int)kEventLatencyHistogramBoundsMicros.size() &&
+           latencyMicros >= kEventLatencyHistogramBoundsMicros[bin]) {
+        bin++;
+    }
+    lock_guard<std::mutex> lock(mLock);
+    mEventLatencyHistograms[stage][bin]++;
+}
+
 void StatsdStats::noteAtomDroppedLocked(int32_t atomId) {
     constexpr int kMaxPushedAtomDroppedStatsSize = kMaxPushedAtomId + kMaxNonPlatformPushedAtoms;
     if (mPushedAtomDropsStats.size() < kMaxPushedAtomDroppedStatsSize ||
@@ -404,10 +494,6 @@ void StatsdStats::noteDataDropped(const ConfigKey& key, const size_t totalBytes,
         ALOGE("Config key %s not found!", key.ToString().c_str());
         return;
     }
-    if (it->second->data_drop_time_sec.size() == kMaxTimestampCount) {
-        it->second->data_drop_time_sec.pop_front();
-        it->second->data_drop_bytes.pop_front();
-    }
     it->second->data_drop_time_sec.push_back(timeSec);
     it->second->data_drop_bytes.push_back(totalBytes);
 }
@@ -425,10 +511,6 @@ void StatsdStats::noteMetricsReportSent(const ConfigKey& key, const size_t numBy
         ALOGE("Config key %s not found!", key.ToString().c_str());
         return;
     }
-
-    if (it->second->dump_report_stats.size() == kMaxTimestampCount) {
-        it->second->dump_report_stats.pop_front();
-    }
     it->second->dump_report_stats.emplace_back(timeSec, numBytes, reportNumber);
 }
 
@@ -583,6 +665,65 @@ void StatsdStats::noteMatcherMatched(const ConfigKey& key, const int64_t& id) {
     statsIt->second->matcher_stats[id]++;
 }
 
+void StatsdStats::noteMatchersMatched(const ConfigKey& key,
+                                      const std::vector<int64_t>& ids) {
+    lock_guard<std::mutex> lock(mLock);
+
+    auto statsIt = mConfigStats.find(key);
+    if (statsIt == mConfigStats.end()) {
+        return;
+    }
+    for (const int64_t id : ids) {
+        statsIt->second->matcher_stats[id]++;
+    }
+}
+
+static void addProcessingCost(int64_t wallTimeNs, int64_t cpuTimeNs, ProcessingCost* cost) {
+    cost->sample_count++;
+    cost->wall_time_ns += wallTimeNs;
+    cost->cpu_time_ns += cpuTimeNs;
+}
+
+void StatsdStats::noteEventProcessingCost(const ConfigKey& key, int64_t wallTimeNs,
+                                          int64_t cpuTimeNs,
+                                          const std::vector<MetricCostSample>& metricCosts) {
+    lock_guard<std::mutex> lock(mLock);
+
+    auto statsIt = mConfigStats.find(key);
+    if (statsIt == mConfigStats.end()) {
+        return;
+    }
+    addProcessingCost(wallTimeNs, cpuTimeNs, &statsIt->second->event_processing_cost);
+    for (const MetricCostSample& metricCost : metricCosts) {
+        addProcessingCost(
+                metricCost.wallTimeNs, metricCost.cpuTimeNs,
+                &statsIt->second->metric_processing_cost[metricCost.metricId].matched_event_cost);
+    }
+}
+
+void StatsdStats::notePulledDataProcessingCost(const ConfigKey& key,
+                                               const MetricCostSample& metricCost) {
+    lock_guard<std::mutex> lock(mLock);
+
+    auto statsIt = mConfigStats.find(key);
+    if (statsIt == mConfigStats.end()) {
+        return;
+    }
+    addProcessingCost(
+            metricCost.wallTimeNs, metricCost.cpuTimeNs,
+            &statsIt->second->metric_processing_cost[metricCost.metricId].pulled_data_cost);
+}
+
+void StatsdStats::noteEventsShed(const ConfigKey& key, int64_t count) {
+    lock_guard<std::mutex> lock(mLock);
+
+    auto statsIt = mConfigStats.find(key);
+    if (statsIt == mConfigStats.end()) {
+        return;
+    }
+    statsIt->second->shed_event_count += count;
+}
+
 void StatsdStats::noteAnomalyDeclared(const ConfigKey& key, const int64_t& id) {
     lock_guard<std::mutex> lock(mLock);
     auto statsIt = mConfigStats.find(key);
@@ -625,6 +766,22 @@ void StatsdStats::notePullTime(int pullAtomId, int64_t pullTimeNs) {
     pullStats.avgPullTimeNs = (pullStats.avgPullTimeNs * pullStats.numPullTime + pullTimeNs) /
                               (pullStats.numPullTime + 1);
     pullStats.numPullTime += 1;
+    const int64_t pullTimeMillis = NanoToMillis(pullTimeNs);
+    int bin = 0;
+    while (bin < (int)kPullTimeHistogramBoundsMillis.size() &&
+           pullTimeMillis >= kPullTimeHistogramBoundsMillis[bin]) {
+        bin++;
+    }
+    pullStats.pullTimeHistogram[bin]++;
+}
+
+void StatsdStats::noteSlowPullerCoolDownPenalty(int pullAtomId, int64_t penaltyNs) {
+    lock_guard<std::mutex> lock(mLock);
+    auto& pullStats = mPulledAtomStats[pullAtomId];
+    pullStats.coolDownPenaltyNs = penaltyNs;
+    if (penaltyNs > 0) {
+        pullStats.slowPullerPenaltyCount++;
+    }
 }
 
 void StatsdStats::notePullDelay(int pullAtomId, int64_t pullDelayNs) {
@@ -637,6 +794,16 @@ void StatsdStats::notePullDelay(int pullAtomId, int64_t pullDelayNs) {
     pullStats.numPullDelay += 1;
 }
 
+void StatsdStats::notePullQueueDelay(int pullAtomId, int64_t queueDelayNs) {
+    lock_guard<std::mutex> lock(mLock);
+    auto& pullStats = mPulledAtomStats[pullAtomId];
+    pullStats.maxPullQueueDelayNs = std::max(pullStats.maxPullQueueDelayNs, queueDelayNs);
+    pullStats.avgPullQueueDelayNs =
+        (pullStats.avgPullQueueDelayNs * pullStats.numPullQueueDelay + queueDelayNs) /
+            (pullStats.numPullQueueDelay + 1);
+    pullStats.numPullQueueDelay += 1;
+}
+
 void StatsdStats::notePullDataError(int pullAtomId) {
     lock_guard<std::mutex> lock(mLock);
     mPulledAtomStats[pullAtomId].dataError++;
@@ -649,9 +816,6 @@ void StatsdStats::notePullTimeout(int pullAtomId,
     PulledAtomStats& pulledAtomStats = mPulledAtomStats[pullAtomId];
     pulledAtomStats.pullTimeout++;
 
-    if (pulledAtomStats.pullTimeoutMetadata.size() == kMaxTimestampCount) {
-        pulledAtomStats.pullTimeoutMetadata.pop_front();
-    }
 
     pulledAtomStats.pullTimeoutMetadata.emplace_back(pullUptimeMillis, pullElapsedMillis);
 }
@@ -662,6 +826,11 @@ void StatsdStats::notePullExceedMaxDelay(int pullAtomId) {
 }
 
 void StatsdStats::noteAtomLogged(int atomId, int32_t /*timeSec*/, bool isSkipped) {
+    if (atomId >= 0 && atomId <= kMaxPushedAtomId) {
+        // Platform atoms have atomic counters and do not need the lock.
+        noteAtomLoggedLocked(atomId, isSkipped);
+        return;
+    }
     lock_guard<std::mutex> lock(mLock);
 
     noteAtomLoggedLocked(atomId, isSkipped);
@@ -669,8 +838,10 @@ void StatsdStats::noteAtomLogged(int atomId, int32_t /*timeSec*/, bool isSkipped
 
 void StatsdStats::noteAtomLoggedLocked(int atomId, bool isSkipped) {
     if (atomId >= 0 && atomId <= kMaxPushedAtomId) {
-        mPushedAtomStats[atomId].logCount++;
-        mPushedAtomStats[atomId].skipCount += isSkipped;
+        mPushedAtomStats[atomId].logCount.fetch_add(1, std::memory_order_relaxed);
+        if (isSkipped) {
+            mPushedAtomStats[atomId].skipCount.fetch_add(1, std::memory_order_relaxed);
+        }
     } else {
         if (atomId < 0) {
             android_errorWriteLog(0x534e4554, "187957589");
@@ -686,9 +857,6 @@ void StatsdStats::noteAtomLoggedLocked(int atomId, bool isSkipped) {
 void StatsdStats::noteSystemServerRestart(int32_t timeSec) {
     lock_guard<std::mutex> lock(mLock);
 
-    if (mSystemServerRestartSec.size() == kMaxSystemServerRestarts) {
-        mSystemServerRestartSec.pop_front();
-    }
     mSystemServerRestartSec.push_back(timeSec);
 }
 
@@ -884,9 +1052,6 @@ void StatsdStats::noteRestrictedMetricFlushLatency(const ConfigKey& configKey,
         return;
     }
     auto& restrictedMetricStats = it->second->restricted_metric_stats[metricId];
-    if (restrictedMetricStats.flushLatencyNs.size() == kMaxRestrictedMetricFlushLatencyCount) {
-        restrictedMetricStats.flushLatencyNs.pop_front();
-    }
     restrictedMetricStats.flushLatencyNs.push_back(flushLatencyNs);
 }
 
@@ -898,11 +1063,7 @@ void StatsdStats::noteRestrictedConfigFlushLatency(const ConfigKey& configKey,
         ALOGE("Config key %s not found!", configKey.ToString().c_str());
         return;
     }
-    std::list<int64_t>& totalFlushLatencies = it->second->total_flush_latency_ns;
-    if (totalFlushLatencies.size() == kMaxRestrictedConfigFlushLatencyCount) {
-        totalFlushLatencies.pop_front();
-    }
-    totalFlushLatencies.push_back(totalFlushLatencyNs);
+    it->second->total_flush_latency_ns.push_back(totalFlushLatencyNs);
 }
 
 void StatsdStats::noteRestrictedConfigDbSize(const ConfigKey& configKey,
@@ -913,14 +1074,8 @@ void StatsdStats::noteRestrictedConfigDbSize(const ConfigKey& configKey,
         ALOGE("Config key %s not found!", configKey.ToString().c_str());
         return;
     }
-    std::list<int64_t>& totalDbSizeTimestamps = it->second->total_db_size_timestamps;
-    std::list<int64_t>& totaDbSizes = it->second->total_db_sizes;
-    if (totalDbSizeTimestamps.size() == kMaxRestrictedConfigDbSizeCount) {
-        totalDbSizeTimestamps.pop_front();
-        totaDbSizes.pop_front();
-    }
-    totalDbSizeTimestamps.push_back(elapsedTimeNs);
-    totaDbSizes.push_back(dbSize);
+    it->second->total_db_size_timestamps.push_back(elapsedTimeNs);
+    it->second->total_db_sizes.push_back(dbSize);
 }
 
 void StatsdStats::noteRestrictedMetricCategoryChanged(const ConfigKey& configKey,
@@ -1020,7 +1175,10 @@ void StatsdStats::resetInternalLocked() {
     // Reset the historical data, but keep the active ConfigStats
     mStartTimeSec = getWallClockSec();
     mIceBox.clear();
-    std::fill(mPushedAtomStats.begin(), mPushedAtomStats.end(), PushedAtomStats());
+    for (PlatformPushedAtomStats& atomStats : mPushedAtomStats) {
+        atomStats.logCount.store(0, std::memory_order_relaxed);
+        atomStats.skipCount.store(0, std::memory_order_relaxed);
+    }
     mNonPlatformPushedAtomStats.clear();
     mAnomalyAlarmRegisteredStats = 0;
     mPeriodicAlarmRegisteredStats = 0;
@@ -1029,6 +1187,12 @@ void StatsdStats::resetInternalLocked() {
     mOverflowCount = 0;
     mMinQueueHistoryNs = kInt64Max;
     mMaxQueueHistoryNs = 0;
+    mSocketReadBatchSizeHistogram.fill(0);
+    mSocketClassStats.fill({});
+    mReportCompressionStats.clear();
+    for (auto& histogram : mEventLatencyHistograms) {
+        histogram.fill(0);
+    }
     for (auto& config : mConfigStats) {
         config.second->broadcast_sent_time_sec.clear();
         config.second->activation_time_sec.clear();
@@ -1043,6 +1207,9 @@ void StatsdStats::resetInternalLocked() {
         config.second->metric_dimension_in_condition_stats.clear();
         config.second->alert_stats.clear();
         config.second->restricted_metric_stats.clear();
+        config.second->event_processing_cost = ProcessingCost();
+        config.second->metric_processing_cost.clear();
+        config.second->shed_event_count = 0;
         config.second->db_corrupted_count = 0;
         config.second->total_flush_latency_ns.clear();
         config.second->total_db_size_timestamps.clear();
@@ -1076,6 +1243,11 @@ void StatsdStats::resetInternalLocked() {
         pullStats.second.binderCallFailCount = 0;
         pullStats.second.pullTimeoutMetadata.clear();
         pullStats.second.subscriptionPullCount = 0;
+        pullStats.second.avgPullQueueDelayNs = 0;
+        pullStats.second.maxPullQueueDelayNs = 0;
+        pullStats.second.numPullQueueDelay = 0;
+        pullStats.second.pullTimeHistogram.fill(0);
+        pullStats.second.slowPullerPenaltyCount = 0;
     }
     mAtomMetricStats.clear();
     mActivationBroadcastGuardrailStats.clear();
@@ -1299,6 +1471,28 @@ void StatsdStats::dumpStats(int out) const {
             dprintf(out, "alert %lld declared %d times\n", (long long)stats.first, stats.second);
         }
 
+        const ProcessingCost& eventCost = configStats->event_processing_cost;
+        if (eventCost.sample_count > 0) {
+            dprintf(out, "event processing cost: %lld samples, wall %lld ns, cpu %lld ns\n",
+                    (long long)eventCost.sample_count, (long long)eventCost.wall_time_ns,
+                    (long long)eventCost.cpu_time_ns);
+        }
+        if (configStats->shed_event_count > 0) {
+            dprintf(out, "events shed under load: %lld\n",
+                    (long long)configStats->shed_event_count);
+        }
+        for (const auto& [metricId, cost] : configStats->metric_processing_cost) {
+            dprintf(out,
+                    "metric %lld cost: matched events %lld samples, wall %lld ns, cpu %lld ns; "
+                    "pulled data %lld samples, wall %lld ns, cpu %lld ns\n",
+                    (long long)metricId, (long long)cost.matched_event_cost.sample_count,
+                    (long long)cost.matched_event_cost.wall_time_ns,
+                    (long long)cost.matched_event_cost.cpu_time_ns,
+                    (long long)cost.pulled_data_cost.sample_count,
+                    (long long)cost.pulled_data_cost.wall_time_ns,
+                    (long long)cost.pulled_data_cost.cpu_time_ns);
+        }
+
         for (const auto& stats : configStats->restricted_metric_stats) {
             dprintf(out, "Restricted MetricId %lld: ", (long long)stats.first);
             dprintf(out, "Insert error %lld, ", (long long)stats.second.insertError);
@@ -1328,11 +1522,13 @@ void StatsdStats::dumpStats(int out) const {
     dprintf(out, "********Pushed Atom stats***********\n");
     const size_t atomCounts = mPushedAtomStats.size();
     for (size_t i = 2; i < atomCounts; i++) {
-        if (mPushedAtomStats[i].logCount > 0) {
+        const int logCount = mPushedAtomStats[i].logCount.load(std::memory_order_relaxed);
+        if (logCount > 0) {
             dprintf(out,
                     "Atom %zu->(total count)%d, (error count)%d, (drop count)%d, (skip count)%d\n",
-                    i, mPushedAtomStats[i].logCount, getPushedAtomErrorsLocked((int)i),
-                    getPushedAtomDropsLocked((int)i), mPushedAtomStats[i].skipCount);
+                    i, logCount, getPushedAtomErrorsLocked((int)i),
+                    getPushedAtomDropsLocked((int)i),
+                    mPushedAtomStats[i].skipCount.load(std::memory_order_relaxed));
         }
     }
     for (const auto& pair : mNonPlatformPushedAtomStats) {
@@ -1352,7 +1548,8 @@ void StatsdStats::dumpStats(int out) const {
                 "  (pull timeout)%ld, (pull exceed max delay)%ld"
                 "  (no uid provider count)%ld, (no puller found count)%ld\n"
                 "  (registered count) %ld, (unregistered count) %ld"
-                "  (atom error count) %d, (subscription pull count) %d, (binder call failed) %ld\n",
+                "  (atom error count) %d, (subscription pull count) %d, (binder call failed) %ld\n"
+                "  (average pull queue delay nanos)%lld, (max pull queue delay nanos)%lld\n",
                 (int)pair.first, (long)pair.second.totalPull, (long)pair.second.totalPullFromCache,
                 (long)pair.second.pullFailed, (long)pair.second.minPullIntervalSec,
                 (long long)pair.second.avgPullTimeNs, (long long)pair.second.maxPullTimeNs,
@@ -1361,7 +1558,24 @@ void StatsdStats::dumpStats(int out) const {
                 pair.second.pullUidProviderNotFound, pair.second.pullerNotFound,
                 pair.second.registeredCount, pair.second.unregisteredCount,
                 pair.second.atomErrorCount, pair.second.subscriptionPullCount,
-                pair.second.binderCallFailCount);
+                pair.second.binderCallFailCount, (long long)pair.second.avgPullQueueDelayNs,
+                (long long)pair.second.maxPullQueueDelayNs);
+        string pullTimeHistogram = "  (pull time histogram millis)";
+        for (int i = 0; i < kNumPullTimeHistogramBins; i++) {
+            pullTimeHistogram.append(i == 0 ? " " : ", ");
+            if (i < (int)kPullTimeHistogramBoundsMillis.size()) {
+                pullTimeHistogram.append("<").append(to_string(kPullTimeHistogramBoundsMillis[i]));
+            } else {
+                pullTimeHistogram.append(">=").append(
+                        to_string(kPullTimeHistogramBoundsMillis.back()));
+            }
+            pullTimeHistogram.append(":").append(to_string(pair.second.pullTimeHistogram[i]));
+        }
+        dprintf(out, "%s\n", pullTimeHistogram.c_str());
+        if (pair.second.slowPullerPenaltyCount > 0) {
+            dprintf(out, "  (slow puller cool down penalty nanos)%lld, (slow puller penalties)%ld\n",
+                    (long long)pair.second.coolDownPenaltyNs, pair.second.slowPullerPenaltyCount);
+        }
         if (pair.second.pullTimeoutMetadata.size() > 0) {
             string uptimeMillis = "(pull timeout system uptime millis) ";
             string pullTimeoutMillis = "(pull timeout elapsed time millis) ";
@@ -1429,6 +1643,48 @@ void StatsdStats::dumpStats(int out) const {
     dprintf(out, "Event queue overflow: %d; MaxHistoryNs: %lld; MinHistoryNs: %lld\n",
             mOverflowCount, (long long)mMaxQueueHistoryNs, (long long)mMinQueueHistoryNs);
 
+    dprintf(out, "********SocketReadBatch stats***********\n");
+    for (int i = 0; i < kMaxSocketReadBatchSize; i++) {
+        if (mSocketReadBatchSizeHistogram[i] > 0) {
+            dprintf(out, "Batch size %d: %lld reads\n", i + 1,
+                    (long long)mSocketReadBatchSizeHistogram[i]);
+        }
+    }
+    for (int i = 0; i < kNumSocketClasses; i++) {
+        const SocketClassStats& stats = mSocketClassStats[i];
+        if (stats.datagramCount > 0 || stats.droppedByWritersCount > 0 ||
+            stats.rejectedCount > 0) {
+            dprintf(out,
+                    "Socket class %d: %lld datagrams, %lld dropped by writers, %lld rejected\n", i,
+                    (long long)stats.datagramCount, (long long)stats.droppedByWritersCount,
+                    (long long)stats.rejectedCount);
+        }
+    }
+
+    dprintf(out, "********ReportCompression stats***********\n");
+    for (const auto& [codec, stats] : mReportCompressionStats) {
+        dprintf(out,
+                "Codec %d: %lld reports (%lld uncompressed), %lld bytes stored as %lld bytes\n",
+                codec, (long long)stats.reportCount, (long long)stats.uncompressedReportCount,
+                (long long)stats.uncompressedBytes, (long long)stats.storedBytes);
+    }
+
+    dprintf(out, "********EventLatency stats***********\n");
+    for (int stage = 0; stage < EVENT_LATENCY_STAGE_COUNT; stage++) {
+        string histogram;
+        for (int i = 0; i < kNumEventLatencyHistogramBins; i++) {
+            histogram.append(i == 0 ? " " : ", ");
+            if (i < (int)kEventLatencyHistogramBoundsMicros.size()) {
+                histogram.append("<").append(to_string(kEventLatencyHistogramBoundsMicros[i]));
+            } else {
+                histogram.append(">=").append(
+                        to_string(kEventLatencyHistogramBoundsMicros.back()));
+            }
+            histogram.append(":").append(to_string(mEventLatencyHistograms[stage][i]));
+        }
+        dprintf(out, "Stage %d (latency histogram micros)%s\n", stage, histogram.c_str());
+    }
+
     if (mActivationBroadcastGuardrailStats.size() > 0) {
         dprintf(out, "********mActivationBroadcastGuardrail stats***********\n");
         for (const auto& pair: mActivationBroadcastGuardrailStats) {
@@ -1476,6 +1732,18 @@ void StatsdStats::dumpStats(int out) const {
     dprintf(out, "Shard Offset: %u\n", ShardOffsetProvider::getInstance().getShardOffset());
 }
 
+static void writeProcessingCostToProto(int fieldId, const ProcessingCost& cost,
+                                       ProtoOutputStream* proto) {
+    uint64_t token = proto->start(FIELD_TYPE_MESSAGE | fieldId);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_PROCESSING_COST_SAMPLE_COUNT,
+                 (long long)cost.sample_count);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_PROCESSING_COST_WALL_TIME_NS,
+                 (long long)cost.wall_time_ns);
+    proto->write(FIELD_TYPE_INT64 | FIELD_ID_PROCESSING_COST_CPU_TIME_NS,
+                 (long long)cost.cpu_time_ns);
+    proto->end(token);
+}
+
 void addConfigStatsToProto(const ConfigStats& configStats, ProtoOutputStream* proto) {
     uint64_t token =
             proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_CONFIG_STATS);
@@ -1680,13 +1948,35 @@ void addConfigStatsToProto(const ConfigStats& configStats, ProtoOutputStream* pr
                              FIELD_COUNT_REPEATED,
                      dbSize);
     }
+    if (configStats.event_processing_cost.sample_count > 0) {
+        writeProcessingCostToProto(FIELD_ID_CONFIG_STATS_EVENT_PROCESSING_COST,
+                                   configStats.event_processing_cost, proto);
+    }
+    for (const auto& [metricId, cost] : configStats.metric_processing_cost) {
+        uint64_t costToken = proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
+                                          FIELD_ID_CONFIG_STATS_METRIC_PROCESSING_COST);
+        proto->write(FIELD_TYPE_INT64 | FIELD_ID_METRIC_PROCESSING_COST_METRIC_ID,
+                     (long long)metricId);
+        if (cost.matched_event_cost.sample_count > 0) {
+            writeProcessingCostToProto(FIELD_ID_METRIC_PROCESSING_COST_MATCHED_EVENT,
+                                       cost.matched_event_cost, proto);
+        }
+        if (cost.pulled_data_cost.sample_count > 0) {
+            writeProcessingCostToProto(FIELD_ID_METRIC_PROCESSING_COST_PULLED_DATA,
+                                       cost.pulled_data_cost, proto);
+        }
+        proto->end(costToken);
+    }
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_CONFIG_STATS_SHED_EVENT_COUNT,
+                             configStats.shed_event_count, proto);
     proto->end(token);
 }
 
 void StatsdStats::dumpStats(std::vector<uint8_t>* output, bool reset) {
     lock_guard<std::mutex> lock(mLock);
 
-    ProtoOutputStream proto;
+    ProtoOutputStreamPool::Stream pooledProto = ProtoOutputStreamPool::getInstance().acquire();
+    ProtoOutputStream& proto = *pooledProto;
     proto.write(FIELD_TYPE_INT32 | FIELD_ID_BEGIN_TIME, mStartTimeSec);
     proto.write(FIELD_TYPE_INT32 | FIELD_ID_END_TIME, (int32_t)getWallClockSec());
 
@@ -1700,19 +1990,21 @@ void StatsdStats::dumpStats(std::vector<uint8_t>* output, bool reset) {
 
     const size_t atomCounts = mPushedAtomStats.size();
     for (size_t i = 2; i < atomCounts; i++) {
-        if (mPushedAtomStats[i].logCount > 0) {
+        const int logCount = mPushedAtomStats[i].logCount.load(std::memory_order_relaxed);
+        if (logCount > 0) {
             uint64_t token =
                     proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM_STATS | FIELD_COUNT_REPEATED);
             proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_TAG, (int32_t)i);
-            proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_COUNT, mPushedAtomStats[i].logCount);
+            proto.write(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_COUNT, logCount);
             const int errors = getPushedAtomErrorsLocked(i);
             writeNonZeroStatToStream(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_ERROR_COUNT, errors,
                                      &proto);
             const int drops = getPushedAtomDropsLocked(i);
             writeNonZeroStatToStream(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_DROPS_COUNT, drops,
                                      &proto);
-            writeNonZeroStatToStream(FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_SKIP_COUNT,
-                                     mPushedAtomStats[i].skipCount, &proto);
+            writeNonZeroStatToStream(
+                    FIELD_TYPE_INT32 | FIELD_ID_ATOM_STATS_SKIP_COUNT,
+                    mPushedAtomStats[i].skipCount.load(std::memory_order_relaxed), &proto);
             proto.end(token);
         }
     }
@@ -1906,6 +2198,71 @@ void StatsdStats::dumpStats(std::vector<uint8_t>* output, bool reset) {
 
     proto.end(socketLossStatsToken);
 
+    const uint64_t socketReadStatsToken =
+            proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_SOCKET_READ_STATS);
+    for (int i = 0; i < kMaxSocketReadBatchSize; i++) {
+        if (mSocketReadBatchSizeHistogram[i] == 0) {
+            continue;
+        }
+        uint64_t token =
+                proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_SOCKET_READ_STATS_BATCH_SIZE_BINS |
+                            FIELD_COUNT_REPEATED);
+        proto.write(FIELD_TYPE_INT32 | FIELD_ID_BATCH_SIZE_BIN_BATCH_SIZE, i + 1);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_BATCH_SIZE_BIN_COUNT,
+                    (long long)mSocketReadBatchSizeHistogram[i]);
+        proto.end(token);
+    }
+    for (int i = 0; i < kNumSocketClasses; i++) {
+        const SocketClassStats& stats = mSocketClassStats[i];
+        if (stats.datagramCount == 0 && stats.droppedByWritersCount == 0 &&
+            stats.rejectedCount == 0) {
+            continue;
+        }
+        uint64_t token =
+                proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_SOCKET_READ_STATS_SOCKET_CLASS_STATS |
+                            FIELD_COUNT_REPEATED);
+        proto.write(FIELD_TYPE_INT32 | FIELD_ID_SOCKET_CLASS_STATS_SOCKET_CLASS, i);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_SOCKET_CLASS_STATS_DATAGRAM_COUNT,
+                    (long long)stats.datagramCount);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_SOCKET_CLASS_STATS_DROPPED_BY_WRITERS_COUNT,
+                    (long long)stats.droppedByWritersCount);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_SOCKET_CLASS_STATS_REJECTED_COUNT,
+                    (long long)stats.rejectedCount);
+        proto.end(token);
+    }
+    proto.end(socketReadStatsToken);
+
+    for (const auto& [codec, stats] : mReportCompressionStats) {
+        uint64_t token = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_REPORT_COMPRESSION_STATS |
+                                     FIELD_COUNT_REPEATED);
+        proto.write(FIELD_TYPE_INT32 | FIELD_ID_REPORT_COMPRESSION_STATS_CODEC, codec);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_REPORT_COMPRESSION_STATS_REPORT_COUNT,
+                    (long long)stats.reportCount);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_REPORT_COMPRESSION_STATS_UNCOMPRESSED_REPORT_COUNT,
+                    (long long)stats.uncompressedReportCount);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_REPORT_COMPRESSION_STATS_UNCOMPRESSED_BYTES,
+                    (long long)stats.uncompressedBytes);
+        proto.write(FIELD_TYPE_INT64 | FIELD_ID_REPORT_COMPRESSION_STATS_STORED_BYTES,
+                    (long long)stats.storedBytes);
+        proto.end(token);
+    }
+
+    for (int stage = 0; stage < EVENT_LATENCY_STAGE_COUNT; stage++) {
+        const auto& histogram = mEventLatencyHistograms[stage];
+        if (std::all_of(histogram.begin(), histogram.end(), [](int64_t n) { return n == 0; })) {
+            continue;
+        }
+        uint64_t token = proto.start(FIELD_TYPE_MESSAGE | FIELD_ID_EVENT_LATENCY_STATS |
+                                     FIELD_COUNT_REPEATED);
+        proto.write(FIELD_TYPE_INT32 | FIELD_ID_EVENT_LATENCY_STATS_STAGE, stage);
+        for (const int64_t count : histogram) {
+            proto.write(FIELD_TYPE_INT64 | FIELD_ID_EVENT_LATENCY_STATS_HISTOGRAM |
+                                FIELD_COUNT_REPEATED,
+                        (long long)count);
+        }
+        proto.end(token);
+    }
+
     output->clear();
     proto.serializeToVector(output);
 
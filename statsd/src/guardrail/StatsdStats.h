@@ -19,6 +19,8 @@
 #include <log/log_time.h>
 #include <src/guardrail/stats_log_enums.pb.h>
 
+#include <array>
+#include <atomic>
 #include <list>
 #include <mutex>
 #include <string>
@@ -27,6 +29,7 @@
 
 #include "config/ConfigKey.h"
 #include "logd/logevent_util.h"
+#include "utils/RingBuffer.h"
 
 namespace android {
 namespace os {
@@ -53,15 +56,19 @@ struct InvalidConfigReason {
     }
 };
 
+// Number of entries kept by each history of ConfigStats, the oldest ones are overwritten.
+const int kMaxConfigHistorySize = 20;
+
 typedef struct {
     int64_t insertError = 0;
     int64_t tableCreationError = 0;
     int64_t tableDeletionError = 0;
-    std::list<int64_t> flushLatencyNs;
+    RingBuffer<int64_t, kMaxConfigHistorySize> flushLatencyNs;
     int64_t categoryChangedCount = 0;
 } RestrictedMetricStats;
 
 struct DumpReportStats {
+    DumpReportStats() = default;
     DumpReportStats(int32_t dumpReportSec, int32_t dumpReportSize, int32_t reportNumber)
         : mDumpReportTimeSec(dumpReportSec),
           mDumpReportSizeBytes(dumpReportSize),
@@ -72,6 +79,27 @@ struct DumpReportStats {
     int32_t mDumpReportNumber = 0;
 };
 
+// Time spent on the sampled work of a config or a metric.
+struct ProcessingCost {
+    int64_t sample_count = 0;
+    int64_t wall_time_ns = 0;
+    int64_t cpu_time_ns = 0;
+};
+
+// The cost of one metric while a sampled event was processed, in ns.
+struct MetricCostSample {
+    int64_t metricId;
+    int64_t wallTimeNs;
+    int64_t cpuTimeNs;
+};
+
+struct MetricProcessingCost {
+    // Cost of the sampled matched events.
+    ProcessingCost matched_event_cost;
+    // Cost of every pull delivered to the metric.
+    ProcessingCost pulled_data_cost;
+};
+
 struct ConfigStats {
     int32_t uid;
     int64_t id;
@@ -95,19 +123,19 @@ struct ConfigStats {
     // Stores reasons for why config is valid or not
     std::optional<InvalidConfigReason> reason;
 
-    std::list<int32_t> broadcast_sent_time_sec;
+    RingBuffer<int32_t, kMaxConfigHistorySize> broadcast_sent_time_sec;
 
     // Times at which this config is activated.
-    std::list<int32_t> activation_time_sec;
+    RingBuffer<int32_t, kMaxConfigHistorySize> activation_time_sec;
 
     // Times at which this config is deactivated.
-    std::list<int32_t> deactivation_time_sec;
+    RingBuffer<int32_t, kMaxConfigHistorySize> deactivation_time_sec;
 
-    std::list<int32_t> data_drop_time_sec;
+    RingBuffer<int32_t, kMaxConfigHistorySize> data_drop_time_sec;
     // Number of bytes dropped at corresponding time.
-    std::list<int64_t> data_drop_bytes;
+    RingBuffer<int64_t, kMaxConfigHistorySize> data_drop_bytes;
 
-    std::list<DumpReportStats> dump_report_stats;
+    RingBuffer<DumpReportStats, kMaxConfigHistorySize> dump_report_stats;
 
     // Stores how many times a matcher have been matched. The map size is capped by kMaxConfigCount.
     std::map<const int64_t, int> matcher_stats;
@@ -138,13 +166,22 @@ struct ConfigStats {
     // Maps metric ID of restricted metric to its stats.
     std::map<int64_t, RestrictedMetricStats> restricted_metric_stats;
 
-    std::list<int64_t> total_flush_latency_ns;
+    RingBuffer<int64_t, kMaxConfigHistorySize> total_flush_latency_ns;
 
     // Stores the last 20 timestamps for computing sqlite db size.
-    std::list<int64_t> total_db_size_timestamps;
+    RingBuffer<int64_t, kMaxConfigHistorySize> total_db_size_timestamps;
 
     // Stores the last 20 sizes of the sqlite db.
-    std::list<int64_t> total_db_sizes;
+    RingBuffer<int64_t, kMaxConfigHistorySize> total_db_sizes;
+
+    // Cost of the sampled events processed by the config's MetricsManager.
+    ProcessingCost event_processing_cost;
+
+    // Maps metric ID to its processing cost. The map size is capped by the metric count.
+    std::map<int64_t, MetricProcessingCost> metric_processing_cost;
+
+    // Events skipped while the config was shedding load.
+    int64_t shed_event_count = 0;
 };
 
 struct UidMapStats {
@@ -190,7 +227,13 @@ public:
 
     const static int kMaxSystemServerRestarts = 20;
 
-    const static int kMaxTimestampCount = 20;
+    const static int kMaxTimestampCount = kMaxConfigHistorySize;
+
+    // A MetricsManager measures the cost of one in this many of the events it has matchers for.
+    const static int kProcessingCostSampleInterval = 100;
+
+    // A best effort config shedding load processes one in this many of the events it may skip.
+    const static int kLoadSheddingSampleInterval = 10;
 
     const static int kMaxLogSourceCount = 150;
 
@@ -198,11 +241,11 @@ public:
 
     const static int kMaxRestrictedMetricQueryCount = 20;
 
-    const static int kMaxRestrictedMetricFlushLatencyCount = 20;
+    const static int kMaxRestrictedMetricFlushLatencyCount = kMaxConfigHistorySize;
 
-    const static int kMaxRestrictedConfigFlushLatencyCount = 20;
+    const static int kMaxRestrictedConfigFlushLatencyCount = kMaxConfigHistorySize;
 
-    const static int kMaxRestrictedConfigDbSizeCount = 20;
+    const static int kMaxRestrictedConfigDbSizeCount = kMaxConfigHistorySize;
 
     // Max memory allowed for storing metrics per configuration. If this limit is exceeded, statsd
     // drops the metrics data in memory.
@@ -223,6 +266,11 @@ public:
     // we begin flush in-memory restricted metrics to database.
     static const size_t kBytesPerRestrictedConfigTriggerFlush = 25 * 1024;
 
+    // Max size of a page of restricted metrics query results sent to the client. Larger results
+    // are sent page by page, so that they are neither held in memory at once nor over the binder
+    // transaction size limit.
+    static const size_t kMaxQueryResultsPageBytes = 256 * 1024;
+
     // Cap the UID map's memory usage to this. This should be fairly high since the UID information
     // is critical for understanding the metrics.
     const static size_t kMaxBytesUsedUidMap = 50 * 1024;
@@ -266,6 +314,12 @@ public:
     // Max time to do a pull.
     static const int64_t kPullMaxDelayNs = 30 * NS_PER_SEC;
 
+    // Upper bounds, in millis, of the bins of the per atom pull time histogram. The last bin
+    // holds every pull at least as long as the last bound.
+    static constexpr std::array<int64_t, 7> kPullTimeHistogramBoundsMillis = {10,   50,   100, 500,
+                                                                              1000, 2000, 5000};
+    static constexpr int kNumPullTimeHistogramBins = kPullTimeHistogramBoundsMillis.size() + 1;
+
     // Maximum number of pushed atoms statsd stats will track above kMaxPushedAtomId.
     static const int kMaxNonPlatformPushedAtoms = 600;
 
@@ -275,6 +329,39 @@ public:
     // Maximum number of socket loss stats to track.
     static const int kMaxSocketLossStatsSize = 50;
 
+    // Max number of datagrams statsd reads from the socket per wakeup. Also the size of the
+    // socket read batch size histogram.
+    static constexpr int kMaxSocketReadBatchSize = 64;
+
+    // Number of sockets statsd reads the atoms from, see StatsSocketListener::SocketClass.
+    static constexpr int kNumSocketClasses = 2;
+
+    // Stages of the events sampled for latency tracing on their way from the socket to the
+    // metrics. Each stage is measured from the end of the previous one.
+    enum EventLatencyStage {
+        // From the socket read to the push into the LogEventQueue, parsing included.
+        EVENT_LATENCY_PARSE = 0,
+        // Time spent in the LogEventQueue.
+        EVENT_LATENCY_QUEUE = 1,
+        // From the pop out of the queue to the StatsLogProcessor, waiting for its lock included.
+        EVENT_LATENCY_DISPATCH = 2,
+        // Processing of the event by one config, measured on its own for every config.
+        EVENT_LATENCY_CONFIG = 3,
+        // From the socket read to the end of the processing by all configs.
+        EVENT_LATENCY_TOTAL = 4,
+        EVENT_LATENCY_STAGE_COUNT = 5,
+    };
+
+    // One event in kEventLatencySampleInterval is traced when event latency tracing is enabled.
+    static constexpr uint32_t kEventLatencySampleInterval = 64;
+
+    // Upper bounds, in micros, of the bins of the event latency histograms. The last bin holds
+    // every latency at least as long as the last bound.
+    static constexpr std::array<int64_t, 9> kEventLatencyHistogramBoundsMicros = {
+            10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000};
+    static constexpr int kNumEventLatencyHistogramBins =
+            kEventLatencyHistogramBoundsMicros.size() + 1;
+
     // Maximum atom id value that we consider a platform pushed atom.
     // This should be updated once highest pushed atom id in atoms.proto approaches this value.
     static const int kMaxPushedAtomId = 900;
@@ -429,6 +516,41 @@ public:
      */
     void noteMatcherMatched(const ConfigKey& key, const int64_t& id);
 
+    /**
+     * Report the matchers that matched one event, taking the lock once.
+     *
+     * [key]: The config key that these matchers belong to.
+     * [ids]: The ids of the matchers.
+     */
+    void noteMatchersMatched(const ConfigKey& key, const std::vector<int64_t>& ids);
+
+    /**
+     * Report the cost of processing one sampled event, taking the lock once.
+     *
+     * [key]: The config key whose MetricsManager processed the event.
+     * [wallTimeNs]: The elapsed time spent in the MetricsManager.
+     * [cpuTimeNs]: The thread CPU time spent in the MetricsManager.
+     * [metricCosts]: The cost of each metric that the event was delivered to.
+     */
+    void noteEventProcessingCost(const ConfigKey& key, int64_t wallTimeNs, int64_t cpuTimeNs,
+                                 const std::vector<MetricCostSample>& metricCosts);
+
+    /**
+     * Report the cost of delivering pulled data to a metric.
+     *
+     * [key]: The config key that this metric belongs to.
+     * [metricCost]: The cost of processing the pulled data.
+     */
+    void notePulledDataProcessingCost(const ConfigKey& key, const MetricCostSample& metricCost);
+
+    /**
+     * Report the events that a best effort config skipped while shedding load.
+     *
+     * [key]: The config key that skipped the events.
+     * [count]: The number of events skipped since the last report.
+     */
+    void noteEventsShed(const ConfigKey& key, int64_t count);
+
     /**
      * Report that an anomaly detection alert has been declared.
      *
@@ -490,16 +612,28 @@ public:
 
     /*
      * Records time for actual pulling, not including those served from cache and not including
-     * statsd processing delays.
+     * statsd processing delays. Also counted in the pull time histogram of the atom.
      */
     void notePullTime(int pullAtomId, int64_t pullTimeNs);
 
+    /*
+     * Records that the cool down of a slow puller was widened by penaltyNs, or restored if
+     * penaltyNs is 0.
+     */
+    void noteSlowPullerCoolDownPenalty(int pullAtomId, int64_t penaltyNs);
+
     /*
      * Records pull delay for a pulled atom, including those served from cache and including statsd
      * processing delays.
      */
     void notePullDelay(int pullAtomId, int64_t pullDelayNs);
 
+    /*
+     * Records how long a scheduled pull waited behind the other pulls due at the same alarm
+     * before it started.
+     */
+    void notePullQueueDelay(int pullAtomId, int64_t queueDelayNs);
+
     /*
      * Records pull exceeds timeout for the puller.
      */
@@ -670,6 +804,46 @@ public:
     void noteRestrictedConfigDbSize(const ConfigKey& configKey, const int64_t elapsedTimeNs,
                                     const int64_t dbSize);
 
+    /**
+     * Records the number of datagrams statsd read from the socket in one wakeup.
+     */
+    void noteSocketReadBatch(int batchSize);
+
+    /**
+     * Records, for the socket of the given class, the datagrams read, the events its writers
+     * reported dropped because the socket was full, and its datagrams rejected.
+     */
+    void noteSocketClassRead(int socketClass, int datagramCount);
+    void noteSocketClassLogLost(int socketClass, int droppedCount);
+    void noteSocketClassRejected(int socketClass);
+
+    /**
+     * Records a report saved to disk with the given codec, which took storedBytes instead of
+     * uncompressedBytes. Both are equal when compressing did not make the report smaller.
+     */
+    void noteReportCompression(int32_t codec, size_t uncompressedBytes, size_t storedBytes);
+
+    /**
+     * Enables event latency tracing of one event in sampleInterval, or disables it with 0.
+     */
+    void setEventLatencySampleInterval(uint32_t sampleInterval);
+
+    /**
+     * Returns whether the next event read from the socket should be traced. Lock free.
+     */
+    inline bool shouldTraceEventLatency() {
+        const uint32_t sampleInterval = mEventLatencySampleInterval.load(std::memory_order_relaxed);
+        return sampleInterval != 0 &&
+               mEventLatencySampleCounter.fetch_add(1, std::memory_order_relaxed) %
+                               sampleInterval ==
+                       0;
+    }
+
+    /**
+     * Records the latency of a traced event in the given stage.
+     */
+    void noteEventLatency(EventLatencyStage stage, int64_t latencyNs);
+
     /**
      * Records libstatssocket was not able to write into socket.
      */
@@ -758,6 +932,7 @@ public:
     typedef struct PullTimeoutMetadata {
         int64_t pullTimeoutUptimeMillis;
         int64_t pullTimeoutElapsedMillis;
+        PullTimeoutMetadata() = default;
         PullTimeoutMetadata(int64_t uptimeMillis, int64_t elapsedMillis)
             : pullTimeoutUptimeMillis(uptimeMillis),
               pullTimeoutElapsedMillis(elapsedMillis) { /* do nothing */
@@ -785,8 +960,16 @@ public:
         long unregisteredCount = 0;
         int32_t atomErrorCount = 0;
         long binderCallFailCount = 0;
-        std::list<PullTimeoutMetadata> pullTimeoutMetadata;
+        RingBuffer<PullTimeoutMetadata, kMaxTimestampCount> pullTimeoutMetadata;
         int32_t subscriptionPullCount = 0;
+        int64_t avgPullQueueDelayNs = 0;
+        int64_t maxPullQueueDelayNs = 0;
+        long numPullQueueDelay = 0;
+        std::array<int32_t, kNumPullTimeHistogramBins> pullTimeHistogram{};
+        // Cool down penalty currently applied to the puller for being slow.
+        int64_t coolDownPenaltyNs = 0;
+        // Number of times a cool down penalty was applied.
+        long slowPullerPenaltyCount = 0;
     } PulledAtomStats;
 
     typedef struct {
@@ -827,16 +1010,22 @@ private:
     std::list<const std::shared_ptr<ConfigStats>> mIceBox;
 
     // Stores the number of times a pushed atom is logged and skipped (if skipped).
-    // The size of the vector is the largest pushed atom id in atoms.proto + 1. Atoms
+    // The size of the array is the largest pushed atom id in atoms.proto + 1. Atoms
     // out of that range will be put in mNonPlatformPushedAtomStats.
-    // This is a vector, not a map because it will be accessed A LOT -- for each stats log.
+    // This is an array, not a map because it will be accessed A LOT -- for each stats log. The
+    // counters are atomic so that logging a platform atom does not take mLock.
+    struct PlatformPushedAtomStats {
+        std::atomic<int> logCount = 0;
+        std::atomic<int> skipCount = 0;
+    };
+
+    std::array<PlatformPushedAtomStats, kMaxPushedAtomId + 1> mPushedAtomStats;
+
     struct PushedAtomStats {
         int logCount = 0;
         int skipCount = 0;
     };
 
-    std::vector<PushedAtomStats> mPushedAtomStats;
-
     // Stores the number of times a pushed atom is logged and skipped for atom ids above
     // kMaxPushedAtomId. The max size of the map is kMaxNonPlatformPushedAtoms.
     std::unordered_map<int, PushedAtomStats> mNonPlatformPushedAtomStats;
@@ -847,7 +1036,7 @@ private:
     std::unordered_map<int, int> mPushedAtomDropsStats;
 
     // Maps PullAtomId to its stats. The size is capped by the puller atom counts.
-    std::map<int, PulledAtomStats> mPulledAtomStats;
+    std::unordered_map<int, PulledAtomStats> mPulledAtomStats;
 
     // Stores the number of times a pushed atom was logged erroneously. The
     // corresponding counts for pulled atoms are stored in PulledAtomStats.
@@ -890,9 +1079,10 @@ private:
 
     // Maps uids to times when the activation changed broadcast not sent due to hitting the
     // guardrail. The size is capped by the number of configs, and up to 20 times per uid.
-    std::map<int, std::list<int32_t>> mActivationBroadcastGuardrailStats;
+    std::map<int, RingBuffer<int32_t, kMaxTimestampCount>> mActivationBroadcastGuardrailStats;
 
     struct LogLossStats {
+        LogLossStats() = default;
         LogLossStats(int32_t sec, int32_t count, int32_t error, int32_t tag, int32_t uid,
                      int32_t pid)
             : mWallClockSec(sec),
@@ -922,10 +1112,40 @@ private:
     // Total number of events that are lost due to queue overflow.
     int32_t mOverflowCount = 0;
 
+    // Histogram of the socket read batch sizes. Element i holds the number of reads which
+    // received i + 1 datagrams.
+    std::array<int64_t, kMaxSocketReadBatchSize> mSocketReadBatchSizeHistogram{};
+
+    struct SocketClassStats {
+        int64_t datagramCount = 0;
+        int64_t droppedByWritersCount = 0;
+        int64_t rejectedCount = 0;
+    };
+
+    // Indexed by socket class.
+    std::array<SocketClassStats, kNumSocketClasses> mSocketClassStats{};
+
+    std::atomic<uint32_t> mEventLatencySampleInterval = 0;
+    std::atomic<uint32_t> mEventLatencySampleCounter = 0;
+
+    // Latency histograms of the traced events, indexed by EventLatencyStage.
+    std::array<std::array<int64_t, kNumEventLatencyHistogramBins>, EVENT_LATENCY_STAGE_COUNT>
+            mEventLatencyHistograms{};
+
+    struct ReportCompressionStats {
+        int64_t reportCount = 0;
+        int64_t uncompressedReportCount = 0;
+        int64_t uncompressedBytes = 0;
+        int64_t storedBytes = 0;
+    };
+
+    // Maps a ReportCodec to the reports saved with it.
+    std::map<int32_t, ReportCompressionStats> mReportCompressionStats;
+
     // Timestamps when we detect log loss, and the number of logs lost.
-    std::list<LogLossStats> mLogLossStats;
+    RingBuffer<LogLossStats, kMaxLoggerErrors> mLogLossStats;
 
-    std::list<int32_t> mSystemServerRestartSec;
+    RingBuffer<int32_t, kMaxSystemServerRestarts> mSystemServerRestartSec;
 
     struct RestrictedMetricQueryStats {
         RestrictedMetricQueryStats(int32_t callingUid, int64_t configId,
@@ -1041,6 +1261,10 @@ private:
     FRIEND_TEST(StatsdStatsTest, TestSubscriptionStartedRemoveFinishedSubscription);
     FRIEND_TEST(StatsdStatsTest, TestSocketLossStats);
     FRIEND_TEST(StatsdStatsTest, TestSocketLossStatsOverflowCounter);
+    FRIEND_TEST(StatsdStatsTest, TestSocketReadBatchStats);
+    FRIEND_TEST(StatsdStatsTest, TestSocketClassStats);
+    FRIEND_TEST(StatsdStatsTest, TestReportCompressionStats);
+    FRIEND_TEST(StatsdStatsTest, TestEventLatencyStats);
 
     FRIEND_TEST(StatsLogProcessorTest, InvalidConfigRemoved);
 };
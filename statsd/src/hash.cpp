@@ -44,6 +44,12 @@ inline uint64_t DecodeFixed64(const char* ptr) {
 static inline uint32_t ByteAs32(char c) { return static_cast<uint32_t>(c) & 0xff; }
 static inline uint64_t ByteAs64(char c) { return static_cast<uint64_t>(c) & 0xff; }
 
+// wyhash secrets.
+const uint64_t kWyP0 = 0xa0761d6478bd642full;
+const uint64_t kWyP1 = 0xe7037ed1a0b428dbull;
+const uint64_t kWyP2 = 0x8ebc6af09c88c6e3ull;
+const uint64_t kWyP3 = 0x589965cc75374cc3ull;
+
 }  // namespace
 
 uint32_t Hash32(const char *data, size_t n, uint32_t seed) {
@@ -137,6 +143,48 @@ uint64_t Hash64(const char* data, size_t n, uint64_t seed) {
 
   return h;
 }
+
+uint64_t WyHash64(const char* data, size_t n, uint64_t seed) {
+    seed ^= WyMix(seed ^ kWyP0, kWyP1);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (n <= 16) {
+        if (n >= 4) {
+            // Two possibly overlapping 4 byte reads from each end cover the whole input.
+            const size_t mid = (n >> 3) << 2;
+            a = (static_cast<uint64_t>(DecodeFixed32(data)) << 32) | DecodeFixed32(data + mid);
+            b = (static_cast<uint64_t>(DecodeFixed32(data + n - 4)) << 32) |
+                DecodeFixed32(data + n - 4 - mid);
+        } else if (n > 0) {
+            a = (ByteAs64(data[0]) << 16) | (ByteAs64(data[n >> 1]) << 8) | ByteAs64(data[n - 1]);
+        }
+    } else {
+        size_t i = n;
+        if (i > 48) {
+            // Three independent lanes keep the multipliers busy on long inputs.
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = WyMix(DecodeFixed64(data) ^ kWyP1, DecodeFixed64(data + 8) ^ seed);
+                seed1 = WyMix(DecodeFixed64(data + 16) ^ kWyP2, DecodeFixed64(data + 24) ^ seed1);
+                seed2 = WyMix(DecodeFixed64(data + 32) ^ kWyP3, DecodeFixed64(data + 40) ^ seed2);
+                data += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = WyMix(DecodeFixed64(data) ^ kWyP1, DecodeFixed64(data + 8) ^ seed);
+            data += 16;
+            i -= 16;
+        }
+        // The last 16 bytes, which may overlap the ones already mixed.
+        a = DecodeFixed64(data + i - 16);
+        b = DecodeFixed64(data + i - 8);
+    }
+    return WyMix(kWyP1 ^ n, WyMix(a ^ kWyP1, b ^ seed));
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -42,6 +42,26 @@ inline uint64_t Hash64(const std::string& str) {
   return Hash64(str.data(), str.size());
 }
 
+// Uses the wyhash algorithm. It reads the input 16 bytes at a time and mixes with a 64x64->128
+// bit multiply, which makes it several times faster than murmur2 on medium length strings.
+extern uint64_t WyHash64(const char* data, size_t n, uint64_t seed);
+
+// The wyhash mixing step: multiplies a and b to 128 bits and folds the halves together.
+inline uint64_t WyMix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    const __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+    const uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a),
+                   lb = static_cast<uint32_t>(b);
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32);
+    const uint64_t lo = t + (rm1 << 32);
+    const uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    return lo ^ hi;
+#endif
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "logd/AtomSchemas.h"
+
+#include <unordered_map>
+
+#include "logd/LogEvent.h"
+#include "statslog_statsd.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+FlatAtomSchema makeSchema(const std::vector<uint8_t>& fieldTypes) {
+    FlatAtomSchema schema;
+    schema.fieldTypes = fieldTypes;
+    for (const uint8_t typeId : fieldTypes) {
+        schema.bodySize += sizeof(uint8_t) + getFixedValueSize(typeId);
+    }
+    return schema;
+}
+
+// Frequently logged atoms with a flat schema, from atoms.proto.
+const std::unordered_map<int32_t, FlatAtomSchema>& getFlatAtomSchemas() {
+    static const std::unordered_map<int32_t, FlatAtomSchema> schemas = {
+            {util::SCREEN_BRIGHTNESS_CHANGED, makeSchema({INT32_TYPE})},
+            {util::BATTERY_LEVEL_CHANGED, makeSchema({INT32_TYPE})},
+    };
+    return schemas;
+}
+
+}  // anonymous namespace
+
+uint32_t getFixedValueSize(const uint8_t typeId) {
+    switch (typeId) {
+        case INT32_TYPE:
+            return sizeof(int32_t);
+        case INT64_TYPE:
+            return sizeof(int64_t);
+        case FLOAT_TYPE:
+            return sizeof(float);
+        case BOOL_TYPE:
+            return sizeof(uint8_t);
+        default:
+            return 0;
+    }
+}
+
+const FlatAtomSchema* getFlatAtomSchema(const int32_t atomId) {
+    const std::unordered_map<int32_t, FlatAtomSchema>& schemas = getFlatAtomSchemas();
+    const auto it = schemas.find(atomId);
+    return it == schemas.end() ? nullptr : &it->second;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
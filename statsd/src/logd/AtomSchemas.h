@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Layout of an atom whose top-level fields are all fixed-width scalars without annotations:
+ * int32, int64, float or bool.
+ *
+ * LogEvent decodes the events of these atoms in a single pass over the body, after one length
+ * check, instead of interpreting the type byte of each field. An event whose body does not have
+ * the expected size or type bytes, e.g. because a field gained an annotation, is parsed by the
+ * generic path.
+ */
+struct FlatAtomSchema {
+    // Type ids of the top-level fields, in order.
+    std::vector<uint8_t> fieldTypes;
+
+    // Encoded size of the body: the type byte and the value of each field.
+    uint32_t bodySize = 0;
+};
+
+// Size of the encoded value of a fixed-width type, 0 for the other types.
+uint32_t getFixedValueSize(const uint8_t typeId);
+
+// Returns the layout of the atom if it has a flat schema, nullptr otherwise.
+const FlatAtomSchema* getFlatAtomSchema(const int32_t atomId);
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -24,6 +24,8 @@
 #include <private/android_filesystem_config.h>
 
 #include "flags/FlagProvider.h"
+#include "external/Perfetto.h"
+#include "logd/AtomSchemas.h"
 #include "stats_annotations.h"
 #include "stats_log_util.h"
 #include "statslog_statsd.h"
@@ -57,6 +59,33 @@ LogEvent::LogEvent(int32_t uid, int32_t pid)
     : mLogdTimestampNs(getWallClockNs()), mLogUid(uid), mLogPid(pid) {
 }
 
+void LogEvent::reset(int32_t uid, int32_t pid) {
+    mBuf = nullptr;
+    mRemainingLen = 0;
+    mValid = true;
+    mParsedHeaderOnly = false;
+    mIsolatedUidsHandled = false;
+    mSkipValues = false;
+    mSkipAttributionTags = false;
+    mValues.clear();
+    mTopLevelFieldOffsets.clear();
+    mLatencyTraceStartNs = 0;
+    mLatencyTraceLapNs = 0;
+    mLogdTimestampNs = getWallClockNs();
+    mElapsedTimestampNs = 0;
+    mTagId = 0;
+    mLogUid = uid;
+    mLogPid = pid;
+    mTruncateTimestamp = false;
+    mResetState = -1;
+    mRestrictionCategory = CATEGORY_NO_RESTRICTION;
+    mEventCount = 1;
+    mNumUidFields = 0;
+    mAttributionChainStartIndex.reset();
+    mAttributionChainEndIndex.reset();
+    mExclusiveStateFieldIndex.reset();
+}
+
 LogEvent::LogEvent(const string& trainName, int64_t trainVersionCode, bool requiresStaging,
                    bool rollbackEnabled, bool requiresLowLatencyMonitor, int32_t state,
                    const std::vector<uint8_t>& experimentIds, int32_t userId) {
@@ -75,6 +104,7 @@ LogEvent::LogEvent(const string& trainName, int64_t trainVersionCode, bool requi
     mValues.push_back(FieldValue(Field(mTagId, getSimpleField(6)), Value(state)));
     mValues.push_back(FieldValue(Field(mTagId, getSimpleField(7)), Value(experimentIds)));
     mValues.push_back(FieldValue(Field(mTagId, getSimpleField(8)), Value(userId)));
+    buildTopLevelFieldIndex();
 }
 
 LogEvent::LogEvent(int64_t wallClockTimestampNs, int64_t elapsedTimestampNs,
@@ -90,6 +120,7 @@ LogEvent::LogEvent(int64_t wallClockTimestampNs, int64_t elapsedTimestampNs,
     mValues.push_back(FieldValue(Field(mTagId, getSimpleField(2)), Value(experimentIdsProto)));
     mValues.push_back(FieldValue(Field(mTagId, getSimpleField(3)), Value(trainInfo.trainName)));
     mValues.push_back(FieldValue(Field(mTagId, getSimpleField(4)), Value(trainInfo.status)));
+    buildTopLevelFieldIndex();
 }
 
 void LogEvent::parseInt32(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations) {
@@ -111,10 +142,23 @@ void LogEvent::parseString(int32_t* pos, int32_t depth, bool* last, uint8_t numA
         return;
     }
 
-    string value = string((char*)mBuf, numBytes);
+    if (mSkipValues) {
+        mBuf += numBytes;
+        mRemainingLen -= numBytes;
+        parseAnnotations(numAnnotations);
+        return;
+    }
+
+    const char* chars = (const char*)mBuf;
     mBuf += numBytes;
     mRemainingLen -= numBytes;
-    addToValues(pos, depth, value, last);
+    if (mStrings != nullptr) {
+        Value value = mStrings->intern(std::string_view(chars, numBytes));
+        addToValues(pos, depth, value, last);
+    } else {
+        string value = string(chars, numBytes);
+        addToValues(pos, depth, value, last);
+    }
     parseAnnotations(numAnnotations);
 }
 
@@ -138,6 +182,13 @@ void LogEvent::parseByteArray(int32_t* pos, int32_t depth, bool* last, uint8_t n
         return;
     }
 
+    if (mSkipValues) {
+        mBuf += numBytes;
+        mRemainingLen -= numBytes;
+        parseAnnotations(numAnnotations);
+        return;
+    }
+
     vector<uint8_t> value(mBuf, mBuf + numBytes);
     mBuf += numBytes;
     mRemainingLen -= numBytes;
@@ -204,10 +255,30 @@ void LogEvent::parseAttributionChain(int32_t* pos, int32_t depth, bool* last,
         // parse tag
         pos[2] = 2;
         last[2] = true;
-        parseString(pos, /*depth=*/2, last, /*numAnnotations=*/0);
+        if (mSkipAttributionTags && !mSkipValues) {
+            mSkipValues = true;
+            parseString(pos, /*depth=*/2, last, /*numAnnotations=*/0);
+            mSkipValues = false;
+        } else {
+            parseString(pos, /*depth=*/2, last, /*numAnnotations=*/0);
+        }
+    }
+
+    if (mSkipValues) {
+        // Nothing was added to mValues, only the buffer content has to be valid.
+        if (numNodes == 0) {
+            mValid = false;
+        }
+        if (mValid) {
+            parseAnnotations(numAnnotations);
+        }
+        pos[1] = pos[2] = 1;
+        last[1] = last[2] = false;
+        return;
     }
 
-    if (mValues.size() > (firstUidInChainIndex.value() + 1)) {
+    const size_t valuesPerNode = mSkipAttributionTags ? 1 : 2;
+    if (mValues.size() >= firstUidInChainIndex.value() + valuesPerNode) {
         // At least one node was successfully parsed.
         mAttributionChainStartIndex = firstUidInChainIndex;
         mAttributionChainEndIndex = mValues.size() - 1;
@@ -418,11 +489,29 @@ void LogEvent::parseFieldRestrictionAnnotation(uint8_t annotationType) {
     return;
 }
 
+void LogEvent::parseEventCountAnnotation(uint8_t annotationType) {
+    // Allowed types: INT, field value should be empty since this is atom-level annotation.
+    if (!mValues.empty() || annotationType != INT32_TYPE) {
+        mValid = false;
+        return;
+    }
+    const int32_t count = readNextValue<int32_t>();
+    if (count < 1) {
+        mValid = false;
+        return;
+    }
+    mEventCount = count;
+}
+
 // firstUidInChainIndex is a default parameter that is only needed when parsing
 // annotations for attribution chains.
 // numElements is a default param that is only needed when parsing annotations for repeated fields
 void LogEvent::parseAnnotations(uint8_t numAnnotations, std::optional<uint8_t> numElements,
                                 std::optional<size_t> firstUidInChainIndex) {
+    if (mSkipValues) {
+        skipAnnotations(numAnnotations);
+        return;
+    }
     for (uint8_t i = 0; i < numAnnotations; i++) {
         uint8_t annotationId = readNextValue<uint8_t>();
         uint8_t annotationType = readNextValue<uint8_t>();
@@ -472,6 +561,9 @@ void LogEvent::parseAnnotations(uint8_t numAnnotations, std::optional<uint8_t> n
                     mValid = false;
                 }
                 break;
+            case ASTATSLOG_ANNOTATION_ID_EVENT_COUNT:
+                parseEventCountAnnotation(annotationType);
+                break;
             default:
                 VLOG("Atom ID %d error while parseAnnotations() - wrong annotationId(%d)", mTagId,
                      annotationId);
@@ -481,6 +573,26 @@ void LogEvent::parseAnnotations(uint8_t numAnnotations, std::optional<uint8_t> n
     }
 }
 
+// Annotations of a skipped field have no value to be applied to, so only their encoding is
+// checked.
+void LogEvent::skipAnnotations(uint8_t numAnnotations) {
+    for (uint8_t i = 0; i < numAnnotations && mValid; i++) {
+        /* annotationId =*/readNextValue<uint8_t>();
+        const uint8_t annotationType = readNextValue<uint8_t>();
+        switch (annotationType) {
+            case BOOL_TYPE:
+                readNextValue<uint8_t>();
+                break;
+            case INT32_TYPE:
+                readNextValue<int32_t>();
+                break;
+            default:
+                mValid = false;
+                break;
+        }
+    }
+}
+
 LogEvent::BodyBufferInfo LogEvent::parseHeader(const uint8_t* buf, size_t len) {
     BodyBufferInfo bodyInfo;
 
@@ -532,9 +644,72 @@ LogEvent::BodyBufferInfo LogEvent::parseHeader(const uint8_t* buf, size_t len) {
     return bodyInfo;
 }
 
-bool LogEvent::parseBody(const BodyBufferInfo& bodyInfo) {
+bool LogEvent::parseFlatBody(const FlatAtomSchema& schema, const BodyBufferInfo& bodyInfo,
+                             const TopLevelFieldMask* fieldsToParse) {
+    // The fields have fixed sizes, so one check covers the reads of all the values.
+    if (bodyInfo.numElements != schema.fieldTypes.size() ||
+        bodyInfo.bufferSize != schema.bodySize) {
+        return false;
+    }
+    // The type bytes also hold the number of annotations, which must be 0.
+    const uint8_t* buf = bodyInfo.buffer;
+    for (const uint8_t typeId : schema.fieldTypes) {
+        if (*buf != typeId) {
+            return false;
+        }
+        buf += sizeof(uint8_t) + getFixedValueSize(typeId);
+    }
+
+    mValues.reserve(schema.fieldTypes.size());
+    buf = bodyInfo.buffer;
+    int32_t pos[] = {1, 1, 1};
+    for (const uint8_t typeId : schema.fieldTypes) {
+        buf += sizeof(uint8_t);
+        const bool skip = fieldsToParse != nullptr && pos[0] < kAttributionTagsInUseOffset &&
+                          !fieldsToParse->test(pos[0]);
+        if (!skip) {
+            const Field field(mTagId, pos, /*depth=*/0);
+            switch (typeId) {
+                case INT32_TYPE: {
+                    int32_t value;
+                    memcpy(&value, buf, sizeof(value));
+                    mValues.emplace_back(field, Value(value));
+                    break;
+                }
+                case INT64_TYPE: {
+                    int64_t value;
+                    memcpy(&value, buf, sizeof(value));
+                    mValues.emplace_back(field, Value(value));
+                    break;
+                }
+                case FLOAT_TYPE: {
+                    float value;
+                    memcpy(&value, buf, sizeof(value));
+                    mValues.emplace_back(field, Value(value));
+                    break;
+                }
+                case BOOL_TYPE:
+                    // cast to int32_t because FieldValue does not support bools
+                    mValues.emplace_back(field, Value((int32_t)*buf));
+                    break;
+            }
+        }
+        buf += getFixedValueSize(typeId);
+        pos[0]++;
+    }
+    mRemainingLen = 0;
+    buildTopLevelFieldIndex();
+    return true;
+}
+
+bool LogEvent::parseBody(const BodyBufferInfo& bodyInfo, const TopLevelFieldMask* fieldsToParse) {
     mParsedHeaderOnly = false;
 
+    const FlatAtomSchema* schema = getFlatAtomSchema(mTagId);
+    if (schema != nullptr && parseFlatBody(*schema, bodyInfo, fieldsToParse)) {
+        return mValid;
+    }
+
     mBuf = bodyInfo.buffer;
     mRemainingLen = (uint32_t)bodyInfo.bufferSize;
 
@@ -548,6 +723,10 @@ bool LogEvent::parseBody(const BodyBufferInfo& bodyInfo) {
 
     for (pos[0] = 1; pos[0] <= bodyInfo.numElements && mValid; pos[0]++) {
         last[0] = (pos[0] == bodyInfo.numElements);
+        const bool hasFieldMask = fieldsToParse != nullptr && pos[0] < kAttributionTagsInUseOffset;
+        mSkipValues = hasFieldMask && !fieldsToParse->test(pos[0]);
+        mSkipAttributionTags =
+                hasFieldMask && !fieldsToParse->test(kAttributionTagsInUseOffset + pos[0]);
 
         uint8_t typeInfo = readNextValue<uint8_t>();
         uint8_t typeId = getTypeId(typeInfo);
@@ -590,14 +769,47 @@ bool LogEvent::parseBody(const BodyBufferInfo& bodyInfo) {
         }
     }
 
+    mSkipValues = false;
+    mSkipAttributionTags = false;
     if (mRemainingLen != 0) mValid = false;
     mBuf = nullptr;
+    buildTopLevelFieldIndex();
     return mValid;
 }
 
+void LogEvent::buildTopLevelFieldIndex() {
+    mTopLevelFieldOffsets.clear();
+    if (mValues.empty()) {
+        return;
+    }
+    // The values are in DFS order, so the values of each top-level field are contiguous.
+    const int lastPos = mValues.back().mField.getPosAtDepth(0);
+    mTopLevelFieldOffsets.resize(lastPos + 2);
+    size_t i = 0;
+    for (int pos = 0; pos <= lastPos + 1; pos++) {
+        while (i < mValues.size() && mValues[i].mField.getPosAtDepth(0) < pos) {
+            i++;
+        }
+        mTopLevelFieldOffsets[pos] = i;
+    }
+}
+
+std::pair<size_t, size_t> LogEvent::getTopLevelFieldRange(int pos) const {
+    if (mTopLevelFieldOffsets.empty()) {
+        return {0, mValues.size()};
+    }
+    if (pos < 0 || pos + 1 >= (int)mTopLevelFieldOffsets.size()) {
+        return {0, 0};
+    }
+    return {mTopLevelFieldOffsets[pos], mTopLevelFieldOffsets[pos + 1]};
+}
+
 // This parsing logic is tied to the encoding scheme used in StatsEvent.java and
 // stats_event.c
-bool LogEvent::parseBuffer(const uint8_t* buf, size_t len) {
+bool LogEvent::parseBuffer(const uint8_t* buf, size_t len,
+                           const TopLevelFieldMask* fieldsToParse,
+                           StringValueInterner* strings) {
+    ScopedStageTrace trace("LogEvent::parseBuffer");
     BodyBufferInfo bodyInfo = parseHeader(buf, len);
 
     // emphasize intention to parse the body, however atom data could be incomplete
@@ -610,7 +822,10 @@ bool LogEvent::parseBuffer(const uint8_t* buf, size_t len) {
         return false;
     }
 
-    return parseBody(bodyInfo);
+    mStrings = strings;
+    const bool valid = parseBody(bodyInfo, fieldsToParse);
+    mStrings = nullptr;
+    return valid;
 }
 
 int64_t LogEvent::GetLong(size_t key, status_t* err) const {
@@ -661,7 +876,7 @@ const char* LogEvent::GetString(size_t key, status_t* err) const {
     for (const auto& value : mValues) {
         if (value.mField.getField() == field) {
             if (value.mValue.getType() == STRING) {
-                return value.mValue.str_value.c_str();
+                return value.mValue.getString().c_str();
             } else {
                 *err = BAD_TYPE;
                 return 0;
@@ -723,7 +938,7 @@ std::vector<uint8_t> LogEvent::GetStorage(size_t key, status_t* err) const {
     for (const auto& value : mValues) {
         if (value.mField.getField() == field) {
             if (value.mValue.getType() == STORAGE) {
-                return value.mValue.storage_value;
+                return value.mValue.getStorage();
             } else {
                 *err = BAD_TYPE;
                 return vector<uint8_t>();
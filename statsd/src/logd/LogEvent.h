@@ -60,6 +60,8 @@ namespace statsd {
 #define ATTRIBUTION_CHAIN_TYPE 0x09
 #define ERROR_TYPE 0x0F
 
+struct FlatAtomSchema;
+
 struct InstallTrainInfo {
     int64_t trainVersionCode;
     std::string trainName;
@@ -82,6 +84,12 @@ public:
      */
     explicit LogEvent(int32_t uid, int32_t pid);
 
+    /**
+     * Reinitializes the event as if it was just constructed with LogEvent(uid, pid).
+     * The storage of the values vector is kept to be reused by the next parse.
+     */
+    void reset(int32_t uid, int32_t pid);
+
     /**
      * Parses the atomId, timestamp, and vector of values from a buffer
      * containing the StatsEvent/AStatsEvent encoding of an atom.
@@ -89,10 +97,15 @@ public:
      * \param buf a buffer that begins at the start of the serialized atom (it
      * should not include the android_log_header_t or the StatsEventTag)
      * \param len size of the buffer
+     * \param fieldsToParse if not null, only the top-level fields set in the mask are decoded,
+     *        see parseBody
+     * \param strings if not null, the string values are interned in it
      *
      * \return success of the parsing
      */
-    bool parseBuffer(const uint8_t* buf, size_t len);
+    bool parseBuffer(const uint8_t* buf, size_t len,
+                     const TopLevelFieldMask* fieldsToParse = nullptr,
+                     StringValueInterner* strings = nullptr);
 
     struct BodyBufferInfo {
         const uint8_t* buffer = nullptr;
@@ -111,9 +124,13 @@ public:
     /**
      * @brief Parses atom body which consists of header.numElements elements
      * Should be called only with BodyBufferInfo if when logEvent.isValid() == true
+     * @param fieldsToParse if not null, only the top-level fields set in the mask are decoded
+     *        into the values. The other fields are validated and skipped together with their
+     *        annotations.
      * \return success of the parsing
      */
-    bool parseBody(const BodyBufferInfo& bodyInfo);
+    bool parseBody(const BodyBufferInfo& bodyInfo,
+                   const TopLevelFieldMask* fieldsToParse = nullptr);
 
     // Constructs a BinaryPushStateChanged LogEvent from API call.
     explicit LogEvent(const std::string& trainName, int64_t trainVersionCode, bool requiresStaging,
@@ -185,6 +202,29 @@ public:
         mLogdTimestampNs = timestampNs;
     }
 
+    /**
+     * Latency tracing of the events sampled by StatsdStats::shouldTraceEventLatency(). The trace
+     * starts when the event is read from the socket, each lap returns the elapsed time since the
+     * previous lap or the start.
+     */
+    void startLatencyTrace(int64_t elapsedRealtimeNs) {
+        mLatencyTraceStartNs = mLatencyTraceLapNs = elapsedRealtimeNs;
+    }
+
+    inline bool isLatencyTraced() const {
+        return mLatencyTraceStartNs != 0;
+    }
+
+    inline int64_t getLatencyTraceStartNs() const {
+        return mLatencyTraceStartNs;
+    }
+
+    int64_t lapLatencyTrace(int64_t elapsedRealtimeNs) {
+        const int64_t lapNs = elapsedRealtimeNs - mLatencyTraceLapNs;
+        mLatencyTraceLapNs = elapsedRealtimeNs;
+        return lapNs;
+    }
+
     inline int size() const {
         return mValues.size();
     }
@@ -193,10 +233,16 @@ public:
         return mValues;
     }
 
+    // Only the values may be changed, not the fields the top-level field index was built from.
     std::vector<FieldValue>* getMutableValues() {
         return &mValues;
     }
 
+    // Returns the [start, end) range of the values of the top-level field at pos, which is empty
+    // if the event has no such field. Looked up from an index built once the values are parsed,
+    // so it is constant time however wide the atom is.
+    std::pair<size_t, size_t> getTopLevelFieldRange(int pos) const;
+
     // Default value = false
     inline bool shouldTruncateTimestamp() const {
         return mTruncateTimestamp;
@@ -258,6 +304,18 @@ public:
         return mParsedHeaderOnly;
     }
 
+    /**
+     * @brief Marks the isolated uids as handled as the event was read: mapped to their host
+     * uids, or applied to the UidMap for ISOLATED_UID_CHANGED.
+     */
+    void setIsolatedUidsHandled() {
+        mIsolatedUidsHandled = true;
+    }
+
+    bool areIsolatedUidsHandled() const {
+        return mIsolatedUidsHandled;
+    }
+
     /**
      * Only use this if copy is absolutely needed.
      */
@@ -271,7 +329,18 @@ public:
         return mRestrictionCategory != CATEGORY_NO_RESTRICTION;
     }
 
+    // The number of identical events this event stands for, which is more than 1 if the client
+    // aggregated them with AStatsEvent_writeAggregated.
+    inline int32_t getEventCount() const {
+        return mEventCount;
+    }
+
 private:
+    // Decodes a body laid out as schema. Returns false, without consuming anything, if the body
+    // does not match the schema.
+    bool parseFlatBody(const FlatAtomSchema& schema, const BodyBufferInfo& bodyInfo,
+                       const TopLevelFieldMask* fieldsToParse);
+
     void parseInt32(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations);
     void parseInt64(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations);
     void parseString(int32_t* pos, int32_t depth, bool* last, uint8_t numAnnotations);
@@ -284,6 +353,7 @@ private:
 
     void parseAnnotations(uint8_t numAnnotations, std::optional<uint8_t> numElements = std::nullopt,
                           std::optional<size_t> firstUidInChainIndex = std::nullopt);
+    void skipAnnotations(uint8_t numAnnotations);
     void parseIsUidAnnotation(uint8_t annotationType, std::optional<uint8_t> numElements);
     void parseTruncateTimestampAnnotation(uint8_t annotationType);
     void parsePrimaryFieldAnnotation(uint8_t annotationType, std::optional<uint8_t> numElements,
@@ -296,7 +366,9 @@ private:
     void parseStateNestedAnnotation(uint8_t annotationType, std::optional<uint8_t> numElements);
     void parseRestrictionCategoryAnnotation(uint8_t annotationType);
     void parseFieldRestrictionAnnotation(uint8_t annotationType);
+    void parseEventCountAnnotation(uint8_t annotationType);
     bool checkPreviousValueType(Type expected);
+    void buildTopLevelFieldIndex();
     bool getRestrictedMetricsFlag();
 
     /**
@@ -306,11 +378,20 @@ private:
      */
     const uint8_t* mBuf;
     uint32_t mRemainingLen; // number of valid bytes left in the buffer being parsed
+    StringValueInterner* mStrings = nullptr;
 
     bool mValid = true; // stores whether the event we received from the socket is valid
 
     bool mParsedHeaderOnly = false;  // stores whether the only header was parsed skipping the body
 
+    bool mIsolatedUidsHandled = false;
+
+    // Set while parseBody() walks over a top-level field which is not decoded into mValues.
+    bool mSkipValues = false;
+
+    // Set while parseBody() walks over an attribution chain whose tags are not decoded.
+    bool mSkipAttributionTags = false;
+
     /**
      * Side-effects:
      *    If there is enough space in buffer to read value of type T
@@ -343,18 +424,26 @@ private:
 
     template <class T>
     void addToValues(int32_t* pos, int32_t depth, T& value, bool* last) {
+        if (mSkipValues) {
+            return;
+        }
         Field f = Field(mTagId, pos, depth);
         // only decorate last position for depths with repeated fields (depth 1)
         if (depth > 0 && last[1]) f.decorateLastPos(1);
 
-        Value v = Value(value);
-        mValues.push_back(FieldValue(f, v));
+        // Strings and byte arrays are moved into the value's payload rather than copied.
+        mValues.emplace_back(f, Value(std::move(value)));
     }
 
     // The items are naturally sorted in DFS order as we read them. this allows us to do fast
     // matching.
     std::vector<FieldValue> mValues;
 
+    // mValues[mTopLevelFieldOffsets[pos], mTopLevelFieldOffsets[pos + 1]) are the values of the
+    // top-level field at pos. Empty until the index is built, in which case every value is
+    // treated as a value of each field.
+    std::vector<uint32_t> mTopLevelFieldOffsets;
+
     // The timestamp set by the logd.
     int64_t mLogdTimestampNs;
 
@@ -375,12 +464,17 @@ private:
     bool mTruncateTimestamp = false;
     int mResetState = -1;
     StatsdRestrictionCategory mRestrictionCategory = CATEGORY_NO_RESTRICTION;
+    int32_t mEventCount = 1;
 
     size_t mNumUidFields = 0;
 
     std::optional<size_t> mAttributionChainStartIndex;
     std::optional<size_t> mAttributionChainEndIndex;
     std::optional<size_t> mExclusiveStateFieldIndex;
+
+    // Both 0 unless the event is latency traced.
+    int64_t mLatencyTraceStartNs = 0;
+    int64_t mLatencyTraceLapNs = 0;
 };
 
 void writeExperimentIdsToProto(const std::vector<int64_t>& experimentIds, std::vector<uint8_t>* protoOut);
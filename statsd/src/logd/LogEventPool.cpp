@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "LogEventPool.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+
+unique_ptr<LogEvent> LogEventPool::obtain(int32_t uid, int32_t pid) {
+    unique_ptr<LogEvent> event;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mFreeEvents.empty()) {
+            event = std::move(mFreeEvents.back());
+            mFreeEvents.pop_back();
+        }
+    }
+
+    if (event == nullptr) {
+        return std::make_unique<LogEvent>(uid, pid);
+    }
+    event->reset(uid, pid);
+    return event;
+}
+
+void LogEventPool::recycle(std::vector<unique_ptr<LogEvent>>& events) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& event : events) {
+            if (mFreeEvents.size() >= mMaxSize) {
+                break;
+            }
+            if (event != nullptr) {
+                mFreeEvents.push_back(std::move(event));
+            }
+        }
+    }
+    // Events which did not fit in the pool are released outside of the lock.
+    events.clear();
+}
+
+void LogEventPool::trim() {
+    std::vector<unique_ptr<LogEvent>> freeEvents;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        freeEvents.swap(mFreeEvents);
+    }
+    // Released outside of the lock.
+}
+
+size_t LogEventPool::size() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFreeEvents.size();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <gtest/gtest_prod.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "LogEvent.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A thread safe pool of LogEvent objects.
+ *
+ * The socket thread obtains events from the pool and the events consumer gives them back once
+ * processed. A recycled LogEvent keeps the capacity of its FieldValue vector, so parsing an
+ * event of a similar shape does not allocate the vector storage again.
+ */
+class LogEventPool {
+public:
+    explicit LogEventPool(size_t maxSize) : mMaxSize(maxSize){};
+
+    /**
+     * Returns a LogEvent initialized for the given uid and pid. The event is recycled from the
+     * pool if one is available, otherwise a new one is allocated.
+     */
+    std::unique_ptr<LogEvent> obtain(int32_t uid, int32_t pid);
+
+    /**
+     * Gives processed events back to the pool. Events beyond the pool capacity are released.
+     * The vector is left empty.
+     */
+    void recycle(std::vector<std::unique_ptr<LogEvent>>& events);
+
+    /**
+     * Releases the events available for reuse.
+     */
+    void trim();
+
+    /**
+     * Returns the number of events available for reuse.
+     */
+    size_t size() const;
+
+private:
+    const size_t mMaxSize;
+
+    mutable std::mutex mMutex;
+
+    std::vector<std::unique_ptr<LogEvent>> mFreeEvents;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
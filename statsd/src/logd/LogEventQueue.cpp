@@ -19,6 +19,10 @@
 
 #include "LogEventQueue.h"
 
+#include <algorithm>
+
+#include "utils/MemoryPressure.h"
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -26,12 +30,35 @@ namespace statsd {
 using std::unique_lock;
 using std::unique_ptr;
 
+LogEventQueue::LogEventQueue(size_t maxSize, Type type, size_t reservedSize, size_t minCapacity)
+    : mQueueLimit(maxSize),
+      mType(type),
+      mMinCapacity(minCapacity > 0 ? std::min(minCapacity, maxSize) : maxSize),
+      // Every priority can push at least one event, whatever the capacity.
+      mReservedSize(mMinCapacity > 0 ? std::min(reservedSize, (mMinCapacity - 1) / 2) : 0),
+      mCapacity(mMinCapacity) {
+    if (mType == Type::LOCK_FREE) {
+        // Unlike the LOCKED queue, the ring is allocated upfront.
+        mRing = std::make_unique<Slot[]>(mQueueLimit);
+        for (size_t i = 0; i < mQueueLimit; i++) {
+            mRing[i].sequence.store(i, std::memory_order_relaxed);
+            mRing[i].timestampNs.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
 unique_ptr<LogEvent> LogEventQueue::waitPop() {
+    if (mType == Type::LOCK_FREE) {
+        return waitPopLockFree();
+    }
+
     std::unique_lock<std::mutex> lock(mMutex);
 
     if (mQueue.empty()) {
         mCondition.wait(lock, [this] { return !this->mQueue.empty(); });
     }
+    mPeakSize.store(std::max(mPeakSize.load(std::memory_order_relaxed), mQueue.size()),
+                    std::memory_order_relaxed);
 
     unique_ptr<LogEvent> item = std::move(mQueue.front());
     mQueue.pop();
@@ -39,17 +66,92 @@ unique_ptr<LogEvent> LogEventQueue::waitPop() {
     return item;
 }
 
-bool LogEventQueue::push(unique_ptr<LogEvent> item, int64_t* oldestTimestampNs) {
+std::vector<unique_ptr<LogEvent>> LogEventQueue::waitPopBatch(size_t maxCount) {
+    std::vector<unique_ptr<LogEvent>> items;
+    if (mType == Type::LOCK_FREE) {
+        items.push_back(waitPopLockFree());
+        mPeakSize.store(std::max(mPeakSize.load(std::memory_order_relaxed), getSize() + 1),
+                        std::memory_order_relaxed);
+        while (items.size() < maxCount) {
+            unique_ptr<LogEvent> item = tryPopLockFree();
+            if (item == nullptr) {
+                break;
+            }
+            items.push_back(std::move(item));
+        }
+        return items;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if (mQueue.empty()) {
+        mCondition.wait(lock, [this] { return !this->mQueue.empty(); });
+    }
+    mPeakSize.store(std::max(mPeakSize.load(std::memory_order_relaxed), mQueue.size()),
+                    std::memory_order_relaxed);
+
+    const size_t count = std::min(maxCount, mQueue.size());
+    items.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        items.push_back(std::move(mQueue.front()));
+        mQueue.pop();
+    }
+
+    return items;
+}
+
+size_t LogEventQueue::getLimit(Priority priority, size_t capacity) const {
+    switch (priority) {
+        case Priority::UNUSED:
+            return capacity - 2 * mReservedSize;
+        case Priority::NORMAL:
+            return capacity - mReservedSize;
+        case Priority::CRITICAL:
+            return capacity;
+    }
+    return capacity;
+}
+
+bool LogEventQueue::growCapacity(size_t capacity) {
+    if (capacity >= mQueueLimit || mUnderMemoryPressure.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    // Another producer may have grown it already, the push is retried either way.
+    mCapacity.compare_exchange_strong(capacity, std::min(2 * capacity, mQueueLimit),
+                                      std::memory_order_relaxed);
+    return true;
+}
+
+bool LogEventQueue::push(unique_ptr<LogEvent> item, int64_t* oldestTimestampNs,
+                         Priority priority) {
+    if (mType == Type::LOCK_FREE) {
+        while (true) {
+            const size_t capacity = mCapacity.load(std::memory_order_relaxed);
+            if (pushLockFree(std::move(item), oldestTimestampNs, getLimit(priority, capacity))) {
+                return true;
+            }
+            if (!growCapacity(capacity)) {
+                return false;
+            }
+        }
+    }
+
     bool success;
     {
         std::unique_lock<std::mutex> lock(mMutex);
-        if (mQueue.size() < mQueueLimit) {
-            mQueue.push(std::move(item));
-            success = true;
-        } else {
-            // safe operation as queue must not be empty.
-            *oldestTimestampNs = mQueue.front()->GetElapsedTimestampNs();
-            success = false;
+        while (true) {
+            const size_t capacity = mCapacity.load(std::memory_order_relaxed);
+            if (mQueue.size() < getLimit(priority, capacity)) {
+                mQueue.push(std::move(item));
+                success = true;
+                break;
+            }
+            if (!growCapacity(capacity)) {
+                // safe operation as queue must not be empty.
+                *oldestTimestampNs = mQueue.front()->GetElapsedTimestampNs();
+                success = false;
+                break;
+            }
         }
     }
 
@@ -57,6 +159,144 @@ bool LogEventQueue::push(unique_ptr<LogEvent> item, int64_t* oldestTimestampNs)
     return success;
 }
 
+void LogEventQueue::maybeUpdateCapacity(int64_t elapsedRealtimeNs) {
+    if (mMinCapacity == mQueueLimit ||
+        elapsedRealtimeNs - mLastCapacityUpdateNs < kCapacityUpdatePeriodNs) {
+        return;
+    }
+    mLastCapacityUpdateNs = elapsedRealtimeNs;
+    updateCapacity(isUnderMemoryPressure());
+}
+
+void LogEventQueue::updateCapacity(bool underMemoryPressure) {
+    mUnderMemoryPressure.store(underMemoryPressure, std::memory_order_relaxed);
+    const size_t peakSize = mPeakSize.exchange(0, std::memory_order_relaxed);
+    const size_t capacity = mCapacity.load(std::memory_order_relaxed);
+    const size_t target = underMemoryPressure ? mMinCapacity
+                                              : std::max(mMinCapacity, 2 * peakSize);
+    if (target < capacity) {
+        // The events already queued above the new capacity are kept. A concurrent growth is
+        // overwritten, the next burst grows the capacity again.
+        mCapacity.store(target, std::memory_order_relaxed);
+    }
+}
+
+size_t LogEventQueue::getSize() {
+    if (mType == Type::LOCK_FREE) {
+        const size_t dequeuePos = mDequeuePos.load(std::memory_order_relaxed);
+        const size_t enqueuePos = mEnqueuePos.load(std::memory_order_relaxed);
+        return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueue.size();
+}
+
+bool LogEventQueue::isCongested() {
+    // Without memory pressure, a full queue grows up to mQueueLimit first.
+    const size_t limit =
+            getLimit(Priority::NORMAL, mUnderMemoryPressure.load(std::memory_order_relaxed)
+                                               ? mCapacity.load(std::memory_order_relaxed)
+                                               : mQueueLimit);
+    const size_t size = getSize();
+    if (size >= limit - limit / 4) {
+        mCongested.store(true, std::memory_order_relaxed);
+    } else if (size <= limit / 4) {
+        mCongested.store(false, std::memory_order_relaxed);
+    }
+    return mCongested.load(std::memory_order_relaxed);
+}
+
+bool LogEventQueue::pushLockFree(unique_ptr<LogEvent>&& item, int64_t* oldestTimestampNs,
+                                 size_t limit) {
+    size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &mRing[pos % mQueueLimit];
+        const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0 && limit < mQueueLimit &&
+            pos - mDequeuePos.load(std::memory_order_relaxed) >= limit) {
+            // The queue is full for this priority. The consumer may be popping concurrently,
+            // so the check is best effort.
+            *oldestTimestampNs = mRing[mDequeuePos.load(std::memory_order_relaxed) % mQueueLimit]
+                                         .timestampNs.load(std::memory_order_relaxed);
+            return false;
+        }
+        if (diff == 0) {
+            // The slot is free, try to claim it.
+            if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The slot still holds the event pushed mQueueLimit positions ago: queue is full.
+            // The consumer may be popping the oldest event concurrently, so the reported
+            // timestamp is best effort.
+            const size_t oldestPos = mDequeuePos.load(std::memory_order_relaxed);
+            *oldestTimestampNs =
+                    mRing[oldestPos % mQueueLimit].timestampNs.load(std::memory_order_relaxed);
+            return false;
+        } else {
+            // Another producer claimed the slot first.
+            pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->timestampNs.store(item->GetElapsedTimestampNs(), std::memory_order_relaxed);
+    slot->event = std::move(item);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the fence in waitPopLockFree(): either the consumer sees the published slot
+    // when it re-checks the ring, or this thread sees the consumer idle and wakes it up.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mConsumerIdle.load(std::memory_order_relaxed)) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mConsumerIdle.store(false, std::memory_order_relaxed);
+        }
+        mCondition.notify_one();
+    }
+    return true;
+}
+
+unique_ptr<LogEvent> LogEventQueue::tryPopLockFree() {
+    const size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+    Slot& slot = mRing[pos % mQueueLimit];
+    const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != pos + 1) {
+        return nullptr;
+    }
+
+    unique_ptr<LogEvent> item = std::move(slot.event);
+    mDequeuePos.store(pos + 1, std::memory_order_relaxed);
+    // Hand the slot back to the producers for the next lap around the ring.
+    slot.sequence.store(pos + mQueueLimit, std::memory_order_release);
+    return item;
+}
+
+unique_ptr<LogEvent> LogEventQueue::waitPopLockFree() {
+    while (true) {
+        unique_ptr<LogEvent> item = tryPopLockFree();
+        if (item != nullptr) {
+            return item;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mConsumerIdle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // Re-check after publishing the idle state, an event may have been pushed by a
+        // producer which did not see it yet.
+        item = tryPopLockFree();
+        if (item != nullptr) {
+            mConsumerIdle.store(false, std::memory_order_relaxed);
+            return item;
+        }
+
+        mCondition.wait(lock,
+                        [this] { return !mConsumerIdle.load(std::memory_order_relaxed); });
+    }
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
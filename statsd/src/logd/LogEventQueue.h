@@ -18,11 +18,15 @@
 
 #include <gtest/gtest_prod.h>
 
+#include <atomic>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "LogEvent.h"
+#include "LogEventSpill.h"
 
 namespace android {
 namespace os {
@@ -30,29 +34,172 @@ namespace statsd {
 
 /**
  * A zero copy thread safe queue buffer for producing and consuming LogEvent.
+ *
+ * Two implementations are available:
+ * - LOCKED: a std::queue guarded by a mutex, every push and pop takes the lock.
+ * - LOCK_FREE: a bounded ring buffer pre-allocated with maxSize slots. Any number of threads
+ *   can push, a single thread must pop. The mutex is only taken to put the consumer to sleep
+ *   when the ring is empty and by the producer which wakes it up.
+ *
+ * Events are pushed with a priority. Each priority below CRITICAL leaves reservedSize more slots
+ * free for the priorities above it, so that an overloaded queue drops the events that matter
+ * least first.
+ *
+ * With a minCapacity below maxSize, the capacity adapts between the two: it doubles when a burst
+ * fills it, unless the device is under memory pressure, and shrinks back towards twice the peak
+ * occupancy recently observed, or down to minCapacity under memory pressure. The memory of the
+ * LOCK_FREE ring is allocated upfront, there the capacity bounds the events held.
  */
 class LogEventQueue {
 public:
-    explicit LogEventQueue(size_t maxSize) : mQueueLimit(maxSize){};
+    enum class Type {
+        LOCKED,
+        LOCK_FREE,
+    };
+
+    enum class Priority {
+        // The atom is not used by any config.
+        UNUSED,
+        NORMAL,
+        // Isolated uid changes, state changes and other atoms whose loss corrupts the data of
+        // every later event.
+        CRITICAL,
+    };
+
+    // Period of the capacity updates done by the consumer.
+    static constexpr int64_t kCapacityUpdatePeriodNs = 10 * 1000000000LL;
+
+    explicit LogEventQueue(size_t maxSize, Type type = Type::LOCKED, size_t reservedSize = 0,
+                           size_t minCapacity = 0);
 
     /**
      * Blocking read one event from the queue.
+     * For LOCK_FREE queues, must only be called from a single consumer thread.
      */
     std::unique_ptr<LogEvent> waitPop();
 
+    /**
+     * Blocking read of up to maxCount events from the queue. Returns as soon as at least one
+     * event is available, without waiting for the batch to be filled.
+     * For LOCK_FREE queues, must only be called from a single consumer thread.
+     */
+    std::vector<std::unique_ptr<LogEvent>> waitPopBatch(size_t maxCount);
+
     /**
      * Puts a LogEvent ptr to the end of the queue.
-     * Returns false on failure when the queue is full, and output the oldest event timestamp
-     * in the queue.
+     * Returns false on failure when the queue is full for the priority of the event, and output
+     * the oldest event timestamp in the queue.
+     */
+    bool push(std::unique_ptr<LogEvent> event, int64_t* oldestTimestampNs,
+              Priority priority = Priority::NORMAL);
+
+    /**
+     * Updates the capacity if kCapacityUpdatePeriodNs elapsed since the last update, reading the
+     * memory pressure from the kernel. No-op for a queue of fixed capacity.
+     * Must only be called from the consumer thread.
+     */
+    void maybeUpdateCapacity(int64_t elapsedRealtimeNs);
+
+    /**
+     * Shrinks the capacity to the recent peak occupancy, or to the minimum one under memory
+     * pressure, which also stops bursts from growing it until the next update.
+     * Must only be called from the consumer thread.
+     */
+    void updateCapacity(bool underMemoryPressure);
+
+    size_t getCapacity() const {
+        return mCapacity.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Whether producers should hold off their events: the queue is getting close to the size
+     * at which it drops events. Once congested, the queue stays so until it drained down to a
+     * quarter of that size.
+     */
+    bool isCongested();
+
+    /**
+     * Sets where the producers spill the atoms that do not fit, see LogEventSpill. Must be set
+     * before any push.
      */
-    bool push(std::unique_ptr<LogEvent> event, int64_t* oldestTimestampNs);
+    void setSpill(std::unique_ptr<LogEventSpill> spill) {
+        mSpill = std::move(spill);
+    }
+
+    // Null if the atoms that do not fit are dropped.
+    LogEventSpill* getSpill() const {
+        return mSpill.get();
+    }
 
 private:
+    struct Slot {
+        // Ring position this slot is ready for. Equals pos when the slot is free for a push at
+        // pos, pos + 1 once the event pushed at pos is published.
+        std::atomic<size_t> sequence;
+
+        // Copy of the event timestamp, readable without owning the event to report the oldest
+        // timestamp on overflow.
+        std::atomic<int64_t> timestampNs;
+
+        std::unique_ptr<LogEvent> event;
+    };
+
+    // The event is only moved from on success.
+    bool pushLockFree(std::unique_ptr<LogEvent>&& event, int64_t* oldestTimestampNs,
+                      size_t limit);
+
+    // Returns the number of events a queue of this capacity can hold when pushing an event of
+    // this priority.
+    size_t getLimit(Priority priority, size_t capacity) const;
+
+    // Doubles the capacity after a push failed at the given one. Returns false if the capacity
+    // can not grow.
+    bool growCapacity(size_t capacity);
+
+    // Number of events in the queue, best effort for LOCK_FREE queues.
+    size_t getSize();
+
+    std::unique_ptr<LogEvent> waitPopLockFree();
+
+    // Returns nullptr if the ring is empty.
+    std::unique_ptr<LogEvent> tryPopLockFree();
+
     const size_t mQueueLimit;
+    const Type mType;
+
+    const size_t mMinCapacity;
+
+    // Slots left free by each priority below CRITICAL for the priorities above it.
+    const size_t mReservedSize;
+
+    // Between mMinCapacity and mQueueLimit.
+    std::atomic<size_t> mCapacity;
+
+    std::atomic<bool> mUnderMemoryPressure = false;
+
+    // Max number of events seen in the queue by the consumer since the last capacity update.
+    std::atomic<size_t> mPeakSize = 0;
+
+    // Consumer thread only.
+    int64_t mLastCapacityUpdateNs = 0;
+
+    std::atomic<bool> mCongested = false;
     std::condition_variable mCondition;
     std::mutex mMutex;
+
+    // LOCKED queue storage.
     std::queue<std::unique_ptr<LogEvent>> mQueue;
 
+    // LOCK_FREE queue storage.
+    std::unique_ptr<Slot[]> mRing;
+    std::atomic<size_t> mEnqueuePos = 0;
+    std::atomic<size_t> mDequeuePos = 0;
+
+    // Set by the consumer before it goes to sleep on mCondition.
+    std::atomic<bool> mConsumerIdle = false;
+
+    std::unique_ptr<LogEventSpill> mSpill;
+
     friend class SocketParseMessageTest;
 
     FRIEND_TEST(SocketParseMessageTest, TestProcessMessage);
@@ -60,6 +207,8 @@ private:
     FRIEND_TEST(SocketParseMessageTest, TestProcessMessageFilterCompleteSet);
     FRIEND_TEST(SocketParseMessageTest, TestProcessMessageFilterPartialSet);
     FRIEND_TEST(SocketParseMessageTest, TestProcessMessageFilterToggle);
+    FRIEND_TEST(LogEventQueue_test, TestLockFreeRingWrapAround);
+    FRIEND_TEST(SequencedLogEventQueueTest, TestEventsForwardedInSequenceOrder);
 };
 
 }  // namespace statsd
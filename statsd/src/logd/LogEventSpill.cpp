@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "LogEventSpill.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+using std::unique_ptr;
+
+// Max size of a socket datagram, so that any atom fits into the scratch buffer.
+static constexpr size_t kMaxRecordPayloadBytes = 4 * 1024;
+
+unique_ptr<LogEventSpill> LogEventSpill::create(const char* path, size_t capacityBytes,
+                                                int64_t maxAgeNs) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)));
+    if (fd < 0) {
+        ALOGE("Failed to open the event spill %s: %s", path, strerror(errno));
+        return nullptr;
+    }
+    if (ftruncate(fd.get(), capacityBytes) != 0) {
+        ALOGE("Failed to size the event spill %s: %s", path, strerror(errno));
+        return nullptr;
+    }
+    void* ring = mmap(nullptr, capacityBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+    if (ring == MAP_FAILED) {
+        ALOGE("Failed to map the event spill %s: %s", path, strerror(errno));
+        return nullptr;
+    }
+    return unique_ptr<LogEventSpill>(new LogEventSpill(std::move(fd), static_cast<uint8_t*>(ring),
+                                                       capacityBytes, maxAgeNs));
+}
+
+LogEventSpill::LogEventSpill(unique_fd fd, uint8_t* ring, size_t capacityBytes, int64_t maxAgeNs)
+    : mFd(std::move(fd)),
+      mRing(ring),
+      mCapacityBytes(capacityBytes),
+      mMaxAgeNs(maxAgeNs),
+      mScratch(std::make_unique<uint8_t[]>(kMaxRecordPayloadBytes)) {
+}
+
+LogEventSpill::~LogEventSpill() {
+    munmap(mRing, mCapacityBytes);
+}
+
+bool LogEventSpill::append(const uint8_t* payload, uint32_t size, uint32_t uid, uint32_t pid,
+                           int64_t nowNs) {
+    if (size > kMaxRecordPayloadBytes) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    const size_t recordSize = sizeof(RecordHeader) + size;
+    if (mTail - mHead + recordSize > mCapacityBytes) {
+        return false;
+    }
+    const RecordHeader header{size, uid, pid, /*reserved=*/0, nowNs};
+    writeLocked(mTail, &header, sizeof(header));
+    writeLocked(mTail + sizeof(header), payload, size);
+    mTail += recordSize;
+    mActive.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool LogEventSpill::replay(int64_t nowNs, const ReplayCallback& onRecord,
+                           const std::function<void(const Record&)>& onExpired) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    while (mHead < mTail) {
+        RecordHeader header;
+        readLocked(mHead, &header, sizeof(header));
+        const size_t payloadOffset = (mHead + sizeof(header)) % mCapacityBytes;
+        const uint8_t* payload = mRing + payloadOffset;
+        if (payloadOffset + header.size > mCapacityBytes) {
+            readLocked(payloadOffset, mScratch.get(), header.size);
+            payload = mScratch.get();
+        }
+        const Record record{payload, header.size, header.uid, header.pid, header.spillTimeNs};
+        if (nowNs - header.spillTimeNs > mMaxAgeNs) {
+            onExpired(record);
+        } else if (!onRecord(record)) {
+            return false;
+        }
+        mHead += sizeof(header) + header.size;
+    }
+    // Both positions are reset so that records start at the beginning of the ring again.
+    mHead = 0;
+    mTail = 0;
+    mActive.store(false, std::memory_order_relaxed);
+    return true;
+}
+
+size_t LogEventSpill::getSpilledBytes() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTail - mHead;
+}
+
+void LogEventSpill::writeLocked(size_t offset, const void* data, size_t size) {
+    offset %= mCapacityBytes;
+    const size_t firstPart = std::min(size, mCapacityBytes - offset);
+    memcpy(mRing + offset, data, firstPart);
+    memcpy(mRing, static_cast<const uint8_t*>(data) + firstPart, size - firstPart);
+}
+
+void LogEventSpill::readLocked(size_t offset, void* data, size_t size) const {
+    offset %= mCapacityBytes;
+    const size_t firstPart = std::min(size, mCapacityBytes - offset);
+    memcpy(data, mRing + offset, firstPart);
+    memcpy(static_cast<uint8_t*>(data) + firstPart, mRing, size - firstPart);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
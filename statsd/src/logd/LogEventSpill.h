@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+#include <gtest/gtest_prod.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Ring of raw atoms in a memory mapped file, holding the atoms that do not fit into a full
+ * LogEventQueue until the consumer catches up. The pages of the file are written back by the
+ * kernel instead of holding on to memory.
+ *
+ * Once an atom is spilled, the later atoms are spilled too until the spill is replayed, so that
+ * the queue gets the atoms in order. Atoms older than the max age are dropped on replay.
+ *
+ * Thread safe.
+ */
+class LogEventSpill {
+public:
+    // A spilled atom, only valid during the callback it is passed to.
+    struct Record {
+        const uint8_t* payload;
+        uint32_t size;
+        uint32_t uid;
+        uint32_t pid;
+        int64_t spillTimeNs;
+    };
+
+    // Returns false to stop the replay, keeping the record.
+    typedef std::function<bool(const Record&)> ReplayCallback;
+
+    static constexpr size_t kDefaultCapacityBytes = 4 * 1024 * 1024;  // 4 MB
+    static constexpr int64_t kDefaultMaxAgeNs = 60 * 1'000'000'000LL;  // 60 seconds.
+
+    // Returns nullptr if the file can not be mapped. The previous content of the file is dropped.
+    static std::unique_ptr<LogEventSpill> create(const char* path,
+                                                 size_t capacityBytes = kDefaultCapacityBytes,
+                                                 int64_t maxAgeNs = kDefaultMaxAgeNs);
+
+    ~LogEventSpill();
+
+    // Whether atoms are spilled, and the new atoms must be spilled after them.
+    bool isActive() const {
+        return mActive.load(std::memory_order_relaxed);
+    }
+
+    // Returns false if the atom does not fit.
+    bool append(const uint8_t* payload, uint32_t size, uint32_t uid, uint32_t pid, int64_t nowNs);
+
+    // Passes the spilled atoms to onRecord in the order they were spilled, until it returns
+    // false. Atoms spilled more than the max age before nowNs are passed to onExpired instead.
+    // Returns true if every atom was replayed, in which case the spill is no longer active.
+    bool replay(int64_t nowNs, const ReplayCallback& onRecord,
+                const std::function<void(const Record&)>& onExpired);
+
+    size_t getSpilledBytes() const;
+
+private:
+    struct RecordHeader {
+        uint32_t size;
+        uint32_t uid;
+        uint32_t pid;
+        uint32_t reserved;
+        int64_t spillTimeNs;
+    };
+
+    LogEventSpill(android::base::unique_fd fd, uint8_t* ring, size_t capacityBytes,
+                  int64_t maxAgeNs);
+
+    // Copies in and out of the ring at the offset, wrapping around its end.
+    void writeLocked(size_t offset, const void* data, size_t size);
+    void readLocked(size_t offset, void* data, size_t size) const;
+
+    const android::base::unique_fd mFd;
+    uint8_t* const mRing;
+    const size_t mCapacityBytes;
+    const int64_t mMaxAgeNs;
+
+    mutable std::mutex mMutex;
+
+    // Positions of the oldest record and past the newest one, growing without wrapping.
+    size_t mHead = 0;
+    size_t mTail = 0;
+
+    // Scratch copy of the payload of a record that wraps around the end of the ring.
+    std::unique_ptr<uint8_t[]> mScratch;
+
+    std::atomic<bool> mActive = false;
+
+    FRIEND_TEST(LogEventSpillTest, TestWrapAround);
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "SequencedLogEventQueue.h"
+
+#include <algorithm>
+
+#include "guardrail/StatsdStats.h"
+#include "stats_log_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_lock;
+using std::unique_ptr;
+
+SequencedLogEventQueue::SequencedLogEventQueue(std::shared_ptr<LogEventQueue> queue,
+                                               size_t windowSize, const sp<UidMap>& uidMap)
+    : mQueue(std::move(queue)), mUidMap(uidMap), mWindow(std::max(windowSize, size_t(1))) {
+}
+
+uint64_t SequencedLogEventQueue::acquireSequence() {
+    unique_lock<std::mutex> lock(mMutex);
+    mForwardedCv.wait(lock, [this] { return mNextSequence - mNextForwarded < mWindow.size(); });
+    return mNextSequence++;
+}
+
+void SequencedLogEventQueue::push(uint64_t sequence, unique_ptr<LogEvent> event,
+                                  LogEventQueue::Priority priority) {
+    unique_lock<std::mutex> lock(mMutex);
+    Slot& slot = mWindow[sequence % mWindow.size()];
+    slot.event = std::move(event);
+    slot.priority = priority;
+    if (sequence != mNextForwarded) {
+        return;
+    }
+
+    // Events are forwarded under the lock, which keeps the pushes to the queue in order.
+    while (mNextForwarded < mNextSequence) {
+        Slot& next = mWindow[mNextForwarded % mWindow.size()];
+        if (next.event == nullptr) {
+            break;
+        }
+        if (mUidMap != nullptr) {
+            handleIsolatedUidsOnIngestion(mUidMap, next.event.get());
+        }
+        const int32_t atomId = next.event->GetTagId();
+        const bool isAtomSkipped = next.event->isParsedHeaderOnly();
+        int64_t oldestTimestamp;
+        if (!mQueue->push(std::move(next.event), &oldestTimestamp, next.priority)) {
+            StatsdStats::getInstance().noteEventQueueOverflow(oldestTimestamp, atomId,
+                                                              isAtomSkipped);
+        }
+        mNextForwarded++;
+    }
+    lock.unlock();
+    mForwardedCv.notify_all();
+}
+
+void SequencedLogEventQueue::waitForDrained() {
+    unique_lock<std::mutex> lock(mMutex);
+    mForwardedCv.wait(lock, [this] { return mNextForwarded == mNextSequence; });
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "LogEvent.h"
+#include "LogEventQueue.h"
+#include "packages/UidMap.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Puts back in order the events parsed concurrently before they reach a LogEventQueue.
+ *
+ * A single producer hands out sequence numbers in arrival order with acquireSequence(). Any
+ * thread then pushes the event of a sequence number, and events are forwarded to the queue in
+ * sequence order: an event waits in the reorder window until every earlier one was pushed.
+ *
+ * The window holds at most windowSize sequence numbers acquired and not yet forwarded,
+ * acquireSequence() blocks while it is full. Its slots are allocated upfront.
+ *
+ * With a uidMap, the isolated uids of the events are handled as they are forwarded, in order,
+ * see handleIsolatedUidsOnIngestion().
+ */
+class SequencedLogEventQueue {
+public:
+    SequencedLogEventQueue(std::shared_ptr<LogEventQueue> queue, size_t windowSize,
+                           const sp<UidMap>& uidMap = nullptr);
+
+    /**
+     * Returns the next sequence number, once the window has room for it.
+     * Must only be called from a single producer thread.
+     */
+    uint64_t acquireSequence();
+
+    /**
+     * Pushes the event of a sequence number returned by acquireSequence(), exactly once per
+     * sequence number. The events forwarded by this call are pushed to the queue from this
+     * thread, and the overflows are noted in StatsdStats.
+     */
+    void push(uint64_t sequence, std::unique_ptr<LogEvent> event,
+              LogEventQueue::Priority priority);
+
+    /**
+     * Blocks until every acquired sequence number was forwarded to the queue.
+     */
+    void waitForDrained();
+
+private:
+    struct Slot {
+        std::unique_ptr<LogEvent> event;
+        LogEventQueue::Priority priority = LogEventQueue::Priority::NORMAL;
+    };
+
+    const std::shared_ptr<LogEventQueue> mQueue;
+
+    const sp<UidMap> mUidMap;
+
+    std::mutex mMutex;
+
+    // Signals the producer and waitForDrained() that events were forwarded.
+    std::condition_variable mForwardedCv;
+
+    // Indexed by sequence number modulo the window size. Guarded by mMutex.
+    std::vector<Slot> mWindow;
+
+    // Next sequence number returned by acquireSequence(). Guarded by mMutex.
+    uint64_t mNextSequence = 0;
+
+    // Sequence number of the next event forwarded to the queue. Guarded by mMutex.
+    uint64_t mNextForwarded = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -22,6 +22,7 @@
 #include <android/binder_interface_utils.h>
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
+#include <cutils/sockets.h>
 #include <stdio.h>
 #include <sys/random.h>
 #include <sys/stat.h>
@@ -30,9 +31,19 @@
 #include <utils/Looper.h>
 
 #include "StatsService.h"
+#include "external/Perfetto.h"
 #include "flags/FlagProvider.h"
+#include "guardrail/StatsdStats.h"
 #include "packages/UidMap.h"
 #include "socket/StatsSocketListener.h"
+#include "state/StateManager.h"
+#include "subscriber/SubscriberDispatcher.h"
+
+/**
+ * NOTE: the directory is protected by SELinux, any changes here must also update the SELinux
+ * policies.
+ */
+#define STATS_EVENT_SPILL_PATH "/data/misc/stats-spill/events"
 
 using namespace android;
 using namespace android::os::statsd;
@@ -42,6 +53,8 @@ using std::make_shared;
 
 shared_ptr<StatsService> gStatsService = nullptr;
 sp<StatsSocketListener> gSocketListener = nullptr;
+sp<StatsSocketListener> gSystemSocketListener = nullptr;
+sp<StatsRingListener> gRingListener = nullptr;
 int gCtrlPipe[2];
 
 void signalHandler(int sig) {
@@ -88,10 +101,69 @@ int main(int /*argc*/, char** /*argv*/) {
     ABinderProcess_startThreadPool();
 
     // Initialize boot flags
-    FlagProvider::getInstance().initBootFlags({STATSD_INIT_COMPLETED_NO_DELAY_FLAG});
+    FlagProvider::getInstance().initBootFlags(
+            {STATSD_INIT_COMPLETED_NO_DELAY_FLAG, STATSD_LOCK_FREE_EVENT_QUEUE_FLAG,
+             STATSD_PARALLEL_CONFIG_PROCESSING_FLAG, STATSD_PULL_ALARM_COALESCING_FLAG,
+             STATSD_ASYNC_DISK_WRITES_FLAG, STATSD_REPORT_SEGMENTS_FLAG,
+             STATSD_REPORT_COMPRESSION_FLAG, STATSD_RING_TRANSPORT_FLAG,
+             STATSD_ALARM_TIMER_WHEEL_FLAG, STATSD_ASYNC_RESTRICTED_INSERTS_FLAG,
+             STATSD_OFF_LOCK_CONFIG_BUILD_FLAG, STATSD_BUCKET_CHECKPOINTS_FLAG,
+             STATSD_EVENT_LATENCY_TRACING_FLAG, STATSD_APP_UPGRADE_COALESCING_FLAG,
+             STATSD_SUBSCRIPTION_RING_FLAG, STATSD_PER_CONFIG_DUMP_FLAG,
+             STATSD_PRIORITIZED_EVENT_QUEUE_FLAG, STATSD_ADAPTIVE_EVENT_QUEUE_FLAG,
+             STATSD_STAGE_TRACING_FLAG, STATSD_PARALLEL_SOCKET_PARSING_FLAG,
+             STATSD_SYSTEM_SOCKET_FLAG, STATSD_ASYNC_CONFIG_TEARDOWN_FLAG,
+             STATSD_CONFIG_ARENAS_FLAG, STATSD_MEMORY_PRESSURE_SHEDDING_FLAG,
+             STATSD_DEBOUNCED_ALARM_REGISTRATION_FLAG, STATSD_INCREMENTAL_UID_MAP_FLAG,
+             STATSD_INGESTION_ISOLATED_UIDS_FLAG, STATSD_ASYNC_SUBSCRIBER_DISPATCH_FLAG,
+             STATSD_EVENT_QUEUE_SPILL_FLAG, STATSD_IDLE_STATE_EVICTION_FLAG,
+             STATSD_LOAD_SHEDDING_FLAG, STATSD_CONFIG_MAJOR_BATCHES_FLAG});
 
-    std::shared_ptr<LogEventQueue> eventQueue =
-            std::make_shared<LogEventQueue>(50000); /*buffer limit. Buffer is NOT pre-allocated*/
+    if (FlagProvider::getInstance().getBootFlagBool(STATSD_EVENT_LATENCY_TRACING_FLAG,
+                                                    FLAG_FALSE)) {
+        StatsdStats::getInstance().setEventLatencySampleInterval(
+                StatsdStats::kEventLatencySampleInterval);
+    }
+    ScopedStageTrace::setEnabled(
+            FlagProvider::getInstance().getBootFlagBool(STATSD_STAGE_TRACING_FLAG, FLAG_FALSE));
+    if (FlagProvider::getInstance().getBootFlagBool(STATSD_ASYNC_SUBSCRIBER_DISPATCH_FLAG,
+                                                    FLAG_FALSE)) {
+        SubscriberDispatcher::getInstance().startAsyncDispatch();
+    }
+    if (FlagProvider::getInstance().getBootFlagBool(STATSD_IDLE_STATE_EVICTION_FLAG, FLAG_FALSE)) {
+        StateManager::getInstance().setIdleStateEvictionNs(
+                StateManager::kDefaultIdleStateEvictionNs);
+    }
+
+    // The lock free queue pre-allocates its ring of 50000 slots, the locked one does not.
+    const LogEventQueue::Type eventQueueType =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_LOCK_FREE_EVENT_QUEUE_FLAG,
+                                                        FLAG_FALSE)
+                    ? LogEventQueue::Type::LOCK_FREE
+                    : LogEventQueue::Type::LOCKED;
+    // With prioritization, critical events keep the last 5000 slots of the queue for themselves
+    // and events of used atoms the 5000 before.
+    const size_t eventQueueReservedSize =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_PRIORITIZED_EVENT_QUEUE_FLAG,
+                                                        FLAG_FALSE)
+                    ? 5000
+                    : 0;
+    // An adaptive queue starts at 12500 events, grows with bursts and signals its congestion to
+    // the processes writing to rings.
+    const bool adaptiveEventQueue = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_ADAPTIVE_EVENT_QUEUE_FLAG, FLAG_FALSE);
+    std::shared_ptr<LogEventQueue> eventQueue = std::make_shared<LogEventQueue>(
+            50000 /*buffer limit*/, eventQueueType, eventQueueReservedSize,
+            adaptiveEventQueue ? 12500 : 0);
+    // The events that do not fit are spilled to a 4 MB file for up to a minute. Without the
+    // file, they are dropped as before.
+    if (FlagProvider::getInstance().getBootFlagBool(STATSD_EVENT_QUEUE_SPILL_FLAG, FLAG_FALSE)) {
+        eventQueue->setSpill(LogEventSpill::create(STATS_EVENT_SPILL_PATH));
+    }
+
+    // Processed events are recycled, so the pool is sized for the steady state rather than for
+    // a full event queue.
+    std::shared_ptr<LogEventPool> logEventPool = std::make_shared<LogEventPool>(1000);
 
     sp<UidMap> uidMap = UidMap::getInstance();
 
@@ -101,10 +173,67 @@ int main(int /*argc*/, char** /*argv*/) {
                                        STATSD_INIT_COMPLETED_NO_DELAY_FLAG, FLAG_FALSE)
                                        ? 0
                                        : StatsService::kStatsdInitDelaySecs;
+    StatsLogProcessorOptions processorOptions;
+    processorOptions.numEventProcessingThreads =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_PARALLEL_CONFIG_PROCESSING_FLAG,
+                                                        FLAG_FALSE)
+                    ? StatsLogProcessor::kParallelEventProcessingThreads
+                    : 1;
+    processorOptions.asyncDiskWrites = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_ASYNC_DISK_WRITES_FLAG, FLAG_FALSE);
+    processorOptions.reportSegments =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_REPORT_SEGMENTS_FLAG, FLAG_FALSE);
+    processorOptions.reportCodec =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_REPORT_COMPRESSION_FLAG, FLAG_FALSE)
+                    ? REPORT_CODEC_LZ4
+                    : REPORT_CODEC_NONE;
+    processorOptions.asyncRestrictedInserts = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_ASYNC_RESTRICTED_INSERTS_FLAG, FLAG_FALSE);
+    processorOptions.offLockConfigBuilds = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_OFF_LOCK_CONFIG_BUILD_FLAG, FLAG_FALSE);
+    processorOptions.bucketCheckpointIntervalNs =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_BUCKET_CHECKPOINTS_FLAG, FLAG_FALSE)
+                    ? StatsLogProcessor::kBucketCheckpointIntervalNs
+                    : 0;
+    processorOptions.appUpgradeCoalescingWindowNs =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_APP_UPGRADE_COALESCING_FLAG,
+                                                        FLAG_FALSE)
+                    ? StatsLogProcessor::kAppUpgradeCoalescingWindowNs
+                    : 0;
+    processorOptions.perConfigDumps = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_PER_CONFIG_DUMP_FLAG, FLAG_FALSE);
+    processorOptions.asyncConfigTeardown = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_ASYNC_CONFIG_TEARDOWN_FLAG, FLAG_FALSE);
+    processorOptions.configArenas =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_CONFIG_ARENAS_FLAG, FLAG_FALSE);
+    processorOptions.configMajorBatches = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_CONFIG_MAJOR_BATCHES_FLAG, FLAG_FALSE);
+
+    const int64_t pullCoalescingWindowNs =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_PULL_ALARM_COALESCING_FLAG,
+                                                        FLAG_FALSE)
+                    ? StatsPullerManager::kPullCoalescingWindowNs
+                    : 0;
+    const AlarmMonitor::Type alarmMonitorType =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_ALARM_TIMER_WHEEL_FLAG, FLAG_FALSE)
+                    ? AlarmMonitor::Type::TIMER_WHEEL
+                    : AlarmMonitor::Type::PRIORITY_QUEUE;
+    const bool subscriptionRings = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_SUBSCRIPTION_RING_FLAG, FLAG_FALSE);
+    const bool memoryPressureShedding = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_MEMORY_PRESSURE_SHEDDING_FLAG, FLAG_FALSE);
+    const bool debouncedAlarmRegistrations = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_DEBOUNCED_ALARM_REGISTRATION_FLAG, FLAG_FALSE);
+    const bool incrementalUidMapUpdates = FlagProvider::getInstance().getBootFlagBool(
+            STATSD_INCREMENTAL_UID_MAP_FLAG, FLAG_FALSE);
+    const bool loadShedding =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_LOAD_SHEDDING_FLAG, FLAG_FALSE);
     initSeedRandom();
     // Create the service
-    gStatsService =
-            SharedRefBase::make<StatsService>(uidMap, eventQueue, logEventFilter, initEventDelay);
+    gStatsService = SharedRefBase::make<StatsService>(
+            uidMap, eventQueue, logEventFilter, initEventDelay, logEventPool, processorOptions,
+            pullCoalescingWindowNs, alarmMonitorType, subscriptionRings, memoryPressureShedding,
+            debouncedAlarmRegistrations, incrementalUidMapUpdates, loadShedding);
     auto binder = gStatsService->asBinder();
 
     // We want to be able to ask for the selinux context of callers:
@@ -124,7 +253,31 @@ int main(int /*argc*/, char** /*argv*/) {
 
     gStatsService->Startup();
 
-    gSocketListener = new StatsSocketListener(eventQueue, logEventFilter);
+    // The listeners map the isolated uids of the events as they read them, instead of the
+    // processor under its lock.
+    const sp<UidMap> ingestionUidMap =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_INGESTION_ISOLATED_UIDS_FLAG,
+                                                        FLAG_FALSE)
+                    ? uidMap
+                    : nullptr;
+    if (FlagProvider::getInstance().getBootFlagBool(STATSD_RING_TRANSPORT_FLAG, FLAG_FALSE)) {
+        gRingListener = new StatsRingListener(eventQueue, logEventFilter, logEventPool,
+                                              adaptiveEventQueue, ingestionUidMap);
+        if (!gRingListener->start()) {
+            gRingListener = nullptr;
+        }
+    }
+
+    const size_t numParseThreads =
+            FlagProvider::getInstance().getBootFlagBool(STATSD_PARALLEL_SOCKET_PARSING_FLAG,
+                                                        FLAG_FALSE)
+                    ? StatsSocketListener::kDefaultParseThreads
+                    : 0;
+    gSocketListener = new StatsSocketListener(eventQueue, logEventFilter,
+                                              StatsSocketListener::kDefaultReadBatchSize,
+                                              logEventPool, gRingListener, numParseThreads,
+                                              StatsSocketListener::SocketClass::DEFAULT,
+                                              ingestionUidMap);
 
     ALOGI("Statsd starts to listen to socket.");
     // Backlog and /proc/sys/net/unix/max_dgram_qlen set to large value
@@ -132,6 +285,23 @@ int main(int /*argc*/, char** /*argv*/) {
         exit(1);
     }
 
+    const char* systemSocketName =
+            StatsSocketListener::getSocketName(StatsSocketListener::SocketClass::SYSTEM);
+    if (FlagProvider::getInstance().getBootFlagBool(STATSD_SYSTEM_SOCKET_FLAG, FLAG_FALSE)) {
+        gSystemSocketListener = new StatsSocketListener(
+                eventQueue, logEventFilter, StatsSocketListener::kSystemReadBatchSize,
+                logEventPool, gRingListener, numParseThreads,
+                StatsSocketListener::SocketClass::SYSTEM, ingestionUidMap);
+        if (gSystemSocketListener->startListener(600)) {
+            exit(1);
+        }
+    } else if (const int systemSocket = android_get_control_socket(systemSocketName);
+               systemSocket >= 0) {
+        // Once nothing holds the system socket, connecting to it fails and the system processes
+        // fall back to the default socket.
+        close(systemSocket);
+    }
+
     // Use self-pipe to notify this thread to gracefully quit
     // when receiving SIGTERM
     registerSignalHandlers();
@@ -143,6 +313,12 @@ int main(int /*argc*/, char** /*argv*/) {
                 if (errno == EINTR) continue;
             }
             gSocketListener->stopListener();
+            if (gSystemSocketListener != nullptr) {
+                gSystemSocketListener->stopListener();
+            }
+            if (gRingListener != nullptr) {
+                gRingListener->stop();
+            }
             gStatsService->Terminate();
             // return the signal handler to its default disposition, then raise the signal again
             signal(SIGTERM, SIG_DFL);
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AtomMatcherDispatchTable.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+void AtomMatcherDispatchTable::build(const unordered_map<int, vector<int>>& tagIdsToMatchers) {
+    clear();
+
+    vector<int> tagIds;
+    tagIds.reserve(tagIdsToMatchers.size());
+    size_t totalMatchers = 0;
+    for (const auto& [tagId, matchers] : tagIdsToMatchers) {
+        tagIds.push_back(tagId);
+        totalMatchers += matchers.size();
+    }
+    std::sort(tagIds.begin(), tagIds.end());
+    mMatcherIndices.reserve(totalMatchers);
+
+    // Atom ids are visited in increasing order, so the dense offsets are filled in one pass.
+    int maxDenseTagId = -1;
+    for (const int tagId : tagIds) {
+        if (tagId >= 0 && tagId < kMaxDenseAtomId) {
+            maxDenseTagId = tagId;
+        }
+    }
+    if (maxDenseTagId >= 0) {
+        mDenseOffsets.assign(maxDenseTagId + 2, 0);
+    }
+
+    int nextDenseTagId = 0;
+    for (const int tagId : tagIds) {
+        const vector<int>& matchers = tagIdsToMatchers.at(tagId);
+        const uint32_t begin = mMatcherIndices.size();
+        mMatcherIndices.insert(mMatcherIndices.end(), matchers.begin(), matchers.end());
+        const uint32_t end = mMatcherIndices.size();
+
+        if (tagId >= 0 && tagId <= maxDenseTagId) {
+            // Atom ids without matchers get an empty range.
+            for (; nextDenseTagId <= tagId; nextDenseTagId++) {
+                mDenseOffsets[nextDenseTagId] = begin;
+            }
+            mDenseOffsets[tagId + 1] = end;
+        } else {
+            mSparseEntries.push_back({tagId, begin, end});
+        }
+    }
+}
+
+AtomMatcherDispatchTable::Range AtomMatcherDispatchTable::lookupSparse(int tagId) const {
+    const auto it = std::lower_bound(
+            mSparseEntries.begin(), mSparseEntries.end(), tagId,
+            [](const SparseEntry& entry, int id) { return entry.tagId < id; });
+    if (it == mSparseEntries.end() || it->tagId != tagId) {
+        return Range();
+    }
+    return rangeAt(it->begin, it->end);
+}
+
+void AtomMatcherDispatchTable::clear() {
+    mMatcherIndices.clear();
+    mDenseOffsets.clear();
+    mSparseEntries.clear();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Flat lookup table from atom id to the indices of the AtomMatchingTrackers interested in it.
+ *
+ * Built once per config init/update from the tag id to matchers map. Atom ids below
+ * kMaxDenseAtomId (the pushed atom range) are looked up by direct indexing, the remaining ids are
+ * looked up with a binary search over a sorted array. All matcher indices are stored contiguously
+ * so a lookup touches at most a couple of cache lines, independent of hash bucketing.
+ */
+class AtomMatcherDispatchTable {
+public:
+    // Atom ids below this value are indexed directly.
+    static constexpr int kMaxDenseAtomId = 10000;
+
+    // A contiguous, possibly empty, range of matcher indices.
+    class Range {
+    public:
+        Range() : mBegin(nullptr), mEnd(nullptr) {
+        }
+
+        Range(const int* begin, const int* end) : mBegin(begin), mEnd(end) {
+        }
+
+        const int* begin() const {
+            return mBegin;
+        }
+
+        const int* end() const {
+            return mEnd;
+        }
+
+        bool empty() const {
+            return mBegin == mEnd;
+        }
+
+        size_t size() const {
+            return mEnd - mBegin;
+        }
+
+    private:
+        const int* mBegin;
+        const int* mEnd;
+    };
+
+    /**
+     * Rebuilds the table from the given atom id to matcher indices map.
+     */
+    void build(const std::unordered_map<int, std::vector<int>>& tagIdsToMatchers);
+
+    /**
+     * Returns the matcher indices for the atom id. The range is empty if no matcher is interested
+     * in the atom and stays valid until the next build().
+     */
+    Range lookup(int tagId) const {
+        if (tagId >= 0 && tagId < (int)mDenseOffsets.size() - 1) {
+            return rangeAt(mDenseOffsets[tagId], mDenseOffsets[tagId + 1]);
+        }
+        return lookupSparse(tagId);
+    }
+
+    void clear();
+
+private:
+    struct SparseEntry {
+        int tagId;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    Range rangeAt(uint32_t begin, uint32_t end) const {
+        return Range(mMatcherIndices.data() + begin, mMatcherIndices.data() + end);
+    }
+
+    Range lookupSparse(int tagId) const;
+
+    // Matcher indices of all atoms, grouped by atom id.
+    std::vector<int> mMatcherIndices;
+
+    // For a dense atom id t, its matchers are mMatcherIndices[mDenseOffsets[t],
+    // mDenseOffsets[t + 1]). Sized to the largest dense atom id in use, plus 2.
+    std::vector<uint32_t> mDenseOffsets;
+
+    // Atom ids not covered by mDenseOffsets, sorted by tagId.
+    std::vector<SparseEntry> mSparseEntries;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
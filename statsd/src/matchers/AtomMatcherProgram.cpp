@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AtomMatcherProgram.h"
+
+#include <span>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+// Appends matcherIndex to order after its children that are interested in the same atom.
+void appendChildrenFirst(const vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+                         const vector<bool>& interested, const int matcherIndex,
+                         vector<bool>& visited, vector<int>& order) {
+    if (visited[matcherIndex]) {
+        return;
+    }
+    visited[matcherIndex] = true;
+    for (const int childIndex : allAtomMatchingTrackers[matcherIndex]->getChildren()) {
+        if (interested[childIndex]) {
+            appendChildrenFirst(allAtomMatchingTrackers, interested, childIndex, visited, order);
+        }
+    }
+    order.push_back(matcherIndex);
+}
+
+}  // anonymous namespace
+
+void AtomMatcherProgram::build(const vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+                               const unordered_map<int, vector<int>>& tagIdsToMatchers) {
+    clear();
+
+    mInstructions.resize(allAtomMatchingTrackers.size());
+    for (size_t i = 0; i < allAtomMatchingTrackers.size(); i++) {
+        const sp<AtomMatchingTracker>& tracker = allAtomMatchingTrackers[i];
+        const vector<int>& children = tracker->getChildren();
+        Instruction& instruction = mInstructions[i];
+        instruction.operation = tracker->getLogicalOperation();
+        instruction.isCombination = !children.empty() ||
+                                    instruction.operation !=
+                                            LogicalOperation::LOGICAL_OPERATION_UNSPECIFIED;
+        instruction.childBegin = mChildren.size();
+        mChildren.insert(mChildren.end(), children.begin(), children.end());
+        instruction.childEnd = mChildren.size();
+    }
+
+    // Matchers not interested in an atom are never computed for it, which combinationMatch()
+    // counts as not matched, like their own evaluation would.
+    unordered_map<int, vector<int>> evaluationOrders;
+    vector<bool> interested(allAtomMatchingTrackers.size(), false);
+    vector<bool> visited(allAtomMatchingTrackers.size(), false);
+    for (const auto& [tagId, matchers] : tagIdsToMatchers) {
+        for (const int matcherIndex : matchers) {
+            interested[matcherIndex] = true;
+        }
+        vector<int>& order = evaluationOrders[tagId];
+        order.reserve(matchers.size());
+        for (const int matcherIndex : matchers) {
+            appendChildrenFirst(allAtomMatchingTrackers, interested, matcherIndex, visited, order);
+        }
+        for (const int matcherIndex : matchers) {
+            interested[matcherIndex] = false;
+            visited[matcherIndex] = false;
+        }
+    }
+    mEvaluationOrder.build(evaluationOrders);
+}
+
+void AtomMatcherProgram::evaluate(const LogEvent& event,
+                                  const vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+                                  vector<MatchingState>& matcherResults) const {
+    for (const int matcherIndex : mEvaluationOrder.lookup(event.GetTagId())) {
+        const Instruction& instruction = mInstructions[matcherIndex];
+        if (!instruction.isCombination) {
+            const int sharedSlot = instruction.sharedSlot;
+            if (sharedSlot != SharedMatcherCache::kNoSlot) {
+                // The tracker skips the evaluation if another config already did it.
+                matcherResults[matcherIndex] = mSharedCache->getResult(sharedSlot);
+            }
+            allAtomMatchingTrackers[matcherIndex]->onLogEvent(event, allAtomMatchingTrackers,
+                                                              matcherResults);
+            if (sharedSlot != SharedMatcherCache::kNoSlot) {
+                mSharedCache->setResult(sharedSlot, matcherResults[matcherIndex]);
+            }
+            continue;
+        }
+        const std::span<const int> children(mChildren.data() + instruction.childBegin,
+                                            mChildren.data() + instruction.childEnd);
+        matcherResults[matcherIndex] =
+                combinationMatch(children, instruction.operation, matcherResults)
+                        ? MatchingState::kMatched
+                        : MatchingState::kNotMatched;
+    }
+}
+
+void AtomMatcherProgram::addSharedMatchers(
+        const vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers, SharedMatcherCache& cache) {
+    for (const sp<AtomMatchingTracker>& tracker : allAtomMatchingTrackers) {
+        if (const optional<uint64_t> contentHash = tracker->getContentHash()) {
+            cache.addMatcher(*contentHash);
+        }
+    }
+}
+
+void AtomMatcherProgram::shareResults(
+        const vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+        const std::shared_ptr<SharedMatcherCache>& cache) {
+    mSharedCache = cache;
+    for (size_t i = 0; i < mInstructions.size(); i++) {
+        const optional<uint64_t> contentHash = allAtomMatchingTrackers[i]->getContentHash();
+        mInstructions[i].sharedSlot = cache != nullptr && contentHash
+                                              ? cache->getSlot(*contentHash)
+                                              : SharedMatcherCache::kNoSlot;
+    }
+}
+
+void AtomMatcherProgram::clear() {
+    mEvaluationOrder.clear();
+    mInstructions.clear();
+    mChildren.clear();
+    mSharedCache = nullptr;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "matchers/AtomMatcherDispatchTable.h"
+#include "matchers/AtomMatchingTracker.h"
+#include "matchers/SharedMatcherCache.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The AtomMatchingTrackers of a config compiled for evaluation in a single bottom-up pass.
+ *
+ * Built once per config init/update. For each atom id, the matchers interested in the atom are
+ * ordered children first. Simple matchers are still evaluated by their trackers, but combination
+ * matchers are evaluated here from a flat array of instructions over the results of their
+ * children, which avoids the recursion and virtual calls of CombinationAtomMatchingTracker.
+ * The results of simple matchers that other configs also define can be shared through a
+ * SharedMatcherCache.
+ */
+class AtomMatcherProgram {
+public:
+    /**
+     * Rebuilds the program from the matchers and the atom id to matcher indices map.
+     */
+    void build(const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+               const std::unordered_map<int, std::vector<int>>& tagIdsToMatchers);
+
+    /**
+     * Computes the results of the matchers interested in the atom of the event. The results of
+     * the other matchers are left as they are.
+     */
+    void evaluate(const LogEvent& event,
+                  const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+                  std::vector<MatchingState>& matcherResults) const;
+
+    /**
+     * Adds the simple matchers to cache, before any config takes its slots.
+     */
+    static void addSharedMatchers(
+            const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+            SharedMatcherCache& cache);
+
+    /**
+     * Looks the results of the simple matchers that have a slot in cache up there, and stores
+     * them there when they are computed. Sharing stops with a nullptr cache, or on rebuild.
+     */
+    void shareResults(const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+                      const std::shared_ptr<SharedMatcherCache>& cache);
+
+    void clear();
+
+private:
+    struct Instruction {
+        bool isCombination = false;
+        LogicalOperation operation = LogicalOperation::LOGICAL_OPERATION_UNSPECIFIED;
+        // The children are mChildren[childBegin, childEnd).
+        uint32_t childBegin = 0;
+        uint32_t childEnd = 0;
+        // Slot of the result in mSharedCache.
+        int sharedSlot = SharedMatcherCache::kNoSlot;
+    };
+
+    // The matchers interested in each atom id, children first.
+    AtomMatcherDispatchTable mEvaluationOrder;
+
+    // Indexed by matcher index.
+    std::vector<Instruction> mInstructions;
+
+    // Children of all the combination matchers.
+    std::vector<int> mChildren;
+
+    std::shared_ptr<SharedMatcherCache> mSharedCache;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -80,6 +80,23 @@ public:
         return mAtomIds;
     }
 
+    // Adds the top-level fields that the matcher reads from events to fieldMasks.
+    virtual void addFieldsInUse(AtomFieldMasks* fieldMasks) const {
+    }
+
+    // Get the indices of the children matchers that this matcher evaluates when it processes an
+    // event. Only CombinationAtomMatchingTrackers have children.
+    virtual const std::vector<int>& getChildren() const {
+        static const std::vector<int> kNoChildren;
+        return kNoChildren;
+    }
+
+    // Get the operation that combines the results of the children matchers. Only
+    // CombinationAtomMatchingTrackers have one.
+    virtual LogicalOperation getLogicalOperation() const {
+        return LogicalOperation::LOGICAL_OPERATION_UNSPECIFIED;
+    }
+
     int64_t getId() const {
         return mId;
     }
@@ -88,6 +105,13 @@ public:
         return mProtoHash;
     }
 
+    // Hash of what the matcher matches, whatever its id. Matchers with the same content hash give
+    // the same result for an event, so configs can share it. Combinations depend on the indices
+    // of their children and have none.
+    virtual optional<uint64_t> getContentHash() const {
+        return std::nullopt;
+    }
+
     bool isInitialized() {
         return mInitialized;
     }
@@ -114,6 +138,7 @@ protected:
     FRIEND_TEST(MetricsManagerUtilTest, TestCreateAtomMatchingTrackerSimple);
     FRIEND_TEST(MetricsManagerUtilTest, TestCreateAtomMatchingTrackerCombination);
     FRIEND_TEST(ConfigUpdateTest, TestUpdateMatchers);
+    FRIEND_TEST(ConfigUpdateTest, TestUpdateMatchersUnchangedInPlace);
 };
 
 }  // namespace statsd
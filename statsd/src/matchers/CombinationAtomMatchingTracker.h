@@ -46,12 +46,21 @@ public:
                     const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
                     std::vector<MatchingState>& matcherResults) override;
 
+    const std::vector<int>& getChildren() const override {
+        return mChildren;
+    }
+
+    LogicalOperation getLogicalOperation() const override {
+        return mLogicalOperation;
+    }
+
 private:
     LogicalOperation mLogicalOperation;
 
     std::vector<int> mChildren;
 
     FRIEND_TEST(ConfigUpdateTest, TestUpdateMatchers);
+    FRIEND_TEST(ConfigUpdateTest, TestUpdateMatchersUnchangedInPlace);
 };
 
 }  // namespace statsd
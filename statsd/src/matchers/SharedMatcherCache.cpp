@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SharedMatcherCache.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+void SharedMatcherCache::addMatcher(const uint64_t contentHash) {
+    mMatcherCounts[contentHash]++;
+}
+
+int SharedMatcherCache::getSlot(const uint64_t contentHash) {
+    const auto count = mMatcherCounts.find(contentHash);
+    if (count == mMatcherCounts.end() || count->second < 2) {
+        return kNoSlot;
+    }
+    const auto [it, inserted] = mSlots.try_emplace(contentHash, mSlots.size());
+    if (inserted && mResults.size() < mSlots.size()) {
+        mResults.push_back(MatchingState::kNotComputed);
+        mGenerations.push_back(0);
+    }
+    return it->second;
+}
+
+void SharedMatcherCache::beginBatch(const size_t numEvents) {
+    beginEvent();
+    const size_t size = std::max(numEvents, (size_t)1) * mSlots.size();
+    if (mResults.size() < size) {
+        mResults.resize(size, MatchingState::kNotComputed);
+        mGenerations.resize(size, 0);
+    }
+}
+
+void SharedMatcherCache::beginEvent() {
+    mOffset = 0;
+    if (++mGeneration == 0) {
+        // The generations wrapped around, the results of older events could look current again.
+        std::fill(mGenerations.begin(), mGenerations.end(), 0);
+        mGeneration = 1;
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
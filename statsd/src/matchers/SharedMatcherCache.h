@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "matchers/matcher_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Results of the simple matchers that several configs define identically, computed once per
+ * event and looked up by the other configs.
+ *
+ * Matchers are told apart by the hash of their contents, see
+ * AtomMatchingTracker::getContentHash(). All the matchers are added before slots are taken, so
+ * that only matchers defined more than once get a slot. A cache is used by one thread at a time,
+ * and beginEvent() must be called before each event the matchers are evaluated for. Configs that
+ * each process a whole batch of events in turn call beginBatch() once instead, and selectEvent()
+ * before each event of the batch.
+ */
+class SharedMatcherCache {
+public:
+    static constexpr int kNoSlot = -1;
+
+    // Notes a matcher with the given contents.
+    void addMatcher(const uint64_t contentHash);
+
+    // Returns the slot of the matchers with the given contents, kNoSlot if no other matcher has
+    // them.
+    int getSlot(const uint64_t contentHash);
+
+    // Forgets the results of the previous event.
+    void beginEvent();
+
+    // Forgets the results of the previous events, and keeps the results of each of the next
+    // numEvents events apart.
+    void beginBatch(const size_t numEvents);
+
+    // Makes the event at the index of the batch the current event.
+    void selectEvent(const size_t index) {
+        mOffset = index * mSlots.size();
+    }
+
+    // Result of the matchers of the slot for the current event, kNotComputed if not computed yet.
+    MatchingState getResult(const int slot) const {
+        return mGenerations[mOffset + slot] == mGeneration ? mResults[mOffset + slot]
+                                                           : MatchingState::kNotComputed;
+    }
+
+    void setResult(const int slot, const MatchingState result) {
+        mResults[mOffset + slot] = result;
+        mGenerations[mOffset + slot] = mGeneration;
+    }
+
+    size_t getSlotCount() const {
+        return mSlots.size();
+    }
+
+private:
+    // Number of matchers added for each content hash.
+    std::unordered_map<uint64_t, int> mMatcherCounts;
+
+    std::unordered_map<uint64_t, int> mSlots;
+
+    // Indexed by slot, then by event of the batch. A result is only valid for the events of the
+    // generation it was set in.
+    std::vector<MatchingState> mResults;
+    std::vector<uint32_t> mGenerations;
+    uint32_t mGeneration = 1;
+
+    // Start of the results of the current event.
+    size_t mOffset = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
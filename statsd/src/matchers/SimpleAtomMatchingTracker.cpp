@@ -19,6 +19,10 @@
 
 #include "SimpleAtomMatchingTracker.h"
 
+#include <algorithm>
+
+#include "hash.h"
+
 namespace android {
 namespace os {
 namespace statsd {
@@ -30,7 +34,8 @@ SimpleAtomMatchingTracker::SimpleAtomMatchingTracker(const int64_t& id, const in
                                                      const uint64_t protoHash,
                                                      const SimpleAtomMatcher& matcher,
                                                      const sp<UidMap>& uidMap)
-    : AtomMatchingTracker(id, index, protoHash), mMatcher(matcher), mUidMap(uidMap) {
+    : AtomMatchingTracker(id, index, protoHash), mMatcher(compileSimpleAtomMatcher(matcher)),
+      mUidMap(uidMap), mContentHash(Hash64(matcher.SerializeAsString())) {
     if (!matcher.has_atom_id()) {
         mInitialized = false;
     } else {
@@ -79,11 +84,31 @@ void SimpleAtomMatchingTracker::onLogEvent(
         return;
     }
 
+    if (mUidMap != nullptr) {
+        updateMatchingUids(*mUidMap, &mMatcher);
+    }
     bool matched = matchesSimple(mUidMap, mMatcher, event);
     matcherResults[mIndex] = matched ? MatchingState::kMatched : MatchingState::kNotMatched;
     VLOG("Stats SimpleAtomMatcher %lld matched? %d", (long long)mId, matched);
 }
 
+void SimpleAtomMatchingTracker::addFieldsInUse(AtomFieldMasks* fieldMasks) const {
+    TopLevelFieldMask& fieldMask = (*fieldMasks)[mMatcher.atomId];
+    for (const CompiledFieldValueMatcher& fieldValueMatcher : mMatcher.fieldValueMatchers) {
+        // Attribution chain matchers usually only match the uid field of the nodes.
+        const std::vector<CompiledFieldValueMatcher>& tupleMatchers =
+                fieldValueMatcher.tupleMatchers;
+        const bool attributionUidsOnly =
+                fieldValueMatcher.hasPosition && !tupleMatchers.empty() &&
+                std::all_of(tupleMatchers.begin(), tupleMatchers.end(),
+                            [](const CompiledFieldValueMatcher& tupleMatcher) {
+                                return tupleMatcher.field == 1 &&
+                                       tupleMatcher.tupleMatchers.empty();
+                            });
+        setTopLevelFieldInUse(fieldValueMatcher.field, attributionUidsOnly, &fieldMask);
+    }
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
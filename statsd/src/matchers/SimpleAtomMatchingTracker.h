@@ -48,9 +48,20 @@ public:
                     const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
                     std::vector<MatchingState>& matcherResults) override;
 
+    void addFieldsInUse(AtomFieldMasks* fieldMasks) const override;
+
+    optional<uint64_t> getContentHash() const override {
+        return mContentHash;
+    }
+
 private:
-    const SimpleAtomMatcher mMatcher;
+    // The SimpleAtomMatcher of this tracker, compiled once so that matching an event does not
+    // walk the proto. Its uid sets are refreshed when the package names in mUidMap change.
+    CompiledSimpleAtomMatcher mMatcher;
     const sp<UidMap> mUidMap;
+
+    // Hash of the SimpleAtomMatcher proto bytes, which leave out the id of the matcher.
+    const uint64_t mContentHash;
 };
 
 }  // namespace statsd
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WildcardPatternSet.h"
+
+#include <fnmatch.h>
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+inline void setBit(uint64_t* bitmap, const size_t index) {
+    bitmap[index / 64] |= uint64_t{1} << (index % 64);
+}
+
+inline bool isBracketClassStart(const string& pattern, const size_t i) {
+    return pattern[i] == '[' && i + 1 < pattern.size() &&
+           (pattern[i + 1] == ':' || pattern[i + 1] == '=' || pattern[i + 1] == '.');
+}
+
+// Reads the character at i, or the escaped one if it is a backslash, and moves i past it.
+// Returns false if the pattern ends on the backslash.
+bool readBracketChar(const string& pattern, size_t* i, unsigned char* c) {
+    if (pattern[*i] == '\\') {
+        if (*i + 1 >= pattern.size()) {
+            return false;
+        }
+        (*i)++;
+    }
+    *c = pattern[(*i)++];
+    return true;
+}
+
+// Parses the bracket expression after the '[' at pattern[start - 1] into chars. Returns the index
+// past its closing ']', or string::npos for the brackets that only fnmatch() handles: the ones
+// with classes, and the ones that are not closed, whose meaning differs between
+// implementations.
+size_t parseBracketExpression(const string& pattern, size_t start, std::bitset<256>* chars) {
+    const size_t n = pattern.size();
+    size_t i = start;
+    bool negated = false;
+    if (i < n && (pattern[i] == '!' || pattern[i] == '^')) {
+        negated = true;
+        i++;
+    }
+    std::bitset<256> set;
+    // A ']' right after the opening is one of the characters.
+    bool first = true;
+    while (true) {
+        if (i >= n) {
+            return string::npos;
+        }
+        if (pattern[i] == ']' && !first) {
+            i++;
+            break;
+        }
+        first = false;
+        if (isBracketClassStart(pattern, i)) {
+            return string::npos;
+        }
+        unsigned char low;
+        if (!readBracketChar(pattern, &i, &low)) {
+            return string::npos;
+        }
+        if (i + 1 < n && pattern[i] == '-' && pattern[i + 1] != ']') {
+            i++;
+            if (isBracketClassStart(pattern, i)) {
+                return string::npos;
+            }
+            unsigned char high;
+            if (!readBracketChar(pattern, &i, &high)) {
+                return string::npos;
+            }
+            // A reversed range matches nothing.
+            for (int c = low; c <= high; c++) {
+                set.set(c);
+            }
+        } else {
+            set.set(low);
+        }
+    }
+    *chars = negated ? ~set : set;
+    return i;
+}
+
+}  // namespace
+
+WildcardPatternSet::WildcardPatternSet(const vector<string>& patterns) {
+    vector<size_t> firstStates;
+    for (const string& pattern : patterns) {
+        const size_t firstState = mStates.size();
+        if (compilePattern(pattern, &mStates)) {
+            firstStates.push_back(firstState);
+        } else {
+            mFallbackPatterns.push_back(pattern);
+        }
+    }
+    const size_t words = (mStates.size() + 63) / 64;
+    mInitialStates.assign(words, 0);
+    mAnySequenceStates.assign(words, 0);
+    mAcceptStates.assign(words, 0);
+    for (size_t i = 0; i < mStates.size(); i++) {
+        if (mStates[i].kind == StateKind::kAnySequence) {
+            setBit(mAnySequenceStates.data(), i);
+        } else if (mStates[i].kind == StateKind::kAccept) {
+            setBit(mAcceptStates.data(), i);
+        }
+    }
+    for (const size_t firstState : firstStates) {
+        setBit(mInitialStates.data(), firstState);
+    }
+    skipAnySequences(mInitialStates.data());
+}
+
+bool WildcardPatternSet::compilePattern(const string& pattern, vector<State>* states) {
+    // fnmatch() stops at a NUL of the pattern.
+    if (pattern.find('\0') != string::npos) {
+        return false;
+    }
+    vector<State> patternStates;
+    const size_t n = pattern.size();
+    size_t i = 0;
+    while (i < n) {
+        State state;
+        switch (pattern[i]) {
+            case '*':
+                i++;
+                // Consecutive stars match like a single one. The state after a kAnySequence is
+                // thus never another one.
+                if (!patternStates.empty() &&
+                    patternStates.back().kind == StateKind::kAnySequence) {
+                    continue;
+                }
+                state.kind = StateKind::kAnySequence;
+                break;
+            case '?':
+                state.chars.set();
+                i++;
+                break;
+            case '[': {
+                const size_t end = parseBracketExpression(pattern, i + 1, &state.chars);
+                if (end == string::npos) {
+                    return false;
+                }
+                i = end;
+                break;
+            }
+            case '\\':
+                // The fnmatch() implementations disagree on a trailing backslash.
+                if (i + 1 >= n) {
+                    return false;
+                }
+                state.chars.set(static_cast<unsigned char>(pattern[i + 1]));
+                i += 2;
+                break;
+            default:
+                state.chars.set(static_cast<unsigned char>(pattern[i]));
+                i++;
+                break;
+        }
+        patternStates.push_back(state);
+    }
+    State accept;
+    accept.kind = StateKind::kAccept;
+    patternStates.push_back(accept);
+    states->insert(states->end(), patternStates.begin(), patternStates.end());
+    return true;
+}
+
+void WildcardPatternSet::skipAnySequences(uint64_t* states) const {
+    uint64_t carry = 0;
+    for (size_t w = 0; w < mAnySequenceStates.size(); w++) {
+        const uint64_t anySequences = states[w] & mAnySequenceStates[w];
+        states[w] |= (anySequences << 1) | carry;
+        carry = anySequences >> 63;
+    }
+}
+
+bool WildcardPatternSet::matchesAny(const string& str) const {
+    for (const string& pattern : mFallbackPatterns) {
+        if (fnmatch(pattern.c_str(), str.c_str(), 0) == 0) {
+            return true;
+        }
+    }
+    if (mStates.empty()) {
+        return false;
+    }
+    const size_t words = mInitialStates.size();
+    uint64_t stackStates[2 * kMaxStackWords];
+    vector<uint64_t> heapStates;
+    uint64_t* current = stackStates;
+    if (words > kMaxStackWords) {
+        heapStates.resize(2 * words);
+        current = heapStates.data();
+    }
+    uint64_t* next = current + words;
+    std::copy(mInitialStates.begin(), mInitialStates.end(), current);
+    for (const char ch : str) {
+        // fnmatch() stops at a NUL of the string.
+        if (ch == '\0') {
+            break;
+        }
+        const unsigned char c = ch;
+        std::fill(next, next + words, 0);
+        bool alive = false;
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t bits = current[w]; bits != 0; bits &= bits - 1) {
+                const size_t index = w * 64 + __builtin_ctzll(bits);
+                const State& state = mStates[index];
+                if (state.kind == StateKind::kAnySequence) {
+                    setBit(next, index);
+                    alive = true;
+                } else if (state.kind == StateKind::kChars && state.chars.test(c)) {
+                    setBit(next, index + 1);
+                    alive = true;
+                }
+            }
+        }
+        if (!alive) {
+            return false;
+        }
+        skipAnySequences(next);
+        std::swap(current, next);
+    }
+    for (size_t w = 0; w < words; w++) {
+        if (current[w] & mAcceptStates[w]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <bitset>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The patterns of a wildcard string matcher compiled into a single automaton, so that a string is
+ * matched against all of them in one pass over its characters, without parsing the patterns again.
+ *
+ * Patterns have the fnmatch() syntax without flags: '*', '?', bracket expressions and backslash
+ * escapes. The few patterns whose meaning depends on the locale or on the fnmatch()
+ * implementation, i.e. with character classes, equivalence classes, collating symbols, an
+ * unclosed bracket or a trailing backslash, are still matched with fnmatch().
+ */
+class WildcardPatternSet {
+public:
+    WildcardPatternSet() = default;
+
+    explicit WildcardPatternSet(const std::vector<std::string>& patterns);
+
+    // Returns whether fnmatch() would match str against any of the patterns.
+    bool matchesAny(const std::string& str) const;
+
+private:
+    // States of a pattern, in order. The pattern has matched a prefix of the string up to a
+    // state, and matches the character under kChars to move on to the next state. kAnySequence
+    // also skips to the next state without a character, or stays on any character.
+    enum class StateKind : uint8_t { kChars, kAnySequence, kAccept };
+
+    struct State {
+        StateKind kind = StateKind::kChars;
+        std::bitset<256> chars;
+    };
+
+    // State bitmaps of up to this many words are kept on the stack while matching.
+    static constexpr size_t kMaxStackWords = 8;
+
+    // Appends the states of the pattern. Returns false, leaving states unchanged, if only
+    // fnmatch() can match it.
+    static bool compilePattern(const std::string& pattern, std::vector<State>* states);
+
+    // Adds the states after the set kAnySequence states.
+    void skipAnySequences(uint64_t* states) const;
+
+    // The states of all the compiled patterns, each ending with its kAccept state.
+    std::vector<State> mStates;
+
+    // Bitmaps over mStates.
+    std::vector<uint64_t> mInitialStates;
+    std::vector<uint64_t> mAnySequenceStates;
+    std::vector<uint64_t> mAcceptStates;
+
+    std::vector<std::string> mFallbackPatterns;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -20,6 +20,8 @@
 
 #include <fnmatch.h>
 
+#include <algorithm>
+
 #include "matchers/AtomMatchingTracker.h"
 #include "src/statsd_config.pb.h"
 #include "stats_util.h"
@@ -32,7 +34,7 @@ namespace android {
 namespace os {
 namespace statsd {
 
-bool combinationMatch(const vector<int>& children, const LogicalOperation& operation,
+bool combinationMatch(std::span<const int> children, const LogicalOperation& operation,
                       const vector<MatchingState>& matcherResults) {
     bool matched;
     switch (operation) {
@@ -57,7 +59,7 @@ bool combinationMatch(const vector<int>& children, const LogicalOperation& opera
             break;
         }
         case LogicalOperation::NOT:
-            matched = matcherResults[children[0]] == MatchingState::kNotMatched;
+            matched = matcherResults[children[0]] != MatchingState::kMatched;
             break;
         case LogicalOperation::NAND:
             matched = false;
@@ -84,18 +86,57 @@ bool combinationMatch(const vector<int>& children, const LogicalOperation& opera
     return matched;
 }
 
+namespace {
+
+bool matchesUidString(const AppNamesSnapshot& appNames, const int32_t uid,
+                      const string& str_match) {
+    auto aidIt = UidMap::sAidToUidMapping.find(str_match);
+    if (aidIt != UidMap::sAidToUidMapping.end()) {
+        return ((int)aidIt->second) == uid;
+    }
+    const std::vector<string>& packageNames = appNames.getNames(uid);
+    return std::binary_search(packageNames.begin(), packageNames.end(), str_match);
+}
+
+// Returns whether matchesName accepts the AID name of the uid or one of its package names.
+template <typename NameMatcher>
+bool matchesUidName(const AppNamesSnapshot& appNames, const int32_t uid,
+                    const NameMatcher& matchesName) {
+    // TODO(b/236886985): replace aid/uid mapping with efficient bidirectional container
+    // AidToUidMapping will never have uids above 10000
+    if (uid < 10000) {
+        for (auto aidIt = UidMap::sAidToUidMapping.begin();
+             aidIt != UidMap::sAidToUidMapping.end(); ++aidIt) {
+            if ((int)aidIt->second == uid) {
+                // Assumes there is only one aid mapping for each uid
+                return matchesName(aidIt->first);
+            }
+        }
+    }
+    for (const string& packageName : appNames.getNames(uid)) {
+        if (matchesName(packageName)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool matchesUidWildcardString(const AppNamesSnapshot& appNames, const int32_t uid,
+                              const string& wildcardPattern) {
+    return matchesUidName(appNames, uid, [&wildcardPattern](const string& name) {
+        return fnmatch(wildcardPattern.c_str(), name.c_str(), 0) == 0;
+    });
+}
+
+}  // namespace
+
 bool tryMatchString(const sp<UidMap>& uidMap, const FieldValue& fieldValue,
                     const string& str_match) {
     if (isAttributionUidField(fieldValue) || isUidField(fieldValue)) {
-        int uid = fieldValue.mValue.int_value;
-        auto aidIt = UidMap::sAidToUidMapping.find(str_match);
-        if (aidIt != UidMap::sAidToUidMapping.end()) {
-            return ((int)aidIt->second) == uid;
-        }
-        std::set<string> packageNames = uidMap->getAppNamesFromUid(uid, true /* normalize*/);
-        return packageNames.find(str_match) != packageNames.end();
+        return matchesUidString(*uidMap->getNormalizedAppNamesSnapshot(),
+                                fieldValue.mValue.int_value, str_match);
     } else if (fieldValue.mValue.getType() == STRING) {
-        return fieldValue.mValue.str_value == str_match;
+        return fieldValue.mValue.getString() == str_match;
     }
     return false;
 }
@@ -103,126 +144,137 @@ bool tryMatchString(const sp<UidMap>& uidMap, const FieldValue& fieldValue,
 bool tryMatchWildcardString(const sp<UidMap>& uidMap, const FieldValue& fieldValue,
                             const string& wildcardPattern) {
     if (isAttributionUidField(fieldValue) || isUidField(fieldValue)) {
-        int uid = fieldValue.mValue.int_value;
-        // TODO(b/236886985): replace aid/uid mapping with efficient bidirectional container
-        // AidToUidMapping will never have uids above 10000
-        if (uid < 10000) {
-            for (auto aidIt = UidMap::sAidToUidMapping.begin();
-                 aidIt != UidMap::sAidToUidMapping.end(); ++aidIt) {
-                if ((int)aidIt->second == uid) {
-                    // Assumes there is only one aid mapping for each uid
-                    return fnmatch(wildcardPattern.c_str(), aidIt->first.c_str(), 0) == 0;
-                }
-            }
-        }
-        std::set<string> packageNames = uidMap->getAppNamesFromUid(uid, true /* normalize*/);
-        for (const auto& packageName : packageNames) {
-            if (fnmatch(wildcardPattern.c_str(), packageName.c_str(), 0) == 0) {
-                return true;
-            }
-        }
+        return matchesUidWildcardString(*uidMap->getNormalizedAppNamesSnapshot(),
+                                        fieldValue.mValue.int_value, wildcardPattern);
     } else if (fieldValue.mValue.getType() == STRING) {
-        return fnmatch(wildcardPattern.c_str(), fieldValue.mValue.str_value.c_str(), 0) == 0;
+        return fnmatch(wildcardPattern.c_str(), fieldValue.mValue.getString().c_str(), 0) == 0;
     }
     return false;
 }
 
-bool matchesSimple(const sp<UidMap>& uidMap, const FieldValueMatcher& matcher,
-                   const vector<FieldValue>& values, int start, int end, int depth) {
-    if (depth > 2) {
+namespace {
+
+// Narrows [start, end) to the values of the given field, then to the requested position if any.
+// When ranges is not null, it is filled with the sub trees that tuple matchers need to match.
+// Returns false if no value can match.
+bool narrowToField(const int field, const bool hasPosition, const Position position,
+                   const vector<FieldValue>& values, int* start, int* end, int* depth,
+                   vector<pair<int, int>>* ranges) {
+    if (*depth > 2) {
         ALOGE("Depth > 3 not supported");
         return false;
     }
 
-    if (start >= end) {
+    if (*start >= *end) {
         return false;
     }
 
     // Filter by entry field first
     int newStart = -1;
-    int newEnd = end;
+    int newEnd = *end;
     // because the fields are naturally sorted in the DFS order. we can safely
     // break when pos is larger than the one we are searching for.
-    for (int i = start; i < end; i++) {
-        int pos = values[i].mField.getPosAtDepth(depth);
-        if (pos == matcher.field()) {
+    for (int i = *start; i < *end; i++) {
+        int pos = values[i].mField.getPosAtDepth(*depth);
+        if (pos == field) {
             if (newStart == -1) {
                 newStart = i;
             }
             newEnd = i + 1;
-        } else if (pos > matcher.field()) {
+        } else if (pos > field) {
             break;
         }
     }
 
     // Now we have zoomed in to a new range
-    start = newStart;
-    end = newEnd;
+    *start = newStart;
+    *end = newEnd;
 
-    if (start == -1) {
+    if (*start == -1) {
         // No such field found.
         return false;
     }
 
-    vector<pair<int, int>> ranges; // the ranges are for matching ANY position
-    if (matcher.has_position()) {
-        // Repeated fields position is stored as a node in the path.
-        depth++;
-        if (depth > 2) {
-            return false;
+    if (!hasPosition) {
+        if (ranges != nullptr) {
+            ranges->push_back(std::make_pair(*start, *end));
         }
-        switch (matcher.position()) {
-            case Position::FIRST: {
-                for (int i = start; i < end; i++) {
-                    int pos = values[i].mField.getPosAtDepth(depth);
-                    if (pos != 1) {
-                        // Again, the log elements are stored in sorted order. so
-                        // once the position is > 1, we break;
-                        end = i;
-                        break;
-                    }
+        return true;
+    }
+
+    // Repeated fields position is stored as a node in the path.
+    (*depth)++;
+    if (*depth > 2) {
+        return false;
+    }
+    switch (position) {
+        case Position::FIRST: {
+            for (int i = *start; i < *end; i++) {
+                int pos = values[i].mField.getPosAtDepth(*depth);
+                if (pos != 1) {
+                    // Again, the log elements are stored in sorted order. so
+                    // once the position is > 1, we break;
+                    *end = i;
+                    break;
                 }
-                ranges.push_back(std::make_pair(start, end));
-                break;
             }
-            case Position::LAST: {
-                // move the starting index to the first LAST field at the depth.
-                for (int i = start; i < end; i++) {
-                    if (values[i].mField.isLastPos(depth)) {
-                        start = i;
-                        break;
-                    }
+            if (ranges != nullptr) {
+                ranges->push_back(std::make_pair(*start, *end));
+            }
+            break;
+        }
+        case Position::LAST: {
+            // move the starting index to the first LAST field at the depth.
+            for (int i = *start; i < *end; i++) {
+                if (values[i].mField.isLastPos(*depth)) {
+                    *start = i;
+                    break;
                 }
-                ranges.push_back(std::make_pair(start, end));
+            }
+            if (ranges != nullptr) {
+                ranges->push_back(std::make_pair(*start, *end));
+            }
+            break;
+        }
+        case Position::ANY: {
+            if (ranges == nullptr) {
+                // Value matchers match any of the values in [start, end).
                 break;
             }
-            case Position::ANY: {
-                // ANY means all the children matchers match in any of the sub trees, it's a match
-                newStart = start;
-                newEnd = end;
-                // Here start is guaranteed to be a valid index.
-                int currentPos = values[start].mField.getPosAtDepth(depth);
-                // Now find all sub trees ranges.
-                for (int i = start; i < end; i++) {
-                    int newPos = values[i].mField.getPosAtDepth(depth);
-                    if (newPos != currentPos) {
-                        ranges.push_back(std::make_pair(newStart, i));
-                        newStart = i;
-                        currentPos = newPos;
-                    }
+            // ANY means all the children matchers match in any of the sub trees, it's a match
+            newStart = *start;
+            // Here start is guaranteed to be a valid index.
+            int currentPos = values[*start].mField.getPosAtDepth(*depth);
+            // Now find all sub trees ranges.
+            for (int i = *start; i < *end; i++) {
+                int newPos = values[i].mField.getPosAtDepth(*depth);
+                if (newPos != currentPos) {
+                    ranges->push_back(std::make_pair(newStart, i));
+                    newStart = i;
+                    currentPos = newPos;
                 }
-                ranges.push_back(std::make_pair(newStart, end));
-                break;
             }
-            case Position::ALL:
-                ALOGE("Not supported: field matcher with ALL position.");
-                break;
-            case Position::POSITION_UNKNOWN:
-                break;
+            ranges->push_back(std::make_pair(newStart, *end));
+            break;
         }
-    } else {
-        // No position
-        ranges.push_back(std::make_pair(start, end));
+        case Position::ALL:
+            ALOGE("Not supported: field matcher with ALL position.");
+            break;
+        case Position::POSITION_UNKNOWN:
+            break;
+    }
+    return true;
+}
+
+}  // namespace
+
+bool matchesSimple(const sp<UidMap>& uidMap, const FieldValueMatcher& matcher,
+                   const vector<FieldValue>& values, int start, int end, int depth) {
+    vector<pair<int, int>> ranges;  // the ranges are for matching ANY position
+    const bool isTuple = matcher.value_matcher_case() == FieldValueMatcher::kMatchesTuple;
+    if (!narrowToField(matcher.field(), matcher.has_position(), matcher.position(), values,
+                       &start, &end, &depth, isTuple ? &ranges : nullptr)) {
+        return false;
     }
     // start and end are still pointing to the matched range.
     switch (matcher.value_matcher_case()) {
@@ -466,7 +518,370 @@ bool matchesSimple(const sp<UidMap>& uidMap, const SimpleAtomMatcher& simpleMatc
     }
 
     for (const auto& matcher : simpleMatcher.field_value_matcher()) {
-        if (!matchesSimple(uidMap, matcher, event.getValues(), 0, event.getValues().size(), 0)) {
+        // Only the values of the top-level field of the matcher are scanned.
+        const auto [start, end] = event.getTopLevelFieldRange(matcher.field());
+        if (!matchesSimple(uidMap, matcher, event.getValues(), start, end, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+CompiledFieldValueMatcher compileFieldValueMatcher(const FieldValueMatcher& matcher) {
+    CompiledFieldValueMatcher compiled;
+    compiled.field = matcher.field();
+    compiled.hasPosition = matcher.has_position();
+    compiled.position = matcher.position();
+    compiled.valueMatcherCase = matcher.value_matcher_case();
+    switch (compiled.valueMatcherCase) {
+        case FieldValueMatcher::kMatchesTuple:
+            for (const auto& subMatcher : matcher.matches_tuple().field_value_matcher()) {
+                compiled.tupleMatchers.push_back(compileFieldValueMatcher(subMatcher));
+            }
+            break;
+        case FieldValueMatcher::kEqBool:
+            compiled.intValue = matcher.eq_bool() ? 1 : 0;
+            break;
+        case FieldValueMatcher::kEqString:
+            compiled.strList.push_back(matcher.eq_string());
+            break;
+        case FieldValueMatcher::kEqAnyString:
+            compiled.strList.assign(matcher.eq_any_string().str_value().begin(),
+                                    matcher.eq_any_string().str_value().end());
+            break;
+        case FieldValueMatcher::kNeqAnyString:
+            compiled.strList.assign(matcher.neq_any_string().str_value().begin(),
+                                    matcher.neq_any_string().str_value().end());
+            break;
+        case FieldValueMatcher::kEqWildcardString:
+            compiled.strList.push_back(matcher.eq_wildcard_string());
+            compiled.wildcardPatterns = WildcardPatternSet(compiled.strList);
+            break;
+        case FieldValueMatcher::kEqAnyWildcardString:
+            compiled.strList.assign(matcher.eq_any_wildcard_string().str_value().begin(),
+                                    matcher.eq_any_wildcard_string().str_value().end());
+            compiled.wildcardPatterns = WildcardPatternSet(compiled.strList);
+            break;
+        case FieldValueMatcher::kNeqAnyWildcardString:
+            compiled.strList.assign(matcher.neq_any_wildcard_string().str_value().begin(),
+                                    matcher.neq_any_wildcard_string().str_value().end());
+            compiled.wildcardPatterns = WildcardPatternSet(compiled.strList);
+            break;
+        case FieldValueMatcher::kEqInt:
+            compiled.intValue = matcher.eq_int();
+            break;
+        case FieldValueMatcher::kEqAnyInt:
+        case FieldValueMatcher::kNeqAnyInt: {
+            const IntListMatcher& intList = compiled.valueMatcherCase == FieldValueMatcher::kEqAnyInt
+                                                    ? matcher.eq_any_int()
+                                                    : matcher.neq_any_int();
+            // The proto path compares the list elements as int, keep the same semantics.
+            for (const int intValue : intList.int_value()) {
+                compiled.intList.push_back(intValue);
+            }
+            std::sort(compiled.intList.begin(), compiled.intList.end());
+            compiled.intList.erase(std::unique(compiled.intList.begin(), compiled.intList.end()),
+                                   compiled.intList.end());
+            break;
+        }
+        case FieldValueMatcher::kLtInt:
+            compiled.intValue = matcher.lt_int();
+            break;
+        case FieldValueMatcher::kGtInt:
+            compiled.intValue = matcher.gt_int();
+            break;
+        case FieldValueMatcher::kLteInt:
+            compiled.intValue = matcher.lte_int();
+            break;
+        case FieldValueMatcher::kGteInt:
+            compiled.intValue = matcher.gte_int();
+            break;
+        case FieldValueMatcher::kLtFloat:
+            compiled.floatValue = matcher.lt_float();
+            break;
+        case FieldValueMatcher::kGtFloat:
+            compiled.floatValue = matcher.gt_float();
+            break;
+        default:
+            break;
+    }
+    return compiled;
+}
+
+bool isWildcardStringMatcher(const FieldValueMatcher::ValueMatcherCase valueMatcherCase) {
+    return valueMatcherCase == FieldValueMatcher::kEqWildcardString ||
+           valueMatcherCase == FieldValueMatcher::kEqAnyWildcardString ||
+           valueMatcherCase == FieldValueMatcher::kNeqAnyWildcardString;
+}
+
+bool isStringMatcher(const FieldValueMatcher::ValueMatcherCase valueMatcherCase) {
+    return valueMatcherCase == FieldValueMatcher::kEqString ||
+           valueMatcherCase == FieldValueMatcher::kEqAnyString ||
+           valueMatcherCase == FieldValueMatcher::kNeqAnyString ||
+           isWildcardStringMatcher(valueMatcherCase);
+}
+
+bool hasStringMatchers(const CompiledFieldValueMatcher& matcher) {
+    if (isStringMatcher(matcher.valueMatcherCase)) {
+        return true;
+    }
+    for (const auto& subMatcher : matcher.tupleMatchers) {
+        if (hasStringMatchers(subMatcher)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void buildMatchingUids(const AppNamesSnapshot& appNames, CompiledFieldValueMatcher* matcher) {
+    for (auto& subMatcher : matcher->tupleMatchers) {
+        buildMatchingUids(appNames, &subMatcher);
+    }
+    if (!isStringMatcher(matcher->valueMatcherCase)) {
+        return;
+    }
+    const bool wildcard = isWildcardStringMatcher(matcher->valueMatcherCase);
+    auto addIfMatched = [&](const int32_t uid) {
+        if (wildcard) {
+            if (matchesUidName(appNames, uid, [matcher](const string& name) {
+                    return matcher->wildcardPatterns.matchesAny(name);
+                })) {
+                matcher->matchingUids.insert(uid);
+            }
+            return;
+        }
+        for (const string& str : matcher->strList) {
+            if (matchesUidString(appNames, uid, str)) {
+                matcher->matchingUids.insert(uid);
+                return;
+            }
+        }
+    };
+    // A uid that has neither an AID nor installed packages matches no string.
+    matcher->matchingUids.clear();
+    for (const auto& [uid, names] : appNames.getNamesByUid()) {
+        addIfMatched(uid);
+    }
+    for (const auto& [aid, uid] : UidMap::sAidToUidMapping) {
+        addIfMatched(uid);
+    }
+    matcher->hasMatchingUids = true;
+}
+
+// Returns whether the value matches any of the string matcher's operands.
+bool matchesAnyString(const sp<UidMap>& uidMap, const CompiledFieldValueMatcher& matcher,
+                      const FieldValue& value) {
+    if (matcher.hasMatchingUids && (isAttributionUidField(value) || isUidField(value))) {
+        return matcher.matchingUids.find(value.mValue.int_value) != matcher.matchingUids.end();
+    }
+    if (isWildcardStringMatcher(matcher.valueMatcherCase)) {
+        if (isAttributionUidField(value) || isUidField(value)) {
+            return matchesUidName(*uidMap->getNormalizedAppNamesSnapshot(),
+                                  value.mValue.int_value, [&matcher](const string& name) {
+                                      return matcher.wildcardPatterns.matchesAny(name);
+                                  });
+        }
+        return value.mValue.getType() == STRING &&
+               matcher.wildcardPatterns.matchesAny(value.mValue.getString());
+    }
+    for (const string& str : matcher.strList) {
+        if (tryMatchString(uidMap, value, str)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads INT and LONG values as int64_t. Returns false for other types.
+inline bool getIntegerValue(const Value& value, int64_t* output) {
+    if (value.getType() == INT) {
+        *output = value.int_value;
+        return true;
+    }
+    if (value.getType() == LONG) {
+        *output = value.long_value;
+        return true;
+    }
+    return false;
+}
+
+bool matchesSimple(const sp<UidMap>& uidMap, const CompiledFieldValueMatcher& matcher,
+                   const vector<FieldValue>& values, int start, int end, int depth) {
+    const bool isTuple = matcher.valueMatcherCase == FieldValueMatcher::kMatchesTuple;
+    if (!isTuple) {
+        if (!narrowToField(matcher.field, matcher.hasPosition, matcher.position, values, &start,
+                           &end, &depth, nullptr)) {
+            return false;
+        }
+    } else {
+        vector<pair<int, int>> ranges;
+        if (!narrowToField(matcher.field, matcher.hasPosition, matcher.position, values, &start,
+                           &end, &depth, &ranges)) {
+            return false;
+        }
+        ++depth;
+        // If any range matches all matchers, good.
+        for (const auto& range : ranges) {
+            bool matched = true;
+            for (const auto& subMatcher : matcher.tupleMatchers) {
+                if (!matchesSimple(uidMap, subMatcher, values, range.first, range.second,
+                                   depth)) {
+                    matched = false;
+                    break;
+                }
+            }
+            if (matched) return true;
+        }
+        return false;
+    }
+
+    // If the field matcher ends with ANY, then we have [start, end) range > 1.
+    // In the following, we should return true, when ANY of the values matches.
+    int64_t intValue;
+    switch (matcher.valueMatcherCase) {
+        case FieldValueMatcher::kEqBool:
+            for (int i = start; i < end; i++) {
+                if (getIntegerValue(values[i].mValue, &intValue) &&
+                    (intValue != 0) == (matcher.intValue != 0)) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kEqString:
+        case FieldValueMatcher::kEqAnyString:
+        case FieldValueMatcher::kEqWildcardString:
+        case FieldValueMatcher::kEqAnyWildcardString:
+            for (int i = start; i < end; i++) {
+                if (matchesAnyString(uidMap, matcher, values[i])) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kNeqAnyString:
+        case FieldValueMatcher::kNeqAnyWildcardString:
+            for (int i = start; i < end; i++) {
+                if (!matchesAnyString(uidMap, matcher, values[i])) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kEqInt:
+            for (int i = start; i < end; i++) {
+                if (getIntegerValue(values[i].mValue, &intValue) && intValue == matcher.intValue) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kEqAnyInt:
+            for (int i = start; i < end; i++) {
+                if (getIntegerValue(values[i].mValue, &intValue) &&
+                    std::binary_search(matcher.intList.begin(), matcher.intList.end(), intValue)) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kNeqAnyInt:
+            for (int i = start; i < end; i++) {
+                // Values that are not integers are not equal to any of the list.
+                if (!getIntegerValue(values[i].mValue, &intValue) ||
+                    !std::binary_search(matcher.intList.begin(), matcher.intList.end(),
+                                        intValue)) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kLtInt:
+            for (int i = start; i < end; i++) {
+                if (getIntegerValue(values[i].mValue, &intValue) && intValue < matcher.intValue) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kGtInt:
+            for (int i = start; i < end; i++) {
+                if (getIntegerValue(values[i].mValue, &intValue) && intValue > matcher.intValue) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kLteInt:
+            for (int i = start; i < end; i++) {
+                if (getIntegerValue(values[i].mValue, &intValue) &&
+                    intValue <= matcher.intValue) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kGteInt:
+            for (int i = start; i < end; i++) {
+                if (getIntegerValue(values[i].mValue, &intValue) &&
+                    intValue >= matcher.intValue) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kLtFloat:
+            for (int i = start; i < end; i++) {
+                if (values[i].mValue.getType() == FLOAT &&
+                    (values[i].mValue.float_value < matcher.floatValue)) {
+                    return true;
+                }
+            }
+            return false;
+        case FieldValueMatcher::kGtFloat:
+            for (int i = start; i < end; i++) {
+                if (values[i].mValue.getType() == FLOAT &&
+                    (values[i].mValue.float_value > matcher.floatValue)) {
+                    return true;
+                }
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
+CompiledSimpleAtomMatcher compileSimpleAtomMatcher(const SimpleAtomMatcher& simpleMatcher) {
+    CompiledSimpleAtomMatcher compiled;
+    compiled.atomId = simpleMatcher.atom_id();
+    compiled.fieldValueMatchers.reserve(simpleMatcher.field_value_matcher_size());
+    for (const auto& matcher : simpleMatcher.field_value_matcher()) {
+        compiled.fieldValueMatchers.push_back(compileFieldValueMatcher(matcher));
+        compiled.hasStringMatchers |= hasStringMatchers(compiled.fieldValueMatchers.back());
+    }
+    return compiled;
+}
+
+void updateMatchingUids(const UidMap& uidMap, CompiledSimpleAtomMatcher* simpleMatcher) {
+    if (!simpleMatcher->hasStringMatchers) {
+        return;
+    }
+    // Read the version first, so that the snapshot is at least as recent as the version.
+    const int64_t version = uidMap.getAppNamesVersion();
+    if (version == simpleMatcher->matchingUidsVersion) {
+        return;
+    }
+    const auto appNames = uidMap.getNormalizedAppNamesSnapshot();
+    for (auto& matcher : simpleMatcher->fieldValueMatchers) {
+        buildMatchingUids(*appNames, &matcher);
+    }
+    simpleMatcher->matchingUidsVersion = version;
+}
+
+bool matchesSimple(const sp<UidMap>& uidMap, const CompiledSimpleAtomMatcher& simpleMatcher,
+                   const LogEvent& event) {
+    if (event.GetTagId() != simpleMatcher.atomId) {
+        return false;
+    }
+
+    for (const auto& matcher : simpleMatcher.fieldValueMatchers) {
+        // Only the values of the top-level field of the matcher are scanned.
+        const auto [start, end] = event.getTopLevelFieldRange(matcher.field);
+        if (!matchesSimple(uidMap, matcher, event.getValues(), start, end, 0)) {
             return false;
         }
     }
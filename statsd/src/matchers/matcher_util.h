@@ -18,8 +18,12 @@
 
 #include "logd/LogEvent.h"
 
+#include <span>
+#include <string>
+#include <unordered_set>
 #include <vector>
 #include "src/statsd_config.pb.h"
+#include "matchers/WildcardPatternSet.h"
 #include "packages/UidMap.h"
 #include "stats_util.h"
 
@@ -33,12 +37,69 @@ enum MatchingState {
     kMatched = 1,
 };
 
-bool combinationMatch(const std::vector<int>& children, const LogicalOperation& operation,
+// Children that are not computed count as not matched, so that a single bottom-up pass over the
+// matchers interested in an atom does not have to compute the others.
+bool combinationMatch(std::span<const int> children, const LogicalOperation& operation,
                       const std::vector<MatchingState>& matcherResults);
 
 bool matchesSimple(const sp<UidMap>& uidMap, const SimpleAtomMatcher& simpleMatcher,
                    const LogEvent& wrapper);
 
+// A FieldValueMatcher translated out of its proto form. Matching events against it does not go
+// through the proto accessors, and int lists are sorted so that they can be binary searched.
+struct CompiledFieldValueMatcher {
+    int32_t field = 0;
+    bool hasPosition = false;
+    Position position = Position::POSITION_UNKNOWN;
+    FieldValueMatcher::ValueMatcherCase valueMatcherCase =
+            FieldValueMatcher::VALUE_MATCHER_NOT_SET;
+
+    // Operand of eq_bool, eq_int, lt_int, gt_int, lte_int and gte_int.
+    int64_t intValue = 0;
+
+    // Operand of lt_float and gt_float.
+    float floatValue = 0;
+
+    // Operands of eq_any_int and neq_any_int, sorted and deduplicated.
+    std::vector<int64_t> intList;
+
+    // Operands of the string matchers. Single string matchers hold one element.
+    std::vector<std::string> strList;
+
+    // strList compiled, for the wildcard string matchers.
+    WildcardPatternSet wildcardPatterns;
+
+    // For string matchers, the uids whose AID name or package names match any of strList. Uid
+    // fields are looked up here instead of in the UidMap once hasMatchingUids is set.
+    bool hasMatchingUids = false;
+    std::unordered_set<int32_t> matchingUids;
+
+    // Sub matchers of matches_tuple.
+    std::vector<CompiledFieldValueMatcher> tupleMatchers;
+};
+
+// A SimpleAtomMatcher translated out of its proto form, see CompiledFieldValueMatcher.
+struct CompiledSimpleAtomMatcher {
+    int32_t atomId = 0;
+    std::vector<CompiledFieldValueMatcher> fieldValueMatchers;
+
+    // Whether any field value matcher, including tuple sub matchers, matches strings.
+    bool hasStringMatchers = false;
+
+    // UidMap::getAppNamesVersion() when the matchingUids sets were built.
+    int64_t matchingUidsVersion = -1;
+};
+
+CompiledSimpleAtomMatcher compileSimpleAtomMatcher(const SimpleAtomMatcher& simpleMatcher);
+
+// Builds the matchingUids sets of the string matchers, or rebuilds them if the package names in
+// the uid map changed since. Call before matching events on the thread that matches them.
+void updateMatchingUids(const UidMap& uidMap, CompiledSimpleAtomMatcher* simpleMatcher);
+
+// Same as matchesSimple with the SimpleAtomMatcher the compiled matcher was created from.
+bool matchesSimple(const sp<UidMap>& uidMap, const CompiledSimpleAtomMatcher& simpleMatcher,
+                   const LogEvent& event);
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics/AggregatedGaugeAtoms.h"
+
+#include <string_view>
+#include <unordered_map>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string_view;
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+// Hashes and compares the fields of atoms by index, so that deduplicating the atoms of a bucket
+// does not copy them.
+struct GaugeAtomFieldsHash {
+    const vector<GaugeAtom>* atoms;
+    size_t operator()(const size_t i) const {
+        return hashFieldValues(*(*atoms)[i].mFields);
+    }
+};
+
+struct GaugeAtomFieldsEqual {
+    const vector<GaugeAtom>* atoms;
+    bool operator()(const size_t i, const size_t j) const {
+        return *(*atoms)[i].mFields == *(*atoms)[j].mFields;
+    }
+};
+
+}  // namespace
+
+void AggregatedGaugeAtoms::build(const vector<GaugeAtom>& atoms) {
+    clear();
+    if (atoms.empty()) {
+        return;
+    }
+
+    // Index of the distinct atom of each atom.
+    vector<uint32_t> distinctIndices(atoms.size());
+    // Index in atoms of the first occurrence of each distinct atom.
+    vector<size_t> firstOccurrences;
+    unordered_map<size_t, uint32_t, GaugeAtomFieldsHash, GaugeAtomFieldsEqual> distinctAtoms(
+            atoms.size(), GaugeAtomFieldsHash{&atoms}, GaugeAtomFieldsEqual{&atoms});
+    for (size_t i = 0; i < atoms.size(); i++) {
+        // Atoms that share the fields of the previous atom need no lookup.
+        if (i > 0 && atoms[i].mFields == atoms[i - 1].mFields) {
+            distinctIndices[i] = distinctIndices[i - 1];
+            continue;
+        }
+        const auto [it, inserted] =
+                distinctAtoms.emplace(i, static_cast<uint32_t>(firstOccurrences.size()));
+        if (inserted) {
+            firstOccurrences.push_back(i);
+        }
+        distinctIndices[i] = it->second;
+    }
+
+    // Fields column. The string views point into the payloads held by the column, which do not
+    // move when the column grows.
+    unordered_map<string_view, size_t> stringIndices;
+    size_t fieldCount = 0;
+    for (const size_t i : firstOccurrences) {
+        fieldCount += atoms[i].mFields->size();
+    }
+    mFieldValues.reserve(fieldCount);
+    mFieldOffsets.reserve(firstOccurrences.size() + 1);
+    for (const size_t i : firstOccurrences) {
+        mFieldOffsets.push_back(static_cast<uint32_t>(mFieldValues.size()));
+        for (const FieldValue& fieldValue : *atoms[i].mFields) {
+            mFieldValues.push_back(fieldValue);
+            if (fieldValue.mValue.getType() != STRING) {
+                continue;
+            }
+            const auto [it, inserted] = stringIndices.emplace(
+                    string_view(mFieldValues.back().mValue.getString()), mFieldValues.size() - 1);
+            if (!inserted) {
+                mFieldValues.back().mValue = mFieldValues[it->second].mValue;
+            }
+        }
+    }
+    mFieldOffsets.push_back(static_cast<uint32_t>(mFieldValues.size()));
+
+    // Timestamps column, grouped by distinct atom in the order they were recorded.
+    mTimestampOffsets.assign(firstOccurrences.size() + 1, 0);
+    for (const uint32_t distinctIndex : distinctIndices) {
+        mTimestampOffsets[distinctIndex + 1]++;
+    }
+    for (size_t i = 1; i < mTimestampOffsets.size(); i++) {
+        mTimestampOffsets[i] += mTimestampOffsets[i - 1];
+    }
+    mElapsedTimestampsNs.resize(atoms.size());
+    vector<uint32_t> nextTimestamp(mTimestampOffsets.begin(), mTimestampOffsets.end() - 1);
+    for (size_t i = 0; i < atoms.size(); i++) {
+        mElapsedTimestampsNs[nextTimestamp[distinctIndices[i]]++] = atoms[i].mElapsedTimestampNs;
+    }
+}
+
+void AggregatedGaugeAtoms::clear() {
+    mFieldValues.clear();
+    mFieldOffsets.clear();
+    mElapsedTimestampsNs.clear();
+    mTimestampOffsets.clear();
+}
+
+size_t AggregatedGaugeAtoms::byteSize() const {
+    return sizeof(FieldValue) * mFieldValues.size() +
+           sizeof(int64_t) * mElapsedTimestampsNs.size();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
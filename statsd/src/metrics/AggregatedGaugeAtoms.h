@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "FieldValue.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+struct GaugeAtom {
+    GaugeAtom(std::shared_ptr<std::vector<FieldValue>> fields, int64_t elapsedTimeNs)
+        : mFields(fields), mElapsedTimestampNs(elapsedTimeNs) {
+    }
+    std::shared_ptr<std::vector<FieldValue>> mFields;
+    int64_t mElapsedTimestampNs;
+};
+
+// The distinct atoms of a gauge bucket, each with the timestamps at which it was recorded.
+//
+// The fields of all atoms are laid end to end in one column and the timestamps in another, so a
+// bucket holds four vectors however many atoms it has. Equal strings in the bucket share one
+// payload.
+class AggregatedGaugeAtoms {
+public:
+    // Replaces the contents with the distinct atoms of atoms, in order of first occurrence.
+    void build(const std::vector<GaugeAtom>& atoms);
+
+    void clear();
+
+    // Number of distinct atoms.
+    inline size_t size() const {
+        return mFieldOffsets.empty() ? 0 : mFieldOffsets.size() - 1;
+    }
+
+    inline bool empty() const {
+        return size() == 0;
+    }
+
+    // The getFieldCount(i) fields of the i-th distinct atom.
+    inline const FieldValue* getFields(size_t i) const {
+        return mFieldValues.data() + mFieldOffsets[i];
+    }
+
+    inline size_t getFieldCount(size_t i) const {
+        return mFieldOffsets[i + 1] - mFieldOffsets[i];
+    }
+
+    // The getTimestampCount(i) timestamps of the i-th distinct atom, in the order it was recorded.
+    inline const int64_t* getElapsedTimestampsNs(size_t i) const {
+        return mElapsedTimestampsNs.data() + mTimestampOffsets[i];
+    }
+
+    inline size_t getTimestampCount(size_t i) const {
+        return mTimestampOffsets[i + 1] - mTimestampOffsets[i];
+    }
+
+    // Size of the fields and timestamps held.
+    size_t byteSize() const;
+
+private:
+    std::vector<FieldValue> mFieldValues;
+
+    // The fields of the i-th atom are [mFieldOffsets[i], mFieldOffsets[i + 1]) in mFieldValues.
+    std::vector<uint32_t> mFieldOffsets;
+
+    std::vector<int64_t> mElapsedTimestampsNs;
+
+    // The timestamps of the i-th atom are [mTimestampOffsets[i], mTimestampOffsets[i + 1]) in
+    // mElapsedTimestampsNs.
+    std::vector<uint32_t> mTimestampOffsets;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
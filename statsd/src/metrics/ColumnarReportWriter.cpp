@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "ColumnarReportWriter.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "stats_log_util.h"
+#include "varint.h"
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::pair;
+using std::vector;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// for ColumnarMetricData
+const uint32_t FIELD_ID_DIMENSION = 1;
+const uint32_t FIELD_ID_DIMENSION_ROW_COUNT = 2;
+const uint32_t FIELD_ID_BUCKET_START_DELTA_MILLIS = 3;
+const uint32_t FIELD_ID_BUCKET_LENGTH_MILLIS = 4;
+const uint32_t FIELD_ID_BUCKET_INDEX = 5;
+const uint32_t FIELD_ID_VALUE = 6;
+const uint32_t FIELD_ID_CONDITION_TRUE_NANOS = 7;
+
+namespace {
+
+uint64_t zigZagEncode(const int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+// Packed fields are written as varints, with negative int32 and int64 values sign extended to
+// 64 bits like libprotobuf does.
+void writePackedField(const uint32_t fieldId, const vector<uint64_t>& varints,
+                      ProtoOutputStream* const protoOutput) {
+    if (varints.empty()) {
+        return;
+    }
+    size_t size = 0;
+    for (const uint64_t varint : varints) {
+        size += Varint::Length64(varint);
+    }
+    protoOutput->writeLengthDelimitedHeader(fieldId, size);
+    for (const uint64_t varint : varints) {
+        protoOutput->writeRawVarint(varint);
+    }
+}
+
+}  // namespace
+
+ColumnarReportWriter::ColumnarReportWriter(const int64_t timeBaseNs,
+                                           const bool writeConditionTrueNs)
+    : mTimeBaseMillis(NanoToMillis(timeBaseNs)), mWriteConditionTrueNs(writeConditionTrueNs) {
+}
+
+void ColumnarReportWriter::addDimension(const DimensionWriter& writeDimension,
+                                        ProtoOutputStream* protoOutput) {
+    const uint64_t dimensionToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
+                                                       FIELD_ID_DIMENSION);
+    writeDimension(protoOutput);
+    protoOutput->end(dimensionToken);
+    mDimensionRowCounts.push_back(0);
+}
+
+void ColumnarReportWriter::addRow(const int64_t bucketStartNs, const int64_t bucketEndNs,
+                                  const int64_t value, const int64_t conditionTrueNs) {
+    mRows.push_back(
+            {NanoToMillis(bucketStartNs), NanoToMillis(bucketEndNs), value, conditionTrueNs});
+    mDimensionRowCounts.back()++;
+}
+
+void ColumnarReportWriter::writeColumns(ProtoOutputStream* protoOutput) const {
+    vector<pair<int64_t, int64_t>> buckets;
+    buckets.reserve(mRows.size());
+    for (const Row& row : mRows) {
+        buckets.emplace_back(row.bucketStartMillis, row.bucketEndMillis);
+    }
+    std::sort(buckets.begin(), buckets.end());
+    buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+
+    vector<uint64_t> varints;
+    varints.reserve(std::max(buckets.size(), mRows.size()));
+    for (const int32_t rowCount : mDimensionRowCounts) {
+        varints.push_back(rowCount);
+    }
+    writePackedField(FIELD_ID_DIMENSION_ROW_COUNT, varints, protoOutput);
+
+    varints.clear();
+    int64_t previousEndMillis = mTimeBaseMillis;
+    for (const auto& [startMillis, endMillis] : buckets) {
+        varints.push_back(zigZagEncode(startMillis - previousEndMillis));
+        previousEndMillis = endMillis;
+    }
+    writePackedField(FIELD_ID_BUCKET_START_DELTA_MILLIS, varints, protoOutput);
+
+    varints.clear();
+    for (const auto& [startMillis, endMillis] : buckets) {
+        varints.push_back(endMillis - startMillis);
+    }
+    writePackedField(FIELD_ID_BUCKET_LENGTH_MILLIS, varints, protoOutput);
+
+    varints.clear();
+    for (const Row& row : mRows) {
+        const auto it = std::lower_bound(buckets.begin(), buckets.end(),
+                                         pair(row.bucketStartMillis, row.bucketEndMillis));
+        varints.push_back(it - buckets.begin());
+    }
+    writePackedField(FIELD_ID_BUCKET_INDEX, varints, protoOutput);
+
+    varints.clear();
+    for (const Row& row : mRows) {
+        varints.push_back(row.value);
+    }
+    writePackedField(FIELD_ID_VALUE, varints, protoOutput);
+
+    if (mWriteConditionTrueNs) {
+        varints.clear();
+        for (const Row& row : mRows) {
+            varints.push_back(row.conditionTrueNs);
+        }
+        writePackedField(FIELD_ID_CONDITION_TRUE_NANOS, varints, protoOutput);
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+
+#include <functional>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Writes the fields of a ColumnarMetricData message.
+ *
+ * The dimension keys are written to the dictionary as they are added. The rows of each key are
+ * kept until writeColumns(), which writes the table of the distinct buckets of all the rows and
+ * the packed columns of the rows.
+ */
+class ColumnarReportWriter {
+public:
+    // Writes the fields of a ColumnarMetricData.Dimension.
+    using DimensionWriter = std::function<void(util::ProtoOutputStream*)>;
+
+    // Bucket starts are encoded relative to timeBaseNs. The rows only have a condition true
+    // time if writeConditionTrueNs.
+    ColumnarReportWriter(int64_t timeBaseNs, bool writeConditionTrueNs);
+
+    // Writes the dictionary entry of the next dimension key, whose rows are added next.
+    void addDimension(const DimensionWriter& writeDimension, util::ProtoOutputStream* protoOutput);
+
+    // Adds a row of the last dimension key added.
+    void addRow(int64_t bucketStartNs, int64_t bucketEndNs, int64_t value,
+                int64_t conditionTrueNs);
+
+    // Writes the bucket table and the columns of the rows added.
+    void writeColumns(util::ProtoOutputStream* protoOutput) const;
+
+private:
+    struct Row {
+        int64_t bucketStartMillis;
+        int64_t bucketEndMillis;
+        int64_t value;
+        int64_t conditionTrueNs;
+    };
+
+    const int64_t mTimeBaseMillis;
+
+    const bool mWriteConditionTrueNs;
+
+    std::vector<int32_t> mDimensionRowCounts;
+
+    std::vector<Row> mRows;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <memory_resource>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Held by the MetricProducers of one MetricsManager. The long lived state of the metrics of a
+// config is allocated from size class pools of its own, instead of being spread over the heap
+// with the allocations of the other configs, and the pools are released together once the last
+// producer of the config is destroyed.
+//
+// Thread safe: the metrics of a config are flushed by the event thread and by pulls.
+class ConfigArena : public virtual RefBase {
+public:
+    // Larger blocks are allocated from the heap directly.
+    static constexpr size_t kLargestPoolBlock = 4096;
+
+    ConfigArena() : mPools(std::pmr::pool_options{0, kLargestPoolBlock}) {
+    }
+
+    std::pmr::memory_resource* resource() {
+        return &mPools;
+    }
+
+private:
+    std::pmr::synchronized_pool_resource mPools;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 
 #include "guardrail/StatsdStats.h"
+#include "metadata_util.h"
+#include "metrics/ColumnarReportWriter.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
 #include "stats_util.h"
@@ -37,6 +39,7 @@ using android::util::FIELD_TYPE_MESSAGE;
 using android::util::FIELD_TYPE_STRING;
 using android::util::ProtoOutputStream;
 using std::map;
+using std::pair;
 using std::string;
 using std::unordered_map;
 using std::vector;
@@ -54,6 +57,7 @@ const int FIELD_ID_BUCKET_SIZE = 10;
 const int FIELD_ID_DIMENSION_PATH_IN_WHAT = 11;
 const int FIELD_ID_IS_ACTIVE = 14;
 const int FIELD_ID_DIMENSION_GUARDRAIL_HIT = 17;
+const int FIELD_ID_COLUMNAR_METRICS = 18;
 
 // for CountMetricDataWrapper
 const int FIELD_ID_DATA = 1;
@@ -62,6 +66,8 @@ const int FIELD_ID_DIMENSION_IN_WHAT = 1;
 const int FIELD_ID_SLICE_BY_STATE = 6;
 const int FIELD_ID_BUCKET_INFO = 3;
 const int FIELD_ID_DIMENSION_LEAF_IN_WHAT = 4;
+const int FIELD_ID_DIMENSION_INDEX_IN_WHAT = 8;
+const int FIELD_ID_IS_HEAVY_HITTER_OVERFLOW = 7;
 // for CountBucketInfo
 const int FIELD_ID_COUNT = 3;
 const int FIELD_ID_BUCKET_NUM = 4;
@@ -80,6 +86,7 @@ CountMetricProducer::CountMetricProducer(
     : MetricProducer(metric.id(), key, timeBaseNs, conditionIndex, initialConditionCache, wizard,
                      protoHash, eventActivationMap, eventDeactivationMap, slicedStateAtoms,
                      stateGroupMap, getAppUpgradeBucketSplit(metric)),
+      mHeavyHitters(std::max(metric.heavy_hitter_capacity(), 0)),
       mDimensionGuardrailHit(false),
       mDimensionHardLimit(
               StatsdStats::clampDimensionKeySizeLimit(metric.max_dimensions_per_bucket())) {
@@ -214,6 +221,8 @@ void CountMetricProducer::onSlicedConditionMayChangeLocked(bool overallCondition
 
 void CountMetricProducer::clearPastBucketsLocked(const int64_t dumpTimeNs) {
     mPastBuckets.clear();
+    mPastOverflowBuckets.clear();
+    mPastBucketsProtoCache.clear();
 }
 
 void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
@@ -221,7 +230,8 @@ void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                                              const bool erase_data, const DumpLatency dumpLatency,
                                              std::set<string>* str_set,
                                              ProtoOutputStream* protoOutput) {
-    if (include_current_partial_bucket) {
+    const bool snapshotCurrentBucket = include_current_partial_bucket && dumpLatency == SNAPSHOT;
+    if (include_current_partial_bucket && !snapshotCurrentBucket) {
         flushLocked(dumpTimeNs);
     } else {
         flushIfNeededLocked(dumpTimeNs);
@@ -230,7 +240,11 @@ void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
     protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_ID, (long long)mMetricId);
     protoOutput->write(FIELD_TYPE_BOOL | FIELD_ID_IS_ACTIVE, isActiveLocked());
 
-    if (mPastBuckets.empty()) {
+    vector<pair<MetricDimensionKey, CountBucket>> currentBucketSnapshot;
+    if (snapshotCurrentBucket) {
+        currentBucketSnapshot = snapshotCurrentBucketLocked(dumpTimeNs);
+    }
+    if (mPastBuckets.empty() && mPastOverflowBuckets.empty() && currentBucketSnapshot.empty()) {
         return;
     }
 
@@ -252,60 +266,119 @@ void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
         }
     }
 
-    uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_COUNT_METRICS);
-
-    for (const auto& counter : mPastBuckets) {
-        const MetricDimensionKey& dimensionKey = counter.first;
-        VLOG("  dimension key %s", dimensionKey.toString().c_str());
-
-        uint64_t wrapperToken =
-                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
-
+    const auto writeDimensionKey = [&](const MetricDimensionKey& dimensionKey,
+                                       std::set<string>* strSet, ProtoOutputStream* output) {
         // First fill dimension.
         if (mShouldUseNestedDimensions) {
-            uint64_t dimensionToken = protoOutput->start(
-                    FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
-            writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), str_set, protoOutput);
-            protoOutput->end(dimensionToken);
+            uint64_t dimensionToken =
+                    output->start(FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
+            writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), strSet, output);
+            output->end(dimensionToken);
+        } else if (mDimensionDictionary != nullptr) {
+            mDimensionDictionary->writeIndex(FIELD_ID_DIMENSION_INDEX_IN_WHAT,
+                                             dimensionKey.getDimensionKeyInWhat(), output);
         } else {
             writeDimensionLeafNodesToProto(dimensionKey.getDimensionKeyInWhat(),
-                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set, protoOutput);
+                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, strSet, output);
         }
         // Then fill slice_by_state.
         for (auto state : dimensionKey.getStateValuesKey().getValues()) {
-            uint64_t stateToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
-                                                     FIELD_ID_SLICE_BY_STATE);
-            writeStateToProto(state, protoOutput);
-            protoOutput->end(stateToken);
+            uint64_t stateToken = output->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
+                                                FIELD_ID_SLICE_BY_STATE);
+            writeStateToProto(state, output);
+            output->end(stateToken);
         }
-        // Then fill bucket_info (CountBucketInfo).
-        for (const auto& bucket : counter.second) {
-            uint64_t bucketInfoToken = protoOutput->start(
-                    FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_BUCKET_INFO);
-            // Partial bucket.
-            if (bucket.mBucketEndNs - bucket.mBucketStartNs != mBucketSizeNs) {
-                protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_START_BUCKET_ELAPSED_MILLIS,
-                                   (long long)NanoToMillis(bucket.mBucketStartNs));
-                protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_END_BUCKET_ELAPSED_MILLIS,
-                                   (long long)NanoToMillis(bucket.mBucketEndNs));
-            } else {
-                protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_BUCKET_NUM,
-                                   (long long)(getBucketNumFromEndTimeNs(bucket.mBucketEndNs)));
-            }
-            protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_COUNT, (long long)bucket.mCount);
-
-            // We only write the condition timer value if the metric has a
-            // condition and isn't sliced by state or condition.
-            // TODO(b/268531179): Slice the condition timer by state and condition
-            if (mConditionTrackerIndex >= 0 && mSlicedStateAtoms.empty() && !mConditionSliced) {
-                protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_CONDITION_TRUE_NS,
-                                   (long long)bucket.mConditionTrueNs);
+    };
+
+    if (mColumnarReport) {
+        uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_COLUMNAR_METRICS);
+        ColumnarReportWriter writer(mTimeBaseNs, reportsConditionTrueNs());
+        // The heavy hitter overflow has a null key.
+        const auto addDimension = [&](const MetricDimensionKey* dimensionKey,
+                                      std::span<const CountBucket> buckets) {
+            writer.addDimension(
+                    [&](ProtoOutputStream* output) {
+                        if (dimensionKey == nullptr) {
+                            output->write(FIELD_TYPE_BOOL | FIELD_ID_IS_HEAVY_HITTER_OVERFLOW,
+                                          true);
+                        } else {
+                            writeDimensionKey(*dimensionKey, str_set, output);
+                        }
+                    },
+                    protoOutput);
+            for (const CountBucket& bucket : buckets) {
+                writer.addRow(bucket.mBucketStartNs, bucket.mBucketEndNs, bucket.mCount,
+                              bucket.mConditionTrueNs);
             }
+        };
+        mPastBuckets.forEach([&](const MetricDimensionKey& dimensionKey,
+                                 const vector<CountBucket>& buckets) {
+            addDimension(&dimensionKey, buckets);
+        });
+        mPastOverflowBuckets.forEach(
+                [&](const MetricDimensionKey&, const vector<CountBucket>& buckets) {
+                    addDimension(nullptr, buckets);
+                });
+        for (const auto& [dimensionKey, bucket] : currentBucketSnapshot) {
+            addDimension(&dimensionKey, std::span(&bucket, 1));
+        }
+        writer.writeColumns(protoOutput);
+        protoOutput->end(protoToken);
+
+        if (erase_data) {
+            mPastBuckets.clear();
+            mPastOverflowBuckets.clear();
+            mPastBucketsProtoCache.clear();
+            mDimensionGuardrailHit = false;
+        }
+        return;
+    }
+
+    uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_COUNT_METRICS);
+
+    mPastBuckets.forEach([&](const MetricDimensionKey& dimensionKey,
+                             const vector<CountBucket>& buckets) {
+        VLOG("  dimension key %s", dimensionKey.toString().c_str());
 
-            protoOutput->end(bucketInfoToken);
-            VLOG("\t bucket [%lld - %lld] count: %lld", (long long)bucket.mBucketStartNs,
-                 (long long)bucket.mBucketEndNs, (long long)bucket.mCount);
+        const auto writeDimension = [&](std::set<string>* strSet, ProtoOutputStream* output) {
+            writeDimensionKey(dimensionKey, strSet, output);
+        };
+
+        // The data is kept after this dump, so only encode the buckets past the ones cached by
+        // the previous dumps. Dictionary indexes only hold within one report, so are not cached.
+        if (!erase_data && mDimensionDictionary == nullptr) {
+            mPastBucketsProtoCache.writeData(
+                    FIELD_ID_DATA, dimensionKey, buckets.size(), str_set, writeDimension,
+                    [&](size_t firstBucket, ProtoOutputStream* output) {
+                        writeBucketsToProto(std::span(buckets).subspan(firstBucket), output);
+                    },
+                    protoOutput);
+            return;
         }
+
+        uint64_t wrapperToken =
+                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
+        writeDimension(str_set, protoOutput);
+        // Then fill bucket_info (CountBucketInfo).
+        writeBucketsToProto(buckets, protoOutput);
+        protoOutput->end(wrapperToken);
+    });
+
+    mPastOverflowBuckets.forEach([&](const MetricDimensionKey& dimensionKey,
+                                     const vector<CountBucket>& buckets) {
+        VLOG("  heavy hitter overflow");
+        uint64_t wrapperToken =
+                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
+        protoOutput->write(FIELD_TYPE_BOOL | FIELD_ID_IS_HEAVY_HITTER_OVERFLOW, true);
+        writeBucketsToProto(buckets, protoOutput);
+        protoOutput->end(wrapperToken);
+    });
+
+    for (const auto& [dimensionKey, bucket] : currentBucketSnapshot) {
+        uint64_t wrapperToken =
+                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
+        writeDimensionKey(dimensionKey, str_set, protoOutput);
+        writeBucketsToProto(std::span(&bucket, 1), protoOutput);
         protoOutput->end(wrapperToken);
     }
 
@@ -313,14 +386,59 @@ void CountMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
 
     if (erase_data) {
         mPastBuckets.clear();
+        mPastOverflowBuckets.clear();
+        mPastBucketsProtoCache.clear();
         mDimensionGuardrailHit = false;
     }
 }
 
+void CountMetricProducer::writeBucketsToProto(std::span<const CountBucket> buckets,
+                                              ProtoOutputStream* protoOutput) const {
+    for (const auto& bucket : buckets) {
+        uint64_t bucketInfoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
+                                                      FIELD_ID_BUCKET_INFO);
+        // Partial bucket, or bucket restored from a checkpoint of a previous statsd process
+        // that bucket numbers from mTimeBaseNs cannot represent.
+        if (bucket.mBucketEndNs - bucket.mBucketStartNs != mBucketSizeNs ||
+            bucket.mBucketStartNs < mTimeBaseNs) {
+            protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_START_BUCKET_ELAPSED_MILLIS,
+                               (long long)NanoToMillis(bucket.mBucketStartNs));
+            protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_END_BUCKET_ELAPSED_MILLIS,
+                               (long long)NanoToMillis(bucket.mBucketEndNs));
+        } else {
+            protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_BUCKET_NUM,
+                               (long long)(getBucketNumFromEndTimeNs(bucket.mBucketEndNs)));
+        }
+        protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_COUNT, (long long)bucket.mCount);
+
+        // We only write the condition timer value if the metric has a
+        // condition and isn't sliced by state or condition.
+        // TODO(b/268531179): Slice the condition timer by state and condition
+        if (reportsConditionTrueNs()) {
+            protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_CONDITION_TRUE_NS,
+                               (long long)bucket.mConditionTrueNs);
+        }
+
+        protoOutput->end(bucketInfoToken);
+        VLOG("\t bucket [%lld - %lld] count: %lld", (long long)bucket.mBucketStartNs,
+             (long long)bucket.mBucketEndNs, (long long)bucket.mCount);
+    }
+}
+
+void CountMetricProducer::onConfigArenaChangedLocked() {
+    std::pmr::memory_resource* resource = mConfigArena != nullptr
+                                                  ? mConfigArena->resource()
+                                                  : std::pmr::get_default_resource();
+    mPastBuckets.setMemoryResource(resource);
+    mPastOverflowBuckets.setMemoryResource(resource);
+}
+
 void CountMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
     flushIfNeededLocked(dropTimeNs);
     StatsdStats::getInstance().noteBucketDropped(mMetricId);
     mPastBuckets.clear();
+    mPastOverflowBuckets.clear();
+    mPastBucketsProtoCache.clear();
 }
 
 void CountMetricProducer::onConditionChangedLocked(const bool conditionMet,
@@ -375,14 +493,15 @@ void CountMetricProducer::onMatchedLogEventInternalLocked(
     if (it == mCurrentSlicedCounter->end()) {
         // ===========GuardRail==============
         if (hitGuardRailLocked(eventKey)) {
+            mHeavyHitters.add(eventKey);
             return;
         }
         // create a counter for the new key
-        (*mCurrentSlicedCounter)[eventKey] = 1;
+        mCurrentSlicedCounter->emplace(internDimensionKeyLocked(eventKey), event.getEventCount());
     } else {
-        // increment the existing value
+        // increment the existing value, by the number of events aggregated by the client
         auto& count = it->second;
-        count++;
+        count += event.getEventCount();
     }
     for (auto& tracker : mAnomalyTrackers) {
         int64_t countWholeBucket = mCurrentSlicedCounter->find(eventKey)->second;
@@ -436,6 +555,77 @@ bool CountMetricProducer::countPassesThreshold(const int64_t& count) {
     }
 }
 
+bool CountMetricProducer::writeBucketCheckpoint(metadata::BucketCheckpoint* checkpoint) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    // The condition timer is not checkpointed, so buckets that report it are not restored.
+    if (mCurrentSlicedCounter->empty() || reportsConditionTrueNs()) {
+        return false;
+    }
+    checkpoint->set_metric_id(mMetricId);
+    checkpoint->set_metric_hash(mProtoHash);
+    checkpoint->set_bucket_start_elapsed_ns(mCurrentBucketStartTimeNs);
+    for (const auto& [dimensionKey, count] : *mCurrentSlicedCounter) {
+        metadata::DimensionKeyedCount* keyedCount = checkpoint->add_dimension_keyed_count();
+        writeMetricDimensionKeyToMetadataDimensionKey(dimensionKey,
+                                                      keyedCount->mutable_dimension_key());
+        keyedCount->set_count(count);
+    }
+    return true;
+}
+
+void CountMetricProducer::restoreBucketCheckpoint(const metadata::BucketCheckpoint& checkpoint,
+                                                  const int64_t checkpointNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (checkpoint.metric_hash() != mProtoHash || reportsConditionTrueNs()) {
+        VLOG("Metric %lld changed, dropping its checkpointed bucket", (long long)mMetricId);
+        return;
+    }
+    CountBucket info;
+    info.mBucketStartNs = checkpoint.bucket_start_elapsed_ns();
+    info.mBucketEndNs = std::min(checkpointNs, info.mBucketStartNs + mBucketSizeNs);
+    info.mConditionTrueNs = 0;
+    // The restored bucket must not overlap with the buckets of this process.
+    if (info.mBucketStartNs >= info.mBucketEndNs || info.mBucketEndNs > mCurrentBucketStartTimeNs) {
+        ALOGW("Metric %lld checkpointed bucket overlaps the current bucket", (long long)mMetricId);
+        return;
+    }
+    mPastBuckets.startBucket(info.mBucketStartNs, info.mBucketEndNs, info.mConditionTrueNs);
+    for (const metadata::DimensionKeyedCount& keyedCount : checkpoint.dimension_keyed_count()) {
+        if (countPassesThreshold(keyedCount.count())) {
+            mPastBuckets.addCount(loadMetricDimensionKeyFromProto(keyedCount.dimension_key()),
+                                  keyedCount.count());
+        }
+    }
+}
+
+vector<pair<MetricDimensionKey, CountBucket>> CountMetricProducer::snapshotCurrentBucketLocked(
+        const int64_t dumpTimeNs) {
+    CountBucket info;
+    info.mBucketStartNs = mCurrentBucketStartTimeNs;
+    info.mBucketEndNs = std::min(dumpTimeNs, getCurrentBucketEndTimeNs());
+    // A copy of the condition timer is closed instead.
+    ConditionTimer conditionTimer = mConditionTimer;
+    info.mConditionTrueNs = conditionTimer.newBucketStart(dumpTimeNs, dumpTimeNs).mDurationNs;
+
+    vector<pair<MetricDimensionKey, CountBucket>> snapshot;
+    for (const auto& [key, count] : *mCurrentSlicedCounter) {
+        if (countPassesThreshold(count)) {
+            info.mCount = count;
+            snapshot.emplace_back(key, info);
+        }
+    }
+    // Like flushCurrentBucketLocked(), heavy hitters report their guaranteed count. The overflow
+    // is left out of the snapshot.
+    for (const SpaceSavingSummary::Entry& entry : mHeavyHitters.getTopEntries()) {
+        const int64_t guaranteedCount = entry.count - entry.error;
+        if (guaranteedCount > 0 && countPassesThreshold(guaranteedCount)) {
+            info.mCount = guaranteedCount;
+            snapshot.emplace_back(entry.key, info);
+        }
+    }
+    return snapshot;
+}
+
 void CountMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
                                                    const int64_t& nextBucketStartTimeNs) {
     int64_t fullBucketEndTimeNs = getCurrentBucketEndTimeNs();
@@ -451,16 +641,35 @@ void CountMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
             mConditionTimer.newBucketStart(eventTimeNs, nextBucketStartTimeNs);
     info.mConditionTrueNs = globalConditionTrueNs;
 
+    mPastBuckets.startBucket(info.mBucketStartNs, info.mBucketEndNs, info.mConditionTrueNs);
     for (const auto& counter : *mCurrentSlicedCounter) {
         if (countPassesThreshold(counter.second)) {
-            info.mCount = counter.second;
-            auto& bucketList = mPastBuckets[counter.first];
-            bucketList.push_back(info);
+            mPastBuckets.addCount(counter.first, counter.second);
             VLOG("metric %lld, dump key value: %s -> %lld", (long long)mMetricId,
                  counter.first.toString().c_str(), (long long)counter.second);
         }
     }
 
+    if (!mHeavyHitters.empty()) {
+        // Heavy hitters report the count they are guaranteed to have, which is exact unless they
+        // replaced another key. The other events go to the overflow bucket, whose count bounds
+        // the error of each heavy hitter.
+        int64_t overflowCount = mHeavyHitters.getTotalCount();
+        for (const SpaceSavingSummary::Entry& entry : mHeavyHitters.getTopEntries()) {
+            const int64_t guaranteedCount = entry.count - entry.error;
+            if (guaranteedCount > 0 && countPassesThreshold(guaranteedCount)) {
+                mPastBuckets.addCount(entry.key, guaranteedCount);
+                overflowCount -= guaranteedCount;
+            }
+        }
+        if (overflowCount > 0) {
+            mPastOverflowBuckets.startBucket(info.mBucketStartNs, info.mBucketEndNs,
+                                             info.mConditionTrueNs);
+            mPastOverflowBuckets.addCount(DEFAULT_METRIC_DIMENSION_KEY, overflowCount);
+        }
+        mHeavyHitters.clear();
+    }
+
     // Only update mCurrentFullCounters if any anomaly tackers are present.
     if (mAnomalyTrackers.size() > 0) {
         // If we have finished a full bucket, then send this to anomaly tracker.
@@ -491,21 +700,24 @@ void CountMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
     StatsdStats::getInstance().noteBucketCount(mMetricId);
     // Only resets the counters, but doesn't setup the times nor numbers.
     // (Do not clear since the old one is still referenced in mAnomalyTrackers).
+    mLastBucketDimensionCount = mCurrentSlicedCounter->size();
     mCurrentSlicedCounter = std::make_shared<DimToValMap>();
+    mCurrentSlicedCounter->reserve(mLastBucketDimensionCount);
     mCurrentBucketStartTimeNs = nextBucketStartTimeNs;
     // Reset mHasHitGuardrail boolean since bucket was reset
     mHasHitGuardrail = false;
 }
 
-// Rough estimate of CountMetricProducer buffer stored. This number will be
-// greater than actual data size as it contains each dimension of
-// CountMetricData is  duplicated.
+// Rough estimate of CountMetricProducer buffer stored. The dimension keys are not counted.
+// The proto cache is not counted, so that dumps that keep the data do not bring the next dump
+// forward.
+void CountMetricProducer::reserveDimensionsLocked(const size_t dimensionCount) {
+    mCurrentSlicedCounter->reserve(dimensionCount);
+    mPastBuckets.reserve(dimensionCount);
+}
+
 size_t CountMetricProducer::byteSizeLocked() const {
-    size_t totalSize = 0;
-    for (const auto& pair : mPastBuckets) {
-        totalSize += pair.second.size() * kBucketSize;
-    }
-    return totalSize;
+    return mPastBuckets.byteSize() + mPastOverflowBuckets.byteSize();
 }
 
 void CountMetricProducer::onActiveStateChangedLocked(const int64_t eventTimeNs,
@@ -20,13 +20,17 @@
 #include <android/util/ProtoOutputStream.h>
 #include <gtest/gtest_prod.h>
 
+#include <span>
 #include <unordered_map>
 
+#include "CountPastBuckets.h"
 #include "MetricProducer.h"
+#include "PastBucketsProtoCache.h"
 #include "anomaly/AnomalyTracker.h"
 #include "condition/ConditionTimer.h"
 #include "condition/ConditionTracker.h"
 #include "matchers/matcher_util.h"
+#include "metrics/SpaceSavingSummary.h"
 #include "src/statsd_config.pb.h"
 #include "stats_util.h"
 
@@ -34,13 +38,6 @@ namespace android {
 namespace os {
 namespace statsd {
 
-struct CountBucket {
-    int64_t mBucketStartNs;
-    int64_t mBucketEndNs;
-    int64_t mCount;
-    int64_t mConditionTrueNs;
-};
-
 class CountMetricProducer : public MetricProducer {
 public:
     CountMetricProducer(
@@ -63,6 +60,11 @@ public:
         return METRIC_TYPE_COUNT;
     }
 
+    bool writeBucketCheckpoint(metadata::BucketCheckpoint* checkpoint) override;
+
+    void restoreBucketCheckpoint(const metadata::BucketCheckpoint& checkpoint,
+                                 const int64_t checkpointNs) override;
+
 protected:
     void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
@@ -89,10 +91,23 @@ private:
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
+    size_t currentBucketByteSizeLocked() const override {
+        return estimateMapByteSize(*mCurrentSlicedCounter) +
+               estimateMapByteSize(*mCurrentFullCounters);
+    }
+
+    size_t getCurrentDimensionCountLocked() const override {
+        return mCurrentSlicedCounter->size();
+    }
+
+    void reserveDimensionsLocked(const size_t dimensionCount) override;
+
     void dumpStatesLocked(int out, bool verbose) const override;
 
     void dropDataLocked(const int64_t dropTimeNs) override;
 
+    void onConfigArenaChangedLocked() override;
+
     // Util function to flush the old packet.
     void flushIfNeededLocked(const int64_t& newEventTime) override;
 
@@ -117,7 +132,18 @@ private:
             std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
             std::vector<int>& metricsWithActivation) override;
 
-    std::unordered_map<MetricDimensionKey, std::vector<CountBucket>> mPastBuckets;
+    CountPastBuckets mPastBuckets;
+
+    // The count of the events past the dimension limit not attributed to a heavy hitter, under
+    // DEFAULT_METRIC_DIMENSION_KEY.
+    CountPastBuckets mPastOverflowBuckets;
+
+    // The encoded data of mPastBuckets, for the dumps that do not erase it.
+    PastBucketsProtoCache mPastBucketsProtoCache;
+
+    // Counts the events of new dimensions past the dimension limit of the current bucket. Its
+    // capacity is 0 unless the metric sets heavy_hitter_capacity.
+    SpaceSavingSummary mHeavyHitters;
 
     // The current bucket (may be a partial bucket).
     std::shared_ptr<DimToValMap> mCurrentSlicedCounter = std::make_shared<DimToValMap>();
@@ -126,12 +152,24 @@ private:
     // partial bucket). This is only updated while flushing the current bucket.
     std::shared_ptr<DimToValMap> mCurrentFullCounters = std::make_shared<DimToValMap>();
 
-    static const size_t kBucketSize = sizeof(CountBucket{});
-
     bool hitGuardRailLocked(const MetricDimensionKey& newKey);
 
     bool countPassesThreshold(const int64_t& count);
 
+    // Returns the counts of the current bucket as if it was closed at dumpTimeNs, without closing
+    // it.
+    std::vector<std::pair<MetricDimensionKey, CountBucket>> snapshotCurrentBucketLocked(
+            const int64_t dumpTimeNs);
+
+    // Writes the CountBucketInfo of each bucket.
+    void writeBucketsToProto(std::span<const CountBucket> buckets,
+                             android::util::ProtoOutputStream* protoOutput) const;
+
+    // Whether the buckets report the time the condition was true.
+    bool reportsConditionTrueNs() const {
+        return mConditionTrackerIndex >= 0 && mSlicedStateAtoms.empty() && !mConditionSliced;
+    }
+
     // Tracks if the dimension guardrail has been hit in the current report.
     bool mDimensionGuardrailHit;
 
@@ -144,6 +182,13 @@ private:
     FRIEND_TEST(CountMetricProducerTest, TestFirstBucket);
     FRIEND_TEST(CountMetricProducerTest, TestOneWeekTimeUnit);
     FRIEND_TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled);
+    FRIEND_TEST(CountMetricProducerTest, TestBucketCheckpointRestored);
+    FRIEND_TEST(CountMetricProducerTest, TestHeavyHittersPastDimensionLimit);
+    FRIEND_TEST(CountMetricProducerTest, TestRepeatedDumpsWithoutErasingData);
+    FRIEND_TEST(CountMetricProducerTest, TestSnapshotCurrentBucket);
+    FRIEND_TEST(CountMetricProducerTest, TestColumnarReport);
+    FRIEND_TEST(CountMetricProducerTest, TestEventCountAnnotation);
+    FRIEND_TEST(CountMetricProducerTest, TestDimensionCountMetadata);
 
     FRIEND_TEST(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket);
     FRIEND_TEST(CountMetricProducerTest_PartialBucket, TestSplitInNextBucket);
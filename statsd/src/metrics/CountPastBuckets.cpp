@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CountPastBuckets.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+namespace {
+
+void appendVarint(uint64_t value, std::pmr::vector<uint8_t>& bytes) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t readVarint(const std::pmr::vector<uint8_t>& bytes, size_t& pos) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        const uint8_t byte = bytes[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+}  // anonymous namespace
+
+void CountPastBuckets::startBucket(const int64_t bucketStartNs, const int64_t bucketEndNs,
+                                   const int64_t conditionTrueNs) {
+    mPendingBucket = {bucketStartNs, bucketEndNs, conditionTrueNs};
+    mHasPendingBucket = true;
+}
+
+void CountPastBuckets::addCount(const MetricDimensionKey& key, const int64_t count) {
+    if (mHasPendingBucket) {
+        mBuckets.push_back(mPendingBucket);
+        mHasPendingBucket = false;
+    }
+    const uint32_t bucketIndex = mBuckets.size() - 1;
+    const auto [it, inserted] = mKeyIds.emplace(key, mKeys.size());
+    if (inserted) {
+        mKeys.push_back(key);
+        mCounts.emplace_back(mResource);
+    }
+    KeyedCounts& counts = mCounts[it->second];
+    const size_t previousSize = counts.mPackedCounts.size();
+    // The first bucket of a key is stored as a delta to bucket 0.
+    appendVarint(bucketIndex - counts.mLastBucketIndex, counts.mPackedCounts);
+    appendVarint(static_cast<uint64_t>(count), counts.mPackedCounts);
+    counts.mLastBucketIndex = bucketIndex;
+    mPackedBytes += counts.mPackedCounts.size() - previousSize;
+}
+
+void CountPastBuckets::decodeBuckets(const size_t keyId, vector<CountBucket>& buckets) const {
+    buckets.clear();
+    const std::pmr::vector<uint8_t>& packedCounts = mCounts[keyId].mPackedCounts;
+    size_t pos = 0;
+    uint64_t bucketIndex = 0;
+    while (pos < packedCounts.size()) {
+        bucketIndex += readVarint(packedCounts, pos);
+        const int64_t count = static_cast<int64_t>(readVarint(packedCounts, pos));
+        const BucketBoundaries& bucket = mBuckets[bucketIndex];
+        buckets.push_back(
+                {bucket.mBucketStartNs, bucket.mBucketEndNs, count, bucket.mConditionTrueNs});
+    }
+}
+
+vector<CountBucket> CountPastBuckets::getBuckets(const MetricDimensionKey& key) const {
+    vector<CountBucket> buckets;
+    const auto it = mKeyIds.find(key);
+    if (it != mKeyIds.end()) {
+        decodeBuckets(it->second, buckets);
+    }
+    return buckets;
+}
+
+void CountPastBuckets::clear() {
+    mBuckets.clear();
+    mHasPendingBucket = false;
+    mKeys.clear();
+    mCounts.clear();
+    mKeyIds.clear();
+    mPackedBytes = 0;
+}
+
+void CountPastBuckets::reserve(const size_t numKeys) {
+    mKeys.reserve(numKeys);
+    mCounts.reserve(numKeys);
+    mKeyIds.reserve(numKeys);
+}
+
+size_t CountPastBuckets::byteSize() const {
+    return mBuckets.size() * sizeof(BucketBoundaries) + mPackedBytes;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
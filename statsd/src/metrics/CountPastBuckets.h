@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+struct CountBucket {
+    int64_t mBucketStartNs;
+    int64_t mBucketEndNs;
+    int64_t mCount;
+    int64_t mConditionTrueNs;
+};
+
+/**
+ * The past buckets of a CountMetricProducer.
+ *
+ * All the keys flushed together share a bucket, so the bucket boundaries and condition true time
+ * are stored once per bucket. Each key only stores its counts, as varint pairs of the delta to its
+ * previous bucket index and the count, under an id given to the key when it is first added.
+ */
+class CountPastBuckets {
+public:
+    // Allocates the counts of the keys added from now on from resource, which must outlive
+    // them.
+    void setMemoryResource(std::pmr::memory_resource* resource) {
+        mResource = resource;
+    }
+
+    // Starts a bucket, that the following addCount() calls add to. The bucket is only stored
+    // once a count is added to it.
+    void startBucket(const int64_t bucketStartNs, const int64_t bucketEndNs,
+                     const int64_t conditionTrueNs);
+
+    // Adds the count of the key in the last started bucket. Each key is only added once to a
+    // bucket.
+    void addCount(const MetricDimensionKey& key, const int64_t count);
+
+    // Calls callback(key, buckets) for each key, in the order the keys were first added.
+    template <typename Callback>
+    void forEach(Callback callback) const {
+        std::vector<CountBucket> buckets;
+        for (size_t keyId = 0; keyId < mKeys.size(); keyId++) {
+            decodeBuckets(keyId, buckets);
+            callback(mKeys[keyId], buckets);
+        }
+    }
+
+    // Decodes the buckets of the key, empty if the key has none.
+    std::vector<CountBucket> getBuckets(const MetricDimensionKey& key) const;
+
+    bool contains(const MetricDimensionKey& key) const {
+        return mKeyIds.find(key) != mKeyIds.end();
+    }
+
+    // Number of keys.
+    size_t size() const {
+        return mKeys.size();
+    }
+
+    bool empty() const {
+        return mKeys.empty();
+    }
+
+    void clear();
+
+    // Makes room for the number of keys.
+    void reserve(const size_t numKeys);
+
+    // Bytes used by the bucket boundaries and the packed counts.
+    size_t byteSize() const;
+
+private:
+    struct BucketBoundaries {
+        int64_t mBucketStartNs;
+        int64_t mBucketEndNs;
+        int64_t mConditionTrueNs;
+    };
+
+    struct KeyedCounts {
+        explicit KeyedCounts(std::pmr::memory_resource* resource) : mPackedCounts(resource) {
+        }
+
+        std::pmr::vector<uint8_t> mPackedCounts;
+        // Index in mBuckets of the last bucket of the key.
+        uint32_t mLastBucketIndex = 0;
+    };
+
+    void decodeBuckets(const size_t keyId, std::vector<CountBucket>& buckets) const;
+
+    std::vector<BucketBoundaries> mBuckets;
+
+    // The last started bucket, until it gets its first count.
+    BucketBoundaries mPendingBucket;
+    bool mHasPendingBucket = false;
+
+    // Indexed by key id.
+    std::vector<MetricDimensionKey> mKeys;
+    std::vector<KeyedCounts> mCounts;
+
+    std::unordered_map<MetricDimensionKey, uint32_t> mKeyIds;
+
+    size_t mPackedBytes = 0;
+
+    std::pmr::memory_resource* mResource = std::pmr::get_default_resource();
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
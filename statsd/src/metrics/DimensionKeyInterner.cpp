@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics/DimensionKeyInterner.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+HashableDimensionKey DimensionKeyInterner::intern(const HashableDimensionKey& key) {
+    if (key.getValues().empty()) {
+        return key;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    return internLocked(key);
+}
+
+MetricDimensionKey DimensionKeyInterner::intern(const MetricDimensionKey& key) {
+    if (key.getDimensionKeyInWhat().getValues().empty() &&
+        key.getStateValuesKey().getValues().empty()) {
+        return key;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    return MetricDimensionKey(internLocked(key.getDimensionKeyInWhat()),
+                              internLocked(key.getStateValuesKey()));
+}
+
+void DimensionKeyInterner::prune() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    pruneLocked();
+}
+
+HashableDimensionKey DimensionKeyInterner::internLocked(const HashableDimensionKey& key) {
+    if (key.getValues().empty()) {
+        return key;
+    }
+    auto it = mKeys.find(key);
+    if (it != mKeys.end()) {
+        return *it;
+    }
+
+    if (mKeys.size() >= mNextPruneSize) {
+        pruneLocked();
+        mNextPruneSize = std::max(kMinPruneSize, 2 * mKeys.size());
+    }
+
+    HashableDimensionKey internedKey(key);
+    if (internedKey.mSharedValues == nullptr) {
+        internedKey.mSharedValues =
+                std::make_shared<const DimensionValues>(std::move(internedKey.mValues));
+        internedKey.mValues.clear();
+    }
+    mKeys.insert(internedKey);
+    return internedKey;
+}
+
+void DimensionKeyInterner::pruneLocked() {
+    for (auto it = mKeys.begin(); it != mKeys.end();) {
+        if (it->mSharedValues.use_count() == 1) {
+            it = mKeys.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <mutex>
+#include <unordered_set>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Held by the MetricProducers of the MetricsManagers of a StatsLogProcessor. Metrics that slice by
+// the same dimensions, in one config or across configs, store one copy of the values of each
+// dimension key instead of one copy per metric. Keys are interned when a metric starts tracking
+// them, and the copies that the metric makes while building buckets share the interned values as
+// well.
+//
+// Thread safe: the configs processing events on different threads, or dumped off the lock of the
+// StatsLogProcessor, intern keys concurrently. Keys are only interned for new dimensions, so the
+// lock is rarely taken.
+class DimensionKeyInterner : public virtual RefBase {
+public:
+    DimensionKeyInterner() : mNextPruneSize(kMinPruneSize) {
+    }
+
+    // Returns a key equal to key that shares its values with the other interned keys.
+    HashableDimensionKey intern(const HashableDimensionKey& key);
+
+    MetricDimensionKey intern(const MetricDimensionKey& key);
+
+    // Drops the interned values that no key outside of the interner refers to anymore.
+    void prune();
+
+    inline size_t size() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mKeys.size();
+    }
+
+private:
+    // prune() runs when the number of interned keys reaches mNextPruneSize, which is then set to
+    // twice the number of keys left, so that interning stays amortized O(1).
+    static constexpr size_t kMinPruneSize = 256;
+
+    HashableDimensionKey internLocked(const HashableDimensionKey& key);
+
+    void pruneLocked();
+
+    mutable std::mutex mMutex;
+
+    std::unordered_set<HashableDimensionKey> mKeys;
+
+    size_t mNextPruneSize;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "DistinctCountMetricProducer.h"
+
+#include "guardrail/StatsdStats.h"
+#include "hash.h"
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_BYTES;
+using android::util::FIELD_TYPE_INT32;
+using android::util::FIELD_TYPE_INT64;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::nullopt;
+using std::optional;
+using std::unique_ptr;
+using std::vector;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// for StatsLogReport
+const int FIELD_ID_VALUE_METRICS = 7;
+// for ValueBucketInfo
+const int FIELD_ID_VALUE_INDEX = 1;
+const int FIELD_ID_VALUE_LONG = 2;
+const int FIELD_ID_VALUE_SAMPLESIZE = 4;
+const int FIELD_ID_VALUE_DISTINCT_COUNT_SKETCH = 5;
+const int FIELD_ID_VALUES = 9;
+const int FIELD_ID_BUCKET_NUM = 4;
+const int FIELD_ID_START_BUCKET_ELAPSED_MILLIS = 5;
+const int FIELD_ID_END_BUCKET_ELAPSED_MILLIS = 6;
+const int FIELD_ID_CONDITION_TRUE_NS = 10;
+
+// Seeds of the value hash, so that equal numbers and strings are counted apart.
+const uint64_t kNumberSeed = 0x9e3779b97f4a7c15ull;
+const uint64_t kStringSeed = 0xc2b2ae3d27d4eb4full;
+
+namespace {
+
+// INT and LONG values are counted as the same number.
+uint64_t hashNumber(const int64_t number) {
+    return WyHash64(reinterpret_cast<const char*>(&number), sizeof(number), kNumberSeed);
+}
+
+}  // anonymous namespace
+
+optional<uint64_t> hashDistinctCountValue(const Value& value) {
+    switch (value.getType()) {
+        case INT:
+            return hashNumber(value.int_value);
+        case LONG:
+            return hashNumber(value.long_value);
+        case STRING:
+            return WyHash64(value.getString().data(), value.getString().size(), kStringSeed);
+        default:
+            return nullopt;
+    }
+}
+
+DistinctCountMetricProducer::DistinctCountMetricProducer(
+        const ConfigKey& key, const ValueMetric& metric, const uint64_t protoHash,
+        const PullOptions& pullOptions, const BucketOptions& bucketOptions,
+        const WhatOptions& whatOptions, const ConditionOptions& conditionOptions,
+        const StateOptions& stateOptions, const ActivationOptions& activationOptions,
+        const GuardrailOptions& guardrailOptions)
+    : ValueMetricProducer(metric.id(), key, protoHash, pullOptions, bucketOptions, whatOptions,
+                          conditionOptions, stateOptions, activationOptions, guardrailOptions),
+      mIncludeSampleSize(metric.include_sample_size()) {
+}
+
+DistinctCountMetricProducer::DumpProtoFields DistinctCountMetricProducer::getDumpProtoFields()
+        const {
+    return {FIELD_ID_VALUE_METRICS,
+            FIELD_ID_BUCKET_NUM,
+            FIELD_ID_START_BUCKET_ELAPSED_MILLIS,
+            FIELD_ID_END_BUCKET_ELAPSED_MILLIS,
+            FIELD_ID_CONDITION_TRUE_NS,
+            /*conditionCorrectionNsFieldId=*/nullopt};
+}
+
+void DistinctCountMetricProducer::writePastBucketAggregateToProto(
+        const int aggIndex, const unique_ptr<HyperLogLog>& sketch, const int sampleSize,
+        ProtoOutputStream* const protoOutput) const {
+    uint64_t valueToken =
+            protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_VALUES);
+    protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_VALUE_INDEX, aggIndex);
+    if (mIncludeSampleSize) {
+        protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_VALUE_SAMPLESIZE, sampleSize);
+    }
+    const int64_t estimate = sketch->estimate();
+    protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_VALUE_LONG, (long long)estimate);
+    const vector<uint8_t> serialized = sketch->serialize();
+    protoOutput->write(FIELD_TYPE_BYTES | FIELD_ID_VALUE_DISTINCT_COUNT_SKETCH,
+                       reinterpret_cast<const char*>(serialized.data()), serialized.size());
+    VLOG("\t\t value %d: ~%lld distinct values", aggIndex, (long long)estimate);
+    protoOutput->end(valueToken);
+}
+
+bool DistinctCountMetricProducer::aggregateFields(const int64_t eventTimeNs,
+                                                  const MetricDimensionKey& eventKey,
+                                                  const LogEvent& event,
+                                                  const Intervals& intervals, Empty& empty) {
+    bool seenNewData = false;
+    for (size_t i = 0; i < mFieldMatchers.size(); i++) {
+        const Matcher& matcher = mFieldMatchers[i];
+        Interval& interval = intervals[i];
+        interval.aggIndex = i;
+        optional<uint64_t> hash;
+        for (const FieldValue& value : event.getValues()) {
+            if (value.mField.matches(matcher)) {
+                hash = hashDistinctCountValue(value.mValue);
+                break;
+            }
+        }
+        if (!hash) {
+            VLOG("Failed to get value %zu from event %s", i, event.ToString().c_str());
+            StatsdStats::getInstance().noteBadValueType(mMetricId);
+            return seenNewData;
+        }
+
+        // interval.aggregate is nullptr until the first value of the bucket, and again once the
+        // sketch is given to a PastBucket.
+        if (!interval.aggregate) {
+            interval.aggregate = std::make_unique<HyperLogLog>();
+        }
+        seenNewData = true;
+        interval.aggregate->add(*hash);
+        interval.sampleSize += 1;
+    }
+    return seenNewData;
+}
+
+PastBucket<unique_ptr<HyperLogLog>> DistinctCountMetricProducer::buildPartialBucket(
+        int64_t bucketEndTimeNs, const Intervals& intervals) {
+    PastBucket<unique_ptr<HyperLogLog>> bucket;
+    bucket.mBucketStartNs = mCurrentBucketStartTimeNs;
+    bucket.mBucketEndNs = bucketEndTimeNs;
+    for (Interval& interval : intervals) {
+        if (interval.hasValue()) {
+            bucket.aggIndex.push_back(interval.aggIndex);
+            bucket.aggregates.push_back(std::move(interval.aggregate));
+        }
+    }
+    return bucket;
+}
+
+size_t DistinctCountMetricProducer::pastBucketByteSize(
+        const PastBucket<unique_ptr<HyperLogLog>>& bucket) const {
+    size_t totalSize = kBucketSize + bucket.aggIndex.size() * sizeof(int);
+    for (const unique_ptr<HyperLogLog>& sketch : bucket.aggregates) {
+        totalSize += sketch->getRegisterCount();
+    }
+    return totalSize;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
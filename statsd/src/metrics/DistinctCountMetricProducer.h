@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+#include <gtest/gtest_prod.h>
+
+#include <optional>
+
+#include "MetricProducer.h"
+#include "ValueMetricProducer.h"
+#include "src/statsd_config.pb.h"
+#include "stats_log_util.h"
+#include "utils/HyperLogLog.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Returns the hash that a distinct count sketch adds for value, or nullopt if values of its type
+// cannot be counted.
+std::optional<uint64_t> hashDistinctCountValue(const Value& value);
+
+// Counts the distinct values of a ValueMetric with the DISTINCT_COUNT aggregation type. Each
+// dimension keeps a HyperLogLog sketch per value field and bucket, which is reported with its
+// estimate so that buckets can be merged offline.
+//
+// Like KllMetricProducer, only pushed atoms are supported.
+class DistinctCountMetricProducer
+    : public ValueMetricProducer<std::unique_ptr<HyperLogLog>, Empty> {
+public:
+    DistinctCountMetricProducer(const ConfigKey& key, const ValueMetric& valueMetric,
+                                const uint64_t protoHash, const PullOptions& pullOptions,
+                                const BucketOptions& bucketOptions, const WhatOptions& whatOptions,
+                                const ConditionOptions& conditionOptions,
+                                const StateOptions& stateOptions,
+                                const ActivationOptions& activationOptions,
+                                const GuardrailOptions& guardrailOptions);
+
+    inline MetricType getMetricType() const override {
+        return METRIC_TYPE_VALUE;
+    }
+
+private:
+    inline optional<int64_t> getConditionIdForMetric(const StatsdConfig& config,
+                                                     const int configIndex) const override {
+        const ValueMetric& metric = config.value_metric(configIndex);
+        return metric.has_condition() ? make_optional(metric.condition()) : nullopt;
+    }
+
+    inline int64_t getWhatAtomMatcherIdForMetric(const StatsdConfig& config,
+                                                 const int configIndex) const override {
+        return config.value_metric(configIndex).what();
+    }
+
+    inline ConditionLinks getConditionLinksForMetric(const StatsdConfig& config,
+                                                     const int configIndex) const override {
+        return config.value_metric(configIndex).links();
+    }
+
+    inline bool canSkipLogEventLocked(
+            const MetricDimensionKey& eventKey, bool condition, int64_t eventTimeNs,
+            const std::map<int, HashableDimensionKey>& statePrimaryKeys) const override {
+        // Can only skip if the condition is false, since the metric is pushed.
+        return !condition;
+    }
+
+    DumpProtoFields getDumpProtoFields() const override;
+
+    inline std::string aggregatedValueToString(
+            const std::unique_ptr<HyperLogLog>& aggregate) const override {
+        return "~" + std::to_string(aggregate->estimate()) + " distinct values";
+    }
+
+    inline bool multipleBucketsSkipped(const int64_t numBucketsForward) const override {
+        // Always false because the metric is pushed.
+        return false;
+    }
+
+    // The sketch ownership is transferred to newly created PastBuckets from Intervals.
+    PastBucket<std::unique_ptr<HyperLogLog>> buildPartialBucket(
+            int64_t bucketEndTime, const Intervals& intervals) override;
+
+    void writePastBucketAggregateToProto(const int aggIndex,
+                                         const std::unique_ptr<HyperLogLog>& sketch,
+                                         const int sampleSize,
+                                         ProtoOutputStream* const protoOutput) const override;
+
+    bool aggregateFields(const int64_t eventTimeNs, const MetricDimensionKey& eventKey,
+                         const LogEvent& event, const Intervals& intervals,
+                         Empty& empty) override;
+
+    size_t pastBucketByteSize(
+            const PastBucket<std::unique_ptr<HyperLogLog>>& bucket) const override;
+
+    const bool mIncludeSampleSize;
+
+    FRIEND_TEST(DistinctCountMetricProducerTest, TestPushedEventsWithoutCondition);
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -23,7 +23,11 @@
 #include <limits.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <unordered_set>
+
 #include "guardrail/StatsdStats.h"
+#include "metrics/ColumnarReportWriter.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
 #include "stats_util.h"
@@ -53,12 +57,14 @@ const int FIELD_ID_BUCKET_SIZE = 10;
 const int FIELD_ID_DIMENSION_PATH_IN_WHAT = 11;
 const int FIELD_ID_IS_ACTIVE = 14;
 const int FIELD_ID_DIMENSION_GUARDRAIL_HIT = 17;
+const int FIELD_ID_COLUMNAR_METRICS = 18;
 // for DurationMetricDataWrapper
 const int FIELD_ID_DATA = 1;
 // for DurationMetricData
 const int FIELD_ID_DIMENSION_IN_WHAT = 1;
 const int FIELD_ID_BUCKET_INFO = 3;
 const int FIELD_ID_DIMENSION_LEAF_IN_WHAT = 4;
+const int FIELD_ID_DIMENSION_INDEX_IN_WHAT = 8;
 const int FIELD_ID_SLICE_BY_STATE = 6;
 // for DurationBucketInfo
 const int FIELD_ID_DURATION = 3;
@@ -160,6 +166,24 @@ DurationMetricProducer::DurationMetricProducer(
         mHasLinksToAllConditionDimensionsInTracker = mWizard->equalOutputDimensions(
                 mConditionTrackerIndex, mMetric2ConditionLinks.begin()->conditionFields);
     }
+    // Changes can be routed by the what key when the link to the condition predicate whose
+    // dimensions change only reads fields of the dimensions in what.
+    mRoutedConditionLinkIndex = -1;
+    const optional<int64_t> changedDimensionSourceId =
+            mWizard != nullptr && !mContainANYPositionInDimensionsInWhat
+                    ? mWizard->getChangedDimensionSourceId(mConditionTrackerIndex)
+                    : nullopt;
+    for (int i = 0; changedDimensionSourceId && i < (int)mMetric2ConditionLinks.size(); i++) {
+        if (mMetric2ConditionLinks[i].conditionId != *changedDimensionSourceId) {
+            continue;
+        }
+        if (mRoutedConditionLinkIndex >= 0 ||
+            !subsetDimensions(mMetric2ConditionLinks[i].metricFields, mDimensionsInWhat)) {
+            mRoutedConditionLinkIndex = -1;
+            break;
+        }
+        mRoutedConditionLinkIndex = i;
+    }
     flushIfNeededLocked(startTimeNs);
     // Adjust start for partial bucket
     mCurrentBucketStartTimeNs = startTimeNs;
@@ -270,7 +294,7 @@ void DurationMetricProducer::initTrueDimensions(const int whatIndex, const int64
     if (whatIndex == -1) {
         return;
     }
-    const map<HashableDimensionKey, int>* slicedWhatMap = mWizard->getSlicedDimensionMap(whatIndex);
+    const SlicedConditionStateMap* slicedWhatMap = mWizard->getSlicedDimensionMap(whatIndex);
     for (const auto& [internalDimKey, count] : *slicedWhatMap) {
         for (int i = 0; i < count; i++) {
             // Fake start events.
@@ -309,6 +333,8 @@ void DurationMetricProducer::addAnomalyTracker(sp<AnomalyTracker>& anomalyTracke
 void DurationMetricProducer::addAnomalyTrackerLocked(sp<AnomalyTracker>& anomalyTracker,
                                                      const UpdateStatus& updateStatus,
                                                      const int64_t updateTimeNs) {
+    // The pending condition changes set no alarm, so they must not be applied after this.
+    applyAllConditionChangesLocked();
     mAnomalyTrackers.push_back(anomalyTracker);
     for (const auto& [_, durationTracker] : mCurrentSlicedDurationTrackerMap) {
         durationTracker->addAnomalyTracker(anomalyTracker, updateStatus, updateTimeNs);
@@ -318,13 +344,27 @@ void DurationMetricProducer::onStateChanged(const int64_t eventTimeNs, const int
                                             const HashableDimensionKey& primaryKey,
                                             const FieldValue& oldState,
                                             const FieldValue& newState) {
+    flushIfNeededLocked(eventTimeNs);
+    notifyTrackersOfStateChange(eventTimeNs, atomId, primaryKey, newState);
+}
+
+void DurationMetricProducer::onStateChanges(const int64_t eventTimeNs, const int32_t atomId,
+                                            const std::vector<StateChange>& changes) {
+    flushIfNeededLocked(eventTimeNs);
+    for (const StateChange& change : changes) {
+        notifyTrackersOfStateChange(eventTimeNs, atomId, change.primaryKey, change.newState);
+    }
+}
+
+void DurationMetricProducer::notifyTrackersOfStateChange(const int64_t eventTimeNs,
+                                                         const int32_t atomId,
+                                                         const HashableDimensionKey& primaryKey,
+                                                         const FieldValue& newState) {
     // Check if this metric has a StateMap. If so, map the new state value to
     // the correct state group id.
     FieldValue newStateCopy = newState;
     mapStateValue(atomId, &newStateCopy);
 
-    flushIfNeededLocked(eventTimeNs);
-
     // Each duration tracker is mapped to a different whatKey (a set of values from the
     // dimensionsInWhat fields). We notify all trackers iff the primaryKey field values from the
     // state change event are a subset of the tracker's whatKey field values.
@@ -339,6 +379,7 @@ void DurationMetricProducer::onStateChanged(const int64_t eventTimeNs, const int
         if (!containsLinkedStateValues(whatIt.first, primaryKey, mMetric2StateLinks, atomId)) {
             continue;
         }
+        applyConditionChangesLocked(*whatIt.second);
         whatIt.second->onStateChanged(eventTimeNs, atomId, newStateCopy);
     }
 }
@@ -389,7 +430,7 @@ void DurationMetricProducer::onSlicedConditionMayChangeLocked_opt1(const int64_t
     // state based on the new unsliced condition state.
     if (dimensionsChangedToTrue == nullptr || dimensionsChangedToFalse == nullptr ||
         (dimensionsChangedToTrue->empty() && dimensionsChangedToFalse->empty())) {
-        const map<HashableDimensionKey, int>* slicedConditionMap =
+        const SlicedConditionStateMap* slicedConditionMap =
                 mWizard->getSlicedDimensionMap(mConditionTrackerIndex);
         for (auto& whatIt : mCurrentSlicedDurationTrackerMap) {
             HashableDimensionKey linkedConditionDimensionKey;
@@ -407,12 +448,12 @@ void DurationMetricProducer::onSlicedConditionMayChangeLocked_opt1(const int64_t
                 HashableDimensionKey linkedConditionDimensionKey;
                 getDimensionForCondition(whatIt.first.getValues(), mMetric2ConditionLinks[0],
                                          &linkedConditionDimensionKey);
-                if (dimensionsChangedToTrue->find(linkedConditionDimensionKey) !=
-                        dimensionsChangedToTrue->end()) {
+                if (std::find(dimensionsChangedToTrue->begin(), dimensionsChangedToTrue->end(),
+                              linkedConditionDimensionKey) != dimensionsChangedToTrue->end()) {
                     whatIt.second->onConditionChanged(true, eventTime);
                 }
-                if (dimensionsChangedToFalse->find(linkedConditionDimensionKey) !=
-                        dimensionsChangedToFalse->end()) {
+                if (std::find(dimensionsChangedToFalse->begin(), dimensionsChangedToFalse->end(),
+                              linkedConditionDimensionKey) != dimensionsChangedToFalse->end()) {
                     whatIt.second->onConditionChanged(false, eventTime);
                 }
             }
@@ -420,6 +461,91 @@ void DurationMetricProducer::onSlicedConditionMayChangeLocked_opt1(const int64_t
     }
 }
 
+// SlicedConditionChange optimization case 2:
+// 1. The condition has a single sliced simple predicate, whatever the logical operation.
+// 2. The link to the sliced predicate only reads fields of the dimensions in what.
+// A change of the sliced predicate then only affects the trackers linked to the dimensions it
+// changed, while a change of the unsliced part may affect all of them.
+bool DurationMetricProducer::onSlicedConditionMayChangeLocked_opt2(const int64_t eventTimeNs) {
+    if (!mWizard->IsSimpleCondition(mConditionTrackerIndex)) {
+        ConditionState unslicedPartState =
+                mWizard->getUnSlicedPartConditionState(mConditionTrackerIndex);
+        const bool unslicedPartChanged = mUnSlicedPartCondition != unslicedPartState;
+        mUnSlicedPartCondition = unslicedPartState;
+        if (unslicedPartChanged) {
+            return false;
+        }
+    }
+
+    auto dimensionsChangedToTrue = mWizard->getChangedToTrueDimensions(mConditionTrackerIndex);
+    auto dimensionsChangedToFalse = mWizard->getChangedToFalseDimensions(mConditionTrackerIndex);
+    if (dimensionsChangedToTrue == nullptr || dimensionsChangedToFalse == nullptr) {
+        return false;
+    }
+
+    const Metric2Condition& link = mMetric2ConditionLinks[mRoutedConditionLinkIndex];
+    std::unordered_set<HashableDimensionKey> linkedDimensions = {DEFAULT_DIMENSION_KEY};
+    for (const ChangedDimensions* changedDimensions :
+         {dimensionsChangedToTrue, dimensionsChangedToFalse}) {
+        for (const HashableDimensionKey& conditionDimension : *changedDimensions) {
+            HashableDimensionKey linkedDimension;
+            if (getLinkedConditionDimension(conditionDimension, link, &linkedDimension)) {
+                linkedDimensions.insert(linkedDimension);
+            }
+        }
+    }
+
+    for (const HashableDimensionKey& linkedDimension : linkedDimensions) {
+        const auto linkedIt = mLinkedWhatKeys.find(linkedDimension);
+        if (linkedIt == mLinkedWhatKeys.end()) {
+            continue;
+        }
+        for (const HashableDimensionKey& whatKey : linkedIt->second) {
+            const auto whatIt = mCurrentSlicedDurationTrackerMap.find(whatKey);
+            if (whatIt != mCurrentSlicedDurationTrackerMap.end()) {
+                whatIt->second->onSlicedConditionMayChange(eventTimeNs);
+            }
+        }
+    }
+    return true;
+}
+
+HashableDimensionKey DurationMetricProducer::getRoutedLinkedDimensionLocked(
+        const HashableDimensionKey& whatKey) const {
+    const Metric2Condition& link = mMetric2ConditionLinks[mRoutedConditionLinkIndex];
+    HashableDimensionKey linkedDimension;
+    getDimensionForCondition(whatKey.getValues(), link, &linkedDimension);
+    if (linkedDimension.getValues().size() != link.conditionFields.size()) {
+        return DEFAULT_DIMENSION_KEY;
+    }
+    return linkedDimension;
+}
+
+void DurationMetricProducer::indexDurationTrackerLocked(const HashableDimensionKey& whatKey) {
+    if (mRoutedConditionLinkIndex < 0) {
+        return;
+    }
+    mLinkedWhatKeys[getRoutedLinkedDimensionLocked(whatKey)].push_back(whatKey);
+}
+
+void DurationMetricProducer::unindexDurationTrackerLocked(const HashableDimensionKey& whatKey) {
+    if (mRoutedConditionLinkIndex < 0) {
+        return;
+    }
+    auto linkedIt = mLinkedWhatKeys.find(getRoutedLinkedDimensionLocked(whatKey));
+    if (linkedIt == mLinkedWhatKeys.end()) {
+        return;
+    }
+    vector<HashableDimensionKey>& whatKeys = linkedIt->second;
+    const auto whatKeyIt = std::find(whatKeys.begin(), whatKeys.end(), whatKey);
+    if (whatKeyIt != whatKeys.end()) {
+        whatKeys.erase(whatKeyIt);
+    }
+    if (whatKeys.empty()) {
+        mLinkedWhatKeys.erase(linkedIt);
+    }
+}
+
 void DurationMetricProducer::onSlicedConditionMayChangeInternalLocked(const int64_t eventTimeNs) {
     bool changeDimTrackable = mWizard->IsChangedDimensionTrackable(mConditionTrackerIndex);
     if (changeDimTrackable && mHasLinksToAllConditionDimensionsInTracker) {
@@ -427,6 +553,10 @@ void DurationMetricProducer::onSlicedConditionMayChangeInternalLocked(const int6
         return;
     }
 
+    if (mRoutedConditionLinkIndex >= 0 && onSlicedConditionMayChangeLocked_opt2(eventTimeNs)) {
+        return;
+    }
+
     // Now for each of the on-going event, check if the condition has changed for them.
     for (auto& whatIt : mCurrentSlicedDurationTrackerMap) {
         whatIt.second->onSlicedConditionMayChange(eventTimeNs);
@@ -463,9 +593,7 @@ void DurationMetricProducer::onActiveStateChangedLocked(const int64_t eventTimeN
             flushIfNeededLocked(eventTimeNs);
         }
 
-        for (auto& whatIt : mCurrentSlicedDurationTrackerMap) {
-            whatIt.second->onConditionChanged(isActive, eventTimeNs);
-        }
+        onUnslicedConditionChangedLocked(isActive, eventTimeNs);
         mConditionTimer.onConditionChanged(isActive, eventTimeNs);
     } else if (isActive) {
         flushIfNeededLocked(eventTimeNs);
@@ -487,28 +615,59 @@ void DurationMetricProducer::onConditionChangedLocked(const bool conditionMet,
     }
 
     flushIfNeededLocked(eventTime);
-    for (auto& whatIt : mCurrentSlicedDurationTrackerMap) {
-        whatIt.second->onConditionChanged(conditionMet, eventTime);
-    }
+    onUnslicedConditionChangedLocked(conditionMet, eventTime);
 
     mConditionTimer.onConditionChanged(mCondition, eventTime);
 }
 
+void DurationMetricProducer::onUnslicedConditionChangedLocked(const bool condition,
+                                                              const int64_t eventTimeNs) {
+    // Anomaly alarms have to be set and declared at the time of the change, and trackers of a
+    // sliced condition do not pause and resume all their keys together.
+    if (!mAnomalyTrackers.empty() || mConditionSliced) {
+        for (auto& whatIt : mCurrentSlicedDurationTrackerMap) {
+            whatIt.second->onConditionChanged(condition, eventTimeNs);
+        }
+        return;
+    }
+    if (mCurrentSlicedDurationTrackerMap.empty()) {
+        return;
+    }
+    mConditionChanges.push_back({condition, eventTimeNs});
+    if (mConditionChanges.size() >= kMaxPendingConditionChanges) {
+        applyAllConditionChangesLocked();
+    }
+}
+
+void DurationMetricProducer::applyAllConditionChangesLocked() {
+    if (mConditionChanges.empty()) {
+        return;
+    }
+    for (auto& [_, tracker] : mCurrentSlicedDurationTrackerMap) {
+        applyConditionChangesLocked(*tracker);
+    }
+    mFirstConditionEpoch += mConditionChanges.size();
+    mConditionChanges.clear();
+}
+
 void DurationMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
     flushIfNeededLocked(dropTimeNs);
     StatsdStats::getInstance().noteBucketDropped(mMetricId);
     mPastBuckets.clear();
+    mNumPastBuckets = 0;
 }
 
 void DurationMetricProducer::clearPastBucketsLocked(const int64_t dumpTimeNs) {
     flushIfNeededLocked(dumpTimeNs);
     mPastBuckets.clear();
+    mNumPastBuckets = 0;
 }
 
 void DurationMetricProducer::onDumpReportLocked(
         const int64_t dumpTimeNs, const bool include_current_partial_bucket, const bool erase_data,
         const DumpLatency dumpLatency, std::set<string>* str_set, ProtoOutputStream* protoOutput) {
-    if (include_current_partial_bucket) {
+    // The current bucket is not snapshotted, only its past buckets are reported.
+    if (include_current_partial_bucket && dumpLatency != SNAPSHOT) {
         flushLocked(dumpTimeNs);
     } else {
         flushIfNeededLocked(dumpTimeNs);
@@ -538,34 +697,69 @@ void DurationMetricProducer::onDumpReportLocked(
         }
     }
 
-    uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_DURATION_METRICS);
-
     VLOG("Duration metric %lld dump report now...", (long long)mMetricId);
 
-    for (const auto& pair : mPastBuckets) {
-        const MetricDimensionKey& dimensionKey = pair.first;
-        VLOG("  dimension key %s", dimensionKey.toString().c_str());
-
-        uint64_t wrapperToken =
-                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
-
+    const auto writeDimensionKey = [&](const MetricDimensionKey& dimensionKey,
+                                       ProtoOutputStream* output) {
         // First fill dimension.
         if (mShouldUseNestedDimensions) {
-            uint64_t dimensionToken = protoOutput->start(
-                    FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
-            writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), str_set, protoOutput);
-            protoOutput->end(dimensionToken);
+            uint64_t dimensionToken =
+                    output->start(FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
+            writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), str_set, output);
+            output->end(dimensionToken);
+        } else if (mDimensionDictionary != nullptr) {
+            mDimensionDictionary->writeIndex(FIELD_ID_DIMENSION_INDEX_IN_WHAT,
+                                             dimensionKey.getDimensionKeyInWhat(), output);
         } else {
             writeDimensionLeafNodesToProto(dimensionKey.getDimensionKeyInWhat(),
-                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set, protoOutput);
+                                           FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set, output);
         }
         // Then fill slice_by_state.
         for (auto state : dimensionKey.getStateValuesKey().getValues()) {
-            uint64_t stateToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
-                                                     FIELD_ID_SLICE_BY_STATE);
-            writeStateToProto(state, protoOutput);
-            protoOutput->end(stateToken);
+            uint64_t stateToken = output->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
+                                                FIELD_ID_SLICE_BY_STATE);
+            writeStateToProto(state, output);
+            output->end(stateToken);
         }
+    };
+
+    // We only write the condition timer value if the metric has a
+    // condition and isn't sliced by state or condition.
+    // TODO(b/268531762): Slice the condition timer by state and condition
+    const bool writeConditionTrueNs =
+            mConditionTrackerIndex >= 0 && mSlicedStateAtoms.empty() && !mConditionSliced;
+
+    if (mColumnarReport) {
+        uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_COLUMNAR_METRICS);
+        ColumnarReportWriter writer(mTimeBaseNs, writeConditionTrueNs);
+        for (const auto& [dimensionKey, buckets] : mPastBuckets) {
+            writer.addDimension(
+                    [&](ProtoOutputStream* output) { writeDimensionKey(dimensionKey, output); },
+                    protoOutput);
+            for (const DurationBucket& bucket : buckets) {
+                writer.addRow(bucket.mBucketStartNs, bucket.mBucketEndNs, bucket.mDuration,
+                              bucket.mConditionTrueNs);
+            }
+        }
+        writer.writeColumns(protoOutput);
+        protoOutput->end(protoToken);
+        if (erase_data) {
+            mPastBuckets.clear();
+            mNumPastBuckets = 0;
+        }
+        return;
+    }
+
+    uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_DURATION_METRICS);
+
+    for (const auto& pair : mPastBuckets) {
+        const MetricDimensionKey& dimensionKey = pair.first;
+        VLOG("  dimension key %s", dimensionKey.toString().c_str());
+
+        uint64_t wrapperToken =
+                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
+
+        writeDimensionKey(dimensionKey, protoOutput);
         // Then fill bucket_info (DurationBucketInfo).
         for (const auto& bucket : pair.second) {
             uint64_t bucketInfoToken = protoOutput->start(
@@ -581,10 +775,7 @@ void DurationMetricProducer::onDumpReportLocked(
             }
             protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_DURATION, (long long)bucket.mDuration);
 
-            // We only write the condition timer value if the metric has a
-            // condition and isn't sliced by state or condition.
-            // TODO(b/268531762): Slice the condition timer by state and condition
-            if (mConditionTrackerIndex >= 0 && mSlicedStateAtoms.empty() && !mConditionSliced) {
+            if (writeConditionTrueNs) {
                 protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_CONDITION_TRUE_NS,
                                    (long long)bucket.mConditionTrueNs);
             }
@@ -600,6 +791,7 @@ void DurationMetricProducer::onDumpReportLocked(
     protoOutput->end(protoToken);
     if (erase_data) {
         mPastBuckets.clear();
+        mNumPastBuckets = 0;
     }
 }
 
@@ -622,16 +814,26 @@ void DurationMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs
     const auto [globalConditionTrueNs, globalConditionCorrectionNs] =
             mConditionTimer.newBucketStart(eventTimeNs, nextBucketStartTimeNs);
 
+    // The trackers flush into a separate map so the new buckets can be counted as they are moved
+    // to mPastBuckets.
+    unordered_map<MetricDimensionKey, vector<DurationBucket>> flushedBuckets;
+    applyAllConditionChangesLocked();
     for (auto whatIt = mCurrentSlicedDurationTrackerMap.begin();
             whatIt != mCurrentSlicedDurationTrackerMap.end();) {
         if (whatIt->second->flushCurrentBucket(eventTimeNs, mUploadThreshold, globalConditionTrueNs,
-                                               &mPastBuckets)) {
+                                               &flushedBuckets)) {
             VLOG("erase bucket for key %s", whatIt->first.toString().c_str());
+            unindexDurationTrackerLocked(whatIt->first);
             whatIt = mCurrentSlicedDurationTrackerMap.erase(whatIt);
         } else {
             ++whatIt;
         }
     }
+    for (auto& [dimensionKey, buckets] : flushedBuckets) {
+        vector<DurationBucket>& pastBuckets = mPastBuckets[dimensionKey];
+        pastBuckets.insert(pastBuckets.end(), buckets.begin(), buckets.end());
+        mNumPastBuckets += buckets.size();
+    }
 
     StatsdStats::getInstance().noteBucketCount(mMetricId);
     mCurrentBucketStartTimeNs = nextBucketStartTimeNs;
@@ -680,17 +882,22 @@ bool DurationMetricProducer::hitGuardRailLocked(const MetricDimensionKey& newKey
 void DurationMetricProducer::handleStartEvent(const MetricDimensionKey& eventKey,
                                               const ConditionKey& conditionKeys, bool condition,
                                               const int64_t eventTimeNs,
-                                              const vector<FieldValue>& eventValues) {
+                                              std::span<const FieldValue> eventValues) {
     const auto& whatKey = eventKey.getDimensionKeyInWhat();
     auto whatIt = mCurrentSlicedDurationTrackerMap.find(whatKey);
     if (whatIt == mCurrentSlicedDurationTrackerMap.end()) {
         if (hitGuardRailLocked(eventKey)) {
             return;
         }
-        mCurrentSlicedDurationTrackerMap[whatKey] = createDurationTracker(eventKey);
+        unique_ptr<DurationTracker> tracker =
+                createDurationTracker(internDimensionKeyLocked(eventKey));
+        tracker->setConditionEpoch(mFirstConditionEpoch + mConditionChanges.size());
+        mCurrentSlicedDurationTrackerMap[internDimensionKeyLocked(whatKey)] = std::move(tracker);
+        indexDurationTrackerLocked(whatKey);
     }
 
     auto it = mCurrentSlicedDurationTrackerMap.find(whatKey);
+    applyConditionChangesLocked(*it->second);
     if (mUseWhatDimensionAsInternalDimension) {
         it->second->noteStart(whatKey, condition, eventTimeNs, conditionKeys, mDimensionHardLimit);
         return;
@@ -721,7 +928,7 @@ void DurationMetricProducer::onMatchedLogEventLocked(const size_t matcherIndex,
 }
 
 void DurationMetricProducer::handleMatchedLogEventValuesLocked(const size_t matcherIndex,
-                                                               const vector<FieldValue>& values,
+                                                               std::span<const FieldValue> values,
                                                                const int64_t eventTimeNs) {
     if (eventTimeNs < mTimeBaseNs) {
         return;
@@ -733,11 +940,13 @@ void DurationMetricProducer::handleMatchedLogEventValuesLocked(const size_t matc
 
     // Handles Stopall events.
     if ((int)matcherIndex == mStopAllIndex) {
+        applyAllConditionChangesLocked();
         for (auto whatIt = mCurrentSlicedDurationTrackerMap.begin();
              whatIt != mCurrentSlicedDurationTrackerMap.end();) {
             whatIt->second->noteStopAll(eventTimeNs);
             if (!whatIt->second->hasAccumulatedDuration()) {
                 VLOG("erase bucket for key %s", whatIt->first.toString().c_str());
+                unindexDurationTrackerLocked(whatIt->first);
                 whatIt = mCurrentSlicedDurationTrackerMap.erase(whatIt);
             } else {
                 whatIt++;
@@ -794,9 +1003,11 @@ void DurationMetricProducer::handleMatchedLogEventValuesLocked(const size_t matc
         if (mUseWhatDimensionAsInternalDimension) {
             auto whatIt = mCurrentSlicedDurationTrackerMap.find(dimensionInWhat);
             if (whatIt != mCurrentSlicedDurationTrackerMap.end()) {
+                applyConditionChangesLocked(*whatIt->second);
                 whatIt->second->noteStop(dimensionInWhat, eventTimeNs, false);
                 if (!whatIt->second->hasAccumulatedDuration()) {
                     VLOG("erase bucket for key %s", whatIt->first.toString().c_str());
+                    unindexDurationTrackerLocked(whatIt->first);
                     mCurrentSlicedDurationTrackerMap.erase(whatIt);
                 }
             }
@@ -810,9 +1021,11 @@ void DurationMetricProducer::handleMatchedLogEventValuesLocked(const size_t matc
 
         auto whatIt = mCurrentSlicedDurationTrackerMap.find(dimensionInWhat);
         if (whatIt != mCurrentSlicedDurationTrackerMap.end()) {
+            applyConditionChangesLocked(*whatIt->second);
             whatIt->second->noteStop(internalDimensionKey, eventTimeNs, false);
             if (!whatIt->second->hasAccumulatedDuration()) {
                 VLOG("erase bucket for key %s", whatIt->first.toString().c_str());
+                unindexDurationTrackerLocked(whatIt->first);
                 mCurrentSlicedDurationTrackerMap.erase(whatIt);
             }
         }
@@ -841,10 +1054,25 @@ void DurationMetricProducer::handleMatchedLogEventValuesLocked(const size_t matc
                      eventTimeNs, values);
 }
 
+size_t DurationMetricProducer::getCurrentDimensionCountLocked() const {
+    return mCurrentSlicedDurationTrackerMap.size();
+}
+
+void DurationMetricProducer::reserveDimensionsLocked(const size_t dimensionCount) {
+    // The trackers outlive the buckets, only the past buckets start over after each dump.
+    mCurrentSlicedDurationTrackerMap.reserve(dimensionCount);
+    mPastBuckets.reserve(dimensionCount);
+}
+
 size_t DurationMetricProducer::byteSizeLocked() const {
-    size_t totalSize = 0;
-    for (const auto& pair : mPastBuckets) {
-        totalSize += pair.second.size() * kBucketSize;
+    return mNumPastBuckets * kBucketSize;
+}
+
+size_t DurationMetricProducer::currentBucketByteSizeLocked() const {
+    size_t totalSize = estimateMapByteSize(mCurrentSlicedDurationTrackerMap) +
+                       mConditionChanges.capacity() * sizeof(ConditionChange);
+    for (const auto& [_, tracker] : mCurrentSlicedDurationTrackerMap) {
+        totalSize += tracker->byteSize();
     }
     return totalSize;
 }
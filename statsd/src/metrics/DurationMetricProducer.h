@@ -63,11 +63,21 @@ public:
                         const HashableDimensionKey& primaryKey, const FieldValue& oldState,
                         const FieldValue& newState) override;
 
+    // Flushes once for all the changes of the event.
+    void onStateChanges(const int64_t eventTimeNs, const int32_t atomId,
+                        const std::vector<StateChange>& changes) override;
+
     MetricType getMetricType() const override {
         return METRIC_TYPE_DURATION;
     }
 
 protected:
+    bool addFieldsInUseLocked(AtomFieldMasks* fieldMasks) const override {
+        MetricProducer::addFieldsInUseLocked(fieldMasks);
+        addTopLevelFields(mInternalDimensions, fieldMasks);
+        return false;
+    }
+
     void onMatchedLogEventLocked(const size_t matcherIndex, const LogEvent& event) override;
 
     void onMatchedLogEventInternalLocked(
@@ -79,12 +89,17 @@ private:
     // Initializes true dimensions of the 'what' predicate. Only to be called during initialization.
     void initTrueDimensions(const int whatIndex, const int64_t startTimeNs);
 
+    // Notifies the duration trackers linked to the primary key of its new state.
+    void notifyTrackersOfStateChange(const int64_t eventTimeNs, const int32_t atomId,
+                                     const HashableDimensionKey& primaryKey,
+                                     const FieldValue& newState);
+
     void handleMatchedLogEventValuesLocked(const size_t matcherIndex,
-                                           const std::vector<FieldValue>& values,
+                                           std::span<const FieldValue> values,
                                            const int64_t eventTimeNs);
     void handleStartEvent(const MetricDimensionKey& eventKey, const ConditionKey& conditionKeys,
                           bool condition, const int64_t eventTimeNs,
-                          const vector<FieldValue>& eventValues);
+                          std::span<const FieldValue> eventValues);
 
     void onDumpReportLocked(const int64_t dumpTimeNs,
                             const bool include_current_partial_bucket,
@@ -108,9 +123,38 @@ private:
 
     void onSlicedConditionMayChangeLocked_opt1(const int64_t eventTime);
 
+    // Returns false if the change can't be routed to the trackers it affects.
+    bool onSlicedConditionMayChangeLocked_opt2(const int64_t eventTimeNs);
+
+    // The key of the tracker for [whatKey] in mLinkedWhatKeys.
+    HashableDimensionKey getRoutedLinkedDimensionLocked(const HashableDimensionKey& whatKey) const;
+
+    // Keep mLinkedWhatKeys in sync with mCurrentSlicedDurationTrackerMap.
+    void indexDurationTrackerLocked(const HashableDimensionKey& whatKey);
+
+    void unindexDurationTrackerLocked(const HashableDimensionKey& whatKey);
+
+    // Passes a change of the unsliced condition on to the trackers. Without anomaly trackers, the
+    // change is only added to mConditionChanges, and each tracker applies it when next used.
+    void onUnslicedConditionChangedLocked(const bool condition, const int64_t eventTimeNs);
+
+    // Applies the pending condition changes to tracker, before it is used.
+    void applyConditionChangesLocked(DurationTracker& tracker) {
+        tracker.applyConditionChanges(mConditionChanges, mFirstConditionEpoch);
+    }
+
+    // Applies the pending condition changes to all the trackers, and drops them.
+    void applyAllConditionChangesLocked();
+
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
+    size_t currentBucketByteSizeLocked() const override;
+
+    size_t getCurrentDimensionCountLocked() const override;
+
+    void reserveDimensionsLocked(const size_t dimensionCount) override;
+
     void dumpStatesLocked(int out, bool verbose) const override;
 
     void dropDataLocked(const int64_t dropTimeNs) override;
@@ -165,15 +209,35 @@ private:
     // Caches the current unsliced part condition.
     ConditionState mUnSlicedPartCondition;
 
+    // Index in mMetric2ConditionLinks of the link that routes sliced condition changes to the
+    // trackers they affect, or -1 if every tracker checks its condition on each change.
+    int mRoutedConditionLinkIndex;
+
+    // The what keys of the duration trackers, by the condition dimension their routed link reads.
+    // Trackers whose what key lacks some linked field are under DEFAULT_DIMENSION_KEY.
+    std::unordered_map<HashableDimensionKey, std::vector<HashableDimensionKey>> mLinkedWhatKeys;
+
     // Save the past buckets and we can clear when the StatsLogReport is dumped.
     std::unordered_map<MetricDimensionKey, std::vector<DurationBucket>> mPastBuckets;
 
+    // Number of buckets in mPastBuckets, kept up to date so byteSizeLocked() does not have to
+    // walk them.
+    size_t mNumPastBuckets = 0;
+
     // The duration trackers in the current bucket.
     std::unordered_map<HashableDimensionKey, std::unique_ptr<DurationTracker>>
             mCurrentSlicedDurationTrackerMap;
 
     const size_t mDimensionHardLimit;
 
+    // The unsliced condition changes that some trackers may not have applied yet. The epoch of a
+    // change is its index in the metric's changes, mFirstConditionEpoch being the first one kept.
+    std::vector<ConditionChange> mConditionChanges;
+    size_t mFirstConditionEpoch = 0;
+
+    // Above this number of pending changes, all the trackers apply them.
+    static const size_t kMaxPendingConditionChanges = 1000;
+
     // Helper function to create a duration tracker given the metric aggregation type.
     std::unique_ptr<DurationTracker> createDurationTracker(
             const MetricDimensionKey& eventKey) const;
@@ -184,9 +248,11 @@ private:
     static const size_t kBucketSize = sizeof(DurationBucket{});
 
     FRIEND_TEST(DurationMetricTrackerTest, TestNoCondition);
+    FRIEND_TEST(DurationMetricTrackerTest, TestByteSize);
     FRIEND_TEST(DurationMetricTrackerTest, TestNonSlicedCondition);
     FRIEND_TEST(DurationMetricTrackerTest, TestNonSlicedConditionUnknownState);
     FRIEND_TEST(DurationMetricTrackerTest, TestFirstBucket);
+    FRIEND_TEST(DurationMetricTrackerTest, TestNonSlicedConditionChangesAppliedLazily);
 
     FRIEND_TEST(DurationMetricProducerTest, TestSumDurationAppUpgradeSplitDisabled);
     FRIEND_TEST(DurationMetricProducerTest, TestClearCurrentSlicedTrackerMapWhenStop);
@@ -202,6 +268,8 @@ private:
     FRIEND_TEST(MetricsManagerUtilDimLimitTest, TestDimLimit);
 
     FRIEND_TEST(ConfigUpdateDimLimitTest, TestDimLimit);
+
+    FRIEND_TEST(DurationMetricE2eTest, TestWithPartialLinkToCombinationCondition);
 };
 
 }  // namespace statsd
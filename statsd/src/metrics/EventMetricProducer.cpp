@@ -134,8 +134,7 @@ optional<InvalidConfigReason> EventMetricProducer::onConfigUpdatedLocked(
 }
 
 void EventMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
-    mAggregatedAtoms.clear();
-    mTotalSize = 0;
+    clearPastBucketsLocked(dropTimeNs);
     StatsdStats::getInstance().noteBucketDropped(mMetricId);
 }
 
@@ -143,25 +142,25 @@ void EventMetricProducer::onSlicedConditionMayChangeLocked(bool overallCondition
                                                            const int64_t eventTime) {
 }
 
-std::unique_ptr<std::vector<uint8_t>> serializeProtoLocked(ProtoOutputStream& protoOutput) {
-    size_t bufferSize = protoOutput.size();
-
-    std::unique_ptr<std::vector<uint8_t>> buffer(new std::vector<uint8_t>(bufferSize));
+void EventMetricProducer::encodeAtomLocked(const LogEvent& event) {
+    mEncodingProto.clear();
+    writeFieldValueTreeToStream(event.GetTagId(), event.getValues(), &mEncodingProto);
 
+    mEncodedAtomBuffer.resize(mEncodingProto.size());
     size_t pos = 0;
-    sp<android::util::ProtoReader> reader = protoOutput.data();
+    sp<android::util::ProtoReader> reader = mEncodingProto.data();
     while (reader->readBuffer() != NULL) {
         size_t toRead = reader->currentToRead();
-        std::memcpy(&((*buffer)[pos]), reader->readBuffer(), toRead);
+        std::memcpy(&mEncodedAtomBuffer[pos], reader->readBuffer(), toRead);
         pos += toRead;
         reader->move(toRead);
     }
-
-    return buffer;
 }
 
 void EventMetricProducer::clearPastBucketsLocked(const int64_t dumpTimeNs) {
     mAggregatedAtoms.clear();
+    mAggregatedAtomIndices.clear();
+    mAtomArena.clear();
     mTotalSize = 0;
 }
 
@@ -174,17 +173,16 @@ void EventMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
     protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_ID, (long long)mMetricId);
     protoOutput->write(FIELD_TYPE_BOOL | FIELD_ID_IS_ACTIVE, isActiveLocked());
     uint64_t protoToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_EVENT_METRICS);
-    for (const auto& [atomDimensionKey, elapsedTimestampsNs] : mAggregatedAtoms) {
+    for (const auto& [encodedAtom, elapsedTimestampsNs] : mAggregatedAtoms) {
         uint64_t wrapperToken =
                 protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
 
         uint64_t aggregatedToken =
                 protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_AGGREGATED_ATOM);
 
-        uint64_t atomToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM);
-        writeFieldValueTreeToStream(atomDimensionKey.getAtomTag(),
-                                    atomDimensionKey.getAtomFieldValues().getValues(), protoOutput);
-        protoOutput->end(atomToken);
+        // The atom was encoded when it was first logged.
+        protoOutput->write(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM,
+                           reinterpret_cast<const char*>(encodedAtom.data()), encodedAtom.size());
         for (int64_t timestampNs : elapsedTimestampsNs) {
             protoOutput->write(FIELD_TYPE_INT64 | FIELD_COUNT_REPEATED | FIELD_ID_ATOM_TIMESTAMPS,
                                (long long)timestampNs);
@@ -194,8 +192,7 @@ void EventMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
     }
     protoOutput->end(protoToken);
     if (erase_data) {
-        mAggregatedAtoms.clear();
-        mTotalSize = 0;
+        clearPastBucketsLocked(dumpTimeNs);
     }
 }
 
@@ -218,13 +215,22 @@ void EventMetricProducer::onMatchedLogEventInternalLocked(
     }
 
     const int64_t elapsedTimeNs = truncateTimestampIfNecessary(event);
-    AtomDimensionKey key(event.GetTagId(), HashableDimensionKey(event.getValues()));
-
-    std::vector<int64_t>& aggregatedTimestampsNs = mAggregatedAtoms[key];
-    if (aggregatedTimestampsNs.empty()) {
-        mTotalSize += getSize(key.getAtomFieldValues().getValues());
+    encodeAtomLocked(event);
+
+    const std::string_view encodedAtom(reinterpret_cast<const char*>(mEncodedAtomBuffer.data()),
+                                       mEncodedAtomBuffer.size());
+    const auto it = mAggregatedAtomIndices.find(encodedAtom);
+    if (it != mAggregatedAtomIndices.end()) {
+        mAggregatedAtoms[it->second].elapsedTimestampsNs.push_back(elapsedTimeNs);
+    } else {
+        const std::span<const uint8_t> storedAtom = mAtomArena.copy(mEncodedAtomBuffer);
+        mAggregatedAtomIndices.emplace(
+                std::string_view(reinterpret_cast<const char*>(storedAtom.data()),
+                                 storedAtom.size()),
+                mAggregatedAtoms.size());
+        mAggregatedAtoms.push_back({storedAtom, {elapsedTimeNs}});
+        mTotalSize += storedAtom.size();
     }
-    aggregatedTimestampsNs.push_back(elapsedTimeNs);
     mTotalSize += sizeof(int64_t); // Add the size of the event timestamp
 }
 
@@ -17,6 +17,8 @@
 #ifndef EVENT_METRIC_PRODUCER_H
 #define EVENT_METRIC_PRODUCER_H
 
+#include <span>
+#include <string_view>
 #include <unordered_map>
 
 #include <android/util/ProtoOutputStream.h>
@@ -27,6 +29,7 @@
 #include "MetricProducer.h"
 #include "src/statsd_config.pb.h"
 #include "stats_util.h"
+#include "utils/PageArena.h"
 
 namespace android {
 namespace os {
@@ -51,6 +54,27 @@ public:
     }
 
 protected:
+    bool addFieldsInUseLocked(AtomFieldMasks* fieldMasks) const override {
+        MetricProducer::addFieldsInUseLocked(fieldMasks);
+        return true;
+    }
+
+    optional<InvalidConfigReason> onConfigUpdatedLocked(
+            const StatsdConfig& config, const int configIndex, const int metricIndex,
+            const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+            const std::unordered_map<int64_t, int>& oldAtomMatchingTrackerMap,
+            const std::unordered_map<int64_t, int>& newAtomMatchingTrackerMap,
+            const sp<EventMatcherWizard>& matcherWizard,
+            const std::vector<sp<ConditionTracker>>& allConditionTrackers,
+            const std::unordered_map<int64_t, int>& conditionTrackerMap,
+            const sp<ConditionWizard>& wizard,
+            const std::unordered_map<int64_t, int>& metricToActivationMap,
+            std::unordered_map<int, std::vector<int>>& trackerToMetricMap,
+            std::unordered_map<int, std::vector<int>>& conditionToMetricMap,
+            std::unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
+            std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
+            std::vector<int>& metricsWithActivation) override;
+
     size_t mTotalSize;
 
 private:
@@ -73,22 +97,6 @@ private:
     // Internal interface to handle sliced condition change.
     void onSlicedConditionMayChangeLocked(bool overallCondition, const int64_t eventTime) override;
 
-    optional<InvalidConfigReason> onConfigUpdatedLocked(
-            const StatsdConfig& config, const int configIndex, const int metricIndex,
-            const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
-            const std::unordered_map<int64_t, int>& oldAtomMatchingTrackerMap,
-            const std::unordered_map<int64_t, int>& newAtomMatchingTrackerMap,
-            const sp<EventMatcherWizard>& matcherWizard,
-            const std::vector<sp<ConditionTracker>>& allConditionTrackers,
-            const std::unordered_map<int64_t, int>& conditionTrackerMap,
-            const sp<ConditionWizard>& wizard,
-            const std::unordered_map<int64_t, int>& metricToActivationMap,
-            std::unordered_map<int, std::vector<int>>& trackerToMetricMap,
-            std::unordered_map<int, std::vector<int>>& conditionToMetricMap,
-            std::unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
-            std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
-            std::vector<int>& metricsWithActivation) override;
-
     void dropDataLocked(const int64_t dropTimeNs) override;
 
     // Internal function to calculate the current used bytes.
@@ -96,8 +104,28 @@ private:
 
     void dumpStatesLocked(int out, bool verbose) const override{};
 
-    // Maps the field/value pairs of an atom to a list of timestamps used to deduplicate atoms.
-    std::unordered_map<AtomDimensionKey, std::vector<int64_t>> mAggregatedAtoms;
+    // Encodes the atom of the event as the content of AggregatedAtomInfo.atom into
+    // mEncodedAtomBuffer.
+    void encodeAtomLocked(const LogEvent& event);
+
+    // An atom as it is written to the report, with the timestamps it was logged at.
+    struct AggregatedAtom {
+        // Stored in mAtomArena.
+        std::span<const uint8_t> encodedAtom;
+        std::vector<int64_t> elapsedTimestampsNs;
+    };
+
+    // Distinct atoms in the order they were first logged.
+    std::vector<AggregatedAtom> mAggregatedAtoms;
+
+    // Maps the encoding of an atom to its index in mAggregatedAtoms, to deduplicate atoms.
+    std::unordered_map<std::string_view, size_t> mAggregatedAtomIndices;
+
+    PageArena mAtomArena;
+
+    // Scratch space reused to encode each matched event.
+    android::util::ProtoOutputStream mEncodingProto;
+    std::vector<uint8_t> mEncodedAtomBuffer;
 
     const int mSamplingPercentage;
 };
@@ -64,6 +64,7 @@ const int FIELD_ID_DROP_TIME = 2;
 const int FIELD_ID_DIMENSION_IN_WHAT = 1;
 const int FIELD_ID_BUCKET_INFO = 3;
 const int FIELD_ID_DIMENSION_LEAF_IN_WHAT = 4;
+const int FIELD_ID_DIMENSION_INDEX_IN_WHAT = 8;
 // for GaugeBucketInfo
 const int FIELD_ID_BUCKET_NUM = 6;
 const int FIELD_ID_START_BUCKET_ELAPSED_MILLIS = 7;
@@ -97,6 +98,10 @@ GaugeMetricProducer::GaugeMetricProducer(
       mSamplingType(metric.sampling_type()),
       mMaxPullDelayNs(metric.max_pull_delay_sec() > 0 ? metric.max_pull_delay_sec() * NS_PER_SEC
                                                       : StatsdStats::kPullMaxDelayNs),
+      mTriggerCoalescingWindowNs(metric.trigger_coalescing_window_millis() > 0
+                                         ? metric.trigger_coalescing_window_millis() * 1000000
+                                         : 0),
+      mDeltaPulledAtoms(mIsPulled && metric.delta_pulled_atoms()),
       mDimensionSoftLimit(dimensionSoftLimit),
       mDimensionHardLimit(dimensionHardLimit),
       mGaugeAtomsPerDimensionLimit(metric.max_num_gauge_atoms_per_bucket()),
@@ -238,6 +243,7 @@ void GaugeMetricProducer::dumpStatesLocked(int out, bool verbose) const {
 void GaugeMetricProducer::clearPastBucketsLocked(const int64_t dumpTimeNs) {
     flushIfNeededLocked(dumpTimeNs);
     mPastBuckets.clear();
+    mPastBucketsByteSize = 0;
     mSkippedBuckets.clear();
 }
 
@@ -248,7 +254,8 @@ void GaugeMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                                              std::set<string> *str_set,
                                              ProtoOutputStream* protoOutput) {
     VLOG("Gauge metric %lld report now...", (long long)mMetricId);
-    if (include_current_partial_bucket) {
+    // The current bucket is not snapshotted, only its past buckets are reported.
+    if (include_current_partial_bucket && dumpLatency != SNAPSHOT) {
         flushLocked(dumpTimeNs);
     } else {
         flushIfNeededLocked(dumpTimeNs);
@@ -312,6 +319,9 @@ void GaugeMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                     FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
             writeDimensionToProto(dimensionKey.getDimensionKeyInWhat(), str_set, protoOutput);
             protoOutput->end(dimensionToken);
+        } else if (mDimensionDictionary != nullptr) {
+            mDimensionDictionary->writeIndex(FIELD_ID_DIMENSION_INDEX_IN_WHAT,
+                                             dimensionKey.getDimensionKeyInWhat(), protoOutput);
         } else {
             writeDimensionLeafNodesToProto(dimensionKey.getDimensionKeyInWhat(),
                                            FIELD_ID_DIMENSION_LEAF_IN_WHAT, str_set, protoOutput);
@@ -332,24 +342,21 @@ void GaugeMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
                                    (long long)(getBucketNumFromEndTimeNs(bucket.mBucketEndNs)));
             }
 
-            if (!bucket.mAggregatedAtoms.empty()) {
-                for (const auto& [atomDimensionKey, elapsedTimestampsNs] :
-                     bucket.mAggregatedAtoms) {
-                    uint64_t aggregatedAtomToken = protoOutput->start(
-                            FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_AGGREGATED_ATOM);
-                    uint64_t atomToken =
-                            protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM_VALUE);
-                    writeFieldValueTreeToStream(mAtomId,
-                                                atomDimensionKey.getAtomFieldValues().getValues(),
-                                                protoOutput);
-                    protoOutput->end(atomToken);
-                    for (int64_t timestampNs : elapsedTimestampsNs) {
-                        protoOutput->write(
-                                FIELD_TYPE_INT64 | FIELD_COUNT_REPEATED | FIELD_ID_ATOM_TIMESTAMPS,
-                                (long long)timestampNs);
-                    }
-                    protoOutput->end(aggregatedAtomToken);
+            const AggregatedGaugeAtoms& aggregatedAtoms = bucket.mAggregatedAtoms;
+            for (size_t i = 0; i < aggregatedAtoms.size(); i++) {
+                uint64_t aggregatedAtomToken = protoOutput->start(
+                        FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_AGGREGATED_ATOM);
+                uint64_t atomToken = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM_VALUE);
+                writeFieldValueTreeToStream(mAtomId, aggregatedAtoms.getFields(i),
+                                            aggregatedAtoms.getFieldCount(i), protoOutput);
+                protoOutput->end(atomToken);
+                const int64_t* elapsedTimestampsNs = aggregatedAtoms.getElapsedTimestampsNs(i);
+                for (size_t j = 0; j < aggregatedAtoms.getTimestampCount(i); j++) {
+                    protoOutput->write(
+                            FIELD_TYPE_INT64 | FIELD_COUNT_REPEATED | FIELD_ID_ATOM_TIMESTAMPS,
+                            (long long)elapsedTimestampsNs[j]);
                 }
+                protoOutput->end(aggregatedAtomToken);
             }
 
             protoOutput->end(bucketInfoToken);
@@ -364,6 +371,7 @@ void GaugeMetricProducer::onDumpReportLocked(const int64_t dumpTimeNs,
 
     if (erase_data) {
         mPastBuckets.clear();
+        mPastBucketsByteSize = 0;
         mSkippedBuckets.clear();
         mDimensionGuardrailHit = false;
     }
@@ -375,40 +383,52 @@ void GaugeMetricProducer::prepareFirstBucketLocked() {
     }
 }
 
-// Only call if mCondition == ConditionState::kTrue && metric is active.
-void GaugeMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs) {
-    bool triggerPuller = false;
+bool GaugeMetricProducer::isCurrentBucketFullLocked() const {
+    // Without dimensions in what, all atoms go to the same slice. Otherwise new slices are dropped
+    // once the dimension guardrail is hit.
+    if (mCurrentSlicedBucket->empty() || (!mDimensionsInWhat.empty() && !mHasHitGuardrail)) {
+        return false;
+    }
+    return mFullSliceCount == mCurrentSlicedBucket->size();
+}
+
+bool GaugeMetricProducer::shouldPullLocked() const {
     switch(mSamplingType) {
         // When the metric wants to do random sampling and there is already one gauge atom for the
         // current bucket, do not do it again.
-        case GaugeMetric::RANDOM_ONE_SAMPLE: {
-            triggerPuller = mCurrentSlicedBucket->empty();
-            break;
-        }
+        case GaugeMetric::RANDOM_ONE_SAMPLE:
+            return mCurrentSlicedBucket->empty();
+        // Nothing pulled would be kept once max_num_gauge_atoms_per_bucket is reached.
         case GaugeMetric::CONDITION_CHANGE_TO_TRUE:
-        case GaugeMetric::FIRST_N_SAMPLES: {
-            triggerPuller = true;
-            break;
-        }
+        case GaugeMetric::FIRST_N_SAMPLES:
+            return !isCurrentBucketFullLocked();
         default:
-            break;
-    }
-    if (!triggerPuller) {
-        return;
+            return false;
     }
-    vector<std::shared_ptr<LogEvent>> allData;
-    if (!mPullerManager->Pull(mPullTagId, mConfigKey, timestampNs, &allData)) {
+}
+
+bool GaugeMetricProducer::pullLocked(const int64_t timestampNs,
+                                     vector<std::shared_ptr<LogEvent>>* allData) {
+    if (!mPullerManager->Pull(mPullTagId, mConfigKey, timestampNs, allData)) {
         ALOGE("Gauge Stats puller failed for tag: %d at %lld", mPullTagId, (long long)timestampNs);
-        return;
+        return false;
     }
     const int64_t pullDelayNs = getElapsedRealtimeNs() - timestampNs;
     StatsdStats::getInstance().notePullDelay(mPullTagId, pullDelayNs);
     if (pullDelayNs > mMaxPullDelayNs) {
         ALOGE("Pull finish too late for atom %d", mPullTagId);
         StatsdStats::getInstance().notePullExceedMaxDelay(mPullTagId);
-        return;
+        return false;
     }
+    return true;
+}
+
+void GaugeMetricProducer::matchPulledEventsLocked(
+        const vector<std::shared_ptr<LogEvent>>& allData, const int64_t timestampNs) {
     for (const auto& data : allData) {
+        if (isCurrentBucketFullLocked()) {
+            return;
+        }
         if (mEventMatcherWizard->matchLogEvent(*data, mWhatMatcherIndex) ==
             MatchingState::kMatched) {
             LogEvent localCopy = *data;
@@ -418,6 +438,39 @@ void GaugeMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs) {
     }
 }
 
+// Only call if mCondition == ConditionState::kTrue && metric is active.
+void GaugeMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs) {
+    if (!shouldPullLocked()) {
+        return;
+    }
+    vector<std::shared_ptr<LogEvent>> allData;
+    if (!pullLocked(timestampNs, &allData)) {
+        return;
+    }
+    matchPulledEventsLocked(allData, timestampNs);
+}
+
+void GaugeMetricProducer::pullAndMatchTriggeredEventsLocked(const int64_t triggerTimeNs) {
+    if (mTriggerCoalescingWindowNs == 0) {
+        pullAndMatchEventsLocked(triggerTimeNs);
+        return;
+    }
+    if (!shouldPullLocked()) {
+        return;
+    }
+    if (mCoalescedPullTimeNs == -1 ||
+        triggerTimeNs >= mCoalescedPullTimeNs + mTriggerCoalescingWindowNs) {
+        vector<std::shared_ptr<LogEvent>> allData;
+        if (!pullLocked(triggerTimeNs, &allData)) {
+            return;
+        }
+        mCoalescedPullData = std::move(allData);
+        mCoalescedPullTimeNs = triggerTimeNs;
+    }
+    // The pulled data is attributed to each trigger that shares it.
+    matchPulledEventsLocked(mCoalescedPullData, triggerTimeNs);
+}
+
 void GaugeMetricProducer::onActiveStateChangedLocked(const int64_t eventTimeNs,
                                                      const bool isActive) {
     MetricProducer::onActiveStateChangedLocked(eventTimeNs, isActive);
@@ -468,7 +521,7 @@ std::shared_ptr<vector<FieldValue>> GaugeMetricProducer::getGaugeFields(const Lo
     std::shared_ptr<vector<FieldValue>> gaugeFields;
     if (mFieldMatchers.size() > 0) {
         gaugeFields = std::make_shared<vector<FieldValue>>();
-        filterGaugeValues(mFieldMatchers, event.getValues(), gaugeFields.get());
+        filterGaugeValues(mFieldMatchers, event, gaugeFields.get());
     } else {
         gaugeFields = std::make_shared<vector<FieldValue>>(event.getValues());
     }
@@ -500,12 +553,17 @@ void GaugeMetricProducer::onDataPulled(const std::vector<std::shared_ptr<LogEven
         StatsdStats::getInstance().notePullExceedMaxDelay(mPullTagId);
         return;
     }
+    const int64_t costStartWallNs = getElapsedRealtimeNs();
+    const int64_t costStartCpuNs = getThreadCpuTimeNs();
     for (const auto& data : allData) {
         if (mEventMatcherWizard->matchLogEvent(
                 *data, mWhatMatcherIndex) == MatchingState::kMatched) {
             onMatchedLogEventLocked(mWhatMatcherIndex, *data);
         }
     }
+    StatsdStats::getInstance().notePulledDataProcessingCost(
+            mConfigKey, {mMetricId, getElapsedRealtimeNs() - costStartWallNs,
+                         getThreadCpuTimeNs() - costStartCpuNs});
 }
 
 bool GaugeMetricProducer::hitGuardRailLocked(const MetricDimensionKey& newKey) {
@@ -551,7 +609,7 @@ void GaugeMetricProducer::onMatchedLogEventInternalLocked(
         // Both Active state and Condition are true here.
         // Active state being true is checked in onMatchedLogEventLocked.
         // Condition being true is checked at the start of this method.
-        pullAndMatchEventsLocked(eventTimeNs);
+        pullAndMatchTriggeredEventsLocked(eventTimeNs);
         return;
     }
 
@@ -564,13 +622,27 @@ void GaugeMetricProducer::onMatchedLogEventInternalLocked(
     if (hitGuardRailLocked(eventKey)) {
         return;
     }
-    if ((*mCurrentSlicedBucket)[eventKey].size() >= mGaugeAtomsPerDimensionLimit) {
+    auto sliceIt = mCurrentSlicedBucket->find(eventKey);
+    if (sliceIt == mCurrentSlicedBucket->end()) {
+        sliceIt = mCurrentSlicedBucket
+                          ->emplace(internDimensionKeyLocked(eventKey), vector<GaugeAtom>())
+                          .first;
+    }
+    if (sliceIt->second.size() >= mGaugeAtomsPerDimensionLimit) {
         return;
     }
 
     const int64_t truncatedElapsedTimestampNs = truncateTimestampIfNecessary(event);
-    GaugeAtom gaugeAtom(getGaugeFields(event), truncatedElapsedTimestampNs);
-    (*mCurrentSlicedBucket)[eventKey].push_back(gaugeAtom);
+    std::shared_ptr<vector<FieldValue>> gaugeFields = getGaugeFields(event);
+    if (mDeltaPulledAtoms && !sliceIt->second.empty() &&
+        *sliceIt->second.back().mFields == *gaugeFields) {
+        gaugeFields = sliceIt->second.back().mFields;
+    }
+    GaugeAtom gaugeAtom(std::move(gaugeFields), truncatedElapsedTimestampNs);
+    sliceIt->second.push_back(gaugeAtom);
+    if (sliceIt->second.size() == mGaugeAtomsPerDimensionLimit) {
+        mFullSliceCount++;
+    }
     // Anomaly detection on gauge metric only works when there is one numeric
     // field specified.
     if (mAnomalyTrackers.size() > 0) {
@@ -610,6 +682,7 @@ void GaugeMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
     flushIfNeededLocked(dropTimeNs);
     StatsdStats::getInstance().noteBucketDropped(mMetricId);
     mPastBuckets.clear();
+    mPastBucketsByteSize = 0;
 }
 
 // When a new matched event comes in, we check if event falls into the current
@@ -650,14 +723,10 @@ void GaugeMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
     bool isBucketLargeEnough = info.mBucketEndNs - mCurrentBucketStartTimeNs >= mMinBucketSizeNs;
     if (isBucketLargeEnough) {
         for (const auto& slice : *mCurrentSlicedBucket) {
-            info.mAggregatedAtoms.clear();
-            for (const GaugeAtom& atom : slice.second) {
-                AtomDimensionKey key(mAtomId, HashableDimensionKey(*atom.mFields));
-                vector<int64_t>& elapsedTimestampsNs = info.mAggregatedAtoms[key];
-                elapsedTimestampsNs.push_back(atom.mElapsedTimestampNs);
-            }
             auto& bucketList = mPastBuckets[slice.first];
             bucketList.push_back(info);
+            bucketList.back().mAggregatedAtoms.build(slice.second);
+            mPastBucketsByteSize += bucketList.back().mAggregatedAtoms.byteSize();
             VLOG("Gauge gauge metric %lld, dump key value: %s", (long long)mMetricId,
                  slice.first.toString().c_str());
         }
@@ -685,24 +754,47 @@ void GaugeMetricProducer::flushCurrentBucketLocked(const int64_t& eventTimeNs,
     }
 
     StatsdStats::getInstance().noteBucketCount(mMetricId);
+    mLastBucketDimensionCount = mCurrentSlicedBucket->size();
     mCurrentSlicedBucket = std::make_shared<DimToGaugeAtomsMap>();
+    mCurrentSlicedBucket->reserve(mLastBucketDimensionCount);
+    mFullSliceCount = 0;
     mCurrentBucketStartTimeNs = nextBucketStartTimeNs;
     mCurrentSkippedBucket.reset();
+    // Triggers of the next bucket do not share pulls of this one.
+    mCoalescedPullData.clear();
+    mCoalescedPullTimeNs = -1;
     // Reset mHasHitGuardrail boolean since bucket was reset
     mHasHitGuardrail = false;
 }
 
+size_t GaugeMetricProducer::getCurrentDimensionCountLocked() const {
+    return mCurrentSlicedBucket->size();
+}
+
+void GaugeMetricProducer::reserveDimensionsLocked(const size_t dimensionCount) {
+    mCurrentSlicedBucket->reserve(dimensionCount);
+    mPastBuckets.reserve(dimensionCount);
+}
+
 size_t GaugeMetricProducer::byteSizeLocked() const {
-    size_t totalSize = 0;
-    for (const auto& pair : mPastBuckets) {
-        for (const auto& bucket : pair.second) {
-            for (const auto& [atomDimensionKey, elapsedTimestampsNs] : bucket.mAggregatedAtoms) {
-                totalSize += sizeof(FieldValue) *
-                             atomDimensionKey.getAtomFieldValues().getValues().size();
-                totalSize += sizeof(int64_t) * elapsedTimestampsNs.size();
+    return mPastBucketsByteSize;
+}
+
+size_t GaugeMetricProducer::currentBucketByteSizeLocked() const {
+    size_t totalSize = estimateMapByteSize(*mCurrentSlicedBucket);
+    for (const auto& [_, atoms] : *mCurrentSlicedBucket) {
+        totalSize += sizeof(GaugeAtom) * atoms.capacity();
+        for (size_t i = 0; i < atoms.size(); i++) {
+            // Fields shared with the previous atom are only counted once.
+            if (atoms[i].mFields != nullptr &&
+                (i == 0 || atoms[i].mFields != atoms[i - 1].mFields)) {
+                totalSize += sizeof(FieldValue) * atoms[i].mFields->capacity();
             }
         }
     }
+    if (mCurrentSlicedBucketForAnomaly != nullptr) {
+        totalSize += estimateMapByteSize(*mCurrentSlicedBucketForAnomaly);
+    }
     return totalSize;
 }
 
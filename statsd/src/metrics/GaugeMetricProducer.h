@@ -25,6 +25,7 @@
 #include "../external/StatsPullerManager.h"
 #include "../matchers/matcher_util.h"
 #include "../matchers/EventMatcherWizard.h"
+#include "AggregatedGaugeAtoms.h"
 #include "MetricProducer.h"
 #include "src/statsd_config.pb.h"
 #include "../stats_util.h"
@@ -33,21 +34,12 @@ namespace android {
 namespace os {
 namespace statsd {
 
-struct GaugeAtom {
-    GaugeAtom(std::shared_ptr<vector<FieldValue>> fields, int64_t elapsedTimeNs)
-        : mFields(fields), mElapsedTimestampNs(elapsedTimeNs) {
-    }
-    std::shared_ptr<vector<FieldValue>> mFields;
-    int64_t mElapsedTimestampNs;
-};
-
 struct GaugeBucket {
     int64_t mBucketStartNs;
     int64_t mBucketEndNs;
-    std::vector<GaugeAtom> mGaugeAtoms;
 
-    // Maps the field/value pairs of an atom to a list of timestamps used to deduplicate atoms.
-    std::unordered_map<AtomDimensionKey, std::vector<int64_t>> mAggregatedAtoms;
+    // The deduplicated atoms of the bucket, with the timestamps of each.
+    AggregatedGaugeAtoms mAggregatedAtoms;
 };
 
 typedef std::unordered_map<MetricDimensionKey, std::vector<GaugeAtom>>
@@ -108,6 +100,13 @@ public:
     }
 
 protected:
+    bool addFieldsInUseLocked(AtomFieldMasks* fieldMasks) const override {
+        MetricProducer::addFieldsInUseLocked(fieldMasks);
+        addTopLevelFields(mFieldMatchers, fieldMasks);
+        // Without a fields filter the gauge metric keeps every field.
+        return mFieldMatchers.empty();
+    }
+
     void onMatchedLogEventInternalLocked(
             const size_t matcherIndex, const MetricDimensionKey& eventKey,
             const ConditionKey& conditionKey, bool condition, const LogEvent& event,
@@ -134,6 +133,12 @@ private:
     // Internal function to calculate the current used bytes.
     size_t byteSizeLocked() const override;
 
+    size_t currentBucketByteSizeLocked() const override;
+
+    size_t getCurrentDimensionCountLocked() const override;
+
+    void reserveDimensionsLocked(const size_t dimensionCount) override;
+
     void dumpStatesLocked(int out, bool verbose) const override;
 
     void dropDataLocked(const int64_t dropTimeNs) override;
@@ -149,6 +154,23 @@ private:
     // Only call if mCondition == ConditionState::kTrue && metric is active.
     void pullAndMatchEventsLocked(const int64_t timestampNs);
 
+    // Same as pullAndMatchEventsLocked, for a trigger event. Shares the pulled data of an earlier
+    // trigger within mTriggerCoalescingWindowNs.
+    void pullAndMatchTriggeredEventsLocked(const int64_t triggerTimeNs);
+
+    // Whether a pull now could add gauge atoms to the current bucket.
+    bool shouldPullLocked() const;
+
+    // Returns false if the pull failed or finished too late.
+    bool pullLocked(const int64_t timestampNs, std::vector<std::shared_ptr<LogEvent>>* allData);
+
+    // Adds the pulled events that match the metric, with the given timestamp.
+    void matchPulledEventsLocked(const std::vector<std::shared_ptr<LogEvent>>& allData,
+                                 const int64_t timestampNs);
+
+    // Whether max_num_gauge_atoms_per_bucket is reached for every slice that new atoms can go to.
+    bool isCurrentBucketFullLocked() const;
+
     optional<InvalidConfigReason> onConfigUpdatedLocked(
             const StatsdConfig& config, const int configIndex, const int metricIndex,
             const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
@@ -190,6 +212,10 @@ private:
     // Save the past buckets and we can clear when the StatsLogReport is dumped.
     std::unordered_map<MetricDimensionKey, std::vector<GaugeBucket>> mPastBuckets;
 
+    // Sum of the byte sizes of the atoms in mPastBuckets, kept up to date so byteSizeLocked()
+    // does not have to walk the buckets.
+    size_t mPastBucketsByteSize = 0;
+
     // The current partial bucket.
     std::shared_ptr<DimToGaugeAtomsMap> mCurrentSlicedBucket;
 
@@ -210,6 +236,19 @@ private:
 
     const int64_t mMaxPullDelayNs;
 
+    // 0 if trigger events do not share pulls.
+    const int64_t mTriggerCoalescingWindowNs;
+
+    // Data of the last pull of a trigger event in the current bucket, shared by the trigger events
+    // within mTriggerCoalescingWindowNs of it.
+    std::vector<std::shared_ptr<LogEvent>> mCoalescedPullData;
+
+    // Time of the pull of mCoalescedPullData. -1 if there is none.
+    int64_t mCoalescedPullTimeNs = -1;
+
+    // Whether a pulled atom equal to the previous atom of its dimension shares its fields.
+    const bool mDeltaPulledAtoms;
+
     // apply an allowlist on the original input
     std::shared_ptr<vector<FieldValue>> getGaugeFields(const LogEvent& event);
 
@@ -224,6 +263,9 @@ private:
 
     const size_t mGaugeAtomsPerDimensionLimit;
 
+    // Number of slices of mCurrentSlicedBucket with mGaugeAtomsPerDimensionLimit atoms.
+    size_t mFullSliceCount = 0;
+
     // Tracks if the dimension guardrail has been hit in the current report.
     bool mDimensionGuardrailHit;
 
@@ -234,7 +276,10 @@ private:
     FRIEND_TEST(GaugeMetricProducerTest, TestPulledEventsAnomalyDetection);
     FRIEND_TEST(GaugeMetricProducerTest, TestFirstBucket);
     FRIEND_TEST(GaugeMetricProducerTest, TestPullOnTrigger);
+    FRIEND_TEST(GaugeMetricProducerTest, TestCoalescedPullOnTrigger);
+    FRIEND_TEST(GaugeMetricProducerTest, TestNoPullOnTriggerWhenBucketFull);
     FRIEND_TEST(GaugeMetricProducerTest, TestPullNWithoutTrigger);
+    FRIEND_TEST(GaugeMetricProducerTest, TestDeltaPulledAtoms);
     FRIEND_TEST(GaugeMetricProducerTest, TestRemoveDimensionInOutput);
     FRIEND_TEST(GaugeMetricProducerTest, TestPullDimensionalSampling);
 
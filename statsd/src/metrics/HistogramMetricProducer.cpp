@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "HistogramMetricProducer.h"
+
+#include "guardrail/StatsdStats.h"
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_INT32;
+using android::util::FIELD_TYPE_INT64;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::nullopt;
+using std::optional;
+using std::string;
+using std::vector;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// for StatsLogReport
+const int FIELD_ID_VALUE_METRICS = 7;
+// for ValueBucketInfo
+const int FIELD_ID_VALUE_INDEX = 1;
+const int FIELD_ID_VALUE_SAMPLESIZE = 4;
+const int FIELD_ID_VALUE_HISTOGRAM_BIN_COUNTS = 6;
+const int FIELD_ID_VALUES = 9;
+const int FIELD_ID_BUCKET_NUM = 4;
+const int FIELD_ID_START_BUCKET_ELAPSED_MILLIS = 5;
+const int FIELD_ID_END_BUCKET_ELAPSED_MILLIS = 6;
+const int FIELD_ID_CONDITION_TRUE_NS = 10;
+
+optional<HistogramBins> createHistogramBins(const HistogramBinConfig& config) {
+    switch (config.binning_strategy_case()) {
+        case HistogramBinConfig::kGeneratedBins: {
+            const HistogramBinConfig::GeneratedBins& bins = config.generated_bins();
+            switch (bins.strategy()) {
+                case HistogramBinConfig::GeneratedBins::LINEAR:
+                    return HistogramBins::createLinear(bins.min(), bins.max(), bins.count());
+                case HistogramBinConfig::GeneratedBins::EXPONENTIAL:
+                    return HistogramBins::createExponential(bins.min(), bins.max(), bins.count());
+                default:
+                    return nullopt;
+            }
+        }
+        case HistogramBinConfig::kExplicitBins:
+            return HistogramBins::create(vector<double>(config.explicit_bins().bin().begin(),
+                                                        config.explicit_bins().bin().end()));
+        default:
+            return nullopt;
+    }
+}
+
+HistogramMetricProducer::HistogramMetricProducer(
+        const ConfigKey& key, const ValueMetric& metric, const uint64_t protoHash,
+        const PullOptions& pullOptions, const BucketOptions& bucketOptions,
+        const WhatOptions& whatOptions, const ConditionOptions& conditionOptions,
+        const StateOptions& stateOptions, const ActivationOptions& activationOptions,
+        const GuardrailOptions& guardrailOptions, HistogramBins bins)
+    : ValueMetricProducer(metric.id(), key, protoHash, pullOptions, bucketOptions, whatOptions,
+                          conditionOptions, stateOptions, activationOptions, guardrailOptions),
+      mIncludeSampleSize(metric.include_sample_size()),
+      mBins(std::move(bins)) {
+}
+
+HistogramMetricProducer::DumpProtoFields HistogramMetricProducer::getDumpProtoFields() const {
+    return {FIELD_ID_VALUE_METRICS,
+            FIELD_ID_BUCKET_NUM,
+            FIELD_ID_START_BUCKET_ELAPSED_MILLIS,
+            FIELD_ID_END_BUCKET_ELAPSED_MILLIS,
+            FIELD_ID_CONDITION_TRUE_NS,
+            /*conditionCorrectionNsFieldId=*/nullopt};
+}
+
+string HistogramMetricProducer::aggregatedValueToString(const vector<int64_t>& aggregate) const {
+    string result = "[";
+    for (size_t i = 0; i < aggregate.size(); i++) {
+        result += (i == 0 ? "" : ", ") + std::to_string(aggregate[i]);
+    }
+    return result + "]";
+}
+
+void HistogramMetricProducer::writePastBucketAggregateToProto(
+        const int aggIndex, const vector<int64_t>& counts, const int sampleSize,
+        ProtoOutputStream* const protoOutput) const {
+    uint64_t valueToken =
+            protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_VALUES);
+    protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_VALUE_INDEX, aggIndex);
+    if (mIncludeSampleSize) {
+        protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_VALUE_SAMPLESIZE, sampleSize);
+    }
+    for (const int64_t count : counts) {
+        protoOutput->write(
+                FIELD_TYPE_INT64 | FIELD_COUNT_REPEATED | FIELD_ID_VALUE_HISTOGRAM_BIN_COUNTS,
+                (long long)count);
+    }
+    VLOG("\t\t value %d: %s", aggIndex, aggregatedValueToString(counts).c_str());
+    protoOutput->end(valueToken);
+}
+
+bool HistogramMetricProducer::aggregateFields(const int64_t eventTimeNs,
+                                              const MetricDimensionKey& eventKey,
+                                              const LogEvent& event, const Intervals& intervals,
+                                              Empty& empty) {
+    bool seenNewData = false;
+    for (size_t i = 0; i < mFieldMatchers.size(); i++) {
+        const Matcher& matcher = mFieldMatchers[i];
+        Interval& interval = intervals[i];
+        interval.aggIndex = i;
+        optional<double> value;
+        for (const FieldValue& fieldValue : event.getValues()) {
+            if (fieldValue.mField.matches(matcher)) {
+                const Type type = fieldValue.mValue.getType();
+                if (type == INT || type == LONG || type == FLOAT || type == DOUBLE) {
+                    value = fieldValue.mValue.getDouble();
+                }
+                break;
+            }
+        }
+        if (!value) {
+            VLOG("Failed to get value %zu from event %s", i, event.ToString().c_str());
+            StatsdStats::getInstance().noteBadValueType(mMetricId);
+            return seenNewData;
+        }
+
+        // The counts are empty until the first value of the bucket, and again once they are given
+        // to a PastBucket. Counts left by a bucket that was not reported are dropped too.
+        if (!interval.hasValue()) {
+            interval.aggregate.assign(mBins.getBinCount(), 0);
+        }
+        seenNewData = true;
+        interval.aggregate[mBins.getBinIndex(*value)]++;
+        interval.sampleSize += 1;
+    }
+    return seenNewData;
+}
+
+PastBucket<vector<int64_t>> HistogramMetricProducer::buildPartialBucket(
+        int64_t bucketEndTimeNs, const Intervals& intervals) {
+    PastBucket<vector<int64_t>> bucket;
+    bucket.mBucketStartNs = mCurrentBucketStartTimeNs;
+    bucket.mBucketEndNs = bucketEndTimeNs;
+    for (Interval& interval : intervals) {
+        if (interval.hasValue()) {
+            bucket.aggIndex.push_back(interval.aggIndex);
+            bucket.aggregates.push_back(std::move(interval.aggregate));
+            if (mIncludeSampleSize) {
+                bucket.sampleSizes.push_back(interval.sampleSize);
+            }
+        }
+    }
+    return bucket;
+}
+
+size_t HistogramMetricProducer::pastBucketByteSize(
+        const PastBucket<vector<int64_t>>& bucket) const {
+    size_t totalSize = kBucketSize + bucket.aggIndex.size() * sizeof(int);
+    for (const vector<int64_t>& counts : bucket.aggregates) {
+        totalSize += counts.size() * sizeof(int64_t);
+    }
+    return totalSize;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
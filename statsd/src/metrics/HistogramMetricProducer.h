@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+#include <gtest/gtest_prod.h>
+
+#include <optional>
+#include <vector>
+
+#include "MetricProducer.h"
+#include "ValueMetricProducer.h"
+#include "src/statsd_config.pb.h"
+#include "stats_log_util.h"
+#include "utils/HistogramBins.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Returns the bins of config, or nullopt if it describes no valid bins.
+std::optional<HistogramBins> createHistogramBins(const HistogramBinConfig& config);
+
+// Counts the values of a ValueMetric with the HISTOGRAM aggregation type in fixed bins. Each
+// dimension keeps a dense array of bin counts per value field and bucket, which is reported as
+// is.
+//
+// Like KllMetricProducer, only pushed atoms are supported.
+class HistogramMetricProducer : public ValueMetricProducer<std::vector<int64_t>, Empty> {
+public:
+    HistogramMetricProducer(const ConfigKey& key, const ValueMetric& valueMetric,
+                            const uint64_t protoHash, const PullOptions& pullOptions,
+                            const BucketOptions& bucketOptions, const WhatOptions& whatOptions,
+                            const ConditionOptions& conditionOptions,
+                            const StateOptions& stateOptions,
+                            const ActivationOptions& activationOptions,
+                            const GuardrailOptions& guardrailOptions, HistogramBins bins);
+
+    inline MetricType getMetricType() const override {
+        return METRIC_TYPE_VALUE;
+    }
+
+private:
+    inline optional<int64_t> getConditionIdForMetric(const StatsdConfig& config,
+                                                     const int configIndex) const override {
+        const ValueMetric& metric = config.value_metric(configIndex);
+        return metric.has_condition() ? make_optional(metric.condition()) : nullopt;
+    }
+
+    inline int64_t getWhatAtomMatcherIdForMetric(const StatsdConfig& config,
+                                                 const int configIndex) const override {
+        return config.value_metric(configIndex).what();
+    }
+
+    inline ConditionLinks getConditionLinksForMetric(const StatsdConfig& config,
+                                                     const int configIndex) const override {
+        return config.value_metric(configIndex).links();
+    }
+
+    inline bool canSkipLogEventLocked(
+            const MetricDimensionKey& eventKey, bool condition, int64_t eventTimeNs,
+            const std::map<int, HashableDimensionKey>& statePrimaryKeys) const override {
+        // Can only skip if the condition is false, since the metric is pushed.
+        return !condition;
+    }
+
+    DumpProtoFields getDumpProtoFields() const override;
+
+    std::string aggregatedValueToString(const std::vector<int64_t>& aggregate) const override;
+
+    inline bool multipleBucketsSkipped(const int64_t numBucketsForward) const override {
+        // Always false because the metric is pushed.
+        return false;
+    }
+
+    // The count arrays are moved from the Intervals to newly created PastBuckets.
+    PastBucket<std::vector<int64_t>> buildPartialBucket(int64_t bucketEndTime,
+                                                        const Intervals& intervals) override;
+
+    void writePastBucketAggregateToProto(const int aggIndex, const std::vector<int64_t>& counts,
+                                         const int sampleSize,
+                                         ProtoOutputStream* const protoOutput) const override;
+
+    bool aggregateFields(const int64_t eventTimeNs, const MetricDimensionKey& eventKey,
+                         const LogEvent& event, const Intervals& intervals,
+                         Empty& empty) override;
+
+    size_t pastBucketByteSize(const PastBucket<std::vector<int64_t>>& bucket) const override;
+
+    const bool mIncludeSampleSize;
+
+    const HistogramBins mBins;
+
+    FRIEND_TEST(HistogramMetricProducerTest, TestPushedEventsWithoutCondition);
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -22,12 +22,14 @@
 #include <limits.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
 #include "guardrail/StatsdStats.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
+#include "varint.h"
 
 using android::util::FIELD_COUNT_REPEATED;
-using android::util::FIELD_TYPE_BYTES;
 using android::util::FIELD_TYPE_INT32;
 using android::util::FIELD_TYPE_MESSAGE;
 using android::util::ProtoOutputStream;
@@ -36,8 +38,9 @@ using std::nullopt;
 using std::optional;
 using std::shared_ptr;
 using std::string;
+using std::vector;
+using std::unique_ptr;
 using std::unordered_map;
-using zetasketch::android::AggregatorStateProto;
 
 namespace android {
 namespace os {
@@ -54,6 +57,152 @@ const int FIELD_ID_START_BUCKET_ELAPSED_MILLIS = 5;
 const int FIELD_ID_END_BUCKET_ELAPSED_MILLIS = 6;
 const int FIELD_ID_CONDITION_TRUE_NS = 7;
 
+// for AggregatorStateProto, see lib/libkll/proto/aggregator.proto
+const uint32_t FIELD_ID_AGGREGATOR_TYPE = 1;
+const uint32_t FIELD_ID_AGGREGATOR_NUM_VALUES = 2;
+const uint32_t FIELD_ID_AGGREGATOR_VALUE_TYPE = 4;
+const uint32_t FIELD_ID_KLL_QUANTILES_STATE = 113;
+// for KllQuantilesStateProto, see lib/libkll/proto/kll-quantiles.proto
+const uint32_t FIELD_ID_KLL_K = 1;
+const uint32_t FIELD_ID_KLL_INV_EPS = 2;
+const uint32_t FIELD_ID_KLL_MIN = 3;
+const uint32_t FIELD_ID_KLL_MAX = 4;
+const uint32_t FIELD_ID_KLL_COMPACTORS = 5;
+const uint32_t FIELD_ID_KLL_SAMPLER = 6;
+// for KllQuantilesStateProto.Compactor
+const uint32_t FIELD_ID_COMPACTOR_PACKED_VALUES = 1;
+// for KllQuantilesStateProto.Sampler
+const uint32_t FIELD_ID_SAMPLER_SAMPLED_ITEM = 1;
+const uint32_t FIELD_ID_SAMPLER_SAMPLED_WEIGHT = 2;
+const uint32_t FIELD_ID_SAMPLER_LOG_CAPACITY = 3;
+
+// Values KllQuantile::SerializeToProto() sets for AggregatorStateProto.type and value_type.
+const uint64_t KLL_QUANTILES_AGGREGATOR_TYPE = 113;
+const uint64_t INT64_VALUE_TYPE = 4;
+
+const uint32_t WIRE_TYPE_VARINT = 0;
+const uint32_t WIRE_TYPE_LENGTH_DELIMITED = 2;
+
+namespace {
+
+// The sketch is written with raw varints rather than ProtoOutputStream::write(), since write()
+// drops fields that hold a default value while the libprotobuf (proto2) encoding keeps them.
+size_t varintFieldSize(const uint32_t fieldId, const uint64_t value) {
+    return Varint::Length64(fieldId << 3 | WIRE_TYPE_VARINT) + Varint::Length64(value);
+}
+
+size_t lengthDelimitedFieldSize(const uint32_t fieldId, const size_t size) {
+    return Varint::Length64(fieldId << 3 | WIRE_TYPE_LENGTH_DELIMITED) + Varint::Length64(size) +
+           size;
+}
+
+void writeVarintField(const uint32_t fieldId, const uint64_t value,
+                      ProtoOutputStream* const protoOutput) {
+    protoOutput->writeRawVarint(fieldId << 3 | WIRE_TYPE_VARINT);
+    protoOutput->writeRawVarint(value);
+}
+
+// libkll encodes each int64 value of min, max, compactors and the sampled item as the varint of
+// the value cast to uint64.
+size_t packedValuesSize(const vector<int64_t>& values) {
+    size_t size = 0;
+    for (const int64_t value : values) {
+        size += Varint::Length64(static_cast<uint64_t>(value));
+    }
+    return size;
+}
+
+void writePackedValuesField(const uint32_t fieldId, const vector<int64_t>& values,
+                            ProtoOutputStream* const protoOutput) {
+    protoOutput->writeLengthDelimitedHeader(fieldId, packedValuesSize(values));
+    for (const int64_t value : values) {
+        protoOutput->writeRawVarint(static_cast<uint64_t>(value));
+    }
+}
+
+}  // namespace
+
+size_t writeKllSketchToProto(KllQuantile& kll, const uint32_t fieldId,
+                             ProtoOutputStream* const protoOutput) {
+    const bool hasValues = kll.num_values() > 0;
+    if (hasValues) {
+        kll.SortCompactorContents();
+    }
+    const vector<int64_t> minValue = {kll.min()};
+    const vector<int64_t> maxValue = {kll.max()};
+    const auto sampledItemAndWeight = kll.sampled_item_and_weight();
+    const vector<int64_t> sampledItem =
+            sampledItemAndWeight.has_value() ? vector<int64_t>{sampledItemAndWeight->first}
+                                             : vector<int64_t>{};
+
+    // Nested sizes are computed up front so that every length prefix is written exactly once.
+    size_t samplerSize = 0;
+    const bool writeSampler = hasValues && kll.IsSamplerOn();
+    if (writeSampler) {
+        if (sampledItemAndWeight.has_value()) {
+            samplerSize +=
+                    lengthDelimitedFieldSize(FIELD_ID_SAMPLER_SAMPLED_ITEM,
+                                             packedValuesSize(sampledItem)) +
+                    varintFieldSize(FIELD_ID_SAMPLER_SAMPLED_WEIGHT, sampledItemAndWeight->second);
+        }
+        samplerSize += varintFieldSize(FIELD_ID_SAMPLER_LOG_CAPACITY, kll.sampler_log_capacity());
+    }
+
+    size_t quantileStateSize = varintFieldSize(FIELD_ID_KLL_K, kll.k()) +
+                               varintFieldSize(FIELD_ID_KLL_INV_EPS, kll.inv_eps());
+    if (hasValues) {
+        quantileStateSize +=
+                lengthDelimitedFieldSize(FIELD_ID_KLL_MIN, packedValuesSize(minValue)) +
+                lengthDelimitedFieldSize(FIELD_ID_KLL_MAX, packedValuesSize(maxValue));
+        for (const vector<int64_t>& compactor : kll.compactors()) {
+            quantileStateSize += lengthDelimitedFieldSize(
+                    FIELD_ID_KLL_COMPACTORS,
+                    lengthDelimitedFieldSize(FIELD_ID_COMPACTOR_PACKED_VALUES,
+                                             packedValuesSize(compactor)));
+        }
+        if (writeSampler) {
+            quantileStateSize += lengthDelimitedFieldSize(FIELD_ID_KLL_SAMPLER, samplerSize);
+        }
+    }
+
+    const size_t aggregatorStateSize =
+            varintFieldSize(FIELD_ID_AGGREGATOR_TYPE, KLL_QUANTILES_AGGREGATOR_TYPE) +
+            varintFieldSize(FIELD_ID_AGGREGATOR_NUM_VALUES, kll.num_values()) +
+            varintFieldSize(FIELD_ID_AGGREGATOR_VALUE_TYPE, INT64_VALUE_TYPE) +
+            lengthDelimitedFieldSize(FIELD_ID_KLL_QUANTILES_STATE, quantileStateSize);
+
+    protoOutput->writeLengthDelimitedHeader(fieldId, aggregatorStateSize);
+    writeVarintField(FIELD_ID_AGGREGATOR_TYPE, KLL_QUANTILES_AGGREGATOR_TYPE, protoOutput);
+    writeVarintField(FIELD_ID_AGGREGATOR_NUM_VALUES, kll.num_values(), protoOutput);
+    writeVarintField(FIELD_ID_AGGREGATOR_VALUE_TYPE, INT64_VALUE_TYPE, protoOutput);
+
+    protoOutput->writeLengthDelimitedHeader(FIELD_ID_KLL_QUANTILES_STATE, quantileStateSize);
+    writeVarintField(FIELD_ID_KLL_K, kll.k(), protoOutput);
+    writeVarintField(FIELD_ID_KLL_INV_EPS, kll.inv_eps(), protoOutput);
+    if (hasValues) {
+        writePackedValuesField(FIELD_ID_KLL_MIN, minValue, protoOutput);
+        writePackedValuesField(FIELD_ID_KLL_MAX, maxValue, protoOutput);
+        for (const vector<int64_t>& compactor : kll.compactors()) {
+            protoOutput->writeLengthDelimitedHeader(
+                    FIELD_ID_KLL_COMPACTORS,
+                    lengthDelimitedFieldSize(FIELD_ID_COMPACTOR_PACKED_VALUES,
+                                             packedValuesSize(compactor)));
+            writePackedValuesField(FIELD_ID_COMPACTOR_PACKED_VALUES, compactor, protoOutput);
+        }
+        if (writeSampler) {
+            protoOutput->writeLengthDelimitedHeader(FIELD_ID_KLL_SAMPLER, samplerSize);
+            if (sampledItemAndWeight.has_value()) {
+                writePackedValuesField(FIELD_ID_SAMPLER_SAMPLED_ITEM, sampledItem, protoOutput);
+                writeVarintField(FIELD_ID_SAMPLER_SAMPLED_WEIGHT, sampledItemAndWeight->second,
+                                 protoOutput);
+            }
+            writeVarintField(FIELD_ID_SAMPLER_LOG_CAPACITY, kll.sampler_log_capacity(),
+                             protoOutput);
+        }
+    }
+    return aggregatorStateSize;
+}
+
 KllMetricProducer::KllMetricProducer(const ConfigKey& key, const KllMetric& metric,
                                      const uint64_t protoHash, const PullOptions& pullOptions,
                                      const BucketOptions& bucketOptions,
@@ -63,7 +212,8 @@ KllMetricProducer::KllMetricProducer(const ConfigKey& key, const KllMetric& metr
                                      const ActivationOptions& activationOptions,
                                      const GuardrailOptions& guardrailOptions)
     : ValueMetricProducer(metric.id(), key, protoHash, pullOptions, bucketOptions, whatOptions,
-                          conditionOptions, stateOptions, activationOptions, guardrailOptions) {
+                          conditionOptions, stateOptions, activationOptions, guardrailOptions),
+      mMergeBucketsInReport(metric.merge_buckets_in_report()) {
 }
 
 KllMetricProducer::DumpProtoFields KllMetricProducer::getDumpProtoFields() const {
@@ -76,18 +226,17 @@ KllMetricProducer::DumpProtoFields KllMetricProducer::getDumpProtoFields() const
 }
 
 void KllMetricProducer::writePastBucketAggregateToProto(
-        const int aggIndex, const unique_ptr<KllQuantile>& kll, const int sampleSize,
+        const int aggIndex, const unique_ptr<KllSketch>& sketch, const int sampleSize,
         ProtoOutputStream* const protoOutput) const {
     uint64_t sketchesToken =
             protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_SKETCHES);
     protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_SKETCH_INDEX, aggIndex);
 
-    // TODO(b/186737273): Serialize directly to ProtoOutputStream
-    const AggregatorStateProto& aggProto = kll->SerializeToProto();
-    const size_t numBytes = aggProto.ByteSizeLong();
-    const unique_ptr<char[]> buffer(new char[numBytes]);
-    aggProto.SerializeToArray(&buffer[0], numBytes);
-    protoOutput->write(FIELD_TYPE_BYTES | FIELD_ID_KLL_SKETCH, &buffer[0], numBytes);
+    // A sparse sketch is encoded as the KllQuantile of its values, which is built only for the
+    // duration of the write.
+    const unique_ptr<KllQuantile> sparseKll = sketch->isSparse() ? sketch->buildKll() : nullptr;
+    KllQuantile& kll = sparseKll != nullptr ? *sparseKll : *sketch->getKll();
+    const size_t numBytes = writeKllSketchToProto(kll, FIELD_ID_KLL_SKETCH, protoOutput);
 
     VLOG("\t\t sketch %d: %zu bytes", aggIndex, numBytes);
     protoOutput->end(sketchesToken);
@@ -111,7 +260,7 @@ optional<int64_t> getInt64ValueFromEvent(const LogEvent& event, const Matcher& m
 
 bool KllMetricProducer::aggregateFields(const int64_t eventTimeNs,
                                         const MetricDimensionKey& eventKey, const LogEvent& event,
-                                        vector<Interval>& intervals, Empty& empty) {
+                                        const Intervals& intervals, Empty& empty) {
     bool seenNewData = false;
     for (size_t i = 0; i < mFieldMatchers.size(); i++) {
         const Matcher& matcher = mFieldMatchers[i];
@@ -126,27 +275,27 @@ bool KllMetricProducer::aggregateFields(const int64_t eventTimeNs,
 
         // interval.aggregate can be nullptr from cases:
         // 1. Initialization from default construction of Interval struct.
-        // 2. Ownership of the unique_ptr<KllQuantile> at interval.aggregate being transferred to
+        // 2. Ownership of the unique_ptr<KllSketch> at interval.aggregate being transferred to
         // PastBucket after flushing.
         if (!interval.aggregate) {
-            interval.aggregate = KllQuantile::Create();
+            interval.aggregate = std::make_unique<KllSketch>(&mRandom);
         }
         seenNewData = true;
-        interval.aggregate->Add(valueOpt.value());
+        interval.aggregate->add(valueOpt.value());
         interval.sampleSize += 1;
     }
     return seenNewData;
 }
 
-PastBucket<unique_ptr<KllQuantile>> KllMetricProducer::buildPartialBucket(
-        int64_t bucketEndTimeNs, vector<Interval>& intervals) {
-    PastBucket<unique_ptr<KllQuantile>> bucket;
+PastBucket<unique_ptr<KllSketch>> KllMetricProducer::buildPartialBucket(
+        int64_t bucketEndTimeNs, const Intervals& intervals) {
+    PastBucket<unique_ptr<KllSketch>> bucket;
     bucket.mBucketStartNs = mCurrentBucketStartTimeNs;
     bucket.mBucketEndNs = bucketEndTimeNs;
     for (Interval& interval : intervals) {
         if (interval.hasValue()) {
             bucket.aggIndex.push_back(interval.aggIndex);
-            // Transfer ownership of unique_ptr<KllQuantile> from interval.aggregate to
+            // Transfer ownership of unique_ptr<KllSketch> from interval.aggregate to
             // bucket.aggregates vector. interval.aggregate is guaranteed to be nullptr after this.
             bucket.aggregates.push_back(std::move(interval.aggregate));
         }
@@ -154,20 +303,48 @@ PastBucket<unique_ptr<KllQuantile>> KllMetricProducer::buildPartialBucket(
     return bucket;
 }
 
-size_t KllMetricProducer::byteSizeLocked() const {
-    size_t totalSize = 0;
-    for (const auto& [_, buckets] : mPastBuckets) {
-        totalSize += buckets.size() * kBucketSize;
-        for (const auto& bucket : buckets) {
-            static const size_t kIntSize = sizeof(int);
-            totalSize += bucket.aggIndex.size() * kIntSize;
-            if (!bucket.aggregates.empty()) {
-                static const size_t kInt64Size = sizeof(int64_t);
-                // Assume sketch size is the same for all aggregations in a bucket.
-                totalSize += bucket.aggregates.size() * kInt64Size *
-                             bucket.aggregates[0]->num_stored_values();
+void KllMetricProducer::prepareDumpReportLocked() {
+    if (!mMergeBucketsInReport) {
+        return;
+    }
+    for (auto& [metricDimensionKey, buckets] : mPastBuckets) {
+        if (buckets.size() < 2) {
+            continue;
+        }
+        // Buckets are appended in time order, so the first one becomes the merged bucket.
+        PastBucket<unique_ptr<KllSketch>>& merged = buckets.front();
+        mPastBucketsByteSize -= pastBucketByteSize(merged);
+        for (auto bucket = buckets.begin() + 1; bucket != buckets.end(); ++bucket) {
+            mPastBucketsByteSize -= pastBucketByteSize(*bucket);
+            for (size_t i = 0; i < bucket->aggIndex.size(); i++) {
+                const auto it = std::find(merged.aggIndex.begin(), merged.aggIndex.end(),
+                                          bucket->aggIndex[i]);
+                if (it == merged.aggIndex.end()) {
+                    merged.aggIndex.push_back(bucket->aggIndex[i]);
+                    merged.aggregates.push_back(std::move(bucket->aggregates[i]));
+                } else {
+                    merged.aggregates[it - merged.aggIndex.begin()]->merge(
+                            *bucket->aggregates[i]);
+                }
             }
+            merged.mBucketEndNs = bucket->mBucketEndNs;
+            merged.mConditionTrueNs += bucket->mConditionTrueNs;
+            merged.mConditionCorrectionNs += bucket->mConditionCorrectionNs;
         }
+        buckets.resize(1);
+        mPastBucketsByteSize += pastBucketByteSize(merged);
+    }
+}
+
+size_t KllMetricProducer::pastBucketByteSize(
+        const PastBucket<unique_ptr<KllSketch>>& bucket) const {
+    static const size_t kIntSize = sizeof(int);
+    size_t totalSize = kBucketSize + bucket.aggIndex.size() * kIntSize;
+    if (!bucket.aggregates.empty()) {
+        static const size_t kInt64Size = sizeof(int64_t);
+        // Assume sketch size is the same for all aggregations in a bucket.
+        totalSize += bucket.aggregates.size() * kInt64Size *
+                     bucket.aggregates[0]->num_stored_values();
     }
     return totalSize;
 }
@@ -19,9 +19,11 @@
 #include <android/util/ProtoOutputStream.h>
 #include <gtest/gtest_prod.h>
 #include <kll.h>
+#include <random_generator.h>
 
 #include <optional>
 
+#include "KllSketch.h"
 #include "MetricProducer.h"
 #include "ValueMetricProducer.h"
 #include "condition/ConditionTimer.h"
@@ -36,13 +38,19 @@ namespace android {
 namespace os {
 namespace statsd {
 
-// Uses KllQuantile to aggregate values within buckets.
+// Writes kll to fieldId as an encoded AggregatorStateProto, with the same bytes as
+// kll.SerializeToProto() but without building the proto or a temporary buffer. Like
+// SerializeToProto(), this sorts the compactors. Returns the size of the encoded sketch.
+size_t writeKllSketchToProto(KllQuantile& kll, uint32_t fieldId,
+                             ProtoOutputStream* protoOutput);
+
+// Uses KllSketch to aggregate values within buckets.
 //
 // There are different events that might complete a bucket
 // - a condition change
 // - an app upgrade
 // - an alarm set to the end of the bucket
-class KllMetricProducer : public ValueMetricProducer<std::unique_ptr<KllQuantile>, Empty> {
+class KllMetricProducer : public ValueMetricProducer<std::unique_ptr<KllSketch>, Empty> {
 public:
     KllMetricProducer(const ConfigKey& key, const KllMetric& kllMetric, const uint64_t protoHash,
                       const PullOptions& pullOptions, const BucketOptions& bucketOptions,
@@ -84,7 +92,7 @@ private:
     DumpProtoFields getDumpProtoFields() const override;
 
     inline std::string aggregatedValueToString(
-            const std::unique_ptr<KllQuantile>& aggregate) const override {
+            const std::unique_ptr<KllSketch>& aggregate) const override {
         return std::to_string(aggregate->num_values()) + " values";
     }
 
@@ -93,26 +101,39 @@ private:
         return false;
     }
 
-    // The KllQuantile ptr ownership is transferred to newly created PastBuckets from Intervals.
-    PastBucket<std::unique_ptr<KllQuantile>> buildPartialBucket(
-            int64_t bucketEndTime, std::vector<Interval>& intervals) override;
+    // The KllSketch ptr ownership is transferred to newly created PastBuckets from Intervals.
+    PastBucket<std::unique_ptr<KllSketch>> buildPartialBucket(
+            int64_t bucketEndTime, const Intervals& intervals) override;
 
     void writePastBucketAggregateToProto(const int aggIndex,
-                                         const std::unique_ptr<KllQuantile>& kll,
+                                         const std::unique_ptr<KllSketch>& sketch,
                                          const int sampleSize,
                                          ProtoOutputStream* const protoOutput) const override;
 
     bool aggregateFields(const int64_t eventTimeNs, const MetricDimensionKey& eventKey,
-                         const LogEvent& event, std::vector<Interval>& intervals,
+                         const LogEvent& event, const Intervals& intervals,
                          Empty& empty) override;
 
-    // Internal function to calculate the current used bytes.
-    size_t byteSizeLocked() const override;
+    // Merges the past buckets of each dimension if the metric sets merge_buckets_in_report.
+    // The merged bucket spans all of them and is reported with start and end times.
+    void prepareDumpReportLocked() override;
+
+    size_t pastBucketByteSize(
+            const PastBucket<std::unique_ptr<KllSketch>>& bucket) const override;
+
+    const bool mMergeBucketsInReport;
+
+    // Shared by the KllQuantiles of all sketches, instead of one seeded generator per sketch.
+    // Sketches outlive this member in the base class, which is fine since they do not use it
+    // when destroyed.
+    dist_proc::aggregation::MTRandomGenerator mRandom;
 
     FRIEND_TEST(KllMetricProducerTest, TestByteSize);
     FRIEND_TEST(KllMetricProducerTest, TestPushedEventsWithoutCondition);
     FRIEND_TEST(KllMetricProducerTest, TestPushedEventsWithCondition);
     FRIEND_TEST(KllMetricProducerTest, TestForcedBucketSplitWhenConditionUnknownSkipsBucket);
+    FRIEND_TEST(KllMetricProducerTest, TestMergeBucketsInReport);
+    FRIEND_TEST(KllMetricProducerTest, TestSparseSketchesPromotedPastCapacity);
 
     FRIEND_TEST(KllMetricProducerTest_BucketDrop, TestInvalidBucketWhenConditionUnknown);
     FRIEND_TEST(KllMetricProducerTest_BucketDrop, TestBucketDropWhenBucketTooSmall);
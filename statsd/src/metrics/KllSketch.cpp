@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KllSketch.h"
+
+using dist_proc::aggregation::KllQuantile;
+using dist_proc::aggregation::KllQuantileOptions;
+using std::unique_ptr;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+void KllSketch::add(const int64_t value) {
+    if (mKll == nullptr) {
+        if (mNumSparseValues < kSparseCapacity) {
+            mSparseValues[mNumSparseValues++] = value;
+            return;
+        }
+        promote();
+    }
+    mKll->Add(value);
+}
+
+void KllSketch::merge(const KllSketch& other) {
+    if (other.mKll == nullptr) {
+        // The values of a sparse sketch are all at the lowest level, which Merge() adds in order.
+        for (uint8_t i = 0; i < other.mNumSparseValues; i++) {
+            add(other.mSparseValues[i]);
+        }
+        return;
+    }
+    if (mKll == nullptr) {
+        promote();
+    }
+    mKll->Merge(*other.mKll);
+}
+
+unique_ptr<KllQuantile> KllSketch::buildKll() const {
+    KllQuantileOptions options;
+    options.set_random(mRandom);
+    unique_ptr<KllQuantile> kll = KllQuantile::Create(options);
+    for (uint8_t i = 0; i < mNumSparseValues; i++) {
+        kll->Add(mSparseValues[i]);
+    }
+    return kll;
+}
+
+void KllSketch::promote() {
+    mKll = buildKll();
+    mNumSparseValues = 0;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
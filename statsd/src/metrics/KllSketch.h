@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <kll.h>
+#include <stdint.h>
+
+#include <array>
+#include <memory>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A KLL sketch that keeps its first values inline and only creates a KllQuantile once it holds
+ * more than kSparseCapacity values.
+ *
+ * A KllQuantile does not compact its values before it holds thousands of them, so a sparse
+ * sketch is the KllQuantile of its values added in order, and is encoded the same way. The
+ * KllQuantiles use the random generator given at construction, which must outlive the sketch.
+ */
+class KllSketch {
+public:
+    static constexpr size_t kSparseCapacity = 8;
+
+    explicit KllSketch(dist_proc::aggregation::RandomGenerator* random) : mRandom(random) {
+    }
+
+    KllSketch(const KllSketch&) = delete;
+    KllSketch& operator=(const KllSketch&) = delete;
+
+    void add(int64_t value);
+
+    // Adds the values summarized by other, as KllQuantile::Merge() does.
+    void merge(const KllSketch& other);
+
+    int64_t num_values() const {
+        return mKll != nullptr ? mKll->num_values() : mNumSparseValues;
+    }
+
+    int64_t num_stored_values() const {
+        return mKll != nullptr ? mKll->num_stored_values() : mNumSparseValues;
+    }
+
+    bool isSparse() const {
+        return mKll == nullptr;
+    }
+
+    // Null while the sketch is sparse.
+    dist_proc::aggregation::KllQuantile* getKll() const {
+        return mKll.get();
+    }
+
+    // Returns the KllQuantile of the values of a sparse sketch.
+    std::unique_ptr<dist_proc::aggregation::KllQuantile> buildKll() const;
+
+private:
+    void promote();
+
+    dist_proc::aggregation::RandomGenerator* const mRandom;
+
+    std::array<int64_t, kSparseCapacity> mSparseValues;
+    uint8_t mNumSparseValues = 0;
+
+    std::unique_ptr<dist_proc::aggregation::KllQuantile> mKll;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MetricDispatchPlan.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+void MetricDispatchPlan::build(
+        const vector<sp<MetricProducer>>& allMetricProducers, const size_t matcherCount,
+        const size_t conditionCount, const unordered_map<int, vector<int>>& trackerToMetricMap,
+        const unordered_map<int, vector<int>>& conditionToMetricMap,
+        const unordered_map<int, vector<int>>& activationAtomTrackerToMetricMap,
+        const unordered_map<int, vector<int>>& deactivationAtomTrackerToMetricMap) {
+    mMatchedMetrics.build(allMetricProducers, matcherCount, trackerToMetricMap);
+    mActivatedMetrics.build(allMetricProducers, matcherCount, activationAtomTrackerToMetricMap);
+    mDeactivatedMetrics.build(allMetricProducers, matcherCount,
+                              deactivationAtomTrackerToMetricMap);
+    mConditionMetrics.build(allMetricProducers, conditionCount, conditionToMetricMap);
+}
+
+void MetricDispatchPlan::clear() {
+    mMatchedMetrics.clear();
+    mActivatedMetrics.clear();
+    mDeactivatedMetrics.clear();
+    mConditionMetrics.clear();
+}
+
+void MetricDispatchPlan::Table::build(const vector<sp<MetricProducer>>& allMetricProducers,
+                                      const size_t count,
+                                      const unordered_map<int, vector<int>>& indexToMetrics) {
+    clear();
+    mOffsets.assign(count + 1, 0);
+    for (const auto& [index, metricIndices] : indexToMetrics) {
+        if (index >= 0 && index < (int)count) {
+            mOffsets[index + 1] = metricIndices.size();
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        mOffsets[i + 1] += mOffsets[i];
+    }
+    mTargets.resize(mOffsets[count]);
+    for (const auto& [index, metricIndices] : indexToMetrics) {
+        if (index < 0 || index >= (int)count) {
+            continue;
+        }
+        // Metrics keep the order of the map, which is the order they are notified in.
+        Target* target = mTargets.data() + mOffsets[index];
+        for (const int metricIndex : metricIndices) {
+            *target++ = {metricIndex, allMetricProducers[metricIndex].get()};
+        }
+    }
+}
+
+void MetricDispatchPlan::Table::clear() {
+    mTargets.clear();
+    mOffsets.clear();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
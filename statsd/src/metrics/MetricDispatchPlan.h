@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "metrics/MetricProducer.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The MetricProducers that a matched event or a changed condition is delivered to.
+ *
+ * Built once per config init/update. The metrics of each matcher and condition index are stored
+ * contiguously, as raw pointers next to their metric index, so the event loop neither hashes the
+ * index nor loads, copies or adjusts an sp<> to reach a metric. The metrics stay owned by the
+ * MetricsManager, and the plan must be rebuilt whenever its metric producers change.
+ */
+class MetricDispatchPlan {
+public:
+    struct Target {
+        int metricIndex;
+        MetricProducer* metric;
+    };
+
+    // A contiguous, possibly empty, range of targets.
+    class Range {
+    public:
+        Range(const Target* begin, const Target* end) : mBegin(begin), mEnd(end) {
+        }
+
+        const Target* begin() const {
+            return mBegin;
+        }
+
+        const Target* end() const {
+            return mEnd;
+        }
+
+        bool empty() const {
+            return mBegin == mEnd;
+        }
+
+    private:
+        const Target* mBegin;
+        const Target* mEnd;
+    };
+
+    /**
+     * Rebuilds the plan from the metrics and the matcher/condition index to metric indices maps.
+     */
+    void build(const std::vector<sp<MetricProducer>>& allMetricProducers, size_t matcherCount,
+               size_t conditionCount,
+               const std::unordered_map<int, std::vector<int>>& trackerToMetricMap,
+               const std::unordered_map<int, std::vector<int>>& conditionToMetricMap,
+               const std::unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
+               const std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap);
+
+    // The metrics whose what is the matcher.
+    Range getMatchedMetrics(const int matcherIndex) const {
+        return mMatchedMetrics.at(matcherIndex);
+    }
+
+    // The metrics activated by the matcher.
+    Range getActivatedMetrics(const int matcherIndex) const {
+        return mActivatedMetrics.at(matcherIndex);
+    }
+
+    // The metrics whose activations are cancelled by the matcher.
+    Range getDeactivatedMetrics(const int matcherIndex) const {
+        return mDeactivatedMetrics.at(matcherIndex);
+    }
+
+    // The metrics using the condition.
+    Range getConditionMetrics(const int conditionIndex) const {
+        return mConditionMetrics.at(conditionIndex);
+    }
+
+    void clear();
+
+private:
+    // Targets grouped by matcher or condition index.
+    class Table {
+    public:
+        void build(const std::vector<sp<MetricProducer>>& allMetricProducers, size_t count,
+                   const std::unordered_map<int, std::vector<int>>& indexToMetrics);
+
+        Range at(const int index) const {
+            if (index < 0 || index + 1 >= (int)mOffsets.size()) {
+                return Range(nullptr, nullptr);
+            }
+            return Range(mTargets.data() + mOffsets[index], mTargets.data() + mOffsets[index + 1]);
+        }
+
+        void clear();
+
+    private:
+        std::vector<Target> mTargets;
+
+        // The targets of index i are mTargets[mOffsets[i], mOffsets[i + 1]).
+        std::vector<uint32_t> mOffsets;
+    };
+
+    Table mMatchedMetrics;
+    Table mActivatedMetrics;
+    Table mDeactivatedMetrics;
+    Table mConditionMetrics;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -19,6 +19,8 @@
 
 #include "MetricProducer.h"
 
+#include <algorithm>
+
 #include "../guardrail/StatsdStats.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "state/StateTracker.h"
@@ -75,6 +77,7 @@ MetricProducer::MetricProducer(
       mIsActive(mEventActivationMap.empty()),
       mSlicedStateAtoms(slicedStateAtoms),
       mStateGroupMap(stateGroupMap),
+      mStateGroupTables(buildStateGroupTables(stateGroupMap)),
       mSplitBucketForAppUpgrade(splitBucketForAppUpgrade),
       mHasHitGuardrail(false),
       mSampledWhatFields({}),
@@ -131,12 +134,26 @@ void MetricProducer::onMatchedLogEventLocked(const size_t matcherIndex, const Lo
     bool condition;
     ConditionKey conditionKey;
     if (mConditionSliced) {
-        for (const auto& link : mMetric2ConditionLinks) {
-            getDimensionForCondition(event.getValues(), link, &conditionKey[link.conditionId]);
+        const bool isPartialLink = !mHasLinksToAllConditionDimensionsInTracker;
+        const ConditionQueryCache::Entry* cachedQuery =
+                mConditionQueryCache == nullptr
+                        ? nullptr
+                        : mConditionQueryCache->find(event, mConditionTrackerIndex,
+                                                     mMetric2ConditionLinks, isPartialLink);
+        ConditionState conditionState;
+        if (cachedQuery != nullptr) {
+            conditionKey = cachedQuery->conditionKey;
+            conditionState = cachedQuery->conditionState;
+        } else {
+            for (const auto& link : mMetric2ConditionLinks) {
+                getDimensionForCondition(event, link, &conditionKey[link.conditionId]);
+            }
+            conditionState = mWizard->query(mConditionTrackerIndex, conditionKey, isPartialLink);
+            if (mConditionQueryCache != nullptr) {
+                mConditionQueryCache->add(event, mConditionTrackerIndex, mMetric2ConditionLinks,
+                                          isPartialLink, conditionKey, conditionState);
+            }
         }
-        auto conditionState =
-            mWizard->query(mConditionTrackerIndex, conditionKey,
-                           !mHasLinksToAllConditionDimensionsInTracker);
         condition = (conditionState == ConditionState::kTrue);
     } else {
         // TODO: The unknown condition state is not handled here, we should fix it.
@@ -151,8 +168,7 @@ void MetricProducer::onMatchedLogEventLocked(const size_t matcherIndex, const Lo
     // field values from the log event. These values will form a primary key
     // that will be used to query StateTracker for the correct state value.
     for (const auto& stateLink : mMetric2StateLinks) {
-        getDimensionForState(event.getValues(), stateLink,
-                             &statePrimaryKeys[stateLink.stateAtomId]);
+        getDimensionForState(event, stateLink, &statePrimaryKeys[stateLink.stateAtomId]);
     }
 
     // For each sliced state, query StateTracker for the state value using
@@ -179,7 +195,7 @@ void MetricProducer::onMatchedLogEventLocked(const size_t matcherIndex, const Lo
     }
 
     HashableDimensionKey dimensionInWhat;
-    filterValues(mDimensionsInWhat, event.getValues(), &dimensionInWhat);
+    filterValues(mDimensionsInWhat, event, &dimensionInWhat);
     MetricDimensionKey metricKey(dimensionInWhat, stateValuesKey);
     onMatchedLogEventInternalLocked(matcherIndex, metricKey, conditionKey, condition, event,
                                     statePrimaryKeys);
@@ -199,6 +215,19 @@ bool MetricProducer::evaluateActiveStateLocked(int64_t elapsedTimestampNs) {
     return isActive;
 }
 
+bool MetricProducer::addFieldsInUseLocked(AtomFieldMasks* fieldMasks) const {
+    addTopLevelFields(mDimensionsInWhat, fieldMasks);
+    addTopLevelFields(mSampledWhatFields, fieldMasks);
+    for (const Metric2Condition& link : mMetric2ConditionLinks) {
+        addTopLevelFields(link.metricFields, fieldMasks);
+        addTopLevelFields(link.conditionFields, fieldMasks);
+    }
+    for (const Metric2State& link : mMetric2StateLinks) {
+        addTopLevelFields(link.metricFields, fieldMasks);
+    }
+    return false;
+}
+
 void MetricProducer::flushIfExpire(int64_t elapsedTimestampNs) {
     std::lock_guard<std::mutex> lock(mMutex);
     if (!mIsActive) {
@@ -214,6 +243,17 @@ void MetricProducer::flushIfExpire(int64_t elapsedTimestampNs) {
     }
 }
 
+int64_t MetricProducer::getActivationExpiryNs() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    int64_t expiryNs = INT64_MAX;
+    for (const auto& [index, activation] : mEventActivationMap) {
+        if (activation->state == ActivationState::kActive) {
+            expiryNs = std::min(expiryNs, activation->start_ns + activation->ttl_ns);
+        }
+    }
+    return expiryNs;
+}
+
 void MetricProducer::activateLocked(int activationTrackerIndex, int64_t elapsedTimestampNs) {
     auto it = mEventActivationMap.find(activationTrackerIndex);
     if (it == mEventActivationMap.end()) {
@@ -319,6 +359,29 @@ void MetricProducer::writeActiveMetricToProtoOutputStream(
     }
 }
 
+bool MetricProducer::writeMetricMetadataToProto(metadata::MetricMetadata* metricMetadata) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    // The current bucket may have just started.
+    const size_t dimensionCount =
+            std::max(getCurrentDimensionCountLocked(), mLastBucketDimensionCount);
+    if (dimensionCount == 0) {
+        return false;
+    }
+    metricMetadata->set_metric_id(mMetricId);
+    metricMetadata->set_dimension_count(dimensionCount);
+    return true;
+}
+
+void MetricProducer::loadMetricMetadataFromProto(const metadata::MetricMetadata& metricMetadata) {
+    if (metricMetadata.dimension_count() <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    // Bounded by the largest dimension limit, in case the metadata is off.
+    reserveDimensionsLocked(std::min<int64_t>(metricMetadata.dimension_count(),
+                                              StatsdStats::kDimensionKeySizeHardLimitMax));
+}
+
 void MetricProducer::queryStateValue(const int32_t atomId, const HashableDimensionKey& queryKey,
                                      FieldValue* value) {
     if (!StateManager::getInstance().getStateValue(atomId, queryKey, value)) {
@@ -329,7 +392,52 @@ void MetricProducer::queryStateValue(const int32_t atomId, const HashableDimensi
     }
 }
 
+vector<MetricProducer::StateGroupTable> MetricProducer::buildStateGroupTables(
+        const unordered_map<int32_t, unordered_map<int, int64_t>>& stateGroupMap) {
+    vector<StateGroupTable> tables;
+    for (const auto& [atomId, groups] : stateGroupMap) {
+        if (groups.empty()) {
+            continue;
+        }
+        int minStateValue = groups.begin()->first;
+        int maxStateValue = minStateValue;
+        for (const auto& [stateValue, groupId] : groups) {
+            minStateValue = std::min(minStateValue, stateValue);
+            maxStateValue = std::max(maxStateValue, stateValue);
+        }
+        const int64_t size = (int64_t)maxStateValue - minStateValue + 1;
+        if (size > kMaxStateGroupTableSize) {
+            continue;
+        }
+        StateGroupTable& table = tables.emplace_back();
+        table.atomId = atomId;
+        table.minStateValue = minStateValue;
+        table.groupIds.resize(size);
+        for (const auto& [stateValue, groupId] : groups) {
+            table.groupIds[stateValue - minStateValue] = groupId;
+        }
+    }
+    return tables;
+}
+
 void MetricProducer::mapStateValue(const int32_t atomId, FieldValue* value) {
+    for (const StateGroupTable& table : mStateGroupTables) {
+        if (table.atomId != atomId) {
+            continue;
+        }
+        const int64_t index = (int64_t)value->mValue.int_value - table.minStateValue;
+        if (index >= 0 && index < (int64_t)table.groupIds.size() && table.groupIds[index]) {
+            value->mValue.setLong(*table.groupIds[index]);
+        } else {
+            value->mValue.setInt(StateTracker::kStateUnknown);
+        }
+        return;
+    }
+    if (mStateGroupTables.size() == mStateGroupMap.size()) {
+        // All the state maps are in tables, so there is none for this atom.
+        return;
+    }
+
     // check if there is a state map for this atom
     auto atomIt = mStateGroupMap.find(atomId);
     if (atomIt == mStateGroupMap.end()) {
@@ -370,19 +478,30 @@ bool MetricProducer::maxDropEventsReached() const {
     return mCurrentSkippedBucket.dropEvents.size() >= StatsdStats::kMaxLoggedBucketDropEvents;
 }
 
-bool MetricProducer::passesSampleCheckLocked(const vector<FieldValue>& values) const {
+bool MetricProducer::passesSampleCheckLocked(std::span<const FieldValue> values) const {
     // Only perform sampling if shard count is correct and there is a sampled what field.
     if (mShardCount <= 1 || mSampledWhatFields.size() == 0) {
         return true;
     }
     // If filtering fails, don't perform sampling. Event could be a gauge trigger event or stop all
     // event.
+    const Matcher& sampledField = mSampledWhatFields[0];
+    if (mSampleDecisionCache != nullptr) {
+        if (const optional<bool> keep =
+                    mSampleDecisionCache->find(values, sampledField, mShardCount)) {
+            return *keep;
+        }
+    }
     FieldValue sampleFieldValue;
-    if (!filterValues(mSampledWhatFields[0], values, &sampleFieldValue)) {
-        return true;
+    bool keep = true;
+    if (filterValues(sampledField, values, &sampleFieldValue)) {
+        keep = shouldKeepSample(sampleFieldValue,
+                                ShardOffsetProvider::getInstance().getShardOffset(), mShardCount);
+    }
+    if (mSampleDecisionCache != nullptr) {
+        mSampleDecisionCache->add(values, sampledField, mShardCount, keep);
     }
-    return shouldKeepSample(sampleFieldValue, ShardOffsetProvider::getInstance().getShardOffset(),
-                            mShardCount);
+    return keep;
 }
 
 }  // namespace statsd
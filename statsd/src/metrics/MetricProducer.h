@@ -24,12 +24,17 @@
 
 #include "HashableDimensionKey.h"
 #include "anomaly/AnomalyTracker.h"
+#include "condition/ConditionQueryCache.h"
 #include "condition/ConditionTimer.h"
 #include "condition/ConditionWizard.h"
 #include "config/ConfigKey.h"
 #include "guardrail/StatsdStats.h"
 #include "matchers/EventMatcherWizard.h"
 #include "matchers/matcher_util.h"
+#include "metrics/ConfigArena.h"
+#include "metrics/DimensionKeyInterner.h"
+#include "metrics/ReportDimensionDictionary.h"
+#include "metrics/SampleDecisionCache.h"
 #include "packages/PackageInfoListener.h"
 #include "src/statsd_metadata.pb.h"  // MetricMetadata
 #include "state/StateListener.h"
@@ -60,7 +65,13 @@ enum DumpLatency {
     FAST = 1,
     // In other cases, it is fine for a dump to take more than a few milliseconds, e.g. config
     // updates.
-    NO_TIME_CONSTRAINTS = 2
+    NO_TIME_CONSTRAINTS = 2,
+    // Dumps polled often, e.g. by dumpsys, which must not change the data. With the current
+    // bucket, the metrics that support it report a snapshot of their current bucket, as a partial
+    // bucket ending at the dump time in data entries of its own, without closing it or pulling.
+    // The other metrics only report their past buckets. The current bucket is reported again once
+    // closed.
+    SNAPSHOT = 3
 };
 
 enum MetricType {
@@ -223,16 +234,20 @@ public:
                         const FieldValue& newState){};
 
     // Output the metrics data to [protoOutput]. All metrics reports end with the same timestamp.
-    // This method clears all the past buckets.
+    // This method clears all the past buckets. With a dimensionDictionary, the metric types that
+    // support it write the index of their dimension keys in the dictionary.
     void onDumpReport(const int64_t dumpTimeNs,
                       const bool include_current_partial_bucket,
                       const bool erase_data,
                       const DumpLatency dumpLatency,
                       std::set<string> *str_set,
-                      android::util::ProtoOutputStream* protoOutput) {
+                      android::util::ProtoOutputStream* protoOutput,
+                      ReportDimensionDictionary* dimensionDictionary = nullptr) {
         std::lock_guard<std::mutex> lock(mMutex);
-        return onDumpReportLocked(dumpTimeNs, include_current_partial_bucket, erase_data,
-                dumpLatency, str_set, protoOutput);
+        mDimensionDictionary = dimensionDictionary;
+        onDumpReportLocked(dumpTimeNs, include_current_partial_bucket, erase_data, dumpLatency,
+                           str_set, protoOutput);
+        mDimensionDictionary = nullptr;
     }
 
     virtual optional<InvalidConfigReason> onConfigUpdatedLocked(
@@ -268,6 +283,14 @@ public:
         return byteSizeLocked();
     }
 
+    // Returns the estimated heap bytes held by the ongoing bucket, such as the maps of the
+    // dimensions seen so far and their trackers. Unlike byteSize(), which covers the past buckets
+    // waiting to be reported, this memory is not released by a dump.
+    size_t currentBucketByteSize() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return currentBucketByteSizeLocked();
+    }
+
     void dumpStates(int out, bool verbose) const {
         std::lock_guard<std::mutex> lock(mMutex);
         dumpStatesLocked(out, verbose);
@@ -304,22 +327,48 @@ public:
 
     void flushIfExpire(int64_t elapsedTimestampNs);
 
+    // Returns the time after which the earliest of the active activations lapses, or INT64_MAX
+    // if none is active. flushIfExpire does nothing before that time.
+    int64_t getActivationExpiryNs() const;
+
     void writeActiveMetricToProtoOutputStream(
             int64_t currentTimeNs, const DumpReportReason reason, ProtoOutputStream* proto);
 
     virtual void enforceRestrictedDataTtl(sqlite3* db, const int64_t wallClockNs){};
 
-    virtual bool writeMetricMetadataToProto(metadata::MetricMetadata* metricMetadata) {
+    // Writes the number of dimension keys of the current bucket. Returns false if the metric has
+    // none.
+    virtual bool writeMetricMetadataToProto(metadata::MetricMetadata* metricMetadata);
+
+    virtual void loadMetricMetadataFromProto(const metadata::MetricMetadata& metricMetadata);
+
+    // Writes the in progress bucket to [checkpoint]. Returns false if there is nothing to restore
+    // or if the metric type does not support checkpoints.
+    virtual bool writeBucketCheckpoint(metadata::BucketCheckpoint* checkpoint) {
         return false;
     }
 
-    virtual void loadMetricMetadataFromProto(const metadata::MetricMetadata& metricMetadata){};
+    // Restores a bucket checkpointed at checkpointNs by a previous statsd process, as a past
+    // bucket ending at the checkpoint.
+    virtual void restoreBucketCheckpoint(const metadata::BucketCheckpoint& checkpoint,
+                                         const int64_t checkpointNs){};
+
+    /*
+     * Adds the top-level fields that the metric reads from events to fieldMasks. Returns true if
+     * the metric also reads all the other fields of the atoms of its what matcher.
+     */
+    bool addFieldsInUse(AtomFieldMasks* fieldMasks) const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return addFieldsInUseLocked(fieldMasks);
+    }
 
     /* Called when the metric is to about to be removed from config. */
     virtual void onMetricRemove() {
     }
 
-    virtual void flushRestrictedData() {
+    /* Writes the restricted data buffered in memory to the db. With asyncInsert, it is only
+     * handed over to the db writer thread. */
+    virtual void flushRestrictedData(const bool asyncInsert) {
     }
 
     // Start: getters/setters
@@ -374,8 +423,38 @@ public:
         mSampledWhatFields.swap(samplingInfo.sampledWhatFields);
         mShardCount = samplingInfo.shardCount;
     }
+
+    void setDimensionKeyInterner(const sp<DimensionKeyInterner>& dimensionKeyInterner) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDimensionKeyInterner = dimensionKeyInterner;
+    }
+
+    void setConditionQueryCache(const sp<ConditionQueryCache>& conditionQueryCache) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mConditionQueryCache = conditionQueryCache;
+    }
+
+    void setSampleDecisionCache(const sp<SampleDecisionCache>& sampleDecisionCache) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSampleDecisionCache = sampleDecisionCache;
+    }
+
+    void setConfigArena(const sp<ConfigArena>& configArena) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mConfigArena != configArena) {
+            mConfigArena = configArena;
+            onConfigArenaChangedLocked();
+        }
+    }
+
+    void setColumnarReport(const bool columnarReport) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mColumnarReport = columnarReport;
+    }
     // End: getters/setters
 protected:
+    virtual bool addFieldsInUseLocked(AtomFieldMasks* fieldMasks) const;
+
     /**
      * Flushes the current bucket if the eventTime is after the current bucket's end time.
      */
@@ -406,6 +485,13 @@ protected:
         flushLocked(eventTimeNs);
     }
 
+    // Returns a copy of key to store when the metric starts tracking a new dimension. The copy
+    // shares its values with the equal keys of the other metrics, of this config or of others.
+    template <typename Key>
+    Key internDimensionKeyLocked(const Key& key) const {
+        return mDimensionKeyInterner == nullptr ? key : mDimensionKeyInterner->intern(key);
+    }
+
     /*
      * Individual metrics can implement their own business logic here. All pre-processing is done.
      *
@@ -440,6 +526,19 @@ protected:
     virtual void clearPastBucketsLocked(const int64_t dumpTimeNs) = 0;
     virtual void prepareFirstBucketLocked(){};
     virtual size_t byteSizeLocked() const = 0;
+    virtual size_t currentBucketByteSizeLocked() const {
+        return 0;
+    }
+
+    // Number of dimension keys of the current bucket.
+    virtual size_t getCurrentDimensionCountLocked() const {
+        return 0;
+    }
+
+    // Reserves the maps of the metric for the number of dimension keys, so that they do not
+    // rehash while the buckets fill up.
+    virtual void reserveDimensionsLocked(const size_t dimensionCount) {
+    }
     virtual void dumpStatesLocked(int out, bool verbose) const = 0;
     virtual void dropDataLocked(const int64_t dropTimeNs) = 0;
     void loadActiveMetricLocked(const ActiveMetric& activeMetric, int64_t currentTimeNs);
@@ -454,6 +553,10 @@ protected:
         }
     }
 
+    // Moves the state allocated from now on to mConfigArena, or back to the heap if null.
+    virtual void onConfigArenaChangedLocked() {
+    }
+
     inline bool isActiveLocked() const {
         return mIsActive;
     }
@@ -488,7 +591,7 @@ protected:
     // exceeded the maximum number allowed, which is currently capped at 10.
     bool maxDropEventsReached() const;
 
-    bool passesSampleCheckLocked(const vector<FieldValue>& values) const;
+    bool passesSampleCheckLocked(std::span<const FieldValue> values) const;
 
     const int64_t mMetricId;
 
@@ -512,6 +615,9 @@ protected:
     // report.
     int64_t mCurrentBucketNum;
 
+    // Number of dimension keys of the last flushed bucket, which the next bucket is reserved for.
+    size_t mLastBucketDimensionCount = 0;
+
     int64_t mBucketSizeNs;
 
     ConditionState mCondition;
@@ -525,6 +631,25 @@ protected:
 
     sp<ConditionWizard> mWizard;
 
+    // Shared by the metrics of the config, null if dimension keys are not interned.
+    sp<DimensionKeyInterner> mDimensionKeyInterner;
+
+    // Shared by the metrics of the config, null if sliced condition queries are not memoized.
+    sp<ConditionQueryCache> mConditionQueryCache;
+
+    // Shared by the metrics of the config, null if sampling decisions are not memoized.
+    sp<SampleDecisionCache> mSampleDecisionCache;
+
+    // Shared by the metrics of the config, null if their state is allocated from the heap.
+    sp<ConfigArena> mConfigArena;
+
+    // Whether the data is reported as ColumnarMetricData, for the metric types that support it.
+    bool mColumnarReport = false;
+
+    // Dictionary of the report being dumped, null outside of onDumpReport() or if the config
+    // does not use one.
+    ReportDimensionDictionary* mDimensionDictionary = nullptr;
+
     bool mContainANYPositionInDimensionsInWhat;
 
     // Metrics slicing by primitive repeated field and/or position ALL need to use nested
@@ -558,6 +683,23 @@ protected:
     // Maps atom ids and state values to group_ids (<atom_id, <value, group_id>>).
     const std::unordered_map<int32_t, std::unordered_map<int, int64_t>> mStateGroupMap;
 
+    // The state map of one atom, as an array indexed by state value.
+    struct StateGroupTable {
+        int32_t atomId;
+        int minStateValue;
+        // Group id of each state value from minStateValue, nullopt for the values in no group.
+        std::vector<std::optional<int64_t>> groupIds;
+    };
+
+    // State maps spanning more state values than this are looked up in mStateGroupMap.
+    static constexpr int64_t kMaxStateGroupTableSize = 256;
+
+    static std::vector<StateGroupTable> buildStateGroupTables(
+            const std::unordered_map<int32_t, std::unordered_map<int, int64_t>>& stateGroupMap);
+
+    // The state maps of mStateGroupMap spanning at most kMaxStateGroupTableSize values.
+    const std::vector<StateGroupTable> mStateGroupTables;
+
     // MetricStateLinks defined in statsd_config that link fields in the state
     // atom to fields in the "what" atom.
     std::vector<Metric2State> mMetric2StateLinks;
@@ -584,6 +726,8 @@ protected:
     FRIEND_TEST(CountMetricE2eTest, TestSlicedStateWithPrimaryFields);
     FRIEND_TEST(CountMetricE2eTest, TestInitialConditionChanges);
 
+    FRIEND_TEST(CountMetricProducerTest, TestStateGroupTables);
+
     FRIEND_TEST(DurationMetricE2eTest, TestOneBucket);
     FRIEND_TEST(DurationMetricE2eTest, TestTwoBuckets);
     FRIEND_TEST(DurationMetricE2eTest, TestWithActivation);
@@ -20,9 +20,12 @@
 
 #include <private/android_filesystem_config.h>
 
+#include <algorithm>
+
 #include "CountMetricProducer.h"
 #include "condition/CombinationConditionTracker.h"
 #include "condition/SimpleConditionTracker.h"
+#include "external/Perfetto.h"
 #include "flags/FlagProvider.h"
 #include "guardrail/StatsdStats.h"
 #include "matchers/CombinationAtomMatchingTracker.h"
@@ -54,6 +57,7 @@ const int FIELD_ID_METRICS = 1;
 const int FIELD_ID_ANNOTATIONS = 7;
 const int FIELD_ID_ANNOTATIONS_INT64 = 1;
 const int FIELD_ID_ANNOTATIONS_INT32 = 2;
+const int FIELD_ID_DIMENSION_DICTIONARY = 11;
 
 // for ActiveConfig
 const int FIELD_ID_ACTIVE_CONFIG_ID = 1;
@@ -65,7 +69,8 @@ MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
                                const sp<UidMap>& uidMap,
                                const sp<StatsPullerManager>& pullerManager,
                                const sp<AlarmMonitor>& anomalyAlarmMonitor,
-                               const sp<AlarmMonitor>& periodicAlarmMonitor)
+                               const sp<AlarmMonitor>& periodicAlarmMonitor,
+                               const bool registerStateListeners)
     : mConfigKey(key),
       mUidMap(uidMap),
       mPackageCertificateHashSizeBytes(
@@ -77,7 +82,8 @@ MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
       mPullerManager(pullerManager),
       mWhitelistedAtomIds(config.whitelisted_atom_ids().begin(),
                           config.whitelisted_atom_ids().end()),
-      mShouldPersistHistory(config.persist_locally()) {
+      mShouldPersistHistory(config.persist_locally()),
+      mRegisteredToStateManager(false) {
     if (!isAtLeastU() && config.has_restricted_metrics_delegate_package_name()) {
         mInvalidConfigReason =
                 InvalidConfigReason(INVALID_CONFIG_REASON_RESTRICTED_METRIC_NOT_ENABLED);
@@ -88,6 +94,7 @@ MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
     }
     // Init the ttl end timestamp.
     refreshTtl(timeBaseNs);
+    mBestEffort = config.best_effort();
     mInvalidConfigReason = initStatsdConfig(
             key, config, uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor,
             timeBaseNs, currentTimeNs, mTagIdsToMatchersMap, mAllAtomMatchingTrackers,
@@ -95,11 +102,24 @@ MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
             mAllMetricProducers, mMetricProducerMap, mAllAnomalyTrackers, mAllPeriodicAlarmTrackers,
             mConditionToMetricMap, mTrackerToMetricMap, mTrackerToConditionMap,
             mActivationAtomTrackerToMetricMap, mDeactivationAtomTrackerToMetricMap,
-            mAlertTrackerMap, mMetricIndexesWithActivation, mStateProtoHashes, mNoReportMetricIds);
+            mAlertTrackerMap, mMetricIndexesWithActivation, mStateProtoHashes, mNoReportMetricIds,
+            registerStateListeners);
+    mRegisteredToStateManager = registerStateListeners;
+    mTagIdMatcherTable.build(mTagIdsToMatchersMap);
+    buildEvaluationPlans();
+    for (const auto& producer : mAllMetricProducers) {
+        producer->setDimensionKeyInterner(mDimensionKeyInterner);
+        producer->setConditionQueryCache(mConditionQueryCache);
+        producer->setSampleDecisionCache(mSampleDecisionCache);
+        producer->setConfigArena(mConfigArena);
+        producer->setColumnarReport(config.columnar_metric_report());
+    }
 
     mHashStringsInReport = config.hash_strings_in_metric_report();
     mVersionStringsInReport = config.version_strings_in_metric_report();
     mInstallerInReport = config.installer_in_metric_report();
+    mUidMapDeltaSnapshots = config.uid_map_delta_snapshots();
+    mDimensionDictionaryInReport = config.dimension_dictionary_in_report();
 
     createAllLogSourcesFromConfig(config);
     setMaxMetricsBytesFromConfig(config);
@@ -115,9 +135,11 @@ MetricsManager::MetricsManager(const ConfigKey& key, const StatsdConfig& config,
 }
 
 MetricsManager::~MetricsManager() {
-    for (auto it : mAllMetricProducers) {
-        for (int atomId : it->getSlicedStateAtoms()) {
-            StateManager::getInstance().unregisterListener(atomId, it);
+    if (mRegisteredToStateManager) {
+        for (auto it : mAllMetricProducers) {
+            for (int atomId : it->getSlicedStateAtoms()) {
+                StateManager::getInstance().unregisterListener(atomId, it);
+            }
         }
     }
     mPullerManager->UnregisterPullUidProvider(mConfigKey, this);
@@ -168,16 +190,38 @@ bool MetricsManager::updateConfig(const StatsdConfig& config, const int64_t time
             mTrackerToMetricMap, mTrackerToConditionMap, mActivationAtomTrackerToMetricMap,
             mDeactivationAtomTrackerToMetricMap, mMetricIndexesWithActivation, newStateProtoHashes,
             mNoReportMetricIds);
-    mAllAtomMatchingTrackers = newAtomMatchingTrackers;
-    mAtomMatchingTrackerMap = newAtomMatchingTrackerMap;
-    mAllConditionTrackers = newConditionTrackers;
-    mConditionTrackerMap = newConditionTrackerMap;
-    mAllMetricProducers = newMetricProducers;
-    mMetricProducerMap = newMetricProducerMap;
-    mStateProtoHashes = newStateProtoHashes;
-    mAllAnomalyTrackers = newAnomalyTrackers;
-    mAlertTrackerMap = newAlertTrackerMap;
-    mAllPeriodicAlarmTrackers = newPeriodicAlarmTrackers;
+    // StateTrackers hold their listeners, so the producers that are not preserved must be
+    // unregistered. The new producers are already registered.
+    const set<sp<MetricProducer>> newProducers(newMetricProducers.begin(),
+                                               newMetricProducers.end());
+    for (const sp<MetricProducer>& producer : mAllMetricProducers) {
+        if (newProducers.find(producer) == newProducers.end()) {
+            for (int atomId : producer->getSlicedStateAtoms()) {
+                StateManager::getInstance().unregisterListener(atomId, producer);
+            }
+        }
+    }
+    mAllAtomMatchingTrackers = std::move(newAtomMatchingTrackers);
+    mAtomMatchingTrackerMap = std::move(newAtomMatchingTrackerMap);
+    mAllConditionTrackers = std::move(newConditionTrackers);
+    mConditionTrackerMap = std::move(newConditionTrackerMap);
+    mAllMetricProducers = std::move(newMetricProducers);
+    mMetricProducerMap = std::move(newMetricProducerMap);
+    mStateProtoHashes = std::move(newStateProtoHashes);
+    mAllAnomalyTrackers = std::move(newAnomalyTrackers);
+    mAlertTrackerMap = std::move(newAlertTrackerMap);
+    mAllPeriodicAlarmTrackers = std::move(newPeriodicAlarmTrackers);
+    mTagIdMatcherTable.build(mTagIdsToMatchersMap);
+    mBestEffort = config.best_effort();
+    buildEvaluationPlans();
+    // Preserved metrics already hold the interner, new ones need it.
+    for (const auto& producer : mAllMetricProducers) {
+        producer->setDimensionKeyInterner(mDimensionKeyInterner);
+        producer->setConditionQueryCache(mConditionQueryCache);
+        producer->setSampleDecisionCache(mSampleDecisionCache);
+        producer->setConfigArena(mConfigArena);
+        producer->setColumnarReport(config.columnar_metric_report());
+    }
 
     mTtlNs = config.has_ttl_in_seconds() ? config.ttl_in_seconds() * NS_PER_SEC : -1;
     refreshTtl(currentTimeNs);
@@ -185,6 +229,8 @@ bool MetricsManager::updateConfig(const StatsdConfig& config, const int64_t time
     mHashStringsInReport = config.hash_strings_in_metric_report();
     mVersionStringsInReport = config.version_strings_in_metric_report();
     mInstallerInReport = config.installer_in_metric_report();
+    mUidMapDeltaSnapshots = config.uid_map_delta_snapshots();
+    mDimensionDictionaryInReport = config.dimension_dictionary_in_report();
     mWhitelistedAtomIds.clear();
     mWhitelistedAtomIds.insert(config.whitelisted_atom_ids().begin(),
                                config.whitelisted_atom_ids().end());
@@ -323,13 +369,83 @@ void MetricsManager::verifyGuardrailsAndUpdateStatsdStats() {
 void MetricsManager::initializeConfigActiveStatus() {
     mIsAlwaysActive = (mMetricIndexesWithActivation.size() != mAllMetricProducers.size()) ||
                       (mAllMetricProducers.size() == 0);
-    mIsActive = mIsAlwaysActive;
+    mActiveMetrics.assign(mAllMetricProducers.size(), false);
+    mActiveMetricCount = 0;
+    mActivationExpiryQueue = {};
+    mScheduledActivationExpiryNs.assign(mAllMetricProducers.size(), INT64_MAX);
     for (int metric : mMetricIndexesWithActivation) {
-        mIsActive |= mAllMetricProducers[metric]->isActive();
+        updateMetricActiveState(metric);
     }
+    mIsActive = mIsAlwaysActive || mActiveMetricCount > 0;
     VLOG("mIsActive is initialized to %d", mIsActive);
 }
 
+void MetricsManager::updateMetricActiveState(int metricIndex) {
+    const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
+    const bool isActive = metric->isActive();
+    if (isActive != mActiveMetrics[metricIndex]) {
+        mActiveMetrics[metricIndex] = isActive;
+        mActiveMetricCount += isActive ? 1 : -1;
+    }
+    if (!isActive) {
+        return;
+    }
+    const int64_t expiryNs = metric->getActivationExpiryNs();
+    // A later expiry is found when the scheduled one is reached.
+    if (expiryNs < mScheduledActivationExpiryNs[metricIndex]) {
+        mScheduledActivationExpiryNs[metricIndex] = expiryNs;
+        mActivationExpiryQueue.emplace(expiryNs, metricIndex);
+    }
+}
+
+void MetricsManager::flushExpiredActivations(int64_t eventTimeNs) {
+    while (!mActivationExpiryQueue.empty() && mActivationExpiryQueue.top().first < eventTimeNs) {
+        const auto [expiryNs, metricIndex] = mActivationExpiryQueue.top();
+        mActivationExpiryQueue.pop();
+        if (expiryNs != mScheduledActivationExpiryNs[metricIndex]) {
+            continue;
+        }
+        mScheduledActivationExpiryNs[metricIndex] = INT64_MAX;
+        mAllMetricProducers[metricIndex]->flushIfExpire(eventTimeNs);
+        updateMetricActiveState(metricIndex);
+    }
+}
+
+void MetricsManager::setDimensionKeyInterner(
+        const sp<DimensionKeyInterner>& dimensionKeyInterner) {
+    mDimensionKeyInterner = dimensionKeyInterner;
+    for (const auto& producer : mAllMetricProducers) {
+        producer->setDimensionKeyInterner(mDimensionKeyInterner);
+    }
+}
+
+void MetricsManager::setConfigArena(const sp<ConfigArena>& configArena) {
+    mConfigArena = configArena;
+    for (const auto& producer : mAllMetricProducers) {
+        producer->setConfigArena(mConfigArena);
+    }
+}
+
+void MetricsManager::addSharedMatchers(SharedMatcherCache& cache) const {
+    if (isConfigValid()) {
+        AtomMatcherProgram::addSharedMatchers(mAllAtomMatchingTrackers, cache);
+    }
+}
+
+void MetricsManager::shareMatcherResults(const std::shared_ptr<SharedMatcherCache>& cache) {
+    if (isConfigValid()) {
+        mAtomMatcherProgram.shareResults(mAllAtomMatchingTrackers, cache);
+    }
+}
+
+void MetricsManager::onActivationsExpired(int64_t eventTimeNs) {
+    if (!isConfigValid()) {
+        return;
+    }
+    flushExpiredActivations(eventTimeNs);
+    mIsActive = mIsAlwaysActive || mActiveMetricCount > 0;
+}
+
 void MetricsManager::initAllowedLogSources() {
     std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
     mAllowedLogSources.clear();
@@ -365,10 +481,12 @@ bool MetricsManager::isConfigValid() const {
 }
 
 void MetricsManager::notifyAppUpgrade(const int64_t& eventTimeNs, const string& apk, const int uid,
-                                      const int64_t version) {
+                                      const int64_t version, const bool splitBuckets) {
     // Inform all metric producers.
-    for (const auto& it : mAllMetricProducers) {
-        it->notifyAppUpgrade(eventTimeNs);
+    if (splitBuckets) {
+        for (const auto& it : mAllMetricProducers) {
+            it->notifyAppUpgrade(eventTimeNs);
+        }
     }
     // check if we care this package
     if (std::find(mAllowedPkg.begin(), mAllowedPkg.end(), apk) != mAllowedPkg.end()) {
@@ -386,10 +504,12 @@ void MetricsManager::notifyAppUpgrade(const int64_t& eventTimeNs, const string&
 }
 
 void MetricsManager::notifyAppRemoved(const int64_t& eventTimeNs, const string& apk,
-                                      const int uid) {
+                                      const int uid, const bool splitBuckets) {
     // Inform all metric producers.
-    for (const auto& it : mAllMetricProducers) {
-        it->notifyAppRemoved(eventTimeNs);
+    if (splitBuckets) {
+        for (const auto& it : mAllMetricProducers) {
+            it->notifyAppRemoved(eventTimeNs);
+        }
     }
     // check if we care this package
     if (std::find(mAllowedPkg.begin(), mAllowedPkg.end(), apk) != mAllowedPkg.end()) {
@@ -431,6 +551,15 @@ void MetricsManager::init() {
     }
 }
 
+void MetricsManager::registerToStateManager() {
+    for (const auto& producer : mAllMetricProducers) {
+        for (int atomId : producer->getSlicedStateAtoms()) {
+            StateManager::getInstance().registerListener(atomId, producer);
+        }
+    }
+    mRegisteredToStateManager = true;
+}
+
 vector<int32_t> MetricsManager::getPullAtomUids(int32_t atomId) {
     std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
     vector<int32_t> uids;
@@ -456,35 +585,60 @@ void MetricsManager::dumpStates(int out, bool verbose) {
     }
 }
 
+void MetricsManager::dumpMemory(int out) {
+    dprintf(out, "ConfigKey %s\n", mConfigKey.ToString().c_str());
+    size_t totalSize = 0;
+    for (const auto& producer : mAllMetricProducers) {
+        const size_t pastBucketsSize = producer->byteSize();
+        const size_t currentBucketSize = producer->currentBucketByteSize();
+        dprintf(out, "\tmetric %lld: past buckets %zu bytes, current bucket %zu bytes\n",
+                (long long)producer->getMetricId(), pastBucketsSize, currentBucketSize);
+        totalSize += pastBucketsSize + currentBucketSize;
+    }
+    for (const auto& tracker : mAllConditionTrackers) {
+        const size_t conditionSize = tracker->byteSize();
+        if (conditionSize > 0) {
+            dprintf(out, "\tcondition %lld: %zu bytes\n", (long long)tracker->getConditionId(),
+                    conditionSize);
+            totalSize += conditionSize;
+        }
+    }
+    dprintf(out, "\ttotal %zu bytes\n", totalSize);
+}
+
 void MetricsManager::dropData(const int64_t dropTimeNs) {
     for (const auto& producer : mAllMetricProducers) {
         producer->dropData(dropTimeNs);
     }
 }
 
-void MetricsManager::onDumpReport(const int64_t dumpTimeStampNs, const int64_t wallClockNs,
-                                  const bool include_current_partial_bucket, const bool erase_data,
-                                  const DumpLatency dumpLatency, std::set<string>* str_set,
-                                  ProtoOutputStream* protoOutput) {
+void MetricsManager::onDumpReport(
+        const int64_t dumpTimeStampNs, const int64_t wallClockNs,
+        const bool include_current_partial_bucket, const bool erase_data,
+        const DumpLatency dumpLatency, std::set<string>* str_set, ProtoOutputStream* protoOutput,
+        const std::function<void(ProtoOutputStream*)>& flushCompletedFields) {
+    ScopedStageTrace trace("MetricsManager::onDumpReport");
     if (hasRestrictedMetricsDelegate()) {
         // TODO(b/268150038): report error to statsdstats
         VLOG("Unexpected call to onDumpReport in restricted metricsmanager.");
         return;
     }
     VLOG("=========================Metric Reports Start==========================");
+    std::set<string>* const strSet = mHashStringsInReport ? str_set : nullptr;
+    ReportDimensionDictionary dimensionDictionary;
+    ReportDimensionDictionary* const dictionary =
+            mDimensionDictionaryInReport ? &dimensionDictionary : nullptr;
     // one StatsLogReport per MetricProduer
     for (const auto& producer : mAllMetricProducers) {
         if (mNoReportMetricIds.find(producer->getMetricId()) == mNoReportMetricIds.end()) {
             uint64_t token = protoOutput->start(
                     FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_METRICS);
-            if (mHashStringsInReport) {
-                producer->onDumpReport(dumpTimeStampNs, include_current_partial_bucket, erase_data,
-                                       dumpLatency, str_set, protoOutput);
-            } else {
-                producer->onDumpReport(dumpTimeStampNs, include_current_partial_bucket, erase_data,
-                                       dumpLatency, nullptr, protoOutput);
-            }
+            producer->onDumpReport(dumpTimeStampNs, include_current_partial_bucket, erase_data,
+                                   dumpLatency, strSet, protoOutput, dictionary);
             protoOutput->end(token);
+            if (flushCompletedFields) {
+                flushCompletedFields(protoOutput);
+            }
         } else {
             producer->clearPastBuckets(dumpTimeStampNs);
         }
@@ -497,6 +651,7 @@ void MetricsManager::onDumpReport(const int64_t dumpTimeStampNs, const int64_t w
         protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_ANNOTATIONS_INT32, annotation.second);
         protoOutput->end(token);
     }
+    dimensionDictionary.writeToProto(FIELD_ID_DIMENSION_DICTIONARY, strSet, protoOutput);
 
     // Do not update the timestamps when data is not cleared to avoid timestamps from being
     // misaligned.
@@ -512,21 +667,33 @@ bool MetricsManager::checkLogCredentials(const LogEvent& event) {
         return true;
     }
 
-    if (event.GetUid() == AID_ROOT ||
-        (event.GetUid() >= AID_SYSTEM && event.GetUid() < AID_SHELL)) {
-        // enable atoms logged from pre-installed Android system services
+    if (isSystemLogSource(event.GetUid())) {
         return true;
     }
 
-    std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
-    if (mAllowedLogSources.find(event.GetUid()) == mAllowedLogSources.end()) {
+    if (!isAllowedLogSource(event.GetUid())) {
         VLOG("log source %d not on the whitelist", event.GetUid());
         return false;
     }
     return true;
 }
 
-bool MetricsManager::eventSanityCheck(const LogEvent& event) {
+bool MetricsManager::isSystemLogSource(int32_t uid) {
+    // enable atoms logged from pre-installed Android system services
+    return uid == AID_ROOT || (uid >= AID_SYSTEM && uid < AID_SHELL);
+}
+
+bool MetricsManager::isAllowedLogSource(int32_t uid) const {
+    std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
+    return mAllowedLogSources.find(uid) != mAllowedLogSources.end();
+}
+
+std::set<int32_t> MetricsManager::getAllowedLogSources() const {
+    std::lock_guard<std::mutex> lock(mAllowedLogSourcesMutex);
+    return mAllowedLogSources;
+}
+
+bool MetricsManager::eventSanityCheck(const LogEvent& event, const sp<UidMap>& uidMap) {
     if (event.GetTagId() == util::APP_BREADCRUMB_REPORTED) {
         // Check that app breadcrumb reported fields are valid.
         status_t err = NO_ERROR;
@@ -541,7 +708,7 @@ bool MetricsManager::eventSanityCheck(const LogEvent& event) {
 
         // Because the uid within the LogEvent may have been mapped from
         // isolated to host, map the loggerUid similarly before comparing.
-        int32_t loggerUid = mUidMap->getHostUidOrSelf(event.GetUid());
+        int32_t loggerUid = uidMap->getHostUidOrSelf(event.GetUid());
         if (loggerUid != appHookUid && loggerUid != AID_STATSD) {
             VLOG("APP_BREADCRUMB_REPORTED has invalid uid: claimed %ld but caller is %d",
                  appHookUid, loggerUid);
@@ -562,45 +729,36 @@ bool MetricsManager::eventSanityCheck(const LogEvent& event) {
     return true;
 }
 
-// Consume the stats log if it's interesting to this metric.
 void MetricsManager::onLogEvent(const LogEvent& event) {
-    if (!isConfigValid()) {
+    if (!eventSanityCheck(event, mUidMap)) {
         return;
     }
+    onLogEvent(event, isSystemLogSource(event.GetUid()) || isAllowedLogSource(event.GetUid()));
+}
 
-    if (!checkLogCredentials(event)) {
+// Consume the stats log if it's interesting to this metric.
+void MetricsManager::onLogEvent(const LogEvent& event, bool fromAllowedLogSource) {
+    ScopedStageTrace trace("MetricsManager::onLogEvent");
+    if (!isConfigValid()) {
         return;
     }
 
-    // TODO(b/212755214): this check could be done once on the StatsLogProcessor level
-    if (!eventSanityCheck(event)) {
+    if (!fromAllowedLogSource &&
+        mWhitelistedAtomIds.find(event.GetTagId()) == mWhitelistedAtomIds.end()) {
+        VLOG("log source %d not on the whitelist", event.GetUid());
         return;
     }
 
     const int tagId = event.GetTagId();
     const int64_t eventTimeNs = event.GetElapsedTimestampNs();
 
-    bool isActive = mIsAlwaysActive;
+    // Update state of the metrics whose activation lapsed as of eventTimeNs.
+    flushExpiredActivations(eventTimeNs);
+    mIsActive = mIsAlwaysActive || mActiveMetricCount > 0;
 
-    // Set of metrics that are still active after flushing.
-    unordered_set<int> activeMetricsIndices;
-
-    // Update state of all metrics w/ activation conditions as of eventTimeNs.
-    for (int metricIndex : mMetricIndexesWithActivation) {
-        const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
-        metric->flushIfExpire(eventTimeNs);
-        if (metric->isActive()) {
-            // If this metric w/ activation condition is still active after
-            // flushing, remember it.
-            activeMetricsIndices.insert(metricIndex);
-        }
-    }
+    const AtomMatcherDispatchTable::Range matchers = mTagIdMatcherTable.lookup(tagId);
 
-    mIsActive = isActive || !activeMetricsIndices.empty();
-
-    const auto matchersIt = mTagIdsToMatchersMap.find(tagId);
-
-    if (matchersIt == mTagIdsToMatchersMap.end()) {
+    if (matchers.empty()) {
         // Not interesting...
         return;
     }
@@ -608,120 +766,235 @@ void MetricsManager::onLogEvent(const LogEvent& event) {
     if (event.isParsedHeaderOnly()) {
         // This should not happen if metric config is defined for certain atom id
         const int64_t firstMatcherId =
-                mAllAtomMatchingTrackers[*matchersIt->second.begin()]->getId();
+                mAllAtomMatchingTrackers[*matchers.begin()]->getId();
         ALOGW("Atom %d is mistakenly skipped - there is a matcher %lld for it", tagId,
               (long long)firstMatcherId);
         return;
     }
 
-    vector<MatchingState> matcherCache(mAllAtomMatchingTrackers.size(),
-                                       MatchingState::kNotComputed);
+    if (mLoadShedding && mSheddableAtomIds.find(tagId) != mSheddableAtomIds.end()) {
+        if (mLoadSheddingSampleCounter++ % StatsdStats::kLoadSheddingSampleInterval != 0) {
+            mShedEventCount++;
+            return;
+        }
+        // Report the skipped events once per sampled event rather than taking the StatsdStats
+        // lock for each of them.
+        flushShedEventCount();
+    }
+
+    const bool costSampled =
+            mProcessingCostSampleCounter++ % StatsdStats::kProcessingCostSampleInterval == 0;
+    const int64_t costStartWallNs = costSampled ? getElapsedRealtimeNs() : 0;
+    const int64_t costStartCpuNs = costSampled ? getThreadCpuTimeNs() : 0;
 
-    for (const auto& matcherIndex : matchersIt->second) {
-        mAllAtomMatchingTrackers[matcherIndex]->onLogEvent(event, mAllAtomMatchingTrackers,
-                                                           matcherCache);
+    if (mMatcherCache.size() != mAllAtomMatchingTrackers.size()) {
+        mMatcherCache.assign(mAllAtomMatchingTrackers.size(), MatchingState::kNotComputed);
+    }
+    if (mConditionCache.size() != mAllConditionTrackers.size()) {
+        mConditionToBeEvaluated.assign(mAllConditionTrackers.size(), false);
+        mConditionCache.assign(mAllConditionTrackers.size(), ConditionState::kNotEvaluated);
+        mConditionChangedCache.assign(mAllConditionTrackers.size(), false);
     }
+    vector<MatchingState>& matcherCache = mMatcherCache;
 
-    // Set of metrics that received an activation cancellation.
-    unordered_set<int> metricIndicesWithCanceledActivations;
+    mAtomMatcherProgram.evaluate(event, mAllAtomMatchingTrackers, matcherCache);
 
-    // Determine which metric activations received a cancellation and cancel them.
-    for (const auto& it : mDeactivationAtomTrackerToMetricMap) {
-        if (matcherCache[it.first] == MatchingState::kMatched) {
-            for (int metricIndex : it.second) {
-                mAllMetricProducers[metricIndex]->cancelEventActivation(it.first);
-                metricIndicesWithCanceledActivations.insert(metricIndex);
-            }
+    // Only the matchers interested in this atom can match it, and they are listed in increasing
+    // index order.
+    mMatchedMatcherIndices.clear();
+    for (const int matcherIndex : matchers) {
+        if (matcherCache[matcherIndex] == MatchingState::kMatched) {
+            mMatchedMatcherIndices.push_back(matcherIndex);
         }
     }
 
-    // Determine whether any metrics are no longer active after cancelling metric activations.
-    for (const int metricIndex : metricIndicesWithCanceledActivations) {
-        const sp<MetricProducer>& metric = mAllMetricProducers[metricIndex];
-        metric->flushIfExpire(eventTimeNs);
-        if (!metric->isActive()) {
-            activeMetricsIndices.erase(metricIndex);
+    // Determine which metric activations received a cancellation and cancel them.
+    for (const int matcherIndex : mMatchedMatcherIndices) {
+        for (const MetricDispatchPlan::Target& target :
+             mMetricDispatchPlan.getDeactivatedMetrics(matcherIndex)) {
+            target.metric->cancelEventActivation(matcherIndex);
+            // Determine whether the metric is no longer active after cancelling the activation.
+            target.metric->flushIfExpire(eventTimeNs);
+            updateMetricActiveState(target.metricIndex);
         }
     }
 
-    isActive |= !activeMetricsIndices.empty();
-
-
     // Determine which metric activations should be turned on and turn them on
-    for (const auto& it : mActivationAtomTrackerToMetricMap) {
-        if (matcherCache[it.first] == MatchingState::kMatched) {
-            for (int metricIndex : it.second) {
-                mAllMetricProducers[metricIndex]->activate(it.first, eventTimeNs);
-                isActive |= mAllMetricProducers[metricIndex]->isActive();
-            }
+    for (const int matcherIndex : mMatchedMatcherIndices) {
+        for (const MetricDispatchPlan::Target& target :
+             mMetricDispatchPlan.getActivatedMetrics(matcherIndex)) {
+            target.metric->activate(matcherIndex, eventTimeNs);
+            updateMetricActiveState(target.metricIndex);
         }
     }
 
-    mIsActive = isActive;
+    mIsActive = mIsAlwaysActive || mActiveMetricCount > 0;
 
-    // A bitmap to see which ConditionTracker needs to be re-evaluated.
-    vector<bool> conditionToBeEvaluated(mAllConditionTrackers.size(), false);
-
-    for (const auto& pair : mTrackerToConditionMap) {
-        if (matcherCache[pair.first] == MatchingState::kMatched) {
-            const auto& conditionList = pair.second;
-            for (const int conditionIndex : conditionList) {
-                conditionToBeEvaluated[conditionIndex] = true;
+    // Collect the ConditionTrackers that need to be re-evaluated, with their descendants.
+    mConditionsToEvaluate.clear();
+    int matchersWithConditions = 0;
+    for (const int matcherIndex : mMatchedMatcherIndices) {
+        const vector<int>& conditions = mConditionEvaluationPlan.getConditions(matcherIndex);
+        if (conditions.empty()) {
+            continue;
+        }
+        matchersWithConditions++;
+        for (const int conditionIndex : conditions) {
+            if (!mConditionToBeEvaluated[conditionIndex]) {
+                mConditionToBeEvaluated[conditionIndex] = true;
+                mConditionsToEvaluate.push_back(conditionIndex);
             }
         }
     }
+    // The conditions of a single matcher are already ranked.
+    if (matchersWithConditions > 1) {
+        std::sort(mConditionsToEvaluate.begin(), mConditionsToEvaluate.end(),
+                  [this](int a, int b) {
+                      return mConditionEvaluationPlan.getRank(a) <
+                             mConditionEvaluationPlan.getRank(b);
+                  });
+    }
 
-    vector<ConditionState> conditionCache(mAllConditionTrackers.size(),
-                                          ConditionState::kNotEvaluated);
+    vector<ConditionState>& conditionCache = mConditionCache;
     // A bitmap to track if a condition has changed value.
-    vector<bool> changedCache(mAllConditionTrackers.size(), false);
-    for (size_t i = 0; i < mAllConditionTrackers.size(); i++) {
-        if (conditionToBeEvaluated[i] == false) {
-            continue;
-        }
-        sp<ConditionTracker>& condition = mAllConditionTrackers[i];
+    vector<bool>& changedCache = mConditionChangedCache;
+    // Children come first, so a combination condition finds them evaluated.
+    for (const int conditionIndex : mConditionsToEvaluate) {
+        sp<ConditionTracker>& condition = mAllConditionTrackers[conditionIndex];
         condition->evaluateCondition(event, matcherCache, mAllConditionTrackers, conditionCache,
                                      changedCache);
     }
+    mTouchedConditionIndices.assign(mConditionsToEvaluate.begin(), mConditionsToEvaluate.end());
+    std::sort(mTouchedConditionIndices.begin(), mTouchedConditionIndices.end());
 
-    for (size_t i = 0; i < mAllConditionTrackers.size(); i++) {
+    for (const int i : mTouchedConditionIndices) {
         if (changedCache[i] == false) {
             continue;
         }
-        auto pair = mConditionToMetricMap.find(i);
-        if (pair != mConditionToMetricMap.end()) {
-            auto& metricList = pair->second;
-            for (auto metricIndex : metricList) {
-                // Metric cares about non sliced condition, and it's changed.
-                // Push the new condition to it directly.
-                if (!mAllMetricProducers[metricIndex]->isConditionSliced()) {
-                    mAllMetricProducers[metricIndex]->onConditionChanged(conditionCache[i],
-                                                                         eventTimeNs);
-                    // Metric cares about sliced conditions, and it may have changed. Send
-                    // notification, and the metric can query the sliced conditions that are
-                    // interesting to it.
-                } else {
-                    mAllMetricProducers[metricIndex]->onSlicedConditionMayChange(conditionCache[i],
-                                                                                 eventTimeNs);
-                }
+        for (const MetricDispatchPlan::Target& target :
+             mMetricDispatchPlan.getConditionMetrics(i)) {
+            // Metric cares about non sliced condition, and it's changed.
+            // Push the new condition to it directly.
+            if (!target.metric->isConditionSliced()) {
+                target.metric->onConditionChanged(conditionCache[i], eventTimeNs);
+                // Metric cares about sliced conditions, and it may have changed. Send
+                // notification, and the metric can query the sliced conditions that are
+                // interesting to it.
+            } else {
+                target.metric->onSlicedConditionMayChange(conditionCache[i], eventTimeNs);
             }
         }
     }
-    // For matched AtomMatchers, tell relevant metrics that a matched event has come.
-    for (size_t i = 0; i < mAllAtomMatchingTrackers.size(); i++) {
-        if (matcherCache[i] == MatchingState::kMatched) {
-            StatsdStats::getInstance().noteMatcherMatched(mConfigKey,
-                                                          mAllAtomMatchingTrackers[i]->getId());
-            auto pair = mTrackerToMetricMap.find(i);
-            if (pair != mTrackerToMetricMap.end()) {
-                auto& metricList = pair->second;
-                for (const int metricIndex : metricList) {
-                    // pushed metrics are never scheduled pulls
-                    mAllMetricProducers[metricIndex]->onMatchedLogEvent(i, event);
-                }
+    // For matched AtomMatchers, tell relevant metrics that a matched event has come. Metrics
+    // sharing a sliced condition or a sampled field reuse each other's condition queries and
+    // sampling decisions for this event.
+    mConditionQueryCache->setCurrentEvent(&event);
+    mSampleDecisionCache->setCurrentEvent(&event);
+    mMatchedMatcherIds.clear();
+    for (const int i : mMatchedMatcherIndices) {
+        mMatchedMatcherIds.push_back(mAllAtomMatchingTrackers[i]->getId());
+        for (const MetricDispatchPlan::Target& target : mMetricDispatchPlan.getMatchedMetrics(i)) {
+            MetricProducer* const metric = target.metric;
+            if (!costSampled) {
+                // pushed metrics are never scheduled pulls
+                metric->onMatchedLogEvent(i, event);
+                continue;
             }
+            const int64_t metricStartWallNs = getElapsedRealtimeNs();
+            const int64_t metricStartCpuNs = getThreadCpuTimeNs();
+            metric->onMatchedLogEvent(i, event);
+            mMetricCostSamples.push_back({metric->getMetricId(),
+                                          getElapsedRealtimeNs() - metricStartWallNs,
+                                          getThreadCpuTimeNs() - metricStartCpuNs});
         }
     }
+
+    mConditionQueryCache->setCurrentEvent(nullptr);
+    mSampleDecisionCache->setCurrentEvent(nullptr);
+    if (!mMatchedMatcherIds.empty()) {
+        StatsdStats::getInstance().noteMatchersMatched(mConfigKey, mMatchedMatcherIds);
+    }
+
+    // Leave the scratch caches clean for the next event, visiting only the touched entries.
+    // The matcher program only computes the matchers interested in the atom.
+    for (const int matcherIndex : matchers) {
+        matcherCache[matcherIndex] = MatchingState::kNotComputed;
+    }
+    for (const int conditionIndex : mConditionsToEvaluate) {
+        mConditionToBeEvaluated[conditionIndex] = false;
+        conditionCache[conditionIndex] = ConditionState::kNotEvaluated;
+        changedCache[conditionIndex] = false;
+    }
+
+    if (costSampled) {
+        StatsdStats::getInstance().noteEventProcessingCost(
+                mConfigKey, getElapsedRealtimeNs() - costStartWallNs,
+                getThreadCpuTimeNs() - costStartCpuNs, mMetricCostSamples);
+        mMetricCostSamples.clear();
+    }
+}
+
+void MetricsManager::buildEvaluationPlans() {
+    if (!isConfigValid()) {
+        mAtomMatcherProgram.clear();
+        mConditionEvaluationPlan.clear();
+        mMetricDispatchPlan.clear();
+        mSheddableAtomIds.clear();
+        return;
+    }
+    mAtomMatcherProgram.build(mAllAtomMatchingTrackers, mTagIdsToMatchersMap);
+    mConditionEvaluationPlan.build(mAllConditionTrackers, mTrackerToConditionMap);
+    mMetricDispatchPlan.build(mAllMetricProducers, mAllAtomMatchingTrackers.size(),
+                              mAllConditionTrackers.size(), mTrackerToMetricMap,
+                              mConditionToMetricMap, mActivationAtomTrackerToMetricMap,
+                              mDeactivationAtomTrackerToMetricMap);
+    buildSheddableAtomIds();
+}
+
+void MetricsManager::buildSheddableAtomIds() {
+    mSheddableAtomIds.clear();
+    if (!mBestEffort) {
+        return;
+    }
+    for (const auto& [atomId, matcherIndices] : mTagIdsToMatchersMap) {
+        const bool sheddable = std::all_of(
+                matcherIndices.begin(), matcherIndices.end(), [this](const int matcherIndex) {
+                    if (!mConditionEvaluationPlan.getConditions(matcherIndex).empty() ||
+                        !mMetricDispatchPlan.getActivatedMetrics(matcherIndex).empty() ||
+                        !mMetricDispatchPlan.getDeactivatedMetrics(matcherIndex).empty()) {
+                        return false;
+                    }
+                    for (const MetricDispatchPlan::Target& target :
+                         mMetricDispatchPlan.getMatchedMetrics(matcherIndex)) {
+                        if (target.metric->getMetricType() == METRIC_TYPE_DURATION) {
+                            return false;
+                        }
+                    }
+                    return true;
+                });
+        if (sheddable) {
+            mSheddableAtomIds.insert(atomId);
+        }
+    }
+}
+
+void MetricsManager::setLoadShedding(bool loadShedding) {
+    if (mLoadShedding == loadShedding) {
+        return;
+    }
+    mLoadShedding = loadShedding;
+    if (!loadShedding) {
+        flushShedEventCount();
+        mLoadSheddingSampleCounter = 0;
+    }
+}
+
+void MetricsManager::flushShedEventCount() {
+    if (mShedEventCount == 0) {
+        return;
+    }
+    StatsdStats::getInstance().noteEventsShed(mConfigKey, mShedEventCount);
+    mShedEventCount = 0;
 }
 
 void MetricsManager::onAnomalyAlarmFired(
@@ -762,11 +1035,12 @@ void MetricsManager::loadActiveConfig(const ActiveConfig& config, int64_t curren
             if (metric->getMetricId() == activeMetric.id()) {
                 VLOG("Setting active metric: %lld", (long long)metric->getMetricId());
                 metric->loadActiveMetric(activeMetric, currentTimeNs);
-                if (!mIsActive && metric->isActive()) {
+                updateMetricActiveState(metricIndex);
+                if (!mIsActive && mActiveMetrics[metricIndex]) {
                     StatsdStats::getInstance().noteActiveStatusChanged(mConfigKey,
                                                                        /*activate=*/ true);
                 }
-                mIsActive |= metric->isActive();
+                mIsActive |= mActiveMetrics[metricIndex];
             }
         }
     }
@@ -832,11 +1106,40 @@ void MetricsManager::loadMetadata(const metadata::StatsMetadata& metadata,
         const auto& it = mMetricProducerMap.find(metricId);
         if (it == mMetricProducerMap.end()) {
             ALOGE("No metricProducer found for metricId %lld", (long long)metricId);
+            continue;
         }
         mAllMetricProducers[it->second]->loadMetricMetadataFromProto(metricMetadata);
     }
 }
 
+bool MetricsManager::writeBucketCheckpoints(metadata::ConfigBucketCheckpoints* checkpoints) {
+    bool checkpointWritten = false;
+    metadata::ConfigKey* configKey = checkpoints->mutable_config_key();
+    configKey->set_config_id(mConfigKey.GetId());
+    configKey->set_uid(mConfigKey.GetUid());
+    for (const auto& metricProducer : mAllMetricProducers) {
+        metadata::BucketCheckpoint* checkpoint = checkpoints->add_bucket_checkpoint();
+        if (!metricProducer->writeBucketCheckpoint(checkpoint)) {
+            checkpoints->mutable_bucket_checkpoint()->RemoveLast();
+            continue;
+        }
+        checkpointWritten = true;
+    }
+    return checkpointWritten;
+}
+
+void MetricsManager::restoreBucketCheckpoints(const metadata::ConfigBucketCheckpoints& checkpoints,
+                                              int64_t checkpointNs) {
+    for (const metadata::BucketCheckpoint& checkpoint : checkpoints.bucket_checkpoint()) {
+        const auto& it = mMetricProducerMap.find(checkpoint.metric_id());
+        if (it == mMetricProducerMap.end()) {
+            VLOG("No metricProducer found for metricId %lld", (long long)checkpoint.metric_id());
+            continue;
+        }
+        mAllMetricProducers[it->second]->restoreBucketCheckpoint(checkpoint, checkpointNs);
+    }
+}
+
 void MetricsManager::enforceRestrictedDataTtls(const int64_t wallClockNs) {
     if (!hasRestrictedMetricsDelegate()) {
         return;
@@ -863,13 +1166,13 @@ bool MetricsManager::validateRestrictedMetricsDelegate(const int32_t callingUid)
     return possibleUids.find(callingUid) != possibleUids.end();
 }
 
-void MetricsManager::flushRestrictedData() {
+void MetricsManager::flushRestrictedData(const bool asyncInsert) {
     if (!hasRestrictedMetricsDelegate()) {
         return;
     }
     int64_t flushStartNs = getElapsedRealtimeNs();
     for (const auto& producer : mAllMetricProducers) {
-        producer->flushRestrictedData();
+        producer->flushRestrictedData(asyncInsert);
     }
     StatsdStats::getInstance().noteRestrictedConfigFlushLatency(
             mConfigKey, getElapsedRealtimeNs() - flushStartNs);
@@ -890,6 +1193,32 @@ void MetricsManager::addAllAtomIds(LogEventFilter::AtomIdSet& allIds) const {
     }
 }
 
+void MetricsManager::addAllAtomFieldMasks(AtomFieldMasks& fieldMasks) const {
+    // Restricted metrics store the events as they are.
+    const bool usesAllFields = hasRestrictedMetricsDelegate();
+    for (const auto& [atomId, _] : mTagIdsToMatchersMap) {
+        TopLevelFieldMask& fieldMask = fieldMasks[atomId];
+        if (usesAllFields) {
+            fieldMask.set();
+        }
+    }
+    for (const auto& matcher : mAllAtomMatchingTrackers) {
+        matcher->addFieldsInUse(&fieldMasks);
+    }
+    for (const auto& condition : mAllConditionTrackers) {
+        condition->addFieldsInUse(&fieldMasks);
+    }
+    for (const auto& [matcherIndex, metricIndices] : mTrackerToMetricMap) {
+        for (const int metricIndex : metricIndices) {
+            if (mAllMetricProducers[metricIndex]->addFieldsInUse(&fieldMasks)) {
+                for (const int atomId : mAllAtomMatchingTrackers[matcherIndex]->getAtomIds()) {
+                    fieldMasks[atomId].set();
+                }
+            }
+        }
+    }
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
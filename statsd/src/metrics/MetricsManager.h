@@ -16,17 +16,26 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <queue>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "anomaly/AlarmMonitor.h"
 #include "anomaly/AlarmTracker.h"
 #include "anomaly/AnomalyTracker.h"
+#include "condition/ConditionEvaluationPlan.h"
 #include "condition/ConditionTracker.h"
 #include "config/ConfigKey.h"
 #include "external/StatsPullerManager.h"
 #include "guardrail/StatsdStats.h"
 #include "logd/LogEvent.h"
+#include "matchers/AtomMatcherDispatchTable.h"
+#include "matchers/AtomMatcherProgram.h"
 #include "matchers/AtomMatchingTracker.h"
+#include "matchers/SharedMatcherCache.h"
+#include "metrics/MetricDispatchPlan.h"
 #include "metrics/MetricProducer.h"
 #include "packages/UidMap.h"
 #include "src/statsd_config.pb.h"
@@ -43,7 +52,8 @@ public:
                    const int64_t currentTimeNs, const sp<UidMap>& uidMap,
                    const sp<StatsPullerManager>& pullerManager,
                    const sp<AlarmMonitor>& anomalyAlarmMonitor,
-                   const sp<AlarmMonitor>& periodicAlarmMonitor);
+                   const sp<AlarmMonitor>& periodicAlarmMonitor,
+                   const bool registerStateListeners = true);
 
     virtual ~MetricsManager();
 
@@ -56,9 +66,45 @@ public:
 
     bool checkLogCredentials(const LogEvent& event);
 
-    bool eventSanityCheck(const LogEvent& event);
+    // Returns whether events from the uid are accepted by every config: the root and the
+    // pre-installed system services.
+    static bool isSystemLogSource(int32_t uid);
 
-    virtual void onLogEvent(const LogEvent& event);
+    // Returns whether the uid is one of the log sources allowed by this config.
+    bool isAllowedLogSource(int32_t uid) const;
+
+    // Returns the uids of the log sources allowed by this config.
+    std::set<int32_t> getAllowedLogSources() const;
+
+    static bool eventSanityCheck(const LogEvent& event, const sp<UidMap>& uidMap);
+
+    // Checks the credentials and the sanity of the event before processing it.
+    void onLogEvent(const LogEvent& event);
+
+    // Processes an event that already passed eventSanityCheck. [fromAllowedLogSource] is whether
+    // the event was logged by a system log source or by one of the allowed log sources of this
+    // config, as computed once per event by StatsLogProcessor.
+    virtual void onLogEvent(const LogEvent& event, bool fromAllowedLogSource);
+
+    // Position of this config in the log source masks of StatsLogProcessor, or kNoLogSourceSlot
+    // if it has none yet.
+    static constexpr size_t kNoLogSourceSlot = SIZE_MAX;
+
+    size_t getLogSourceSlot() const {
+        return mLogSourceSlot;
+    }
+
+    void setLogSourceSlot(size_t slot) {
+        mLogSourceSlot = slot;
+    }
+
+    // While shedding load, a best effort config only processes one in
+    // StatsdStats::kLoadSheddingSampleInterval of the events of its sheddable atoms.
+    void setLoadShedding(bool loadShedding);
+
+    bool isBestEffort() const {
+        return mBestEffort;
+    }
 
     void onAnomalyAlarmFired(
         const int64_t& timestampNs,
@@ -68,10 +114,13 @@ public:
         const int64_t& timestampNs,
         unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>>& alarmSet);
 
+    // The metrics only split their buckets if splitBuckets is true. The StatsLogProcessor
+    // coalesces the splits of app changes that come in bursts.
     void notifyAppUpgrade(const int64_t& eventTimeNs, const string& apk, const int uid,
-                          const int64_t version);
+                          const int64_t version, const bool splitBuckets = true);
 
-    void notifyAppRemoved(const int64_t& eventTimeNs, const string& apk, const int uid);
+    void notifyAppRemoved(const int64_t& eventTimeNs, const string& apk, const int uid,
+                          const bool splitBuckets = true);
 
     void onUidMapReceived(const int64_t& eventTimeNs);
 
@@ -79,6 +128,10 @@ public:
 
     void init();
 
+    // Registers the metrics sliced by state to the StateManager, for a MetricsManager created
+    // without registering them. Must be called with the StatsLogProcessor lock held.
+    void registerToStateManager();
+
     vector<int32_t> getPullAtomUids(int32_t atomId) override;
 
     bool shouldWriteToDisk() const {
@@ -91,10 +144,18 @@ public:
 
     void dumpStates(int out, bool verbose);
 
+    // Writes the estimated heap bytes held by each metric and sliced condition of the config.
+    void dumpMemory(int out);
+
     inline bool isInTtl(const int64_t timestampNs) const {
         return mTtlNs <= 0 || timestampNs < mTtlEndNs;
     };
 
+    // First timestamp at which the config is not in its ttl, INT64_MAX if it has none.
+    inline int64_t getTtlExpiryNs() const {
+        return mTtlNs <= 0 ? INT64_MAX : mTtlEndNs;
+    }
+
     inline bool hashStringInReport() const {
         return mHashStringsInReport;
     };
@@ -111,6 +172,10 @@ public:
         return mPackageCertificateHashSizeBytes;
     }
 
+    inline bool uidMapDeltaSnapshots() const {
+        return mUidMapDeltaSnapshots;
+    }
+
     void refreshTtl(const int64_t currentTimestampNs) {
         if (mTtlNs > 0) {
             mTtlEndNs = currentTimestampNs + mTtlNs;
@@ -133,10 +198,15 @@ public:
 
     virtual void dropData(const int64_t dropTimeNs);
 
-    virtual void onDumpReport(const int64_t dumpTimeNs, const int64_t wallClockNs,
-                              const bool include_current_partial_bucket, const bool erase_data,
-                              const DumpLatency dumpLatency, std::set<string>* str_set,
-                              android::util::ProtoOutputStream* protoOutput);
+    // If flushCompletedFields is set, it is called each time protoOutput only holds completed
+    // fields, after every metric report, so the caller can drain the stream.
+    virtual void onDumpReport(
+            const int64_t dumpTimeNs, const int64_t wallClockNs,
+            const bool include_current_partial_bucket, const bool erase_data,
+            const DumpLatency dumpLatency, std::set<string>* str_set,
+            android::util::ProtoOutputStream* protoOutput,
+            const std::function<void(android::util::ProtoOutputStream*)>& flushCompletedFields =
+                    nullptr);
 
     // Computes the total byte size of all metrics managed by a single config source.
     // Does not change the state.
@@ -148,6 +218,29 @@ public:
         return mIsActive;
     }
 
+    // Flushes the metric activations that lapsed before eventTimeNs, as onLogEvent does for
+    // every event. Lets the caller skip the events of atoms the config does not use.
+    void onActivationsExpired(int64_t eventTimeNs);
+
+    // Makes the metric producers store their dimension keys in dimensionKeyInterner, shared with
+    // the other configs, instead of the interner of this config.
+    void setDimensionKeyInterner(const sp<DimensionKeyInterner>& dimensionKeyInterner);
+
+    // Makes the metric producers allocate their long lived state from configArena.
+    void setConfigArena(const sp<ConfigArena>& configArena);
+
+    // Adds the matchers of the config to cache, before the configs sharing it take their slots.
+    void addSharedMatchers(SharedMatcherCache& cache) const;
+
+    // Shares the results of the matchers other configs also define through cache. The config
+    // must only process events on the thread using cache.
+    void shareMatcherResults(const std::shared_ptr<SharedMatcherCache>& cache);
+
+    // Earliest activation expiry onActivationsExpired would act on, INT64_MAX if none.
+    int64_t getNextActivationExpiryNs() const {
+        return mActivationExpiryQueue.empty() ? INT64_MAX : mActivationExpiryQueue.top().first;
+    }
+
     void loadActiveConfig(const ActiveConfig& config, int64_t currentTimeNs);
 
     void writeActiveConfigToProtoOutputStream(
@@ -162,6 +255,12 @@ public:
                       int64_t currentWallClockTimeNs,
                       int64_t systemElapsedTimeNs);
 
+    // Returns true if the in progress bucket of at least one metric is written.
+    bool writeBucketCheckpoints(metadata::ConfigBucketCheckpoints* checkpoints);
+
+    void restoreBucketCheckpoints(const metadata::ConfigBucketCheckpoints& checkpoints,
+                                  int64_t checkpointNs);
+
     inline bool hasRestrictedMetricsDelegate() const {
         return mRestrictedMetricsDelegatePackageName.has_value();
     }
@@ -178,7 +277,7 @@ public:
 
     bool validateRestrictedMetricsDelegate(const int32_t callingUid);
 
-    virtual void flushRestrictedData();
+    virtual void flushRestrictedData(const bool asyncInsert);
 
     // Slow, should not be called in a hotpath.
     vector<int64_t> getAllMetricIds() const;
@@ -186,6 +285,9 @@ public:
     // Adds all atom ids referenced by matchers in the MetricsManager's config
     void addAllAtomIds(LogEventFilter::AtomIdSet& allIds) const;
 
+    // Adds the top-level fields read by the MetricsManager's config for each of its atoms
+    void addAllAtomFieldMasks(AtomFieldMasks& fieldMasks) const;
+
     // Gets the memory limit for the MetricsManager's config
     inline size_t getMaxMetricsBytes() const {
         return mMaxMetricsBytes;
@@ -208,6 +310,10 @@ private:
     bool mInstallerInReport = false;
     uint8_t mPackageCertificateHashSizeBytes;
 
+    bool mUidMapDeltaSnapshots = false;
+
+    bool mDimensionDictionaryInReport = false;
+
     int64_t mTtlNs;
     int64_t mTtlEndNs;
 
@@ -233,6 +339,8 @@ private:
 
     std::set<int32_t> mWhitelistedAtomIds;
 
+    size_t mLogSourceSlot = kNoLogSourceSlot;
+
     // We can pull any atom from these uids.
     std::set<int32_t> mDefaultPullUids;
 
@@ -251,9 +359,34 @@ private:
 
     bool mShouldPersistHistory;
 
+    // Whether the metrics sliced by state were registered to the StateManager.
+    bool mRegisteredToStateManager;
+
     // All event tags that are interesting to config metrics matchers.
     std::unordered_map<int, std::vector<int>> mTagIdsToMatchersMap;
 
+    // Flat copy of mTagIdsToMatchersMap used to dispatch events, rebuilt on config init/update.
+    AtomMatcherDispatchTable mTagIdMatcherTable;
+
+    // Bottom-up evaluation of the matchers and the conditions of an event, and the metrics they
+    // are delivered to, rebuilt on config init/update by buildEvaluationPlans().
+    AtomMatcherProgram mAtomMatcherProgram;
+    ConditionEvaluationPlan mConditionEvaluationPlan;
+    MetricDispatchPlan mMetricDispatchPlan;
+
+    // Shared by all metric producers so that they store one copy of each dimension key.
+    sp<DimensionKeyInterner> mDimensionKeyInterner = new DimensionKeyInterner();
+
+    // Shared by all metric producers to allocate their state together. Null unless config
+    // arenas are enabled.
+    sp<ConfigArena> mConfigArena;
+
+    // Shared by all metric producers to memoize sliced condition queries per event.
+    const sp<ConditionQueryCache> mConditionQueryCache = new ConditionQueryCache();
+
+    // Shared by all metric producers to memoize sampling decisions per event.
+    const sp<SampleDecisionCache> mSampleDecisionCache = new SampleDecisionCache();
+
     // We only store the sp of AtomMatchingTracker, MetricProducer, and ConditionTracker in
     // MetricsManager. There are relationships between them, and the relationships are denoted by
     // index instead of pointers. The reasons for this are: (1) the relationship between them are
@@ -291,7 +424,7 @@ private:
     // To make the log processing more efficient, we want to do as much filtering as possible
     // before we go into individual trackers and conditions to match.
 
-    // 1st filter: check if the event tag id is in mTagIdsToMatchersMap.
+    // 1st filter: check if the event tag id is in mTagIdMatcherTable.
     // 2nd filter: if it is, we parse the event because there is at least one member is interested.
     //             then pass to all AtomMatchingTrackers (itself also filter events by ids).
     // 3nd filter: for AtomMatchingTrackers that matched this event, we pass this event to the
@@ -322,6 +455,74 @@ private:
 
     std::vector<int> mMetricIndexesWithActivation;
 
+    // Whether each metric with an activation is active, indexed like mAllMetricProducers, and
+    // the number of set entries. Kept across events and updated when activations change.
+    std::vector<bool> mActiveMetrics;
+    int mActiveMetricCount = 0;
+
+    // Min-heap of (activation expiry, metric index), so that flushIfExpire is only called on the
+    // metrics whose activation may have lapsed. A metric has at most one live entry, the one
+    // matching mScheduledActivationExpiryNs. Other entries are stale and skipped.
+    std::priority_queue<std::pair<int64_t, int>, std::vector<std::pair<int64_t, int>>,
+                        std::greater<std::pair<int64_t, int>>>
+            mActivationExpiryQueue;
+    std::vector<int64_t> mScheduledActivationExpiryNs;
+
+    // Records whether the metric is active, and schedules its next activation expiry.
+    void updateMetricActiveState(int metricIndex);
+
+    // Calls flushIfExpire on the metrics whose activation lapsed before eventTimeNs.
+    void flushExpiredActivations(int64_t eventTimeNs);
+
+    // Scratch state of onLogEvent, indexed like mAllAtomMatchingTrackers and
+    // mAllConditionTrackers. It is kept across events instead of being reallocated for each one,
+    // and only the entries touched by an event are reset once the event is processed.
+    std::vector<MatchingState> mMatcherCache;
+    std::vector<bool> mConditionToBeEvaluated;
+    std::vector<ConditionState> mConditionCache;
+    std::vector<bool> mConditionChangedCache;
+
+    // Matchers that matched the current event, in increasing index order.
+    std::vector<int> mMatchedMatcherIndices;
+    // Ids of mMatchedMatcherIndices, reported to StatsdStats under a single lock per event.
+    std::vector<int64_t> mMatchedMatcherIds;
+
+    // Counts the events with matchers in this config. Every
+    // StatsdStats::kProcessingCostSampleInterval-th one has its cost measured.
+    uint32_t mProcessingCostSampleCounter = 0;
+    // Cost of each metric the sampled event was delivered to.
+    std::vector<MetricCostSample> mMetricCostSamples;
+
+    // Whether the config has the best_effort option.
+    bool mBestEffort = false;
+
+    bool mLoadShedding = false;
+
+    // Atoms that only feed what of metrics other than duration metrics, so skipping some of
+    // their events leaves the conditions, activations and durations of the config exact. Only
+    // computed for best effort configs.
+    std::unordered_set<int> mSheddableAtomIds;
+
+    // Counts the events of sheddable atoms while shedding load, and the ones skipped since they
+    // were last reported to StatsdStats.
+    uint32_t mLoadSheddingSampleCounter = 0;
+    int64_t mShedEventCount = 0;
+
+    // Computes mSheddableAtomIds from the evaluation plans.
+    void buildSheddableAtomIds();
+
+    // Reports mShedEventCount to StatsdStats.
+    void flushShedEventCount();
+
+    // Conditions evaluated for the current event, including the children of combination
+    // conditions, by rank in mConditionEvaluationPlan.
+    std::vector<int> mConditionsToEvaluate;
+
+    // mConditionsToEvaluate in increasing index order.
+    std::vector<int> mTouchedConditionIndices;
+
+    void buildEvaluationPlans();
+
     void initAllowedLogSources();
 
     void initPullAtomSources();
@@ -402,6 +603,8 @@ private:
 
     FRIEND_TEST(MetricsManagerTest, TestLogSources);
     FRIEND_TEST(MetricsManagerTest, TestLogSourcesOnConfigUpdate);
+    FRIEND_TEST(MetricsManagerTest, TestOnLogEventResetsScratchCaches);
+    FRIEND_TEST(MetricsManagerTest, TestActivationExpiryQueue);
     FRIEND_TEST(MetricsManagerTest_SPlus, TestRestrictedMetricsConfig);
     FRIEND_TEST(MetricsManagerTest_SPlus, TestRestrictedMetricsConfigUpdate);
     FRIEND_TEST(MetricsManagerUtilTest, TestSampledMetrics);
@@ -425,6 +628,7 @@ private:
     FRIEND_TEST(DurationMetricE2eTest, TestWithCondition);
     FRIEND_TEST(DurationMetricE2eTest, TestWithSlicedCondition);
     FRIEND_TEST(DurationMetricE2eTest, TestWithActivationAndSlicedCondition);
+    FRIEND_TEST(DurationMetricE2eTest, TestWithPartialLinkToCombinationCondition);
     FRIEND_TEST(DurationMetricE2eTest, TestWithSlicedState);
     FRIEND_TEST(DurationMetricE2eTest, TestWithConditionAndSlicedState);
     FRIEND_TEST(DurationMetricE2eTest, TestWithSlicedStateMapped);
@@ -439,6 +643,8 @@ private:
     FRIEND_TEST(ValueMetricE2eTest, TestInitWithSlicedState_WithDimensions);
     FRIEND_TEST(ValueMetricE2eTest, TestInitWithSlicedState_WithIncorrectDimensions);
     FRIEND_TEST(GaugeMetricE2ePushedTest, TestDimensionalSampling);
+    FRIEND_TEST(MetricsManagerTest, TestLoadShedding);
+    FRIEND_TEST(MetricsManagerTest, TestLoadSheddingNotBestEffort);
 };
 
 }  // namespace statsd
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "metrics/MetricsManagerReaper.h"
+
+#include "metrics/MetricsManager.h"
+#include "utils/ThreadConfig.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+MetricsManagerReaper::MetricsManagerReaper() : mReaper([this] { reaperLoop(); }) {
+}
+
+MetricsManagerReaper::~MetricsManagerReaper() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mQueueCv.notify_one();
+    mReaper.join();
+}
+
+void MetricsManagerReaper::release(sp<MetricsManager> metricsManager) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.push_back(std::move(metricsManager));
+    }
+    mQueueCv.notify_one();
+}
+
+void MetricsManagerReaper::waitForIdle() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDrainedCv.wait(lock, [this] { return mQueue.empty() && !mReaping; });
+}
+
+void MetricsManagerReaper::reaperLoop() {
+    configureStatsdThread("statsd.reaper", kReaperNiceValue);
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mQueueCv.wait(lock, [this] { return !mQueue.empty() || mStopping; });
+        if (mQueue.empty()) {
+            // Only stop once everything queued is dropped.
+            return;
+        }
+        sp<MetricsManager> metricsManager = std::move(mQueue.front());
+        mQueue.pop_front();
+        mReaping = true;
+        lock.unlock();
+
+        VLOG("Dropping the MetricsManager of %s",
+             metricsManager->getConfigKey().ToString().c_str());
+        metricsManager.clear();
+
+        lock.lock();
+        mReaping = false;
+        if (mQueue.empty()) {
+            mDrainedCv.notify_all();
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+class MetricsManager;
+
+/**
+ * Destroys the MetricsManagers of removed or replaced configs on a low priority thread, so that
+ * freeing their dimensions, buckets and trackers does not hold up event processing.
+ *
+ * A released manager must not be reachable from the StatsLogProcessor anymore. Its destructor
+ * only unregisters from the thread safe StateManager, StatsPullerManager and AlarmMonitors.
+ * Managers are destroyed in the order they were released.
+ */
+class MetricsManagerReaper {
+public:
+    // ANDROID_PRIORITY_BACKGROUND.
+    static constexpr int kReaperNiceValue = 10;
+
+    MetricsManagerReaper();
+
+    MetricsManagerReaper(const MetricsManagerReaper&) = delete;
+    MetricsManagerReaper& operator=(const MetricsManagerReaper&) = delete;
+
+    // Destroys the managers still queued before returning.
+    ~MetricsManagerReaper();
+
+    // Drops the reference to the manager on the reaper thread. The manager is only destroyed
+    // there if no one else holds it by then.
+    void release(sp<MetricsManager> metricsManager);
+
+    // Returns once every manager released before the call is dropped.
+    void waitForIdle();
+
+private:
+    void reaperLoop();
+
+    std::mutex mMutex;
+
+    // Signals the reaper that a manager was released or that the reaper is stopping.
+    std::condition_variable mQueueCv;
+
+    // Signals waitForIdle that the queue was drained.
+    std::condition_variable mDrainedCv;
+
+    std::deque<sp<MetricsManager>> mQueue;
+
+    // True while the reaper drops a manager it took from mQueue.
+    bool mReaping = false;
+
+    bool mStopping = false;
+
+    std::thread mReaper;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -22,6 +22,8 @@
 #include <limits.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
 #include "guardrail/StatsdStats.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
@@ -81,13 +83,47 @@ NumericValueMetricProducer::NumericValueMetricProducer(
       mUseZeroDefaultBase(metric.use_zero_default_base()),
       mHasGlobalBase(false),
       mMaxPullDelayNs(metric.has_max_pull_delay_sec() ? metric.max_pull_delay_sec() * NS_PER_SEC
-                                                      : StatsdStats::kPullMaxDelayNs) {
+                                                      : StatsdStats::kPullMaxDelayNs),
+      mPullAggregation(computePullAggregation(pullOptions.whatMatcherFields)),
+      mSumsSingleFieldWithoutDiff(mFieldMatchers.size() == 1 && !mUseDiff &&
+                                  (mAggregationType == ValueMetric::SUM ||
+                                   mAggregationType == ValueMetric::AVG)),
+      mCompressPastBuckets(metric.compress_past_buckets()) {
     // TODO(b/186677791): Use initializer list to initialize mUploadThreshold.
     if (metric.has_threshold()) {
         mUploadThreshold = metric.threshold();
     }
 }
 
+optional<PullAggregation> NumericValueMetricProducer::computePullAggregation(
+        const optional<vector<int>>& whatMatcherFields) const {
+    if (!isPulled() || !mUseDiff || !whatMatcherFields) {
+        return nullopt;
+    }
+    vector<int> groupByFields = *whatMatcherFields;
+    const auto addTopLevelFields = [&groupByFields](const vector<Matcher>& matchers) {
+        for (const Matcher& matcher : matchers) {
+            groupByFields.push_back(matcher.mMatcher.getPosAtDepth(0));
+        }
+    };
+    addTopLevelFields(mDimensionsInWhat);
+    for (const Metric2Condition& link : mMetric2ConditionLinks) {
+        addTopLevelFields(link.metricFields);
+    }
+    for (const Metric2State& link : mMetric2StateLinks) {
+        addTopLevelFields(link.metricFields);
+    }
+    vector<int> sumFields;
+    for (const Matcher& matcher : mFieldMatchers) {
+        if (matcher.mMatcher.getDepth() > 0) {
+            // A value in a repeated or nested field, which a row cannot hold the sum of.
+            return nullopt;
+        }
+        sumFields.push_back(matcher.mMatcher.getPosAtDepth(0));
+    }
+    return makePullAggregation(std::move(groupByFields), std::move(sumFields));
+}
+
 void NumericValueMetricProducer::invalidateCurrentBucket(const int64_t dropTimeNs,
                                                          const BucketDropReason reason) {
     ValueMetricProducer::invalidateCurrentBucket(dropTimeNs, reason);
@@ -113,6 +149,34 @@ void NumericValueMetricProducer::resetBase() {
         }
     }
     mHasGlobalBase = false;
+    clearBaseSnapshotLocked();
+}
+
+void NumericValueMetricProducer::clearBaseSnapshotLocked() {
+    mBaseSnapshot = nullptr;
+    mParkedBases.clear();
+    mParkedBasesSnapshot = nullptr;
+}
+
+bool NumericValueMetricProducer::restoreParkedBasesLocked(const PulledDataSnapshot& snapshot,
+                                                          const int64_t timestampNs) {
+    // Accumulating the data again would only set the bases, as the condition is not true yet.
+    if (snapshot != mParkedBasesSnapshot || mCondition == ConditionState::kTrue ||
+        mParkedBases.size() != mDimInfos.size()) {
+        return false;
+    }
+    if (!checkPulledDataTimingLocked(timestampNs, timestampNs)) {
+        return true;
+    }
+    size_t i = 0;
+    for (auto& [_, dimInfo] : mDimInfos) {
+        dimInfo.dimExtras = std::move(mParkedBases[i++]);
+    }
+    mParkedBases.clear();
+    mParkedBasesSnapshot = nullptr;
+    mBaseSnapshot = snapshot;
+    mHasGlobalBase = true;
+    return true;
 }
 
 void NumericValueMetricProducer::writePastBucketAggregateToProto(
@@ -136,6 +200,38 @@ void NumericValueMetricProducer::writePastBucketAggregateToProto(
     protoOutput->end(valueToken);
 }
 
+void NumericValueMetricProducer::addPastBucketLocked(const MetricDimensionKey& metricDimensionKey,
+                                                     PastBucket<Value>&& bucket) {
+    if (!mCompressPastBuckets || !NumericValuePastBuckets::canEncode(bucket)) {
+        ValueMetricProducer::addPastBucketLocked(metricDimensionKey, std::move(bucket));
+        return;
+    }
+    const size_t previousByteSize = mCompressedPastBuckets.byteSize();
+    mCompressedPastBuckets.addBucket(metricDimensionKey, bucket);
+    mPastBucketsByteSize += mCompressedPastBuckets.byteSize() - previousByteSize;
+}
+
+void NumericValueMetricProducer::prepareDumpReportLocked() {
+    if (mCompressedPastBuckets.empty()) {
+        return;
+    }
+    mPastBucketsByteSize -= mCompressedPastBuckets.byteSize();
+    mCompressedPastBuckets.forEach(
+            [this](const MetricDimensionKey& key, vector<PastBucket<Value>>& buckets) {
+                vector<PastBucket<Value>>& pastBuckets = mPastBuckets[key];
+                for (PastBucket<Value>& bucket : buckets) {
+                    mPastBucketsByteSize += pastBucketByteSize(bucket);
+                    pastBuckets.push_back(std::move(bucket));
+                }
+            });
+    mCompressedPastBuckets.clear();
+}
+
+void NumericValueMetricProducer::clearPastBucketsLocked(const int64_t dumpTimeNs) {
+    ValueMetricProducer::clearPastBucketsLocked(dumpTimeNs);
+    mCompressedPastBuckets.clear();
+}
+
 void NumericValueMetricProducer::onActiveStateChangedInternalLocked(const int64_t eventTimeNs,
                                                                     const bool isActive) {
     // When active state changes from true to false for pulled metric, clear diff base but don't
@@ -154,7 +250,20 @@ void NumericValueMetricProducer::onConditionChangedInternalLocked(const Conditio
     // more value in the bucket.
     if (mUseDiff &&
         (oldCondition == ConditionState::kTrue && newCondition == ConditionState::kFalse)) {
+        PulledDataSnapshot baseSnapshot = std::move(mBaseSnapshot);
+        vector<ValueBases> bases;
+        // With sliced states, the data matched again may have other state keys.
+        if (baseSnapshot != nullptr && mSlicedStateAtoms.empty() && !hasReachedGuardRailLimit()) {
+            bases.reserve(mDimInfos.size());
+            for (const auto& [_, dimInfo] : mDimInfos) {
+                bases.push_back(dimInfo.dimExtras);
+            }
+        }
         resetBase();
+        if (!bases.empty()) {
+            mParkedBases = std::move(bases);
+            mParkedBasesSnapshot = std::move(baseSnapshot);
+        }
     }
 }
 
@@ -166,14 +275,47 @@ void NumericValueMetricProducer::prepareFirstBucketLocked() {
 }
 
 void NumericValueMetricProducer::pullAndMatchEventsLocked(const int64_t timestampNs) {
-    vector<shared_ptr<LogEvent>> allData;
-    if (!mPullerManager->Pull(mPullAtomId, mConfigKey, timestampNs, &allData)) {
+    // Metrics pulling the same atom at the same time, like on a condition change, get the same
+    // snapshot from the puller cache.
+    PulledDataSnapshot snapshot;
+    if (!mPullerManager->Pull(mPullAtomId, mConfigKey, timestampNs, &snapshot)) {
         ALOGE("Stats puller failed for tag: %d at %lld", mPullAtomId, (long long)timestampNs);
         invalidateCurrentBucket(timestampNs, BucketDropReason::PULL_FAILED);
         return;
     }
 
-    accumulateEvents(allData, timestampNs, timestampNs);
+    if (restoreParkedBasesLocked(snapshot, timestampNs)) {
+        return;
+    }
+    accumulateEvents(*snapshot, timestampNs, timestampNs);
+    if (mHasGlobalBase) {
+        mBaseSnapshot = std::move(snapshot);
+    }
+}
+
+bool NumericValueMetricProducer::checkPulledDataTimingLocked(const int64_t originalPullTimeNs,
+                                                             const int64_t eventElapsedTimeNs) {
+    if (isEventLateLocked(eventElapsedTimeNs)) {
+        VLOG("Skip bucket end pull due to late arrival: %lld vs %lld",
+             (long long)eventElapsedTimeNs, (long long)mCurrentBucketStartTimeNs);
+        StatsdStats::getInstance().noteLateLogEventSkipped(mMetricId);
+        invalidateCurrentBucket(eventElapsedTimeNs, BucketDropReason::EVENT_IN_WRONG_BUCKET);
+        return false;
+    }
+
+    const int64_t elapsedRealtimeNs = getElapsedRealtimeNs();
+    const int64_t pullDelayNs = elapsedRealtimeNs - originalPullTimeNs;
+    StatsdStats::getInstance().notePullDelay(mPullAtomId, pullDelayNs);
+    if (pullDelayNs > mMaxPullDelayNs) {
+        ALOGE("Pull finish too late for atom %d, longer than %lld", mPullAtomId,
+              (long long)mMaxPullDelayNs);
+        StatsdStats::getInstance().notePullExceedMaxDelay(mPullAtomId);
+        // We are missing one pull from the bucket which means we will not have a complete view of
+        // what's going on.
+        invalidateCurrentBucket(eventElapsedTimeNs, BucketDropReason::PULL_DELAYED);
+        return false;
+    }
+    return true;
 }
 
 int64_t NumericValueMetricProducer::calcPreviousBucketEndTime(const int64_t currentTimeNs) {
@@ -186,6 +328,8 @@ int64_t NumericValueMetricProducer::calcPreviousBucketEndTime(const int64_t curr
 void NumericValueMetricProducer::onDataPulled(const std::vector<std::shared_ptr<LogEvent>>& allData,
                                               PullResult pullResult, int64_t originalPullTimeNs) {
     lock_guard<mutex> lock(mMutex);
+    const int64_t costStartWallNs = getElapsedRealtimeNs();
+    const int64_t costStartCpuNs = getThreadCpuTimeNs();
     if (mCondition == ConditionState::kTrue) {
         // If the pull failed, we won't be able to compute a diff.
         if (pullResult == PullResult::PULL_RESULT_FAIL) {
@@ -217,20 +361,20 @@ void NumericValueMetricProducer::onDataPulled(const std::vector<std::shared_ptr<
     // We can probably flush the bucket. Since we used bucketEndTimeNs when calling
     // #onMatchedLogEventInternalLocked, the current bucket will not have been flushed.
     flushIfNeededLocked(originalPullTimeNs);
+    StatsdStats::getInstance().notePulledDataProcessingCost(
+            mConfigKey, {mMetricId, getElapsedRealtimeNs() - costStartWallNs,
+                         getThreadCpuTimeNs() - costStartCpuNs});
 }
 
-void NumericValueMetricProducer::combineValueFields(pair<LogEvent, vector<int>>& eventValues,
+void NumericValueMetricProducer::combineValueFields(LogEvent& aggregateEvent,
+                                                    const int* aggregateValueIndices,
                                                     const LogEvent& newEvent,
                                                     const vector<int>& newValueIndices) const {
-    if (eventValues.second.size() != newValueIndices.size()) {
-        ALOGE("NumericValueMetricProducer value indices sizes don't match");
-        return;
-    }
-    vector<FieldValue>* const aggregateFieldValues = eventValues.first.getMutableValues();
+    vector<FieldValue>* const aggregateFieldValues = aggregateEvent.getMutableValues();
     const vector<FieldValue>& newFieldValues = newEvent.getValues();
-    for (size_t i = 0; i < eventValues.second.size(); ++i) {
-        if (newValueIndices[i] != -1 && eventValues.second[i] != -1) {
-            (*aggregateFieldValues)[eventValues.second[i]].mValue +=
+    for (size_t i = 0; i < newValueIndices.size(); ++i) {
+        if (newValueIndices[i] != -1 && aggregateValueIndices[i] != -1) {
+            (*aggregateFieldValues)[aggregateValueIndices[i]].mValue +=
                     newFieldValues[newValueIndices[i]].mValue;
         }
     }
@@ -240,32 +384,27 @@ void NumericValueMetricProducer::combineValueFields(pair<LogEvent, vector<int>>&
 void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEvent>>& allData,
                                                   int64_t originalPullTimeNs,
                                                   int64_t eventElapsedTimeNs) {
-    if (isEventLateLocked(eventElapsedTimeNs)) {
-        VLOG("Skip bucket end pull due to late arrival: %lld vs %lld",
-             (long long)eventElapsedTimeNs, (long long)mCurrentBucketStartTimeNs);
-        StatsdStats::getInstance().noteLateLogEventSkipped(mMetricId);
-        invalidateCurrentBucket(eventElapsedTimeNs, BucketDropReason::EVENT_IN_WRONG_BUCKET);
-        return;
-    }
-
-    const int64_t elapsedRealtimeNs = getElapsedRealtimeNs();
-    const int64_t pullDelayNs = elapsedRealtimeNs - originalPullTimeNs;
-    StatsdStats::getInstance().notePullDelay(mPullAtomId, pullDelayNs);
-    if (pullDelayNs > mMaxPullDelayNs) {
-        ALOGE("Pull finish too late for atom %d, longer than %lld", mPullAtomId,
-              (long long)mMaxPullDelayNs);
-        StatsdStats::getInstance().notePullExceedMaxDelay(mPullAtomId);
-        // We are missing one pull from the bucket which means we will not have a complete view of
-        // what's going on.
-        invalidateCurrentBucket(eventElapsedTimeNs, BucketDropReason::PULL_DELAYED);
+    if (!checkPulledDataTimingLocked(originalPullTimeNs, eventElapsedTimeNs)) {
         return;
     }
+    clearBaseSnapshotLocked();
 
     mMatchedMetricDimensionKeys.clear();
     if (mUseDiff) {
         // An extra aggregation step is needed to sum values with matching dimensions
         // before calculating the diff between sums of consecutive pulls.
-        std::unordered_map<HashableDimensionKey, pair<LogEvent, vector<int>>> aggregateEvents;
+        //
+        // Pulls can have thousands of rows, so they are gathered into arrays sized up front: one
+        // event per dimension in pull order, with the value indices of all of them in a single
+        // vector, instead of a map node and an index vector per row.
+        const size_t numValueFields = mFieldMatchers.size();
+        unordered_map<HashableDimensionKey, size_t> dimensionIndices;
+        dimensionIndices.reserve(allData.size());
+        vector<LogEvent> aggregateEvents;
+        aggregateEvents.reserve(allData.size());
+        vector<int> aggregateValueIndices;
+        aggregateValueIndices.reserve(allData.size() * numValueFields);
+        vector<int> valueIndices(numValueFields);
         for (const auto& data : allData) {
             if (mEventMatcherWizard->matchLogEvent(*data, mWhatMatcherIndex) !=
                 MatchingState::kMatched) {
@@ -274,26 +413,29 @@ void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEve
 
             // Get dimensions_in_what key and value indices.
             HashableDimensionKey dimensionsInWhat;
-            vector<int> valueIndices(mFieldMatchers.size(), -1);
-            if (!filterValues(mDimensionsInWhat, mFieldMatchers, data->getValues(),
-                              dimensionsInWhat, valueIndices)) {
+            std::fill(valueIndices.begin(), valueIndices.end(), -1);
+            if (!filterValues(mDimensionsInWhat, mFieldMatchers, *data, dimensionsInWhat,
+                              valueIndices)) {
                 StatsdStats::getInstance().noteBadValueType(mMetricId);
             }
 
-            // Store new event in map or combine values in existing event.
-            auto it = aggregateEvents.find(dimensionsInWhat);
-            if (it == aggregateEvents.end()) {
-                aggregateEvents.emplace(std::piecewise_construct,
-                                        std::forward_as_tuple(dimensionsInWhat),
-                                        std::forward_as_tuple(*data, valueIndices));
+            // Store new event or combine values in the existing event of the dimension.
+            const auto [it, inserted] = dimensionIndices.try_emplace(std::move(dimensionsInWhat),
+                                                                     aggregateEvents.size());
+            if (inserted) {
+                aggregateEvents.push_back(*data);
+                aggregateValueIndices.insert(aggregateValueIndices.end(), valueIndices.begin(),
+                                             valueIndices.end());
             } else {
-                combineValueFields(it->second, *data, valueIndices);
+                combineValueFields(aggregateEvents[it->second],
+                                   aggregateValueIndices.data() + it->second * numValueFields,
+                                   *data, valueIndices);
             }
         }
 
-        for (auto& [dimKey, eventInfo] : aggregateEvents) {
-            eventInfo.first.setElapsedTimestampNs(eventElapsedTimeNs);
-            onMatchedLogEventLocked(mWhatMatcherIndex, eventInfo.first);
+        for (LogEvent& aggregateEvent : aggregateEvents) {
+            aggregateEvent.setElapsedTimestampNs(eventElapsedTimeNs);
+            onMatchedLogEventLocked(mWhatMatcherIndex, aggregateEvent);
         }
     } else {
         for (const auto& data : allData) {
@@ -337,7 +479,7 @@ void NumericValueMetricProducer::accumulateEvents(const vector<shared_ptr<LogEve
     // might be missing from mCurrentSlicedBucket.
     if (hasReachedGuardRailLimit()) {
         invalidateCurrentBucket(eventElapsedTimeNs, BucketDropReason::DIMENSION_GUARDRAIL_REACHED);
-        mCurrentSlicedBucket.clear();
+        clearCurrentSlicedBucket();
     }
 }
 
@@ -389,10 +531,46 @@ bool getDoubleOrLong(const LogEvent& event, const Matcher& matcher, Value& ret)
     return false;
 }
 
+// Same as getDoubleOrLong, but only for integer values.
+bool getLong(const LogEvent& event, const Matcher& matcher, int64_t& ret) {
+    for (const FieldValue& value : event.getValues()) {
+        if (value.mField.matches(matcher)) {
+            if (value.mValue.type == INT) {
+                ret = value.mValue.int_value;
+                return true;
+            }
+            if (value.mValue.type == LONG) {
+                ret = value.mValue.long_value;
+                return true;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
 bool NumericValueMetricProducer::aggregateFields(const int64_t eventTimeNs,
                                                  const MetricDimensionKey& eventKey,
-                                                 const LogEvent& event, vector<Interval>& intervals,
-                                                 ValueBases& bases) {
+                                                 const LogEvent& event,
+                                                 const Intervals& intervals, ValueBases& bases) {
+    if (mSumsSingleFieldWithoutDiff) {
+        Interval& interval = intervals[0];
+        int64_t value;
+        // Other values, and the errors, are handled below.
+        if (getLong(event, mFieldMatchers[0], value) &&
+            (!interval.hasValue() || interval.aggregate.type == LONG)) {
+            interval.aggIndex = 0;
+            if (interval.hasValue()) {
+                interval.aggregate.long_value += value;
+            } else {
+                interval.aggregate.setLong(value);
+            }
+            interval.sampleSize += 1;
+            detectAnomalies(eventTimeNs, eventKey, intervals);
+            return true;
+        }
+    }
+
     if (bases.size() < mFieldMatchers.size()) {
         VLOG("Resizing number of bases to %zu", mFieldMatchers.size());
         bases.resize(mFieldMatchers.size());
@@ -497,25 +675,34 @@ bool NumericValueMetricProducer::aggregateFields(const int64_t eventTimeNs,
         interval.sampleSize += 1;
     }
 
-    // Only trigger the tracker if all intervals are correct and we have not skipped the bucket due
-    // to MULTIPLE_BUCKETS_SKIPPED.
-    if (useAnomalyDetection && !multipleBucketsSkipped(calcBucketsForwardCount(eventTimeNs))) {
-        // TODO: propgate proper values down stream when anomaly support doubles
-        long wholeBucketVal = intervals[0].aggregate.long_value;
-        auto prev = mCurrentFullBucket.find(eventKey);
-        if (prev != mCurrentFullBucket.end()) {
-            wholeBucketVal += prev->second;
-        }
-        for (auto& tracker : mAnomalyTrackers) {
-            tracker->detectAndDeclareAnomaly(eventTimeNs, mCurrentBucketNum, mMetricId, eventKey,
-                                             wholeBucketVal);
-        }
+    // Only trigger the tracker if all intervals are correct.
+    if (useAnomalyDetection) {
+        detectAnomalies(eventTimeNs, eventKey, intervals);
     }
     return seenNewData;
 }
 
+void NumericValueMetricProducer::detectAnomalies(const int64_t eventTimeNs,
+                                                 const MetricDimensionKey& eventKey,
+                                                 const Intervals& intervals) {
+    // Not when the bucket was skipped due to MULTIPLE_BUCKETS_SKIPPED.
+    if (mAnomalyTrackers.empty() || multipleBucketsSkipped(calcBucketsForwardCount(eventTimeNs))) {
+        return;
+    }
+    // TODO: propgate proper values down stream when anomaly support doubles
+    long wholeBucketVal = intervals[0].aggregate.long_value;
+    auto prev = mCurrentFullBucket.find(eventKey);
+    if (prev != mCurrentFullBucket.end()) {
+        wholeBucketVal += prev->second;
+    }
+    for (auto& tracker : mAnomalyTrackers) {
+        tracker->detectAndDeclareAnomaly(eventTimeNs, mCurrentBucketNum, mMetricId, eventKey,
+                                         wholeBucketVal);
+    }
+}
+
 PastBucket<Value> NumericValueMetricProducer::buildPartialBucket(int64_t bucketEndTimeNs,
-                                                                 vector<Interval>& intervals) {
+                                                                 const Intervals& intervals) {
     PastBucket<Value> bucket;
     bucket.mBucketStartNs = mCurrentBucketStartTimeNs;
     bucket.mBucketEndNs = bucketEndTimeNs;
@@ -553,6 +740,8 @@ void NumericValueMetricProducer::closeCurrentBucket(const int64_t eventTimeNs,
 
 void NumericValueMetricProducer::initNextSlicedBucket(int64_t nextBucketStartTimeNs) {
     ValueMetricProducer::initNextSlicedBucket(nextBucketStartTimeNs);
+    // Matching the data again would mark the dimensions of the new bucket as seen.
+    clearBaseSnapshotLocked();
 
     // If we do not have a global base when the condition is true,
     // we will have incomplete bucket for the next bucket.
@@ -576,12 +765,12 @@ void NumericValueMetricProducer::appendToFullBucket(const bool isFullBucketReach
         // Accumulate partial buckets with current value and then send to anomaly tracker.
         if (mCurrentFullBucket.size() > 0) {
             for (const auto& [metricDimensionKey, currentBucket] : mCurrentSlicedBucket) {
-                if (hitFullBucketGuardRailLocked(metricDimensionKey) ||
-                    currentBucket.intervals.empty()) {
+                const Intervals intervals = getIntervals(currentBucket);
+                if (hitFullBucketGuardRailLocked(metricDimensionKey) || intervals.empty()) {
                     continue;
                 }
                 // TODO: fix this when anomaly can accept double values
-                auto& interval = currentBucket.intervals[0];
+                auto& interval = intervals[0];
                 if (interval.hasValue()) {
                     mCurrentFullBucket[metricDimensionKey] += interval.aggregate.long_value;
                 }
@@ -597,10 +786,11 @@ void NumericValueMetricProducer::appendToFullBucket(const bool isFullBucketReach
         } else {
             // Skip aggregating the partial buckets since there's no previous partial bucket.
             for (const auto& [metricDimensionKey, currentBucket] : mCurrentSlicedBucket) {
+                const Intervals intervals = getIntervals(currentBucket);
                 for (auto& tracker : mAnomalyTrackers) {
-                    if (tracker != nullptr && !currentBucket.intervals.empty()) {
+                    if (tracker != nullptr && !intervals.empty()) {
                         // TODO: fix this when anomaly can accept double values
-                        auto& interval = currentBucket.intervals[0];
+                        auto& interval = intervals[0];
                         if (interval.hasValue()) {
                             tracker->addPastBucket(metricDimensionKey,
                                                    interval.aggregate.long_value,
@@ -613,9 +803,10 @@ void NumericValueMetricProducer::appendToFullBucket(const bool isFullBucketReach
     } else {
         // Accumulate partial bucket.
         for (const auto& [metricDimensionKey, currentBucket] : mCurrentSlicedBucket) {
-            if (!currentBucket.intervals.empty()) {
+            const Intervals intervals = getIntervals(currentBucket);
+            if (!intervals.empty()) {
                 // TODO: fix this when anomaly can accept double values
-                auto& interval = currentBucket.intervals[0];
+                auto& interval = intervals[0];
                 if (interval.hasValue()) {
                     mCurrentFullBucket[metricDimensionKey] += interval.aggregate.long_value;
                 }
@@ -624,15 +815,6 @@ void NumericValueMetricProducer::appendToFullBucket(const bool isFullBucketReach
     }
 }
 
-size_t NumericValueMetricProducer::byteSizeLocked() const {
-    size_t totalSize = 0;
-    for (const auto& [_, buckets] : mPastBuckets) {
-        totalSize += buckets.size() * kBucketSize;
-        // TODO(b/189283526): Add bytes used to store PastBucket.aggIndex vector
-    }
-    return totalSize;
-}
-
 bool NumericValueMetricProducer::valuePassesThreshold(const Interval& interval) const {
     if (mUploadThreshold == nullopt) {
         return true;
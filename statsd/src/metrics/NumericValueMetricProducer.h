@@ -20,6 +20,7 @@
 
 #include <optional>
 
+#include "NumericValuePastBuckets.h"
 #include "ValueMetricProducer.h"
 
 namespace android {
@@ -48,6 +49,10 @@ public:
         return mIsActive && (mCondition == ConditionState::kTrue);
     }
 
+    std::optional<PullAggregation> getPullAggregation() const override {
+        return mPullAggregation;
+    }
+
     inline MetricType getMetricType() const override {
         return METRIC_TYPE_VALUE;
     }
@@ -90,6 +95,9 @@ private:
     // Reset diff base and mHasGlobalBase
     void resetBase();
 
+    std::optional<PullAggregation> computePullAggregation(
+            const std::optional<std::vector<int>>& whatMatcherFields) const;
+
     // Calculate previous bucket end time based on current time.
     int64_t calcPreviousBucketEndTime(const int64_t currentTimeNs);
 
@@ -101,11 +109,24 @@ private:
     void accumulateEvents(const std::vector<std::shared_ptr<LogEvent>>& allData,
                           int64_t originalPullTimeNs, int64_t eventElapsedTimeNs);
 
+    // Returns false, and invalidates the current bucket, if pulled data is too late to be used.
+    bool checkPulledDataTimingLocked(int64_t originalPullTimeNs, int64_t eventElapsedTimeNs);
+
+    // Sets the bases back to the ones reset when the condition last turned false, if snapshot is
+    // the data they were set from. Returns false if snapshot has to be accumulated instead.
+    bool restoreParkedBasesLocked(const PulledDataSnapshot& snapshot, int64_t timestampNs);
+
+    void clearBaseSnapshotLocked();
+
     void closeCurrentBucket(const int64_t eventTimeNs,
                             const int64_t nextBucketStartTimeNs) override;
 
     PastBucket<Value> buildPartialBucket(int64_t bucketEndTime,
-                                         std::vector<Interval>& intervals) override;
+                                         const Intervals& intervals) override;
+
+    inline bool canSnapshotCurrentBucket() const override {
+        return true;
+    }
 
     bool valuePassesThreshold(const Interval& interval) const;
 
@@ -128,9 +149,14 @@ private:
     }
 
     bool aggregateFields(const int64_t eventTimeNs, const MetricDimensionKey& eventKey,
-                         const LogEvent& event, std::vector<Interval>& intervals,
+                         const LogEvent& event, const Intervals& intervals,
                          ValueBases& bases) override;
 
+    // Passes the aggregate of the first value field, with the past buckets of the current full
+    // bucket, to the anomaly trackers.
+    void detectAnomalies(const int64_t eventTimeNs, const MetricDimensionKey& eventKey,
+                         const Intervals& intervals);
+
     void pullAndMatchEventsLocked(const int64_t timestampNs) override;
 
     DumpProtoFields getDumpProtoFields() const override;
@@ -139,11 +165,18 @@ private:
                                          const int sampleSize,
                                          ProtoOutputStream* const protoOutput) const override;
 
-    // Internal function to calculate the current used bytes.
-    size_t byteSizeLocked() const override;
+    void addPastBucketLocked(const MetricDimensionKey& metricDimensionKey,
+                             PastBucket<Value>&& bucket) override;
 
-    void combineValueFields(pair<LogEvent, vector<int>>& eventValues, const LogEvent& newEvent,
-                            const vector<int>& newValueIndices) const;
+    // Decodes the compressed past buckets into mPastBuckets.
+    void prepareDumpReportLocked() override;
+
+    void clearPastBucketsLocked(const int64_t dumpTimeNs) override;
+
+    // Adds the values of newEvent to those of aggregateEvent, whose value field indices are
+    // aggregateValueIndices[0, newValueIndices.size()).
+    void combineValueFields(LogEvent& aggregateEvent, const int* aggregateValueIndices,
+                            const LogEvent& newEvent, const vector<int>& newValueIndices) const;
 
     const bool mUseAbsoluteValueOnReset;
 
@@ -169,13 +202,39 @@ private:
     // diff against.
     bool mHasGlobalBase;
 
+    // The pulled data the bases were last set from, or null if they changed since.
+    PulledDataSnapshot mBaseSnapshot;
+
+    // The bases reset when the condition last turned false, in the order of mDimInfos, and the
+    // data they were set from. When the condition flaps within the cool down of the puller, the
+    // next pull gets the same data and the bases are restored without matching it again. Any
+    // other change of the bases or of mDimInfos drops them.
+    std::vector<ValueBases> mParkedBases;
+    PulledDataSnapshot mParkedBasesSnapshot;
+
     const int64_t mMaxPullDelayNs;
 
+    // How the pulled rows may be aggregated before they reach this metric. The rows with the same
+    // dimensions are summed before the diffs are taken, which the puller may do as well as long as
+    // it keeps apart the rows that differ in any field read from them.
+    const std::optional<PullAggregation> mPullAggregation;
+
+    // Whether the metric sums, or averages, a single value field as logged. aggregateFields then
+    // adds integer values in place, without going through the diff and aggregation type
+    // dispatch. Sums of single integer fields are the bulk of value metrics.
+    const bool mSumsSingleFieldWithoutDiff;
+
+    const bool mCompressPastBuckets;
+
+    // The past buckets when mCompressPastBuckets is set, until they are dumped.
+    NumericValuePastBuckets mCompressedPastBuckets;
+
     // For anomaly detection.
     std::unordered_map<MetricDimensionKey, int64_t> mCurrentFullBucket;
 
     FRIEND_TEST(NumericValueMetricProducerTest, TestAnomalyDetection);
     FRIEND_TEST(NumericValueMetricProducerTest, TestBaseSetOnConditionChange);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestBasesRestoredForSamePulledData);
     FRIEND_TEST(NumericValueMetricProducerTest, TestBucketBoundariesOnConditionChange);
     FRIEND_TEST(NumericValueMetricProducerTest, TestBucketBoundaryNoCondition);
     FRIEND_TEST(NumericValueMetricProducerTest, TestBucketBoundaryWithCondition);
@@ -188,6 +247,7 @@ private:
     FRIEND_TEST(NumericValueMetricProducerTest, TestEmptyDataResetsBase_onDataPulled);
     FRIEND_TEST(NumericValueMetricProducerTest, TestEventsWithNonSlicedCondition);
     FRIEND_TEST(NumericValueMetricProducerTest, TestFirstBucket);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestIntervalsReusedAcrossBuckets);
     FRIEND_TEST(NumericValueMetricProducerTest, TestLateOnDataPulledWithDiff);
     FRIEND_TEST(NumericValueMetricProducerTest, TestLateOnDataPulledWithoutDiff);
     FRIEND_TEST(NumericValueMetricProducerTest, TestPartialResetOnBucketBoundaries);
@@ -200,6 +260,7 @@ private:
     FRIEND_TEST(NumericValueMetricProducerTest, TestPulledEventsTakeAbsoluteValueOnReset);
     FRIEND_TEST(NumericValueMetricProducerTest, TestPulledEventsTakeZeroOnReset);
     FRIEND_TEST(NumericValueMetricProducerTest, TestPulledEventsWithFiltering);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestPulledRowsCombinedByDimension);
     FRIEND_TEST(NumericValueMetricProducerTest, TestPulledWithAppUpgradeDisabled);
     FRIEND_TEST(NumericValueMetricProducerTest, TestPushedAggregateAvg);
     FRIEND_TEST(NumericValueMetricProducerTest, TestPushedAggregateMax);
@@ -231,7 +292,9 @@ private:
     FRIEND_TEST(NumericValueMetricProducerTest, TestSlicedStateWithConditionFalseMultipleBuckets);
     FRIEND_TEST(NumericValueMetricProducerTest,
                 TestSlicedStateWithMultipleDimensionsMissingDataInPull);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestSnapshotCurrentBucket);
     FRIEND_TEST(NumericValueMetricProducerTest, TestUploadThreshold);
+    FRIEND_TEST(NumericValueMetricProducerTest, TestCompressPastBuckets);
 
     FRIEND_TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenOneConditionFailed);
     FRIEND_TEST(NumericValueMetricProducerTest_BucketDrop, TestInvalidBucketWhenInitialPullFailed);
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NumericValuePastBuckets.h"
+
+#include <cstring>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+namespace {
+
+void appendVarint(uint64_t value, vector<uint8_t>& bytes) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t readVarint(const vector<uint8_t>& bytes, size_t& pos) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        const uint8_t byte = bytes[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+// Deltas are computed on unsigned values, so that they wrap instead of overflowing.
+void appendDelta(int64_t value, int64_t previous, vector<uint8_t>& bytes) {
+    const int64_t delta =
+            static_cast<int64_t>(static_cast<uint64_t>(value) - static_cast<uint64_t>(previous));
+    // Zigzag encoding, so that small negative deltas take few bytes.
+    appendVarint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63), bytes);
+}
+
+int64_t readDelta(int64_t previous, const vector<uint8_t>& bytes, size_t& pos) {
+    const uint64_t zigzag = readVarint(bytes, pos);
+    const uint64_t delta = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+    return static_cast<int64_t>(static_cast<uint64_t>(previous) + delta);
+}
+
+uint64_t getValueBits(const Value& value) {
+    if (value.getType() == LONG) {
+        return static_cast<uint64_t>(value.long_value);
+    }
+    uint64_t bits;
+    memcpy(&bits, &value.double_value, sizeof(bits));
+    return bits;
+}
+
+}  // anonymous namespace
+
+bool NumericValuePastBuckets::canEncode(const PastBucket<Value>& bucket) {
+    for (const Value& value : bucket.aggregates) {
+        if (value.getType() != LONG && value.getType() != DOUBLE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void NumericValuePastBuckets::addBucket(const MetricDimensionKey& key,
+                                        const PastBucket<Value>& bucket) {
+    const auto [it, inserted] = mKeyIds.emplace(key, mKeys.size());
+    if (inserted) {
+        mKeys.push_back(key);
+        mBuckets.emplace_back();
+    }
+    vector<uint8_t>& bytes = mBuckets[it->second].mPackedBuckets;
+    EncoderState& state = mBuckets[it->second].mState;
+    const size_t previousSize = bytes.size();
+
+    const int64_t durationNs = bucket.mBucketEndNs - bucket.mBucketStartNs;
+    appendDelta(bucket.mBucketStartNs, state.mLastBucketEndNs, bytes);
+    appendDelta(durationNs, state.mLastBucketDurationNs, bytes);
+    appendDelta(bucket.mConditionTrueNs, state.mLastConditionTrueNs, bytes);
+    appendDelta(bucket.mConditionCorrectionNs, 0, bytes);
+    state.mLastBucketEndNs = bucket.mBucketEndNs;
+    state.mLastBucketDurationNs = durationNs;
+    state.mLastConditionTrueNs = bucket.mConditionTrueNs;
+
+    const bool hasSampleSizes = !bucket.sampleSizes.empty();
+    appendVarint((bucket.aggIndex.size() << 1) | hasSampleSizes, bytes);
+    for (size_t i = 0; i < bucket.aggIndex.size(); i++) {
+        const int aggIndex = bucket.aggIndex[i];
+        const Value& value = bucket.aggregates[i];
+        const bool isDouble = value.getType() == DOUBLE;
+        appendVarint((static_cast<uint64_t>(aggIndex) << 1) | isDouble, bytes);
+        if (hasSampleSizes) {
+            appendVarint(static_cast<uint32_t>(bucket.sampleSizes[i]), bytes);
+        }
+        if (state.mLastValues.size() <= static_cast<size_t>(aggIndex)) {
+            state.mLastValues.resize(aggIndex + 1);
+        }
+        uint64_t& lastValue = state.mLastValues[aggIndex];
+        const uint64_t bits = getValueBits(value);
+        if (isDouble) {
+            // 0 for an unchanged value, else the number of dropped trailing zeros plus one.
+            const uint64_t xorBits = bits ^ lastValue;
+            if (xorBits == 0) {
+                bytes.push_back(0);
+            } else {
+                const int trailingZeros = __builtin_ctzll(xorBits);
+                bytes.push_back(static_cast<uint8_t>(trailingZeros + 1));
+                appendVarint(xorBits >> trailingZeros, bytes);
+            }
+        } else {
+            appendDelta(static_cast<int64_t>(bits), static_cast<int64_t>(lastValue), bytes);
+        }
+        lastValue = bits;
+    }
+    mPackedBytes += bytes.size() - previousSize;
+}
+
+void NumericValuePastBuckets::decodeBuckets(const size_t keyId,
+                                            vector<PastBucket<Value>>& buckets) const {
+    buckets.clear();
+    const vector<uint8_t>& bytes = mBuckets[keyId].mPackedBuckets;
+    EncoderState state;
+    size_t pos = 0;
+    while (pos < bytes.size()) {
+        PastBucket<Value>& bucket = buckets.emplace_back();
+        bucket.mBucketStartNs = readDelta(state.mLastBucketEndNs, bytes, pos);
+        state.mLastBucketDurationNs = readDelta(state.mLastBucketDurationNs, bytes, pos);
+        bucket.mBucketEndNs = bucket.mBucketStartNs + state.mLastBucketDurationNs;
+        bucket.mConditionTrueNs = readDelta(state.mLastConditionTrueNs, bytes, pos);
+        bucket.mConditionCorrectionNs = readDelta(0, bytes, pos);
+        state.mLastBucketEndNs = bucket.mBucketEndNs;
+        state.mLastConditionTrueNs = bucket.mConditionTrueNs;
+
+        const uint64_t countAndFlag = readVarint(bytes, pos);
+        const size_t count = countAndFlag >> 1;
+        const bool hasSampleSizes = countAndFlag & 1;
+        for (size_t i = 0; i < count; i++) {
+            const uint64_t indexAndType = readVarint(bytes, pos);
+            const int aggIndex = indexAndType >> 1;
+            const bool isDouble = indexAndType & 1;
+            bucket.aggIndex.push_back(aggIndex);
+            if (hasSampleSizes) {
+                bucket.sampleSizes.push_back(static_cast<int>(readVarint(bytes, pos)));
+            }
+            if (state.mLastValues.size() <= static_cast<size_t>(aggIndex)) {
+                state.mLastValues.resize(aggIndex + 1);
+            }
+            uint64_t& lastValue = state.mLastValues[aggIndex];
+            if (isDouble) {
+                const uint8_t trailingZeros = bytes[pos++];
+                if (trailingZeros > 0) {
+                    lastValue ^= readVarint(bytes, pos) << (trailingZeros - 1);
+                }
+                double value;
+                memcpy(&value, &lastValue, sizeof(value));
+                bucket.aggregates.emplace_back(value);
+            } else {
+                lastValue = static_cast<uint64_t>(
+                        readDelta(static_cast<int64_t>(lastValue), bytes, pos));
+                bucket.aggregates.emplace_back(static_cast<int64_t>(lastValue));
+            }
+        }
+    }
+}
+
+vector<PastBucket<Value>> NumericValuePastBuckets::getBuckets(const MetricDimensionKey& key) const {
+    vector<PastBucket<Value>> buckets;
+    const auto it = mKeyIds.find(key);
+    if (it != mKeyIds.end()) {
+        decodeBuckets(it->second, buckets);
+    }
+    return buckets;
+}
+
+void NumericValuePastBuckets::clear() {
+    mKeys.clear();
+    mBuckets.clear();
+    mKeyIds.clear();
+    mPackedBytes = 0;
+}
+
+size_t NumericValuePastBuckets::byteSize() const {
+    size_t stateBytes = mBuckets.size() * sizeof(KeyedBuckets);
+    for (const KeyedBuckets& keyedBuckets : mBuckets) {
+        stateBytes += keyedBuckets.mState.mLastValues.size() * sizeof(uint64_t);
+    }
+    return mPackedBytes + stateBytes;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
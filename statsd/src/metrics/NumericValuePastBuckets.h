@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "FieldValue.h"
+#include "HashableDimensionKey.h"
+#include "ValueMetricProducer.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The past buckets of a NumericValueMetricProducer, encoded per key as they are added and only
+ * decoded for dumps.
+ *
+ * Each bucket of a key is stored as varints: its start as a delta to the end of the previous
+ * bucket, its duration as a delta to the previous duration, and its condition true time as a
+ * delta to the previous one. Consecutive full buckets therefore take a byte for each of them.
+ * Each value is stored against the previous value of its aggregation index: as a delta for longs,
+ * and XORed for doubles with the trailing zero bits dropped, like the Gorilla time series format.
+ */
+class NumericValuePastBuckets {
+public:
+    // Whether addBucket() can encode the bucket, which needs long or double aggregates.
+    static bool canEncode(const PastBucket<Value>& bucket);
+
+    // Adds a bucket of the key, after its previous buckets.
+    void addBucket(const MetricDimensionKey& key, const PastBucket<Value>& bucket);
+
+    // Calls callback(key, buckets) for each key, in the order the keys were first added. The
+    // buckets can be moved from.
+    template <typename Callback>
+    void forEach(Callback callback) const {
+        std::vector<PastBucket<Value>> buckets;
+        for (size_t keyId = 0; keyId < mKeys.size(); keyId++) {
+            decodeBuckets(keyId, buckets);
+            callback(mKeys[keyId], buckets);
+        }
+    }
+
+    // Decodes the buckets of the key, empty if the key has none.
+    std::vector<PastBucket<Value>> getBuckets(const MetricDimensionKey& key) const;
+
+    // Number of keys.
+    size_t size() const {
+        return mKeys.size();
+    }
+
+    bool empty() const {
+        return mKeys.empty();
+    }
+
+    void clear();
+
+    // Bytes used by the encoded buckets and the state they are encoded against.
+    size_t byteSize() const;
+
+private:
+    // The previous bucket of a key, that its next bucket is encoded against.
+    struct EncoderState {
+        int64_t mLastBucketEndNs = 0;
+        int64_t mLastBucketDurationNs = 0;
+        int64_t mLastConditionTrueNs = 0;
+        // Bits of the last value, indexed by aggregation index.
+        std::vector<uint64_t> mLastValues;
+    };
+
+    struct KeyedBuckets {
+        std::vector<uint8_t> mPackedBuckets;
+        EncoderState mState;
+    };
+
+    void decodeBuckets(const size_t keyId, std::vector<PastBucket<Value>>& buckets) const;
+
+    // Indexed by key id.
+    std::vector<MetricDimensionKey> mKeys;
+    std::vector<KeyedBuckets> mBuckets;
+
+    std::unordered_map<MetricDimensionKey, uint32_t> mKeyIds;
+
+    size_t mPackedBytes = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
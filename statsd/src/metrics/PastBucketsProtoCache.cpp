@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "PastBucketsProtoCache.h"
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::set;
+using std::string;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+void PastBucketsProtoCache::writeData(uint64_t dataFieldId, const MetricDimensionKey& key,
+                                      size_t numBuckets, set<string>* strSet,
+                                      const DimensionWriter& writeDimension,
+                                      const BucketsWriter& writeBuckets,
+                                      ProtoOutputStream* protoOutput) {
+    const bool hashStrings = strSet != nullptr;
+    if (hashStrings != mHashStrings) {
+        clear();
+        mHashStrings = hashStrings;
+    }
+
+    auto [it, inserted] = mEntries.try_emplace(key);
+    Entry& entry = it->second;
+    if (entry.numBuckets > numBuckets) {
+        // Buckets were removed without clearing the cache, start over.
+        mByteSize -= entry.data.size();
+        entry = Entry();
+        inserted = true;
+    }
+    if (inserted) {
+        set<string> strings;
+        writeDimension(hashStrings ? &strings : nullptr, &mScratch);
+        for (const string& str : strings) {
+            mByteSize += str.size();
+        }
+        entry.strings.assign(strings.begin(), strings.end());
+    }
+    if (entry.numBuckets < numBuckets) {
+        writeBuckets(entry.numBuckets, &mScratch);
+        entry.numBuckets = numBuckets;
+    }
+    if (mScratch.size() > 0) {
+        mScratch.serializeToVector(&mScratchBytes);
+        entry.data.insert(entry.data.end(), mScratchBytes.begin(), mScratchBytes.end());
+        mByteSize += mScratchBytes.size();
+        mScratch.clear();
+    }
+
+    if (strSet != nullptr) {
+        strSet->insert(entry.strings.begin(), entry.strings.end());
+    }
+    protoOutput->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | dataFieldId,
+                       reinterpret_cast<const char*>(entry.data.data()), entry.data.size());
+}
+
+void PastBucketsProtoCache::clear() {
+    mEntries.clear();
+    mByteSize = 0;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
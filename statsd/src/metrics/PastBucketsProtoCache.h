@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+
+#include <functional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The encoded data messages of the past buckets of a metric, kept across the dumps that do not
+ * erase the data.
+ *
+ * A past bucket never changes, and the past buckets of a dimension are only appended to until
+ * they are all cleared. So the data message of a dimension is encoded once, and the next dumps
+ * only encode the buckets appended since. The cache must be cleared along with the past buckets.
+ */
+class PastBucketsProtoCache {
+public:
+    // Writes the dimension fields of the data message of a key. str_set may be null.
+    using DimensionWriter =
+            std::function<void(std::set<std::string>* strSet, util::ProtoOutputStream*)>;
+
+    // Writes the buckets of a key from the index firstBucket on.
+    using BucketsWriter = std::function<void(size_t firstBucket, util::ProtoOutputStream*)>;
+
+    /**
+     * Writes the data message of the key, holding its numBuckets past buckets, as a repeated
+     * field dataFieldId of protoOutput. The strings that the dimension writer hashed are added
+     * to strSet, like writing the dimension again would.
+     */
+    void writeData(uint64_t dataFieldId, const MetricDimensionKey& key, size_t numBuckets,
+                   std::set<std::string>* strSet, const DimensionWriter& writeDimension,
+                   const BucketsWriter& writeBuckets, util::ProtoOutputStream* protoOutput);
+
+    void clear();
+
+    bool empty() const {
+        return mEntries.empty();
+    }
+
+    // Bytes of the encoded messages and of the hashed strings.
+    size_t byteSize() const {
+        return mByteSize;
+    }
+
+private:
+    struct Entry {
+        // Encoded fields of the data message.
+        std::vector<uint8_t> data;
+        size_t numBuckets = 0;
+        // Strings hashed by the dimension fields.
+        std::vector<std::string> strings;
+    };
+
+    std::unordered_map<MetricDimensionKey, Entry> mEntries;
+
+    // Whether the cached dimensions have their strings hashed.
+    bool mHashStrings = false;
+
+    size_t mByteSize = 0;
+
+    // Encodes the appended fields before they are copied to the entries.
+    util::ProtoOutputStream mScratch;
+
+    std::vector<uint8_t> mScratchBytes;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
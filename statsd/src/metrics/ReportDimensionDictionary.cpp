@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "ReportDimensionDictionary.h"
+
+#include "stats_log_util.h"
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::set;
+using std::string;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// for DimensionDictionaryEntry
+const int FIELD_ID_DIMENSION_LEAF_IN_WHAT = 1;
+
+const uint32_t WIRE_TYPE_VARINT = 0;
+
+void ReportDimensionDictionary::writeIndex(const uint32_t fieldId, const HashableDimensionKey& key,
+                                           ProtoOutputStream* protoOutput) {
+    // Like the leaf values, nothing is written for the key of a metric without dimensions.
+    if (key.getValues().empty()) {
+        return;
+    }
+    const auto [it, inserted] = mIndexes.try_emplace(key, mKeys.size());
+    if (inserted) {
+        mKeys.push_back(key);
+    }
+    // Written raw, since write() drops the index 0.
+    protoOutput->writeRawVarint(fieldId << 3 | WIRE_TYPE_VARINT);
+    protoOutput->writeRawVarint(it->second);
+}
+
+void ReportDimensionDictionary::writeToProto(const uint64_t fieldId, set<string>* strSet,
+                                             ProtoOutputStream* protoOutput) const {
+    for (const HashableDimensionKey& key : mKeys) {
+        const uint64_t entryToken =
+                protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | fieldId);
+        writeDimensionLeafNodesToProto(key, FIELD_ID_DIMENSION_LEAF_IN_WHAT, strSet, protoOutput);
+        protoOutput->end(entryToken);
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The dimension keys in what of the metrics of one report, for configs with
+ * dimension_dictionary_in_report. The metrics write the index of each key instead of its values,
+ * and the keys are written once as the ConfigMetricsReport.dimension_dictionary.
+ *
+ * The keys of the metrics are interned, so their hashes are cached and equal keys share their
+ * values, which keeps the lookups cheap. Not thread safe: it is only used by one dump.
+ */
+class ReportDimensionDictionary {
+public:
+    // Writes the index of the key, added to the dictionary if needed, as the int32 field fieldId.
+    // Nothing is written for an empty key.
+    void writeIndex(uint32_t fieldId, const HashableDimensionKey& key,
+                    util::ProtoOutputStream* protoOutput);
+
+    // Writes the keys as repeated DimensionDictionaryEntry fields fieldId. str_set may be null.
+    void writeToProto(uint64_t fieldId, std::set<std::string>* strSet,
+                      util::ProtoOutputStream* protoOutput) const;
+
+    size_t size() const {
+        return mKeys.size();
+    }
+
+private:
+    std::unordered_map<HashableDimensionKey, int32_t> mIndexes;
+
+    // Keys in index order.
+    std::vector<HashableDimensionKey> mKeys;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -73,7 +73,7 @@ void RestrictedEventMetricProducer::onDumpReportLocked(
 
 void RestrictedEventMetricProducer::onMetricRemove() {
     std::lock_guard<std::mutex> lock(mMutex);
-    if (!mIsMetricTableCreated) {
+    if (!mTableDbGeneration) {
         return;
     }
     deleteMetricTable();
@@ -97,13 +97,15 @@ void RestrictedEventMetricProducer::dropDataLocked(const int64_t dropTimeNs) {
     StatsdStats::getInstance().noteBucketDropped(mMetricId);
 }
 
-void RestrictedEventMetricProducer::flushRestrictedData() {
+void RestrictedEventMetricProducer::flushRestrictedData(const bool asyncInsert) {
     std::lock_guard<std::mutex> lock(mMutex);
     if (mLogEvents.empty()) {
         return;
     }
     int64_t flushStartNs = getElapsedRealtimeNs();
-    if (!mIsMetricTableCreated) {
+    vector<string> tableSchema = dbutils::getTableSchema(mLogEvents[0]);
+    if (!mTableDbGeneration || *mTableDbGeneration != dbutils::getDbGeneration(mConfigKey) ||
+        tableSchema != mTableSchema) {
         if (!dbutils::isEventCompatible(mConfigKey, mMetricId, mLogEvents[0])) {
             // Delete old data if schema changes
             // TODO(b/268150038): report error to statsdstats
@@ -117,7 +119,15 @@ void RestrictedEventMetricProducer::flushRestrictedData() {
                                                                               mMetricId);
             return;
         }
-        mIsMetricTableCreated = true;
+        mTableDbGeneration = dbutils::getDbGeneration(mConfigKey);
+        mTableSchema = std::move(tableSchema);
+    }
+    if (asyncInsert) {
+        // Swaps the buffer out, the writer thread reports the insert errors and latency.
+        dbutils::insertAsync(mConfigKey, mMetricId, std::move(mLogEvents), flushStartNs);
+        mLogEvents = vector<LogEvent>();
+        mTotalSize = 0;
+        return;
     }
     string err;
     if (!dbutils::insert(mConfigKey, mMetricId, mLogEvents, err)) {
@@ -150,7 +160,33 @@ void RestrictedEventMetricProducer::deleteMetricTable() {
         StatsdStats::getInstance().noteRestrictedMetricTableDeletionError(mConfigKey, mMetricId);
         VLOG("Failed to delete table for metric %lld", (long long)mMetricId);
     }
-    mIsMetricTableCreated = false;
+    mTableDbGeneration.reset();
+    mTableSchema.clear();
+}
+
+optional<InvalidConfigReason> RestrictedEventMetricProducer::onConfigUpdatedLocked(
+        const StatsdConfig& config, const int configIndex, const int metricIndex,
+        const vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+        const unordered_map<int64_t, int>& oldAtomMatchingTrackerMap,
+        const unordered_map<int64_t, int>& newAtomMatchingTrackerMap,
+        const sp<EventMatcherWizard>& matcherWizard,
+        const vector<sp<ConditionTracker>>& allConditionTrackers,
+        const unordered_map<int64_t, int>& conditionTrackerMap, const sp<ConditionWizard>& wizard,
+        const unordered_map<int64_t, int>& metricToActivationMap,
+        unordered_map<int, vector<int>>& trackerToMetricMap,
+        unordered_map<int, vector<int>>& conditionToMetricMap,
+        unordered_map<int, vector<int>>& activationAtomTrackerToMetricMap,
+        unordered_map<int, vector<int>>& deactivationAtomTrackerToMetricMap,
+        vector<int>& metricsWithActivation) {
+    // The table is checked again on the next flush, in case the db changed meanwhile.
+    mTableDbGeneration.reset();
+    mTableSchema.clear();
+    return EventMetricProducer::onConfigUpdatedLocked(
+            config, configIndex, metricIndex, allAtomMatchingTrackers, oldAtomMatchingTrackerMap,
+            newAtomMatchingTrackerMap, matcherWizard, allConditionTrackers, conditionTrackerMap,
+            wizard, metricToActivationMap, trackerToMetricMap, conditionToMetricMap,
+            activationAtomTrackerToMetricMap, deactivationAtomTrackerToMetricMap,
+            metricsWithActivation);
 }
 
 }  // namespace statsd
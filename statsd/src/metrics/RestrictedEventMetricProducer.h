@@ -3,6 +3,8 @@
 
 #include <gtest/gtest_prod.h>
 
+#include <optional>
+
 #include "EventMetricProducer.h"
 #include "utils/RestrictedPolicyManager.h"
 
@@ -26,7 +28,7 @@ public:
 
     void enforceRestrictedDataTtl(sqlite3* db, const int64_t wallClockNs);
 
-    void flushRestrictedData() override;
+    void flushRestrictedData(const bool asyncInsert) override;
 
     bool writeMetricMetadataToProto(metadata::MetricMetadata* metricMetadata) override;
 
@@ -52,9 +54,33 @@ private:
 
     void dropDataLocked(const int64_t dropTimeNs) override;
 
+    optional<InvalidConfigReason> onConfigUpdatedLocked(
+            const StatsdConfig& config, const int configIndex, const int metricIndex,
+            const std::vector<sp<AtomMatchingTracker>>& allAtomMatchingTrackers,
+            const std::unordered_map<int64_t, int>& oldAtomMatchingTrackerMap,
+            const std::unordered_map<int64_t, int>& newAtomMatchingTrackerMap,
+            const sp<EventMatcherWizard>& matcherWizard,
+            const std::vector<sp<ConditionTracker>>& allConditionTrackers,
+            const std::unordered_map<int64_t, int>& conditionTrackerMap,
+            const sp<ConditionWizard>& wizard,
+            const std::unordered_map<int64_t, int>& metricToActivationMap,
+            std::unordered_map<int, std::vector<int>>& trackerToMetricMap,
+            std::unordered_map<int, std::vector<int>>& conditionToMetricMap,
+            std::unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
+            std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
+            std::vector<int>& metricsWithActivation) override;
+
     void deleteMetricTable();
 
-    bool mIsMetricTableCreated = false;
+    // Set once the metric table is created or checked, to the generation of the db handles it
+    // was checked on. The table metadata is only queried again when the db is opened again, or
+    // when the events change schema.
+    std::optional<uint64_t> mTableDbGeneration;
+
+    // Column types of the metric table, from dbutils::getTableSchema().
+    std::vector<std::string> mTableSchema;
+
+    FRIEND_TEST(RestrictedEventMetricProducerTest, TestFlushAfterDbDeleted);
 
     StatsdRestrictionCategory mRestrictedDataCategory;
 
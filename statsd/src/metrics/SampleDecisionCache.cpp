@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics/SampleDecisionCache.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::nullopt;
+using std::optional;
+using std::span;
+
+void SampleDecisionCache::setCurrentEvent(const LogEvent* event) {
+    mCurrentEvent = event;
+    mEntries.clear();
+}
+
+bool SampleDecisionCache::isCurrentEvent(span<const FieldValue> values) const {
+    // Metrics are given the values of the event itself, copies like pulled aggregates are not
+    // cached.
+    return mCurrentEvent != nullptr && values.data() == mCurrentEvent->getValues().data() &&
+           values.size() == mCurrentEvent->getValues().size();
+}
+
+optional<bool> SampleDecisionCache::find(span<const FieldValue> values,
+                                         const Matcher& sampledField, const int shardCount) const {
+    if (!isCurrentEvent(values)) {
+        return nullopt;
+    }
+    for (const Entry& entry : mEntries) {
+        if (entry.shardCount == shardCount && entry.sampledField == sampledField) {
+            return entry.keep;
+        }
+    }
+    return nullopt;
+}
+
+void SampleDecisionCache::add(span<const FieldValue> values, const Matcher& sampledField,
+                              const int shardCount, const bool keep) {
+    if (!isCurrentEvent(values)) {
+        return;
+    }
+    mEntries.push_back({sampledField, shardCount, keep});
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/RefBase.h>
+
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "FieldValue.h"
+#include "logd/LogEvent.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Held by the MetricProducers of one MetricsManager. Metrics sampled on the same field with the
+// same shard count keep or drop the same events, so the first metric to hash the sampled field of
+// the event the MetricsManager is dispatching leaves its decision here for the others.
+//
+// Not thread safe, this is used under the lock of the StatsLogProcessor like the rest of the
+// MetricsManager.
+class SampleDecisionCache : public virtual RefBase {
+public:
+    // Decisions are only returned for the values of event until the next call. Pass nullptr once
+    // the event has been dispatched.
+    void setCurrentEvent(const LogEvent* event);
+
+    // Returns whether to keep values if a decision was added for the sampled field and shard count
+    // of the current event.
+    std::optional<bool> find(std::span<const FieldValue> values, const Matcher& sampledField,
+                             const int shardCount) const;
+
+    // Adds a decision for the current event, does nothing for other values.
+    void add(std::span<const FieldValue> values, const Matcher& sampledField, const int shardCount,
+             const bool keep);
+
+private:
+    struct Entry {
+        Matcher sampledField;
+        int shardCount;
+        bool keep;
+    };
+
+    bool isCurrentEvent(std::span<const FieldValue> values) const;
+
+    const LogEvent* mCurrentEvent = nullptr;
+
+    // A few entries at most per event, searched linearly.
+    std::vector<Entry> mEntries;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SpaceSavingSummary.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::vector;
+
+SpaceSavingSummary::SpaceSavingSummary(const size_t capacity)
+    : mCapacity(std::min(capacity, kMaxCapacity)) {
+}
+
+void SpaceSavingSummary::add(const MetricDimensionKey& key, const int64_t count) {
+    if (mCapacity == 0) {
+        return;
+    }
+    mTotalCount += count;
+    const auto it = mIndices.find(key);
+    if (it != mIndices.end()) {
+        mEntries[it->second].count += count;
+        return;
+    }
+    if (mEntries.size() < mCapacity) {
+        mIndices.emplace(key, mEntries.size());
+        mEntries.push_back({key, count, /*error=*/0});
+        return;
+    }
+    // The summary is small, and only a key that is not tracked scans it.
+    const auto minEntry = std::min_element(
+            mEntries.begin(), mEntries.end(),
+            [](const Entry& a, const Entry& b) { return a.count < b.count; });
+    const size_t index = minEntry - mEntries.begin();
+    mIndices.erase(minEntry->key);
+    mIndices.emplace(key, index);
+    minEntry->key = key;
+    minEntry->error = minEntry->count;
+    minEntry->count += count;
+}
+
+vector<SpaceSavingSummary::Entry> SpaceSavingSummary::getTopEntries() const {
+    vector<Entry> entries = mEntries;
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry& a, const Entry& b) { return a.count > b.count; });
+    return entries;
+}
+
+void SpaceSavingSummary::clear() {
+    mEntries.clear();
+    mIndices.clear();
+    mTotalCount = 0;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
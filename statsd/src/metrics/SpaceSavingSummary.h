@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "HashableDimensionKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Space-Saving summary of the most frequent keys of a stream, in bounded memory.
+ *
+ * Up to capacity keys are tracked. A key that is not tracked when the summary is full replaces
+ * the key with the lowest count, and inherits that count as its error. Every tracked key occurs
+ * at least count - error times, and any key that occurs more than total / capacity times is
+ * tracked.
+ */
+class SpaceSavingSummary {
+public:
+    static constexpr size_t kMaxCapacity = 100;
+
+    struct Entry {
+        MetricDimensionKey key;
+        int64_t count;
+        // Upper bound of the count that the key inherited from the key it replaced.
+        int64_t error;
+    };
+
+    // capacity is clamped to kMaxCapacity.
+    explicit SpaceSavingSummary(size_t capacity);
+
+    void add(const MetricDimensionKey& key, int64_t count = 1);
+
+    // The tracked keys, by decreasing count.
+    std::vector<Entry> getTopEntries() const;
+
+    // Sum of the counts added since the last clear().
+    int64_t getTotalCount() const {
+        return mTotalCount;
+    }
+
+    size_t getCapacity() const {
+        return mCapacity;
+    }
+
+    bool empty() const {
+        return mEntries.empty();
+    }
+
+    void clear();
+
+private:
+    const size_t mCapacity;
+
+    std::vector<Entry> mEntries;
+
+    // Index of each key in mEntries.
+    std::unordered_map<MetricDimensionKey, size_t> mIndices;
+
+    int64_t mTotalCount = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -19,16 +19,17 @@
 
 #include "ValueMetricProducer.h"
 
-#include <kll.h>
 #include <limits.h>
 #include <stdlib.h>
 
 #include "FieldValue.h"
 #include "HashableDimensionKey.h"
+#include "KllSketch.h"
 #include "guardrail/StatsdStats.h"
 #include "metrics/parsing_utils/metrics_manager_util.h"
 #include "stats_log_util.h"
 #include "stats_util.h"
+#include "utils/HyperLogLog.h"
 
 using android::util::FIELD_COUNT_REPEATED;
 using android::util::FIELD_TYPE_BOOL;
@@ -36,8 +37,8 @@ using android::util::FIELD_TYPE_INT32;
 using android::util::FIELD_TYPE_INT64;
 using android::util::FIELD_TYPE_MESSAGE;
 using android::util::ProtoOutputStream;
-using dist_proc::aggregation::KllQuantile;
 using std::optional;
+using std::pair;
 using std::shared_ptr;
 using std::unique_ptr;
 using std::unordered_map;
@@ -68,6 +69,7 @@ const int FIELD_ID_DROP_TIME = 2;
 const int FIELD_ID_DIMENSION_IN_WHAT = 1;
 const int FIELD_ID_BUCKET_INFO = 3;
 const int FIELD_ID_DIMENSION_LEAF_IN_WHAT = 4;
+const int FIELD_ID_DIMENSION_INDEX_IN_WHAT = 8;
 const int FIELD_ID_SLICE_BY_STATE = 6;
 
 template <typename AggregatedValue, typename DimExtras>
@@ -286,6 +288,7 @@ template <typename AggregatedValue, typename DimExtras>
 void ValueMetricProducer<AggregatedValue, DimExtras>::clearPastBucketsLocked(
         const int64_t dumpTimeNs) {
     mPastBuckets.clear();
+    mPastBucketsByteSize = 0;
     mSkippedBuckets.clear();
 }
 
@@ -300,7 +303,8 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onDumpReportLocked(
     if (!isPulled()) {
         flushIfNeededLocked(dumpTimeNs);
     }
-    if (includeCurrentPartialBucket) {
+    const bool snapshotCurrentBucket = includeCurrentPartialBucket && dumpLatency == SNAPSHOT;
+    if (includeCurrentPartialBucket && !snapshotCurrentBucket) {
         // For pull metrics, we need to do a pull at bucket boundaries. If we do not do that the
         // current bucket will have incomplete data and the next will have the wrong snapshot to do
         // a diff against. If the condition is false, we are fine since the base data is reset and
@@ -313,14 +317,22 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onDumpReportLocked(
                 case NO_TIME_CONSTRAINTS:
                     pullAndMatchEventsLocked(dumpTimeNs);
                     break;
+                case SNAPSHOT:
+                    // The current bucket is not flushed.
+                    break;
             }
         }
         flushCurrentBucketLocked(dumpTimeNs, dumpTimeNs);
     }
+    prepareDumpReportLocked();
 
     protoOutput->write(FIELD_TYPE_INT64 | FIELD_ID_ID, (long long)mMetricId);
     protoOutput->write(FIELD_TYPE_BOOL | FIELD_ID_IS_ACTIVE, isActiveLocked());
-    if (mPastBuckets.empty() && mSkippedBuckets.empty()) {
+    vector<pair<MetricDimensionKey, PastBucket<AggregatedValue>>> currentBucketSnapshot;
+    if (snapshotCurrentBucket) {
+        currentBucketSnapshot = snapshotCurrentBucketLocked(dumpTimeNs);
+    }
+    if (mPastBuckets.empty() && mSkippedBuckets.empty() && currentBucketSnapshot.empty()) {
         return;
     }
 
@@ -363,7 +375,8 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onDumpReportLocked(
         protoOutput->end(wrapperToken);
     }
 
-    for (const auto& [metricDimensionKey, buckets] : mPastBuckets) {
+    const auto writeData = [&](const MetricDimensionKey& metricDimensionKey,
+                               std::span<const PastBucket<AggregatedValue>> buckets) {
         VLOG("  dimension key %s", metricDimensionKey.toString().c_str());
         uint64_t wrapperToken =
                 protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_DATA);
@@ -374,6 +387,10 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onDumpReportLocked(
                     protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_DIMENSION_IN_WHAT);
             writeDimensionToProto(metricDimensionKey.getDimensionKeyInWhat(), strSet, protoOutput);
             protoOutput->end(dimensionToken);
+        } else if (mDimensionDictionary != nullptr) {
+            mDimensionDictionary->writeIndex(FIELD_ID_DIMENSION_INDEX_IN_WHAT,
+                                             metricDimensionKey.getDimensionKeyInWhat(),
+                                             protoOutput);
         } else {
             writeDimensionLeafNodesToProto(metricDimensionKey.getDimensionKeyInWhat(),
                                            FIELD_ID_DIMENSION_LEAF_IN_WHAT, strSet, protoOutput);
@@ -434,12 +451,20 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onDumpReportLocked(
             protoOutput->end(bucketInfoToken);
         }
         protoOutput->end(wrapperToken);
+    };
+    for (const auto& [metricDimensionKey, buckets] : mPastBuckets) {
+        writeData(metricDimensionKey, buckets);
+    }
+    // The snapshot of the current bucket, in data entries of its own.
+    for (const auto& [metricDimensionKey, bucket] : currentBucketSnapshot) {
+        writeData(metricDimensionKey, std::span(&bucket, 1));
     }
     protoOutput->end(protoToken);
 
     VLOG("metric %lld done with dump report...", (long long)mMetricId);
     if (eraseData) {
         mPastBuckets.clear();
+        mPastBucketsByteSize = 0;
         mSkippedBuckets.clear();
     }
 }
@@ -599,7 +624,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::dumpStatesLocked(int out,
             (unsigned long)mCurrentSlicedBucket.size());
     if (verbose) {
         for (const auto& [metricDimensionKey, currentBucket] : mCurrentSlicedBucket) {
-            for (const Interval& interval : currentBucket.intervals) {
+            for (const Interval& interval : getIntervals(currentBucket)) {
                 dprintf(out, "\t(what)%s\t(states)%s  (aggregate)%s\n",
                         metricDimensionKey.getDimensionKeyInWhat().toString().c_str(),
                         metricDimensionKey.getStateValuesKey().toString().c_str(),
@@ -678,10 +703,19 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalL
         return;
     }
 
-    const auto& returnVal = mDimInfos.emplace(whatKey, DimensionsInWhatInfo(getUnknownStateKey()));
-    DimensionsInWhatInfo& dimensionsInWhatInfo = returnVal.first->second;
+    auto dimInfoIt = mDimInfos.find(whatKey);
+    if (dimInfoIt == mDimInfos.end()) {
+        dimInfoIt = mDimInfos.emplace(internDimensionKeyLocked(whatKey),
+                                      DimensionsInWhatInfo(getUnknownStateKey()))
+                            .first;
+    }
+    // Use the stored key for the buckets so that they share its values.
+    const HashableDimensionKey& internedWhatKey = dimInfoIt->first;
+    DimensionsInWhatInfo& dimensionsInWhatInfo = dimInfoIt->second;
     const HashableDimensionKey& oldStateKey = dimensionsInWhatInfo.currentState;
-    CurrentBucket& currentBucket = mCurrentSlicedBucket[MetricDimensionKey(whatKey, oldStateKey)];
+    const auto currentBucketIt =
+            mCurrentSlicedBucket.try_emplace(MetricDimensionKey(internedWhatKey, oldStateKey)).first;
+    CurrentBucket& currentBucket = currentBucketIt->second;
 
     // Ensure we turn on the condition timer in the case where dimensions
     // were missing on a previous pull due to a state change.
@@ -690,10 +724,10 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalL
 
     // We need to get the intervals stored with the previous state key so we can
     // close these value intervals.
-    vector<Interval>& intervals = currentBucket.intervals;
-    if (intervals.size() < mFieldMatchers.size()) {
-        VLOG("Resizing number of intervals to %d", (int)mFieldMatchers.size());
-        intervals.resize(mFieldMatchers.size());
+    const Intervals intervals = getOrCreateIntervals(currentBucket);
+    if (!currentBucket.touched) {
+        currentBucket.touched = true;
+        mTouchedBuckets.push_back(&*currentBucketIt);
     }
 
     dimensionsInWhatInfo.hasCurrentState = true;
@@ -708,7 +742,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::onMatchedLogEventInternalL
         currentBucket.conditionTimer.onConditionChanged(false, eventTimeNs);
 
         // Turn ON the condition timer for the new state key.
-        mCurrentSlicedBucket[MetricDimensionKey(whatKey, stateKey)]
+        mCurrentSlicedBucket[MetricDimensionKey(internedWhatKey, stateKey)]
                 .conditionTimer.onConditionChanged(true, eventTimeNs);
     }
 }
@@ -797,10 +831,12 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::closeCurrentBucket(
     }
     if (!mCurrentBucketIsSkipped) {
         bool bucketHasData = false;
-        // The current bucket is large enough to keep.
-        for (auto& [metricDimensionKey, currentBucket] : mCurrentSlicedBucket) {
+        // The current bucket is large enough to keep. Only the buckets that aggregated events
+        // since the last bucket boundary can have data.
+        for (CurrentBucketEntry* touchedBucketEntry : mTouchedBuckets) {
+            auto& [metricDimensionKey, currentBucket] = *touchedBucketEntry;
             PastBucket<AggregatedValue> bucket =
-                    buildPartialBucket(bucketEndTimeNs, currentBucket.intervals);
+                    buildPartialBucket(bucketEndTimeNs, getIntervals(currentBucket));
             if (bucket.aggIndex.empty()) {
                 continue;
             }
@@ -815,8 +851,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::closeCurrentBucket(
                 bucket.mConditionCorrectionNs = globalConditionCorrectionNs;
             }
 
-            auto& bucketList = mPastBuckets[metricDimensionKey];
-            bucketList.push_back(std::move(bucket));
+            addPastBucketLocked(metricDimensionKey, std::move(bucket));
         }
         if (!bucketHasData) {
             skipCurrentBucket(eventTimeNs, BucketDropReason::NO_DATA);
@@ -842,18 +877,61 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::closeCurrentBucket(
     }
 }
 
+template <typename AggregatedValue, typename DimExtras>
+vector<pair<MetricDimensionKey, PastBucket<AggregatedValue>>>
+ValueMetricProducer<AggregatedValue, DimExtras>::snapshotCurrentBucketLocked(
+        const int64_t dumpTimeNs) {
+    vector<pair<MetricDimensionKey, PastBucket<AggregatedValue>>> snapshot;
+    if (!canSnapshotCurrentBucket() || mCurrentBucketIsSkipped ||
+        mCondition == ConditionState::kUnknown) {
+        return snapshot;
+    }
+    const int64_t bucketEndTimeNs = std::min(dumpTimeNs, getCurrentBucketEndTimeNs());
+    // Copies of the condition timers are closed instead, like in closeCurrentBucket().
+    ConditionTimer globalConditionTimer = mConditionTimer;
+    const auto [globalConditionDurationNs, globalConditionCorrectionNs] =
+            globalConditionTimer.newBucketStart(dumpTimeNs, bucketEndTimeNs);
+    for (CurrentBucketEntry* touchedBucketEntry : mTouchedBuckets) {
+        auto& [metricDimensionKey, currentBucket] = *touchedBucketEntry;
+        PastBucket<AggregatedValue> bucket =
+                buildPartialBucket(bucketEndTimeNs, getIntervals(currentBucket));
+        if (bucket.aggIndex.empty()) {
+            continue;
+        }
+        if (!mSlicedStateAtoms.empty()) {
+            ConditionTimer conditionTimer = currentBucket.conditionTimer;
+            const auto [conditionDurationNs, conditionCorrectionNs] =
+                    conditionTimer.newBucketStart(dumpTimeNs, bucketEndTimeNs);
+            bucket.mConditionTrueNs = conditionDurationNs;
+            bucket.mConditionCorrectionNs = conditionCorrectionNs;
+        } else {
+            bucket.mConditionTrueNs = globalConditionDurationNs;
+            bucket.mConditionCorrectionNs = globalConditionCorrectionNs;
+        }
+        snapshot.emplace_back(metricDimensionKey, std::move(bucket));
+    }
+    return snapshot;
+}
+
 template <typename AggregatedValue, typename DimExtras>
 void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
         int64_t nextBucketStartTimeNs) {
     StatsdStats::getInstance().noteBucketCount(mMetricId);
+    mLastBucketDimensionCount = mCurrentSlicedBucket.size();
     if (mSlicedStateAtoms.empty()) {
-        mCurrentSlicedBucket.clear();
+        clearCurrentSlicedBucket();
     } else {
-        for (auto it = mCurrentSlicedBucket.begin(); it != mCurrentSlicedBucket.end();) {
-            bool obsolete = true;
-            for (auto& interval : it->second.intervals) {
+        // Buckets that did not aggregate any event have no samples to reset.
+        for (CurrentBucketEntry* touchedBucketEntry : mTouchedBuckets) {
+            for (auto& interval : getIntervals(touchedBucketEntry->second)) {
                 interval.sampleSize = 0;
             }
+            touchedBucketEntry->second.touched = false;
+        }
+        mTouchedBuckets.clear();
+
+        for (auto it = mCurrentSlicedBucket.begin(); it != mCurrentSlicedBucket.end();) {
+            bool obsolete = true;
 
             // When slicing by state, only delete the MetricDimensionKey when the
             // state key in the MetricDimensionKey is not the current state key.
@@ -865,7 +943,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
                 obsolete = false;
             }
             if (obsolete) {
-                it = mCurrentSlicedBucket.erase(it);
+                it = eraseCurrentBucket(it);
             } else {
                 it++;
             }
@@ -879,6 +957,7 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
             it++;
         }
     }
+    shrinkMapIfSparse(mDimInfos);
 
     mCurrentBucketIsSkipped = false;
     mCurrentSkippedBucket.reset();
@@ -890,9 +969,63 @@ void ValueMetricProducer<AggregatedValue, DimExtras>::initNextSlicedBucket(
          (long long)mCurrentBucketStartTimeNs);
 }
 
+template <typename AggregatedValue, typename DimExtras>
+typename ValueMetricProducer<AggregatedValue, DimExtras>::Intervals
+ValueMetricProducer<AggregatedValue, DimExtras>::getOrCreateIntervals(
+        CurrentBucket& currentBucket) {
+    if (currentBucket.intervalRow < 0 && !mFieldMatchers.empty()) {
+        if (!mFreeIntervalRows.empty()) {
+            currentBucket.intervalRow = mFreeIntervalRows.back();
+            mFreeIntervalRows.pop_back();
+        } else {
+            VLOG("Adding a row of %d intervals", (int)mFieldMatchers.size());
+            currentBucket.intervalRow = static_cast<int>(mIntervals.size() / mFieldMatchers.size());
+            mIntervals.resize(mIntervals.size() + mFieldMatchers.size());
+        }
+    }
+    return getIntervals(currentBucket);
+}
+
+template <typename AggregatedValue, typename DimExtras>
+typename std::unordered_map<
+        MetricDimensionKey,
+        typename ValueMetricProducer<AggregatedValue, DimExtras>::CurrentBucket>::iterator
+ValueMetricProducer<AggregatedValue, DimExtras>::eraseCurrentBucket(
+        typename std::unordered_map<MetricDimensionKey, CurrentBucket>::iterator it) {
+    if (it->second.intervalRow >= 0) {
+        for (Interval& interval : getIntervals(it->second)) {
+            interval = Interval();
+        }
+        mFreeIntervalRows.push_back(it->second.intervalRow);
+    }
+    return mCurrentSlicedBucket.erase(it);
+}
+
+template <typename AggregatedValue, typename DimExtras>
+void ValueMetricProducer<AggregatedValue, DimExtras>::reserveDimensionsLocked(
+        const size_t dimensionCount) {
+    // clear() keeps the capacity of the maps, so that they are only reserved once.
+    mCurrentSlicedBucket.reserve(dimensionCount);
+    mDimInfos.reserve(dimensionCount);
+    mPastBuckets.reserve(dimensionCount);
+    mTouchedBuckets.reserve(dimensionCount);
+    mIntervals.reserve(dimensionCount * mFieldMatchers.size());
+}
+
+template <typename AggregatedValue, typename DimExtras>
+void ValueMetricProducer<AggregatedValue, DimExtras>::clearCurrentSlicedBucket() {
+    mCurrentSlicedBucket.clear();
+    mTouchedBuckets.clear();
+    // clear() keeps the capacity of mIntervals for the next bucket.
+    mIntervals.clear();
+    mFreeIntervalRows.clear();
+}
+
 // Explicit template instantiations
 template class ValueMetricProducer<Value, vector<optional<Value>>>;
-template class ValueMetricProducer<unique_ptr<KllQuantile>, Empty>;
+template class ValueMetricProducer<unique_ptr<KllSketch>, Empty>;
+template class ValueMetricProducer<unique_ptr<HyperLogLog>, Empty>;
+template class ValueMetricProducer<vector<int64_t>, Empty>;
 
 }  // namespace statsd
 }  // namespace os
@@ -19,6 +19,8 @@
 #include <gtest/gtest_prod.h>
 
 #include <optional>
+#include <span>
+#include <utility>
 
 #include "FieldValue.h"
 #include "HashableDimensionKey.h"
@@ -70,6 +72,8 @@ public:
     struct PullOptions {
         const int pullAtomId;
         const sp<StatsPullerManager>& pullerManager;
+        // The top level fields of the atom that the what matcher reads, nullopt if unknown.
+        const std::optional<std::vector<int>> whatMatcherFields = std::nullopt;
     };
 
     struct BucketOptions {
@@ -133,6 +137,12 @@ public:
                         const FieldValue& oldState, const FieldValue& newState) override;
 
 protected:
+    bool addFieldsInUseLocked(AtomFieldMasks* fieldMasks) const override {
+        MetricProducer::addFieldsInUseLocked(fieldMasks);
+        addTopLevelFields(mFieldMatchers, fieldMasks);
+        return false;
+    }
+
     ValueMetricProducer(const int64_t& metricId, const ConfigKey& key, const uint64_t protoHash,
                         const PullOptions& pullOptions, const BucketOptions& bucketOptions,
                         const WhatOptions& whatOptions, const ConditionOptions& conditionOptions,
@@ -281,18 +291,96 @@ protected:
         // If the `MetricDimensionKey` state key is the current state key, then
         // the condition timer will be updated later (e.g. condition/state/active
         // state change) with the correct condition and time.
-        CurrentBucket() : intervals(), conditionTimer(ConditionTimer(false, 0)) {
+        CurrentBucket()
+            : intervalRow(-1), touched(false), conditionTimer(ConditionTimer(false, 0)) {
         }
-        // Value information for each value field of the metric.
-        std::vector<Interval> intervals;
+        // Row of mIntervals holding the value information for each value field of the metric,
+        // or -1 if nothing has been aggregated into the bucket yet.
+        int intervalRow;
+        // Whether the bucket is in mTouchedBuckets.
+        bool touched;
         // Tracks how long the condition is true.
         ConditionTimer conditionTimer;
     };
 
+    // The intervals of one current bucket. Only valid until intervals are given to another
+    // bucket, which may grow mIntervals.
+    template <typename IntervalType>
+    struct IntervalRow {
+        IntervalType* first;
+        size_t count;
+
+        inline IntervalType* begin() const {
+            return first;
+        }
+
+        inline IntervalType* end() const {
+            return first + count;
+        }
+
+        inline size_t size() const {
+            return count;
+        }
+
+        inline bool empty() const {
+            return count == 0;
+        }
+
+        inline IntervalType& operator[](size_t i) const {
+            return first[i];
+        }
+    };
+
+    using Intervals = IntervalRow<Interval>;
+    using ConstIntervals = IntervalRow<const Interval>;
+
     // Tracks the internal state in the ongoing aggregation bucket for each DimensionsInWhat
     // key and StateValuesKey pair.
     std::unordered_map<MetricDimensionKey, CurrentBucket> mCurrentSlicedBucket;
 
+    using CurrentBucketEntry =
+            typename std::unordered_map<MetricDimensionKey, CurrentBucket>::value_type;
+
+    // Entries of mCurrentSlicedBucket that aggregated events since the last bucket boundary, so
+    // that closing a bucket does not visit the keys kept only for their state. Cleared whenever
+    // entries are erased.
+    std::vector<CurrentBucketEntry*> mTouchedBuckets;
+
+    // Intervals of all current buckets, one row of mFieldMatchers.size() intervals per bucket.
+    // Keeping them in one vector avoids an allocation per dimension key, and the capacity is
+    // reused by the following buckets.
+    std::vector<Interval> mIntervals;
+
+    // Rows of mIntervals released by erased buckets, reset to default intervals.
+    std::vector<int> mFreeIntervalRows;
+
+    // Returns the intervals of a current bucket, empty if nothing has been aggregated into it.
+    inline Intervals getIntervals(const CurrentBucket& currentBucket) {
+        if (currentBucket.intervalRow < 0) {
+            return {nullptr, 0};
+        }
+        return {mIntervals.data() + currentBucket.intervalRow * mFieldMatchers.size(),
+                mFieldMatchers.size()};
+    }
+
+    inline ConstIntervals getIntervals(const CurrentBucket& currentBucket) const {
+        if (currentBucket.intervalRow < 0) {
+            return {nullptr, 0};
+        }
+        return {mIntervals.data() + currentBucket.intervalRow * mFieldMatchers.size(),
+                mFieldMatchers.size()};
+    }
+
+    // Gives the bucket a row of intervals if it does not have one yet.
+    Intervals getOrCreateIntervals(CurrentBucket& currentBucket);
+
+    // Erases a bucket from mCurrentSlicedBucket and releases its intervals.
+    typename std::unordered_map<MetricDimensionKey, CurrentBucket>::iterator eraseCurrentBucket(
+            typename std::unordered_map<MetricDimensionKey, CurrentBucket>::iterator it);
+
+    // Clears mCurrentSlicedBucket along with all intervals.
+    void clearCurrentSlicedBucket();
+
     // State key and any extra information for a specific DimensionsInWhat key.
     struct DimensionsInWhatInfo {
         DimensionsInWhatInfo(const HashableDimensionKey& stateKey)
@@ -317,6 +405,10 @@ protected:
     // Save the past buckets and we can clear when the StatsLogReport is dumped.
     std::unordered_map<MetricDimensionKey, std::vector<PastBucket<AggregatedValue>>> mPastBuckets;
 
+    // Sum of pastBucketByteSize() over mPastBuckets, kept up to date as buckets are added and
+    // cleared so byteSizeLocked() does not have to walk the buckets.
+    size_t mPastBucketsByteSize = 0;
+
     const int64_t mMinBucketSizeNs;
 
     // Util function to check whether the specified dimension hits the guardrail.
@@ -330,7 +422,18 @@ protected:
     virtual bool multipleBucketsSkipped(const int64_t numBucketsForward) const = 0;
 
     virtual PastBucket<AggregatedValue> buildPartialBucket(int64_t bucketEndTime,
-                                                           std::vector<Interval>& intervals) = 0;
+                                                           const Intervals& intervals) = 0;
+
+    // Whether buildPartialBucket() leaves the intervals unchanged, so that the dumps can snapshot
+    // the current bucket.
+    virtual bool canSnapshotCurrentBucket() const {
+        return false;
+    }
+
+    // Returns the buckets of the current bucket as if it was closed at dumpTimeNs, without
+    // closing it. Empty if the current bucket can not be snapshotted or is skipped.
+    std::vector<std::pair<MetricDimensionKey, PastBucket<AggregatedValue>>>
+    snapshotCurrentBucketLocked(const int64_t dumpTimeNs);
 
     virtual void closeCurrentBucket(const int64_t eventTimeNs, const int64_t nextBucketStartTimeNs);
 
@@ -340,11 +443,47 @@ protected:
     // condition change or an active state change.
     void updateCurrentSlicedBucketConditionTimers(bool newCondition, int64_t eventTimeNs);
 
+    // Called on dump reports after the last bucket is flushed and before the past buckets are
+    // written, so producers can combine buckets first.
+    virtual void prepareDumpReportLocked() {
+    }
+
     virtual void writePastBucketAggregateToProto(const int aggIndex,
                                                  const AggregatedValue& aggregate,
                                                  const int sampleSize,
                                                  ProtoOutputStream* const protoOutput) const = 0;
 
+    // Returns the bytes used to store a past bucket.
+    virtual size_t pastBucketByteSize(const PastBucket<AggregatedValue>& bucket) const {
+        return kBucketSize;
+    }
+
+    // Stores a bucket closed with data. Producers storing it elsewhere than mPastBuckets add it
+    // there in prepareDumpReportLocked(), and count it in mPastBucketsByteSize meanwhile.
+    virtual void addPastBucketLocked(const MetricDimensionKey& metricDimensionKey,
+                                     PastBucket<AggregatedValue>&& bucket) {
+        mPastBucketsByteSize += pastBucketByteSize(bucket);
+        mPastBuckets[metricDimensionKey].push_back(std::move(bucket));
+    }
+
+    size_t byteSizeLocked() const override {
+        return mPastBucketsByteSize;
+    }
+
+    // The aggregates behind the intervals, such as the sketches of distinct counts, are not
+    // counted.
+    size_t currentBucketByteSizeLocked() const override {
+        return estimateMapByteSize(mCurrentSlicedBucket) + estimateMapByteSize(mDimInfos) +
+               mTouchedBuckets.capacity() * sizeof(CurrentBucketEntry*) +
+               mIntervals.capacity() * sizeof(Interval);
+    }
+
+    size_t getCurrentDimensionCountLocked() const override {
+        return mCurrentSlicedBucket.size();
+    }
+
+    void reserveDimensionsLocked(const size_t dimensionCount) override;
+
     static const size_t kBucketSize = sizeof(PastBucket<AggregatedValue>{});
 
     const size_t mDimensionSoftLimit;
@@ -365,7 +504,7 @@ protected:
     // Returns true if any of the intervals have seen new data.
     // This should return true unless there is an error parsing the value fields from the event.
     virtual bool aggregateFields(const int64_t eventTimeNs, const MetricDimensionKey& eventKey,
-                                 const LogEvent& event, std::vector<Interval>& intervals,
+                                 const LogEvent& event, const Intervals& intervals,
                                  DimExtras& dimExtras) = 0;
 
     // If this is a pulled metric
@@ -71,6 +71,25 @@ struct DurationValues {
     DurationValues() : mDuration(0), mDurationFullBucket(0){};
 };
 
+// A change of the unsliced condition of a metric, which its trackers may apply later.
+struct ConditionChange {
+    bool condition;
+    int64_t timestampNs;
+};
+
+// The effect of consecutive ConditionChanges on durations that are all started, or all paused,
+// before the first change.
+struct FoldedConditionChanges {
+    // Number of changes that paused or resumed the durations.
+    size_t toggleCount = 0;
+    int64_t firstToggleNs = 0;
+    // Time the condition was true between the first and the last toggle.
+    int64_t innerTrueNs = 0;
+    // Start of the last period the condition was true.
+    int64_t lastStartNs = 0;
+    bool endsStarted = false;
+};
+
 class DurationTracker {
 public:
     DurationTracker(const ConfigKey& key, const int64_t& id, const MetricDimensionKey& eventKey,
@@ -111,6 +130,22 @@ public:
     virtual void onSlicedConditionMayChange(const int64_t timestamp) = 0;
     virtual void onConditionChanged(bool condition, const int64_t timestamp) = 0;
 
+    // Applies the changes of an unsliced condition that this tracker has not seen yet. changes
+    // holds the changes of the metric from its epoch firstEpoch on.
+    void applyConditionChanges(const std::vector<ConditionChange>& changes,
+                               const size_t firstEpoch) {
+        const size_t from = mConditionEpoch - firstEpoch;
+        if (from < changes.size()) {
+            onConditionChanges(changes, from);
+        }
+        mConditionEpoch = firstEpoch + changes.size();
+    }
+
+    // Marks the changes before epoch as seen, for a tracker created after them.
+    void setConditionEpoch(const size_t epoch) {
+        mConditionEpoch = epoch;
+    }
+
     virtual void onStateChanged(const int64_t timestamp, const int32_t atomId,
                                 const FieldValue& newState) = 0;
 
@@ -133,6 +168,9 @@ public:
     // Dump internal states for debugging
     virtual void dumpStates(int out, bool verbose) const = 0;
 
+    // Estimated heap bytes of this tracker and the durations it keeps for the current bucket.
+    virtual size_t byteSize() const = 0;
+
     virtual int64_t getCurrentStateKeyDuration() const = 0;
 
     virtual int64_t getCurrentStateKeyFullBucketDuration() const = 0;
@@ -162,6 +200,44 @@ public:
 protected:
     virtual bool hasStartedDuration() const = 0;
 
+    // Applies changes from index from on, as onConditionChanged would one by one. Only called
+    // without anomaly trackers, since no alarm is set or declared for the changes.
+    virtual void onConditionChanges(const std::vector<ConditionChange>& changes,
+                                    const size_t from) = 0;
+
+    void replayConditionChanges(const std::vector<ConditionChange>& changes, const size_t from) {
+        for (size_t i = from; i < changes.size(); i++) {
+            onConditionChanged(changes[i].condition, changes[i].timestampNs);
+        }
+    }
+
+    static FoldedConditionChanges foldConditionChanges(const std::vector<ConditionChange>& changes,
+                                                       const size_t from, const bool started) {
+        FoldedConditionChanges folded;
+        folded.endsStarted = started;
+        for (size_t i = from; i < changes.size(); i++) {
+            const ConditionChange& change = changes[i];
+            if (change.condition == folded.endsStarted) {
+                continue;
+            }
+            if (folded.toggleCount == 0) {
+                folded.firstToggleNs = change.timestampNs;
+            } else if (!change.condition) {
+                folded.innerTrueNs += change.timestampNs - folded.lastStartNs;
+            }
+            if (change.condition) {
+                folded.lastStartNs = change.timestampNs;
+            }
+            folded.endsStarted = change.condition;
+            folded.toggleCount++;
+        }
+        return folded;
+    }
+
+    size_t stateKeyDurationMapByteSize() const {
+        return estimateMapByteSize(mStateKeyDurationMap);
+    }
+
     int64_t getCurrentBucketEndTimeNs() const {
         return mStartTimeNs + (mCurrentBucketNum + 1) * mBucketSizeNs;
     }
@@ -264,6 +340,9 @@ protected:
 
     int64_t mCurrentBucketNum;
 
+    // Number of unsliced condition changes of the metric applied by this tracker.
+    size_t mConditionEpoch = 0;
+
     const int64_t mStartTimeNs;
 
     const bool mConditionSliced;
@@ -33,17 +33,14 @@ MaxDurationTracker::MaxDurationTracker(const ConfigKey& key, const int64_t& id,
                                        const vector<sp<AnomalyTracker>>& anomalyTrackers)
     : DurationTracker(key, id, eventKey, wizard, conditionIndex, nesting, currentBucketStartNs,
                       currentBucketNum, startTimeNs, bucketSizeNs, conditionSliced, fullLink,
-                      anomalyTrackers) {
+                      anomalyTrackers),
+      mNumStarted(0) {
     mDuration = 0;
 }
 
 bool MaxDurationTracker::hitGuardRail(const HashableDimensionKey& newKey,
                                       size_t dimensionHardLimit) const {
     // ===========GuardRail==============
-    if (mInfos.find(newKey) != mInfos.end()) {
-        // if the key existed, we are good!
-        return false;
-    }
     // 1. Report the tuple count if the tuple count > soft limit
     if (mInfos.size() >= StatsdStats::kDimensionKeySizeSoftLimit) {
         size_t newTupleCount = mInfos.size() + 1;
@@ -62,20 +59,62 @@ bool MaxDurationTracker::hitGuardRail(const HashableDimensionKey& newKey,
     return false;
 }
 
+void MaxDurationTracker::detach(IndexedDurationInfo& info, const int64_t timestamp) {
+    if (!info.followsClock) {
+        return;
+    }
+    DurationInfo& duration = info.duration;
+    const int64_t currentDuration = *info.indexIt + getClockNs(timestamp);
+    mClockIndex.erase(info.indexIt);
+    info.followsClock = false;
+    mDetachedInfos.insert(&info);
+    if (!mClockRunning) {
+        duration.state = DurationState::kPaused;
+        duration.lastDuration = currentDuration;
+        return;
+    }
+    // The duration still has the start time it joined with, unless the clock paused and resumed
+    // since. A duration that joined paused only runs after such a resume.
+    if (mClockResumes > info.clockResumes) {
+        duration.lastStartTime = mClockResumedNs;
+        duration.lastDuration = currentDuration - (timestamp - mClockResumedNs);
+    }
+    duration.state = DurationState::kStarted;
+    onStarted(info);
+}
+
+void MaxDurationTracker::onStarted(IndexedDurationInfo& info) {
+    mNumStarted++;
+    info.indexIt = mStartedIndex.insert(info.duration.lastDuration - info.duration.lastStartTime);
+}
+
+void MaxDurationTracker::onNoLongerStarted(IndexedDurationInfo& info) {
+    mNumStarted--;
+    mStartedIndex.erase(info.indexIt);
+}
+
 void MaxDurationTracker::noteStart(const HashableDimensionKey& key, bool condition,
                                    const int64_t eventTime, const ConditionKey& conditionKey,
                                    size_t dimensionHardLimit) {
-    // this will construct a new DurationInfo if this key didn't exist.
-    if (hitGuardRail(key, dimensionHardLimit)) {
-        return;
+    auto it = mInfos.find(key);
+    if (it == mInfos.end()) {
+        if (hitGuardRail(key, dimensionHardLimit)) {
+            return;
+        }
+        // this will construct a new DurationInfo since this key didn't exist.
+        it = mInfos.emplace(key, IndexedDurationInfo()).first;
+        mDetachedInfos.insert(&it->second);
     }
 
-    DurationInfo& duration = mInfos[key];
+    IndexedDurationInfo& info = it->second;
+    DurationInfo& duration = info.duration;
     if (mConditionSliced) {
         duration.conditionKeys = conditionKey;
     }
     VLOG("MaxDuration: key %s start condition %d", key.toString().c_str(), condition);
 
+    // The state of a duration that follows the clock is not up to date, but it is never
+    // kStopped, which is all that matters here.
     switch (duration.state) {
         case kStarted:
             duration.startCount++;
@@ -90,6 +129,7 @@ void MaxDurationTracker::noteStart(const HashableDimensionKey& key, bool conditi
             } else {
                 duration.state = DurationState::kStarted;
                 duration.lastStartTime = eventTime;
+                onStarted(info);
                 startAnomalyAlarm(eventTime);
             }
             duration.startCount = 1;
@@ -100,11 +140,14 @@ void MaxDurationTracker::noteStart(const HashableDimensionKey& key, bool conditi
 void MaxDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t eventTime,
                                   bool forceStop) {
     VLOG("MaxDuration: key %s stop", key.toString().c_str());
-    if (mInfos.find(key) == mInfos.end()) {
+    auto it = mInfos.find(key);
+    if (it == mInfos.end()) {
         // we didn't see a start event before. do nothing.
         return;
     }
-    DurationInfo& duration = mInfos[key];
+    IndexedDurationInfo& info = it->second;
+    detach(info, eventTime);
+    DurationInfo& duration = info.duration;
 
     switch (duration.state) {
         case DurationState::kStopped:
@@ -115,6 +158,7 @@ void MaxDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t
             if (forceStop || !mNested || duration.startCount <= 0) {
                 stopAnomalyAlarm(eventTime);
                 duration.state = DurationState::kStopped;
+                onNoLongerStarted(info);
                 int64_t durationTime = eventTime - duration.lastStartTime;
                 VLOG("Max, key %s, Stop %lld %lld %lld", key.toString().c_str(),
                      (long long)duration.lastStartTime, (long long)eventTime,
@@ -145,17 +189,13 @@ void MaxDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t
     // Once an atom duration ends, we erase it. Next time, if we see another atom event with the
     // same name, they are still considered as different atom durations.
     if (duration.state == DurationState::kStopped) {
-        mInfos.erase(key);
+        mDetachedInfos.erase(&info);
+        mInfos.erase(it);
     }
 }
 
 bool MaxDurationTracker::hasStartedDuration() const {
-    for (auto& pair : mInfos) {
-        if (pair.second.state == kStarted) {
-            return true;
-        }
-    }
-    return false;
+    return mNumStarted > 0 || (mClockRunning && !mClockIndex.empty());
 }
 
 bool MaxDurationTracker::hasAccumulatedDuration() const {
@@ -192,18 +232,9 @@ bool MaxDurationTracker::flushCurrentBucket(
         currentBucketEndTimeNs = eventTimeNs;
     }
 
-    bool hasPendingEvent =
-            false;  // has either a kStarted or kPaused event across bucket boundaries
-    // meaning we need to carry them over to the new bucket.
-    for (auto it = mInfos.begin(); it != mInfos.end();) {
-        if (it->second.state == DurationState::kStopped) {
-            // No need to keep buckets for events that were stopped before.
-            it = mInfos.erase(it);
-        } else {
-            ++it;
-            hasPendingEvent = true;
-        }
-    }
+    // Stopped durations are erased as they stop, so every duration left is either kStarted or
+    // kPaused across the bucket boundary, and is carried over to the new bucket.
+    const bool hasPendingEvent = !mInfos.empty();
 
     // mDuration is updated in noteStop to the maximum duration that ended in the current bucket.
     if (durationPassesThreshold(uploadThreshold, mDuration)) {
@@ -244,16 +275,13 @@ bool MaxDurationTracker::flushIfNeeded(
 void MaxDurationTracker::onSlicedConditionMayChange(const int64_t timestamp) {
     // Now for each of the on-going event, check if the condition has changed for them.
     for (auto& pair : mInfos) {
-        if (pair.second.state == kStopped) {
-            continue;
-        }
         ConditionState conditionState = mWizard->query(
-            mConditionTrackerIndex, pair.second.conditionKeys,
+            mConditionTrackerIndex, pair.second.duration.conditionKeys,
             !mHasLinksToAllConditionDimensionsInTracker);
         bool conditionMet = (conditionState == ConditionState::kTrue);
 
         VLOG("key: %s, condition: %d", pair.first.toString().c_str(), conditionMet);
-        noteConditionChanged(pair.first, conditionMet, timestamp);
+        noteConditionChanged(pair.first, pair.second, conditionMet, timestamp);
     }
 }
 
@@ -263,9 +291,59 @@ void MaxDurationTracker::onStateChanged(const int64_t timestamp, const int32_t a
 }
 
 void MaxDurationTracker::onConditionChanged(bool condition, const int64_t timestamp) {
-    for (auto& pair : mInfos) {
-        noteConditionChanged(pair.first, condition, timestamp);
+    // Every duration is left kStarted if the condition is met and kPaused otherwise, which the
+    // durations on the clock get by the clock running or not.
+    bool changed = condition != mClockRunning && !mClockIndex.empty();
+    for (IndexedDurationInfo* info : mDetachedInfos) {
+        changed |= (info->duration.state == DurationState::kStarted) != condition;
+    }
+    if (!changed) {
+        return;
+    }
+    if (!condition) {
+        stopAnomalyAlarm(timestamp);
     }
+
+    mClockTrueNs = getClockNs(timestamp);
+    mClockUpdatedNs = timestamp;
+    if (condition && !mClockRunning) {
+        mClockResumes++;
+        mClockResumedNs = timestamp;
+    }
+    mClockRunning = condition;
+    // The durations are paused or resumed as they would be on their own, before joining the
+    // clock.
+    for (IndexedDurationInfo* info : mDetachedInfos) {
+        DurationInfo& duration = info->duration;
+        if (duration.state == DurationState::kStarted) {
+            mStartedIndex.erase(info->indexIt);
+            if (!condition) {
+                duration.lastDuration += timestamp - duration.lastStartTime;
+            }
+        } else if (condition) {
+            duration.lastStartTime = timestamp;
+        }
+        duration.state = condition ? DurationState::kStarted : DurationState::kPaused;
+        const int64_t currentDuration =
+                duration.lastDuration + (condition ? timestamp - duration.lastStartTime : 0);
+        info->followsClock = true;
+        info->clockResumes = mClockResumes;
+        info->indexIt = mClockIndex.insert(currentDuration - mClockTrueNs);
+    }
+    mDetachedInfos.clear();
+    mNumStarted = 0;
+    VLOG("MaxDurationTracker %s %zu durations", condition ? "started" : "paused",
+         mClockIndex.size());
+
+    if (condition) {
+        startAnomalyAlarm(timestamp);
+    }
+}
+
+void MaxDurationTracker::onConditionChanges(const vector<ConditionChange>& changes,
+                                            const size_t from) {
+    // Once the durations follow the clock, each change only starts or stops the clock.
+    replayConditionChanges(changes, from);
 }
 
 void MaxDurationTracker::noteConditionChanged(const HashableDimensionKey& key, bool conditionMet,
@@ -274,15 +352,26 @@ void MaxDurationTracker::noteConditionChanged(const HashableDimensionKey& key, b
     if (it == mInfos.end()) {
         return;
     }
+    noteConditionChanged(key, it->second, conditionMet, timestamp);
+}
 
-    switch (it->second.state) {
+void MaxDurationTracker::noteConditionChanged(const HashableDimensionKey& key,
+                                              IndexedDurationInfo& info, bool conditionMet,
+                                              const int64_t timestamp) {
+    if (info.followsClock && conditionMet == mClockRunning) {
+        return;
+    }
+    detach(info, timestamp);
+    DurationInfo& duration = info.duration;
+    switch (duration.state) {
         case kStarted:
             // If condition becomes false, kStarted -> kPaused. Record the current duration and
             // stop anomaly alarm.
             if (!conditionMet) {
                 stopAnomalyAlarm(timestamp);
-                it->second.state = DurationState::kPaused;
-                it->second.lastDuration += (timestamp - it->second.lastStartTime);
+                duration.state = DurationState::kPaused;
+                onNoLongerStarted(info);
+                duration.lastDuration += (timestamp - duration.lastStartTime);
                 if (hasStartedDuration()) {
                     // In case any other dimensions are still started, we need to set the alarm.
                     startAnomalyAlarm(timestamp);
@@ -297,8 +386,9 @@ void MaxDurationTracker::noteConditionChanged(const HashableDimensionKey& key, b
             // If condition becomes true, kPaused -> kStarted. and the start time is the condition
             // change time.
             if (conditionMet) {
-                it->second.state = DurationState::kStarted;
-                it->second.lastStartTime = timestamp;
+                duration.state = DurationState::kStarted;
+                duration.lastStartTime = timestamp;
+                onStarted(info);
                 startAnomalyAlarm(timestamp);
                 VLOG("MaxDurationTracker Key: %s Paused->Started", key.toString().c_str());
             }
@@ -312,14 +402,11 @@ int64_t MaxDurationTracker::predictAnomalyTimestampNs(const AnomalyTracker& anom
     // The allowed time we can continue in the current state is the
     // (anomaly threshold) - max(elapsed time of the started mInfos).
     int64_t maxElapsed = 0;
-    for (auto it = mInfos.begin(); it != mInfos.end(); ++it) {
-        if (it->second.state == DurationState::kStarted) {
-            int64_t duration =
-                    it->second.lastDuration + (currentTimestamp - it->second.lastStartTime);
-            if (duration > maxElapsed) {
-                maxElapsed = duration;
-            }
-        }
+    if (!mStartedIndex.empty()) {
+        maxElapsed = std::max(maxElapsed, *mStartedIndex.rbegin() + currentTimestamp);
+    }
+    if (mClockRunning && !mClockIndex.empty()) {
+        maxElapsed = std::max(maxElapsed, *mClockIndex.rbegin() + getClockNs(currentTimestamp));
     }
     int64_t anomalyTimeNs = currentTimestamp + anomalyTracker.getAnomalyThreshold() - maxElapsed;
     int64_t refractoryEndNs = anomalyTracker.getRefractoryPeriodEndsSec(mEventKey) * NS_PER_SEC;
@@ -331,6 +418,15 @@ void MaxDurationTracker::dumpStates(int out, bool verbose) const {
     dprintf(out, "\t\t current duration %lld\n", (long long)mDuration);
 }
 
+size_t MaxDurationTracker::byteSize() const {
+    // A tree node holds its value next to three pointers and a color.
+    const size_t indexNodeSize = sizeof(int64_t) + 4 * sizeof(void*);
+    return sizeof(MaxDurationTracker) + estimateMapByteSize(mInfos) +
+           estimateMapByteSize(mDetachedInfos) +
+           (mStartedIndex.size() + mClockIndex.size()) * indexNodeSize +
+           stateKeyDurationMapByteSize();
+}
+
 int64_t MaxDurationTracker::getCurrentStateKeyDuration() const {
     ALOGE("MaxDurationTracker does not handle sliced state changes.");
     return -1;
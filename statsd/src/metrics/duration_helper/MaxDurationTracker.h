@@ -17,6 +17,9 @@
 #ifndef MAX_DURATION_TRACKER_H
 #define MAX_DURATION_TRACKER_H
 
+#include <set>
+#include <unordered_set>
+
 #include "DurationTracker.h"
 
 namespace android {
@@ -26,6 +29,11 @@ namespace statsd {
 // Tracks a pool of atom durations, and output the max duration for each bucket.
 // To get max duration, we need to keep track of each individual durations, and compare them when
 // they stop or bucket expires.
+//
+// The started durations are indexed by their duration at time 0, so that the longest one is found
+// without a scan. An unsliced condition change pauses or resumes all the durations at once by
+// moving them onto a clock of the condition true time, after which the next changes only stop or
+// run the clock. A duration leaves the clock when it changes on its own, such as when it stops.
 class MaxDurationTracker : public DurationTracker {
 public:
     MaxDurationTracker(const ConfigKey& key, const int64_t& id, const MetricDimensionKey& eventKey,
@@ -34,7 +42,8 @@ public:
                        int64_t bucketSizeNs, bool conditionSliced, bool fullLink,
                        const std::vector<sp<AnomalyTracker>>& anomalyTrackers);
 
-    MaxDurationTracker(const MaxDurationTracker& tracker) = default;
+    // mDetachedInfos and the index entries of mInfos point into the tracker.
+    MaxDurationTracker(const MaxDurationTracker& tracker) = delete;
 
     void noteStart(const HashableDimensionKey& key, bool condition, const int64_t eventTime,
                    const ConditionKey& conditionKey, size_t dimensionHardLimit) override;
@@ -60,6 +69,8 @@ public:
                                       const int64_t currentTimestamp) const override;
     void dumpStates(int out, bool verbose) const override;
 
+    size_t byteSize() const override;
+
     int64_t getCurrentStateKeyDuration() const override;
 
     int64_t getCurrentStateKeyFullBucketDuration() const override;
@@ -72,15 +83,70 @@ protected:
     // Returns true if at least one of the mInfos is started.
     bool hasStartedDuration() const override;
 
+    void onConditionChanges(const std::vector<ConditionChange>& changes,
+                            const size_t from) override;
+
 private:
-    std::unordered_map<HashableDimensionKey, DurationInfo> mInfos;
+    struct IndexedDurationInfo {
+        DurationInfo duration;
+
+        // Whether the duration follows the condition clock. It is then started if the clock
+        // runs, and duration holds its state as of when it joined the clock.
+        bool followsClock = false;
+
+        // mClockResumes when the duration joined the clock.
+        int64_t clockResumes = 0;
+
+        // Entry in mClockIndex if the duration follows the clock, or in mStartedIndex if it is
+        // started otherwise.
+        std::multiset<int64_t>::iterator indexIt;
+    };
+
+    std::unordered_map<HashableDimensionKey, IndexedDurationInfo> mInfos;
+
+    // The mInfos that do not follow the clock.
+    std::unordered_set<IndexedDurationInfo*> mDetachedInfos;
+
+    // Number of the mDetachedInfos in the kStarted state.
+    size_t mNumStarted;
+
+    // lastDuration - lastStartTime of the started mDetachedInfos, which adding the time gives
+    // their current duration.
+    std::multiset<int64_t> mStartedIndex;
+
+    // Current duration minus the clock of the mInfos that follow the clock.
+    std::multiset<int64_t> mClockIndex;
+
+    // Time the condition was true until mClockUpdatedNs, and whether it still is.
+    int64_t mClockTrueNs = 0;
+    int64_t mClockUpdatedNs = 0;
+    bool mClockRunning = false;
+
+    // Number of times the clock resumed, and when it last did. The durations on the clock were
+    // started then, unless they joined it later.
+    int64_t mClockResumes = 0;
+    int64_t mClockResumedNs = 0;
 
     int64_t mDuration;  // current recorded duration result (for partial bucket)
 
+    int64_t getClockNs(const int64_t timestamp) const {
+        return mClockTrueNs + (mClockRunning ? timestamp - mClockUpdatedNs : 0);
+    }
+
+    // Takes the duration off the clock, so that its state and times are up to date.
+    void detach(IndexedDurationInfo& info, const int64_t timestamp);
+
+    void onStarted(IndexedDurationInfo& info);
+    void onNoLongerStarted(IndexedDurationInfo& info);
+
     void noteConditionChanged(const HashableDimensionKey& key, bool conditionMet,
                               const int64_t timestamp);
 
-    // return true if we should not allow newKey to be tracked because we are above the threshold
+    void noteConditionChanged(const HashableDimensionKey& key, IndexedDurationInfo& info,
+                              bool conditionMet, const int64_t timestamp);
+
+    // return true if we should not allow newKey, which is not in mInfos, to be tracked because we
+    // are above the threshold
     bool hitGuardRail(const HashableDimensionKey& newKey, size_t dimensionHardLimit) const;
 
     FRIEND_TEST(MaxDurationTrackerTest, TestSimpleMaxDuration);
@@ -91,6 +157,7 @@ private:
     FRIEND_TEST(MaxDurationTrackerTest, TestAnomalyPredictedTimestamp);
     FRIEND_TEST(MaxDurationTrackerTest, TestUploadThreshold);
     FRIEND_TEST(MaxDurationTrackerTest, TestNoAccumulatingDuration);
+    FRIEND_TEST(MaxDurationTrackerTest, TestConditionClock);
 };
 
 }  // namespace statsd
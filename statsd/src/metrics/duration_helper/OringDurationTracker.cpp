@@ -32,20 +32,50 @@ OringDurationTracker::OringDurationTracker(
     : DurationTracker(key, id, eventKey, wizard, conditionIndex, nesting, currentBucketStartNs,
                       currentBucketNum, startTimeNs, bucketSizeNs, conditionSliced, fullLink,
                       anomalyTrackers),
-      mStarted(),
-      mPaused() {
+      mNumStarted(0),
+      mNumPaused(0),
+      mNumConditionKeys(0) {
     mLastStartTime = 0;
 }
 
+size_t OringDurationTracker::addSlot(const HashableDimensionKey& key) {
+    size_t index;
+    if (!mFreeSlots.empty()) {
+        index = mFreeSlots.back();
+        mFreeSlots.pop_back();
+    } else {
+        index = mSlots.size();
+        mSlots.emplace_back();
+    }
+    mSlotIndex.emplace(key, index);
+    return index;
+}
+
+void OringDurationTracker::removeSlot(
+        std::unordered_map<HashableDimensionKey, size_t>::iterator it) {
+    mSlots[it->second] = DimensionSlot();
+    mFreeSlots.push_back(it->second);
+    mSlotIndex.erase(it);
+}
+
+void OringDurationTracker::clearConditionKey(DimensionSlot* slot) {
+    if (slot->hasConditionKey) {
+        slot->hasConditionKey = false;
+        slot->conditionKey.clear();
+        mNumConditionKeys--;
+    }
+}
+
 bool OringDurationTracker::hitGuardRail(const HashableDimensionKey& newKey,
+                                        const DimensionSlot* slot,
                                         size_t dimensionHardLimit) const {
     // ===========GuardRail==============
     // 1. Report the tuple count if the tuple count > soft limit
-    if (mConditionKeyMap.find(newKey) != mConditionKeyMap.end()) {
+    if (slot != nullptr && slot->hasConditionKey) {
         return false;
     }
-    if (mConditionKeyMap.size() >= StatsdStats::kDimensionKeySizeSoftLimit) {
-        size_t newTupleCount = mConditionKeyMap.size() + 1;
+    if (mNumConditionKeys >= StatsdStats::kDimensionKeySizeSoftLimit) {
+        size_t newTupleCount = mNumConditionKeys + 1;
         StatsdStats::getInstance().noteMetricDimensionSize(mConfigKey, mTrackerId, newTupleCount);
         // 2. Don't add more tuples, we are above the allowed threshold. Drop the data.
         if (newTupleCount > dimensionHardLimit) {
@@ -64,22 +94,32 @@ bool OringDurationTracker::hitGuardRail(const HashableDimensionKey& newKey,
 void OringDurationTracker::noteStart(const HashableDimensionKey& key, bool condition,
                                      const int64_t eventTime, const ConditionKey& conditionKey,
                                      size_t dimensionHardLimit) {
-    if (hitGuardRail(key, dimensionHardLimit)) {
+    auto it = mSlotIndex.find(key);
+    if (hitGuardRail(key, it != mSlotIndex.end() ? &mSlots[it->second] : nullptr,
+                     dimensionHardLimit)) {
         return;
     }
+    const size_t index = it != mSlotIndex.end() ? it->second : addSlot(key);
+    DimensionSlot& slot = mSlots[index];
     if (condition) {
-        if (mStarted.size() == 0) {
+        if (mNumStarted == 0) {
             mLastStartTime = eventTime;
             VLOG("record first start....");
             startAnomalyAlarm(eventTime);
         }
-        mStarted[key]++;
+        if (slot.startedCount++ == 0) {
+            mNumStarted++;
+        }
     } else {
-        mPaused[key]++;
+        if (slot.pausedCount++ == 0) {
+            mNumPaused++;
+        }
     }
 
-    if (mConditionSliced && mConditionKeyMap.find(key) == mConditionKeyMap.end()) {
-        mConditionKeyMap[key] = conditionKey;
+    if (mConditionSliced && !slot.hasConditionKey) {
+        slot.conditionKey = conditionKey;
+        slot.hasConditionKey = true;
+        mNumConditionKeys++;
     }
     VLOG("Oring: %s start, condition %d", key.toString().c_str(), condition);
 }
@@ -87,40 +127,48 @@ void OringDurationTracker::noteStart(const HashableDimensionKey& key, bool condi
 void OringDurationTracker::noteStop(const HashableDimensionKey& key, const int64_t timestamp,
                                     const bool stopAll) {
     VLOG("Oring: %s stop", key.toString().c_str());
-    auto it = mStarted.find(key);
-    if (it != mStarted.end()) {
-        (it->second)--;
-        if (stopAll || !mNested || it->second <= 0) {
-            mStarted.erase(it);
-            mConditionKeyMap.erase(key);
-        }
-        if (mStarted.empty()) {
-            mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
-                    (timestamp - mLastStartTime);
-            detectAndDeclareAnomaly(
-                    timestamp, mCurrentBucketNum,
-                    getCurrentStateKeyDuration() + getCurrentStateKeyFullBucketDuration());
-            VLOG("record duration %lld, total duration %lld for state key %s",
-                 (long long)timestamp - mLastStartTime, (long long)getCurrentStateKeyDuration(),
-                 mEventKey.getStateValuesKey().toString().c_str());
+    auto it = mSlotIndex.find(key);
+    if (it != mSlotIndex.end()) {
+        DimensionSlot& slot = mSlots[it->second];
+        if (slot.startedCount > 0) {
+            slot.startedCount--;
+            if (stopAll || !mNested || slot.startedCount <= 0) {
+                slot.startedCount = 0;
+                mNumStarted--;
+                clearConditionKey(&slot);
+            }
+            if (mNumStarted == 0) {
+                mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
+                        (timestamp - mLastStartTime);
+                detectAndDeclareAnomaly(
+                        timestamp, mCurrentBucketNum,
+                        getCurrentStateKeyDuration() + getCurrentStateKeyFullBucketDuration());
+                VLOG("record duration %lld, total duration %lld for state key %s",
+                     (long long)timestamp - mLastStartTime,
+                     (long long)getCurrentStateKeyDuration(),
+                     mEventKey.getStateValuesKey().toString().c_str());
+            }
         }
-    }
 
-    auto pausedIt = mPaused.find(key);
-    if (pausedIt != mPaused.end()) {
-        (pausedIt->second)--;
-        if (stopAll || !mNested || pausedIt->second <= 0) {
-            mPaused.erase(pausedIt);
-            mConditionKeyMap.erase(key);
+        if (slot.pausedCount > 0) {
+            slot.pausedCount--;
+            if (stopAll || !mNested || slot.pausedCount <= 0) {
+                slot.pausedCount = 0;
+                mNumPaused--;
+                clearConditionKey(&slot);
+            }
+        }
+        if (slot.startedCount == 0 && slot.pausedCount == 0) {
+            removeSlot(it);
         }
     }
-    if (mStarted.empty()) {
+    if (mNumStarted == 0) {
         stopAnomalyAlarm(timestamp);
     }
 }
 
 void OringDurationTracker::noteStopAll(const int64_t timestamp) {
-    if (!mStarted.empty()) {
+    if (mNumStarted > 0) {
         mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                 (timestamp - mLastStartTime);
         VLOG("Oring Stop all: record duration %lld, total duration %lld for state key %s",
@@ -132,9 +180,12 @@ void OringDurationTracker::noteStopAll(const int64_t timestamp) {
     }
 
     stopAnomalyAlarm(timestamp);
-    mStarted.clear();
-    mPaused.clear();
-    mConditionKeyMap.clear();
+    mSlots.clear();
+    mFreeSlots.clear();
+    mSlotIndex.clear();
+    mNumStarted = 0;
+    mNumPaused = 0;
+    mNumConditionKeys = 0;
 }
 
 bool OringDurationTracker::flushCurrentBucket(
@@ -160,7 +211,7 @@ bool OringDurationTracker::flushCurrentBucket(
     }
 
     // Process the current bucket.
-    if (mStarted.size() > 0) {
+    if (mNumStarted > 0) {
         // Calculate the duration for the current state key.
         mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                 (currentBucketEndTimeNs - mLastStartTime);
@@ -199,7 +250,7 @@ bool OringDurationTracker::flushCurrentBucket(
         mStateKeyDurationMap.clear();
     }
 
-    if (mStarted.size() > 0) {
+    if (mNumStarted > 0) {
         for (int i = 1; i < numBucketsForward; i++) {
             DurationBucket info;
             info.mBucketStartNs = fullBucketEnd + mBucketSizeNs * (i - 1);
@@ -233,7 +284,7 @@ bool OringDurationTracker::flushCurrentBucket(
     // for anomaly detection.
     // Note: Anomaly trackers can be added on config updates, in which case mAnomalyTrackers > 0 and
     // the full bucket duration could be used, but this is very rare so it is okay to clear.
-    return mStarted.empty() && mPaused.empty() && (isFullBucket || mAnomalyTrackers.size() == 0);
+    return mNumStarted == 0 && mNumPaused == 0 && (isFullBucket || mAnomalyTrackers.size() == 0);
 }
 
 bool OringDurationTracker::flushIfNeeded(
@@ -246,30 +297,31 @@ bool OringDurationTracker::flushIfNeeded(
 }
 
 void OringDurationTracker::onSlicedConditionMayChange(const int64_t timestamp) {
-    vector<pair<HashableDimensionKey, int>> startedToPaused;
-    vector<pair<HashableDimensionKey, int>> pausedToStarted;
-    if (!mStarted.empty()) {
-        for (auto it = mStarted.begin(); it != mStarted.end();) {
-            const auto& key = it->first;
-            const auto& condIt = mConditionKeyMap.find(key);
-            if (condIt == mConditionKeyMap.end()) {
+    // The slots moved, with their count.
+    vector<pair<size_t, int>> startedToPaused;
+    vector<pair<size_t, int>> pausedToStarted;
+    if (mNumStarted > 0) {
+        for (const auto& [key, index] : mSlotIndex) {
+            DimensionSlot& slot = mSlots[index];
+            if (slot.startedCount == 0) {
+                continue;
+            }
+            if (!slot.hasConditionKey) {
                 VLOG("Key %s dont have condition key", key.toString().c_str());
-                ++it;
                 continue;
             }
             ConditionState conditionState =
-                mWizard->query(mConditionTrackerIndex, condIt->second,
+                mWizard->query(mConditionTrackerIndex, slot.conditionKey,
                                !mHasLinksToAllConditionDimensionsInTracker);
             if (conditionState != ConditionState::kTrue) {
-                startedToPaused.push_back(*it);
-                it = mStarted.erase(it);
+                startedToPaused.emplace_back(index, slot.startedCount);
+                slot.startedCount = 0;
+                mNumStarted--;
                 VLOG("Key %s started -> paused", key.toString().c_str());
-            } else {
-                ++it;
             }
         }
 
-        if (mStarted.empty()) {
+        if (mNumStarted == 0) {
             mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                     (timestamp - mLastStartTime);
             VLOG("record duration %lld, total duration %lld for state key %s",
@@ -281,79 +333,140 @@ void OringDurationTracker::onSlicedConditionMayChange(const int64_t timestamp) {
         }
     }
 
-    if (!mPaused.empty()) {
-        for (auto it = mPaused.begin(); it != mPaused.end();) {
-            const auto& key = it->first;
-            if (mConditionKeyMap.find(key) == mConditionKeyMap.end()) {
+    if (mNumPaused > 0) {
+        for (const auto& [key, index] : mSlotIndex) {
+            DimensionSlot& slot = mSlots[index];
+            if (slot.pausedCount == 0) {
+                continue;
+            }
+            if (!slot.hasConditionKey) {
                 VLOG("Key %s dont have condition key", key.toString().c_str());
-                ++it;
                 continue;
             }
             ConditionState conditionState =
-                mWizard->query(mConditionTrackerIndex, mConditionKeyMap[key],
+                mWizard->query(mConditionTrackerIndex, slot.conditionKey,
                                !mHasLinksToAllConditionDimensionsInTracker);
             if (conditionState == ConditionState::kTrue) {
-                pausedToStarted.push_back(*it);
-                it = mPaused.erase(it);
+                pausedToStarted.emplace_back(index, slot.pausedCount);
+                slot.pausedCount = 0;
+                mNumPaused--;
                 VLOG("Key %s paused -> started", key.toString().c_str());
-            } else {
-                ++it;
             }
         }
 
-        if (mStarted.empty() && pausedToStarted.size() > 0) {
+        if (mNumStarted == 0 && pausedToStarted.size() > 0) {
             mLastStartTime = timestamp;
         }
     }
 
-    if (mStarted.empty() && !pausedToStarted.empty()) {
+    if (mNumStarted == 0 && !pausedToStarted.empty()) {
         startAnomalyAlarm(timestamp);
     }
-    mStarted.insert(pausedToStarted.begin(), pausedToStarted.end());
-    mPaused.insert(startedToPaused.begin(), startedToPaused.end());
+    // A key keeps its count if it is already started, or paused.
+    for (const auto& [index, count] : pausedToStarted) {
+        if (mSlots[index].startedCount == 0) {
+            mSlots[index].startedCount = count;
+            mNumStarted++;
+        }
+    }
+    for (const auto& [index, count] : startedToPaused) {
+        if (mSlots[index].pausedCount == 0) {
+            mSlots[index].pausedCount = count;
+            mNumPaused++;
+        }
+    }
 
-    if (mStarted.empty()) {
+    if (mNumStarted == 0) {
         stopAnomalyAlarm(timestamp);
     }
 }
 
 void OringDurationTracker::onConditionChanged(bool condition, const int64_t timestamp) {
     if (condition) {
-        if (!mPaused.empty()) {
+        if (mNumPaused > 0) {
             VLOG("Condition true, all started");
-            if (mStarted.empty()) {
+            if (mNumStarted == 0) {
                 mLastStartTime = timestamp;
-            }
-            if (mStarted.empty() && !mPaused.empty()) {
                 startAnomalyAlarm(timestamp);
             }
-            mStarted.insert(mPaused.begin(), mPaused.end());
-            mPaused.clear();
+            resumePausedSlots();
         }
     } else {
-        if (!mStarted.empty()) {
+        if (mNumStarted > 0) {
             VLOG("Condition false, all paused");
             mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration +=
                     (timestamp - mLastStartTime);
-            mPaused.insert(mStarted.begin(), mStarted.end());
-            mStarted.clear();
+            pauseStartedSlots();
             detectAndDeclareAnomaly(
                     timestamp, mCurrentBucketNum,
                     getCurrentStateKeyDuration() + getCurrentStateKeyFullBucketDuration());
         }
     }
-    if (mStarted.empty()) {
+    if (mNumStarted == 0) {
         stopAnomalyAlarm(timestamp);
     }
 }
 
+void OringDurationTracker::onConditionChanges(const vector<ConditionChange>& changes,
+                                              const size_t from) {
+    // An unsliced condition pauses and resumes all the keys together, so the changes only add the
+    // time they keep the condition true, with one pass over the slots at most.
+    const bool started = mNumStarted > 0;
+    if (started && mNumPaused > 0) {
+        replayConditionChanges(changes, from);
+        return;
+    }
+    const FoldedConditionChanges folded = foldConditionChanges(changes, from, started);
+    if (folded.toggleCount == 0 || (!started && mNumPaused == 0)) {
+        return;
+    }
+    int64_t& duration = mStateKeyDurationMap[mEventKey.getStateValuesKey()].mDuration;
+    duration += folded.innerTrueNs;
+    if (started) {
+        duration += folded.firstToggleNs - mLastStartTime;
+    }
+    if (folded.endsStarted) {
+        mLastStartTime = folded.lastStartNs;
+        if (!started) {
+            resumePausedSlots();
+        }
+    } else if (started) {
+        pauseStartedSlots();
+    }
+}
+
+void OringDurationTracker::resumePausedSlots() {
+    for (DimensionSlot& slot : mSlots) {
+        if (slot.pausedCount > 0) {
+            if (slot.startedCount == 0) {
+                slot.startedCount = slot.pausedCount;
+                mNumStarted++;
+            }
+            slot.pausedCount = 0;
+        }
+    }
+    mNumPaused = 0;
+}
+
+void OringDurationTracker::pauseStartedSlots() {
+    for (DimensionSlot& slot : mSlots) {
+        if (slot.startedCount > 0) {
+            if (slot.pausedCount == 0) {
+                slot.pausedCount = slot.startedCount;
+                mNumPaused++;
+            }
+            slot.startedCount = 0;
+        }
+    }
+    mNumStarted = 0;
+}
+
 void OringDurationTracker::onStateChanged(const int64_t timestamp, const int32_t atomId,
                                           const FieldValue& newState) {
     // Nothing needs to be done on a state change if we have not seen a start
     // event, the metric is currently not active, or condition is false.
-    // For these cases, no keys are being tracked in mStarted, so update
-    // the current state key and return.
-    if (mStarted.empty()) {
+    // For these cases, no keys are started, so update the current state key and return.
+    if (mNumStarted == 0) {
         updateCurrentStateKey(atomId, newState);
         return;
     }
@@ -365,11 +478,11 @@ void OringDurationTracker::onStateChanged(const int64_t timestamp, const int32_t
 }
 
 bool OringDurationTracker::hasAccumulatedDuration() const {
-    return !mStarted.empty() || !mPaused.empty() || !mStateKeyDurationMap.empty();
+    return mNumStarted > 0 || mNumPaused > 0 || !mStateKeyDurationMap.empty();
 }
 
 bool OringDurationTracker::hasStartedDuration() const {
-    return !mStarted.empty();
+    return mNumStarted > 0;
 }
 
 int64_t OringDurationTracker::predictAnomalyTimestampNs(const AnomalyTracker& anomalyTracker,
@@ -453,11 +566,17 @@ int64_t OringDurationTracker::predictAnomalyTimestampNs(const AnomalyTracker& an
 }
 
 void OringDurationTracker::dumpStates(int out, bool verbose) const {
-    dprintf(out, "\t\t started count %lu\n", (unsigned long)mStarted.size());
-    dprintf(out, "\t\t paused count %lu\n", (unsigned long)mPaused.size());
+    dprintf(out, "\t\t started count %lu\n", (unsigned long)mNumStarted);
+    dprintf(out, "\t\t paused count %lu\n", (unsigned long)mNumPaused);
     dprintf(out, "\t\t current duration %lld\n", (long long)getCurrentStateKeyDuration());
 }
 
+size_t OringDurationTracker::byteSize() const {
+    return sizeof(OringDurationTracker) + sizeof(DimensionSlot) * mSlots.capacity() +
+           sizeof(size_t) * mFreeSlots.capacity() + estimateMapByteSize(mSlotIndex) +
+           stateKeyDurationMapByteSize();
+}
+
 int64_t OringDurationTracker::getCurrentStateKeyDuration() const {
     auto it = mStateKeyDurationMap.find(mEventKey.getStateValuesKey());
     if (it == mStateKeyDurationMap.end()) {
@@ -59,6 +59,8 @@ public:
                                       const int64_t currentTimestamp) const override;
     void dumpStates(int out, bool verbose) const override;
 
+    size_t byteSize() const override;
+
     int64_t getCurrentStateKeyDuration() const override;
 
     int64_t getCurrentStateKeyFullBucketDuration() const override;
@@ -71,19 +73,54 @@ protected:
     // Returns true if at least one of the mInfos is started.
     bool hasStartedDuration() const override;
 
+    void onConditionChanges(const std::vector<ConditionChange>& changes,
+                            const size_t from) override;
+
 private:
     // We don't need to keep track of individual durations. The information that's needed is:
     // 1) which keys are started. We record the first start time.
     // 2) which keys are paused (started but condition was false)
     // 3) whenever a key stops, we remove it from the started set. And if the set becomes empty,
     //    it means everything has stopped, we then record the end time.
-    std::unordered_map<HashableDimensionKey, int> mStarted;
-    std::unordered_map<HashableDimensionKey, int> mPaused;
+    // A key can be both started and paused, if it was started both while its condition was true
+    // and while it was false.
+    struct DimensionSlot {
+        // Number of nested starts while the condition is true, 0 if the key is not started.
+        int startedCount = 0;
+        // Number of nested starts while the condition is false, 0 if the key is not paused.
+        int pausedCount = 0;
+        bool hasConditionKey = false;
+        ConditionKey conditionKey;
+    };
+
+    // The state of all the keys in one table, indexed by mSlotIndex. The slots of the stopped
+    // keys are reused.
+    std::vector<DimensionSlot> mSlots;
+    std::vector<size_t> mFreeSlots;
+    std::unordered_map<HashableDimensionKey, size_t> mSlotIndex;
+
+    // Number of slots with a non zero startedCount, pausedCount, and with a condition key.
+    size_t mNumStarted;
+    size_t mNumPaused;
+    size_t mNumConditionKeys;
+
     int64_t mLastStartTime;
-    std::unordered_map<HashableDimensionKey, ConditionKey> mConditionKeyMap;
 
-    // return true if we should not allow newKey to be tracked because we are above the threshold
-    bool hitGuardRail(const HashableDimensionKey& newKey, size_t dimensionHardLimit) const;
+    // Returns the index of a new slot for the key.
+    size_t addSlot(const HashableDimensionKey& key);
+
+    void removeSlot(std::unordered_map<HashableDimensionKey, size_t>::iterator it);
+
+    void clearConditionKey(DimensionSlot* slot);
+
+    // Move the nested starts of all the paused slots to started, and the other way around.
+    void resumePausedSlots();
+    void pauseStartedSlots();
+
+    // return true if we should not allow newKey to be tracked because we are above the threshold.
+    // slot is the one of newKey, null if it is not tracked.
+    bool hitGuardRail(const HashableDimensionKey& newKey, const DimensionSlot* slot,
+                      size_t dimensionHardLimit) const;
 
     FRIEND_TEST(OringDurationTrackerTest, TestDurationOverlap);
     FRIEND_TEST(OringDurationTrackerTest, TestCrossBucketBoundary);
@@ -53,13 +53,12 @@ optional<InvalidConfigReason> determineMatcherUpdateStatus(
     }
 
     // This is an existing matcher. Check if it has changed.
-    string serializedMatcher;
-    if (!matcher.SerializeToString(&serializedMatcher)) {
+    uint64_t newProtoHash;
+    if (!getProtoHash(matcher, newProtoHash)) {
         ALOGE("Unable to serialize matcher %lld", (long long)id);
         return createInvalidConfigReasonWithMatcher(
                 INVALID_CONFIG_REASON_MATCHER_SERIALIZATION_FAILED, id);
     }
-    uint64_t newProtoHash = Hash64(serializedMatcher);
     if (newProtoHash != oldAtomMatchingTrackers[oldAtomMatchingTrackerIt->second]->getProtoHash()) {
         matchersToUpdate[matcherIdx] = UPDATE_REPLACE;
         return nullopt;
@@ -155,6 +154,28 @@ optional<InvalidConfigReason> updateAtomMatchingTrackers(
         }
     }
 
+    // When every matcher is preserved at its old index, the old trackers already hold the right
+    // indices, so they are reused as they are instead of being updated and initialized again.
+    bool unchangedInPlace = oldAtomMatchingTrackers.size() == (size_t)atomMatcherCount;
+    for (int i = 0; unchangedInPlace && i < atomMatcherCount; i++) {
+        const auto& oldIt = oldAtomMatchingTrackerMap.find(config.atom_matcher(i).id());
+        unchangedInPlace = matchersToUpdate[i] == UPDATE_PRESERVE &&
+                           oldIt != oldAtomMatchingTrackerMap.end() && oldIt->second == i;
+    }
+    if (unchangedInPlace) {
+        newAtomMatchingTrackers = oldAtomMatchingTrackers;
+        for (size_t matcherIndex = 0; matcherIndex < newAtomMatchingTrackers.size();
+             matcherIndex++) {
+            for (int atomId : newAtomMatchingTrackers[matcherIndex]->getAtomIds()) {
+                auto& matchers = allTagIdsToMatchersMap[atomId];
+                if (find(matchers.begin(), matchers.end(), matcherIndex) == matchers.end()) {
+                    matchers.push_back(matcherIndex);
+                }
+            }
+        }
+        return nullopt;
+    }
+
     for (int i = 0; i < atomMatcherCount; i++) {
         const AtomMatcher& matcher = config.atom_matcher(i);
         const int64_t id = matcher.id();
@@ -254,13 +275,12 @@ optional<InvalidConfigReason> determineConditionUpdateStatus(
     }
 
     // This is an existing condition. Check if it has changed.
-    string serializedCondition;
-    if (!predicate.SerializeToString(&serializedCondition)) {
+    uint64_t newProtoHash;
+    if (!getProtoHash(predicate, newProtoHash)) {
         ALOGE("Unable to serialize predicate %lld", (long long)id);
         return createInvalidConfigReasonWithPredicate(
                 INVALID_CONFIG_REASON_CONDITION_SERIALIZATION_FAILED, id);
     }
-    uint64_t newProtoHash = Hash64(serializedCondition);
     if (newProtoHash != oldConditionTrackers[oldConditionTrackerIt->second]->getProtoHash()) {
         conditionsToUpdate[conditionIdx] = UPDATE_REPLACE;
         return nullopt;
@@ -470,6 +490,22 @@ optional<InvalidConfigReason> updateStates(
     }
     return nullopt;
 }
+
+// Returns true if any of the dependencies were replaced. Most updates replace few components, so
+// this looks up the replaced ids instead of building the intersection.
+template <typename Dependencies>
+static bool dependsOnAny(const Dependencies& dependencies, const set<int64_t>& replaced) {
+    if (replaced.empty()) {
+        return false;
+    }
+    for (const int64_t id : dependencies) {
+        if (replaced.find(id) != replaced.end()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Returns true if any matchers in the metric activation were replaced.
 bool metricActivationDepsChange(const StatsdConfig& config,
                                 const unordered_map<int64_t, int>& metricToActivationMap,
@@ -526,27 +562,10 @@ optional<InvalidConfigReason> determineMetricUpdateStatus(
         return nullopt;
     }
 
-    // Take intersections of the matchers/predicates/states that the metric
-    // depends on with those that have been replaced. If a metric depends on any
-    // replaced component, it too must be replaced.
-    set<int64_t> intersection;
-    set_intersection(matcherDependencies.begin(), matcherDependencies.end(),
-                     replacedMatchers.begin(), replacedMatchers.end(),
-                     inserter(intersection, intersection.begin()));
-    if (intersection.size() > 0) {
-        updateStatus = UPDATE_REPLACE;
-        return nullopt;
-    }
-    set_intersection(conditionDependencies.begin(), conditionDependencies.end(),
-                     replacedConditions.begin(), replacedConditions.end(),
-                     inserter(intersection, intersection.begin()));
-    if (intersection.size() > 0) {
-        updateStatus = UPDATE_REPLACE;
-        return nullopt;
-    }
-    set_intersection(stateDependencies.begin(), stateDependencies.end(), replacedStates.begin(),
-                     replacedStates.end(), inserter(intersection, intersection.begin()));
-    if (intersection.size() > 0) {
+    // If a metric depends on any replaced matcher/predicate/state, it too must be replaced.
+    if (dependsOnAny(matcherDependencies, replacedMatchers) ||
+        dependsOnAny(conditionDependencies, replacedConditions) ||
+        dependsOnAny(stateDependencies, replacedStates)) {
         updateStatus = UPDATE_REPLACE;
         return nullopt;
     }
@@ -1088,13 +1107,12 @@ optional<InvalidConfigReason> determineAlertUpdateStatus(
     }
 
     // This is an existing alert, check if it has changed.
-    string serializedAlert;
-    if (!alert.SerializeToString(&serializedAlert)) {
+    uint64_t newProtoHash;
+    if (!getProtoHash(alert, newProtoHash)) {
         ALOGW("Unable to serialize alert %lld", (long long)alert.id());
         return createInvalidConfigReasonWithAlert(INVALID_CONFIG_REASON_ALERT_SERIALIZATION_FAILED,
                                                   alert.id());
     }
-    uint64_t newProtoHash = Hash64(serializedAlert);
     const auto [invalidConfigReason, oldProtoHash] =
             oldAnomalyTrackers[oldAnomalyTrackerIt->second]->getProtoHash();
     if (invalidConfigReason.has_value()) {
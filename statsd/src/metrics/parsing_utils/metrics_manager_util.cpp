@@ -31,9 +31,11 @@
 #include "matchers/EventMatcherWizard.h"
 #include "matchers/SimpleAtomMatchingTracker.h"
 #include "metrics/CountMetricProducer.h"
+#include "metrics/DistinctCountMetricProducer.h"
 #include "metrics/DurationMetricProducer.h"
 #include "metrics/EventMetricProducer.h"
 #include "metrics/GaugeMetricProducer.h"
+#include "metrics/HistogramMetricProducer.h"
 #include "metrics/KllMetricProducer.h"
 #include "metrics/MetricProducer.h"
 #include "metrics/NumericValueMetricProducer.h"
@@ -64,19 +66,41 @@ bool hasLeafNode(const FieldMatcher& matcher) {
     return true;
 }
 
+// The top level fields of the atom that the matcher reads, nullopt unless it is a simple matcher.
+optional<vector<int>> getMatcherTopLevelFields(const AtomMatcher& matcher) {
+    if (!matcher.has_simple_atom_matcher()) {
+        return nullopt;
+    }
+    vector<int> fields;
+    for (const FieldValueMatcher& fieldValueMatcher :
+         matcher.simple_atom_matcher().field_value_matcher()) {
+        fields.push_back(fieldValueMatcher.field());
+    }
+    return fields;
+}
+
 }  // namespace
 
+bool getProtoHash(const MessageLite& proto, uint64_t& hash) {
+    thread_local string serializedProto;
+    serializedProto.clear();
+    if (!proto.AppendToString(&serializedProto)) {
+        return false;
+    }
+    hash = Hash64(serializedProto);
+    return true;
+}
+
 sp<AtomMatchingTracker> createAtomMatchingTracker(
         const AtomMatcher& logMatcher, const int index, const sp<UidMap>& uidMap,
         optional<InvalidConfigReason>& invalidConfigReason) {
-    string serializedMatcher;
-    if (!logMatcher.SerializeToString(&serializedMatcher)) {
+    uint64_t protoHash;
+    if (!getProtoHash(logMatcher, protoHash)) {
         ALOGE("Unable to serialize matcher %lld", (long long)logMatcher.id());
         invalidConfigReason = createInvalidConfigReasonWithMatcher(
                 INVALID_CONFIG_REASON_MATCHER_SERIALIZATION_FAILED, logMatcher.id());
         return nullptr;
     }
-    uint64_t protoHash = Hash64(serializedMatcher);
     switch (logMatcher.contents_case()) {
         case AtomMatcher::ContentsCase::kSimpleAtomMatcher: {
             sp<AtomMatchingTracker> simpleAtomMatcher = new SimpleAtomMatchingTracker(
@@ -97,14 +121,13 @@ sp<ConditionTracker> createConditionTracker(
         const ConfigKey& key, const Predicate& predicate, const int index,
         const unordered_map<int64_t, int>& atomMatchingTrackerMap,
         optional<InvalidConfigReason>& invalidConfigReason) {
-    string serializedPredicate;
-    if (!predicate.SerializeToString(&serializedPredicate)) {
+    uint64_t protoHash;
+    if (!getProtoHash(predicate, protoHash)) {
         ALOGE("Unable to serialize predicate %lld", (long long)predicate.id());
         invalidConfigReason = createInvalidConfigReasonWithPredicate(
                 INVALID_CONFIG_REASON_CONDITION_SERIALIZATION_FAILED, predicate.id());
         return nullptr;
     }
-    uint64_t protoHash = Hash64(serializedPredicate);
     switch (predicate.contents_case()) {
         case Predicate::ContentsCase::kSimplePredicate: {
             return new SimpleConditionTracker(key, predicate.id(), protoHash, index,
@@ -124,24 +147,22 @@ sp<ConditionTracker> createConditionTracker(
 optional<InvalidConfigReason> getMetricProtoHash(
         const StatsdConfig& config, const MessageLite& metric, const int64_t id,
         const unordered_map<int64_t, int>& metricToActivationMap, uint64_t& metricHash) {
-    string serializedMetric;
-    if (!metric.SerializeToString(&serializedMetric)) {
+    if (!getProtoHash(metric, metricHash)) {
         ALOGE("Unable to serialize metric %lld", (long long)id);
         return InvalidConfigReason(INVALID_CONFIG_REASON_METRIC_SERIALIZATION_FAILED, id);
     }
-    metricHash = Hash64(serializedMetric);
 
     // Combine with activation hash, if applicable
     const auto& metricActivationIt = metricToActivationMap.find(id);
     if (metricActivationIt != metricToActivationMap.end()) {
-        string serializedActivation;
+        uint64_t activationHash;
         const MetricActivation& activation = config.metric_activation(metricActivationIt->second);
-        if (!activation.SerializeToString(&serializedActivation)) {
+        if (!getProtoHash(activation, activationHash)) {
             ALOGE("Unable to serialize metric activation for metric %lld", (long long)id);
             return InvalidConfigReason(INVALID_CONFIG_REASON_METRIC_ACTIVATION_SERIALIZATION_FAILED,
                                        id);
         }
-        metricHash = Hash64(to_string(metricHash).append(to_string(Hash64(serializedActivation))));
+        metricHash = Hash64(to_string(metricHash).append(to_string(activationHash)));
     }
     return nullopt;
 }
@@ -863,6 +884,33 @@ optional<sp<MetricProducer>> createNumericValueMetricProducerAndUpdateMetadata(
     sp<AtomMatchingTracker> atomMatcher = allAtomMatchingTrackers.at(trackerIndex);
     int atomTagId = *(atomMatcher->getAtomIds().begin());
     int pullTagId = pullerManager->PullerForMatcherExists(atomTagId) ? atomTagId : -1;
+    const bool isDistinctCount = metric.aggregation_type() == ValueMetric::DISTINCT_COUNT;
+    if (isDistinctCount && pullTagId != -1) {
+        ALOGE("DISTINCT_COUNT is not supported for pulled atoms. ValueMetric \"%lld\"",
+              (long long)metric.id());
+        invalidConfigReason = InvalidConfigReason(
+                INVALID_CONFIG_REASON_VALUE_METRIC_DISTINCT_COUNT_PULLED, metric.id());
+        return nullopt;
+    }
+    const bool isHistogram = metric.aggregation_type() == ValueMetric::HISTOGRAM;
+    optional<HistogramBins> histogramBins;
+    if (isHistogram) {
+        if (pullTagId != -1) {
+            ALOGE("HISTOGRAM is not supported for pulled atoms. ValueMetric \"%lld\"",
+                  (long long)metric.id());
+            invalidConfigReason = InvalidConfigReason(
+                    INVALID_CONFIG_REASON_VALUE_METRIC_HISTOGRAM_PULLED, metric.id());
+            return nullopt;
+        }
+        histogramBins = createHistogramBins(metric.histogram_bin_config());
+        if (!histogramBins) {
+            ALOGE("invalid \"histogram_bin_config\" in ValueMetric \"%lld\"",
+                  (long long)metric.id());
+            invalidConfigReason = InvalidConfigReason(
+                    INVALID_CONFIG_REASON_VALUE_METRIC_HISTOGRAM_INVALID_BINS, metric.id());
+            return nullopt;
+        }
+    }
 
     int conditionIndex = -1;
     if (metric.has_condition()) {
@@ -943,15 +991,45 @@ optional<sp<MetricProducer>> createNumericValueMetricProducerAndUpdateMetadata(
                     ? optional<int64_t>(metric.condition_correction_threshold_nanos())
                     : nullopt;
 
-    sp<MetricProducer> metricProducer = new NumericValueMetricProducer(
-            key, metric, metricHash, {pullTagId, pullerManager},
-            {timeBaseNs, currentTimeNs, bucketSizeNs, metric.min_bucket_size_nanos(),
-             conditionCorrectionThresholdNs, getAppUpgradeBucketSplit(metric)},
-            {containsAnyPositionInDimensionsInWhat, shouldUseNestedDimensions, trackerIndex,
-             matcherWizard, metric.dimensions_in_what(), fieldMatchers},
-            {conditionIndex, metric.links(), initialConditionCache, wizard},
-            {metric.state_link(), slicedStateAtoms, stateGroupMap},
-            {eventActivationMap, eventDeactivationMap}, {dimensionSoftLimit, dimensionHardLimit});
+    sp<MetricProducer> metricProducer;
+    if (isDistinctCount) {
+        metricProducer = new DistinctCountMetricProducer(
+                key, metric, metricHash, {pullTagId, pullerManager},
+                {timeBaseNs, currentTimeNs, bucketSizeNs, metric.min_bucket_size_nanos(),
+                 /*conditionCorrectionThresholdNs=*/nullopt, getAppUpgradeBucketSplit(metric)},
+                {containsAnyPositionInDimensionsInWhat, shouldUseNestedDimensions, trackerIndex,
+                 matcherWizard, metric.dimensions_in_what(), fieldMatchers},
+                {conditionIndex, metric.links(), initialConditionCache, wizard},
+                {metric.state_link(), slicedStateAtoms, stateGroupMap},
+                {eventActivationMap, eventDeactivationMap},
+                {dimensionSoftLimit, dimensionHardLimit});
+    } else if (isHistogram) {
+        metricProducer = new HistogramMetricProducer(
+                key, metric, metricHash, {pullTagId, pullerManager},
+                {timeBaseNs, currentTimeNs, bucketSizeNs, metric.min_bucket_size_nanos(),
+                 /*conditionCorrectionThresholdNs=*/nullopt, getAppUpgradeBucketSplit(metric)},
+                {containsAnyPositionInDimensionsInWhat, shouldUseNestedDimensions, trackerIndex,
+                 matcherWizard, metric.dimensions_in_what(), fieldMatchers},
+                {conditionIndex, metric.links(), initialConditionCache, wizard},
+                {metric.state_link(), slicedStateAtoms, stateGroupMap},
+                {eventActivationMap, eventDeactivationMap},
+                {dimensionSoftLimit, dimensionHardLimit}, std::move(*histogramBins));
+    } else {
+        // The matchers are indexed like the config.
+        const optional<vector<int>> whatMatcherFields =
+                pullTagId == -1 ? nullopt
+                                : getMatcherTopLevelFields(config.atom_matcher(trackerIndex));
+        metricProducer = new NumericValueMetricProducer(
+                key, metric, metricHash, {pullTagId, pullerManager, whatMatcherFields},
+                {timeBaseNs, currentTimeNs, bucketSizeNs, metric.min_bucket_size_nanos(),
+                 conditionCorrectionThresholdNs, getAppUpgradeBucketSplit(metric)},
+                {containsAnyPositionInDimensionsInWhat, shouldUseNestedDimensions, trackerIndex,
+                 matcherWizard, metric.dimensions_in_what(), fieldMatchers},
+                {conditionIndex, metric.links(), initialConditionCache, wizard},
+                {metric.state_link(), slicedStateAtoms, stateGroupMap},
+                {eventActivationMap, eventDeactivationMap},
+                {dimensionSoftLimit, dimensionHardLimit});
+    }
 
     SamplingInfo samplingInfo;
     if (metric.has_dimensional_sampling_info()) {
@@ -1414,13 +1492,11 @@ optional<InvalidConfigReason> initStates(
         const int64_t stateId = state.id();
         stateAtomIdMap[stateId] = state.atom_id();
 
-        string serializedState;
-        if (!state.SerializeToString(&serializedState)) {
+        if (!getProtoHash(state, stateProtoHashes[stateId])) {
             ALOGE("Unable to serialize state %lld", (long long)stateId);
             return createInvalidConfigReasonWithState(
                     INVALID_CONFIG_REASON_STATE_SERIALIZATION_FAILED, state.id(), state.atom_id());
         }
-        stateProtoHashes[stateId] = Hash64(serializedState);
 
         const StateMap& stateMap = state.map();
         for (auto group : stateMap.group()) {
@@ -1449,7 +1525,7 @@ optional<InvalidConfigReason> initMetrics(
         std::set<int64_t>& noReportMetricIds,
         unordered_map<int, vector<int>>& activationAtomTrackerToMetricMap,
         unordered_map<int, vector<int>>& deactivationAtomTrackerToMetricMap,
-        vector<int>& metricsWithActivation) {
+        vector<int>& metricsWithActivation, const bool registerStateListeners) {
     sp<ConditionWizard> wizard = new ConditionWizard(allConditionTrackers);
     sp<EventMatcherWizard> matcherWizard = new EventMatcherWizard(allAtomMatchingTrackers);
     const int allMetricsCount = config.count_metric_size() + config.duration_metric_size() +
@@ -1603,13 +1679,14 @@ optional<InvalidConfigReason> initMetrics(
         for (int atomId : it->getSlicedStateAtoms()) {
             // Register listener for non-whitelisted atoms only. Using whitelisted atom as a sliced
             // state atom is not allowed.
-            if (whitelistedAtomIds.find(atomId) == whitelistedAtomIds.end()) {
-                StateManager::getInstance().registerListener(atomId, it);
-            } else {
+            if (whitelistedAtomIds.find(atomId) != whitelistedAtomIds.end()) {
                 return InvalidConfigReason(
                         INVALID_CONFIG_REASON_METRIC_SLICED_STATE_ATOM_ALLOWED_FROM_ANY_UID,
                         it->getMetricId());
             }
+            if (registerStateListeners) {
+                StateManager::getInstance().registerListener(atomId, it);
+            }
         }
     }
     return nullopt;
@@ -1684,7 +1761,8 @@ optional<InvalidConfigReason> initStatsdConfig(
         unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
         unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
         unordered_map<int64_t, int>& alertTrackerMap, vector<int>& metricsWithActivation,
-        map<int64_t, uint64_t>& stateProtoHashes, set<int64_t>& noReportMetricIds) {
+        map<int64_t, uint64_t>& stateProtoHashes, set<int64_t>& noReportMetricIds,
+        const bool registerStateListeners) {
     vector<ConditionState> initialConditionCache;
     unordered_map<int64_t, int> stateAtomIdMap;
     unordered_map<int64_t, unordered_map<int, int64_t>> allStateGroupMaps;
@@ -1724,7 +1802,7 @@ optional<InvalidConfigReason> initStatsdConfig(
             allConditionTrackers, initialConditionCache, allMetricProducers, conditionToMetricMap,
             trackerToMetricMap, metricProducerMap, noReportMetricIds,
             activationAtomTrackerToMetricMap, deactivationAtomTrackerToMetricMap,
-            metricsWithActivation);
+            metricsWithActivation, registerStateListeners);
     if (invalidConfigReason.has_value()) {
         ALOGE("initMetricProducers failed");
         return invalidConfigReason;
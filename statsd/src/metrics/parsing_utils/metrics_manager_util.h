@@ -33,6 +33,11 @@ namespace statsd {
 // Helper functions for creating, validating, and updating config components from StatsdConfig.
 // Should only be called from metrics_manager_util and config_update_utils.
 
+// Computes the hash of the serialized proto into [hash]. Returns false if the proto could not be
+// serialized. The serialization buffer is reused across calls on a thread, so that hashing every
+// element of a config does not allocate a string per element.
+bool getProtoHash(const google::protobuf::MessageLite& proto, uint64_t& hash);
+
 // Create a AtomMatchingTracker.
 // input:
 // [logMatcher]: the input AtomMatcher from the StatsdConfig
@@ -355,7 +360,7 @@ optional<InvalidConfigReason> initMetrics(
         std::set<int64_t>& noReportMetricIds,
         std::unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
         std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
-        std::vector<int>& metricsWithActivation);
+        std::vector<int>& metricsWithActivation, const bool registerStateListeners = true);
 
 // Initialize alarms
 // Is called both on initialize new configs and config updates since alarms do not have any state.
@@ -366,6 +371,8 @@ optional<InvalidConfigReason> initAlarms(const StatsdConfig& config, const Confi
 
 // Initialize MetricsManager from StatsdConfig.
 // Parameters are the members of MetricsManager. See MetricsManager for declaration.
+// [registerStateListeners]: whether the metrics sliced by state are registered to the
+//                           StateManager, which is only used with the StatsLogProcessor lock held.
 optional<InvalidConfigReason> initStatsdConfig(
         const ConfigKey& key, const StatsdConfig& config, const sp<UidMap>& uidMap,
         const sp<StatsPullerManager>& pullerManager, const sp<AlarmMonitor>& anomalyAlarmMonitor,
@@ -386,7 +393,8 @@ optional<InvalidConfigReason> initStatsdConfig(
         std::unordered_map<int, std::vector<int>>& activationAtomTrackerToMetricMap,
         std::unordered_map<int, std::vector<int>>& deactivationAtomTrackerToMetricMap,
         std::unordered_map<int64_t, int>& alertTrackerMap, std::vector<int>& metricsWithActivation,
-        std::map<int64_t, uint64_t>& stateProtoHashes, std::set<int64_t>& noReportMetricIds);
+        std::map<int64_t, uint64_t>& stateProtoHashes, std::set<int64_t>& noReportMetricIds,
+        const bool registerStateListeners = true);
 
 }  // namespace statsd
 }  // namespace os
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "packages/StringInterner.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+InternedString StringInterner::intern(const std::string_view str) {
+    auto it = mStrings.find(str);
+    if (it != mStrings.end()) {
+        return it->second;
+    }
+
+    if (mStrings.size() >= mNextPruneSize) {
+        prune();
+        mNextPruneSize = std::max(kMinPruneSize, 2 * mStrings.size());
+    }
+
+    InternedString interned = std::make_shared<const std::string>(str);
+    mStrings.emplace(*interned, interned);
+    return interned;
+}
+
+InternedString StringInterner::find(const std::string_view str) const {
+    auto it = mStrings.find(str);
+    return it == mStrings.end() ? nullptr : it->second;
+}
+
+void StringInterner::prune() {
+    for (auto it = mStrings.begin(); it != mStrings.end();) {
+        if (it->second.use_count() == 1) {
+            it = mStrings.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
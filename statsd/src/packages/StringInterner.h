@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Immutable string shared by everything that interned an equal string in the same StringInterner.
+// Two strings interned by one StringInterner are equal if and only if they are the same pointer.
+using InternedString = std::shared_ptr<const std::string>;
+
+// Stores one copy of each of the strings held by UidMap. Package names repeat across users, and
+// installers and version strings across packages.
+//
+// Not thread safe: UidMap only uses it under its lock.
+class StringInterner {
+public:
+    StringInterner() : mNextPruneSize(kMinPruneSize) {
+    }
+
+    // Returns the interned string equal to str, interning it first if needed.
+    InternedString intern(std::string_view str);
+
+    // Returns the interned string equal to str, or nullptr if no such string is held.
+    InternedString find(std::string_view str) const;
+
+    // Drops the interned strings that nothing outside of the interner refers to anymore.
+    void prune();
+
+    inline size_t size() const {
+        return mStrings.size();
+    }
+
+private:
+    // prune() runs when the number of interned strings reaches mNextPruneSize, which is then set to
+    // twice the number of strings left, so that interning stays amortized O(1).
+    static constexpr size_t kMinPruneSize = 256;
+
+    // Keyed by a view of the interned string itself.
+    std::unordered_map<std::string_view, InternedString> mStrings;
+
+    size_t mNextPruneSize;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -16,11 +16,13 @@
 #define STATSD_DEBUG false  // STOPSHIP if true
 #include "Log.h"
 
-#include "hash.h"
 #include "stats_log_util.h"
 #include "guardrail/StatsdStats.h"
 #include "packages/UidMap.h"
+#include "utils/ProtoOutputStreamPool.h"
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <inttypes.h>
 
 using namespace android;
@@ -37,6 +39,9 @@ using android::util::FIELD_TYPE_STRING;
 using android::util::FIELD_TYPE_UINT32;
 using android::util::FIELD_TYPE_UINT64;
 using android::util::ProtoOutputStream;
+using google::protobuf::internal::WireFormatLite;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::ZeroCopyInputStream;
 
 namespace android {
 namespace os {
@@ -59,6 +64,7 @@ const int FIELD_ID_SNAPSHOTS = 1;
 const int FIELD_ID_CHANGES = 2;
 const int FIELD_ID_INSTALLER_HASH = 3;
 const int FIELD_ID_INSTALLER_NAME = 4;
+const int FIELD_ID_BASE_SNAPSHOT_TIMESTAMP = 5;
 const int FIELD_ID_CHANGE_DELETION = 1;
 const int FIELD_ID_CHANGE_TIMESTAMP = 2;
 const int FIELD_ID_CHANGE_PACKAGE = 3;
@@ -70,8 +76,13 @@ const int FIELD_ID_CHANGE_NEW_VERSION_STRING = 8;
 const int FIELD_ID_CHANGE_PREV_VERSION_STRING = 9;
 const int FIELD_ID_CHANGE_NEW_VERSION_STRING_HASH = 10;
 const int FIELD_ID_CHANGE_PREV_VERSION_STRING_HASH = 11;
+// for UidData
+const int FIELD_ID_UID_DATA_APP_INFO = 1;
 
-UidMap::UidMap() : mBytesUsed(0) {
+UidMap::UidMap()
+    : mAppNamesSnapshot(std::make_shared<AppNamesSnapshot>()),
+      mIsolatedUidSnapshot(std::make_shared<std::unordered_map<int, int>>()),
+      mBytesUsed(0) {
 }
 
 UidMap::~UidMap() {}
@@ -84,7 +95,7 @@ sp<UidMap> UidMap::getInstance() {
 bool UidMap::hasApp(int uid, const string& packageName) const {
     lock_guard<mutex> lock(mMutex);
 
-    auto it = mMap.find(std::make_pair(uid, packageName));
+    auto it = mMap.find(std::make_pair(uid, mStringInterner.find(packageName)));
     return it != mMap.end() && !it->second.deleted;
 }
 
@@ -103,16 +114,48 @@ std::set<string> UidMap::getAppNamesFromUidLocked(const int32_t& uid, bool retur
     std::set<string> names;
     for (const auto& kv : mMap) {
         if (kv.first.first == uid && !kv.second.deleted) {
-            names.insert(returnNormalized ? normalizeAppName(kv.first.second) : kv.first.second);
+            names.insert(returnNormalized ? normalizeAppName(*kv.first.second) : *kv.first.second);
         }
     }
     return names;
 }
 
+const std::vector<string>& AppNamesSnapshot::getNames(const int32_t uid) const {
+    static const std::vector<string> kNoNames;
+    auto it = mNames.find(uid);
+    return it == mNames.end() ? kNoNames : it->second;
+}
+
+std::shared_ptr<const AppNamesSnapshot> UidMap::getNormalizedAppNamesSnapshot() const {
+    return std::atomic_load(&mAppNamesSnapshot);
+}
+
+void UidMap::publishAppNamesLocked() {
+    auto snapshot = std::make_shared<AppNamesSnapshot>();
+    for (const auto& [uidAndName, appData] : mMap) {
+        if (!appData.deleted) {
+            snapshot->mNames[uidAndName.first].push_back(normalizeAppName(*uidAndName.second));
+        }
+    }
+    for (auto& [uid, names] : snapshot->mNames) {
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+    }
+    std::shared_ptr<const AppNamesSnapshot> published = std::move(snapshot);
+    std::atomic_store(&mAppNamesSnapshot, published);
+    mAppNamesVersion.fetch_add(1, std::memory_order_release);
+}
+
+void UidMap::publishIsolatedUidsLocked() {
+    std::shared_ptr<const std::unordered_map<int, int>> snapshot =
+            std::make_shared<std::unordered_map<int, int>>(mIsolatedUidMap);
+    std::atomic_store(&mIsolatedUidSnapshot, snapshot);
+}
+
 int64_t UidMap::getAppVersion(int uid, const string& packageName) const {
     lock_guard<mutex> lock(mMutex);
 
-    auto it = mMap.find(std::make_pair(uid, packageName));
+    auto it = mMap.find(std::make_pair(uid, mStringInterner.find(packageName)));
     if (it == mMap.end() || it->second.deleted) {
         return 0;
     }
@@ -124,7 +167,9 @@ void UidMap::updateMap(const int64_t& timestamp, const UidData& uidData) {
     {
         lock_guard<mutex> lock(mMutex);  // Exclusively lock for updates.
 
-        std::unordered_map<std::pair<int, string>, AppData, PairHash> deletedApps;
+        // Holds the interned strings of the deleted apps while mMap is rebuilt, so that their keys
+        // still match.
+        std::unordered_map<AppKey, AppData, AppKeyHash> deletedApps;
 
         // Copy all the deleted apps.
         for (const auto& kv : mMap) {
@@ -135,9 +180,10 @@ void UidMap::updateMap(const int64_t& timestamp, const UidData& uidData) {
 
         mMap.clear();
         for (const auto& appInfo : uidData.app_info()) {
-            mMap[std::make_pair(appInfo.uid(), appInfo.package_name())] =
-                    AppData(appInfo.version(), appInfo.version_string(), appInfo.installer(),
-                            appInfo.certificate_hash());
+            mMap[std::make_pair(appInfo.uid(), mStringInterner.intern(appInfo.package_name()))] =
+                    AppData(appInfo.version(), mStringInterner.intern(appInfo.version_string()),
+                            mStringInterner.intern(appInfo.installer()),
+                            mStringInterner.intern(appInfo.certificate_hash()));
         }
 
         for (const auto& kv : deletedApps) {
@@ -148,6 +194,7 @@ void UidMap::updateMap(const int64_t& timestamp, const UidData& uidData) {
             }
         }
 
+        onMapChangedLocked(false /* changeRecorded */);
         ensureBytesUsedBelowLimit();
         StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
         broadcast = mSubscriber;
@@ -162,6 +209,139 @@ void UidMap::updateMap(const int64_t& timestamp, const UidData& uidData) {
     }
 }
 
+bool UidMap::parseUidDataLocked(ZeroCopyInputStream* uidData,
+                                std::unordered_map<AppKey, AppData, AppKeyHash>* apps) {
+    CodedInputStream input(uidData);
+    ApplicationInfo appInfo;
+    for (uint32_t tag = input.ReadTag(); tag != 0; tag = input.ReadTag()) {
+        if (WireFormatLite::GetTagFieldNumber(tag) != FIELD_ID_UID_DATA_APP_INFO ||
+            WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+            if (!WireFormatLite::SkipField(&input, tag)) {
+                return false;
+            }
+            continue;
+        }
+        uint32_t length;
+        if (!input.ReadVarint32(&length)) {
+            return false;
+        }
+        const CodedInputStream::Limit limit = input.PushLimit(length);
+        appInfo.Clear();
+        if (!appInfo.MergeFromCodedStream(&input) || !input.ConsumedEntireMessage()) {
+            return false;
+        }
+        input.PopLimit(limit);
+        (*apps)[std::make_pair(appInfo.uid(), mStringInterner.intern(appInfo.package_name()))] =
+                AppData(appInfo.version(), mStringInterner.intern(appInfo.version_string()),
+                        mStringInterner.intern(appInfo.installer()),
+                        mStringInterner.intern(appInfo.certificate_hash()));
+    }
+    // ReadTag() also returns 0 on errors, which do not end the message where the stream ends.
+    return input.ConsumedEntireMessage();
+}
+
+bool UidMap::updateMapIncrementally(const int64_t& timestamp, ZeroCopyInputStream* uidData) {
+    struct Upgrade {
+        string app;
+        int32_t uid;
+        int64_t version;
+    };
+    vector<Upgrade> upgradedApps;
+    vector<std::pair<string, int32_t>> removedApps;
+    bool appsAddedOrRemoved = false;
+    wp<PackageInfoListener> broadcast = NULL;
+    {
+        lock_guard<mutex> lock(mMutex);
+        std::unordered_map<AppKey, AppData, AppKeyHash> apps;
+        if (!parseUidDataLocked(uidData, &apps)) {
+            return false;
+        }
+
+        const InternedString emptyString = mStringInterner.intern("");
+        // The first snapshot is not recorded app by app, like with updateMap().
+        const bool firstSnapshot = mMap.empty();
+        size_t numChanges = 0;
+        for (const auto& [key, app] : apps) {
+            auto it = mMap.find(key);
+            if (it == mMap.end()) {
+                if (!firstSnapshot) {
+                    mChanges.emplace_back(false, timestamp, key.second, key.first,
+                                          app.versionCode, app.versionString, 0, emptyString);
+                }
+                mMap.emplace(key, app);
+                appsAddedOrRemoved = true;
+                numChanges++;
+                continue;
+            }
+            AppData& current = it->second;
+            // As with updateMap(), a deleted app stays deleted, since the snapshot can predate
+            // its removal. Interned strings are equal if and only if they are the same pointer.
+            if (current.deleted ||
+                (current.versionCode == app.versionCode &&
+                 current.versionString == app.versionString && current.installer == app.installer &&
+                 current.certificateHash == app.certificateHash)) {
+                continue;
+            }
+            mChanges.emplace_back(false, timestamp, key.second, key.first, app.versionCode,
+                                  app.versionString, current.versionCode, current.versionString);
+            upgradedApps.push_back({*key.second, key.first, app.versionCode});
+            current = app;
+            numChanges++;
+        }
+
+        vector<AppKey> removedKeys;
+        for (const auto& [key, app] : mMap) {
+            if (!app.deleted && apps.find(key) == apps.end()) {
+                removedKeys.push_back(key);
+            }
+        }
+        for (const AppKey& key : removedKeys) {
+            AppData& app = mMap[key];
+            mChanges.emplace_back(true, timestamp, key.second, key.first, 0, emptyString,
+                                  app.versionCode, app.versionString);
+            app.deleted = true;
+            mDeletedApps.push_back(key);
+            removedApps.emplace_back(*key.second, key.first);
+            appsAddedOrRemoved = true;
+            numChanges++;
+        }
+        bool changeRecorded = !firstSnapshot;
+        while (mDeletedApps.size() > StatsdStats::kMaxDeletedAppsInUidMap) {
+            mMap.erase(mDeletedApps.front());
+            mDeletedApps.pop_front();
+            changeRecorded = false;
+            StatsdStats::getInstance().noteUidMapAppDeletionDropped();
+        }
+
+        if (numChanges == 0) {
+            VLOG("UidData snapshot matches the uid map");
+            return true;
+        }
+        onMapChangedLocked(changeRecorded);
+        if (!firstSnapshot) {
+            mBytesUsed += numChanges * kBytesChangeRecord;
+        }
+        ensureBytesUsedBelowLimit();
+        StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
+        StatsdStats::getInstance().setUidMapChanges(mChanges.size());
+        broadcast = mSubscriber;
+    }
+
+    auto strongPtr = broadcast.promote();
+    if (strongPtr != NULL) {
+        for (const Upgrade& upgrade : upgradedApps) {
+            strongPtr->notifyAppUpgrade(timestamp, upgrade.app, upgrade.uid, upgrade.version);
+        }
+        for (const auto& [app, uid] : removedApps) {
+            strongPtr->notifyAppRemoved(timestamp, app, uid);
+        }
+        if (appsAddedOrRemoved) {
+            strongPtr->onUidMapReceived(timestamp);
+        }
+    }
+    return true;
+}
+
 void UidMap::updateApp(const int64_t& timestamp, const string& appName, const int32_t& uid,
                        const int64_t& versionCode, const string& versionString,
                        const string& installer, const vector<uint8_t>& certificateHash) {
@@ -171,17 +351,21 @@ void UidMap::updateApp(const int64_t& timestamp, const string& appName, const in
     {
         lock_guard<mutex> lock(mMutex);
         int32_t prevVersion = 0;
-        string prevVersionString = "";
-        auto key = std::make_pair(uid, appName);
+        InternedString prevVersionString = mStringInterner.intern("");
+        const InternedString internedVersionString = mStringInterner.intern(versionString);
+        const InternedString internedInstaller = mStringInterner.intern(installer);
+        const InternedString internedCertificateHash =
+                mStringInterner.intern(certificateHashString);
+        auto key = std::make_pair(uid, mStringInterner.intern(appName));
         auto it = mMap.find(key);
         if (it != mMap.end()) {
             prevVersion = it->second.versionCode;
             prevVersionString = it->second.versionString;
             it->second.versionCode = versionCode;
-            it->second.versionString = versionString;
-            it->second.installer = installer;
+            it->second.versionString = internedVersionString;
+            it->second.installer = internedInstaller;
             it->second.deleted = false;
-            it->second.certificateHash = certificateHashString;
+            it->second.certificateHash = internedCertificateHash;
 
             // Only notify the listeners if this is an app upgrade. If this app is being installed
             // for the first time, then we don't notify the listeners.
@@ -190,11 +374,13 @@ void UidMap::updateApp(const int64_t& timestamp, const string& appName, const in
             broadcast = mSubscriber;
         } else {
             // Otherwise, we need to add an app at this uid.
-            mMap[key] = AppData(versionCode, versionString, installer, certificateHashString);
+            mMap[key] = AppData(versionCode, internedVersionString, internedInstaller,
+                                internedCertificateHash);
         }
 
-        mChanges.emplace_back(false, timestamp, appName, uid, versionCode, versionString,
-                              prevVersion, prevVersionString);
+        mChanges.emplace_back(false, timestamp, key.second, uid, versionCode,
+                              internedVersionString, prevVersion, prevVersionString);
+        onMapChangedLocked(true /* changeRecorded */);
         mBytesUsed += kBytesChangeRecord;
         ensureBytesUsedBelowLimit();
         StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
@@ -219,6 +405,8 @@ void UidMap::ensureBytesUsedBelowLimit() {
         if (mChanges.size() > 0) {
             mBytesUsed -= kBytesChangeRecord;
             mChanges.pop_front();
+            // Configs that have not received the dropped change need a full snapshot.
+            mChangeLogEpoch++;
             StatsdStats::getInstance().noteUidMapDropped(1);
         }
     }
@@ -230,8 +418,9 @@ void UidMap::removeApp(const int64_t& timestamp, const string& app, const int32_
         lock_guard<mutex> lock(mMutex);
 
         int64_t prevVersion = 0;
-        string prevVersionString = "";
-        auto key = std::make_pair(uid, app);
+        const InternedString emptyString = mStringInterner.intern("");
+        InternedString prevVersionString = emptyString;
+        auto key = std::make_pair(uid, mStringInterner.intern(app));
         auto it = mMap.find(key);
         if (it != mMap.end() && !it->second.deleted) {
             prevVersion = it->second.versionCode;
@@ -239,14 +428,18 @@ void UidMap::removeApp(const int64_t& timestamp, const string& app, const int32_
             it->second.deleted = true;
             mDeletedApps.push_back(key);
         }
+        bool changeRecorded = true;
         if (mDeletedApps.size() > StatsdStats::kMaxDeletedAppsInUidMap) {
             // Delete the oldest one.
             auto oldest = mDeletedApps.front();
             mDeletedApps.pop_front();
             mMap.erase(oldest);
+            changeRecorded = false;
             StatsdStats::getInstance().noteUidMapAppDeletionDropped();
         }
-        mChanges.emplace_back(true, timestamp, app, uid, 0, "", prevVersion, prevVersionString);
+        mChanges.emplace_back(true, timestamp, key.second, uid, 0, emptyString, prevVersion,
+                              prevVersionString);
+        onMapChangedLocked(changeRecorded);
         mBytesUsed += kBytesChangeRecord;
         ensureBytesUsedBelowLimit();
         StatsdStats::getInstance().setCurrentUidMapMemory(mBytesUsed);
@@ -269,6 +462,7 @@ void UidMap::assignIsolatedUid(int isolatedUid, int parentUid) {
     lock_guard<mutex> lock(mIsolatedMutex);
 
     mIsolatedUidMap[isolatedUid] = parentUid;
+    publishIsolatedUidsLocked();
 }
 
 void UidMap::removeIsolatedUid(int isolatedUid) {
@@ -277,21 +471,30 @@ void UidMap::removeIsolatedUid(int isolatedUid) {
     auto it = mIsolatedUidMap.find(isolatedUid);
     if (it != mIsolatedUidMap.end()) {
         mIsolatedUidMap.erase(it);
+        publishIsolatedUidsLocked();
     }
 }
 
 int UidMap::getHostUidOrSelf(int uid) const {
-    lock_guard<mutex> lock(mIsolatedMutex);
-
-    auto it = mIsolatedUidMap.find(uid);
-    if (it != mIsolatedUidMap.end()) {
+    const auto isolatedUids = std::atomic_load(&mIsolatedUidSnapshot);
+    auto it = isolatedUids->find(uid);
+    if (it != isolatedUids->end()) {
         return it->second;
     }
     return uid;
 }
 
+void UidMap::onMapChangedLocked(bool changeRecorded) {
+    mSharedSnapshots.clear();
+    publishAppNamesLocked();
+    if (!changeRecorded) {
+        mChangeLogEpoch++;
+    }
+}
+
 void UidMap::clearOutput() {
     mChanges.clear();
+    mChangeLogEpoch++;
     // Also update the guardrail trackers.
     StatsdStats::getInstance().setUidMapChanges(0);
     mBytesUsed = 0;
@@ -336,7 +539,8 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
 
     proto->write(FIELD_TYPE_INT64 | FIELD_ID_SNAPSHOT_TIMESTAMP, (long long)timestamp);
     for (const auto& [keyPair, appData] : mMap) {
-        const auto& [uid, packageName] = keyPair;
+        const int uid = keyPair.first;
+        const string& packageName = *keyPair.second;
         if (!interestingUids.empty() && interestingUids.find(uid) == interestingUids.end()) {
             continue;
         }
@@ -345,10 +549,10 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
         // Get installer index.
         int installerIndex = -1;
         if (includeInstaller && installerIndices != nullptr) {
-            const auto& it = installerIndices->find(appData.installer);
+            const auto& it = installerIndices->find(*appData.installer);
             if (it == installerIndices->end()) {
                 // We have not encountered this installer yet; add it to installerIndices.
-                (*installerIndices)[appData.installer] = curInstallerIndex;
+                (*installerIndices)[*appData.installer] = curInstallerIndex;
                 installerIndex = curInstallerIndex;
                 curInstallerIndex++;
             } else {
@@ -357,30 +561,28 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
         }
 
         if (str_set != nullptr) {  // Hash strings in report
-            str_set->insert(packageName);
             proto->write(FIELD_TYPE_UINT64 | FIELD_ID_SNAPSHOT_PACKAGE_NAME_HASH,
-                         (long long)Hash64(packageName));
+                         (long long)hashStringInReport(packageName, str_set));
             if (includeVersionStrings) {
-                str_set->insert(appData.versionString);
                 proto->write(FIELD_TYPE_UINT64 | FIELD_ID_SNAPSHOT_PACKAGE_VERSION_STRING_HASH,
-                             (long long)Hash64(appData.versionString));
+                             (long long)hashStringInReport(*appData.versionString, str_set));
             }
             if (includeInstaller) {
-                str_set->insert(appData.installer);
+                str_set->insert(*appData.installer);
                 if (installerIndex != -1) {
                     // Write installer index.
                     proto->write(FIELD_TYPE_UINT32 | FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_INDEX,
                                  installerIndex);
                 } else {
                     proto->write(FIELD_TYPE_UINT64 | FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER_HASH,
-                                 (long long)Hash64(appData.installer));
+                                 (long long)getCachedStringHash(*appData.installer));
                 }
             }
         } else {  // Strings not hashed in report
             proto->write(FIELD_TYPE_STRING | FIELD_ID_SNAPSHOT_PACKAGE_NAME, packageName);
             if (includeVersionStrings) {
                 proto->write(FIELD_TYPE_STRING | FIELD_ID_SNAPSHOT_PACKAGE_VERSION_STRING,
-                             appData.versionString);
+                             *appData.versionString);
             }
             if (includeInstaller) {
                 if (installerIndex != -1) {
@@ -388,17 +590,18 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
                                  installerIndex);
                 } else {
                     proto->write(FIELD_TYPE_STRING | FIELD_ID_SNAPSHOT_PACKAGE_INSTALLER,
-                                 appData.installer);
+                                 *appData.installer);
                 }
             }
         }
 
-        const size_t dumpHashSize = truncatedCertificateHashSize <= appData.certificateHash.size()
+        const string& certificateHash = *appData.certificateHash;
+        const size_t dumpHashSize = truncatedCertificateHashSize <= certificateHash.size()
                                             ? truncatedCertificateHashSize
-                                            : appData.certificateHash.size();
+                                            : certificateHash.size();
         if (dumpHashSize > 0) {
             proto->write(FIELD_TYPE_BYTES | FIELD_ID_SNAPSHOT_PACKAGE_TRUNCATED_CERTIFICATE_HASH,
-                         appData.certificateHash.c_str(), dumpHashSize);
+                         certificateHash.c_str(), dumpHashSize);
         }
 
         proto->write(FIELD_TYPE_INT64 | FIELD_ID_SNAPSHOT_PACKAGE_VERSION,
@@ -409,10 +612,60 @@ void UidMap::writeUidMapSnapshotLocked(const int64_t timestamp, const bool inclu
     }
 }
 
+void UidMap::writeSharedUidMapSnapshotLocked(const int64_t timestamp,
+                                             const bool includeVersionStrings,
+                                             const bool includeInstaller,
+                                             const uint8_t truncatedCertificateHashSize,
+                                             std::set<string>* str_set, ProtoOutputStream* proto) {
+    SharedSnapshot& shared = mSharedSnapshots[std::make_tuple(
+            includeVersionStrings, includeInstaller, truncatedCertificateHashSize,
+            str_set != nullptr)];
+    if (shared.snapshot.empty() || shared.timestampNs != timestamp) {
+        ProtoOutputStreamPool::Stream snapshotProto =
+                ProtoOutputStreamPool::getInstance().acquire();
+        map<string, int> installerIndices;
+        shared.strings.clear();
+        // Write snapshot from current uid map state.
+        writeUidMapSnapshotLocked(timestamp, includeVersionStrings, includeInstaller,
+                                  truncatedCertificateHashSize,
+                                  std::set<int32_t>() /*empty uid set means including every uid*/,
+                                  &installerIndices, str_set != nullptr ? &shared.strings : nullptr,
+                                  snapshotProto.get());
+        shared.snapshot.clear();
+        snapshotProto->serializeToVector(&shared.snapshot);
+        shared.timestampNs = timestamp;
+
+        shared.installers.assign(installerIndices.size(), "");
+        for (const auto& [installer, index] : installerIndices) {
+            // index is guaranteed to be < installers.size().
+            shared.installers[index] = installer;
+        }
+    }
+
+    proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_SNAPSHOTS,
+                 reinterpret_cast<const char*>(shared.snapshot.data()), shared.snapshot.size());
+    if (str_set != nullptr) {
+        str_set->insert(shared.strings.begin(), shared.strings.end());
+    }
+
+    if (includeInstaller) {
+        // Write installer list; either strings or hashes.
+        for (const string& installerName : shared.installers) {
+            if (str_set == nullptr) {  // Strings not hashed
+                proto->write(FIELD_TYPE_STRING | FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_NAME,
+                             installerName);
+            } else {  // Strings are hashed
+                proto->write(FIELD_TYPE_UINT64 | FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_HASH,
+                             (long long)getCachedStringHash(installerName));
+            }
+        }
+    }
+}
+
 void UidMap::appendUidMap(const int64_t& timestamp, const ConfigKey& key,
                           const bool includeVersionStrings, const bool includeInstaller,
                           const uint8_t truncatedCertificateHashSize, std::set<string>* str_set,
-                          ProtoOutputStream* proto) {
+                          ProtoOutputStream* proto, const bool deltaSnapshot) {
     lock_guard<mutex> lock(mMutex);  // Lock for updates
 
     for (const ChangeRecord& record : mChanges) {
@@ -423,24 +676,22 @@ void UidMap::appendUidMap(const int64_t& timestamp, const ConfigKey& key,
             proto->write(FIELD_TYPE_INT64 | FIELD_ID_CHANGE_TIMESTAMP,
                          (long long)record.timestampNs);
             if (str_set != nullptr) {
-                str_set->insert(record.package);
                 proto->write(FIELD_TYPE_UINT64 | FIELD_ID_CHANGE_PACKAGE_HASH,
-                             (long long)Hash64(record.package));
+                             (long long)hashStringInReport(*record.package, str_set));
                 if (includeVersionStrings) {
-                    str_set->insert(record.versionString);
                     proto->write(FIELD_TYPE_UINT64 | FIELD_ID_CHANGE_NEW_VERSION_STRING_HASH,
-                                 (long long)Hash64(record.versionString));
-                    str_set->insert(record.prevVersionString);
-                    proto->write(FIELD_TYPE_UINT64 | FIELD_ID_CHANGE_PREV_VERSION_STRING_HASH,
-                                 (long long)Hash64(record.prevVersionString));
+                                 (long long)hashStringInReport(*record.versionString, str_set));
+                    proto->write(
+                            FIELD_TYPE_UINT64 | FIELD_ID_CHANGE_PREV_VERSION_STRING_HASH,
+                            (long long)hashStringInReport(*record.prevVersionString, str_set));
                 }
             } else {
-                proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_PACKAGE, record.package);
+                proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_PACKAGE, *record.package);
                 if (includeVersionStrings) {
                     proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_NEW_VERSION_STRING,
-                                 record.versionString);
+                                 *record.versionString);
                     proto->write(FIELD_TYPE_STRING | FIELD_ID_CHANGE_PREV_VERSION_STRING,
-                                 record.prevVersionString);
+                                 *record.prevVersionString);
                 }
             }
 
@@ -452,33 +703,18 @@ void UidMap::appendUidMap(const int64_t& timestamp, const ConfigKey& key,
         }
     }
 
-    map<string, int> installerIndices;
-
-    // Write snapshot from current uid map state.
-    uint64_t snapshotsToken =
-            proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_SNAPSHOTS);
-    writeUidMapSnapshotLocked(timestamp, includeVersionStrings, includeInstaller,
-                              truncatedCertificateHashSize,
-                              std::set<int32_t>() /*empty uid set means including every uid*/,
-                              &installerIndices, str_set, proto);
-    proto->end(snapshotsToken);
-
-    vector<string> installers(installerIndices.size(), "");
-    for (const auto& [installer, index] : installerIndices) {
-        // index is guaranteed to be < installers.size().
-        installers[index] = installer;
-    }
-
-    if (includeInstaller) {
-        // Write installer list; either strings or hashes.
-        for (const string& installerName : installers) {
-            if (str_set == nullptr) {  // Strings not hashed
-                proto->write(FIELD_TYPE_STRING | FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_NAME,
-                             installerName);
-            } else {  // Strings are hashed
-                proto->write(FIELD_TYPE_UINT64 | FIELD_COUNT_REPEATED | FIELD_ID_INSTALLER_HASH,
-                             (long long)Hash64(installerName));
-            }
+    auto base = mDeltaSnapshotBases.find(key);
+    if (deltaSnapshot && base != mDeltaSnapshotBases.end() &&
+        base->second.changeLogEpoch == mChangeLogEpoch &&
+        timestamp - base->second.timestampNs < kMaxDeltaSnapshotIntervalNs) {
+        // The changes above bring the base snapshot up to date.
+        proto->write(FIELD_TYPE_INT64 | FIELD_ID_BASE_SNAPSHOT_TIMESTAMP,
+                     (long long)base->second.timestampNs);
+    } else {
+        writeSharedUidMapSnapshotLocked(timestamp, includeVersionStrings, includeInstaller,
+                                        truncatedCertificateHashSize, str_set, proto);
+        if (deltaSnapshot) {
+            mDeltaSnapshotBases[key] = {mChangeLogEpoch, timestamp};
         }
     }
 
@@ -509,14 +745,14 @@ void UidMap::printUidMap(int out, bool includeCertificateHash) const {
         const auto& [uid, packageName] = keyPair;
         if (!appData.deleted) {
             if (includeCertificateHash) {
-                const string& certificateHashHexString = toHexString(appData.certificateHash);
-                dprintf(out, "%s, v%" PRId64 ", %s, %s (%i), %s\n", packageName.c_str(),
-                        appData.versionCode, appData.versionString.c_str(),
-                        appData.installer.c_str(), uid, certificateHashHexString.c_str());
+                const string& certificateHashHexString = toHexString(*appData.certificateHash);
+                dprintf(out, "%s, v%" PRId64 ", %s, %s (%i), %s\n", packageName->c_str(),
+                        appData.versionCode, appData.versionString->c_str(),
+                        appData.installer->c_str(), uid, certificateHashHexString.c_str());
             } else {
-                dprintf(out, "%s, v%" PRId64 ", %s, %s (%i)\n", packageName.c_str(),
-                        appData.versionCode, appData.versionString.c_str(),
-                        appData.installer.c_str(), uid);
+                dprintf(out, "%s, v%" PRId64 ", %s, %s (%i)\n", packageName->c_str(),
+                        appData.versionCode, appData.versionString->c_str(),
+                        appData.installer->c_str(), uid);
             }
         }
     }
@@ -524,18 +760,24 @@ void UidMap::printUidMap(int out, bool includeCertificateHash) const {
 
 void UidMap::OnConfigUpdated(const ConfigKey& key) {
     mLastUpdatePerConfigKey[key] = -1;
+    mDeltaSnapshotBases.erase(key);
 }
 
 void UidMap::OnConfigRemoved(const ConfigKey& key) {
     mLastUpdatePerConfigKey.erase(key);
+    mDeltaSnapshotBases.erase(key);
 }
 
 set<int32_t> UidMap::getAppUid(const string& package) const {
     lock_guard<mutex> lock(mMutex);
 
     set<int32_t> results;
+    const InternedString internedPackage = mStringInterner.find(package);
+    if (internedPackage == nullptr) {
+        return results;
+    }
     for (const auto& kv : mMap) {
-        if (kv.first.second == package && !kv.second.deleted) {
+        if (kv.first.second == internedPackage && !kv.second.deleted) {
             results.insert(kv.first.first);
         }
     }
@@ -16,20 +16,28 @@
 
 #pragma once
 
+#include <google/protobuf/io/zero_copy_stream.h>
 #include <gtest/gtest_prod.h>
+#include <log/log_time.h>
 #include <src/uid_data.pb.h>
 #include <stdio.h>
 #include <utils/RefBase.h>
 #include <utils/String16.h>
 
+#include <atomic>
 #include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include "config/ConfigKey.h"
 #include "packages/PackageInfoListener.h"
+#include "packages/StringInterner.h"
 #include "stats_util.h"
 
 using namespace android;
@@ -41,19 +49,20 @@ namespace android {
 namespace os {
 namespace statsd {
 
+// The strings are interned by the UidMap that holds the AppData.
 struct AppData {
     int64_t versionCode;
-    string versionString;
-    string installer;
+    InternedString versionString;
+    InternedString installer;
     bool deleted;
-    string certificateHash;
+    InternedString certificateHash;
 
     // Empty constructor needed for unordered map.
     AppData() {
     }
 
-    AppData(const int64_t v, const string& versionString, const string& installer,
-            const string& certificateHash)
+    AppData(const int64_t v, const InternedString& versionString, const InternedString& installer,
+            const InternedString& certificateHash)
         : versionCode(v),
           versionString(versionString),
           installer(installer),
@@ -62,20 +71,21 @@ struct AppData {
 };
 
 // When calling appendUidMap, we retrieve all the ChangeRecords since the last
-// timestamp we called appendUidMap for this configuration key.
+// timestamp we called appendUidMap for this configuration key. The strings are interned by the
+// UidMap that holds the ChangeRecord.
 struct ChangeRecord {
     const bool deletion;
     const int64_t timestampNs;
-    const string package;
+    const InternedString package;
     const int32_t uid;
     const int64_t version;
     const int64_t prevVersion;
-    const string versionString;
-    const string prevVersionString;
+    const InternedString versionString;
+    const InternedString prevVersionString;
 
-    ChangeRecord(const bool isDeletion, const int64_t timestampNs, const string& package,
-                 const int32_t uid, const int64_t version, const string versionString,
-                 const int64_t prevVersion, const string prevVersionString)
+    ChangeRecord(const bool isDeletion, const int64_t timestampNs, const InternedString& package,
+                 const int32_t uid, const int64_t version, const InternedString& versionString,
+                 const int64_t prevVersion, const InternedString& prevVersionString)
         : deletion(isDeletion),
           timestampNs(timestampNs),
           package(package),
@@ -89,6 +99,24 @@ struct ChangeRecord {
 
 const unsigned int kBytesChangeRecord = sizeof(struct ChangeRecord);
 
+// Immutable table of the installed package names of each uid, normalized to lower case. UidMap
+// publishes a new one whenever the map changes, so readers never take the UidMap lock.
+class AppNamesSnapshot {
+public:
+    // Sorted names of the packages installed for the uid. Valid while the snapshot is held.
+    const std::vector<string>& getNames(const int32_t uid) const;
+
+    // Sorted package names of every uid that has at least one installed package.
+    const std::unordered_map<int32_t, std::vector<string>>& getNamesByUid() const {
+        return mNames;
+    }
+
+private:
+    std::unordered_map<int32_t, std::vector<string>> mNames;
+
+    friend class UidMap;
+};
+
 // UidMap keeps track of what the corresponding app name (APK name) and version code for every uid
 // at any given moment. This map must be updated by StatsCompanionService.
 class UidMap : public virtual RefBase {
@@ -101,6 +129,14 @@ public:
 
     void updateMap(const int64_t& timestamp, const UidData& uidData);
 
+    // Like updateMap(), but reads the UidData from uidData one ApplicationInfo at a time and only
+    // changes the apps that differ from the map. Those get change records and listener callbacks
+    // as with updateApp() and removeApp(), and onUidMapReceived() is only called if apps were
+    // added or removed. A snapshot with no change leaves the map and the listener untouched.
+    // Returns false, without changing the map, if uidData is not a valid UidData.
+    bool updateMapIncrementally(const int64_t& timestamp,
+                                google::protobuf::io::ZeroCopyInputStream* uidData);
+
     void updateApp(const int64_t& timestamp, const string& appName, const int32_t& uid,
                    const int64_t& versionCode, const string& versionString, const string& installer,
                    const vector<uint8_t>& certificateHash);
@@ -112,6 +148,16 @@ public:
     // Returns the app names from uid.
     std::set<string> getAppNamesFromUid(const int32_t& uid, bool returnNormalized) const;
 
+    // Returns the current package names table without locking or copying. Prefer this over
+    // getAppNamesFromUid in the event processing path.
+    std::shared_ptr<const AppNamesSnapshot> getNormalizedAppNamesSnapshot() const;
+
+    // Incremented every time a new package names snapshot is published. Cheaper than comparing
+    // snapshots for callers that cache results derived from them.
+    int64_t getAppNamesVersion() const {
+        return mAppNamesVersion.load(std::memory_order_acquire);
+    }
+
     int64_t getAppVersion(int uid, const string& packageName) const;
 
     // Helper for debugging contents of this uid map. Can be triggered with:
@@ -138,10 +184,17 @@ public:
     // Gets all snapshots and changes that have occurred since the last output.
     // If every config key has received a change or snapshot record, then this
     // record is deleted.
+    // deltaSnapshot: if true, the snapshot is left out when the changes since the last snapshot
+    //                written for this config fully describe the package table. The report then
+    //                refers to that snapshot by its timestamp instead.
     void appendUidMap(const int64_t& timestamp, const ConfigKey& key,
                       const bool includeVersionStrings, const bool includeInstaller,
                       const uint8_t truncatedCertificateHashSize, std::set<string>* str_set,
-                      ProtoOutputStream* proto);
+                      ProtoOutputStream* proto, const bool deltaSnapshot = false);
+
+    // In delta snapshot mode, configs still get a full snapshot this often, so that a lost
+    // upload only affects the reports until the next full snapshot.
+    static constexpr int64_t kMaxDeltaSnapshotIntervalNs = 24 * 60 * 60 * NS_PER_SEC;
 
     // Forces the output to be cleared. We still generate a snapshot based on the current state.
     // This results in extra data uploaded but helps us reconstruct the uid mapping on the server
@@ -178,24 +231,50 @@ private:
     mutable mutex mMutex;
     mutable mutex mIsolatedMutex;
 
-    struct PairHash {
-        size_t operator()(std::pair<int, string> p) const noexcept {
-            std::hash<std::string> hash_fn;
-            return hash_fn(std::to_string(p.first) + p.second);
+    // Interns the package names, version strings, installers and certificate hashes of mMap and
+    // mChanges.
+    StringInterner mStringInterner;
+
+    // Uid and interned package name. Keys with a package name that is not interned, such as
+    // {uid, mStringInterner.find(name)} for a name that is not held, are never in mMap.
+    using AppKey = std::pair<int, InternedString>;
+
+    struct AppKeyHash {
+        size_t operator()(const AppKey& key) const noexcept {
+            // Interned package names are compared by pointer.
+            return std::hash<const string*>()(key.second.get()) * 31 + key.first;
         }
     };
+
     // Maps uid and package name to application data.
-    std::unordered_map<std::pair<int, string>, AppData, PairHash> mMap;
+    std::unordered_map<AppKey, AppData, AppKeyHash> mMap;
+
+    // Parses the apps of a serialized UidData into apps, interning their strings.
+    bool parseUidDataLocked(google::protobuf::io::ZeroCopyInputStream* uidData,
+                            std::unordered_map<AppKey, AppData, AppKeyHash>* apps);
 
     // Maps isolated uid to the parent uid. Any metrics for an isolated uid will instead contribute
     // to the parent uid.
     std::unordered_map<int, int> mIsolatedUidMap;
 
+    // Read-only copies of mMap and mIsolatedUidMap for lock free lookups. Replaced, never
+    // modified, so readers that loaded the old pointer keep a consistent table. Only accessed
+    // through std::atomic_load and std::atomic_store.
+    std::shared_ptr<const AppNamesSnapshot> mAppNamesSnapshot;
+    std::shared_ptr<const std::unordered_map<int, int>> mIsolatedUidSnapshot;
+
+    // Incremented after mAppNamesSnapshot is replaced.
+    std::atomic<int64_t> mAppNamesVersion = 0;
+
+    void publishAppNamesLocked();
+
+    void publishIsolatedUidsLocked();
+
     // Record the changes that can be provided with the uploads.
     std::list<ChangeRecord> mChanges;
 
     // Store which uid and apps represent deleted ones.
-    std::list<std::pair<int, string>> mDeletedApps;
+    std::list<AppKey> mDeletedApps;
 
     // Notify StatsLogProcessor if there's an upgrade/removal in any app.
     wp<PackageInfoListener> mSubscriber;
@@ -208,6 +287,43 @@ private:
     // Returns the minimum value from mConfigKeys.
     int64_t getMinimumTimestampNs();
 
+    // Writes the full snapshot, and the installer list that goes with it, serialized once per
+    // dump timestamp and shared by every config dumped with the same options.
+    void writeSharedUidMapSnapshotLocked(const int64_t timestamp, const bool includeVersionStrings,
+                                         const bool includeInstaller,
+                                         const uint8_t truncatedCertificateHashSize,
+                                         std::set<string>* str_set, ProtoOutputStream* proto);
+
+    // Called whenever mMap changes, with changeRecorded false if the change can not be
+    // reconstructed from mChanges. That makes every config's next report include a full snapshot.
+    void onMapChangedLocked(bool changeRecorded);
+
+    // Incremented whenever mChanges stops describing every change to mMap.
+    int64_t mChangeLogEpoch = 0;
+
+    struct DeltaSnapshotBase {
+        // mChangeLogEpoch when the snapshot was written.
+        int64_t changeLogEpoch;
+        int64_t timestampNs;
+    };
+
+    // The last full snapshot written to each config in delta snapshot mode.
+    std::unordered_map<ConfigKey, DeltaSnapshotBase> mDeltaSnapshotBases;
+
+    // Cleared whenever mMap changes.
+    struct SharedSnapshot {
+        int64_t timestampNs;
+        // Serialized PackageInfoSnapshot.
+        std::vector<uint8_t> snapshot;
+        std::vector<string> installers;
+        // Strings hashed in the snapshot and installer list, for the report's string set.
+        std::set<string> strings;
+    };
+
+    // Keyed by the includeVersionStrings, includeInstaller, truncatedCertificateHashSize and
+    // hash strings options of the configs it was written for.
+    std::map<std::tuple<bool, bool, uint8_t, bool>, SharedSnapshot> mSharedSnapshots;
+
     // If our current used bytes is above the limit, then we clear out the earliest snapshot. If
     // there are no more snapshots, then we clear out the earliest delta. We repeat the deletions
     // until the memory consumed by mOutput is below the specified limit.
@@ -230,6 +346,9 @@ private:
     FRIEND_TEST(UidMapTest, TestOutputIncludesAtLeastOneSnapshot);
     FRIEND_TEST(UidMapTest, TestMemoryComputed);
     FRIEND_TEST(UidMapTest, TestMemoryGuardrail);
+    FRIEND_TEST(UidMapTest, TestStringsInterned);
+    FRIEND_TEST(UidMapTest, TestDeltaSnapshots);
+    FRIEND_TEST(UidMapTest, TestSharedSnapshot);
 };
 
 }  // namespace statsd
@@ -24,8 +24,10 @@
 
 #include "guardrail/StatsdStats.h"
 #include "stats_log_util.h"
+#include "utils/ThreadConfig.h"
 
 using aidl::android::os::IStatsSubscriptionCallback;
+using android::base::unique_fd;
 
 namespace android {
 namespace os {
@@ -58,7 +60,8 @@ bool ShellSubscriber::startNewSubscription(int in, int out, int64_t timeoutSec)
 }
 
 bool ShellSubscriber::startNewSubscription(const vector<uint8_t>& subscriptionConfig,
-                                           const shared_ptr<IStatsSubscriptionCallback>& callback) {
+                                           const shared_ptr<IStatsSubscriptionCallback>& callback,
+                                           unique_fd ringFd) {
     std::unique_lock<std::mutex> lock(mMutex);
     VLOG("ShellSubscriber: new subscription has come in");
     if (mClientSet.size() >= kMaxSubscriptions) {
@@ -68,8 +71,9 @@ bool ShellSubscriber::startNewSubscription(const vector<uint8_t>& subscriptionCo
         return false;
     }
 
-    return startNewSubscriptionLocked(ShellSubscriberClient::create(
-            subscriptionConfig, callback, getElapsedRealtimeSec(), mUidMap, mPullerMgr));
+    return startNewSubscriptionLocked(
+            ShellSubscriberClient::create(subscriptionConfig, callback, getElapsedRealtimeSec(),
+                                          mUidMap, mPullerMgr, std::move(ringFd)));
 }
 
 bool ShellSubscriber::startNewSubscriptionLocked(unique_ptr<ShellSubscriberClient> client) {
@@ -92,20 +96,34 @@ bool ShellSubscriber::startNewSubscriptionLocked(unique_ptr<ShellSubscriberClien
     return true;
 }
 
-// Sends heartbeat signals and sleeps between doing work
+// Sends heartbeat signals and buffered atoms, and sleeps between doing work
 void ShellSubscriber::pullAndSendHeartbeats() {
+    configureStatsdThread("statsd.shell");
     VLOG("ShellSubscriber: helper thread starting");
     std::unique_lock<std::mutex> lock(mMutex);
     while (true) {
         StatsdStats::getInstance().noteSubscriptionPullThreadWakeup();
+        mFlushRequested = false;
         int64_t sleepTimeMs = 24 * 60 * 60 * 1000;  // 24 hours.
         const int64_t nowNanos = getElapsedRealtimeNs();
         const int64_t nowMillis = nanoseconds_to_milliseconds(nowNanos);
         const int64_t nowSecs = nanoseconds_to_seconds(nowNanos);
+        vector<pair<shared_ptr<ShellSubscriberClient>, ShellSubscriberClient::PendingFlush>>
+                flushes;
+        // Clients pulling the same atom share one pull, which the clients whose pull is due
+        // soon after are aligned with.
+        ShellSubscriberClient::SharedPulls sharedPulls;
+        for (const shared_ptr<ShellSubscriberClient>& client : mClientSet) {
+            client->addDuePulls(nowMillis, &sharedPulls);
+        }
         for (auto clientIt = mClientSet.begin(); clientIt != mClientSet.end();) {
-            int64_t subscriptionSleepMs =
-                    (*clientIt)->pullAndSendHeartbeatsIfNeeded(nowSecs, nowMillis, nowNanos);
+            ShellSubscriberClient::PendingFlush flush;
+            int64_t subscriptionSleepMs = (*clientIt)->pullAndPrepareFlushIfNeeded(
+                    nowSecs, nowMillis, nowNanos, &flush, &sharedPulls);
             sleepTimeMs = std::min(sleepTimeMs, subscriptionSleepMs);
+            if (flush.pending) {
+                flushes.emplace_back(*clientIt, std::move(flush));
+            }
             if ((*clientIt)->isAlive()) {
                 ++clientIt;
             } else {
@@ -120,8 +138,25 @@ void ShellSubscriber::pullAndSendHeartbeats() {
             VLOG("ShellSubscriber: helper thread done!");
             return;
         }
+        if (!flushes.empty()) {
+            // Slow subscribers must not block onLogEvent(), send without holding the lock.
+            vector<bool> results;
+            lock.unlock();
+            for (const auto& [client, flush] : flushes) {
+                results.push_back(client->sendFlush(flush));
+            }
+            lock.lock();
+            for (size_t i = 0; i < flushes.size(); i++) {
+                flushes[i].first->onFlushSent(results[i]);
+                if (!results[i]) {
+                    // Removes the client right away.
+                    sleepTimeMs = 0;
+                }
+            }
+        }
         VLOG("ShellSubscriber: helper thread sleeping for %" PRId64 "ms", sleepTimeMs);
-        mThreadSleepCV.wait_for(lock, sleepTimeMs * 1ms, [this] { return mClientSet.empty(); });
+        mThreadSleepCV.wait_for(lock, sleepTimeMs * 1ms,
+                                [this] { return mClientSet.empty() || mFlushRequested; });
     }
 }
 
@@ -135,8 +170,17 @@ void ShellSubscriber::onLogEvent(const LogEvent& event) {
         return;
     }
     std::unique_lock<std::mutex> lock(mMutex);
+    // Clients subscribed to the same atom share its encoding, a single client encodes it directly
+    // into its cache.
+    ShellSubscriberClient::EncodedEvent encodedEvent;
+    ShellSubscriberClient::EncodedEvent* sharedEncoding =
+            mClientSet.size() > 1 ? &encodedEvent : nullptr;
     for (auto clientIt = mClientSet.begin(); clientIt != mClientSet.end();) {
-        (*clientIt)->onLogEvent(event);
+        if ((*clientIt)->onLogEvent(event, sharedEncoding) && !mFlushRequested) {
+            // The helper thread sends the data, this never waits on the subscriber.
+            mFlushRequested = true;
+            mThreadSleepCV.notify_one();
+        }
         if ((*clientIt)->isAlive()) {
             ++clientIt;
         } else {
@@ -149,6 +193,17 @@ void ShellSubscriber::onLogEvent(const LogEvent& event) {
     }
 }
 
+void ShellSubscriber::onRawAtom(const RawSocketAtom& atom) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (const auto& client : mClientSet) {
+        // Dead clients are removed by onLogEvent() and the helper thread.
+        if (client->isAlive() && client->onRawAtom(atom) && !mFlushRequested) {
+            mFlushRequested = true;
+            mThreadSleepCV.notify_one();
+        }
+    }
+}
+
 void ShellSubscriber::flushSubscription(const shared_ptr<IStatsSubscriptionCallback>& callback) {
     std::unique_lock<std::mutex> lock(mMutex);
 
@@ -203,6 +258,22 @@ void ShellSubscriber::updateLogEventFilterLocked() const {
     }
     VLOG("ShellSubscriber: Updating allAtomIds done. Total atoms %d", (int)allAtomIds.size());
     mLogEventFilter->setAtomIds(std::move(allAtomIds), this);
+
+    LogEventFilter::AtomIdSet rawAtomIds;
+    for (const auto& client : mClientSet) {
+        client->addRawAtomIds(rawAtomIds);
+    }
+    if (rawAtomIds.empty()) {
+        mLogEventFilter->setRawAtoms({}, nullptr);
+        return;
+    }
+    // The readers may still forward an atom while the subscriber is destroyed.
+    const wp<ShellSubscriber> weakThis = const_cast<ShellSubscriber*>(this);
+    mLogEventFilter->setRawAtoms(std::move(rawAtomIds), [weakThis](const RawSocketAtom& atom) {
+        if (const sp<ShellSubscriber> subscriber = weakThis.promote()) {
+            subscriber->onRawAtom(atom);
+        }
+    });
 }
 
 }  // namespace statsd
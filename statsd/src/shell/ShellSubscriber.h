@@ -65,13 +65,18 @@ public:
     // Create new ShellSubscriberClient with file descriptors to manage a new subscription.
     bool startNewSubscription(int inFd, int outFd, int64_t timeoutSec);
 
-    // Create new ShellSubscriberClient with Binder callback to manage a new subscription.
+    // Create new ShellSubscriberClient with Binder callback to manage a new subscription, and
+    // optionally the shared memory ring its data is written to.
     bool startNewSubscription(
             const vector<uint8_t>& subscriptionConfig,
-            const shared_ptr<aidl::android::os::IStatsSubscriptionCallback>& callback);
+            const shared_ptr<aidl::android::os::IStatsSubscriptionCallback>& callback,
+            android::base::unique_fd ringFd = android::base::unique_fd());
 
     void onLogEvent(const LogEvent& event);
 
+    // Called from the threads reading the socket with the raw atoms of the subscriptions.
+    void onRawAtom(const RawSocketAtom& atom);
+
     void flushSubscription(
             const shared_ptr<aidl::android::os::IStatsSubscriptionCallback>& callback);
 
@@ -90,7 +95,7 @@ private:
 
     void pullAndSendHeartbeats();
 
-    /* Tells LogEventFilter about atom ids to parse */
+    /* Tells LogEventFilter about atom ids to parse, and the raw atoms to forward */
     void updateLogEventFilterLocked() const;
 
     sp<UidMap> mUidMap;
@@ -99,13 +104,17 @@ private:
 
     std::shared_ptr<LogEventFilter> mLogEventFilter;
 
-    // Protects mClientSet, mThreadAlive, and ShellSubscriberClient
+    // Protects mClientSet, mThreadAlive, mFlushRequested and ShellSubscriberClient
     mutable std::mutex mMutex;
 
-    std::set<unique_ptr<ShellSubscriberClient>> mClientSet;
+    // Shared with the helper thread while it sends data without holding mMutex.
+    std::set<shared_ptr<ShellSubscriberClient>> mClientSet;
 
     bool mThreadAlive = false;
 
+    // Set when a client has data to send before the helper thread would wake up.
+    bool mFlushRequested = false;
+
     std::condition_variable mThreadSleepCV;
 
     std::thread mThread;
@@ -33,6 +33,11 @@ namespace statsd {
 
 const static int FIELD_ID_SHELL_DATA__ATOM = 1;
 const static int FIELD_ID_SHELL_DATA__ELAPSED_TIMESTAMP_NANOS = 2;
+const static int FIELD_ID_SHELL_DATA__RAW_ATOM = 3;
+const static int FIELD_ID_RAW_ATOM__PAYLOAD = 1;
+const static int FIELD_ID_RAW_ATOM__UID = 2;
+const static int FIELD_ID_RAW_ATOM__PID = 3;
+const static int FIELD_ID_RAW_ATOM__ELAPSED_TIMESTAMP_NANOS = 4;
 
 // Store next subscription ID for StatsdStats.
 // Not thread-safe; should only be accessed while holding ShellSubscriber::mMutex lock.
@@ -41,6 +46,7 @@ static int nextSubId = 0;
 struct ReadConfigResult {
     vector<SimpleAtomMatcher> pushedMatchers;
     vector<ShellSubscriberClient::PullInfo> pullInfo;
+    vector<int32_t> rawAtomIds;
 };
 
 // Read and parse single config. There should only one config in the input.
@@ -56,6 +62,7 @@ static optional<ReadConfigResult> readConfig(const vector<uint8_t>& configBytes,
     ReadConfigResult result;
 
     result.pushedMatchers.assign(config.pushed().begin(), config.pushed().end());
+    result.rawAtomIds.assign(config.raw_atom_id().begin(), config.raw_atom_id().end());
 
     vector<ShellSubscriberClient::PullInfo> pullInfo;
     for (const auto& pulled : config.pulled()) {
@@ -90,6 +97,10 @@ ShellSubscriberClient::PullInfo::PullInfo(const SimpleAtomMatcher& matcher, int6
       mPullUids(uids) {
 }
 
+ShellSubscriberClient::PullKey ShellSubscriberClient::PullInfo::getPullKey() const {
+    return PullKey(mPullerMatcher.atom_id(), mPullPackages, mPullUids);
+}
+
 ShellSubscriberClient::ShellSubscriberClient(
         int id, int out, const std::shared_ptr<IStatsSubscriptionCallback>& callback,
         const std::vector<SimpleAtomMatcher>& pushedMatchers,
@@ -105,7 +116,11 @@ ShellSubscriberClient::ShellSubscriberClient(
       mTimeoutSec(timeoutSec),
       mStartTimeSec(startTimeSec),
       mLastWriteMs(startTimeSec * 1000),
-      mCacheSize(0){};
+      mCacheSize(0) {
+    for (const SimpleAtomMatcher& matcher : mPushedMatchers) {
+        mPushedMatchersByAtomId[matcher.atom_id()].push_back(&matcher);
+    }
+}
 
 unique_ptr<ShellSubscriberClient> ShellSubscriberClient::create(
         int in, int out, int64_t timeoutSec, int64_t startTimeSec, const sp<UidMap>& uidMap,
@@ -137,15 +152,19 @@ unique_ptr<ShellSubscriberClient> ShellSubscriberClient::create(
         return nullptr;
     }
 
-    return make_unique<ShellSubscriberClient>(
+    unique_ptr<ShellSubscriberClient> client = make_unique<ShellSubscriberClient>(
             nextSubId++, out, /*callback=*/nullptr, readConfigResult->pushedMatchers,
             readConfigResult->pullInfo, timeoutSec, startTimeSec, uidMap, pullerMgr);
+    client->mRawAtomIds.insert(readConfigResult->rawAtomIds.begin(),
+                               readConfigResult->rawAtomIds.end());
+    return client;
 }
 
 unique_ptr<ShellSubscriberClient> ShellSubscriberClient::create(
         const vector<uint8_t>& subscriptionConfig,
         const shared_ptr<IStatsSubscriptionCallback>& callback, int64_t startTimeSec,
-        const sp<UidMap>& uidMap, const sp<StatsPullerManager>& pullerMgr) {
+        const sp<UidMap>& uidMap, const sp<StatsPullerManager>& pullerMgr,
+        unique_fd ringFd) {
     if (callback == nullptr) {
         ALOGE("ShellSubscriberClient: received nullptr callback");
         return nullptr;
@@ -169,18 +188,47 @@ unique_ptr<ShellSubscriberClient> ShellSubscriberClient::create(
 
     StatsdStats::getInstance().noteSubscriptionStarted(id, readConfigResult->pushedMatchers.size(),
                                                        readConfigResult->pullInfo.size());
-    return make_unique<ShellSubscriberClient>(
+    unique_ptr<ShellSubscriberClient> client = make_unique<ShellSubscriberClient>(
             id, /*out=*/-1, callback, readConfigResult->pushedMatchers, readConfigResult->pullInfo,
             /*timeoutSec=*/-1, startTimeSec, uidMap, pullerMgr);
+    client->mRawAtomIds.insert(readConfigResult->rawAtomIds.begin(),
+                               readConfigResult->rawAtomIds.end());
+    if (ringFd.ok()) {
+        // Without a valid ring, the subscription falls back to the callback.
+        client->mRing = SubscriptionRing::map(std::move(ringFd));
+    }
+    return client;
 }
 
 bool ShellSubscriberClient::writeEventToProtoIfMatched(const LogEvent& event,
                                                        const SimpleAtomMatcher& matcher,
-                                                       const sp<UidMap>& uidMap) {
+                                                       const sp<UidMap>& uidMap,
+                                                       EncodedEvent* encodedEvent) {
     if (!matchesSimple(uidMap, matcher, event)) {
         return false;
     }
 
+    if (encodedEvent != nullptr) {
+        if (!encodedEvent->encoded) {
+            ProtoOutputStream atomProto;
+            event.ToProto(atomProto);
+            atomProto.serializeToVector(&encodedEvent->atom);
+            encodedEvent->timestampNs = truncateTimestampIfNecessary(event);
+            encodedEvent->cacheSize =
+                    getSize(event.getValues()) + sizeof(encodedEvent->timestampNs);
+            encodedEvent->encoded = true;
+        }
+        mProtoOut.write(util::FIELD_TYPE_MESSAGE | util::FIELD_COUNT_REPEATED |
+                                FIELD_ID_SHELL_DATA__ATOM,
+                        reinterpret_cast<const char*>(encodedEvent->atom.data()),
+                        encodedEvent->atom.size());
+        mProtoOut.write(util::FIELD_TYPE_INT64 | util::FIELD_COUNT_REPEATED |
+                                FIELD_ID_SHELL_DATA__ELAPSED_TIMESTAMP_NANOS,
+                        static_cast<long long>(encodedEvent->timestampNs));
+        mCacheSize += encodedEvent->cacheSize;
+        return true;
+    }
+
     // Cache atom event in mProtoOut.
     uint64_t atomToken = mProtoOut.start(util::FIELD_TYPE_MESSAGE | util::FIELD_COUNT_REPEATED |
                                          FIELD_ID_SHELL_DATA__ATOM);
@@ -199,41 +247,113 @@ bool ShellSubscriberClient::writeEventToProtoIfMatched(const LogEvent& event,
 }
 
 // Called by ShellSubscriber when a pushed event occurs
-void ShellSubscriberClient::onLogEvent(const LogEvent& event) {
-    for (const auto& matcher : mPushedMatchers) {
-        if (writeEventToProtoIfMatched(event, matcher, mUidMap)) {
+bool ShellSubscriberClient::onLogEvent(const LogEvent& event, EncodedEvent* encodedEvent) {
+    const auto it = mPushedMatchersByAtomId.find(event.GetTagId());
+    if (it == mPushedMatchersByAtomId.end()) {
+        return false;
+    }
+    if (isBufferFull()) {
+        mDroppedAtomCount++;
+        return true;
+    }
+    const bool wasEmpty = mPendingFrames.empty();
+    for (const SimpleAtomMatcher* matcher : it->second) {
+        if (writeEventToProtoIfMatched(event, *matcher, mUidMap, encodedEvent)) {
             flushProtoIfNeeded();
-            break;
+            // File descriptor subscriptions get atoms as they come, callbacks once the cache is
+            // full.
+            return mCallback == nullptr ? wasEmpty : mCacheSize >= kMaxCacheSizeBytes;
         }
     }
+    return false;
+}
+
+bool ShellSubscriberClient::onRawAtom(const RawSocketAtom& atom) {
+    if (mRawAtomIds.find(atom.atomId) == mRawAtomIds.end()) {
+        return false;
+    }
+    if (isBufferFull()) {
+        mDroppedAtomCount++;
+        return true;
+    }
+    const bool wasEmpty = mPendingFrames.empty();
+    const uint64_t rawAtomToken = mProtoOut.start(
+            util::FIELD_TYPE_MESSAGE | util::FIELD_COUNT_REPEATED | FIELD_ID_SHELL_DATA__RAW_ATOM);
+    mProtoOut.write(util::FIELD_TYPE_BYTES | FIELD_ID_RAW_ATOM__PAYLOAD,
+                    reinterpret_cast<const char*>(atom.payload), atom.size);
+    mProtoOut.write(util::FIELD_TYPE_INT32 | FIELD_ID_RAW_ATOM__UID, atom.uid);
+    mProtoOut.write(util::FIELD_TYPE_INT32 | FIELD_ID_RAW_ATOM__PID, atom.pid);
+    mProtoOut.write(util::FIELD_TYPE_INT64 | FIELD_ID_RAW_ATOM__ELAPSED_TIMESTAMP_NANOS,
+                    static_cast<long long>(atom.elapsedTimestampNs));
+    mProtoOut.end(rawAtomToken);
+    mCacheSize += atom.size + sizeof(atom.uid) + sizeof(atom.pid) + sizeof(atom.elapsedTimestampNs);
+    flushProtoIfNeeded();
+    return mCallback == nullptr ? wasEmpty : mCacheSize >= kMaxCacheSizeBytes;
 }
 
 void ShellSubscriberClient::flushProtoIfNeeded() {
     if (mCallback == nullptr) {  // Using file descriptor.
-        triggerFdFlush();
-    } else if (mCacheSize >= kMaxCacheSizeBytes) {  // Using callback.
-        // Flush data if cache is full.
-        triggerCallback(StatsSubscriptionCallbackReason::STATSD_INITIATED);
+        appendFrame();
     }
+    // Callback data is flushed by the helper thread once the cache is full.
 }
 
-int64_t ShellSubscriberClient::pullIfNeeded(int64_t nowSecs, int64_t nowMillis, int64_t nowNanos) {
-    int64_t sleepTimeMs = 24 * 60 * 60 * 1000;  // 24 hours.
-    for (PullInfo& pullInfo : mPulledInfo) {
+void ShellSubscriberClient::appendFrame() {
+    vector<uint8_t> frame;
+    mProtoOut.serializeToVector(&frame);
+    const size_t dataSize = frame.size();
+    const uint8_t* sizeBytes = reinterpret_cast<const uint8_t*>(&dataSize);
+    mPendingFrames.insert(mPendingFrames.end(), sizeBytes, sizeBytes + sizeof(dataSize));
+    mPendingFrames.insert(mPendingFrames.end(), frame.begin(), frame.end());
+    clearCache();
+}
+
+bool ShellSubscriberClient::isBufferFull() const {
+    return mPendingFrames.size() + mCacheSize >= kMaxBufferedBytes;
+}
+
+void ShellSubscriberClient::addDuePulls(int64_t nowMillis, SharedPulls* sharedPulls) const {
+    for (const PullInfo& pullInfo : mPulledInfo) {
         if (pullInfo.mPrevPullElapsedRealtimeMs + pullInfo.mIntervalMs <= nowMillis) {
-            vector<int32_t> uids;
-            getUidsForPullAtom(&uids, pullInfo);
+            sharedPulls->try_emplace(pullInfo.getPullKey());
+        }
+    }
+}
 
-            vector<shared_ptr<LogEvent>> data;
-            mPullerMgr->Pull(pullInfo.mPullerMatcher.atom_id(), uids, nowNanos, &data);
-            VLOG("ShellSubscriberClient: pulled %zu atoms with id %d", data.size(),
-                 pullInfo.mPullerMatcher.atom_id());
+int64_t ShellSubscriberClient::pullIfNeeded(int64_t nowSecs, int64_t nowMillis, int64_t nowNanos,
+                                            SharedPulls* sharedPulls) {
+    int64_t sleepTimeMs = 24 * 60 * 60 * 1000;  // 24 hours.
+    for (PullInfo& pullInfo : mPulledInfo) {
+        SharedPull* sharedPull = nullptr;
+        if (sharedPulls != nullptr) {
+            auto it = sharedPulls->find(pullInfo.getPullKey());
+            if (it != sharedPulls->end()) {
+                sharedPull = &it->second;
+            }
+        }
+        const int64_t timeBeforeDueMs =
+                pullInfo.mPrevPullElapsedRealtimeMs + pullInfo.mIntervalMs - nowMillis;
+        const bool aligned = sharedPull != nullptr &&
+                             timeBeforeDueMs <= pullInfo.mIntervalMs / kPullAlignmentDivisor;
+        if (timeBeforeDueMs <= 0 || aligned) {
+            SharedPull ownPull;
+            SharedPull& pull = sharedPull != nullptr ? *sharedPull : ownPull;
+            if (!pull.pulled) {
+                vector<int32_t> uids;
+                getUidsForPullAtom(&uids, pullInfo);
+
+                mPullerMgr->Pull(pullInfo.mPullerMatcher.atom_id(), uids, nowNanos, &pull.data);
+                VLOG("ShellSubscriberClient: pulled %zu atoms with id %d", pull.data.size(),
+                     pullInfo.mPullerMatcher.atom_id());
+                pull.encodedEvents.resize(pull.data.size());
+                pull.pulled = true;
+            }
             if (mCallback != nullptr) {  // Callback subscription
                 StatsdStats::getInstance().noteSubscriptionAtomPulled(
                         pullInfo.mPullerMatcher.atom_id());
             }
 
-            writePulledAtomsLocked(data, pullInfo.mPullerMatcher);
+            writePulledAtomsLocked(pull.data, pullInfo.mPullerMatcher, &pull.encodedEvents);
             pullInfo.mPrevPullElapsedRealtimeMs = nowMillis;
         }
 
@@ -250,7 +370,21 @@ int64_t ShellSubscriberClient::pullIfNeeded(int64_t nowSecs, int64_t nowMillis,
 // The pullAndHeartbeat threads sleep for the minimum time
 // among all clients' input
 int64_t ShellSubscriberClient::pullAndSendHeartbeatsIfNeeded(int64_t nowSecs, int64_t nowMillis,
-                                                             int64_t nowNanos) {
+                                                             int64_t nowNanos,
+                                                             SharedPulls* sharedPulls) {
+    PendingFlush flush;
+    const int64_t sleepTimeMs =
+            pullAndPrepareFlushIfNeeded(nowSecs, nowMillis, nowNanos, &flush, sharedPulls);
+    if (flush.pending) {
+        onFlushSent(sendFlush(flush));
+    }
+    return sleepTimeMs;
+}
+
+int64_t ShellSubscriberClient::pullAndPrepareFlushIfNeeded(int64_t nowSecs, int64_t nowMillis,
+                                                           int64_t nowNanos,
+                                                           PendingFlush* flush,
+                                                           SharedPulls* sharedPulls) {
     int64_t sleepTimeMs;
     if (mCallback == nullptr) {  // File descriptor subscription
         if ((nowSecs - mStartTimeSec >= mTimeoutSec) && (mTimeoutSec > 0)) {
@@ -258,28 +392,25 @@ int64_t ShellSubscriberClient::pullAndSendHeartbeatsIfNeeded(int64_t nowSecs, in
             return kMsBetweenHeartbeats;
         }
 
-        sleepTimeMs = min(kMsBetweenHeartbeats, pullIfNeeded(nowSecs, nowMillis, nowNanos));
+        sleepTimeMs = min(kMsBetweenHeartbeats,
+                          pullIfNeeded(nowSecs, nowMillis, nowNanos, sharedPulls));
 
-        // Send a heartbeat consisting of data size of 0, if
-        // the user hasn't recently received data from statsd. When it receives the data size of 0,
-        // the user will not expect any atoms and recheck whether the subscription should end.
-        if (nowMillis - mLastWriteMs >= kMsBetweenHeartbeats) {
-            triggerFdFlush();
-            if (!mClientAlive) return kMsBetweenHeartbeats;
-        }
+        // Sends the buffered atoms, or a heartbeat consisting of data size of 0 if the user
+        // hasn't recently received data from statsd. When it receives the data size of 0, the
+        // user will not expect any atoms and recheck whether the subscription should end.
+        takePendingFlush(nowMillis, flush);
 
         int64_t timeBeforeHeartbeat = mLastWriteMs + kMsBetweenHeartbeats - nowMillis;
         sleepTimeMs = min(sleepTimeMs, timeBeforeHeartbeat);
     } else {  // Callback subscription.
-        sleepTimeMs = min(kMsBetweenCallbacks, pullIfNeeded(nowSecs, nowMillis, nowNanos));
+        const int64_t flushIntervalMs = getFlushIntervalMs();
+        sleepTimeMs = min(flushIntervalMs, pullIfNeeded(nowSecs, nowMillis, nowNanos, sharedPulls));
 
-        if (mCacheSize > 0 && nowMillis - mLastWriteMs >= kMsBetweenCallbacks) {
-            // Flush data if cache has kept data for longer than kMsBetweenCallbacks.
-            triggerCallback(StatsSubscriptionCallbackReason::STATSD_INITIATED);
-        }
+        // Flush data if the cache is full or has kept data for longer than the flush interval.
+        takePendingFlush(nowMillis, flush);
 
-        // Cache should be flushed kMsBetweenCallbacks after mLastWrite.
-        const int64_t timeToCallbackMs = mLastWriteMs + kMsBetweenCallbacks - nowMillis;
+        // Cache should be flushed the flush interval after mLastWrite.
+        const int64_t timeToCallbackMs = mLastWriteMs + flushIntervalMs - nowMillis;
 
         // For callback subscriptions, ensure minimum sleep time is at least
         // kMinCallbackSleepIntervalMs. Even if there is less than kMinCallbackSleepIntervalMs left
@@ -293,10 +424,11 @@ int64_t ShellSubscriberClient::pullAndSendHeartbeatsIfNeeded(int64_t nowSecs, in
 }
 
 void ShellSubscriberClient::writePulledAtomsLocked(const vector<shared_ptr<LogEvent>>& data,
-                                                   const SimpleAtomMatcher& matcher) {
+                                                   const SimpleAtomMatcher& matcher,
+                                                   vector<EncodedEvent>* encodedEvents) {
     bool hasData = false;
-    for (const shared_ptr<LogEvent>& event : data) {
-        if (writeEventToProtoIfMatched(*event, matcher, mUidMap)) {
+    for (size_t i = 0; i < data.size(); i++) {
+        if (writeEventToProtoIfMatched(*data[i], matcher, mUidMap, &(*encodedEvents)[i])) {
             hasData = true;
         }
     }
@@ -306,18 +438,71 @@ void ShellSubscriberClient::writePulledAtomsLocked(const vector<shared_ptr<LogEv
     }
 }
 
-// Tries to write the atom encoded in mProtoOut to the pipe. If the write fails
-// because the read end of the pipe has closed, change the client status so
-// the manager knows the subscription is no longer active
-void ShellSubscriberClient::attemptWriteToPipeLocked() {
-    const size_t dataSize = mProtoOut.size();
-    // First, write the payload size.
-    if (!android::base::WriteFully(mDupOut, &dataSize, sizeof(dataSize))) {
-        mClientAlive = false;
-        return;
+void ShellSubscriberClient::takePendingFlush(int64_t nowMillis, PendingFlush* flush) {
+    if (mCallback == nullptr) {
+        if (mPendingFrames.empty()) {
+            if (nowMillis - mLastWriteMs < kMsBetweenHeartbeats) {
+                return;
+            }
+            const size_t heartbeat = 0;
+            const uint8_t* heartbeatBytes = reinterpret_cast<const uint8_t*>(&heartbeat);
+            flush->data.assign(heartbeatBytes, heartbeatBytes + sizeof(heartbeat));
+        } else {
+            flush->data = std::move(mPendingFrames);
+            mPendingFrames.clear();
+        }
+    } else {
+        if (mCacheSize < kMaxCacheSizeBytes &&
+            (mCacheSize == 0 || nowMillis - mLastWriteMs < getFlushIntervalMs())) {
+            return;
+        }
+        mProtoOut.serializeToVector(&flush->data);
+        flush->reason = StatsSubscriptionCallbackReason::STATSD_INITIATED;
+        clearCache();
+    }
+    if (mDroppedAtomCount > 0) {
+        ALOGW("ShellSubscriberClient: dropped %d atoms, subscription %d is too slow",
+              mDroppedAtomCount, mId);
+        mDroppedAtomCount = 0;
     }
-    // Then, write the payload if this is not just a heartbeat.
-    if (dataSize > 0 && !mProtoOut.flush(mDupOut.get())) {
+    flush->pending = true;
+    // Assume the flush succeeds for the sleep time, onFlushSent() corrects it.
+    mLastWriteMs = nowMillis;
+}
+
+// Writes the flush to the pipe or the callback. If the write fails because the read end of the
+// pipe has closed or the callback died, returns false so that the manager knows the subscription
+// is no longer active.
+bool ShellSubscriberClient::sendFlush(const PendingFlush& flush) const {
+    if (mCallback == nullptr) {
+        return android::base::WriteFully(mDupOut, flush.data.data(), flush.data.size());
+    }
+    StatsdStats::getInstance().noteSubscriptionFlushed(mId);
+    Status status = Status::ok();
+    bool wakeUp = false;
+    // Requested flushes go through the callback, which the subscriber may wait for.
+    if (mRing != nullptr && flush.reason == StatsSubscriptionCallbackReason::STATSD_INITIATED &&
+        mRing->write(flush.data.data(), flush.data.size(), &wakeUp)) {
+        if (!wakeUp) {
+            // The subscriber is still draining the ring, it reads the new record too.
+            return true;
+        }
+        status = mCallback->onSubscriptionRingData();
+    } else {
+        // Also used when the ring is full. The subscriber drains the ring before handling the
+        // payload, so the data is still delivered in order.
+        status = mCallback->onSubscriptionData(flush.reason, flush.data);
+    }
+    return !(status.getStatus() == STATUS_DEAD_OBJECT &&
+             status.getExceptionCode() == EX_TRANSACTION_FAILED);
+}
+
+int64_t ShellSubscriberClient::getFlushIntervalMs() const {
+    return mRing != nullptr ? kMsBetweenRingFlushes : kMsBetweenCallbacks;
+}
+
+void ShellSubscriberClient::onFlushSent(bool success) {
+    if (!success) {
         mClientAlive = false;
         return;
     }
@@ -339,11 +524,6 @@ void ShellSubscriberClient::clearCache() {
     mCacheSize = 0;
 }
 
-void ShellSubscriberClient::triggerFdFlush() {
-    attemptWriteToPipeLocked();
-    clearCache();
-}
-
 void ShellSubscriberClient::triggerCallback(StatsSubscriptionCallbackReason reason) {
     // Invoke Binder callback with cached event data.
     vector<uint8_t> payloadBytes;
@@ -377,6 +557,10 @@ void ShellSubscriberClient::addAllAtomIds(LogEventFilter::AtomIdSet& allAtomIds)
     }
 }
 
+void ShellSubscriberClient::addRawAtomIds(LogEventFilter::AtomIdSet& rawAtomIds) const {
+    rawAtomIds.insert(mRawAtomIds.begin(), mRawAtomIds.end());
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
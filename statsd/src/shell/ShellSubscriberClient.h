@@ -22,11 +22,16 @@
 #include <android/util/ProtoOutputStream.h>
 #include <private/android_filesystem_config.h>
 
+#include <map>
 #include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "external/StatsPullerManager.h"
 #include "logd/LogEvent.h"
 #include "packages/UidMap.h"
+#include "shell/SubscriptionRing.h"
 #include "socket/LogEventFilter.h"
 #include "src/shell/shell_config.pb.h"
 #include "src/statsd_config.pb.h"
@@ -39,13 +44,52 @@ namespace os {
 namespace statsd {
 
 // ShellSubscriberClient is not thread-safe. All calls must be
-// guarded by the mutex in ShellSubscriber.h
+// guarded by the mutex in ShellSubscriber.h, except sendFlush().
+//
+// Matched atoms are buffered, and sent by the ShellSubscriber helper thread so that the event
+// processing never waits on the subscriber.
 class ShellSubscriberClient {
 public:
+    // Data taken out of the buffer, sent with sendFlush().
+    struct PendingFlush {
+        bool pending = false;
+        // Size prefixed ShellData frames for file descriptor subscriptions, or the ShellData
+        // payload of the callback.
+        std::vector<uint8_t> data;
+        StatsSubscriptionCallbackReason reason = StatsSubscriptionCallbackReason::STATSD_INITIATED;
+    };
+
+    // Encoding of a pushed event, shared by all the clients the event matches within one
+    // ShellSubscriber::onLogEvent() call. The event is encoded by the first client it matches.
+    struct EncodedEvent {
+        bool encoded = false;
+        // Serialized Atom message.
+        std::vector<uint8_t> atom;
+        int64_t timestampNs = 0;
+        // Approximate size added to the cache.
+        size_t cacheSize = 0;
+    };
+
+    // Identifies the pulls that return the same data: atom id, packages and uids.
+    using PullKey = std::tuple<int, std::vector<std::string>, std::vector<int32_t>>;
+
+    // Result of a pull shared by all the clients pulling it within one
+    // ShellSubscriber::pullAndSendHeartbeats() wake up. The atom is pulled by the first client,
+    // and each event is encoded by the first client it matches.
+    struct SharedPull {
+        bool pulled = false;
+        std::vector<std::shared_ptr<LogEvent>> data;
+        std::vector<EncodedEvent> encodedEvents;
+    };
+
+    using SharedPulls = std::map<PullKey, SharedPull>;
+
     struct PullInfo {
         PullInfo(const SimpleAtomMatcher& matcher, int64_t startTimeMs, int64_t interval,
                  const std::vector<std::string>& packages, const std::vector<int32_t>& uids);
 
+        PullKey getPullKey() const;
+
         const SimpleAtomMatcher mPullerMatcher;
         const int64_t mIntervalMs;
         int64_t mPrevPullElapsedRealtimeMs;
@@ -58,10 +102,13 @@ public:
                                                          const sp<UidMap>& uidMap,
                                                          const sp<StatsPullerManager>& pullerMgr);
 
+    // With a valid ringFd, the data is written to the shared memory ring of the subscriber and
+    // the callback is only used for wake ups, for flushes, and when the ring is full.
     static std::unique_ptr<ShellSubscriberClient> create(
             const std::vector<uint8_t>& subscriptionConfig,
             const std::shared_ptr<IStatsSubscriptionCallback>& callback, int64_t startTimeSec,
-            const sp<UidMap>& uidMap, const sp<StatsPullerManager>& pullerMgr);
+            const sp<UidMap>& uidMap, const sp<StatsPullerManager>& pullerMgr,
+            android::base::unique_fd ringFd = android::base::unique_fd());
 
     // Should only be called by the create() factory.
     explicit ShellSubscriberClient(int id, int out,
@@ -71,9 +118,36 @@ public:
                                    int64_t startTimeSec, const sp<UidMap>& uidMap,
                                    const sp<StatsPullerManager>& pullerMgr);
 
-    void onLogEvent(const LogEvent& event);
+    // Buffers the event if it matches. Returns true if the buffered data should be sent soon.
+    // The event is encoded into encodedEvent if it is not already, or on its own if null.
+    bool onLogEvent(const LogEvent& event, EncodedEvent* encodedEvent = nullptr);
+
+    // Buffers the raw atom if it is subscribed. Returns true if the buffered data should be sent
+    // soon.
+    bool onRawAtom(const RawSocketAtom& atom);
+
+    // Adds the pulls that are due to sharedPulls, before any client pulls.
+    void addDuePulls(int64_t nowMillis, SharedPulls* sharedPulls) const;
+
+    // Pulls, and sends the buffered data and heartbeats that are due. Returns how long to sleep
+    // before the next call.
+    //
+    // Pulls in sharedPulls are done once for all the clients. A pull that is not yet due is done
+    // early, to stay aligned with the clients it shares, if it is due in less than a tenth of
+    // its interval.
+    int64_t pullAndSendHeartbeatsIfNeeded(int64_t nowSecs, int64_t nowMillis, int64_t nowNanos,
+                                          SharedPulls* sharedPulls = nullptr);
+
+    // Same as pullAndSendHeartbeatsIfNeeded(), except that the data due is only taken out in
+    // flush, to be sent with sendFlush() and then reported with onFlushSent().
+    int64_t pullAndPrepareFlushIfNeeded(int64_t nowSecs, int64_t nowMillis, int64_t nowNanos,
+                                        PendingFlush* flush, SharedPulls* sharedPulls = nullptr);
+
+    // Writes the flush to the subscriber. Only uses state that is immutable after construction,
+    // so it can be called without holding the ShellSubscriber mutex.
+    bool sendFlush(const PendingFlush& flush) const;
 
-    int64_t pullAndSendHeartbeatsIfNeeded(int64_t nowSecs, int64_t nowMillis, int64_t nowNanos);
+    void onFlushSent(bool success);
 
     // Should only be called when mCallback is not nullptr.
     void flush();
@@ -96,30 +170,44 @@ public:
 
     void addAllAtomIds(LogEventFilter::AtomIdSet& allAtomIds) const;
 
+    void addRawAtomIds(LogEventFilter::AtomIdSet& rawAtomIds) const;
+
     // Minimum pull interval for callback subscriptions.
     static constexpr int64_t kMinCallbackPullIntervalMs = 60'000;  // 60 seconds.
 
     // Minimum sleep for the pull thread for callback subscriptions.
     static constexpr int64_t kMinCallbackSleepIntervalMs = 2000;  // 2 seconds.
 private:
-    int64_t pullIfNeeded(int64_t nowSecs, int64_t nowMillis, int64_t nowNanos);
+    int64_t pullIfNeeded(int64_t nowSecs, int64_t nowMillis, int64_t nowNanos,
+                         SharedPulls* sharedPulls);
 
+    // encodedEvents holds the encoding of each event of data.
     void writePulledAtomsLocked(const vector<std::shared_ptr<LogEvent>>& data,
-                                const SimpleAtomMatcher& matcher);
+                                const SimpleAtomMatcher& matcher,
+                                std::vector<EncodedEvent>* encodedEvents);
+
+    // Takes the buffered data out if it is due, or a heartbeat.
+    void takePendingFlush(int64_t nowMillis, PendingFlush* flush);
+
+    // How long callback data may be held before it is sent.
+    int64_t getFlushIntervalMs() const;
+
+    // Moves the ShellData in mProtoOut to the frames buffered for the file descriptor.
+    void appendFrame();
 
-    void attemptWriteToPipeLocked();
+    // Whether the buffers are full, in which case new atoms are dropped.
+    bool isBufferFull() const;
 
     void getUidsForPullAtom(vector<int32_t>* uids, const PullInfo& pullInfo);
 
     void flushProtoIfNeeded();
 
     bool writeEventToProtoIfMatched(const LogEvent& event, const SimpleAtomMatcher& matcher,
-                                    const sp<UidMap>& uidMap);
+                                    const sp<UidMap>& uidMap,
+                                    EncodedEvent* encodedEvent = nullptr);
 
     void clearCache();
 
-    void triggerFdFlush();
-
     void triggerCallback(StatsSubscriptionCallbackReason reason);
 
     const int32_t DEFAULT_PULL_UID = AID_SYSTEM;
@@ -135,10 +223,19 @@ private:
 
     const std::vector<SimpleAtomMatcher> mPushedMatchers;
 
+    // mPushedMatchers by atom id, in the order of mPushedMatchers.
+    std::unordered_map<int, std::vector<const SimpleAtomMatcher*>> mPushedMatchersByAtomId;
+
     std::vector<PullInfo> mPulledInfo;
 
+    // Pushed atoms sent unparsed.
+    std::unordered_set<int> mRawAtomIds;
+
     std::shared_ptr<IStatsSubscriptionCallback> mCallback;
 
+    // Shared memory ring of a callback subscription. Null if the data goes through mCallback.
+    std::unique_ptr<SubscriptionRing> mRing;
+
     const int64_t mTimeoutSec;
 
     const int64_t mStartTimeSec;
@@ -154,14 +251,30 @@ private:
     // mEventTimestampNs and mProtoOut.
     size_t mCacheSize;
 
+    // Size prefixed ShellData frames not yet written to the file descriptor.
+    std::vector<uint8_t> mPendingFrames;
+
+    // Atoms dropped since the last flush because the subscriber did not keep up.
+    int mDroppedAtomCount = 0;
+
     static constexpr int64_t kMsBetweenHeartbeats = 1000;
 
+    // A pull is done early with the same pull of another client if it is due within its
+    // interval divided by this.
+    static constexpr int64_t kPullAlignmentDivisor = 10;
+
     // Cap the buffer size of configs to guard against bad allocations
     static constexpr size_t kMaxSizeKb = 50;
 
     static constexpr size_t kMaxCacheSizeBytes = 2 * 1024;  // 2 KB
 
+    // Atoms are dropped once this much data waits to be sent.
+    static constexpr size_t kMaxBufferedBytes = 64 * 1024;  // 64 KB
+
     static constexpr int64_t kMsBetweenCallbacks = 70'000;  // 70 seconds.
+
+    // Writing to the ring costs no binder call, so the data is not held as long.
+    static constexpr int64_t kMsBetweenRingFlushes = kMinCallbackSleepIntervalMs;
 };
 
 }  // namespace statsd
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "SubscriptionRing.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+
+namespace {
+
+// Records are 4 byte aligned.
+constexpr uint64_t alignRecord(uint64_t size) {
+    return (size + 3) & ~uint64_t(3);
+}
+
+}  // namespace
+
+std::unique_ptr<SubscriptionRing> SubscriptionRing::map(unique_fd memFd) {
+    // Like the atom rings, the memfd must not shrink while it is mapped.
+    const int seals = fcntl(memFd.get(), F_GET_SEALS);
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0) {
+        ALOGW("Subscription ring is not sealed");
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(memFd.get(), &st) != 0 || st.st_size <= (off_t)kStatsRingHeaderSize) {
+        return nullptr;
+    }
+    const uint64_t capacity = st.st_size - kStatsRingHeaderSize;
+    if (capacity < kMinRingCapacity || capacity > kMaxRingCapacity ||
+        (capacity & (capacity - 1)) != 0) {
+        ALOGW("Subscription ring has an invalid capacity %llu", (unsigned long long)capacity);
+        return nullptr;
+    }
+    void* mapped =
+            mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memFd.get(), 0);
+    if (mapped == MAP_FAILED) {
+        ALOGE("Failed to map the subscription ring: %s", strerror(errno));
+        return nullptr;
+    }
+    StatsRingHeader* header = static_cast<StatsRingHeader*>(mapped);
+    if (header->magic != kStatsRingMagic || header->version != kStatsRingVersion ||
+        header->capacity != capacity) {
+        ALOGW("Subscription ring has an invalid header");
+        munmap(mapped, st.st_size);
+        return nullptr;
+    }
+    return std::unique_ptr<SubscriptionRing>(new SubscriptionRing(header, st.st_size, capacity));
+}
+
+SubscriptionRing::SubscriptionRing(StatsRingHeader* header, size_t mappedSize, uint64_t capacity)
+    : mHeader(header),
+      mMappedSize(mappedSize),
+      mCapacity(capacity),
+      // A ring registered again after a statsd restart continues where it was.
+      mWritePos(header->writePos.load()) {
+    mHeader->producerClosed.store(0);
+}
+
+SubscriptionRing::~SubscriptionRing() {
+    mHeader->producerClosed.store(1);
+    munmap(mHeader, mMappedSize);
+}
+
+bool SubscriptionRing::write(const uint8_t* buffer, size_t size, bool* wakeUp) {
+    *wakeUp = false;
+    const uint64_t recordSize = alignRecord(sizeof(uint32_t) + (uint64_t)size);
+    if (recordSize > mCapacity) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    uint8_t* data = reinterpret_cast<uint8_t*>(mHeader) + kStatsRingHeaderSize;
+    // The read position is written by the subscriber, it is not trusted.
+    const uint64_t readPos = mHeader->readPos.load(std::memory_order_acquire);
+    if (readPos > mWritePos || mWritePos - readPos > mCapacity) {
+        return false;
+    }
+    // Positions are multiples of 4, so there is always room for the wrap marker.
+    const uint64_t contiguous = mCapacity - (mWritePos & (mCapacity - 1));
+    const uint64_t needed = recordSize > contiguous ? contiguous + recordSize : recordSize;
+    if (mWritePos - readPos + needed > mCapacity) {
+        return false;
+    }
+    if (recordSize > contiguous) {
+        const uint32_t marker = kStatsRingWrapMarker;
+        memcpy(data + (mWritePos & (mCapacity - 1)), &marker, sizeof(marker));
+        mWritePos += contiguous;
+    }
+    uint8_t* record = data + (mWritePos & (mCapacity - 1));
+    const uint32_t recordPayloadSize = size;
+    memcpy(record, &recordPayloadSize, sizeof(recordPayloadSize));
+    memcpy(record + sizeof(recordPayloadSize), buffer, size);
+    mWritePos += recordSize;
+
+    // Pairs with the subscriber marking itself as waiting and then reading the write position,
+    // at least one of the two sides sees the other's update.
+    mHeader->writePos.store(mWritePos);
+    uint32_t expected = kStatsRingConsumerWaiting;
+    *wakeUp = mHeader->consumerState.load() == kStatsRingConsumerWaiting &&
+              mHeader->consumerState.compare_exchange_strong(expected,
+                                                             kStatsRingConsumerAttached);
+    return true;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
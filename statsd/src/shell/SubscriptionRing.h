@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+
+#include "socket/StatsRingListener.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * The shared memory ring of a callback subscription, mapped from a memfd of the subscriber.
+ * statsd is the producer of the ring and libstatspull the consumer, with the StatsRingHeader
+ * layout of the atom rings. Each record is the ShellData payload of one flush, which the
+ * subscriber hands to its callback in place.
+ */
+class SubscriptionRing {
+public:
+    // Bounds of the ring capacity accepted from subscribers.
+    static constexpr uint32_t kMinRingCapacity = 4 * 1024;
+    static constexpr uint32_t kMaxRingCapacity = 4 * 1024 * 1024;
+
+    // Returns null if the memfd does not hold a valid ring.
+    static std::unique_ptr<SubscriptionRing> map(android::base::unique_fd memFd);
+
+    ~SubscriptionRing();
+
+    /**
+     * Appends a record to the ring. Thread safe.
+     *
+     * @param wakeUp set to true if the subscriber is waiting for data and must be woken up
+     * @return false if the record does not fit, nothing is written then
+     */
+    bool write(const uint8_t* buffer, size_t size, bool* wakeUp);
+
+private:
+    SubscriptionRing(StatsRingHeader* header, size_t mappedSize, uint64_t capacity);
+
+    std::mutex mMutex;
+    StatsRingHeader* const mHeader;
+    const size_t mMappedSize;
+    // Validated copy of the header capacity, a power of 2.
+    const uint64_t mCapacity;
+    // Local copy, the shared one is only written.
+    uint64_t mWritePos;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -19,23 +19,114 @@
 #include <gtest/gtest_prod.h>
 
 #include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "FieldValue.h"
 
 namespace android {
 namespace os {
 namespace statsd {
 
+/**
+ * Set of atom ids backed by a bitmap, so that a lookup is a single bit test.
+ *
+ * Atom ids are small dense integers. Ids which do not fit into the bitmap (negative or above
+ * kMaxBitmapAtomId) are kept in a side set so that any id is still handled correctly.
+ */
+class AtomIdBitmap {
+public:
+    static constexpr int kMaxBitmapAtomId = (1 << 18) - 1;
+
+    void insert(int atomId) {
+        if (atomId < 0 || atomId > kMaxBitmapAtomId) {
+            mCount += mOverflowIds.insert(atomId).second;
+            return;
+        }
+        const size_t word = static_cast<size_t>(atomId) / kBitsPerWord;
+        if (word >= mWords.size()) {
+            mWords.resize(word + 1, 0);
+        }
+        const uint64_t mask = uint64_t(1) << (atomId % kBitsPerWord);
+        mCount += (mWords[word] & mask) == 0;
+        mWords[word] |= mask;
+    }
+
+    template <typename Iterator>
+    void insert(Iterator begin, Iterator end) {
+        for (; begin != end; ++begin) {
+            insert(*begin);
+        }
+    }
+
+    bool contains(int atomId) const {
+        // Negative ids wrap around to large values and fall through to the side set.
+        const size_t word = static_cast<size_t>(static_cast<unsigned int>(atomId)) / kBitsPerWord;
+        if (word < mWords.size()) {
+            return (mWords[word] >> (atomId % kBitsPerWord)) & 1;
+        }
+        return !mOverflowIds.empty() && mOverflowIds.find(atomId) != mOverflowIds.end();
+    }
+
+    size_t size() const {
+        return mCount;
+    }
+
+    void clear() {
+        mWords.clear();
+        mOverflowIds.clear();
+        mCount = 0;
+    }
+
+    void swap(AtomIdBitmap& other) {
+        mWords.swap(other.mWords);
+        mOverflowIds.swap(other.mOverflowIds);
+        std::swap(mCount, other.mCount);
+    }
+
+private:
+    static constexpr int kBitsPerWord = 64;
+
+    std::vector<uint64_t> mWords;
+    std::unordered_set<int> mOverflowIds;
+    size_t mCount = 0;
+};
+
+/**
+ * An atom forwarded as it was written to the socket, see LogEventFilterGeneric::setRawAtoms().
+ * The payload is only valid during the callback.
+ */
+struct RawSocketAtom {
+    const uint8_t* payload;
+    uint32_t size;
+    int32_t uid;
+    int32_t pid;
+    int atomId;
+    int64_t elapsedTimestampNs;
+};
+
+typedef std::function<void(const RawSocketAtom&)> RawAtomCallback;
+
 /**
  * Templating is for benchmarks only
  *
+ * The template parameter is the container consumers use to pass their atom ids. The superset
+ * of all consumers is published to the reader as an AtomIdBitmap.
+ *
  * Based on benchmarks the more fast container to be used for atom ids filtering
  * is unordered_set<int>
  * #BM_LogEventFilterUnorderedSet                       391208 ns     390086 ns         1793
  * #BM_LogEventFilterUnorderedSet2Consumers            1293527 ns    1289326 ns          543
  * #BM_LogEventFilterSet                                613362 ns     611259 ns         1146
  * #BM_LogEventFilterSet2Consumers                     1859397 ns    1854193 ns          378
+ * The bitmap lookup itself is compared with an unordered_set<int> lookup by
+ * BM_LogEventFilterBitmapLookup and BM_LogEventFilterUnorderedSetLookup.
  *
  * See @LogEventFilter definition below
  */
@@ -70,8 +161,23 @@ public:
             std::lock_guard<std::mutex> guard(mTagIdsMutex);
             mLocalSetUpdateCounter = mSetUpdateCounter.load(std::memory_order_relaxed);
             mLocalTagIds.swap(mTagIds);
+            mLocalFieldMasks.swap(mFieldMasks);
+        }
+        return mLocalTagIds.contains(atomId);
+    }
+
+    /**
+     * @brief Returns the top-level fields of the atom used by any of consumers
+     *        Should be called after isAtomInUse() for the same atom and from the same thread
+     * @param atomId
+     * @return nullptr if all fields of the atom are used
+     */
+    const TopLevelFieldMask* getAtomFieldMask(int atomId) const {
+        if (mLocalFieldMasks.empty()) {
+            return nullptr;
         }
-        return mLocalTagIds.find(atomId) != mLocalTagIds.end();
+        const auto it = mLocalFieldMasks.find(atomId);
+        return it == mLocalFieldMasks.end() ? nullptr : &it->second;
     }
 
     typedef const void* ConsumerId;
@@ -91,23 +197,117 @@ public:
         } else {
             mTagIdsPerConsumer[consumer].swap(tagIds);
         }
+        updateSupersetLocked();
+    }
+
+    /**
+     * @brief Set the top-level fields the consumer reads from its atoms
+     *
+     * @param fieldMasks masks per atom id, atoms without a mask are fully parsed for the consumer
+     * @param consumer used to differentiate the consumers to form proper superset of fields
+     */
+    virtual void setAtomFieldMasks(AtomFieldMasks fieldMasks, ConsumerId consumer) {
+        std::lock_guard lock(mTagIdsMutex);
+        if (fieldMasks.empty()) {
+            mFieldMasksPerConsumer.erase(consumer);
+        } else {
+            mFieldMasksPerConsumer[consumer].swap(fieldMasks);
+        }
+        updateSupersetLocked();
+    }
+
+    /**
+     * @brief Set the atoms forwarded unparsed to the callback by forwardRawAtom(). Raw atoms are
+     *        not parsed for the callback, only the consumers set with setAtomIds() have them
+     *        parsed.
+     * @param atomIds empty to forward no atom
+     * @param callback called from the threads reading the atoms
+     */
+    void setRawAtoms(AtomIdSet atomIds, RawAtomCallback callback) {
+        std::lock_guard lock(mRawAtomsMutex);
+        mRawAtomIds.clear();
+        mRawAtomIds.insert(atomIds.begin(), atomIds.end());
+        mRawAtomCallback = mRawAtomIds.size() > 0
+                                   ? std::make_shared<const RawAtomCallback>(std::move(callback))
+                                   : nullptr;
+        mHasRawAtoms.store(mRawAtomCallback != nullptr, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Calls the callback set with setRawAtoms() if the atom is one of its atoms.
+     *        Costs a single relaxed load while no atom is forwarded.
+     */
+    void forwardRawAtom(const RawSocketAtom& atom) const {
+        if (!mHasRawAtoms.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::shared_ptr<const RawAtomCallback> callback;
+        {
+            std::lock_guard lock(mRawAtomsMutex);
+            if (!mRawAtomIds.contains(atom.atomId)) {
+                return;
+            }
+            callback = mRawAtomCallback;
+        }
+        // Called without the lock, so that the callback may set the raw atoms.
+        if (callback != nullptr) {
+            (*callback)(atom);
+        }
+    }
+
+private:
+    void updateSupersetLocked() {
         // populate the superset incorporating list of distinct atom ids from all consumers
         mTagIds.clear();
         for (const auto& [_, atomIds] : mTagIdsPerConsumer) {
             mTagIds.insert(atomIds.begin(), atomIds.end());
         }
+
+        // an atom is parsed partially only if every consumer of it has a mask for it
+        mFieldMasks.clear();
+        for (const auto& [consumer, atomIds] : mTagIdsPerConsumer) {
+            const auto masksIt = mFieldMasksPerConsumer.find(consumer);
+            for (const int atomId : atomIds) {
+                TopLevelFieldMask& fieldMask = mFieldMasks[atomId];
+                if (masksIt == mFieldMasksPerConsumer.end()) {
+                    fieldMask.set();
+                    continue;
+                }
+                const auto maskIt = masksIt->second.find(atomId);
+                if (maskIt == masksIt->second.end()) {
+                    fieldMask.set();
+                } else {
+                    fieldMask |= maskIt->second;
+                }
+            }
+        }
+        for (auto it = mFieldMasks.begin(); it != mFieldMasks.end();) {
+            if (it->second.all()) {
+                it = mFieldMasks.erase(it);
+            } else {
+                ++it;
+            }
+        }
         mSetUpdateCounter.fetch_add(1, std::memory_order_relaxed);
     }
 
-private:
     std::atomic_bool mLogsFilteringEnabled = true;
     std::atomic_int mSetUpdateCounter;
     mutable int mLocalSetUpdateCounter;
 
     mutable std::mutex mTagIdsMutex;
     std::unordered_map<ConsumerId, AtomIdSet> mTagIdsPerConsumer;
-    mutable AtomIdSet mTagIds;
-    mutable AtomIdSet mLocalTagIds;
+    mutable AtomIdBitmap mTagIds;
+    mutable AtomIdBitmap mLocalTagIds;
+
+    std::unordered_map<ConsumerId, AtomFieldMasks> mFieldMasksPerConsumer;
+    mutable AtomFieldMasks mFieldMasks;
+    mutable AtomFieldMasks mLocalFieldMasks;
+
+    std::atomic_bool mHasRawAtoms = false;
+    mutable std::mutex mRawAtomsMutex;
+    AtomIdBitmap mRawAtomIds;
+    std::shared_ptr<const RawAtomCallback> mRawAtomCallback;
 
     friend class LogEventFilterTest;
 
@@ -117,10 +317,13 @@ private:
     FRIEND_TEST(LogEventFilterTest, TestNonEmptyFilterFullOverlap);
     FRIEND_TEST(LogEventFilterTest, TestNonEmptyFilterPartialOverlap);
     FRIEND_TEST(LogEventFilterTest, TestNonEmptyFilterDisabled);
+    FRIEND_TEST(LogEventFilterTest, TestNonEmptyFilterOutOfBitmapRange);
     FRIEND_TEST(LogEventFilterTest, TestNonEmptyFilterDisabledPartialOverlap);
     FRIEND_TEST(LogEventFilterTest, TestMultipleConsumerOverlapIds);
     FRIEND_TEST(LogEventFilterTest, TestMultipleConsumerOverlapIdsRemoved);
     FRIEND_TEST(LogEventFilterTest, TestMultipleConsumerEmptyFilter);
+    FRIEND_TEST(LogEventFilterTest, TestFieldMasks);
+    FRIEND_TEST(LogEventFilterTest, TestFieldMasksMultipleConsumers);
 };
 
 typedef LogEventFilterGeneric<std::unordered_set<int>> LogEventFilter;
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "LogEventParsePipeline.h"
+
+#include <algorithm>
+
+#include "socket/StatsSocketListener.h"
+#include "utils/ThreadConfig.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_lock;
+using std::unique_ptr;
+
+LogEventParsePipeline::LogEventParsePipeline(std::shared_ptr<LogEventQueue> queue,
+                                             const std::shared_ptr<LogEventFilter>& logEventFilter,
+                                             const std::shared_ptr<LogEventPool>& logEventPool,
+                                             size_t numWorkers, const sp<UidMap>& uidMap)
+    : mSequencedQueue(std::move(queue), kMaxPendingAtoms, uidMap),
+      mLogEventFilter(logEventFilter),
+      mLogEventPool(logEventPool) {
+    numWorkers = std::max(numWorkers, size_t(1));
+    mWorkers.reserve(numWorkers);
+    for (size_t i = 0; i < numWorkers; i++) {
+        mWorkers.emplace_back([this] { workerLoop(); });
+    }
+}
+
+LogEventParsePipeline::~LogEventParsePipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mAtomCv.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+void LogEventParsePipeline::submit(const uint8_t* msg, uint32_t len, uint32_t uid,
+                                   uint32_t pid) {
+    // Acquired before taking mMutex, the workers need it to make room in the window.
+    const uint64_t sequence = mSequencedQueue.acquireSequence();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::vector<uint8_t> data;
+        if (!mFreeBuffers.empty()) {
+            data = std::move(mFreeBuffers.back());
+            mFreeBuffers.pop_back();
+        }
+        data.assign(msg, msg + len);
+        mPendingAtoms.push_back({sequence, uid, pid, std::move(data)});
+    }
+    mAtomCv.notify_one();
+}
+
+void LogEventParsePipeline::waitForDrained() {
+    mSequencedQueue.waitForDrained();
+}
+
+void LogEventParsePipeline::workerLoop() {
+    configureStatsdThread("statsd.parser");
+    unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mAtomCv.wait(lock, [this] { return mStopping || !mPendingAtoms.empty(); });
+        if (mPendingAtoms.empty()) {
+            return;
+        }
+        PendingAtom atom = std::move(mPendingAtoms.front());
+        mPendingAtoms.pop_front();
+        lock.unlock();
+
+        LogEventQueue::Priority priority;
+        unique_ptr<LogEvent> event = StatsSocketListener::parseMessage(
+                atom.data.data(), atom.data.size(), atom.uid, atom.pid, mLogEventFilter,
+                mLogEventPool, &priority);
+        mSequencedQueue.push(atom.sequence, std::move(event), priority);
+
+        lock.lock();
+        if (mFreeBuffers.size() < kMaxFreeBuffers) {
+            mFreeBuffers.push_back(std::move(atom.data));
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
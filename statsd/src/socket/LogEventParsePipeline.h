@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LogEventFilter.h"
+#include "logd/LogEventPool.h"
+#include "logd/LogEventQueue.h"
+#include "logd/SequencedLogEventQueue.h"
+#include "packages/UidMap.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Parses the atoms read from the socket on a pool of worker threads.
+ *
+ * The listener thread only copies each atom with its sequence number, the workers parse them
+ * like StatsSocketListener::processMessage() would, and a SequencedLogEventQueue forwards the
+ * events to the event queue in the order the atoms were submitted. With a uidMap, the isolated
+ * uids of the events are handled in that order as they are forwarded.
+ */
+class LogEventParsePipeline {
+public:
+    // Max number of atoms submitted and not yet in the event queue.
+    static constexpr size_t kMaxPendingAtoms = 1024;
+
+    // Max number of atom buffers kept for reuse.
+    static constexpr size_t kMaxFreeBuffers = 64;
+
+    LogEventParsePipeline(std::shared_ptr<LogEventQueue> queue,
+                          const std::shared_ptr<LogEventFilter>& logEventFilter,
+                          const std::shared_ptr<LogEventPool>& logEventPool, size_t numWorkers,
+                          const sp<UidMap>& uidMap = nullptr);
+
+    LogEventParsePipeline(const LogEventParsePipeline&) = delete;
+    LogEventParsePipeline& operator=(const LogEventParsePipeline&) = delete;
+
+    // Parses the atoms still pending before stopping the workers.
+    ~LogEventParsePipeline();
+
+    /**
+     * Copies the atom for a worker to parse it. Blocks while kMaxPendingAtoms are pending.
+     * Must only be called from a single thread.
+     */
+    void submit(const uint8_t* msg, uint32_t len, uint32_t uid, uint32_t pid);
+
+    /**
+     * Blocks until every atom submitted is in the event queue.
+     */
+    void waitForDrained();
+
+private:
+    struct PendingAtom {
+        uint64_t sequence;
+        uint32_t uid;
+        uint32_t pid;
+        std::vector<uint8_t> data;
+    };
+
+    void workerLoop();
+
+    SequencedLogEventQueue mSequencedQueue;
+
+    std::shared_ptr<LogEventFilter> mLogEventFilter;
+
+    std::shared_ptr<LogEventPool> mLogEventPool;
+
+    std::mutex mMutex;
+
+    // Signals the workers that an atom was submitted or that the pipeline is stopping.
+    std::condition_variable mAtomCv;
+
+    // Atoms not yet picked up by a worker. Guarded by mMutex.
+    std::deque<PendingAtom> mPendingAtoms;
+
+    // Buffers of the atoms parsed, they keep their capacity. Guarded by mMutex.
+    std::vector<std::vector<uint8_t>> mFreeBuffers;
+
+    // Guarded by mMutex.
+    bool mStopping = false;
+
+    std::vector<std::thread> mWorkers;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
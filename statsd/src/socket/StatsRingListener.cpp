@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "StatsRingListener.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "socket/StatsSocketListener.h"
+#include "utils/ThreadConfig.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+
+namespace {
+
+constexpr uint64_t alignRecord(uint64_t size) {
+    return (size + 3) & ~uint64_t(3);
+}
+
+}  // namespace
+
+StatsRingListener::Ring::~Ring() {
+    if (header != nullptr) {
+        header->consumerState.store(kStatsRingConsumerDetached);
+        munmap(header, mappedSize);
+    }
+}
+
+StatsRingListener::StatsRingListener(std::shared_ptr<LogEventQueue> queue,
+                                     const std::shared_ptr<LogEventFilter>& logEventFilter,
+                                     const std::shared_ptr<LogEventPool>& logEventPool,
+                                     bool signalCongestion, const sp<UidMap>& uidMap)
+    : mQueue(std::move(queue)),
+      mLogEventFilter(logEventFilter),
+      mLogEventPool(logEventPool),
+      mSignalCongestion(signalCongestion),
+      mUidMap(uidMap) {
+}
+
+StatsRingListener::~StatsRingListener() {
+    stop();
+}
+
+bool StatsRingListener::start() {
+    mWakeFd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    mEpollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (mWakeFd < 0 || mEpollFd < 0) {
+        ALOGE("Failed to create the ring listener fds: %s", strerror(errno));
+        return false;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data = {.fd = mWakeFd.get()}};
+    if (epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, mWakeFd.get(), &event) != 0) {
+        ALOGE("Failed to watch the ring listener wake fd: %s", strerror(errno));
+        return false;
+    }
+    mThread = std::thread([this] { threadLoop(); });
+    return true;
+}
+
+void StatsRingListener::stop() {
+    if (!mThread.joinable()) {
+        return;
+    }
+    mStopRequested = true;
+    const uint64_t one = 1;
+    TEMP_FAILURE_RETRY(write(mWakeFd.get(), &one, sizeof(one)));
+    mThread.join();
+}
+
+bool StatsRingListener::addRing(unique_fd memFd, unique_fd eventFd, uint32_t uid, uint32_t pid) {
+    std::unique_ptr<Ring> ring = mapRing(std::move(memFd), std::move(eventFd), uid, pid);
+    if (ring == nullptr) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mRingCount >= kMaxRings) {
+            ALOGW("Too many rings, rejecting the one of uid %d pid %d", uid, pid);
+            return false;
+        }
+        mRingCount++;
+        mPendingRings.push_back(std::move(ring));
+    }
+    const uint64_t one = 1;
+    TEMP_FAILURE_RETRY(write(mWakeFd.get(), &one, sizeof(one)));
+    ALOGI("Attached the atom ring of uid %d pid %d", uid, pid);
+    return true;
+}
+
+std::unique_ptr<StatsRingListener::Ring> StatsRingListener::mapRing(unique_fd memFd,
+                                                                    unique_fd eventFd,
+                                                                    uint32_t uid, uint32_t pid) {
+    // The ring stays mapped while the producer can resize the memfd, shrinking it must be
+    // sealed off so that reading the ring can not fault.
+    const int seals = fcntl(memFd.get(), F_GET_SEALS);
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0) {
+        ALOGW("Ring of uid %d pid %d is not sealed", uid, pid);
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(memFd.get(), &st) != 0 || st.st_size <= (off_t)kStatsRingHeaderSize) {
+        return nullptr;
+    }
+    const uint64_t capacity = st.st_size - kStatsRingHeaderSize;
+    if (capacity < kMinRingCapacity || capacity > kMaxRingCapacity ||
+        (capacity & (capacity - 1)) != 0) {
+        ALOGW("Ring of uid %d pid %d has an invalid capacity %llu", uid, pid,
+              (unsigned long long)capacity);
+        return nullptr;
+    }
+    // Reading the event fd must not block the listener thread.
+    const int flags = fcntl(eventFd.get(), F_GETFL);
+    if (flags < 0 || fcntl(eventFd.get(), F_SETFL, flags | O_NONBLOCK) != 0) {
+        return nullptr;
+    }
+    void* mapped =
+            mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memFd.get(), 0);
+    if (mapped == MAP_FAILED) {
+        ALOGE("Failed to map the ring of uid %d pid %d: %s", uid, pid, strerror(errno));
+        return nullptr;
+    }
+
+    std::unique_ptr<Ring> ring = std::make_unique<Ring>();
+    ring->eventFd = std::move(eventFd);
+    ring->header = static_cast<StatsRingHeader*>(mapped);
+    ring->mappedSize = st.st_size;
+    ring->capacity = capacity;
+    ring->uid = uid;
+    ring->pid = pid;
+    if (ring->header->magic != kStatsRingMagic || ring->header->version != kStatsRingVersion ||
+        ring->header->capacity != capacity) {
+        ALOGW("Ring of uid %d pid %d has an invalid header", uid, pid);
+        // Not attached, the producer keeps using the socket.
+        munmap(mapped, ring->mappedSize);
+        ring->header = nullptr;
+        return nullptr;
+    }
+    ring->readPos = ring->header->readPos.load();
+    // Left over by a previous statsd instance.
+    ring->header->consumerCongested.store(0);
+    ring->header->consumerState.store(kStatsRingConsumerAttached);
+    return ring;
+}
+
+bool StatsRingListener::consumeRing(Ring* ring) {
+    StatsRingHeader* header = ring->header;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(header) + kStatsRingHeaderSize;
+    const uint64_t writePos = header->writePos.load(std::memory_order_acquire);
+    if (writePos < ring->readPos || writePos - ring->readPos > ring->capacity) {
+        return false;
+    }
+    while (ring->readPos < writePos) {
+        const size_t offset = ring->readPos & (ring->capacity - 1);
+        const size_t contiguous = ring->capacity - offset;
+        const uint64_t available = writePos - ring->readPos;
+        uint32_t size;
+        if (contiguous < sizeof(size) || available < sizeof(size)) {
+            return false;
+        }
+        memcpy(&size, data + offset, sizeof(size));
+        if (size == kStatsRingWrapMarker) {
+            if (available < contiguous) {
+                return false;
+            }
+            ring->readPos += contiguous;
+            header->readPos.store(ring->readPos, std::memory_order_release);
+            continue;
+        }
+        const uint64_t recordSize = alignRecord(sizeof(size) + (uint64_t)size);
+        if (recordSize > contiguous || recordSize > available) {
+            return false;
+        }
+        StatsSocketListener::processMessage(data + offset + sizeof(size), size, ring->uid,
+                                            ring->pid, mQueue, mLogEventFilter, mLogEventPool,
+                                            mUidMap);
+        ring->readPos += recordSize;
+        // Frees the space for the producer right away.
+        header->readPos.store(ring->readPos, std::memory_order_release);
+    }
+    return true;
+}
+
+bool StatsRingListener::drainRing(Ring* ring) {
+    while (true) {
+        if (!consumeRing(ring)) {
+            ALOGE("Ring of uid %d pid %d is corrupted", ring->uid, ring->pid);
+            return false;
+        }
+        // Pairs with the producer writing its position and then reading the consumer state,
+        // at least one of the two sides sees the other's update.
+        ring->header->consumerState.store(kStatsRingConsumerWaiting);
+        if (ring->header->writePos.load() == ring->readPos) {
+            return true;
+        }
+        ring->header->consumerState.store(kStatsRingConsumerAttached);
+    }
+}
+
+void StatsRingListener::threadLoop() {
+    configureStatsdThread("statsd.ring");
+
+    std::vector<std::unique_ptr<Ring>> rings;
+    struct epoll_event events[kMaxRings + 1];
+    bool timedOut = false;
+    while (!mStopRequested) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (auto& ring : mPendingRings) {
+                struct epoll_event event = {.events = EPOLLIN,
+                                            .data = {.fd = ring->eventFd.get()}};
+                epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, ring->eventFd.get(), &event);
+                rings.push_back(std::move(ring));
+            }
+            mPendingRings.clear();
+        }
+
+        for (auto it = rings.begin(); it != rings.end();) {
+            Ring* ring = it->get();
+            uint64_t signalCount;
+            TEMP_FAILURE_RETRY(read(ring->eventFd.get(), &signalCount, sizeof(signalCount)));
+            bool keep = drainRing(ring);
+            if (keep && ring->header->producerClosed.load()) {
+                // The producer moved on to another ring after writing its last atom.
+                keep = ring->header->writePos.load() != ring->readPos;
+            }
+            if (keep && timedOut && kill(ring->pid, 0) != 0 && errno == ESRCH) {
+                keep = false;
+            }
+            if (keep) {
+                ++it;
+                continue;
+            }
+            ALOGI("Detached the atom ring of uid %d pid %d", ring->uid, ring->pid);
+            epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, ring->eventFd.get(), nullptr);
+            it = rings.erase(it);
+            std::lock_guard<std::mutex> lock(mMutex);
+            mRingCount--;
+        }
+
+        const bool congested = mSignalCongestion && mQueue->isCongested();
+        if (mSignalCongestion) {
+            for (const auto& ring : rings) {
+                ring->header->consumerCongested.store(congested ? 1 : 0,
+                                                      std::memory_order_relaxed);
+            }
+        }
+
+        const int count = TEMP_FAILURE_RETRY(
+                epoll_wait(mEpollFd.get(), events, kMaxRings + 1,
+                           congested ? kCongestedPollTimeoutMs : kPollTimeoutMs));
+        timedOut = count == 0;
+        uint64_t wakeCount;
+        TEMP_FAILURE_RETRY(read(mWakeFd.get(), &wakeCount, sizeof(wakeCount)));
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <android-base/unique_fd.h>
+#include <gtest/gtest_prod.h>
+#include <utils/RefBase.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LogEventFilter.h"
+#include "logd/LogEventPool.h"
+#include "logd/LogEventQueue.h"
+#include "packages/UidMap.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Shared memory layout of a ring written by libstatssocket.
+ * (*MUST BE IN SYNC WITH stats_ring_writer_impl.h in libstatssocket*)
+ *
+ * The ring data follows the header at kStatsRingHeaderSize. Each record is a uint32_t size
+ * followed by the atom, padded to 4 bytes. A record that does not fit before the end of the
+ * ring is preceded by a kStatsRingWrapMarker size, and starts over at offset 0. Positions only
+ * grow, the offset in the ring is the position modulo the capacity.
+ */
+struct StatsRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t reserved;
+    // Written by the producer only. The producer sets producerClosed when it stops writing to
+    // the ring.
+    alignas(64) std::atomic<uint64_t> writePos;
+    std::atomic<uint32_t> producerClosed;
+    // Written by the consumer only.
+    alignas(64) std::atomic<uint64_t> readPos;
+    // One of the kStatsRingConsumer* states. The producer moves a waiting consumer back to
+    // attached when it signals the event fd after writing.
+    alignas(64) std::atomic<uint32_t> consumerState;
+    // Non zero while the event queue of statsd is congested, the producer then holds its atoms
+    // back. Zero filled by producers that do not know about it.
+    std::atomic<uint32_t> consumerCongested;
+};
+
+constexpr uint32_t kStatsRingMagic = 0x73726e67;
+constexpr uint32_t kStatsRingVersion = 1;
+constexpr size_t kStatsRingHeaderSize = 256;
+constexpr uint32_t kStatsRingWrapMarker = 0xffffffff;
+constexpr uint32_t kStatsRingConsumerDetached = 0;
+constexpr uint32_t kStatsRingConsumerAttached = 1;
+constexpr uint32_t kStatsRingConsumerWaiting = 2;
+
+static_assert(sizeof(StatsRingHeader) <= kStatsRingHeaderSize);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+/**
+ * Drains the shared memory rings that trusted processes register on the statsd socket, on a
+ * thread of its own. Atoms are parsed and queued exactly like the ones read from the socket,
+ * which remains the fallback whenever a ring is full or not attached.
+ */
+class StatsRingListener : public virtual RefBase {
+public:
+    // Bounds of the ring capacity accepted from producers.
+    static constexpr uint32_t kMinRingCapacity = 4 * 1024;
+    static constexpr uint32_t kMaxRingCapacity = 4 * 1024 * 1024;
+
+    // Max number of rings drained at once.
+    static constexpr size_t kMaxRings = 16;
+
+    // The rings are also drained on this period, in case a wake up was missed.
+    static constexpr int kPollTimeoutMs = 1000;
+
+    // Poll period while the queue is congested, producers holding their atoms back do not
+    // wake up the listener.
+    static constexpr int kCongestedPollTimeoutMs = 10;
+
+    // With signalCongestion, the congestion of the event queue is published in the header of
+    // every ring for the producers to back off. With a uidMap, the isolated uids of the events
+    // are handled as they are read, see handleIsolatedUidsOnIngestion().
+    StatsRingListener(std::shared_ptr<LogEventQueue> queue,
+                      const std::shared_ptr<LogEventFilter>& logEventFilter,
+                      const std::shared_ptr<LogEventPool>& logEventPool = nullptr,
+                      bool signalCongestion = false, const sp<UidMap>& uidMap = nullptr);
+
+    ~StatsRingListener();
+
+    // Starts the thread draining the rings.
+    bool start();
+
+    void stop();
+
+    /**
+     * Maps and attaches the ring of a producer. The ring is drained by the listener thread.
+     *
+     * @param memFd sealed memfd holding the StatsRingHeader and the ring data
+     * @param eventFd eventfd the producer signals when the ring is no longer empty
+     * @return false if the ring is invalid or too many rings are attached
+     */
+    bool addRing(android::base::unique_fd memFd, android::base::unique_fd eventFd, uint32_t uid,
+                 uint32_t pid);
+
+private:
+    struct Ring {
+        android::base::unique_fd eventFd;
+        StatsRingHeader* header = nullptr;
+        size_t mappedSize = 0;
+        // Validated copy of the header capacity, a power of 2.
+        uint64_t capacity = 0;
+        uint32_t uid = 0;
+        uint32_t pid = 0;
+        // Local copy, the shared one is only written.
+        uint64_t readPos = 0;
+
+        ~Ring();
+    };
+
+    // Validates and maps the ring. Returns null if it is invalid.
+    static std::unique_ptr<Ring> mapRing(android::base::unique_fd memFd,
+                                         android::base::unique_fd eventFd, uint32_t uid,
+                                         uint32_t pid);
+
+    // Queues the atoms written to the ring, and marks the consumer as waiting once the ring is
+    // empty. Returns false if the ring is corrupted.
+    bool drainRing(Ring* ring);
+
+    // Queues the atoms between the ring read and write positions.
+    bool consumeRing(Ring* ring);
+
+    void threadLoop();
+
+    std::shared_ptr<LogEventQueue> mQueue;
+
+    std::shared_ptr<LogEventFilter> mLogEventFilter;
+
+    std::shared_ptr<LogEventPool> mLogEventPool;
+
+    const bool mSignalCongestion;
+
+    const sp<UidMap> mUidMap;
+
+    // Wakes up the listener thread on new rings and on stop().
+    android::base::unique_fd mWakeFd;
+
+    android::base::unique_fd mEpollFd;
+
+    std::mutex mMutex;
+
+    // Rings added and not yet picked up by the listener thread. Guarded by mMutex.
+    std::vector<std::unique_ptr<Ring>> mPendingRings;
+
+    // Number of rings attached, including the pending ones. Guarded by mMutex.
+    size_t mRingCount = 0;
+
+    std::atomic_bool mStopRequested = false;
+
+    std::thread mThread;
+
+    friend class StatsRingListenerTest;
+    FRIEND_TEST(StatsRingListenerTest, TestDrainRing);
+    FRIEND_TEST(StatsRingListenerTest, TestDrainRingWrapAround);
+    FRIEND_TEST(StatsRingListenerTest, TestCorruptedRing);
+    FRIEND_TEST(StatsRingListenerTest, TestInvalidRingRejected);
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
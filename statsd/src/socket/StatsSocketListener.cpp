@@ -21,45 +21,115 @@
 #include <ctype.h>
 #include <cutils/sockets.h>
 #include <limits.h>
+#include <private/android_filesystem_config.h>
 #include <stdio.h>
 #include <sys/cdefs.h>
-#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
+
+#include "external/Perfetto.h"
 #include "guardrail/StatsdStats.h"
 #include "logd/logevent_util.h"
 #include "stats_log_util.h"
 #include "statslog_statsd.h"
+#include "utils/ThreadConfig.h"
 
 namespace android {
 namespace os {
 namespace statsd {
 
+namespace {
+
+// + 1 to ensure null terminator if MAX_PAYLOAD buffer is received
+constexpr size_t kDatagramBufferSize = sizeof(android_log_header_t) + LOGGER_ENTRY_MAX_PAYLOAD + 1;
+
+// Max number of file descriptors accepted with a datagram, the ring registration sends 2.
+constexpr size_t kMaxDatagramFds = 2;
+
+// CMSG_SPACE() is a multiple of the cmsghdr alignment, so every slice of the
+// control buffer stays properly aligned.
+constexpr size_t kControlBufferSize =
+        CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(kMaxDatagramFds * sizeof(int));
+
+// Tag of the datagrams carrying several atoms, each one prefixed with its uint32_t size.
+// (*MUST BE IN SYNC WITH STATS_EVENT_BATCH_TAG in libstatssocket*)
+constexpr uint32_t kStatsEventBatchTag = 0x73746274;
+
+// Tag of the datagrams registering a shared memory ring, sent with the ring memfd and eventfd.
+// (*MUST BE IN SYNC WITH STATS_RING_REGISTRATION_TAG in libstatssocket*)
+constexpr uint32_t kStatsRingRegistrationTag = 0x73747267;
+
+// Atoms not used by any config are dropped first on overflow. Isolated uid changes and state
+// changes are dropped last, since losing one skews the data of every later event.
+LogEventQueue::Priority getQueuePriority(const LogEvent& event, bool isAtomSkipped) {
+    if (isAtomSkipped) {
+        return LogEventQueue::Priority::UNUSED;
+    }
+    const int32_t atomId = event.GetTagId();
+    if (atomId == util::ISOLATED_UID_CHANGED || atomId == util::APP_BREADCRUMB_REPORTED ||
+        event.getExclusiveStateFieldIndex()) {
+        return LogEventQueue::Priority::CRITICAL;
+    }
+    return LogEventQueue::Priority::NORMAL;
+}
+
+}  // namespace
+
 StatsSocketListener::StatsSocketListener(std::shared_ptr<LogEventQueue> queue,
-                                         const std::shared_ptr<LogEventFilter>& logEventFilter)
-    : SocketListener(getLogSocket(), false /*start listen*/),
+                                         const std::shared_ptr<LogEventFilter>& logEventFilter,
+                                         int readBatchSize,
+                                         const std::shared_ptr<LogEventPool>& logEventPool,
+                                         const sp<StatsRingListener>& ringListener,
+                                         size_t numParseThreads, SocketClass socketClass,
+                                         const sp<UidMap>& uidMap)
+    : SocketListener(getLogSocket(getSocketName(socketClass)), false /*start listen*/),
+      mSocketClass(socketClass),
       mQueue(std::move(queue)),
-      mLogEventFilter(logEventFilter) {
+      mLogEventFilter(logEventFilter),
+      mLogEventPool(logEventPool),
+      mUidMap(uidMap),
+      mRingListener(ringListener),
+      mParsePipeline(numParseThreads > 0
+                             ? std::make_unique<LogEventParsePipeline>(
+                                       mQueue, mLogEventFilter, mLogEventPool, numParseThreads,
+                                       mUidMap)
+                             : nullptr),
+      mReadBatchSize(std::clamp(readBatchSize, 1, StatsdStats::kMaxSocketReadBatchSize)),
+      mDataBuffer(mReadBatchSize * kDatagramBufferSize),
+      mControlBuffer(mReadBatchSize * kControlBufferSize),
+      mIovecs(mReadBatchSize),
+      mMsgHdrs(mReadBatchSize) {
 }
 
 bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
-    static bool name_set;
+    ScopedStageTrace trace("StatsSocketListener::onDataAvailable");
+    // Each socket is read on a thread of its own.
+    static thread_local bool name_set;
     if (!name_set) {
-        prctl(PR_SET_NAME, "statsd.writer");
+        configureStatsdThread(mSocketClass == SocketClass::SYSTEM ? "statsd.swriter"
+                                                                  : "statsd.writer");
         name_set = true;
     }
 
-    // + 1 to ensure null terminator if MAX_PAYLOAD buffer is received
-    char buffer[sizeof(android_log_header_t) + LOGGER_ENTRY_MAX_PAYLOAD + 1];
-    struct iovec iov = {buffer, sizeof(buffer) - 1};
-
-    alignas(4) char control[CMSG_SPACE(sizeof(struct ucred))];
-    struct msghdr hdr = {
-            NULL, 0, &iov, 1, control, sizeof(control), 0,
-    };
+    // recvmmsg() overwrites msg_controllen and msg_flags, so the headers are re-initialized
+    // before every read.
+    for (int i = 0; i < mReadBatchSize; i++) {
+        mIovecs[i] = {&mDataBuffer[i * kDatagramBufferSize], kDatagramBufferSize - 1};
+        struct msghdr& hdr = mMsgHdrs[i].msg_hdr;
+        hdr.msg_name = NULL;
+        hdr.msg_namelen = 0;
+        hdr.msg_iov = &mIovecs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &mControlBuffer[i * kControlBufferSize];
+        hdr.msg_controllen = kControlBufferSize;
+        hdr.msg_flags = 0;
+        mMsgHdrs[i].msg_len = 0;
+    }
 
     int socket = cli->getSocket();
 
@@ -67,24 +137,57 @@ bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
     // overhead under logging load. We are safe because we check counts, but
     // still need to clear null terminator
     // memset(buffer, 0, sizeof(buffer));
-    ssize_t n = recvmsg(socket, &hdr, 0);
-    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+    //
+    // The socket is readable when this is called, so at least one datagram is received.
+    // MSG_DONTWAIT makes recvmmsg() return as soon as the socket is drained instead of blocking
+    // until the whole batch is filled.
+    const int count = recvmmsg(socket, mMsgHdrs.data(), mReadBatchSize,
+                               MSG_DONTWAIT | MSG_CMSG_CLOEXEC, NULL);
+    if (count <= 0) {
         return false;
     }
 
-    buffer[n] = 0;
+    StatsdStats::getInstance().noteSocketReadBatch(count);
+    StatsdStats::getInstance().noteSocketClassRead(static_cast<int>(mSocketClass), count);
+
+    bool result = true;
+    for (int i = 0; i < count; i++) {
+        // Datagrams of the same batch are already dequeued from the socket, keep processing
+        // the remaining ones even if one of them is malformed.
+        if (!processDatagram(static_cast<char*>(mIovecs[i].iov_base), mMsgHdrs[i].msg_len,
+                             mMsgHdrs[i].msg_hdr)) {
+            result = false;
+        }
+    }
+    return result;
+}
 
+bool StatsSocketListener::processDatagram(char* buffer, ssize_t n, const struct msghdr& hdr) {
     struct ucred* cred = NULL;
+    // Received file descriptors are owned here, and closed unless handed over.
+    std::vector<base::unique_fd> fds;
 
     struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
     while (cmsg != NULL) {
         if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS) {
             cred = (struct ucred*)CMSG_DATA(cmsg);
-            break;
+        } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            const size_t fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < fdCount; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                fds.emplace_back(fd);
+            }
         }
-        cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(&hdr), cmsg);
+    }
+
+    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+        return false;
     }
 
+    buffer[n] = 0;
+
     struct ucred fake_cred;
     if (cred == NULL) {
         cred = &fake_cred;
@@ -92,6 +195,12 @@ bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
         cred->uid = DEFAULT_OVERFLOWUID;
     }
 
+    // Apps are not allowed on the system socket, whatever the socket permissions.
+    if (mSocketClass == SocketClass::SYSTEM && cred->uid % AID_USER_OFFSET >= AID_APP_START) {
+        StatsdStats::getInstance().noteSocketClassRejected(static_cast<int>(mSocketClass));
+        return true;
+    }
+
     uint8_t* ptr = ((uint8_t*)buffer) + sizeof(android_log_header_t);
     n -= sizeof(android_log_header_t);
 
@@ -117,6 +226,8 @@ bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
             StatsdStats::getInstance().noteLogLost((int32_t)getWallClockSec(), dropped_count,
                                                    long_event->header.tag, last_atom_tag, cred->uid,
                                                    cred->pid);
+            StatsdStats::getInstance().noteSocketClassLogLost(static_cast<int>(mSocketClass),
+                                                              dropped_count);
             return true;
         }
     }
@@ -127,20 +238,144 @@ bool StatsSocketListener::onDataAvailable(SocketClient* cli) {
     const uint32_t uid = cred->uid;
     const uint32_t pid = cred->pid;
 
-    processMessage(msg, len, uid, pid, mQueue, mLogEventFilter);
+    uint32_t tag;
+    if (n >= (ssize_t)sizeof(tag)) {
+        memcpy(&tag, ptr, sizeof(tag));
+        if (tag == kStatsEventBatchTag) {
+            if (mParsePipeline != nullptr) {
+                return forEachBatchAtom(msg, len, [&](const uint8_t* atom, uint32_t atomLen) {
+                    mParsePipeline->submit(atom, atomLen, uid, pid);
+                });
+            }
+            return processBatch(msg, len, uid, pid, mQueue, mLogEventFilter, mLogEventPool,
+                                mUidMap);
+        }
+        if (tag == kStatsRingRegistrationTag) {
+            // Only system processes are trusted to share memory with statsd.
+            if (mRingListener == nullptr || uid != AID_SYSTEM || fds.size() != 2) {
+                return true;
+            }
+            mRingListener->addRing(std::move(fds[0]), std::move(fds[1]), uid, pid);
+            return true;
+        }
+    }
+
+    if (mParsePipeline != nullptr) {
+        mParsePipeline->submit(msg, len, uid, pid);
+    } else {
+        processMessage(msg, len, uid, pid, mQueue, mLogEventFilter, mLogEventPool, mUidMap);
+    }
+
+    return true;
+}
+
+bool StatsSocketListener::processBatch(const uint8_t* msg, uint32_t len, uint32_t uid,
+                                       uint32_t pid, const std::shared_ptr<LogEventQueue>& queue,
+                                       const std::shared_ptr<LogEventFilter>& filter,
+                                       const std::shared_ptr<LogEventPool>& pool,
+                                       const sp<UidMap>& uidMap) {
+    return forEachBatchAtom(msg, len, [&](const uint8_t* atom, uint32_t atomLen) {
+        processMessage(atom, atomLen, uid, pid, queue, filter, pool, uidMap);
+    });
+}
 
+bool StatsSocketListener::forEachBatchAtom(
+        const uint8_t* msg, uint32_t len,
+        const std::function<void(const uint8_t*, uint32_t)>& onAtom) {
+    // format: |size of atom 1|atom 1|size of atom 2|atom 2|...
+    while (len > 0) {
+        uint32_t atomLen;
+        if (len < sizeof(atomLen)) {
+            return false;
+        }
+        memcpy(&atomLen, msg, sizeof(atomLen));
+        msg += sizeof(atomLen);
+        len -= sizeof(atomLen);
+        if (atomLen > len) {
+            return false;
+        }
+        onAtom(msg, atomLen);
+        msg += atomLen;
+        len -= atomLen;
+    }
     return true;
 }
 
 void StatsSocketListener::processMessage(const uint8_t* msg, uint32_t len, uint32_t uid,
                                          uint32_t pid, const std::shared_ptr<LogEventQueue>& queue,
-                                         const std::shared_ptr<LogEventFilter>& filter) {
-    std::unique_ptr<LogEvent> logEvent = std::make_unique<LogEvent>(uid, pid);
+                                         const std::shared_ptr<LogEventFilter>& filter,
+                                         const std::shared_ptr<LogEventPool>& pool,
+                                         const sp<UidMap>& uidMap) {
+    LogEventQueue::Priority priority;
+    std::unique_ptr<LogEvent> logEvent = parseMessage(msg, len, uid, pid, filter, pool, &priority);
+    if (uidMap != nullptr) {
+        handleIsolatedUidsOnIngestion(uidMap, logEvent.get());
+    }
+    const int32_t atomId = logEvent->GetTagId();
+    const bool isAtomSkipped = logEvent->isParsedHeaderOnly();
+    const int64_t timestampNs = logEvent->GetElapsedTimestampNs();
+    LogEventSpill* spill = queue->getSpill();
+    // While atoms are spilled, the new ones go after them until they are all replayed.
+    if (spill != nullptr && spill->isActive() &&
+        !replaySpill(spill, queue, filter, pool, uidMap)) {
+        if (!isAtomSkipped && !spill->append(msg, len, uid, pid, getElapsedRealtimeNs())) {
+            StatsdStats::getInstance().noteEventQueueOverflow(timestampNs, atomId, isAtomSkipped);
+        }
+        return;
+    }
+    int64_t oldestTimestamp;
+    if (!queue->push(std::move(logEvent), &oldestTimestamp, priority)) {
+        // Atoms no config uses are not worth spilling.
+        if (spill == nullptr || isAtomSkipped ||
+            !spill->append(msg, len, uid, pid, getElapsedRealtimeNs())) {
+            StatsdStats::getInstance().noteEventQueueOverflow(oldestTimestamp, atomId,
+                                                              isAtomSkipped);
+        }
+    }
+}
+
+bool StatsSocketListener::replaySpill(LogEventSpill* spill,
+                                      const std::shared_ptr<LogEventQueue>& queue,
+                                      const std::shared_ptr<LogEventFilter>& filter,
+                                      const std::shared_ptr<LogEventPool>& pool,
+                                      const sp<UidMap>& uidMap) {
+    return spill->replay(
+            getElapsedRealtimeNs(),
+            [&](const LogEventSpill::Record& record) {
+                LogEventQueue::Priority priority;
+                std::unique_ptr<LogEvent> logEvent =
+                        parseMessage(record.payload, record.size, record.uid, record.pid, filter,
+                                     pool, &priority, /*isReplay=*/true);
+                if (uidMap != nullptr) {
+                    handleIsolatedUidsOnIngestion(uidMap, logEvent.get());
+                }
+                int64_t oldestTimestamp;
+                return queue->push(std::move(logEvent), &oldestTimestamp, priority);
+            },
+            [&](const LogEventSpill::Record& record) {
+                // Too old to be replayed, dropped like an overflow.
+                LogEvent logEvent(record.uid, record.pid);
+                logEvent.parseHeader(record.payload, record.size);
+                StatsdStats::getInstance().noteEventQueueOverflow(
+                        logEvent.GetElapsedTimestampNs(), logEvent.GetTagId(),
+                        /*isSkipped=*/false);
+            });
+}
+
+std::unique_ptr<LogEvent> StatsSocketListener::parseMessage(
+        const uint8_t* msg, uint32_t len, uint32_t uid, uint32_t pid,
+        const std::shared_ptr<LogEventFilter>& filter, const std::shared_ptr<LogEventPool>& pool,
+        LogEventQueue::Priority* priority, bool isReplay) {
+    std::unique_ptr<LogEvent> logEvent =
+            pool != nullptr ? pool->obtain(uid, pid) : std::make_unique<LogEvent>(uid, pid);
+    if (StatsdStats::getInstance().shouldTraceEventLatency()) {
+        logEvent->startLatencyTrace(getElapsedRealtimeNs());
+    }
 
     if (filter->getFilteringEnabled()) {
         const LogEvent::BodyBufferInfo bodyInfo = logEvent->parseHeader(msg, len);
         if (filter->isAtomInUse(logEvent->GetTagId())) {
-            logEvent->parseBody(bodyInfo);
+            logEvent->parseBody(bodyInfo, filter->getAtomFieldMask(logEvent->GetTagId()));
         }
     } else {
         logEvent->parseBuffer(msg, len);
@@ -149,7 +384,15 @@ void StatsSocketListener::processMessage(const uint8_t* msg, uint32_t len, uint3
     const int32_t atomId = logEvent->GetTagId();
     const bool isAtomSkipped = logEvent->isParsedHeaderOnly();
 
-    if (atomId == util::STATS_SOCKET_LOSS_REPORTED) {
+    // The payload holds the exact timestamp, so atoms with a truncated timestamp are not
+    // forwarded.
+    if (!isReplay && logEvent->isValid() && !logEvent->isRestricted() &&
+        truncateTimestampIfNecessary(*logEvent) == logEvent->GetElapsedTimestampNs()) {
+        filter->forwardRawAtom({msg, len, static_cast<int32_t>(uid), static_cast<int32_t>(pid),
+                                atomId, logEvent->GetElapsedTimestampNs()});
+    }
+
+    if (atomId == util::STATS_SOCKET_LOSS_REPORTED && !isReplay) {
         if (isAtomSkipped) {
             ALOGW("Atom STATS_SOCKET_LOSS_REPORTED should not be skipped");
         }
@@ -164,14 +407,28 @@ void StatsSocketListener::processMessage(const uint8_t* msg, uint32_t len, uint3
         }
     }
 
-    int64_t oldestTimestamp;
-    if (!queue->push(std::move(logEvent), &oldestTimestamp)) {
-        StatsdStats::getInstance().noteEventQueueOverflow(oldestTimestamp, atomId, isAtomSkipped);
+    if (logEvent->isLatencyTraced()) {
+        StatsdStats::getInstance().noteEventLatency(
+                StatsdStats::EVENT_LATENCY_PARSE,
+                logEvent->lapLatencyTrace(getElapsedRealtimeNs()));
+    }
+
+    *priority = getQueuePriority(*logEvent, isAtomSkipped);
+    return logEvent;
+}
+
+const char* StatsSocketListener::getSocketName(SocketClass socketClass) {
+    // (*MUST BE IN SYNC WITH statsd_writer.cpp in libstatssocket*)
+    switch (socketClass) {
+        case SocketClass::SYSTEM:
+            return "statsdw_system";
+        case SocketClass::DEFAULT:
+        default:
+            return "statsdw";
     }
 }
 
-int StatsSocketListener::getLogSocket() {
-    static const char socketName[] = "statsdw";
+int StatsSocketListener::getLogSocket(const char* socketName) {
     int sock = android_get_control_socket(socketName);
 
     if (sock < 0) {  // statsd started up in init.sh
@@ -16,11 +16,20 @@
 #pragma once
 
 #include <gtest/gtest_prod.h>
+#include <sys/socket.h>
 #include <sysutils/SocketListener.h>
 #include <utils/RefBase.h>
 
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include "LogEventFilter.h"
+#include "logd/LogEventPool.h"
 #include "logd/LogEventQueue.h"
+#include "packages/UidMap.h"
+#include "socket/LogEventParsePipeline.h"
+#include "socket/StatsRingListener.h"
 
 // DEFAULT_OVERFLOWUID is defined in linux/highuid.h, which is not part of
 // the uapi headers for userspace to use.  This value is filled in on the
@@ -38,16 +47,75 @@ namespace statsd {
 
 class StatsSocketListener : public SocketListener, public virtual RefBase {
 public:
+    // Sockets the atoms are written to, each one read by a listener of its own.
+    enum class SocketClass {
+        // Written by the apps, and by every process while the system socket is not served.
+        DEFAULT = 0,
+        // Written by the processes of the system uids, so that app bursts do not fill it up.
+        SYSTEM = 1,
+    };
+
+    // Default max number of datagrams read from the socket per wakeup.
+    static constexpr int kDefaultReadBatchSize = 16;
+
+    // Max number of datagrams read from the system socket per wakeup, system_server logs most
+    // of the atoms.
+    static constexpr int kSystemReadBatchSize = 32;
+
+    // Number of threads parsing the atoms when parsing is moved off the listener thread.
+    static constexpr size_t kDefaultParseThreads = 2;
+
+    // With numParseThreads > 0, the listener thread only copies the atoms and a
+    // LogEventParsePipeline parses them on that many threads, keeping their order.
+    // With a uidMap, the isolated uids of the events are handled as they are read, see
+    // handleIsolatedUidsOnIngestion().
     explicit StatsSocketListener(std::shared_ptr<LogEventQueue> queue,
-                                 const std::shared_ptr<LogEventFilter>& logEventFilter);
+                                 const std::shared_ptr<LogEventFilter>& logEventFilter,
+                                 int readBatchSize = kDefaultReadBatchSize,
+                                 const std::shared_ptr<LogEventPool>& logEventPool = nullptr,
+                                 const sp<StatsRingListener>& ringListener = nullptr,
+                                 size_t numParseThreads = 0,
+                                 SocketClass socketClass = SocketClass::DEFAULT,
+                                 const sp<UidMap>& uidMap = nullptr);
 
     virtual ~StatsSocketListener() = default;
 
+    // Name of the init socket of the class.
+    static const char* getSocketName(SocketClass socketClass);
+
 protected:
     bool onDataAvailable(SocketClient* cli) override;
 
 private:
-    static int getLogSocket();
+    static int getLogSocket(const char* socketName);
+
+    /**
+     * @brief Helper API to handle a single datagram received from the socket: extracts the
+     * sender credentials, handles the dropped events notification or forwards the payload to
+     * processMessage()
+     *
+     * @param buffer datagram content, must have room for a null terminator at buffer[len]
+     * @param len size of datagram in bytes
+     * @param hdr message header the datagram was received with
+     * @return false if the datagram is malformed
+     */
+    bool processDatagram(char* buffer, ssize_t len, const struct msghdr& hdr);
+
+    /**
+     * @brief Helper API to parse buffer and make the LogEvent, without queueing it. Atoms
+     * reporting socket loss are noted in StatsdStats.
+     *
+     * @param priority set to the priority the event is queued with
+     * @param isReplay true if the atom was parsed before it was spilled, so it is neither
+     *        forwarded as a raw atom nor noted as a socket loss again
+     * @return the parsed event, never null
+     */
+    static std::unique_ptr<LogEvent> parseMessage(const uint8_t* msg, uint32_t len, uint32_t uid,
+                                                  uint32_t pid,
+                                                  const std::shared_ptr<LogEventFilter>& filter,
+                                                  const std::shared_ptr<LogEventPool>& pool,
+                                                  LogEventQueue::Priority* priority,
+                                                  bool isReplay = false);
 
     /**
      * @brief Helper API to parse buffer, make the LogEvent & submit it into the queue
@@ -59,10 +127,48 @@ private:
      * @param pid arguments for LogEvent constructor
      * @param queue queue to submit the event
      * @param filter to be used for event evaluation
+     * @param pool to obtain the LogEvent from, a new LogEvent is allocated if null
+     * @param uidMap to handle the isolated uids of the event with, left to the processor if null
      */
     static void processMessage(const uint8_t* msg, uint32_t len, uint32_t uid, uint32_t pid,
                                const std::shared_ptr<LogEventQueue>& queue,
-                               const std::shared_ptr<LogEventFilter>& filter);
+                               const std::shared_ptr<LogEventFilter>& filter,
+                               const std::shared_ptr<LogEventPool>& pool = nullptr,
+                               const sp<UidMap>& uidMap = nullptr);
+
+    /**
+     * @brief Helper API to push the spilled atoms into the queue, in order, until it is full.
+     *
+     * @return true if every spilled atom was replayed
+     */
+    static bool replaySpill(LogEventSpill* spill, const std::shared_ptr<LogEventQueue>& queue,
+                            const std::shared_ptr<LogEventFilter>& filter,
+                            const std::shared_ptr<LogEventPool>& pool, const sp<UidMap>& uidMap);
+
+    /**
+     * @brief Helper API to unpack a batch datagram written by libstatssocket and submit each of
+     * its atoms with processMessage(). Atoms before a malformed size prefix are still submitted.
+     *
+     * @param msg batch payload after the batch tag
+     * @param len size of the payload in bytes
+     * @return false if the batch is malformed
+     */
+    static bool processBatch(const uint8_t* msg, uint32_t len, uint32_t uid, uint32_t pid,
+                             const std::shared_ptr<LogEventQueue>& queue,
+                             const std::shared_ptr<LogEventFilter>& filter,
+                             const std::shared_ptr<LogEventPool>& pool = nullptr,
+                             const sp<UidMap>& uidMap = nullptr);
+
+    /**
+     * @brief Calls onAtom for each atom of a batch payload, in order. Atoms before a malformed
+     * size prefix are still visited.
+     *
+     * @return false if the batch is malformed
+     */
+    static bool forEachBatchAtom(const uint8_t* msg, uint32_t len,
+                                 const std::function<void(const uint8_t*, uint32_t)>& onAtom);
+
+    const SocketClass mSocketClass;
 
     /**
      * Who is going to get the events when they're read.
@@ -71,7 +177,44 @@ private:
 
     std::shared_ptr<LogEventFilter> mLogEventFilter;
 
+    /**
+     * Pool of recycled LogEvents, can be null.
+     */
+    std::shared_ptr<LogEventPool> mLogEventPool;
+
+    /**
+     * Handles the isolated uids of the events as they are read, can be null.
+     */
+    sp<UidMap> mUidMap;
+
+    /**
+     * Drains the rings registered on the socket, null if the ring transport is disabled.
+     */
+    sp<StatsRingListener> mRingListener;
+
+    /**
+     * Parses the atoms off the listener thread, null if they are parsed inline.
+     */
+    std::unique_ptr<LogEventParsePipeline> mParsePipeline;
+
+    /**
+     * Max number of datagrams read with a single recvmmsg() call.
+     */
+    const int mReadBatchSize;
+
+    /**
+     * Receive buffers reused across reads. Each datagram in a batch gets a slice of
+     * mDataBuffer and of mControlBuffer.
+     */
+    std::vector<char> mDataBuffer;
+    std::vector<char> mControlBuffer;
+    std::vector<struct iovec> mIovecs;
+    std::vector<struct mmsghdr> mMsgHdrs;
+
     friend class SocketParseMessageTest;
+    friend class StatsRingListener;
+    friend class LogEventParsePipeline;
+    friend class ReplayHarness;
     friend void generateAtomLogging(const std::shared_ptr<LogEventQueue>& queue,
                                     const std::shared_ptr<LogEventFilter>& filter, int eventCount,
                                     int startAtomId);
@@ -81,6 +224,8 @@ private:
     FRIEND_TEST(SocketParseMessageTest, TestProcessMessageFilterCompleteSet);
     FRIEND_TEST(SocketParseMessageTest, TestProcessMessageFilterPartialSet);
     FRIEND_TEST(SocketParseMessageTest, TestProcessMessageFilterToggle);
+    FRIEND_TEST(SocketParseMessageTest, TestProcessBatch);
+    FRIEND_TEST(SocketParseMessageTest, TestProcessBatchMalformed);
 };
 
 }  // namespace statsd
@@ -17,12 +17,21 @@
 
 #include <utils/RefBase.h>
 
+#include <vector>
+
 #include "HashableDimensionKey.h"
 
 namespace android {
 namespace os {
 namespace statsd {
 
+// One state transition of a primary key.
+struct StateChange {
+    HashableDimensionKey primaryKey;
+    FieldValue oldState;
+    FieldValue newState;
+};
+
 class StateListener : public virtual RefBase {
 public:
     StateListener(){};
@@ -47,6 +56,23 @@ public:
     virtual void onStateChanged(const int64_t eventTimeNs, const int32_t atomId,
                                 const HashableDimensionKey& primaryKey, const FieldValue& oldState,
                                 const FieldValue& newState) = 0;
+
+    /**
+     * Handles all the state changes caused by one state atom event, in the order they happened.
+     * A reset event changes the state of every primary key at once. The default implementation
+     * calls onStateChanged() for each change.
+     *
+     * [eventTimeNs]: Time of the state change log event.
+     * [atomId]: The id of the state atom
+     * [changes]: The transitions of each primary key whose state changed
+     */
+    virtual void onStateChanges(const int64_t eventTimeNs, const int32_t atomId,
+                                const std::vector<StateChange>& changes) {
+        for (const StateChange& change : changes) {
+            onStateChanged(eventTimeNs, atomId, change.primaryKey, change.oldState,
+                           change.newState);
+        }
+    }
 };
 
 }  // namespace statsd
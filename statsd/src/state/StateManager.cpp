@@ -53,7 +53,7 @@ void StateManager::onLogEvent(const LogEvent& event) {
     }
 }
 
-void StateManager::registerListener(const int32_t atomId, wp<StateListener> listener) {
+void StateManager::registerListener(const int32_t atomId, const sp<StateListener>& listener) {
     // Check if state tracker already exists.
     if (mStateTrackers.find(atomId) == mStateTrackers.end()) {
         mStateTrackers[atomId] = new StateTracker(atomId);
@@ -61,7 +61,8 @@ void StateManager::registerListener(const int32_t atomId, wp<StateListener> list
     mStateTrackers[atomId]->registerListener(listener);
 }
 
-void StateManager::unregisterListener(const int32_t atomId, wp<StateListener> listener) {
+void StateManager::unregisterListener(const int32_t atomId,
+                                      const sp<StateListener>& listener) {
     std::unique_lock<std::mutex> lock(mMutex);
 
     // Hold the sp<> until the lock is released so that ~StateTracker() is
@@ -109,6 +110,15 @@ void StateManager::notifyAppChanged(const string& apk, const sp<UidMap>& uidMap)
     }
 }
 
+void StateManager::evictIdleStates(const int64_t nowNs) {
+    if (mIdleStateEvictionNs <= 0) {
+        return;
+    }
+    for (const auto& [atomId, stateTracker] : mStateTrackers) {
+        stateTracker->evictIdleStates(nowNs, mIdleStateEvictionNs, kIdleStateEvictionSliceSize);
+    }
+}
+
 void StateManager::addAllAtomIds(LogEventFilter::AtomIdSet& allIds) const {
     for (const auto& stateTracker : mStateTrackers) {
         allIds.insert(stateTracker.first);
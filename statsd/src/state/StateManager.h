@@ -53,13 +53,14 @@ public:
 
     // Notifies the StateTracker for the given atomId to register listener.
     // If the correct StateTracker does not exist, a new StateTracker is created.
+    // The StateTracker holds the listener until it is unregistered.
     // Note: StateTrackers can be created for non-state atoms. They are essentially empty and
     // do not perform any actions.
-    void registerListener(const int32_t atomId, wp<StateListener> listener);
+    void registerListener(const int32_t atomId, const sp<StateListener>& listener);
 
     // Notifies the correct StateTracker to unregister a listener
     // and removes the tracker if it no longer has any listeners.
-    void unregisterListener(const int32_t atomId, wp<StateListener> listener);
+    void unregisterListener(const int32_t atomId, const sp<StateListener>& listener);
 
     // Returns true if the StateTracker exists and queries for the
     // original state value mapped to the given query key. The state value is
@@ -77,6 +78,10 @@ public:
         return mStateTrackers.size();
     }
 
+    inline bool hasStateTracker(const int32_t atomId) const {
+        return mStateTrackers.find(atomId) != mStateTrackers.end();
+    }
+
     inline int getListenersCount(const int32_t atomId) const {
         auto it = mStateTrackers.find(atomId);
         if (it != mStateTrackers.end()) {
@@ -87,6 +92,21 @@ public:
 
     void addAllAtomIds(LogEventFilter::AtomIdSet& allIds) const;
 
+    // States of the primary keys that have not changed for this long are evicted, when enabled.
+    static constexpr int64_t kDefaultIdleStateEvictionNs = 24 * 60 * 60 * 1'000'000'000LL;
+
+    // Entries scanned per tracker by each evictIdleStates() call.
+    static constexpr size_t kIdleStateEvictionSliceSize = 64;
+
+    // Sets how long the state of a primary key can stay unchanged before it is evicted, or 0 to
+    // keep the states until they become unknown, which is the default.
+    void setIdleStateEvictionNs(const int64_t idleStateEvictionNs) {
+        mIdleStateEvictionNs = idleStateEvictionNs;
+    }
+
+    // Evicts a slice of the idle states of each tracker. See StateTracker::evictIdleStates.
+    void evictIdleStates(const int64_t nowNs);
+
 private:
     mutable std::mutex mMutex;
 
@@ -99,6 +119,8 @@ private:
     // The combined uid sources (after translating pkg name to uid).
     // State events from uids that are not in the list will be ignored to avoid state pollution.
     std::set<int32_t> mAllowedLogSources;
+
+    int64_t mIdleStateEvictionNs = 0;
 };
 
 }  // namespace statsd
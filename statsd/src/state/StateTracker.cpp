@@ -25,10 +25,26 @@ namespace android {
 namespace os {
 namespace statsd {
 
-StateTracker::StateTracker(const int32_t atomId) : mField(atomId, 0) {
+StateTracker::StateTracker(const int32_t atomId)
+    : mField(atomId, 0), mHasIntKeyField(false) {
 }
 
 void StateTracker::onLogEvent(const LogEvent& event) {
+    handleLogEvent(event);
+    notifyStateChanges(event.GetElapsedTimestampNs());
+}
+
+void StateTracker::notifyStateChanges(const int64_t eventTimeNs) {
+    if (mEventChanges.empty()) {
+        return;
+    }
+    for (const sp<StateListener>& listener : mListeners) {
+        listener->onStateChanges(eventTimeNs, mField.getTag(), mEventChanges);
+    }
+    mEventChanges.clear();
+}
+
+void StateTracker::handleLogEvent(const LogEvent& event) {
     const int64_t eventTimeNs = event.GetElapsedTimestampNs();
 
     // Parse event for primary field values i.e. primary key.
@@ -59,22 +75,23 @@ void StateTracker::onLogEvent(const LogEvent& event) {
     }
 
     const bool nested = newState.mAnnotations.isNested();
-    updateStateForPrimaryKey(eventTimeNs, primaryKey, newState, nested, mStateMap[primaryKey]);
+    updateStateForPrimaryKey(eventTimeNs, primaryKey, newState, nested,
+                             getOrAddStateValueInfo(primaryKey));
 }
 
-void StateTracker::registerListener(wp<StateListener> listener) {
+void StateTracker::registerListener(const sp<StateListener>& listener) {
     mListeners.insert(listener);
 }
 
-void StateTracker::unregisterListener(wp<StateListener> listener) {
+void StateTracker::unregisterListener(const sp<StateListener>& listener) {
     mListeners.erase(listener);
 }
 
 bool StateTracker::getStateValue(const HashableDimensionKey& queryKey, FieldValue* output) const {
     output->mField = mField;
 
-    if (const auto it = mStateMap.find(queryKey); it != mStateMap.end()) {
-        output->mValue = it->second.state;
+    if (const StateValueInfo* info = findStateValueInfo(queryKey); info != nullptr) {
+        output->mValue = info->state;
         return true;
     }
 
@@ -84,8 +101,127 @@ bool StateTracker::getStateValue(const HashableDimensionKey& queryKey, FieldValu
     return false;
 }
 
+// Scans the buckets of the map from the cursor until maxEntries entries are scanned, adding the
+// primary keys of the idle entries to idleKeys. Returns true if the scan reached the end of the
+// map, in which case the cursor is back at its first bucket.
+template <typename Map, typename IsIdle, typename GetKey>
+static bool scanIdleEntries(const Map& map, size_t* cursor, size_t maxEntries, IsIdle isIdle,
+                            GetKey getKey, std::vector<HashableDimensionKey>* idleKeys) {
+    if (*cursor >= map.bucket_count()) {
+        *cursor = 0;
+    }
+    size_t scanned = 0;
+    while (*cursor < map.bucket_count() && scanned < maxEntries) {
+        for (auto it = map.begin(*cursor); it != map.end(*cursor); ++it, ++scanned) {
+            if (isIdle(it->second)) {
+                idleKeys->push_back(getKey(*it));
+            }
+        }
+        ++*cursor;
+    }
+    if (*cursor < map.bucket_count()) {
+        return false;
+    }
+    *cursor = 0;
+    return true;
+}
+
+void StateTracker::evictIdleStates(const int64_t nowNs, const int64_t idleNs,
+                                   const size_t maxEntries) {
+    const int64_t lastActiveEpoch = (nowNs - idleNs) / kEvictionEpochNs;
+    std::vector<HashableDimensionKey> idleKeys;
+    const bool intKeySweepDone = scanIdleEntries(
+            mIntKeyStateMap, &mIntKeyEvictionCursor, maxEntries,
+            [lastActiveEpoch](const IntKeyStateValueInfo& intKeyInfo) {
+                return intKeyInfo.info.lastTouchedEpoch < lastActiveEpoch;
+            },
+            [](const auto& entry) { return entry.second.primaryKey; }, &idleKeys);
+    const bool sweepDone = scanIdleEntries(
+            mStateMap, &mEvictionCursor, maxEntries,
+            [lastActiveEpoch](const StateValueInfo& info) {
+                return info.lastTouchedEpoch < lastActiveEpoch;
+            },
+            [](const auto& entry) { return entry.first; }, &idleKeys);
+
+    for (const HashableDimensionKey& primaryKey : idleKeys) {
+        VLOG("StateTracker evict idle state for primary key %s", primaryKey.toString().c_str());
+        clearStateForPrimaryKey(nowNs, primaryKey);
+    }
+    notifyStateChanges(nowNs);
+
+    // The maps are only rehashed once the cursor is back at their first bucket.
+    if (intKeySweepDone) {
+        shrinkMapIfSparse(mIntKeyStateMap);
+    }
+    if (sweepDone) {
+        shrinkMapIfSparse(mStateMap);
+    }
+}
+
+bool StateTracker::isIntKey(const HashableDimensionKey& primaryKey) const {
+    const DimensionValues& values = primaryKey.getValues();
+    return mHasIntKeyField && values.size() == 1 && values[0].mValue.getType() == INT &&
+           values[0].mField == mIntKeyField;
+}
+
+const StateTracker::StateValueInfo* StateTracker::findStateValueInfo(
+        const HashableDimensionKey& primaryKey) const {
+    if (primaryKey.getValues().empty()) {
+        return mUnslicedState.state == kStateUnknown ? nullptr : &mUnslicedState;
+    }
+    if (isIntKey(primaryKey)) {
+        const auto it = mIntKeyStateMap.find(primaryKey.getValues()[0].mValue.int_value);
+        return it == mIntKeyStateMap.end() ? nullptr : &it->second.info;
+    }
+    const auto it = mStateMap.find(primaryKey);
+    return it == mStateMap.end() ? nullptr : &it->second;
+}
+
+StateTracker::StateValueInfo& StateTracker::getOrAddStateValueInfo(
+        const HashableDimensionKey& primaryKey) {
+    const DimensionValues& values = primaryKey.getValues();
+    if (values.empty()) {
+        return mUnslicedState;
+    }
+    if (!mHasIntKeyField && values.size() == 1 && values[0].mValue.getType() == INT) {
+        mHasIntKeyField = true;
+        mIntKeyField = values[0].mField;
+    }
+    if (isIntKey(primaryKey)) {
+        const auto [it, inserted] = mIntKeyStateMap.try_emplace(values[0].mValue.int_value);
+        if (inserted) {
+            it->second.primaryKey = primaryKey;
+        }
+        return it->second.info;
+    }
+    return mStateMap[primaryKey];
+}
+
+void StateTracker::eraseStateValueInfo(const HashableDimensionKey& primaryKey) {
+    if (primaryKey.getValues().empty()) {
+        mUnslicedState = StateValueInfo();
+    } else if (isIntKey(primaryKey)) {
+        // primaryKey may be the key stored in the erased entry.
+        const int32_t value = primaryKey.getValues()[0].mValue.int_value;
+        mIntKeyStateMap.erase(value);
+    } else {
+        mStateMap.erase(primaryKey);
+    }
+}
+
 void StateTracker::handleReset(const int64_t eventTimeNs, const FieldValue& newState) {
     VLOG("StateTracker handle reset");
+    // The reset state is never kStateUnknown, so no entry is erased while iterating.
+    if (mUnslicedState.state != kStateUnknown) {
+        updateStateForPrimaryKey(eventTimeNs, DEFAULT_DIMENSION_KEY, newState,
+                                 false /* nested; treat this state change as not nested */,
+                                 mUnslicedState);
+    }
+    for (auto& [value, intKeyInfo] : mIntKeyStateMap) {
+        updateStateForPrimaryKey(eventTimeNs, intKeyInfo.primaryKey, newState,
+                                 false /* nested; treat this state change as not nested */,
+                                 intKeyInfo.info);
+    }
     for (auto& [primaryKey, stateValueInfo] : mStateMap) {
         updateStateForPrimaryKey(eventTimeNs, primaryKey, newState,
                                  false /* nested; treat this state change as not nested */,
@@ -96,16 +232,12 @@ void StateTracker::handleReset(const int64_t eventTimeNs, const FieldValue& newS
 void StateTracker::clearStateForPrimaryKey(const int64_t eventTimeNs,
                                            const HashableDimensionKey& primaryKey) {
     VLOG("StateTracker clear state for primary key");
-    const std::unordered_map<HashableDimensionKey, StateValueInfo>::iterator it =
-            mStateMap.find(primaryKey);
-
-    // If there is no entry for the primaryKey in mStateMap, then the state is already
-    // kStateUnknown.
+    // If there is no entry for the primaryKey, then the state is already kStateUnknown.
     const FieldValue state(mField, Value(kStateUnknown));
-    if (it != mStateMap.end()) {
+    if (findStateValueInfo(primaryKey) != nullptr) {
         updateStateForPrimaryKey(eventTimeNs, primaryKey, state,
                                  false /* nested; treat this state change as not nested */,
-                                 it->second);
+                                 getOrAddStateValueInfo(primaryKey));
     }
 }
 
@@ -113,6 +245,7 @@ void StateTracker::updateStateForPrimaryKey(const int64_t eventTimeNs,
                                             const HashableDimensionKey& primaryKey,
                                             const FieldValue& newState, const bool nested,
                                             StateValueInfo& stateValueInfo) {
+    stateValueInfo.lastTouchedEpoch = eventTimeNs / kEvictionEpochNs;
     FieldValue oldState;
     oldState.mField = mField;
     oldState.mValue.setInt(stateValueInfo.state);
@@ -125,7 +258,7 @@ void StateTracker::updateStateForPrimaryKey(const int64_t eventTimeNs,
         if (newStateValue != oldStateValue) {
             stateValueInfo.state = newStateValue;
             stateValueInfo.count = 1;
-            notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+            recordStateChange(primaryKey, oldState, newState);
         }
 
     // Update state map for nested counting case.
@@ -140,36 +273,31 @@ void StateTracker::updateStateForPrimaryKey(const int64_t eventTimeNs,
     // The atom must be logged correctly.
     } else if (newStateValue == kStateUnknown) {
         if (oldStateValue != kStateUnknown) {
-            notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+            recordStateChange(primaryKey, oldState, newState);
         }
     } else if (oldStateValue == kStateUnknown) {
         stateValueInfo.state = newStateValue;
         stateValueInfo.count = 1;
-        notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+        recordStateChange(primaryKey, oldState, newState);
     } else if (oldStateValue == newStateValue) {
         stateValueInfo.count++;
     } else if (--stateValueInfo.count == 0) {
         stateValueInfo.state = newStateValue;
         stateValueInfo.count = 1;
-        notifyListeners(eventTimeNs, primaryKey, oldState, newState);
+        recordStateChange(primaryKey, oldState, newState);
     }
 
     // Clear primary key entry from state map if state is now unknown.
-    // stateValueInfo points to a value in mStateMap and should not be accessed after erasing the
-    // entry
+    // stateValueInfo points to a mapped value and should not be accessed after erasing the entry
     if (newStateValue == kStateUnknown) {
-        mStateMap.erase(primaryKey);
+        eraseStateValueInfo(primaryKey);
     }
 }
 
-void StateTracker::notifyListeners(const int64_t eventTimeNs,
-                                   const HashableDimensionKey& primaryKey,
-                                   const FieldValue& oldState, const FieldValue& newState) {
-    for (auto l : mListeners) {
-        auto sl = l.promote();
-        if (sl != nullptr) {
-            sl->onStateChanged(eventTimeNs, mField.getTag(), primaryKey, oldState, newState);
-        }
+void StateTracker::recordStateChange(const HashableDimensionKey& primaryKey,
+                                     const FieldValue& oldState, const FieldValue& newState) {
+    if (!mListeners.empty()) {
+        mEventChanges.push_back({primaryKey, oldState, newState});
     }
 }
 
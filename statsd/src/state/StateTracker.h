@@ -15,6 +15,7 @@
  */
 #pragma once
 
+#include <gtest/gtest_prod.h>
 #include <utils/RefBase.h>
 #include "HashableDimensionKey.h"
 #include "logd/LogEvent.h"
@@ -22,6 +23,7 @@
 #include "state/StateListener.h"
 
 #include <unordered_map>
+#include <vector>
 
 namespace android {
 namespace os {
@@ -35,14 +37,15 @@ public:
 
     // Updates state map and notifies all listeners if a state change occurs.
     // Checks if a state change has occurred by getting the state value from
-    // the log event and comparing the old and new states.
+    // the log event and comparing the old and new states. All the changes of the event are sent
+    // to each listener in one onStateChanges() call.
     void onLogEvent(const LogEvent& event);
 
     // Adds new listeners to set of StateListeners. If a listener is already
-    // registered, it is ignored.
-    void registerListener(wp<StateListener> listener);
+    // registered, it is ignored. Listeners are held until they are unregistered.
+    void registerListener(const sp<StateListener>& listener);
 
-    void unregisterListener(wp<StateListener> listener);
+    void unregisterListener(const sp<StateListener>& listener);
 
     // The output is a FieldValue object that has mStateField as the field and
     // the original state value (found using the given query key) as the value.
@@ -51,6 +54,13 @@ public:
     // number of primary fields, the output value is set to kStateUnknown.
     bool getStateValue(const HashableDimensionKey& queryKey, FieldValue* output) const;
 
+    // Clears the states of the primary keys that have not changed for idleNs, such as the uids
+    // of uninstalled apps, and notifies the listeners as if the states became unknown. At most
+    // about maxEntries entries are scanned per call, resuming where the previous call stopped,
+    // and the maps shrink once a whole sweep evicted most of their entries. The state of the
+    // empty primary key is never evicted.
+    void evictIdleStates(const int64_t nowNs, const int64_t idleNs, const size_t maxEntries);
+
     inline int getListenersCount() const {
         return mListeners.size();
     }
@@ -61,15 +71,56 @@ private:
     struct StateValueInfo {
         int32_t state = kStateUnknown;  // state value
         int count = 0;                  // nested count (only used for binary states)
+        uint32_t lastTouchedEpoch = 0;  // epoch of the last event for the key
+    };
+
+    // Idle times are counted in epochs of a minute, so that the last touch takes 4 bytes.
+    static constexpr int64_t kEvictionEpochNs = 60 * 1'000'000'000LL;
+
+    struct IntKeyStateValueInfo {
+        HashableDimensionKey primaryKey;
+        StateValueInfo info;
     };
 
     Field mField;
 
-    // Maps primary key to state value info
+    // State of the empty primary key, used by states without primary fields. The key has no
+    // state if the state is kStateUnknown.
+    StateValueInfo mUnslicedState;
+
+    // States keyed by a single int primary field, such as a uid, are mapped by the int value so
+    // that lookups do not build or hash a HashableDimensionKey. mIntKeyField is the field of
+    // the first such key and other fields go to mStateMap.
+    bool mHasIntKeyField;
+    Field mIntKeyField;
+    std::unordered_map<int32_t, IntKeyStateValueInfo> mIntKeyStateMap;
+
+    // Maps the other primary keys to state value info
     std::unordered_map<HashableDimensionKey, StateValueInfo> mStateMap;
 
     // Set of all StateListeners (objects listening for state changes)
-    std::set<wp<StateListener>> mListeners;
+    std::set<sp<StateListener>> mListeners;
+
+    // State changes of the event being processed. Listeners are notified of all of them at once
+    // after the event has been applied.
+    std::vector<StateChange> mEventChanges;
+
+    // Bucket of each map at which the next eviction slice starts.
+    size_t mIntKeyEvictionCursor = 0;
+    size_t mEvictionCursor = 0;
+
+    void handleLogEvent(const LogEvent& event);
+
+    // Returns true if the key is a single int that is mapped in mIntKeyStateMap.
+    bool isIntKey(const HashableDimensionKey& primaryKey) const;
+
+    // Returns the state value info of the key, or null if the key has no state.
+    const StateValueInfo* findStateValueInfo(const HashableDimensionKey& primaryKey) const;
+
+    // Returns the state value info of the key, adding an unknown state if it has none.
+    StateValueInfo& getOrAddStateValueInfo(const HashableDimensionKey& primaryKey);
+
+    void eraseStateValueInfo(const HashableDimensionKey& primaryKey);
 
     // Reset all state values in map to the given state.
     void handleReset(const int64_t eventTimeNs, const FieldValue& newState);
@@ -82,9 +133,14 @@ private:
                                   const FieldValue& newState, const bool nested,
                                   StateValueInfo& stateValueInfo);
 
-    // Notify registered state listeners of state change.
-    void notifyListeners(const int64_t eventTimeNs, const HashableDimensionKey& primaryKey,
-                         const FieldValue& oldState, const FieldValue& newState);
+    // Record a state change to notify the registered state listeners of.
+    void recordStateChange(const HashableDimensionKey& primaryKey, const FieldValue& oldState,
+                           const FieldValue& newState);
+
+    // Notifies the listeners of the recorded state changes and clears them.
+    void notifyStateChanges(const int64_t eventTimeNs);
+
+    FRIEND_TEST(StateTrackerTest, TestEvictIdleStates);
 };
 
 bool getStateFieldValueFromLogEvent(const LogEvent& event, FieldValue* output);
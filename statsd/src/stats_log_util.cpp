@@ -19,10 +19,15 @@
 
 #include <aidl/android/os/IStatsCompanionService.h>
 #include <private/android_filesystem_config.h>
-#include <set>
+#include <string.h>
 #include <utils/SystemClock.h>
 
+#include <algorithm>
+#include <array>
+#include <set>
+
 #include "statscompanion_util.h"
+#include "statslog_statsd.h"
 
 using android::util::FIELD_COUNT_REPEATED;
 using android::util::FIELD_TYPE_BOOL;
@@ -85,6 +90,11 @@ const int FIELD_ID_PULL_TIMEOUT_METADATA = 22;
 const int FIELD_ID_PULL_TIMEOUT_METADATA_UPTIME_MILLIS = 1;
 const int FIELD_ID_PULL_TIMEOUT_METADATA_ELAPSED_MILLIS = 2;
 const int FIELD_ID_SUBSCRIPTION_PULL_COUNT = 23;
+const int FIELD_ID_AVERAGE_PULL_QUEUE_DELAY_NANOS = 24;
+const int FIELD_ID_MAX_PULL_QUEUE_DELAY_NANOS = 25;
+const int FIELD_ID_PULL_TIME_HISTOGRAM = 26;
+const int FIELD_ID_COOL_DOWN_PENALTY_NANOS = 27;
+const int FIELD_ID_SLOW_PULLER_PENALTY_COUNT = 28;
 
 // for AtomMetricStats proto
 const int FIELD_ID_ATOM_METRIC_STATS = 17;
@@ -103,7 +113,72 @@ const int FIELD_ID_BUCKET_COUNT = 12;
 
 namespace {
 
-void writeDimensionToProtoHelper(const std::vector<FieldValue>& dims, size_t* index, int depth,
+namespace {
+
+struct StringHashCacheEntry {
+    bool valid = false;
+    string str;
+    uint64_t hash;
+};
+
+const size_t kStringHashCacheSizeBits = 8;
+
+// Picks the cache slot from the length and the first and last 8 bytes, which is much cheaper
+// than hashing the whole string. The entry's string is compared before its hash is used.
+size_t getStringHashCacheSlot(const string& str) {
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    memcpy(&head, str.data(), std::min<size_t>(str.size(), sizeof(head)));
+    if (str.size() > sizeof(tail)) {
+        memcpy(&tail, str.data() + str.size() - sizeof(tail), sizeof(tail));
+    }
+    const uint64_t mixed =
+            head * 0x9E3779B97F4A7C15ULL ^ (tail + str.size()) * 0xC2B2AE3D27D4EB4FULL;
+    return mixed >> (64 - kStringHashCacheSizeBits);
+}
+
+}  // namespace
+
+uint64_t getCachedStringHash(const string& str) {
+    thread_local std::array<StringHashCacheEntry, 1 << kStringHashCacheSizeBits> cache;
+    StringHashCacheEntry& entry = cache[getStringHashCacheSlot(str)];
+    if (!entry.valid || entry.str != str) {
+        entry.valid = true;
+        entry.str = str;
+        entry.hash = Hash64(str);
+    }
+    return entry.hash;
+}
+
+// Writes the value of a DimensionsValue.
+void writeDimensionValueToProto(const Value& value, std::set<string>* str_set,
+                                ProtoOutputStream* protoOutput) {
+    switch (value.getType()) {
+        case INT:
+            protoOutput->write(FIELD_TYPE_INT32 | DIMENSIONS_VALUE_VALUE_INT, value.int_value);
+            break;
+        case LONG:
+            protoOutput->write(FIELD_TYPE_INT64 | DIMENSIONS_VALUE_VALUE_LONG,
+                               (long long)value.long_value);
+            break;
+        case FLOAT:
+            protoOutput->write(FIELD_TYPE_FLOAT | DIMENSIONS_VALUE_VALUE_FLOAT, value.float_value);
+            break;
+        case STRING:
+            if (str_set == nullptr) {
+                protoOutput->write(FIELD_TYPE_STRING | DIMENSIONS_VALUE_VALUE_STR,
+                                   value.getString());
+            } else {
+                protoOutput->write(FIELD_TYPE_UINT64 | DIMENSIONS_VALUE_VALUE_STR_HASH,
+                                   (long long)hashStringInReport(value.getString(), str_set));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void writeDimensionToProtoHelper(std::span<const FieldValue> dims, size_t* index, int depth,
                                  int prefix, std::set<string>* str_set,
                                  ProtoOutputStream* protoOutput) {
     size_t count = dims.size();
@@ -123,32 +198,7 @@ void writeDimensionToProtoHelper(const std::vector<FieldValue>& dims, size_t* in
             uint64_t token = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
                                                  DIMENSIONS_VALUE_TUPLE_VALUE);
             protoOutput->write(FIELD_TYPE_INT32 | DIMENSIONS_VALUE_FIELD, fieldNum);
-            switch (dim.mValue.getType()) {
-                case INT:
-                    protoOutput->write(FIELD_TYPE_INT32 | DIMENSIONS_VALUE_VALUE_INT,
-                                       dim.mValue.int_value);
-                    break;
-                case LONG:
-                    protoOutput->write(FIELD_TYPE_INT64 | DIMENSIONS_VALUE_VALUE_LONG,
-                                       (long long)dim.mValue.long_value);
-                    break;
-                case FLOAT:
-                    protoOutput->write(FIELD_TYPE_FLOAT | DIMENSIONS_VALUE_VALUE_FLOAT,
-                                       dim.mValue.float_value);
-                    break;
-                case STRING:
-                    if (str_set == nullptr) {
-                        protoOutput->write(FIELD_TYPE_STRING | DIMENSIONS_VALUE_VALUE_STR,
-                                           dim.mValue.str_value);
-                    } else {
-                        str_set->insert(dim.mValue.str_value);
-                        protoOutput->write(FIELD_TYPE_UINT64 | DIMENSIONS_VALUE_VALUE_STR_HASH,
-                                           (long long)Hash64(dim.mValue.str_value));
-                    }
-                    break;
-                default:
-                    break;
-            }
+            writeDimensionValueToProto(dim.mValue, str_set, protoOutput);
             if (token != 0) {
                 protoOutput->end(token);
             }
@@ -171,65 +221,6 @@ void writeDimensionToProtoHelper(const std::vector<FieldValue>& dims, size_t* in
     }
 }
 
-void writeDimensionLeafToProtoHelper(const std::vector<FieldValue>& dims,
-                                     const int dimensionLeafField, size_t* index, int depth,
-                                     int prefix, std::set<string>* str_set,
-                                     ProtoOutputStream* protoOutput) {
-    size_t count = dims.size();
-    while (*index < count) {
-        const auto& dim = dims[*index];
-        const int valueDepth = dim.mField.getDepth();
-        const int valuePrefix = dim.mField.getPrefix(depth);
-        if (valueDepth > 2) {
-            ALOGE("Depth > 2 not supported");
-            return;
-        }
-
-        // If valueDepth == 1, we're writing a repeated field.
-        if ((depth == valueDepth || valueDepth == 1) && valuePrefix == prefix) {
-            uint64_t token = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
-                                                dimensionLeafField);
-            switch (dim.mValue.getType()) {
-                case INT:
-                    protoOutput->write(FIELD_TYPE_INT32 | DIMENSIONS_VALUE_VALUE_INT,
-                                       dim.mValue.int_value);
-                    break;
-                case LONG:
-                    protoOutput->write(FIELD_TYPE_INT64 | DIMENSIONS_VALUE_VALUE_LONG,
-                                       (long long)dim.mValue.long_value);
-                    break;
-                case FLOAT:
-                    protoOutput->write(FIELD_TYPE_FLOAT | DIMENSIONS_VALUE_VALUE_FLOAT,
-                                       dim.mValue.float_value);
-                    break;
-                case STRING:
-                    if (str_set == nullptr) {
-                        protoOutput->write(FIELD_TYPE_STRING | DIMENSIONS_VALUE_VALUE_STR,
-                                           dim.mValue.str_value);
-                    } else {
-                        str_set->insert(dim.mValue.str_value);
-                        protoOutput->write(FIELD_TYPE_UINT64 | DIMENSIONS_VALUE_VALUE_STR_HASH,
-                                           (long long)Hash64(dim.mValue.str_value));
-                    }
-                    break;
-                default:
-                    break;
-            }
-            if (token != 0) {
-                protoOutput->end(token);
-            }
-            (*index)++;
-        } else if (valueDepth == depth + 2 && valuePrefix == prefix) {
-            writeDimensionLeafToProtoHelper(dims, dimensionLeafField,
-                                            index, valueDepth, dim.mField.getPrefix(valueDepth),
-                                            str_set, protoOutput);
-        } else {
-            // Done with the prev sub tree
-            return;
-        }
-    }
-}
-
 void writeDimensionPathToProtoHelper(const std::vector<Matcher>& fieldMatchers,
                                      size_t* index, int depth, int prefix,
                                      ProtoOutputStream* protoOutput) {
@@ -289,12 +280,18 @@ void writeDimensionLeafNodesToProto(const HashableDimensionKey& dimension,
                                     const int dimensionLeafFieldId,
                                     std::set<string> *str_set,
                                     ProtoOutputStream* protoOutput) {
-    if (dimension.getValues().size() == 0) {
-        return;
+    // Leaf nodes are written in the order of the values whatever their depth, so unlike the
+    // nested encoding this needs no walk of the field tree.
+    for (const FieldValue& dim : dimension.getValues()) {
+        if (dim.mField.getDepth() > 2) {
+            ALOGE("Depth > 2 not supported");
+            return;
+        }
+        uint64_t token = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED |
+                                            dimensionLeafFieldId);
+        writeDimensionValueToProto(dim.mValue, str_set, protoOutput);
+        protoOutput->end(token);
     }
-    size_t index = 0;
-    writeDimensionLeafToProtoHelper(dimension.getValues(), dimensionLeafFieldId,
-                                    &index, 0, 0, str_set, protoOutput);
 }
 
 void writeDimensionPathToProto(const std::vector<Matcher>& fieldMatchers,
@@ -336,10 +333,9 @@ void writeDimensionPathToProto(const std::vector<Matcher>& fieldMatchers,
 // }
 //
 //
-void writeFieldValueTreeToStreamHelper(int tagId, const std::vector<FieldValue>& dims,
+void writeFieldValueTreeToStreamHelper(int tagId, const FieldValue* dims, const size_t count,
                                        size_t* index, int depth, int prefix,
                                        ProtoOutputStream* protoOutput) {
-    size_t count = dims.size();
     while (*index < count) {
         const auto& dim = dims[*index];
         const int valueDepth = dim.mField.getDepth();
@@ -369,13 +365,13 @@ void writeFieldValueTreeToStreamHelper(int tagId, const std::vector<FieldValue>&
                     break;
                 case STRING: {
                     protoOutput->write(FIELD_TYPE_STRING | repeatedFieldMask | fieldNum,
-                                       dim.mValue.str_value);
+                                       dim.mValue.getString());
                     break;
                 }
                 case STORAGE:
                     protoOutput->write(FIELD_TYPE_MESSAGE | fieldNum,
-                                       (const char*)dim.mValue.storage_value.data(),
-                                       dim.mValue.storage_value.size());
+                                       (const char*)dim.mValue.getStorage().data(),
+                                       dim.mValue.getStorage().size());
                     break;
                 default:
                     break;
@@ -387,7 +383,7 @@ void writeFieldValueTreeToStreamHelper(int tagId, const std::vector<FieldValue>&
             msg_token = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | fieldNum);
             // Directly jump to the leaf value because the repeated position field is implied
             // by the position of the sub msg in the parent field.
-            writeFieldValueTreeToStreamHelper(tagId, dims, index, valueDepth,
+            writeFieldValueTreeToStreamHelper(tagId, dims, count, index, valueDepth,
                                               dim.mField.getPrefix(valueDepth), protoOutput);
             if (msg_token != 0) {
                 protoOutput->end(msg_token);
@@ -399,12 +395,17 @@ void writeFieldValueTreeToStreamHelper(int tagId, const std::vector<FieldValue>&
     }
 }
 
-void writeFieldValueTreeToStream(int tagId, const std::vector<FieldValue>& values,
+void writeFieldValueTreeToStream(int tagId, std::span<const FieldValue> values,
+                                 util::ProtoOutputStream* protoOutput) {
+    writeFieldValueTreeToStream(tagId, values.data(), values.size(), protoOutput);
+}
+
+void writeFieldValueTreeToStream(int tagId, const FieldValue* values, const size_t count,
                                  util::ProtoOutputStream* protoOutput) {
     uint64_t atomToken = protoOutput->start(FIELD_TYPE_MESSAGE | tagId);
 
     size_t index = 0;
-    writeFieldValueTreeToStreamHelper(tagId, values, &index, 0, 0, protoOutput);
+    writeFieldValueTreeToStreamHelper(tagId, values, count, &index, 0, 0, protoOutput);
     protoOutput->end(atomToken);
 }
 
@@ -471,7 +472,7 @@ void writeNonZeroStatToStream(const uint64_t fieldId, const int64_t value,
     }
 }
 
-void writePullerStatsToStream(const std::pair<int, StatsdStats::PulledAtomStats>& pair,
+void writePullerStatsToStream(const std::pair<const int, StatsdStats::PulledAtomStats>& pair,
                               util::ProtoOutputStream* protoOutput) {
     uint64_t token = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_PULLED_ATOM_STATS |
                                          FIELD_COUNT_REPEATED);
@@ -519,11 +520,27 @@ void writePullerStatsToStream(const std::pair<int, StatsdStats::PulledAtomStats>
     }
     writeNonZeroStatToStream(FIELD_TYPE_INT32 | FIELD_ID_SUBSCRIPTION_PULL_COUNT,
                              pair.second.subscriptionPullCount, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_AVERAGE_PULL_QUEUE_DELAY_NANOS,
+                             pair.second.avgPullQueueDelayNs, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_MAX_PULL_QUEUE_DELAY_NANOS,
+                             pair.second.maxPullQueueDelayNs, protoOutput);
+    if (pair.second.numPullTime > 0) {
+        for (const int32_t count : pair.second.pullTimeHistogram) {
+            protoOutput->write(FIELD_TYPE_INT32 | FIELD_ID_PULL_TIME_HISTOGRAM |
+                                       FIELD_COUNT_REPEATED,
+                               count);
+        }
+    }
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_COOL_DOWN_PENALTY_NANOS,
+                             pair.second.coolDownPenaltyNs, protoOutput);
+    writeNonZeroStatToStream(FIELD_TYPE_INT64 | FIELD_ID_SLOW_PULLER_PENALTY_COUNT,
+                             pair.second.slowPullerPenaltyCount, protoOutput);
     protoOutput->end(token);
 }
 
-void writeAtomMetricStatsToStream(const std::pair<int64_t, StatsdStats::AtomMetricStats> &pair,
-                                  util::ProtoOutputStream *protoOutput) {
+void writeAtomMetricStatsToStream(
+        const std::pair<const int64_t, StatsdStats::AtomMetricStats>& pair,
+        util::ProtoOutputStream* protoOutput) {
     uint64_t token = protoOutput->start(FIELD_TYPE_MESSAGE | FIELD_ID_ATOM_METRIC_STATS |
                                         FIELD_COUNT_REPEATED);
 
@@ -576,6 +593,12 @@ int64_t getWallClockNs() {
     return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
 }
 
+int64_t getThreadCpuTimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
 int64_t getWallClockSec() {
     return time(nullptr);
 }
@@ -630,6 +653,50 @@ void mapIsolatedUidsToHostUidInLogEvent(const sp<UidMap> uidMap, LogEvent& event
     }
 }
 
+void mapIsolatedUidsToHostUid(const sp<UidMap>& uidMap, LogEvent* event) {
+    if (std::pair<size_t, size_t> indexRange; event->hasAttributionChain(&indexRange)) {
+        vector<FieldValue>* const fieldValues = event->getMutableValues();
+        for (size_t i = indexRange.first; i <= indexRange.second; i++) {
+            FieldValue& fieldValue = fieldValues->at(i);
+            if (isAttributionUidField(fieldValue)) {
+                const int hostUid = uidMap->getHostUidOrSelf(fieldValue.mValue.int_value);
+                fieldValue.mValue.setInt(hostUid);
+            }
+        }
+    } else {
+        mapIsolatedUidsToHostUidInLogEvent(uidMap, *event);
+    }
+}
+
+void onIsolatedUidChangedEvent(const sp<UidMap>& uidMap, const LogEvent& event) {
+    status_t err = NO_ERROR, err2 = NO_ERROR, err3 = NO_ERROR;
+    bool is_create = event.GetBool(3, &err);
+    auto parent_uid = int(event.GetLong(1, &err2));
+    auto isolated_uid = int(event.GetLong(2, &err3));
+    if (err == NO_ERROR && err2 == NO_ERROR && err3 == NO_ERROR) {
+        if (is_create) {
+            uidMap->assignIsolatedUid(isolated_uid, parent_uid);
+        } else {
+            uidMap->removeIsolatedUid(isolated_uid);
+        }
+    } else {
+        ALOGE("Failed to parse uid in the isolated uid change event.");
+    }
+}
+
+void handleIsolatedUidsOnIngestion(const sp<UidMap>& uidMap, LogEvent* event) {
+    if (!event->isValid()) {
+        // Left to StatsLogProcessor, which drops it.
+        return;
+    }
+    if (event->GetTagId() == util::ISOLATED_UID_CHANGED) {
+        onIsolatedUidChangedEvent(uidMap, *event);
+    } else {
+        mapIsolatedUidsToHostUid(uidMap, event);
+    }
+    event->setIsolatedUidsHandled();
+}
+
 std::string toHexString(const string& bytes) {
     static const char* kLookup = "0123456789ABCDEF";
     string hex;
@@ -31,8 +31,23 @@ namespace android {
 namespace os {
 namespace statsd {
 
-void writeFieldValueTreeToStream(int tagId, const std::vector<FieldValue>& values,
+void writeFieldValueTreeToStream(int tagId, std::span<const FieldValue> values,
                                  ProtoOutputStream* protoOutput);
+
+// Same as above for the count values starting at values.
+void writeFieldValueTreeToStream(int tagId, const FieldValue* values, const size_t count,
+                                 ProtoOutputStream* protoOutput);
+// Returns Hash64(str). Strings hashed in reports repeat across dimensions, buckets, configs and
+// dumps, so recent hashes are kept in a small cache per thread.
+uint64_t getCachedStringHash(const string& str);
+
+// Adds str to the strings of a report with hash_strings_in_metric_report and returns the hash
+// written in its place.
+inline uint64_t hashStringInReport(const string& str, std::set<string>* str_set) {
+    str_set->insert(str);
+    return getCachedStringHash(str);
+}
+
 void writeDimensionToProto(const HashableDimensionKey& dimension, std::set<string> *str_set,
                            ProtoOutputStream* protoOutput);
 
@@ -68,6 +83,9 @@ int64_t getSystemUptimeMillis();
 // Gets the wall clock timestamp in ns.
 int64_t getWallClockNs();
 
+// Gets the CPU time consumed by the calling thread in ns.
+int64_t getThreadCpuTimeNs();
+
 // Gets the wall clock timestamp in millis.
 int64_t getWallClockMillis();
 
@@ -83,12 +101,13 @@ void writeNonZeroStatToStream(const uint64_t fieldId, const int64_t value,
                               ProtoOutputStream* protoOutput);
 
 // Helper function to write PulledAtomStats to ProtoOutputStream
-void writePullerStatsToStream(const std::pair<int, StatsdStats::PulledAtomStats>& pair,
+void writePullerStatsToStream(const std::pair<const int, StatsdStats::PulledAtomStats>& pair,
                               ProtoOutputStream* protoOutput);
 
 // Helper function to write AtomMetricStats to ProtoOutputStream
-void writeAtomMetricStatsToStream(const std::pair<int64_t, StatsdStats::AtomMetricStats> &pair,
-                                  ProtoOutputStream *protoOutput);
+void writeAtomMetricStatsToStream(
+        const std::pair<const int64_t, StatsdStats::AtomMetricStats>& pair,
+        ProtoOutputStream* protoOutput);
 
 template<class T>
 bool parseProtoOutputStream(ProtoOutputStream& protoOutput, T* message) {
@@ -119,6 +138,19 @@ inline bool isPulledAtom(int atomId) {
 
 void mapIsolatedUidsToHostUidInLogEvent(const sp<UidMap> uidMap, LogEvent& event);
 
+// Maps the isolated uids in the attribution chain, or else in the uid fields, of the event to
+// their host uids.
+void mapIsolatedUidsToHostUid(const sp<UidMap>& uidMap, LogEvent* event);
+
+// Assigns or removes the isolated uid of an ISOLATED_UID_CHANGED event in the uid map.
+void onIsolatedUidChangedEvent(const sp<UidMap>& uidMap, const LogEvent& event);
+
+// Handles the isolated uids of an event as it is read, off the StatsLogProcessor lock: applies
+// ISOLATED_UID_CHANGED to the uid map, or maps the isolated uids of any other event. The event is
+// marked so that StatsLogProcessor does not do it again. The events of a source must go through
+// it in their order, so that each one sees the isolated uid changes logged before it.
+void handleIsolatedUidsOnIngestion(const sp<UidMap>& uidMap, LogEvent* event);
+
 std::string toHexString(const string& bytes);
 
 }  // namespace statsd
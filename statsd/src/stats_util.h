@@ -43,12 +43,37 @@ typedef std::map<int64_t, HashableDimensionKey> ConditionKey;
 
 typedef std::unordered_map<MetricDimensionKey, int64_t> DimToValMap;
 
+// Number of started (possibly nested) slices of a sliced condition, keyed by the output dimensions.
+typedef std::unordered_map<HashableDimensionKey, int> SlicedConditionStateMap;
+
+// Dimensions whose sliced condition changed with the last evaluated event.
+typedef std::vector<HashableDimensionKey> ChangedDimensions;
+
 using ConditionLinks = google::protobuf::RepeatedPtrField<MetricConditionLink>;
 
 using StateLinks = google::protobuf::RepeatedPtrField<MetricStateLink>;
 
 struct Empty {};
 
+// Estimated heap bytes of an unordered map: a node per entry, holding the entry and a next pointer
+// alongside the cached hash, plus the bucket array. What the entries point to is not counted, nor
+// are the dimension keys, which share their values through the DimensionKeyInterner.
+template <typename Map>
+size_t estimateMapByteSize(const Map& map) {
+    return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) +
+           map.bucket_count() * sizeof(void*);
+}
+
+// Shrinks the bucket array of an unordered map, which never shrinks by itself, once the map holds
+// less than a quarter of the entries the array was sized for. The margin keeps a map whose size
+// goes up and down from being rehashed every time.
+template <typename Map>
+void shrinkMapIfSparse(Map& map) {
+    if (map.size() * 4 < map.bucket_count() * map.max_load_factor()) {
+        map.rehash(0);
+    }
+}
+
 inline bool isAtLeastS() {
     const static bool isAtLeastS = android::modules::sdklevel::IsAtLeastS();
     return isAtLeastS;
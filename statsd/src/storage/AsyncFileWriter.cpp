@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "storage/AsyncFileWriter.h"
+
+#include "storage/StorageManager.h"
+#include "utils/ThreadConfig.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+AsyncFileWriter::AsyncFileWriter() : mWriter([this] { writerLoop(); }) {
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mQueueCv.notify_one();
+    mWriter.join();
+}
+
+void AsyncFileWriter::write(std::string fileName, std::vector<uint8_t> data) {
+    enqueue([fileName = std::move(fileName), data = std::move(data)] {
+        StorageManager::writeFileAtomically(fileName.c_str(), data.data(), data.size());
+        VLOG("Wrote %s asynchronously", fileName.c_str());
+    });
+}
+
+void AsyncFileWriter::append(std::string fileName, std::vector<uint8_t> data) {
+    enqueue([fileName = std::move(fileName), data = std::move(data)] {
+        StorageManager::appendToFile(fileName.c_str(), data.data(), data.size());
+    });
+}
+
+void AsyncFileWriter::appendReport(const ConfigKey& key, std::vector<uint8_t> report) {
+    enqueue([key, report = std::move(report)] {
+        StorageManager::appendReportToSegment(key, report.data(), report.size());
+    });
+}
+
+void AsyncFileWriter::enqueue(std::function<void()> write) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.push_back(std::move(write));
+    }
+    mQueueCv.notify_one();
+}
+
+void AsyncFileWriter::waitForPendingWrites() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDrainedCv.wait(lock, [this] { return mQueue.empty() && !mWriting; });
+}
+
+void AsyncFileWriter::writerLoop() {
+    configureStatsdThread("statsd.disk");
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mQueueCv.wait(lock, [this] { return !mQueue.empty() || mStopping; });
+        if (mQueue.empty()) {
+            // Only stop once everything queued is written.
+            return;
+        }
+        std::function<void()> write = std::move(mQueue.front());
+        mQueue.pop_front();
+        mWriting = true;
+        lock.unlock();
+
+        write();
+
+        lock.lock();
+        mWriting = false;
+        if (mQueue.empty()) {
+            mDrainedCv.notify_all();
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "config/ConfigKey.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Writes files on a background thread, so callers holding locks only pay for building the
+ * contents.
+ *
+ * Writes are done in the order they were queued: files atomically with
+ * StorageManager::writeFileAtomically, appends with StorageManager::appendToFile, reports with
+ * StorageManager::appendReportToSegment.
+ * waitForPendingWrites() is the completion barrier: once it returns, every write queued before
+ * the call is on disk.
+ */
+class AsyncFileWriter {
+public:
+    AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    // Writes the files still queued before returning.
+    ~AsyncFileWriter();
+
+    void write(std::string fileName, std::vector<uint8_t> data);
+
+    void append(std::string fileName, std::vector<uint8_t> data);
+
+    void appendReport(const ConfigKey& key, std::vector<uint8_t> report);
+
+    void waitForPendingWrites();
+
+private:
+    void enqueue(std::function<void()> write);
+
+    void writerLoop();
+
+    std::mutex mMutex;
+
+    // Signals the writer that a write was queued or that the writer is stopping.
+    std::condition_variable mQueueCv;
+
+    // Signals waitForPendingWrites that the queue was drained.
+    std::condition_variable mDrainedCv;
+
+    std::deque<std::function<void()>> mQueue;
+
+    // True while the writer does a write it took from mQueue.
+    bool mWriting = false;
+
+    bool mStopping = false;
+
+    std::thread mWriter;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "storage/ChunkedFileWriter.h"
+
+#include <fcntl.h>
+#include <private/android_filesystem_config.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "storage/StorageManager.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::util::ProtoOutputStream;
+using std::string;
+
+#define STATS_DATA_DIR "/data/misc/stats-data"
+#define STATS_SERVICE_DIR "/data/misc/stats-service"
+
+namespace {
+
+string getTmpFileName(const string& path) {
+    const size_t nameStart = path.rfind('/') + 1;
+    return path.substr(0, nameStart) + "." + path.substr(nameStart) + ".tmp";
+}
+
+}  // anonymous namespace
+
+ChunkedFileWriter::ChunkedFileWriter(const string& file)
+    : mFile(file),
+      mTmpFile(getTmpFileName(file)),
+      mFd(open(mTmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR)) {
+    if (mFd == -1) {
+        VLOG("Attempt to access %s but failed", mTmpFile.c_str());
+        return;
+    }
+    StorageManager::trimToFit(STATS_SERVICE_DIR);
+    StorageManager::trimToFit(STATS_DATA_DIR);
+}
+
+ChunkedFileWriter::~ChunkedFileWriter() {
+    if (isOpen()) {
+        discard();
+    }
+}
+
+void ChunkedFileWriter::write(ProtoOutputStream* proto) {
+    if (isOpen() && !mWriteFailed) {
+        const size_t size = proto->size();
+        if (proto->flush(mFd)) {
+            mBytesWritten += size;
+        } else {
+            mWriteFailed = true;
+        }
+    }
+    proto->clear();
+}
+
+bool ChunkedFileWriter::commit() {
+    if (!isOpen()) {
+        return false;
+    }
+    if (mWriteFailed) {
+        ALOGE("Failed to write %s", mFile.c_str());
+        discard();
+        return false;
+    }
+    if (fchown(mFd, AID_STATSD, AID_STATSD)) {
+        VLOG("Failed to chown %s to statsd", mTmpFile.c_str());
+    }
+    close(mFd);
+    mFd = -1;
+    if (rename(mTmpFile.c_str(), mFile.c_str()) != 0) {
+        ALOGE("Failed to write %s", mFile.c_str());
+        unlink(mTmpFile.c_str());
+        return false;
+    }
+    StorageManager::noteFileWritten(mFile, mBytesWritten);
+    VLOG("Successfully wrote %s", mFile.c_str());
+    return true;
+}
+
+void ChunkedFileWriter::discard() {
+    close(mFd);
+    mFd = -1;
+    unlink(mTmpFile.c_str());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
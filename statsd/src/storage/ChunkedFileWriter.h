@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+
+#include <string>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Writes a file from a ProtoOutputStream in pieces, so the caller can drain the stream after
+ * each completed top level field instead of holding the whole contents in memory.
+ *
+ * Data goes to a hidden temporary file next to the file path, which every reader of the stats
+ * directories skips. commit() renames it to the file path; if it is never called, or a write
+ * failed, the temporary file is removed.
+ */
+class ChunkedFileWriter {
+public:
+    explicit ChunkedFileWriter(const std::string& file);
+
+    ChunkedFileWriter(const ChunkedFileWriter&) = delete;
+    ChunkedFileWriter& operator=(const ChunkedFileWriter&) = delete;
+
+    ~ChunkedFileWriter();
+
+    bool isOpen() const {
+        return mFd != -1;
+    }
+
+    // Appends the contents of proto to the file and clears proto. proto must not have an open
+    // submessage.
+    void write(android::util::ProtoOutputStream* proto);
+
+    // Returns false if the file could not be written. Nothing is left at the file path then.
+    bool commit();
+
+    size_t bytesWritten() const {
+        return mBytesWritten;
+    }
+
+private:
+    void discard();
+
+    const std::string mFile;
+    const std::string mTmpFile;
+    int mFd;
+    bool mWriteFailed = false;
+    size_t mBytesWritten = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "storage/ReportCompression.h"
+
+#include <lz4.h>
+#include <string.h>
+
+#include "guardrail/StatsdStats.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+struct CompressedReportHeader {
+    uint32_t magic;
+    uint32_t codec;
+    uint32_t uncompressedSize;
+};
+
+}  // namespace
+
+bool compressReport(ReportCodec codec, const std::vector<uint8_t>& report,
+                    std::vector<uint8_t>* out) {
+    out->clear();
+    if (codec != REPORT_CODEC_LZ4 || report.empty() ||
+        report.size() > (size_t)StatsdStats::kMaxFileSize) {
+        return false;
+    }
+
+    const CompressedReportHeader header = {COMPRESSED_REPORT_MAGIC, codec,
+                                           (uint32_t)report.size()};
+    out->resize(sizeof(header) + LZ4_compressBound(report.size()));
+    memcpy(out->data(), &header, sizeof(header));
+    const int compressedSize = LZ4_compress_default(
+            reinterpret_cast<const char*>(report.data()),
+            reinterpret_cast<char*>(out->data() + sizeof(header)), report.size(),
+            out->size() - sizeof(header));
+    if (compressedSize <= 0 || sizeof(header) + compressedSize >= report.size()) {
+        VLOG("Report of %zu bytes not compressed", report.size());
+        out->clear();
+        StatsdStats::getInstance().noteReportCompression(codec, report.size(), report.size());
+        return false;
+    }
+    out->resize(sizeof(header) + compressedSize);
+    StatsdStats::getInstance().noteReportCompression(codec, report.size(), out->size());
+    return true;
+}
+
+bool isCompressedReport(std::string_view data) {
+    uint32_t magic;
+    if (data.size() < sizeof(CompressedReportHeader)) {
+        return false;
+    }
+    memcpy(&magic, data.data(), sizeof(magic));
+    return magic == COMPRESSED_REPORT_MAGIC;
+}
+
+bool decompressReport(std::string_view data, std::string* out) {
+    if (!isCompressedReport(data)) {
+        return false;
+    }
+    CompressedReportHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.codec != REPORT_CODEC_LZ4 ||
+        header.uncompressedSize > (uint32_t)StatsdStats::kMaxFileSize) {
+        ALOGE("Unexpected compressed report codec %u of size %u", header.codec,
+              header.uncompressedSize);
+        return false;
+    }
+    out->resize(header.uncompressedSize);
+    const int decompressedSize =
+            LZ4_decompress_safe(data.data() + sizeof(header), out->data(),
+                                data.size() - sizeof(header), header.uncompressedSize);
+    if (decompressedSize != (int)header.uncompressedSize) {
+        ALOGE("Failed to decompress report of %u bytes", header.uncompressedSize);
+        out->clear();
+        return false;
+    }
+    return true;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
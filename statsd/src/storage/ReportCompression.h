@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Codecs reports saved to disk can be compressed with. Recorded in StatsdStats, do not renumber.
+enum ReportCodec : uint32_t {
+    REPORT_CODEC_NONE = 0,
+    REPORT_CODEC_LZ4 = 1,
+};
+
+// Magic word at the start of a compressed report. Its first byte is 0, which can not start a
+// serialized proto, so compressed and raw reports are told apart without a file format change.
+const uint32_t COMPRESSED_REPORT_MAGIC = 0x347a6c00;
+
+/**
+ * Compresses a serialized ConfigMetricsReport into out, as the magic word, the codec, the
+ * uncompressed size and the compressed block. Returns false, leaving out empty, if the codec
+ * is REPORT_CODEC_NONE or compression does not make the report smaller.
+ * The outcome is recorded in StatsdStats.
+ */
+bool compressReport(ReportCodec codec, const std::vector<uint8_t>& report,
+                    std::vector<uint8_t>* out);
+
+bool isCompressedReport(std::string_view data);
+
+/**
+ * Decompresses a report written by compressReport. Returns false if it is corrupted or uses
+ * an unknown codec.
+ */
+bool decompressReport(std::string_view data, std::string* out);
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
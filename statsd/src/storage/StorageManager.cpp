@@ -20,14 +20,21 @@
 #include "storage/StorageManager.h"
 
 #include <android-base/file.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <private/android_filesystem_config.h>
+#include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <fstream>
 
 #include "android-base/stringprintf.h"
+#include "external/Perfetto.h"
 #include "guardrail/StatsdStats.h"
 #include "stats_log_util.h"
+#include "storage/ReportCompression.h"
 #include "utils/DbUtils.h"
 
 namespace android {
@@ -49,6 +56,8 @@ using std::map;
 const int FIELD_ID_REPORTS = 2;
 
 std::mutex StorageManager::sTrainInfoMutex;
+bool StorageManager::sTrainInfosLoaded = false;
+std::unordered_map<std::string, StorageManager::TrainInfoFile> StorageManager::sTrainInfos;
 
 using android::base::StringPrintf;
 using std::unique_ptr;
@@ -58,12 +67,20 @@ struct FileName {
     int mUid;
     int64_t mConfigId;
     bool mIsHistory;
+    bool mIsSegment;
     string getFullFileName(const char* path) {
-        return StringPrintf("%s/%lld_%d_%lld%s", path, (long long)mTimestampSec, (int)mUid,
-                            (long long)mConfigId, (mIsHistory ? "_history" : ""));
+        return StringPrintf("%s/%lld_%d_%lld%s%s", path, (long long)mTimestampSec, (int)mUid,
+                            (long long)mConfigId, (mIsSegment ? "_segment" : ""),
+                            (mIsHistory ? "_history" : ""));
     };
 };
 
+std::mutex StorageManager::sSegmentMutex;
+map<ConfigKey, StorageManager::SegmentInfo> StorageManager::sActiveSegments;
+
+std::mutex StorageManager::sCatalogMutex;
+map<string, StorageManager::DirCatalog> StorageManager::sCatalogs;
+
 string StorageManager::getDataFileName(long wallClockSec, int uid, int64_t id) {
     return StringPrintf("%s/%ld_%d_%lld", STATS_DATA_DIR, wallClockSec, uid,
                         (long long)id);
@@ -74,39 +91,23 @@ string StorageManager::getDataHistoryFileName(long wallClockSec, int uid, int64_
                         (long long)id);
 }
 
-static string findTrainInfoFileNameLocked(const string& trainName) {
-    unique_ptr<DIR, decltype(&closedir)> dir(opendir(TRAIN_INFO_DIR), closedir);
-    if (dir == NULL) {
-        VLOG("Path %s does not exist", TRAIN_INFO_DIR);
-        return "";
-    }
-    dirent* de;
-    while ((de = readdir(dir.get()))) {
-        char* fileName = de->d_name;
-        if (fileName[0] == '.' || de->d_type == DT_DIR) continue;
-
-        size_t fileNameLength = strlen(fileName);
-        if (fileNameLength >= trainName.length()) {
-            if (0 == strncmp(fileName + fileNameLength - trainName.length(), trainName.c_str(),
-                             trainName.length())) {
-              return string(fileName);
-            }
-        }
-    }
-
-    return "";
+string StorageManager::getDataSegmentFileName(long wallClockSec, int uid, int64_t id) {
+    return StringPrintf("%s/%ld_%d_%lld_segment", STATS_DATA_DIR, wallClockSec, uid,
+                        (long long)id);
 }
 
 // Returns array of int64_t which contains timestamp in seconds, uid,
-// configID and whether the file is a local history file.
+// configID and whether the file is a local history file and/or a report segment.
+// Uses strtok_r since reports can be written and trimmed from the async disk writer thread.
 static void parseFileName(char* name, FileName* output) {
     int64_t result[3];
     int index = 0;
-    char* substr = strtok(name, "_");
+    char* savePtr = nullptr;
+    char* substr = strtok_r(name, "_", &savePtr);
     while (substr != nullptr && index < 3) {
         result[index] = StrToInt64(substr);
         index++;
-        substr = strtok(nullptr, "_");
+        substr = strtok_r(nullptr, "_", &savePtr);
     }
     // When index ends before hitting 3, file name is corrupted. We
     // intentionally put -1 at index 0 to indicate the error to caller.
@@ -118,6 +119,11 @@ static void parseFileName(char* name, FileName* output) {
     output->mTimestampSec = result[0];
     output->mUid = result[1];
     output->mConfigId = result[2];
+    // check if the file is a report segment.
+    output->mIsSegment = (substr != nullptr && strcmp("segment", substr) == 0);
+    if (output->mIsSegment) {
+        substr = strtok_r(nullptr, "_", &savePtr);
+    }
     // check if the file is a local history.
     output->mIsHistory = (substr != nullptr && strcmp("history", substr) == 0);
 }
@@ -133,6 +139,7 @@ static ConfigKey parseDbName(char* name) {
 }
 
 void StorageManager::writeFile(const char* file, const void* buffer, int numBytes) {
+    ScopedStageTrace trace("StorageManager::writeFile");
     int fd = open(file, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
     if (fd == -1) {
         VLOG("Attempt to access %s but failed", file);
@@ -152,24 +159,77 @@ void StorageManager::writeFile(const char* file, const void* buffer, int numByte
         VLOG("Failed to chown %s to statsd", file);
     }
 
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0) {
+        noteFileWritten(file, fileStat.st_size);
+    }
     close(fd);
 }
 
-bool StorageManager::writeTrainInfo(const InstallTrainInfo& trainInfo) {
-    std::lock_guard<std::mutex> lock(sTrainInfoMutex);
+bool StorageManager::writeFileAtomically(const char* file, const void* buffer, int numBytes) {
+    ScopedStageTrace trace("StorageManager::writeFileAtomically");
+    // Every reader of the stats directories skips files starting with '.'.
+    const string path(file);
+    const size_t nameStart = path.rfind('/') + 1;
+    const string tmpFile = path.substr(0, nameStart) + "." + path.substr(nameStart) + ".tmp";
 
-    if (trainInfo.trainName.empty()) {
-      return false;
+    int fd = open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        VLOG("Attempt to access %s but failed", tmpFile.c_str());
+        return false;
     }
-    deleteSuffixedFiles(TRAIN_INFO_DIR, trainInfo.trainName.c_str());
+    trimToFit(STATS_SERVICE_DIR);
+    trimToFit(STATS_DATA_DIR);
 
-    std::string fileName =
-            StringPrintf("%s/%ld_%s", TRAIN_INFO_DIR, (long) getWallClockSec(),
-                         trainInfo.trainName.c_str());
+    bool success = android::base::WriteFully(fd, buffer, numBytes) && fsync(fd) == 0;
+    if (fchown(fd, AID_STATSD, AID_STATSD)) {
+        VLOG("Failed to chown %s to statsd", tmpFile.c_str());
+    }
+    close(fd);
+
+    if (success && rename(tmpFile.c_str(), file) != 0) {
+        success = false;
+    }
+    if (!success) {
+        ALOGE("Failed to write %s", file);
+        unlink(tmpFile.c_str());
+        return false;
+    }
+    noteFileWritten(file, numBytes);
+    VLOG("Successfully wrote %s", file);
+    return true;
+}
 
-    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+bool StorageManager::appendToFile(const char* file, const void* buffer, int numBytes) {
+    ScopedStageTrace trace("StorageManager::appendToFile");
+    int fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
     if (fd == -1) {
-        VLOG("Attempt to access %s but failed", fileName.c_str());
+        VLOG("Attempt to access %s but failed", file);
+        return false;
+    }
+
+    const bool success = android::base::WriteFully(fd, buffer, numBytes) && fsync(fd) == 0;
+    if (fchown(fd, AID_STATSD, AID_STATSD)) {
+        VLOG("Failed to chown %s to statsd", file);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0) {
+        noteFileWritten(file, fileStat.st_size);
+    }
+    close(fd);
+
+    if (!success) {
+        ALOGE("Failed to append to %s", file);
+        return false;
+    }
+    VLOG("Successfully appended to %s", file);
+    return true;
+}
+
+static bool writeTrainInfoFile(const char* fileName, const InstallTrainInfo& trainInfo) {
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        VLOG("Attempt to access %s but failed", fileName);
         return false;
     }
 
@@ -269,20 +329,10 @@ bool StorageManager::writeTrainInfo(const InstallTrainInfo& trainInfo) {
     return true;
 }
 
-bool StorageManager::readTrainInfo(const std::string& trainName, InstallTrainInfo& trainInfo) {
-    std::lock_guard<std::mutex> lock(sTrainInfoMutex);
-    return readTrainInfoLocked(trainName, trainInfo);
-}
-
-bool StorageManager::readTrainInfoLocked(const std::string& trainName, InstallTrainInfo& trainInfo) {
-    trimToFit(TRAIN_INFO_DIR, /*parseTimestampOnly=*/ true);
-    string fileName = findTrainInfoFileNameLocked(trainName);
-    if (fileName.empty()) {
-        return false;
-    }
-    int fd = open(StringPrintf("%s/%s", TRAIN_INFO_DIR, fileName.c_str()).c_str(), O_RDONLY | O_CLOEXEC);
+static bool readTrainInfoFile(const char* fileName, InstallTrainInfo& trainInfo) {
+    int fd = open(fileName, O_RDONLY | O_CLOEXEC);
     if (fd == -1) {
-        VLOG("Failed to open %s", fileName.c_str());
+        VLOG("Failed to open %s", fileName);
         return false;
     }
 
@@ -432,13 +482,86 @@ bool StorageManager::readTrainInfoLocked(const std::string& trainName, InstallTr
     return true;
 }
 
+bool StorageManager::writeTrainInfo(const InstallTrainInfo& trainInfo) {
+    std::lock_guard<std::mutex> lock(sTrainInfoMutex);
+
+    if (trainInfo.trainName.empty()) {
+      return false;
+    }
+    if (!sTrainInfosLoaded) {
+        loadTrainInfosLocked();
+    }
+    auto it = sTrainInfos.find(trainInfo.trainName);
+    if (it != sTrainInfos.end()) {
+        deleteFile(it->second.mFileName.c_str());
+        sTrainInfos.erase(it);
+    }
+
+    TrainInfoFile trainInfoFile;
+    trainInfoFile.mTimestampSec = getWallClockSec();
+    trainInfoFile.mFileName = StringPrintf("%s/%ld_%s", TRAIN_INFO_DIR, trainInfoFile.mTimestampSec,
+                                           trainInfo.trainName.c_str());
+    if (!writeTrainInfoFile(trainInfoFile.mFileName.c_str(), trainInfo)) {
+        return false;
+    }
+    trainInfoFile.mTrainInfo = trainInfo;
+    sTrainInfos[trainInfo.trainName] = std::move(trainInfoFile);
+
+
+    // Train info files are small, so trimToFit() would only ever delete them for their number.
+    // The oldest ones are deleted here instead, which does not need to scan the directory.
+    while (sTrainInfos.size() > StatsdStats::kMaxFileNumber) {
+        auto oldest = std::min_element(sTrainInfos.begin(), sTrainInfos.end(),
+                                       [](const auto& a, const auto& b) {
+                                           return a.second.mTimestampSec < b.second.mTimestampSec;
+                                       });
+        deleteFile(oldest->second.mFileName.c_str());
+        sTrainInfos.erase(oldest);
+    }
+    return true;
+}
+
+bool StorageManager::readTrainInfo(const std::string& trainName, InstallTrainInfo& trainInfo) {
+    std::lock_guard<std::mutex> lock(sTrainInfoMutex);
+    if (!sTrainInfosLoaded) {
+        loadTrainInfosLocked();
+    }
+    removeExpiredTrainInfosLocked();
+    const auto it = sTrainInfos.find(trainName);
+    if (it == sTrainInfos.end()) {
+        return false;
+    }
+    trainInfo = it->second.mTrainInfo;
+    return true;
+}
+
 vector<InstallTrainInfo> StorageManager::readAllTrainInfo() {
     std::lock_guard<std::mutex> lock(sTrainInfoMutex);
+    if (!sTrainInfosLoaded) {
+        loadTrainInfosLocked();
+    }
+    removeExpiredTrainInfosLocked();
     vector<InstallTrainInfo> trainInfoList;
+    trainInfoList.reserve(sTrainInfos.size());
+    for (const auto& [_, trainInfoFile] : sTrainInfos) {
+        trainInfoList.push_back(trainInfoFile.mTrainInfo);
+    }
+    return trainInfoList;
+}
+
+void StorageManager::loadTrainInfos() {
+    std::lock_guard<std::mutex> lock(sTrainInfoMutex);
+    loadTrainInfosLocked();
+}
+
+void StorageManager::loadTrainInfosLocked() {
+    sTrainInfos.clear();
+    sTrainInfosLoaded = true;
+    trimToFit(TRAIN_INFO_DIR, /*parseTimestampOnly=*/true);
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(TRAIN_INFO_DIR), closedir);
     if (dir == NULL) {
         VLOG("Directory does not exist: %s", TRAIN_INFO_DIR);
-        return trainInfoList;
+        return;
     }
 
     dirent* de;
@@ -448,24 +571,147 @@ vector<InstallTrainInfo> StorageManager::readAllTrainInfo() {
             continue;
         }
 
-        InstallTrainInfo trainInfo;
-        bool readSuccess = StorageManager::readTrainInfoLocked(name, trainInfo);
-        if (!readSuccess) {
+        TrainInfoFile trainInfoFile;
+        trainInfoFile.mFileName = StringPrintf("%s/%s", TRAIN_INFO_DIR, name);
+        trainInfoFile.mTimestampSec = strtol(name, nullptr, 10);
+        if (!readTrainInfoFile(trainInfoFile.mFileName.c_str(), trainInfoFile.mTrainInfo)) {
             continue;
         }
-        trainInfoList.push_back(trainInfo);
+        // Only the newest file of a train is kept when it is written, so a duplicate is stale.
+        const string trainName = trainInfoFile.mTrainInfo.trainName;
+        auto [it, inserted] = sTrainInfos.emplace(trainName, trainInfoFile);
+        if (!inserted && it->second.mTimestampSec < trainInfoFile.mTimestampSec) {
+            it->second = std::move(trainInfoFile);
+        }
+    }
+}
+
+void StorageManager::removeExpiredTrainInfosLocked() {
+    const long nowSec = getWallClockSec();
+    for (auto it = sTrainInfos.begin(); it != sTrainInfos.end();) {
+        if (nowSec - it->second.mTimestampSec > StatsdStats::kMaxAgeSecond) {
+            deleteFile(it->second.mFileName.c_str());
+            it = sTrainInfos.erase(it);
+        } else {
+            ++it;
+        }
     }
-    return trainInfoList;
 }
 
 void StorageManager::deleteFile(const char* file) {
     if (remove(file) != 0) {
         VLOG("Attempt to delete %s but is not found", file);
     } else {
+        noteFileDeleted(file);
         VLOG("Successfully deleted %s", file);
     }
 }
 
+void StorageManager::loadFileCatalogs() {
+    std::lock_guard<std::mutex> lock(sCatalogMutex);
+    for (const char* dir : {STATS_DATA_DIR, STATS_SERVICE_DIR}) {
+        loadCatalogLocked(dir, &sCatalogs[dir]);
+    }
+}
+
+StorageManager::DirCatalog* StorageManager::getCatalogLocked(const string& dir) {
+    if (dir != STATS_DATA_DIR && dir != STATS_SERVICE_DIR) {
+        return nullptr;
+    }
+    DirCatalog& catalog = sCatalogs[dir];
+    if (!catalog.mLoaded) {
+        loadCatalogLocked(dir, &catalog);
+    }
+    return &catalog;
+}
+
+void StorageManager::loadCatalogLocked(const string& dir, DirCatalog* catalog) {
+    catalog->mFiles.clear();
+    catalog->mLoaded = true;
+    unique_ptr<DIR, decltype(&closedir)> dirp(opendir(dir.c_str()), closedir);
+    if (dirp == NULL) {
+        VLOG("Path %s does not exist", dir.c_str());
+        return;
+    }
+
+    dirent* de;
+    while ((de = readdir(dirp.get()))) {
+        char* name = de->d_name;
+        if (name[0] == '.' || de->d_type == DT_DIR) continue;
+
+        struct stat fileStat;
+        if (stat(StringPrintf("%s/%s", dir.c_str(), name).c_str(), &fileStat) != 0) continue;
+        catalog->mFiles[name] = makeCatalogedFile(name, fileStat.st_size);
+    }
+}
+
+StorageManager::CatalogedFile StorageManager::makeCatalogedFile(const string& name,
+                                                                int64_t sizeBytes) {
+    // parseFileName() tokenizes the name in place.
+    vector<char> nameBuffer(name.c_str(), name.c_str() + name.size() + 1);
+    FileName output;
+    parseFileName(nameBuffer.data(), &output);
+    return {output.mTimestampSec, output.mUid, output.mConfigId, output.mIsHistory,
+            output.mIsSegment, sizeBytes};
+}
+
+bool StorageManager::getCatalogedFiles(const char* dir,
+                                       vector<std::pair<string, CatalogedFile>>* files) {
+    std::lock_guard<std::mutex> lock(sCatalogMutex);
+    const DirCatalog* catalog = getCatalogLocked(dir);
+    if (catalog == nullptr) {
+        return false;
+    }
+    files->reserve(catalog->mFiles.size());
+    for (const auto& [name, file] : catalog->mFiles) {
+        files->emplace_back(StringPrintf("%s/%s", dir, name.c_str()), file);
+    }
+    return true;
+}
+
+void StorageManager::noteFileWritten(const string& file, int64_t sizeBytes) {
+    const size_t nameStart = file.rfind('/') + 1;
+    if (nameStart == 0 || nameStart == file.size() || file[nameStart] == '.') {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sCatalogMutex);
+    DirCatalog* catalog = getCatalogLocked(file.substr(0, nameStart - 1));
+    if (catalog != nullptr) {
+        const string name = file.substr(nameStart);
+        catalog->mFiles[name] = makeCatalogedFile(name, sizeBytes);
+    }
+}
+
+void StorageManager::noteFileDeleted(const string& file) {
+    const size_t nameStart = file.rfind('/') + 1;
+    if (nameStart == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sCatalogMutex);
+    DirCatalog* catalog = getCatalogLocked(file.substr(0, nameStart - 1));
+    if (catalog != nullptr) {
+        catalog->mFiles.erase(file.substr(nameStart));
+    }
+}
+
+void StorageManager::noteFileRenamed(const string& from, const string& to) {
+    int64_t sizeBytes = 0;
+    {
+        const size_t nameStart = from.rfind('/') + 1;
+        std::lock_guard<std::mutex> lock(sCatalogMutex);
+        DirCatalog* catalog = getCatalogLocked(from.substr(0, nameStart - 1));
+        if (catalog == nullptr) {
+            return;
+        }
+        auto it = catalog->mFiles.find(from.substr(nameStart));
+        if (it != catalog->mFiles.end()) {
+            sizeBytes = it->second.mSizeBytes;
+            catalog->mFiles.erase(it);
+        }
+    }
+    noteFileWritten(to, sizeBytes);
+}
+
 void StorageManager::deleteAllFiles(const char* path) {
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(path), closedir);
     if (dir == NULL) {
@@ -482,6 +728,19 @@ void StorageManager::deleteAllFiles(const char* path) {
 }
 
 void StorageManager::deleteSuffixedFiles(const char* path, const char* suffix) {
+    const size_t suffixLen = strlen(suffix);
+    vector<std::pair<string, CatalogedFile>> files;
+    if (getCatalogedFiles(path, &files)) {
+        for (const auto& [file, _] : files) {
+            const size_t nameLen = file.size() - (file.rfind('/') + 1);
+            if (suffixLen <= nameLen &&
+                file.compare(file.size() - suffixLen, suffixLen, suffix) == 0) {
+                deleteFile(file.c_str());
+            }
+        }
+        return;
+    }
+
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(path), closedir);
     if (dir == NULL) {
         VLOG("Directory does not exist: %s", path);
@@ -495,7 +754,6 @@ void StorageManager::deleteSuffixedFiles(const char* path, const char* suffix) {
             continue;
         }
         size_t nameLen = strlen(name);
-        size_t suffixLen = strlen(suffix);
         if (suffixLen <= nameLen && strncmp(name + nameLen - suffixLen, suffix, suffixLen) == 0) {
             deleteFile(StringPrintf("%s/%s", path, name).c_str());
         }
@@ -504,6 +762,15 @@ void StorageManager::deleteSuffixedFiles(const char* path, const char* suffix) {
 
 void StorageManager::sendBroadcast(const char* path,
                                    const std::function<void(const ConfigKey&)>& sendBroadcast) {
+    vector<std::pair<string, CatalogedFile>> files;
+    if (getCatalogedFiles(path, &files)) {
+        for (const auto& [_, file] : files) {
+            if (file.mTimestampSec == -1 || file.mIsHistory) continue;
+            sendBroadcast(ConfigKey((int)file.mUid, file.mConfigId));
+        }
+        return;
+    }
+
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(path), closedir);
     if (dir == NULL) {
         VLOG("no stats-data directory on disk");
@@ -524,69 +791,121 @@ void StorageManager::sendBroadcast(const char* path,
 }
 
 bool StorageManager::hasConfigMetricsReport(const ConfigKey& key) {
-    unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_DATA_DIR), closedir);
-    if (dir == NULL) {
-        VLOG("Path %s does not exist", STATS_DATA_DIR);
-        return false;
+    std::lock_guard<std::mutex> lock(sCatalogMutex);
+    for (const auto& [_, file] : getCatalogLocked(STATS_DATA_DIR)->mFiles) {
+        if (file.mTimestampSec == -1 || file.mIsHistory) continue;
+        if (file.mUid == key.GetUid() && file.mConfigId == key.GetId()) {
+            return true;
+        }
     }
+    return false;
+}
 
-    string suffix = StringPrintf("%d_%lld", key.GetUid(), (long long)key.GetId());
+// Maps a report file into memory. An empty file has no mapping and empty content.
+static bool mapReportFile(const string& fileName, MappedReports* reports,
+                          std::string_view* content) {
+    android::base::unique_fd fd(open(fileName.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat fileStat;
+    if (fd == -1 || fstat(fd.get(), &fileStat) != 0) {
+        ALOGE("file cannot be opened");
+        return false;
+    }
+    *content = std::string_view();
+    if (fileStat.st_size == 0) {
+        return true;
+    }
+    // The mapping outlives the descriptor, and the file if it is erased.
+    std::unique_ptr<android::base::MappedFile> file =
+            android::base::MappedFile::FromFd(fd, 0, fileStat.st_size, PROT_READ);
+    if (file == nullptr) {
+        ALOGE("Failed to map %s", fileName.c_str());
+        return false;
+    }
+    *content = std::string_view(file->data(), file->size());
+    reports->mFiles.push_back(std::move(file));
+    return true;
+}
 
-    dirent* de;
-    while ((de = readdir(dir.get()))) {
-        char* name = de->d_name;
-        if (name[0] == '.' || de->d_type == DT_DIR) continue;
+// Adds a report, decompressing it if it was saved compressed.
+static void addReport(std::string_view report, MappedReports* reports) {
+    if (!isCompressedReport(report)) {
+        reports->mReports.push_back(report);
+        return;
+    }
+    std::string decompressed;
+    if (!decompressReport(report, &decompressed)) {
+        return;
+    }
+    reports->mDecompressed.push_back(std::move(decompressed));
+    reports->mReports.push_back(reports->mDecompressed.back());
+}
 
-        size_t nameLen = strlen(name);
-        size_t suffixLen = suffix.length();
-        if (suffixLen <= nameLen &&
-            strncmp(name + nameLen - suffixLen, suffix.c_str(), suffixLen) == 0) {
-            // Check again that the file name is parseable.
-            FileName output;
-            parseFileName(name, &output);
-            if (output.mTimestampSec == -1 || output.mIsHistory) continue;
-            return true;
+// Adds every complete report in a segment. A report that was only partially written ends the
+// segment.
+static void addSegmentReports(const string& fileName, std::string_view content,
+                              MappedReports* reports) {
+    uint32_t magic;
+    if (content.size() < sizeof(magic)) {
+        ALOGE("Segment %s is truncated", fileName.c_str());
+        return;
+    }
+    memcpy(&magic, content.data(), sizeof(magic));
+    if (magic != REPORT_SEGMENT_FILE_MAGIC) {
+        ALOGE("Segment magic was 0x%08x, expected 0x%08x", magic, REPORT_SEGMENT_FILE_MAGIC);
+        return;
+    }
+    size_t offset = sizeof(magic);
+    uint32_t reportSize;
+    while (content.size() - offset >= sizeof(reportSize)) {
+        memcpy(&reportSize, content.data() + offset, sizeof(reportSize));
+        offset += sizeof(reportSize);
+        if (reportSize > content.size() - offset) {
+            ALOGE("Segment %s ends with a partial report", fileName.c_str());
+            return;
         }
+        addReport(content.substr(offset, reportSize), reports);
+        offset += reportSize;
     }
-    return false;
 }
 
 void StorageManager::appendConfigMetricsReport(const ConfigKey& key, ProtoOutputStream* proto,
                                                bool erase_data, bool isAdb) {
-    unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_DATA_DIR), closedir);
-    if (dir == NULL) {
-        VLOG("Path %s does not exist", STATS_DATA_DIR);
-        return;
+    MappedReports reports;
+    mapConfigMetricsReports(key, erase_data, isAdb, &reports);
+    for (const std::string_view& report : reports.mReports) {
+        proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS, report.data(),
+                     report.size());
     }
+}
 
-    dirent* de;
-    while ((de = readdir(dir.get()))) {
-        char* name = de->d_name;
-        string fileName(name);
-        if (name[0] == '.' || de->d_type == DT_DIR) continue;
-        FileName output;
-        parseFileName(name, &output);
-
+void StorageManager::mapConfigMetricsReports(const ConfigKey& key, bool erase_data, bool isAdb,
+                                             MappedReports* reports) {
+    std::lock_guard<std::mutex> lock(sSegmentMutex);
+    if (erase_data || !isAdb) {
+        // The active segment is about to be removed or renamed to a history file.
+        sActiveSegments.erase(key);
+    }
+    vector<std::pair<string, CatalogedFile>> files;
+    getCatalogedFiles(STATS_DATA_DIR, &files);
+    for (const auto& [fullPathName, output] : files) {
         if (output.mTimestampSec == -1 || (output.mIsHistory && !isAdb) ||
             output.mUid != key.GetUid() || output.mConfigId != key.GetId()) {
             continue;
         }
 
-        auto fullPathName = StringPrintf("%s/%s", STATS_DATA_DIR, fileName.c_str());
-        int fd = open(fullPathName.c_str(), O_RDONLY | O_CLOEXEC);
-        if (fd != -1) {
-            string content;
-            if (android::base::ReadFdToString(fd, &content)) {
-                proto->write(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | FIELD_ID_REPORTS,
-                             content.c_str(), content.size());
+        std::string_view content;
+        if (mapReportFile(fullPathName, reports, &content)) {
+            if (output.mIsSegment) {
+                addSegmentReports(fullPathName, content, reports);
+            } else {
+                addReport(content, reports);
             }
-            close(fd);
-        } else {
-            ALOGE("file cannot be opened");
         }
 
         if (erase_data) {
-            remove(fullPathName.c_str());
+            if (remove(fullPathName.c_str()) == 0) {
+                noteFileDeleted(fullPathName);
+            }
         } else if (!output.mIsHistory && !isAdb) {
             // This means a real data owner has called to get this data. But the config says it
             // wants to keep a local history. So now this file must be renamed as a history file.
@@ -594,11 +913,80 @@ void StorageManager::appendConfigMetricsReport(const ConfigKey& key, ProtoOutput
             // again. rename returns 0 on success
             if (rename(fullPathName.c_str(), (fullPathName + "_history").c_str())) {
                 ALOGE("Failed to rename file %s", fullPathName.c_str());
+            } else {
+                noteFileRenamed(fullPathName, fullPathName + "_history");
             }
         }
     }
 }
 
+bool StorageManager::appendReportToSegment(const ConfigKey& key, const void* buffer,
+                                           int numBytes) {
+    std::lock_guard<std::mutex> lock(sSegmentMutex);
+    const long nowSec = getWallClockSec();
+    const uint32_t reportSize = numBytes;
+
+    int fd = -1;
+    auto it = sActiveSegments.find(key);
+    if (it != sActiveSegments.end() && nowSec - it->second.mCreatedSec <= kMaxSegmentAgeSec) {
+        // Fails once the segment was read, renamed to history or trimmed.
+        fd = open(it->second.mFileName.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        struct stat fileStat;
+        if (fd != -1 &&
+            (fstat(fd, &fileStat) != 0 ||
+             fileStat.st_size + (off_t)sizeof(reportSize) + reportSize > kMaxSegmentBytes)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd == -1) {
+        SegmentInfo segment = {getDataSegmentFileName(nowSec, key.GetUid(), key.GetId()), nowSec};
+        // Starting a segment is the only time an append lists the stats directories.
+        trimToFit(STATS_SERVICE_DIR);
+        trimToFit(STATS_DATA_DIR);
+
+        fd = open(segment.mFileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR);
+        if (fd == -1) {
+            VLOG("Attempt to access %s but failed", segment.mFileName.c_str());
+            sActiveSegments.erase(key);
+            return false;
+        }
+        if (fchown(fd, AID_STATSD, AID_STATSD)) {
+            VLOG("Failed to chown %s to statsd", segment.mFileName.c_str());
+        }
+        // A segment rolled over within the same second is appended to rather than restarted.
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size == 0 &&
+            !android::base::WriteFully(fd, &REPORT_SEGMENT_FILE_MAGIC,
+                                       sizeof(REPORT_SEGMENT_FILE_MAGIC))) {
+            ALOGE("Failed to write segment magic to %s", segment.mFileName.c_str());
+            close(fd);
+            unlink(segment.mFileName.c_str());
+            sActiveSegments.erase(key);
+            return false;
+        }
+        it = sActiveSegments.insert_or_assign(key, std::move(segment)).first;
+    }
+
+    const bool success = android::base::WriteFully(fd, &reportSize, sizeof(reportSize)) &&
+                         android::base::WriteFully(fd, buffer, numBytes);
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0) {
+        noteFileWritten(it->second.mFileName, fileStat.st_size);
+    }
+    close(fd);
+    if (!success) {
+        // Readers stop at the partial report, so later reports go to a new segment.
+        ALOGE("Failed to append report to %s", it->second.mFileName.c_str());
+        sActiveSegments.erase(it);
+        return false;
+    }
+    VLOG("Appended %d bytes to %s", numBytes, it->second.mFileName.c_str());
+    return true;
+}
+
 bool StorageManager::readFileToString(const char* file, string* content) {
     int fd = open(file, O_RDONLY | O_CLOEXEC);
     bool res = false;
@@ -610,10 +998,17 @@ bool StorageManager::readFileToString(const char* file, string* content) {
         }
         close(fd);
     }
+    if (res && isCompressedReport(*content)) {
+        string decompressed;
+        res = decompressReport(*content, &decompressed);
+        content->swap(decompressed);
+    }
     return res;
 }
 
-void StorageManager::readConfigFromDisk(map<ConfigKey, StatsdConfig>& configsMap) {
+void StorageManager::readConfigFromDisk(
+        const std::function<void(const ConfigKey&, const StatsdConfig&, const string&)>&
+                onConfig) {
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(STATS_SERVICE_DIR), closedir);
     if (dir == NULL) {
         VLOG("no default config on disk");
@@ -621,6 +1016,9 @@ void StorageManager::readConfigFromDisk(map<ConfigKey, StatsdConfig>& configsMap
     }
     trimToFit(STATS_SERVICE_DIR);
 
+    // Only the file names are listed first, so that the configs are parsed and handed over one
+    // at a time rather than all held in memory while the first ones are built.
+    map<ConfigKey, FileName> configFiles;
     dirent* de;
     while ((de = readdir(dir.get()))) {
         char* name = de->d_name;
@@ -629,19 +1027,33 @@ void StorageManager::readConfigFromDisk(map<ConfigKey, StatsdConfig>& configsMap
         FileName output;
         parseFileName(name, &output);
         if (output.mTimestampSec == -1) continue;
-        string file_name = output.getFullFileName(STATS_SERVICE_DIR);
-        int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
-        if (fd != -1) {
-            string content;
-            if (android::base::ReadFdToString(fd, &content)) {
-                StatsdConfig config;
-                if (config.ParseFromString(content)) {
-                    configsMap[ConfigKey(output.mUid, output.mConfigId)] = config;
-                    VLOG("map key uid=%lld|configID=%lld", (long long)output.mUid,
-                         (long long)output.mConfigId);
-                }
-            }
-            close(fd);
+        const auto [it, inserted] =
+                configFiles.try_emplace(ConfigKey(output.mUid, output.mConfigId), output);
+        if (inserted) {
+            continue;
+        }
+        // Saving a config deletes its previous files, so an older file is left over.
+        if (it->second.mTimestampSec < output.mTimestampSec) {
+            std::swap(it->second, output);
+        }
+        deleteFile(output.getFullFileName(STATS_SERVICE_DIR).c_str());
+    }
+    dir.reset();
+
+    for (auto& [key, file] : configFiles) {
+        const string fileName = file.getFullFileName(STATS_SERVICE_DIR);
+        int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        // Parse straight from the file, without copying the file content into a string.
+        StatsdConfig config;
+        const bool parsed = config.ParseFromFileDescriptor(fd);
+        close(fd);
+        if (parsed) {
+            VLOG("map key uid=%lld|configID=%lld", (long long)key.GetUid(),
+                 (long long)key.GetId());
+            onConfig(key, config, fileName);
         }
     }
 }
@@ -720,16 +1132,67 @@ void StorageManager::sortFiles(vector<FileInfo>* fileNames) {
     });
 }
 
+bool StorageManager::getCatalogedFilesToTrim(const char* path, long nowSec,
+                                             vector<FileInfo>* fileInfos, int* totalFileSize) {
+    vector<string> expiredFiles;
+    {
+        std::lock_guard<std::mutex> lock(sCatalogMutex);
+        const DirCatalog* catalog = getCatalogLocked(path);
+        if (catalog == nullptr) {
+            return false;
+        }
+        for (const auto& [name, file] : catalog->mFiles) {
+            if (file.mTimestampSec == -1) continue;
+
+            string fileName = StringPrintf("%s/%s", path, name.c_str());
+            long fileAge = nowSec - file.mTimestampSec;
+            if (fileAge > StatsdStats::kMaxAgeSecond ||
+                (file.mIsHistory && fileAge > StatsdStats::kMaxLocalHistoryAgeSecond)) {
+                expiredFiles.push_back(std::move(fileName));
+                continue;
+            }
+            *totalFileSize += file.mSizeBytes;
+            fileInfos->emplace_back(std::move(fileName), file.mIsHistory, file.mSizeBytes,
+                                    fileAge);
+        }
+    }
+    for (const string& fileName : expiredFiles) {
+        deleteFile(fileName.c_str());
+    }
+    return true;
+}
+
 void StorageManager::trimToFit(const char* path, bool parseTimestampOnly) {
+    int totalFileSize = 0;
+    vector<FileInfo> fileNames;
+    auto nowSec = getWallClockSec();
+    if (!getCatalogedFilesToTrim(path, nowSec, &fileNames, &totalFileSize)) {
+        getUncatalogedFilesToTrim(path, parseTimestampOnly, nowSec, &fileNames, &totalFileSize);
+    }
+
+    if (fileNames.size() > StatsdStats::kMaxFileNumber ||
+        totalFileSize > StatsdStats::kMaxFileSize) {
+        sortFiles(&fileNames);
+    }
+
+    // Start removing files from oldest to be under the limit.
+    while (fileNames.size() > 0 && (fileNames.size() > StatsdStats::kMaxFileNumber ||
+                                    totalFileSize > StatsdStats::kMaxFileSize)) {
+        totalFileSize -= fileNames.at(fileNames.size() - 1).mFileSizeBytes;
+        deleteFile(fileNames.at(fileNames.size() - 1).mFileName.c_str());
+        fileNames.pop_back();
+    }
+}
+
+void StorageManager::getUncatalogedFilesToTrim(const char* path, bool parseTimestampOnly,
+                                               long nowSec, vector<FileInfo>* fileNames,
+                                               int* totalFileSize) {
     unique_ptr<DIR, decltype(&closedir)> dir(opendir(path), closedir);
     if (dir == NULL) {
         VLOG("Path %s does not exist", path);
         return;
     }
     dirent* de;
-    int totalFileSize = 0;
-    vector<FileInfo> fileNames;
-    auto nowSec = getWallClockSec();
     while ((de = readdir(dir.get()))) {
         char* name = de->d_name;
         if (name[0] == '.' || de->d_type == DT_DIR) continue;
@@ -738,8 +1201,10 @@ void StorageManager::trimToFit(const char* path, bool parseTimestampOnly) {
         string file_name;
         if (parseTimestampOnly) {
             file_name = StringPrintf("%s/%s", path, name);
-            output.mTimestampSec = StrToInt64(strtok(name, "_"));
+            char* savePtr = nullptr;
+            output.mTimestampSec = StrToInt64(strtok_r(name, "_", &savePtr));
             output.mIsHistory = false;
+            output.mIsSegment = false;
         } else {
             parseFileName(name, &output);
             file_name = output.getFullFileName(path);
@@ -760,22 +1225,9 @@ void StorageManager::trimToFit(const char* path, bool parseTimestampOnly) {
             file.seekg(0, ios::end);
             fileSize = file.tellg();
             file.close();
-            totalFileSize += fileSize;
+            *totalFileSize += fileSize;
         }
-        fileNames.emplace_back(file_name, output.mIsHistory, fileSize, fileAge);
-    }
-
-    if (fileNames.size() > StatsdStats::kMaxFileNumber ||
-        totalFileSize > StatsdStats::kMaxFileSize) {
-        sortFiles(&fileNames);
-    }
-
-    // Start removing files from oldest to be under the limit.
-    while (fileNames.size() > 0 && (fileNames.size() > StatsdStats::kMaxFileNumber ||
-                                    totalFileSize > StatsdStats::kMaxFileSize)) {
-        totalFileSize -= fileNames.at(fileNames.size() - 1).mFileSizeBytes;
-        deleteFile(fileNames.at(fileNames.size() - 1).mFileName.c_str());
-        fileNames.pop_back();
+        fileNames->emplace_back(file_name, output.mIsHistory, fileSize, fileAge);
     }
 }
 
@@ -786,34 +1238,17 @@ void StorageManager::printStats(int outFd) {
 
 void StorageManager::printDirStats(int outFd, const char* path) {
     dprintf(outFd, "Printing stats of %s\n", path);
-    unique_ptr<DIR, decltype(&closedir)> dir(opendir(path), closedir);
-    if (dir == NULL) {
-        VLOG("Path %s does not exist", path);
-        return;
-    }
-    dirent* de;
+    std::lock_guard<std::mutex> lock(sCatalogMutex);
+    const DirCatalog* catalog = getCatalogLocked(path);
     int fileCount = 0;
     int totalFileSize = 0;
-    while ((de = readdir(dir.get()))) {
-        char* name = de->d_name;
-        if (name[0] == '.' || de->d_type == DT_DIR) {
-            continue;
-        }
-        FileName output;
-        parseFileName(name, &output);
-        if (output.mTimestampSec == -1) continue;
+    for (const auto& [_, file] : catalog->mFiles) {
+        if (file.mTimestampSec == -1) continue;
         dprintf(outFd, "\t #%d, Last updated: %lld, UID: %d, Config ID: %lld, %s", fileCount + 1,
-                (long long)output.mTimestampSec, output.mUid, (long long)output.mConfigId,
-                (output.mIsHistory ? "local history" : ""));
-        string file_name = output.getFullFileName(path);
-        ifstream file(file_name.c_str(), ifstream::in | ifstream::binary);
-        if (file.is_open()) {
-            file.seekg(0, ios::end);
-            int fileSize = file.tellg();
-            file.close();
-            dprintf(outFd, ", File Size: %d bytes", fileSize);
-            totalFileSize += fileSize;
-        }
+                (long long)file.mTimestampSec, file.mUid, (long long)file.mConfigId,
+                (file.mIsHistory ? "local history" : ""));
+        dprintf(outFd, ", File Size: %lld bytes", (long long)file.mSizeBytes);
+        totalFileSize += file.mSizeBytes;
         dprintf(outFd, "\n");
         fileCount++;
     }
@@ -837,9 +1272,18 @@ void StorageManager::enforceDbGuardrails(const char* path, const int64_t currWal
     while ((de = readdir(dir.get()))) {
         char* name = de->d_name;
         if (name[0] == '.' || de->d_type == DT_DIR) continue;
+        // The write-ahead log of a db is handled with the db.
+        if (android::base::EndsWith(name, "-wal") || android::base::EndsWith(name, "-shm")) {
+            continue;
+        }
         string fullPathName = StringPrintf("%s/%s", path, name);
         struct stat fileInfo;
         const ConfigKey key = parseDbName(name);
+        const bool isDbFile = fullPathName == dbutils::getDbName(key);
+        if (isDbFile) {
+            // Checkpoints the write-ahead log into the db file before measuring it.
+            dbutils::releaseDb(key);
+        }
         if (stat(fullPathName.c_str(), &fileInfo) != 0) {
             StatsdStats::getInstance().noteDbStatFailed(key);
             // Remove file if stat fails.
@@ -850,11 +1294,19 @@ void StorageManager::enforceDbGuardrails(const char* path, const int64_t currWal
                                                               fileInfo.st_size);
         if (fileInfo.st_mtime <= deleteThresholdSec) {
             StatsdStats::getInstance().noteDbTooOld(key);
-            remove(fullPathName.c_str());
+            if (isDbFile) {
+                dbutils::deleteDb(key);
+            } else {
+                remove(fullPathName.c_str());
+            }
         }
         if (fileInfo.st_size >= maxBytes) {
             StatsdStats::getInstance().noteDbSizeExceeded(key);
-            remove(fullPathName.c_str());
+            if (isDbFile) {
+                dbutils::deleteDb(key);
+            } else {
+                remove(fullPathName.c_str());
+            }
         }
         if (hasFile(dbutils::getDbName(key).c_str())) {
             dbutils::verifyIntegrityAndDeleteIfNecessary(key);
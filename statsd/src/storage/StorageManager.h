@@ -17,10 +17,17 @@
 #ifndef STORAGE_MANAGER_H
 #define STORAGE_MANAGER_H
 
+#include <android-base/mapped_file.h>
 #include <android/util/ProtoOutputStream.h>
 #include <utils/Log.h>
 #include <utils/RefBase.h>
 
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
 #include "packages/UidMap.h"
 
 namespace android {
@@ -39,6 +46,23 @@ using android::util::ProtoOutputStream;
 // Magic word at the start of the train info file, change this if changing the file format
 const uint32_t TRAIN_INFO_FILE_MAGIC = 0xfb7447bf;
 
+// Magic word at the start of each report segment file, change this if changing the file format
+const uint32_t REPORT_SEGMENT_FILE_MAGIC = 0x5e9f0c1d;
+
+/**
+ * ConfigMetricsReports on disk, mapped into memory rather than read. The reports stay readable
+ * after their files are erased or renamed, for as long as this is alive.
+ */
+struct MappedReports {
+    std::vector<std::unique_ptr<android::base::MappedFile>> mFiles;
+
+    // Reports that were saved compressed. A deque, so that they never move.
+    std::deque<std::string> mDecompressed;
+
+    // Each report points into one of mFiles or mDecompressed.
+    std::vector<std::string_view> mReports;
+};
+
 class StorageManager : public virtual RefBase {
 public:
     struct FileInfo {
@@ -60,27 +84,42 @@ public:
     static void writeFile(const char* file, const void* buffer, int numBytes);
 
     /**
-     * Writes train info.
+     * Same as writeFile, but the data is written to a hidden temporary file, synced, then renamed
+     * to the file path. Readers never see a partially written file.
+     * Returns false if the file could not be written.
+     */
+    static bool writeFileAtomically(const char* file, const void* buffer, int numBytes);
+
+    /**
+     * Appends a given byte array to the file at the specified file path, which is created if it
+     * does not exist. The data is synced before returning.
+     * Returns false if the data could not be appended.
+     */
+    static bool appendToFile(const char* file, const void* buffer, int numBytes);
+
+    /**
+     * Writes train info, to disk and to the in-memory index.
      */
     static bool writeTrainInfo(const InstallTrainInfo& trainInfo);
 
     /**
-     * Reads train info.
+     * Reads train info from the in-memory index.
      */
     static bool readTrainInfo(const std::string& trainName, InstallTrainInfo& trainInfo);
 
     /**
-     * Reads train info assuming lock is obtained.
+     * Reads all train info from the in-memory index and returns a vector of train info.
      */
-    static bool readTrainInfoLocked(const std::string& trainName, InstallTrainInfo& trainInfo);
+    static vector<InstallTrainInfo> readAllTrainInfo();
 
     /**
-     * Reads all train info and returns a vector of train info.
+     * Rebuilds the in-memory index of train info from the files in TRAIN_INFO_DIR. Called on
+     * startup, the index is otherwise loaded by the first train info read or write.
      */
-    static vector<InstallTrainInfo> readAllTrainInfo();
+    static void loadTrainInfos();
 
     /**
-     * Reads the file content to the buffer.
+     * Reads the file content to the buffer. Compressed reports are decompressed.
      */
     static bool readFileToString(const char* file, string* content);
 
@@ -128,9 +167,30 @@ public:
                                           bool erase_data, bool isAdb);
 
     /**
-     * Call to load the saved configs from disk.
+     * Same as appendConfigMetricsReport, but the reports are mapped into memory instead of
+     * being copied into a proto, so they can be streamed out without being held on the heap.
+     */
+    static void mapConfigMetricsReports(const ConfigKey& key, bool erase_data, bool isAdb,
+                                        MappedReports* reports);
+
+    /**
+     * Appends a ConfigMetricsReport to the config's active segment in the data directory,
+     * instead of writing it to a file of its own. A segment is a magic word followed by
+     * length-prefixed reports, and is read back, renamed and trimmed as a whole like any other
+     * report file. A new segment is started once the active one would exceed kMaxSegmentBytes or
+     * is older than kMaxSegmentAgeSec.
+     * Returns false if the report could not be written.
+     */
+    static bool appendReportToSegment(const ConfigKey& key, const void* buffer, int numBytes);
+
+    /**
+     * Call to load the saved configs from disk. onConfig is called with each config in turn,
+     * which is only held in memory for the duration of the call, and the file it was read from.
+     * Only the newest file of each config is read, the older ones are deleted.
      */
-    static void readConfigFromDisk(std::map<ConfigKey, StatsdConfig>& configsMap);
+    static void readConfigFromDisk(
+            const std::function<void(const ConfigKey&, const StatsdConfig&, const string&)>&
+                    onConfig);
 
     /**
      * Call to load the specified config from disk. Returns false if the config file does not
@@ -160,6 +220,8 @@ public:
 
     static string getDataHistoryFileName(long wallClockSec, int uid, int64_t id);
 
+    static string getDataSegmentFileName(long wallClockSec, int uid, int64_t id);
+
     static void sortFiles(vector<FileInfo>* fileNames);
 
     static void enforceDbGuardrails(const char* path, const int64_t wallClockSec,
@@ -167,6 +229,18 @@ public:
 
     static bool hasFile(const char* file);
 
+    /**
+     * Records a file written to, or renamed into, a stats directory by some other class than
+     * StorageManager, so that the directory catalog stays up to date.
+     */
+    static void noteFileWritten(const std::string& file, int64_t sizeBytes);
+
+    /**
+     * Rebuilds the catalogs of the stats data and service directories from disk. Called on
+     * startup, the catalogs are otherwise loaded on first use.
+     */
+    static void loadFileCatalogs();
+
 private:
     /**
      * Prints disk usage statistics about a directory related to statsd.
@@ -174,6 +248,91 @@ private:
     static void printDirStats(int out, const char* path);
 
     static std::mutex sTrainInfoMutex;
+
+    struct TrainInfoFile {
+        InstallTrainInfo mTrainInfo;
+        std::string mFileName;
+        long mTimestampSec;
+    };
+
+    // The train info files by train name, guarded by sTrainInfoMutex. Binary push events read and
+    // update train info on the event thread, so they are kept in memory rather than scanning and
+    // parsing TRAIN_INFO_DIR every time.
+    static bool sTrainInfosLoaded;
+    static std::unordered_map<std::string, TrainInfoFile> sTrainInfos;
+
+    static void loadTrainInfosLocked();
+
+    // Removes the train info older than StatsdStats::kMaxAgeSecond, like trimToFit() does.
+    static void removeExpiredTrainInfosLocked();
+
+    // Large enough for many reports, small enough that trimming a segment loses little data.
+    static const int kMaxSegmentBytes = 1024 * 1024;
+
+    // Bounds how much newer than the segment's timestamp the reports in it can be.
+    static const long kMaxSegmentAgeSec = 60 * 60;
+
+    struct SegmentInfo {
+        std::string mFileName;
+        long mCreatedSec;
+    };
+
+    // Guards sActiveSegments and the segment files, which are appended to from the disk writer.
+    static std::mutex sSegmentMutex;
+
+    // Index of the segment each config appends to, so appends do not list the data directory.
+    static std::map<ConfigKey, SegmentInfo> sActiveSegments;
+
+    struct CatalogedFile {
+        long mTimestampSec;
+        int mUid;
+        int64_t mConfigId;
+        bool mIsHistory;
+        bool mIsSegment;
+        int64_t mSizeBytes;
+    };
+
+    struct DirCatalog {
+        bool mLoaded = false;
+
+        // By file name, without the directory.
+        std::map<std::string, CatalogedFile> mFiles;
+    };
+
+    // Guards sCatalogs. Never held while taking sSegmentMutex.
+    static std::mutex sCatalogMutex;
+
+    // The files of the stats data and service directories, which are trimmed on every write.
+    // Trimming, stats and report lookups read these instead of listing and stating every file of
+    // the directories. The StorageManager methods that write, rename and delete files keep them up
+    // to date.
+    static std::map<std::string, DirCatalog> sCatalogs;
+
+    // Returns the catalog of a directory, loading it from disk first if needed, or nullptr if the
+    // directory is not cataloged.
+    static DirCatalog* getCatalogLocked(const std::string& dir);
+
+    static void loadCatalogLocked(const std::string& dir, DirCatalog* catalog);
+
+    static CatalogedFile makeCatalogedFile(const std::string& name, int64_t sizeBytes);
+
+    // Returns false if the directory is not cataloged, otherwise sets the full paths of the
+    // cataloged files of the directory, along with their catalog entries.
+    static bool getCatalogedFiles(const char* dir,
+                                  vector<std::pair<std::string, CatalogedFile>>* files);
+
+    static void noteFileDeleted(const std::string& file);
+
+    static void noteFileRenamed(const std::string& from, const std::string& to);
+
+    // Returns false if the directory is not cataloged, otherwise deletes the cataloged files that
+    // are too old and sets the others.
+    static bool getCatalogedFilesToTrim(const char* dir, long nowSec, vector<FileInfo>* fileInfos,
+                                        int* totalFileSize);
+
+    // Same as getCatalogedFilesToTrim, for the directories that are not cataloged.
+    static void getUncatalogedFilesToTrim(const char* dir, bool parseTimestampOnly, long nowSec,
+                                          vector<FileInfo>* fileInfos, int* totalFileSize);
 };
 
 }  // namespace statsd
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "subscriber/SubscriberDispatcher.h"
+
+#include "external/Perfetto.h"
+#include "subscriber/IncidentdReporter.h"
+#include "subscriber/SubscriberReporter.h"
+#include "utils/ThreadConfig.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+SubscriberDispatcher::~SubscriberDispatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mQueueCv.notify_one();
+    if (mDispatcher.joinable()) {
+        mDispatcher.join();
+    }
+}
+
+void SubscriberDispatcher::startAsyncDispatch() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mDispatcher.joinable()) {
+        mDispatcher = std::thread([this] { dispatchLoop(); });
+    }
+}
+
+void SubscriberDispatcher::dispatch(const Subscription& subscription, int64_t ruleId,
+                                    int64_t metricId, const MetricDimensionKey& dimensionKey,
+                                    int64_t metricValue, const ConfigKey& configKey) {
+    Trigger trigger = {subscription, ruleId, metricId, dimensionKey, metricValue, configKey};
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mDispatcher.joinable()) {
+            for (const Trigger& pending : mQueue) {
+                if (pending.isIdentical(trigger)) {
+                    VLOG("Subscriber %lld is already queued to be informed",
+                         (long long)subscription.id());
+                    return;
+                }
+            }
+            if (mQueue.size() >= kMaxPendingTriggers) {
+                ALOGW("Too many pending subscriber triggers, dropping subscriber %lld of rule %lld",
+                      (long long)subscription.id(), (long long)ruleId);
+                return;
+            }
+            mQueue.push_back(std::move(trigger));
+            mQueueCv.notify_one();
+            return;
+        }
+    }
+    inform(trigger);
+}
+
+void SubscriberDispatcher::waitForPendingTriggers() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDrainedCv.wait(lock, [this] { return mQueue.empty() && !mDispatching; });
+}
+
+bool SubscriberDispatcher::Trigger::isIdentical(const Trigger& that) const {
+    return subscription.id() == that.subscription.id() && ruleId == that.ruleId &&
+           metricId == that.metricId && configKey == that.configKey &&
+           dimensionKey == that.dimensionKey;
+}
+
+void SubscriberDispatcher::inform(const Trigger& trigger) {
+    const Subscription& subscription = trigger.subscription;
+    switch (subscription.subscriber_information_case()) {
+        case Subscription::SubscriberInformationCase::kIncidentdDetails:
+            if (!GenerateIncidentReport(subscription.incidentd_details(), trigger.ruleId,
+                                        trigger.metricId, trigger.dimensionKey,
+                                        trigger.metricValue, trigger.configKey)) {
+                ALOGW("Failed to generate incident report.");
+            }
+            break;
+        case Subscription::SubscriberInformationCase::kPerfettoDetails:
+            if (!CollectPerfettoTraceAndUploadToDropbox(subscription.perfetto_details(),
+                                                        subscription.id(), trigger.ruleId,
+                                                        trigger.configKey)) {
+                ALOGW("Failed to generate perfetto traces.");
+            }
+            break;
+        case Subscription::SubscriberInformationCase::kBroadcastSubscriberDetails:
+            SubscriberReporter::getInstance().alertBroadcastSubscriber(
+                    trigger.configKey, subscription, trigger.dimensionKey);
+            break;
+        default:
+            break;
+    }
+}
+
+void SubscriberDispatcher::dispatchLoop() {
+    configureStatsdThread("statsd.notify");
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mQueueCv.wait(lock, [this] { return !mQueue.empty() || mStopping; });
+        if (mQueue.empty()) {
+            // Only stop once everything queued is done.
+            return;
+        }
+        Trigger trigger = std::move(mQueue.front());
+        mQueue.pop_front();
+        mDispatching = true;
+        lock.unlock();
+
+        inform(trigger);
+
+        lock.lock();
+        mDispatching = false;
+        if (mQueue.empty()) {
+            mDrainedCv.notify_all();
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <gtest/gtest_prod.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "HashableDimensionKey.h"
+#include "config/ConfigKey.h"
+#include "src/statsd_config.pb.h"  // subscription
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Informs the subscribers of the anomalies and alarms: through incidentd, perfetto or a
+ * broadcast. These do binder calls or start processes, so once startAsyncDispatch() is called
+ * they are done on a thread of their own instead of the event processing thread.
+ *
+ * Queued triggers are done in order. A trigger is dropped if an identical one is still queued,
+ * or once kMaxPendingTriggers are queued.
+ */
+class SubscriberDispatcher {
+public:
+    /** Get (singleton) instance of SubscriberDispatcher. */
+    static SubscriberDispatcher& getInstance() {
+        static SubscriberDispatcher subscriberDispatcher;
+        return subscriberDispatcher;
+    }
+
+    // Tests use instances of their own.
+    SubscriberDispatcher() = default;
+
+    SubscriberDispatcher(const SubscriberDispatcher&) = delete;
+    SubscriberDispatcher& operator=(const SubscriberDispatcher&) = delete;
+
+    // Does the triggers still queued before returning.
+    ~SubscriberDispatcher();
+
+    void startAsyncDispatch();
+
+    // Informs the subscriber of the rule that triggered, or queues it to be informed.
+    void dispatch(const Subscription& subscription, int64_t ruleId, int64_t metricId,
+                  const MetricDimensionKey& dimensionKey, int64_t metricValue,
+                  const ConfigKey& configKey);
+
+    // Returns once the triggers queued before the call are done.
+    void waitForPendingTriggers();
+
+    static constexpr size_t kMaxPendingTriggers = 100;
+
+private:
+    struct Trigger {
+        Subscription subscription;
+        int64_t ruleId;
+        int64_t metricId;
+        MetricDimensionKey dimensionKey;
+        int64_t metricValue;
+        ConfigKey configKey;
+
+        // Whether the triggers inform the same subscriber of the same rule and dimension.
+        bool isIdentical(const Trigger& that) const;
+    };
+
+    static void inform(const Trigger& trigger);
+
+    void dispatchLoop();
+
+    std::mutex mMutex;
+
+    // Signals the dispatcher that a trigger was queued or that the dispatcher is stopping.
+    std::condition_variable mQueueCv;
+
+    // Signals waitForPendingTriggers that the queue was drained.
+    std::condition_variable mDrainedCv;
+
+    std::deque<Trigger> mQueue;
+
+    // True while the dispatcher does a trigger it took from mQueue.
+    bool mDispatching = false;
+
+    bool mStopping = false;
+
+    // Not joinable until startAsyncDispatch(). Triggers are done by dispatch() until then.
+    std::thread mDispatcher;
+
+    FRIEND_TEST(SubscriberDispatcherTest, TestDropsIdenticalPendingTriggers);
+    FRIEND_TEST(SubscriberDispatcherTest, TestDropsTriggersWhenFull);
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
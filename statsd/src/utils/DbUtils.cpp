@@ -21,12 +21,23 @@
 #include "utils/DbUtils.h"
 
 #include <android/api-level.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include "FieldValue.h"
 #include "android-base/properties.h"
 #include "android-base/stringprintf.h"
 #include "stats_log_util.h"
 #include "storage/StorageManager.h"
+#include "utils/ThreadConfig.h"
 
 namespace android {
 namespace os {
@@ -42,6 +53,9 @@ using base::GetProperty;
 using base::StringPrintf;
 
 const string TABLE_NAME_PREFIX = "metric_";
+
+// Max number of expired rows flushTtl deletes at once.
+const int kMaxTtlDeletedRowsPerTransaction = 1000;
 const string COLUMN_NAME_ATOM_TAG = "atomId";
 const string COLUMN_NAME_EVENT_ELAPSED_CLOCK_NS = "elapsedTimestampNs";
 const string COLUMN_NAME_EVENT_WALL_CLOCK_NS = "wallTimestampNs";
@@ -57,7 +71,7 @@ const string COLUMN_NAME_BRAND = "brand";
 const string COLUMN_NAME_MANUFACTURER = "manufacturer";
 const string COLUMN_NAME_BOARD = "board";
 
-static std::vector<std::string> getExpectedTableSchema(const LogEvent& logEvent) {
+vector<string> getTableSchema(const LogEvent& logEvent) {
     vector<std::string> result;
     for (const FieldValue& fieldValue : logEvent.getValues()) {
         if (fieldValue.mField.getDepth() > 0) {
@@ -126,6 +140,12 @@ static string getCreateSqlString(const int64_t metricId, const LogEvent& event)
     }
     result.pop_back();
     result += ") STRICT;";
+    // Lets the TTL enforcement find the expired rows without scanning the whole table. Also added
+    // to the tables created without it.
+    const string tableName = TABLE_NAME_PREFIX + reformatMetricId(metricId);
+    result += StringPrintf("CREATE INDEX IF NOT EXISTS %s_%s ON %s(%s);", tableName.c_str(),
+                           COLUMN_NAME_EVENT_WALL_CLOCK_NS.c_str(), tableName.c_str(),
+                           COLUMN_NAME_EVENT_WALL_CLOCK_NS.c_str());
     return result;
 }
 
@@ -134,18 +154,283 @@ string reformatMetricId(const int64_t metricId) {
                         : StringPrintf("%lld", (long long)metricId);
 }
 
-bool createTableIfNeeded(const ConfigKey& key, const int64_t metricId, const LogEvent& event) {
+namespace {
+
+// Prepared statements inserting one row into the metric tables, by metric id.
+class InsertStatementCache {
+public:
+    ~InsertStatementCache() {
+        clear();
+    }
+
+    // Returns the statement inserting numParams values into the table of the metric. Returns
+    // nullptr and sets err if it can not be prepared.
+    sqlite3_stmt* get(sqlite3* db, const int64_t metricId, const int numParams, string& err) {
+        auto it = mStatements.find(metricId);
+        if (it != mStatements.end()) {
+            if (it->second.second == numParams) {
+                return it->second.first;
+            }
+            sqlite3_finalize(it->second.first);
+            mStatements.erase(it);
+        }
+        string zSql =
+                StringPrintf("INSERT INTO metric_%s VALUES(", reformatMetricId(metricId).c_str());
+        for (int i = 0; i < numParams; ++i) {
+            zSql += "?,";
+        }
+        zSql.back() = ')';
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v3(db, zSql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) !=
+            SQLITE_OK) {
+            err = sqlite3_errmsg(db);
+            sqlite3_finalize(stmt);
+            return nullptr;
+        }
+        mStatements[metricId] = {stmt, numParams};
+        return stmt;
+    }
+
+    void erase(const int64_t metricId) {
+        auto it = mStatements.find(metricId);
+        if (it != mStatements.end()) {
+            sqlite3_finalize(it->second.first);
+            mStatements.erase(it);
+        }
+    }
+
+    void clear() {
+        for (auto& [metricId, statement] : mStatements) {
+            sqlite3_finalize(statement.first);
+        }
+        mStatements.clear();
+    }
+
+private:
+    std::unordered_map<int64_t, std::pair<sqlite3_stmt*, int>> mStatements;
+};
+
+// Max number of idle read-only handles kept open per config.
+constexpr size_t kMaxIdleReadOnlyDbs = 4;
+
+// Handles kept open to the db of a config.
+struct DbConnection {
+    sqlite3* db = nullptr;
+    // Idle handles used for the queries, so that they can not write to the db. A query takes one
+    // out while it runs, so that queries run concurrently with each other and with the inserts.
+    vector<sqlite3*> readOnlyDbs;
+    // Tells the handles taken out of this connection from the ones of a later connection.
+    uint64_t generation = 0;
+    // The db file the handles were opened on.
+    bool hasFile = false;
+    dev_t fileDevice = 0;
+    ino_t fileInode = 0;
+    InsertStatementCache insertStatements;
+
+    ~DbConnection() {
+        // The statements must be finalized before closing their db.
+        insertStatements.clear();
+        for (sqlite3* readOnlyDb : readOnlyDbs) {
+            sqlite3_close(readOnlyDb);
+        }
+        sqlite3_close(db);
+    }
+};
+
+std::mutex sDbMutex;
+
+// Guarded by sDbMutex.
+std::unordered_map<ConfigKey, std::unique_ptr<DbConnection>> sDbConnections;
+uint64_t sNextConnectionGeneration = 0;
+
+// Returns the handles kept for the config. They are closed first if the db file was deleted or
+// replaced since they were opened.
+DbConnection& getConnectionLocked(const ConfigKey& key, const string& dbName) {
+    std::unique_ptr<DbConnection>& connection = sDbConnections[key];
+    if (connection != nullptr) {
+        struct stat fileInfo;
+        if (stat(dbName.c_str(), &fileInfo) != 0 || fileInfo.st_dev != connection->fileDevice ||
+            fileInfo.st_ino != connection->fileInode) {
+            connection.reset();
+        }
+    }
+    if (connection == nullptr) {
+        connection = std::make_unique<DbConnection>();
+        connection->generation = sNextConnectionGeneration++;
+    }
+    return *connection;
+}
+
+// Records the db file the first handle of the connection was opened on.
+void setDbFile(DbConnection& connection, const string& dbName) {
+    struct stat fileInfo;
+    if (!connection.hasFile && stat(dbName.c_str(), &fileInfo) == 0) {
+        connection.hasFile = true;
+        connection.fileDevice = fileInfo.st_dev;
+        connection.fileInode = fileInfo.st_ino;
+    }
+}
+
+// Returns the handles kept for the config, with the read-write one open. Returns nullptr and sets
+// error if the db can not be opened. The db file is only created if create is true.
+DbConnection* openDbLocked(const ConfigKey& key, string* error, const bool create = true) {
     const string dbName = getDbName(key);
+    DbConnection& connection = getConnectionLocked(key, dbName);
+    if (connection.db != nullptr) {
+        return &connection;
+    }
     sqlite3* db;
-    if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK) {
+    const int flags = SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0);
+    if (sqlite3_open_v2(dbName.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+        if (error != nullptr) {
+            *error = sqlite3_errmsg(db);
+        }
         sqlite3_close(db);
+        return nullptr;
+    }
+    // Writes are appended to the write-ahead log, and only synced when it is checkpointed.
+    char* pragmaError = nullptr;
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", nullptr, nullptr,
+                 &pragmaError);
+    if (pragmaError) {
+        ALOGW("Failed to set the db journal mode: %s", pragmaError);
+        sqlite3_free(pragmaError);
+    }
+    setDbFile(connection, dbName);
+    connection.db = db;
+    return &connection;
+}
+
+// Takes an idle read-only handle out of the ones kept for the config, or opens a new one, and
+// sets generation to the one of the connection. Returns nullptr and sets err if the db can not be
+// opened.
+sqlite3* takeReadOnlyDbLocked(const ConfigKey& key, uint64_t* generation, string& err) {
+    const string dbName = getDbName(key);
+    DbConnection& connection = getConnectionLocked(key, dbName);
+    *generation = connection.generation;
+    if (!connection.readOnlyDbs.empty()) {
+        sqlite3* db = connection.readOnlyDbs.back();
+        connection.readOnlyDbs.pop_back();
+        return db;
+    }
+    sqlite3* db;
+    if (sqlite3_open_v2(dbName.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        err = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        return nullptr;
+    }
+    setDbFile(connection, dbName);
+    return db;
+}
+
+// Gives back a handle from takeReadOnlyDbLocked. It is closed if the connection it was taken
+// from was released in the meantime, or if enough handles are idle already.
+void returnReadOnlyDbLocked(const ConfigKey& key, sqlite3* db, const uint64_t generation) {
+    auto it = sDbConnections.find(key);
+    if (it != sDbConnections.end() && it->second != nullptr &&
+        it->second->generation == generation &&
+        it->second->readOnlyDbs.size() < kMaxIdleReadOnlyDbs) {
+        it->second->readOnlyDbs.push_back(db);
+        return;
+    }
+    sqlite3_close(db);
+}
+
+struct PendingInsert {
+    ConfigKey key;
+    int64_t metricId;
+    vector<LogEvent> events;
+    int64_t flushStartNs;
+};
+
+// Max number of events queued by insertAsync before it blocks.
+constexpr size_t kMaxPendingInsertEvents = 10000;
+
+// The inserts queued by insertAsync, and the thread writing them.
+class PendingInserts {
+public:
+    // Blocks while the queue is full.
+    void enqueue(PendingInsert insert);
+
+    // Waits for the inserts queued before the call to be written.
+    void waitForIdle();
+
+private:
+    void writerLoop();
+
+    std::mutex mMutex;
+
+    // Signals the writer that an insert was queued.
+    std::condition_variable mQueueCv;
+
+    // Signals the callers of enqueue and waitForIdle that queued inserts were written.
+    std::condition_variable mWrittenCv;
+
+    std::deque<PendingInsert> mQueue;
+
+    // Number of events queued or being written.
+    size_t mPendingEvents = 0;
+
+    // True while the writer writes the inserts it took from mQueue.
+    bool mWriting = false;
+
+    // Started on the first insert. Never stopped, the queue lives until the process exits.
+    std::thread mWriter;
+};
+
+PendingInserts& getPendingInserts() {
+    static PendingInserts* pendingInserts = new PendingInserts();
+    return *pendingInserts;
+}
+
+// Waits for the queued inserts to be written, then locks the db handles, so that the callers see
+// the data queued before them.
+std::unique_lock<std::mutex> lockDb() {
+    getPendingInserts().waitForIdle();
+    return std::unique_lock<std::mutex>(sDbMutex);
+}
+
+// A read-only handle taken out of the ones kept for a config, used without holding sDbMutex.
+// Sees the data queued before its creation.
+class ReadOnlyDb {
+public:
+    ReadOnlyDb(const ConfigKey& key, string& err) : mKey(key) {
+        std::unique_lock<std::mutex> lock = lockDb();
+        mDb = takeReadOnlyDbLocked(key, &mGeneration, err);
+    }
+
+    ~ReadOnlyDb() {
+        if (mDb != nullptr) {
+            std::lock_guard<std::mutex> lock(sDbMutex);
+            returnReadOnlyDbLocked(mKey, mDb, mGeneration);
+        }
+    }
+
+    ReadOnlyDb(const ReadOnlyDb&) = delete;
+    ReadOnlyDb& operator=(const ReadOnlyDb&) = delete;
+
+    sqlite3* get() const {
+        return mDb;
+    }
+
+private:
+    const ConfigKey mKey;
+    sqlite3* mDb = nullptr;
+    uint64_t mGeneration = 0;
+};
+
+}  // namespace
+
+bool createTableIfNeeded(const ConfigKey& key, const int64_t metricId, const LogEvent& event) {
+    std::unique_lock<std::mutex> lock = lockDb();
+    DbConnection* connection = openDbLocked(key, nullptr);
+    if (connection == nullptr) {
         return false;
     }
 
     char* error = nullptr;
     string zSql = getCreateSqlString(metricId, event);
-    sqlite3_exec(db, zSql.c_str(), nullptr, nullptr, &error);
-    sqlite3_close(db);
+    sqlite3_exec(connection->db, zSql.c_str(), nullptr, nullptr, &error);
     if (error) {
         ALOGW("Failed to create table to db: %s", error);
         return false;
@@ -153,11 +438,13 @@ bool createTableIfNeeded(const ConfigKey& key, const int64_t metricId, const Log
     return true;
 }
 
+static bool queryDb(sqlite3* db, const string& zSql, vector<vector<string>>& rows,
+                    vector<int32_t>& columnTypes, vector<string>& columnNames, string& err);
+
 bool isEventCompatible(const ConfigKey& key, const int64_t metricId, const LogEvent& event) {
-    const string dbName = getDbName(key);
-    sqlite3* db;
-    if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK) {
-        sqlite3_close(db);
+    std::unique_lock<std::mutex> lock = lockDb();
+    // Creates the db if needed, for the query.
+    if (openDbLocked(key, nullptr) == nullptr) {
         return false;
     }
     string zSql = StringPrintf("PRAGMA table_info(metric_%s);", reformatMetricId(metricId).c_str());
@@ -165,9 +452,14 @@ bool isEventCompatible(const ConfigKey& key, const int64_t metricId, const LogEv
     std::vector<int32_t> columnTypes;
     std::vector<string> columnNames;
     std::vector<std::vector<std::string>> rows;
-    if (!query(key, zSql, rows, columnTypes, columnNames, err)) {
+    uint64_t generation;
+    sqlite3* db = takeReadOnlyDbLocked(key, &generation, err);
+    const bool queried = db != nullptr && queryDb(db, zSql, rows, columnTypes, columnNames, err);
+    if (db != nullptr) {
+        returnReadOnlyDbLocked(key, db, generation);
+    }
+    if (!queried) {
         ALOGE("Failed to check table schema for metric %lld: %s", (long long)metricId, err.c_str());
-        sqlite3_close(db);
         return false;
     }
     // Sample query result
@@ -182,22 +474,20 @@ bool isEventCompatible(const ConfigKey& key, const int64_t metricId, const LogEv
     for (size_t i = 3; i < rows.size(); ++i) {  // Atom fields start at the third row
         tableSchema.push_back(rows[i][2]);  // The third column stores the data type for the column
     }
-    sqlite3_close(db);
     // An empty rows vector implies the table has not yet been created.
-    return rows.size() == 0 || getExpectedTableSchema(event) == tableSchema;
+    return rows.size() == 0 || getTableSchema(event) == tableSchema;
 }
 
 bool deleteTable(const ConfigKey& key, const int64_t metricId) {
-    const string dbName = getDbName(key);
-    sqlite3* db;
-    if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK) {
-        sqlite3_close(db);
+    std::unique_lock<std::mutex> lock = lockDb();
+    DbConnection* connection = openDbLocked(key, nullptr);
+    if (connection == nullptr) {
         return false;
     }
+    connection->insertStatements.erase(metricId);
     string zSql = StringPrintf("DROP TABLE metric_%s", reformatMetricId(metricId).c_str());
     char* error = nullptr;
-    sqlite3_exec(db, zSql.c_str(), nullptr, nullptr, &error);
-    sqlite3_close(db);
+    sqlite3_exec(connection->db, zSql.c_str(), nullptr, nullptr, &error);
     if (error) {
         ALOGW("Failed to drop table from db: %s", error);
         return false;
@@ -205,147 +495,320 @@ bool deleteTable(const ConfigKey& key, const int64_t metricId) {
     return true;
 }
 
-void deleteDb(const ConfigKey& key) {
+static void deleteDbLocked(const ConfigKey& key) {
+    sDbConnections.erase(key);
     const string dbName = getDbName(key);
     StorageManager::deleteFile(dbName.c_str());
+    StorageManager::deleteFile((dbName + "-wal").c_str());
+    StorageManager::deleteFile((dbName + "-shm").c_str());
+}
+
+void deleteDb(const ConfigKey& key) {
+    std::unique_lock<std::mutex> lock = lockDb();
+    deleteDbLocked(key);
 }
 
 sqlite3* getDb(const ConfigKey& key) {
-    const string dbName = getDbName(key);
-    sqlite3* db;
-    if (sqlite3_open(dbName.c_str(), &db) == SQLITE_OK) {
-        return db;
+    std::unique_lock<std::mutex> lock = lockDb();
+    DbConnection* connection = openDbLocked(key, nullptr);
+    return connection != nullptr ? connection->db : nullptr;
+}
+
+static DbConnection* findConnectionLocked(sqlite3* db) {
+    for (const auto& [key, connection] : sDbConnections) {
+        if (connection != nullptr && connection->db == db) {
+            return connection.get();
+        }
     }
     return nullptr;
 }
 
 void closeDb(sqlite3* db) {
-    sqlite3_close(db);
+    std::unique_lock<std::mutex> lock = lockDb();
+    // The handles from getDb stay open until the db is released.
+    if (db != nullptr && findConnectionLocked(db) == nullptr) {
+        sqlite3_close(db);
+    }
 }
 
-static bool getInsertSqlStmt(sqlite3* db, sqlite3_stmt** stmt, const int64_t metricId,
-                             const vector<LogEvent>& events, string& err) {
-    string result =
-            StringPrintf("INSERT INTO metric_%s VALUES", reformatMetricId(metricId).c_str());
-    for (auto& logEvent : events) {
-        result += StringPrintf("(%d, %lld, %lld,", logEvent.GetTagId(),
-                               (long long)logEvent.GetElapsedTimestampNs(),
-                               (long long)logEvent.GetLogdTimestampNs());
-        for (auto& fieldValue : logEvent.getValues()) {
-            if (fieldValue.mField.getDepth() > 0 || fieldValue.mValue.getType() == STORAGE) {
-                // Repeated fields and byte fields are not supported.
-                continue;
-            }
-            result += "?,";
+void releaseDb(const ConfigKey& key) {
+    std::unique_lock<std::mutex> lock = lockDb();
+    sDbConnections.erase(key);
+}
+
+uint64_t getDbGeneration(const ConfigKey& key) {
+    // Does not wait for the queued inserts, which do not reopen the db.
+    std::lock_guard<std::mutex> lock(sDbMutex);
+    return getConnectionLocked(key, getDbName(key)).generation;
+}
+
+static int getInsertParamCount(const LogEvent& logEvent) {
+    // The atom id, elapsed and wall clock timestamps, then the atom fields.
+    int count = 3;
+    for (auto& fieldValue : logEvent.getValues()) {
+        if (fieldValue.mField.getDepth() > 0 || fieldValue.mValue.getType() == STORAGE) {
+            // Repeated fields and byte fields are not supported.
+            continue;
         }
-        result.pop_back();
-        result += "),";
-    }
-    result.pop_back();
-    result += ";";
-    if (sqlite3_prepare_v2(db, result.c_str(), -1, stmt, nullptr) != SQLITE_OK) {
-        err = sqlite3_errmsg(db);
-        return false;
+        ++count;
     }
+    return count;
+}
+
+static void bindInsertSqlStmt(sqlite3_stmt* stmt, const LogEvent& logEvent) {
     // ? parameters start with an index of 1 from start of query string to the
     // end.
     int32_t index = 1;
-    for (auto& logEvent : events) {
-        for (auto& fieldValue : logEvent.getValues()) {
-            if (fieldValue.mField.getDepth() > 0 || fieldValue.mValue.getType() == STORAGE) {
-                // Repeated fields and byte fields are not supported.
-                continue;
-            }
-            switch (fieldValue.mValue.getType()) {
-                case INT:
-                    sqlite3_bind_int(*stmt, index, fieldValue.mValue.int_value);
-                    break;
-                case LONG:
-                    sqlite3_bind_int64(*stmt, index, fieldValue.mValue.long_value);
-                    break;
-                case STRING:
-                    sqlite3_bind_text(*stmt, index, fieldValue.mValue.str_value.c_str(), -1,
-                                      SQLITE_STATIC);
-                    break;
-                case FLOAT:
-                    sqlite3_bind_double(*stmt, index, fieldValue.mValue.float_value);
-                    break;
-                default:
-                    // Byte array fields are not supported.
-                    break;
-            }
-            ++index;
+    sqlite3_bind_int(stmt, index++, logEvent.GetTagId());
+    sqlite3_bind_int64(stmt, index++, logEvent.GetElapsedTimestampNs());
+    sqlite3_bind_int64(stmt, index++, logEvent.GetLogdTimestampNs());
+    for (auto& fieldValue : logEvent.getValues()) {
+        if (fieldValue.mField.getDepth() > 0 || fieldValue.mValue.getType() == STORAGE) {
+            // Repeated fields and byte fields are not supported.
+            continue;
         }
+        switch (fieldValue.mValue.getType()) {
+            case INT:
+                sqlite3_bind_int(stmt, index, fieldValue.mValue.int_value);
+                break;
+            case LONG:
+                sqlite3_bind_int64(stmt, index, fieldValue.mValue.long_value);
+                break;
+            case STRING:
+                sqlite3_bind_text(stmt, index, fieldValue.mValue.getString().c_str(), -1,
+                                  SQLITE_STATIC);
+                break;
+            case FLOAT:
+                sqlite3_bind_double(stmt, index, fieldValue.mValue.float_value);
+                break;
+            default:
+                // Byte array fields are not supported.
+                break;
+        }
+        ++index;
+    }
+}
+
+static void rollBackInsertLocked(sqlite3* db) {
+    sqlite3_exec(db, "ROLLBACK TO insert_events; RELEASE insert_events;", nullptr, nullptr,
+                 nullptr);
+}
+
+static bool insertLocked(sqlite3* db, InsertStatementCache& statements, const int64_t metricId,
+                         const vector<LogEvent>& events, string& error) {
+    // The events are all inserted, or none of them. The savepoint is a transaction of its own, or
+    // nests in the one of the caller.
+    if (sqlite3_exec(db, "SAVEPOINT insert_events;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        error = sqlite3_errmsg(db);
+        ALOGW("Failed to insert data to db: %s", error.c_str());
+        return false;
+    }
+    for (const LogEvent& logEvent : events) {
+        sqlite3_stmt* stmt =
+                statements.get(db, metricId, getInsertParamCount(logEvent), error);
+        if (stmt == nullptr) {
+            ALOGW("Failed to generate prepared sql insert query %s", error.c_str());
+            rollBackInsertLocked(db);
+            return false;
+        }
+        bindInsertSqlStmt(stmt, logEvent);
+        const bool inserted = sqlite3_step(stmt) == SQLITE_DONE;
+        if (!inserted) {
+            error = sqlite3_errmsg(db);
+        }
+        sqlite3_reset(stmt);
+        // The bound strings belong to the event.
+        sqlite3_clear_bindings(stmt);
+        if (!inserted) {
+            ALOGW("Failed to insert data to db: %s", error.c_str());
+            rollBackInsertLocked(db);
+            return false;
+        }
+    }
+    if (sqlite3_exec(db, "RELEASE insert_events;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        error = sqlite3_errmsg(db);
+        ALOGW("Failed to insert data to db: %s", error.c_str());
+        rollBackInsertLocked(db);
+        return false;
     }
     return true;
 }
 
 bool insert(const ConfigKey& key, const int64_t metricId, const vector<LogEvent>& events,
             string& error) {
-    const string dbName = getDbName(key);
-    sqlite3* db;
-    if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK) {
-        error = sqlite3_errmsg(db);
-        sqlite3_close(db);
+    std::unique_lock<std::mutex> lock = lockDb();
+    DbConnection* connection = openDbLocked(key, &error);
+    if (connection == nullptr) {
         return false;
     }
-    bool success = insert(db, metricId, events, error);
-    sqlite3_close(db);
-    return success;
+    return insertLocked(connection->db, connection->insertStatements, metricId, events, error);
 }
 
 bool insert(sqlite3* db, const int64_t metricId, const vector<LogEvent>& events, string& error) {
-    sqlite3_stmt* stmt = nullptr;
-    if (!getInsertSqlStmt(db, &stmt, metricId, events, error)) {
-        ALOGW("Failed to generate prepared sql insert query %s", error.c_str());
-        sqlite3_finalize(stmt);
-        return false;
+    std::unique_lock<std::mutex> lock = lockDb();
+    DbConnection* connection = findConnectionLocked(db);
+    if (connection != nullptr) {
+        return insertLocked(db, connection->insertStatements, metricId, events, error);
     }
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        error = sqlite3_errmsg(db);
-        ALOGW("Failed to insert data to db: %s", error.c_str());
-        sqlite3_finalize(stmt);
-        return false;
+    InsertStatementCache statements;
+    return insertLocked(db, statements, metricId, events, error);
+}
+
+// Writes the inserts queued for the config in one transaction. A failed insert is rolled back on
+// its own.
+static void writePendingInserts(const ConfigKey& key, const vector<PendingInsert*>& inserts) {
+    vector<string> errors(inserts.size());
+    vector<bool> inserted(inserts.size(), false);
+    {
+        std::lock_guard<std::mutex> lock(sDbMutex);
+        string error;
+        // The tables were created before the inserts were queued, a missing db was deleted.
+        DbConnection* connection = openDbLocked(key, &error, /*create=*/false);
+        if (connection != nullptr &&
+            sqlite3_exec(connection->db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr) !=
+                    SQLITE_OK) {
+            error = sqlite3_errmsg(connection->db);
+            connection = nullptr;
+        }
+        if (connection != nullptr) {
+            for (size_t i = 0; i < inserts.size(); ++i) {
+                inserted[i] = insertLocked(connection->db, connection->insertStatements,
+                                           inserts[i]->metricId, inserts[i]->events, errors[i]);
+            }
+            if (sqlite3_exec(connection->db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+                error = sqlite3_errmsg(connection->db);
+                sqlite3_exec(connection->db, "ROLLBACK;", nullptr, nullptr, nullptr);
+                std::fill(inserted.begin(), inserted.end(), false);
+            }
+        }
+        for (size_t i = 0; i < inserts.size(); ++i) {
+            if (!inserted[i] && errors[i].empty()) {
+                errors[i] = error;
+            }
+        }
     }
-    sqlite3_finalize(stmt);
-    return true;
+    const int64_t writtenNs = getElapsedRealtimeNs();
+    for (size_t i = 0; i < inserts.size(); ++i) {
+        const int64_t metricId = inserts[i]->metricId;
+        if (inserted[i]) {
+            StatsdStats::getInstance().noteRestrictedMetricFlushLatency(
+                    key, metricId, writtenNs - inserts[i]->flushStartNs);
+        } else {
+            ALOGE("Failed to insert logEvent to table for metric %lld. err=%s",
+                  (long long)metricId, errors[i].c_str());
+            StatsdStats::getInstance().noteRestrictedMetricInsertError(key, metricId);
+        }
+    }
+}
+
+void PendingInserts::enqueue(PendingInsert insert) {
+    const size_t numEvents = insert.events.size();
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWrittenCv.wait(lock, [this, numEvents] {
+            return mPendingEvents == 0 || mPendingEvents + numEvents <= kMaxPendingInsertEvents;
+        });
+        if (!mWriter.joinable()) {
+            mWriter = std::thread([this] { writerLoop(); });
+        }
+        mPendingEvents += numEvents;
+        mQueue.push_back(std::move(insert));
+    }
+    mQueueCv.notify_one();
+}
+
+void PendingInserts::waitForIdle() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWrittenCv.wait(lock, [this] { return mQueue.empty() && !mWriting; });
+}
+
+void PendingInserts::writerLoop() {
+    configureStatsdThread("statsd.db");
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mQueueCv.wait(lock, [this] { return !mQueue.empty(); });
+        // Takes all the queued inserts, the more there are the fewer transactions are needed.
+        std::deque<PendingInsert> inserts;
+        inserts.swap(mQueue);
+        mWriting = true;
+        lock.unlock();
+
+        std::map<ConfigKey, vector<PendingInsert*>> insertsByConfig;
+        size_t numEvents = 0;
+        for (PendingInsert& insert : inserts) {
+            insertsByConfig[insert.key].push_back(&insert);
+            numEvents += insert.events.size();
+        }
+        for (const auto& [key, configInserts] : insertsByConfig) {
+            writePendingInserts(key, configInserts);
+        }
+        inserts.clear();
+
+        lock.lock();
+        mWriting = false;
+        mPendingEvents -= numEvents;
+        mWrittenCv.notify_all();
+    }
+}
+
+void insertAsync(const ConfigKey& key, const int64_t metricId, vector<LogEvent>&& events,
+                 const int64_t flushStartNs) {
+    if (events.empty()) {
+        return;
+    }
+    getPendingInserts().enqueue({key, metricId, std::move(events), flushStartNs});
+}
+
+void flushPendingInserts() {
+    getPendingInserts().waitForIdle();
 }
 
 bool query(const ConfigKey& key, const string& zSql, vector<vector<string>>& rows,
            vector<int32_t>& columnTypes, vector<string>& columnNames, string& err) {
-    const string dbName = getDbName(key);
-    sqlite3* db;
-    if (sqlite3_open_v2(dbName.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
-        err = sqlite3_errmsg(db);
-        sqlite3_close(db);
+    ReadOnlyDb db(key, err);
+    if (db.get() == nullptr) {
         return false;
     }
+    return queryDb(db.get(), zSql, rows, columnTypes, columnNames, err);
+}
+
+static void readColumns(sqlite3_stmt* stmt, vector<int32_t>& columnTypes,
+                        vector<string>& columnNames) {
+    const int colCount = sqlite3_column_count(stmt);
+    for (int i = 0; i < colCount; ++i) {
+        int32_t columnType = sqlite3_column_type(stmt, i);
+        // Needed to convert to java compatible cursor types. See AbstractCursor#getType()
+        if (columnType == 5) {
+            columnType = 0;  // Remap 5 (null type) to 0 for java cursor
+        }
+        columnTypes.push_back(columnType);
+        columnNames.push_back(reinterpret_cast<const char*>(sqlite3_column_name(stmt, i)));
+    }
+}
+
+static string readColumnText(sqlite3_stmt* stmt, const int column) {
+    const unsigned char* textResult = sqlite3_column_text(stmt, column);
+    return textResult != nullptr ? string(reinterpret_cast<const char*>(textResult)) : "";
+}
+
+static bool queryDb(sqlite3* db, const string& zSql, vector<vector<string>>& rows,
+                    vector<int32_t>& columnTypes, vector<string>& columnNames, string& err) {
     sqlite3_stmt* stmt;
     if (sqlite3_prepare_v2(db, zSql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
         err = sqlite3_errmsg(db);
         sqlite3_finalize(stmt);
-        sqlite3_close(db);
         return false;
     }
     int result = sqlite3_step(stmt);
     bool firstIter = true;
     while (result == SQLITE_ROW) {
+        if (firstIter) {
+            readColumns(stmt, columnTypes, columnNames);
+        }
         int colCount = sqlite3_column_count(stmt);
         vector<string> rowData(colCount);
         for (int i = 0; i < colCount; ++i) {
-            if (firstIter) {
-                int32_t columnType = sqlite3_column_type(stmt, i);
-                // Needed to convert to java compatible cursor types. See AbstractCursor#getType()
-                if (columnType == 5) {
-                    columnType = 0;  // Remap 5 (null type) to 0 for java cursor
-                }
-                columnTypes.push_back(columnType);
-                columnNames.push_back(reinterpret_cast<const char*>(sqlite3_column_name(stmt, i)));
-            }
-            const unsigned char* textResult = sqlite3_column_text(stmt, i);
-            string colData =
-                    textResult != nullptr ? string(reinterpret_cast<const char*>(textResult)) : "";
-            rowData[i] = std::move(colData);
+            rowData[i] = readColumnText(stmt, i);
         }
         rows.push_back(std::move(rowData));
         firstIter = false;
@@ -354,28 +817,104 @@ bool query(const ConfigKey& key, const string& zSql, vector<vector<string>>& row
     sqlite3_finalize(stmt);
     if (result != SQLITE_DONE) {
         err = sqlite3_errmsg(db);
-        sqlite3_close(db);
         return false;
     }
-    sqlite3_close(db);
     return true;
 }
 
-bool flushTtl(sqlite3* db, const int64_t metricId, const int64_t ttlWallClockNs) {
-    string zSql = StringPrintf("DELETE FROM %s%s WHERE %s <= %lld", TABLE_NAME_PREFIX.c_str(),
-                               reformatMetricId(metricId).c_str(),
-                               COLUMN_NAME_EVENT_WALL_CLOCK_NS.c_str(), (long long)ttlWallClockNs);
-
-    char* error = nullptr;
-    sqlite3_exec(db, zSql.c_str(), nullptr, nullptr, &error);
-    if (error) {
-        ALOGW("Failed to enforce ttl: %s", error);
+bool query(const ConfigKey& key, const string& zSql, const size_t maxPageBytes,
+           const QueryPageCallback& onPage, vector<int32_t>& columnTypes,
+           vector<string>& columnNames, string& err) {
+    ReadOnlyDb readOnlyDb(key, err);
+    sqlite3* db = readOnlyDb.get();
+    if (db == nullptr) {
+        return false;
+    }
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, zSql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        err = sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    vector<string> pageData;
+    int32_t pageRows = 0;
+    size_t pageBytes = 0;
+    bool firstIter = true;
+    int result = sqlite3_step(stmt);
+    while (result == SQLITE_ROW) {
+        if (firstIter) {
+            readColumns(stmt, columnTypes, columnNames);
+            firstIter = false;
+        }
+        const int colCount = sqlite3_column_count(stmt);
+        for (int i = 0; i < colCount; ++i) {
+            pageData.push_back(readColumnText(stmt, i));
+            // The length and the UTF-16 characters of the string in the parcel.
+            pageBytes += sizeof(int32_t) + (pageData.back().size() + 1) * sizeof(char16_t);
+        }
+        pageRows++;
+        // Steps first to know whether this is the last page.
+        result = sqlite3_step(stmt);
+        if (result == SQLITE_ROW && pageBytes < maxPageBytes) {
+            continue;
+        }
+        if (result != SQLITE_ROW && result != SQLITE_DONE) {
+            break;
+        }
+        if (!onPage(pageData, pageRows, /*isLastPage=*/result == SQLITE_DONE)) {
+            sqlite3_finalize(stmt);
+            err = "Query cancelled";
+            return false;
+        }
+        if (result == SQLITE_DONE) {
+            sqlite3_finalize(stmt);
+            return true;
+        }
+        pageData.clear();
+        pageRows = 0;
+        pageBytes = 0;
+    }
+    if (result != SQLITE_DONE) {
+        err = sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    sqlite3_finalize(stmt);
+    // There were no rows.
+    if (!onPage(pageData, /*rowCount=*/0, /*isLastPage=*/true)) {
+        err = "Query cancelled";
         return false;
     }
     return true;
 }
 
+bool flushTtl(sqlite3* db, const int64_t metricId, const int64_t ttlWallClockNs) {
+    const string tableName = TABLE_NAME_PREFIX + reformatMetricId(metricId);
+    // Ranges of the wall clock index, each deleted in a transaction of its own.
+    string zSql = StringPrintf(
+            "DELETE FROM %s WHERE rowid IN (SELECT rowid FROM %s WHERE %s <= %lld LIMIT %d)",
+            tableName.c_str(), tableName.c_str(), COLUMN_NAME_EVENT_WALL_CLOCK_NS.c_str(),
+            (long long)ttlWallClockNs, kMaxTtlDeletedRowsPerTransaction);
+    while (true) {
+        // Released between the ranges, for the queued inserts.
+        std::unique_lock<std::mutex> lock = lockDb();
+        char* error = nullptr;
+        sqlite3_exec(db, zSql.c_str(), nullptr, nullptr, &error);
+        if (error) {
+            ALOGW("Failed to enforce ttl: %s", error);
+            sqlite3_free(error);
+            return false;
+        }
+        if (sqlite3_changes(db) < kMaxTtlDeletedRowsPerTransaction) {
+            return true;
+        }
+    }
+}
+
 void verifyIntegrityAndDeleteIfNecessary(const ConfigKey& configKey) {
+    std::unique_lock<std::mutex> lock = lockDb();
+    // Checks the db file with all the data checkpointed into it, from a handle of its own.
+    sDbConnections.erase(configKey);
     const string dbName = getDbName(configKey);
     sqlite3* db;
     if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK) {
@@ -389,8 +928,9 @@ void verifyIntegrityAndDeleteIfNecessary(const ConfigKey& configKey) {
     if (error) {
         StatsdStats::getInstance().noteDbCorrupted(configKey);
         ALOGW("Integrity Check failed %s", error);
+        sqlite3_free(error);
         sqlite3_close(db);
-        deleteDb(configKey);
+        deleteDbLocked(configKey);
         return;
     }
     sqlite3_close(db);
@@ -450,13 +990,12 @@ static bool getDeviceInfoInsertStmt(sqlite3* db, sqlite3_stmt** stmt, string err
 }
 
 bool updateDeviceInfoTable(const ConfigKey& key, string& error) {
-    const string dbName = getDbName(key);
-    sqlite3* db;
-    if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK) {
-        error = sqlite3_errmsg(db);
-        sqlite3_close(db);
+    std::unique_lock<std::mutex> lock = lockDb();
+    DbConnection* connection = openDbLocked(key, &error);
+    if (connection == nullptr) {
         return false;
     }
+    sqlite3* db = connection->db;
 
     string dropTableSql = "DROP TABLE device_info";
     // Ignore possible error result code if table has not yet been created.
@@ -473,7 +1012,6 @@ bool updateDeviceInfoTable(const ConfigKey& key, string& error) {
     if (sqlite3_exec(db, createTableSql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
         error = sqlite3_errmsg(db);
         ALOGW("Failed to create device info table %s", error.c_str());
-        sqlite3_close(db);
         return false;
     }
 
@@ -481,7 +1019,6 @@ bool updateDeviceInfoTable(const ConfigKey& key, string& error) {
     if (!getDeviceInfoInsertStmt(db, &stmt, error)) {
         ALOGW("Failed to generate device info prepared sql insert query %s", error.c_str());
         sqlite3_finalize(stmt);
-        sqlite3_close(db);
         return false;
     }
 
@@ -489,11 +1026,9 @@ bool updateDeviceInfoTable(const ConfigKey& key, string& error) {
         error = sqlite3_errmsg(db);
         ALOGW("Failed to insert data to device info table: %s", error.c_str());
         sqlite3_finalize(stmt);
-        sqlite3_close(db);
         return false;
     }
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
     return true;
 }
 }  // namespace dbutils
@@ -17,6 +17,8 @@
 
 #include <sqlite3.h>
 
+#include <functional>
+
 #include "config/ConfigKey.h"
 #include "logd/LogEvent.h"
 
@@ -38,6 +40,9 @@ string getDbName(const ConfigKey& key);
 
 string reformatMetricId(const int64_t metricId);
 
+/* Returns the column types of the atom fields in the data table storing the event. */
+vector<string> getTableSchema(const LogEvent& event);
+
 /* Creates a new data table for a specified metric if one does not yet exist. */
 bool createTableIfNeeded(const ConfigKey& key, const int64_t metricId, const LogEvent& event);
 
@@ -52,16 +57,29 @@ bool deleteTable(const ConfigKey& key, const int64_t metricId);
 /* Deletes the SQLite db data file. */
 void deleteDb(const ConfigKey& key);
 
-/* Gets a handle to the sqlite db. You must call closeDb to free the allocated memory.
+/* Gets a handle to the sqlite db. You must call closeDb when done with it.
+ * The handle is kept open and shared with the other functions taking the same ConfigKey, it must
+ * not be used concurrently with them.
  * Returns a nullptr if an error occurs.
  */
 sqlite3* getDb(const ConfigKey& key);
 
-/* Closes the handle to the sqlite db. */
+/* Releases the handle to the sqlite db. */
 void closeDb(sqlite3* db);
 
+/* Closes the handles kept open to the sqlite db, which checkpoints its write-ahead log into the
+ * db file. They are opened again on the next access.
+ */
+void releaseDb(const ConfigKey& key);
+
+/* Returns the generation of the handles kept open to the sqlite db. It changes when they are
+ * opened again, e.g. after releaseDb or once the db file was deleted or replaced, so that the
+ * callers know when to check the tables again.
+ */
+uint64_t getDbGeneration(const ConfigKey& key);
+
 /* Inserts new data into the specified metric data table.
- * A temp sqlite handle is created using the ConfigKey.
+ * Uses the sqlite handle kept open for the ConfigKey.
  */
 bool insert(const ConfigKey& key, const int64_t metricId, const vector<LogEvent>& events,
             string& error);
@@ -69,12 +87,41 @@ bool insert(const ConfigKey& key, const int64_t metricId, const vector<LogEvent>
 /* Inserts new data into the specified sqlite db handle. */
 bool insert(sqlite3* db, const int64_t metricId, const vector<LogEvent>& events, string& error);
 
+/* Queues new data to be inserted into the specified metric data table by the db writer thread.
+ * The table must already exist. The inserts queued for a ConfigKey are written together in one
+ * transaction, insert errors and flush latencies are reported to StatsdStats.
+ * Blocks while too many events are queued already. All the other functions wait for the queued
+ * data to be inserted before accessing the db.
+ */
+void insertAsync(const ConfigKey& key, const int64_t metricId, vector<LogEvent>&& events,
+                 const int64_t flushStartNs);
+
+/* Waits for the data queued by insertAsync to be inserted. */
+void flushPendingInserts();
+
 /* Executes a sql query on the specified SQLite db.
- * A temp sqlite handle is created using the ConfigKey.
+ * Uses one of the read-only sqlite handles kept open for the ConfigKey, without locking the other
+ * handles: queries run concurrently with each other and with the inserts. The query sees the data
+ * queued by insertAsync before the call.
  */
 bool query(const ConfigKey& key, const string& zSql, vector<vector<string>>& rows,
            vector<int32_t>& columnTypes, vector<string>& columnNames, string& err);
 
+/* Called with each page of query results, the values of its rows one after the other. The page
+ * data can be moved from. Returning false stops the query.
+ */
+using QueryPageCallback =
+        std::function<bool(vector<string>& pageData, int32_t rowCount, bool isLastPage)>;
+
+/* Executes a sql query on the specified SQLite db, delivering the rows by pages of about
+ * maxPageBytes of their values in a parcel, rather than all at once. The columns are set before
+ * the first page. The last page is delivered, possibly empty, unless an error occurs first.
+ * Uses a read-only sqlite handle like the other query, onPage may access the db.
+ */
+bool query(const ConfigKey& key, const string& zSql, const size_t maxPageBytes,
+           const QueryPageCallback& onPage, vector<int32_t>& columnTypes,
+           vector<string>& columnNames, string& err);
+
 bool flushTtl(sqlite3* db, const int64_t metricId, const int64_t ttlWallClockNs);
 
 /* Checks for database corruption and deletes the db if it is corrupted. */
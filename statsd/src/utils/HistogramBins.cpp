@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HistogramBins.h"
+
+#include <cmath>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::nullopt;
+using std::optional;
+using std::vector;
+
+optional<HistogramBins> HistogramBins::create(vector<double> boundaries) {
+    if (boundaries.empty() || boundaries.size() > kMaxBoundaryCount) {
+        return nullopt;
+    }
+    for (size_t i = 0; i < boundaries.size(); i++) {
+        if (!std::isfinite(boundaries[i]) || (i > 0 && boundaries[i] <= boundaries[i - 1])) {
+            return nullopt;
+        }
+    }
+    return HistogramBins(std::move(boundaries));
+}
+
+optional<HistogramBins> HistogramBins::createLinear(const double min, const double max,
+                                                    const int binCount) {
+    if (binCount <= 0 || (size_t)binCount >= kMaxBoundaryCount || !(min < max)) {
+        return nullopt;
+    }
+    vector<double> boundaries(binCount + 1);
+    const double width = (max - min) / binCount;
+    for (int i = 0; i < binCount; i++) {
+        boundaries[i] = min + i * width;
+    }
+    boundaries[binCount] = max;
+    return create(std::move(boundaries));
+}
+
+optional<HistogramBins> HistogramBins::createExponential(const double min, const double max,
+                                                         const int binCount) {
+    if (binCount <= 0 || (size_t)binCount >= kMaxBoundaryCount || !(0 < min && min < max)) {
+        return nullopt;
+    }
+    vector<double> boundaries(binCount + 1);
+    const double factor = std::pow(max / min, 1.0 / binCount);
+    for (int i = 0; i < binCount; i++) {
+        boundaries[i] = min * std::pow(factor, i);
+    }
+    boundaries[binCount] = max;
+    return create(std::move(boundaries));
+}
+
+size_t HistogramBins::getBinIndex(const double value) const {
+    // Counts the boundaries up to value with a binary search whose steps are conditional moves
+    // rather than branches, since the values of an atom are rarely predictable.
+    const double* base = mBoundaries.data();
+    size_t size = mBoundaries.size();
+    while (size > 1) {
+        const size_t half = size / 2;
+        base = base[half] <= value ? base + half : base;
+        size -= half;
+    }
+    return (base - mBoundaries.data()) + (*base <= value);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <optional>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Bins of a histogram, split by increasing boundaries.
+ *
+ * With n boundaries there are n + 1 bins: bin 0 counts the values below the first boundary, bin i
+ * the values in [boundary i - 1, boundary i), and the last bin the values from the last boundary
+ * up.
+ */
+class HistogramBins {
+public:
+    // Bounds the size of the count array kept per dimension and value field.
+    static constexpr size_t kMaxBoundaryCount = 100;
+
+    // Returns nullopt unless there are 1 to kMaxBoundaryCount strictly increasing, finite
+    // boundaries.
+    static std::optional<HistogramBins> create(std::vector<double> boundaries);
+
+    // binCount bins of equal width between min and max.
+    static std::optional<HistogramBins> createLinear(double min, double max, int binCount);
+
+    // binCount bins between min and max, each wider than the previous one by the same factor.
+    // min must be positive.
+    static std::optional<HistogramBins> createExponential(double min, double max, int binCount);
+
+    // Returns the bin of value. NaN values count in bin 0.
+    size_t getBinIndex(double value) const;
+
+    inline size_t getBinCount() const {
+        return mBoundaries.size() + 1;
+    }
+
+    inline const std::vector<double>& getBoundaries() const {
+        return mBoundaries;
+    }
+
+private:
+    explicit HistogramBins(std::vector<double> boundaries) : mBoundaries(std::move(boundaries)) {
+    }
+
+    std::vector<double> mBoundaries;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HyperLogLog.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+int clampPrecision(const int precision) {
+    return std::clamp(precision, HyperLogLog::kMinPrecision, HyperLogLog::kMaxPrecision);
+}
+
+// Bias correction constant of the raw estimate, from the HyperLogLog paper.
+double alpha(const size_t registerCount) {
+    switch (registerCount) {
+        case 16:
+            return 0.673;
+        case 32:
+            return 0.697;
+        case 64:
+            return 0.709;
+        default:
+            return 0.7213 / (1 + 1.079 / registerCount);
+    }
+}
+
+}  // anonymous namespace
+
+HyperLogLog::HyperLogLog(const int precision)
+    : mPrecision(clampPrecision(precision)), mRegisters(size_t(1) << mPrecision, 0) {
+}
+
+void HyperLogLog::add(const uint64_t hash) {
+    // The top bits pick the register, which keeps the rank of the first set bit in the rest.
+    const size_t index = hash >> (64 - mPrecision);
+    const uint64_t rest = hash << mPrecision;
+    const uint8_t rank = rest == 0 ? 64 - mPrecision + 1 : __builtin_clzll(rest) + 1;
+    mRegisters[index] = std::max(mRegisters[index], rank);
+}
+
+bool HyperLogLog::merge(const HyperLogLog& other) {
+    if (other.mPrecision != mPrecision) {
+        return false;
+    }
+    for (size_t i = 0; i < mRegisters.size(); i++) {
+        mRegisters[i] = std::max(mRegisters[i], other.mRegisters[i]);
+    }
+    return true;
+}
+
+int64_t HyperLogLog::estimate() const {
+    const double registerCount = mRegisters.size();
+    double sum = 0;
+    size_t zeroRegisters = 0;
+    for (const uint8_t rank : mRegisters) {
+        sum += std::ldexp(1.0, -rank);
+        zeroRegisters += rank == 0;
+    }
+    double estimate = alpha(mRegisters.size()) * registerCount * registerCount / sum;
+    // Small cardinalities are better estimated by linear counting of the empty registers. With
+    // 64 bit hashes, no correction is needed for large ones.
+    if (estimate <= 2.5 * registerCount && zeroRegisters > 0) {
+        estimate = registerCount * std::log(registerCount / zeroRegisters);
+    }
+    return std::llround(estimate);
+}
+
+vector<uint8_t> HyperLogLog::serialize() const {
+    vector<uint8_t> data;
+    data.reserve(1 + mRegisters.size());
+    data.push_back(mPrecision);
+    data.insert(data.end(), mRegisters.begin(), mRegisters.end());
+    return data;
+}
+
+unique_ptr<HyperLogLog> HyperLogLog::deserialize(const uint8_t* data, const size_t size) {
+    if (size < 1 || data[0] != clampPrecision(data[0]) || size != 1 + (size_t(1) << data[0])) {
+        return nullptr;
+    }
+    unique_ptr<HyperLogLog> sketch = std::make_unique<HyperLogLog>(data[0]);
+    const uint8_t maxRank = 64 - sketch->mPrecision + 1;
+    for (size_t i = 0; i < sketch->mRegisters.size(); i++) {
+        if (data[1 + i] > maxRank) {
+            return nullptr;
+        }
+        sketch->mRegisters[i] = data[1 + i];
+    }
+    return sketch;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Approximate distinct counter over 64 bit hashes.
+ *
+ * The sketch has 2^precision one byte registers, whatever the number of values added, and has a
+ * relative standard error of about 1.04 / sqrt(2^precision). Sketches with the same precision
+ * merge into the sketch of the union of their values.
+ */
+class HyperLogLog {
+public:
+    static constexpr int kMinPrecision = 4;
+    static constexpr int kMaxPrecision = 16;
+    // 1024 registers, for an error of about 3%.
+    static constexpr int kDefaultPrecision = 10;
+
+    explicit HyperLogLog(int precision = kDefaultPrecision);
+
+    // hash must be uniformly distributed over its 64 bits.
+    void add(uint64_t hash);
+
+    // Returns false, and leaves this sketch unchanged, if other has another precision.
+    bool merge(const HyperLogLog& other);
+
+    int64_t estimate() const;
+
+    // Encodes the sketch as its precision followed by its registers.
+    std::vector<uint8_t> serialize() const;
+
+    // Returns nullptr if data is not a sketch encoded by serialize().
+    static std::unique_ptr<HyperLogLog> deserialize(const uint8_t* data, size_t size);
+
+    inline int getPrecision() const {
+        return mPrecision;
+    }
+
+    inline size_t getRegisterCount() const {
+        return mRegisters.size();
+    }
+
+private:
+    const int mPrecision;
+
+    std::vector<uint8_t> mRegisters;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
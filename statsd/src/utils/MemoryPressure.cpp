@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MemoryPressure.h"
+
+#include <stdio.h>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+// Share of the last 10s during which some tasks stalled on memory, in percent, above which the
+// device is considered under memory pressure.
+constexpr float kMemoryPressureThreshold = 10.0f;
+
+}  // anonymous namespace
+
+bool isUnderMemoryPressure() {
+    FILE* file = fopen("/proc/pressure/memory", "re");
+    if (file == nullptr) {
+        // No PSI support in the kernel.
+        return false;
+    }
+    float stalledPercent = 0;
+    const bool parsed = fscanf(file, "some avg10=%f", &stalledPercent) == 1;
+    fclose(file);
+    return parsed && stalledPercent >= kMemoryPressureThreshold;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -18,6 +18,8 @@
 
 #include "MultiConditionTrigger.h"
 
+#include "utils/ThreadConfig.h"
+
 using namespace std;
 
 namespace android {
@@ -51,7 +53,10 @@ void MultiConditionTrigger::markComplete(const string& conditionName) {
 }
 
 void MultiConditionTrigger::startExecutorThread() {
-    mExecutorThread = make_unique<thread>([this] { mTrigger(); });
+    mExecutorThread = make_unique<thread>([this] {
+        configureStatsdThread("statsd.trigger");
+        mTrigger();
+    });
 }
 
 MultiConditionTrigger::~MultiConditionTrigger() {
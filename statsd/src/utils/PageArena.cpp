@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PageArena.h"
+
+#include <string.h>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+PageArena::PageArena(size_t pageSize) : mPageSize(pageSize) {
+}
+
+std::span<const uint8_t> PageArena::copy(std::span<const uint8_t> bytes) {
+    const size_t size = bytes.size();
+    uint8_t* destination;
+    if (size > mPageSize) {
+        // The current page keeps being filled after an oversized allocation.
+        mPages.emplace_back(new uint8_t[size]);
+        mCapacityBytes += size;
+        destination = mPages.back().get();
+    } else {
+        if (size > mRemaining) {
+            mPages.emplace_back(new uint8_t[mPageSize]);
+            mCapacityBytes += mPageSize;
+            mCursor = mPages.back().get();
+            mRemaining = mPageSize;
+        }
+        destination = mCursor;
+        mCursor += size;
+        mRemaining -= size;
+    }
+    if (size > 0) {
+        memcpy(destination, bytes.data(), size);
+    }
+    return std::span<const uint8_t>(destination, size);
+}
+
+void PageArena::clear() {
+    mPages.clear();
+    mCursor = nullptr;
+    mRemaining = 0;
+    mCapacityBytes = 0;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Append-only byte storage in a chain of fixed-size pages.
+ *
+ * Copied bytes never move until clear(), so callers can keep spans and string_views over them.
+ * An allocation that does not fit in the remaining space of the current page starts a new page,
+ * and one larger than a page gets a page of its own.
+ */
+class PageArena {
+public:
+    static constexpr size_t kDefaultPageSize = 4096;
+
+    explicit PageArena(size_t pageSize = kDefaultPageSize);
+
+    PageArena(const PageArena&) = delete;
+    PageArena& operator=(const PageArena&) = delete;
+
+    // Copies the bytes into the arena and returns where they are stored.
+    std::span<const uint8_t> copy(std::span<const uint8_t> bytes);
+
+    // Releases all the pages.
+    void clear();
+
+    // Bytes held by the pages, used or not.
+    size_t capacityBytes() const {
+        return mCapacityBytes;
+    }
+
+    size_t pageCount() const {
+        return mPages.size();
+    }
+
+private:
+    const size_t mPageSize;
+
+    std::vector<std::unique_ptr<uint8_t[]>> mPages;
+
+    // Free space left in the last regular page.
+    uint8_t* mCursor = nullptr;
+    size_t mRemaining = 0;
+
+    size_t mCapacityBytes = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
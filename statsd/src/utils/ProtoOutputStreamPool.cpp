@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ProtoOutputStreamPool.h"
+
+#include <algorithm>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::util::ProtoOutputStream;
+using std::lock_guard;
+using std::unique_ptr;
+
+ProtoOutputStreamPool::Stream::~Stream() {
+    if (mStream != nullptr) {
+        mPool->release(std::move(mStream), mCapacityBytes);
+    }
+}
+
+ProtoOutputStreamPool::ProtoOutputStreamPool(std::function<bool()> isUnderMemoryPressure)
+    : mIsUnderMemoryPressure(std::move(isUnderMemoryPressure)) {
+}
+
+ProtoOutputStreamPool& ProtoOutputStreamPool::getInstance() {
+    static ProtoOutputStreamPool pool;
+    return pool;
+}
+
+ProtoOutputStreamPool::Stream ProtoOutputStreamPool::acquire() {
+    {
+        lock_guard<std::mutex> lock(mMutex);
+        if (!mIdleStreams.empty()) {
+            IdleStream idle = std::move(mIdleStreams.back());
+            mIdleStreams.pop_back();
+            mRetainedBytes -= idle.capacityBytes;
+            return Stream(this, std::move(idle.stream), idle.capacityBytes);
+        }
+    }
+    return Stream(this, std::make_unique<ProtoOutputStream>(), 0);
+}
+
+void ProtoOutputStreamPool::release(unique_ptr<ProtoOutputStream> stream, size_t capacityBytes) {
+    // The caller is done with the stream, so it is complete and size() does not fail.
+    capacityBytes = std::max(capacityBytes, stream->size());
+    if (mIsUnderMemoryPressure()) {
+        trim();
+        return;  // The stream is freed with its buffer.
+    }
+    if (capacityBytes > kMaxRetainedStreamBytes) {
+        return;
+    }
+    stream->clear();
+
+    lock_guard<std::mutex> lock(mMutex);
+    const auto it = std::upper_bound(
+            mIdleStreams.begin(), mIdleStreams.end(), capacityBytes,
+            [](size_t bytes, const IdleStream& idle) { return bytes < idle.capacityBytes; });
+    mIdleStreams.insert(it, {std::move(stream), capacityBytes});
+    mRetainedBytes += capacityBytes;
+    if (mIdleStreams.size() > kMaxIdleStreams) {
+        mRetainedBytes -= mIdleStreams.front().capacityBytes;
+        mIdleStreams.erase(mIdleStreams.begin());
+    }
+}
+
+void ProtoOutputStreamPool::trim() {
+    std::vector<IdleStream> idleStreams;
+    {
+        lock_guard<std::mutex> lock(mMutex);
+        idleStreams.swap(mIdleStreams);
+        mRetainedBytes = 0;
+    }
+    // The buffers are freed outside of the lock.
+}
+
+size_t ProtoOutputStreamPool::getRetainedBytes() const {
+    lock_guard<std::mutex> lock(mMutex);
+    return mRetainedBytes;
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/util/ProtoOutputStream.h>
+#include <gtest/gtest_prod.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils/MemoryPressure.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * Idle ProtoOutputStreams kept across reports, dumps and snapshots.
+ *
+ * A cleared ProtoOutputStream keeps the chunks of its buffer, so a stream taken from the pool
+ * writes a report of the size of the previous ones without allocating. The streams that grew the
+ * largest are kept, up to kMaxIdleStreams of them and kMaxRetainedStreamBytes each, and the pool
+ * is emptied when the device is under memory pressure.
+ */
+class ProtoOutputStreamPool {
+public:
+    static constexpr size_t kMaxIdleStreams = 4;
+    static constexpr size_t kMaxRetainedStreamBytes = 2 * 1024 * 1024;
+
+    // A stream taken from the pool, which is cleared and given back when the handle is destroyed.
+    class Stream {
+    public:
+        Stream(Stream&& other) = default;
+        Stream& operator=(Stream&& other) = delete;
+        ~Stream();
+
+        inline util::ProtoOutputStream& operator*() const {
+            return *mStream;
+        }
+
+        inline util::ProtoOutputStream* operator->() const {
+            return mStream.get();
+        }
+
+        inline util::ProtoOutputStream* get() const {
+            return mStream.get();
+        }
+
+    private:
+        Stream(ProtoOutputStreamPool* pool, std::unique_ptr<util::ProtoOutputStream> stream,
+               size_t capacityBytes)
+            : mPool(pool), mStream(std::move(stream)), mCapacityBytes(capacityBytes) {
+        }
+
+        ProtoOutputStreamPool* mPool;
+        std::unique_ptr<util::ProtoOutputStream> mStream;
+        // Largest size the stream has reached, which its buffer still holds.
+        size_t mCapacityBytes;
+
+        friend class ProtoOutputStreamPool;
+    };
+
+    explicit ProtoOutputStreamPool(
+            std::function<bool()> isUnderMemoryPressure = statsd::isUnderMemoryPressure);
+
+    static ProtoOutputStreamPool& getInstance();
+
+    // Returns the idle stream with the largest buffer, or a new stream if none is idle.
+    Stream acquire();
+
+    // Frees the idle streams.
+    void trim();
+
+    // Returns the bytes held by the buffers of the idle streams.
+    size_t getRetainedBytes() const;
+
+private:
+    struct IdleStream {
+        std::unique_ptr<util::ProtoOutputStream> stream;
+        size_t capacityBytes;
+    };
+
+    void release(std::unique_ptr<util::ProtoOutputStream> stream, size_t capacityBytes);
+
+    const std::function<bool()> mIsUnderMemoryPressure;
+
+    mutable std::mutex mMutex;
+
+    // Sorted by increasing capacity.
+    std::vector<IdleStream> mIdleStreams;
+
+    size_t mRetainedBytes = 0;
+
+    FRIEND_TEST(ProtoOutputStreamPoolTest, TestLargestStreamsAreKept);
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A history of the last N elements pushed, stored inline.
+ *
+ * Once full, pushing an element overwrites the oldest one, so the buffer never allocates.
+ * Iteration goes from the oldest element to the newest.
+ */
+template <class T, size_t N>
+class RingBuffer {
+    static_assert(N > 0, "RingBuffer needs room for at least one element");
+
+public:
+    using value_type = T;
+    using size_type = size_t;
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator(const RingBuffer* buffer, size_t index) : mBuffer(buffer), mIndex(index) {
+        }
+
+        reference operator*() const {
+            return (*mBuffer)[mIndex];
+        }
+
+        pointer operator->() const {
+            return &(*mBuffer)[mIndex];
+        }
+
+        const_iterator& operator++() {
+            mIndex++;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator it = *this;
+            mIndex++;
+            return it;
+        }
+
+        bool operator==(const const_iterator& that) const {
+            return mIndex == that.mIndex;
+        }
+
+        bool operator!=(const const_iterator& that) const {
+            return mIndex != that.mIndex;
+        }
+
+    private:
+        const RingBuffer* mBuffer;
+        // Position from the oldest element.
+        size_t mIndex;
+    };
+
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+
+    bool empty() const {
+        return mSize == 0;
+    }
+
+    bool full() const {
+        return mSize == N;
+    }
+
+    void push_back(T value) {
+        mData[(mStart + mSize) % N] = std::move(value);
+        if (mSize < N) {
+            mSize++;
+        } else {
+            mStart = (mStart + 1) % N;
+        }
+    }
+
+    template <class... Args>
+    void emplace_back(Args&&... args) {
+        push_back(T(std::forward<Args>(args)...));
+    }
+
+    // Elements are not destroyed, only forgotten.
+    void clear() {
+        mStart = 0;
+        mSize = 0;
+    }
+
+    // index 0 is the oldest element.
+    const T& operator[](size_t index) const {
+        return mData[(mStart + index) % N];
+    }
+
+    const T& front() const {
+        return mData[mStart];
+    }
+
+    const T& back() const {
+        return (*this)[mSize - 1];
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, mSize);
+    }
+
+private:
+    std::array<T, N> mData{};
+
+    // Position of the oldest element in mData.
+    size_t mStart = 0;
+
+    size_t mSize = 0;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
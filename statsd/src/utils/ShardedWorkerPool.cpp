@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "utils/ShardedWorkerPool.h"
+
+#include "utils/ThreadConfig.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+ShardedWorkerPool::ShardedWorkerPool(size_t numShards) {
+    for (size_t shard = 1; shard < numShards; shard++) {
+        mWorkers.emplace_back([this, shard] { workerLoop(shard); });
+    }
+}
+
+ShardedWorkerPool::~ShardedWorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mTaskCv.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+void ShardedWorkerPool::runOnAllShards(const std::function<void(size_t shard)>& task) {
+    if (mWorkers.empty()) {
+        task(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTask = &task;
+        mPendingWorkers = mWorkers.size();
+        mTaskGeneration++;
+    }
+    mTaskCv.notify_all();
+
+    task(0);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDoneCv.wait(lock, [this] { return mPendingWorkers == 0; });
+    mTask = nullptr;
+}
+
+void ShardedWorkerPool::workerLoop(size_t shard) {
+    configureStatsdThread("statsd.shard");
+    uint64_t lastTaskGeneration = 0;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mTaskCv.wait(lock, [this, lastTaskGeneration] {
+            return mStopping || mTaskGeneration != lastTaskGeneration;
+        });
+        if (mStopping) {
+            return;
+        }
+        lastTaskGeneration = mTaskGeneration;
+        const std::function<void(size_t)>* task = mTask;
+
+        lock.unlock();
+        (*task)(shard);
+        lock.lock();
+
+        if (--mPendingWorkers == 0) {
+            mDoneCv.notify_one();
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A fixed set of threads, each owning one shard of some work.
+ *
+ * runOnAllShards() runs a task once for every shard, always on the thread owning that shard, and
+ * returns once every shard is done. Shard 0 is owned by the calling thread, so a pool of N shards
+ * starts N - 1 threads. Work given to the same shard is therefore processed in order.
+ */
+class ShardedWorkerPool {
+public:
+    explicit ShardedWorkerPool(size_t numShards);
+
+    ShardedWorkerPool(const ShardedWorkerPool&) = delete;
+    ShardedWorkerPool& operator=(const ShardedWorkerPool&) = delete;
+
+    ~ShardedWorkerPool();
+
+    size_t getNumShards() const {
+        return mWorkers.size() + 1;
+    }
+
+    /**
+     * Runs task(shard) for every shard in [0, getNumShards()) and blocks until all are done.
+     * Must not be called concurrently or from a task.
+     */
+    void runOnAllShards(const std::function<void(size_t shard)>& task);
+
+private:
+    void workerLoop(size_t shard);
+
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mMutex;
+
+    // Signals the workers that a new task is available or that the pool is stopping.
+    std::condition_variable mTaskCv;
+
+    // Signals runOnAllShards that all workers finished the current task.
+    std::condition_variable mDoneCv;
+
+    // Task currently being run. Only set while runOnAllShards is running.
+    const std::function<void(size_t)>* mTask = nullptr;
+
+    // Incremented every time a new task is posted, so workers can tell a new task apart from a
+    // spurious wakeup.
+    uint64_t mTaskGeneration = 0;
+
+    // Number of workers that did not finish the current task yet.
+    size_t mPendingWorkers = 0;
+
+    bool mStopping = false;
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
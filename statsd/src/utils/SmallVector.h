@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+/**
+ * A vector that keeps up to N elements inline and only allocates once it grows past them.
+ *
+ * Iterators are plain pointers, so a SmallVector converts to a std::span like a std::vector
+ * does. Like std::vector, growing or moving the vector invalidates pointers to its elements.
+ */
+template <class T, size_t N>
+class SmallVector {
+    static_assert(N > 0, "SmallVector needs room for at least one inline element");
+
+public:
+    using value_type = T;
+    using size_type = size_t;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    SmallVector() {
+    }
+
+    SmallVector(const T* first, const T* last) {
+        reserve(last - first);
+        for (; first != last; first++) {
+            new (mData + mSize) T(*first);
+            mSize++;
+        }
+    }
+
+    SmallVector(const SmallVector& that) : SmallVector(that.begin(), that.end()) {
+    }
+
+    SmallVector(SmallVector&& that) noexcept {
+        moveFrom(that);
+    }
+
+    ~SmallVector() {
+        clear();
+        releaseHeap();
+    }
+
+    SmallVector& operator=(const SmallVector& that) {
+        if (this != &that) {
+            clear();
+            reserve(that.size());
+            for (const T& value : that) {
+                new (mData + mSize) T(value);
+                mSize++;
+            }
+        }
+        return *this;
+    }
+
+    SmallVector& operator=(SmallVector&& that) noexcept {
+        if (this != &that) {
+            clear();
+            releaseHeap();
+            moveFrom(that);
+        }
+        return *this;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+
+    bool empty() const {
+        return mSize == 0;
+    }
+
+    size_t capacity() const {
+        return mCapacity;
+    }
+
+    // True while the elements are held in the inline buffer.
+    bool isInline() const {
+        return mData == inlineData();
+    }
+
+    T* data() {
+        return mData;
+    }
+
+    const T* data() const {
+        return mData;
+    }
+
+    T* begin() {
+        return mData;
+    }
+
+    const T* begin() const {
+        return mData;
+    }
+
+    T* end() {
+        return mData + mSize;
+    }
+
+    const T* end() const {
+        return mData + mSize;
+    }
+
+    T& operator[](size_t i) {
+        return mData[i];
+    }
+
+    const T& operator[](size_t i) const {
+        return mData[i];
+    }
+
+    T& front() {
+        return mData[0];
+    }
+
+    const T& front() const {
+        return mData[0];
+    }
+
+    T& back() {
+        return mData[mSize - 1];
+    }
+
+    const T& back() const {
+        return mData[mSize - 1];
+    }
+
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {
+        emplace_back(std::move(value));
+    }
+
+    template <class... Args>
+    T& emplace_back(Args&&... args) {
+        if (mSize < mCapacity) {
+            new (mData + mSize) T(std::forward<Args>(args)...);
+        } else {
+            // The new element is constructed before the old ones move, as args may refer to them.
+            const size_t capacity = 2 * mCapacity;
+            T* data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+            new (data + mSize) T(std::forward<Args>(args)...);
+            moveElementsTo(data);
+            releaseHeap();
+            mData = data;
+            mCapacity = capacity;
+        }
+        return mData[mSize++];
+    }
+
+    void pop_back() {
+        mSize--;
+        mData[mSize].~T();
+    }
+
+    // Destroys the elements, keeping the capacity.
+    void clear() {
+        for (size_t i = 0; i < mSize; i++) {
+            mData[i].~T();
+        }
+        mSize = 0;
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity <= mCapacity) {
+            return;
+        }
+        T* data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        moveElementsTo(data);
+        releaseHeap();
+        mData = data;
+        mCapacity = capacity;
+    }
+
+    bool operator==(const SmallVector& that) const {
+        return mSize == that.mSize && std::equal(begin(), end(), that.begin());
+    }
+
+    bool operator!=(const SmallVector& that) const {
+        return !(*this == that);
+    }
+
+private:
+    T* inlineData() {
+        return reinterpret_cast<T*>(mInline);
+    }
+
+    const T* inlineData() const {
+        return reinterpret_cast<const T*>(mInline);
+    }
+
+    // Move constructs the elements into [data] and destroys them here. mSize is unchanged.
+    void moveElementsTo(T* data) {
+        for (size_t i = 0; i < mSize; i++) {
+            new (data + i) T(std::move(mData[i]));
+            mData[i].~T();
+        }
+    }
+
+    void releaseHeap() {
+        if (!isInline()) {
+            ::operator delete(mData);
+            mData = inlineData();
+            mCapacity = N;
+        }
+    }
+
+    // Requires this to be empty and inline. Leaves [that] empty and inline.
+    void moveFrom(SmallVector& that) {
+        if (that.isInline()) {
+            that.moveElementsTo(mData);
+        } else {
+            mData = that.mData;
+            mCapacity = that.mCapacity;
+            that.mData = that.inlineData();
+            that.mCapacity = N;
+        }
+        mSize = that.mSize;
+        that.mSize = 0;
+    }
+
+    T* mData = inlineData();
+    size_t mSize = 0;
+    size_t mCapacity = N;
+    alignas(T) unsigned char mInline[N * sizeof(T)];
+};
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define STATSD_DEBUG false  // STOPSHIP if true
+#include "Log.h"
+
+#include "utils/ThreadConfig.h"
+
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+
+#include "stats_log_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::GetProperty;
+using android::base::ParseInt;
+using android::base::Split;
+using std::string;
+
+namespace {
+
+struct ThreadInfo {
+    string name;
+    pthread_t thread;
+    int policy;
+    int priority;
+};
+
+std::mutex sThreadsMutex;
+
+// By tid. A thread is removed by its ThreadRegistration before it exits, so that its pthread_t
+// is valid while sThreadsMutex is held.
+std::map<pid_t, ThreadInfo> sThreads;
+
+struct ThreadRegistration {
+    pid_t tid = 0;
+
+    ~ThreadRegistration() {
+        if (tid != 0) {
+            std::lock_guard<std::mutex> lock(sThreadsMutex);
+            sThreads.erase(tid);
+        }
+    }
+};
+
+thread_local ThreadRegistration tRegistration;
+
+const char* policyName(int policy) {
+    switch (policy) {
+        case SCHED_OTHER:
+            return "other";
+        case SCHED_BATCH:
+            return "batch";
+        case SCHED_IDLE:
+            return "idle";
+        case SCHED_FIFO:
+            return "fifo";
+        case SCHED_RR:
+            return "rr";
+        default:
+            return "unknown";
+    }
+}
+
+bool parsePolicy(const string& value, int* policy) {
+    for (int candidate : {SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO, SCHED_RR}) {
+        if (value == policyName(candidate)) {
+            *policy = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isRealTime(int policy) {
+    return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+bool parseCpus(const string& value, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    for (const string& range : Split(value, ",")) {
+        const std::vector<string> bounds = Split(range, "-");
+        int first;
+        int last;
+        if (bounds.size() > 2 || !ParseInt(bounds[0], &first, 0, CPU_SETSIZE - 1) ||
+            !ParseInt(bounds.back(), &last, first, CPU_SETSIZE - 1)) {
+            return false;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool parseThreadConfig(const string& policy, const string& priority, const string& cpus,
+                       ThreadConfig* config) {
+    if (!policy.empty()) {
+        int value;
+        if (!parsePolicy(policy, &value)) {
+            return false;
+        }
+        config->policy = value;
+    }
+    if (!priority.empty()) {
+        const bool realTime = config->policy.has_value() && isRealTime(*config->policy);
+        int value;
+        if (!(realTime ? ParseInt(priority, &value, 1, 99) : ParseInt(priority, &value, -20, 19))) {
+            return false;
+        }
+        config->priority = value;
+    }
+    if (!cpus.empty()) {
+        cpu_set_t value;
+        if (!parseCpus(cpus, &value)) {
+            return false;
+        }
+        config->cpus = value;
+    }
+    return true;
+}
+
+void configureStatsdThread(const char* name, int defaultNice) {
+    prctl(PR_SET_NAME, name);
+
+    string shortName(name);
+    if (android::base::StartsWith(shortName, "statsd.")) {
+        shortName = shortName.substr(strlen("statsd."));
+    }
+    const string prefix = "persist.statsd.thread." + shortName;
+    ThreadConfig config;
+    if (!parseThreadConfig(GetProperty(prefix + ".policy", ""),
+                           GetProperty(prefix + ".priority", ""), GetProperty(prefix + ".cpus", ""),
+                           &config)) {
+        ALOGW("Ignoring the invalid scheduling properties of %s", name);
+        config = ThreadConfig();
+    }
+
+    const int policy = config.policy.value_or(SCHED_OTHER);
+    int priority = 0;
+    if (isRealTime(policy)) {
+        priority = config.priority.value_or(1);
+        struct sched_param param = {.sched_priority = priority};
+        if (sched_setscheduler(0, policy, &param) != 0) {
+            ALOGW("Failed to set the %s policy of %s", policyName(policy), name);
+        }
+    } else {
+        struct sched_param param = {.sched_priority = 0};
+        if (policy != SCHED_OTHER && sched_setscheduler(0, policy, &param) != 0) {
+            ALOGW("Failed to set the %s policy of %s", policyName(policy), name);
+        }
+        priority = config.priority.value_or(defaultNice);
+        if (priority != 0 && setpriority(PRIO_PROCESS, 0, priority) != 0) {
+            ALOGW("Failed to set the priority of %s", name);
+        }
+    }
+    if (config.cpus && sched_setaffinity(0, sizeof(cpu_set_t), &*config.cpus) != 0) {
+        ALOGW("Failed to set the cpus of %s", name);
+    }
+
+    std::lock_guard<std::mutex> lock(sThreadsMutex);
+    tRegistration.tid = gettid();
+    sThreads[tRegistration.tid] = {name, pthread_self(), policy, priority};
+}
+
+void dumpStatsdThreads(int out) {
+    std::lock_guard<std::mutex> lock(sThreadsMutex);
+    dprintf(out, "Threads: %zu\n", sThreads.size());
+    for (const auto& [tid, info] : sThreads) {
+        clockid_t clock;
+        struct timespec cpuTime = {};
+        if (pthread_getcpuclockid(info.thread, &clock) != 0 ||
+            clock_gettime(clock, &cpuTime) != 0) {
+            dprintf(out, "  %s (tid %d): cpu time unavailable\n", info.name.c_str(), tid);
+            continue;
+        }
+        cpu_set_t cpus;
+        const int numCpus =
+                sched_getaffinity(tid, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : -1;
+        dprintf(out, "  %s (tid %d): policy %s, priority %d, %d cpus, cpu time %lld ms\n",
+                info.name.c_str(), tid, policyName(info.policy), info.priority, numCpus,
+                (long long)NanoToMillis(cpuTime.tv_sec * NS_PER_SEC + cpuTime.tv_nsec));
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sched.h>
+
+#include <optional>
+#include <string>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+// Scheduling of a statsd thread, read from the system properties
+// persist.statsd.thread.<name>.{policy,priority,cpus}, where <name> is the thread name without
+// its "statsd." prefix:
+//  - policy: one of other, batch, idle, fifo or rr.
+//  - priority: the nice value for other and batch, the real time priority for fifo and rr.
+//  - cpus: the cpus the thread may run on, e.g. "4-7" or "0,2,4-5".
+struct ThreadConfig {
+    std::optional<int> policy;
+    std::optional<int> priority;
+    std::optional<cpu_set_t> cpus;
+};
+
+// Parses the properties of a ThreadConfig. Returns false if one of them is invalid.
+bool parseThreadConfig(const std::string& policy, const std::string& priority,
+                       const std::string& cpus, ThreadConfig* config);
+
+// Names the calling thread, and applies the scheduling configured for it. defaultNice is used
+// when no priority is configured. The thread is listed with its cpu time by dumpStatsdThreads()
+// until it exits.
+//
+// Must be called by the thread itself, before it does any work.
+void configureStatsdThread(const char* name, int defaultNice = 0);
+
+// Writes the threads configured by configureStatsdThread(), with their scheduling and cpu time.
+void dumpStatsdThreads(int out);
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
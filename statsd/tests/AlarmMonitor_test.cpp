@@ -64,6 +64,109 @@ TEST(AlarmMonitor, popSoonerThan) {
     ASSERT_EQ(0u, set.size());
 }
 
+TEST(AlarmMonitor, popSoonerThanTimerWheel) {
+    int64_t registeredAlarmMillis = 0;
+    AlarmMonitor am(
+            2,
+            [&](const shared_ptr<IStatsCompanionService>&, int64_t timeMillis) {
+                registeredAlarmMillis = timeMillis;
+            },
+            [&](const shared_ptr<IStatsCompanionService>&) { registeredAlarmMillis = 0; },
+            AlarmMonitor::Type::TIMER_WHEEL);
+
+    sp<const InternalAlarm> a = new InternalAlarm{10};
+    sp<const InternalAlarm> b = new InternalAlarm{20};
+    sp<const InternalAlarm> c = new InternalAlarm{3000};
+
+    am.add(c);
+    EXPECT_EQ(3'000'000, registeredAlarmMillis);
+    am.add(b);
+    EXPECT_EQ(20'000, registeredAlarmMillis);
+    am.add(a);
+    EXPECT_EQ(10'000, registeredAlarmMillis);
+
+    am.remove(a);
+    EXPECT_EQ(20'000, registeredAlarmMillis);
+
+    // Within the minimum difference of the registered alarm.
+    sp<const InternalAlarm> d = new InternalAlarm{19};
+    am.add(d);
+    EXPECT_EQ(20'000, registeredAlarmMillis);
+
+    unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> set = am.popSoonerThan(20);
+    ASSERT_EQ(2u, set.size());
+    EXPECT_EQ(1u, set.count(b));
+    EXPECT_EQ(1u, set.count(d));
+    EXPECT_EQ(3'000'000, registeredAlarmMillis);
+
+    am.remove(c);
+    EXPECT_EQ(0, registeredAlarmMillis);
+    EXPECT_TRUE(am.popSoonerThan(5000).empty());
+}
+
+TEST(AlarmMonitor, alarmSlack) {
+    int64_t registeredAlarmMillis = 0;
+    int registrations = 0;
+    AlarmMonitor am(
+            2,
+            [&](const shared_ptr<IStatsCompanionService>&, int64_t timeMillis) {
+                registeredAlarmMillis = timeMillis;
+                registrations++;
+            },
+            [&](const shared_ptr<IStatsCompanionService>&) { registeredAlarmMillis = 0; });
+
+    am.add(new InternalAlarm{100});
+    EXPECT_EQ(100'000, registeredAlarmMillis);
+
+    // Can fire up to 30 seconds late, so shares the registered alarm.
+    am.add(new InternalAlarm{80, /*slackSec=*/30});
+    EXPECT_EQ(100'000, registeredAlarmMillis);
+    am.add(new InternalAlarm{60, /*slackSec=*/30});
+    EXPECT_EQ(60'000, registeredAlarmMillis);
+    EXPECT_EQ(2, registrations);
+}
+
+TEST(AlarmMonitor, debouncedRegistrations) {
+    int64_t registeredAlarmMillis = 0;
+    int registrations = 0;
+    int cancellations = 0;
+    AlarmMonitor am(
+            2,
+            [&](const shared_ptr<IStatsCompanionService>&, int64_t timeMillis) {
+                registeredAlarmMillis = timeMillis;
+                registrations++;
+            },
+            [&](const shared_ptr<IStatsCompanionService>&) {
+                registeredAlarmMillis = 0;
+                cancellations++;
+            },
+            AlarmMonitor::Type::PRIORITY_QUEUE, /*minRegistrationIntervalSec=*/3600);
+
+    sp<const InternalAlarm> a = new InternalAlarm{10};
+    sp<const InternalAlarm> b = new InternalAlarm{20};
+    am.add(b);
+    am.add(a);
+    EXPECT_EQ(10'000, registeredAlarmMillis);
+    EXPECT_EQ(2, registrations);
+
+    // Removing the soonest alarm keeps it registered.
+    am.remove(a);
+    EXPECT_EQ(10'000, registeredAlarmMillis);
+    EXPECT_EQ(2, registrations);
+
+    // When it fires without alarm to pop, the soonest alarm is registered.
+    EXPECT_TRUE(am.popSoonerThan(10).empty());
+    EXPECT_EQ(20'000, registeredAlarmMillis);
+    EXPECT_EQ(3, registrations);
+
+    am.remove(b);
+    EXPECT_EQ(20'000, registeredAlarmMillis);
+    EXPECT_EQ(0, cancellations);
+    EXPECT_TRUE(am.popSoonerThan(20).empty());
+    EXPECT_EQ(0, registeredAlarmMillis);
+    EXPECT_EQ(1, cancellations);
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
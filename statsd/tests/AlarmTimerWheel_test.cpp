@@ -0,0 +1,100 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/anomaly/AlarmTimerWheel.h"
+
+#include <gtest/gtest.h>
+
+#include "src/anomaly/AlarmMonitor.h"
+
+using namespace android::os::statsd;
+
+#ifdef __ANDROID__
+TEST(AlarmTimerWheelTest, TestPushRemove) {
+    AlarmTimerWheel wheel;
+    sp<const InternalAlarm> a = new InternalAlarm{10};
+    sp<const InternalAlarm> b = new InternalAlarm{10};
+    sp<const InternalAlarm> c = new InternalAlarm{100000};
+
+    EXPECT_FALSE(wheel.push(nullptr));
+    EXPECT_TRUE(wheel.push(c));
+    EXPECT_TRUE(wheel.push(a));
+    EXPECT_TRUE(wheel.push(b));
+    EXPECT_FALSE(wheel.push(a));
+    EXPECT_EQ(3u, wheel.size());
+    EXPECT_EQ(10u, wheel.soonestTimestampSec());
+
+    // Another wheel can not take an alarm that is already in one.
+    AlarmTimerWheel otherWheel;
+    EXPECT_FALSE(otherWheel.push(a));
+    EXPECT_FALSE(otherWheel.remove(a));
+
+    EXPECT_TRUE(wheel.remove(a));
+    EXPECT_FALSE(wheel.remove(a));
+    EXPECT_EQ(10u, wheel.soonestTimestampSec());
+    EXPECT_TRUE(wheel.remove(b));
+    EXPECT_EQ(100000u, wheel.soonestTimestampSec());
+    EXPECT_TRUE(wheel.remove(c));
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(AlarmTimerWheelTest, TestCascade) {
+    AlarmTimerWheel wheel;
+    // One alarm per level of the wheel.
+    sp<const InternalAlarm> a = new InternalAlarm{200};
+    sp<const InternalAlarm> b = new InternalAlarm{60000};
+    sp<const InternalAlarm> c = new InternalAlarm{10000000};
+    sp<const InternalAlarm> d = new InternalAlarm{4000000000};
+    wheel.push(d);
+    wheel.push(c);
+    wheel.push(b);
+    wheel.push(a);
+
+    unordered_set<sp<const InternalAlarm>, SpHash<InternalAlarm>> alarms;
+    wheel.popSoonerThan(199, &alarms);
+    EXPECT_TRUE(alarms.empty());
+
+    wheel.popSoonerThan(59999, &alarms);
+    ASSERT_EQ(1u, alarms.size());
+    EXPECT_EQ(1u, alarms.count(a));
+    EXPECT_EQ(60000u, wheel.soonestTimestampSec());
+
+    // The remaining alarms moved down as the current time advanced.
+    alarms.clear();
+    wheel.popSoonerThan(60000, &alarms);
+    ASSERT_EQ(1u, alarms.size());
+    EXPECT_EQ(1u, alarms.count(b));
+    EXPECT_EQ(10000000u, wheel.soonestTimestampSec());
+
+    alarms.clear();
+    wheel.popSoonerThan(10000000, &alarms);
+    ASSERT_EQ(1u, alarms.size());
+    EXPECT_EQ(1u, alarms.count(c));
+    EXPECT_EQ(4000000000u, wheel.soonestTimestampSec());
+
+    // Alarms not later than the current time are still popped.
+    sp<const InternalAlarm> e = new InternalAlarm{100};
+    wheel.push(e);
+    EXPECT_EQ(100u, wheel.soonestTimestampSec());
+    alarms.clear();
+    wheel.popSoonerThan(UINT32_MAX, &alarms);
+    ASSERT_EQ(2u, alarms.size());
+    EXPECT_EQ(1u, alarms.count(d));
+    EXPECT_EQ(1u, alarms.count(e));
+    EXPECT_TRUE(wheel.empty());
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
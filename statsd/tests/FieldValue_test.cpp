@@ -17,6 +17,7 @@
 
 #include "src/stats_log.pb.h"
 #include "src/statsd_config.pb.h"
+#include "hash.h"
 #include "matchers/matcher_util.h"
 #include "src/logd/LogEvent.h"
 #include "stats_event.h"
@@ -142,20 +143,58 @@ TEST(AtomMatcherTest, TestFilter_ALL) {
     EXPECT_EQ((int32_t)0x02010101, output.getValues()[0].mField.getField());
     EXPECT_EQ((int32_t)1111, output.getValues()[0].mValue.int_value);
     EXPECT_EQ((int32_t)0x02010102, output.getValues()[1].mField.getField());
-    EXPECT_EQ("location1", output.getValues()[1].mValue.str_value);
+    EXPECT_EQ("location1", output.getValues()[1].mValue.getString());
 
     EXPECT_EQ((int32_t)0x02010201, output.getValues()[2].mField.getField());
     EXPECT_EQ((int32_t)2222, output.getValues()[2].mValue.int_value);
     EXPECT_EQ((int32_t)0x02010202, output.getValues()[3].mField.getField());
-    EXPECT_EQ("location2", output.getValues()[3].mValue.str_value);
+    EXPECT_EQ("location2", output.getValues()[3].mValue.getString());
 
     EXPECT_EQ((int32_t)0x02010301, output.getValues()[4].mField.getField());
     EXPECT_EQ((int32_t)3333, output.getValues()[4].mValue.int_value);
     EXPECT_EQ((int32_t)0x02010302, output.getValues()[5].mField.getField());
-    EXPECT_EQ("location3", output.getValues()[5].mValue.str_value);
+    EXPECT_EQ("location3", output.getValues()[5].mValue.getString());
 
     EXPECT_EQ((int32_t)0x00020000, output.getValues()[6].mField.getField());
-    EXPECT_EQ("some value", output.getValues()[6].mValue.str_value);
+    EXPECT_EQ("some value", output.getValues()[6].mValue.getString());
+}
+
+TEST(AtomMatcherTest, TestFilterEvent) {
+    // The matchers are not in the order of the fields.
+    FieldMatcher matcher1;
+    matcher1.set_field(10);
+    matcher1.add_child()->set_field(2);
+    FieldMatcher* child = matcher1.add_child();
+    child->set_field(1);
+    child->set_position(Position::LAST);
+    child->add_child()->set_field(1);
+
+    vector<Matcher> matchers;
+    translateFieldMatcher(matcher1, &matchers);
+
+    std::vector<int> attributionUids = {1111, 2222, 3333};
+    std::vector<string> attributionTags = {"location1", "location2", "location3"};
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event, 10 /*atomId*/, /*timestamp=*/1012345, attributionUids, attributionTags,
+                 "some value");
+
+    // Looking up the fields of the matchers gives the dimension scanning all the values gives.
+    HashableDimensionKey scanned;
+    EXPECT_TRUE(filterValues(matchers, event.getValues(), &scanned));
+    HashableDimensionKey indexed;
+    EXPECT_TRUE(filterValues(matchers, event, &indexed));
+    EXPECT_EQ(scanned, indexed);
+
+    ASSERT_EQ((size_t)2, indexed.getValues().size());
+    EXPECT_EQ((int32_t)3333, indexed.getValues()[0].mValue.int_value);
+    EXPECT_EQ("some value", indexed.getValues()[1].mValue.getString());
+
+    vector<FieldValue> gaugeValues;
+    filterGaugeValues(matchers, event, &gaugeValues);
+    ASSERT_EQ((size_t)2, gaugeValues.size());
+    EXPECT_EQ("some value", gaugeValues[0].mValue.getString());
+    EXPECT_EQ((int32_t)3333, gaugeValues[1].mValue.int_value);
 }
 
 TEST(AtomMatcherTest, TestFilterRepeated_FIRST) {
@@ -247,7 +286,7 @@ TEST(AtomMatcherTest, TestFilterWithOneMatcher) {
 
     EXPECT_TRUE(filterValues(matchers[0], event.getValues(), &value));
     EXPECT_EQ((int32_t)0x20000, value.mField.getField());
-    EXPECT_EQ("some value", value.mValue.str_value);
+    EXPECT_EQ("some value", value.mValue.getString());
 }
 
 TEST(AtomMatcherTest, TestFilterWithOneMatcher_PositionFIRST) {
@@ -567,10 +606,10 @@ TEST(AtomMatcherTest, TestSubscriberDimensionWrite) {
     ASSERT_EQ(attributionChainParcel.tupleValue.size(), 2);
     checkAttributionNodeInDimensionsValueParcel(attributionChainParcel.tupleValue[0],
                                                 /*nodeDepthInAttributionChain=*/1,
-                                                value1.int_value, value2.str_value);
+                                                value1.int_value, value2.getString());
     checkAttributionNodeInDimensionsValueParcel(attributionChainParcel.tupleValue[1],
                                                 /*nodeDepthInAttributionChain=*/2,
-                                                value3.int_value, value4.str_value);
+                                                value3.int_value, value4.getString());
 
     // Check that the float is populated correctly
     StatsDimensionsValueParcel floatParcel = rootParcel.tupleValue[1];
@@ -697,6 +736,36 @@ TEST(AtomMatcherTest, TestWriteDimensionLeafNodesToProto) {
     EXPECT_EQ(99999, dim4.value_long());
 }
 
+TEST(AtomMatcherTest, TestWriteDimensionLeafNodesToProtoMultipleSubtrees) {
+    // A top level field, two attribution nodes, then another top level field.
+    HashableDimensionKey dim;
+    int pos1[] = {1, 0, 0};
+    int pos2[] = {2, 1, 1};
+    int pos3[] = {2, 1, 2};
+    int pos4[] = {2, 2, 1};
+    int pos5[] = {2, 2, 2};
+    int pos6[] = {3, 0, 0};
+    dim.addValue(FieldValue(Field(10, pos1, 0), Value((int32_t)1)));
+    dim.addValue(FieldValue(Field(10, pos2, 2), Value((int32_t)2)));
+    dim.addValue(FieldValue(Field(10, pos3, 2), Value("tag2")));
+    dim.addValue(FieldValue(Field(10, pos4, 2), Value((int32_t)4)));
+    dim.addValue(FieldValue(Field(10, pos5, 2), Value("tag4")));
+    dim.addValue(FieldValue(Field(10, pos6, 0), Value((int64_t)6)));
+
+    android::util::ProtoOutputStream protoOut;
+    writeDimensionLeafNodesToProto(dim, 1, nullptr /* include strings */, &protoOut);
+    DimensionsValueTuple result;
+    outputStreamToProto(&protoOut, &result);
+
+    ASSERT_EQ(6, result.dimensions_value_size());
+    EXPECT_EQ(1, result.dimensions_value(0).value_int());
+    EXPECT_EQ(2, result.dimensions_value(1).value_int());
+    EXPECT_EQ("tag2", result.dimensions_value(2).value_str());
+    EXPECT_EQ(4, result.dimensions_value(3).value_int());
+    EXPECT_EQ("tag4", result.dimensions_value(4).value_str());
+    EXPECT_EQ(6, result.dimensions_value(5).value_long());
+}
+
 TEST(AtomMatcherTest, TestWriteAtomToProto) {
     std::vector<int> attributionUids = {1111, 2222};
     std::vector<string> attributionTags = {"location1", "location2"};
@@ -1166,6 +1235,165 @@ TEST(FieldValueTest, TestShouldKeepSampleByteArray) {
     EXPECT_TRUE(shouldKeepSample(fieldValue2, shardOffset, shardCount));
 }
 
+TEST(FieldValueTest, TestStringValueCopiesSharePayload) {
+    Value value1(string("some value"));
+    Value value2(value1);
+    Value value3;
+    value3 = value2;
+
+    EXPECT_EQ(value1.string_payload, value2.string_payload);
+    EXPECT_EQ(value1.string_payload, value3.string_payload);
+    EXPECT_EQ(3, value1.string_payload->refCount.load());
+
+    value3.setInt(5);
+    EXPECT_EQ(INT, value3.getType());
+    EXPECT_EQ(5, value3.int_value);
+    EXPECT_EQ(2, value1.string_payload->refCount.load());
+
+    Value value4(std::move(value2));
+    EXPECT_EQ(UNKNOWN, value2.getType());
+    EXPECT_EQ(value1.string_payload, value4.string_payload);
+    EXPECT_EQ(2, value1.string_payload->refCount.load());
+
+    EXPECT_EQ("some value", value4.getString());
+    EXPECT_TRUE(value4.getStorage().empty());
+    EXPECT_EQ(value1, value4);
+    EXPECT_EQ(sizeof(char) * 10, value4.getSize());
+}
+
+TEST(FieldValueTest, TestStringValueInterner) {
+    StringValueInterner interner;
+
+    Value value1 = interner.intern("com.android.vending");
+    Value value2 = interner.intern(string("com.android.vending"));
+    Value value3 = interner.intern("com.google.android.gms");
+    EXPECT_EQ(2u, interner.size());
+
+    EXPECT_EQ(STRING, value1.getType());
+    EXPECT_EQ("com.android.vending", value1.getString());
+    EXPECT_EQ(value1.string_payload, value2.string_payload);
+    EXPECT_NE(value1.string_payload, value3.string_payload);
+
+    // Only the strings still held outside of the interner are kept.
+    value3.setInt(0);
+    interner.prune();
+    EXPECT_EQ(1u, interner.size());
+    EXPECT_EQ(value1.string_payload, interner.intern("com.android.vending").string_payload);
+}
+
+TEST(FieldValueTest, TestStorageValueCopiesSharePayload) {
+    vector<uint8_t> message = {'\t', 'e', '\0', 's', 't'};
+    Value value1(message);
+    Value value2(value1);
+
+    EXPECT_EQ(value1.storage_payload, value2.storage_payload);
+    EXPECT_EQ(message, value2.getStorage());
+    EXPECT_TRUE(value2.getString().empty());
+    EXPECT_FALSE(value1 < value2);
+    EXPECT_FALSE(value2 < value1);
+
+    value2 = Value(vector<uint8_t>{'\t', 'e', '\0', 's', 't', 't'});
+    EXPECT_NE(value1.storage_payload, value2.storage_payload);
+    EXPECT_EQ(1, value1.storage_payload->refCount.load());
+    EXPECT_TRUE(value1 < value2);
+}
+
+TEST(FieldValueTest, TestFieldValueSize) {
+    EXPECT_LE(sizeof(Value), 16u);
+    EXPECT_LE(sizeof(FieldValue), 32u);
+}
+
+TEST(FieldValueTest, TestSortKeyOrdering) {
+    // Each value orders strictly before the next one.
+    vector<FieldValue> values = {
+            FieldValue(Field(-1, 1), Value(0)),
+            FieldValue(Field(1, int32_t(0x80000000)), Value(0)),
+            FieldValue(Field(1, -1), Value(0)),
+            FieldValue(Field(1, 1), Value(std::numeric_limits<int32_t>::min())),
+            FieldValue(Field(1, 1), Value(-1)),
+            FieldValue(Field(1, 1), Value(0)),
+            FieldValue(Field(1, 1), Value(std::numeric_limits<int32_t>::max())),
+            FieldValue(Field(1, 1), Value(std::numeric_limits<int64_t>::min())),
+            FieldValue(Field(1, 1), Value(int64_t(-1))),
+            FieldValue(Field(1, 1), Value(std::numeric_limits<int64_t>::max())),
+            FieldValue(Field(1, 1), Value(-1.5f)),
+            FieldValue(Field(1, 1), Value(2.5f)),
+            FieldValue(Field(1, 1), Value(string())),
+            FieldValue(Field(1, 1), Value(string("com.example"))),
+            FieldValue(Field(1, 1), Value(string("com.example\0", 12))),
+            FieldValue(Field(1, 1), Value(string("com.example.a"))),
+            FieldValue(Field(1, 1), Value(string("com.example.b"))),
+            FieldValue(Field(1, 1), Value(string("com.example\xff"))),
+            FieldValue(Field(1, 2), Value(0)),
+    };
+    for (size_t i = 0; i < values.size(); i++) {
+        for (size_t j = 0; j < values.size(); j++) {
+            EXPECT_EQ(i < j, values[i] < values[j]) << i << " " << j;
+            EXPECT_EQ(i < j, values[i].mField < values[j].mField ||
+                                     (values[i].mField == values[j].mField &&
+                                      values[i].mValue < values[j].mValue))
+                    << i << " " << j;
+        }
+    }
+
+    // Zeros of both signs are equivalent.
+    EXPECT_EQ(0, Value(0.0f).compare(Value(-0.0f)));
+    EXPECT_EQ(0, Value(string("com.example")).compare(Value(string("com.example"))));
+}
+
+TEST(FieldValueTest, TestCachedStringHash) {
+    // Strings that share their length, prefix and suffix land in the same cache slot.
+    vector<string> strings = {"", "a", "com.example.app"};
+    for (int i = 0; i < 1000; i++) {
+        strings.push_back("com.example." + std::to_string(i) + ".app");
+    }
+    for (int round = 0; round < 2; round++) {
+        for (const string& str : strings) {
+            EXPECT_EQ(Hash64(str), getCachedStringHash(str)) << str;
+        }
+    }
+
+    std::set<string> strSet;
+    EXPECT_EQ(Hash64("tag"), hashStringInReport("tag", &strSet));
+    EXPECT_EQ(Hash64("tag"), hashStringInReport("tag", &strSet));
+    EXPECT_THAT(strSet, ElementsAre("tag"));
+}
+
+TEST(FieldValueTest, TestAddTopLevelFieldsAttributionUidsOnly) {
+    FieldMatcher uidMatcher;
+    uidMatcher.set_field(10);
+    FieldMatcher* child = uidMatcher.add_child();
+    child->set_field(1);
+    child->set_position(Position::FIRST);
+    child->add_child()->set_field(1);
+    uidMatcher.add_child()->set_field(2);
+
+    vector<Matcher> matchers;
+    translateFieldMatcher(uidMatcher, &matchers);
+    AtomFieldMasks masks;
+    addTopLevelFields(matchers, &masks);
+
+    ASSERT_EQ(1, masks.size());
+    const TopLevelFieldMask& mask = masks[10];
+    EXPECT_TRUE(mask.test(1));
+    EXPECT_FALSE(mask.test(kAttributionTagsInUseOffset + 1));
+    EXPECT_TRUE(mask.test(2));
+    EXPECT_TRUE(mask.test(kAttributionTagsInUseOffset + 2));
+    EXPECT_EQ(3, mask.count());
+
+    FieldMatcher tagMatcher;
+    tagMatcher.set_field(10);
+    child = tagMatcher.add_child();
+    child->set_field(1);
+    child->set_position(Position::ANY);
+    child->add_child()->set_field(2);
+
+    matchers.clear();
+    translateFieldMatcher(tagMatcher, &matchers);
+    addTopLevelFields(matchers, &masks);
+    EXPECT_TRUE(masks[10].test(kAttributionTagsInUseOffset + 1));
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
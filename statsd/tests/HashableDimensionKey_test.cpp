@@ -164,6 +164,89 @@ TEST(HashableDimensionKeyTest, TestHashDimensionDouble) {
               std::hash<HashableDimensionKey>{}(dimKey2));
 }
 
+/**
+ * Test that the cached hash follows modifications of the values.
+ */
+TEST(HashableDimensionKeyTest, TestCachedHashInvalidation) {
+    int pos[] = {1, 1, 1};
+    Field field(1, pos, 1);
+    HashableDimensionKey dimKey;
+    dimKey.addValue(FieldValue(field, Value((int32_t)100)));
+    EXPECT_EQ(hashDimension(dimKey), dimKey.getHash());
+
+    dimKey.addValue(FieldValue(field, Value((int32_t)200)));
+    EXPECT_EQ(hashDimension(dimKey), dimKey.getHash());
+
+    dimKey.mutableValue(0)->mValue = Value((int32_t)300);
+    EXPECT_EQ(hashDimension(dimKey), dimKey.getHash());
+
+    dimKey.mutableValues()->pop_back();
+    EXPECT_EQ(hashDimension(dimKey), dimKey.getHash());
+
+    HashableDimensionKey copy(dimKey);
+    EXPECT_EQ(dimKey.getHash(), copy.getHash());
+    EXPECT_EQ(dimKey, copy);
+
+    // Equal keys stay equal whether or not their hashes are cached.
+    HashableDimensionKey uncached(dimKey.getValues());
+    EXPECT_EQ(dimKey, uncached);
+    copy.mutableValue(0)->mValue = Value((int32_t)400);
+    EXPECT_NE(dimKey, copy);
+    copy.getHash();
+    EXPECT_NE(dimKey, copy);
+}
+
+/**
+ * Test that keys with up to three values hold them inline, and compare equal to heap keys.
+ */
+TEST(HashableDimensionKeyTest, TestSmallKeysStayInline) {
+    int pos[] = {1, 1, 1};
+    HashableDimensionKey smallKey;
+    for (int i = 1; i <= 3; i++) {
+        pos[0] = i;
+        smallKey.addValue(FieldValue(Field(10, pos, 0), Value((int32_t)i)));
+    }
+    EXPECT_TRUE(smallKey.getValues().isInline());
+
+    HashableDimensionKey largeKey(smallKey);
+    pos[0] = 4;
+    largeKey.addValue(FieldValue(Field(10, pos, 0), Value(string("tag"))));
+    EXPECT_FALSE(largeKey.getValues().isInline());
+    EXPECT_NE(smallKey, largeKey);
+
+    largeKey.mutableValues()->pop_back();
+    EXPECT_EQ(smallKey, largeKey);
+    EXPECT_EQ(smallKey.getHash(), largeKey.getHash());
+}
+
+/**
+ * Test that keys differing only in field, tag, type or a single string byte hash differently.
+ */
+TEST(HashableDimensionKeyTest, TestHashDistinguishesKeys) {
+    int pos[] = {1, 1, 1};
+    vector<FieldValue> base = {FieldValue(Field(10, pos, 0), Value((int32_t)1)),
+                               FieldValue(Field(10, pos, 0), Value(string("com.app.name")))};
+    const android::hash_t baseHash = hashFieldValues(base);
+    EXPECT_EQ(baseHash, hashFieldValues(base));
+
+    vector<FieldValue> otherTag = base;
+    otherTag[0].mField = Field(11, pos, 0);
+    EXPECT_NE(baseHash, hashFieldValues(otherTag));
+
+    vector<FieldValue> otherField = base;
+    pos[0] = 2;
+    otherField[0].mField = Field(10, pos, 0);
+    EXPECT_NE(baseHash, hashFieldValues(otherField));
+
+    vector<FieldValue> otherType = base;
+    otherType[0].mValue = Value((int64_t)1);
+    EXPECT_NE(baseHash, hashFieldValues(otherType));
+
+    vector<FieldValue> otherString = base;
+    otherString[1].mValue = Value(string("com.app.namf"));
+    EXPECT_NE(baseHash, hashFieldValues(otherString));
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
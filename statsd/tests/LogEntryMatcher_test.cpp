@@ -137,6 +137,17 @@ void makeRepeatedStringLogEvent(LogEvent* logEvent, const int32_t atomId,
     parseStatsEventToLogEvent(statsEvent, logEvent);
 }
 
+// Matches the event with the proto and the compiled forms of the matcher, which must all agree.
+bool matches(const sp<UidMap>& uidMap, const SimpleAtomMatcher& simpleMatcher,
+             const LogEvent& event) {
+    const bool matched = matchesSimple(uidMap, simpleMatcher, event);
+    CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(simpleMatcher);
+    EXPECT_EQ(matched, matchesSimple(uidMap, compiled, event));
+    updateMatchingUids(*uidMap, &compiled);
+    EXPECT_EQ(matched, matchesSimple(uidMap, compiled, event));
+    return matched;
+}
+
 }  // anonymous namespace
 
 TEST(AtomMatcherTest, TestSimpleMatcher) {
@@ -151,11 +162,11 @@ TEST(AtomMatcherTest, TestSimpleMatcher) {
     makeIntLogEvent(&event, TAG_ID, 0, 11);
 
     // Test
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Wrong tag id.
     simpleMatcher->set_atom_id(TAG_ID + 1);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestAttributionMatcher) {
@@ -186,43 +197,43 @@ TEST(AtomMatcherTest, TestAttributionMatcher) {
     fieldMatcher->set_eq_string("some value");
 
     // Tag not matched.
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location3");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Match last node.
     attributionMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Match any node.
     attributionMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location2");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location4");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Attribution match but primitive field not match.
     attributionMatcher->set_position(Position::ANY);
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "location2");
     fieldMatcher->set_eq_string("wrong value");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldMatcher->set_eq_string("some value");
 
@@ -232,7 +243,7 @@ TEST(AtomMatcherTest, TestAttributionMatcher) {
             ATTRIBUTION_UID_FIELD_ID);
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg0");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     UidData uidData;
     *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1111, /*version*/ 1, "v1", "pkg0");
@@ -243,47 +254,47 @@ TEST(AtomMatcherTest, TestAttributionMatcher) {
 
     uidMap->updateMap(1, uidData);
 
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg2");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg0");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     attributionMatcher->set_position(Position::FIRST);
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg0");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg2");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     attributionMatcher->set_position(Position::LAST);
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg0");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg2");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Uid + tag.
     attributionMatcher->set_position(Position::ANY);
@@ -293,96 +304,96 @@ TEST(AtomMatcherTest, TestAttributionMatcher) {
             "pkg0");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location2");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg2");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     attributionMatcher->set_position(Position::FIRST);
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg0");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location2");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg2");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location3");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location3");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     attributionMatcher->set_position(Position::LAST);
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg0");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg1");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location2");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg2");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(0)->set_eq_string(
             "pkg3");
     attributionMatcher->mutable_matches_tuple()->mutable_field_value_matcher(1)->set_eq_string(
             "location1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestUidFieldMatcher) {
@@ -407,7 +418,7 @@ TEST(AtomMatcherTest, TestUidFieldMatcher) {
     // Make event without is_uid annotation.
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     makeIntLogEvent(&event1, TAG_ID, 0, 1111);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event1));
 
     // Make event with is_uid annotation.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
@@ -416,12 +427,12 @@ TEST(AtomMatcherTest, TestUidFieldMatcher) {
 
     // Event has is_uid annotation, so mapping from uid to package name occurs.
     simpleMatcher->set_atom_id(TAG_ID_2);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 
     // Event has is_uid annotation, but uid maps to different package name.
     simpleMatcher->mutable_field_value_matcher(0)->set_eq_string(
             "pkg2");  // package names are normalized
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event2));
 }
 
 TEST(AtomMatcherTest, TestRepeatedUidFieldMatcher) {
@@ -450,35 +461,35 @@ TEST(AtomMatcherTest, TestRepeatedUidFieldMatcher) {
 
     fieldValueMatcher->set_position(Position::FIRST);
     fieldValueMatcher->set_eq_string("pkg0");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event1));
 
     fieldValueMatcher->set_position(Position::LAST);
     fieldValueMatcher->set_eq_string("pkg1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event1));
 
     fieldValueMatcher->set_position(Position::ANY);
     fieldValueMatcher->set_eq_string("pkg2");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event1));
 
     // is_uid annotation, mapping from uid to package name.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeRepeatedUidLogEvent(&event2, TAG_ID, intArray);
 
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event2));
     fieldValueMatcher->set_eq_string("pkg0");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event2));
     fieldValueMatcher->set_eq_string("pkg1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 
     fieldValueMatcher->set_position(Position::ANY);
     fieldValueMatcher->set_eq_string("pkg");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event2));
     fieldValueMatcher->set_eq_string("pkg2");  // package names are normalized
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 }
 
 TEST(AtomMatcherTest, TestNeqAnyStringMatcher_SingleString) {
@@ -498,17 +509,17 @@ TEST(AtomMatcherTest, TestNeqAnyStringMatcher_SingleString) {
     // First string matched.
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event1, TAG_ID, 0, "some value");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event1));
 
     // Second string matched.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event2, TAG_ID, 0, "another value");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event2));
 
     // No strings matched.
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event3, TAG_ID, 0, "foo");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event3));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event3));
 }
 
 TEST(AtomMatcherTest, TestNeqAnyStringMatcher_AttributionUids) {
@@ -551,26 +562,26 @@ TEST(AtomMatcherTest, TestNeqAnyStringMatcher_AttributionUids) {
     fieldMatcher->set_field(FIELD_ID_2);
     fieldMatcher->set_eq_string("some value");
 
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     neqStringList->Clear();
     neqStringList->add_str_value("pkg1");
     neqStringList->add_str_value("pkg3");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     attributionMatcher->set_position(Position::ANY);
     neqStringList->Clear();
     neqStringList->add_str_value("maps.com");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     neqStringList->Clear();
     neqStringList->add_str_value("PkG3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     attributionMatcher->set_position(Position::LAST);
     neqStringList->Clear();
     neqStringList->add_str_value("AID_STATSD");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestEqAnyStringMatcher) {
@@ -613,29 +624,29 @@ TEST(AtomMatcherTest, TestEqAnyStringMatcher) {
     fieldMatcher->set_field(FIELD_ID_2);
     fieldMatcher->set_eq_string("some value");
 
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     attributionMatcher->set_position(Position::ANY);
     eqStringList->Clear();
     eqStringList->add_str_value("AID_STATSD");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     eqStringList->Clear();
     eqStringList->add_str_value("pkg1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     auto normalStringField = fieldMatcher->mutable_eq_any_string();
     normalStringField->add_str_value("some value123");
     normalStringField->add_str_value("some value");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     normalStringField->Clear();
     normalStringField->add_str_value("AID_STATSD");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     eqStringList->Clear();
     eqStringList->add_str_value("maps.com");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestBoolMatcher) {
@@ -656,19 +667,19 @@ TEST(AtomMatcherTest, TestBoolMatcher) {
     // Test
     keyValue1->set_eq_bool(true);
     keyValue2->set_eq_bool(false);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     keyValue1->set_eq_bool(false);
     keyValue2->set_eq_bool(false);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     keyValue1->set_eq_bool(false);
     keyValue2->set_eq_bool(true);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     keyValue1->set_eq_bool(true);
     keyValue2->set_eq_bool(true);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestStringMatcher) {
@@ -686,7 +697,7 @@ TEST(AtomMatcherTest, TestStringMatcher) {
     makeStringLogEvent(&event, TAG_ID, 0, "some value");
 
     // Test
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestIntMatcher_EmptyRepeatedField) {
@@ -706,16 +717,16 @@ TEST(AtomMatcherTest, TestIntMatcher_EmptyRepeatedField) {
     // Match first int.
     fieldValueMatcher->set_position(Position::FIRST);
     fieldValueMatcher->set_eq_int(9);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Match last int.
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Match any int.
     fieldValueMatcher->set_position(Position::ANY);
     fieldValueMatcher->set_eq_int(13);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestIntMatcher_RepeatedIntField) {
@@ -736,28 +747,28 @@ TEST(AtomMatcherTest, TestIntMatcher_RepeatedIntField) {
     fieldValueMatcher->set_field(FIELD_ID_1);
     fieldValueMatcher->set_position(Position::FIRST);
     fieldValueMatcher->set_eq_int(9);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_int(21);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Match last int.
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_int(9);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Match any int.
     fieldValueMatcher->set_position(Position::ANY);
     fieldValueMatcher->set_eq_int(13);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_int(21);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_int(9);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestLtIntMatcher_RepeatedIntField) {
@@ -778,34 +789,34 @@ TEST(AtomMatcherTest, TestLtIntMatcher_RepeatedIntField) {
     fieldValueMatcher->set_field(FIELD_ID_1);
     fieldValueMatcher->set_position(Position::FIRST);
     fieldValueMatcher->set_lt_int(9);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_lt_int(21);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_lt_int(23);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Match last int.
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_lt_int(9);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_lt_int(8);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Match any int.
     fieldValueMatcher->set_position(Position::ANY);
     fieldValueMatcher->set_lt_int(21);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_lt_int(8);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_lt_int(23);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestStringMatcher_RepeatedStringField) {
@@ -826,31 +837,31 @@ TEST(AtomMatcherTest, TestStringMatcher_RepeatedStringField) {
     fieldValueMatcher->set_field(FIELD_ID_1);
     fieldValueMatcher->set_position(Position::FIRST);
     fieldValueMatcher->set_eq_string("str2");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_string("str1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Match last int.
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_string("str3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Match any int.
     fieldValueMatcher->set_position(Position::ANY);
     fieldValueMatcher->set_eq_string("str4");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_string("str1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_string("str2");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     fieldValueMatcher->set_eq_string("str3");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestEqAnyStringMatcher_RepeatedStringField) {
@@ -871,43 +882,43 @@ TEST(AtomMatcherTest, TestEqAnyStringMatcher_RepeatedStringField) {
     StringListMatcher* eqStringList = fieldValueMatcher->mutable_eq_any_string();
 
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     eqStringList->add_str_value("str4");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     eqStringList->add_str_value("str2");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     eqStringList->add_str_value("str3");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     eqStringList->add_str_value("str1");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestNeqAnyStringMatcher_RepeatedStringField) {
@@ -928,43 +939,43 @@ TEST(AtomMatcherTest, TestNeqAnyStringMatcher_RepeatedStringField) {
     StringListMatcher* neqStringList = fieldValueMatcher->mutable_neq_any_string();
 
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     neqStringList->add_str_value("str4");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     neqStringList->add_str_value("str2");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     neqStringList->add_str_value("str3");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     neqStringList->add_str_value("str1");
     fieldValueMatcher->set_position(Position::FIRST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::LAST);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     fieldValueMatcher->set_position(Position::ANY);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestMultiFieldsMatcher) {
@@ -985,15 +996,15 @@ TEST(AtomMatcherTest, TestMultiFieldsMatcher) {
     // Test
     keyValue1->set_eq_int(2);
     keyValue2->set_eq_int(3);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     keyValue1->set_eq_int(2);
     keyValue2->set_eq_int(4);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     keyValue1->set_eq_int(4);
     keyValue2->set_eq_int(3);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestIntComparisonMatcher) {
@@ -1014,43 +1025,43 @@ TEST(AtomMatcherTest, TestIntComparisonMatcher) {
 
     // eq_int
     keyValue->set_eq_int(10);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_eq_int(11);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_eq_int(12);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // lt_int
     keyValue->set_lt_int(10);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_lt_int(11);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_lt_int(12);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // lte_int
     keyValue->set_lte_int(10);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_lte_int(11);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_lte_int(12);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // gt_int
     keyValue->set_gt_int(10);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_gt_int(11);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_gt_int(12);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // gte_int
     keyValue->set_gte_int(10);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_gte_int(11);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
     keyValue->set_gte_int(12);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 }
 
 TEST(AtomMatcherTest, TestFloatComparisonMatcher) {
@@ -1066,20 +1077,20 @@ TEST(AtomMatcherTest, TestFloatComparisonMatcher) {
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     makeFloatLogEvent(&event1, TAG_ID, 0, 10.1f);
     keyValue->set_lt_float(10.0);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event1));
 
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeFloatLogEvent(&event2, TAG_ID, 0, 9.9f);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeFloatLogEvent(&event3, TAG_ID, 0, 10.1f);
     keyValue->set_gt_float(10.0);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event3));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event3));
 
     LogEvent event4(/*uid=*/0, /*pid=*/0);
     makeFloatLogEvent(&event4, TAG_ID, 0, 9.9f);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event4));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event4));
 }
 
 // Helper for the composite matchers.
@@ -1226,17 +1237,17 @@ TEST(AtomMatcherTest, TestUidFieldMatcherWithWildcardString) {
     // Event without is_uid annotation.
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     makeIntLogEvent(&event1, TAG_ID, 0, 1111);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event1));
 
     // Event where mapping from uid to package name occurs.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeIntWithBoolAnnotationLogEvent(&event2, TAG_ID, 1111, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 
     // Event where uid maps to package names that don't fit wildcard pattern.
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeIntWithBoolAnnotationLogEvent(&event3, TAG_ID, 3333, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event3));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event3));
 
     // Update matcher to match one AID
     simpleMatcher->mutable_field_value_matcher(0)->set_eq_wildcard_string(
@@ -1245,12 +1256,12 @@ TEST(AtomMatcherTest, TestUidFieldMatcherWithWildcardString) {
     // Event where mapping from uid to aid doesn't fit wildcard pattern.
     LogEvent event4(/*uid=*/0, /*pid=*/0);
     makeIntWithBoolAnnotationLogEvent(&event4, TAG_ID, 1005, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event4));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event4));
 
     // Event where mapping from uid to aid does fit wildcard pattern.
     LogEvent event5(/*uid=*/0, /*pid=*/0);
     makeIntWithBoolAnnotationLogEvent(&event5, TAG_ID, 1000, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event5));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event5));
 
     // Update matcher to match multiple AIDs
     simpleMatcher->mutable_field_value_matcher(0)->set_eq_wildcard_string("AID_SDCARD_*");
@@ -1258,16 +1269,16 @@ TEST(AtomMatcherTest, TestUidFieldMatcherWithWildcardString) {
     // Event where mapping from uid to aid doesn't fit wildcard pattern.
     LogEvent event6(/*uid=*/0, /*pid=*/0);
     makeIntWithBoolAnnotationLogEvent(&event6, TAG_ID, 1036, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event6));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event6));
 
     // Event where mapping from uid to aid does fit wildcard pattern.
     LogEvent event7(/*uid=*/0, /*pid=*/0);
     makeIntWithBoolAnnotationLogEvent(&event7, TAG_ID, 1034, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event7));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event7));
 
     LogEvent event8(/*uid=*/0, /*pid=*/0);
     makeIntWithBoolAnnotationLogEvent(&event8, TAG_ID, 1035, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event8));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event8));
 }
 
 TEST(AtomMatcherTest, TestWildcardStringMatcher) {
@@ -1284,55 +1295,55 @@ TEST(AtomMatcherTest, TestWildcardStringMatcher) {
 
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event1, TAG_ID, 0, "test.string:test_0");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event1));
 
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event2, TAG_ID, 0, "test.string:test_19");
     EXPECT_FALSE(
-            matchesSimple(uidMap, *simpleMatcher, event2));  // extra character at end of string
+            matches(uidMap, *simpleMatcher, event2));  // extra character at end of string
 
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event3, TAG_ID, 0, "extra.test.string:test_1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher,
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher,
                                event3));  // extra characters at beginning of string
 
     LogEvent event4(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event4, TAG_ID, 0, "test.string:test_");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher,
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher,
                                event4));  // missing character from 0-9 at end of string
 
     LogEvent event5(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event5, TAG_ID, 0, "est.string:test_1");
     EXPECT_FALSE(
-            matchesSimple(uidMap, *simpleMatcher, event5));  // missing 't' at beginning of string
+            matches(uidMap, *simpleMatcher, event5));  // missing 't' at beginning of string
 
     LogEvent event6(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event6, TAG_ID, 0, "test.string:test_1extra");
     EXPECT_FALSE(
-            matchesSimple(uidMap, *simpleMatcher, event6));  // extra characters at end of string
+            matches(uidMap, *simpleMatcher, event6));  // extra characters at end of string
 
     // Matches any string that contains "test.string:test_" + any extra characters before or after
     fieldValueMatcher->set_eq_wildcard_string("*test.string:test_*");
 
     LogEvent event7(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event7, TAG_ID, 0, "test.string:test_");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event7));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event7));
 
     LogEvent event8(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event8, TAG_ID, 0, "extra.test.string:test_");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event8));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event8));
 
     LogEvent event9(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event9, TAG_ID, 0, "test.string:test_extra");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event9));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event9));
 
     LogEvent event10(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event10, TAG_ID, 0, "est.string:test_");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event10));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event10));
 
     LogEvent event11(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event11, TAG_ID, 0, "test.string:test");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event11));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event11));
 }
 
 TEST(AtomMatcherTest, TestEqAnyWildcardStringMatcher) {
@@ -1352,17 +1363,17 @@ TEST(AtomMatcherTest, TestEqAnyWildcardStringMatcher) {
     // First wildcard pattern matched.
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event1, TAG_ID, 0, "first_string_1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event1));
 
     // Second wildcard pattern matched.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event2, TAG_ID, 0, "second_string_1");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 
     // No wildcard patterns matched.
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeStringLogEvent(&event3, TAG_ID, 0, "third_string_1");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event3));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event3));
 }
 
 TEST(AtomMatcherTest, TestNeqAnyWildcardStringMatcher) {
@@ -1389,27 +1400,27 @@ TEST(AtomMatcherTest, TestNeqAnyWildcardStringMatcher) {
 
     // First tag is not matched. neq string list {"tag"}
     neqWildcardStrList->add_str_value("tag");
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // First tag is matched. neq string list {"tag", "location_*"}
     neqWildcardStrList->add_str_value("location_*");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Match last tag.
     attributionMatcher->set_position(Position::LAST);
 
     // Last tag is not matched. neq string list {"tag", "location_*"}
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Last tag is matched. neq string list {"tag", "location_*", "location*"}
     neqWildcardStrList->add_str_value("location*");
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Match any tag.
     attributionMatcher->set_position(Position::ANY);
 
     // All tags are matched. neq string list {"tag", "location_*", "location*"}
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Set up another log event.
     std::vector<string> attributionTags2 = {"location_1", "location", "string"};
@@ -1417,7 +1428,7 @@ TEST(AtomMatcherTest, TestNeqAnyWildcardStringMatcher) {
     makeAttributionLogEvent(&event2, TAG_ID, 0, attributionUids, attributionTags2, "some value");
 
     // Tag "string" is not matched. neq string list {"tag", "location_*", "location*"}
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 }
 
 TEST(AtomMatcherTest, TestEqAnyIntMatcher) {
@@ -1437,17 +1448,17 @@ TEST(AtomMatcherTest, TestEqAnyIntMatcher) {
     // First int matched.
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     makeIntLogEvent(&event1, TAG_ID, 0, 3);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event1));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event1));
 
     // Second int matched.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeIntLogEvent(&event2, TAG_ID, 0, 5);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event2));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event2));
 
     // No ints matched.
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeIntLogEvent(&event3, TAG_ID, 0, 4);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event3));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event3));
 }
 
 TEST(AtomMatcherTest, TestNeqAnyIntMatcher) {
@@ -1473,31 +1484,91 @@ TEST(AtomMatcherTest, TestNeqAnyIntMatcher) {
 
     // First uid is not matched. neq int list {4444}
     neqIntList->add_int_value(4444);
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // First uid is matched. neq int list {4444, 1111}
     neqIntList->add_int_value(1111);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Match last uid.
     attributionMatcher->set_position(Position::LAST);
 
     // Last uid is not matched. neq int list {4444, 1111}
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // Last uid is matched. neq int list {4444, 1111, 3333}
     neqIntList->add_int_value(3333);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
 
     // Match any uid.
     attributionMatcher->set_position(Position::ANY);
 
     // Uid 2222 is not matched. neq int list {4444, 1111, 3333}
-    EXPECT_TRUE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_TRUE(matches(uidMap, *simpleMatcher, event));
 
     // All uids are matched. neq int list {4444, 1111, 3333, 2222}
     neqIntList->add_int_value(2222);
-    EXPECT_FALSE(matchesSimple(uidMap, *simpleMatcher, event));
+    EXPECT_FALSE(matches(uidMap, *simpleMatcher, event));
+}
+
+TEST(AtomMatcherTest, TestMatchingUidsUpdatedOnUidMapChange) {
+    sp<UidMap> uidMap = new UidMap();
+    UidData uidData;
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1111, /*version*/ 1, "v1", "pkg0");
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 2222, /*version*/ 1, "v1", "pkg1");
+    uidMap->updateMap(1, uidData);
+
+    SimpleAtomMatcher simpleMatcher;
+    simpleMatcher.set_atom_id(TAG_ID);
+    simpleMatcher.add_field_value_matcher()->set_field(FIELD_ID_1);
+    simpleMatcher.mutable_field_value_matcher(0)->set_eq_string("pkg0");
+    CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(simpleMatcher);
+    EXPECT_TRUE(compiled.hasStringMatchers);
+
+    updateMatchingUids(*uidMap, &compiled);
+    EXPECT_EQ(uidMap->getAppNamesVersion(), compiled.matchingUidsVersion);
+    EXPECT_THAT(compiled.fieldValueMatchers[0].matchingUids, UnorderedElementsAre(1111));
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeIntWithBoolAnnotationLogEvent(&event, TAG_ID, 2222, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+    EXPECT_FALSE(matchesSimple(uidMap, compiled, event));
+
+    // The uid sets are rebuilt once the uid map changes.
+    uidMap->updateApp(2, "pkg0", 2222, 1, "v1", "", /* certificateHash */ {});
+    updateMatchingUids(*uidMap, &compiled);
+    EXPECT_THAT(compiled.fieldValueMatchers[0].matchingUids, UnorderedElementsAre(1111, 2222));
+    EXPECT_TRUE(matchesSimple(uidMap, compiled, event));
+}
+
+TEST(AtomMatcherTest, TestCompileSimpleAtomMatcher) {
+    SimpleAtomMatcher simpleMatcher;
+    simpleMatcher.set_atom_id(TAG_ID);
+    FieldValueMatcher* fieldValueMatcher = simpleMatcher.add_field_value_matcher();
+    fieldValueMatcher->set_field(FIELD_ID_1);
+    fieldValueMatcher->set_position(Position::ANY);
+    IntListMatcher* eqIntList = fieldValueMatcher->mutable_eq_any_int();
+    eqIntList->add_int_value(5);
+    eqIntList->add_int_value(3);
+    eqIntList->add_int_value(5);
+    simpleMatcher.add_field_value_matcher()->set_field(FIELD_ID_2);
+    simpleMatcher.mutable_field_value_matcher(1)->set_eq_string("some value");
+
+    CompiledSimpleAtomMatcher compiled = compileSimpleAtomMatcher(simpleMatcher);
+    EXPECT_EQ(TAG_ID, compiled.atomId);
+    ASSERT_EQ(2, compiled.fieldValueMatchers.size());
+
+    const CompiledFieldValueMatcher& intMatcher = compiled.fieldValueMatchers[0];
+    EXPECT_EQ(FIELD_ID_1, intMatcher.field);
+    EXPECT_TRUE(intMatcher.hasPosition);
+    EXPECT_EQ(Position::ANY, intMatcher.position);
+    EXPECT_EQ(FieldValueMatcher::kEqAnyInt, intMatcher.valueMatcherCase);
+    EXPECT_EQ(vector<int64_t>({3, 5}), intMatcher.intList);
+
+    const CompiledFieldValueMatcher& stringMatcher = compiled.fieldValueMatchers[1];
+    EXPECT_EQ(FIELD_ID_2, stringMatcher.field);
+    EXPECT_FALSE(stringMatcher.hasPosition);
+    EXPECT_EQ(FieldValueMatcher::kEqString, stringMatcher.valueMatcherCase);
+    EXPECT_EQ(vector<string>({"some value"}), stringMatcher.strList);
 }
 
 #else
@@ -15,9 +15,11 @@
  */
 #include "socket/LogEventFilter.h"
 
+#include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <vector>
 
 #ifdef __ANDROID__
 
@@ -25,6 +27,9 @@ namespace android {
 namespace os {
 namespace statsd {
 
+using std::vector;
+using testing::ElementsAre;
+
 namespace {
 
 constexpr int kAtomIdsCount = 100;  //  Filter size setup
@@ -104,6 +109,25 @@ TEST(LogEventFilterTest, TestNonEmptyFilterPartialOverlap) {
     }
 }
 
+TEST(LogEventFilterTest, TestNonEmptyFilterOutOfBitmapRange) {
+    LogEventFilter filter;
+    LogEventFilter::AtomIdSet filterIds{-5, 1, AtomIdBitmap::kMaxBitmapAtomId,
+                                        AtomIdBitmap::kMaxBitmapAtomId + 1, 1 << 28};
+    filter.setAtomIds(std::move(filterIds), reinterpret_cast<LogEventFilter::ConsumerId>(0));
+    EXPECT_TRUE(filter.isAtomInUse(-5));
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_TRUE(filter.isAtomInUse(AtomIdBitmap::kMaxBitmapAtomId));
+    EXPECT_TRUE(filter.isAtomInUse(AtomIdBitmap::kMaxBitmapAtomId + 1));
+    EXPECT_TRUE(filter.isAtomInUse(1 << 28));
+    EXPECT_EQ(5, filter.mLocalTagIds.size());
+
+    EXPECT_FALSE(filter.isAtomInUse(-1));
+    EXPECT_FALSE(filter.isAtomInUse(2));
+    EXPECT_FALSE(filter.isAtomInUse(AtomIdBitmap::kMaxBitmapAtomId - 1));
+    EXPECT_FALSE(filter.isAtomInUse(AtomIdBitmap::kMaxBitmapAtomId + 2));
+    EXPECT_TRUE(testGuaranteedUnusedAtomsNotInUse(filter));
+}
+
 TEST(LogEventFilterTest, TestNonEmptyFilterDisabledPartialOverlap) {
     LogEventFilter filter;
     auto filterIds = generateAtomIds(1, kAtomIdsCount);
@@ -183,6 +207,82 @@ TEST(LogEventFilterTest, TestMultipleConsumerEmptyFilter) {
     EXPECT_TRUE(testGuaranteedUnusedAtomsNotInUse(filter));
 }
 
+TEST(LogEventFilterTest, TestFieldMasks) {
+    LogEventFilter filter;
+    const auto consumer = reinterpret_cast<LogEventFilter::ConsumerId>(0);
+    TopLevelFieldMask fieldMask;
+    fieldMask.set(2);
+    filter.setAtomFieldMasks({{1, fieldMask}}, consumer);
+    filter.setAtomIds({1, 2}, consumer);
+
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    ASSERT_NE(nullptr, filter.getAtomFieldMask(1));
+    EXPECT_EQ(fieldMask, *filter.getAtomFieldMask(1));
+    // atoms without a mask are fully parsed
+    EXPECT_TRUE(filter.isAtomInUse(2));
+    EXPECT_EQ(nullptr, filter.getAtomFieldMask(2));
+
+    filter.setAtomFieldMasks({}, consumer);
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_EQ(nullptr, filter.getAtomFieldMask(1));
+    EXPECT_EQ(0, filter.mLocalFieldMasks.size());
+}
+
+TEST(LogEventFilterTest, TestFieldMasksMultipleConsumers) {
+    LogEventFilter filter;
+    const auto consumer1 = reinterpret_cast<LogEventFilter::ConsumerId>(0);
+    const auto consumer2 = reinterpret_cast<LogEventFilter::ConsumerId>(1);
+    TopLevelFieldMask fieldMask1;
+    fieldMask1.set(1);
+    TopLevelFieldMask fieldMask2;
+    fieldMask2.set(3);
+    filter.setAtomFieldMasks({{1, fieldMask1}, {2, fieldMask1}}, consumer1);
+    filter.setAtomFieldMasks({{1, fieldMask2}}, consumer2);
+    filter.setAtomIds({1, 2}, consumer1);
+    filter.setAtomIds({1}, consumer2);
+
+    // the masks of all consumers of an atom are merged
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    ASSERT_NE(nullptr, filter.getAtomFieldMask(1));
+    EXPECT_EQ(fieldMask1 | fieldMask2, *filter.getAtomFieldMask(1));
+    EXPECT_TRUE(filter.isAtomInUse(2));
+    ASSERT_NE(nullptr, filter.getAtomFieldMask(2));
+    EXPECT_EQ(fieldMask1, *filter.getAtomFieldMask(2));
+
+    // a consumer without masks reads all fields of its atoms
+    filter.setAtomFieldMasks({}, consumer2);
+    EXPECT_TRUE(filter.isAtomInUse(1));
+    EXPECT_EQ(nullptr, filter.getAtomFieldMask(1));
+    EXPECT_TRUE(filter.isAtomInUse(2));
+    ASSERT_NE(nullptr, filter.getAtomFieldMask(2));
+    EXPECT_EQ(fieldMask1, *filter.getAtomFieldMask(2));
+}
+
+TEST(LogEventFilterTest, TestRawAtoms) {
+    LogEventFilter filter;
+    const uint8_t payload[] = {1, 2, 3};
+    vector<int> forwardedAtomIds;
+    filter.setRawAtoms({1, 2}, [&forwardedAtomIds, &payload](const RawSocketAtom& atom) {
+        EXPECT_EQ(payload, atom.payload);
+        forwardedAtomIds.push_back(atom.atomId);
+    });
+
+    for (int atomId : {1, 2, 3}) {
+        filter.forwardRawAtom({payload, sizeof(payload), /*uid=*/1000, /*pid=*/1, atomId,
+                               /*elapsedTimestampNs=*/10});
+    }
+    EXPECT_THAT(forwardedAtomIds, ElementsAre(1, 2));
+
+    // raw atoms are not parsed
+    EXPECT_FALSE(filter.isAtomInUse(1));
+
+    filter.setRawAtoms({}, nullptr);
+    forwardedAtomIds.clear();
+    filter.forwardRawAtom({payload, sizeof(payload), /*uid=*/1000, /*pid=*/1, /*atomId=*/1,
+                           /*elapsedTimestampNs=*/10});
+    EXPECT_TRUE(forwardedAtomIds.empty());
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -16,6 +16,8 @@
 
 #include <gtest/gtest.h>
 
+#include <functional>
+
 #include "flags/FlagProvider.h"
 #include "frameworks/proto_logging/stats/atoms.pb.h"
 #include "frameworks/proto_logging/stats/enums/stats/launcher/launcher.pb.h"
@@ -23,6 +25,7 @@
 #include "stats_annotations.h"
 #include "stats_event.h"
 #include "statsd_test_util.h"
+#include "statslog_statsd.h"
 
 #ifdef __ANDROID__
 
@@ -299,6 +302,201 @@ TEST(LogEventTestParsing, TestFetchHeaderOnly) {
     ASSERT_EQ(0, logEvent.getValues().size());
 }
 
+TEST(LogEventTestParsing, TestParseBodyWithFieldMask) {
+    string tag1 = "tag1";
+    uint32_t uids[] = {1001};
+    const char* tags[] = {tag1.c_str()};
+    int64_t int64Array[] = {3, 6};
+
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 10);
+    AStatsEvent_addBoolAnnotation(event, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+    AStatsEvent_writeString(event, "test");
+    AStatsEvent_writeAttributionChain(event, uids, tags, 1);
+    AStatsEvent_writeInt64Array(event, int64Array, 2);
+    AStatsEvent_writeFloat(event, 2.0);
+    AStatsEvent_build(event);
+
+    size_t size;
+    const uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+
+    TopLevelFieldMask fieldMask;
+    fieldMask.set(2);
+    fieldMask.set(5);
+
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    const LogEvent::BodyBufferInfo bodyInfo = logEvent.parseHeader(buf, size);
+    EXPECT_TRUE(logEvent.parseBody(bodyInfo, &fieldMask));
+    AStatsEvent_release(event);
+
+    EXPECT_TRUE(logEvent.isValid());
+    EXPECT_FALSE(logEvent.isParsedHeaderOnly());
+    EXPECT_EQ(100, logEvent.GetTagId());
+    // The skipped fields leave neither values nor annotations behind.
+    EXPECT_FALSE(logEvent.hasAttributionChain());
+    EXPECT_EQ(0, logEvent.getNumUidFields());
+
+    const vector<FieldValue>& values = logEvent.getValues();
+    ASSERT_EQ(2, values.size());
+
+    EXPECT_EQ(getField(100, {2, 1, 1}, 0, {false, false, false}), values[0].mField);
+    EXPECT_EQ(Type::STRING, values[0].mValue.getType());
+    EXPECT_EQ("test", values[0].mValue.getString());
+
+    EXPECT_EQ(getField(100, {5, 1, 1}, 0, {true, false, false}), values[1].mField);
+    EXPECT_EQ(Type::FLOAT, values[1].mValue.getType());
+    EXPECT_EQ(2.0, values[1].mValue.float_value);
+}
+
+TEST(LogEventTestParsing, TestParseBufferInternsStrings) {
+    StringValueInterner strings;
+    vector<std::unique_ptr<LogEvent>> events;
+    for (const char* packageName : {"com.android.vending", "com.android.vending", "other"}) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, 100);
+        AStatsEvent_writeString(event, packageName);
+        AStatsEvent_build(event);
+        size_t size;
+        const uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+        events.push_back(std::make_unique<LogEvent>(/*uid=*/1000, /*pid=*/1001));
+        EXPECT_TRUE(events.back()->parseBuffer(buf, size, /*fieldsToParse=*/nullptr, &strings));
+        AStatsEvent_release(event);
+    }
+
+    EXPECT_EQ(2u, strings.size());
+    const Value& value1 = events[0]->getValues()[0].mValue;
+    const Value& value2 = events[1]->getValues()[0].mValue;
+    const Value& value3 = events[2]->getValues()[0].mValue;
+    EXPECT_EQ("com.android.vending", value1.getString());
+    EXPECT_EQ(value1.string_payload, value2.string_payload);
+    EXPECT_EQ("other", value3.getString());
+}
+
+TEST(LogEventTestParsing, TestParseBodyWithFieldMaskAttributionUidsOnly) {
+    string tag1 = "tag1";
+    string tag2 = "tag2";
+    uint32_t uids[] = {1001, 1002};
+    const char* tags[] = {tag1.c_str(), tag2.c_str()};
+
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeAttributionChain(event, uids, tags, 2);
+    AStatsEvent_writeInt32(event, 10);
+    AStatsEvent_build(event);
+
+    size_t size;
+    const uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+
+    TopLevelFieldMask fieldMask;
+    setTopLevelFieldInUse(1, /*attributionUidsOnly=*/true, &fieldMask);
+    setTopLevelFieldInUse(2, /*attributionUidsOnly=*/false, &fieldMask);
+
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    const LogEvent::BodyBufferInfo bodyInfo = logEvent.parseHeader(buf, size);
+    EXPECT_TRUE(logEvent.parseBody(bodyInfo, &fieldMask));
+    AStatsEvent_release(event);
+
+    EXPECT_TRUE(logEvent.isValid());
+    std::pair<size_t, size_t> attrIndexRange;
+    ASSERT_TRUE(logEvent.hasAttributionChain(&attrIndexRange));
+    EXPECT_EQ(0, attrIndexRange.first);
+    EXPECT_EQ(1, attrIndexRange.second);
+
+    // The uids keep the fields they have when the tags are decoded.
+    const vector<FieldValue>& values = logEvent.getValues();
+    ASSERT_EQ(3, values.size());
+
+    EXPECT_EQ(getField(100, {1, 1, 1}, 2, {false, false, false}), values[0].mField);
+    EXPECT_EQ(1001, values[0].mValue.int_value);
+    EXPECT_TRUE(isAttributionUidField(values[0]));
+
+    EXPECT_EQ(getField(100, {1, 2, 1}, 2, {false, true, false}), values[1].mField);
+    EXPECT_EQ(1002, values[1].mValue.int_value);
+    EXPECT_TRUE(isAttributionUidField(values[1]));
+
+    EXPECT_EQ(getField(100, {2, 1, 1}, 0, {true, false, false}), values[2].mField);
+    EXPECT_EQ(10, values[2].mValue.int_value);
+}
+
+TEST(LogEventTestParsing, TestParseBodyWithFieldMaskInvalidSkippedField) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+    AStatsEvent_writeInt32(event, 10);
+    AStatsEvent_writeAttributionChain(event, {}, {}, 0);
+    AStatsEvent_build(event);
+
+    size_t size;
+    const uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+
+    TopLevelFieldMask fieldMask;
+    fieldMask.set(1);
+
+    // An empty attribution chain is invalid even when its field is not decoded.
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    const LogEvent::BodyBufferInfo bodyInfo = logEvent.parseHeader(buf, size);
+    EXPECT_FALSE(logEvent.parseBody(bodyInfo, &fieldMask));
+    EXPECT_FALSE(logEvent.isValid());
+    AStatsEvent_release(event);
+}
+
+TEST(LogEventTestParsing, TestParseFlatSchema) {
+    const int32_t atomId = util::SCREEN_BRIGHTNESS_CHANGED;
+    auto parse = [atomId](LogEvent* logEvent, const TopLevelFieldMask* fieldMask,
+                          const std::function<void(AStatsEvent*)>& writeFields) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, atomId);
+        writeFields(event);
+        AStatsEvent_build(event);
+        size_t size;
+        const uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+        const LogEvent::BodyBufferInfo bodyInfo = logEvent->parseHeader(buf, size);
+        const bool valid = logEvent->parseBody(bodyInfo, fieldMask);
+        AStatsEvent_release(event);
+        return valid;
+    };
+
+    // Decoded by the flat schema.
+    LogEvent flatEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(parse(&flatEvent, nullptr,
+                      [](AStatsEvent* event) { AStatsEvent_writeInt32(event, 10); }));
+    ASSERT_EQ(1, flatEvent.getValues().size());
+    EXPECT_EQ(getField(atomId, {1, 1, 1}, 0, {true, false, false}),
+              flatEvent.getValues()[0].mField);
+    EXPECT_EQ(Type::INT, flatEvent.getValues()[0].mValue.getType());
+    EXPECT_EQ(10, flatEvent.getValues()[0].mValue.int_value);
+    EXPECT_EQ(std::make_pair<size_t, size_t>(0, 1), flatEvent.getTopLevelFieldRange(1));
+
+    TopLevelFieldMask fieldMask;
+    LogEvent maskedEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(parse(&maskedEvent, &fieldMask,
+                      [](AStatsEvent* event) { AStatsEvent_writeInt32(event, 10); }));
+    EXPECT_TRUE(maskedEvent.getValues().empty());
+
+    // An annotation or an extra field fall back to the generic path.
+    LogEvent annotatedEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(parse(&annotatedEvent, nullptr, [](AStatsEvent* event) {
+        AStatsEvent_writeInt32(event, 10);
+        AStatsEvent_addBoolAnnotation(event, ASTATSLOG_ANNOTATION_ID_IS_UID, true);
+    }));
+    ASSERT_EQ(1, annotatedEvent.getValues().size());
+    EXPECT_EQ(1, annotatedEvent.getNumUidFields());
+
+    LogEvent longerEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(parse(&longerEvent, nullptr, [](AStatsEvent* event) {
+        AStatsEvent_writeInt32(event, 10);
+        AStatsEvent_writeInt64(event, 20);
+    }));
+    ASSERT_EQ(2, longerEvent.getValues().size());
+    EXPECT_EQ(20, longerEvent.getValues()[1].mValue.long_value);
+
+    LogEvent otherTypeEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(parse(&otherTypeEvent, nullptr,
+                      [](AStatsEvent* event) { AStatsEvent_writeFloat(event, 2.0); }));
+    ASSERT_EQ(1, otherTypeEvent.getValues().size());
+    EXPECT_EQ(Type::FLOAT, otherTypeEvent.getValues()[0].mValue.getType());
+}
+
 TEST_P(LogEventTest, TestStringAndByteArrayParsing) {
     AStatsEvent* event = AStatsEvent_obtain();
     AStatsEvent_setAtomId(event, 100);
@@ -325,14 +523,14 @@ TEST_P(LogEventTest, TestStringAndByteArrayParsing) {
     Field expectedField = getField(100, {1, 1, 1}, 0, {false, false, false});
     EXPECT_EQ(expectedField, stringItem.mField);
     EXPECT_EQ(Type::STRING, stringItem.mValue.getType());
-    EXPECT_EQ(str, stringItem.mValue.str_value);
+    EXPECT_EQ(str, stringItem.mValue.getString());
 
     const FieldValue& storageItem = values[1];
     expectedField = getField(100, {2, 1, 1}, 0, {true, false, false});
     EXPECT_EQ(expectedField, storageItem.mField);
     EXPECT_EQ(Type::STORAGE, storageItem.mValue.getType());
     vector<uint8_t> expectedValue = {'t', 'e', 's', 't'};
-    EXPECT_EQ(expectedValue, storageItem.mValue.storage_value);
+    EXPECT_EQ(expectedValue, storageItem.mValue.getStorage());
 
     AStatsEvent_release(event);
 }
@@ -362,7 +560,7 @@ TEST_P(LogEventTest, TestEmptyString) {
     Field expectedField = getField(100, {1, 1, 1}, 0, {true, false, false});
     EXPECT_EQ(expectedField, item.mField);
     EXPECT_EQ(Type::STRING, item.mValue.getType());
-    EXPECT_EQ(empty, item.mValue.str_value);
+    EXPECT_EQ(empty, item.mValue.getString());
 
     AStatsEvent_release(event);
 }
@@ -392,7 +590,7 @@ TEST_P(LogEventTest, TestByteArrayWithNullCharacter) {
     EXPECT_EQ(expectedField, item.mField);
     EXPECT_EQ(Type::STORAGE, item.mValue.getType());
     vector<uint8_t> expectedValue(message, message + 5);
-    EXPECT_EQ(expectedValue, item.mValue.storage_value);
+    EXPECT_EQ(expectedValue, item.mValue.getStorage());
 
     AStatsEvent_release(event);
 }
@@ -458,7 +656,7 @@ TEST_P(LogEventTest, TestAttributionChain) {
     expectedField = getField(100, {1, 1, 2}, 2, {true, false, true});
     EXPECT_EQ(expectedField, tag1Item.mField);
     EXPECT_EQ(Type::STRING, tag1Item.mValue.getType());
-    EXPECT_EQ(tag1, tag1Item.mValue.str_value);
+    EXPECT_EQ(tag1, tag1Item.mValue.getString());
 
     // Check second attribution nodes
     const FieldValue& uid2Item = values[2];
@@ -471,7 +669,43 @@ TEST_P(LogEventTest, TestAttributionChain) {
     expectedField = getField(100, {1, 2, 2}, 2, {true, true, true});
     EXPECT_EQ(expectedField, tag2Item.mField);
     EXPECT_EQ(Type::STRING, tag2Item.mValue.getType());
-    EXPECT_EQ(tag2, tag2Item.mValue.str_value);
+    EXPECT_EQ(tag2, tag2Item.mValue.getString());
+
+    AStatsEvent_release(event);
+}
+
+TEST_P(LogEventTest, TestTopLevelFieldRange) {
+    AStatsEvent* event = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(event, 100);
+
+    uint32_t uids[] = {1001, 1002};
+    const char* tags[] = {"tag1", "tag2"};
+    AStatsEvent_writeAttributionChain(event, uids, tags, 2);
+    AStatsEvent_writeInt32(event, 10);
+    int32_t int32Array[] = {3, 6, 9};
+    AStatsEvent_writeInt32Array(event, int32Array, 3);
+    AStatsEvent_writeString(event, "test");
+    AStatsEvent_build(event);
+
+    size_t size;
+    const uint8_t* buf = AStatsEvent_getBuffer(event, &size);
+
+    LogEvent logEvent(/*uid=*/1000, /*pid=*/1001);
+    EXPECT_TRUE(ParseBuffer(logEvent, buf, size));
+    ASSERT_EQ(9, logEvent.getValues().size());
+
+    EXPECT_EQ(std::make_pair<size_t, size_t>(0, 4), logEvent.getTopLevelFieldRange(1));
+    EXPECT_EQ(std::make_pair<size_t, size_t>(4, 5), logEvent.getTopLevelFieldRange(2));
+    EXPECT_EQ(std::make_pair<size_t, size_t>(5, 8), logEvent.getTopLevelFieldRange(3));
+    EXPECT_EQ(std::make_pair<size_t, size_t>(8, 9), logEvent.getTopLevelFieldRange(4));
+
+    // Fields the event does not have have no values.
+    auto [start, end] = logEvent.getTopLevelFieldRange(0);
+    EXPECT_EQ(start, end);
+    std::tie(start, end) = logEvent.getTopLevelFieldRange(5);
+    EXPECT_EQ(start, end);
+    std::tie(start, end) = logEvent.getTopLevelFieldRange(127);
+    EXPECT_EQ(start, end);
 
     AStatsEvent_release(event);
 }
@@ -608,13 +842,13 @@ TEST_P(LogEventTest, TestArrayParsing) {
     expectedField = getField(100, {5, 1, 1}, 1, {true, false, false});
     EXPECT_EQ(expectedField, stringArrayItem1.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem1.mValue.getType());
-    EXPECT_EQ("str1", stringArrayItem1.mValue.str_value);
+    EXPECT_EQ("str1", stringArrayItem1.mValue.getString());
 
     const FieldValue& stringArrayItem2 = values[9];
     expectedField = getField(100, {5, 2, 1}, 1, {true, true, false});
     EXPECT_EQ(expectedField, stringArrayItem2.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem2.mValue.getType());
-    EXPECT_EQ("str2", stringArrayItem2.mValue.str_value);
+    EXPECT_EQ("str2", stringArrayItem2.mValue.getString());
 }
 
 TEST_P(LogEventTest, TestEmptyStringArray) {
@@ -645,13 +879,13 @@ TEST_P(LogEventTest, TestEmptyStringArray) {
     Field expectedField = getField(100, {1, 1, 1}, 1, {true, false, false});
     EXPECT_EQ(expectedField, stringArrayItem1.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem1.mValue.getType());
-    EXPECT_EQ(empty, stringArrayItem1.mValue.str_value);
+    EXPECT_EQ(empty, stringArrayItem1.mValue.getString());
 
     const FieldValue& stringArrayItem2 = values[1];
     expectedField = getField(100, {1, 2, 1}, 1, {true, true, false});
     EXPECT_EQ(expectedField, stringArrayItem2.mField);
     EXPECT_EQ(Type::STRING, stringArrayItem2.mValue.getType());
-    EXPECT_EQ(empty, stringArrayItem2.mValue.str_value);
+    EXPECT_EQ(empty, stringArrayItem2.mValue.getString());
 
     AStatsEvent_release(event);
 }
@@ -1030,6 +1264,47 @@ TEST_P(LogEventTest, TestRestrictionCategoryAnnotationBelowUDevice) {
             /*doHeaderPrefetch=*/GetParam()));
 }
 
+TEST_P(LogEventTest, TestEventCountAnnotation) {
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    EXPECT_TRUE(createAtomLevelIntAnnotationLogEvent(&event, INT32_TYPE,
+                                                     ASTATSLOG_ANNOTATION_ID_EVENT_COUNT, 12,
+                                                     /*doHeaderPrefetch=*/GetParam()));
+    EXPECT_EQ(event.getEventCount(), 12);
+
+    LogEvent eventWithoutCount(/*uid=*/0, /*pid=*/0);
+    EXPECT_TRUE(createFieldWithIntAnnotationLogEvent(
+            &eventWithoutCount, INT32_TYPE, ASTATSLOG_ANNOTATION_ID_TRIGGER_STATE_RESET, 10,
+            /*doHeaderPrefetch=*/GetParam()));
+    EXPECT_EQ(eventWithoutCount.getEventCount(), 1);
+}
+
+TEST_P(LogEventTest, TestEventCountAnnotationAfterReset) {
+    // Pooled events are reset and parsed again, the count must not carry over.
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    EXPECT_TRUE(createAtomLevelIntAnnotationLogEvent(&event, INT32_TYPE,
+                                                     ASTATSLOG_ANNOTATION_ID_EVENT_COUNT, 12,
+                                                     /*doHeaderPrefetch=*/GetParam()));
+    EXPECT_EQ(event.getEventCount(), 12);
+
+    event.reset(/*uid=*/0, /*pid=*/0);
+    EXPECT_TRUE(createFieldWithIntAnnotationLogEvent(
+            &event, INT32_TYPE, ASTATSLOG_ANNOTATION_ID_TRIGGER_STATE_RESET, 10,
+            /*doHeaderPrefetch=*/GetParam()));
+    EXPECT_EQ(event.getEventCount(), 1);
+}
+
+TEST_P(LogEventTest, TestInvalidEventCountAnnotation) {
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    EXPECT_FALSE(createAtomLevelIntAnnotationLogEvent(&event, INT32_TYPE,
+                                                      ASTATSLOG_ANNOTATION_ID_EVENT_COUNT, 0,
+                                                      /*doHeaderPrefetch=*/GetParam()));
+
+    LogEvent fieldEvent(/*uid=*/0, /*pid=*/0);
+    EXPECT_FALSE(createFieldWithIntAnnotationLogEvent(&fieldEvent, INT32_TYPE,
+                                                      ASTATSLOG_ANNOTATION_ID_EVENT_COUNT, 2,
+                                                      /*doHeaderPrefetch=*/GetParam()));
+}
+
 TEST_P(LogEventTestBadAnnotationFieldTypes, TestResetStateAnnotation) {
     LogEvent event(/*uid=*/0, /*pid=*/0);
     int32_t resetState = 10;
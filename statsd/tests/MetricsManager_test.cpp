@@ -19,6 +19,7 @@
 
 #include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "metrics/metrics_test_helper.h"
@@ -527,6 +528,237 @@ TEST(MetricsManagerTest, TestGetTriggerMemoryKbUnset) {
     EXPECT_TRUE(metricsManager.isConfigValid());
 }
 
+TEST(MetricsManagerTest, TestOnLogEventResetsScratchCaches) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config = buildGoodConfig(kConfigId);
+    Predicate* combinationPredicate = config.add_predicate();
+    combinationPredicate->set_id(StringToId("ScreenIsOnCombination"));
+    combinationPredicate->mutable_combination()->set_operation(LogicalOperation::AND);
+    addPredicateToPredicateCombination(CreateScreenIsOnPredicate(), combinationPredicate);
+
+    MetricsManager metricsManager(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap,
+                                  pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+
+    const sp<ConditionTracker>& combinationCondition =
+            metricsManager.mAllConditionTrackers[metricsManager.mConditionTrackerMap.at(
+                    StringToId("ScreenIsOnCombination"))];
+
+    auto expectCachesReset = [&metricsManager]() {
+        for (const MatchingState state : metricsManager.mMatcherCache) {
+            EXPECT_EQ(MatchingState::kNotComputed, state);
+        }
+        for (const ConditionState state : metricsManager.mConditionCache) {
+            EXPECT_EQ(ConditionState::kNotEvaluated, state);
+        }
+        for (const bool value : metricsManager.mConditionChangedCache) {
+            EXPECT_FALSE(value);
+        }
+        for (const bool value : metricsManager.mConditionToBeEvaluated) {
+            EXPECT_FALSE(value);
+        }
+    };
+
+    metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+            timeBaseSec + 10, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    ASSERT_EQ(metricsManager.mAllAtomMatchingTrackers.size(), metricsManager.mMatcherCache.size());
+    ASSERT_EQ(metricsManager.mAllConditionTrackers.size(), metricsManager.mConditionCache.size());
+    EXPECT_EQ(ConditionState::kTrue, combinationCondition->getUnSlicedPartConditionState());
+    // The combination condition and its child were evaluated.
+    EXPECT_EQ(2, metricsManager.mTouchedConditionIndices.size());
+    expectCachesReset();
+
+    metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+            timeBaseSec + 20, android::view::DisplayStateEnum::DISPLAY_STATE_OFF));
+    EXPECT_EQ(ConditionState::kFalse, combinationCondition->getUnSlicedPartConditionState());
+    expectCachesReset();
+}
+
+TEST(MetricsManagerTest, TestActivationExpiryQueue) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    AtomMatcher crashMatcher = CreateProcessCrashAtomMatcher();
+    AtomMatcher screenOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = crashMatcher;
+    *config.add_atom_matcher() = screenOnMatcher;
+    const int64_t metricId = 123456;
+    CountMetric* countMetric = config.add_count_metric();
+    countMetric->set_id(metricId);
+    countMetric->set_what(crashMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    MetricActivation* metricActivation = config.add_metric_activation();
+    metricActivation->set_metric_id(metricId);
+    EventActivation* eventActivation = metricActivation->add_event_activation();
+    eventActivation->set_atom_matcher_id(screenOnMatcher.id());
+    eventActivation->set_ttl_seconds(60);
+
+    MetricsManager metricsManager(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap,
+                                  pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    EXPECT_FALSE(metricsManager.isActive());
+    EXPECT_TRUE(metricsManager.mActivationExpiryQueue.empty());
+
+    const int64_t activationNs = timeBaseSec + 10;
+    metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+            activationNs, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    EXPECT_TRUE(metricsManager.isActive());
+    EXPECT_EQ(1, metricsManager.mActiveMetricCount);
+    ASSERT_EQ(1, metricsManager.mActivationExpiryQueue.size());
+    EXPECT_EQ(activationNs + 60 * NS_PER_SEC, metricsManager.mActivationExpiryQueue.top().first);
+
+    // A later activation extends the ttl without adding an entry. The scheduled one finds it.
+    metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+            activationNs + 30 * NS_PER_SEC, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    EXPECT_EQ(1, metricsManager.mActivationExpiryQueue.size());
+    metricsManager.onLogEvent(
+            *CreateAppCrashEvent(activationNs + 61 * NS_PER_SEC, /*uid=*/1000));
+    EXPECT_TRUE(metricsManager.isActive());
+    ASSERT_EQ(1, metricsManager.mActivationExpiryQueue.size());
+    EXPECT_EQ(activationNs + 90 * NS_PER_SEC, metricsManager.mActivationExpiryQueue.top().first);
+
+    metricsManager.onLogEvent(
+            *CreateAppCrashEvent(activationNs + 91 * NS_PER_SEC, /*uid=*/1000));
+    EXPECT_FALSE(metricsManager.isActive());
+    EXPECT_EQ(0, metricsManager.mActiveMetricCount);
+    EXPECT_TRUE(metricsManager.mActivationExpiryQueue.empty());
+}
+
+TEST(MetricsManagerTest, TestAddAllAtomFieldMasks) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    StatsdConfig config;
+    config.set_id(kConfigId);
+    config.add_allowed_log_source("AID_SYSTEM");
+    *config.add_atom_matcher() = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOnAtomMatcher();
+
+    CountMetric* countMetric = config.add_count_metric();
+    countMetric->set_id(StringToId("WakelockCount"));
+    countMetric->set_what(StringToId("AcquireWakelock"));
+    countMetric->set_bucket(FIVE_MINUTES);
+    *countMetric->mutable_dimensions_in_what() =
+            CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+
+    EventMetric* eventMetric = config.add_event_metric();
+    eventMetric->set_id(StringToId("ScreenOnEvents"));
+    eventMetric->set_what(StringToId("ScreenTurnedOn"));
+
+    MetricsManager metricsManager(kConfigKey, config, timeBaseSec, timeBaseSec, uidMap,
+                                  pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+
+    AtomFieldMasks fieldMasks;
+    metricsManager.addAllAtomFieldMasks(fieldMasks);
+    ASSERT_EQ(2, fieldMasks.size());
+
+    // The attribution chain is sliced by and the state field is matched on.
+    TopLevelFieldMask expectedWakelockMask;
+    expectedWakelockMask.set(1);
+    expectedWakelockMask.set(4);
+    EXPECT_EQ(expectedWakelockMask, fieldMasks[util::WAKELOCK_STATE_CHANGED]);
+
+    // Event metrics keep whole atoms.
+    EXPECT_TRUE(fieldMasks[util::SCREEN_STATE_CHANGED].all());
+}
+
+namespace {
+
+// Counts crashes, and screen on events once activated by a screen turning on.
+StatsdConfig createLoadSheddingConfig(bool bestEffort) {
+    StatsdConfig config;
+    config.set_id(kConfigId);
+    config.set_best_effort(bestEffort);
+    AtomMatcher crashMatcher = CreateProcessCrashAtomMatcher();
+    AtomMatcher screenOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = crashMatcher;
+    *config.add_atom_matcher() = screenOnMatcher;
+
+    CountMetric* crashCount = config.add_count_metric();
+    crashCount->set_id(StringToId("CrashCount"));
+    crashCount->set_what(crashMatcher.id());
+    crashCount->set_bucket(FIVE_MINUTES);
+
+    CountMetric* screenOnCount = config.add_count_metric();
+    screenOnCount->set_id(StringToId("ScreenOnCount"));
+    screenOnCount->set_what(screenOnMatcher.id());
+    screenOnCount->set_bucket(FIVE_MINUTES);
+    MetricActivation* metricActivation = config.add_metric_activation();
+    metricActivation->set_metric_id(screenOnCount->id());
+    EventActivation* eventActivation = metricActivation->add_event_activation();
+    eventActivation->set_atom_matcher_id(screenOnMatcher.id());
+    eventActivation->set_ttl_seconds(60);
+    return config;
+}
+
+}  // anonymous namespace
+
+TEST(MetricsManagerTest, TestLoadShedding) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    MetricsManager metricsManager(kConfigKey, createLoadSheddingConfig(/*bestEffort=*/true),
+                                  timeBaseSec, timeBaseSec, uidMap, pullerManager,
+                                  anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    EXPECT_TRUE(metricsManager.isBestEffort());
+    // The screen atom activates a metric.
+    EXPECT_EQ(std::unordered_set<int>({util::PROCESS_LIFE_CYCLE_STATE_CHANGED}),
+              metricsManager.mSheddableAtomIds);
+
+    metricsManager.onLogEvent(*CreateAppCrashEvent(timeBaseSec + 1, /*uid=*/1000));
+    EXPECT_EQ(0, metricsManager.mShedEventCount);
+
+    metricsManager.setLoadShedding(true);
+    for (int i = 0; i < 15; i++) {
+        metricsManager.onLogEvent(*CreateAppCrashEvent(timeBaseSec + 10 + i, /*uid=*/1000));
+        metricsManager.onLogEvent(*CreateScreenStateChangedEvent(
+                timeBaseSec + 10 + i, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    }
+    // The first and eleventh crashes are processed, the skipped ones before the eleventh are
+    // already reported. Screen events are never skipped.
+    EXPECT_EQ(4, metricsManager.mShedEventCount);
+
+    metricsManager.setLoadShedding(false);
+    EXPECT_EQ(0, metricsManager.mShedEventCount);
+    EXPECT_EQ(0, metricsManager.mLoadSheddingSampleCounter);
+    metricsManager.onLogEvent(*CreateAppCrashEvent(timeBaseSec + 30, /*uid=*/1000));
+    metricsManager.onLogEvent(*CreateAppCrashEvent(timeBaseSec + 31, /*uid=*/1000));
+    EXPECT_EQ(0, metricsManager.mShedEventCount);
+}
+
+TEST(MetricsManagerTest, TestLoadSheddingNotBestEffort) {
+    sp<UidMap> uidMap;
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+
+    MetricsManager metricsManager(kConfigKey, createLoadSheddingConfig(/*bestEffort=*/false),
+                                  timeBaseSec, timeBaseSec, uidMap, pullerManager,
+                                  anomalyAlarmMonitor, periodicAlarmMonitor);
+    ASSERT_TRUE(metricsManager.isConfigValid());
+    EXPECT_TRUE(metricsManager.mSheddableAtomIds.empty());
+
+    metricsManager.setLoadShedding(true);
+    for (int i = 0; i < 15; i++) {
+        metricsManager.onLogEvent(*CreateAppCrashEvent(timeBaseSec + 10 + i, /*uid=*/1000));
+    }
+    EXPECT_EQ(0, metricsManager.mShedEventCount);
+    EXPECT_EQ(0, metricsManager.mLoadSheddingSampleCounter);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
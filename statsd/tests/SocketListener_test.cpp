@@ -13,6 +13,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <android-base/file.h>
 #include <gtest/gtest.h>
 
 #include "socket/StatsSocketListener.h"
@@ -246,6 +247,111 @@ TEST(SocketParseMessageTest, TestProcessMessageFilterToggle) {
     }
 }
 
+namespace {
+
+// Appends the atom to the batch in the libstatssocket batch format.
+void appendToBatch(const AStatsEventWrapper& event, std::vector<uint8_t>* batch) {
+    auto [buf, size] = event.getBuffer();
+    const uint32_t atomLen = size;
+    const uint8_t* lenBytes = reinterpret_cast<const uint8_t*>(&atomLen);
+    batch->insert(batch->end(), lenBytes, lenBytes + sizeof(atomLen));
+    batch->insert(batch->end(), buf, buf + size);
+}
+
+}  //  namespace
+
+TEST(SocketParseMessageTest, TestProcessBatch) {
+    std::shared_ptr<LogEventQueue> eventQueue =
+            std::make_shared<LogEventQueue>(kEventCount /*buffer limit*/);
+    std::shared_ptr<LogEventFilter> logEventFilter = std::make_shared<LogEventFilter>();
+
+    std::vector<uint8_t> batch;
+    for (int i = 0; i < 10; i++) {
+        appendToBatch(AStatsEventWrapper(kAtomId + i), &batch);
+    }
+    EXPECT_TRUE(StatsSocketListener::processBatch(batch.data(), batch.size(), kTestUid, kTestPid,
+                                                  eventQueue, logEventFilter));
+
+    EXPECT_EQ(10, eventQueue->mQueue.size());
+    for (int i = 0; i < 10; i++) {
+        auto logEvent = eventQueue->waitPop();
+        EXPECT_TRUE(logEvent->isValid());
+        EXPECT_EQ(kAtomId + i, logEvent->GetTagId());
+        EXPECT_EQ((int32_t)kTestUid, logEvent->GetUid());
+        EXPECT_EQ((int32_t)kTestPid, logEvent->GetPid());
+    }
+}
+
+TEST(SocketParseMessageTest, TestProcessBatchMalformed) {
+    std::shared_ptr<LogEventQueue> eventQueue =
+            std::make_shared<LogEventQueue>(kEventCount /*buffer limit*/);
+    std::shared_ptr<LogEventFilter> logEventFilter = std::make_shared<LogEventFilter>();
+
+    std::vector<uint8_t> batch;
+    appendToBatch(AStatsEventWrapper(kAtomId), &batch);
+    // size prefix of an atom that is longer than the rest of the batch
+    const uint32_t atomLen = 100;
+    const uint8_t* lenBytes = reinterpret_cast<const uint8_t*>(&atomLen);
+    batch.insert(batch.end(), lenBytes, lenBytes + sizeof(atomLen));
+    batch.push_back(0);
+
+    EXPECT_FALSE(StatsSocketListener::processBatch(batch.data(), batch.size(), kTestUid,
+                                                   kTestPid, eventQueue, logEventFilter));
+
+    // the atom before the malformed one is kept
+    ASSERT_EQ(1, eventQueue->mQueue.size());
+    EXPECT_EQ(kAtomId, eventQueue->waitPop()->GetTagId());
+}
+
+TEST(SocketParseMessageTest, TestProcessMessageSpill) {
+    std::shared_ptr<LogEventQueue> eventQueue = std::make_shared<LogEventQueue>(2 /*buffer limit*/);
+    TemporaryFile file;
+    eventQueue->setSpill(LogEventSpill::create(file.path));
+    ASSERT_NE(eventQueue->getSpill(), nullptr);
+    std::shared_ptr<LogEventFilter> logEventFilter = std::make_shared<LogEventFilter>();
+    logEventFilter->setFilteringEnabled(false);
+
+    // The 2 atoms that do not fit are spilled.
+    generateAtomLogging(eventQueue, logEventFilter, 4, kAtomId);
+    EXPECT_TRUE(eventQueue->getSpill()->isActive());
+    EXPECT_EQ(kAtomId, eventQueue->waitPop()->GetTagId());
+    EXPECT_EQ(kAtomId + 1, eventQueue->waitPop()->GetTagId());
+
+    // The spilled atoms fill the queue again, so the new atom goes after them into the spill.
+    generateAtomLogging(eventQueue, logEventFilter, 1, kAtomId + 4);
+    EXPECT_TRUE(eventQueue->getSpill()->isActive());
+    EXPECT_EQ(kAtomId + 2, eventQueue->waitPop()->GetTagId());
+    EXPECT_EQ(kAtomId + 3, eventQueue->waitPop()->GetTagId());
+
+    generateAtomLogging(eventQueue, logEventFilter, 1, kAtomId + 5);
+    EXPECT_FALSE(eventQueue->getSpill()->isActive());
+    EXPECT_EQ(kAtomId + 4, eventQueue->waitPop()->GetTagId());
+    EXPECT_EQ(kAtomId + 5, eventQueue->waitPop()->GetTagId());
+}
+
+TEST(LogEventParsePipelineTest, TestEventsQueuedInSubmitOrder) {
+    std::shared_ptr<LogEventQueue> eventQueue =
+            std::make_shared<LogEventQueue>(kEventCount /*buffer limit*/);
+    std::shared_ptr<LogEventFilter> logEventFilter = std::make_shared<LogEventFilter>();
+    LogEventParsePipeline pipeline(eventQueue, logEventFilter, /*logEventPool=*/nullptr,
+                                   /*numWorkers=*/4);
+
+    for (int i = 0; i < kEventCount; i++) {
+        AStatsEventWrapper event(kAtomId + i);
+        auto [buf, size] = event.getBuffer();
+        pipeline.submit(buf, size, kTestUid, kTestPid);
+    }
+    pipeline.waitForDrained();
+
+    for (int i = 0; i < kEventCount; i++) {
+        auto logEvent = eventQueue->waitPop();
+        EXPECT_TRUE(logEvent->isValid());
+        EXPECT_EQ(kAtomId + i, logEvent->GetTagId());
+        EXPECT_EQ((int32_t)kTestUid, logEvent->GetUid());
+        EXPECT_EQ((int32_t)kTestPid, logEvent->GetPid());
+    }
+}
+
 // TODO: tests for setAtomIds() with multiple consumers
 // TODO: use MockLogEventFilter to test different sets from different consumers
 
@@ -14,9 +14,11 @@
 
 #include "StatsLogProcessor.h"
 
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <private/android_filesystem_config.h>
 #include <stdio.h>
 
 #include "StatsService.h"
@@ -49,13 +51,21 @@ using ::testing::Expectation;
 #ifdef __ANDROID__
 #define STATS_DATA_DIR "/data/misc/stats-data"
 
+// Events are only routed to the configs using their atom: adds a matcher of the atom the tests
+// log to the config of a mock.
+StatsdConfig withTestAtom(StatsdConfig config) {
+    *config.add_atom_matcher() = CreateSimpleAtomMatcher("TestAtom", /*atomId=*/123);
+    return config;
+}
+
 /**
  * Mock MetricsManager (ByteSize() is called).
  */
 class MockMetricsManager : public MetricsManager {
 public:
-    MockMetricsManager(ConfigKey configKey = ConfigKey(1, 12345))
-        : MetricsManager(configKey, StatsdConfig(), 1000, 1000, new UidMap(),
+    MockMetricsManager(ConfigKey configKey = ConfigKey(1, 12345),
+                       const StatsdConfig& config = StatsdConfig())
+        : MetricsManager(configKey, withTestAtom(config), 1000, 1000, new UidMap(),
                          new StatsPullerManager(),
                          new AlarmMonitor(
                                  10, [](const shared_ptr<IStatsCompanionService>&, int64_t) {},
@@ -69,13 +79,15 @@ public:
 
     MOCK_METHOD1(dropData, void(const int64_t dropTimeNs));
 
-    MOCK_METHOD(void, onLogEvent, (const LogEvent& event), (override));
+    MOCK_METHOD(void, onLogEvent, (const LogEvent& event, bool fromAllowedLogSource), (override));
 
     MOCK_METHOD(void, onDumpReport,
                 (const int64_t dumpTimeNs, const int64_t wallClockNs,
                  const bool include_current_partial_bucket, const bool erase_data,
                  const DumpLatency dumpLatency, std::set<string>* str_set,
-                 android::util::ProtoOutputStream* protoOutput),
+                 android::util::ProtoOutputStream* protoOutput,
+                 const std::function<void(android::util::ProtoOutputStream*)>&
+                         flushCompletedFields),
                 (override));
 };
 
@@ -200,7 +212,8 @@ StatsdConfig makeRestrictedConfig(bool includeMetric = false) {
 class MockRestrictedMetricsManager : public MetricsManager {
 public:
     MockRestrictedMetricsManager(ConfigKey configKey = ConfigKey(1, 12345))
-        : MetricsManager(configKey, makeRestrictedConfig(), 1000, 1000, new UidMap(),
+        : MetricsManager(configKey, withTestAtom(makeRestrictedConfig()), 1000, 1000,
+                         new UidMap(),
                          new StatsPullerManager(),
                          new AlarmMonitor(
                                  10, [](const shared_ptr<IStatsCompanionService>&, int64_t) {},
@@ -210,17 +223,498 @@ public:
                                  [](const shared_ptr<IStatsCompanionService>&) {})) {
     }
 
-    MOCK_METHOD(void, onLogEvent, (const LogEvent& event), (override));
+    MOCK_METHOD(void, onLogEvent, (const LogEvent& event, bool fromAllowedLogSource), (override));
     MOCK_METHOD(void, onDumpReport,
                 (const int64_t dumpTimeNs, const int64_t wallClockNs,
                  const bool include_current_partial_bucket, const bool erase_data,
                  const DumpLatency dumpLatency, std::set<string>* str_set,
-                 android::util::ProtoOutputStream* protoOutput),
+                 android::util::ProtoOutputStream* protoOutput,
+                 const std::function<void(android::util::ProtoOutputStream*)>&
+                         flushCompletedFields),
                 (override));
     MOCK_METHOD(size_t, byteSize, (), (override));
-    MOCK_METHOD(void, flushRestrictedData, (), (override));
+    MOCK_METHOD(void, flushRestrictedData, (const bool asyncInsert), (override));
 };
 
+TEST(StatsLogProcessorTest, TestOnLogEventsBatch) {
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(
+            /*timeBaseNs=*/1, /*currentTimeNs=*/1, StatsdConfig(), ConfigKey(1, 12345));
+    sp<MockMetricsManager> metricsManager = new MockMetricsManager();
+    processor->mMetricsManagers[ConfigKey(1, 12345)] = metricsManager;
+    processor->updateLogEventFilterLocked();
+
+    // Every event reaches the metrics manager while the guardrail is checked once per batch.
+    EXPECT_CALL(*metricsManager, onLogEvent).Times(5);
+    EXPECT_CALL(*metricsManager, byteSize()).Times(1).WillRepeatedly(Return(0));
+
+    vector<std::unique_ptr<LogEvent>> events;
+    for (int i = 0; i < 5; i++) {
+        events.push_back(CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/i + 1));
+    }
+    processor->OnLogEvents(events, /*elapsedRealtimeNs=*/10);
+}
+
+TEST(StatsLogProcessorTest, TestOnLogEventsChecksAtFirstValidEvent) {
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(
+            /*timeBaseNs=*/1, /*currentTimeNs=*/1, StatsdConfig(), ConfigKey(1, 12345));
+    sp<MockMetricsManager> metricsManager = new MockMetricsManager();
+    processor->mMetricsManagers[ConfigKey(1, 12345)] = metricsManager;
+    processor->updateLogEventFilterLocked();
+    processor->mNextHousekeepingNs = 0;
+    EXPECT_CALL(*metricsManager, byteSize()).WillRepeatedly(Return(0));
+
+    // A batch of invalid events is dropped before the time driven checks, as single events are.
+    const uint8_t invalidBuf[] = {0};
+    vector<std::unique_ptr<LogEvent>> events;
+    events.push_back(std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0));
+    events.back()->parseBuffer(invalidBuf, sizeof(invalidBuf));
+    ASSERT_FALSE(events.back()->isValid());
+    EXPECT_CALL(*metricsManager, onLogEvent).Times(0);
+    processor->OnLogEvents(events, /*elapsedRealtimeNs=*/10);
+    EXPECT_EQ(0, processor->mNextHousekeepingNs.load());
+    EXPECT_FALSE(processor->mBatchConfigTtlCheckDue);
+    EXPECT_FALSE(processor->mBatchHousekeepingDue);
+    ::testing::Mock::VerifyAndClearExpectations(metricsManager.get());
+
+    // The first valid event of a batch does them.
+    EXPECT_CALL(*metricsManager, byteSize()).WillRepeatedly(Return(0));
+    EXPECT_CALL(*metricsManager, onLogEvent).Times(1);
+    events.push_back(CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/2));
+    processor->OnLogEvents(events, /*elapsedRealtimeNs=*/11);
+    EXPECT_NE(0, processor->mNextHousekeepingNs.load());
+}
+
+TEST(StatsLogProcessorTest, TestLogSourceVerdict) {
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(
+            /*timeBaseNs=*/1, /*currentTimeNs=*/1, StatsdConfig(), ConfigKey(1, 12345));
+    StatsdConfig shellConfig;
+    shellConfig.add_allowed_log_source("AID_SHELL");
+    sp<MockMetricsManager> shellManager = new MockMetricsManager(ConfigKey(1, 1), shellConfig);
+    sp<MockMetricsManager> otherManager = new MockMetricsManager(ConfigKey(1, 2));
+    processor->mMetricsManagers.clear();
+    processor->mMetricsManagers[ConfigKey(1, 1)] = shellManager;
+    processor->mMetricsManagers[ConfigKey(1, 2)] = otherManager;
+    processor->updateLogEventFilterLocked();
+    processor->refreshLogSourceConfigMasksLocked();
+    EXPECT_NE(MetricsManager::kNoLogSourceSlot, shellManager->getLogSourceSlot());
+    EXPECT_NE(MetricsManager::kNoLogSourceSlot, otherManager->getLogSourceSlot());
+
+    // The shell is only allowed by the first config, the system services are allowed by all.
+    EXPECT_CALL(*shellManager, onLogEvent(_, true)).Times(2);
+    EXPECT_CALL(*otherManager, onLogEvent(_, false)).Times(1);
+    EXPECT_CALL(*otherManager, onLogEvent(_, true)).Times(1);
+    EXPECT_CALL(*shellManager, byteSize()).WillRepeatedly(Return(0));
+    EXPECT_CALL(*otherManager, byteSize()).WillRepeatedly(Return(0));
+
+    LogEvent shellEvent(AID_SHELL, /*pid=*/0);
+    CreateNoValuesLogEvent(&shellEvent, /*atomId=*/123, /*eventTimeNs=*/1);
+    processor->OnLogEvent(&shellEvent, /*elapsedRealtimeNs=*/10);
+
+    LogEvent systemEvent(AID_SYSTEM, /*pid=*/0);
+    CreateNoValuesLogEvent(&systemEvent, /*atomId=*/123, /*eventTimeNs=*/2);
+    processor->OnLogEvent(&systemEvent, /*elapsedRealtimeNs=*/11);
+}
+
+TEST(StatsLogProcessorTest, TestEventsRoutedToConfigsUsingAtom) {
+    const int uid = 1111;
+    StatsdConfig config1;
+    config1.set_id(1);
+    const AtomMatcher wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config1.add_atom_matcher() = wakelockAcquireMatcher;
+    const int64_t metricId = 1001;
+    CountMetric* countMetric = config1.add_count_metric();
+    countMetric->set_id(metricId);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+    MetricActivation* activation = config1.add_metric_activation();
+    activation->set_metric_id(metricId);
+    activation->set_activation_type(ACTIVATE_IMMEDIATELY);
+    EventActivation* trigger = activation->add_event_activation();
+    trigger->set_atom_matcher_id(wakelockAcquireMatcher.id());
+    trigger->set_ttl_seconds(100);
+
+    StatsdConfig config2;
+    config2.set_id(2);
+    *config2.add_atom_matcher() = CreateBatterySaverModeStartAtomMatcher();
+
+    const ConfigKey key1(uid, 1);
+    const ConfigKey key2(uid, 2);
+    const int64_t timeBaseNs = 1;
+    sp<StatsLogProcessor> processor =
+            CreateStatsLogProcessor(timeBaseNs, timeBaseNs, config1, key1);
+    processor->OnConfigUpdated(timeBaseNs, key2, config2);
+    ASSERT_EQ(2, processor->mMetricsManagers.size());
+    const sp<MetricsManager> metricsManager1 = processor->mMetricsManagers[key1];
+
+    ASSERT_EQ(1, processor->mAtomConfigRoutes.count(util::WAKELOCK_STATE_CHANGED));
+    ASSERT_EQ(1, processor->mAtomConfigRoutes[util::WAKELOCK_STATE_CHANGED].size());
+    EXPECT_EQ(key1, processor->mAtomConfigRoutes[util::WAKELOCK_STATE_CHANGED][0].key);
+    ASSERT_EQ(1, processor->mAtomConfigRoutes.count(util::BATTERY_SAVER_MODE_STATE_CHANGED));
+    ASSERT_EQ(1, processor->mAtomConfigRoutes[util::BATTERY_SAVER_MODE_STATE_CHANGED].size());
+    EXPECT_EQ(key2, processor->mAtomConfigRoutes[util::BATTERY_SAVER_MODE_STATE_CHANGED][0].key);
+
+    EXPECT_FALSE(metricsManager1->isActive());
+    std::unique_ptr<LogEvent> event = CreateAcquireWakelockEvent(
+            timeBaseNs + 10 * NS_PER_SEC, {uid}, {"App1"}, "wl1");
+    processor->OnLogEvent(event.get());
+    EXPECT_TRUE(metricsManager1->isActive());
+    EXPECT_EQ(timeBaseNs + 110 * NS_PER_SEC, processor->mNextActivationExpiryNs);
+
+    // The activation lapses on an event the config does not use.
+    event = CreateBatterySaverOnEvent(timeBaseNs + 200 * NS_PER_SEC);
+    processor->OnLogEvent(event.get());
+    EXPECT_FALSE(metricsManager1->isActive());
+    EXPECT_EQ(INT64_MAX, processor->mNextActivationExpiryNs);
+
+    processor->OnConfigRemoved(key1);
+    EXPECT_EQ(0, processor->mAtomConfigRoutes.count(util::WAKELOCK_STATE_CHANGED));
+}
+
+TEST(StatsLogProcessorTest, TestOnLogEventsParallel) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessorOptions options;
+    options.numEventProcessingThreads = 3;
+    StatsLogProcessor processor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>(), options);
+    ASSERT_NE(nullptr, processor.mEventWorkerPool);
+
+    const int numConfigs = 8;
+    const int numEvents = 20;
+    // Each config is only processed by the thread owning its shard.
+    vector<vector<int64_t>> receivedTimestamps(numConfigs);
+    for (int i = 0; i < numConfigs; i++) {
+        const ConfigKey key(1, i);
+        sp<MockMetricsManager> metricsManager = new MockMetricsManager(key);
+        EXPECT_CALL(*metricsManager, onLogEvent)
+                .Times(numEvents)
+                .WillRepeatedly(Invoke([&receivedTimestamps, i](const LogEvent& event, bool) {
+                    receivedTimestamps[i].push_back(event.GetElapsedTimestampNs());
+                }));
+        EXPECT_CALL(*metricsManager, byteSize()).WillRepeatedly(Return(0));
+        processor.mMetricsManagers[key] = metricsManager;
+    }
+    processor.updateLogEventFilterLocked();
+
+    vector<std::unique_ptr<LogEvent>> events;
+    vector<int64_t> expectedTimestamps;
+    for (int i = 0; i < numEvents; i++) {
+        events.push_back(CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/i + 1));
+        expectedTimestamps.push_back(i + 1);
+    }
+    processor.OnLogEvents(events, /*elapsedRealtimeNs=*/10);
+
+    // Every config received every event, in order.
+    for (int i = 0; i < numConfigs; i++) {
+        EXPECT_EQ(expectedTimestamps, receivedTimestamps[i]);
+    }
+}
+
+TEST(StatsLogProcessorTest, TestOnLogEventsConfigMajor) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessorOptions options;
+    options.configMajorBatches = true;
+    StatsLogProcessor processor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>(), options);
+
+    const int numConfigs = 3;
+    // The config and the timestamp of each event passed to a config, in call order.
+    vector<std::pair<int, int64_t>> calls;
+    for (int i = 0; i < numConfigs; i++) {
+        const ConfigKey key(1, i);
+        sp<MockMetricsManager> metricsManager = new MockMetricsManager(key);
+        EXPECT_CALL(*metricsManager, onLogEvent)
+                .WillRepeatedly(Invoke([&calls, i](const LogEvent& event, bool) {
+                    calls.push_back({i, event.GetElapsedTimestampNs()});
+                }));
+        EXPECT_CALL(*metricsManager, byteSize()).WillRepeatedly(Return(0));
+        processor.mMetricsManagers[key] = metricsManager;
+    }
+    processor.updateLogEventFilterLocked();
+
+    // The isolated uid change splits the batch in two runs.
+    vector<std::unique_ptr<LogEvent>> events;
+    events.push_back(CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/1));
+    events.push_back(CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/2));
+    events.push_back(CreateIsolatedUidChangedEvent(/*timestampNs=*/3, /*hostUid=*/1000,
+                                                   /*isolatedUid=*/99999, /*is_create=*/true));
+    events.push_back(CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/4));
+    events.push_back(CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/5));
+    processor.OnLogEvents(events, /*elapsedRealtimeNs=*/10);
+
+    // Each config processed a run before the next config started it.
+    vector<std::pair<int, int64_t>> expectedCalls;
+    for (const vector<int64_t>& run : {vector<int64_t>{1, 2}, vector<int64_t>{4, 5}}) {
+        for (const auto& [key, metricsManager] : processor.mMetricsManagers) {
+            for (const int64_t timestampNs : run) {
+                expectedCalls.push_back({(int)key.GetId(), timestampNs});
+            }
+        }
+    }
+    EXPECT_EQ(expectedCalls, calls);
+}
+
+TEST(StatsLogProcessorTest, TestWriteDataToDiskParallel) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessorOptions options;
+    options.numEventProcessingThreads = 3;
+    StatsLogProcessor processor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>(), options);
+    ASSERT_NE(nullptr, processor.mEventWorkerPool);
+
+    const int numConfigs = 8;
+    for (int i = 0; i < numConfigs; i++) {
+        processor.OnConfigUpdated(0, ConfigKey(1, i), MakeConfig(/*includeMetric=*/true));
+    }
+    // Configs without metrics to report are not written.
+    processor.OnConfigUpdated(0, ConfigKey(1, numConfigs), StatsdConfig());
+
+    processor.WriteDataToDisk(DEVICE_SHUTDOWN, FAST, /*elapsedRealtimeNs=*/100 * NS_PER_SEC,
+                              /*wallClockNs=*/0);
+
+    // Every config is reported, whichever thread wrote its report.
+    for (int i = 0; i < numConfigs; i++) {
+        const ConfigKey key(1, i);
+        EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+        EXPECT_EQ(1, processor.mOnDiskDataConfigs.count(key));
+    }
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(ConfigKey(1, numConfigs)));
+    EXPECT_EQ(0, processor.mOnDiskDataConfigs.count(ConfigKey(1, numConfigs)));
+    StorageManager::deleteAllFiles(STATS_DATA_DIR);
+}
+
+TEST(StatsLogProcessorTest, TestOffLockConfigBuild) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessorOptions options;
+    options.offLockConfigBuilds = true;
+    StatsLogProcessor processor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>(), options);
+
+    StatsdConfig config = MakeConfig(/*includeMetric=*/true);
+    State screenState = CreateScreenState();
+    *config.add_state() = screenState;
+    config.mutable_count_metric(0)->add_slice_by_state(screenState.id());
+
+    const ConfigKey key(3, 4);
+    processor.OnConfigUpdated(0, key, config);
+    ASSERT_EQ(1, processor.mMetricsManagers.count(key));
+    EXPECT_TRUE(processor.mMetricsManagers[key]->isConfigValid());
+    // The state sliced metric is registered when the MetricsManager is swapped in.
+    EXPECT_EQ(1, StateManager::getInstance().getListenersCount(util::SCREEN_STATE_CHANGED));
+    EXPECT_EQ(0, processor.mPendingConfigBuilds);
+    EXPECT_TRUE(processor.mConfigBuildEvents.empty());
+
+    processor.OnConfigRemoved(key);
+    EXPECT_EQ(0, processor.mMetricsManagers.count(key));
+    EXPECT_FALSE(StateManager::getInstance().hasStateTracker(util::SCREEN_STATE_CHANGED));
+}
+
+TEST(StatsLogProcessorTest, TestConfigBatch) {
+    for (const bool offLockConfigBuilds : {false, true}) {
+        sp<UidMap> uidMap = new UidMap();
+        sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+        sp<AlarmMonitor> anomalyAlarmMonitor;
+        sp<AlarmMonitor> periodicAlarmMonitor;
+        std::shared_ptr<LogEventFilter> logEventFilter = std::make_shared<LogEventFilter>();
+        StatsLogProcessorOptions options;
+        options.offLockConfigBuilds = offLockConfigBuilds;
+        StatsLogProcessor processor(
+                uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+                [](const ConfigKey&) { return true; },
+                [](const int&, const vector<int64_t>&) { return true; },
+                [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+                logEventFilter, options);
+
+        // More configs than build threads, and an invalid one.
+        const int numConfigs = StatsLogProcessor::kConfigBatchBuildThreads + 2;
+        vector<std::pair<ConfigKey, StatsdConfig>> configs;
+        for (int i = 0; i < numConfigs; i++) {
+            configs.emplace_back(ConfigKey(1, i), MakeConfig(/*includeMetric=*/true));
+        }
+        StatsdConfig invalidConfig = MakeConfig(/*includeMetric=*/true);
+        invalidConfig.mutable_count_metric(0)->set_what(StringToId("UnknownMatcher"));
+        configs.emplace_back(ConfigKey(1, numConfigs), invalidConfig);
+
+        processor.OnConfigsUpdated(/*timestampNs=*/0, configs);
+
+        ASSERT_EQ(numConfigs, processor.mMetricsManagers.size()) << offLockConfigBuilds;
+        for (int i = 0; i < numConfigs; i++) {
+            ASSERT_EQ(1, processor.mMetricsManagers.count(ConfigKey(1, i)));
+            EXPECT_TRUE(processor.mMetricsManagers[ConfigKey(1, i)]->isConfigValid());
+        }
+        EXPECT_EQ(numConfigs,
+                  processor.mAtomConfigRoutes[util::PROCESS_LIFE_CYCLE_STATE_CHANGED].size());
+        EXPECT_EQ(0, processor.mPendingConfigBuilds);
+        EXPECT_TRUE(processor.mConfigBuildEvents.empty());
+    }
+}
+
+TEST(StatsLogProcessorTest, TestConfigBuildEventsReplayed) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessorOptions options;
+    options.offLockConfigBuilds = true;
+    StatsLogProcessor processor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>(), options);
+
+    // Events are kept while a config is built.
+    const int numEvents = 5;
+    processor.mPendingConfigBuilds = 1;
+    for (int i = 0; i < numEvents; i++) {
+        std::unique_ptr<LogEvent> event =
+                CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/i + 1);
+        processor.OnLogEvent(event.get());
+    }
+    ASSERT_EQ(numEvents, processor.mConfigBuildEvents.size());
+
+    // Only the events from the index recorded when the build started are replayed.
+    const ConfigKey key(1, 2);
+    vector<int64_t> receivedTimestamps;
+    sp<MockMetricsManager> metricsManager = new MockMetricsManager(key);
+    EXPECT_CALL(*metricsManager, onLogEvent)
+            .Times(numEvents - 2)
+            .WillRepeatedly(Invoke([&receivedTimestamps](const LogEvent& event, bool) {
+                receivedTimestamps.push_back(event.GetElapsedTimestampNs());
+            }));
+    EXPECT_CALL(*metricsManager, byteSize()).WillRepeatedly(Return(0));
+    processor.mMetricsManagers[key] = metricsManager;
+    processor.replayConfigBuildEventsLocked(key, /*firstEventIndex=*/2);
+    EXPECT_EQ(vector<int64_t>({3, 4, 5}), receivedTimestamps);
+}
+
+TEST(StatsLogProcessorTest, TestPerConfigDump) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessorOptions options;
+    options.perConfigDumps = true;
+    StatsLogProcessor processor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>(), options);
+
+    const ConfigKey dumpedKey(1, 2);
+    const ConfigKey otherKey(1, 3);
+    vector<int64_t> dumpedTimestamps;
+    vector<int64_t> otherTimestamps;
+    sp<MockMetricsManager> dumpedMetricsManager = new MockMetricsManager(dumpedKey);
+    sp<MockMetricsManager> otherMetricsManager = new MockMetricsManager(otherKey);
+    EXPECT_CALL(*dumpedMetricsManager, onLogEvent)
+            .WillRepeatedly(Invoke([&dumpedTimestamps](const LogEvent& event, bool) {
+                dumpedTimestamps.push_back(event.GetElapsedTimestampNs());
+            }));
+    EXPECT_CALL(*otherMetricsManager, onLogEvent)
+            .WillRepeatedly(Invoke([&otherTimestamps](const LogEvent& event, bool) {
+                otherTimestamps.push_back(event.GetElapsedTimestampNs());
+            }));
+    EXPECT_CALL(*dumpedMetricsManager, byteSize()).WillRepeatedly(Return(0));
+    EXPECT_CALL(*otherMetricsManager, byteSize()).WillRepeatedly(Return(0));
+    processor.mMetricsManagers[dumpedKey] = dumpedMetricsManager;
+    processor.mMetricsManagers[otherKey] = otherMetricsManager;
+    processor.updateLogEventFilterLocked();
+
+    // The dump holds mConfigDumpMutex, but not mMetricsMutex.
+    processor.mConfigDumpMutex.lock();
+    {
+        std::lock_guard<std::mutex> lock(processor.mMetricsMutex);
+        ASSERT_TRUE(processor.beginConfigDumpLocked(dumpedKey));
+    }
+    const int numEvents = 3;
+    for (int i = 0; i < numEvents; i++) {
+        std::unique_ptr<LogEvent> event =
+                CreateNonRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/i + 1);
+        processor.OnLogEvent(event.get());
+    }
+    // Only the config being dumped waits.
+    EXPECT_EQ(vector<int64_t>({1, 2, 3}), otherTimestamps);
+    EXPECT_TRUE(dumpedTimestamps.empty());
+    EXPECT_EQ(numEvents, processor.mConfigDumpEvents.size());
+
+    processor.mConfigDumpMutex.unlock();
+    {
+        std::lock_guard<std::mutex> lock(processor.mMetricsMutex);
+        processor.endConfigDumpLocked(/*dumpTimeNs=*/4, /*wallClockNs=*/4);
+    }
+    EXPECT_EQ(vector<int64_t>({1, 2, 3}), dumpedTimestamps);
+    EXPECT_TRUE(processor.mConfigDumpEvents.empty());
+    EXPECT_TRUE(processor.mConfigBeingDumped == nullptr);
+}
+
+TEST(StatsLogProcessorTest, TestAsyncConfigTeardown) {
+    sp<UidMap> uidMap = new UidMap();
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    sp<AlarmMonitor> anomalyAlarmMonitor;
+    sp<AlarmMonitor> periodicAlarmMonitor;
+    StatsLogProcessorOptions options;
+    options.asyncConfigTeardown = true;
+    StatsLogProcessor processor(
+            uidMap, pullerManager, anomalyAlarmMonitor, periodicAlarmMonitor, 0,
+            [](const ConfigKey&) { return true; },
+            [](const int&, const vector<int64_t>&) { return true; },
+            [](const ConfigKey&, const string&, const vector<int64_t>&) {},
+            std::make_shared<LogEventFilter>(), options);
+    ASSERT_NE(nullptr, processor.mMetricsManagerReaper);
+
+    StatsdConfig config = MakeConfig(/*includeMetric=*/true);
+    State screenState = CreateScreenState();
+    *config.add_state() = screenState;
+    config.mutable_count_metric(0)->add_slice_by_state(screenState.id());
+
+    // A full update replaces the MetricsManager, and the old one is dropped by the reaper.
+    const ConfigKey key(3, 4);
+    processor.OnConfigUpdated(0, key, config);
+    ASSERT_EQ(1, processor.mMetricsManagers.count(key));
+    wp<MetricsManager> oldMetricsManager = processor.mMetricsManagers[key];
+    processor.OnConfigUpdated(1, key, config, /*modularUpdate=*/false);
+    processor.mMetricsManagerReaper->waitForIdle();
+    EXPECT_EQ(nullptr, oldMetricsManager.promote());
+    ASSERT_EQ(1, processor.mMetricsManagers.count(key));
+    EXPECT_EQ(1, StateManager::getInstance().getListenersCount(util::SCREEN_STATE_CHANGED));
+
+    wp<MetricsManager> removedMetricsManager = processor.mMetricsManagers[key];
+    processor.OnConfigRemoved(key);
+    processor.mMetricsManagerReaper->waitForIdle();
+    EXPECT_EQ(nullptr, removedMetricsManager.promote());
+    EXPECT_EQ(0, processor.mMetricsManagers.count(key));
+    EXPECT_FALSE(StateManager::getInstance().hasStateTracker(util::SCREEN_STATE_CHANGED));
+}
+
 TEST(StatsLogProcessorTest, TestUidMapHasSnapshot) {
     ConfigKey key(3, 4);
     StatsdConfig config = MakeConfig(true);
@@ -394,6 +888,88 @@ TEST(StatsLogProcessorTest, TestOnDumpReportEraseData) {
     EXPECT_TRUE(noData);
 }
 
+TEST(StatsLogProcessorTest, TestHousekeepingDeadline) {
+    StatsdConfig config;
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+
+    ConfigKey cfgKey;
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(1, 1, config, cfgKey);
+    const int64_t eventTimeNs = 100 * NS_PER_SEC;
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(eventTimeNs, {111}, {"App1"}, "wl1");
+    processor->OnLogEvent(event.get(), eventTimeNs);
+
+    // The next periodic check is the puller cache clearing.
+    const int64_t nextHousekeepingNs = processor->mNextHousekeepingNs.load();
+    EXPECT_GT(nextHousekeepingNs, eventTimeNs);
+    EXPECT_LE(nextHousekeepingNs,
+              eventTimeNs + (StatsdStats::kPullerCacheClearIntervalSec + 1) * NS_PER_SEC);
+    EXPECT_GT(processor->mNextByteSizeCheckNs, eventTimeNs);
+    EXPECT_EQ(INT64_MAX, processor->mNextConfigTtlExpiryNs);
+
+    // A batch before the deadline leaves it alone.
+    event = CreateAcquireWakelockEvent(eventTimeNs + 1, {111}, {"App1"}, "wl1");
+    processor->OnLogEvent(event.get(), eventTimeNs + 1);
+    EXPECT_EQ(nextHousekeepingNs, processor->mNextHousekeepingNs.load());
+
+    // An anomaly alarm moves the deadline earlier.
+    processor->setAnomalyAlarm(NanoToMillis(eventTimeNs) + 10);
+    EXPECT_EQ(MillisToNano(NanoToMillis(eventTimeNs) + 10), processor->mNextHousekeepingNs.load());
+
+    // A config update checks the ttl and the byte size with the next batch.
+    processor->OnConfigUpdated(eventTimeNs + 2, cfgKey, config);
+    EXPECT_EQ(0, processor->mNextConfigTtlExpiryNs);
+    EXPECT_EQ(0, processor->mNextByteSizeCheckNs);
+}
+
+TEST(StatsLogProcessorTest, TestConfigSummariesReadWithoutLock) {
+    StatsdConfig config;
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+
+    ConfigKey cfgKey;
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(1, 1, config, cfgKey);
+    std::unique_ptr<LogEvent> event = CreateAcquireWakelockEvent(2 /*timestamp*/, {111}, {"App1"},
+                                                                 "wl1");
+    processor->OnLogEvent(event.get());
+    vector<uint8_t> bytes;
+    processor->onDumpReport(cfgKey, 3, true, true /* DO erase data. */, ADB_DUMP, FAST, &bytes);
+
+    const sp<MetricsManager> metricsManager = processor->mMetricsManagers[cfgKey];
+    {
+        // The read APIs would deadlock if they took mMetricsMutex.
+        std::lock_guard<std::mutex> lock(processor->mMetricsMutex);
+        // Lift the rate limit so the size is checked again.
+        processor->mLastByteSizeTimes.clear();
+        processor->flushIfNecessaryLocked(cfgKey, *metricsManager);
+        const size_t byteSize = metricsManager->byteSize();
+
+        vector<int64_t> activeConfigs;
+        processor->GetActiveConfigs(cfgKey.GetUid(), activeConfigs);
+        EXPECT_THAT(activeConfigs, ElementsAre(cfgKey.GetId()));
+        EXPECT_EQ(3, processor->getLastReportTimeNs(cfgKey));
+        EXPECT_EQ(byteSize, processor->GetMetricsSize(cfgKey));
+    }
+
+    processor->OnConfigRemoved(cfgKey);
+    vector<int64_t> activeConfigs;
+    processor->GetActiveConfigs(cfgKey.GetUid(), activeConfigs);
+    EXPECT_TRUE(activeConfigs.empty());
+    EXPECT_EQ(0, processor->getLastReportTimeNs(cfgKey));
+    EXPECT_EQ(0u, processor->GetMetricsSize(cfgKey));
+}
+
 TEST(StatsLogProcessorTest, TestPullUidProviderSetOnConfigUpdate) {
     // Setup simple config key corresponding to empty config.
     ConfigKey key(3, 4);
@@ -1982,9 +2558,9 @@ TEST(StatsLogProcessorTest_mapIsolatedUidToHostUid, LogHostUidAttributionChain)
     const vector<FieldValue>* actualFieldValues = &logEvent->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(200, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(field1, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(field2, actualFieldValues->at(5).mValue.int_value);
 }
@@ -2010,9 +2586,9 @@ TEST(StatsLogProcessorTest_mapIsolatedUidToHostUid, LogIsolatedUidAttributionCha
     const vector<FieldValue>* actualFieldValues = &logEvent->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(200, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(field1, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(field2, actualFieldValues->at(5).mValue.int_value);
 }
@@ -2097,6 +2673,57 @@ TEST(StatsLogProcessorTest_mapIsolatedUidToHostUid, LogRepeatedUidField) {
     EXPECT_EQ(hostUid1, actualFieldValues->at(3).mValue.int_value);
 }
 
+TEST(StatsLogProcessorTest, TestOnDumpReportParts) {
+    StatsdConfig config;
+    auto wakelockAcquireMatcher = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = wakelockAcquireMatcher;
+
+    auto countMetric = config.add_count_metric();
+    countMetric->set_id(123456);
+    countMetric->set_what(wakelockAcquireMatcher.id());
+    countMetric->set_bucket(FIVE_MINUTES);
+
+    ConfigKey cfgKey(3, 5);
+    sp<StatsLogProcessor> processor = CreateStatsLogProcessor(1, 1, config, cfgKey);
+
+    std::vector<int> attributionUids = {111};
+    std::vector<string> attributionTags = {"App1"};
+    std::unique_ptr<LogEvent> event =
+            CreateAcquireWakelockEvent(2 /*timestamp*/, attributionUids, attributionTags, "wl1");
+    processor->OnLogEvent(event.get());
+
+    // A report saved before the dump, which is mapped rather than read.
+    ConfigMetricsReport diskReport;
+    diskReport.set_current_report_elapsed_nanos(1);
+    string diskReportBytes = diskReport.SerializeAsString();
+    ASSERT_TRUE(StorageManager::appendReportToSegment(cfgKey, diskReportBytes.data(),
+                                                      diskReportBytes.size()));
+
+    ConfigMetricsReportListParts parts;
+    processor->onDumpReport(cfgKey, 3, 4, true, false /* Do NOT erase data. */, ADB_DUMP, FAST,
+                            &parts);
+    TemporaryFile file;
+    ASSERT_TRUE(parts.writeToFd(file.fd));
+    string partsBytes;
+    ASSERT_TRUE(android::base::ReadFileToString(file.path, &partsBytes));
+    EXPECT_EQ(parts.size(), partsBytes.size());
+
+    // The pieces serialize to exactly the report list that is otherwise assembled in memory.
+    vector<uint8_t> bytes;
+    processor->onDumpReport(cfgKey, 3, 4, true, false /* Do NOT erase data. */, ADB_DUMP, FAST,
+                            &bytes);
+    EXPECT_EQ(string(bytes.begin(), bytes.end()), partsBytes);
+    ProtoOutputStream proto;
+    StorageManager::appendConfigMetricsReport(cfgKey, &proto, /*erase data=*/true, /*isAdb=*/true);
+
+    ConfigMetricsReportList output;
+    ASSERT_TRUE(output.ParseFromString(partsBytes));
+    ASSERT_EQ(output.reports_size(), 2);
+    EXPECT_EQ(output.reports(0).current_report_elapsed_nanos(), 1);
+    ASSERT_EQ(output.reports(1).metrics_size(), 1);
+    EXPECT_EQ(output.reports(1).metrics(0).count_metrics().data_size(), 1);
+}
+
 TEST(StatsLogProcessorTest, TestDumpReportWithoutErasingDataDoesNotUpdateTimestamp) {
     int hostUid = 20;
     int isolatedUid = 30;
@@ -2228,6 +2855,7 @@ TEST_F(StatsLogProcessorTestRestricted, TestRestrictedLogEventNotPassed) {
     EXPECT_CALL(*metricsManager, onLogEvent).Times(0);
 
     processor->mMetricsManagers[mConfigKey] = metricsManager;
+    processor->updateLogEventFilterLocked();
     EXPECT_FALSE(processor->mMetricsManagers[mConfigKey]->hasRestrictedMetricsDelegate());
 
     unique_ptr<LogEvent> event = CreateRestrictedLogEvent(123);
@@ -2243,6 +2871,7 @@ TEST_F(StatsLogProcessorTestRestricted, TestRestrictedLogEventPassed) {
     EXPECT_CALL(*metricsManager, onLogEvent).Times(1);
 
     processor->mMetricsManagers[mConfigKey] = metricsManager;
+    processor->updateLogEventFilterLocked();
     EXPECT_TRUE(processor->mMetricsManagers[mConfigKey]->hasRestrictedMetricsDelegate());
 
     unique_ptr<LogEvent> event = CreateRestrictedLogEvent(123);
@@ -0,0 +1,215 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "socket/StatsRingListener.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+
+namespace {
+
+constexpr uint32_t kTestUid = 1000;
+constexpr uint32_t kTestPid = 1002;
+constexpr int kAtomId = 1000;
+constexpr uint32_t kCapacity = StatsRingListener::kMinRingCapacity;
+
+// Producer side of a ring, as written by libstatssocket.
+class TestRing {
+public:
+    explicit TestRing(uint32_t capacity = kCapacity, int seals = F_SEAL_SHRINK | F_SEAL_GROW)
+        : mCapacity(capacity), mMappedSize(kStatsRingHeaderSize + capacity) {
+        memFd.reset(memfd_create("test_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+        eventFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+        EXPECT_EQ(0, ftruncate(memFd.get(), mMappedSize));
+        EXPECT_EQ(0, fcntl(memFd.get(), F_ADD_SEALS, seals));
+        void* mapped =
+                mmap(nullptr, mMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd.get(), 0);
+        EXPECT_NE(MAP_FAILED, mapped);
+        header = static_cast<StatsRingHeader*>(mapped);
+        header->magic = kStatsRingMagic;
+        header->version = kStatsRingVersion;
+        header->capacity = capacity;
+    }
+
+    ~TestRing() {
+        munmap(header, mMappedSize);
+    }
+
+    bool write(int atomId) {
+        AStatsEvent* statsEvent = AStatsEvent_obtain();
+        createStatsEvent(statsEvent, INT64_TYPE, atomId);
+        AStatsEvent_build(statsEvent);
+        size_t size;
+        const uint8_t* buf = AStatsEvent_getBuffer(statsEvent, &size);
+        const bool written = writeRecord(buf, size);
+        AStatsEvent_release(statsEvent);
+        return written;
+    }
+
+    bool writeRecord(const uint8_t* buf, uint32_t size) {
+        uint8_t* data = reinterpret_cast<uint8_t*>(header) + kStatsRingHeaderSize;
+        const uint64_t recordSize = (sizeof(size) + size + 3) & ~uint64_t(3);
+        uint64_t writePos = header->writePos.load();
+        const uint64_t contiguous = mCapacity - (writePos & (mCapacity - 1));
+        const uint64_t needed = recordSize > contiguous ? contiguous + recordSize : recordSize;
+        if (writePos - header->readPos.load() + needed > mCapacity) {
+            return false;
+        }
+        if (recordSize > contiguous) {
+            memcpy(data + (writePos & (mCapacity - 1)), &kStatsRingWrapMarker,
+                   sizeof(kStatsRingWrapMarker));
+            writePos += contiguous;
+        }
+        memcpy(data + (writePos & (mCapacity - 1)), &size, sizeof(size));
+        memcpy(data + (writePos & (mCapacity - 1)) + sizeof(size), buf, size);
+        header->writePos.store(writePos + recordSize);
+        return true;
+    }
+
+    unique_fd memFd;
+    unique_fd eventFd;
+    StatsRingHeader* header = nullptr;
+
+private:
+    const uint32_t mCapacity;
+    const size_t mMappedSize;
+};
+
+void expectAtoms(const std::shared_ptr<LogEventQueue>& queue, int firstAtomId, int count) {
+    for (int i = 0; i < count; i++) {
+        std::unique_ptr<LogEvent> logEvent = queue->waitPop();
+        EXPECT_TRUE(logEvent->isValid());
+        EXPECT_EQ(firstAtomId + i, logEvent->GetTagId());
+        EXPECT_EQ((int32_t)kTestUid, logEvent->GetUid());
+        EXPECT_EQ((int32_t)kTestPid, logEvent->GetPid());
+    }
+}
+
+}  // namespace
+
+class StatsRingListenerTest : public testing::Test {
+protected:
+    std::shared_ptr<LogEventQueue> mEventQueue = std::make_shared<LogEventQueue>(1000);
+    sp<StatsRingListener> mListener =
+            new StatsRingListener(mEventQueue, std::make_shared<LogEventFilter>());
+
+    static std::unique_ptr<StatsRingListener::Ring> mapRing(const TestRing& testRing) {
+        return StatsRingListener::mapRing(unique_fd(dup(testRing.memFd.get())),
+                                          unique_fd(dup(testRing.eventFd.get())), kTestUid,
+                                          kTestPid);
+    }
+};
+
+TEST_F(StatsRingListenerTest, TestDrainRing) {
+    TestRing testRing;
+    auto ring = mapRing(testRing);
+    ASSERT_NE(nullptr, ring);
+    EXPECT_EQ(kStatsRingConsumerAttached, testRing.header->consumerState.load());
+
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(testRing.write(kAtomId + i));
+    }
+    EXPECT_TRUE(mListener->drainRing(ring.get()));
+
+    expectAtoms(mEventQueue, kAtomId, 10);
+    EXPECT_EQ(testRing.header->writePos.load(), testRing.header->readPos.load());
+    // The producer signals the next write.
+    EXPECT_EQ(kStatsRingConsumerWaiting, testRing.header->consumerState.load());
+}
+
+TEST_F(StatsRingListenerTest, TestDrainRingWrapAround) {
+    TestRing testRing;
+    auto ring = mapRing(testRing);
+    ASSERT_NE(nullptr, ring);
+
+    // Fill the ring a few times over, so records wrap around its end.
+    int atomId = kAtomId;
+    for (int round = 0; round < 5; round++) {
+        const int firstAtomId = atomId;
+        while (testRing.write(atomId)) {
+            atomId++;
+        }
+        ASSERT_GT(atomId, firstAtomId);
+        EXPECT_TRUE(mListener->drainRing(ring.get()));
+        expectAtoms(mEventQueue, firstAtomId, atomId - firstAtomId);
+    }
+    EXPECT_GT(testRing.header->readPos.load(), 5 * (uint64_t)kCapacity / 2);
+    EXPECT_EQ(testRing.header->writePos.load(), testRing.header->readPos.load());
+}
+
+TEST_F(StatsRingListenerTest, TestCorruptedRing) {
+    {
+        TestRing testRing;
+        auto ring = mapRing(testRing);
+        ASSERT_NE(nullptr, ring);
+        // Write position past the capacity.
+        testRing.header->writePos.store(2 * kCapacity);
+        EXPECT_FALSE(mListener->drainRing(ring.get()));
+    }
+    {
+        TestRing testRing;
+        auto ring = mapRing(testRing);
+        ASSERT_NE(nullptr, ring);
+        ASSERT_TRUE(testRing.write(kAtomId));
+        // Record larger than what was written.
+        const uint8_t atom[8] = {};
+        ASSERT_TRUE(testRing.writeRecord(atom, sizeof(atom)));
+        uint8_t* data = reinterpret_cast<uint8_t*>(testRing.header) + kStatsRingHeaderSize;
+        const uint32_t size = kCapacity;
+        memcpy(data + testRing.header->writePos.load() - 12, &size, sizeof(size));
+
+        EXPECT_FALSE(mListener->drainRing(ring.get()));
+        // The atom before the corrupted record is kept.
+        expectAtoms(mEventQueue, kAtomId, 1);
+    }
+}
+
+TEST_F(StatsRingListenerTest, TestInvalidRingRejected) {
+    {
+        // Not sealed against shrinking.
+        TestRing testRing(kCapacity, F_SEAL_GROW);
+        EXPECT_EQ(nullptr, mapRing(testRing));
+    }
+    {
+        // Capacity is not a power of 2.
+        TestRing testRing(kCapacity + 4);
+        EXPECT_EQ(nullptr, mapRing(testRing));
+    }
+    {
+        TestRing testRing;
+        testRing.header->magic = 0;
+        EXPECT_EQ(nullptr, mapRing(testRing));
+        EXPECT_EQ(kStatsRingConsumerDetached, testRing.header->consumerState.load());
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
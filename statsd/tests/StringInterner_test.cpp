@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/packages/StringInterner.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(StringInternerTest, TestInternSharesStrings) {
+    StringInterner interner;
+
+    InternedString string1 = interner.intern("com.android.vending");
+    InternedString string2 = interner.intern(std::string("com.android.vending"));
+    InternedString string3 = interner.intern("com.google.android.gms");
+    EXPECT_EQ(2u, interner.size());
+
+    EXPECT_EQ("com.android.vending", *string1);
+    EXPECT_EQ(string1, string2);
+    EXPECT_NE(string1, string3);
+
+    EXPECT_EQ(string3, interner.find("com.google.android.gms"));
+    EXPECT_EQ(nullptr, interner.find("com.android.shell"));
+    EXPECT_EQ(2u, interner.size());
+}
+
+TEST(StringInternerTest, TestPrune) {
+    StringInterner interner;
+
+    InternedString string1 = interner.intern("v1");
+    interner.intern("v2");
+    EXPECT_EQ(2u, interner.size());
+
+    interner.prune();
+    EXPECT_EQ(1u, interner.size());
+    EXPECT_EQ(nullptr, interner.find("v2"));
+    EXPECT_EQ(string1, interner.intern("v1"));
+}
+
+TEST(StringInternerTest, TestPruneOnGrowth) {
+    StringInterner interner;
+
+    InternedString held = interner.intern("held");
+    for (int i = 0; i < 1000; i++) {
+        interner.intern(std::to_string(i));
+    }
+    // Strings that are not held are dropped as the interner grows.
+    EXPECT_LT(interner.size(), 300u);
+    EXPECT_EQ(held, interner.find("held"));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -15,6 +15,7 @@
 #include "packages/UidMap.h"
 
 #include <android/util/ProtoOutputStream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <gtest/gtest.h>
 #include <src/uid_data.pb.h>
 #include <stdio.h>
@@ -257,6 +258,26 @@ TEST(UidMapTest, TestRemoveApp) {
                 UnorderedPointwise(EqPackageInfo(), expectedPackageInfos));
 }
 
+TEST(UidMapTest, TestAppNamesSnapshot) {
+    UidMap m;
+    UidData uidData;
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 4, "v4", kApp2);
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 5, "v5", kApp1);
+    m.updateMap(1 /* timestamp */, uidData);
+
+    const auto before = m.getNormalizedAppNamesSnapshot();
+    EXPECT_THAT(before->getNames(1000), ElementsAre(kApp1, kApp2));
+    EXPECT_THAT(before->getNames(2000), IsEmpty());
+
+    m.updateApp(2, "NeW_aPP1_NAmE", 1000, 40, "v40", "", /* certificateHash */ {});
+    m.removeApp(3, kApp2, 1000);
+
+    // Snapshots already handed out are not modified.
+    EXPECT_THAT(before->getNames(1000), ElementsAre(kApp1, kApp2));
+    EXPECT_THAT(m.getNormalizedAppNamesSnapshot()->getNames(1000),
+                ElementsAre(kApp1, "new_app1_name"));
+}
+
 TEST(UidMapTest, TestUpdateApp) {
     const sp<UidMap> uidMap = new UidMap();
     const shared_ptr<StatsService> service = SharedRefBase::make<StatsService>(
@@ -400,6 +421,85 @@ TEST(UidMapTest, TestRemovedAppOverGuardrail) {
     ASSERT_EQ(maxDeletedApps, results.snapshots(0).package_info_size());
 }
 
+namespace {
+
+class RecordingPackageInfoListener : public PackageInfoListener {
+public:
+    void notifyAppUpgrade(const int64_t& eventTimeNs, const string& apk, const int uid,
+                          const int64_t version) override {
+        upgrades.push_back(apk);
+    }
+
+    void notifyAppRemoved(const int64_t& eventTimeNs, const string& apk, const int uid) override {
+        removals.push_back(apk);
+    }
+
+    void onUidMapReceived(const int64_t& eventTimeNs) override {
+        snapshots++;
+    }
+
+    vector<string> upgrades;
+    vector<string> removals;
+    int snapshots = 0;
+};
+
+bool updateMapIncrementally(UidMap* m, const int64_t timestamp, const string& serializedUidData) {
+    google::protobuf::io::ArrayInputStream input(serializedUidData.data(),
+                                                 serializedUidData.size());
+    return m->updateMapIncrementally(timestamp, &input);
+}
+
+}  // anonymous namespace
+
+TEST(UidMapTest, TestUpdateMapIncrementally) {
+    const sp<UidMap> m = new UidMap();
+    const sp<RecordingPackageInfoListener> listener = new RecordingPackageInfoListener();
+    m->setListener(listener);
+    ConfigKey config1(1, StringToId("config1"));
+    m->OnConfigUpdated(config1);
+
+    UidData uidData;
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 4, "v4", kApp1);
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 5, "v5", kApp2);
+    ASSERT_TRUE(updateMapIncrementally(m.get(), 1, uidData.SerializeAsString()));
+    EXPECT_TRUE(m->hasApp(1000, kApp1));
+    EXPECT_TRUE(m->hasApp(1000, kApp2));
+    EXPECT_EQ(1, listener->snapshots);
+    EXPECT_EQ(0u, m->getBytesUsed());
+
+    // The same snapshot leaves the map and the listener untouched.
+    ASSERT_TRUE(updateMapIncrementally(m.get(), 2, uidData.SerializeAsString()));
+    EXPECT_EQ(1, listener->snapshots);
+    EXPECT_EQ(0u, m->getBytesUsed());
+
+    // Upgrades kApp1 and removes kApp2.
+    uidData.clear_app_info();
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 6, "v6", kApp1);
+    ASSERT_TRUE(updateMapIncrementally(m.get(), 3, uidData.SerializeAsString()));
+    EXPECT_EQ(6, m->getAppVersion(1000, kApp1));
+    EXPECT_FALSE(m->hasApp(1000, kApp2));
+    EXPECT_THAT(listener->upgrades, ElementsAre(kApp1));
+    EXPECT_THAT(listener->removals, ElementsAre(kApp2));
+    EXPECT_EQ(2, listener->snapshots);
+    EXPECT_EQ(2 * kBytesChangeRecord, m->getBytesUsed());
+
+    ProtoOutputStream proto;
+    m->appendUidMap(/* timestamp */ 4, config1, /* includeVersionStrings */ true,
+                    /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
+                    /* str_set */ nullptr, &proto);
+    UidMapping results;
+    outputStreamToProto(&proto, &results);
+    ASSERT_EQ(2, results.changes_size());
+
+    // A truncated snapshot is rejected without changing the map.
+    uidData.clear_app_info();
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 7, "v7", kApp1);
+    string truncated = uidData.SerializeAsString();
+    truncated.pop_back();
+    EXPECT_FALSE(updateMapIncrementally(m.get(), 5, truncated));
+    EXPECT_EQ(6, m->getAppVersion(1000, kApp1));
+}
+
 TEST(UidMapTest, TestClearingOutput) {
     UidMap m;
 
@@ -467,6 +567,100 @@ TEST(UidMapTest, TestClearingOutput) {
     ASSERT_EQ(0U, m.mChanges.size());
 }
 
+TEST(UidMapTest, TestDeltaSnapshots) {
+    UidMap m;
+    ConfigKey config1(1, StringToId("config1"));
+    m.OnConfigUpdated(config1);
+
+    UidData uidData;
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 4, "v4", kApp1);
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 5, "v5", kApp2);
+    m.updateMap(1 /* timestamp */, uidData);
+
+    ProtoOutputStream proto;
+    m.appendUidMap(/* timestamp */ 2, config1, /* includeVersionStrings */ true,
+                   /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
+                   /* str_set */ nullptr, &proto, /* deltaSnapshot */ true);
+    UidMapping results;
+    outputStreamToProto(&proto, &results);
+    ASSERT_EQ(1, results.snapshots_size());
+    EXPECT_FALSE(results.has_base_snapshot_elapsed_timestamp_nanos());
+
+    // Only the change is written, on top of the snapshot from the previous report.
+    m.updateApp(3, kApp1, 1000, 40, "v40", "", /* certificateHash */ {});
+    proto.clear();
+    m.appendUidMap(/* timestamp */ 4, config1, /* includeVersionStrings */ true,
+                   /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
+                   /* str_set */ nullptr, &proto, /* deltaSnapshot */ true);
+    results.Clear();
+    outputStreamToProto(&proto, &results);
+    EXPECT_EQ(0, results.snapshots_size());
+    ASSERT_EQ(1, results.changes_size());
+    EXPECT_EQ(40, results.changes(0).new_version());
+    EXPECT_EQ(2, results.base_snapshot_elapsed_timestamp_nanos());
+
+    // A full map update is not in the change log, so a new snapshot is needed.
+    m.updateMap(5 /* timestamp */, uidData);
+    proto.clear();
+    m.appendUidMap(/* timestamp */ 6, config1, /* includeVersionStrings */ true,
+                   /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0,
+                   /* str_set */ nullptr, &proto, /* deltaSnapshot */ true);
+    results.Clear();
+    outputStreamToProto(&proto, &results);
+    EXPECT_EQ(1, results.snapshots_size());
+    EXPECT_FALSE(results.has_base_snapshot_elapsed_timestamp_nanos());
+
+    // The base snapshot expires after a day.
+    proto.clear();
+    m.appendUidMap(/* timestamp */ 6 + UidMap::kMaxDeltaSnapshotIntervalNs, config1,
+                   /* includeVersionStrings */ true, /* includeInstaller */ true,
+                   /* truncatedCertificateHashSize */ 0, /* str_set */ nullptr, &proto,
+                   /* deltaSnapshot */ true);
+    results.Clear();
+    outputStreamToProto(&proto, &results);
+    EXPECT_EQ(1, results.snapshots_size());
+}
+
+TEST(UidMapTest, TestSharedSnapshot) {
+    UidMap m;
+    ConfigKey config1(1, StringToId("config1"));
+    ConfigKey config2(1, StringToId("config2"));
+    m.OnConfigUpdated(config1);
+    m.OnConfigUpdated(config2);
+
+    UidData uidData;
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 4, "v4", kApp1);
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1000, /*version*/ 5, "v5", kApp2);
+    m.updateMap(1 /* timestamp */, uidData);
+
+    ProtoOutputStream proto1;
+    std::set<string> strSet1;
+    m.appendUidMap(/* timestamp */ 2, config1, /* includeVersionStrings */ true,
+                   /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0, &strSet1,
+                   &proto1);
+    ProtoOutputStream proto2;
+    std::set<string> strSet2;
+    m.appendUidMap(/* timestamp */ 2, config2, /* includeVersionStrings */ true,
+                   /* includeInstaller */ true, /* truncatedCertificateHashSize */ 0, &strSet2,
+                   &proto2);
+    EXPECT_EQ(1U, m.mSharedSnapshots.size());
+    EXPECT_EQ(strSet1, strSet2);
+
+    UidMapping results1;
+    outputStreamToProto(&proto1, &results1);
+    UidMapping results2;
+    outputStreamToProto(&proto2, &results2);
+    ASSERT_EQ(1, results1.snapshots_size());
+    ASSERT_EQ(1, results2.snapshots_size());
+    EXPECT_EQ(results1.snapshots(0).SerializeAsString(),
+              results2.snapshots(0).SerializeAsString());
+    EXPECT_EQ(results1.installer_hash_size(), results2.installer_hash_size());
+
+    // Changing the map drops the shared snapshot.
+    m.updateApp(3, kApp1, 1000, 40, "v40", "", /* certificateHash */ {});
+    EXPECT_EQ(0U, m.mSharedSnapshots.size());
+}
+
 TEST(UidMapTest, TestMemoryComputed) {
     UidMap m;
 
@@ -518,6 +712,28 @@ TEST(UidMapTest, TestMemoryGuardrail) {
     ASSERT_EQ(1U, m.mChanges.size());
 }
 
+TEST(UidMapTest, TestStringsInterned) {
+    UidMap m;
+    UidData uidData;
+    // The same packages, installed for two users.
+    for (const int32_t uid : {1000, 1101000}) {
+        *uidData.add_app_info() = createApplicationInfo(uid, /*version*/ 1, "v1", "com.app.a");
+        *uidData.add_app_info() = createApplicationInfo(uid, /*version*/ 1, "v1", "com.app.b");
+    }
+    m.updateMap(1 /* timestamp */, uidData);
+
+    // The package names, the version string, and the empty installer and certificate hash.
+    EXPECT_EQ(4u, m.mStringInterner.size());
+    EXPECT_TRUE(m.hasApp(1101000, "com.app.b"));
+    EXPECT_FALSE(m.hasApp(1000, "com.app.c"));
+    EXPECT_THAT(m.getAppUid("com.app.a"), UnorderedElementsAre(1000, 1101000));
+
+    m.removeApp(2, "com.app.a", 1000);
+    EXPECT_FALSE(m.hasApp(1000, "com.app.a"));
+    EXPECT_TRUE(m.hasApp(1101000, "com.app.a"));
+    EXPECT_EQ(1, m.getAppVersion(1101000, "com.app.a"));
+}
+
 class UidMapTestAppendUidMap : public Test {
 protected:
     const ConfigKey config1;
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/condition/ConditionQueryCache.h"
+
+#include <gtest/gtest.h>
+
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+Metric2Condition makeLink(int64_t conditionId, int32_t metricAtomId) {
+    Metric2Condition link;
+    link.conditionId = conditionId;
+    FieldMatcher fieldMatcher;
+    fieldMatcher.set_field(metricAtomId);
+    fieldMatcher.add_child()->set_field(1);
+    translateFieldMatcher(fieldMatcher, &link.metricFields);
+    fieldMatcher.set_field(metricAtomId + 1);
+    translateFieldMatcher(fieldMatcher, &link.conditionFields);
+    return link;
+}
+
+}  // namespace
+
+TEST(ConditionQueryCacheTest, TestFindForCurrentEvent) {
+    sp<ConditionQueryCache> cache = new ConditionQueryCache();
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    LogEvent otherEvent(/*uid=*/0, /*pid=*/0);
+
+    const std::vector<Metric2Condition> links = {makeLink(1, 10)};
+    const std::vector<Metric2Condition> sameLinks = {makeLink(1, 10)};
+    const std::vector<Metric2Condition> otherLinks = {makeLink(1, 20)};
+    ConditionKey conditionKey;
+    getUidProcessKey(1000, &conditionKey[1]);
+
+    // Nothing is cached outside of an event.
+    cache->add(event, 0, links, false, conditionKey, ConditionState::kTrue);
+    EXPECT_EQ(nullptr, cache->find(event, 0, links, false));
+
+    cache->setCurrentEvent(&event);
+    cache->add(event, 0, links, false, conditionKey, ConditionState::kTrue);
+    const ConditionQueryCache::Entry* entry = cache->find(event, 0, sameLinks, false);
+    ASSERT_NE(nullptr, entry);
+    EXPECT_EQ(ConditionState::kTrue, entry->conditionState);
+    EXPECT_EQ(conditionKey, entry->conditionKey);
+
+    EXPECT_EQ(nullptr, cache->find(event, 1, links, false));
+    EXPECT_EQ(nullptr, cache->find(event, 0, links, true));
+    EXPECT_EQ(nullptr, cache->find(event, 0, otherLinks, false));
+    EXPECT_EQ(nullptr, cache->find(otherEvent, 0, links, false));
+
+    // A new event drops the entries of the previous one.
+    cache->setCurrentEvent(&otherEvent);
+    EXPECT_EQ(nullptr, cache->find(otherEvent, 0, links, false));
+    cache->setCurrentEvent(nullptr);
+    EXPECT_EQ(nullptr, cache->find(event, 0, links, false));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
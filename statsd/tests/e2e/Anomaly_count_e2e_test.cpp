@@ -380,6 +380,71 @@ TEST(AnomalyCountDetectionE2eTest, TestCountMetric_load_refractory_from_disk) {
               mockElapsedTimeNs / NS_PER_SEC);
 }
 
+TEST(AnomalyCountDetectionE2eTest, TestCountMetric_load_refractory_from_appended_metadata) {
+    const int num_buckets = 1;
+    const int threshold = 0;
+    const int refractory_period_sec = 86400 * 365; // 1 year
+    auto config = CreateStatsdConfig(num_buckets, threshold, refractory_period_sec);
+
+    int64_t bucketStartTimeNs = 10000000000;
+
+    int configUid = 2000;
+    int64_t configId = 1000;
+    ConfigKey cfgKey(configUid, configId);
+    auto processor = CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey);
+    ASSERT_EQ(processor->mMetricsManagers.size(), 1u);
+    sp<AnomalyTracker> anomalyTracker =
+            processor->mMetricsManagers.begin()->second->mAllAnomalyTrackers[0];
+
+    std::vector<int> attributionUids1 = {111};
+    std::vector<string> attributionTags1 = {"App1"};
+    std::vector<int> attributionUids2 = {222};
+    std::vector<string> attributionTags2 = {"App2"};
+
+    FieldValue fieldValue1(Field(util::WAKELOCK_STATE_CHANGED, (int32_t)0x02010101),
+                           Value((int32_t)111));
+    MetricDimensionKey dimensionKey1(HashableDimensionKey({fieldValue1}), DEFAULT_DIMENSION_KEY);
+    FieldValue fieldValue2(Field(util::WAKELOCK_STATE_CHANGED, (int32_t)0x02010101),
+                           Value((int32_t)222));
+    MetricDimensionKey dimensionKey2(HashableDimensionKey({fieldValue2}), DEFAULT_DIMENSION_KEY);
+
+    auto event = CreateAcquireWakelockEvent(bucketStartTimeNs + 2, attributionUids1,
+                                            attributionTags1, "wl1");
+    processor->OnLogEvent(event.get());
+
+    int64_t mockWallClockNs = 1584991200 * NS_PER_SEC;
+    int64_t mockElapsedTimeNs = bucketStartTimeNs + 5000 * NS_PER_SEC;
+    processor->SaveMetadataToDisk(mockWallClockNs, mockElapsedTimeNs);
+    EXPECT_EQ(processor->mPersistedMetadata.appendedCount, 0u);
+
+    // Unchanged metadata is not written again.
+    processor->SaveMetadataToDisk(mockWallClockNs + 100 * NS_PER_SEC,
+                                  mockElapsedTimeNs + 100 * NS_PER_SEC);
+    EXPECT_EQ(processor->mPersistedMetadata.appendedCount, 0u);
+
+    event = CreateAcquireWakelockEvent(bucketStartTimeNs + 3, attributionUids2, attributionTags2,
+                                       "wl2");
+    processor->OnLogEvent(event.get());
+    processor->SaveMetadataToDisk(mockWallClockNs + 200 * NS_PER_SEC,
+                                  mockElapsedTimeNs + 200 * NS_PER_SEC);
+    EXPECT_EQ(processor->mPersistedMetadata.appendedCount, 1u);
+
+    auto processor2 = CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey);
+    int64_t mockElapsedTimeSinceBoot = 10 * NS_PER_SEC;
+    processor2->LoadMetadataFromDisk(mockWallClockNs, mockElapsedTimeSinceBoot);
+
+    sp<AnomalyTracker> anomalyTracker2 =
+            processor2->mMetricsManagers.begin()->second->mAllAnomalyTrackers[0];
+    EXPECT_EQ(anomalyTracker2->getRefractoryPeriodEndsSec(dimensionKey1) -
+                      mockElapsedTimeSinceBoot / NS_PER_SEC,
+              anomalyTracker->getRefractoryPeriodEndsSec(dimensionKey1) -
+                      mockElapsedTimeNs / NS_PER_SEC);
+    EXPECT_EQ(anomalyTracker2->getRefractoryPeriodEndsSec(dimensionKey2) -
+                      mockElapsedTimeSinceBoot / NS_PER_SEC,
+              anomalyTracker->getRefractoryPeriodEndsSec(dimensionKey2) -
+                      mockElapsedTimeNs / NS_PER_SEC);
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
@@ -17,6 +17,7 @@
 #include <vector>
 
 #include "src/StatsLogProcessor.h"
+#include "src/metrics/DurationMetricProducer.h"
 #include "src/state/StateTracker.h"
 #include "src/stats_log_util.h"
 #include "tests/statsd_test_util.h"
@@ -732,6 +733,137 @@ TEST(DurationMetricE2eTest, TestWithActivationAndSlicedCondition) {
     EXPECT_EQ(bucketStartTimeNs + bucketSizeNs - duration2StartNs, bucketInfo.duration_nanos());
 }
 
+TEST(DurationMetricE2eTest, TestWithPartialLinkToCombinationCondition) {
+    StatsdConfig config;
+    *config.add_atom_matcher() = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = CreateReleaseWakelockAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOffAtomMatcher();
+    *config.add_atom_matcher() = CreateSyncStartAtomMatcher();
+    *config.add_atom_matcher() = CreateSyncEndAtomMatcher();
+
+    auto holdingWakelockPredicate = CreateHoldingWakelockPredicate();
+    *holdingWakelockPredicate.mutable_simple_predicate()->mutable_dimensions() =
+            CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+    *config.add_predicate() = holdingWakelockPredicate;
+
+    auto screenIsOffPredicate = CreateScreenIsOffPredicate();
+    *config.add_predicate() = screenIsOffPredicate;
+
+    // The sync predicate is sliced by uid and sync name, the link only reads the uid.
+    auto isSyncingPredicate = CreateIsSyncingPredicate();
+    FieldMatcher syncDimensions =
+            CreateAttributionUidDimensions(util::SYNC_STATE_CHANGED, {Position::FIRST});
+    syncDimensions.add_child()->set_field(2);  // sync name field.
+    *isSyncingPredicate.mutable_simple_predicate()->mutable_dimensions() = syncDimensions;
+    *config.add_predicate() = isSyncingPredicate;
+
+    Predicate* screenOffOrSyncingPredicate = config.add_predicate();
+    screenOffOrSyncingPredicate->set_id(StringToId("ScreenOffOrSyncing"));
+    screenOffOrSyncingPredicate->mutable_combination()->set_operation(LogicalOperation::OR);
+    addPredicateToPredicateCombination(screenIsOffPredicate, screenOffOrSyncingPredicate);
+    addPredicateToPredicateCombination(isSyncingPredicate, screenOffOrSyncingPredicate);
+
+    auto durationMetric = config.add_duration_metric();
+    durationMetric->set_id(StringToId("WakelockDuration"));
+    durationMetric->set_what(holdingWakelockPredicate.id());
+    durationMetric->set_condition(screenOffOrSyncingPredicate->id());
+    durationMetric->set_aggregation_type(DurationMetric::SUM);
+    *durationMetric->mutable_dimensions_in_what() =
+            CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+    durationMetric->set_bucket(FIVE_MINUTES);
+
+    auto links = durationMetric->add_links();
+    links->set_condition(isSyncingPredicate.id());
+    *links->mutable_fields_in_what() =
+            CreateAttributionUidDimensions(util::WAKELOCK_STATE_CHANGED, {Position::FIRST});
+    *links->mutable_fields_in_condition() =
+            CreateAttributionUidDimensions(util::SYNC_STATE_CHANGED, {Position::FIRST});
+
+    ConfigKey cfgKey;
+    uint64_t bucketStartTimeNs = 10000000000;
+    uint64_t bucketSizeNs =
+            TimeUnitToBucketSizeInMillis(config.duration_metric(0).bucket()) * 1000000LL;
+    auto processor = CreateStatsLogProcessor(bucketStartTimeNs, bucketStartTimeNs, config, cfgKey);
+    ASSERT_EQ(processor->mMetricsManagers.size(), 1u);
+    sp<MetricsManager> metricsManager = processor->mMetricsManagers.begin()->second;
+    EXPECT_TRUE(metricsManager->isConfigValid());
+    ASSERT_EQ(metricsManager->mAllMetricProducers.size(), 1);
+    DurationMetricProducer* durationProducer =
+            static_cast<DurationMetricProducer*>(metricsManager->mAllMetricProducers[0].get());
+    // The link is partial and the condition is an OR, so the changes of the sync predicate are
+    // routed through the index rather than by the single full link case.
+    EXPECT_FALSE(durationProducer->mHasLinksToAllConditionDimensionsInTracker);
+    EXPECT_EQ(0, durationProducer->mRoutedConditionLinkIndex);
+
+    int appUid1 = 111;
+    int appUid2 = 222;
+    std::vector<string> attributionTags = {"App"};
+
+    auto event = CreateScreenStateChangedEvent(
+            bucketStartTimeNs + 5 * NS_PER_SEC,
+            android::view::DisplayStateEnum::DISPLAY_STATE_ON);  // 0:05
+    processor->OnLogEvent(event.get());
+
+    event = CreateAcquireWakelockEvent(bucketStartTimeNs + 10 * NS_PER_SEC, {appUid1},
+                                       attributionTags, "wl1");  // 0:10
+    processor->OnLogEvent(event.get());
+
+    event = CreateAcquireWakelockEvent(bucketStartTimeNs + 11 * NS_PER_SEC, {appUid2},
+                                       attributionTags, "wl2");  // 0:11
+    processor->OnLogEvent(event.get());
+    EXPECT_EQ(durationProducer->mLinkedWhatKeys.size(), 2u);
+
+    event = CreateSyncStartEvent(bucketStartTimeNs + 20 * NS_PER_SEC, {appUid1}, attributionTags,
+                                 "sync1");  // 0:20
+    processor->OnLogEvent(event.get());
+
+    event = CreateScreenStateChangedEvent(
+            bucketStartTimeNs + 60 * NS_PER_SEC,
+            android::view::DisplayStateEnum::DISPLAY_STATE_OFF);  // 1:00
+    processor->OnLogEvent(event.get());
+
+    event = CreateScreenStateChangedEvent(
+            bucketStartTimeNs + 120 * NS_PER_SEC,
+            android::view::DisplayStateEnum::DISPLAY_STATE_ON);  // 2:00
+    processor->OnLogEvent(event.get());
+
+    event = CreateSyncEndEvent(bucketStartTimeNs + 150 * NS_PER_SEC, {appUid1}, attributionTags,
+                               "sync1");  // 2:30
+    processor->OnLogEvent(event.get());
+
+    vector<uint8_t> buffer;
+    ConfigMetricsReportList reports;
+    processor->onDumpReport(cfgKey, bucketStartTimeNs + bucketSizeNs + 1, false, true, ADB_DUMP,
+                            FAST, &buffer);
+    ASSERT_GT(buffer.size(), 0);
+    EXPECT_TRUE(reports.ParseFromArray(&buffer[0], buffer.size()));
+    backfillDimensionPath(&reports);
+    backfillStringInReport(&reports);
+    backfillStartEndTimestamp(&reports);
+
+    ASSERT_EQ(1, reports.reports_size());
+    ASSERT_EQ(1, reports.reports(0).metrics_size());
+    StatsLogReport::DurationMetricDataWrapper durationMetrics;
+    sortMetricDataByDimensionsValue(reports.reports(0).metrics(0).duration_metrics(),
+                                    &durationMetrics);
+    ASSERT_EQ(2, durationMetrics.data_size());
+
+    // Syncing from 0:20 to 2:30.
+    DurationMetricData data = durationMetrics.data(0);
+    ValidateAttributionUidDimension(data.dimensions_in_what(), util::WAKELOCK_STATE_CHANGED,
+                                    appUid1);
+    ASSERT_EQ(1, data.bucket_info_size());
+    EXPECT_EQ(130 * NS_PER_SEC, data.bucket_info(0).duration_nanos());
+
+    // Screen off from 1:00 to 2:00.
+    data = durationMetrics.data(1);
+    ValidateAttributionUidDimension(data.dimensions_in_what(), util::WAKELOCK_STATE_CHANGED,
+                                    appUid2);
+    ASSERT_EQ(1, data.bucket_info_size());
+    EXPECT_EQ(60 * NS_PER_SEC, data.bucket_info(0).duration_nanos());
+}
+
 TEST(DurationMetricE2eTest, TestWithSlicedState) {
     // Initialize config.
     StatsdConfig config;
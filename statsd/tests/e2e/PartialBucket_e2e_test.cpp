@@ -449,6 +449,59 @@ TEST_F(PartialBucketE2eTest, TestCountMetricNoSplitByDefault) {
     EXPECT_EQ(bucketInfo.count(), 2);
 }
 
+class PartialBucketCoalescingE2eTest : public StatsServiceConfigTest {
+protected:
+    shared_ptr<StatsService> createStatsService() override {
+        StatsLogProcessorOptions processorOptions;
+        processorOptions.appUpgradeCoalescingWindowNs =
+                StatsLogProcessor::kAppUpgradeCoalescingWindowNs;
+        return SharedRefBase::make<StatsService>(
+                new UidMap(), /*queue=*/nullptr, std::make_shared<LogEventFilter>(),
+                /*initEventDelaySecs=*/StatsService::kStatsdInitDelaySecs, /*logEventPool=*/nullptr,
+                processorOptions);
+    }
+};
+
+TEST_F(PartialBucketCoalescingE2eTest, TestCountMetricCoalescesUpgradeSplits) {
+    sendConfig(MakeCountMetricConfig({true}));
+    int64_t start = getElapsedRealtimeNs();  // This is the start-time the metrics producers are
+                                             // initialized with.
+    const string kApp2 = "app2.sharing.1";
+    UidData uidData;
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 1, /*version*/ 1, "v1", kApp1);
+    *uidData.add_app_info() = createApplicationInfo(/*uid*/ 2, /*version*/ 1, "v1", kApp2);
+    service->mUidMap->updateMap(start, uidData);
+
+    service->mProcessor->OnLogEvent(CreateAppCrashEvent(start + 1 * NS_PER_SEC, 100).get());
+    // Splits the bucket.
+    service->mUidMap->updateApp(start + 2 * NS_PER_SEC, kApp1, 1, 2, "v2", "",
+                                /* certificateHash */ {});
+    service->mProcessor->OnLogEvent(CreateAppCrashEvent(start + 3 * NS_PER_SEC, 100).get());
+    // Within the coalescing window of the first upgrade, so it shares its partial bucket.
+    service->mUidMap->updateApp(start + 5 * NS_PER_SEC, kApp2, 2, 2, "v2", "",
+                                /* certificateHash */ {});
+    service->mProcessor->OnLogEvent(CreateAppCrashEvent(start + 6 * NS_PER_SEC, 100).get());
+    // Past the window, so it splits again.
+    service->mUidMap->removeApp(start + 20 * NS_PER_SEC, kApp2, 2);
+    service->mProcessor->OnLogEvent(CreateAppCrashEvent(start + 21 * NS_PER_SEC, 100).get());
+
+    ConfigMetricsReport report = getReports(service->mProcessor, start + 22 * NS_PER_SEC,
+                                            /*include_current=*/true);
+    backfillStartEndTimestamp(&report);
+
+    ASSERT_EQ(1, report.metrics_size());
+    ASSERT_EQ(1, report.metrics(0).count_metrics().data_size());
+    const CountMetricData& data = report.metrics(0).count_metrics().data(0);
+    ASSERT_EQ(3, data.bucket_info_size());
+    EXPECT_EQ(1, data.bucket_info(0).count());
+    EXPECT_EQ(MillisToNano(NanoToMillis(start + 2 * NS_PER_SEC)),
+              data.bucket_info(0).end_bucket_elapsed_nanos());
+    EXPECT_EQ(2, data.bucket_info(1).count());
+    EXPECT_EQ(MillisToNano(NanoToMillis(start + 20 * NS_PER_SEC)),
+              data.bucket_info(1).end_bucket_elapsed_nanos());
+    EXPECT_EQ(1, data.bucket_info(2).count());
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
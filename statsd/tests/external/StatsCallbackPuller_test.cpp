@@ -56,6 +56,26 @@ vector<int64_t> values;
 int64_t pullDelayNs;
 int64_t pullTimeoutNs;
 int64_t pullCoolDownNs;
+// If non zero, the pull is sent with pullPartial in chunks of this many events.
+size_t pullChunkSize;
+// If true, the pull is sent with pullPartialPacked and pullFinishedPacked.
+bool pullPacked;
+// If true, the last packed event of the pull is cut short.
+bool pullTruncated;
+// The rows sent by onPullAtomDelta, as key and value.
+vector<std::pair<int32_t, int64_t>> deltaRows;
+// The base generation onPullAtomDelta was called with.
+int64_t requestedBaseGeneration;
+// The generations onPullAtomDelta sends its result with.
+int64_t resultBaseGeneration;
+int64_t resultGeneration;
+// The fields onPullAtomAggregated was called with.
+vector<int32_t> requestedGroupByFields;
+vector<int32_t> requestedSumFields;
+// The fields onPullAtomProjected was called with.
+vector<int32_t> requestedFields;
+// The atoms onPullAtomGroup was called with.
+vector<int32_t> requestedAtomTags;
 std::thread pullThread;
 
 AStatsEvent* createSimpleEvent(int64_t value) {
@@ -66,6 +86,35 @@ AStatsEvent* createSimpleEvent(int64_t value) {
     return event;
 }
 
+vector<uint8_t> packEvents(vector<StatsEventParcel>::const_iterator begin,
+                           vector<StatsEventParcel>::const_iterator end) {
+    vector<uint8_t> packedEvents;
+    for (auto it = begin; it != end; it++) {
+        const uint32_t size = it->buffer.size();
+        const uint8_t* sizeBytes = reinterpret_cast<const uint8_t*>(&size);
+        packedEvents.insert(packedEvents.end(), sizeBytes, sizeBytes + sizeof(size));
+        packedEvents.insert(packedEvents.end(), it->buffer.begin(), it->buffer.end());
+    }
+    return packedEvents;
+}
+
+void executePackedPull(const shared_ptr<IPullAtomResultReceiver>& resultReceiver,
+                       const vector<StatsEventParcel>& parcels) {
+    auto chunkBegin = parcels.begin();
+    if (pullChunkSize > 0) {
+        while (static_cast<size_t>(parcels.end() - chunkBegin) > pullChunkSize) {
+            resultReceiver->pullPartialPacked(pullTagId,
+                                              packEvents(chunkBegin, chunkBegin + pullChunkSize));
+            chunkBegin += pullChunkSize;
+        }
+    }
+    vector<uint8_t> packedEvents = packEvents(chunkBegin, parcels.end());
+    if (pullTruncated) {
+        packedEvents.pop_back();
+    }
+    resultReceiver->pullFinishedPacked(pullTagId, pullSuccess, packedEvents);
+}
+
 void executePull(const shared_ptr<IPullAtomResultReceiver>& resultReceiver) {
     // Convert stats_events into StatsEventParcels.
     vector<StatsEventParcel> parcels;
@@ -83,9 +132,41 @@ void executePull(const shared_ptr<IPullAtomResultReceiver>& resultReceiver) {
     }
 
     sleep_for(std::chrono::nanoseconds(pullDelayNs));
+    if (pullPacked) {
+        executePackedPull(resultReceiver, parcels);
+        return;
+    }
+    if (pullChunkSize > 0) {
+        while (parcels.size() > pullChunkSize) {
+            vector<StatsEventParcel> chunk(std::make_move_iterator(parcels.begin()),
+                                           std::make_move_iterator(parcels.begin() +
+                                                                   pullChunkSize));
+            parcels.erase(parcels.begin(), parcels.begin() + pullChunkSize);
+            resultReceiver->pullPartial(pullTagId, chunk);
+        }
+    }
     resultReceiver->pullFinished(pullTagId, pullSuccess, parcels);
 }
 
+void executeDeltaPull(const shared_ptr<IPullAtomResultReceiver>& resultReceiver) {
+    vector<StatsEventParcel> parcels;
+    for (const auto& [key, value] : deltaRows) {
+        AStatsEvent* event = AStatsEvent_obtain();
+        AStatsEvent_setAtomId(event, pullTagId);
+        AStatsEvent_writeInt32(event, key);
+        AStatsEvent_writeInt64(event, value);
+        AStatsEvent_build(event);
+        size_t size;
+        uint8_t* buffer = AStatsEvent_getBuffer(event, &size);
+        StatsEventParcel p;
+        p.buffer.assign(buffer, buffer + size);
+        parcels.push_back(std::move(p));
+        AStatsEvent_release(event);
+    }
+    resultReceiver->pullFinishedDelta(pullTagId, pullSuccess, resultBaseGeneration,
+                                      resultGeneration, packEvents(parcels.begin(), parcels.end()));
+}
+
 class FakePullAtomCallback : public BnPullAtomCallback {
 public:
     Status onPullAtom(int atomTag,
@@ -94,6 +175,38 @@ public:
         pullThread = std::thread(executePull, resultReceiver);
         return Status::ok();
     }
+
+    Status onPullAtomDelta(int atomTag, int64_t baseGeneration,
+                           const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        requestedBaseGeneration = baseGeneration;
+        pullThread = std::thread(executeDeltaPull, resultReceiver);
+        return Status::ok();
+    }
+
+    Status onPullAtomAggregated(
+            int atomTag, const vector<int32_t>& groupByFields,
+            const vector<int32_t>& sumFields,
+            const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        requestedGroupByFields = groupByFields;
+        requestedSumFields = sumFields;
+        pullThread = std::thread(executePull, resultReceiver);
+        return Status::ok();
+    }
+
+    Status onPullAtomProjected(
+            int atomTag, const vector<int32_t>& fields,
+            const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        requestedFields = fields;
+        pullThread = std::thread(executePull, resultReceiver);
+        return Status::ok();
+    }
+
+    Status onPullAtomGroup(const vector<int32_t>& atomTags,
+                           const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        requestedAtomTags = atomTags;
+        pullThread = std::thread(executePull, resultReceiver);
+        return Status::ok();
+    }
 };
 
 class StatsCallbackPullerTest : public ::testing::Test {
@@ -104,6 +217,17 @@ public:
     void SetUp() override {
         pullSuccess = false;
         pullDelayNs = 0;
+        pullChunkSize = 0;
+        pullPacked = false;
+        pullTruncated = false;
+        deltaRows.clear();
+        requestedBaseGeneration = -1;
+        requestedGroupByFields.clear();
+        requestedSumFields.clear();
+        requestedFields.clear();
+        requestedAtomTags.clear();
+        resultBaseGeneration = 0;
+        resultGeneration = 0;
         values.clear();
         pullTimeoutNs = 10000000000LL;  // 10 seconds.
         pullCoolDownNs = 1000000000;    // 1 second.
@@ -139,6 +263,262 @@ TEST_F(StatsCallbackPullerTest, PullSuccess) {
     EXPECT_EQ(value, dataHolder[0]->getValues()[0].mValue.int_value);
 }
 
+TEST_F(StatsCallbackPullerTest, PullSuccessInChunks) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    values = {1, 2, 3, 4, 5};
+    pullChunkSize = 2;
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+
+    ASSERT_EQ(5, dataHolder.size());
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(pullTagId, dataHolder[i]->GetTagId());
+        EXPECT_EQ(values[i], dataHolder[i]->getValues()[0].mValue.long_value);
+    }
+}
+
+TEST_F(StatsCallbackPullerTest, PullFailInChunks) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = false;
+    values = {1, 2, 3, 4, 5};
+    pullChunkSize = 2;
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    // Chunks delivered before the failure are dropped.
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    ASSERT_EQ(0, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullSuccessPacked) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    pullPacked = true;
+    values = {1, 2, 3, 4, 5};
+    pullChunkSize = 2;
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+
+    ASSERT_EQ(5, dataHolder.size());
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(pullTagId, dataHolder[i]->GetTagId());
+        EXPECT_EQ(values[i], dataHolder[i]->getValues()[0].mValue.long_value);
+    }
+}
+
+TEST_F(StatsCallbackPullerTest, PullSuccessPackedEmpty) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    pullPacked = true;
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(0, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullFailPackedTruncated) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    pullPacked = true;
+    pullTruncated = true;
+    values = {1, 2, 3};
+
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+
+    // A malformed buffer fails the pull, even if the events before it are valid.
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    ASSERT_EQ(0, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullDelta) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{1});
+
+    // The first pull is a full snapshot.
+    deltaRows = {{1, 10}, {2, 20}};
+    resultGeneration = 1;
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    pullThread.join();
+    EXPECT_EQ(0, requestedBaseGeneration);
+    ASSERT_EQ(2, dataHolder.size());
+
+    // The second one changes row 2 and adds row 3. Row 1 comes from the snapshot.
+    deltaRows = {{2, 25}, {3, 30}};
+    resultBaseGeneration = 1;
+    resultGeneration = 2;
+    dataHolder.clear();
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    pullThread.join();
+    EXPECT_EQ(1, requestedBaseGeneration);
+
+    const vector<std::pair<int32_t, int64_t>> expectedRows = {{1, 10}, {2, 25}, {3, 30}};
+    ASSERT_EQ(expectedRows.size(), dataHolder.size());
+    for (int i = 0; i < expectedRows.size(); i++) {
+        EXPECT_EQ(pullTagId, dataHolder[i]->GetTagId());
+        EXPECT_EQ(expectedRows[i].first, dataHolder[i]->getValues()[0].mValue.int_value);
+        EXPECT_EQ(expectedRows[i].second, dataHolder[i]->getValues()[1].mValue.long_value);
+    }
+
+    // The next request is against the applied delta.
+    deltaRows.clear();
+    resultBaseGeneration = 2;
+    resultGeneration = 3;
+    dataHolder.clear();
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(2, requestedBaseGeneration);
+    EXPECT_EQ(3, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullDeltaAgainstUnknownGeneration) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{1});
+
+    deltaRows = {{1, 10}};
+    resultGeneration = 1;
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    pullThread.join();
+
+    // A delta against a generation the puller does not hold fails the pull.
+    resultBaseGeneration = 5;
+    resultGeneration = 6;
+    dataHolder.clear();
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    pullThread.join();
+    EXPECT_EQ(0, dataHolder.size());
+
+    // The snapshot is dropped, so the next request asks for a full pull.
+    resultBaseGeneration = 0;
+    resultGeneration = 7;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(0, requestedBaseGeneration);
+    EXPECT_EQ(1, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullDeltaResetAfterFailure) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{1});
+
+    deltaRows = {{1, 10}};
+    resultGeneration = 1;
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    pullThread.join();
+
+    pullSuccess = false;
+    dataHolder.clear();
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_FAIL);
+    pullThread.join();
+    EXPECT_EQ(1, requestedBaseGeneration);
+
+    pullSuccess = true;
+    EXPECT_EQ(puller.PullInternal(&dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(0, requestedBaseGeneration);
+}
+
+TEST_F(StatsCallbackPullerTest, PullAggregated) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    values = {10, 20};
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{}, /*supportsAggregation=*/true);
+    ASSERT_TRUE(puller.SupportsAggregation());
+
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullSubsetInternal(&dataHolder, makePullAggregation({1, 3}, {2}),
+                                        /*fieldMask=*/std::nullopt),
+              PULL_SUCCESS);
+    EXPECT_THAT(requestedGroupByFields, ElementsAre(1, 3));
+    EXPECT_THAT(requestedSumFields, ElementsAre(2));
+    EXPECT_EQ(2, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullAggregatedNotSupportedWithDelta) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{1}, /*supportsAggregation=*/true);
+    EXPECT_FALSE(puller.SupportsAggregation());
+}
+
+TEST_F(StatsCallbackPullerTest, PullFieldMask) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    values = {10};
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {});
+    ASSERT_TRUE(puller.SupportsFieldMask());
+
+    TopLevelFieldMask fieldMask;
+    fieldMask.set(1);
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullSubsetInternal(&dataHolder, /*aggregation=*/std::nullopt, fieldMask),
+              PULL_SUCCESS);
+    EXPECT_THAT(requestedFields, ElementsAre(1));
+    ASSERT_EQ(1, dataHolder.size());
+    ASSERT_EQ(1, dataHolder[0]->getValues().size());
+    EXPECT_EQ(10, dataHolder[0]->getValues()[0].mValue.long_value);
+    pullThread.join();
+
+    // The fields that are not in use are skipped when parsing the rows.
+    fieldMask.reset();
+    fieldMask.set(2);
+    dataHolder.clear();
+    EXPECT_EQ(puller.PullSubsetInternal(&dataHolder, /*aggregation=*/std::nullopt, fieldMask),
+              PULL_SUCCESS);
+    EXPECT_THAT(requestedFields, ElementsAre(2));
+    ASSERT_EQ(1, dataHolder.size());
+    EXPECT_EQ(pullTagId, dataHolder[0]->GetTagId());
+    EXPECT_EQ(0, dataHolder[0]->getValues().size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullFieldMaskNotSupportedWithDelta) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{1});
+    EXPECT_FALSE(puller.SupportsFieldMask());
+}
+
+TEST_F(StatsCallbackPullerTest, PullGroup) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    pullSuccess = true;
+    values = {10, 20};
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{}, /*supportsAggregation=*/false,
+                               /*pullGroup=*/3);
+    ASSERT_EQ(3, puller.GetPullGroup());
+
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.PullGroupInternal({pullTagId, pullTagId - 1}, pullTimeoutNs, &dataHolder),
+              PULL_SUCCESS);
+    EXPECT_THAT(requestedAtomTags, ElementsAre(pullTagId, pullTagId - 1));
+    EXPECT_EQ(2, dataHolder.size());
+}
+
+TEST_F(StatsCallbackPullerTest, PullGroupNotSupportedWithDelta) {
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
+    StatsCallbackPuller puller(pullTagId, cb, pullCoolDownNs, pullTimeoutNs, {},
+                               /*deltaKeyFields=*/{1}, /*supportsAggregation=*/false,
+                               /*pullGroup=*/3);
+    EXPECT_EQ(0, puller.GetPullGroup());
+}
+
 TEST_F(StatsCallbackPullerTest, PullFail) {
     shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>();
     pullSuccess = false;
@@ -19,6 +19,9 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <future>
+#include <thread>
+
 #include "stats_event.h"
 #include "tests/statsd_test_util.h"
 
@@ -27,6 +30,7 @@ using ::ndk::SharedRefBase;
 using std::make_shared;
 using std::shared_ptr;
 using std::vector;
+using testing::ElementsAre;
 
 namespace android {
 namespace os {
@@ -40,6 +44,7 @@ int uid1 = 9999;
 int uid2 = 8888;
 ConfigKey configKey(50, 12345);
 ConfigKey badConfigKey(60, 54321);
+ConfigKey otherConfigKey(55, 12345);
 int unregisteredUid = 98765;
 int64_t coolDownNs = NS_PER_SEC;
 int64_t timeoutNs = NS_PER_SEC / 2;
@@ -57,6 +62,7 @@ public:
     FakePullAtomCallback(int32_t uid) : mUid(uid){};
     Status onPullAtom(int atomTag,
                       const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        mPulls++;
         vector<StatsEventParcel> parcels;
         AStatsEvent* event = createSimpleEvent(atomTag, mUid);
         size_t size;
@@ -71,7 +77,122 @@ public:
         resultReceiver->pullFinished(atomTag, /*success*/ true, parcels);
         return Status::ok();
     }
+    Status onPullAtomDelta(int atomTag, int64_t /*baseGeneration*/,
+                           const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        return onPullAtom(atomTag, resultReceiver);
+    }
+    Status onPullAtomAggregated(
+            int atomTag, const vector<int32_t>& /*groupByFields*/,
+            const vector<int32_t>& /*sumFields*/,
+            const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        return onPullAtom(atomTag, resultReceiver);
+    }
+    Status onPullAtomProjected(
+            int atomTag, const vector<int32_t>& /*fields*/,
+            const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        return onPullAtom(atomTag, resultReceiver);
+    }
+    Status onPullAtomGroup(const vector<int32_t>& atomTags,
+                           const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        mGroupPulls++;
+        vector<StatsEventParcel> parcels;
+        for (const int32_t atomTag : atomTags) {
+            AStatsEvent* event = createSimpleEvent(atomTag, mUid);
+            size_t size;
+            uint8_t* buffer = AStatsEvent_getBuffer(event, &size);
+            StatsEventParcel p;
+            p.buffer.assign(buffer, buffer + size);
+            parcels.push_back(std::move(p));
+            AStatsEvent_release(event);
+        }
+        resultReceiver->pullFinished(atomTags[0], /*success*/ true, parcels);
+        return Status::ok();
+    }
     int32_t mUid;
+    int mPulls = 0;
+    int mGroupPulls = 0;
+};
+
+// Blocks its pulls until mRelease is ready.
+class BlockingPullAtomCallback : public FakePullAtomCallback {
+public:
+    BlockingPullAtomCallback(int32_t uid) : FakePullAtomCallback(uid){};
+    Status onPullAtom(int atomTag,
+                      const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        mStarted.set_value();
+        mRelease.wait();
+        return FakePullAtomCallback::onPullAtom(atomTag, resultReceiver);
+    }
+    std::promise<void> mStarted;
+    std::shared_future<void> mRelease;
+};
+
+class DeadPullAtomCallback : public BnPullAtomCallback {
+public:
+    Status onPullAtom(int /*atomTag*/,
+                      const shared_ptr<IPullAtomResultReceiver>& /*resultReceiver*/) override {
+        return Status::fromStatus(STATUS_DEAD_OBJECT);
+    }
+    Status onPullAtomDelta(int /*atomTag*/, int64_t /*baseGeneration*/,
+                           const shared_ptr<IPullAtomResultReceiver>& /*resultReceiver*/) override {
+        return Status::fromStatus(STATUS_DEAD_OBJECT);
+    }
+    Status onPullAtomAggregated(
+            int /*atomTag*/, const vector<int32_t>& /*groupByFields*/,
+            const vector<int32_t>& /*sumFields*/,
+            const shared_ptr<IPullAtomResultReceiver>& /*resultReceiver*/) override {
+        return Status::fromStatus(STATUS_DEAD_OBJECT);
+    }
+    Status onPullAtomProjected(
+            int /*atomTag*/, const vector<int32_t>& /*fields*/,
+            const shared_ptr<IPullAtomResultReceiver>& /*resultReceiver*/) override {
+        return Status::fromStatus(STATUS_DEAD_OBJECT);
+    }
+    Status onPullAtomGroup(
+            const vector<int32_t>& /*atomTags*/,
+            const shared_ptr<IPullAtomResultReceiver>& /*resultReceiver*/) override {
+        return Status::fromStatus(STATUS_DEAD_OBJECT);
+    }
+};
+
+// Records every delivery, in order, into a log shared by all receivers of a test.
+class FakePullDataReceiver : public PullDataReceiver {
+public:
+    struct Delivery {
+        int tagId;
+        PullResult pullResult;
+        vector<int32_t> values;
+        std::thread::id threadId;
+    };
+
+    FakePullDataReceiver(int tagId, vector<Delivery>* log,
+                         const std::optional<PullAggregation>& aggregation = std::nullopt)
+        : mTagId(tagId), mLog(log), mAggregation(aggregation) {
+    }
+
+    void onDataPulled(const vector<shared_ptr<LogEvent>>& data, PullResult pullResult,
+                      int64_t /*originalPullTimeNs*/) override {
+        Delivery delivery = {.tagId = mTagId,
+                             .pullResult = pullResult,
+                             .threadId = std::this_thread::get_id()};
+        for (const auto& event : data) {
+            delivery.values.push_back(event->getValues()[0].mValue.int_value);
+        }
+        mLog->push_back(delivery);
+    }
+
+    bool isPullNeeded() const override {
+        return true;
+    }
+
+    std::optional<PullAggregation> getPullAggregation() const override {
+        return mAggregation;
+    }
+
+private:
+    const int mTagId;
+    vector<Delivery>* mLog;
+    const std::optional<PullAggregation> mAggregation;
 };
 
 class FakePullUidProvider : public PullUidProvider {
@@ -86,8 +207,8 @@ public:
     }
 };
 
-sp<StatsPullerManager> createPullerManagerAndRegister() {
-    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+sp<StatsPullerManager> createPullerManagerAndRegister(size_t numPullThreads = 1) {
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager(numPullThreads);
     shared_ptr<FakePullAtomCallback> cb1 = SharedRefBase::make<FakePullAtomCallback>(uid1);
     pullerManager->RegisterPullAtomCallback(uid1, pullTagId1, coolDownNs, timeoutNs, {}, cb1);
     shared_ptr<FakePullAtomCallback> cb2 = SharedRefBase::make<FakePullAtomCallback>(uid2);
@@ -145,6 +266,239 @@ TEST(StatsPullerManagerTest, TestPullConfigKeyNoPullerWithUid) {
     EXPECT_FALSE(pullerManager->Pull(pullTagId2, configKey, /*timestamp =*/1, &data));
 }
 
+TEST(StatsPullerManagerTest, TestSlowPullDoesNotBlockOtherAtoms) {
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    shared_ptr<BlockingPullAtomCallback> slowCb =
+            SharedRefBase::make<BlockingPullAtomCallback>(uid1);
+    std::promise<void> release;
+    slowCb->mRelease = release.get_future().share();
+    std::future<void> started = slowCb->mStarted.get_future();
+    pullerManager->RegisterPullAtomCallback(uid1, pullTagId1, coolDownNs, timeoutNs, {}, slowCb);
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+
+    std::thread slowPull([&pullerManager] {
+        vector<shared_ptr<LogEvent>> data;
+        pullerManager->Pull(pullTagId1, configKey, /*eventTimeNs=*/1, &data);
+    });
+    started.wait();
+
+    // Registrations and the pulls of other atoms go on while the pull is blocked.
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>(uid2);
+    pullerManager->RegisterPullAtomCallback(uid2, pullTagId2, coolDownNs, timeoutNs, {}, cb);
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver = new FakePullDataReceiver(pullTagId2, &log);
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver, /*nextPullTimeNs=*/0,
+                                    60 * NS_PER_SEC);
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/1);
+    ASSERT_EQ(log.size(), 1);
+    EXPECT_EQ(log[0].pullResult, PullResult::PULL_RESULT_SUCCESS);
+    EXPECT_THAT(log[0].values, ElementsAre(uid2));
+    pullerManager->UnRegisterReceiver(pullTagId2, configKey, receiver);
+
+    release.set_value();
+    slowPull.join();
+    EXPECT_EQ(slowCb->mPulls, 1);
+}
+
+TEST(StatsPullerManagerTest, TestParallelPullsOnAlarm) {
+    sp<StatsPullerManager> pullerManager =
+            createPullerManagerAndRegister(StatsPullerManager::kParallelPullThreads);
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>(uid2);
+    pullerManager->RegisterPullAtomCallback(uid2, pullTagId2, coolDownNs, timeoutNs, {}, cb);
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+    pullerManager->RegisterPullUidProvider(otherConfigKey, uidProvider);
+
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver(pullTagId1, &log);
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver(pullTagId2, &log);
+    sp<FakePullDataReceiver> receiver3 = new FakePullDataReceiver(pullTagId1, &log);
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver2, /*nextPullTimeNs=*/0,
+                                    intervalNs);
+    pullerManager->RegisterReceiver(pullTagId1, otherConfigKey, receiver3, /*nextPullTimeNs=*/0,
+                                    intervalNs);
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, /*nextPullTimeNs=*/0,
+                                    intervalNs);
+
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/1);
+
+    // Deliveries follow the receiver order, on the alarm thread, whichever thread pulled.
+    ASSERT_EQ(log.size(), 3);
+    EXPECT_EQ(log[0].tagId, pullTagId1);
+    EXPECT_EQ(log[1].tagId, pullTagId1);
+    EXPECT_EQ(log[2].tagId, pullTagId2);
+    for (const auto& delivery : log) {
+        EXPECT_EQ(delivery.pullResult, PullResult::PULL_RESULT_SUCCESS);
+        EXPECT_THAT(delivery.values, ElementsAre(uid2));
+        EXPECT_EQ(delivery.threadId, std::this_thread::get_id());
+    }
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, intervalNs);
+}
+
+TEST(StatsPullerManagerTest, TestParallelPullsDeadPuller) {
+    sp<StatsPullerManager> pullerManager =
+            createPullerManagerAndRegister(StatsPullerManager::kParallelPullThreads);
+    shared_ptr<DeadPullAtomCallback> deadCb = SharedRefBase::make<DeadPullAtomCallback>();
+    pullerManager->RegisterPullAtomCallback(uid2, pullTagId2, coolDownNs, timeoutNs, {}, deadCb);
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver(pullTagId1, &log);
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver(pullTagId2, &log);
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, /*nextPullTimeNs=*/0,
+                                    60 * NS_PER_SEC);
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver2, /*nextPullTimeNs=*/0,
+                                    60 * NS_PER_SEC);
+
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/1);
+
+    ASSERT_EQ(log.size(), 2);
+    EXPECT_EQ(log[0].tagId, pullTagId1);
+    EXPECT_EQ(log[0].pullResult, PullResult::PULL_RESULT_SUCCESS);
+    EXPECT_EQ(log[1].tagId, pullTagId2);
+    EXPECT_EQ(log[1].pullResult, PullResult::PULL_RESULT_FAIL);
+
+    // The dead puller is dropped once the parallel pulls are done.
+    PullerKey deadKey = {.uid = uid2, .atomTag = pullTagId2};
+    EXPECT_EQ(pullerManager->kAllPullAtomInfo.count(deadKey), 0);
+    PullerKey liveKey = {.uid = uid2, .atomTag = pullTagId1};
+    EXPECT_EQ(pullerManager->kAllPullAtomInfo.count(liveKey), 1);
+}
+
+TEST(StatsPullerManagerTest, TestPullCoalescing) {
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager(
+            /*numPullThreads=*/1, StatsPullerManager::kPullCoalescingWindowNs);
+    shared_ptr<FakePullAtomCallback> cb = SharedRefBase::make<FakePullAtomCallback>(uid2);
+    pullerManager->RegisterPullAtomCallback(uid2, pullTagId1, coolDownNs, timeoutNs, {}, cb);
+    pullerManager->RegisterPullAtomCallback(uid2, pullTagId2, coolDownNs, timeoutNs, {}, cb);
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver(pullTagId1, &log);
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver(pullTagId2, &log);
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1,
+                                    /*nextPullTimeNs=*/60 * NS_PER_SEC, intervalNs);
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 60 * NS_PER_SEC);
+
+    // Due 5s later, so both pulls share the later alarm.
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver2,
+                                    /*nextPullTimeNs=*/65 * NS_PER_SEC, intervalNs);
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 65 * NS_PER_SEC);
+
+    pullerManager->OnAlarmFired(65 * NS_PER_SEC);
+    ASSERT_EQ(log.size(), 2);
+    EXPECT_EQ(log[0].tagId, pullTagId1);
+    EXPECT_EQ(log[0].pullResult, PullResult::PULL_RESULT_SUCCESS);
+    EXPECT_EQ(log[1].tagId, pullTagId2);
+    EXPECT_EQ(log[1].pullResult, PullResult::PULL_RESULT_SUCCESS);
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 125 * NS_PER_SEC);
+
+    // Pulls further apart than the window keep their own alarm.
+    sp<FakePullDataReceiver> receiver3 = new FakePullDataReceiver(pullTagId2, &log);
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver3,
+                                    /*nextPullTimeNs=*/140 * NS_PER_SEC, intervalNs);
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 125 * NS_PER_SEC);
+}
+
+TEST(StatsPullerManagerTest, TestPullCoalescingDisabled) {
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver(pullTagId1, &log);
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver(pullTagId2, &log);
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1,
+                                    /*nextPullTimeNs=*/60 * NS_PER_SEC, 60 * NS_PER_SEC);
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver2,
+                                    /*nextPullTimeNs=*/65 * NS_PER_SEC, 60 * NS_PER_SEC);
+    EXPECT_EQ(pullerManager->mNextPullTimeNs, 60 * NS_PER_SEC);
+}
+
+TEST(StatsPullerManagerTest, TestReceiversPullAggregation) {
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    EXPECT_EQ(pullerManager->getReceiversPullAggregationLocked(pullTagId1), std::nullopt);
+
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver1 =
+            new FakePullDataReceiver(pullTagId1, &log, makePullAggregation({1}, {3}));
+    sp<FakePullDataReceiver> receiver2 =
+            new FakePullDataReceiver(pullTagId1, &log, makePullAggregation({2}, {3, 4}));
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, intervalNs, intervalNs);
+    pullerManager->RegisterReceiver(pullTagId1, otherConfigKey, receiver2, intervalNs,
+                                    intervalNs);
+    EXPECT_EQ(pullerManager->getReceiversPullAggregationLocked(pullTagId1),
+              makePullAggregation({1, 2}, {3, 4}));
+    EXPECT_EQ(pullerManager->getReceiversPullAggregationLocked(pullTagId2), std::nullopt);
+
+    // A receiver of the raw rows disables the aggregation of the atom.
+    sp<FakePullDataReceiver> receiver3 = new FakePullDataReceiver(pullTagId1, &log);
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver3, intervalNs, intervalNs);
+    EXPECT_EQ(pullerManager->getReceiversPullAggregationLocked(pullTagId1), std::nullopt);
+}
+
+TEST(StatsPullerManagerTest, TestReceiversPullFieldMask) {
+    sp<StatsPullerManager> pullerManager = createPullerManagerAndRegister();
+    TopLevelFieldMask fieldMask;
+    fieldMask.set(1);
+    TopLevelFieldMask allFields;
+    allFields.set();
+    // Atoms that are not pulled, or whose fields are all in use, do not keep a mask.
+    pullerManager->SetPullAtomFieldMasks({{pullTagId1, fieldMask},
+                                          {pullTagId2, allFields},
+                                          {util::SCREEN_STATE_CHANGED, fieldMask}});
+    EXPECT_EQ(pullerManager->getReceiversPullFieldMaskLocked(pullTagId1), fieldMask);
+    EXPECT_EQ(pullerManager->getReceiversPullFieldMaskLocked(pullTagId2), std::nullopt);
+    EXPECT_EQ(pullerManager->mPullAtomFieldMasks.size(), 1);
+
+    // A new receiver may read other fields until the masks are set again.
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver = new FakePullDataReceiver(pullTagId1, &log);
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver, intervalNs, intervalNs);
+    EXPECT_EQ(pullerManager->getReceiversPullFieldMaskLocked(pullTagId1), std::nullopt);
+}
+
+TEST(StatsPullerManagerTest, TestPullGroupOnAlarm) {
+    sp<StatsPullerManager> pullerManager = new StatsPullerManager();
+    shared_ptr<FakePullAtomCallback> cb1 = SharedRefBase::make<FakePullAtomCallback>(uid2);
+    shared_ptr<FakePullAtomCallback> cb2 = SharedRefBase::make<FakePullAtomCallback>(uid2);
+    pullerManager->RegisterPullAtomCallback(uid2, pullTagId1, coolDownNs, timeoutNs, {}, cb1,
+                                            /*deltaKeyFields=*/{}, /*supportsAggregation=*/false,
+                                            /*pullGroup=*/1);
+    pullerManager->RegisterPullAtomCallback(uid2, pullTagId2, coolDownNs, timeoutNs, {}, cb2,
+                                            /*deltaKeyFields=*/{}, /*supportsAggregation=*/false,
+                                            /*pullGroup=*/1);
+    sp<FakePullUidProvider> uidProvider = new FakePullUidProvider();
+    pullerManager->RegisterPullUidProvider(configKey, uidProvider);
+
+    vector<FakePullDataReceiver::Delivery> log;
+    sp<FakePullDataReceiver> receiver1 = new FakePullDataReceiver(pullTagId1, &log);
+    sp<FakePullDataReceiver> receiver2 = new FakePullDataReceiver(pullTagId2, &log);
+    const int64_t intervalNs = 60 * NS_PER_SEC;
+    pullerManager->RegisterReceiver(pullTagId1, configKey, receiver1, /*nextPullTimeNs=*/0,
+                                    intervalNs);
+    pullerManager->RegisterReceiver(pullTagId2, configKey, receiver2, /*nextPullTimeNs=*/0,
+                                    intervalNs);
+
+    pullerManager->OnAlarmFired(/*elapsedTimeNs=*/1);
+
+    // Both atoms come from one request to the callback of the first of them.
+    EXPECT_EQ(cb1->mGroupPulls, 1);
+    EXPECT_EQ(cb2->mGroupPulls, 0);
+    EXPECT_EQ(cb1->mPulls + cb2->mPulls, 0);
+    ASSERT_EQ(log.size(), 2);
+    EXPECT_EQ(log[0].tagId, pullTagId1);
+    EXPECT_EQ(log[1].tagId, pullTagId2);
+    for (const auto& delivery : log) {
+        EXPECT_EQ(delivery.pullResult, PullResult::PULL_RESULT_SUCCESS);
+        EXPECT_THAT(delivery.values, ElementsAre(uid2));
+    }
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
\ No newline at end of file
@@ -60,6 +60,81 @@ private:
 
 FakePuller puller;
 
+// Counts its pulls, by whether the rows may be aggregated.
+class FakeSubsetPuller : public StatsPuller {
+public:
+    FakeSubsetPuller()
+        : StatsPuller(pullTagId, /*coolDownNs=*/MillisToNano(10), /*timeoutNs=*/MillisToNano(5)){};
+
+    int numPulls = 0;
+    int numSubsetPulls = 0;
+    std::optional<PullAggregation> lastAggregation;
+    std::optional<TopLevelFieldMask> lastFieldMask;
+
+private:
+    PullErrorCode PullInternal(vector<std::shared_ptr<LogEvent>>* data) override {
+        numPulls++;
+        lastAggregation = std::nullopt;
+        lastFieldMask = std::nullopt;
+        (*data) = pullData;
+        return PULL_SUCCESS;
+    }
+
+    PullErrorCode PullSubsetInternal(vector<std::shared_ptr<LogEvent>>* data,
+                                     const std::optional<PullAggregation>& aggregation,
+                                     const std::optional<TopLevelFieldMask>& fieldMask) override {
+        numSubsetPulls++;
+        lastAggregation = aggregation;
+        lastFieldMask = fieldMask;
+        (*data) = pullData;
+        return PULL_SUCCESS;
+    }
+
+    bool SupportsAggregation() const override {
+        return true;
+    }
+
+    bool SupportsFieldMask() const override {
+        return true;
+    }
+};
+
+// Counts its pulls, by whether they are of its pull group. A group pull sends a row of each atom
+// holding the atom tag, unless groupPullSuccess is false.
+class FakeGroupPuller : public StatsPuller {
+public:
+    explicit FakeGroupPuller(int tagId)
+        : StatsPuller(tagId, /*coolDownNs=*/MillisToNano(10), /*timeoutNs=*/MillisToNano(5)){};
+
+    bool groupPullSuccess = true;
+    int numPulls = 0;
+    int numGroupPulls = 0;
+
+    int32_t GetPullGroup() const override {
+        return 1;
+    }
+
+private:
+    PullErrorCode PullInternal(vector<std::shared_ptr<LogEvent>>* data) override {
+        numPulls++;
+        return PULL_SUCCESS;
+    }
+
+    PullErrorCode PullGroupInternal(const vector<int32_t>& atomTags, int64_t /*timeoutNs*/,
+                                    vector<std::shared_ptr<LogEvent>>* data) override {
+        numGroupPulls++;
+        for (const int32_t atomTag : atomTags) {
+            AStatsEvent* statsEvent = AStatsEvent_obtain();
+            AStatsEvent_setAtomId(statsEvent, atomTag);
+            AStatsEvent_writeInt64(statsEvent, atomTag);
+            std::shared_ptr<LogEvent> logEvent = std::make_shared<LogEvent>(/*uid=*/0, /*pid=*/0);
+            parseStatsEventToLogEvent(statsEvent, logEvent.get());
+            data->push_back(logEvent);
+        }
+        return groupPullSuccess ? PULL_SUCCESS : PULL_FAIL;
+    }
+};
+
 std::unique_ptr<LogEvent> createSimpleEvent(int64_t eventTimeNs, int64_t value) {
     AStatsEvent* statsEvent = AStatsEvent_obtain();
     AStatsEvent_setAtomId(statsEvent, pullTagId);
@@ -308,6 +383,193 @@ TEST_F(StatsPullerTest, PullFailsAndPullSameEventTime) {
     ASSERT_EQ(0, dataHolder.size());
 }
 
+TEST_F(StatsPullerTest, PullSnapshotSharedAcrossCallers) {
+    pullData.push_back(createSimpleEvent(1111L, 33));
+
+    pullSuccess = true;
+    int64_t eventTimeNs = getElapsedRealtimeNs();
+
+    PulledDataSnapshot snapshot1;
+    EXPECT_EQ(puller.Pull(eventTimeNs, &snapshot1), PULL_SUCCESS);
+    ASSERT_NE(snapshot1, nullptr);
+    ASSERT_EQ(1, snapshot1->size());
+    EXPECT_EQ(33, (*snapshot1)[0]->getValues()[0].mValue.int_value);
+
+    pullData.clear();
+    pullData.push_back(createSimpleEvent(2222L, 44));
+
+    // Served from the cache: the same snapshot, not a copy of it.
+    PulledDataSnapshot snapshot2;
+    EXPECT_EQ(puller.Pull(eventTimeNs, &snapshot2), PULL_SUCCESS);
+    EXPECT_EQ(snapshot1, snapshot2);
+
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller.Pull(eventTimeNs, &dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(dataHolder, *snapshot1);
+
+    // A cleared cache still hands out a non-null snapshot for a good pull.
+    puller.ForceClearCache();
+    PulledDataSnapshot snapshot3;
+    EXPECT_EQ(puller.Pull(/*eventTimeNs=*/0, &snapshot3), PULL_SUCCESS);
+    ASSERT_NE(snapshot3, nullptr);
+    EXPECT_EQ(0, snapshot3->size());
+}
+
+TEST_F(StatsPullerTest, PullAggregatedCache) {
+    pullData.push_back(createSimpleEvent(1111L, 33));
+    FakeSubsetPuller subsetPuller;
+    const int64_t eventTimeNs = getElapsedRealtimeNs();
+    const PullAggregation byField1 = makePullAggregation({1}, {2});
+    const PullAggregation byField3 = makePullAggregation({3}, {2});
+
+    PulledDataSnapshot snapshot;
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, byField1), PULL_SUCCESS);
+    EXPECT_EQ(1, subsetPuller.numSubsetPulls);
+    EXPECT_EQ(byField1, subsetPuller.lastAggregation);
+
+    // Served from the cache.
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, byField1), PULL_SUCCESS);
+    EXPECT_EQ(1, subsetPuller.numSubsetPulls);
+
+    // Rows grouped by field 1 do not serve a caller that groups by field 3. The new rows serve
+    // both.
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, byField3), PULL_SUCCESS);
+    EXPECT_EQ(2, subsetPuller.numSubsetPulls);
+    EXPECT_EQ(makePullAggregation({1, 3}, {2}), subsetPuller.lastAggregation);
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, byField1), PULL_SUCCESS);
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, byField3), PULL_SUCCESS);
+    EXPECT_EQ(2, subsetPuller.numSubsetPulls);
+
+    // Aggregated rows do not serve a caller that needs them as pulled, whose rows serve anyone.
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(1, subsetPuller.numPulls);
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, byField1), PULL_SUCCESS);
+    EXPECT_EQ(1, subsetPuller.numPulls);
+    EXPECT_EQ(2, subsetPuller.numSubsetPulls);
+}
+
+TEST_F(StatsPullerTest, PullAggregatedNotSupported) {
+    pullData.push_back(createSimpleEvent(1111L, 33));
+    pullSuccess = true;
+    const int64_t eventTimeNs = getElapsedRealtimeNs();
+
+    // The rows of a puller that does not aggregate them serve every caller.
+    PulledDataSnapshot snapshot1;
+    EXPECT_EQ(puller.Pull(eventTimeNs, &snapshot1, makePullAggregation({1}, {2})), PULL_SUCCESS);
+    PulledDataSnapshot snapshot2;
+    EXPECT_EQ(puller.Pull(eventTimeNs, &snapshot2), PULL_SUCCESS);
+    EXPECT_EQ(snapshot1, snapshot2);
+}
+
+TEST_F(StatsPullerTest, PullFieldMaskCache) {
+    pullData.push_back(createSimpleEvent(1111L, 33));
+    FakeSubsetPuller subsetPuller;
+    const int64_t eventTimeNs = getElapsedRealtimeNs();
+    TopLevelFieldMask field1;
+    field1.set(1);
+    TopLevelFieldMask field2;
+    field2.set(2);
+
+    PulledDataSnapshot snapshot;
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, /*aggregation=*/std::nullopt, field1),
+              PULL_SUCCESS);
+    EXPECT_EQ(1, subsetPuller.numSubsetPulls);
+    EXPECT_EQ(field1, subsetPuller.lastFieldMask);
+
+    // Rows holding field 1 do not serve a caller that reads field 2. The new rows serve both.
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, /*aggregation=*/std::nullopt, field2),
+              PULL_SUCCESS);
+    EXPECT_EQ(2, subsetPuller.numSubsetPulls);
+    EXPECT_EQ(field1 | field2, subsetPuller.lastFieldMask);
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, /*aggregation=*/std::nullopt, field1),
+              PULL_SUCCESS);
+    EXPECT_EQ(2, subsetPuller.numSubsetPulls);
+
+    // Nor do they serve a caller that reads every field.
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(1, subsetPuller.numPulls);
+    EXPECT_EQ(subsetPuller.Pull(eventTimeNs, &snapshot, /*aggregation=*/std::nullopt, field2),
+              PULL_SUCCESS);
+    EXPECT_EQ(1, subsetPuller.numPulls);
+    EXPECT_EQ(2, subsetPuller.numSubsetPulls);
+}
+
+TEST_F(StatsPullerTest, PullGroupCache) {
+    sp<FakeGroupPuller> puller1 = new FakeGroupPuller(pullTagId);
+    sp<FakeGroupPuller> puller2 = new FakeGroupPuller(pullTagId + 1);
+    const int64_t eventTimeNs = getElapsedRealtimeNs();
+
+    StatsPuller::PullGroup({puller1, puller2}, eventTimeNs);
+    EXPECT_EQ(1, puller1->numGroupPulls);
+    EXPECT_EQ(0, puller2->numGroupPulls);
+
+    // Each puller serves the rows of its atom from the cache.
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller1->Pull(eventTimeNs, &dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(1, dataHolder.size());
+    EXPECT_EQ(pullTagId, dataHolder[0]->GetTagId());
+    EXPECT_EQ(puller2->Pull(eventTimeNs, &dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(1, dataHolder.size());
+    EXPECT_EQ(pullTagId + 1, dataHolder[0]->GetTagId());
+    EXPECT_EQ(0, puller1->numPulls);
+    EXPECT_EQ(0, puller2->numPulls);
+}
+
+TEST_F(StatsPullerTest, PullGroupFail) {
+    sp<FakeGroupPuller> puller1 = new FakeGroupPuller(pullTagId);
+    sp<FakeGroupPuller> puller2 = new FakeGroupPuller(pullTagId + 1);
+    puller1->groupPullSuccess = false;
+    const int64_t eventTimeNs = getElapsedRealtimeNs();
+
+    // A failed group pull leaves each atom to be pulled on its own.
+    StatsPuller::PullGroup({puller1, puller2}, eventTimeNs);
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    EXPECT_EQ(puller1->Pull(eventTimeNs, &dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(puller2->Pull(eventTimeNs, &dataHolder), PULL_SUCCESS);
+    EXPECT_EQ(1, puller1->numPulls);
+    EXPECT_EQ(1, puller2->numPulls);
+}
+
+TEST_F(StatsPullerTest, SlowPullerCoolDownPenalty) {
+    pullSuccess = true;
+    // Slower than half of the 5ms timeout, but within it.
+    pullDelayNs = MillisToNano(3);
+
+    vector<std::shared_ptr<LogEvent>> dataHolder;
+    pullData.push_back(createSimpleEvent(1111L, 33));
+    for (int i = 0; i < StatsPuller::kSlowPullsForPenalty; i++) {
+        if (i > 0) {
+            // Let the regular 10ms cool down expire.
+            sleep_for(std::chrono::milliseconds(11));
+        }
+        EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &dataHolder), PULL_SUCCESS);
+    }
+
+    // The cool down now also covers 4 times the last pull time, so this is served from cache.
+    pullData.clear();
+    pullData.push_back(createSimpleEvent(2222L, 44));
+    sleep_for(std::chrono::milliseconds(11));
+    EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(1, dataHolder.size());
+    EXPECT_EQ(33, dataHolder[0]->getValues()[0].mValue.int_value);
+
+    // A fast pull restores the regular cool down.
+    sleep_for(std::chrono::milliseconds(30));
+    pullDelayNs = 0;
+    EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(1, dataHolder.size());
+    EXPECT_EQ(44, dataHolder[0]->getValues()[0].mValue.int_value);
+
+    pullData.clear();
+    pullData.push_back(createSimpleEvent(3333L, 55));
+    sleep_for(std::chrono::milliseconds(11));
+    EXPECT_EQ(puller.Pull(getElapsedRealtimeNs(), &dataHolder), PULL_SUCCESS);
+    ASSERT_EQ(1, dataHolder.size());
+    EXPECT_EQ(55, dataHolder[0]->getValues()[0].mValue.int_value);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
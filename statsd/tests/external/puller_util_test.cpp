@@ -106,14 +106,14 @@ TEST(PullerUtilTest, MergeWithDimension) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(3, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(2).mValue.int_value);
 
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(3, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
 }
 
 TEST(PullerUtilTest, NoMergeHostUidOnly) {
@@ -135,14 +135,14 @@ TEST(PullerUtilTest, NoMergeHostUidOnly) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(3, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(2).mValue.int_value);
 
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(3, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
 }
 
 TEST(PullerUtilTest, IsolatedUidOnly) {
@@ -165,15 +165,15 @@ TEST(PullerUtilTest, IsolatedUidOnly) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(3, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(2).mValue.int_value);
 
     // 20->22->21
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(3, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
 }
 
 TEST(PullerUtilTest, MultipleIsolatedUidToOneHostUid) {
@@ -276,9 +276,9 @@ TEST(PullerUtilTest, MergeNoDimensionAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(isolatedAdditiveData + hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
@@ -307,20 +307,20 @@ TEST(PullerUtilTest, MergeWithDimensionAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(200, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(hostUid, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
-    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
 
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(200, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(hostUid, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
-    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
 
 TEST(PullerUtilTest, NoMergeHostUidOnlyAttributionChain) {
@@ -343,20 +343,20 @@ TEST(PullerUtilTest, NoMergeHostUidOnlyAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
-    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
 
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
-    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
 
 TEST(PullerUtilTest, IsolatedUidOnlyAttributionChain) {
@@ -380,21 +380,21 @@ TEST(PullerUtilTest, IsolatedUidOnlyAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
-    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
 
     // 20->tag1->400->tag2->22->21
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
-    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(isolatedAdditiveData, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(5).mValue.int_value);
 }
 
 TEST(PullerUtilTest, MultipleIsolatedUidToOneHostUidAttributionChain) {
@@ -421,9 +421,9 @@ TEST(PullerUtilTest, MultipleIsolatedUidToOneHostUidAttributionChain) {
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.str_value);
+    EXPECT_EQ("tag1", actualFieldValues->at(1).mValue.getString());
     EXPECT_EQ(400, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.str_value);
+    EXPECT_EQ("tag2", actualFieldValues->at(3).mValue.getString());
     EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(isolatedAdditiveData + hostAdditiveData + hostAdditiveData,
               actualFieldValues->at(5).mValue.int_value);
@@ -469,7 +469,7 @@ TEST(PullerUtilTest, RepeatedAdditiveField) {
     EXPECT_EQ(9, actualFieldValues->at(3).mValue.int_value);
 }
 
-// Test that repeated uid events are sorted and merged correctly.
+// Test that repeated uid events are merged correctly.
 TEST(PullerUtilTest, RepeatedUidField) {
     vector<int> uidArray1 = {isolatedUid1, hostUid};
     vector<int> uidArray2 = {isolatedUid1, isolatedUid3};
@@ -514,20 +514,20 @@ TEST(PullerUtilTest, RepeatedUidField) {
     EXPECT_EQ(hostAdditiveData + isolatedAdditiveData + hostAdditiveData,
               actualFieldValues->at(3).mValue.int_value);
 
-    // Event 4 isn't merged - different non-additive data.
+    // Event 2 isn't merged - different uid.
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(4, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(hostUid, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostUid2, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(2).mValue.int_value);
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(3).mValue.int_value);
 
-    // Event 2 isn't merged - different uid.
+    // Event 4 isn't merged - different non-additive data.
     actualFieldValues = &data[2]->getValues();
     ASSERT_EQ(4, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(hostUid2, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostNonAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostUid, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(isolatedNonAdditiveData, actualFieldValues->at(2).mValue.int_value);
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(3).mValue.int_value);
 
     // Event 5 isn't merged - different repeated uid length.
@@ -540,8 +540,7 @@ TEST(PullerUtilTest, RepeatedUidField) {
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(4).mValue.int_value);
 }
 
-// Test that repeated uid events with multiple repeated non-additive fields are sorted and merged
-// correctly.
+// Test that repeated uid events with multiple repeated non-additive fields are merged correctly.
 TEST(PullerUtilTest, MultipleRepeatedFields) {
     vector<int> uidArray1 = {isolatedUid1, hostUid};
     vector<int> uidArray2 = {isolatedUid1, isolatedUid3};
@@ -554,9 +553,6 @@ TEST(PullerUtilTest, MultipleRepeatedFields) {
     const vector<int> secondAdditiveField = {2};
 
     vector<shared_ptr<LogEvent>> data = {
-            // TODO: Once b/224880904 is fixed, can use different additive data without
-            // having the sort order messed up.
-
             // Event 1 {30, 20}->21->{1, 2, 3} (merged with event 4)
             makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray1, hostAdditiveData,
                                     nonAdditiveArray1),
@@ -570,9 +566,9 @@ TEST(PullerUtilTest, MultipleRepeatedFields) {
             makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray3, hostAdditiveData,
                                     nonAdditiveArray3),
 
-            // Event 4 {30, 20}->21->{1, 2, 3} (merged with event 1)
-            // TODO: once sorting bug is fixed, can change this additive field
-            makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray1, hostAdditiveData,
+            // Event 4 {30, 20}->31->{1, 2, 3} (merged with event 1, though event 5 is between
+            // them in sorted order)
+            makeRepeatedUidLogEvent(uidAtomTagId, timestamp, uidArray1, isolatedAdditiveData,
                                     nonAdditiveArray1),
 
             // Event 5 {30, 20}->21->{1, 5, 3} (different repeated field, not merged)
@@ -585,61 +581,98 @@ TEST(PullerUtilTest, MultipleRepeatedFields) {
                                     nonAdditiveArray3),
     };
 
-    // Expected event ordering after the sort:
-    // Event 3 {30, 20, 40}->21->{1, 2} (total size equal to event 1, merged with event 6)
-    // Event 6 {30, 20, 40}->22->{1, 2} (total size equal to event 1, merged with event 3)
-    // Event 1 {30, 20}->21->{1, 2, 3}
-    // Event 4 {30, 20}->21->{1, 2, 3} (merged with event 1)
-    // Event 5 {30, 20}->21->{1, 5, 3} (different repeated field, not merged)
-    // Event 2 {30, 3000}->21->{1, 2, 3} (different uid, not merged)
+    // Merged events keep the position of their first event.
 
     sp<MockUidMap> uidMap = makeMockUidMap();
     mapAndMergeIsolatedUidsToHostUid(data, uidMap, uidAtomTagId, secondAdditiveField);
 
     ASSERT_EQ(4, (int)data.size());
 
-    // Events 3 and 6 are merged. Not merged with event 1 because different repeated uids and
-    // fields, though length is same.
+    // Events 1 and 4 are merged.
     const vector<FieldValue>* actualFieldValues = &data[0]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
     EXPECT_EQ(hostUid, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostUid, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(3).mValue.int_value);
-    EXPECT_EQ(1, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(2, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(1, actualFieldValues->at(3).mValue.int_value);
+    EXPECT_EQ(2, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(3, actualFieldValues->at(5).mValue.int_value);
 
-    // Events 1 and 4 are merged.
+    // Event 2 isn't merged - different uid.
     actualFieldValues = &data[1]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(hostUid, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData + hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostUid2, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
     EXPECT_EQ(1, actualFieldValues->at(3).mValue.int_value);
     EXPECT_EQ(2, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(3, actualFieldValues->at(5).mValue.int_value);
 
-    // Event 5 isn't merged - different repeated field.
+    // Events 3 and 6 are merged. Not merged with event 1 because different repeated uids and
+    // fields, though length is same.
     actualFieldValues = &data[2]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
     EXPECT_EQ(hostUid, actualFieldValues->at(1).mValue.int_value);
-    EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
-    EXPECT_EQ(1, actualFieldValues->at(3).mValue.int_value);
-    EXPECT_EQ(5, actualFieldValues->at(4).mValue.int_value);
-    EXPECT_EQ(3, actualFieldValues->at(5).mValue.int_value);
+    EXPECT_EQ(hostUid, actualFieldValues->at(2).mValue.int_value);
+    EXPECT_EQ(hostAdditiveData + isolatedAdditiveData, actualFieldValues->at(3).mValue.int_value);
+    EXPECT_EQ(1, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(2, actualFieldValues->at(5).mValue.int_value);
 
-    // Event 2 isn't merged - different uid.
+    // Event 5 isn't merged - different repeated field.
     actualFieldValues = &data[3]->getValues();
     ASSERT_EQ(6, actualFieldValues->size());
     EXPECT_EQ(hostUid, actualFieldValues->at(0).mValue.int_value);
-    EXPECT_EQ(hostUid2, actualFieldValues->at(1).mValue.int_value);
+    EXPECT_EQ(hostUid, actualFieldValues->at(1).mValue.int_value);
     EXPECT_EQ(hostAdditiveData, actualFieldValues->at(2).mValue.int_value);
     EXPECT_EQ(1, actualFieldValues->at(3).mValue.int_value);
-    EXPECT_EQ(2, actualFieldValues->at(4).mValue.int_value);
+    EXPECT_EQ(5, actualFieldValues->at(4).mValue.int_value);
     EXPECT_EQ(3, actualFieldValues->at(5).mValue.int_value);
 }
 
+TEST(PullerUtilTest, MakePullAggregation) {
+    const PullAggregation aggregation = makePullAggregation({3, 1, 3}, {4, 1, 2});
+    EXPECT_THAT(aggregation.groupByFields, ElementsAre(1, 3));
+    EXPECT_THAT(aggregation.sumFields, ElementsAre(2, 4));
+}
+
+TEST(PullerUtilTest, PullAggregationCovers) {
+    const PullAggregation pulled = makePullAggregation({1, 2}, {3});
+    EXPECT_TRUE(pullAggregationCovers(std::nullopt, pulled));
+    EXPECT_TRUE(pullAggregationCovers(std::nullopt, std::nullopt));
+    EXPECT_FALSE(pullAggregationCovers(pulled, std::nullopt));
+    EXPECT_TRUE(pullAggregationCovers(pulled, pulled));
+    EXPECT_TRUE(pullAggregationCovers(pulled, makePullAggregation({1}, {2, 3})));
+    EXPECT_FALSE(pullAggregationCovers(pulled, makePullAggregation({1, 3}, {})));
+    EXPECT_FALSE(pullAggregationCovers(pulled, makePullAggregation({1}, {4})));
+}
+
+TEST(PullerUtilTest, MergePullAggregations) {
+    const PullAggregation a = makePullAggregation({1}, {3, 4});
+    const PullAggregation b = makePullAggregation({2, 4}, {3});
+    EXPECT_EQ(mergePullAggregations(a, b), makePullAggregation({1, 2, 4}, {3}));
+    EXPECT_EQ(mergePullAggregations(a, std::nullopt), std::nullopt);
+}
+
+TEST(PullerUtilTest, PullFieldMasks) {
+    TopLevelFieldMask fields12;
+    fields12.set(1);
+    fields12.set(2);
+    TopLevelFieldMask fields3;
+    fields3.set(3);
+    EXPECT_TRUE(pullFieldMaskCovers(std::nullopt, fields12));
+    EXPECT_FALSE(pullFieldMaskCovers(fields12, std::nullopt));
+    EXPECT_TRUE(pullFieldMaskCovers(fields12, fields12));
+    EXPECT_FALSE(pullFieldMaskCovers(fields12, fields3));
+
+    const std::optional<TopLevelFieldMask> merged = mergePullFieldMasks(fields12, fields3);
+    ASSERT_TRUE(merged);
+    EXPECT_TRUE(pullFieldMaskCovers(merged, fields12));
+    EXPECT_TRUE(pullFieldMaskCovers(merged, fields3));
+    EXPECT_THAT(getTopLevelFieldsInUse(*merged), ElementsAre(1, 2, 3));
+    EXPECT_EQ(mergePullFieldMasks(fields12, std::nullopt), std::nullopt);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -16,6 +16,7 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
 #include <vector>
 
 #include "gtest_matchers.h"
@@ -365,6 +366,115 @@ TEST(StatsdStatsTest, TestAtomLog) {
     EXPECT_TRUE(sensorAtomGood);
 }
 
+TEST(StatsdStatsTest, TestMatchersMatchedBatch) {
+    StatsdStats stats;
+    ConfigKey key(0, 12345);
+    stats.noteConfigReceived(key, 2, 3, 4, 5, {}, nullopt);
+
+    stats.noteMatchersMatched(key, {StringToId("matcher1"), StringToId("matcher2")});
+    stats.noteMatchersMatched(key, {StringToId("matcher1")});
+    stats.noteMatcherMatched(key, StringToId("matcher1"));
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ false);
+    ASSERT_EQ(1, report.config_stats_size());
+    const auto& configReport = report.config_stats(0);
+    ASSERT_EQ(2, configReport.matcher_stats_size());
+    for (const auto& matcherStats : configReport.matcher_stats()) {
+        if (matcherStats.id() == StringToId("matcher1")) {
+            EXPECT_EQ(3, matcherStats.matched_times());
+        } else {
+            EXPECT_EQ(StringToId("matcher2"), matcherStats.id());
+            EXPECT_EQ(1, matcherStats.matched_times());
+        }
+    }
+}
+
+TEST(StatsdStatsTest, TestProcessingCost) {
+    StatsdStats stats;
+    ConfigKey key(0, 12345);
+    stats.noteConfigReceived(key, 2, 3, 4, 5, {}, nullopt);
+
+    const int64_t metric1 = StringToId("metric1");
+    const int64_t metric2 = StringToId("metric2");
+    stats.noteEventProcessingCost(key, 100, 80, {{metric1, 30, 20}, {metric2, 10, 5}});
+    stats.noteEventProcessingCost(key, 200, 150, {{metric1, 50, 40}});
+    stats.notePulledDataProcessingCost(key, {metric2, 1000, 900});
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ true);
+    ASSERT_EQ(1, report.config_stats_size());
+    const auto& configReport = report.config_stats(0);
+    EXPECT_EQ(2, configReport.event_processing_cost().sample_count());
+    EXPECT_EQ(300, configReport.event_processing_cost().wall_time_ns());
+    EXPECT_EQ(230, configReport.event_processing_cost().cpu_time_ns());
+
+    ASSERT_EQ(2, configReport.metric_processing_cost_size());
+    for (const auto& metricCost : configReport.metric_processing_cost()) {
+        if (metricCost.metric_id() == metric1) {
+            EXPECT_EQ(2, metricCost.matched_event_cost().sample_count());
+            EXPECT_EQ(80, metricCost.matched_event_cost().wall_time_ns());
+            EXPECT_EQ(60, metricCost.matched_event_cost().cpu_time_ns());
+            EXPECT_FALSE(metricCost.has_pulled_data_cost());
+        } else {
+            EXPECT_EQ(metric2, metricCost.metric_id());
+            EXPECT_EQ(1, metricCost.matched_event_cost().sample_count());
+            EXPECT_EQ(1, metricCost.pulled_data_cost().sample_count());
+            EXPECT_EQ(1000, metricCost.pulled_data_cost().wall_time_ns());
+            EXPECT_EQ(900, metricCost.pulled_data_cost().cpu_time_ns());
+        }
+    }
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    ASSERT_EQ(1, report.config_stats_size());
+    EXPECT_FALSE(report.config_stats(0).has_event_processing_cost());
+    EXPECT_EQ(0, report.config_stats(0).metric_processing_cost_size());
+}
+
+TEST(StatsdStatsTest, TestEventsShed) {
+    StatsdStats stats;
+    ConfigKey key(0, 12345);
+    stats.noteConfigReceived(key, 2, 3, 4, 5, {}, nullopt);
+
+    stats.noteEventsShed(key, 9);
+    stats.noteEventsShed(key, 4);
+    // Not a known config.
+    stats.noteEventsShed(ConfigKey(0, 54321), 1);
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ true);
+    ASSERT_EQ(1, report.config_stats_size());
+    EXPECT_EQ(13, report.config_stats(0).shed_event_count());
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    ASSERT_EQ(1, report.config_stats_size());
+    EXPECT_FALSE(report.config_stats(0).has_shed_event_count());
+}
+
+TEST(StatsdStatsTest, TestAtomLogConcurrent) {
+    StatsdStats stats;
+    const int threadCount = 4;
+    const int logsPerThread = 1000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back([&stats, i] {
+            for (int j = 0; j < logsPerThread; j++) {
+                stats.noteAtomLogged(util::SENSOR_STATE_CHANGED, /*timeSec=*/0,
+                                     /*isSkipped=*/i == 0);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ true);
+    ASSERT_EQ(1, report.atom_stats_size());
+    EXPECT_EQ(util::SENSOR_STATE_CHANGED, report.atom_stats(0).tag());
+    EXPECT_EQ(threadCount * logsPerThread, report.atom_stats(0).count());
+    EXPECT_EQ(logsPerThread, report.atom_stats(0).skip_count());
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    EXPECT_EQ(0, report.atom_stats_size());
+}
+
 TEST(StatsdStatsTest, TestNonPlatformAtomLog) {
     StatsdStats stats;
     time_t now = time(nullptr);
@@ -419,6 +529,8 @@ TEST(StatsdStatsTest, TestPullAtomStats) {
     stats.notePullerNotFound(util::DISK_SPACE);
     stats.notePullTimeout(util::DISK_SPACE, 3000L, 6000L);
     stats.notePullTimeout(util::DISK_SPACE, 4000L, 7000L);
+    stats.notePullQueueDelay(util::DISK_SPACE, 100L);
+    stats.notePullQueueDelay(util::DISK_SPACE, 300L);
 
     StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ false);
     ASSERT_EQ(1, report.pulled_atom_stats_size());
@@ -443,6 +555,36 @@ TEST(StatsdStatsTest, TestPullAtomStats) {
             .pull_timeout_elapsed_millis());
     EXPECT_EQ(7000L, report.pulled_atom_stats(0).pull_atom_metadata(1)
             .pull_timeout_elapsed_millis());
+    EXPECT_EQ(200L, report.pulled_atom_stats(0).average_pull_queue_delay_nanos());
+    EXPECT_EQ(300L, report.pulled_atom_stats(0).max_pull_queue_delay_nanos());
+}
+
+TEST(StatsdStatsTest, TestPullTimeHistogramAndPenalty) {
+    StatsdStats stats;
+
+    stats.notePullTime(util::DISK_SPACE, MillisToNano(1));
+    stats.notePullTime(util::DISK_SPACE, MillisToNano(10));
+    stats.notePullTime(util::DISK_SPACE, MillisToNano(700));
+    stats.notePullTime(util::DISK_SPACE, MillisToNano(6000));
+    stats.noteSlowPullerCoolDownPenalty(util::DISK_SPACE, MillisToNano(400));
+    stats.noteSlowPullerCoolDownPenalty(util::DISK_SPACE, MillisToNano(800));
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ false);
+    ASSERT_EQ(1, report.pulled_atom_stats_size());
+    EXPECT_THAT(report.pulled_atom_stats(0).pull_time_histogram(),
+                ElementsAre(1, 1, 0, 0, 1, 0, 0, 1));
+    EXPECT_EQ(MillisToNano(800), report.pulled_atom_stats(0).cool_down_penalty_nanos());
+    EXPECT_EQ(2, report.pulled_atom_stats(0).slow_puller_penalty_count());
+
+    // Restoring the cool down keeps the penalty count.
+    stats.noteSlowPullerCoolDownPenalty(util::DISK_SPACE, /*penaltyNs=*/0);
+    report = getStatsdStatsReport(stats, /* reset stats */ true);
+    EXPECT_FALSE(report.pulled_atom_stats(0).has_cool_down_penalty_nanos());
+    EXPECT_EQ(2, report.pulled_atom_stats(0).slow_puller_penalty_count());
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    ASSERT_EQ(1, report.pulled_atom_stats_size());
+    EXPECT_EQ(0, report.pulled_atom_stats(0).pull_time_histogram_size());
 }
 
 TEST(StatsdStatsTest, TestAtomMetricsStats) {
@@ -1090,6 +1232,105 @@ TEST(StatsdStatsTest, TestSocketLossStatsOverflowCounter) {
     }
 }
 
+TEST(StatsdStatsTest, TestSocketReadBatchStats) {
+    StatsdStats stats;
+
+    stats.noteSocketReadBatch(1);
+    stats.noteSocketReadBatch(1);
+    stats.noteSocketReadBatch(8);
+    stats.noteSocketReadBatch(StatsdStats::kMaxSocketReadBatchSize + 10);
+    stats.noteSocketReadBatch(0);
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ true);
+
+    const auto& bins = report.socket_read_stats().batch_size_bins();
+    ASSERT_EQ(bins.size(), 3);
+    EXPECT_EQ(bins[0].batch_size(), 1);
+    EXPECT_EQ(bins[0].count(), 2);
+    EXPECT_EQ(bins[1].batch_size(), 8);
+    EXPECT_EQ(bins[1].count(), 1);
+    EXPECT_EQ(bins[2].batch_size(), StatsdStats::kMaxSocketReadBatchSize);
+    EXPECT_EQ(bins[2].count(), 1);
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    EXPECT_EQ(report.socket_read_stats().batch_size_bins_size(), 0);
+}
+
+TEST(StatsdStatsTest, TestSocketClassStats) {
+    StatsdStats stats;
+
+    stats.noteSocketClassRead(/*socketClass=*/0, 10);
+    stats.noteSocketClassRead(/*socketClass=*/0, 5);
+    stats.noteSocketClassLogLost(/*socketClass=*/0, 3);
+    stats.noteSocketClassRead(/*socketClass=*/1, 7);
+    stats.noteSocketClassRejected(/*socketClass=*/1);
+    stats.noteSocketClassRead(StatsdStats::kNumSocketClasses, 100);
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ true);
+
+    const auto& socketClassStats = report.socket_read_stats().socket_class_stats();
+    ASSERT_EQ(socketClassStats.size(), 2);
+    EXPECT_EQ(socketClassStats[0].socket_class(), 0);
+    EXPECT_EQ(socketClassStats[0].datagram_count(), 15);
+    EXPECT_EQ(socketClassStats[0].dropped_by_writers_count(), 3);
+    EXPECT_EQ(socketClassStats[0].rejected_count(), 0);
+    EXPECT_EQ(socketClassStats[1].socket_class(), 1);
+    EXPECT_EQ(socketClassStats[1].datagram_count(), 7);
+    EXPECT_EQ(socketClassStats[1].dropped_by_writers_count(), 0);
+    EXPECT_EQ(socketClassStats[1].rejected_count(), 1);
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    EXPECT_EQ(report.socket_read_stats().socket_class_stats_size(), 0);
+}
+
+TEST(StatsdStatsTest, TestEventLatencyStats) {
+    StatsdStats stats;
+
+    EXPECT_FALSE(stats.shouldTraceEventLatency());
+    stats.setEventLatencySampleInterval(2);
+    EXPECT_TRUE(stats.shouldTraceEventLatency() != stats.shouldTraceEventLatency());
+
+    stats.noteEventLatency(StatsdStats::EVENT_LATENCY_PARSE, 5 * NS_PER_SEC / 1000000);
+    stats.noteEventLatency(StatsdStats::EVENT_LATENCY_PARSE, 20 * NS_PER_SEC / 1000000);
+    stats.noteEventLatency(StatsdStats::EVENT_LATENCY_TOTAL, 10 * NS_PER_SEC);
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ true);
+
+    ASSERT_EQ(report.event_latency_stats_size(), 2);
+    const auto& parseStats = report.event_latency_stats(0);
+    EXPECT_EQ(parseStats.stage(), StatsdStats::EVENT_LATENCY_PARSE);
+    ASSERT_EQ(parseStats.histogram_size(), StatsdStats::kNumEventLatencyHistogramBins);
+    EXPECT_EQ(parseStats.histogram(0), 1);
+    EXPECT_EQ(parseStats.histogram(1), 1);
+    const auto& totalStats = report.event_latency_stats(1);
+    EXPECT_EQ(totalStats.stage(), StatsdStats::EVENT_LATENCY_TOTAL);
+    EXPECT_EQ(totalStats.histogram(StatsdStats::kNumEventLatencyHistogramBins - 1), 1);
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    EXPECT_EQ(report.event_latency_stats_size(), 0);
+}
+
+TEST(StatsdStatsTest, TestReportCompressionStats) {
+    StatsdStats stats;
+
+    stats.noteReportCompression(/*codec=*/1, /*uncompressedBytes=*/1000, /*storedBytes=*/250);
+    stats.noteReportCompression(/*codec=*/1, /*uncompressedBytes=*/2000, /*storedBytes=*/500);
+    stats.noteReportCompression(/*codec=*/1, /*uncompressedBytes=*/10, /*storedBytes=*/10);
+
+    StatsdStatsReport report = getStatsdStatsReport(stats, /* reset stats */ true);
+
+    ASSERT_EQ(report.report_compression_stats_size(), 1);
+    const auto& compressionStats = report.report_compression_stats(0);
+    EXPECT_EQ(compressionStats.codec(), 1);
+    EXPECT_EQ(compressionStats.report_count(), 3);
+    EXPECT_EQ(compressionStats.uncompressed_report_count(), 1);
+    EXPECT_EQ(compressionStats.uncompressed_bytes(), 3010);
+    EXPECT_EQ(compressionStats.stored_bytes(), 760);
+
+    report = getStatsdStatsReport(stats, /* reset stats */ false);
+    EXPECT_EQ(report.report_compression_stats_size(), 0);
+}
+
 TEST_P(StatsdStatsTest_GetAtomDimensionKeySizeLimit_InMap, TestGetAtomDimensionKeySizeLimits) {
     const auto& [atomId, defaultHardLimit] = GetParam();
     EXPECT_EQ(StatsdStats::getAtomDimensionKeySizeLimits(atomId, defaultHardLimit),
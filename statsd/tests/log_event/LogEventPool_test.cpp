@@ -0,0 +1,122 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/LogEventPool.h"
+
+#include <gtest/gtest.h>
+
+#include "stats_event.h"
+#include "tests/statsd_test_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+
+#ifdef __ANDROID__
+
+namespace {
+
+void parseEvent(int atomId, int64_t timestampNs, int numFields, LogEvent* logEvent) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, atomId);
+    AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+    for (int i = 0; i < numFields; i++) {
+        AStatsEvent_writeInt32(statsEvent, i);
+    }
+    parseStatsEventToLogEvent(statsEvent, logEvent);
+}
+
+}  // anonymous namespace
+
+TEST(LogEventPoolTest, TestObtainFromEmptyPool) {
+    LogEventPool pool(/*maxSize=*/10);
+    unique_ptr<LogEvent> event = pool.obtain(/*uid=*/100, /*pid=*/200);
+    ASSERT_NE(event, nullptr);
+    EXPECT_EQ(100, event->GetUid());
+    EXPECT_EQ(200, event->GetPid());
+    EXPECT_EQ(0, pool.size());
+}
+
+TEST(LogEventPoolTest, TestRecycledEventIsReset) {
+    LogEventPool pool(/*maxSize=*/10);
+    unique_ptr<LogEvent> event = pool.obtain(/*uid=*/100, /*pid=*/200);
+    parseEvent(/*atomId=*/10, /*timestampNs=*/1000, /*numFields=*/5, event.get());
+    ASSERT_EQ(5, event->size());
+    const LogEvent* recycledEvent = event.get();
+    const size_t valuesCapacity = event->getValues().capacity();
+
+    std::vector<unique_ptr<LogEvent>> events;
+    events.push_back(std::move(event));
+    pool.recycle(events);
+    EXPECT_TRUE(events.empty());
+    EXPECT_EQ(1, pool.size());
+
+    event = pool.obtain(/*uid=*/300, /*pid=*/400);
+    EXPECT_EQ(recycledEvent, event.get());
+    EXPECT_EQ(0, pool.size());
+    EXPECT_EQ(300, event->GetUid());
+    EXPECT_EQ(400, event->GetPid());
+    EXPECT_EQ(0, event->GetTagId());
+    EXPECT_EQ(0, event->size());
+    EXPECT_TRUE(event->isValid());
+    EXPECT_FALSE(event->isParsedHeaderOnly());
+    EXPECT_FALSE(event->hasAttributionChain());
+    EXPECT_EQ(std::nullopt, event->getExclusiveStateFieldIndex());
+    // The values storage is kept.
+    EXPECT_EQ(valuesCapacity, event->getValues().capacity());
+
+    parseEvent(/*atomId=*/11, /*timestampNs=*/2000, /*numFields=*/3, event.get());
+    EXPECT_TRUE(event->isValid());
+    EXPECT_EQ(11, event->GetTagId());
+    EXPECT_EQ(2000, event->GetElapsedTimestampNs());
+    EXPECT_EQ(3, event->size());
+}
+
+TEST(LogEventPoolTest, TestRecycleBeyondCapacity) {
+    LogEventPool pool(/*maxSize=*/2);
+    std::vector<unique_ptr<LogEvent>> events;
+    for (int i = 0; i < 5; i++) {
+        events.push_back(pool.obtain(/*uid=*/100, /*pid=*/200));
+    }
+    pool.recycle(events);
+    EXPECT_TRUE(events.empty());
+    EXPECT_EQ(2, pool.size());
+}
+
+TEST(LogEventPoolTest, TestTrim) {
+    LogEventPool pool(/*maxSize=*/4);
+    std::vector<unique_ptr<LogEvent>> events;
+    for (int i = 0; i < 3; i++) {
+        events.push_back(pool.obtain(/*uid=*/100, /*pid=*/200));
+    }
+    pool.recycle(events);
+    EXPECT_EQ(3, pool.size());
+
+    pool.trim();
+    EXPECT_EQ(0, pool.size());
+    // The pool is refilled by the next recycled events.
+    events.push_back(pool.obtain(/*uid=*/100, /*pid=*/200));
+    pool.recycle(events);
+    EXPECT_EQ(1, pool.size());
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
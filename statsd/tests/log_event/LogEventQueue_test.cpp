@@ -19,6 +19,7 @@
 #include <stdio.h>
 
 #include <thread>
+#include <vector>
 
 #include "stats_event.h"
 #include "tests/statsd_test_util.h"
@@ -106,6 +107,236 @@ TEST(LogEventQueue_test, TestSlowConsumer) {
     writer.join();
 }
 
+TEST(LogEventQueue_test, TestWaitPopBatch) {
+    for (const auto type : {LogEventQueue::Type::LOCKED, LogEventQueue::Type::LOCK_FREE}) {
+        LogEventQueue queue(50, type);
+        int64_t oldestEventNs;
+        for (int i = 0; i < 10; i++) {
+            EXPECT_TRUE(queue.push(makeLogEvent(i * 1000), &oldestEventNs));
+        }
+
+        auto events = queue.waitPopBatch(/*maxCount=*/4);
+        ASSERT_EQ(4, events.size());
+        for (int i = 0; i < 4; i++) {
+            EXPECT_EQ(i * 1000, events[i]->GetElapsedTimestampNs());
+        }
+
+        // Returns the remaining events without waiting for the batch to be full.
+        events = queue.waitPopBatch(/*maxCount=*/20);
+        ASSERT_EQ(6, events.size());
+        for (int i = 0; i < 6; i++) {
+            EXPECT_EQ((i + 4) * 1000, events[i]->GetElapsedTimestampNs());
+        }
+    }
+}
+
+TEST(LogEventQueue_test, TestWaitPopBatchBlocksUntilEvent) {
+    LogEventQueue queue(50);
+    std::thread writer([&queue] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        int64_t oldestEventNs;
+        EXPECT_TRUE(queue.push(makeLogEvent(100), &oldestEventNs));
+    });
+
+    auto events = queue.waitPopBatch(/*maxCount=*/10);
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(100, events[0]->GetElapsedTimestampNs());
+
+    writer.join();
+}
+
+TEST(LogEventQueue_test, TestLockFreeGoodConsumer) {
+    LogEventQueue queue(50, LogEventQueue::Type::LOCK_FREE);
+    int64_t timeBaseNs = 100;
+    std::thread writer([&queue, timeBaseNs] {
+        for (int i = 0; i < 100; i++) {
+            int64_t oldestEventNs;
+            bool success = queue.push(makeLogEvent(timeBaseNs + i * 1000), &oldestEventNs);
+            EXPECT_TRUE(success);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    std::thread reader([&queue, timeBaseNs] {
+        for (int i = 0; i < 100; i++) {
+            auto event = queue.waitPop();
+            EXPECT_TRUE(event != nullptr);
+            // All events are in right order.
+            EXPECT_EQ(timeBaseNs + i * 1000, event->GetElapsedTimestampNs());
+        }
+    });
+
+    reader.join();
+    writer.join();
+}
+
+TEST(LogEventQueue_test, TestLockFreeOverflow) {
+    LogEventQueue queue(5, LogEventQueue::Type::LOCK_FREE);
+    int64_t timeBaseNs = 100;
+    int64_t oldestEventNs = 0;
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(queue.push(makeLogEvent(timeBaseNs + i * 1000), &oldestEventNs));
+    }
+
+    EXPECT_FALSE(queue.push(makeLogEvent(timeBaseNs + 5 * 1000), &oldestEventNs));
+    EXPECT_EQ(timeBaseNs, oldestEventNs);
+
+    auto event = queue.waitPop();
+    EXPECT_EQ(timeBaseNs, event->GetElapsedTimestampNs());
+
+    // One slot is free again.
+    EXPECT_TRUE(queue.push(makeLogEvent(timeBaseNs + 6 * 1000), &oldestEventNs));
+    EXPECT_FALSE(queue.push(makeLogEvent(timeBaseNs + 7 * 1000), &oldestEventNs));
+    EXPECT_EQ(timeBaseNs + 1000, oldestEventNs);
+}
+
+TEST(LogEventQueue_test, TestLockFreeRingWrapAround) {
+    LogEventQueue queue(3, LogEventQueue::Type::LOCK_FREE);
+    int64_t oldestEventNs;
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(queue.push(makeLogEvent(i), &oldestEventNs));
+        EXPECT_TRUE(queue.push(makeLogEvent(i + 100), &oldestEventNs));
+        EXPECT_EQ(i, queue.waitPop()->GetElapsedTimestampNs());
+        EXPECT_EQ(i + 100, queue.waitPop()->GetElapsedTimestampNs());
+    }
+    EXPECT_EQ(20, queue.mEnqueuePos.load());
+    EXPECT_EQ(20, queue.mDequeuePos.load());
+}
+
+TEST(LogEventQueue_test, TestPriorityReservedSize) {
+    for (const LogEventQueue::Type type :
+         {LogEventQueue::Type::LOCKED, LogEventQueue::Type::LOCK_FREE}) {
+        LogEventQueue queue(7, type, /*reservedSize=*/2);
+        int64_t oldestEventNs = 0;
+
+        // Unused atoms can only fill 3 slots, used atoms 5 and critical ones all 7.
+        for (int i = 0; i < 3; i++) {
+            EXPECT_TRUE(queue.push(makeLogEvent(i), &oldestEventNs,
+                                   LogEventQueue::Priority::UNUSED));
+        }
+        EXPECT_FALSE(
+                queue.push(makeLogEvent(3), &oldestEventNs, LogEventQueue::Priority::UNUSED));
+        EXPECT_EQ(0, oldestEventNs);
+        for (int i = 3; i < 5; i++) {
+            EXPECT_TRUE(queue.push(makeLogEvent(i), &oldestEventNs,
+                                   LogEventQueue::Priority::NORMAL));
+        }
+        EXPECT_FALSE(
+                queue.push(makeLogEvent(5), &oldestEventNs, LogEventQueue::Priority::NORMAL));
+        for (int i = 5; i < 7; i++) {
+            EXPECT_TRUE(queue.push(makeLogEvent(i), &oldestEventNs,
+                                   LogEventQueue::Priority::CRITICAL));
+        }
+        EXPECT_FALSE(
+                queue.push(makeLogEvent(7), &oldestEventNs, LogEventQueue::Priority::CRITICAL));
+
+        // Popping makes room for critical events first.
+        EXPECT_EQ(0, queue.waitPop()->GetElapsedTimestampNs());
+        EXPECT_FALSE(
+                queue.push(makeLogEvent(8), &oldestEventNs, LogEventQueue::Priority::NORMAL));
+        EXPECT_TRUE(
+                queue.push(makeLogEvent(9), &oldestEventNs, LogEventQueue::Priority::CRITICAL));
+        for (int i = 1; i < 7; i++) {
+            EXPECT_EQ(i, queue.waitPop()->GetElapsedTimestampNs());
+        }
+        EXPECT_EQ(9, queue.waitPop()->GetElapsedTimestampNs());
+    }
+}
+
+TEST(LogEventQueue_test, TestAdaptiveCapacity) {
+    for (const LogEventQueue::Type type :
+         {LogEventQueue::Type::LOCKED, LogEventQueue::Type::LOCK_FREE}) {
+        LogEventQueue queue(8, type, /*reservedSize=*/0, /*minCapacity=*/2);
+        int64_t oldestEventNs = 0;
+        EXPECT_EQ(2, queue.getCapacity());
+
+        // A burst grows the capacity up to the max size.
+        for (int i = 0; i < 8; i++) {
+            EXPECT_TRUE(queue.push(makeLogEvent(i), &oldestEventNs));
+        }
+        EXPECT_FALSE(queue.push(makeLogEvent(8), &oldestEventNs));
+        EXPECT_EQ(0, oldestEventNs);
+        EXPECT_EQ(8, queue.getCapacity());
+        EXPECT_EQ(8, queue.waitPopBatch(8).size());
+
+        // The capacity is kept while the peak would not fit in half of it.
+        queue.updateCapacity(/*underMemoryPressure=*/false);
+        EXPECT_EQ(8, queue.getCapacity());
+        EXPECT_TRUE(queue.push(makeLogEvent(9), &oldestEventNs));
+        EXPECT_EQ(1, queue.waitPopBatch(8).size());
+        queue.updateCapacity(/*underMemoryPressure=*/false);
+        EXPECT_EQ(2, queue.getCapacity());
+
+        // No growth under memory pressure.
+        queue.updateCapacity(/*underMemoryPressure=*/true);
+        EXPECT_TRUE(queue.push(makeLogEvent(10), &oldestEventNs));
+        EXPECT_TRUE(queue.push(makeLogEvent(11), &oldestEventNs));
+        EXPECT_FALSE(queue.push(makeLogEvent(12), &oldestEventNs));
+        EXPECT_EQ(10, oldestEventNs);
+        EXPECT_EQ(2, queue.getCapacity());
+
+        queue.updateCapacity(/*underMemoryPressure=*/false);
+        EXPECT_TRUE(queue.push(makeLogEvent(13), &oldestEventNs));
+        EXPECT_EQ(4, queue.getCapacity());
+        EXPECT_EQ(3, queue.waitPopBatch(8).size());
+    }
+}
+
+TEST(LogEventQueue_test, TestCongestion) {
+    for (const LogEventQueue::Type type :
+         {LogEventQueue::Type::LOCKED, LogEventQueue::Type::LOCK_FREE}) {
+        LogEventQueue queue(8, type);
+        int64_t oldestEventNs;
+
+        for (int i = 0; i < 5; i++) {
+            EXPECT_TRUE(queue.push(makeLogEvent(i), &oldestEventNs));
+        }
+        EXPECT_FALSE(queue.isCongested());
+        EXPECT_TRUE(queue.push(makeLogEvent(5), &oldestEventNs));
+        EXPECT_TRUE(queue.isCongested());
+
+        // Congested until the queue drains down to a quarter.
+        EXPECT_EQ(3, queue.waitPopBatch(3).size());
+        EXPECT_TRUE(queue.isCongested());
+        EXPECT_EQ(1, queue.waitPopBatch(1).size());
+        EXPECT_FALSE(queue.isCongested());
+        EXPECT_EQ(2, queue.waitPopBatch(8).size());
+    }
+}
+
+TEST(LogEventQueue_test, TestLockFreeMultipleProducers) {
+    constexpr int kProducerCount = 4;
+    constexpr int kEventsPerProducer = 1000;
+    LogEventQueue queue(50, LogEventQueue::Type::LOCK_FREE);
+
+    std::vector<std::thread> writers;
+    for (int p = 0; p < kProducerCount; p++) {
+        writers.emplace_back([&queue, p] {
+            for (int i = 0; i < kEventsPerProducer; i++) {
+                int64_t oldestEventNs;
+                while (!queue.push(makeLogEvent(p * kEventsPerProducer + i), &oldestEventNs)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Events of each producer are received in order.
+    std::vector<int64_t> lastSeen(kProducerCount, -1);
+    for (int i = 0; i < kProducerCount * kEventsPerProducer; i++) {
+        auto event = queue.waitPop();
+        ASSERT_TRUE(event != nullptr);
+        const int64_t timestampNs = event->GetElapsedTimestampNs();
+        const int producer = timestampNs / kEventsPerProducer;
+        EXPECT_LT(lastSeen[producer], timestampNs);
+        lastSeen[producer] = timestampNs;
+    }
+
+    for (auto& writer : writers) {
+        writer.join();
+    }
+}
+
 #else
 GTEST_LOG_(INFO) << "This test does nothing.\n";
 #endif
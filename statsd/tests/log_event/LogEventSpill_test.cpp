@@ -0,0 +1,204 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/LogEventSpill.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace {
+
+const int64_t kMaxAgeNs = 1000;
+
+vector<uint8_t> makePayload(size_t size, uint8_t seed) {
+    vector<uint8_t> payload(size);
+    for (size_t i = 0; i < size; i++) {
+        payload[i] = seed + i;
+    }
+    return payload;
+}
+
+bool appendPayload(LogEventSpill* spill, const vector<uint8_t>& payload, int64_t nowNs) {
+    return spill->append(payload.data(), payload.size(), /*uid=*/payload[0], /*pid=*/2, nowNs);
+}
+
+// Replays every record, returning their payloads.
+vector<vector<uint8_t>> replayAll(LogEventSpill* spill, int64_t nowNs) {
+    vector<vector<uint8_t>> payloads;
+    EXPECT_TRUE(spill->replay(
+            nowNs,
+            [&payloads](const LogEventSpill::Record& record) {
+                payloads.emplace_back(record.payload, record.payload + record.size);
+                return true;
+            },
+            [](const LogEventSpill::Record&) { ADD_FAILURE() << "Unexpected expired record"; }));
+    return payloads;
+}
+
+}  // anonymous namespace
+
+TEST(LogEventSpillTest, TestAppendAndReplay) {
+    TemporaryFile file;
+    unique_ptr<LogEventSpill> spill = LogEventSpill::create(file.path);
+    ASSERT_NE(spill, nullptr);
+    EXPECT_FALSE(spill->isActive());
+
+    const vector<uint8_t> first = makePayload(10, 1);
+    const vector<uint8_t> second = makePayload(20, 50);
+    EXPECT_TRUE(appendPayload(spill.get(), first, /*nowNs=*/100));
+    EXPECT_TRUE(appendPayload(spill.get(), second, /*nowNs=*/200));
+    EXPECT_TRUE(spill->isActive());
+    EXPECT_GT(spill->getSpilledBytes(), first.size() + second.size());
+
+    vector<uint32_t> uids;
+    vector<int64_t> spillTimes;
+    vector<vector<uint8_t>> payloads;
+    EXPECT_TRUE(spill->replay(
+            /*nowNs=*/300,
+            [&](const LogEventSpill::Record& record) {
+                uids.push_back(record.uid);
+                spillTimes.push_back(record.spillTimeNs);
+                payloads.emplace_back(record.payload, record.payload + record.size);
+                EXPECT_EQ(record.pid, 2);
+                return true;
+            },
+            [](const LogEventSpill::Record&) { ADD_FAILURE() << "Unexpected expired record"; }));
+
+    EXPECT_EQ(payloads, vector<vector<uint8_t>>({first, second}));
+    EXPECT_EQ(uids, vector<uint32_t>({1, 50}));
+    EXPECT_EQ(spillTimes, vector<int64_t>({100, 200}));
+    EXPECT_FALSE(spill->isActive());
+    EXPECT_EQ(spill->getSpilledBytes(), 0);
+}
+
+TEST(LogEventSpillTest, TestCapacity) {
+    TemporaryFile file;
+    unique_ptr<LogEventSpill> spill = LogEventSpill::create(file.path, /*capacityBytes=*/100);
+    ASSERT_NE(spill, nullptr);
+
+    // Each record takes the payload and a 24 byte header.
+    EXPECT_TRUE(appendPayload(spill.get(), makePayload(26, 1), /*nowNs=*/100));
+    EXPECT_TRUE(appendPayload(spill.get(), makePayload(26, 2), /*nowNs=*/100));
+    EXPECT_FALSE(appendPayload(spill.get(), makePayload(1, 3), /*nowNs=*/100));
+    EXPECT_EQ(spill->getSpilledBytes(), 100);
+
+    // Larger than any socket datagram.
+    TemporaryFile largeFile;
+    unique_ptr<LogEventSpill> largeSpill = LogEventSpill::create(largeFile.path);
+    ASSERT_NE(largeSpill, nullptr);
+    EXPECT_FALSE(appendPayload(largeSpill.get(), makePayload(8 * 1024, 1), /*nowNs=*/100));
+    EXPECT_FALSE(largeSpill->isActive());
+}
+
+TEST(LogEventSpillTest, TestWrapAround) {
+    TemporaryFile file;
+    unique_ptr<LogEventSpill> spill = LogEventSpill::create(file.path, /*capacityBytes=*/100);
+    ASSERT_NE(spill, nullptr);
+
+    const vector<uint8_t> first = makePayload(20, 1);
+    const vector<uint8_t> second = makePayload(20, 10);
+    const vector<uint8_t> third = makePayload(20, 20);
+    EXPECT_TRUE(appendPayload(spill.get(), first, /*nowNs=*/100));
+    EXPECT_TRUE(appendPayload(spill.get(), second, /*nowNs=*/100));
+
+    // Replay only the first record.
+    EXPECT_FALSE(spill->replay(
+            /*nowNs=*/100, [](const LogEventSpill::Record& record) { return record.uid == 1; },
+            [](const LogEventSpill::Record&) {}));
+    EXPECT_TRUE(spill->isActive());
+    EXPECT_EQ(spill->mHead, 44);
+
+    // The payload of the third record wraps around the end of the ring.
+    EXPECT_TRUE(appendPayload(spill.get(), third, /*nowNs=*/100));
+    EXPECT_EQ(spill->mTail, 132);
+
+    EXPECT_EQ(replayAll(spill.get(), /*nowNs=*/100), vector<vector<uint8_t>>({second, third}));
+    EXPECT_EQ(spill->mHead, 0);
+    EXPECT_EQ(spill->mTail, 0);
+}
+
+TEST(LogEventSpillTest, TestStopReplay) {
+    TemporaryFile file;
+    unique_ptr<LogEventSpill> spill = LogEventSpill::create(file.path);
+    ASSERT_NE(spill, nullptr);
+
+    const vector<uint8_t> first = makePayload(10, 1);
+    const vector<uint8_t> second = makePayload(10, 2);
+    EXPECT_TRUE(appendPayload(spill.get(), first, /*nowNs=*/100));
+    EXPECT_TRUE(appendPayload(spill.get(), second, /*nowNs=*/100));
+
+    int calls = 0;
+    EXPECT_FALSE(spill->replay(
+            /*nowNs=*/100,
+            [&calls](const LogEventSpill::Record&) {
+                calls++;
+                return false;
+            },
+            [](const LogEventSpill::Record&) {}));
+    EXPECT_EQ(calls, 1);
+    EXPECT_TRUE(spill->isActive());
+
+    // The record that was refused is replayed again.
+    EXPECT_EQ(replayAll(spill.get(), /*nowNs=*/100), vector<vector<uint8_t>>({first, second}));
+}
+
+TEST(LogEventSpillTest, TestExpiredRecords) {
+    TemporaryFile file;
+    unique_ptr<LogEventSpill> spill = LogEventSpill::create(
+            file.path, LogEventSpill::kDefaultCapacityBytes, kMaxAgeNs);
+    ASSERT_NE(spill, nullptr);
+
+    const vector<uint8_t> old = makePayload(10, 1);
+    const vector<uint8_t> recent = makePayload(10, 2);
+    EXPECT_TRUE(appendPayload(spill.get(), old, /*nowNs=*/100));
+    EXPECT_TRUE(appendPayload(spill.get(), recent, /*nowNs=*/100 + kMaxAgeNs));
+
+    vector<vector<uint8_t>> replayed;
+    vector<vector<uint8_t>> expired;
+    EXPECT_TRUE(spill->replay(
+            /*nowNs=*/101 + kMaxAgeNs,
+            [&replayed](const LogEventSpill::Record& record) {
+                replayed.emplace_back(record.payload, record.payload + record.size);
+                return true;
+            },
+            [&expired](const LogEventSpill::Record& record) {
+                expired.emplace_back(record.payload, record.payload + record.size);
+            }));
+    EXPECT_EQ(replayed, vector<vector<uint8_t>>({recent}));
+    EXPECT_EQ(expired, vector<vector<uint8_t>>({old}));
+    EXPECT_FALSE(spill->isActive());
+}
+
+TEST(LogEventSpillTest, TestCreateFailure) {
+    EXPECT_EQ(LogEventSpill::create("/nonexistent/dir/events"), nullptr);
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,164 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logd/SequencedLogEventQueue.h"
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "stats_event.h"
+#include "tests/statsd_test_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+
+#ifdef __ANDROID__
+
+namespace {
+
+unique_ptr<LogEvent> makeLogEvent(int64_t timestampNs) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, 10);
+    AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+
+    unique_ptr<LogEvent> logEvent = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+    parseStatsEventToLogEvent(statsEvent, logEvent.get());
+    return logEvent;
+}
+
+}  // anonymous namespace
+
+TEST(SequencedLogEventQueueTest, TestEventsForwardedInSequenceOrder) {
+    std::shared_ptr<LogEventQueue> queue = std::make_shared<LogEventQueue>(10);
+    SequencedLogEventQueue sequencedQueue(queue, /*windowSize=*/4);
+
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ((uint64_t)i, sequencedQueue.acquireSequence());
+    }
+    sequencedQueue.push(2, makeLogEvent(1002), LogEventQueue::Priority::NORMAL);
+    sequencedQueue.push(1, makeLogEvent(1001), LogEventQueue::Priority::NORMAL);
+    // Nothing is forwarded before the event of sequence 0.
+    EXPECT_EQ(0, queue->getSize());
+
+    sequencedQueue.push(0, makeLogEvent(1000), LogEventQueue::Priority::NORMAL);
+    sequencedQueue.waitForDrained();
+    ASSERT_EQ(3, queue->getSize());
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(1000 + i, queue->waitPop()->GetElapsedTimestampNs());
+    }
+}
+
+TEST(SequencedLogEventQueueTest, TestIsolatedUidsHandledInSequenceOrder) {
+    std::shared_ptr<LogEventQueue> queue = std::make_shared<LogEventQueue>(10);
+    sp<UidMap> uidMap = new UidMap();
+    SequencedLogEventQueue sequencedQueue(queue, /*windowSize=*/4, uidMap);
+
+    const int hostUid = 1000;
+    const int isolatedUid = 99001;
+    for (int i = 0; i < 3; i++) {
+        sequencedQueue.acquireSequence();
+    }
+    // Uid events before and after the isolated uid is assigned, parsed before the assignment.
+    for (int sequence : {0, 2}) {
+        unique_ptr<LogEvent> event = std::make_unique<LogEvent>(/*uid=*/0, /*pid=*/0);
+        parseStatsEventToLogEvent(
+                makeUidStatsEvent(/*atomId=*/10, 1000 + sequence, isolatedUid, 1, 2), event.get());
+        sequencedQueue.push(sequence, std::move(event), LogEventQueue::Priority::NORMAL);
+    }
+    sequencedQueue.push(1, CreateIsolatedUidChangedEvent(1001, hostUid, isolatedUid, true),
+                        LogEventQueue::Priority::NORMAL);
+    sequencedQueue.waitForDrained();
+    EXPECT_EQ(hostUid, uidMap->getHostUidOrSelf(isolatedUid));
+
+    ASSERT_EQ(3, queue->getSize());
+    unique_ptr<LogEvent> event = queue->waitPop();
+    EXPECT_TRUE(event->areIsolatedUidsHandled());
+    EXPECT_EQ(isolatedUid, event->getValues()[0].mValue.int_value);
+    event = queue->waitPop();
+    EXPECT_TRUE(event->areIsolatedUidsHandled());
+    EXPECT_EQ(util::ISOLATED_UID_CHANGED, event->GetTagId());
+    event = queue->waitPop();
+    EXPECT_TRUE(event->areIsolatedUidsHandled());
+    EXPECT_EQ(hostUid, event->getValues()[0].mValue.int_value);
+}
+
+TEST(SequencedLogEventQueueTest, TestConcurrentPushes) {
+    const int eventCount = 1000;
+    std::shared_ptr<LogEventQueue> queue = std::make_shared<LogEventQueue>(eventCount);
+    SequencedLogEventQueue sequencedQueue(queue, /*windowSize=*/16);
+
+    // The window is smaller than the number of events, so acquiring blocks until the earliest
+    // events are pushed by the workers.
+    std::vector<std::thread> workers;
+    const int numWorkers = 4;
+    std::vector<std::vector<uint64_t>> sequences(numWorkers);
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    for (int w = 0; w < numWorkers; w++) {
+        workers.emplace_back([&, w] {
+            size_t next = 0;
+            while (true) {
+                uint64_t sequence;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&] { return done || next < sequences[w].size(); });
+                    if (next == sequences[w].size()) {
+                        return;
+                    }
+                    sequence = sequences[w][next++];
+                }
+                sequencedQueue.push(sequence, makeLogEvent(1000 + sequence),
+                                    LogEventQueue::Priority::NORMAL);
+            }
+        });
+    }
+    for (int i = 0; i < eventCount; i++) {
+        const uint64_t sequence = sequencedQueue.acquireSequence();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // Spread the events so that workers push them out of order.
+            sequences[(i * 7) % numWorkers].push_back(sequence);
+        }
+        cv.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cv.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    sequencedQueue.waitForDrained();
+
+    for (int i = 0; i < eventCount; i++) {
+        EXPECT_EQ(1000 + i, queue->waitPop()->GetElapsedTimestampNs());
+    }
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,89 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "matchers/AtomMatcherDispatchTable.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unordered_map;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace {
+
+vector<int> toVector(const AtomMatcherDispatchTable::Range& range) {
+    return vector<int>(range.begin(), range.end());
+}
+
+}  // anonymous namespace
+
+TEST(AtomMatcherDispatchTableTest, TestEmpty) {
+    AtomMatcherDispatchTable table;
+    table.build({});
+
+    EXPECT_TRUE(table.lookup(0).empty());
+    EXPECT_TRUE(table.lookup(10).empty());
+    EXPECT_TRUE(table.lookup(100000).empty());
+    EXPECT_TRUE(table.lookup(-1).empty());
+}
+
+TEST(AtomMatcherDispatchTableTest, TestDenseAndSparseAtoms) {
+    const unordered_map<int, vector<int>> tagIdsToMatchers = {
+            {10, {0, 3}},
+            {12, {1}},
+            {AtomMatcherDispatchTable::kMaxDenseAtomId - 1, {2}},
+            {AtomMatcherDispatchTable::kMaxDenseAtomId, {4, 5}},
+            {100000, {6}},
+            {-5, {7}},
+    };
+    AtomMatcherDispatchTable table;
+    table.build(tagIdsToMatchers);
+
+    for (const auto& [tagId, matchers] : tagIdsToMatchers) {
+        EXPECT_EQ(matchers, toVector(table.lookup(tagId))) << "tagId " << tagId;
+    }
+
+    EXPECT_TRUE(table.lookup(0).empty());
+    EXPECT_TRUE(table.lookup(11).empty());
+    EXPECT_TRUE(table.lookup(13).empty());
+    EXPECT_TRUE(table.lookup(AtomMatcherDispatchTable::kMaxDenseAtomId + 1).empty());
+    EXPECT_TRUE(table.lookup(99999).empty());
+    EXPECT_TRUE(table.lookup(-1).empty());
+}
+
+TEST(AtomMatcherDispatchTableTest, TestRebuild) {
+    AtomMatcherDispatchTable table;
+    table.build({{10, {0}}, {100000, {1}}});
+    table.build({{20, {2, 3}}});
+
+    EXPECT_TRUE(table.lookup(10).empty());
+    EXPECT_TRUE(table.lookup(100000).empty());
+    EXPECT_EQ(vector<int>({2, 3}), toVector(table.lookup(20)));
+    EXPECT_EQ(2u, table.lookup(20).size());
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,252 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "matchers/AtomMatcherProgram.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "src/metrics/parsing_utils/metrics_manager_util.h"
+#include "src/statsd_config.pb.h"
+#include "tests/statsd_test_util.h"
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace {
+
+AtomMatcher CreateCombinationAtomMatcher(const string& name, LogicalOperation operation,
+                                         const vector<int64_t>& matcherIds) {
+    AtomMatcher matcher;
+    matcher.set_id(StringToId(name));
+    AtomMatcher_Combination* combination = matcher.mutable_combination();
+    combination->set_operation(operation);
+    for (const int64_t matcherId : matcherIds) {
+        combination->add_matcher(matcherId);
+    }
+    return matcher;
+}
+
+// Combinations come before the matchers they reference, so they get the lower indices.
+StatsdConfig CreateConfig() {
+    StatsdConfig config;
+    *config.add_atom_matcher() = CreateCombinationAtomMatcher(
+            "ScreenOnOrNotWakelock", LogicalOperation::OR,
+            {StringToId("ScreenTurnedOn"), StringToId("NotWakelock")});
+    *config.add_atom_matcher() = CreateCombinationAtomMatcher(
+            "NotWakelock", LogicalOperation::NOT, {StringToId("AcquireWakelockOrScreenOff")});
+    *config.add_atom_matcher() = CreateCombinationAtomMatcher(
+            "AcquireWakelockOrScreenOff", LogicalOperation::OR,
+            {CreateAcquireWakelockAtomMatcher().id(), CreateScreenTurnedOffAtomMatcher().id()});
+    *config.add_atom_matcher() = CreateCombinationAtomMatcher(
+            "ScreenOnAndOff", LogicalOperation::AND,
+            {StringToId("ScreenTurnedOn"), CreateScreenTurnedOffAtomMatcher().id()});
+    *config.add_atom_matcher() = CreateScreenTurnedOnAtomMatcher();
+    *config.add_atom_matcher() = CreateScreenTurnedOffAtomMatcher();
+    *config.add_atom_matcher() = CreateAcquireWakelockAtomMatcher();
+    *config.add_atom_matcher() = CreateReleaseWakelockAtomMatcher();
+    return config;
+}
+
+}  // anonymous namespace
+
+TEST(AtomMatcherProgramTest, TestMatchesRecursiveEvaluation) {
+    const StatsdConfig config = CreateConfig();
+    sp<UidMap> uidMap = new UidMap();
+    unordered_map<int64_t, int> atomMatchingTrackerMap;
+    vector<sp<AtomMatchingTracker>> allAtomMatchingTrackers;
+    unordered_map<int, vector<int>> tagIdsToMatchers;
+    ASSERT_EQ(initAtomMatchingTrackers(config, uidMap, atomMatchingTrackerMap,
+                                       allAtomMatchingTrackers, tagIdsToMatchers),
+              nullopt);
+
+    AtomMatcherProgram program;
+    program.build(allAtomMatchingTrackers, tagIdsToMatchers);
+
+    vector<unique_ptr<LogEvent>> events;
+    events.push_back(CreateScreenStateChangedEvent(
+            1, android::view::DisplayStateEnum::DISPLAY_STATE_ON));
+    events.push_back(CreateScreenStateChangedEvent(
+            2, android::view::DisplayStateEnum::DISPLAY_STATE_OFF));
+    events.push_back(CreateScreenStateChangedEvent(
+            3, android::view::DisplayStateEnum::DISPLAY_STATE_DOZE));
+    events.push_back(CreateAcquireWakelockEvent(4, {111}, {"App1"}, "wl1"));
+    events.push_back(CreateReleaseWakelockEvent(5, {111}, {"App1"}, "wl1"));
+    events.push_back(CreateBatteryStateChangedEvent(
+            6, BatteryPluggedStateEnum::BATTERY_PLUGGED_USB));
+
+    const size_t matcherCount = allAtomMatchingTrackers.size();
+    for (const unique_ptr<LogEvent>& event : events) {
+        vector<MatchingState> expected(matcherCount, MatchingState::kNotComputed);
+        vector<MatchingState> actual(matcherCount, MatchingState::kNotComputed);
+        const auto it = tagIdsToMatchers.find(event->GetTagId());
+        if (it != tagIdsToMatchers.end()) {
+            for (const int matcherIndex : it->second) {
+                allAtomMatchingTrackers[matcherIndex]->onLogEvent(
+                        *event, allAtomMatchingTrackers, expected);
+            }
+        }
+        program.evaluate(*event, allAtomMatchingTrackers, actual);
+
+        // The recursive evaluation also computes uninterested children as not matched.
+        for (size_t i = 0; i < matcherCount; i++) {
+            if (expected[i] == MatchingState::kNotMatched &&
+                actual[i] == MatchingState::kNotComputed) {
+                expected[i] = MatchingState::kNotComputed;
+            }
+        }
+        EXPECT_EQ(expected, actual) << "tagId " << event->GetTagId();
+    }
+}
+
+TEST(AtomMatcherProgramTest, TestUninterestedChildren) {
+    const StatsdConfig config = CreateConfig();
+    sp<UidMap> uidMap = new UidMap();
+    unordered_map<int64_t, int> atomMatchingTrackerMap;
+    vector<sp<AtomMatchingTracker>> allAtomMatchingTrackers;
+    unordered_map<int, vector<int>> tagIdsToMatchers;
+    ASSERT_EQ(initAtomMatchingTrackers(config, uidMap, atomMatchingTrackerMap,
+                                       allAtomMatchingTrackers, tagIdsToMatchers),
+              nullopt);
+
+    AtomMatcherProgram program;
+    program.build(allAtomMatchingTrackers, tagIdsToMatchers);
+
+    // ScreenTurnedOff is not computed for a wakelock event, so AcquireWakelockOrScreenOff only
+    // depends on AcquireWakelock and ScreenOnAndOff is not computed at all.
+    unique_ptr<LogEvent> event = CreateReleaseWakelockEvent(1, {111}, {"App1"}, "wl1");
+    vector<MatchingState> results(allAtomMatchingTrackers.size(), MatchingState::kNotComputed);
+    program.evaluate(*event, allAtomMatchingTrackers, results);
+    EXPECT_EQ(MatchingState::kNotComputed,
+              results[atomMatchingTrackerMap[CreateScreenTurnedOffAtomMatcher().id()]]);
+    EXPECT_EQ(MatchingState::kNotMatched,
+              results[atomMatchingTrackerMap[StringToId("AcquireWakelockOrScreenOff")]]);
+    EXPECT_EQ(MatchingState::kMatched, results[atomMatchingTrackerMap[StringToId("NotWakelock")]]);
+    EXPECT_EQ(MatchingState::kMatched,
+              results[atomMatchingTrackerMap[StringToId("ScreenOnOrNotWakelock")]]);
+    EXPECT_EQ(MatchingState::kNotComputed,
+              results[atomMatchingTrackerMap[StringToId("ScreenOnAndOff")]]);
+
+    event = CreateScreenStateChangedEvent(2, android::view::DisplayStateEnum::DISPLAY_STATE_OFF);
+    results.assign(allAtomMatchingTrackers.size(), MatchingState::kNotComputed);
+    program.evaluate(*event, allAtomMatchingTrackers, results);
+    EXPECT_EQ(MatchingState::kNotComputed,
+              results[atomMatchingTrackerMap[CreateAcquireWakelockAtomMatcher().id()]]);
+    EXPECT_EQ(MatchingState::kMatched,
+              results[atomMatchingTrackerMap[StringToId("AcquireWakelockOrScreenOff")]]);
+    EXPECT_EQ(MatchingState::kNotMatched,
+              results[atomMatchingTrackerMap[StringToId("NotWakelock")]]);
+    EXPECT_EQ(MatchingState::kNotMatched,
+              results[atomMatchingTrackerMap[StringToId("ScreenOnOrNotWakelock")]]);
+    EXPECT_EQ(MatchingState::kNotMatched,
+              results[atomMatchingTrackerMap[StringToId("ScreenOnAndOff")]]);
+}
+
+TEST(AtomMatcherProgramTest, TestClear) {
+    const StatsdConfig config = CreateConfig();
+    sp<UidMap> uidMap = new UidMap();
+    unordered_map<int64_t, int> atomMatchingTrackerMap;
+    vector<sp<AtomMatchingTracker>> allAtomMatchingTrackers;
+    unordered_map<int, vector<int>> tagIdsToMatchers;
+    ASSERT_EQ(initAtomMatchingTrackers(config, uidMap, atomMatchingTrackerMap,
+                                       allAtomMatchingTrackers, tagIdsToMatchers),
+              nullopt);
+
+    AtomMatcherProgram program;
+    program.build(allAtomMatchingTrackers, tagIdsToMatchers);
+    program.clear();
+
+    unique_ptr<LogEvent> event =
+            CreateScreenStateChangedEvent(1, android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    vector<MatchingState> results(allAtomMatchingTrackers.size(), MatchingState::kNotComputed);
+    program.evaluate(*event, allAtomMatchingTrackers, results);
+    EXPECT_EQ(vector<MatchingState>(allAtomMatchingTrackers.size(), MatchingState::kNotComputed),
+              results);
+}
+
+TEST(AtomMatcherProgramTest, TestSharedResults) {
+    const StatsdConfig config1 = CreateConfig();
+    // Same contents as the ScreenTurnedOn matcher of config1, under another id.
+    StatsdConfig config2;
+    AtomMatcher screenOnMatcher = CreateScreenTurnedOnAtomMatcher();
+    screenOnMatcher.set_id(StringToId("OtherScreenTurnedOn"));
+    *config2.add_atom_matcher() = CreateBatterySaverModeStartAtomMatcher();
+    *config2.add_atom_matcher() = screenOnMatcher;
+
+    sp<UidMap> uidMap = new UidMap();
+    unordered_map<int64_t, int> atomMatchingTrackerMap1;
+    vector<sp<AtomMatchingTracker>> allAtomMatchingTrackers1;
+    unordered_map<int, vector<int>> tagIdsToMatchers1;
+    ASSERT_EQ(initAtomMatchingTrackers(config1, uidMap, atomMatchingTrackerMap1,
+                                       allAtomMatchingTrackers1, tagIdsToMatchers1),
+              nullopt);
+    unordered_map<int64_t, int> atomMatchingTrackerMap2;
+    vector<sp<AtomMatchingTracker>> allAtomMatchingTrackers2;
+    unordered_map<int, vector<int>> tagIdsToMatchers2;
+    ASSERT_EQ(initAtomMatchingTrackers(config2, uidMap, atomMatchingTrackerMap2,
+                                       allAtomMatchingTrackers2, tagIdsToMatchers2),
+              nullopt);
+
+    AtomMatcherProgram program1;
+    program1.build(allAtomMatchingTrackers1, tagIdsToMatchers1);
+    AtomMatcherProgram program2;
+    program2.build(allAtomMatchingTrackers2, tagIdsToMatchers2);
+    std::shared_ptr<SharedMatcherCache> cache = std::make_shared<SharedMatcherCache>();
+    AtomMatcherProgram::addSharedMatchers(allAtomMatchingTrackers1, *cache);
+    AtomMatcherProgram::addSharedMatchers(allAtomMatchingTrackers2, *cache);
+    program1.shareResults(allAtomMatchingTrackers1, cache);
+    program2.shareResults(allAtomMatchingTrackers2, cache);
+    // Only the screen on matcher is defined twice.
+    EXPECT_EQ(1u, cache->getSlotCount());
+    const int slot = cache->getSlot(*allAtomMatchingTrackers2[1]->getContentHash());
+    ASSERT_NE(SharedMatcherCache::kNoSlot, slot);
+
+    unique_ptr<LogEvent> event =
+            CreateScreenStateChangedEvent(1, android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    cache->beginEvent();
+    vector<MatchingState> results1(allAtomMatchingTrackers1.size(), MatchingState::kNotComputed);
+    program1.evaluate(*event, allAtomMatchingTrackers1, results1);
+    EXPECT_EQ(MatchingState::kMatched, cache->getResult(slot));
+
+    // The second config takes the result from the cache rather than evaluating the matcher.
+    cache->setResult(slot, MatchingState::kNotMatched);
+    vector<MatchingState> results2(allAtomMatchingTrackers2.size(), MatchingState::kNotComputed);
+    program2.evaluate(*event, allAtomMatchingTrackers2, results2);
+    EXPECT_EQ(MatchingState::kNotMatched,
+              results2[atomMatchingTrackerMap2[StringToId("OtherScreenTurnedOn")]]);
+
+    // The results are only kept for one event.
+    cache->beginEvent();
+    EXPECT_EQ(MatchingState::kNotComputed, cache->getResult(slot));
+    results2.assign(allAtomMatchingTrackers2.size(), MatchingState::kNotComputed);
+    program2.evaluate(*event, allAtomMatchingTrackers2, results2);
+    EXPECT_EQ(MatchingState::kMatched,
+              results2[atomMatchingTrackerMap2[StringToId("OtherScreenTurnedOn")]]);
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,128 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "matchers/WildcardPatternSet.h"
+
+#include <fnmatch.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace {
+
+bool fnmatchAny(const vector<string>& patterns, const string& str) {
+    for (const string& pattern : patterns) {
+        if (fnmatch(pattern.c_str(), str.c_str(), 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // anonymous namespace
+
+TEST(WildcardPatternSetTest, TestEmpty) {
+    WildcardPatternSet patterns;
+    EXPECT_FALSE(patterns.matchesAny(""));
+    EXPECT_FALSE(patterns.matchesAny("abc"));
+
+    WildcardPatternSet emptyPattern({""});
+    EXPECT_TRUE(emptyPattern.matchesAny(""));
+    EXPECT_FALSE(emptyPattern.matchesAny("a"));
+}
+
+TEST(WildcardPatternSetTest, TestMatchesAny) {
+    WildcardPatternSet patterns({"com.google.*", "*.test", "com.?ndroid.sh*ll"});
+    EXPECT_TRUE(patterns.matchesAny("com.google.android.gms"));
+    EXPECT_TRUE(patterns.matchesAny("com.google."));
+    EXPECT_TRUE(patterns.matchesAny("foo.test"));
+    EXPECT_TRUE(patterns.matchesAny("com.android.shell"));
+    EXPECT_TRUE(patterns.matchesAny("com.android.shll"));
+    EXPECT_FALSE(patterns.matchesAny("com.google"));
+    EXPECT_FALSE(patterns.matchesAny("foo.test2"));
+    EXPECT_FALSE(patterns.matchesAny("com.nndroid.shell.x"));
+}
+
+TEST(WildcardPatternSetTest, TestBracketsAndEscapes) {
+    WildcardPatternSet patterns({"[a-c]x", "[!0-9]y", "[]z]", "\\*\\?", "[\\]]w"});
+    EXPECT_TRUE(patterns.matchesAny("bx"));
+    EXPECT_FALSE(patterns.matchesAny("dx"));
+    EXPECT_TRUE(patterns.matchesAny("ay"));
+    EXPECT_FALSE(patterns.matchesAny("5y"));
+    EXPECT_TRUE(patterns.matchesAny("]"));
+    EXPECT_TRUE(patterns.matchesAny("z"));
+    EXPECT_TRUE(patterns.matchesAny("*?"));
+    EXPECT_FALSE(patterns.matchesAny("ab"));
+    EXPECT_TRUE(patterns.matchesAny("]w"));
+}
+
+TEST(WildcardPatternSetTest, TestFallbackPatterns) {
+    // Character classes, an unclosed bracket and a trailing backslash are left to fnmatch().
+    const vector<string> patternList = {"[[:digit:]]*", "[ab", "a\\", "x*"};
+    WildcardPatternSet patterns(patternList);
+    for (const string& str : {"1abc", "abc", "[ab", "a\\", "a", "xyz", ""}) {
+        EXPECT_EQ(fnmatchAny(patternList, str), patterns.matchesAny(str)) << str;
+    }
+}
+
+TEST(WildcardPatternSetTest, TestManyPatterns) {
+    // More states than fit in the bitmaps kept on the stack.
+    vector<string> patternList;
+    for (int i = 0; i < 300; i++) {
+        patternList.push_back("com.app" + std::to_string(i) + ".*");
+    }
+    WildcardPatternSet patterns(patternList);
+    EXPECT_TRUE(patterns.matchesAny("com.app0.main"));
+    EXPECT_TRUE(patterns.matchesAny("com.app299."));
+    EXPECT_FALSE(patterns.matchesAny("com.app300.main"));
+    EXPECT_FALSE(patterns.matchesAny("com.app1"));
+}
+
+TEST(WildcardPatternSetTest, TestSameAsFnmatch) {
+    const vector<string> patternList = {"*a*b?", "[!a]*", "?*?", "a**b", "*[b-a]*", "[-a]*-"};
+    WildcardPatternSet patterns(patternList);
+    const string alphabet = "ab-[]*";
+    // Every string of up to 4 characters of the alphabet.
+    vector<string> strs = {""};
+    for (size_t begin = 0, length = 0; length < 4; length++) {
+        const size_t end = strs.size();
+        for (size_t i = begin; i < end; i++) {
+            for (const char c : alphabet) {
+                strs.push_back(strs[i] + c);
+            }
+        }
+        begin = end;
+    }
+    for (const string& str : strs) {
+        EXPECT_EQ(fnmatchAny(patternList, str), patterns.matchesAny(str)) << str;
+    }
+}
+
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/metrics/AggregatedGaugeAtoms.h"
+
+#include <gtest/gtest.h>
+
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+std::shared_ptr<vector<FieldValue>> makeFields(int32_t value, const string& str) {
+    int pos[] = {1, 1, 1};
+    auto fields = std::make_shared<vector<FieldValue>>();
+    fields->emplace_back(Field(10, pos, 0), Value(value));
+    pos[0] = 2;
+    fields->emplace_back(Field(10, pos, 0), Value(str));
+    return fields;
+}
+
+}  // anonymous namespace
+
+TEST(AggregatedGaugeAtomsTest, TestDeduplicatesAtoms) {
+    vector<GaugeAtom> atoms;
+    atoms.emplace_back(makeFields(1, "a"), 10);
+    atoms.emplace_back(makeFields(2, "a"), 20);
+    atoms.emplace_back(makeFields(1, "a"), 30);
+    atoms.emplace_back(makeFields(3, "b"), 40);
+    atoms.emplace_back(makeFields(2, "a"), 50);
+
+    AggregatedGaugeAtoms aggregatedAtoms;
+    aggregatedAtoms.build(atoms);
+
+    // Distinct atoms keep the order of their first occurrence.
+    ASSERT_EQ(3UL, aggregatedAtoms.size());
+    ASSERT_EQ(2UL, aggregatedAtoms.getFieldCount(0));
+    EXPECT_EQ(1, aggregatedAtoms.getFields(0)[0].mValue.int_value);
+    EXPECT_EQ("a", aggregatedAtoms.getFields(0)[1].mValue.getString());
+    EXPECT_EQ(2, aggregatedAtoms.getFields(1)[0].mValue.int_value);
+    EXPECT_EQ(3, aggregatedAtoms.getFields(2)[0].mValue.int_value);
+    EXPECT_EQ("b", aggregatedAtoms.getFields(2)[1].mValue.getString());
+
+    // Timestamps are grouped by atom in the order they were recorded.
+    ASSERT_EQ(2UL, aggregatedAtoms.getTimestampCount(0));
+    EXPECT_EQ(10, aggregatedAtoms.getElapsedTimestampsNs(0)[0]);
+    EXPECT_EQ(30, aggregatedAtoms.getElapsedTimestampsNs(0)[1]);
+    ASSERT_EQ(2UL, aggregatedAtoms.getTimestampCount(1));
+    EXPECT_EQ(20, aggregatedAtoms.getElapsedTimestampsNs(1)[0]);
+    EXPECT_EQ(50, aggregatedAtoms.getElapsedTimestampsNs(1)[1]);
+    ASSERT_EQ(1UL, aggregatedAtoms.getTimestampCount(2));
+    EXPECT_EQ(40, aggregatedAtoms.getElapsedTimestampsNs(2)[0]);
+}
+
+TEST(AggregatedGaugeAtomsTest, TestSharesEqualStrings) {
+    vector<GaugeAtom> atoms;
+    atoms.emplace_back(makeFields(1, "some value"), 10);
+    atoms.emplace_back(makeFields(2, "some value"), 20);
+
+    AggregatedGaugeAtoms aggregatedAtoms;
+    aggregatedAtoms.build(atoms);
+    ASSERT_EQ(2UL, aggregatedAtoms.size());
+    EXPECT_EQ(aggregatedAtoms.getFields(0)[1].mValue.string_payload,
+              aggregatedAtoms.getFields(1)[1].mValue.string_payload);
+
+    // The columns do not depend on the atoms they were built from.
+    atoms.clear();
+    EXPECT_EQ("some value", aggregatedAtoms.getFields(1)[1].mValue.getString());
+}
+
+TEST(AggregatedGaugeAtomsTest, TestRebuild) {
+    vector<GaugeAtom> atoms;
+    atoms.emplace_back(makeFields(1, "a"), 10);
+
+    AggregatedGaugeAtoms aggregatedAtoms;
+    aggregatedAtoms.build(atoms);
+    ASSERT_EQ(1UL, aggregatedAtoms.size());
+    EXPECT_GT(aggregatedAtoms.byteSize(), 0UL);
+
+    aggregatedAtoms.build({});
+    EXPECT_TRUE(aggregatedAtoms.empty());
+    EXPECT_EQ(0UL, aggregatedAtoms.byteSize());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
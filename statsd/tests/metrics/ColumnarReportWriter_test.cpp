@@ -0,0 +1,119 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/ColumnarReportWriter.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "src/stats_log.pb.h"
+#include "tests/statsd_test_util.h"
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_BOOL;
+using android::util::FIELD_TYPE_INT32;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+ColumnarMetricData toColumnarMetricData(ProtoOutputStream* output) {
+    vector<uint8_t> bytes;
+    output->serializeToVector(&bytes);
+    ColumnarMetricData data;
+    EXPECT_TRUE(data.ParseFromArray(bytes.data(), bytes.size()));
+    return data;
+}
+
+}  // namespace
+
+TEST(ColumnarReportWriterTest, TestWriteColumns) {
+    ProtoOutputStream output;
+    ColumnarReportWriter writer(/*timeBaseNs=*/10 * NS_PER_SEC, /*writeConditionTrueNs=*/true);
+
+    writer.addDimension(
+            [](ProtoOutputStream* output) {
+                uint64_t token =
+                        output->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | 4 /* leaf */);
+                output->write(FIELD_TYPE_INT32 | 1 /* field */, 1);
+                output->write(FIELD_TYPE_INT32 | 3 /* value_int */, 111);
+                output->end(token);
+            },
+            &output);
+    writer.addRow(10 * NS_PER_SEC, 20 * NS_PER_SEC, /*value=*/3, /*conditionTrueNs=*/5);
+    writer.addRow(20 * NS_PER_SEC, 25 * NS_PER_SEC, /*value=*/4, /*conditionTrueNs=*/6);
+
+    writer.addDimension(
+            [](ProtoOutputStream* output) {
+                output->write(FIELD_TYPE_BOOL | 7 /* is_heavy_hitter_overflow */, true);
+            },
+            &output);
+    writer.addRow(10 * NS_PER_SEC, 20 * NS_PER_SEC, /*value=*/7, /*conditionTrueNs=*/8);
+    // Restored from a previous statsd process, before the time base.
+    writer.addRow(5 * NS_PER_SEC, 8 * NS_PER_SEC, /*value=*/9, /*conditionTrueNs=*/10);
+    writer.writeColumns(&output);
+
+    const ColumnarMetricData data = toColumnarMetricData(&output);
+    ASSERT_EQ(2, data.dimension_size());
+    ASSERT_EQ(1, data.dimension(0).dimension_leaf_values_in_what_size());
+    EXPECT_EQ(111, data.dimension(0).dimension_leaf_values_in_what(0).value_int());
+    EXPECT_FALSE(data.dimension(0).is_heavy_hitter_overflow());
+    EXPECT_TRUE(data.dimension(1).is_heavy_hitter_overflow());
+    EXPECT_EQ(vector<int32_t>({2, 2}), vector<int32_t>(data.dimension_row_count().begin(),
+                                                        data.dimension_row_count().end()));
+
+    // The buckets [5s, 8s], [10s, 20s] and [20s, 25s].
+    EXPECT_EQ(vector<int64_t>({-5000, 2000, 0}),
+              vector<int64_t>(data.bucket_start_delta_millis().begin(),
+                              data.bucket_start_delta_millis().end()));
+    EXPECT_EQ(vector<int64_t>({3000, 10000, 5000}),
+              vector<int64_t>(data.bucket_length_millis().begin(),
+                              data.bucket_length_millis().end()));
+
+    EXPECT_EQ(vector<int32_t>({1, 2, 1, 0}),
+              vector<int32_t>(data.bucket_index().begin(), data.bucket_index().end()));
+    EXPECT_EQ(vector<int64_t>({3, 4, 7, 9}),
+              vector<int64_t>(data.value().begin(), data.value().end()));
+    EXPECT_EQ(vector<int64_t>({5, 6, 8, 10}), vector<int64_t>(data.condition_true_nanos().begin(),
+                                                              data.condition_true_nanos().end()));
+}
+
+TEST(ColumnarReportWriterTest, TestNoConditionTrueNs) {
+    ProtoOutputStream output;
+    ColumnarReportWriter writer(/*timeBaseNs=*/0, /*writeConditionTrueNs=*/false);
+    writer.addDimension([](ProtoOutputStream*) {}, &output);
+    writer.addRow(0, 10 * NS_PER_SEC, /*value=*/1, /*conditionTrueNs=*/0);
+    writer.writeColumns(&output);
+
+    const ColumnarMetricData data = toColumnarMetricData(&output);
+    ASSERT_EQ(1, data.dimension_size());
+    ASSERT_EQ(1, data.value_size());
+    EXPECT_EQ(1, data.value(0));
+    EXPECT_EQ(0, data.condition_true_nanos_size());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
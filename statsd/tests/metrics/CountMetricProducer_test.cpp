@@ -19,6 +19,7 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <map>
 #include <vector>
 
 #include "metrics_test_helper.h"
@@ -114,9 +115,8 @@ TEST(CountMetricProducerTest, TestNonDimensionalEvents) {
     // Flushes.
     countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    const auto& buckets = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(1UL, buckets.size());
     EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
     EXPECT_EQ(bucketStartTimeNs + bucketSizeNs, buckets[0].mBucketEndNs);
@@ -130,10 +130,10 @@ TEST(CountMetricProducerTest, TestNonDimensionalEvents) {
 
     countProducer.flushIfNeededLocked(bucketStartTimeNs + 2 * bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    ASSERT_EQ(2UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    const auto& bucketInfo2 = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][1];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    ASSERT_EQ(2UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
+    const CountBucket bucketInfo2 =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY)[1];
     EXPECT_EQ(bucket2StartTimeNs, bucketInfo2.mBucketStartNs);
     EXPECT_EQ(bucket2StartTimeNs + bucketSizeNs, bucketInfo2.mBucketEndNs);
     EXPECT_EQ(1LL, bucketInfo2.mCount);
@@ -141,12 +141,67 @@ TEST(CountMetricProducerTest, TestNonDimensionalEvents) {
     // nothing happens in bucket 3. we should not record anything for bucket 3.
     countProducer.flushIfNeededLocked(bucketStartTimeNs + 3 * bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    const auto& buckets3 = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    const auto& buckets3 = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(2UL, buckets3.size());
 }
 
+TEST(CountMetricProducerTest, TestEventCountAnnotation) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+
+    // An event aggregated from 5 events by the client, then a plain one.
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, tagId);
+    AStatsEvent_addInt32Annotation(statsEvent, ASTATSLOG_ANNOTATION_ID_EVENT_COUNT, 5);
+    AStatsEvent_overwriteTimestamp(statsEvent, bucketStartTimeNs + 1);
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    parseStatsEventToLogEvent(statsEvent, &event1);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event2, bucketStartTimeNs + 2, tagId);
+
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event1);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
+
+    countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, buckets.size());
+    EXPECT_EQ(6LL, buckets[0].mCount);
+}
+
+TEST(CountMetricProducerTest, TestCurrentBucketByteSize) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    const size_t emptySize = countProducer.currentBucketByteSize();
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event, bucketStartTimeNs + 1, tagId);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+
+    // The counter of the event is held by the current bucket, not by a past bucket.
+    EXPECT_GT(countProducer.currentBucketByteSize(), emptySize);
+    EXPECT_EQ(0UL, countProducer.byteSize());
+}
+
 TEST(CountMetricProducerTest, TestEventsWithNonSlicedCondition) {
     int64_t bucketStartTimeNs = 10000000000;
     int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
@@ -182,10 +237,9 @@ TEST(CountMetricProducerTest, TestEventsWithNonSlicedCondition) {
 
     countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
 
-    const auto& buckets = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(1UL, buckets.size());
     const auto& bucketInfo = buckets[0];
     EXPECT_EQ(bucketStartTimeNs, bucketInfo.mBucketStartNs);
@@ -240,9 +294,8 @@ TEST(CountMetricProducerTest, TestEventsWithSlicedCondition) {
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
     countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
     ASSERT_EQ(1UL, countProducer.mPastBuckets.size());
-    EXPECT_TRUE(countProducer.mPastBuckets.find(DEFAULT_METRIC_DIMENSION_KEY) !=
-                countProducer.mPastBuckets.end());
-    const auto& buckets = countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY];
+    EXPECT_TRUE(countProducer.mPastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    const auto& buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
     ASSERT_EQ(1UL, buckets.size());
     const auto& bucketInfo = buckets[0];
     EXPECT_EQ(bucketStartTimeNs, bucketInfo.mBucketStartNs);
@@ -293,11 +346,11 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket) {
             countProducer.onStatsdInitCompleted(eventTimeNs);
             break;
     }
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ(bucketStartTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketStartNs);
-    EXPECT_EQ(eventTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketEndNs);
+    const vector<CountBucket> buckets =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, buckets.size());
+    EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
+    EXPECT_EQ(eventTimeNs, buckets[0].mBucketEndNs);
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(eventTimeNs, countProducer.mCurrentBucketStartTimeNs);
     // Anomaly tracker only contains full buckets.
@@ -308,7 +361,7 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket) {
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event2, bucketStartTimeNs + 59 * NS_PER_SEC + 10, tagId, /*uid=*/"222");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(1UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(eventTimeNs, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(0, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -317,7 +370,7 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInCurrentBucket) {
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event3, bucketStartTimeNs + 62 * NS_PER_SEC + 10, tagId, /*uid=*/"333");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event3);
-    ASSERT_EQ(2UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(2UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(lastEndTimeNs, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(1, countProducer.getCurrentBucketNum());
     EXPECT_EQ(2, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -358,28 +411,27 @@ TEST_P(CountMetricProducerTest_PartialBucket, TestSplitInNextBucket) {
             countProducer.onStatsdInitCompleted(eventTimeNs);
             break;
     }
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ(bucketStartTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketStartNs);
-    EXPECT_EQ(bucketStartTimeNs + bucketSizeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketEndNs);
+    vector<CountBucket> buckets =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, buckets.size());
+    EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + bucketSizeNs, buckets[0].mBucketEndNs);
     EXPECT_EQ(eventTimeNs, countProducer.mCurrentBucketStartTimeNs);
 
     // Next event occurs in same bucket as partial bucket created.
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event2, bucketStartTimeNs + 70 * NS_PER_SEC + 10, tagId, /*uid=*/"222");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(1UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
 
     // Third event in following bucket.
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event3, bucketStartTimeNs + 121 * NS_PER_SEC + 10, tagId, /*uid=*/"333");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event3);
-    ASSERT_EQ(2UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ((int64_t)eventTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][1].mBucketStartNs);
-    EXPECT_EQ(bucketStartTimeNs + 2 * bucketSizeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][1].mBucketEndNs);
+    buckets = countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(2UL, buckets.size());
+    EXPECT_EQ((int64_t)eventTimeNs, buckets[1].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + 2 * bucketSizeNs, buckets[1].mBucketEndNs);
 }
 
 TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
@@ -416,7 +468,7 @@ TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
     // Check that there's a past bucket and the bucket end is not adjusted.
     countProducer.notifyAppUpgrade(eventTimeNs);
 
-    ASSERT_EQ(0UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(0UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(bucketStartTimeNs, countProducer.mCurrentBucketStartTimeNs);
     // Anomaly tracker only contains full buckets.
@@ -427,7 +479,7 @@ TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
     LogEvent event2(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event2, eventTimeNs + 10 * NS_PER_SEC, tagId, /*uid=*/"222");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
-    ASSERT_EQ(0UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    ASSERT_EQ(0UL, countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).size());
     EXPECT_EQ(bucketStartTimeNs, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(0, countProducer.getCurrentBucketNum());
     EXPECT_EQ(0, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -436,12 +488,12 @@ TEST(CountMetricProducerTest, TestSplitOnAppUpgradeDisabled) {
     LogEvent event3(/*uid=*/0, /*pid=*/0);
     makeLogEvent(&event3, bucketStartTimeNs + 62 * NS_PER_SEC + 10, tagId, /*uid=*/"333");
     countProducer.onMatchedLogEvent(1 /*log matcher index*/, event3);
-    ASSERT_EQ(1UL, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
-    EXPECT_EQ(bucketStartTimeNs,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketStartNs);
-    EXPECT_EQ(bucketStartTimeNs + 60 * NS_PER_SEC,
-              countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mBucketEndNs);
-    EXPECT_EQ(2, countProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY][0].mCount);
+    const vector<CountBucket> buckets =
+            countProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, buckets.size());
+    EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
+    EXPECT_EQ(bucketStartTimeNs + 60 * NS_PER_SEC, buckets[0].mBucketEndNs);
+    EXPECT_EQ(2, buckets[0].mCount);
     EXPECT_EQ(bucketStartTimeNs + 60 * NS_PER_SEC, countProducer.mCurrentBucketStartTimeNs);
     EXPECT_EQ(1, countProducer.getCurrentBucketNum());
     EXPECT_EQ(2, anomalyTracker->getSumOverPastBuckets(DEFAULT_METRIC_DIMENSION_KEY));
@@ -541,6 +593,421 @@ TEST(CountMetricProducerTest, TestOneWeekTimeUnit) {
     EXPECT_EQ(fiveWeeksOneDayNs, countProducer.getCurrentBucketEndTimeNs());
 }
 
+TEST(CountMetricProducerTest, TestBucketCheckpointRestored) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    metadata::BucketCheckpoint checkpoint;
+    EXPECT_FALSE(countProducer.writeBucketCheckpoint(&checkpoint));
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event1, bucketStartTimeNs + 1, tagId);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event2, bucketStartTimeNs + 2, tagId);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event1);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event2);
+    ASSERT_TRUE(countProducer.writeBucketCheckpoint(&checkpoint));
+    EXPECT_EQ(bucketStartTimeNs, checkpoint.bucket_start_elapsed_ns());
+
+    // The next statsd process starts halfway through the bucket.
+    const int64_t checkpointNs = bucketStartTimeNs + bucketSizeNs / 2;
+    const int64_t restartTimeNs = checkpointNs + 5 * NS_PER_SEC;
+    CountMetricProducer restartedProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                          wizard, protoHash, restartTimeNs, restartTimeNs);
+    restartedProducer.restoreBucketCheckpoint(checkpoint, checkpointNs);
+    ASSERT_EQ(1UL, restartedProducer.mPastBuckets.size());
+    const auto& buckets = restartedProducer.mPastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, buckets.size());
+    EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
+    EXPECT_EQ(checkpointNs, buckets[0].mBucketEndNs);
+    EXPECT_EQ(2LL, buckets[0].mCount);
+    EXPECT_TRUE(restartedProducer.mCurrentSlicedCounter->empty());
+
+    // The checkpoint of a changed metric is not restored.
+    CountMetricProducer changedProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                        wizard, protoHash + 1, restartTimeNs, restartTimeNs);
+    changedProducer.restoreBucketCheckpoint(checkpoint, checkpointNs);
+    EXPECT_TRUE(changedProducer.mPastBuckets.empty());
+
+    // Nor a checkpoint overlapping the current bucket.
+    CountMetricProducer overlappingProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/,
+                                            {}, wizard, protoHash, bucketStartTimeNs,
+                                            bucketStartTimeNs);
+    overlappingProducer.restoreBucketCheckpoint(checkpoint, checkpointNs);
+    EXPECT_TRUE(overlappingProducer.mPastBuckets.empty());
+}
+
+TEST(CountMetricProducerTest, TestHeavyHittersPastDimensionLimit) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+    metric.set_heavy_hitter_capacity(2);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+
+    auto logValue = [&](int value) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        CreateRepeatedValueLogEvent(&event, tagId, bucketStartTimeNs + 1, value);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    };
+    // Fill the dimension limit.
+    for (int value = 0; value < StatsdStats::kDimensionKeySizeHardLimitMin; value++) {
+        logValue(value);
+    }
+    // 1001 replaces 1002 in the summary, and inherits its count as error.
+    for (int i = 0; i < 5; i++) {
+        logValue(1000);
+    }
+    logValue(1002);
+    logValue(1001);
+
+    countProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
+    unordered_map<int, int64_t> counts;
+    countProducer.mPastBuckets.forEach(
+            [&](const MetricDimensionKey& key, const vector<CountBucket>& buckets) {
+                ASSERT_EQ(1UL, buckets.size());
+                counts[key.getDimensionKeyInWhat().getValues()[0].mValue.int_value] =
+                        buckets[0].mCount;
+            });
+    EXPECT_EQ(static_cast<size_t>(StatsdStats::kDimensionKeySizeHardLimitMin + 2), counts.size());
+    EXPECT_EQ(5, counts[1000]);
+    EXPECT_EQ(1, counts[1001]);
+    EXPECT_EQ(0UL, counts.count(1002));
+
+    const vector<CountBucket> overflowBuckets =
+            countProducer.mPastOverflowBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(1UL, overflowBuckets.size());
+    EXPECT_EQ(1, overflowBuckets[0].mCount);
+    EXPECT_TRUE(countProducer.mHeavyHitters.empty());
+}
+
+TEST(CountMetricProducerTest, TestRepeatedDumpsWithoutErasingData) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+
+    auto logUid = [&](int64_t timestampNs, const string& uid) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeLogEvent(&event, timestampNs, tagId, uid);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    };
+    auto dump = [&](int64_t dumpTimeNs, bool eraseData, set<string>* strSet) {
+        ProtoOutputStream output;
+        countProducer.onDumpReport(dumpTimeNs, false /*include current partial bucket*/,
+                                   eraseData, FAST, strSet, &output);
+        vector<uint8_t> bytes;
+        output.serializeToVector(&bytes);
+        return bytes;
+    };
+
+    logUid(bucketStartTimeNs + 1, "111");
+    logUid(bucketStartTimeNs + 2, "222");
+    logUid(bucketStartTimeNs + bucketSizeNs + 1, "111");
+    const int64_t firstDumpTimeNs = bucketStartTimeNs + bucketSizeNs + 2;
+    set<string> strSet;
+    const vector<uint8_t> firstDump = dump(firstDumpTimeNs, false, &strSet);
+    EXPECT_EQ(firstDump, dump(firstDumpTimeNs, false, &strSet));
+    ASSERT_EQ(2UL, countProducer.mPastBuckets.size());
+
+    // The cached strings are reported again.
+    set<string> secondStrSet;
+    EXPECT_EQ(firstDump, dump(firstDumpTimeNs, false, &secondStrSet));
+    EXPECT_EQ(strSet, secondStrSet);
+
+    // Dumps without hashing the strings do not reuse the hashed dimensions.
+    ProtoOutputStream unhashedOutput;
+    countProducer.onDumpReport(firstDumpTimeNs, false /*include current partial bucket*/,
+                               false /*erase data*/, FAST, nullptr, &unhashedOutput);
+    StatsLogReport unhashedReport = outputStreamToProto(&unhashedOutput);
+    ASSERT_EQ(2, unhashedReport.count_metrics().data_size());
+    EXPECT_EQ("111",
+              unhashedReport.count_metrics().data(0).dimension_leaf_values_in_what(0).value_str());
+
+    // The next non-erasing dump appends the new buckets, and matches an erasing dump.
+    logUid(bucketStartTimeNs + 2 * bucketSizeNs + 1, "333");
+    const int64_t secondDumpTimeNs = bucketStartTimeNs + 3 * bucketSizeNs + 1;
+    set<string> nonErasingStrSet;
+    const vector<uint8_t> nonErasingDump = dump(secondDumpTimeNs, false, &nonErasingStrSet);
+    set<string> erasingStrSet;
+    EXPECT_EQ(nonErasingDump, dump(secondDumpTimeNs, true, &erasingStrSet));
+    EXPECT_EQ(erasingStrSet, nonErasingStrSet);
+    EXPECT_TRUE(countProducer.mPastBucketsProtoCache.empty());
+
+    StatsLogReport report;
+    ASSERT_TRUE(report.ParseFromArray(nonErasingDump.data(), nonErasingDump.size()));
+    ASSERT_EQ(3, report.count_metrics().data_size());
+    ASSERT_EQ(2, report.count_metrics().data(0).bucket_info_size());
+    EXPECT_EQ(1, report.count_metrics().data(0).bucket_info(0).count());
+    EXPECT_EQ(1, report.count_metrics().data(0).bucket_info(1).count());
+}
+
+TEST(CountMetricProducerTest, TestSnapshotCurrentBucket) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event, bucketStartTimeNs + 1, tagId);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+
+    // The snapshot reports the current bucket so far, without closing it.
+    const int64_t dumpTimeNs = bucketStartTimeNs + bucketSizeNs / 2;
+    for (int i = 0; i < 2; i++) {
+        ProtoOutputStream output;
+        countProducer.onDumpReport(dumpTimeNs, true /*include current partial bucket*/,
+                                   false /*erase data*/, SNAPSHOT, nullptr, &output);
+        StatsLogReport report = outputStreamToProto(&output);
+        ASSERT_EQ(1, report.count_metrics().data_size());
+        ASSERT_EQ(1, report.count_metrics().data(0).bucket_info_size());
+        const CountBucketInfo& bucketInfo = report.count_metrics().data(0).bucket_info(0);
+        EXPECT_EQ(2, bucketInfo.count());
+        EXPECT_EQ(NanoToMillis(bucketStartTimeNs), bucketInfo.start_bucket_elapsed_millis());
+        EXPECT_EQ(NanoToMillis(dumpTimeNs), bucketInfo.end_bucket_elapsed_millis());
+    }
+    EXPECT_TRUE(countProducer.mPastBuckets.empty());
+    EXPECT_EQ(bucketStartTimeNs, countProducer.mCurrentBucketStartTimeNs);
+
+    // The full bucket is reported once closed.
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    ProtoOutputStream output;
+    countProducer.onDumpReport(bucketStartTimeNs + bucketSizeNs + 1,
+                               false /*include current partial bucket*/, true /*erase data*/,
+                               FAST, nullptr, &output);
+    StatsLogReport report = outputStreamToProto(&output);
+    ASSERT_EQ(1, report.count_metrics().data_size());
+    ASSERT_EQ(1, report.count_metrics().data(0).bucket_info_size());
+    EXPECT_EQ(3, report.count_metrics().data(0).bucket_info(0).count());
+    EXPECT_EQ(0, report.count_metrics().data(0).bucket_info(0).bucket_num());
+}
+
+TEST(CountMetricProducerTest, TestColumnarReport) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    countProducer.setColumnarReport(true);
+
+    auto logUid = [&](int64_t timestampNs, const string& uid) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeLogEvent(&event, timestampNs, tagId, uid);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    };
+    logUid(bucketStartTimeNs + 1, "111");
+    logUid(bucketStartTimeNs + 2, "111");
+    logUid(bucketStartTimeNs + 3, "222");
+    logUid(bucketStartTimeNs + bucketSizeNs + 1, "111");
+
+    ProtoOutputStream output;
+    countProducer.onDumpReport(bucketStartTimeNs + 2 * bucketSizeNs + 1,
+                               false /*include current partial bucket*/, true /*erase data*/,
+                               FAST, nullptr, &output);
+    StatsLogReport report = outputStreamToProto(&output);
+    EXPECT_FALSE(report.has_count_metrics());
+    ASSERT_TRUE(report.has_columnar_metrics());
+    const ColumnarMetricData& data = report.columnar_metrics();
+
+    // Both buckets are full, each starting at the end of the previous one.
+    EXPECT_EQ(vector<int64_t>({0, 0}), vector<int64_t>(data.bucket_start_delta_millis().begin(),
+                                                       data.bucket_start_delta_millis().end()));
+    EXPECT_EQ(vector<int64_t>({bucketSizeNs / 1000000, bucketSizeNs / 1000000}),
+              vector<int64_t>(data.bucket_length_millis().begin(),
+                              data.bucket_length_millis().end()));
+
+    // Bucket index and count of the rows of each uid.
+    std::map<string, vector<std::pair<int32_t, int64_t>>> rows;
+    ASSERT_EQ(2, data.dimension_size());
+    ASSERT_EQ(2, data.dimension_row_count_size());
+    ASSERT_EQ(3, data.value_size());
+    ASSERT_EQ(3, data.bucket_index_size());
+    int row = 0;
+    for (int i = 0; i < data.dimension_size(); i++) {
+        ASSERT_EQ(1, data.dimension(i).dimension_leaf_values_in_what_size());
+        const string& uid = data.dimension(i).dimension_leaf_values_in_what(0).value_str();
+        for (int j = 0; j < data.dimension_row_count(i); j++, row++) {
+            rows[uid].emplace_back(data.bucket_index(row), data.value(row));
+        }
+    }
+    EXPECT_EQ((vector<std::pair<int32_t, int64_t>>{{0, 2}, {1, 1}}), rows["111"]);
+    EXPECT_EQ((vector<std::pair<int32_t, int64_t>>{{0, 1}}), rows["222"]);
+    EXPECT_EQ(0, data.condition_true_nanos_size());
+    EXPECT_TRUE(countProducer.mPastBuckets.empty());
+}
+
+TEST(CountMetricProducerTest, TestDimensionDictionary) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer firstProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+    CountMetricProducer secondProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                       wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+
+    auto logUid = [&](CountMetricProducer& producer, const string& uid) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeLogEvent(&event, bucketStartTimeNs + 1, tagId, uid);
+        producer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    };
+    logUid(firstProducer, "111");
+    logUid(secondProducer, "222");
+    logUid(secondProducer, "111");
+
+    // The metrics of a report share the dictionary, so "111" is written once.
+    ReportDimensionDictionary dictionary;
+    const int64_t dumpTimeNs = bucketStartTimeNs + bucketSizeNs + 1;
+    ProtoOutputStream firstOutput;
+    firstProducer.onDumpReport(dumpTimeNs, false /*include current partial bucket*/,
+                               true /*erase data*/, FAST, nullptr, &firstOutput, &dictionary);
+    ProtoOutputStream secondOutput;
+    secondProducer.onDumpReport(dumpTimeNs, false /*include current partial bucket*/,
+                                true /*erase data*/, FAST, nullptr, &secondOutput, &dictionary);
+    EXPECT_EQ(2u, dictionary.size());
+
+    StatsLogReport firstReport = outputStreamToProto(&firstOutput);
+    ASSERT_EQ(1, firstReport.count_metrics().data_size());
+    EXPECT_EQ(0, firstReport.count_metrics().data(0).dimension_leaf_values_in_what_size());
+    EXPECT_TRUE(firstReport.count_metrics().data(0).has_dimension_index_in_what());
+    EXPECT_EQ(0, firstReport.count_metrics().data(0).dimension_index_in_what());
+
+    StatsLogReport secondReport = outputStreamToProto(&secondOutput);
+    ASSERT_EQ(2, secondReport.count_metrics().data_size());
+    std::set<int> secondIndexes;
+    for (const CountMetricData& data : secondReport.count_metrics().data()) {
+        EXPECT_EQ(0, data.dimension_leaf_values_in_what_size());
+        secondIndexes.insert(data.dimension_index_in_what());
+    }
+    EXPECT_EQ(std::set<int>({0, 1}), secondIndexes);
+}
+
+TEST(CountMetricProducerTest, TestDimensionCountMetadata) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    CountMetricProducer countProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs, bucketStartTimeNs);
+
+    metadata::MetricMetadata metricMetadata;
+    EXPECT_FALSE(countProducer.writeMetricMetadataToProto(&metricMetadata));
+
+    for (const string& uid : {"111", "222", "333"}) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        makeLogEvent(&event, bucketStartTimeNs + 1, tagId, uid);
+        countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    }
+    // The next bucket is reserved for the keys of the previous one.
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event, bucketStartTimeNs + bucketSizeNs + 1, tagId, /*uid=*/"111");
+    countProducer.onMatchedLogEvent(1 /*log matcher index*/, event);
+    ASSERT_EQ(1u, countProducer.mCurrentSlicedCounter->size());
+    EXPECT_GE(countProducer.mCurrentSlicedCounter->bucket_count(), 3u);
+
+    // The previous bucket had more keys than the current one so far.
+    ASSERT_TRUE(countProducer.writeMetricMetadataToProto(&metricMetadata));
+    EXPECT_EQ(metric.id(), metricMetadata.metric_id());
+    EXPECT_EQ(3, metricMetadata.dimension_count());
+
+    // A producer loading the metadata starts with its maps reserved.
+    CountMetricProducer restartedProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                          wizard, protoHash, bucketStartTimeNs,
+                                          bucketStartTimeNs);
+    restartedProducer.loadMetricMetadataFromProto(metricMetadata);
+    EXPECT_GE(restartedProducer.mCurrentSlicedCounter->bucket_count(), 3u);
+}
+
+TEST(CountMetricProducerTest, TestStateGroupTables) {
+    CountMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    int64_t bucketStartTimeNs = 10000000000;
+    const int denseAtomId = 10;
+    const int sparseAtomId = 20;
+    const int unmappedAtomId = 30;
+    CountMetricProducer countProducer(
+            kConfigKey, metric, -1 /*-1 meaning no condition*/, {}, wizard, protoHash,
+            bucketStartTimeNs, bucketStartTimeNs, {}, {},
+            {denseAtomId, sparseAtomId, unmappedAtomId},
+            {{denseAtomId, {{-1, 100}, {2, 200}}}, {sparseAtomId, {{0, 300}, {100000, 400}}}});
+    ASSERT_EQ(1, countProducer.mStateGroupTables.size());
+    EXPECT_EQ(denseAtomId, countProducer.mStateGroupTables[0].atomId);
+    EXPECT_EQ(4, countProducer.mStateGroupTables[0].groupIds.size());
+
+    const auto mapStateValue = [&countProducer](int atomId, int stateValue) {
+        FieldValue value(Field(atomId, 1), Value(stateValue));
+        countProducer.mapStateValue(atomId, &value);
+        return value.mValue;
+    };
+    EXPECT_EQ(Value((int64_t)100), mapStateValue(denseAtomId, -1));
+    EXPECT_EQ(Value((int64_t)200), mapStateValue(denseAtomId, 2));
+    EXPECT_EQ(Value(StateTracker::kStateUnknown), mapStateValue(denseAtomId, 0));
+    EXPECT_EQ(Value(StateTracker::kStateUnknown), mapStateValue(denseAtomId, 3));
+    EXPECT_EQ(Value((int64_t)300), mapStateValue(sparseAtomId, 0));
+    EXPECT_EQ(Value((int64_t)400), mapStateValue(sparseAtomId, 100000));
+    EXPECT_EQ(Value(StateTracker::kStateUnknown), mapStateValue(sparseAtomId, 1));
+    EXPECT_EQ(Value(5), mapStateValue(unmappedAtomId, 5));
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
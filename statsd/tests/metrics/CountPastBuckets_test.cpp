@@ -0,0 +1,162 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/CountPastBuckets.h"
+
+#include <gtest/gtest.h>
+
+#include <memory_resource>
+#include <vector>
+
+#include "metrics_test_helper.h"
+
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+void expectBucket(const CountBucket& bucket, int64_t startNs, int64_t endNs, int64_t count,
+                  int64_t conditionTrueNs) {
+    EXPECT_EQ(startNs, bucket.mBucketStartNs);
+    EXPECT_EQ(endNs, bucket.mBucketEndNs);
+    EXPECT_EQ(count, bucket.mCount);
+    EXPECT_EQ(conditionTrueNs, bucket.mConditionTrueNs);
+}
+
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocatedBytes = 0;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        allocatedBytes += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        allocatedBytes -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+}  // anonymous namespace
+
+TEST(CountPastBucketsTest, TestSharedBucketBoundaries) {
+    const MetricDimensionKey key1 = getMockedMetricDimensionKey(/*tagId=*/1, /*key=*/1, "111");
+    const MetricDimensionKey key2 = getMockedMetricDimensionKey(/*tagId=*/1, /*key=*/1, "222");
+
+    CountPastBuckets pastBuckets;
+    EXPECT_TRUE(pastBuckets.empty());
+    pastBuckets.startBucket(100, 200, 10);
+    pastBuckets.addCount(key1, 1);
+    pastBuckets.addCount(key2, 300);
+    pastBuckets.startBucket(200, 300, 20);
+    pastBuckets.addCount(key2, 5);
+    pastBuckets.startBucket(300, 400, 30);
+    pastBuckets.addCount(key1, 1LL << 40);
+
+    ASSERT_EQ(2u, pastBuckets.size());
+    EXPECT_TRUE(pastBuckets.contains(key1));
+    EXPECT_FALSE(pastBuckets.contains(DEFAULT_METRIC_DIMENSION_KEY));
+    EXPECT_TRUE(pastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).empty());
+
+    const vector<CountBucket> buckets1 = pastBuckets.getBuckets(key1);
+    ASSERT_EQ(2u, buckets1.size());
+    expectBucket(buckets1[0], 100, 200, 1, 10);
+    expectBucket(buckets1[1], 300, 400, 1LL << 40, 30);
+
+    const vector<CountBucket> buckets2 = pastBuckets.getBuckets(key2);
+    ASSERT_EQ(2u, buckets2.size());
+    expectBucket(buckets2[0], 100, 200, 300, 10);
+    expectBucket(buckets2[1], 200, 300, 5, 20);
+
+    // Keys are visited in the order they were first added.
+    vector<MetricDimensionKey> keys;
+    pastBuckets.forEach([&](const MetricDimensionKey& key, const vector<CountBucket>& buckets) {
+        keys.push_back(key);
+        EXPECT_EQ(2u, buckets.size());
+    });
+    EXPECT_EQ(vector<MetricDimensionKey>({key1, key2}), keys);
+}
+
+TEST(CountPastBucketsTest, TestEmptyBucketIsNotStored) {
+    CountPastBuckets pastBuckets;
+    pastBuckets.startBucket(100, 200, 0);
+    EXPECT_TRUE(pastBuckets.empty());
+    EXPECT_EQ(0u, pastBuckets.byteSize());
+
+    pastBuckets.startBucket(200, 300, 0);
+    pastBuckets.addCount(DEFAULT_METRIC_DIMENSION_KEY, 7);
+    const size_t oneBucketSize = pastBuckets.byteSize();
+    EXPECT_GT(oneBucketSize, 0u);
+
+    pastBuckets.startBucket(300, 400, 0);
+    pastBuckets.addCount(DEFAULT_METRIC_DIMENSION_KEY, 8);
+    // Each bucket stores 3 int64 and two one byte varints.
+    EXPECT_EQ(2 * oneBucketSize, pastBuckets.byteSize());
+
+    const vector<CountBucket> buckets = pastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(2u, buckets.size());
+    expectBucket(buckets[0], 200, 300, 7, 0);
+    expectBucket(buckets[1], 300, 400, 8, 0);
+
+    pastBuckets.clear();
+    EXPECT_TRUE(pastBuckets.empty());
+    EXPECT_EQ(0u, pastBuckets.byteSize());
+}
+
+TEST(CountPastBucketsTest, TestCountsAllocatedFromMemoryResource) {
+    const MetricDimensionKey key1 = getMockedMetricDimensionKey(/*tagId=*/1, /*key=*/1, "111");
+    const MetricDimensionKey key2 = getMockedMetricDimensionKey(/*tagId=*/1, /*key=*/1, "222");
+    CountingResource resource;
+
+    CountPastBuckets pastBuckets;
+    pastBuckets.startBucket(100, 200, 0);
+    pastBuckets.addCount(key1, 1);
+    // Only the keys added from now on use the resource, the others stay valid.
+    pastBuckets.setMemoryResource(&resource);
+    pastBuckets.addCount(key2, 2);
+    pastBuckets.startBucket(200, 300, 0);
+    pastBuckets.addCount(key1, 3);
+    pastBuckets.addCount(key2, 4);
+
+    vector<CountBucket> buckets = pastBuckets.getBuckets(key1);
+    ASSERT_EQ(2u, buckets.size());
+    expectBucket(buckets[0], 100, 200, 1, 0);
+    expectBucket(buckets[1], 200, 300, 3, 0);
+    buckets = pastBuckets.getBuckets(key2);
+    ASSERT_EQ(2u, buckets.size());
+    expectBucket(buckets[0], 100, 200, 2, 0);
+    expectBucket(buckets[1], 200, 300, 4, 0);
+    EXPECT_GT(resource.allocatedBytes, 0u);
+
+    pastBuckets.clear();
+    EXPECT_EQ(0u, resource.allocatedBytes);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
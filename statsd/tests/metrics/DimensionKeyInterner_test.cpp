@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/metrics/DimensionKeyInterner.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+HashableDimensionKey makeUidKey(int32_t uid) {
+    int pos[] = {1, 1, 1};
+    HashableDimensionKey key;
+    key.addValue(FieldValue(Field(10, pos, 0), Value(uid)));
+    return key;
+}
+
+}  // anonymous namespace
+
+TEST(DimensionKeyInternerTest, TestInternSharesValues) {
+    sp<DimensionKeyInterner> interner = new DimensionKeyInterner();
+
+    HashableDimensionKey key1 = interner->intern(makeUidKey(1000));
+    HashableDimensionKey key2 = interner->intern(makeUidKey(1000));
+    HashableDimensionKey key3 = interner->intern(makeUidKey(1001));
+    EXPECT_EQ(2u, interner->size());
+
+    EXPECT_EQ(makeUidKey(1000), key1);
+    EXPECT_EQ(key1, key2);
+    EXPECT_EQ(&key1.getValues(), &key2.getValues());
+    EXPECT_NE(key1, key3);
+
+    // Modifying an interned key copies its values first.
+    key2.mutableValue(0)->mValue = Value((int32_t)1001);
+    EXPECT_EQ(key3, key2);
+    EXPECT_EQ(makeUidKey(1000), key1);
+
+    MetricDimensionKey metricKey =
+            interner->intern(MetricDimensionKey(makeUidKey(1001), DEFAULT_DIMENSION_KEY));
+    EXPECT_EQ(&key3.getValues(), &metricKey.getDimensionKeyInWhat().getValues());
+    EXPECT_EQ(DEFAULT_DIMENSION_KEY, metricKey.getStateValuesKey());
+    EXPECT_EQ(2u, interner->size());
+}
+
+TEST(DimensionKeyInternerTest, TestPrune) {
+    sp<DimensionKeyInterner> interner = new DimensionKeyInterner();
+
+    HashableDimensionKey key1 = interner->intern(makeUidKey(1000));
+    interner->intern(makeUidKey(1001));
+    EXPECT_EQ(2u, interner->size());
+
+    interner->prune();
+    EXPECT_EQ(1u, interner->size());
+    EXPECT_EQ(&key1.getValues(), &interner->intern(makeUidKey(1000)).getValues());
+}
+
+TEST(DimensionKeyInternerTest, TestPruneOnGrowth) {
+    sp<DimensionKeyInterner> interner = new DimensionKeyInterner();
+
+    // None of the interned keys are kept, so the interner never grows past the first prune.
+    for (int32_t uid = 0; uid < 10000; uid++) {
+        interner->intern(makeUidKey(uid));
+    }
+    EXPECT_LE(interner->size(), 1000u);
+}
+
+TEST(DimensionKeyInternerTest, TestConcurrentIntern) {
+    sp<DimensionKeyInterner> interner = new DimensionKeyInterner();
+
+    // Configs processed by different threads intern the same keys.
+    const int numThreads = 4;
+    std::vector<std::vector<HashableDimensionKey>> keys(numThreads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+        threads.emplace_back([&interner, &keys, i] {
+            for (int32_t uid = 0; uid < 100; uid++) {
+                keys[i].push_back(interner->intern(makeUidKey(uid)));
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(100u, interner->size());
+    for (int i = 1; i < numThreads; i++) {
+        for (int32_t uid = 0; uid < 100; uid++) {
+            EXPECT_EQ(&keys[0][uid].getValues(), &keys[i][uid].getValues());
+        }
+    }
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
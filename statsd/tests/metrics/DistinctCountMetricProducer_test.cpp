@@ -0,0 +1,106 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/DistinctCountMetricProducer.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "metrics_test_helper.h"
+#include "src/FieldValue.h"
+#include "src/stats_log_util.h"
+#include "tests/statsd_test_util.h"
+
+using namespace testing;
+using android::sp;
+using std::unique_ptr;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+const int atomId = 1;
+const int64_t metricId = 123;
+const uint64_t protoHash = 0x1234567890;
+const int logEventMatcherIndex = 0;
+const int64_t bucketStartTimeNs = 10000000000;
+const int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+const int64_t bucket2StartTimeNs = bucketStartTimeNs + bucketSizeNs;
+
+sp<DistinctCountMetricProducer> createDistinctCountProducer(const ValueMetric& metric) {
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    vector<Matcher> fieldMatchers;
+    translateFieldMatcher(metric.value_field(), &fieldMatchers);
+    const auto [dimensionSoftLimit, dimensionHardLimit] =
+            StatsdStats::getAtomDimensionKeySizeLimits(atomId,
+                                                       StatsdStats::kDimensionKeySizeHardLimitMin);
+    return new DistinctCountMetricProducer(
+            kConfigKey, metric, protoHash, {/*pullAtomId=*/-1, /*pullerManager=*/nullptr},
+            {bucketStartTimeNs, bucketStartTimeNs, bucketSizeNs, metric.min_bucket_size_nanos(),
+             /*conditionCorrectionThresholdNs=*/nullopt, metric.split_bucket_for_app_upgrade()},
+            {/*containsAnyPositionInDimensionsInWhat=*/false,
+             /*shouldUseNestedDimensions=*/false, logEventMatcherIndex,
+             /*eventMatcherWizard=*/nullptr, metric.dimensions_in_what(), fieldMatchers},
+            {/*conditionIndex=*/-1, metric.links(), /*initialConditionCache=*/{}, wizard},
+            {metric.state_link(), /*slicedStateAtoms=*/{}, /*stateGroupMap=*/{}},
+            {/*eventActivationMap=*/{}, /*eventDeactivationMap=*/{}},
+            {dimensionSoftLimit, dimensionHardLimit});
+}
+
+}  // anonymous namespace
+
+TEST(DistinctCountMetricProducerTest, TestPushedEventsWithoutCondition) {
+    ValueMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_value_field()->set_field(atomId);
+    metric.mutable_value_field()->add_child()->set_field(2);
+    metric.set_aggregation_type(ValueMetric::DISTINCT_COUNT);
+    sp<DistinctCountMetricProducer> producer = createDistinctCountProducer(metric);
+
+    for (const int value : {10, 20, 10, 30, 20}) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        CreateRepeatedValueLogEvent(&event, atomId, bucketStartTimeNs + 10, value);
+        producer->onMatchedLogEvent(logEventMatcherIndex, event);
+    }
+    ASSERT_EQ(1UL, producer->mCurrentSlicedBucket.size());
+    const DistinctCountMetricProducer::Interval& interval =
+            producer->getIntervals(producer->mCurrentSlicedBucket.begin()->second)[0];
+    EXPECT_EQ(3, interval.aggregate->estimate());
+    EXPECT_EQ(5, interval.sampleSize);
+
+    producer->flushIfNeededLocked(bucket2StartTimeNs);
+    ASSERT_EQ(1UL, producer->mPastBuckets.size());
+    const vector<PastBucket<unique_ptr<HyperLogLog>>>& buckets =
+            producer->mPastBuckets.begin()->second;
+    ASSERT_EQ(1UL, buckets.size());
+    EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
+    EXPECT_EQ(bucket2StartTimeNs, buckets[0].mBucketEndNs);
+    EXPECT_EQ(3, buckets[0].aggregates[0]->estimate());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
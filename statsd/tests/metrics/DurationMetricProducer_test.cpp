@@ -54,6 +54,15 @@ void makeLogEvent(LogEvent* logEvent, int64_t timestampNs, int atomId) {
     parseStatsEventToLogEvent(statsEvent, logEvent);
 }
 
+void makeUidLogEvent(LogEvent* logEvent, int64_t timestampNs, int atomId, int uid) {
+    AStatsEvent* statsEvent = AStatsEvent_obtain();
+    AStatsEvent_setAtomId(statsEvent, atomId);
+    AStatsEvent_overwriteTimestamp(statsEvent, timestampNs);
+    AStatsEvent_writeInt32(statsEvent, uid);
+
+    parseStatsEventToLogEvent(statsEvent, logEvent);
+}
+
 }  // namespace
 
 // Setup for parameterized tests.
@@ -121,6 +130,40 @@ TEST(DurationMetricTrackerTest, TestNoCondition) {
     EXPECT_EQ(2LL, buckets[1].mDuration);
 }
 
+TEST(DurationMetricTrackerTest, TestByteSize) {
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+
+    DurationMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_aggregation_type(DurationMetric_AggregationType_SUM);
+
+    int tagId = 1;
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event1, bucketStartTimeNs + 1, tagId);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event2, bucketStartTimeNs + bucketSizeNs + 2, tagId);
+
+    FieldMatcher dimensions;
+
+    DurationMetricProducer durationProducer(
+            kConfigKey, metric, -1 /*no condition*/, {}, -1 /*what index not needed*/,
+            1 /* start index */, 2 /* stop index */, 3 /* stop_all index */, false /*nesting*/,
+            wizard, protoHash, dimensions, bucketStartTimeNs, bucketStartTimeNs);
+    EXPECT_EQ(0UL, durationProducer.byteSize());
+
+    durationProducer.onMatchedLogEvent(1 /* start index*/, event1);
+    durationProducer.onMatchedLogEvent(2 /* stop index*/, event2);
+    durationProducer.flushIfNeededLocked(bucketStartTimeNs + 2 * bucketSizeNs + 1);
+    ASSERT_EQ(2UL, durationProducer.mPastBuckets[DEFAULT_METRIC_DIMENSION_KEY].size());
+    EXPECT_EQ(2 * DurationMetricProducer::kBucketSize, durationProducer.byteSize());
+
+    durationProducer.clearPastBucketsLocked(bucketStartTimeNs + 2 * bucketSizeNs + 2);
+    EXPECT_EQ(0UL, durationProducer.byteSize());
+}
+
 TEST(DurationMetricTrackerTest, TestNonSlicedCondition) {
     sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
     int64_t bucketStartTimeNs = 10000000000;
@@ -179,6 +222,57 @@ TEST(DurationMetricTrackerTest, TestNonSlicedCondition) {
     EXPECT_EQ(bucket2EndTimeNs - conditionStartTimeNs, buckets2[0].mConditionTrueNs);
 }
 
+TEST(DurationMetricTrackerTest, TestNonSlicedConditionChangesAppliedLazily) {
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    int64_t bucketStartTimeNs = 10000000000;
+    int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+    int tagId = 1;
+
+    DurationMetric metric;
+    metric.set_id(1);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_aggregation_type(DurationMetric_AggregationType_SUM);
+    FieldMatcher dimensions = CreateDimensions(tagId, {1 /* uid */});
+    *metric.mutable_dimensions_in_what() = dimensions;
+
+    DurationMetricProducer durationProducer(
+            kConfigKey, metric, 0 /* condition index */, {ConditionState::kUnknown},
+            -1 /*what index not needed*/, 1 /* start index */, 2 /* stop index */,
+            3 /* stop_all index */, false /*nesting*/, wizard, protoHash, dimensions,
+            bucketStartTimeNs, bucketStartTimeNs);
+
+    LogEvent start1(/*uid=*/0, /*pid=*/0);
+    makeUidLogEvent(&start1, bucketStartTimeNs + 10, tagId, 1001);
+    LogEvent start2(/*uid=*/0, /*pid=*/0);
+    makeUidLogEvent(&start2, bucketStartTimeNs + 20, tagId, 1002);
+    LogEvent stop1(/*uid=*/0, /*pid=*/0);
+    makeUidLogEvent(&stop1, bucketStartTimeNs + 400, tagId, 1001);
+
+    durationProducer.onConditionChanged(true, bucketStartTimeNs + 5);
+    durationProducer.onMatchedLogEvent(1 /* start index*/, start1);
+    durationProducer.onMatchedLogEvent(1 /* start index*/, start2);
+    durationProducer.onConditionChanged(false, bucketStartTimeNs + 100);
+    durationProducer.onConditionChanged(true, bucketStartTimeNs + 200);
+    durationProducer.onConditionChanged(false, bucketStartTimeNs + 300);
+    // The trackers apply the changes when they are next used.
+    EXPECT_EQ(3UL, durationProducer.mConditionChanges.size());
+
+    durationProducer.onMatchedLogEvent(2 /* stop index*/, stop1);
+    durationProducer.onConditionChanged(true, bucketStartTimeNs + 500);
+    durationProducer.flushIfNeededLocked(bucketStartTimeNs + bucketSizeNs + 1);
+    EXPECT_TRUE(durationProducer.mConditionChanges.empty());
+    EXPECT_EQ(4UL, durationProducer.mFirstConditionEpoch);
+
+    ASSERT_EQ(2UL, durationProducer.mPastBuckets.size());
+    vector<int64_t> durations;
+    for (const auto& [_, buckets] : durationProducer.mPastBuckets) {
+        ASSERT_EQ(1UL, buckets.size());
+        durations.push_back(buckets[0].mDuration);
+    }
+    EXPECT_THAT(durations, UnorderedElementsAre((100 - 10) + (300 - 200),
+                                                (100 - 20) + (300 - 200) + (bucketSizeNs - 500)));
+}
+
 TEST(DurationMetricTrackerTest, TestNonSlicedConditionUnknownState) {
     sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
     int64_t bucketStartTimeNs = 10000000000;
@@ -343,6 +343,67 @@ TEST_F(EventMetricProducerTest, TestTwoAtomTagAggregatedEvents) {
         }
     }
 }
+
+TEST_F(EventMetricProducerTest, TestAggregatedEventsInFirstLoggedOrder) {
+    int64_t bucketStartTimeNs = 10000000000;
+    int tagId = 1;
+
+    EventMetric metric;
+    metric.set_id(1);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event1, tagId, bucketStartTimeNs + 10, "222");
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event2, tagId, bucketStartTimeNs + 20, "111");
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event3, tagId, bucketStartTimeNs + 30, "222");
+    LogEvent event4(/*uid=*/0, /*pid=*/0);
+    makeLogEvent(&event4, tagId, bucketStartTimeNs + 40, "333");
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    EventMetricProducer eventProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, bucketStartTimeNs);
+
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event1);
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event2);
+    const size_t twoAtomsSize = eventProducer.byteSize();
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event3);
+    // A duplicate only adds its timestamp.
+    EXPECT_EQ(twoAtomsSize + sizeof(int64_t), eventProducer.byteSize());
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event4);
+
+    ProtoOutputStream output;
+    std::set<string> strSet;
+    eventProducer.onDumpReport(bucketStartTimeNs + 50, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output);
+    EXPECT_EQ(0u, eventProducer.byteSize());
+
+    StatsLogReport report = outputStreamToProto(&output);
+    ASSERT_EQ(3, report.event_metrics().data_size());
+    const AggregatedAtomInfo& atomInfo1 = report.event_metrics().data(0).aggregated_atom_info();
+    ASSERT_EQ(2, atomInfo1.elapsed_timestamp_nanos_size());
+    EXPECT_EQ(bucketStartTimeNs + 10, atomInfo1.elapsed_timestamp_nanos(0));
+    EXPECT_EQ(bucketStartTimeNs + 30, atomInfo1.elapsed_timestamp_nanos(1));
+    const AggregatedAtomInfo& atomInfo2 = report.event_metrics().data(1).aggregated_atom_info();
+    ASSERT_EQ(1, atomInfo2.elapsed_timestamp_nanos_size());
+    EXPECT_EQ(bucketStartTimeNs + 20, atomInfo2.elapsed_timestamp_nanos(0));
+    const AggregatedAtomInfo& atomInfo3 = report.event_metrics().data(2).aggregated_atom_info();
+    ASSERT_EQ(1, atomInfo3.elapsed_timestamp_nanos_size());
+    EXPECT_EQ(bucketStartTimeNs + 40, atomInfo3.elapsed_timestamp_nanos(0));
+    const string atom2 = atomInfo2.atom().SerializeAsString();
+    EXPECT_NE(atomInfo1.atom().SerializeAsString(), atom2);
+
+    // Data logged after the dump starts over.
+    eventProducer.onMatchedLogEvent(1 /*matcher index*/, event2);
+    ProtoOutputStream output2;
+    eventProducer.onDumpReport(bucketStartTimeNs + 60, true /*include current partial bucket*/,
+                               true /*erase data*/, FAST, &strSet, &output2);
+    report = outputStreamToProto(&output2);
+    ASSERT_EQ(1, report.event_metrics().data_size());
+    EXPECT_EQ(atom2,
+              report.event_metrics().data(0).aggregated_atom_info().atom().SerializeAsString());
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
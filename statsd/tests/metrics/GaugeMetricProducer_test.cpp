@@ -160,10 +160,7 @@ TEST(GaugeMetricProducerTest, TestPulledEventsNoCondition) {
     ASSERT_EQ(1UL, gaugeProducer.mPastBuckets.size());
     EXPECT_EQ(3, gaugeProducer.mPastBuckets.begin()
                          ->second.back()
-                         .mAggregatedAtoms.begin()
-                         ->first.getAtomFieldValues()
-                         .getValues()
-                         .begin()
+                         .mAggregatedAtoms.getFields(0)
                          ->mValue.int_value);
 
     allData.clear();
@@ -181,10 +178,7 @@ TEST(GaugeMetricProducerTest, TestPulledEventsNoCondition) {
     ASSERT_EQ(2UL, gaugeProducer.mPastBuckets.begin()->second.size());
     auto it2 = gaugeProducer.mPastBuckets.begin()
                        ->second.back()
-                       .mAggregatedAtoms.begin()
-                       ->first.getAtomFieldValues()
-                       .getValues()
-                       .begin();
+                       .mAggregatedAtoms.getFields(0);
     EXPECT_EQ(INT, it2->mValue.getType());
     EXPECT_EQ(10L, it2->mValue.int_value);
     it2++;
@@ -198,10 +192,7 @@ TEST(GaugeMetricProducerTest, TestPulledEventsNoCondition) {
     ASSERT_EQ(3UL, gaugeProducer.mPastBuckets.begin()->second.size());
     it2 = gaugeProducer.mPastBuckets.begin()
                   ->second.back()
-                  .mAggregatedAtoms.begin()
-                  ->first.getAtomFieldValues()
-                  .getValues()
-                  .begin();
+                  .mAggregatedAtoms.getFields(0);
     EXPECT_EQ(INT, it2->mValue.getType());
     EXPECT_EQ(24L, it2->mValue.int_value);
     it2++;
@@ -474,10 +465,7 @@ TEST(GaugeMetricProducerTest, TestPulledEventsWithCondition) {
 
     EXPECT_EQ(100, gaugeProducer.mPastBuckets.begin()
                            ->second.back()
-                           .mAggregatedAtoms.begin()
-                           ->first.getAtomFieldValues()
-                           .getValues()
-                           .begin()
+                           .mAggregatedAtoms.getFields(0)
                            ->mValue.int_value);
 
     gaugeProducer.onConditionChanged(false, bucket2StartTimeNs + 10);
@@ -486,10 +474,7 @@ TEST(GaugeMetricProducerTest, TestPulledEventsWithCondition) {
     ASSERT_EQ(2UL, gaugeProducer.mPastBuckets.begin()->second.size());
     EXPECT_EQ(110L, gaugeProducer.mPastBuckets.begin()
                             ->second.back()
-                            .mAggregatedAtoms.begin()
-                            ->first.getAtomFieldValues()
-                            .getValues()
-                            .begin()
+                            .mAggregatedAtoms.getFields(0)
                             ->mValue.int_value);
 }
 
@@ -699,14 +684,130 @@ TEST(GaugeMetricProducerTest, TestPullOnTrigger) {
 
     ASSERT_EQ(1UL, gaugeProducer.mPastBuckets.size());
     ASSERT_EQ(2UL, gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms.size());
-    auto it = gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms.begin();
+    const AggregatedGaugeAtoms& atoms =
+            gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms;
     vector<int> atomValues;
-    atomValues.emplace_back(it->first.getAtomFieldValues().getValues().begin()->mValue.int_value);
-    it++;
-    atomValues.emplace_back(it->first.getAtomFieldValues().getValues().begin()->mValue.int_value);
+    for (size_t i = 0; i < atoms.size(); i++) {
+        atomValues.emplace_back(atoms.getFields(i)->mValue.int_value);
+    }
     EXPECT_THAT(atomValues, UnorderedElementsAre(4, 5));
 }
 
+TEST(GaugeMetricProducerTest, TestCoalescedPullOnTrigger) {
+    GaugeMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_sampling_type(GaugeMetric::FIRST_N_SAMPLES);
+    metric.mutable_gauge_fields_filter()->set_include_all(false);
+    metric.set_max_pull_delay_sec(INT_MAX);
+    metric.set_trigger_coalescing_window_millis(100);
+    auto gaugeFieldMatcher = metric.mutable_gauge_fields_filter()->mutable_fields();
+    gaugeFieldMatcher->set_field(tagId);
+    gaugeFieldMatcher->add_child()->set_field(1);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    sp<EventMatcherWizard> eventMatcherWizard =
+            createEventMatcherWizard(tagId, logEventMatcherIndex);
+
+    const int64_t windowNs = 100 * NS_PER_SEC / 1000;
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, _, _))
+            .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t eventTimeNs,
+                                vector<std::shared_ptr<LogEvent>>* data) {
+                EXPECT_EQ(eventTimeNs, bucketStartTimeNs + 10);
+                data->clear();
+                data->push_back(CreateRepeatedValueLogEvent(tagId, eventTimeNs, 4));
+                return true;
+            }))
+            .WillOnce(Invoke([windowNs](int tagId, const ConfigKey&, const int64_t eventTimeNs,
+                                        vector<std::shared_ptr<LogEvent>>* data) {
+                EXPECT_EQ(eventTimeNs, bucketStartTimeNs + 10 + windowNs);
+                data->clear();
+                data->push_back(CreateRepeatedValueLogEvent(tagId, eventTimeNs, 5));
+                return true;
+            }))
+            .WillOnce(Return(true));
+
+    int triggerId = 5;
+    GaugeMetricProducer gaugeProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, logEventMatcherIndex, eventMatcherWizard,
+                                      tagId, triggerId, tagId, bucketStartTimeNs, bucketStartTimeNs,
+                                      pullerManager);
+    gaugeProducer.prepareFirstBucket();
+
+    LogEvent triggerEvent(/*uid=*/0, /*pid=*/0);
+    CreateNoValuesLogEvent(&triggerEvent, triggerId, bucketStartTimeNs + 10);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, triggerEvent);
+    ASSERT_EQ(1UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+
+    // Within the window of the first pull, so its data is used again.
+    triggerEvent.setElapsedTimestampNs(bucketStartTimeNs + 10 + windowNs - 1);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, triggerEvent);
+    ASSERT_EQ(2UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+
+    triggerEvent.setElapsedTimestampNs(bucketStartTimeNs + 10 + windowNs);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, triggerEvent);
+    ASSERT_EQ(3UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+
+    // Pulls are not shared across buckets.
+    triggerEvent.setElapsedTimestampNs(bucket2StartTimeNs + 1);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, triggerEvent);
+
+    ASSERT_EQ(1UL, gaugeProducer.mPastBuckets.size());
+    const AggregatedGaugeAtoms& atoms =
+            gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms;
+    vector<int> atomValues;
+    for (size_t i = 0; i < atoms.size(); i++) {
+        atomValues.emplace_back(atoms.getFields(i)->mValue.int_value);
+    }
+    EXPECT_THAT(atomValues, UnorderedElementsAre(4, 4, 5));
+}
+
+TEST(GaugeMetricProducerTest, TestNoPullOnTriggerWhenBucketFull) {
+    GaugeMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_sampling_type(GaugeMetric::FIRST_N_SAMPLES);
+    metric.mutable_gauge_fields_filter()->set_include_all(true);
+    metric.set_max_pull_delay_sec(INT_MAX);
+    metric.set_max_num_gauge_atoms_per_bucket(2);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    sp<EventMatcherWizard> eventMatcherWizard =
+            createEventMatcherWizard(tagId, logEventMatcherIndex);
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, _, _))
+            .Times(2)
+            .WillRepeatedly(Invoke([](int tagId, const ConfigKey&, const int64_t eventTimeNs,
+                                      vector<std::shared_ptr<LogEvent>>* data) {
+                data->clear();
+                data->push_back(CreateRepeatedValueLogEvent(tagId, eventTimeNs, 4));
+                return true;
+            }));
+
+    int triggerId = 5;
+    GaugeMetricProducer gaugeProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, logEventMatcherIndex, eventMatcherWizard,
+                                      tagId, triggerId, tagId, bucketStartTimeNs, bucketStartTimeNs,
+                                      pullerManager);
+    gaugeProducer.prepareFirstBucket();
+
+    LogEvent triggerEvent(/*uid=*/0, /*pid=*/0);
+    CreateNoValuesLogEvent(&triggerEvent, triggerId, bucketStartTimeNs + 10);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, triggerEvent);
+    triggerEvent.setElapsedTimestampNs(bucketStartTimeNs + 20);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, triggerEvent);
+    ASSERT_EQ(2UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+
+    // max_num_gauge_atoms_per_bucket is reached, so nothing is pulled.
+    triggerEvent.setElapsedTimestampNs(bucketStartTimeNs + 30);
+    gaugeProducer.onMatchedLogEvent(1 /*log matcher index*/, triggerEvent);
+    ASSERT_EQ(2UL, gaugeProducer.mCurrentSlicedBucket->begin()->second.size());
+}
+
 TEST(GaugeMetricProducerTest, TestPullNWithoutTrigger) {
     GaugeMetric metric;
     metric.set_id(metricId);
@@ -755,16 +856,76 @@ TEST(GaugeMetricProducerTest, TestPullNWithoutTrigger) {
 
     ASSERT_EQ(1UL, gaugeProducer.mPastBuckets.size());
     ASSERT_EQ(3UL, gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms.size());
-    auto it = gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms.begin();
+    const AggregatedGaugeAtoms& atoms =
+            gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms;
     vector<int> atomValues;
-    atomValues.emplace_back(it->first.getAtomFieldValues().getValues().begin()->mValue.int_value);
-    it++;
-    atomValues.emplace_back(it->first.getAtomFieldValues().getValues().begin()->mValue.int_value);
-    it++;
-    atomValues.emplace_back(it->first.getAtomFieldValues().getValues().begin()->mValue.int_value);
+    for (size_t i = 0; i < atoms.size(); i++) {
+        atomValues.emplace_back(atoms.getFields(i)->mValue.int_value);
+    }
     EXPECT_THAT(atomValues, UnorderedElementsAre(4, 5, 6));
 }
 
+TEST(GaugeMetricProducerTest, TestDeltaPulledAtoms) {
+    GaugeMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.set_sampling_type(GaugeMetric::FIRST_N_SAMPLES);
+    metric.set_max_pull_delay_sec(INT_MAX);
+    metric.set_delta_pulled_atoms(true);
+    auto gaugeFieldMatcher = metric.mutable_gauge_fields_filter()->mutable_fields();
+    gaugeFieldMatcher->set_field(tagId);
+
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+
+    sp<EventMatcherWizard> eventMatcherWizard =
+            createEventMatcherWizard(tagId, logEventMatcherIndex);
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, RegisterReceiver(tagId, kConfigKey, _, _, _)).WillOnce(Return());
+    EXPECT_CALL(*pullerManager, UnRegisterReceiver(tagId, kConfigKey, _)).WillOnce(Return());
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, _, _))
+            .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t eventTimeNs,
+                                vector<std::shared_ptr<LogEvent>>* data) {
+                data->clear();
+                data->push_back(CreateRepeatedValueLogEvent(tagId, eventTimeNs, 4));
+                return true;
+            }));
+
+    GaugeMetricProducer gaugeProducer(kConfigKey, metric, -1 /*-1 meaning no condition*/, {},
+                                      wizard, protoHash, logEventMatcherIndex, eventMatcherWizard,
+                                      tagId, /*triggerId=*/-1, tagId, bucketStartTimeNs,
+                                      bucketStartTimeNs, pullerManager);
+    gaugeProducer.prepareFirstBucket();
+
+    vector<std::shared_ptr<LogEvent>> allData;
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 10, 4));
+    gaugeProducer.onDataPulled(allData, PullResult::PULL_RESULT_SUCCESS, bucketStartTimeNs + 10);
+    allData.clear();
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 20, 5));
+    gaugeProducer.onDataPulled(allData, PullResult::PULL_RESULT_SUCCESS, bucketStartTimeNs + 20);
+
+    // The unchanged atom references the fields of the first one.
+    ASSERT_EQ(1UL, gaugeProducer.mCurrentSlicedBucket->size());
+    const vector<GaugeAtom>& gaugeAtoms = gaugeProducer.mCurrentSlicedBucket->begin()->second;
+    ASSERT_EQ(3UL, gaugeAtoms.size());
+    EXPECT_EQ(gaugeAtoms[0].mFields, gaugeAtoms[1].mFields);
+    EXPECT_NE(gaugeAtoms[1].mFields, gaugeAtoms[2].mFields);
+
+    allData.clear();
+    allData.push_back(CreateRepeatedValueLogEvent(tagId, bucket2StartTimeNs + 10, 5));
+    gaugeProducer.onDataPulled(allData, PullResult::PULL_RESULT_SUCCESS, bucket2StartTimeNs + 10);
+
+    // The report holds each distinct atom with the timestamps at which it was pulled.
+    ASSERT_EQ(1UL, gaugeProducer.mPastBuckets.size());
+    const AggregatedGaugeAtoms& atoms =
+            gaugeProducer.mPastBuckets.begin()->second.back().mAggregatedAtoms;
+    ASSERT_EQ(2UL, atoms.size());
+    EXPECT_EQ(4, atoms.getFields(0)->mValue.int_value);
+    EXPECT_EQ(2UL, atoms.getTimestampCount(0));
+    EXPECT_EQ(5, atoms.getFields(1)->mValue.int_value);
+    EXPECT_EQ(1UL, atoms.getTimestampCount(1));
+}
+
 TEST(GaugeMetricProducerTest, TestRemoveDimensionInOutput) {
     GaugeMetric metric;
     metric.set_id(metricId);
@@ -833,21 +994,16 @@ TEST(GaugeMetricProducerTest, TestRemoveDimensionInOutput) {
     ASSERT_EQ(1UL, bucketIt->second.back().mAggregatedAtoms.size());
     EXPECT_EQ(3, bucketIt->first.getDimensionKeyInWhat().getValues().begin()->mValue.int_value);
     EXPECT_EQ(4, bucketIt->second.back()
-                         .mAggregatedAtoms.begin()
-                         ->first.getAtomFieldValues()
-                         .getValues()
-                         .begin()
+                         .mAggregatedAtoms.getFields(0)
                          ->mValue.int_value);
     bucketIt++;
     ASSERT_EQ(2UL, bucketIt->second.back().mAggregatedAtoms.size());
     EXPECT_EQ(4, bucketIt->first.getDimensionKeyInWhat().getValues().begin()->mValue.int_value);
-    auto atomIt = bucketIt->second.back().mAggregatedAtoms.begin();
+    const AggregatedGaugeAtoms& atoms = bucketIt->second.back().mAggregatedAtoms;
     vector<int> atomValues;
-    atomValues.emplace_back(
-            atomIt->first.getAtomFieldValues().getValues().begin()->mValue.int_value);
-    atomIt++;
-    atomValues.emplace_back(
-            atomIt->first.getAtomFieldValues().getValues().begin()->mValue.int_value);
+    for (size_t i = 0; i < atoms.size(); i++) {
+        atomValues.emplace_back(atoms.getFields(i)->mValue.int_value);
+    }
     EXPECT_THAT(atomValues, UnorderedElementsAre(5, 6));
 }
 
@@ -0,0 +1,138 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/HistogramMetricProducer.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "metrics_test_helper.h"
+#include "src/FieldValue.h"
+#include "src/stats_log_util.h"
+#include "tests/statsd_test_util.h"
+
+using namespace testing;
+using android::sp;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+const int atomId = 1;
+const int64_t metricId = 123;
+const uint64_t protoHash = 0x1234567890;
+const int logEventMatcherIndex = 0;
+const int64_t bucketStartTimeNs = 10000000000;
+const int64_t bucketSizeNs = TimeUnitToBucketSizeInMillis(ONE_MINUTE) * 1000000LL;
+const int64_t bucket2StartTimeNs = bucketStartTimeNs + bucketSizeNs;
+
+sp<HistogramMetricProducer> createHistogramProducer(const ValueMetric& metric) {
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    vector<Matcher> fieldMatchers;
+    translateFieldMatcher(metric.value_field(), &fieldMatchers);
+    const auto [dimensionSoftLimit, dimensionHardLimit] =
+            StatsdStats::getAtomDimensionKeySizeLimits(atomId,
+                                                       StatsdStats::kDimensionKeySizeHardLimitMin);
+    return new HistogramMetricProducer(
+            kConfigKey, metric, protoHash, {/*pullAtomId=*/-1, /*pullerManager=*/nullptr},
+            {bucketStartTimeNs, bucketStartTimeNs, bucketSizeNs, metric.min_bucket_size_nanos(),
+             /*conditionCorrectionThresholdNs=*/nullopt, metric.split_bucket_for_app_upgrade()},
+            {/*containsAnyPositionInDimensionsInWhat=*/false,
+             /*shouldUseNestedDimensions=*/false, logEventMatcherIndex,
+             /*eventMatcherWizard=*/nullptr, metric.dimensions_in_what(), fieldMatchers},
+            {/*conditionIndex=*/-1, metric.links(), /*initialConditionCache=*/{}, wizard},
+            {metric.state_link(), /*slicedStateAtoms=*/{}, /*stateGroupMap=*/{}},
+            {/*eventActivationMap=*/{}, /*eventDeactivationMap=*/{}},
+            {dimensionSoftLimit, dimensionHardLimit},
+            *createHistogramBins(metric.histogram_bin_config()));
+}
+
+}  // anonymous namespace
+
+TEST(HistogramMetricProducerTest, TestPushedEventsWithoutCondition) {
+    ValueMetric metric;
+    metric.set_id(metricId);
+    metric.set_bucket(ONE_MINUTE);
+    metric.mutable_value_field()->set_field(atomId);
+    metric.mutable_value_field()->add_child()->set_field(2);
+    metric.set_aggregation_type(ValueMetric::HISTOGRAM);
+    metric.set_include_sample_size(true);
+    for (const float bin : {10, 20, 30}) {
+        metric.mutable_histogram_bin_config()->mutable_explicit_bins()->add_bin(bin);
+    }
+    sp<HistogramMetricProducer> producer = createHistogramProducer(metric);
+
+    for (const int value : {5, 10, 15, 25, 25, 40}) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        CreateRepeatedValueLogEvent(&event, atomId, bucketStartTimeNs + 10, value);
+        producer->onMatchedLogEvent(logEventMatcherIndex, event);
+    }
+    ASSERT_EQ(1UL, producer->mCurrentSlicedBucket.size());
+    const HistogramMetricProducer::Interval& interval =
+            producer->getIntervals(producer->mCurrentSlicedBucket.begin()->second)[0];
+    EXPECT_EQ(vector<int64_t>({1, 2, 2, 1}), interval.aggregate);
+    EXPECT_EQ(6, interval.sampleSize);
+
+    producer->flushIfNeededLocked(bucket2StartTimeNs);
+    ASSERT_EQ(1UL, producer->mPastBuckets.size());
+    const vector<PastBucket<vector<int64_t>>>& buckets = producer->mPastBuckets.begin()->second;
+    ASSERT_EQ(1UL, buckets.size());
+    EXPECT_EQ(bucketStartTimeNs, buckets[0].mBucketStartNs);
+    EXPECT_EQ(bucket2StartTimeNs, buckets[0].mBucketEndNs);
+    EXPECT_EQ(vector<int64_t>({1, 2, 2, 1}), buckets[0].aggregates[0]);
+    EXPECT_EQ(vector<int>({6}), buckets[0].sampleSizes);
+
+    // The counts of the next bucket start from zero.
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event, atomId, bucket2StartTimeNs + 10, 35);
+    producer->onMatchedLogEvent(logEventMatcherIndex, event);
+    const HistogramMetricProducer::Interval& nextInterval =
+            producer->getIntervals(producer->mCurrentSlicedBucket.begin()->second)[0];
+    EXPECT_EQ(vector<int64_t>({0, 0, 0, 1}), nextInterval.aggregate);
+}
+
+TEST(HistogramMetricProducerTest, TestCreateHistogramBins) {
+    HistogramBinConfig config;
+    EXPECT_FALSE(createHistogramBins(config).has_value());
+
+    HistogramBinConfig::GeneratedBins* generatedBins = config.mutable_generated_bins();
+    generatedBins->set_min(0);
+    generatedBins->set_max(100);
+    generatedBins->set_count(4);
+    EXPECT_FALSE(createHistogramBins(config).has_value());
+
+    generatedBins->set_strategy(HistogramBinConfig::GeneratedBins::LINEAR);
+    const optional<HistogramBins> bins = createHistogramBins(config);
+    ASSERT_TRUE(bins.has_value());
+    EXPECT_EQ(vector<double>({0, 25, 50, 75, 100}), bins->getBoundaries());
+
+    config.mutable_explicit_bins()->add_bin(2);
+    config.mutable_explicit_bins()->add_bin(1);
+    EXPECT_FALSE(createHistogramBins(config).has_value());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
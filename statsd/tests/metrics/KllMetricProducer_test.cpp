@@ -30,11 +30,16 @@
 
 using namespace testing;
 using android::sp;
+using android::util::FIELD_TYPE_BYTES;
+using android::util::ProtoOutputStream;
 using dist_proc::aggregation::KllQuantile;
+using dist_proc::aggregation::KllQuantileOptions;
 using std::make_shared;
 using std::optional;
+using std::pair;
 using std::set;
 using std::shared_ptr;
+using std::string;
 using std::unique_ptr;
 using std::unordered_map;
 using std::vector;
@@ -62,7 +67,7 @@ const int64_t bucket6StartTimeNs = bucketStartTimeNs + 5 * bucketSizeNs;
 
 static void assertPastBucketsSingleKey(
         const std::unordered_map<MetricDimensionKey,
-                                 std::vector<PastBucket<unique_ptr<KllQuantile>>>>& mPastBuckets,
+                                 std::vector<PastBucket<unique_ptr<KllSketch>>>>& mPastBuckets,
         const std::initializer_list<int>& expectedKllCountsList,
         const std::initializer_list<int64_t>& expectedDurationNsList,
         const std::initializer_list<int64_t>& expectedStartTimeNsList,
@@ -82,7 +87,7 @@ static void assertPastBucketsSingleKey(
     }
 
     ASSERT_EQ(1, mPastBuckets.size());
-    const vector<PastBucket<unique_ptr<KllQuantile>>>& buckets = mPastBuckets.begin()->second;
+    const vector<PastBucket<unique_ptr<KllSketch>>>& buckets = mPastBuckets.begin()->second;
     ASSERT_EQ(expectedKllCounts.size(), buckets.size());
 
     for (int i = 0; i < expectedKllCounts.size(); i++) {
@@ -237,7 +242,7 @@ TEST(KllMetricProducerTest, TestPushedEventsWithoutCondition) {
     // has one slice
     ASSERT_EQ(1UL, kllProducer->mCurrentSlicedBucket.size());
     const KllMetricProducer::Interval& curInterval0 =
-            kllProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            kllProducer->getIntervals(kllProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(1, curInterval0.aggregate->num_values());
     EXPECT_GT(curInterval0.sampleSize, 0);
 
@@ -272,7 +277,7 @@ TEST(KllMetricProducerTest, TestPushedEventsWithCondition) {
     // has one slice
     ASSERT_EQ(1UL, kllProducer->mCurrentSlicedBucket.size());
     const KllMetricProducer::Interval& curInterval0 =
-            kllProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            kllProducer->getIntervals(kllProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(1, curInterval0.aggregate->num_values());
 
     LogEvent event3(/*uid=*/0, /*pid=*/0);
@@ -460,6 +465,142 @@ TEST(KllMetricProducerTest, TestByteSize) {
     EXPECT_EQ(expectedSize, kllProducer->byteSize());
 }
 
+TEST(KllMetricProducerTest, TestMergeBucketsInReport) {
+    KllMetric metric = KllMetricProducerTestHelper::createMetric();
+    metric.set_merge_buckets_in_report(true);
+    sp<KllMetricProducer> kllProducer =
+            KllMetricProducerTestHelper::createKllProducerNoConditions(metric);
+
+    const vector<int64_t> eventTimesNs = {bucketStartTimeNs + 10, bucketStartTimeNs + 20,
+                                          bucket2StartTimeNs + 10, bucket3StartTimeNs + 10};
+    for (const int64_t eventTimeNs : eventTimesNs) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        CreateRepeatedValueLogEvent(&event, atomId, eventTimeNs, 10);
+        kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event);
+    }
+    kllProducer->flushIfNeededLocked(bucket4StartTimeNs);
+    TRACE_CALL(assertPastBucketsSingleKey, kllProducer->mPastBuckets, {2, 1, 1},
+               {bucketSizeNs, bucketSizeNs, bucketSizeNs},
+               {bucketStartTimeNs, bucket2StartTimeNs, bucket3StartTimeNs},
+               {bucket2StartTimeNs, bucket3StartTimeNs, bucket4StartTimeNs});
+
+    ProtoOutputStream output;
+    kllProducer->onDumpReport(bucket4StartTimeNs + 10, /*include_current_partial_bucket=*/false,
+                              /*erase_data=*/false, FAST, nullptr, &output);
+
+    // The merged bucket keeps the condition true time of all three buckets.
+    TRACE_CALL(assertPastBucketsSingleKey, kllProducer->mPastBuckets, {4}, {3 * bucketSizeNs},
+               {bucketStartTimeNs}, {bucket4StartTimeNs});
+    StatsLogReport report = outputStreamToProto(&output);
+    ASSERT_EQ(1, report.kll_metrics().data_size());
+    ASSERT_EQ(1, report.kll_metrics().data(0).bucket_info_size());
+    const KllBucketInfo& bucketInfo = report.kll_metrics().data(0).bucket_info(0);
+    EXPECT_EQ(NanoToMillis(bucketStartTimeNs), bucketInfo.start_bucket_elapsed_millis());
+    EXPECT_EQ(NanoToMillis(bucket4StartTimeNs), bucketInfo.end_bucket_elapsed_millis());
+    ASSERT_EQ(1, bucketInfo.sketches_size());
+}
+
+TEST(KllMetricProducerTest, TestSparseSketchesPromotedPastCapacity) {
+    const KllMetric& metric = KllMetricProducerTestHelper::createMetric();
+    sp<KllMetricProducer> kllProducer =
+            KllMetricProducerTestHelper::createKllProducerNoConditions(metric);
+
+    for (size_t i = 0; i < KllSketch::kSparseCapacity; i++) {
+        LogEvent event(/*uid=*/0, /*pid=*/0);
+        CreateRepeatedValueLogEvent(&event, atomId, bucketStartTimeNs + 10 + i, i * 10);
+        kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event);
+    }
+    const KllMetricProducer::Interval& curInterval0 =
+            kllProducer->getIntervals(kllProducer->mCurrentSlicedBucket.begin()->second)[0];
+    EXPECT_TRUE(curInterval0.aggregate->isSparse());
+    EXPECT_EQ((int64_t)KllSketch::kSparseCapacity, curInterval0.aggregate->num_values());
+
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event, atomId, bucketStartTimeNs + 100, 100);
+    kllProducer->onMatchedLogEvent(1 /*log matcher index*/, event);
+    EXPECT_FALSE(curInterval0.aggregate->isSparse());
+    EXPECT_EQ((int64_t)KllSketch::kSparseCapacity + 1, curInterval0.aggregate->num_values());
+}
+
+TEST(KllSketchTest, TestSparseSketchWrittenAsKllQuantile) {
+    dist_proc::aggregation::MTRandomGenerator random;
+    KllSketch sketch(&random);
+    unique_ptr<KllQuantile> kll = KllQuantile::Create();
+    for (int64_t value : {5, -3, 12, 5}) {
+        sketch.add(value);
+        kll->Add(value);
+    }
+    ASSERT_TRUE(sketch.isSparse());
+
+    ProtoOutputStream expectedProto, actualProto;
+    writeKllSketchToProto(*kll, 1, &expectedProto);
+    writeKllSketchToProto(*sketch.buildKll(), 1, &actualProto);
+    vector<uint8_t> expectedBytes, actualBytes;
+    expectedProto.serializeToVector(&expectedBytes);
+    actualProto.serializeToVector(&actualBytes);
+    EXPECT_EQ(expectedBytes, actualBytes);
+
+    // Merging sparse sketches keeps them sparse until they hold more than kSparseCapacity values.
+    KllSketch other(&random);
+    other.add(7);
+    sketch.merge(other);
+    EXPECT_TRUE(sketch.isSparse());
+    EXPECT_EQ(5, sketch.num_values());
+    for (size_t i = 0; i < KllSketch::kSparseCapacity; i++) {
+        other.add(i);
+    }
+    ASSERT_FALSE(other.isSparse());
+    sketch.merge(other);
+    EXPECT_FALSE(sketch.isSparse());
+    EXPECT_EQ(5 + (int64_t)KllSketch::kSparseCapacity + 1, sketch.num_values());
+}
+
+namespace {
+
+// Returns the ProtoOutputStream bytes of kll written to field 1, once with the previous
+// SerializeToProto() path and once with writeKllSketchToProto().
+pair<vector<uint8_t>, vector<uint8_t>> writeSketchBothWays(KllQuantile& kll) {
+    const string expectedSketch = kll.SerializeToProto().SerializeAsString();
+    ProtoOutputStream expectedProto;
+    expectedProto.write(FIELD_TYPE_BYTES | 1, expectedSketch.data(), expectedSketch.size());
+
+    ProtoOutputStream actualProto;
+    EXPECT_EQ(expectedSketch.size(), writeKllSketchToProto(kll, 1, &actualProto));
+
+    vector<uint8_t> expectedBytes, actualBytes;
+    expectedProto.serializeToVector(&expectedBytes);
+    actualProto.serializeToVector(&actualBytes);
+    return {expectedBytes, actualBytes};
+}
+
+}  // anonymous namespace
+
+TEST(KllMetricProducerTest, TestWriteKllSketchToProtoMatchesSerializeToProto) {
+    unique_ptr<KllQuantile> kll = KllQuantile::Create();
+    auto [expected, actual] = writeSketchBothWays(*kll);
+    EXPECT_EQ(expected, actual);
+
+    for (int i = 0; i < 50; i++) {
+        kll->Add(i * 7 - 100);
+    }
+    std::tie(expected, actual) = writeSketchBothWays(*kll);
+    EXPECT_EQ(expected, actual);
+
+    // A small k turns the sampler on after enough values.
+    KllQuantileOptions options;
+    options.set_k(8);
+    options.set_inv_eps(10);
+    kll = KllQuantile::Create(options);
+    for (int i = 0; i < 100000; i++) {
+        kll->Add((i * 7919) % 100003 - 5000);
+    }
+    kll->Add(INT64_MIN);
+    kll->Add(INT64_MAX);
+    ASSERT_TRUE(kll->IsSamplerOn());
+    std::tie(expected, actual) = writeSketchBothWays(*kll);
+    EXPECT_EQ(expected, actual);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
@@ -469,6 +469,65 @@ TEST(MaxDurationTrackerTest, TestUploadThreshold) {
     EXPECT_EQ(thresholdDurationNs + 1, buckets[eventKey][0].mDuration);
 }
 
+// Tests that an unsliced condition pauses and resumes the durations through the condition clock,
+// and that their durations and the anomaly alarm are the same as when paused one by one.
+TEST(MaxDurationTrackerTest, TestConditionClock) {
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    unordered_map<MetricDimensionKey, vector<DurationBucket>> buckets;
+
+    int64_t bucketSizeNs = 60 * NS_PER_SEC;
+    int64_t bucketStartTimeNs = 10 * NS_PER_SEC;
+    int64_t eventStartTimeNs = 13 * NS_PER_SEC;
+
+    Alert alert;
+    alert.set_id(101);
+    alert.set_metric_id(1);
+    alert.set_trigger_if_sum_gt(40 * NS_PER_SEC);
+    alert.set_num_buckets(2);
+    sp<AlarmMonitor> alarmMonitor;
+    sp<DurationAnomalyTracker> anomalyTracker =
+            new DurationAnomalyTracker(alert, kConfigKey, alarmMonitor);
+    MaxDurationTracker tracker(kConfigKey, metricId, eventKey, wizard, 1, false, bucketStartTimeNs,
+                               0, bucketStartTimeNs, bucketSizeNs, false, false,
+                               {anomalyTracker});
+
+    tracker.noteStart(key1, true, eventStartTimeNs, ConditionKey(),
+                      StatsdStats::kDimensionKeySizeHardLimitMin);
+    tracker.noteStart(key2, true, eventStartTimeNs + 5 * NS_PER_SEC, ConditionKey(),
+                      StatsdStats::kDimensionKeySizeHardLimitMin);
+    EXPECT_EQ(2u, tracker.mNumStarted);
+
+    // Both durations join the clock as they pause.
+    tracker.onConditionChanged(false, eventStartTimeNs + 10 * NS_PER_SEC);
+    EXPECT_TRUE(tracker.mDetachedInfos.empty());
+    EXPECT_EQ(2u, tracker.mClockIndex.size());
+    EXPECT_EQ(0u, tracker.mNumStarted);
+    EXPECT_FALSE(tracker.hasStartedDuration());
+    ASSERT_EQ(0u, anomalyTracker->mAlarms.size());
+
+    // key1 has run for 10 seconds, so the anomaly is 30 seconds after the resume.
+    tracker.onConditionChanged(true, eventStartTimeNs + 20 * NS_PER_SEC);
+    EXPECT_TRUE(tracker.hasStartedDuration());
+    ASSERT_EQ(1u, anomalyTracker->mAlarms.size());
+    EXPECT_EQ(eventStartTimeNs + 50 * NS_PER_SEC,
+              anomalyTracker->mAlarms.begin()->second->timestampSec * NS_PER_SEC);
+
+    // key1 leaves the clock as it stops after 20 seconds, key2 has run for 15 and is left 25.
+    tracker.noteStop(key1, eventStartTimeNs + 30 * NS_PER_SEC, false);
+    EXPECT_EQ(1u, tracker.mClockIndex.size());
+    EXPECT_EQ(20 * NS_PER_SEC, tracker.mDuration);
+    ASSERT_EQ(1u, anomalyTracker->mAlarms.size());
+    EXPECT_EQ(eventStartTimeNs + 55 * NS_PER_SEC,
+              anomalyTracker->mAlarms.begin()->second->timestampSec * NS_PER_SEC);
+
+    tracker.noteStop(key2, eventStartTimeNs + 40 * NS_PER_SEC, false);
+    EXPECT_TRUE(tracker.mInfos.empty());
+    EXPECT_TRUE(tracker.mClockIndex.empty());
+    tracker.flushIfNeeded(bucketStartTimeNs + bucketSizeNs + 1, emptyThreshold, &buckets);
+    ASSERT_EQ(1u, buckets[eventKey].size());
+    EXPECT_EQ(25 * NS_PER_SEC, buckets[eventKey][0].mDuration);
+}
+
 TEST(MaxDurationTrackerTest, TestNoAccumulatingDuration) {
     const MetricDimensionKey eventKey = getMockedMetricDimensionKey(TagId, 0, "1");
     const HashableDimensionKey key1 = getMockedDimensionKey(TagId, 1, "1");
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/metrics/MetricDispatchPlan.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "metrics_test_helper.h"
+#include "src/metrics/CountMetricProducer.h"
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+using namespace testing;
+using std::unordered_map;
+using std::vector;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const ConfigKey kConfigKey(0, 12345);
+const uint64_t protoHash = 0x1234567890;
+
+vector<sp<MetricProducer>> createMetrics(const int numMetrics) {
+    sp<MockConditionWizard> wizard = new NaggyMock<MockConditionWizard>();
+    vector<sp<MetricProducer>> metrics;
+    for (int i = 0; i < numMetrics; i++) {
+        CountMetric metric;
+        metric.set_id(i + 1);
+        metric.set_bucket(ONE_MINUTE);
+        metrics.push_back(new CountMetricProducer(kConfigKey, metric, /*conditionIndex=*/-1, {},
+                                                  wizard, protoHash, /*timeBaseNs=*/0,
+                                                  /*startTimeNs=*/0));
+    }
+    return metrics;
+}
+
+vector<int> getMetricIndices(const MetricDispatchPlan::Range& range) {
+    vector<int> metricIndices;
+    for (const MetricDispatchPlan::Target& target : range) {
+        metricIndices.push_back(target.metricIndex);
+    }
+    return metricIndices;
+}
+
+}  // anonymous namespace
+
+TEST(MetricDispatchPlanTest, TestMatchedMetricRanges) {
+    const vector<sp<MetricProducer>> metrics = createMetrics(4);
+    MetricDispatchPlan plan;
+    plan.build(metrics, /*matcherCount=*/4, /*conditionCount=*/0,
+               /*trackerToMetricMap=*/{{0, {0, 2}}, {2, {1}}, {3, {3, 0}}},
+               /*conditionToMetricMap=*/{}, /*activationAtomTrackerToMetricMap=*/{},
+               /*deactivationAtomTrackerToMetricMap=*/{});
+
+    // Each matcher keeps the order of its metrics, next to their producer.
+    EXPECT_THAT(getMetricIndices(plan.getMatchedMetrics(0)), ElementsAre(0, 2));
+    EXPECT_THAT(getMetricIndices(plan.getMatchedMetrics(2)), ElementsAre(1));
+    EXPECT_THAT(getMetricIndices(plan.getMatchedMetrics(3)), ElementsAre(3, 0));
+    for (int matcherIndex = 0; matcherIndex < 4; matcherIndex++) {
+        for (const MetricDispatchPlan::Target& target : plan.getMatchedMetrics(matcherIndex)) {
+            EXPECT_EQ(metrics[target.metricIndex].get(), target.metric);
+        }
+    }
+
+    // A matcher without metrics has an empty range between its neighbours.
+    const MetricDispatchPlan::Range emptyRange = plan.getMatchedMetrics(1);
+    EXPECT_TRUE(emptyRange.empty());
+    EXPECT_EQ(emptyRange.begin(), emptyRange.end());
+
+    // The ranges of consecutive matchers are contiguous.
+    EXPECT_EQ(plan.getMatchedMetrics(0).end(), plan.getMatchedMetrics(1).begin());
+    EXPECT_EQ(plan.getMatchedMetrics(1).end(), plan.getMatchedMetrics(2).begin());
+    EXPECT_EQ(plan.getMatchedMetrics(2).end(), plan.getMatchedMetrics(3).begin());
+    EXPECT_EQ(2, plan.getMatchedMetrics(0).end() - plan.getMatchedMetrics(0).begin());
+    EXPECT_EQ(5, plan.getMatchedMetrics(3).end() - plan.getMatchedMetrics(0).begin());
+
+    // No matcher activates metrics.
+    for (int matcherIndex = 0; matcherIndex < 4; matcherIndex++) {
+        EXPECT_TRUE(plan.getActivatedMetrics(matcherIndex).empty());
+        EXPECT_TRUE(plan.getDeactivatedMetrics(matcherIndex).empty());
+    }
+}
+
+TEST(MetricDispatchPlanTest, TestLookupsOutOfRange) {
+    const vector<sp<MetricProducer>> metrics = createMetrics(2);
+    MetricDispatchPlan plan;
+    // Indices past the counts are not part of the plan.
+    plan.build(metrics, /*matcherCount=*/2, /*conditionCount=*/1,
+               /*trackerToMetricMap=*/{{1, {0}}, {2, {1}}},
+               /*conditionToMetricMap=*/{{0, {1}}, {1, {0}}},
+               /*activationAtomTrackerToMetricMap=*/{{1, {1}}},
+               /*deactivationAtomTrackerToMetricMap=*/{});
+
+    EXPECT_THAT(getMetricIndices(plan.getMatchedMetrics(1)), ElementsAre(0));
+    EXPECT_THAT(getMetricIndices(plan.getConditionMetrics(0)), ElementsAre(1));
+
+    // Lookups past the last index, or before the first one, find no metrics.
+    EXPECT_TRUE(plan.getMatchedMetrics(2).empty());
+    EXPECT_TRUE(plan.getMatchedMetrics(100).empty());
+    EXPECT_TRUE(plan.getMatchedMetrics(-1).empty());
+    EXPECT_TRUE(plan.getActivatedMetrics(2).empty());
+    EXPECT_TRUE(plan.getDeactivatedMetrics(2).empty());
+    EXPECT_TRUE(plan.getConditionMetrics(1).empty());
+    EXPECT_TRUE(plan.getConditionMetrics(-1).empty());
+}
+
+TEST(MetricDispatchPlanTest, TestTablesAreIndependent) {
+    const vector<sp<MetricProducer>> metrics = createMetrics(3);
+    MetricDispatchPlan plan;
+    plan.build(metrics, /*matcherCount=*/3, /*conditionCount=*/2,
+               /*trackerToMetricMap=*/{{0, {0}}},
+               /*conditionToMetricMap=*/{{1, {0, 1, 2}}},
+               /*activationAtomTrackerToMetricMap=*/{{1, {2}}},
+               /*deactivationAtomTrackerToMetricMap=*/{{2, {1, 2}}});
+
+    EXPECT_THAT(getMetricIndices(plan.getMatchedMetrics(0)), ElementsAre(0));
+    EXPECT_TRUE(plan.getMatchedMetrics(1).empty());
+    EXPECT_TRUE(plan.getMatchedMetrics(2).empty());
+    EXPECT_TRUE(plan.getActivatedMetrics(0).empty());
+    EXPECT_THAT(getMetricIndices(plan.getActivatedMetrics(1)), ElementsAre(2));
+    EXPECT_TRUE(plan.getDeactivatedMetrics(1).empty());
+    EXPECT_THAT(getMetricIndices(plan.getDeactivatedMetrics(2)), ElementsAre(1, 2));
+    EXPECT_TRUE(plan.getConditionMetrics(0).empty());
+    EXPECT_THAT(getMetricIndices(plan.getConditionMetrics(1)), ElementsAre(0, 1, 2));
+
+    // A rebuild replaces the previous plan.
+    plan.build(metrics, /*matcherCount=*/1, /*conditionCount=*/0,
+               /*trackerToMetricMap=*/{{0, {2}}}, /*conditionToMetricMap=*/{},
+               /*activationAtomTrackerToMetricMap=*/{},
+               /*deactivationAtomTrackerToMetricMap=*/{});
+    EXPECT_THAT(getMetricIndices(plan.getMatchedMetrics(0)), ElementsAre(2));
+    EXPECT_TRUE(plan.getActivatedMetrics(1).empty());
+    EXPECT_TRUE(plan.getDeactivatedMetrics(2).empty());
+    EXPECT_TRUE(plan.getConditionMetrics(1).empty());
+
+    plan.clear();
+    EXPECT_TRUE(plan.getMatchedMetrics(0).empty());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -660,7 +660,7 @@ TEST(NumericValueMetricProducerTest, TestEventsWithNonSlicedCondition) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     // startUpdated:false sum:0 start:100
@@ -688,7 +688,8 @@ TEST(NumericValueMetricProducerTest, TestEventsWithNonSlicedCondition) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_TRUE(curInterval.hasValue());
@@ -909,7 +910,7 @@ TEST(NumericValueMetricProducerTest, TestPushedEventsWithoutCondition) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(10, curInterval.aggregate.long_value);
     EXPECT_TRUE(curInterval.hasValue());
@@ -918,7 +919,8 @@ TEST(NumericValueMetricProducerTest, TestPushedEventsWithoutCondition) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(30, curInterval.aggregate.long_value);
 
     // Check dump report.
@@ -943,6 +945,51 @@ TEST(NumericValueMetricProducerTest, TestPushedEventsWithoutCondition) {
     ASSERT_EQ(0UL, valueProducer->mCurrentSlicedBucket.size());
 }
 
+TEST(NumericValueMetricProducerTest, TestIntervalsReusedAcrossBuckets) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerNoConditions(
+                    pullerManager, metric, /*pullAtomId=*/-1);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&event1, tagId, bucketStartTimeNs + 10, 1, 10);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&event2, tagId, bucketStartTimeNs + 20, 2, 20);
+    valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event1);
+    valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event2);
+
+    // Each dimension has a row of intervals in the same vector.
+    ASSERT_EQ(2UL, valueProducer->mCurrentSlicedBucket.size());
+    EXPECT_EQ(2UL, valueProducer->mIntervals.size());
+    EXPECT_EQ(2UL, valueProducer->mTouchedBuckets.size());
+    for (const auto& [metricDimensionKey, currentBucket] : valueProducer->mCurrentSlicedBucket) {
+        const int dimension =
+                metricDimensionKey.getDimensionKeyInWhat().getValues()[0].mValue.int_value;
+        ASSERT_EQ(1UL, valueProducer->getIntervals(currentBucket).size());
+        EXPECT_EQ(dimension * 10,
+                  valueProducer->getIntervals(currentBucket)[0].aggregate.long_value);
+    }
+
+    // The next bucket starts again from the first row.
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&event3, tagId, bucket2StartTimeNs + 10, 2, 5);
+    valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event3);
+    ASSERT_EQ(2UL, valueProducer->mPastBuckets.size());
+    ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
+    EXPECT_EQ(1UL, valueProducer->mIntervals.size());
+    ASSERT_EQ(1UL, valueProducer->mTouchedBuckets.size());
+    EXPECT_EQ(&*valueProducer->mCurrentSlicedBucket.begin(), valueProducer->mTouchedBuckets[0]);
+    NumericValueMetricProducer::CurrentBucket& currentBucket =
+            valueProducer->mCurrentSlicedBucket.begin()->second;
+    EXPECT_EQ(0, currentBucket.intervalRow);
+    EXPECT_EQ(5, valueProducer->getIntervals(currentBucket)[0].aggregate.long_value);
+    EXPECT_EQ(1, valueProducer->getIntervals(currentBucket)[0].sampleSize);
+}
+
 TEST(NumericValueMetricProducerTest, TestPushedEventsWithCondition) {
     ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
 
@@ -970,8 +1017,9 @@ TEST(NumericValueMetricProducerTest, TestPushedEventsWithCondition) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(20, curInterval.aggregate.long_value);
 
     LogEvent event3(/*uid=*/0, /*pid=*/0);
@@ -980,7 +1028,8 @@ TEST(NumericValueMetricProducerTest, TestPushedEventsWithCondition) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(50, curInterval.aggregate.long_value);
 
     valueProducer->onConditionChangedLocked(false, bucketStartTimeNs + 35);
@@ -991,7 +1040,8 @@ TEST(NumericValueMetricProducerTest, TestPushedEventsWithCondition) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(50, curInterval.aggregate.long_value);
 
     // Check dump report.
@@ -1241,7 +1291,7 @@ TEST(NumericValueMetricProducerTest, TestBucketBoundaryWithCondition) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(100, curBase.value().long_value);
@@ -1314,7 +1364,7 @@ TEST(NumericValueMetricProducerTest, TestBucketBoundaryWithCondition2) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     // startUpdated:false sum:0 start:100
     EXPECT_EQ(true, curBase.has_value());
@@ -1337,7 +1387,8 @@ TEST(NumericValueMetricProducerTest, TestBucketBoundaryWithCondition2) {
                                     {bucketStartTimeNs}, {bucket2StartTimeNs});
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(130, curBase.value().long_value);
@@ -1351,7 +1402,8 @@ TEST(NumericValueMetricProducerTest, TestBucketBoundaryWithCondition2) {
 
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(140, curBase.value().long_value);
@@ -1381,6 +1433,7 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateMin) {
     sp<NumericValueMetricProducer> valueProducer =
             NumericValueMetricProducerTestHelper::createValueProducerNoConditions(
                     pullerManager, metric, /*pullAtomId=*/-1);
+    EXPECT_FALSE(valueProducer->mSumsSingleFieldWithoutDiff);
 
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     CreateRepeatedValueLogEvent(&event1, tagId, bucketStartTimeNs + 10, 10);
@@ -1392,7 +1445,7 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateMin) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(10, curInterval.aggregate.long_value);
     EXPECT_TRUE(curInterval.hasValue());
 
@@ -1400,7 +1453,8 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateMin) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(10, curInterval.aggregate.long_value);
 
     valueProducer->flushIfNeededLocked(bucket2StartTimeNs);
@@ -1429,7 +1483,7 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateMax) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(10, curInterval.aggregate.long_value);
     EXPECT_TRUE(curInterval.hasValue());
 
@@ -1439,7 +1493,8 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateMax) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(20, curInterval.aggregate.long_value);
 
     valueProducer->flushIfNeededLocked(bucket2StartTimeNs);
@@ -1469,7 +1524,8 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateAvg) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval;
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(1, curInterval.sampleSize);
     EXPECT_EQ(10, curInterval.aggregate.long_value);
 
@@ -1477,7 +1533,8 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateAvg) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(25, curInterval.aggregate.long_value);
     EXPECT_EQ(2, curInterval.sampleSize);
 
@@ -1503,6 +1560,7 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateSum) {
     sp<NumericValueMetricProducer> valueProducer =
             NumericValueMetricProducerTestHelper::createValueProducerNoConditions(
                     pullerManager, metric, /*pullAtomId=*/-1);
+    EXPECT_TRUE(valueProducer->mSumsSingleFieldWithoutDiff);
 
     LogEvent event1(/*uid=*/0, /*pid=*/0);
     CreateRepeatedValueLogEvent(&event1, tagId, bucketStartTimeNs + 10, 10);
@@ -1513,7 +1571,7 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateSum) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(10, curInterval.aggregate.long_value);
     EXPECT_TRUE(curInterval.hasValue());
 
@@ -1521,7 +1579,8 @@ TEST(NumericValueMetricProducerTest, TestPushedAggregateSum) {
 
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(25, curInterval.aggregate.long_value);
 
     valueProducer->flushIfNeededLocked(bucket2StartTimeNs);
@@ -1551,7 +1610,7 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutput) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(10, curBase.value().long_value);
@@ -1564,7 +1623,8 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutput) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(15, curBase.value().long_value);
@@ -1578,7 +1638,8 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutput) {
 
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(15, curBase.value().long_value);
@@ -1589,7 +1650,8 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutput) {
     CreateRepeatedValueLogEvent(&event4, tagId, bucket2StartTimeNs + 15, 15);
     valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event4);
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     EXPECT_EQ(true, curBase.has_value());
@@ -1628,7 +1690,7 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutputMultiValue) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(10, curBase.value().long_value);
@@ -1642,13 +1704,15 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutputMultiValue) {
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(15, curBase.value().long_value);
     EXPECT_TRUE(curInterval.hasValue());
     EXPECT_EQ(5, curInterval.aggregate.long_value);
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[1];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[1];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[1];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(22, curBase.value().long_value);
@@ -1662,13 +1726,15 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutputMultiValue) {
     valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event3);
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(15, curBase.value().long_value);
     EXPECT_TRUE(curInterval.hasValue());
     EXPECT_EQ(0, curInterval.aggregate.long_value);
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[1];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[1];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[1];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(25, curBase.value().long_value);
@@ -1680,13 +1746,15 @@ TEST(NumericValueMetricProducerTest, TestSkipZeroDiffOutputMultiValue) {
 
     valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event4);
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(15, curBase.value().long_value);
     EXPECT_TRUE(curInterval.hasValue());
     EXPECT_EQ(0, curInterval.aggregate.long_value);
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[1];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[1];
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[1];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(29, curBase.value().long_value);
@@ -1736,7 +1804,7 @@ TEST(NumericValueMetricProducerTest, TestUseZeroDefaultBase) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     auto iter = valueProducer->mCurrentSlicedBucket.begin();
-    auto& interval1 = iter->second.intervals[0];
+    auto& interval1 = valueProducer->getIntervals(iter->second)[0];
     auto iterBase = valueProducer->mDimInfos.begin();
     auto& base1 = iterBase->second.dimExtras[0];
     EXPECT_EQ(1, iter->first.getDimensionKeyInWhat().getValues()[0].mValue.int_value);
@@ -1802,7 +1870,7 @@ TEST(NumericValueMetricProducerTest, TestUseZeroDefaultBaseWithPullFailures) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     const auto& it = valueProducer->mCurrentSlicedBucket.begin();
-    NumericValueMetricProducer::Interval& interval1 = it->second.intervals[0];
+    NumericValueMetricProducer::Interval& interval1 = valueProducer->getIntervals(it->second)[0];
     optional<Value>& base1 =
             valueProducer->mDimInfos.find(it->first.getDimensionKeyInWhat())->second.dimExtras[0];
     EXPECT_EQ(1, it->first.getDimensionKeyInWhat().getValues()[0].mValue.int_value);
@@ -1894,7 +1962,7 @@ TEST(NumericValueMetricProducerTest, TestTrimUnusedDimensionKey) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     auto iter = valueProducer->mCurrentSlicedBucket.begin();
-    auto& interval1 = iter->second.intervals[0];
+    auto& interval1 = valueProducer->getIntervals(iter->second)[0];
     auto iterBase = valueProducer->mDimInfos.begin();
     auto& base1 = iterBase->second.dimExtras[0];
     EXPECT_EQ(1, iter->first.getDimensionKeyInWhat().getValues()[0].mValue.int_value);
@@ -2011,7 +2079,7 @@ TEST(NumericValueMetricProducerTest, TestResetBaseOnPullFailAfterConditionChange
     // has one slice
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     NumericValueMetricProducer::Interval& curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value>& curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(100, curBase.value().long_value);
@@ -2051,7 +2119,7 @@ TEST(NumericValueMetricProducerTest, TestResetBaseOnPullFailAfterConditionChange
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval& curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value>& curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(100, curBase.value().long_value);
@@ -2100,7 +2168,7 @@ TEST(NumericValueMetricProducerTest, TestResetBaseOnPullFailBeforeConditionChang
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval& curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(false, curBase.has_value());
     EXPECT_EQ(0, curInterval.sampleSize);
@@ -2171,7 +2239,7 @@ TEST(NumericValueMetricProducerTest, TestBaseSetOnConditionChange) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval& curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(100, curBase.value().long_value);
@@ -2179,6 +2247,61 @@ TEST(NumericValueMetricProducerTest, TestBaseSetOnConditionChange) {
     EXPECT_EQ(true, valueProducer->mHasGlobalBase);
 }
 
+// Serves the same snapshot to every pull, as a puller does within its cool down.
+class CachedSnapshotPullerManager : public MockStatsPullerManager {
+public:
+    bool Pull(const int pullCode, const ConfigKey& key, const int64_t eventTimeNs,
+              PulledDataSnapshot* data) override {
+        *data = mSnapshot;
+        return true;
+    }
+
+    PulledDataSnapshot mSnapshot;
+};
+
+/*
+ * Tests that the bases are restored without matching the data again when the condition flaps and
+ * the pull returns the data they were set from.
+ */
+TEST(NumericValueMetricProducerTest, TestBasesRestoredForSamePulledData) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetricWithCondition();
+
+    sp<CachedSnapshotPullerManager> cachedPullerManager = new CachedSnapshotPullerManager();
+    cachedPullerManager->mSnapshot = std::make_shared<const vector<std::shared_ptr<LogEvent>>>(
+            vector<std::shared_ptr<LogEvent>>{
+                    CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 1, 100)});
+    sp<MockStatsPullerManager> pullerManager = cachedPullerManager;
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerWithCondition(
+                    pullerManager, metric, ConditionState::kFalse);
+
+    valueProducer->onConditionChanged(true, bucketStartTimeNs + 1);
+    valueProducer->onConditionChanged(false, bucketStartTimeNs + 2);
+    ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
+    EXPECT_FALSE(valueProducer->mDimInfos.begin()->second.dimExtras[0].has_value());
+    EXPECT_FALSE(valueProducer->mHasGlobalBase);
+    ASSERT_EQ(1UL, valueProducer->mParkedBases.size());
+
+    valueProducer->onConditionChanged(true, bucketStartTimeNs + 3);
+    EXPECT_TRUE(valueProducer->mParkedBases.empty());
+    ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
+    optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
+    ASSERT_TRUE(curBase.has_value());
+    EXPECT_EQ(100, curBase.value().long_value);
+    EXPECT_TRUE(valueProducer->mHasGlobalBase);
+
+    // New data is matched against the restored bases.
+    cachedPullerManager->mSnapshot = std::make_shared<const vector<std::shared_ptr<LogEvent>>>(
+            vector<std::shared_ptr<LogEvent>>{
+                    CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 4, 150)});
+    valueProducer->onConditionChanged(false, bucketStartTimeNs + 4);
+    ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
+    NumericValueMetricProducer::Interval& curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
+    EXPECT_EQ(50, curInterval.aggregate.long_value);
+    EXPECT_EQ(2, curInterval.sampleSize);
+}
+
 /*
  * Tests that a bucket is marked invalid when a condition change pull fails.
  */
@@ -2561,7 +2684,7 @@ TEST(NumericValueMetricProducerTest, TestEmptyDataResetsBase_onConditionChanged)
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval& curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(0, curInterval.sampleSize);
@@ -2571,14 +2694,16 @@ TEST(NumericValueMetricProducerTest, TestEmptyDataResetsBase_onConditionChanged)
     valueProducer->onConditionChanged(false, bucketStartTimeNs + 20);
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(0UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(0, curInterval.sampleSize);
     EXPECT_EQ(false, valueProducer->mHasGlobalBase);
 
     valueProducer->onConditionChanged(true, bucketStartTimeNs + 30);
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(0, curInterval.sampleSize);
     curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
@@ -2636,7 +2761,7 @@ TEST(NumericValueMetricProducerTest, TestEmptyDataResetsBase_onBucketBoundary) {
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval& curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_TRUE(curInterval.hasValue());
@@ -2694,6 +2819,50 @@ TEST(NumericValueMetricProducerTest, TestPartialResetOnBucketBoundaries) {
     EXPECT_EQ(true, valueProducer->mHasGlobalBase);
 }
 
+TEST(NumericValueMetricProducerTest, TestPulledRowsCombinedByDimension) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
+    metric.mutable_dimensions_in_what()->set_field(tagId);
+    metric.mutable_dimensions_in_what()->add_child()->set_field(1);
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, bucketStartTimeNs, _))
+            .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t,
+                                vector<std::shared_ptr<LogEvent>>* data) {
+                data->clear();
+                data->push_back(CreateTwoValueLogEvent(tagId, bucketStartTimeNs, 1, 3));
+                data->push_back(CreateTwoValueLogEvent(tagId, bucketStartTimeNs, 2, 10));
+                data->push_back(CreateTwoValueLogEvent(tagId, bucketStartTimeNs, 1, 4));
+                return true;
+            }));
+
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerNoConditions(pullerManager,
+                                                                                  metric);
+
+    // Rows with the same dimension are summed before being used as the base.
+    ASSERT_EQ(2UL, valueProducer->mDimInfos.size());
+    for (const auto& [whatKey, dimInfo] : valueProducer->mDimInfos) {
+        const int dimension = whatKey.getValues()[0].mValue.int_value;
+        ASSERT_TRUE(dimInfo.dimExtras[0].has_value());
+        EXPECT_EQ(dimension == 1 ? 7 : 10, dimInfo.dimExtras[0].value().long_value);
+    }
+
+    vector<shared_ptr<LogEvent>> allData;
+    allData.push_back(CreateTwoValueLogEvent(tagId, bucket2StartTimeNs + 1, 2, 15));
+    allData.push_back(CreateTwoValueLogEvent(tagId, bucket2StartTimeNs + 1, 1, 5));
+    allData.push_back(CreateTwoValueLogEvent(tagId, bucket2StartTimeNs + 1, 1, 6));
+    valueProducer->onDataPulled(allData, PullResult::PULL_RESULT_SUCCESS, bucket2StartTimeNs);
+
+    ASSERT_EQ(2UL, valueProducer->mPastBuckets.size());
+    for (const auto& [metricDimensionKey, buckets] : valueProducer->mPastBuckets) {
+        const int dimension =
+                metricDimensionKey.getDimensionKeyInWhat().getValues()[0].mValue.int_value;
+        ASSERT_EQ(1UL, buckets.size());
+        ASSERT_EQ(1UL, buckets[0].aggregates.size());
+        EXPECT_EQ(dimension == 1 ? 4 : 5, buckets[0].aggregates[0].long_value);
+    }
+}
+
 TEST_P(NumericValueMetricProducerTest_PartialBucket, TestFullBucketResetWhenLastBucketInvalid) {
     ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
 
@@ -2800,7 +2969,8 @@ TEST(NumericValueMetricProducerTest, TestBucketBoundariesOnConditionChange) {
     valueProducer->onConditionChanged(true, bucket2StartTimeNs + 10);
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
-    auto curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    auto curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     auto curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(true, curBase.has_value());
     EXPECT_EQ(5, curBase.value().long_value);
@@ -2940,7 +3110,8 @@ TEST(NumericValueMetricProducerTest, TestDataIsNotUpdatedWhenNoConditionChanged)
     valueProducer->onConditionChanged(false, bucketStartTimeNs + 12);
 
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
-    auto curInterval = valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+    auto curInterval =
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     auto curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_TRUE(curInterval.hasValue());
     EXPECT_EQ(2, curInterval.aggregate.long_value);
@@ -3045,6 +3216,55 @@ TEST(NumericValueMetricProducerTest, TestFastDumpWithoutCurrentBucket) {
     ASSERT_EQ(0, report.value_metrics().skipped_size());
 }
 
+TEST(NumericValueMetricProducerTest, TestSnapshotCurrentBucket) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetricWithCondition();
+
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    EXPECT_CALL(*pullerManager, Pull(tagId, kConfigKey, _, _))
+            // Condition changed to true.
+            .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t eventTimeNs,
+                                vector<std::shared_ptr<LogEvent>>* data) {
+                EXPECT_EQ(eventTimeNs, bucketStartTimeNs + 10);
+                data->clear();
+                data->push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 10, 10));
+                return true;
+            }))
+            // Condition changed to false.
+            .WillOnce(Invoke([](int tagId, const ConfigKey&, const int64_t eventTimeNs,
+                                vector<std::shared_ptr<LogEvent>>* data) {
+                EXPECT_EQ(eventTimeNs, bucketStartTimeNs + 20);
+                data->clear();
+                data->push_back(CreateRepeatedValueLogEvent(tagId, bucketStartTimeNs + 20, 15));
+                return true;
+            }));
+
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerWithCondition(
+                    pullerManager, metric, ConditionState::kFalse);
+
+    valueProducer->onConditionChanged(true, bucketStartTimeNs + 10);
+    valueProducer->onConditionChanged(false, bucketStartTimeNs + 20);
+
+    // The snapshot neither pulls nor closes the current bucket.
+    for (int64_t dumpTimeNs : {bucketStartTimeNs + 30, bucketStartTimeNs + 40}) {
+        ProtoOutputStream output;
+        std::set<string> strSet;
+        valueProducer->onDumpReport(dumpTimeNs, true /* include current bucket */, false,
+                                    SNAPSHOT, &strSet, &output);
+
+        StatsLogReport report = outputStreamToProto(&output);
+        ASSERT_EQ(1, report.value_metrics().data_size());
+        ASSERT_EQ(1, report.value_metrics().data(0).bucket_info_size());
+        const ValueBucketInfo& bucketInfo = report.value_metrics().data(0).bucket_info(0);
+        EXPECT_EQ(NanoToMillis(bucketStartTimeNs), bucketInfo.start_bucket_elapsed_millis());
+        EXPECT_EQ(NanoToMillis(dumpTimeNs), bucketInfo.end_bucket_elapsed_millis());
+        EXPECT_EQ(5, bucketInfo.values(0).value_long());
+        EXPECT_EQ(0, report.value_metrics().skipped_size());
+    }
+    EXPECT_EQ(bucketStartTimeNs, valueProducer->mCurrentBucketStartTimeNs);
+    ASSERT_EQ(0UL, valueProducer->mPastBuckets.size());
+}
+
 TEST(NumericValueMetricProducerTest, TestPullNeededNoTimeConstraints) {
     ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
 
@@ -3138,7 +3358,7 @@ TEST(NumericValueMetricProducerTest, TestPulledData_noDiff_withMultipleCondition
     ASSERT_EQ(1UL, valueProducer->mCurrentSlicedBucket.size());
     ASSERT_EQ(1UL, valueProducer->mDimInfos.size());
     NumericValueMetricProducer::Interval curInterval =
-            valueProducer->mCurrentSlicedBucket.begin()->second.intervals[0];
+            valueProducer->getIntervals(valueProducer->mCurrentSlicedBucket.begin()->second)[0];
     optional<Value> curBase = valueProducer->mDimInfos.begin()->second.dimExtras[0];
     EXPECT_EQ(false, curBase.has_value());
     EXPECT_TRUE(curInterval.hasValue());
@@ -4099,7 +4319,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_EQ(0, it->second.intervals[0].sampleSize);
+    EXPECT_EQ(0, valueProducer->getIntervals(it->second)[0].sampleSize);
     assertConditionTimer(it->second.conditionTimer, true, 0, bucketStartTimeNs);
 
     // Bucket status after screen state change kStateUnknown->ON.
@@ -4122,7 +4342,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_ON,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_EQ(0, it->second.intervals.size());
+    EXPECT_EQ(0, valueProducer->getIntervals(it->second).size());
     assertConditionTimer(it->second.conditionTimer, true, 0, bucketStartTimeNs + 5 * NS_PER_SEC);
     // Value for dimension, state key {{}, kStateUnknown}
     it++;
@@ -4130,8 +4350,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 5 * NS_PER_SEC);
 
@@ -4154,7 +4374,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_OFF,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_EQ(0, it->second.intervals.size());
+    EXPECT_EQ(0, valueProducer->getIntervals(it->second).size());
     assertConditionTimer(it->second.conditionTimer, true, 0, bucketStartTimeNs + 10 * NS_PER_SEC);
     // Value for dimension, state key {{}, ON}
     it++;
@@ -4162,8 +4382,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_ON,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(4, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(4, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 10 * NS_PER_SEC);
     // Value for dimension, state key {{}, kStateUnknown}
@@ -4172,8 +4392,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 5 * NS_PER_SEC);
 
@@ -4197,8 +4417,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_OFF,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(12, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(12, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 15 * NS_PER_SEC);
     // Value for dimension, state key {{}, ON}
@@ -4207,8 +4427,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_ON,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(4, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(4, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, true, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 15 * NS_PER_SEC);
     // Value for dimension, state key {{}, kStateUnknown}
@@ -4217,8 +4437,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 5 * NS_PER_SEC);
 
@@ -4245,7 +4465,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedState) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(android::view::DisplayStateEnum::DISPLAY_STATE_ON,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_EQ(it->second.intervals[0].sampleSize, 0);
+    EXPECT_EQ(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
     assertConditionTimer(it->second.conditionTimer, true, 0, bucketStartTimeNs + 50 * NS_PER_SEC);
 
     StatsLogReport report = outputStreamToProto(&output);
@@ -4373,7 +4593,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_EQ(0, it->second.intervals[0].sampleSize);
+    EXPECT_EQ(0, valueProducer->getIntervals(it->second)[0].sampleSize);
     assertConditionTimer(it->second.conditionTimer, true, 0, bucketStartTimeNs);
 
     // Bucket status after screen state change kStateUnknown->ON.
@@ -4403,8 +4623,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 5 * NS_PER_SEC);
 
@@ -4436,8 +4656,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 5 * NS_PER_SEC);
 
@@ -4469,8 +4689,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 5 * NS_PER_SEC);
 
@@ -4501,8 +4721,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(screenOnGroup.group_id(),
               it->first.getStateValuesKey().getValues()[0].mValue.long_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(16, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(16, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 10 * NS_PER_SEC,
                          bucketStartTimeNs + 15 * NS_PER_SEC);
     // Value for dimension, state key {{}, kStateUnknown}
@@ -4511,8 +4731,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithMap) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /* StateTracker::kStateUnknown */,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 5 * NS_PER_SEC,
                          bucketStartTimeNs + 5 * NS_PER_SEC);
 
@@ -5933,7 +6153,7 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithCondition) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(-1 /*StateTracker::kUnknown*/,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_EQ(0, it->second.intervals[0].sampleSize);
+    EXPECT_EQ(0, valueProducer->getIntervals(it->second)[0].sampleSize);
     assertConditionTimer(it->second.conditionTimer, false, 0, 0);
 
     // Bucket status after battery saver mode OFF event.
@@ -5963,8 +6183,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithCondition) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(BatterySaverModeStateChanged::ON,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(2, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(2, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 10 * NS_PER_SEC,
                          bucketStartTimeNs + 30 * NS_PER_SEC);
     // Value for key {{}, -1}
@@ -6010,8 +6230,8 @@ TEST(NumericValueMetricProducerTest, TestSlicedStateWithCondition) {
     ASSERT_EQ(1, it->first.getStateValuesKey().getValues().size());
     EXPECT_EQ(BatterySaverModeStateChanged::OFF,
               it->first.getStateValuesKey().getValues()[0].mValue.int_value);
-    EXPECT_GT(it->second.intervals[0].sampleSize, 0);
-    EXPECT_EQ(4, it->second.intervals[0].aggregate.long_value);
+    EXPECT_GT(valueProducer->getIntervals(it->second)[0].sampleSize, 0);
+    EXPECT_EQ(4, valueProducer->getIntervals(it->second)[0].aggregate.long_value);
     assertConditionTimer(it->second.conditionTimer, false, 10 * NS_PER_SEC,
                          bucket2StartTimeNs + 10 * NS_PER_SEC);
 
@@ -6495,6 +6715,52 @@ TEST(NumericValueMetricProducerTest, TestForcedBucketSplitWhenConditionUnknownSk
     EXPECT_EQ(NanoToMillis(appUpdateTimeNs), dropEvent.drop_time_millis());
 }
 
+TEST(NumericValueMetricProducerTest, TestCompressPastBuckets) {
+    ValueMetric metric = NumericValueMetricProducerTestHelper::createMetric();
+    metric.set_compress_past_buckets(true);
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    sp<NumericValueMetricProducer> valueProducer =
+            NumericValueMetricProducerTestHelper::createValueProducerNoConditions(
+                    pullerManager, metric, /*pullAtomId=*/-1);
+
+    LogEvent event1(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event1, tagId, bucketStartTimeNs + 10, 10);
+    valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event1);
+    LogEvent event2(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event2, tagId, bucket2StartTimeNs + 10, 20);
+    valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event2);
+    LogEvent event3(/*uid=*/0, /*pid=*/0);
+    CreateRepeatedValueLogEvent(&event3, tagId, bucket3StartTimeNs + 10, 30);
+    valueProducer->onMatchedLogEvent(1 /*log matcher index*/, event3);
+
+    // The 2 closed buckets are only kept compressed.
+    EXPECT_TRUE(valueProducer->mPastBuckets.empty());
+    ASSERT_EQ(1u, valueProducer->mCompressedPastBuckets.size());
+    EXPECT_EQ(valueProducer->mCompressedPastBuckets.byteSize(), valueProducer->byteSizeLocked());
+    EXPECT_LT(valueProducer->byteSizeLocked(), 2 * sizeof(PastBucket<Value>));
+
+    valueProducer->prepareDumpReportLocked();
+    EXPECT_TRUE(valueProducer->mCompressedPastBuckets.empty());
+    EXPECT_EQ(2 * sizeof(PastBucket<Value>), valueProducer->byteSizeLocked());
+    assertPastBucketValuesSingleKey(valueProducer->mPastBuckets, {10, 20},
+                                    {bucketSizeNs, bucketSizeNs}, {0, 0},
+                                    {bucketStartTimeNs, bucket2StartTimeNs},
+                                    {bucket2StartTimeNs, bucket3StartTimeNs});
+
+    ProtoOutputStream output;
+    valueProducer->onDumpReport(bucket3StartTimeNs + 20, false /* include recent buckets */,
+                                true, FAST /* dumpLatency */, nullptr, &output);
+    StatsLogReport report = outputStreamToProto(&output);
+    backfillStartEndTimestamp(&report);
+    ASSERT_EQ(1, report.value_metrics().data_size());
+    const auto& data = report.value_metrics().data(0);
+    ASSERT_EQ(2, data.bucket_info_size());
+    EXPECT_EQ(10, data.bucket_info(0).values(0).value_long());
+    EXPECT_EQ(20, data.bucket_info(1).values(0).value_long());
+    EXPECT_EQ(bucket2StartTimeNs, data.bucket_info(1).start_bucket_elapsed_nanos());
+    EXPECT_EQ(0u, valueProducer->byteSizeLocked());
+}
+
 TEST(NumericValueMetricProducerTest, TestUploadThreshold) {
     // Create metric with upload threshold and two value fields.
     int64_t thresholdValue = 15;
@@ -7599,13 +7865,16 @@ TEST(NumericValueMetricProducerTest, TestSampleSize) {
 
     NumericValueMetricProducer::Interval curInterval;
     ASSERT_EQ(1UL, valueProducerAvg->mCurrentSlicedBucket.size());
-    curInterval = valueProducerAvg->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval = valueProducerAvg->getIntervals(
+            valueProducerAvg->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(2, curInterval.sampleSize);
     ASSERT_EQ(1UL, valueProducerSum->mCurrentSlicedBucket.size());
-    curInterval = valueProducerSum->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval = valueProducerSum->getIntervals(
+            valueProducerSum->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(3, curInterval.sampleSize);
     ASSERT_EQ(1UL, valueProducerSumWithSampleSize->mCurrentSlicedBucket.size());
-    curInterval = valueProducerSumWithSampleSize->mCurrentSlicedBucket.begin()->second.intervals[0];
+    curInterval = valueProducerSumWithSampleSize->getIntervals(
+            valueProducerSumWithSampleSize->mCurrentSlicedBucket.begin()->second)[0];
     EXPECT_EQ(3, curInterval.sampleSize);
 
     valueProducerAvg->flushIfNeededLocked(bucket2StartTimeNs);
@@ -0,0 +1,148 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/NumericValuePastBuckets.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <vector>
+
+#include "metrics_test_helper.h"
+
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+PastBucket<Value> makeBucket(int64_t startNs, int64_t endNs, const vector<Value>& aggregates,
+                             const vector<int>& sampleSizes = {}, int64_t conditionTrueNs = 0,
+                             int64_t conditionCorrectionNs = 0) {
+    PastBucket<Value> bucket;
+    bucket.mBucketStartNs = startNs;
+    bucket.mBucketEndNs = endNs;
+    for (size_t i = 0; i < aggregates.size(); i++) {
+        bucket.aggIndex.push_back(i);
+    }
+    bucket.aggregates = aggregates;
+    bucket.sampleSizes = sampleSizes;
+    bucket.mConditionTrueNs = conditionTrueNs;
+    bucket.mConditionCorrectionNs = conditionCorrectionNs;
+    return bucket;
+}
+
+void expectBucketEq(const PastBucket<Value>& expected, const PastBucket<Value>& actual) {
+    EXPECT_EQ(expected.mBucketStartNs, actual.mBucketStartNs);
+    EXPECT_EQ(expected.mBucketEndNs, actual.mBucketEndNs);
+    EXPECT_EQ(expected.aggIndex, actual.aggIndex);
+    EXPECT_EQ(expected.aggregates, actual.aggregates);
+    EXPECT_EQ(expected.sampleSizes, actual.sampleSizes);
+    EXPECT_EQ(expected.mConditionTrueNs, actual.mConditionTrueNs);
+    EXPECT_EQ(expected.mConditionCorrectionNs, actual.mConditionCorrectionNs);
+}
+
+}  // anonymous namespace
+
+TEST(NumericValuePastBucketsTest, TestRoundTrip) {
+    const MetricDimensionKey key1 = getMockedMetricDimensionKey(/*tagId=*/1, /*key=*/1, "111");
+    const MetricDimensionKey key2 = getMockedMetricDimensionKey(/*tagId=*/1, /*key=*/1, "222");
+    const vector<PastBucket<Value>> buckets1 = {
+            makeBucket(100, 200, {Value((int64_t)5), Value(1.5)}, /*sampleSizes=*/{2, 3},
+                       /*conditionTrueNs=*/50, /*conditionCorrectionNs=*/-20),
+            // A partial bucket, then a gap.
+            makeBucket(200, 250, {Value((int64_t)-7), Value(1.5)}, {1, 1}, 40, 30),
+            makeBucket(400, 500, {Value(std::numeric_limits<int64_t>::max()), Value(-0.1)},
+                       {4, 9}),
+            makeBucket(500, 600, {Value(std::numeric_limits<int64_t>::min()), Value(1e300)},
+                       {4, 9}),
+    };
+    PastBucket<Value> sparseBucket = makeBucket(100, 200, {Value(2.5)});
+    sparseBucket.aggIndex = {3};
+
+    NumericValuePastBuckets pastBuckets;
+    EXPECT_TRUE(pastBuckets.empty());
+    pastBuckets.addBucket(key1, buckets1[0]);
+    pastBuckets.addBucket(key2, sparseBucket);
+    for (size_t i = 1; i < buckets1.size(); i++) {
+        pastBuckets.addBucket(key1, buckets1[i]);
+    }
+
+    ASSERT_EQ(2u, pastBuckets.size());
+    EXPECT_TRUE(pastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY).empty());
+    const vector<PastBucket<Value>> actual1 = pastBuckets.getBuckets(key1);
+    ASSERT_EQ(buckets1.size(), actual1.size());
+    for (size_t i = 0; i < buckets1.size(); i++) {
+        expectBucketEq(buckets1[i], actual1[i]);
+    }
+    const vector<PastBucket<Value>> actual2 = pastBuckets.getBuckets(key2);
+    ASSERT_EQ(1u, actual2.size());
+    expectBucketEq(sparseBucket, actual2[0]);
+
+    // Keys are visited in the order they were first added.
+    vector<MetricDimensionKey> keys;
+    pastBuckets.forEach([&](const MetricDimensionKey& key, vector<PastBucket<Value>>& buckets) {
+        keys.push_back(key);
+        EXPECT_FALSE(buckets.empty());
+    });
+    EXPECT_EQ(vector<MetricDimensionKey>({key1, key2}), keys);
+
+    pastBuckets.clear();
+    EXPECT_TRUE(pastBuckets.empty());
+    EXPECT_EQ(0u, pastBuckets.byteSize());
+}
+
+TEST(NumericValuePastBucketsTest, TestConsecutiveBucketsAreSmall) {
+    NumericValuePastBuckets pastBuckets;
+    const int64_t bucketSizeNs = 5 * 60 * NS_PER_SEC;
+    const int64_t startNs = 1000 * NS_PER_SEC;
+    pastBuckets.addBucket(DEFAULT_METRIC_DIMENSION_KEY,
+                          makeBucket(startNs, startNs + bucketSizeNs, {Value((int64_t)1000)}));
+    const size_t firstBucketSize = pastBuckets.byteSize();
+
+    for (int i = 1; i <= 100; i++) {
+        const int64_t bucketStartNs = startNs + i * bucketSizeNs;
+        pastBuckets.addBucket(DEFAULT_METRIC_DIMENSION_KEY,
+                              makeBucket(bucketStartNs, bucketStartNs + bucketSizeNs,
+                                         {Value((int64_t)1000 + i)}));
+    }
+    // The boundaries, condition times, value count, index and value delta take a byte each.
+    EXPECT_EQ(firstBucketSize + 100 * 7, pastBuckets.byteSize());
+    EXPECT_LT(pastBuckets.byteSize(), 101 * sizeof(PastBucket<Value>));
+
+    const vector<PastBucket<Value>> buckets =
+            pastBuckets.getBuckets(DEFAULT_METRIC_DIMENSION_KEY);
+    ASSERT_EQ(101u, buckets.size());
+    expectBucketEq(makeBucket(startNs + 100 * bucketSizeNs, startNs + 101 * bucketSizeNs,
+                              {Value((int64_t)1100)}),
+                   buckets[100]);
+}
+
+TEST(NumericValuePastBucketsTest, TestCanEncode) {
+    EXPECT_TRUE(NumericValuePastBuckets::canEncode(
+            makeBucket(100, 200, {Value((int64_t)1), Value(2.0)})));
+    EXPECT_FALSE(NumericValuePastBuckets::canEncode(makeBucket(100, 200, {Value((int32_t)1)})));
+    EXPECT_FALSE(NumericValuePastBuckets::canEncode(makeBucket(100, 200, {Value()})));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
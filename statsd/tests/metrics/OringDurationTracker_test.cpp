@@ -504,10 +504,10 @@ TEST(OringDurationTrackerTest, TestAnomalyDetectionExpiredAlarm) {
                       StatsdStats::kDimensionKeySizeHardLimitMin);
     tracker.noteStop(kEventKey1, eventStartTimeNs + 10, false);
     EXPECT_EQ(anomalyTracker->getRefractoryPeriodEndsSec(eventKey), 0U);
-    EXPECT_TRUE(tracker.mStarted.empty());
+    EXPECT_EQ(0u, tracker.mNumStarted);
     EXPECT_EQ(10LL, tracker.mStateKeyDurationMap[DEFAULT_DIMENSION_KEY].mDuration);  // 10ns
 
-    ASSERT_EQ(0u, tracker.mStarted.size());
+    ASSERT_EQ(0u, tracker.mNumStarted);
 
     tracker.noteStart(kEventKey1, true, eventStartTimeNs + 20, ConditionKey(),
                       StatsdStats::kDimensionKeySizeHardLimitMin);
@@ -660,10 +660,10 @@ TEST(OringDurationTrackerTest, TestClearStateKeyMapWhenBucketFull) {
 
     tracker.noteStart(kEventKey1, true, bucketStartTimeNs + 100, ConditionKey(),
                       StatsdStats::kDimensionKeySizeHardLimitMin);
-    EXPECT_FALSE(tracker.mStarted.empty());
+    EXPECT_NE(0u, tracker.mNumStarted);
     tracker.onConditionChanged(false, bucketStartTimeNs + 150);
-    EXPECT_TRUE(tracker.mStarted.empty());
-    EXPECT_FALSE(tracker.mPaused.empty());
+    EXPECT_EQ(0u, tracker.mNumStarted);
+    EXPECT_NE(0u, tracker.mNumPaused);
     EXPECT_FALSE(tracker.mStateKeyDurationMap.empty());
     EXPECT_TRUE(tracker.hasAccumulatedDuration());
 
@@ -702,7 +702,7 @@ TEST(OringDurationTrackerTest, TestClearStateKeyMapWhenNoTrackers) {
     tracker.noteStop(kEventKey1, eventStartTimeNs + 10, false);
     tracker.flushCurrentBucket(eventStartTimeNs + 20, emptyThreshold, 0, &buckets);
 
-    EXPECT_TRUE(tracker.mStarted.empty());
+    EXPECT_EQ(0u, tracker.mNumStarted);
     // During flush, we will clear the map since there are no anomaly trackers.
     EXPECT_TRUE(tracker.mStateKeyDurationMap.empty());
     EXPECT_FALSE(tracker.hasAccumulatedDuration());
@@ -0,0 +1,84 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/ReportDimensionDictionary.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "metrics_test_helper.h"
+#include "src/stats_log.pb.h"
+
+using android::util::ProtoOutputStream;
+using std::vector;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const int kDimensionIndexFieldId = 8;  // CountMetricData.dimension_index_in_what
+const int kDictionaryFieldId = 11;     // ConfigMetricsReport.dimension_dictionary
+
+vector<uint8_t> toBytes(ProtoOutputStream* output) {
+    vector<uint8_t> bytes;
+    output->serializeToVector(&bytes);
+    return bytes;
+}
+
+}  // namespace
+
+TEST(ReportDimensionDictionaryTest, TestIndexesAndEntries) {
+    ReportDimensionDictionary dictionary;
+    const HashableDimensionKey key1 = getMockedDimensionKey(/*tagId=*/1, /*key=*/1, "111");
+    const HashableDimensionKey key2 = getMockedDimensionKey(/*tagId=*/1, /*key=*/1, "222");
+
+    // Each key, written as the dimension of a CountMetricData, gets the index it was first
+    // added with. The index 0 is still written.
+    const vector<HashableDimensionKey> keys = {key1, key2, key1, HashableDimensionKey()};
+    vector<int> indexes;
+    for (const HashableDimensionKey& key : keys) {
+        ProtoOutputStream output;
+        dictionary.writeIndex(kDimensionIndexFieldId, key, &output);
+        const vector<uint8_t> bytes = toBytes(&output);
+        CountMetricData data;
+        ASSERT_TRUE(data.ParseFromArray(bytes.data(), bytes.size()));
+        indexes.push_back(data.has_dimension_index_in_what() ? data.dimension_index_in_what()
+                                                             : -1);
+    }
+    EXPECT_EQ(vector<int>({0, 1, 0, -1}), indexes);
+    EXPECT_EQ(2u, dictionary.size());
+
+    ConfigMetricsReport report;
+    ProtoOutputStream reportOutput;
+    dictionary.writeToProto(kDictionaryFieldId, nullptr, &reportOutput);
+    const vector<uint8_t> bytes = toBytes(&reportOutput);
+    ASSERT_TRUE(report.ParseFromArray(bytes.data(), bytes.size()));
+    ASSERT_EQ(2, report.dimension_dictionary_size());
+    ASSERT_EQ(1, report.dimension_dictionary(0).dimension_leaf_values_in_what_size());
+    EXPECT_EQ("111", report.dimension_dictionary(0).dimension_leaf_values_in_what(0).value_str());
+    ASSERT_EQ(1, report.dimension_dictionary(1).dimension_leaf_values_in_what_size());
+    EXPECT_EQ("222", report.dimension_dictionary(1).dimension_leaf_values_in_what(0).value_str());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -64,7 +64,7 @@ TEST_F(RestrictedEventMetricProducerTest, TestOnMatchedLogEventMultipleEvents) {
 
     producer.onMatchedLogEvent(/*matcherIndex=*/1, *event1);
     producer.onMatchedLogEvent(/*matcherIndex=*/1, *event2);
-    producer.flushRestrictedData();
+    producer.flushRestrictedData(/*asyncInsert=*/false);
 
     stringstream query;
     query << "SELECT * FROM metric_" << metricId1;
@@ -84,6 +84,68 @@ TEST_F(RestrictedEventMetricProducerTest, TestOnMatchedLogEventMultipleEvents) {
                 ElementsAre("atomId", "elapsedTimestampNs", "wallTimestampNs", "field_1"));
 }
 
+TEST_F(RestrictedEventMetricProducerTest, TestFlushAsyncInsert) {
+    EventMetric metric;
+    metric.set_id(metricId1);
+    RestrictedEventMetricProducer producer(configKey, metric,
+                                           /*conditionIndex=*/-1,
+                                           /*initialConditionCache=*/{}, new ConditionWizard(),
+                                           /*protoHash=*/0x1234567890,
+                                           /*startTimeNs=*/0);
+    std::unique_ptr<LogEvent> event1 = CreateRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/1);
+    std::unique_ptr<LogEvent> event2 = CreateRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/3);
+
+    producer.onMatchedLogEvent(/*matcherIndex=*/1, *event1);
+    producer.flushRestrictedData(/*asyncInsert=*/true);
+    producer.onMatchedLogEvent(/*matcherIndex=*/1, *event2);
+    producer.flushRestrictedData(/*asyncInsert=*/true);
+    EXPECT_EQ(producer.byteSize(), 0);
+
+    // The query waits for the queued inserts.
+    stringstream query;
+    query << "SELECT * FROM metric_" << metricId1;
+    string err;
+    vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    vector<vector<string>> rows;
+    EXPECT_TRUE(dbutils::query(configKey, query.str(), rows, columnTypes, columnNames, err));
+    ASSERT_EQ(rows.size(), 2);
+    EXPECT_EQ(/*elapsedTimestampNs=*/rows[0][1], to_string(event1->GetElapsedTimestampNs()));
+    EXPECT_EQ(/*elapsedTimestampNs=*/rows[1][1], to_string(event2->GetElapsedTimestampNs()));
+}
+
+TEST_F(RestrictedEventMetricProducerTest, TestFlushAfterDbDeleted) {
+    EventMetric metric;
+    metric.set_id(metricId1);
+    RestrictedEventMetricProducer producer(configKey, metric,
+                                           /*conditionIndex=*/-1,
+                                           /*initialConditionCache=*/{}, new ConditionWizard(),
+                                           /*protoHash=*/0x1234567890,
+                                           /*startTimeNs=*/0);
+    std::unique_ptr<LogEvent> event1 = CreateRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/1);
+    std::unique_ptr<LogEvent> event2 = CreateRestrictedLogEvent(/*atomTag=*/123, /*timestampNs=*/3);
+
+    producer.onMatchedLogEvent(/*matcherIndex=*/1, *event1);
+    producer.flushRestrictedData(/*asyncInsert=*/false);
+    ASSERT_TRUE(producer.mTableDbGeneration.has_value());
+
+    // The table is created again in the new db.
+    dbutils::deleteDb(configKey);
+    producer.onMatchedLogEvent(/*matcherIndex=*/1, *event2);
+    producer.flushRestrictedData(/*asyncInsert=*/false);
+
+    stringstream query;
+    query << "SELECT * FROM metric_" << metricId1;
+    string err;
+    vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    vector<vector<string>> rows;
+    EXPECT_TRUE(dbutils::query(configKey, query.str(), rows, columnTypes, columnNames, err));
+    ASSERT_EQ(rows.size(), 1);
+    EXPECT_EQ(/*elapsedTimestampNs=*/rows[0][1], to_string(event2->GetElapsedTimestampNs()));
+    EXPECT_EQ(producer.mTableDbGeneration, dbutils::getDbGeneration(configKey));
+}
+
 TEST_F(RestrictedEventMetricProducerTest, TestOnMatchedLogEventMultipleFields) {
     EventMetric metric;
     metric.set_id(metricId2);
@@ -105,7 +167,7 @@ TEST_F(RestrictedEventMetricProducerTest, TestOnMatchedLogEventMultipleFields) {
     parseStatsEventToLogEvent(statsEvent, &logEvent);
 
     producer.onMatchedLogEvent(/*matcherIndex=1*/ 1, logEvent);
-    producer.flushRestrictedData();
+    producer.flushRestrictedData(/*asyncInsert=*/false);
 
     stringstream query;
     query << "SELECT * FROM metric_" << metricId2;
@@ -142,7 +204,7 @@ TEST_F(RestrictedEventMetricProducerTest, TestOnMatchedLogEventWithCondition) {
     producer.onMatchedLogEvent(/*matcherIndex=*/1, *event1);
     producer.onConditionChanged(false, 1);
     producer.onMatchedLogEvent(/*matcherIndex=*/1, *event2);
-    producer.flushRestrictedData();
+    producer.flushRestrictedData(/*asyncInsert=*/false);
 
     std::stringstream query;
     query << "SELECT * FROM metric_" << metricId1;
@@ -191,7 +253,7 @@ TEST_F(RestrictedEventMetricProducerTest, TestOnMetricRemove) {
 
     std::unique_ptr<LogEvent> event1 = CreateRestrictedLogEvent(/*timestampNs=*/1);
     producer.onMatchedLogEvent(/*matcherIndex=*/1, *event1);
-    producer.flushRestrictedData();
+    producer.flushRestrictedData(/*asyncInsert=*/false);
     EXPECT_TRUE(metricTableExist(metricId1));
 
     producer.onMetricRemove();
@@ -216,7 +278,7 @@ TEST_F(RestrictedEventMetricProducerTest, TestRestrictedEventMetricTtlDeletesFir
 
     producer.onMatchedLogEvent(/*matcherIndex=*/1, *event1);
     producer.onMatchedLogEvent(/*matcherIndex=*/1, *event2);
-    producer.flushRestrictedData();
+    producer.flushRestrictedData(/*asyncInsert=*/false);
     sqlite3* dbHandle = dbutils::getDb(configKey);
     producer.enforceRestrictedDataTtl(dbHandle, currentTimeNs + 100);
     dbutils::closeDb(dbHandle);
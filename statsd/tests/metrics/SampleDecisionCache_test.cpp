@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/metrics/SampleDecisionCache.h"
+
+#include <gtest/gtest.h>
+
+#include "tests/statsd_test_util.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(SampleDecisionCacheTest, TestFindForCurrentEvent) {
+    sp<SampleDecisionCache> cache = new SampleDecisionCache();
+    LogEvent event(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&event, /*atomId=*/10, /*eventTimeNs=*/1, 3, 4);
+    LogEvent otherEvent(/*uid=*/0, /*pid=*/0);
+    CreateTwoValueLogEvent(&otherEvent, /*atomId=*/10, /*eventTimeNs=*/2, 3, 4);
+    const Matcher sampledField = getSimpleMatcher(10, 1);
+    const Matcher otherField = getSimpleMatcher(10, 2);
+
+    // Nothing is cached outside of an event.
+    cache->add(event.getValues(), sampledField, 2, false);
+    EXPECT_EQ(std::nullopt, cache->find(event.getValues(), sampledField, 2));
+
+    cache->setCurrentEvent(&event);
+    cache->add(event.getValues(), sampledField, 2, false);
+    EXPECT_EQ(std::optional<bool>(false), cache->find(event.getValues(), sampledField, 2));
+    EXPECT_EQ(std::nullopt, cache->find(event.getValues(), sampledField, 3));
+    EXPECT_EQ(std::nullopt, cache->find(event.getValues(), otherField, 2));
+    EXPECT_EQ(std::nullopt, cache->find(otherEvent.getValues(), sampledField, 2));
+
+    // Copies of the values, like pulled aggregates, are not cached.
+    const std::vector<FieldValue> copy = event.getValues();
+    EXPECT_EQ(std::nullopt, cache->find(copy, sampledField, 2));
+
+    // A new event drops the decisions of the previous one.
+    cache->setCurrentEvent(&otherEvent);
+    EXPECT_EQ(std::nullopt, cache->find(otherEvent.getValues(), sampledField, 2));
+    cache->setCurrentEvent(nullptr);
+    EXPECT_EQ(std::nullopt, cache->find(event.getValues(), sampledField, 2));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,90 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/metrics/SpaceSavingSummary.h"
+
+#include <gtest/gtest.h>
+
+#include "metrics_test_helper.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+MetricDimensionKey keyOf(int value) {
+    return getMockedMetricDimensionKey(/*tagId=*/1, /*key=*/1, std::to_string(value));
+}
+
+}  // anonymous namespace
+
+TEST(SpaceSavingSummaryTest, TestExactUnderCapacity) {
+    SpaceSavingSummary summary(/*capacity=*/3);
+    summary.add(keyOf(1), 4);
+    summary.add(keyOf(2));
+    summary.add(keyOf(1));
+
+    const std::vector<SpaceSavingSummary::Entry> entries = summary.getTopEntries();
+    ASSERT_EQ(2UL, entries.size());
+    EXPECT_EQ(keyOf(1), entries[0].key);
+    EXPECT_EQ(5, entries[0].count);
+    EXPECT_EQ(0, entries[0].error);
+    EXPECT_EQ(keyOf(2), entries[1].key);
+    EXPECT_EQ(1, entries[1].count);
+    EXPECT_EQ(6, summary.getTotalCount());
+}
+
+TEST(SpaceSavingSummaryTest, TestReplacesLowestCount) {
+    SpaceSavingSummary summary(/*capacity=*/2);
+    summary.add(keyOf(1), 10);
+    summary.add(keyOf(2), 2);
+    summary.add(keyOf(3));
+
+    const std::vector<SpaceSavingSummary::Entry> entries = summary.getTopEntries();
+    ASSERT_EQ(2UL, entries.size());
+    EXPECT_EQ(keyOf(1), entries[0].key);
+    EXPECT_EQ(10, entries[0].count);
+    EXPECT_EQ(keyOf(3), entries[1].key);
+    EXPECT_EQ(3, entries[1].count);
+    EXPECT_EQ(2, entries[1].error);
+    EXPECT_EQ(13, summary.getTotalCount());
+
+    // The replaced key starts over with the lowest count as error.
+    summary.add(keyOf(2));
+    EXPECT_EQ(keyOf(2), summary.getTopEntries()[1].key);
+    EXPECT_EQ(3, summary.getTopEntries()[1].error);
+
+    summary.clear();
+    EXPECT_TRUE(summary.empty());
+    EXPECT_EQ(0, summary.getTotalCount());
+}
+
+TEST(SpaceSavingSummaryTest, TestCapacity) {
+    SpaceSavingSummary disabled(/*capacity=*/0);
+    disabled.add(keyOf(1));
+    EXPECT_TRUE(disabled.empty());
+
+    EXPECT_EQ(SpaceSavingSummary::kMaxCapacity,
+              SpaceSavingSummary(SpaceSavingSummary::kMaxCapacity + 1).getCapacity());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
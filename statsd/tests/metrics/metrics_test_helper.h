@@ -42,6 +42,16 @@ public:
                             vector<std::shared_ptr<LogEvent>>* data));
     MOCK_METHOD4(Pull, bool(const int pullCode, const vector<int32_t>& uids,
                             const int64_t eventTimeNs, vector<std::shared_ptr<LogEvent>>* data));
+    // Pulls a new snapshot from the mocked Pull above.
+    bool Pull(const int pullCode, const ConfigKey& key, const int64_t eventTimeNs,
+              PulledDataSnapshot* data) override {
+        vector<std::shared_ptr<LogEvent>> events;
+        if (!Pull(pullCode, key, eventTimeNs, &events)) {
+            return false;
+        }
+        *data = std::make_shared<const vector<std::shared_ptr<LogEvent>>>(std::move(events));
+        return true;
+    }
     MOCK_METHOD2(RegisterPullUidProvider,
                  void(const ConfigKey& configKey, wp<PullUidProvider> provider));
     MOCK_METHOD2(UnregisterPullUidProvider,
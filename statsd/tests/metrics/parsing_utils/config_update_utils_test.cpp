@@ -516,6 +516,51 @@ TEST_F(ConfigUpdateTest, TestUpdateMatchers) {
     EXPECT_NE(replacedMatchers.find(combination2Id), replacedMatchers.end());
 }
 
+TEST_F(ConfigUpdateTest, TestUpdateMatchersUnchangedInPlace) {
+    StatsdConfig config;
+    AtomMatcher simple1 = CreateSimpleAtomMatcher("SIMPLE1", /*atom=*/10);
+    *config.add_atom_matcher() = simple1;
+    AtomMatcher simple2 = CreateSimpleAtomMatcher("SIMPLE2", /*atom=*/11);
+    *config.add_atom_matcher() = simple2;
+
+    AtomMatcher combination1;
+    combination1.set_id(StringToId("combination1"));
+    AtomMatcher_Combination* combination = combination1.mutable_combination();
+    combination->set_operation(LogicalOperation::OR);
+    combination->add_matcher(simple1.id());
+    combination->add_matcher(simple2.id());
+    *config.add_atom_matcher() = combination1;
+
+    EXPECT_TRUE(initConfig(config));
+
+    // Every matcher keeps its index.
+    StatsdConfig newConfig = config;
+    *newConfig.add_count_metric() = createCountMetric("COUNT1", simple1.id(), nullopt, {});
+
+    unordered_map<int, vector<int>> newTagIds;
+    unordered_map<int64_t, int> newAtomMatchingTrackerMap;
+    vector<sp<AtomMatchingTracker>> newAtomMatchingTrackers;
+    set<int64_t> replacedMatchers;
+    EXPECT_EQ(updateAtomMatchingTrackers(newConfig, uidMap, oldAtomMatchingTrackerMap,
+                                         oldAtomMatchingTrackers, newTagIds,
+                                         newAtomMatchingTrackerMap, newAtomMatchingTrackers,
+                                         replacedMatchers),
+              nullopt);
+
+    EXPECT_EQ(newAtomMatchingTrackers, oldAtomMatchingTrackers);
+    EXPECT_EQ(newAtomMatchingTrackerMap, oldAtomMatchingTrackerMap);
+    EXPECT_TRUE(replacedMatchers.empty());
+
+    ASSERT_EQ(newTagIds.size(), 2);
+    EXPECT_THAT(newTagIds[10], UnorderedElementsAre(0, 2));
+    EXPECT_THAT(newTagIds[11], UnorderedElementsAre(1, 2));
+
+    CombinationAtomMatchingTracker* combinationTracker =
+            static_cast<CombinationAtomMatchingTracker*>(newAtomMatchingTrackers[2].get());
+    EXPECT_TRUE(combinationTracker->mInitialized);
+    EXPECT_THAT(combinationTracker->mChildren, UnorderedElementsAre(0, 1));
+}
+
 TEST_F(ConfigUpdateTest, TestSimpleConditionPreserve) {
     StatsdConfig config;
     AtomMatcher startMatcher = CreateScreenTurnedOnAtomMatcher();
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "src/condition/ConditionTracker.h"
+#include "src/hash.h"
 #include "src/matchers/AtomMatchingTracker.h"
 #include "src/metrics/CountMetricProducer.h"
 #include "src/metrics/DurationMetricProducer.h"
@@ -451,6 +452,19 @@ TEST_F(MetricsManagerUtilTest, TestGoodConfig) {
     EXPECT_EQ(alertTrackerMap.find(kAlertId)->second, 0);
 }
 
+TEST(MetricsManagerUtilHashTest, TestGetProtoHash) {
+    const AtomMatcher longMatcher = CreateScreenTurnedOnAtomMatcher();
+    const AtomMatcher shortMatcher = CreateSimpleAtomMatcher("Short", /*atomId=*/1);
+
+    // The reused serialization buffer does not leak the longer proto into the shorter one.
+    uint64_t longHash = 0;
+    uint64_t shortHash = 0;
+    ASSERT_TRUE(getProtoHash(longMatcher, longHash));
+    ASSERT_TRUE(getProtoHash(shortMatcher, shortHash));
+    EXPECT_EQ(Hash64(longMatcher.SerializeAsString()), longHash);
+    EXPECT_EQ(Hash64(shortMatcher.SerializeAsString()), shortHash);
+}
+
 TEST_F(MetricsManagerUtilTest, TestDimensionMetricsWithMultiTags) {
     EXPECT_EQ(initConfig(buildDimensionMetricsWithMultiTags()),
               createInvalidConfigReasonWithMatcher(
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include <future>
 #include <optional>
 #include <vector>
 
@@ -411,8 +412,16 @@ TEST_F(ShellSubscriberCallbackTest, testPushedEventsAreCached) {
 }
 
 TEST_F(ShellSubscriberCallbackTest, testOverflowCacheIsFlushed) {
-    // Expect callback to be invoked once.
-    EXPECT_CALL(*callback, onSubscriptionData(_, _)).Times(Exactly(1)).RetiresOnSaturation();
+    // Expect callback to be invoked once, from the helper thread.
+    std::promise<void> flushed;
+    EXPECT_CALL(*callback, onSubscriptionData(_, _))
+            .Times(Exactly(1))
+            .WillOnce(DoAll(SaveArg<0>(&reason), SaveArg<1>(&payload),
+                            [&flushed] {
+                                flushed.set_value();
+                                return Status::ok();
+                            }))
+            .RetiresOnSaturation();
     EXPECT_CALL(
             *mockLogEventFilter,
             setAtomIds(CreateAtomIdSetFromShellSubscriptionBytes(configBytes), &shellSubscriber))
@@ -429,6 +438,7 @@ TEST_F(ShellSubscriberCallbackTest, testOverflowCacheIsFlushed) {
     shellSubscriber.onLogEvent(*createTestAtomReportedEvent(/*timestampNs=*/1100,
                                                             /*intFieldValue=*/1, expIds));
 
+    ASSERT_EQ(flushed.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
     EXPECT_THAT(reason, Eq(StatsSubscriptionCallbackReason::STATSD_INITIATED));
 
     // Get ShellData proto from the bytes payload of the callback.
@@ -451,6 +461,72 @@ TEST_F(ShellSubscriberCallbackTest, testOverflowCacheIsFlushed) {
     EXPECT_EQ(perSubscriptionStats.flush_count(), 1);
 }
 
+TEST_F(ShellSubscriberCallbackTest, testOverflowIsNotSentFromOnLogEvent) {
+    unique_ptr<ShellSubscriberClient> client = ShellSubscriberClient::create(
+            configBytes, callback, /* startTimeSec= */ 0, uidMap, pullerManager);
+    ASSERT_NE(client, nullptr);
+
+    MockFunction<void(string checkPointName)> check;
+    {
+        InSequence s;
+        EXPECT_CALL(*callback, onSubscriptionData(_, _)).Times(Exactly(0));
+        EXPECT_CALL(check, Call("overflow"));
+        EXPECT_CALL(*callback,
+                    onSubscriptionData(StatsSubscriptionCallbackReason::STATSD_INITIATED, _))
+                .Times(Exactly(1));
+    }
+
+    // Not subscribed, filtered out by atom id.
+    EXPECT_FALSE(client->onLogEvent(*CreateBatteryStateChangedEvent(
+            1000 /*timestamp*/, BatteryPluggedStateEnum::BATTERY_PLUGGED_USB)));
+    EXPECT_FALSE(client->onLogEvent(*CreateScreenStateChangedEvent(
+            1000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_ON)));
+
+    // Overflows the cache, the flush is only requested.
+    const vector<int64_t> expIds = vector<int64_t>(200, INT64_MAX);
+    EXPECT_TRUE(client->onLogEvent(*createTestAtomReportedEvent(/*timestampNs=*/1100,
+                                                                /*intFieldValue=*/1, expIds)));
+    check.Call("overflow");
+
+    client->pullAndSendHeartbeatsIfNeeded(/* nowSecs= */ 1, /* nowMillis= */ 1000,
+                                          /* nowNanos= */ 1'000'000'000);
+
+    ShellData actualShellData;
+    ASSERT_TRUE(actualShellData.ParseFromArray(payload.data(), payload.size()));
+    EXPECT_EQ(actualShellData.atom_size(), 2);
+}
+
+TEST_F(ShellSubscriberCallbackTest, testEncodedEventIsShared) {
+    unique_ptr<ShellSubscriberClient> client1 = ShellSubscriberClient::create(
+            configBytes, callback, /* startTimeSec= */ 0, uidMap, pullerManager);
+    unique_ptr<ShellSubscriberClient> client2 = ShellSubscriberClient::create(
+            configBytes, callback, /* startTimeSec= */ 0, uidMap, pullerManager);
+    ASSERT_NE(client1, nullptr);
+    ASSERT_NE(client2, nullptr);
+
+    ShellSubscriberClient::EncodedEvent encodedEvent;
+    std::unique_ptr<LogEvent> event = CreateScreenStateChangedEvent(
+            1000 /*timestamp*/, ::android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    client1->onLogEvent(*event, &encodedEvent);
+    ASSERT_TRUE(encodedEvent.encoded);
+    const vector<uint8_t> encodedAtom = encodedEvent.atom;
+    client2->onLogEvent(*event, &encodedEvent);
+    EXPECT_EQ(encodedEvent.atom, encodedAtom);
+
+    ShellData expectedShellData;
+    expectedShellData.add_atom()->mutable_screen_state_changed()->set_state(
+            ::android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    expectedShellData.add_elapsed_timestamp_nanos(1000);
+
+    EXPECT_CALL(*callback, onSubscriptionData(_, _)).Times(Exactly(2)).RetiresOnSaturation();
+    for (ShellSubscriberClient* client : {client1.get(), client2.get()}) {
+        client->flush();
+        ShellData actualShellData;
+        ASSERT_TRUE(actualShellData.ParseFromArray(payload.data(), payload.size()));
+        EXPECT_THAT(actualShellData, EqShellData(expectedShellData));
+    }
+}
+
 TEST_F(ShellSubscriberCallbackTest, testFlushTrigger) {
     // Expect callback to be invoked once.
     EXPECT_CALL(*callback, onSubscriptionData(_, _)).Times(Exactly(1)).RetiresOnSaturation();
@@ -708,6 +784,67 @@ TEST_F(ShellSubscriberCallbackPulledTest, testMinSleep) {
     EXPECT_THAT(sleepTimeMs, Eq(ShellSubscriberClient::kMinCallbackSleepIntervalMs));
 }
 
+TEST_F(ShellSubscriberCallbackPulledTest, testSharedPull) {
+    unique_ptr<ShellSubscriberClient> otherClient = ShellSubscriberClient::create(
+            configBytes, callback, /* startTimeSec= */ 0, uidMap, pullerManager);
+
+    // Both clients are due, and pull once.
+    EXPECT_CALL(*pullerManager, Pull(_, A<const vector<int32_t>&>(), _, _)).Times(Exactly(1));
+
+    ShellSubscriberClient::SharedPulls sharedPulls;
+    shellSubscriberClient->addDuePulls(/* nowMillis= */ 61'000, &sharedPulls);
+    otherClient->addDuePulls(/* nowMillis= */ 61'000, &sharedPulls);
+    EXPECT_EQ(sharedPulls.size(), 1u);
+    shellSubscriberClient->pullAndSendHeartbeatsIfNeeded(/* nowSecs= */ 61, /* nowMillis= */ 61'000,
+                                                         /* nowNanos= */ 61'000'000'000,
+                                                         &sharedPulls);
+    otherClient->pullAndSendHeartbeatsIfNeeded(/* nowSecs= */ 61, /* nowMillis= */ 61'000,
+                                               /* nowNanos= */ 61'000'000'000, &sharedPulls);
+
+    // Each client sends the shared data.
+    EXPECT_CALL(*callback, onSubscriptionData(_, _)).Times(Exactly(2));
+    for (ShellSubscriberClient* client : {shellSubscriberClient.get(), otherClient.get()}) {
+        client->flush();
+        ShellData actualShellData;
+        ASSERT_TRUE(actualShellData.ParseFromArray(payload.data(), payload.size()));
+        EXPECT_THAT(actualShellData, EqShellData(getExpectedPulledData()));
+    }
+}
+
+TEST_F(ShellSubscriberCallbackPulledTest, testSharedPullAlignment) {
+    // Due 2 s after shellSubscriberClient, within a tenth of the 60 s interval.
+    unique_ptr<ShellSubscriberClient> alignedClient = ShellSubscriberClient::create(
+            configBytes, callback, /* startTimeSec= */ 2, uidMap, pullerManager);
+    // Due 30 s after shellSubscriberClient.
+    unique_ptr<ShellSubscriberClient> lateClient = ShellSubscriberClient::create(
+            configBytes, callback, /* startTimeSec= */ 30, uidMap, pullerManager);
+
+    EXPECT_CALL(*pullerManager, Pull(_, A<const vector<int32_t>&>(), _, _)).Times(Exactly(1));
+
+    ShellSubscriberClient::SharedPulls sharedPulls;
+    shellSubscriberClient->addDuePulls(/* nowMillis= */ 61'000, &sharedPulls);
+    alignedClient->addDuePulls(/* nowMillis= */ 61'000, &sharedPulls);
+    lateClient->addDuePulls(/* nowMillis= */ 61'000, &sharedPulls);
+    EXPECT_EQ(sharedPulls.size(), 1u);
+    shellSubscriberClient->pullAndSendHeartbeatsIfNeeded(/* nowSecs= */ 61, /* nowMillis= */ 61'000,
+                                                         /* nowNanos= */ 61'000'000'000,
+                                                         &sharedPulls);
+    alignedClient->pullAndSendHeartbeatsIfNeeded(/* nowSecs= */ 61, /* nowMillis= */ 61'000,
+                                                 /* nowNanos= */ 61'000'000'000, &sharedPulls);
+    lateClient->pullAndSendHeartbeatsIfNeeded(/* nowSecs= */ 61, /* nowMillis= */ 61'000,
+                                              /* nowNanos= */ 61'000'000'000, &sharedPulls);
+
+    // The aligned client is not due again until a full interval after the shared pull.
+    alignedClient->pullAndSendHeartbeatsIfNeeded(/* nowSecs= */ 62, /* nowMillis= */ 62'000,
+                                                 /* nowNanos= */ 62'000'000'000);
+
+    EXPECT_CALL(*callback, onSubscriptionData(_, _)).Times(Exactly(1));
+    alignedClient->flush();
+    ShellData actualShellData;
+    ASSERT_TRUE(actualShellData.ParseFromArray(payload.data(), payload.size()));
+    EXPECT_THAT(actualShellData, EqShellData(getExpectedPulledData()));
+}
+
 TEST(ShellSubscriberTest, testPushedSubscription) {
     sp<MockUidMap> uidMap = new NaggyMock<MockUidMap>();
     sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
@@ -802,6 +939,48 @@ TEST(ShellSubscriberTest, testBothSubscriptions) {
     TRACE_CALL(runShellTest, config, uidMap, pullerManager, pushedList, expectedData, kNumClients);
 }
 
+TEST(ShellSubscriberTest, testRawAtoms) {
+    sp<MockUidMap> uidMap = new NaggyMock<MockUidMap>();
+    sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
+    std::shared_ptr<LogEventFilter> logEventFilter = std::make_shared<LogEventFilter>();
+    sp<ShellSubscriber> shellManager = new ShellSubscriber(uidMap, pullerManager, logEventFilter);
+    std::shared_ptr<MockStatsSubscriptionCallback> callback =
+            SharedRefBase::make<StrictMock<MockStatsSubscriptionCallback>>();
+    std::optional<StatsSubscriptionCallbackReason> reason;
+    vector<uint8_t> payload;
+    // Once for the flush, and once when unsubscribing.
+    EXPECT_CALL(*callback, onSubscriptionData(_, _))
+            .Times(2)
+            .WillRepeatedly(DoAll(SaveArg<0>(&reason), SaveArg<1>(&payload),
+                                  [] { return Status::ok(); }));
+
+    ShellSubscription config;
+    config.add_raw_atom_id(SCREEN_STATE_CHANGED);
+    ASSERT_TRUE(shellManager->startNewSubscription(protoToBytes(config), callback));
+
+    // Raw atoms are forwarded by the filter without being parsed.
+    EXPECT_FALSE(logEventFilter->isAtomInUse(SCREEN_STATE_CHANGED));
+    const uint8_t rawPayload[] = {1, 2, 3};
+    logEventFilter->forwardRawAtom({rawPayload, sizeof(rawPayload), /*uid=*/1000, /*pid=*/10,
+                                    SCREEN_STATE_CHANGED, /*elapsedTimestampNs=*/1000});
+    logEventFilter->forwardRawAtom({rawPayload, sizeof(rawPayload), /*uid=*/1000, /*pid=*/10,
+                                    PHONE_SIGNAL_STRENGTH_CHANGED, /*elapsedTimestampNs=*/2000});
+    shellManager->flushSubscription(callback);
+    EXPECT_THAT(reason, Eq(StatsSubscriptionCallbackReason::FLUSH_REQUESTED));
+
+    ShellData actualShellData;
+    ASSERT_TRUE(actualShellData.ParseFromArray(payload.data(), payload.size()));
+    EXPECT_EQ(actualShellData.atom_size(), 0);
+    ASSERT_EQ(actualShellData.raw_atom_size(), 1);
+    const RawAtom& rawAtom = actualShellData.raw_atom(0);
+    EXPECT_EQ(rawAtom.payload(), string(rawPayload, rawPayload + sizeof(rawPayload)));
+    EXPECT_EQ(rawAtom.uid(), 1000);
+    EXPECT_EQ(rawAtom.pid(), 10);
+    EXPECT_EQ(rawAtom.elapsed_timestamp_nanos(), 1000);
+
+    shellManager->unsubscribe(callback);
+}
+
 TEST(ShellSubscriberTest, testMaxSizeGuard) {
     sp<MockUidMap> uidMap = new NaggyMock<MockUidMap>();
     sp<MockStatsPullerManager> pullerManager = new StrictMock<MockStatsPullerManager>();
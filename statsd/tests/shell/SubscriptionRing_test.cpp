@@ -0,0 +1,197 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shell/SubscriptionRing.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <vector>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::base::unique_fd;
+using std::vector;
+
+namespace {
+
+constexpr uint32_t kCapacity = SubscriptionRing::kMinRingCapacity;
+
+// Consumer side of a subscription ring, as read by libstatspull.
+class TestRing {
+public:
+    explicit TestRing(uint32_t capacity = kCapacity, int seals = F_SEAL_SHRINK | F_SEAL_GROW)
+        : mCapacity(capacity), mMappedSize(kStatsRingHeaderSize + capacity) {
+        memFd.reset(memfd_create("test_subscription_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+        EXPECT_EQ(0, ftruncate(memFd.get(), mMappedSize));
+        EXPECT_EQ(0, fcntl(memFd.get(), F_ADD_SEALS, seals));
+        void* mapped =
+                mmap(nullptr, mMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd.get(), 0);
+        EXPECT_NE(MAP_FAILED, mapped);
+        header = static_cast<StatsRingHeader*>(mapped);
+        header->magic = kStatsRingMagic;
+        header->version = kStatsRingVersion;
+        header->capacity = capacity;
+    }
+
+    ~TestRing() {
+        munmap(header, mMappedSize);
+    }
+
+    std::unique_ptr<SubscriptionRing> map() {
+        return SubscriptionRing::map(unique_fd(dup(memFd.get())));
+    }
+
+    // Reads all the records and advances the read position.
+    vector<vector<uint8_t>> drain() {
+        vector<vector<uint8_t>> records;
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(header) + kStatsRingHeaderSize;
+        uint64_t readPos = header->readPos.load();
+        const uint64_t writePos = header->writePos.load();
+        while (readPos < writePos) {
+            uint32_t size;
+            memcpy(&size, data + (readPos & (mCapacity - 1)), sizeof(size));
+            if (size == kStatsRingWrapMarker) {
+                readPos += mCapacity - (readPos & (mCapacity - 1));
+                continue;
+            }
+            const uint8_t* record = data + (readPos & (mCapacity - 1)) + sizeof(size);
+            records.emplace_back(record, record + size);
+            readPos += (sizeof(size) + size + 3) & ~uint64_t(3);
+        }
+        header->readPos.store(readPos);
+        return records;
+    }
+
+    unique_fd memFd;
+    StatsRingHeader* header;
+
+private:
+    const uint32_t mCapacity;
+    const size_t mMappedSize;
+};
+
+bool write(SubscriptionRing& ring, const vector<uint8_t>& record, bool* wakeUp) {
+    return ring.write(record.data(), record.size(), wakeUp);
+}
+
+}  // anonymous namespace
+
+TEST(SubscriptionRingTest, TestMapRejectsInvalidRings) {
+    TestRing unsealed(kCapacity, /*seals=*/0);
+    EXPECT_EQ(nullptr, unsealed.map());
+
+    TestRing tooSmall(SubscriptionRing::kMinRingCapacity / 2);
+    EXPECT_EQ(nullptr, tooSmall.map());
+
+    TestRing notPowerOfTwo(kCapacity + 4);
+    EXPECT_EQ(nullptr, notPowerOfTwo.map());
+
+    TestRing badMagic;
+    badMagic.header->magic = 0;
+    EXPECT_EQ(nullptr, badMagic.map());
+
+    TestRing valid;
+    EXPECT_NE(nullptr, valid.map());
+}
+
+TEST(SubscriptionRingTest, TestWriteAndWrap) {
+    TestRing testRing;
+    std::unique_ptr<SubscriptionRing> ring = testRing.map();
+    ASSERT_NE(nullptr, ring);
+
+    // Three records of 3/8 of the ring: the third one only fits after a drain, and wraps.
+    const vector<uint8_t> record(kCapacity * 3 / 8 - sizeof(uint32_t), 0x5a);
+    bool wakeUp;
+    EXPECT_TRUE(write(*ring, record, &wakeUp));
+    EXPECT_TRUE(write(*ring, record, &wakeUp));
+    EXPECT_FALSE(write(*ring, record, &wakeUp));
+    EXPECT_FALSE(wakeUp);
+
+    EXPECT_EQ(vector<vector<uint8_t>>({record, record}), testRing.drain());
+    const vector<uint8_t> other(record.size(), 0xa5);
+    EXPECT_TRUE(write(*ring, other, &wakeUp));
+    EXPECT_EQ(vector<vector<uint8_t>>({other}), testRing.drain());
+    EXPECT_EQ(kCapacity + record.size() + sizeof(uint32_t), testRing.header->writePos.load());
+}
+
+TEST(SubscriptionRingTest, TestRecordLargerThanRing) {
+    TestRing testRing;
+    std::unique_ptr<SubscriptionRing> ring = testRing.map();
+    ASSERT_NE(nullptr, ring);
+
+    const vector<uint8_t> record(kCapacity, 0);
+    bool wakeUp;
+    EXPECT_FALSE(write(*ring, record, &wakeUp));
+    EXPECT_EQ(0u, testRing.header->writePos.load());
+}
+
+TEST(SubscriptionRingTest, TestWakeUpWaitingConsumer) {
+    TestRing testRing;
+    std::unique_ptr<SubscriptionRing> ring = testRing.map();
+    ASSERT_NE(nullptr, ring);
+
+    const vector<uint8_t> record(10, 1);
+    bool wakeUp;
+    testRing.header->consumerState.store(kStatsRingConsumerWaiting);
+    EXPECT_TRUE(write(*ring, record, &wakeUp));
+    EXPECT_TRUE(wakeUp);
+    EXPECT_EQ(kStatsRingConsumerAttached, testRing.header->consumerState.load());
+
+    // The consumer has not gone back to waiting, no wakeup is needed.
+    EXPECT_TRUE(write(*ring, record, &wakeUp));
+    EXPECT_FALSE(wakeUp);
+}
+
+TEST(SubscriptionRingTest, TestUntrustedReadPosition) {
+    TestRing testRing;
+    std::unique_ptr<SubscriptionRing> ring = testRing.map();
+    ASSERT_NE(nullptr, ring);
+
+    testRing.header->readPos.store(1000);
+    const vector<uint8_t> record(10, 1);
+    bool wakeUp;
+    EXPECT_FALSE(write(*ring, record, &wakeUp));
+    EXPECT_EQ(0u, testRing.header->writePos.load());
+}
+
+TEST(SubscriptionRingTest, TestResumeAfterRestart) {
+    TestRing testRing;
+    const vector<uint8_t> record(10, 1);
+    bool wakeUp;
+    {
+        std::unique_ptr<SubscriptionRing> ring = testRing.map();
+        ASSERT_NE(nullptr, ring);
+        EXPECT_TRUE(write(*ring, record, &wakeUp));
+    }
+    EXPECT_EQ(1u, testRing.header->producerClosed.load());
+
+    std::unique_ptr<SubscriptionRing> ring = testRing.map();
+    ASSERT_NE(nullptr, ring);
+    EXPECT_TRUE(write(*ring, record, &wakeUp));
+    EXPECT_EQ(vector<vector<uint8_t>>({record, record}), testRing.drain());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
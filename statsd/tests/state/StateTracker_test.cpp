@@ -51,11 +51,20 @@ public:
 
     std::vector<Update> updates;
 
+    // Number of onStateChanges() calls.
+    int batches = 0;
+
     void onStateChanged(const int64_t eventTimeNs, const int32_t atomId,
                         const HashableDimensionKey& primaryKey, const FieldValue& oldState,
-                        const FieldValue& newState) {
+                        const FieldValue& newState) override {
         updates.emplace_back(primaryKey, newState.mValue.int_value);
     }
+
+    void onStateChanges(const int64_t eventTimeNs, const int32_t atomId,
+                        const std::vector<StateChange>& changes) override {
+        batches++;
+        StateListener::onStateChanges(eventTimeNs, atomId, changes);
+    }
 };
 
 int getStateInt(StateManager& mgr, int atomId, const HashableDimensionKey& queryKey) {
@@ -106,6 +115,26 @@ TEST(StateListenerTest, TestStateListenerWeakPointer) {
     EXPECT_TRUE(wListener.promote() == nullptr);
 }
 
+TEST(StateManagerTest, TestListenerHeldUntilUnregistered) {
+    sp<TestStateListener> listener = new TestStateListener();
+    wp<TestStateListener> wListener = listener;
+    StateManager mgr;
+    mgr.registerListener(util::SCREEN_STATE_CHANGED, listener);
+    listener = nullptr;
+
+    std::unique_ptr<LogEvent> event = CreateScreenStateChangedEvent(
+            timestampNs, android::view::DisplayStateEnum::DISPLAY_STATE_ON);
+    mgr.onLogEvent(*event);
+    listener = wListener.promote();
+    ASSERT_TRUE(listener != nullptr);
+    ASSERT_EQ(1, listener->updates.size());
+    EXPECT_EQ(1, listener->batches);
+
+    mgr.unregisterListener(util::SCREEN_STATE_CHANGED, listener);
+    listener = nullptr;
+    EXPECT_TRUE(wListener.promote() == nullptr);
+}
+
 TEST(StateManagerTest, TestStateManagerGetInstance) {
     sp<TestStateListener> listener1 = new TestStateListener();
     StateManager& mgr = StateManager::getInstance();
@@ -322,7 +351,10 @@ TEST(StateTrackerTest, TestStateChangeReset) {
     std::unique_ptr<LogEvent> event3 =
             CreateBleScanStateChangedEvent(timestampNs + 2000, attributionUids2, attributionTags1,
                                            BleScanStateChanged::RESET, false, false, false);
+    listener->batches = 0;
     mgr.onLogEvent(*event3);
+    // Both keys are reset in one batch.
+    EXPECT_EQ(1, listener->batches);
     ASSERT_EQ(2, listener->updates.size());
     for (const TestStateListener::Update& update : listener->updates) {
         EXPECT_EQ(BleScanStateChanged::OFF, update.mState);
@@ -383,6 +415,45 @@ TEST(StateTrackerTest, TestStateChangeOnePrimaryField) {
               getStateInt(mgr, util::UID_PROCESS_STATE_CHANGED, queryKey));
 }
 
+/**
+ * Test that a state keyed by a single int primary field is only found with a query key that has
+ * the same field, and that its state is cleared when it becomes unknown.
+ */
+TEST(StateTrackerTest, TestStateQueryIntPrimaryField) {
+    sp<TestStateListener> listener1 = new TestStateListener();
+    StateManager mgr;
+    mgr.registerListener(util::UID_PROCESS_STATE_CHANGED, listener1);
+
+    std::unique_ptr<LogEvent> event = CreateUidProcessStateChangedEvent(
+            timestampNs, 1000 /*uid*/, android::app::ProcessStateEnum::PROCESS_STATE_TOP);
+    mgr.onLogEvent(*event);
+
+    HashableDimensionKey queryKey;
+    getUidProcessKey(1000 /* uid */, &queryKey);
+    EXPECT_EQ(android::app::ProcessStateEnum::PROCESS_STATE_TOP,
+              getStateInt(mgr, util::UID_PROCESS_STATE_CHANGED, queryKey));
+
+    // Same uid in another field.
+    int pos[] = {2, 0, 0};
+    HashableDimensionKey otherFieldKey;
+    otherFieldKey.addValue(
+            FieldValue(Field(util::UID_PROCESS_STATE_CHANGED, pos, 0 /* depth */), Value(1000)));
+    EXPECT_EQ(kStateUnknown, getStateInt(mgr, util::UID_PROCESS_STATE_CHANGED, otherFieldKey));
+    EXPECT_EQ(kStateUnknown,
+              getStateInt(mgr, util::UID_PROCESS_STATE_CHANGED, DEFAULT_DIMENSION_KEY));
+
+    event = CreateUidProcessStateChangedEvent(
+            timestampNs + 1000, 1000 /*uid*/,
+            static_cast<android::app::ProcessStateEnum>(kStateUnknown));
+    mgr.onLogEvent(*event);
+    ASSERT_EQ(2, listener1->updates.size());
+    EXPECT_EQ(queryKey, listener1->updates[1].mKey);
+    EXPECT_EQ(kStateUnknown, listener1->updates[1].mState);
+    FieldValue output;
+    EXPECT_FALSE(mgr.getStateValue(util::UID_PROCESS_STATE_CHANGED, queryKey, &output));
+    EXPECT_EQ(kStateUnknown, output.mValue.int_value);
+}
+
 TEST(StateTrackerTest, TestStateChangePrimaryFieldAttrChain) {
     sp<TestStateListener> listener1 = new TestStateListener();
     StateManager mgr;
@@ -403,7 +474,7 @@ TEST(StateTrackerTest, TestStateChangePrimaryFieldAttrChain) {
     ASSERT_EQ(3, listener1->updates[0].mKey.getValues().size());
     EXPECT_EQ(1001, listener1->updates[0].mKey.getValues()[0].mValue.int_value);
     EXPECT_EQ(1, listener1->updates[0].mKey.getValues()[1].mValue.int_value);
-    EXPECT_EQ("wakelockName", listener1->updates[0].mKey.getValues()[2].mValue.str_value);
+    EXPECT_EQ("wakelockName", listener1->updates[0].mKey.getValues()[2].mValue.getString());
     EXPECT_EQ(WakelockStateChanged::ACQUIRE, listener1->updates[0].mState);
 
     // Check StateTracker was updated by querying for state.
@@ -591,6 +662,82 @@ TEST(StateTrackerTest, TestMalformedStateEvent_ExistingStateValue) {
     listener->updates.clear();
 }
 
+/**
+ * Test that the states that have not changed for the idle time are evicted in slices, that the
+ * listeners see them become unknown, and that the map shrinks once they are gone.
+ */
+TEST(StateTrackerTest, TestEvictIdleStates) {
+    sp<TestStateListener> listener = new TestStateListener();
+    sp<StateTracker> tracker = new StateTracker(util::UID_PROCESS_STATE_CHANGED);
+    tracker->registerListener(listener);
+
+    const int64_t idleNs = 60 * 60 * NS_PER_SEC;  // 1 hour
+    const int64_t activeTimeNs = 2 * idleNs;
+    for (int uid = 1000; uid < 1200; uid++) {
+        tracker->onLogEvent(*CreateUidProcessStateChangedEvent(
+                timestampNs, uid, android::app::ProcessStateEnum::PROCESS_STATE_TOP));
+    }
+    tracker->onLogEvent(*CreateUidProcessStateChangedEvent(
+            activeTimeNs, 2000 /*uid*/, android::app::ProcessStateEnum::PROCESS_STATE_TOP));
+    ASSERT_EQ(201, tracker->mIntKeyStateMap.size());
+    const size_t bucketCount = tracker->mIntKeyStateMap.bucket_count();
+    listener->updates.clear();
+
+    // Nothing is idle yet.
+    tracker->evictIdleStates(idleNs, idleNs, 1000);
+    EXPECT_EQ(201, tracker->mIntKeyStateMap.size());
+    EXPECT_TRUE(listener->updates.empty());
+
+    // Each call scans a slice of the map.
+    const int64_t nowNs = activeTimeNs + idleNs / 2;
+    tracker->evictIdleStates(nowNs, idleNs, 50);
+    EXPECT_LT(100, tracker->mIntKeyStateMap.size());
+    EXPECT_GT(201, tracker->mIntKeyStateMap.size());
+    for (const TestStateListener::Update& update : listener->updates) {
+        EXPECT_EQ(kStateUnknown, update.mState);
+    }
+    while (tracker->mIntKeyStateMap.size() > 1) {
+        tracker->evictIdleStates(nowNs, idleNs, 50);
+    }
+    EXPECT_EQ(200, listener->updates.size());
+
+    // The key that changed within the idle time keeps its state.
+    HashableDimensionKey queryKey;
+    getUidProcessKey(2000 /* uid */, &queryKey);
+    FieldValue output;
+    EXPECT_TRUE(tracker->getStateValue(queryKey, &output));
+    EXPECT_EQ(android::app::ProcessStateEnum::PROCESS_STATE_TOP, output.mValue.int_value);
+    getUidProcessKey(1000 /* uid */, &queryKey);
+    EXPECT_FALSE(tracker->getStateValue(queryKey, &output));
+
+    // The map shrinks at the end of the sweep.
+    while (tracker->mIntKeyEvictionCursor != 0) {
+        tracker->evictIdleStates(nowNs, idleNs, 50);
+    }
+    EXPECT_GT(bucketCount, tracker->mIntKeyStateMap.bucket_count());
+}
+
+TEST(StateManagerTest, TestIdleStateEvictionDisabledByDefault) {
+    sp<TestStateListener> listener = new TestStateListener();
+    StateManager mgr;
+    mgr.registerListener(util::UID_PROCESS_STATE_CHANGED, listener);
+    mgr.onLogEvent(*CreateUidProcessStateChangedEvent(
+            timestampNs, 1000 /*uid*/, android::app::ProcessStateEnum::PROCESS_STATE_TOP));
+
+    HashableDimensionKey queryKey;
+    getUidProcessKey(1000 /* uid */, &queryKey);
+    const int64_t nowNs = timestampNs + 2 * StateManager::kDefaultIdleStateEvictionNs;
+    mgr.evictIdleStates(nowNs);
+    EXPECT_EQ(android::app::ProcessStateEnum::PROCESS_STATE_TOP,
+              getStateInt(mgr, util::UID_PROCESS_STATE_CHANGED, queryKey));
+
+    mgr.setIdleStateEvictionNs(StateManager::kDefaultIdleStateEvictionNs);
+    mgr.evictIdleStates(nowNs);
+    EXPECT_EQ(kStateUnknown, getStateInt(mgr, util::UID_PROCESS_STATE_CHANGED, queryKey));
+    ASSERT_EQ(2, listener->updates.size());
+    EXPECT_EQ(kStateUnknown, listener->updates[1].mState);
+}
+
 }  // namespace statsd
 }  // namespace os
 }  // namespace android
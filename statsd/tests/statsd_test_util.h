@@ -110,6 +110,9 @@ public:
     MOCK_METHOD4(sendResults,
                  Status(const vector<string>& queryData, const vector<string>& columnNames,
                         const vector<int32_t>& columnTypes, int32_t rowCount));
+    MOCK_METHOD5(sendResultsPage,
+                 Status(const vector<string>& queryData, const vector<string>& columnNames,
+                        const vector<int32_t>& columnTypes, int32_t rowCount, bool isLastPage));
     MOCK_METHOD1(sendFailure, Status(const string& in_error));
 };
 
@@ -119,6 +122,7 @@ public:
                 (StatsSubscriptionCallbackReason in_reason,
                  const std::vector<uint8_t>& in_subscriptionPayload),
                 (override));
+    MOCK_METHOD(Status, onSubscriptionRingData, (), (override));
 };
 
 class StatsServiceConfigTest : public ::testing::Test {
@@ -663,6 +667,27 @@ public:
     int pullNum = 1;
     Status onPullAtom(int atomTag,
                       const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override;
+    Status onPullAtomDelta(int atomTag, int64_t /*baseGeneration*/,
+                           const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        return onPullAtom(atomTag, resultReceiver);
+    }
+    Status onPullAtomAggregated(
+            int atomTag, const vector<int32_t>& /*groupByFields*/,
+            const vector<int32_t>& /*sumFields*/,
+            const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        return onPullAtom(atomTag, resultReceiver);
+    }
+    Status onPullAtomProjected(
+            int atomTag, const vector<int32_t>& /*fields*/,
+            const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        return onPullAtom(atomTag, resultReceiver);
+    }
+    Status onPullAtomGroup(const vector<int32_t>& atomTags,
+                           const shared_ptr<IPullAtomResultReceiver>& resultReceiver) override {
+        // Never registered with a pull group.
+        resultReceiver->pullFinished(atomTags.empty() ? 0 : atomTags[0], /*success=*/false, {});
+        return Status::ok();
+    }
 };
 
 template <typename T>
@@ -0,0 +1,102 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/storage/AsyncFileWriter.h"
+
+#include <android-base/file.h>
+#include <dirent.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/storage/StorageManager.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using namespace testing;
+using std::string;
+using std::vector;
+
+namespace {
+
+vector<uint8_t> toBytes(const string& s) {
+    return vector<uint8_t>(s.begin(), s.end());
+}
+
+string readFile(const string& path) {
+    string content;
+    EXPECT_TRUE(StorageManager::readFileToString(path.c_str(), &content));
+    return content;
+}
+
+vector<string> listDir(const string& path) {
+    vector<string> names;
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(path.c_str()), closedir);
+    dirent* de;
+    while ((de = readdir(dir.get()))) {
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            names.push_back(de->d_name);
+        }
+    }
+    return names;
+}
+
+}  // anonymous namespace
+
+TEST(AsyncFileWriterTest, TestWaitForPendingWrites) {
+    TemporaryDir dir;
+    const string file1 = string(dir.path) + "/file1";
+    const string file2 = string(dir.path) + "/file2";
+
+    AsyncFileWriter writer;
+    writer.write(file1, toBytes("first"));
+    writer.write(file2, toBytes("second"));
+    // Files are written in order, so the last write to a path wins.
+    writer.write(file1, toBytes("third"));
+    writer.waitForPendingWrites();
+
+    EXPECT_EQ(readFile(file1), "third");
+    EXPECT_EQ(readFile(file2), "second");
+    // No temporary file is left behind.
+    EXPECT_THAT(listDir(dir.path), UnorderedElementsAre("file1", "file2"));
+}
+
+TEST(AsyncFileWriterTest, TestDestructorWritesPendingFiles) {
+    TemporaryDir dir;
+    const string file = string(dir.path) + "/file";
+    {
+        AsyncFileWriter writer;
+        writer.write(file, toBytes("data"));
+    }
+    EXPECT_EQ(readFile(file), "data");
+}
+
+TEST(AsyncFileWriterTest, TestWaitWithoutWrites) {
+    AsyncFileWriter writer;
+    writer.waitForPendingWrites();
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
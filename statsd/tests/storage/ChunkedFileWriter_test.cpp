@@ -0,0 +1,118 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/storage/ChunkedFileWriter.h"
+
+#include <android-base/file.h>
+#include <dirent.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/storage/StorageManager.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::util::FIELD_COUNT_REPEATED;
+using android::util::FIELD_TYPE_INT64;
+using android::util::FIELD_TYPE_MESSAGE;
+using android::util::ProtoOutputStream;
+using namespace testing;
+using std::string;
+using std::vector;
+
+namespace {
+
+vector<string> listDir(const string& path) {
+    vector<string> names;
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(path.c_str()), closedir);
+    dirent* de;
+    while ((de = readdir(dir.get()))) {
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            names.push_back(de->d_name);
+        }
+    }
+    return names;
+}
+
+void writeMessage(ProtoOutputStream* proto, int64_t value) {
+    const uint64_t token = proto->start(FIELD_TYPE_MESSAGE | FIELD_COUNT_REPEATED | 1);
+    proto->write(FIELD_TYPE_INT64 | 1, (long long)value);
+    proto->end(token);
+}
+
+}  // anonymous namespace
+
+TEST(ChunkedFileWriterTest, TestChunksAreConcatenated) {
+    TemporaryDir dir;
+    const string file = string(dir.path) + "/report";
+
+    ProtoOutputStream expected;
+    ProtoOutputStream chunked;
+    ChunkedFileWriter writer(file);
+    ASSERT_TRUE(writer.isOpen());
+    for (int64_t value = 1; value <= 3; value++) {
+        writeMessage(&expected, value);
+        writeMessage(&chunked, value);
+        writer.write(&chunked);
+        EXPECT_EQ(0, chunked.size());
+    }
+    const size_t expectedSize = expected.size();
+    // Nothing is visible at the file path before the commit.
+    EXPECT_THAT(listDir(dir.path), ElementsAre(".report.tmp"));
+    EXPECT_TRUE(writer.commit());
+
+    string expectedBytes;
+    expected.serializeToString(&expectedBytes);
+    string content;
+    ASSERT_TRUE(StorageManager::readFileToString(file.c_str(), &content));
+    EXPECT_EQ(expectedBytes, content);
+    EXPECT_EQ(expectedSize, writer.bytesWritten());
+    EXPECT_THAT(listDir(dir.path), ElementsAre("report"));
+}
+
+TEST(ChunkedFileWriterTest, TestUncommittedFileIsRemoved) {
+    TemporaryDir dir;
+    {
+        ChunkedFileWriter writer(string(dir.path) + "/report");
+        ProtoOutputStream proto;
+        writeMessage(&proto, 1);
+        writer.write(&proto);
+    }
+    EXPECT_THAT(listDir(dir.path), IsEmpty());
+}
+
+TEST(ChunkedFileWriterTest, TestOpenFailure) {
+    ChunkedFileWriter writer("/nonexistent_dir/report");
+    EXPECT_FALSE(writer.isOpen());
+    ProtoOutputStream proto;
+    writeMessage(&proto, 1);
+    writer.write(&proto);
+    EXPECT_EQ(0, proto.size());
+    EXPECT_FALSE(writer.commit());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
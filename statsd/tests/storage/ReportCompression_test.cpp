@@ -0,0 +1,111 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/storage/ReportCompression.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "src/stats_log.pb.h"
+#include "src/storage/StorageManager.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// A report with the repeated strings that make real reports compress well.
+vector<uint8_t> makeCompressibleReport() {
+    ConfigMetricsReport report;
+    for (int i = 0; i < 100; i++) {
+        report.add_strings("com.android.example.package.name");
+    }
+    string bytes = report.SerializeAsString();
+    return vector<uint8_t>(bytes.begin(), bytes.end());
+}
+
+}  // namespace
+
+TEST(ReportCompressionTest, TestRoundTrip) {
+    const vector<uint8_t> report = makeCompressibleReport();
+
+    vector<uint8_t> compressed;
+    ASSERT_TRUE(compressReport(REPORT_CODEC_LZ4, report, &compressed));
+    EXPECT_LT(compressed.size(), report.size());
+    EXPECT_TRUE(isCompressedReport(string(compressed.begin(), compressed.end())));
+    EXPECT_FALSE(isCompressedReport(string(report.begin(), report.end())));
+
+    string decompressed;
+    ASSERT_TRUE(decompressReport(string(compressed.begin(), compressed.end()), &decompressed));
+    EXPECT_EQ(string(report.begin(), report.end()), decompressed);
+}
+
+TEST(ReportCompressionTest, TestNotCompressed) {
+    vector<uint8_t> compressed;
+    EXPECT_FALSE(compressReport(REPORT_CODEC_NONE, makeCompressibleReport(), &compressed));
+    EXPECT_TRUE(compressed.empty());
+
+    // Too short to get smaller.
+    const vector<uint8_t> report = {0x08, 0x01};
+    EXPECT_FALSE(compressReport(REPORT_CODEC_LZ4, report, &compressed));
+    EXPECT_TRUE(compressed.empty());
+}
+
+TEST(ReportCompressionTest, TestCorruptedReport) {
+    vector<uint8_t> compressed;
+    ASSERT_TRUE(compressReport(REPORT_CODEC_LZ4, makeCompressibleReport(), &compressed));
+    compressed.resize(compressed.size() / 2);
+
+    string decompressed;
+    EXPECT_FALSE(decompressReport(string(compressed.begin(), compressed.end()), &decompressed));
+}
+
+TEST(ReportCompressionTest, TestCompressedFileReadBack) {
+    const vector<uint8_t> report = makeCompressibleReport();
+    vector<uint8_t> compressed;
+    ASSERT_TRUE(compressReport(REPORT_CODEC_LZ4, report, &compressed));
+
+    const ConfigKey key(1066, 7);
+    const string fileName = StorageManager::getDataFileName(2557169347, key.GetUid(), key.GetId());
+    StorageManager::writeFile(fileName.c_str(), compressed.data(), compressed.size());
+
+    string content;
+    ASSERT_TRUE(StorageManager::readFileToString(fileName.c_str(), &content));
+    EXPECT_EQ(string(report.begin(), report.end()), content);
+
+    ProtoOutputStream out;
+    StorageManager::appendConfigMetricsReport(key, &out, true /*erase?*/, true /*isAdb?*/);
+    vector<uint8_t> bytes;
+    out.serializeToVector(&bytes);
+    ConfigMetricsReportList reports;
+    ASSERT_TRUE(reports.ParseFromArray(bytes.data(), bytes.size()));
+    ASSERT_EQ(reports.reports_size(), 1);
+    EXPECT_EQ(reports.reports(0).strings_size(), 100);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
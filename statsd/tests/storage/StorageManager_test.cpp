@@ -14,6 +14,7 @@
 
 #include "src/storage/StorageManager.h"
 
+#include <android-base/file.h>
 #include <android-base/unique_fd.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -63,6 +64,25 @@ TEST(StorageManagerTest, TrainInfoReadWriteTest) {
     EXPECT_EQ(trainInfo.experimentIds, trainInfoResult.experimentIds);
 }
 
+TEST(StorageManagerTest, TrainInfoReadFromIndexTest) {
+    InstallTrainInfo trainInfo;
+    trainInfo.trainVersionCode = 12345;
+    trainInfo.trainName = "train_info_index";
+    trainInfo.status = 1;
+    ASSERT_TRUE(StorageManager::writeTrainInfo(trainInfo));
+
+    // Reads are served from memory until the index is rebuilt from disk.
+    StorageManager::deleteSuffixedFiles(TRAIN_INFO_DIR, trainInfo.trainName.c_str());
+    InstallTrainInfo trainInfoResult;
+    EXPECT_TRUE(StorageManager::readTrainInfo(trainInfo.trainName, trainInfoResult));
+    EXPECT_EQ(trainInfo.trainVersionCode, trainInfoResult.trainVersionCode);
+    EXPECT_THAT(StorageManager::readAllTrainInfo(),
+                Contains(Field(&InstallTrainInfo::trainName, trainInfo.trainName)));
+
+    StorageManager::loadTrainInfos();
+    EXPECT_FALSE(StorageManager::readTrainInfo(trainInfo.trainName, trainInfoResult));
+}
+
 TEST(StorageManagerTest, TrainInfoReadWriteTrainNameSizeOneTest) {
     InstallTrainInfo trainInfo;
     trainInfo.trainVersionCode = 12345;
@@ -126,6 +146,8 @@ bool prepareLocalHistoryTestFiles() {
     } else {
         return false;
     }
+    // The files were written behind the back of the directory catalog.
+    StorageManager::loadFileCatalogs();
     return true;
 }
 
@@ -134,6 +156,7 @@ void clearLocalHistoryTestFiles() {
     TEMP_FAILURE_RETRY(remove(file2.c_str()));
     TEMP_FAILURE_RETRY(remove(file1_history.c_str()));
     TEMP_FAILURE_RETRY(remove(file2_history.c_str()));
+    StorageManager::loadFileCatalogs();
 }
 
 bool fileExist(string name) {
@@ -203,6 +226,154 @@ TEST(StorageManagerTest, AppendConfigReportTest4) {
     clearLocalHistoryTestFiles();
 }
 
+ConfigMetricsReport makeTestReport(int64_t elapsedNanos) {
+    ConfigMetricsReport report;
+    report.set_current_report_elapsed_nanos(elapsedNanos);
+    return report;
+}
+
+bool appendTestReport(const ConfigKey& key, int64_t elapsedNanos) {
+    string bytes = makeTestReport(elapsedNanos).SerializeAsString();
+    return StorageManager::appendReportToSegment(key, bytes.data(), bytes.size());
+}
+
+ConfigMetricsReportList readReports(const ConfigKey& key, bool erase, bool isAdb) {
+    ProtoOutputStream out;
+    StorageManager::appendConfigMetricsReport(key, &out, erase, isAdb);
+    ConfigMetricsReportList reports;
+    outputStreamToProto(&out, &reports);
+    return reports;
+}
+
+TEST(StorageManagerTest, SegmentAppendAndReadTest) {
+    ConfigKey key(1066, 2);
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+
+    EXPECT_TRUE(appendTestReport(key, 100));
+    EXPECT_TRUE(appendTestReport(key, 200));
+    EXPECT_TRUE(appendTestReport(key, 300));
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+
+    // Another config's reports go to a segment of their own.
+    ConfigKey otherKey(1066, 3);
+    EXPECT_TRUE(appendTestReport(otherKey, 400));
+
+    ConfigMetricsReportList reports = readReports(key, true /*erase?*/, true /*isAdb?*/);
+    ASSERT_EQ(3, reports.reports_size());
+    EXPECT_EQ(100, reports.reports(0).current_report_elapsed_nanos());
+    EXPECT_EQ(200, reports.reports(1).current_report_elapsed_nanos());
+    EXPECT_EQ(300, reports.reports(2).current_report_elapsed_nanos());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+
+    // Appends after the segment was erased start a new one.
+    EXPECT_TRUE(appendTestReport(key, 500));
+    reports = readReports(key, true /*erase?*/, true /*isAdb?*/);
+    ASSERT_EQ(1, reports.reports_size());
+    EXPECT_EQ(500, reports.reports(0).current_report_elapsed_nanos());
+
+    reports = readReports(otherKey, true /*erase?*/, true /*isAdb?*/);
+    ASSERT_EQ(1, reports.reports_size());
+    EXPECT_EQ(400, reports.reports(0).current_report_elapsed_nanos());
+}
+
+TEST(StorageManagerTest, SegmentLocalHistoryTest) {
+    ConfigKey key(1066, 2);
+    EXPECT_TRUE(appendTestReport(key, 100));
+
+    // The owner's read renames the segment to a history file.
+    ConfigMetricsReportList reports = readReports(key, false /*erase?*/, false /*isAdb?*/);
+    ASSERT_EQ(1, reports.reports_size());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+
+    // Appends after the rename start a new segment.
+    EXPECT_TRUE(appendTestReport(key, 200));
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+
+    // Adb also reads the history segment.
+    reports = readReports(key, false /*erase?*/, true /*isAdb?*/);
+    EXPECT_EQ(2, reports.reports_size());
+    reports = readReports(key, true /*erase?*/, true /*isAdb?*/);
+    EXPECT_EQ(2, reports.reports_size());
+    reports = readReports(key, true /*erase?*/, true /*isAdb?*/);
+    EXPECT_EQ(0, reports.reports_size());
+}
+
+TEST(StorageManagerTest, FileCatalogTest) {
+    ConfigKey key(1066, 5);
+    const string file = StorageManager::getDataFileName(getWallClockSec(), key.GetUid(),
+                                                        key.GetId());
+    const string bytes = makeTestReport(100).SerializeAsString();
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+
+    StorageManager::writeFile(file.c_str(), bytes.data(), bytes.size());
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+
+    // The owner's read renames the report to a history file, which does not count.
+    EXPECT_EQ(1, readReports(key, false /*erase?*/, false /*isAdb?*/).reports_size());
+    EXPECT_FALSE(StorageManager::hasConfigMetricsReport(key));
+    EXPECT_EQ(1, readReports(key, false /*erase?*/, true /*isAdb?*/).reports_size());
+
+    // The catalog agrees with the directory.
+    StorageManager::loadFileCatalogs();
+    EXPECT_EQ(1, readReports(key, true /*erase?*/, true /*isAdb?*/).reports_size());
+    EXPECT_EQ(0, readReports(key, true /*erase?*/, true /*isAdb?*/).reports_size());
+    EXPECT_FALSE(fileExist(file + "_history"));
+}
+
+TEST(StorageManagerTest, ReadConfigFromDiskKeepsNewestFileTest) {
+    ConfigKey key(1066, 6);
+    StatsdConfig oldConfig;
+    oldConfig.set_id(1);
+    StatsdConfig newConfig;
+    newConfig.set_id(2);
+    const long nowSec = getWallClockSec();
+    const string oldFile = base::StringPrintf("%s/%ld_1066_6", STATS_SERVICE_DIR, nowSec - 10);
+    const string newFile = base::StringPrintf("%s/%ld_1066_6", STATS_SERVICE_DIR, nowSec);
+    const string oldBytes = oldConfig.SerializeAsString();
+    const string newBytes = newConfig.SerializeAsString();
+    StorageManager::writeFile(oldFile.c_str(), oldBytes.data(), oldBytes.size());
+    StorageManager::writeFile(newFile.c_str(), newBytes.data(), newBytes.size());
+
+    vector<int64_t> readConfigIds;
+    StorageManager::readConfigFromDisk(
+            [&](const ConfigKey& readKey, const StatsdConfig& config, const string& fileName) {
+                if (readKey == key) {
+                    readConfigIds.push_back(config.id());
+                    EXPECT_EQ(newFile, fileName);
+                }
+            });
+    EXPECT_THAT(readConfigIds, ElementsAre(2));
+    EXPECT_FALSE(StorageManager::hasFile(oldFile.c_str()));
+    StorageManager::deleteFile(newFile.c_str());
+}
+
+TEST(StorageManagerTest, SegmentPartialReportTest) {
+    ConfigKey key(1066, 4);
+    const string segment = testDir + "2557169347_1066_4_segment";
+    string bytes = makeTestReport(100).SerializeAsString();
+    const uint32_t reportSize = bytes.size();
+    const uint32_t partialReportSize = 100;
+    {
+        android::base::unique_fd fd(TEMP_FAILURE_RETRY(
+                open(segment.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+        ASSERT_NE(-1, fd);
+        ASSERT_TRUE(android::base::WriteFully(fd, &REPORT_SEGMENT_FILE_MAGIC,
+                                              sizeof(REPORT_SEGMENT_FILE_MAGIC)));
+        ASSERT_TRUE(android::base::WriteFully(fd, &reportSize, sizeof(reportSize)));
+        ASSERT_TRUE(android::base::WriteFully(fd, bytes.data(), bytes.size()));
+        // A report that was cut short by a crash.
+        ASSERT_TRUE(android::base::WriteFully(fd, &partialReportSize, sizeof(partialReportSize)));
+        ASSERT_TRUE(android::base::WriteFully(fd, bytes.data(), 3));
+    }
+    StorageManager::loadFileCatalogs();
+    EXPECT_TRUE(StorageManager::hasConfigMetricsReport(key));
+
+    ConfigMetricsReportList reports = readReports(key, true /*erase?*/, true /*isAdb?*/);
+    ASSERT_EQ(1, reports.reports_size());
+    EXPECT_EQ(100, reports.reports(0).current_report_elapsed_nanos());
+    EXPECT_FALSE(fileExist(segment));
+}
+
 TEST(StorageManagerTest, TrainInfoReadWrite32To64BitTest) {
     InstallTrainInfo trainInfo;
     trainInfo.trainVersionCode = 12345;
@@ -270,6 +441,8 @@ TEST(StorageManagerTest, TrainInfoReadWrite32To64BitTest) {
     ASSERT_EQ(result, boolByteCount);
     close(fd);
 
+    // The file was written behind the back of the train info index.
+    StorageManager::loadTrainInfos();
     InstallTrainInfo trainInfoResult;
     EXPECT_TRUE(StorageManager::readTrainInfo(trainInfo.trainName, trainInfoResult));
 
@@ -0,0 +1,159 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "subscriber/SubscriberDispatcher.h"
+
+#include <android/binder_interface_utils.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+
+#include "subscriber/SubscriberReporter.h"
+#include "tests/statsd_test_util.h"
+
+using namespace testing;
+using ::ndk::SharedRefBase;
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+const int kConfigUid = 0;
+const int kConfigId = 12345;
+const ConfigKey kConfigKey(kConfigUid, kConfigId);
+const int64_t kRuleId = 7;
+const int64_t kBroadcastSubscriberId = 3;
+
+MetricDimensionKey getDimensionKey(int32_t uid) {
+    int pos[] = {1, 0, 0};
+    HashableDimensionKey dim;
+    dim.addValue(FieldValue(Field(10, pos, 0), Value(uid)));
+    return MetricDimensionKey(dim, DEFAULT_DIMENSION_KEY);
+}
+
+}  // anonymous namespace
+
+class SubscriberDispatcherTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        subscription = createSubscription("sub", /*rule_type=*/Subscription::ALERT, kRuleId);
+        subscription.mutable_broadcast_subscriber_details()->set_subscriber_id(
+                kBroadcastSubscriberId);
+        SubscriberReporter::getInstance().setBroadcastSubscriber(kConfigKey, kBroadcastSubscriberId,
+                                                                 pir);
+    }
+
+    void TearDown() override {
+        SubscriberReporter::getInstance().unsetBroadcastSubscriber(kConfigKey,
+                                                                   kBroadcastSubscriberId);
+    }
+
+    // The first broadcast waits for release, after noting that it started.
+    void blockFirstBroadcast() {
+        EXPECT_CALL(*pir, sendSubscriberBroadcast(kConfigUid, kConfigId, subscription.id(),
+                                                  kRuleId, _, _))
+                .WillOnce([this] {
+                    broadcastCount++;
+                    started.set_value();
+                    release.get_future().wait();
+                    return Status::ok();
+                })
+                .WillRepeatedly([this] {
+                    broadcastCount++;
+                    return Status::ok();
+                });
+    }
+
+    const shared_ptr<MockPendingIntentRef> pir =
+            SharedRefBase::make<StrictMock<MockPendingIntentRef>>();
+    Subscription subscription;
+    std::atomic<int> broadcastCount = 0;
+    std::promise<void> started;
+    std::promise<void> release;
+};
+
+TEST_F(SubscriberDispatcherTest, TestDispatchesOnCallerThreadByDefault) {
+    EXPECT_CALL(*pir, sendSubscriberBroadcast(kConfigUid, kConfigId, subscription.id(), kRuleId,
+                                              _, _))
+            .Times(2)
+            .WillRepeatedly([this] {
+                broadcastCount++;
+                return Status::ok();
+            });
+    SubscriberDispatcher dispatcher;
+
+    dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(1000),
+                        /*metricValue=*/5, kConfigKey);
+    EXPECT_EQ(broadcastCount, 1);
+    // Identical triggers are only dropped while one is queued.
+    dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(1000),
+                        /*metricValue=*/5, kConfigKey);
+    EXPECT_EQ(broadcastCount, 2);
+}
+
+TEST_F(SubscriberDispatcherTest, TestDropsIdenticalPendingTriggers) {
+    blockFirstBroadcast();
+    SubscriberDispatcher dispatcher;
+    dispatcher.startAsyncDispatch();
+
+    dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(1000),
+                        /*metricValue=*/5, kConfigKey);
+    started.get_future().wait();
+
+    dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(1000),
+                        /*metricValue=*/6, kConfigKey);
+    dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(1000),
+                        /*metricValue=*/7, kConfigKey);
+    dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(1001),
+                        /*metricValue=*/5, kConfigKey);
+    EXPECT_EQ(dispatcher.mQueue.size(), 2u);
+
+    release.set_value();
+    dispatcher.waitForPendingTriggers();
+    EXPECT_EQ(broadcastCount, 3);
+}
+
+TEST_F(SubscriberDispatcherTest, TestDropsTriggersWhenFull) {
+    blockFirstBroadcast();
+    SubscriberDispatcher dispatcher;
+    dispatcher.startAsyncDispatch();
+
+    dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(0),
+                        /*metricValue=*/5, kConfigKey);
+    started.get_future().wait();
+
+    const int numTriggers = SubscriberDispatcher::kMaxPendingTriggers + 5;
+    for (int uid = 1; uid <= numTriggers; uid++) {
+        dispatcher.dispatch(subscription, kRuleId, /*metricId=*/1, getDimensionKey(uid),
+                            /*metricValue=*/5, kConfigKey);
+    }
+    EXPECT_EQ(dispatcher.mQueue.size(), SubscriberDispatcher::kMaxPendingTriggers);
+
+    release.set_value();
+    dispatcher.waitForPendingTriggers();
+    EXPECT_EQ(broadcastCount, 1 + (int)SubscriberDispatcher::kMaxPendingTriggers);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -270,6 +270,46 @@ TEST_F(DbUtilsTest, TestInsertTwoEventsEnforceTtl) {
                 ElementsAre("atomId", "elapsedTimestampNs", "wallTimestampNs", "field_1"));
 }
 
+TEST_F(DbUtilsTest, TestEnforceTtlManyEvents) {
+    int64_t eventElapsedTimeNs = 10000000000;
+    int64_t eventWallClockNs = 50000000000;
+
+    vector<LogEvent> events;
+    // More than the rows deleted in one transaction.
+    for (int i = 0; i < 2500; ++i) {
+        AStatsEvent* statsEvent = makeAStatsEvent(tagId, eventElapsedTimeNs + i);
+        AStatsEvent_writeString(statsEvent, "111");
+        events.push_back(makeLogEvent(statsEvent));
+        events.back().setLogdWallClockTimestampNs(eventWallClockNs - i);
+    }
+    AStatsEvent* statsEvent = makeAStatsEvent(tagId, eventElapsedTimeNs + 2500);
+    AStatsEvent_writeString(statsEvent, "222");
+    events.push_back(makeLogEvent(statsEvent));
+    events.back().setLogdWallClockTimestampNs(eventWallClockNs + 1);
+
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, events[0]));
+    sqlite3* db = getDb(key);
+    string err;
+    EXPECT_TRUE(insert(db, metricId, events, err));
+    EXPECT_TRUE(flushTtl(db, metricId, eventWallClockNs));
+    closeDb(db);
+
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    std::vector<std::vector<std::string>> rows;
+    string zSql = "SELECT * FROM metric_111";
+    EXPECT_TRUE(query(key, zSql, rows, columnTypes, columnNames, err));
+    ASSERT_EQ(rows.size(), 1);
+    EXPECT_THAT(rows[0], ElementsAre("1", to_string(eventElapsedTimeNs + 2500), _, "222"));
+
+    // The expired rows are found with the wall clock index.
+    rows.clear();
+    zSql = "SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = 'metric_111'";
+    EXPECT_TRUE(query(key, zSql, rows, columnTypes, columnNames, err));
+    ASSERT_EQ(rows.size(), 1);
+    EXPECT_THAT(rows[0], ElementsAre("metric_111_wallTimestampNs"));
+}
+
 TEST_F(DbUtilsTest, TestMaliciousQuery) {
     int64_t eventElapsedTimeNs = 10000000000;
 
@@ -326,6 +366,8 @@ TEST_F(DbUtilsTest, TestInsertStringIntegrityCheckFails) {
     EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent));
     string err;
     EXPECT_TRUE(insert(key, metricId, events, err));
+    // Checkpoints the write-ahead log, so that the data is in the file corrupted below.
+    releaseDb(key);
 
     vector<string> randomData{"1232hasha14125ashfas21512sh31321"};
     string fileName = StringPrintf("%s/%d_%lld.db", STATS_RESTRICTED_DATA_DIR, key.GetUid(),
@@ -342,6 +384,210 @@ TEST_F(DbUtilsTest, TestInsertStringIntegrityCheckFails) {
     EXPECT_FALSE(StorageManager::hasFile(fileName.c_str()));
 }
 
+TEST_F(DbUtilsTest, TestInsertAfterDeleteDb) {
+    int64_t eventElapsedTimeNs = 10000000000;
+
+    AStatsEvent* statsEvent1 = makeAStatsEvent(tagId, eventElapsedTimeNs + 10);
+    AStatsEvent_writeString(statsEvent1, "111");
+    LogEvent logEvent1 = makeLogEvent(statsEvent1);
+
+    AStatsEvent* statsEvent2 = makeAStatsEvent(tagId, eventElapsedTimeNs + 20);
+    AStatsEvent_writeString(statsEvent2, "222");
+    LogEvent logEvent2 = makeLogEvent(statsEvent2);
+
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent1));
+    string err;
+    EXPECT_TRUE(insert(key, metricId, {logEvent1}, err));
+
+    // The handles kept open to the deleted db are not reused.
+    deleteDb(key);
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent2));
+    EXPECT_TRUE(insert(key, metricId, {logEvent2}, err));
+
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    std::vector<std::vector<std::string>> rows;
+    string zSql = "SELECT * FROM metric_111 ORDER BY elapsedTimestampNs";
+    EXPECT_TRUE(query(key, zSql, rows, columnTypes, columnNames, err));
+    ASSERT_EQ(rows.size(), 1);
+    EXPECT_THAT(rows[0], ElementsAre("1", to_string(eventElapsedTimeNs + 20), _, "222"));
+}
+
+TEST_F(DbUtilsTest, TestInsertSchemaMismatch) {
+    int64_t eventElapsedTimeNs = 10000000000;
+
+    AStatsEvent* statsEvent1 = makeAStatsEvent(tagId, eventElapsedTimeNs + 10);
+    AStatsEvent_writeString(statsEvent1, "111");
+    LogEvent logEvent1 = makeLogEvent(statsEvent1);
+
+    AStatsEvent* statsEvent2 = makeAStatsEvent(tagId, eventElapsedTimeNs + 20);
+    AStatsEvent_writeString(statsEvent2, "222");
+    AStatsEvent_writeInt32(statsEvent2, 23);
+    LogEvent logEvent2 = makeLogEvent(statsEvent2);
+
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent1));
+    string err;
+    EXPECT_TRUE(insert(key, metricId, {logEvent1}, err));
+    // None of the events are inserted.
+    EXPECT_FALSE(insert(key, metricId, {logEvent1, logEvent2}, err));
+
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    std::vector<std::vector<std::string>> rows;
+    string zSql = "SELECT * FROM metric_111 ORDER BY elapsedTimestampNs";
+    EXPECT_TRUE(query(key, zSql, rows, columnTypes, columnNames, err));
+    ASSERT_EQ(rows.size(), 1);
+    EXPECT_THAT(rows[0], ElementsAre("1", to_string(eventElapsedTimeNs + 10), _, "111"));
+}
+
+TEST_F(DbUtilsTest, TestInsertAsync) {
+    int64_t eventElapsedTimeNs = 10000000000;
+    const int64_t metricId2 = 222;
+
+    AStatsEvent* statsEvent1 = makeAStatsEvent(tagId, eventElapsedTimeNs + 10);
+    AStatsEvent_writeString(statsEvent1, "111");
+    LogEvent logEvent1 = makeLogEvent(statsEvent1);
+
+    AStatsEvent* statsEvent2 = makeAStatsEvent(tagId, eventElapsedTimeNs + 20);
+    AStatsEvent_writeString(statsEvent2, "222");
+    LogEvent logEvent2 = makeLogEvent(statsEvent2);
+
+    AStatsEvent* statsEvent3 = makeAStatsEvent(tagId, eventElapsedTimeNs + 30);
+    AStatsEvent_writeInt32(statsEvent3, 23);
+    AStatsEvent_writeInt32(statsEvent3, 24);
+    LogEvent logEvent3 = makeLogEvent(statsEvent3);
+
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent1));
+    EXPECT_TRUE(createTableIfNeeded(key, metricId2, logEvent1));
+    insertAsync(key, metricId, {logEvent1}, eventElapsedTimeNs);
+    // Rolled back on its own, the other inserts are still written.
+    insertAsync(key, metricId2, {logEvent1, logEvent3}, eventElapsedTimeNs);
+    insertAsync(key, metricId, {logEvent2}, eventElapsedTimeNs);
+
+    // Waits for the queued inserts.
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    std::vector<std::vector<std::string>> rows;
+    string err;
+    string zSql = "SELECT * FROM metric_111 ORDER BY elapsedTimestampNs";
+    EXPECT_TRUE(query(key, zSql, rows, columnTypes, columnNames, err));
+    ASSERT_EQ(rows.size(), 2);
+    EXPECT_THAT(rows[0], ElementsAre("1", to_string(eventElapsedTimeNs + 10), _, "111"));
+    EXPECT_THAT(rows[1], ElementsAre("1", to_string(eventElapsedTimeNs + 20), _, "222"));
+
+    rows.clear();
+    zSql = "SELECT * FROM metric_222";
+    EXPECT_TRUE(query(key, zSql, rows, columnTypes, columnNames, err));
+    EXPECT_EQ(rows.size(), 0);
+}
+
+TEST_F(DbUtilsTest, TestQueryPages) {
+    int64_t eventElapsedTimeNs = 10000000000;
+
+    vector<LogEvent> logEvents;
+    for (int i = 0; i < 3; ++i) {
+        AStatsEvent* statsEvent = makeAStatsEvent(tagId, eventElapsedTimeNs + i);
+        AStatsEvent_writeString(statsEvent, to_string(i).c_str());
+        logEvents.push_back(makeLogEvent(statsEvent));
+    }
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvents[0]));
+    string err;
+    EXPECT_TRUE(insert(key, metricId, logEvents, err));
+
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    vector<vector<string>> pages;
+    vector<bool> lastPages;
+    const auto onPage = [&](vector<string>& pageData, int32_t rowCount, bool isLastPage) {
+        EXPECT_EQ(rowCount, 1);
+        pages.push_back(std::move(pageData));
+        lastPages.push_back(isLastPage);
+        return true;
+    };
+    string zSql = "SELECT * FROM metric_111 ORDER BY elapsedTimestampNs";
+    // One row per page.
+    EXPECT_TRUE(query(key, zSql, /*maxPageBytes=*/1, onPage, columnTypes, columnNames, err));
+    EXPECT_THAT(columnNames,
+                ElementsAre("atomId", "elapsedTimestampNs", "wallTimestampNs", "field_1"));
+    ASSERT_EQ(pages.size(), 3);
+    EXPECT_THAT(pages[0], ElementsAre("1", to_string(eventElapsedTimeNs), _, "0"));
+    EXPECT_THAT(pages[2], ElementsAre("1", to_string(eventElapsedTimeNs + 2), _, "2"));
+    EXPECT_THAT(lastPages, ElementsAre(false, false, true));
+}
+
+TEST_F(DbUtilsTest, TestQueryPagesCancelled) {
+    AStatsEvent* statsEvent = makeAStatsEvent(tagId, /*eventElapsedTime=*/10000000000);
+    AStatsEvent_writeString(statsEvent, "111");
+    LogEvent logEvent = makeLogEvent(statsEvent);
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent));
+    string err;
+    EXPECT_TRUE(insert(key, metricId, {logEvent, logEvent}, err));
+
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    int pageCount = 0;
+    const auto onPage = [&](vector<string>&, int32_t, bool) {
+        pageCount++;
+        return false;
+    };
+    string zSql = "SELECT * FROM metric_111";
+    EXPECT_FALSE(query(key, zSql, /*maxPageBytes=*/1, onPage, columnTypes, columnNames, err));
+    EXPECT_EQ(pageCount, 1);
+    EXPECT_EQ(err, "Query cancelled");
+}
+
+TEST_F(DbUtilsTest, TestQueryPagesNoRows) {
+    AStatsEvent* statsEvent = makeAStatsEvent(tagId, /*eventElapsedTime=*/10000000000);
+    AStatsEvent_writeString(statsEvent, "111");
+    LogEvent logEvent = makeLogEvent(statsEvent);
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent));
+
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    int pageCount = 0;
+    const auto onPage = [&](vector<string>& pageData, int32_t rowCount, bool isLastPage) {
+        pageCount++;
+        EXPECT_TRUE(pageData.empty());
+        EXPECT_EQ(rowCount, 0);
+        EXPECT_TRUE(isLastPage);
+        return true;
+    };
+    string err;
+    string zSql = "SELECT * FROM metric_111";
+    EXPECT_TRUE(query(key, zSql, /*maxPageBytes=*/1, onPage, columnTypes, columnNames, err));
+    EXPECT_EQ(pageCount, 1);
+}
+
+TEST_F(DbUtilsTest, TestQueryDoesNotLockDb) {
+    AStatsEvent* statsEvent = makeAStatsEvent(tagId, /*eventElapsedTime=*/10000000000);
+    AStatsEvent_writeString(statsEvent, "111");
+    LogEvent logEvent = makeLogEvent(statsEvent);
+    EXPECT_TRUE(createTableIfNeeded(key, metricId, logEvent));
+    string err;
+    EXPECT_TRUE(insert(key, metricId, {logEvent}, err));
+
+    std::vector<int32_t> columnTypes;
+    std::vector<string> columnNames;
+    size_t nestedRowCount = 0;
+    const auto onPage = [&](vector<string>&, int32_t rowCount, bool) {
+        EXPECT_EQ(rowCount, 1);
+        // Inserts and queries while the query runs.
+        string insertErr;
+        EXPECT_TRUE(insert(key, metricId, {logEvent}, insertErr));
+        std::vector<int32_t> nestedColumnTypes;
+        std::vector<string> nestedColumnNames;
+        vector<vector<string>> rows;
+        string queryErr;
+        EXPECT_TRUE(query(key, "SELECT * FROM metric_111", rows, nestedColumnTypes,
+                          nestedColumnNames, queryErr));
+        nestedRowCount = rows.size();
+        return true;
+    };
+    EXPECT_TRUE(query(key, "SELECT * FROM metric_111", /*maxPageBytes=*/1000, onPage, columnTypes,
+                      columnNames, err));
+    EXPECT_EQ(nestedRowCount, 2u);
+}
+
 TEST_F(DbUtilsTest, TestEventCompatibilityEventMatchesTable) {
     AStatsEvent* statsEvent = makeAStatsEvent(tagId, /*eventElapsedTime=*/10000000000);
     AStatsEvent_writeString(statsEvent, "111");
@@ -0,0 +1,94 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/HistogramBins.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(HistogramBinsTest, TestExplicitBins) {
+    const std::optional<HistogramBins> bins = HistogramBins::create({1, 2, 5, 10});
+    ASSERT_TRUE(bins.has_value());
+    EXPECT_EQ(5u, bins->getBinCount());
+    EXPECT_EQ(0u, bins->getBinIndex(-1));
+    EXPECT_EQ(0u, bins->getBinIndex(0.99));
+    EXPECT_EQ(1u, bins->getBinIndex(1));
+    EXPECT_EQ(1u, bins->getBinIndex(1.5));
+    EXPECT_EQ(2u, bins->getBinIndex(2));
+    EXPECT_EQ(3u, bins->getBinIndex(9.99));
+    EXPECT_EQ(4u, bins->getBinIndex(10));
+    EXPECT_EQ(4u, bins->getBinIndex(1e9));
+    EXPECT_EQ(0u, bins->getBinIndex(NAN));
+}
+
+TEST(HistogramBinsTest, TestSingleBoundary) {
+    const std::optional<HistogramBins> bins = HistogramBins::create({5});
+    ASSERT_TRUE(bins.has_value());
+    EXPECT_EQ(2u, bins->getBinCount());
+    EXPECT_EQ(0u, bins->getBinIndex(4));
+    EXPECT_EQ(1u, bins->getBinIndex(5));
+}
+
+TEST(HistogramBinsTest, TestInvalidExplicitBins) {
+    EXPECT_FALSE(HistogramBins::create({}).has_value());
+    EXPECT_FALSE(HistogramBins::create({1, 1}).has_value());
+    EXPECT_FALSE(HistogramBins::create({2, 1}).has_value());
+    EXPECT_FALSE(HistogramBins::create({1, INFINITY}).has_value());
+    EXPECT_FALSE(
+            HistogramBins::create(std::vector<double>(HistogramBins::kMaxBoundaryCount + 1, 0))
+                    .has_value());
+}
+
+TEST(HistogramBinsTest, TestLinearBins) {
+    const std::optional<HistogramBins> bins = HistogramBins::createLinear(0, 100, 10);
+    ASSERT_TRUE(bins.has_value());
+    // 10 bins between the boundaries, plus the underflow and overflow bins.
+    EXPECT_EQ(12u, bins->getBinCount());
+    EXPECT_EQ(0u, bins->getBinIndex(-1));
+    EXPECT_EQ(1u, bins->getBinIndex(0));
+    EXPECT_EQ(6u, bins->getBinIndex(55));
+    EXPECT_EQ(11u, bins->getBinIndex(100));
+
+    EXPECT_FALSE(HistogramBins::createLinear(0, 100, 0).has_value());
+    EXPECT_FALSE(HistogramBins::createLinear(100, 0, 10).has_value());
+}
+
+TEST(HistogramBinsTest, TestExponentialBins) {
+    const std::optional<HistogramBins> bins = HistogramBins::createExponential(1, 1000, 3);
+    ASSERT_TRUE(bins.has_value());
+    const std::vector<double>& boundaries = bins->getBoundaries();
+    ASSERT_EQ(4u, boundaries.size());
+    EXPECT_DOUBLE_EQ(1, boundaries[0]);
+    EXPECT_DOUBLE_EQ(10, boundaries[1]);
+    EXPECT_DOUBLE_EQ(100, boundaries[2]);
+    EXPECT_DOUBLE_EQ(1000, boundaries[3]);
+    EXPECT_EQ(2u, bins->getBinIndex(50));
+
+    EXPECT_FALSE(HistogramBins::createExponential(0, 1000, 3).has_value());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,97 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/HyperLogLog.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+#include "hash.h"
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+
+uint64_t hashOf(const int64_t value) {
+    return WyHash64(reinterpret_cast<const char*>(&value), sizeof(value), 0x9e3779b97f4a7c15ull);
+}
+
+void addRange(HyperLogLog& sketch, const int64_t begin, const int64_t end) {
+    for (int64_t value = begin; value < end; value++) {
+        sketch.add(hashOf(value));
+    }
+}
+
+}  // anonymous namespace
+
+TEST(HyperLogLogTest, TestSmallCardinalitiesAreExact) {
+    HyperLogLog sketch;
+    EXPECT_EQ(0, sketch.estimate());
+    addRange(sketch, 0, 10);
+    addRange(sketch, 0, 10);
+    // Linear counting is exact unless two values hit the same register.
+    EXPECT_NEAR(10, sketch.estimate(), 1);
+}
+
+TEST(HyperLogLogTest, TestEstimateWithinError) {
+    HyperLogLog sketch;
+    addRange(sketch, 0, 100000);
+    // Four standard errors of a sketch with 1024 registers.
+    EXPECT_LT(std::abs(sketch.estimate() - 100000), 100000 * 0.13);
+    EXPECT_EQ(1024u, sketch.getRegisterCount());
+}
+
+TEST(HyperLogLogTest, TestMerge) {
+    HyperLogLog first;
+    HyperLogLog second;
+    HyperLogLog both;
+    addRange(first, 0, 30000);
+    addRange(second, 20000, 50000);
+    addRange(both, 0, 50000);
+    ASSERT_TRUE(first.merge(second));
+    EXPECT_EQ(both.estimate(), first.estimate());
+    EXPECT_EQ(both.serialize(), first.serialize());
+
+    HyperLogLog otherPrecision(HyperLogLog::kDefaultPrecision + 1);
+    EXPECT_FALSE(first.merge(otherPrecision));
+}
+
+TEST(HyperLogLogTest, TestSerialize) {
+    HyperLogLog sketch(HyperLogLog::kMinPrecision);
+    addRange(sketch, 0, 1000);
+    const std::vector<uint8_t> data = sketch.serialize();
+    ASSERT_EQ(17u, data.size());
+
+    std::unique_ptr<HyperLogLog> parsed = HyperLogLog::deserialize(data.data(), data.size());
+    ASSERT_NE(nullptr, parsed);
+    EXPECT_EQ(HyperLogLog::kMinPrecision, parsed->getPrecision());
+    EXPECT_EQ(sketch.estimate(), parsed->estimate());
+
+    EXPECT_EQ(nullptr, HyperLogLog::deserialize(data.data(), data.size() - 1));
+    std::vector<uint8_t> badRank = data;
+    badRank[1] = 64;
+    EXPECT_EQ(nullptr, HyperLogLog::deserialize(badRank.data(), badRank.size()));
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
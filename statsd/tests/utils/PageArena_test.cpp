@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "utils/PageArena.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#ifdef __ANDROID__
+
+using std::vector;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+vector<uint8_t> toVector(std::span<const uint8_t> bytes) {
+    return vector<uint8_t>(bytes.begin(), bytes.end());
+}
+}  // namespace
+
+TEST(PageArenaTest, TestFillsPagesInOrder) {
+    PageArena arena(/*pageSize=*/8);
+    EXPECT_EQ(0u, arena.pageCount());
+
+    const vector<uint8_t> first = {1, 2, 3, 4, 5};
+    const vector<uint8_t> second = {6, 7, 8};
+    const vector<uint8_t> third = {9};
+    std::span<const uint8_t> firstCopy = arena.copy(first);
+    std::span<const uint8_t> secondCopy = arena.copy(second);
+    EXPECT_EQ(1u, arena.pageCount());
+    EXPECT_EQ(firstCopy.data() + first.size(), secondCopy.data());
+
+    // The first page is full.
+    std::span<const uint8_t> thirdCopy = arena.copy(third);
+    EXPECT_EQ(2u, arena.pageCount());
+    EXPECT_EQ(16u, arena.capacityBytes());
+
+    EXPECT_EQ(first, toVector(firstCopy));
+    EXPECT_EQ(second, toVector(secondCopy));
+    EXPECT_EQ(third, toVector(thirdCopy));
+}
+
+TEST(PageArenaTest, TestOversizedCopy) {
+    PageArena arena(/*pageSize=*/8);
+    const vector<uint8_t> small = {1, 2};
+    const vector<uint8_t> large = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    std::span<const uint8_t> smallCopy = arena.copy(small);
+    std::span<const uint8_t> largeCopy = arena.copy(large);
+    EXPECT_EQ(2u, arena.pageCount());
+    EXPECT_EQ(18u, arena.capacityBytes());
+
+    // The page of the small copy still has room.
+    std::span<const uint8_t> nextCopy = arena.copy(small);
+    EXPECT_EQ(2u, arena.pageCount());
+    EXPECT_EQ(smallCopy.data() + small.size(), nextCopy.data());
+
+    EXPECT_EQ(small, toVector(smallCopy));
+    EXPECT_EQ(large, toVector(largeCopy));
+    EXPECT_EQ(small, toVector(nextCopy));
+}
+
+TEST(PageArenaTest, TestClear) {
+    PageArena arena(/*pageSize=*/8);
+    arena.copy(vector<uint8_t>{1, 2, 3});
+    arena.clear();
+    EXPECT_EQ(0u, arena.pageCount());
+    EXPECT_EQ(0u, arena.capacityBytes());
+
+    const vector<uint8_t> bytes = {4, 5};
+    EXPECT_EQ(bytes, toVector(arena.copy(bytes)));
+    EXPECT_EQ(1u, arena.pageCount());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
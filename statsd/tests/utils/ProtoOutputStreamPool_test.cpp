@@ -0,0 +1,109 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/ProtoOutputStreamPool.h"
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#ifdef __ANDROID__
+
+namespace android {
+namespace os {
+namespace statsd {
+
+using android::util::FIELD_TYPE_STRING;
+using android::util::ProtoOutputStream;
+using std::string;
+using std::vector;
+
+namespace {
+
+const uint64_t kFieldId = FIELD_TYPE_STRING | 1;
+
+bool neverUnderMemoryPressure() {
+    return false;
+}
+
+}  // anonymous namespace
+
+TEST(ProtoOutputStreamPoolTest, TestStreamIsReused) {
+    ProtoOutputStreamPool pool(neverUnderMemoryPressure);
+    ProtoOutputStream* firstStream;
+    {
+        ProtoOutputStreamPool::Stream stream = pool.acquire();
+        stream->write(kFieldId, string(1000, 'a'));
+        firstStream = stream.get();
+    }
+    EXPECT_GT(pool.getRetainedBytes(), 1000u);
+
+    ProtoOutputStreamPool::Stream stream = pool.acquire();
+    EXPECT_EQ(firstStream, stream.get());
+    // The stream is cleared but keeps its buffer.
+    EXPECT_EQ(0u, stream->size());
+    EXPECT_EQ(0u, pool.getRetainedBytes());
+}
+
+TEST(ProtoOutputStreamPoolTest, TestLargestStreamsAreKept) {
+    ProtoOutputStreamPool pool(neverUnderMemoryPressure);
+    {
+        vector<ProtoOutputStreamPool::Stream> streams;
+        for (size_t i = 0; i <= ProtoOutputStreamPool::kMaxIdleStreams; i++) {
+            streams.push_back(pool.acquire());
+            streams.back()->write(kFieldId, string((i + 1) * 100, 'a'));
+        }
+    }
+    ASSERT_EQ(ProtoOutputStreamPool::kMaxIdleStreams, pool.mIdleStreams.size());
+    // The smallest stream was freed, and the largest is handed out first.
+    EXPECT_GT(pool.mIdleStreams.front().capacityBytes, 200u);
+    const size_t largestCapacity = pool.mIdleStreams.back().capacityBytes;
+    ProtoOutputStreamPool::Stream stream = pool.acquire();
+    EXPECT_GT(largestCapacity, (ProtoOutputStreamPool::kMaxIdleStreams + 1) * 100);
+    EXPECT_EQ(ProtoOutputStreamPool::kMaxIdleStreams - 1, pool.mIdleStreams.size());
+}
+
+TEST(ProtoOutputStreamPoolTest, TestOversizedStreamIsFreed) {
+    ProtoOutputStreamPool pool(neverUnderMemoryPressure);
+    {
+        ProtoOutputStreamPool::Stream stream = pool.acquire();
+        stream->write(kFieldId, string(ProtoOutputStreamPool::kMaxRetainedStreamBytes, 'a'));
+    }
+    EXPECT_EQ(0u, pool.getRetainedBytes());
+}
+
+TEST(ProtoOutputStreamPoolTest, TestTrimUnderMemoryPressure) {
+    bool underMemoryPressure = false;
+    ProtoOutputStreamPool pool([&underMemoryPressure] { return underMemoryPressure; });
+    std::optional<ProtoOutputStreamPool::Stream> first = pool.acquire();
+    std::optional<ProtoOutputStreamPool::Stream> second = pool.acquire();
+    (*first)->write(kFieldId, string(100, 'a'));
+    (*second)->write(kFieldId, string(100, 'a'));
+    first.reset();
+    EXPECT_GT(pool.getRetainedBytes(), 0u);
+
+    // Giving back a stream under memory pressure frees it and the idle streams.
+    underMemoryPressure = true;
+    second.reset();
+    EXPECT_EQ(0u, pool.getRetainedBytes());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "utils/RingBuffer.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#ifdef __ANDROID__
+
+using std::vector;
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+template <class T, size_t N>
+vector<T> toVector(const RingBuffer<T, N>& buffer) {
+    return vector<T>(buffer.begin(), buffer.end());
+}
+}  // namespace
+
+TEST(RingBufferTest, TestKeepsPushOrderUntilFull) {
+    RingBuffer<int, 3> buffer;
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_THAT(toVector(buffer), IsEmpty());
+
+    buffer.push_back(1);
+    buffer.push_back(2);
+    EXPECT_EQ(2u, buffer.size());
+    EXPECT_FALSE(buffer.full());
+    EXPECT_EQ(1, buffer.front());
+    EXPECT_EQ(2, buffer.back());
+    EXPECT_THAT(toVector(buffer), ElementsAre(1, 2));
+}
+
+TEST(RingBufferTest, TestOverwritesOldestWhenFull) {
+    RingBuffer<int, 3> buffer;
+    for (int i = 1; i <= 7; i++) {
+        buffer.push_back(i);
+    }
+    EXPECT_TRUE(buffer.full());
+    EXPECT_EQ(3u, buffer.size());
+    EXPECT_EQ(5, buffer.front());
+    EXPECT_EQ(7, buffer.back());
+    EXPECT_EQ(6, buffer[1]);
+    EXPECT_THAT(toVector(buffer), ElementsAre(5, 6, 7));
+}
+
+TEST(RingBufferTest, TestClear) {
+    RingBuffer<std::pair<int, int>, 2> buffer;
+    buffer.emplace_back(1, 2);
+    buffer.emplace_back(3, 4);
+    buffer.emplace_back(5, 6);
+    buffer.clear();
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_EQ(buffer.begin(), buffer.end());
+
+    buffer.emplace_back(7, 8);
+    EXPECT_EQ(std::make_pair(7, 8), buffer.front());
+    EXPECT_EQ(1u, buffer.size());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
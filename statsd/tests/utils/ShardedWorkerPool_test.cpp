@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "utils/ShardedWorkerPool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifdef __ANDROID__
+
+using std::vector;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(ShardedWorkerPoolTest, TestSingleShardRunsOnCallingThread) {
+    ShardedWorkerPool pool(1);
+    ASSERT_EQ(1u, pool.getNumShards());
+
+    std::thread::id taskThread;
+    pool.runOnAllShards([&taskThread](size_t shard) {
+        EXPECT_EQ(0u, shard);
+        taskThread = std::this_thread::get_id();
+    });
+    EXPECT_EQ(std::this_thread::get_id(), taskThread);
+}
+
+TEST(ShardedWorkerPoolTest, TestRunsEveryShardOnItsOwnThread) {
+    const size_t numShards = 4;
+    ShardedWorkerPool pool(numShards);
+    ASSERT_EQ(numShards, pool.getNumShards());
+
+    vector<std::thread::id> shardThreads(numShards);
+    vector<int> shardRuns(numShards, 0);
+    for (int i = 0; i < 100; i++) {
+        pool.runOnAllShards([&](size_t shard) {
+            const std::thread::id threadId = std::this_thread::get_id();
+            if (shardRuns[shard] == 0) {
+                shardThreads[shard] = threadId;
+            }
+            // A shard is always run by the same thread.
+            EXPECT_EQ(shardThreads[shard], threadId);
+            shardRuns[shard]++;
+        });
+        // Every shard is done once runOnAllShards returns.
+        for (size_t shard = 0; shard < numShards; shard++) {
+            EXPECT_EQ(i + 1, shardRuns[shard]);
+        }
+    }
+
+    EXPECT_EQ(std::this_thread::get_id(), shardThreads[0]);
+    for (size_t shard = 1; shard < numShards; shard++) {
+        EXPECT_NE(std::this_thread::get_id(), shardThreads[shard]);
+        for (size_t other = shard + 1; other < numShards; other++) {
+            EXPECT_NE(shardThreads[shard], shardThreads[other]);
+        }
+    }
+}
+
+TEST(ShardedWorkerPoolTest, TestShardsRunConcurrently) {
+    const size_t numShards = 3;
+    ShardedWorkerPool pool(numShards);
+
+    // Every shard waits for all the others to start, which only completes if they run in parallel.
+    std::atomic<size_t> startedShards = 0;
+    pool.runOnAllShards([&startedShards](size_t) {
+        startedShards++;
+        while (startedShards < numShards) {
+            std::this_thread::yield();
+        }
+    });
+    EXPECT_EQ(numShards, startedShards);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
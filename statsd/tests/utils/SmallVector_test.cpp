@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "utils/SmallVector.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <numeric>
+#include <span>
+#include <string>
+
+#ifdef __ANDROID__
+
+using std::string;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+namespace {
+int sumOf(std::span<const int> values) {
+    return std::accumulate(values.begin(), values.end(), 0);
+}
+}  // namespace
+
+TEST(SmallVectorTest, TestStaysInlineUpToN) {
+    SmallVector<int, 3> values;
+    EXPECT_TRUE(values.empty());
+    values.push_back(1);
+    values.push_back(2);
+    values.push_back(3);
+    EXPECT_TRUE(values.isInline());
+    EXPECT_EQ(3u, values.capacity());
+    EXPECT_EQ(6, sumOf(values));
+
+    values.push_back(4);
+    EXPECT_FALSE(values.isInline());
+    ASSERT_EQ(4u, values.size());
+    EXPECT_EQ(1, values.front());
+    EXPECT_EQ(4, values.back());
+    EXPECT_EQ(10, sumOf(values));
+
+    values.pop_back();
+    values.clear();
+    EXPECT_TRUE(values.empty());
+}
+
+TEST(SmallVectorTest, TestPushBackOwnElementWhileGrowing) {
+    SmallVector<string, 2> values;
+    values.push_back("first");
+    values.push_back("second");
+    values.push_back(values[0]);
+    ASSERT_EQ(3u, values.size());
+    EXPECT_EQ("first", values[2]);
+    EXPECT_EQ("second", values[1]);
+}
+
+TEST(SmallVectorTest, TestCopyAndMove) {
+    SmallVector<string, 2> inlineValues;
+    inlineValues.push_back("a");
+    SmallVector<string, 2> heapValues;
+    heapValues.push_back("a");
+    heapValues.push_back("b");
+    heapValues.push_back("c");
+
+    SmallVector<string, 2> copy(heapValues);
+    EXPECT_EQ(heapValues, copy);
+    EXPECT_NE(inlineValues, copy);
+    copy = inlineValues;
+    EXPECT_EQ(inlineValues, copy);
+
+    const string* heapData = heapValues.data();
+    SmallVector<string, 2> moved(std::move(heapValues));
+    EXPECT_EQ(heapData, moved.data());
+    EXPECT_TRUE(heapValues.empty());
+    EXPECT_TRUE(heapValues.isInline());
+
+    moved = std::move(inlineValues);
+    EXPECT_TRUE(moved.isInline());
+    ASSERT_EQ(1u, moved.size());
+    EXPECT_EQ("a", moved[0]);
+    EXPECT_TRUE(inlineValues.empty());
+}
+
+TEST(SmallVectorTest, TestDestroysElements) {
+    std::shared_ptr<int> tracked = std::make_shared<int>(0);
+    {
+        SmallVector<std::shared_ptr<int>, 2> values;
+        for (int i = 0; i < 5; i++) {
+            values.push_back(tracked);
+        }
+        EXPECT_EQ(6, tracked.use_count());
+        values.pop_back();
+        EXPECT_EQ(5, tracked.use_count());
+    }
+    EXPECT_EQ(1, tracked.use_count());
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "utils/ThreadConfig.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <sys/resource.h>
+
+#include <thread>
+
+#ifdef __ANDROID__
+
+using std::string;
+
+namespace android {
+namespace os {
+namespace statsd {
+
+TEST(ThreadConfigTest, TestParseThreadConfig) {
+    ThreadConfig config;
+    ASSERT_TRUE(parseThreadConfig("fifo", "10", "0-1,3", &config));
+    EXPECT_EQ(SCHED_FIFO, config.policy);
+    EXPECT_EQ(10, config.priority);
+    ASSERT_TRUE(config.cpus.has_value());
+    EXPECT_EQ(3, CPU_COUNT(&*config.cpus));
+    EXPECT_TRUE(CPU_ISSET(3, &*config.cpus));
+    EXPECT_FALSE(CPU_ISSET(2, &*config.cpus));
+
+    ThreadConfig niceConfig;
+    ASSERT_TRUE(parseThreadConfig("", "-5", "", &niceConfig));
+    EXPECT_FALSE(niceConfig.policy.has_value());
+    EXPECT_EQ(-5, niceConfig.priority);
+    EXPECT_FALSE(niceConfig.cpus.has_value());
+}
+
+TEST(ThreadConfigTest, TestParseInvalidThreadConfig) {
+    ThreadConfig config;
+    EXPECT_FALSE(parseThreadConfig("deadline", "", "", &config));
+    // Real time priorities start at 1.
+    EXPECT_FALSE(parseThreadConfig("rr", "0", "", &config));
+    EXPECT_FALSE(parseThreadConfig("other", "20", "", &config));
+    EXPECT_FALSE(parseThreadConfig("", "", "3-1", &config));
+    EXPECT_FALSE(parseThreadConfig("", "", "1-2-3", &config));
+    EXPECT_FALSE(parseThreadConfig("", "", "big", &config));
+}
+
+TEST(ThreadConfigTest, TestConfigureStatsdThread) {
+    string dump;
+    std::thread thread([&dump] {
+        configureStatsdThread("statsd.cfgtest", /*defaultNice=*/5);
+        EXPECT_EQ(5, getpriority(PRIO_PROCESS, 0));
+
+        TemporaryFile out;
+        dumpStatsdThreads(out.fd);
+        ASSERT_TRUE(android::base::ReadFileToString(out.path, &dump));
+    });
+    thread.join();
+    EXPECT_NE(dump.find("statsd.cfgtest"), string::npos);
+
+    // The thread is no longer listed once it exited.
+    TemporaryFile out;
+    dumpStatsdThreads(out.fd);
+    string dumpAfterExit;
+    ASSERT_TRUE(android::base::ReadFileToString(out.path, &dumpAfterExit));
+    EXPECT_EQ(dumpAfterExit.find("statsd.cfgtest"), string::npos);
+}
+
+}  // namespace statsd
+}  // namespace os
+}  // namespace android
+#else
+GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif